@@ -0,0 +1,394 @@
+/*
+ * Astra Module: Bench
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the core functions. Not a part of the default build:
+ *      ./configure.sh --with-modules=*:bench
+ *      ./astra bench/bench.lua [file.ts]
+ * The stream benchmarks are in bench_source.c, the cases are in bench.lua.
+ *
+ * Each function returns the result table, see bench_result().
+ *
+ * Methods:
+ *      bench.crc32b(size, count)
+ *                  - checksum of the buffer with size bytes, count times
+ *      bench.thread_buffer(chunk, count, zerocopy)
+ *                  - write and read count chunks through the thread buffer.
+ *                    zerocopy - reserve/commit and peek/consume instead of
+ *                    write and read
+ *      bench.ring_copy(chunk, count, stream, ws)
+ *                  - copy count chunks to the 256MB ring (more than L3) and
+ *                    read the working set of ws kilobytes after each 16 chunks.
+ *                    stream - asc_ring_copy() instead of memcpy(). ws_ns in
+ *                    the result is the average time of the working set read,
+ *                    grows with the cache misses
+ *      bench.psi_mux(items, count, versions)
+ *                  - assemble the PMT section with items streams from the
+ *                    packets, count times. versions - number of the section
+ *                    versions in rotation, more than the size of checksum
+ *                    cache to verify each section
+ *      bench.csa_engine(name)
+ *                  - return true if the DVB-CSA engine is built in
+ *      bench.cpu_time([pid])
+ *                  - return CPU time (user and system) of the process in seconds.
+ *                    by default of the current process. nil if not available
+ */
+
+#include "bench.h"
+#include "../modules/softcam/csa_engine.h"
+
+#define MSG(_msg) "[bench] " _msg
+
+void bench_result(lua_State *L, bench_clock_t *clock, uint64_t bytes)
+{
+    uint64_t time = asc_utime() - clock->start;
+    if(time == 0)
+        time = 1;
+    const uint64_t ops = (clock->ops > 0) ? clock->ops : 1;
+
+    lua_newtable(L);
+
+    lua_pushnumber(L, (lua_Number)ops);
+    lua_setfield(L, -2, "ops");
+    lua_pushnumber(L, (lua_Number)time);
+    lua_setfield(L, -2, "time");
+    lua_pushnumber(L, (lua_Number)time * 1000.0 / ops);
+    lua_setfield(L, -2, "ns_op");
+    lua_pushnumber(L, (clock->chunk_max > 0)
+                      ? (lua_Number)clock->chunk_max * 1000.0 / BENCH_CHUNK
+                      : (lua_Number)time * 1000.0 / ops);
+    lua_setfield(L, -2, "ns_op_max");
+    lua_pushnumber(L, (lua_Number)ops * 1000000.0 / time);
+    lua_setfield(L, -2, "ops_sec");
+
+    if(bytes > 0)
+    {
+        lua_pushnumber(L, (lua_Number)bytes * 8.0 / time);
+        lua_setfield(L, -2, "mbps");
+    }
+}
+
+static int bench_crc32b(lua_State *L)
+{
+    const int size = luaL_checkinteger(L, 1);
+    const int count = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, size > 0 && count > 0, 1, MSG("size and count should be positive"));
+
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    for(int i = 0; i < size; ++i)
+        buffer[i] = (uint8_t)rand();
+
+    uint32_t crc = 0;
+
+    bench_clock_t clock;
+    bench_clock_start(&clock);
+    for(int i = 0; i < count; ++i)
+    {
+        /* depends on the previous result, the calls are not merged */
+        buffer[0] = (uint8_t)crc;
+        crc = crc32b(buffer, size);
+        bench_clock_tick(&clock);
+    }
+    bench_result(L, &clock, (uint64_t)size * count);
+
+    free(buffer);
+    return 1;
+}
+
+static int bench_thread_buffer(lua_State *L)
+{
+    const int chunk = luaL_checkinteger(L, 1);
+    const int count = luaL_checkinteger(L, 2);
+    const bool is_zerocopy = lua_toboolean(L, 3);
+    luaL_argcheck(L, chunk > 0 && count > 0, 1, MSG("chunk and count should be positive"));
+
+    /* few chunks in the buffer, like the reader is behind the writer */
+    asc_thread_buffer_t *buffer = asc_thread_buffer_init(chunk * 16);
+    uint8_t *data = (uint8_t *)calloc(1, chunk);
+
+    bench_clock_t clock;
+    bench_clock_start(&clock);
+    for(int i = 0; i < count; ++i)
+    {
+        if(is_zerocopy)
+        {
+            /* the chunk may be split on the end of the buffer */
+            size_t skip = 0;
+            while(skip < (size_t)chunk)
+            {
+                const size_t want = chunk - skip;
+                size_t size = want;
+                uint8_t *ptr = asc_thread_buffer_reserve(buffer, &size);
+                if(size == 0)
+                {
+                    asc_log_warning(MSG("thread_buffer: reserve failed"));
+                    break;
+                }
+                /* reserve returns all contiguous free space */
+                if(size > want)
+                    size = want;
+                memcpy(ptr, &data[skip], size);
+                asc_thread_buffer_commit(buffer, size);
+                skip += size;
+            }
+
+            if((i & 0x07) == 0x07)
+            {
+                /* not less than one byte, otherwise the head is not reloaded */
+                size_t size = 1;
+                while(asc_thread_buffer_peek(buffer, &size) && size > 0)
+                {
+                    if(!asc_thread_buffer_consume(buffer, size))
+                        break;
+                    size = 1;
+                }
+            }
+        }
+        else
+        {
+            if(asc_thread_buffer_write(buffer, data, chunk) != chunk)
+                asc_log_warning(MSG("thread_buffer: write failed"));
+
+            if((i & 0x07) == 0x07)
+            {
+                for(int j = 0; j < 8; ++j)
+                {
+                    if(asc_thread_buffer_read(buffer, data, chunk) != chunk)
+                        break;
+                }
+            }
+        }
+        bench_clock_tick(&clock);
+    }
+    bench_result(L, &clock, (uint64_t)chunk * count);
+
+    free(data);
+    asc_thread_buffer_destroy(buffer);
+    return 1;
+}
+
+#define BENCH_RING_SIZE (256 * 1024 * 1024)
+
+static int bench_ring_copy(lua_State *L)
+{
+    const int chunk = luaL_checkinteger(L, 1);
+    const int count = luaL_checkinteger(L, 2);
+    const bool is_stream = lua_toboolean(L, 3);
+    const size_t ws_size = (size_t)luaL_optinteger(L, 4, 256) * 1024;
+    luaL_argcheck(L, chunk > 0 && chunk <= BENCH_RING_SIZE && count > 0, 1
+                  , MSG("chunk and count should be positive"));
+    luaL_argcheck(L, ws_size > 0, 4, MSG("ws should be positive"));
+
+    uint8_t *ring = (uint8_t *)asc_ring_alloc(BENCH_RING_SIZE, -1);
+    memset(ring, 0, BENCH_RING_SIZE);
+    uint8_t *data = (uint8_t *)malloc(chunk);
+    for(int i = 0; i < chunk; ++i)
+        data[i] = (uint8_t)rand();
+    uint64_t *ws = (uint64_t *)calloc(1, ws_size);
+
+    size_t skip = 0;
+    uint64_t sum = 0;
+    uint64_t ws_time = 0;
+    uint64_t ws_count = 0;
+
+    bench_clock_t clock;
+    bench_clock_start(&clock);
+    for(int i = 0; i < count; ++i)
+    {
+        if(skip + chunk > BENCH_RING_SIZE)
+            skip = 0;
+        if(is_stream)
+            asc_ring_copy(&ring[skip], data, chunk);
+        else
+            memcpy(&ring[skip], data, chunk);
+        skip += chunk;
+
+        if((i & 0x0F) == 0x0F)
+        {
+            /* the working set of the other modules between the writes */
+            const uint64_t start = asc_utime();
+            for(size_t j = 0; j < ws_size / sizeof(uint64_t); j += 8)
+                sum += ws[j];
+            ws_time += asc_utime() - start;
+            ++ws_count;
+        }
+        bench_clock_tick(&clock);
+    }
+    bench_result(L, &clock, (uint64_t)chunk * count);
+
+    lua_pushnumber(L, (ws_count > 0) ? (lua_Number)ws_time * 1000.0 / ws_count : 0);
+    lua_setfield(L, -2, "ws_ns");
+    /* keeps the reads */
+    lua_pushnumber(L, (lua_Number)(sum & 1));
+    lua_setfield(L, -2, "ws_sum");
+
+    free(ws);
+    free(data);
+    asc_ring_free(ring, BENCH_RING_SIZE);
+    return 1;
+}
+
+typedef struct
+{
+    uint8_t *packets;
+    size_t size;
+    size_t count;
+} bench_psi_packets_t;
+
+static void on_psi_packet(void *arg, const uint8_t *ts)
+{
+    bench_psi_packets_t *p = (bench_psi_packets_t *)arg;
+    if(p->count == p->size)
+        return;
+    memcpy(&p->packets[p->count * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++p->count;
+}
+
+static void on_psi_section(void *arg, mpegts_psi_t *psi)
+{
+    __uarg(psi);
+    ++(*(uint64_t *)arg);
+}
+
+static int bench_psi_mux(lua_State *L)
+{
+    const int items = luaL_checkinteger(L, 1);
+    const int count = luaL_checkinteger(L, 2);
+    int versions = luaL_optinteger(L, 3, 1);
+    luaL_argcheck(L, items > 0 && items < 500, 1, MSG("items should be in range 1..499"));
+    luaL_argcheck(L, count > 0, 2, MSG("count should be positive"));
+    if(versions < 1)
+        versions = 1;
+    else if(versions > 32)
+        versions = 32;
+
+    mpegts_psi_t *psi = mpegts_psi_init(MPEGTS_PACKET_PMT, 0x100);
+
+    /* packets of all versions one after another */
+    const size_t packets_max = ((12 + items * 5 + CRC32_SIZE) / TS_BODY_SIZE + 1) * versions;
+    bench_psi_packets_t p =
+    {
+        .packets = (uint8_t *)malloc(packets_max * TS_PACKET_SIZE),
+        .size = packets_max,
+        .count = 0,
+    };
+
+    for(int v = 0; v < versions; ++v)
+    {
+        PMT_INIT(psi, 1, v, 0x101, NULL, 0);
+        for(int i = 0; i < items; ++i)
+            PMT_ITEMS_APPEND(psi, 0x1B, 0x101 + i, NULL, 0);
+        PSI_SET_CRC32(psi);
+        mpegts_psi_demux(psi, on_psi_packet, &p);
+    }
+    mpegts_psi_destroy(psi);
+
+    psi = mpegts_psi_init(MPEGTS_PACKET_PMT, 0x100);
+
+    const size_t section_packets = p.count / versions;
+    uint64_t sections = 0;
+    uint8_t cc = 0;
+
+    bench_clock_t clock;
+    bench_clock_start(&clock);
+    for(int i = 0; i < count; ++i)
+    {
+        uint8_t *section = &p.packets[(i % versions) * section_packets * TS_PACKET_SIZE];
+        for(size_t j = 0; j < section_packets; ++j)
+        {
+            uint8_t *ts = &section[j * TS_PACKET_SIZE];
+            TS_SET_CC(ts, cc);
+            cc = (cc + 1) & 0x0F;
+            mpegts_psi_mux(psi, ts, on_psi_section, &sections);
+        }
+        bench_clock_tick(&clock);
+    }
+    bench_result(L, &clock, (uint64_t)count * section_packets * TS_PACKET_SIZE);
+
+    mpegts_psi_destroy(psi);
+    free(p.packets);
+
+    if(sections != (uint64_t)count)
+        asc_log_warning(MSG("psi_mux: %"PRIu64" sections of %d"), sections, count);
+    return 1;
+}
+
+static int bench_csa_engine(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    lua_pushboolean(L, csa_engine_get(name) != NULL);
+    return 1;
+}
+
+static int bench_cpu_time(lua_State *L)
+{
+    const int pid = luaL_optinteger(L, 1, 0);
+
+#ifdef __linux
+    char path[64];
+    if(pid > 0)
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    else
+        snprintf(path, sizeof(path), "/proc/self/stat");
+
+    FILE *fp = fopen(path, "r");
+    if(!fp)
+        return 0;
+
+    char buffer[1024];
+    const size_t size = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    fclose(fp);
+    buffer[size] = '\0';
+
+    /* fields after the process name, it may contain spaces */
+    const char *ptr = strrchr(buffer, ')');
+    unsigned long utime = 0, stime = 0;
+    if(!ptr || sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu"
+                      , &utime, &stime) != 2)
+    {
+        return 0;
+    }
+
+    lua_pushnumber(L, (lua_Number)(utime + stime) / sysconf(_SC_CLK_TCK));
+    return 1;
+#else
+    __uarg(pid);
+    return 0;
+#endif
+}
+
+LUA_API int luaopen_bench(lua_State *L)
+{
+    static const luaL_Reg api[] =
+    {
+        { "crc32b", bench_crc32b },
+        { "thread_buffer", bench_thread_buffer },
+        { "ring_copy", bench_ring_copy },
+        { "psi_mux", bench_psi_mux },
+        { "csa_engine", bench_csa_engine },
+        { "cpu_time", bench_cpu_time },
+        { NULL, NULL }
+    };
+
+    luaL_newlib(L, api);
+    lua_setglobal(L, "bench");
+
+    return 0;
+}
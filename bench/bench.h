@@ -0,0 +1,78 @@
+/*
+ * Astra Module: Bench
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_ 1
+
+#include <astra.h>
+
+/*
+ * Probe packet of the paced bench_source, checked by bench_sink:
+ *      magic, send time (asc_utime, 64 bit), sequence number (32 bit)
+ * Both ends should use the same clock to measure the latency.
+ */
+#define BENCH_PROBE_PID 0x1FFE
+#define BENCH_PROBE_MAGIC "ASTRA-BENCH"
+#define BENCH_PROBE_INTERVAL (10 * 1000)
+
+/* operations are timed in groups, the clock is slower than a single operation */
+#define BENCH_CHUNK 64
+
+typedef struct
+{
+    uint64_t start;
+    uint64_t chunk_start;
+    uint64_t chunk_max;
+    uint64_t ops;
+    uint32_t chunk_ops;
+} bench_clock_t;
+
+static inline void bench_clock_start(bench_clock_t *clock)
+{
+    memset(clock, 0, sizeof(bench_clock_t));
+    clock->start = asc_utime();
+    clock->chunk_start = clock->start;
+}
+
+static inline void bench_clock_tick(bench_clock_t *clock)
+{
+    ++clock->ops;
+    if(++clock->chunk_ops < BENCH_CHUNK)
+        return;
+
+    const uint64_t now = asc_utime();
+    if(now - clock->chunk_start > clock->chunk_max)
+        clock->chunk_max = now - clock->chunk_start;
+    clock->chunk_start = now;
+    clock->chunk_ops = 0;
+}
+
+/*
+ * Pushes the result table:
+ *      ops         - number of operations
+ *      time        - total time in microseconds
+ *      ns_op       - average time of the operation in nanoseconds
+ *      ns_op_max   - average time of the operation in the slowest group
+ *      ops_sec     - operations per second
+ *      mbps        - throughput in Mbit/s, if bytes is not 0
+ */
+void bench_result(lua_State *L, bench_clock_t *clock, uint64_t bytes);
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,312 @@
+-- Astra Bench
+-- https://cesbo.com/astra
+--
+-- Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+--
+-- This program is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- This program is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+-- Usage: astra bench/bench.lua [OPTIONS] [FILE]
+--     FILE            - TS file for the stream benchmarks. by default generated stream
+--     --filter TEXT   - run only the cases with TEXT in the name
+--     --repeat N      - runs of each case. default: 5
+--     --scale N       - multiply the operations count. default: 1
+--     --log FILE      - write log messages to the file. stdout is for the report only
+--     --port N        - local port for the http_upstream benchmarks. default: 18080
+--
+-- Output is JSON: { version, file, cases = [ { name, ops, ns_op, ns_op_min,
+-- ns_op_max, ops_sec, mbps, ws_ns } ] }. ns_op and mbps are the median of the
+-- runs, ns_op_min is the best run, ns_op_max is the slowest group of operations.
+-- ws_ns is the read time of the working set, ring_copy cases only.
+
+if not bench then
+    print("Error: bench module is not built. ./configure.sh --with-modules=*:bench")
+    astra.exit()
+end
+
+local config = {
+    file = nil,
+    filter = nil,
+    ["repeat"] = 5,
+    scale = 1,
+    log = nil,
+    port = 18080,
+}
+
+options_usage = [[
+    --filter TEXT       run only the cases with TEXT in the name
+    --repeat N          runs of each case. default: 5
+    --scale N           multiply the operations count. default: 1
+    --log FILE          write log messages to the file
+    --port N            local port for the http_upstream benchmarks. default: 18080
+    FILE                TS file for the stream benchmarks
+]]
+
+options = {
+    ["--filter"] = function(idx)
+        config.filter = argv[idx + 1]
+        return 1
+    end,
+    ["--repeat"] = function(idx)
+        config["repeat"] = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--scale"] = function(idx)
+        config.scale = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--log"] = function(idx)
+        config.log = argv[idx + 1]
+        return 1
+    end,
+    ["--port"] = function(idx)
+        config.port = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["*"] = function(idx)
+        config.file = argv[idx]
+        return 0
+    end,
+}
+
+local cases = {}
+
+local function case(name, func)
+    table.insert(cases, { name = name, func = func })
+end
+
+local function N(count)
+    return math.floor(count * config.scale)
+end
+
+-- core
+
+case("crc32b/188", function() return bench.crc32b(188, N(1000000)) end)
+case("crc32b/4096", function() return bench.crc32b(4096, N(100000)) end)
+
+case("thread_buffer/copy/1316", function()
+    return bench.thread_buffer(1316, N(1000000), false)
+end)
+case("thread_buffer/zerocopy/1316", function()
+    return bench.thread_buffer(1316, N(1000000), true)
+end)
+
+-- ws_ns shows the eviction of the working set by the ring writes
+for _, ws in ipairs({ 256, 2048 }) do
+    case("ring_copy/memcpy/ws" .. ws, function()
+        return bench.ring_copy(13160, N(200000), false, ws)
+    end)
+    case("ring_copy/stream/ws" .. ws, function()
+        return bench.ring_copy(13160, N(200000), true, ws)
+    end)
+end
+
+case("psi_mux/cached", function() return bench.psi_mux(60, N(200000), 1) end)
+case("psi_mux/verify", function() return bench.psi_mux(60, N(200000), 8) end)
+
+-- stream tree. the packets are sent by bench_source, nodes are kept in the case
+
+local function stream_case(name, count, batch, build, source_options)
+    case(name, function()
+        local conf = { file = config.file }
+        if source_options then
+            for k, v in pairs(source_options) do conf[k] = v end
+        end
+        local source = bench_source(conf)
+        local nodes = build(source)
+        local result = source:run(N(count), batch)
+        nodes = nil
+        source = nil
+        collectgarbage()
+        return result
+    end)
+end
+
+local function fanout(children)
+    return function(source)
+        local list = {}
+        for i = 1, children do
+            list[i] = transmit({ upstream = source:stream() })
+        end
+        return list
+    end
+end
+
+stream_case("stream_send/fanout/1", 2000000, 0, fanout(1))
+stream_case("stream_send/fanout/8", 1000000, 0, fanout(8))
+stream_case("stream_send/fanout/64", 200000, 0, fanout(64))
+stream_case("stream_send/batch/8", 1000000, 7, fanout(8))
+
+stream_case("channel/remap", 1000000, 0, function(source)
+    return channel({
+        upstream = source:stream(),
+        name = "bench",
+        map = { { "video", 513 }, { "audio", 514 } },
+    })
+end)
+
+for _, engine in ipairs({ "ffdecsa", "libdvbcsa" }) do
+    if decrypt and bench.csa_engine(engine) then
+        stream_case("decrypt/" .. engine, 500000, 0, function(source)
+            return decrypt({
+                upstream = source:stream(),
+                name = "bench",
+                biss = "1122330044556600",
+                engine = engine,
+            })
+        end, { scramble = true })
+    end
+end
+
+-- http_upstream. clients are connected before the cases, they are not read
+-- while the case is running: shared - writes to the ring, queue - blocks in the
+-- per-client queue with the overflow flush
+
+local HTTP_CLIENTS = 16
+
+local http = {
+    server = nil,
+    requests = {},
+    source = {},
+}
+
+case("http_upstream/shared/" .. HTTP_CLIENTS, function()
+    return http.source.shared:run(N(1000000), 0)
+end)
+case("http_upstream/queue/" .. HTTP_CLIENTS, function()
+    return http.source.queue:run(N(200000), 0)
+end)
+
+local function http_prepare(callback)
+    http.source.shared = bench_source({ file = config.file })
+    http.source.queue = bench_source({ file = config.file })
+
+    http.server = http_server({
+        addr = "127.0.0.1",
+        port = config.port,
+        route = {
+            { "/*", http_upstream({ callback = function(server, client, request)
+                if not request then return nil end
+                local mode = request.path:sub(2)
+                if not http.source[mode] then
+                    server:abort(client, 404)
+                    return nil
+                end
+                server:send(client, {
+                    upstream = http.source[mode]:stream(),
+                    shared = (mode == "shared"),
+                })
+            end }) },
+        },
+    })
+
+    local connected = 0
+    local total = HTTP_CLIENTS * 2
+
+    local function on_response(self, response)
+        if not response or response.code ~= 200 then
+            log.error("[bench] http_upstream: request failed")
+            astra.exit()
+        end
+        connected = connected + 1
+        if connected == total then
+            callback()
+        end
+    end
+
+    for _, mode in ipairs({ "shared", "queue" }) do
+        for _ = 1, HTTP_CLIENTS do
+            table.insert(http.requests, http_request({
+                host = "127.0.0.1",
+                port = config.port,
+                path = "/" .. mode,
+                stream = true,
+                callback = on_response,
+            }))
+        end
+    end
+end
+
+-- run
+
+local function median(list)
+    table.sort(list)
+    return list[math.floor((#list + 1) / 2)]
+end
+
+local function selected(c)
+    return not config.filter or c.name:find(config.filter, 1, true)
+end
+
+local report = {
+    version = astra.version,
+    file = config.file or "generated",
+    cases = {},
+}
+
+local function run_cases()
+    for _, c in ipairs(cases) do
+        if selected(c) then
+            local ns_op = {}
+            local mbps = {}
+            local ws_ns = {}
+            local ns_op_max = 0
+            local result = nil
+
+            for _ = 1, config["repeat"] do
+                result = c.func()
+                table.insert(ns_op, result.ns_op)
+                if result.mbps then table.insert(mbps, result.mbps) end
+                if result.ws_ns then table.insert(ws_ns, result.ws_ns) end
+                if result.ns_op_max > ns_op_max then ns_op_max = result.ns_op_max end
+            end
+
+            -- median() sorts the list, the first is the best run
+            local ns_op_median = median(ns_op)
+
+            local item = {
+                name = c.name,
+                ops = result.ops,
+                ns_op = ns_op_median,
+                ns_op_min = ns_op[1],
+                ns_op_max = ns_op_max,
+            }
+            item.ops_sec = math.floor(1000000000 / item.ns_op)
+            if #mbps > 0 then item.mbps = median(mbps) end
+            if #ws_ns > 0 then item.ws_ns = median(ws_ns) end
+
+            table.insert(report.cases, item)
+        end
+    end
+
+    print(json.encode(report))
+    astra.exit()
+end
+
+function main()
+    -- stdout is for the report only
+    log.set({ stdout = false, filename = config.log })
+
+    local is_http = false
+    for _, c in ipairs(cases) do
+        if selected(c) and c.name:find("http_upstream/", 1, true) == 1 then
+            is_http = true
+        end
+    end
+
+    if is_http then
+        http_prepare(run_cases)
+    else
+        run_cases()
+    end
+end
@@ -0,0 +1,175 @@
+/*
+ * Astra Module: Bench (Sink)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stream receiver for the load tests. Counts the packets and the continuity
+ * errors, and measures the latency with the probe packets of the paced
+ * bench_source.
+ *
+ * Module Name:
+ *      bench_sink
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *
+ * Module Methods:
+ *      stat()      - return the counters since the previous call:
+ *                    packets, cc_errors, probes, probes_lost,
+ *                    latency_avg, latency_max - in microseconds,
+ *                    first_packet - time from the module start to the first
+ *                    packet, in microseconds. nil if nothing is received
+ */
+
+#include "bench.h"
+
+/* the last continuity counter is stored with this flag */
+#define CC_IS_SET 0x10
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    uint64_t start;
+    uint64_t first_packet;
+
+    uint8_t cc[MAX_PID];
+
+    bool is_probe;
+    uint32_t probe_seq;
+
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t probes;
+    uint64_t probes_lost;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+};
+
+static void on_probe(module_data_t *mod, const uint8_t *ts)
+{
+    const uint8_t *payload = &ts[TS_HEADER_SIZE];
+    if(memcmp(payload, BENCH_PROBE_MAGIC, sizeof(BENCH_PROBE_MAGIC) - 1))
+        return;
+    payload += sizeof(BENCH_PROBE_MAGIC) - 1;
+
+    uint64_t time = 0;
+    for(int i = 0; i < 8; ++i)
+        time = (time << 8) | payload[i];
+    payload += 8;
+
+    uint32_t seq = 0;
+    for(int i = 0; i < 4; ++i)
+        seq = (seq << 8) | payload[i];
+
+    if(mod->is_probe && seq != mod->probe_seq)
+        mod->probes_lost += seq - mod->probe_seq;
+    mod->is_probe = true;
+    mod->probe_seq = seq + 1;
+
+    const uint64_t now = asc_utime();
+    const uint64_t latency = (now > time) ? now - time : 0;
+    ++mod->probes;
+    mod->latency_sum += latency;
+    if(latency > mod->latency_max)
+        mod->latency_max = latency;
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(!mod->first_packet)
+        mod->first_packet = asc_utime() - mod->start + 1;
+
+    ++mod->packets;
+
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == NULL_TS_PID)
+        return;
+
+    if(TS_IS_PAYLOAD(ts))
+    {
+        const uint8_t cc = TS_GET_CC(ts);
+        const uint8_t last = mod->cc[pid];
+
+        /* duplicate packet is allowed */
+        if((last & CC_IS_SET) && cc != ((last + 1) & 0x0F) && cc != (last & 0x0F))
+            ++mod->cc_errors;
+        mod->cc[pid] = CC_IS_SET | cc;
+    }
+
+    if(pid == BENCH_PROBE_PID)
+        on_probe(mod, ts);
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, (lua_Number)mod->packets);
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, (lua_Number)mod->cc_errors);
+    lua_setfield(lua, -2, "cc_errors");
+    lua_pushnumber(lua, (lua_Number)mod->probes);
+    lua_setfield(lua, -2, "probes");
+    lua_pushnumber(lua, (lua_Number)mod->probes_lost);
+    lua_setfield(lua, -2, "probes_lost");
+
+    if(mod->probes > 0)
+    {
+        lua_pushnumber(lua, (lua_Number)mod->latency_sum / mod->probes);
+        lua_setfield(lua, -2, "latency_avg");
+        lua_pushnumber(lua, (lua_Number)mod->latency_max);
+        lua_setfield(lua, -2, "latency_max");
+    }
+
+    if(mod->first_packet)
+    {
+        lua_pushnumber(lua, (lua_Number)(mod->first_packet - 1));
+        lua_setfield(lua, -2, "first_packet");
+    }
+
+    mod->packets = 0;
+    mod->cc_errors = 0;
+    mod->probes = 0;
+    mod->probes_lost = 0;
+    mod->latency_sum = 0;
+    mod->latency_max = 0;
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, on_ts);
+    mod->start = asc_utime();
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "stat", method_stat },
+    MODULE_STREAM_METHODS_REF()
+};
+
+MODULE_LUA_REGISTER(bench_sink)
@@ -0,0 +1,342 @@
+/*
+ * Astra Module: Bench (Source)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stream source for the benchmarks. Packets are loaded into memory and sent
+ * to the children in a loop, so the time is spent only in the stream tree.
+ * Without file the stream is generated: PAT, PMT and the program with
+ * video (PCR) pid 0x101 and audio pid 0x102.
+ *
+ * Module Name:
+ *      bench_source
+ *
+ * Module Options:
+ *      file        - string, TS file. up to 32Mb are loaded
+ *      scramble    - boolean, mark the elementary stream packets as scrambled with
+ *                    the even key. for the decrypt benchmarks. default: false
+ *      rate        - number, paced mode for the load tests: send the stream with
+ *                    rate Mbit/s on the timer instead of run(). continuity
+ *                    counters are restamped so the loop is seamless, and the probe
+ *                    packets are inserted, see bench.h
+ *
+ * Module Methods:
+ *      run(count, batch)
+ *                  - send count packets, in batches of batch packets if batch > 0.
+ *                    return the result table, see bench_result()
+ *      size()      - return number of the packets in memory
+ */
+
+#include "bench.h"
+
+#define MSG(_msg) "[bench_source] " _msg
+
+#define BENCH_FILE_MAX (32 * 1024 * 1024)
+#define BENCH_SYNTH_PACKETS 8192
+
+/* paced mode. the sender is restarted if it is late more than PACE_LATE_MAX */
+#define PACE_INTERVAL 1
+#define PACE_LATE_MAX (100 * 1000)
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    uint8_t *packets;
+    size_t count;
+
+    // paced mode
+    int rate;
+    asc_timer_t *pace_timer;
+    uint64_t pace_start;
+    uint64_t pace_sent;
+    size_t pace_skip;
+    uint8_t cc[MAX_PID];
+
+    uint8_t probe[TS_PACKET_SIZE];
+    uint64_t probe_time;
+    uint32_t probe_seq;
+};
+
+static void on_synth_packet(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    memcpy(&mod->packets[mod->count * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++mod->count;
+}
+
+static void synth_stream(module_data_t *mod)
+{
+    mod->packets = (uint8_t *)malloc(BENCH_SYNTH_PACKETS * TS_PACKET_SIZE);
+    mod->count = 0;
+
+    mpegts_psi_t *psi = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    PAT_INIT(psi, 1, 0);
+    PAT_ITEMS_APPEND(psi, 1, 0x100);
+    PSI_SET_CRC32(psi);
+    mpegts_psi_demux(psi, on_synth_packet, mod);
+    mpegts_psi_destroy(psi);
+
+    psi = mpegts_psi_init(MPEGTS_PACKET_PMT, 0x100);
+    PMT_INIT(psi, 1, 0, 0x101, NULL, 0);
+    PMT_ITEMS_APPEND(psi, 0x1B, 0x101, NULL, 0);
+    PMT_ITEMS_APPEND(psi, 0x0F, 0x102, NULL, 0);
+    PSI_SET_CRC32(psi);
+    mpegts_psi_demux(psi, on_synth_packet, mod);
+    mpegts_psi_destroy(psi);
+
+    uint8_t cc[2] = { 0, 0 };
+    uint64_t pcr = 0;
+    while(mod->count < BENCH_SYNTH_PACKETS)
+    {
+        uint8_t *ts = &mod->packets[mod->count * TS_PACKET_SIZE];
+        const bool is_audio = (mod->count % 10) == 0;
+        const uint16_t pid = (is_audio) ? 0x102 : 0x101;
+
+        ts[0] = 0x47;
+        ts[1] = (mod->count % 40 == 2) ? 0x40 : 0x00;
+        ts[2] = 0x00;
+        TS_SET_PID(ts, pid);
+        ts[3] = 0x10 | (cc[is_audio] & 0x0F);
+        cc[is_audio] = (cc[is_audio] + 1) & 0x0F;
+
+        size_t skip = TS_HEADER_SIZE;
+        if(!is_audio && mod->count % 40 == 2)
+        {
+            /* adaptation field with PCR */
+            ts[3] |= 0x20;
+            ts[4] = 7;
+            ts[5] = 0x10;
+            pcr += 27000000 / 25;
+            const uint64_t base = pcr / 300;
+            ts[6] = (base >> 25) & 0xFF;
+            ts[7] = (base >> 17) & 0xFF;
+            ts[8] = (base >> 9) & 0xFF;
+            ts[9] = (base >> 1) & 0xFF;
+            ts[10] = ((base & 1) << 7) | 0x7E;
+            ts[11] = 0x00;
+            skip += 8;
+        }
+
+        for(; skip < TS_PACKET_SIZE; ++skip)
+            ts[skip] = (uint8_t)rand();
+
+        ++mod->count;
+    }
+}
+
+static bool load_file(module_data_t *mod, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp)
+    {
+        asc_log_error(MSG("failed to open %s: %s"), filename, strerror(errno));
+        return false;
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc(BENCH_FILE_MAX);
+    const size_t size = fread(buffer, 1, BENCH_FILE_MAX, fp);
+    fclose(fp);
+
+    size_t skip = 0;
+    for(; skip < TS_PACKET_SIZE && skip + TS_PACKET_SIZE < size; ++skip)
+    {
+        if(buffer[skip] == 0x47 && buffer[skip + TS_PACKET_SIZE] == 0x47)
+            break;
+    }
+
+    mod->count = (size > skip) ? (size - skip) / TS_PACKET_SIZE : 0;
+    if(mod->count < 2 || buffer[skip] != 0x47)
+    {
+        asc_log_error(MSG("%s is not a TS file"), filename);
+        free(buffer);
+        mod->count = 0;
+        return false;
+    }
+
+    mod->packets = (uint8_t *)malloc(mod->count * TS_PACKET_SIZE);
+    memcpy(mod->packets, &buffer[skip], mod->count * TS_PACKET_SIZE);
+    free(buffer);
+
+    return true;
+}
+
+static void scramble_stream(module_data_t *mod)
+{
+    for(size_t i = 0; i < mod->count; ++i)
+    {
+        uint8_t *ts = &mod->packets[i * TS_PACKET_SIZE];
+        if(TS_GET_PID(ts) >= 0x20 && TS_GET_PID(ts) != NULL_TS_PID && TS_IS_PAYLOAD(ts))
+            ts[3] = (ts[3] & 0x3F) | 0x80;
+    }
+}
+
+static void send_probe(module_data_t *mod, uint64_t now)
+{
+    uint8_t *ts = mod->probe;
+    TS_SET_CC(ts, mod->cc[BENCH_PROBE_PID]);
+    mod->cc[BENCH_PROBE_PID] = (mod->cc[BENCH_PROBE_PID] + 1) & 0x0F;
+
+    uint8_t *payload = &ts[TS_HEADER_SIZE];
+    memcpy(payload, BENCH_PROBE_MAGIC, sizeof(BENCH_PROBE_MAGIC) - 1);
+    payload += sizeof(BENCH_PROBE_MAGIC) - 1;
+    for(int i = 0; i < 8; ++i)
+        payload[i] = (now >> (56 - i * 8)) & 0xFF;
+    payload += 8;
+    for(int i = 0; i < 4; ++i)
+        payload[i] = (mod->probe_seq >> (24 - i * 8)) & 0xFF;
+    ++mod->probe_seq;
+
+    module_stream_send(mod, ts);
+}
+
+static void on_pace(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_utime();
+    if(now - mod->probe_time >= BENCH_PROBE_INTERVAL)
+    {
+        mod->probe_time = now;
+        send_probe(mod, now);
+    }
+
+    /* packets = time(us) * rate(Mbit/s) / packet size(bits) */
+    const uint64_t elapsed = now - mod->pace_start;
+    const uint64_t expected = elapsed * mod->rate / (TS_PACKET_SIZE * 8);
+    if(expected - mod->pace_sent > (uint64_t)mod->rate * PACE_LATE_MAX / (TS_PACKET_SIZE * 8))
+    {
+        asc_log_warning(MSG("sender is late, %"PRIu64" packets are skipped")
+                        , expected - mod->pace_sent);
+        mod->pace_start = now;
+        mod->pace_sent = 0;
+        return;
+    }
+
+    for(; mod->pace_sent < expected; ++mod->pace_sent)
+    {
+        uint8_t *ts = &mod->packets[mod->pace_skip * TS_PACKET_SIZE];
+        if(TS_IS_PAYLOAD(ts))
+        {
+            const uint16_t pid = TS_GET_PID(ts);
+            TS_SET_CC(ts, mod->cc[pid]);
+            mod->cc[pid] = (mod->cc[pid] + 1) & 0x0F;
+        }
+
+        module_stream_send(mod, ts);
+        if(++mod->pace_skip == mod->count)
+            mod->pace_skip = 0;
+    }
+}
+
+static int method_run(module_data_t *mod)
+{
+    const int count = luaL_checkinteger(lua, 2);
+    const int batch = luaL_optinteger(lua, 3, 0);
+    luaL_argcheck(lua, count > 0, 2, MSG("count should be positive"));
+
+    size_t skip = 0;
+
+    bench_clock_t clock;
+    bench_clock_start(&clock);
+
+    if(batch > 0)
+    {
+        for(int i = 0; i < count; i += batch)
+        {
+            size_t size = (size_t)batch;
+            if(skip + size > mod->count)
+                size = mod->count - skip;
+
+            __module_stream_send_batch(&mod->__stream, &mod->packets[skip * TS_PACKET_SIZE], size);
+            skip += size;
+            if(skip == mod->count)
+                skip = 0;
+
+            for(size_t j = 0; j < size; ++j)
+                bench_clock_tick(&clock);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            module_stream_send(mod, &mod->packets[skip * TS_PACKET_SIZE]);
+            if(++skip == mod->count)
+                skip = 0;
+            bench_clock_tick(&clock);
+        }
+    }
+
+    bench_result(lua, &clock, clock.ops * TS_PACKET_SIZE);
+    return 1;
+}
+
+static int method_size(module_data_t *mod)
+{
+    lua_pushnumber(lua, mod->count);
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    const char *filename = NULL;
+    module_option_string("file", &filename, NULL);
+    if(!filename || !load_file(mod, filename))
+        synth_stream(mod);
+
+    bool scramble = false;
+    module_option_boolean("scramble", &scramble);
+    if(scramble)
+        scramble_stream(mod);
+
+    module_option_number("rate", &mod->rate);
+    if(mod->rate > 0)
+    {
+        uint8_t *ts = mod->probe;
+        memset(ts, 0xFF, TS_PACKET_SIZE);
+        ts[0] = 0x47;
+        ts[1] = 0x00;
+        ts[2] = 0x00;
+        TS_SET_PID(ts, BENCH_PROBE_PID);
+        ts[3] = 0x10;
+
+        mod->pace_start = asc_utime();
+        mod->pace_timer = asc_timer_init(PACE_INTERVAL, on_pace, mod);
+    }
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->pace_timer, asc_timer_destroy);
+    module_stream_destroy(mod);
+    ASC_FREE(mod->packets, free);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "run", method_run },
+    { "size", method_size },
+    MODULE_STREAM_METHODS_REF()
+};
+
+MODULE_LUA_REGISTER(bench_source)
@@ -0,0 +1,306 @@
+-- Astra Load Generator
+-- https://cesbo.com/astra
+--
+-- Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+--
+-- This program is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- This program is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+-- Usage: astra bench/loadgen.lua [OPTIONS] [FILE]
+--
+-- Load and soak test of the Astra under test (SUT). The stream is sent to
+-- the multicast groups with the fixed rate and received back from the SUT
+-- by the HTTP clients:
+--
+--     loadgen: bench_source -> udp_output x N  ->  SUT: udp_input ... http_upstream
+--     loadgen: http_request x M -> bench_sink  <-  SUT
+--
+-- The latency is measured with the probe packets on pid 0x1FFE, so the SUT
+-- should pass it through (channel without pnr or with map/filter allowing it),
+-- and the SUT should run on the same host, or the probes show only the loss.
+--
+-- Report is a JSON line on each interval:
+--     { time, tx_mbps, rx_mbps, clients, connected, cpu, cpu_gbit,
+--       channels = [ { path, clients, rx_mbps, cc_errors, probes_lost,
+--                      latency_avg, latency_max, first_packet } ] }
+-- latency and first_packet are in milliseconds. cpu is the CPU usage of the
+-- process --pid (cores), cpu_gbit is cores per Gbit/s received by the clients.
+
+if not bench then
+    print("Error: bench module is not built. ./configure.sh --with-modules=*:bench")
+    astra.exit()
+end
+
+local config = {
+    file = nil,
+    udp = nil,
+    localaddr = nil,
+    groups = 1,
+    rate = 10,
+    http = nil,
+    clients = 1,
+    duration = 0,
+    interval = 10,
+    pid = nil,
+    log = nil,
+}
+
+options_usage = [[
+    --udp ADDR:PORT     first multicast group. group i is ADDR + i
+    --groups N          number of the multicast groups. default: 1
+    --rate N            rate of each group in Mbit/s. default: 10
+    --localaddr IP      interface for the multicast
+    --http URL          http://host:port/path of the SUT. %d in the path is
+                        replaced with the channel number 1..groups
+    --clients M         HTTP clients, distributed over the channels. default: 1
+    --duration SEC      test time. default: 0 - until interrupted
+    --interval SEC      report interval. default: 10
+    --pid PID           process id of the SUT to measure CPU usage
+    --log FILE          write log messages to the file
+    FILE                TS file. by default generated stream
+]]
+
+local function option_string(key)
+    return function(idx)
+        config[key] = argv[idx + 1]
+        return 1
+    end
+end
+
+local function option_number(key)
+    return function(idx)
+        config[key] = tonumber(argv[idx + 1])
+        return 1
+    end
+end
+
+options = {
+    ["--udp"] = option_string("udp"),
+    ["--groups"] = option_number("groups"),
+    ["--rate"] = option_number("rate"),
+    ["--localaddr"] = option_string("localaddr"),
+    ["--http"] = option_string("http"),
+    ["--clients"] = option_number("clients"),
+    ["--duration"] = option_number("duration"),
+    ["--interval"] = option_number("interval"),
+    ["--pid"] = option_number("pid"),
+    ["--log"] = option_string("log"),
+    ["*"] = function(idx)
+        config.file = argv[idx]
+        return 0
+    end,
+}
+
+local source = nil
+local udp_list = {}
+local channel_list = {}
+local report_timer = nil
+local cpu_time = nil
+local started = nil
+
+local function inet_add(addr, n)
+    local a, b, c, d = addr:match("^(%d+)%.(%d+)%.(%d+)%.(%d+)$")
+    if not a then return nil end
+    local x = ((tonumber(a) * 256 + tonumber(b)) * 256 + tonumber(c)) * 256 + tonumber(d) + n
+    return string.format("%d.%d.%d.%d",
+        math.floor(x / 16777216) % 256, math.floor(x / 65536) % 256,
+        math.floor(x / 256) % 256, x % 256)
+end
+
+-- udp
+
+local function start_udp()
+    local conf = parse_url("udp://" .. config.udp)
+    if not conf or not conf.addr or not inet_add(conf.addr, 0) then
+        log.error("[loadgen] wrong --udp value")
+        astra.exit()
+    end
+
+    for i = 0, config.groups - 1 do
+        table.insert(udp_list, udp_output({
+            upstream = source:stream(),
+            addr = inet_add(conf.addr, i),
+            port = conf.port or 1234,
+            localaddr = config.localaddr,
+            socket_size = 0x80000,
+        }))
+    end
+end
+
+-- http
+
+local function client_connect(channel, client)
+    client.sink = nil
+    client.request = http_request({
+        host = channel.host,
+        port = channel.port,
+        path = channel.path,
+        stream = true,
+        headers = {
+            "User-Agent: Astra Loadgen",
+            "Host: " .. channel.host .. ":" .. channel.port,
+            "Connection: close",
+        },
+        callback = function(self, response)
+            if response and response.code == 200 then
+                client.sink = bench_sink({ upstream = self:stream() })
+                return
+            end
+
+            if response then
+                log.error("[loadgen] " .. channel.path .. ": " .. response.code)
+            end
+
+            -- reconnect on the next report
+            channel.reconnects = channel.reconnects + 1
+            self:close()
+            client.request = nil
+            client.sink = nil
+        end,
+    })
+end
+
+local function start_http()
+    local conf = parse_url(config.http)
+    if not conf or conf.format ~= "http" then
+        log.error("[loadgen] wrong --http value")
+        astra.exit()
+    end
+
+    local count = (conf.path:find("%d", 1, true)) and config.groups or 1
+    for i = 1, count do
+        table.insert(channel_list, {
+            host = conf.host,
+            port = conf.port or 80,
+            path = conf.path:gsub("%%d", tostring(i)),
+            clients = {},
+            reconnects = 0,
+            first_packet = nil,
+        })
+    end
+
+    for i = 1, config.clients do
+        local channel = channel_list[(i - 1) % count + 1]
+        local client = {}
+        table.insert(channel.clients, client)
+        client_connect(channel, client)
+    end
+end
+
+-- report
+
+local function on_report()
+    local report = {
+        time = os.time() - started,
+        tx_mbps = config.udp and (config.rate * config.groups) or 0,
+        rx_mbps = 0,
+        clients = config.clients,
+        connected = 0,
+        channels = {},
+    }
+
+    local rx_bits = 0
+    for _, channel in ipairs(channel_list) do
+        local item = {
+            path = channel.path,
+            clients = 0,
+            rx_mbps = 0,
+            cc_errors = 0,
+            probes_lost = 0,
+            reconnects = channel.reconnects,
+        }
+        local latency_sum = 0
+        local probes = 0
+        local bits = 0
+
+        for _, client in ipairs(channel.clients) do
+            if client.sink then
+                local stat = client.sink:stat()
+                item.clients = item.clients + 1
+                bits = bits + stat.packets * 188 * 8
+                item.cc_errors = item.cc_errors + stat.cc_errors
+                item.probes_lost = item.probes_lost + stat.probes_lost
+                if stat.probes > 0 then
+                    probes = probes + stat.probes
+                    latency_sum = latency_sum + stat.latency_avg * stat.probes
+                    local latency_max = stat.latency_max / 1000
+                    if not item.latency_max or latency_max > item.latency_max then
+                        item.latency_max = latency_max
+                    end
+                end
+                if stat.first_packet then
+                    local first_packet = stat.first_packet / 1000
+                    if not item.first_packet or first_packet > item.first_packet then
+                        item.first_packet = first_packet
+                    end
+                end
+            elseif not client.request then
+                client_connect(channel, client)
+            end
+        end
+
+        if probes > 0 then item.latency_avg = latency_sum / probes / 1000 end
+        item.rx_mbps = bits / config.interval / 1000000
+        rx_bits = rx_bits + bits
+        report.connected = report.connected + item.clients
+        table.insert(report.channels, item)
+    end
+
+    report.rx_mbps = rx_bits / config.interval / 1000000
+
+    if config.pid then
+        local t = bench.cpu_time(config.pid)
+        if t and cpu_time then
+            report.cpu = (t - cpu_time) / config.interval
+            if report.rx_mbps > 0 then
+                report.cpu_gbit = report.cpu / (report.rx_mbps / 1000)
+            end
+        end
+        cpu_time = t
+    end
+
+    print(json.encode(report))
+
+    if config.duration > 0 and report.time >= config.duration then
+        astra.exit()
+    end
+end
+
+function main()
+    log.set({ stdout = false, filename = config.log })
+
+    if not config.udp and not config.http then
+        print("Error: --udp or --http is required")
+        astra.exit()
+    end
+
+    started = os.time()
+
+    if config.udp then
+        source = bench_source({ file = config.file, rate = config.rate })
+        start_udp()
+    end
+
+    if config.http then
+        start_http()
+    end
+
+    if config.pid then
+        cpu_time = bench.cpu_time(config.pid)
+        if not cpu_time then
+            log.error("[loadgen] failed to get CPU time of the process " .. config.pid)
+        end
+    end
+
+    report_timer = timer({ interval = config.interval, callback = on_report })
+end
@@ -0,0 +1,6 @@
+
+# Benchmarks. Not selected by default: ./configure.sh --with-modules=*:bench
+# bench.csa_engine() requires modules/softcam
+
+SOURCES="bench.c bench_source.c bench_sink.c"
+MODULES="bench bench_source bench_sink"
@@ -16,6 +16,9 @@ Usage: $0 [OPTIONS]
 
     --with-libdvbcsa            - build with libdvbcsa
     --with-igmp-emulation       - build with igmp emulated multicast renew
+    --with-io-uring             - event loop with io_uring instead of epoll
+                                  (Linux 5.11 or newer required)
+    --with-memstat              - heap accounting by the module instance
 
     --cc=GCC                    - custom C compiler (cross-compile)
     --static                    - build static binary
@@ -47,6 +50,8 @@ ARG_CFLAGS=""
 ARG_LDFLAGS=""
 ARG_LIBDVBCSA=0
 ARG_IGMP_EMULATION=0
+ARG_IO_URING=0
+ARG_MEMSTAT=0
 ARG_DEBUG=0
 
 set_cc()
@@ -76,6 +81,12 @@ while [ $# -ne 0 ] ; do
         "--with-igmp-emulation")
             ARG_IGMP_EMULATION=1
             ;;
+        "--with-io-uring")
+            ARG_IO_URING=1
+            ;;
+        "--with-memstat")
+            ARG_MEMSTAT=1
+            ;;
         "--cc="*)
             set_cc `echo $OPT | sed 's/^--cc=//'`
             ;;
@@ -455,6 +466,210 @@ if check_strnlen ; then
     CFLAGS="$CFLAGS -DHAVE_STRNLEN=1"
 fi
 
+recvmmsg_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+int main(void) { struct mmsghdr m; return recvmmsg(0, &m, 1, 0, 0); }
+EOF
+}
+
+check_recvmmsg()
+{
+    recvmmsg_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_recvmmsg ; then
+    CFLAGS="$CFLAGS -DHAVE_RECVMMSG=1"
+fi
+
+sendmmsg_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+int main(void) { struct mmsghdr m; return sendmmsg(0, &m, 1, 0); }
+EOF
+}
+
+check_sendmmsg()
+{
+    sendmmsg_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_sendmmsg ; then
+    CFLAGS="$CFLAGS -DHAVE_SENDMMSG=1"
+fi
+
+txtime_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+int main(void) { struct sock_txtime t; t.clockid = 0; t.flags = 0; return SO_TXTIME + t.flags; }
+EOF
+}
+
+check_txtime()
+{
+    txtime_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_txtime ; then
+    CFLAGS="$CFLAGS -DHAVE_SO_TXTIME=1"
+fi
+
+zerocopy_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+int main(void) { return SO_ZEROCOPY + MSG_ZEROCOPY + SO_EE_ORIGIN_ZEROCOPY; }
+EOF
+}
+
+check_zerocopy()
+{
+    zerocopy_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_zerocopy ; then
+    CFLAGS="$CFLAGS -DHAVE_MSG_ZEROCOPY=1"
+fi
+
+accept4_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+int main(void) { return accept4(0, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC); }
+EOF
+}
+
+check_accept4()
+{
+    accept4_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_accept4 ; then
+    CFLAGS="$CFLAGS -DHAVE_ACCEPT4=1"
+fi
+
+timerfd_test_c()
+{
+    cat <<EOF
+#include <sys/timerfd.h>
+int main(void) { return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC); }
+EOF
+}
+
+check_timerfd()
+{
+    timerfd_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_timerfd ; then
+    CFLAGS="$CFLAGS -DHAVE_TIMERFD=1"
+fi
+
+memfd_test_c()
+{
+    cat <<EOF
+#include <sys/mman.h>
+int main(void) { return memfd_create("test", MFD_CLOEXEC); }
+EOF
+}
+
+check_memfd()
+{
+    memfd_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_memfd ; then
+    CFLAGS="$CFLAGS -DHAVE_MEMFD_CREATE=1"
+fi
+
+inotify_test_c()
+{
+    cat <<EOF
+#include <sys/inotify.h>
+int main(void) { return inotify_init1(IN_NONBLOCK | IN_CLOEXEC); }
+EOF
+}
+
+check_inotify()
+{
+    inotify_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_inotify ; then
+    CFLAGS="$CFLAGS -DHAVE_INOTIFY=1"
+fi
+
+sdt_test_c()
+{
+    cat <<EOF
+#include <sys/sdt.h>
+int main(void) { DTRACE_PROBE1(astra, test, 1); return 0; }
+EOF
+}
+
+check_sdt()
+{
+    sdt_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_sdt ; then
+    CFLAGS="$CFLAGS -DHAVE_SYS_SDT_H=1"
+fi
+
+packet_mmap_test_c()
+{
+    cat <<EOF
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+int main(void) { struct tpacket_req3 r; (void)r; return TPACKET_V3 + PACKET_RX_RING + SO_ATTACH_FILTER; }
+EOF
+}
+
+check_packet_mmap()
+{
+    packet_mmap_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_packet_mmap ; then
+    CFLAGS="$CFLAGS -DHAVE_PACKET_MMAP=1"
+fi
+
+io_uring_test_c()
+{
+    cat <<EOF
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main(void) { struct io_uring_getevents_arg a; struct io_uring_buf_ring b; (void)a; (void)b; return __NR_io_uring_enter + IORING_FEAT_EXT_ARG + IORING_OP_POLL_ADD + IORING_RECV_MULTISHOT + IORING_REGISTER_PBUF_RING; }
+EOF
+}
+
+check_io_uring()
+{
+    io_uring_test_c | $APP_C -Werror $CFLAGS -c -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if [ $ARG_IO_URING -eq 1 ] ; then
+    if [ "$OS" = "linux" ] && check_io_uring ; then
+        CFLAGS="$CFLAGS -DWITH_IO_URING=1"
+    else
+        echo "Error: io_uring is not supported" >&2
+        exit 1
+    fi
+fi
+
+# Memory accounting
+
+if [ $ARG_MEMSTAT -eq 1 ] ; then
+    CFLAGS="$CFLAGS -DWITH_MEMSTAT=1"
+fi
+
 # IGMP Emulation
 
 if [ $ARG_IGMP_EMULATION -eq 1 ]; then
@@ -751,6 +966,39 @@ uninstall:
 	@rm -f \$(APP) $APP_OBJS
 	@rm -f \$(MODS_OBJS)
 	@rm -f \$(CORE_OBJS)
+	@rm -f ffdecsa-bench ffdecsa-bench-*.o
+EOF
+
+# FFdecsa benchmark, all parallel modes in one binary. see FFdecsa_bench.c
+
+FFDECSA_DIR="$SRCDIR/modules/softcam/FFdecsa"
+FFDECSA_BENCH_MODES="320 321 322 640 641 642 643 1280 1281 1282 1283 2560"
+FFDECSA_BENCH_CFLAGS="-O2 -fomit-frame-pointer -I$SRCDIR -D_GNU_SOURCE"
+
+if $APP_C -dM -E -x c /dev/null | grep -q "__x86_64__\|__i386__" ; then
+    FFDECSA_BENCH_MODES="$FFDECSA_BENCH_MODES 644 1284 1285 1286"
+    FFDECSA_BENCH_CFLAGS="$FFDECSA_BENCH_CFLAGS -msse2 -DFFDECSA_BENCH_X86=1"
+    echo '#pragma GCC target("avx2")' | $APP_C -mavx2 -c -o /dev/null -x c - >/dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        FFDECSA_BENCH_MODES="$FFDECSA_BENCH_MODES 2561"
+        FFDECSA_BENCH_CFLAGS="$FFDECSA_BENCH_CFLAGS -DFFDECSA_BENCH_AVX2=1"
+    fi
+fi
+
+cat >&5 <<EOF
+
+FFDECSA_BENCH_MODES = $FFDECSA_BENCH_MODES
+FFDECSA_BENCH_CFLAGS = $FFDECSA_BENCH_CFLAGS
+
+ffdecsa-bench: $FFDECSA_DIR/FFdecsa_bench.c $FFDECSA_DIR/FFdecsa_mode.c $FFDECSA_DIR/FFdecsa.c
+	@for M in \$(FFDECSA_BENCH_MODES) ; do \\
+		echo "   CC: ffdecsa-bench-\$\$M.o" ; \\
+		\$(CC) \$(FFDECSA_BENCH_CFLAGS) -DPARALLEL_MODE=\$\$M -o ffdecsa-bench-\$\$M.o \\
+			-c $FFDECSA_DIR/FFdecsa_mode.c || exit 1 ; \\
+	done
+	@echo "BUILD: \$@"
+	@\$(CC) \$(FFDECSA_BENCH_CFLAGS) -o \$@ $FFDECSA_DIR/FFdecsa_bench.c \\
+		\$(patsubst %,ffdecsa-bench-%.o,\$(FFDECSA_BENCH_MODES))
 EOF
 
 exec 5>&-
@@ -24,14 +24,23 @@
 #include "assert.h"
 #include "base.h"
 #include "clock.h"
+#include "command.h"
 #include "compat.h"
 #include "event.h"
+#include "handover.h"
+#include "job.h"
 #include "list.h"
 #include "log.h"
 #include "loopctl.h"
+#include "loopstat.h"
+#include "memory.h"
+#include "metrics.h"
+#include "profile.h"
+#include "resolve.h"
 #include "socket.h"
 #include "strbuffer.h"
 #include "thread.h"
 #include "timer.h"
+#include "trace.h"
 
 #endif /* _ASC_H_ */
@@ -21,6 +21,8 @@
 
 #include "clock.h"
 
+uint64_t asc_loop_time = 0;
+
 __asc_inline
 uint64_t asc_utime(void)
 {
@@ -39,6 +41,25 @@ uint64_t asc_utime(void)
 #endif
 }
 
+uint64_t asc_utime_coarse(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0)
+        return asc_utime();
+
+    return ((uint64_t)ts.tv_sec * 1000000) + (uint64_t)(ts.tv_nsec / 1000);
+#else
+    return asc_utime();
+#endif
+}
+
+void asc_clock_update(void)
+{
+    asc_loop_time = asc_utime();
+}
+
 __asc_inline
 void asc_usleep(uint64_t usec)
 {
@@ -27,4 +27,21 @@
 uint64_t asc_utime(void);
 void asc_usleep(uint64_t usec);
 
+/*
+ * asc_utime() with the resolution of the kernel tick (1-4ms) and without the
+ * clock read, CLOCK_MONOTONIC_COARSE. Same time base as asc_utime(). For the
+ * timeouts and cache expiration, not for the pacing.
+ */
+uint64_t asc_utime_coarse(void);
+
+/*
+ * asc_utime() of the current main loop iteration. Updated once after the event
+ * wait, so the packet processing takes the time without the system call.
+ */
+extern uint64_t asc_loop_time;
+
+#define asc_loop_utime() (asc_loop_time)
+
+void asc_clock_update(void);
+
 #endif /* _ASC_CLOCK_H_ */
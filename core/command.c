@@ -0,0 +1,122 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "command.h"
+#include "event.h"
+#include "loopctl.h"
+
+typedef struct
+{
+    asc_command_t *head; // posted, LIFO. producers push, the main loop takes all
+
+    // taken from the posted list in order of posting, main loop only
+    asc_command_t *ready;
+    asc_command_t **ready_tail;
+} command_queue_t;
+
+static command_queue_t queue = { NULL, NULL, &queue.ready };
+
+bool asc_command_post(asc_command_t *command)
+{
+    if(__atomic_exchange_n(&command->is_pending, true, __ATOMIC_ACQ_REL))
+        return false;
+
+    asc_command_t *head = __atomic_load_n(&queue.head, __ATOMIC_RELAXED);
+    do
+    {
+        command->next = head;
+    } while(!__atomic_compare_exchange_n(  &queue.head, &head, command, true
+                                         , __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* non-empty queue is taken on the next iteration anyway */
+    if(!head)
+        asc_event_core_wakeup();
+
+    return true;
+}
+
+/* moves the posted commands to the ready list */
+static void command_take(void)
+{
+    asc_command_t *list = __atomic_exchange_n(&queue.head, NULL, __ATOMIC_ACQUIRE);
+    if(!list)
+        return;
+
+    asc_command_t *fifo = NULL;
+    asc_command_t *last = list;
+    while(list)
+    {
+        asc_command_t *next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    *queue.ready_tail = fifo;
+    queue.ready_tail = &last->next;
+}
+
+void asc_command_cancel(asc_command_t *command)
+{
+    if(!__atomic_load_n(&command->is_pending, __ATOMIC_ACQUIRE))
+        return;
+
+    command_take();
+
+    asc_command_t **item = &queue.ready;
+    while(*item && *item != command)
+        item = &(*item)->next;
+    if(*item)
+    {
+        *item = command->next;
+        if(queue.ready_tail == &command->next)
+            queue.ready_tail = item;
+    }
+
+    command->next = NULL;
+    __atomic_store_n(&command->is_pending, false, __ATOMIC_RELEASE);
+}
+
+void asc_command_core_loop(void)
+{
+    /* commands posted by the running ones are taken on the next iteration */
+    command_take();
+
+    asc_command_t *command;
+    while((command = queue.ready) != NULL)
+    {
+        queue.ready = command->next;
+        if(!queue.ready)
+            queue.ready_tail = &queue.ready;
+        command->next = NULL;
+
+        __atomic_store_n(&command->is_pending, false, __ATOMIC_RELEASE);
+        is_main_loop_idle = false;
+        command->run(command);
+    }
+}
+
+void asc_command_core_destroy(void)
+{
+    /* owners are released, pending commands are dropped */
+    __atomic_store_n(&queue.head, NULL, __ATOMIC_RELEASE);
+    queue.ready = NULL;
+    queue.ready_tail = &queue.ready;
+}
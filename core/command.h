@@ -0,0 +1,59 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_COMMAND_H_
+#define _ASC_COMMAND_H_ 1
+
+#include "base.h"
+
+/*
+ * Commands to the main loop from any thread. Post is lock-free: one
+ * compare-and-swap on the queue head, the main loop is woken up on the
+ * empty to non-empty transition only. The main loop takes the whole queue
+ * once per iteration and runs the commands in order of posting.
+ *
+ * The command is the part of the owner structure, the queue does not
+ * allocate memory. Posting the pending command does nothing, so the owner
+ * may post the same command on each change and apply the last state.
+ */
+
+typedef struct asc_command_t asc_command_t;
+typedef void (*asc_command_callback_t)(asc_command_t *command);
+
+struct asc_command_t
+{
+    asc_command_callback_t run; // called on the main loop
+    void *arg;
+
+    /* private */
+    bool is_pending;            // posted and not started
+    asc_command_t *next;
+};
+
+/* any thread. returns false if the command is pending already */
+bool asc_command_post(asc_command_t *command);
+
+/* main loop only. removes the pending command, call it before release */
+void asc_command_cancel(asc_command_t *command);
+
+void asc_command_core_loop(void);
+void asc_command_core_destroy(void);
+
+#endif /* _ASC_COMMAND_H_ */
@@ -19,15 +19,22 @@
  */
 
 #include "assert.h"
+#include "clock.h"
 #include "event.h"
 #include "list.h"
 #include "log.h"
 #include "loopctl.h"
+#include "loopstat.h"
 
 #ifndef EV_LIST_SIZE
 #   define EV_LIST_SIZE 1024
 #endif
 
+/* time of the control events per loop iteration, see asc_event_set_priority() */
+#ifndef EV_CONTROL_BUDGET
+#   define EV_CONTROL_BUDGET 2000 // us
+#endif
+
 #if defined(WITH_POLL)
 #   define EV_TYPE_POLL
 #   define MSG(_msg) "[core/event poll] " _msg
@@ -35,6 +42,14 @@
 #elif defined(WITH_SELECT)
 #   define EV_TYPE_SELECT
 #   define MSG(_msg) "[core/event select] " _msg
+#elif defined(WITH_IO_URING)
+#   define EV_TYPE_URING
+#   include <poll.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <sys/socket.h>
+#   include <linux/io_uring.h>
+#   define MSG(_msg) "[core/event io_uring] " _msg
 #elif defined(WITH_KQUEUE)
 #   define EV_TYPE_KQUEUE
 #   include <sys/event.h>
@@ -54,16 +69,830 @@
 #   error "Event notification interface not set"
 #endif
 
-struct asc_event_t
+#if defined(EV_TYPE_EPOLL) || defined(EV_TYPE_URING)
+#   include <sys/eventfd.h>
+#endif
+
+struct asc_event_t
+{
+    int fd;
+    event_callback_t on_read;
+    event_callback_t on_write;
+    event_callback_t on_error;
+    void *arg;
+
+    TAILQ_ENTRY(asc_event_t) entries;
+
+    bool is_closed;
+
+    /* io_uring: polls in flight, the last one is armed */
+    uint32_t inflight;
+    bool is_armed;
+
+    /* edge mode, see asc_event_set_edge() */
+    bool is_edge;
+    bool is_writable;
+    bool is_pending;
+    uint32_t mask; // events subscribed in the kernel
+    TAILQ_ENTRY(asc_event_t) pending_entries;
+
+    asc_event_priority_t priority;
+};
+
+/*
+ * Main loop wakeup channel. Other threads (and signal handlers) write to it
+ * to interrupt the blocking wait in asc_event_core_loop().
+ * Not available with the select() backend.
+ */
+
+#ifndef EV_TYPE_SELECT
+
+static int wakeup_fd[2] = { -1, -1 };
+
+static void asc_event_wakeup_open(void)
+{
+#if defined(EV_TYPE_EPOLL) || defined(EV_TYPE_URING)
+    wakeup_fd[0] = eventfd(0, EFD_NONBLOCK);
+    asc_assert(wakeup_fd[0] != -1, MSG("failed to open wakeup fd [%s]"), strerror(errno));
+    wakeup_fd[1] = wakeup_fd[0];
+#else
+    const int ret = pipe(wakeup_fd);
+    asc_assert(ret != -1, MSG("failed to open wakeup pipe [%s]"), strerror(errno));
+    fcntl(wakeup_fd[0], F_SETFL, fcntl(wakeup_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wakeup_fd[1], F_SETFL, fcntl(wakeup_fd[1], F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+static void asc_event_wakeup_close(void)
+{
+    if(wakeup_fd[0] == -1)
+        return;
+
+    close(wakeup_fd[0]);
+    if(wakeup_fd[1] != wakeup_fd[0])
+        close(wakeup_fd[1]);
+
+    wakeup_fd[0] = -1;
+    wakeup_fd[1] = -1;
+}
+
+static void asc_event_wakeup_drain(void)
+{
+    uint8_t buffer[64];
+    while(read(wakeup_fd[0], buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+void asc_event_core_wakeup(void)
+{
+    if(wakeup_fd[1] == -1)
+        return;
+
+    const uint64_t value = 1;
+    if(write(wakeup_fd[1], &value, sizeof(value)) == -1)
+    {
+        ; /* counter overflow or pipe is full, main loop is awake anyway */
+    }
+}
+
+#else
+
+void asc_event_core_wakeup(void)
+{
+    ;
+}
+
+#endif /* !EV_TYPE_SELECT */
+
+#if defined(EV_TYPE_URING)
+
+/*
+ * ooooo  ooooooo        ooooo  oooo oooooooooo  ooooo oooo   oooo  ooooooo8
+ *  888 o888   888o       888    88   888    888  888   8888o  88 o888    88
+ *  888 888     888       888    88   888oooo88   888   88 888o88 888    oooooo
+ *  888 888o   o888       888    88   888  88o    888   88   8888 888o    oo88
+ * o888o  88ooo88 ooooooo  888oo88   o888o  88o8 o888o o88o    88  888ooo888
+ *
+ * Readiness with the one-shot IORING_OP_POLL_ADD for each event. Changes of
+ * the interest are queued to the submission ring and submitted with the wait
+ * in one io_uring_enter(), the poll is armed again after the callbacks.
+ * Polls of the event complete in order of the submission, so a completion
+ * with other polls in flight belongs to the replaced poll and is skipped.
+ * Closed event is freed when its last poll is completed.
+ *
+ * Completion path, see asc_event_recv_init() and asc_event_sendto().
+ * The receive is the multishot IORING_OP_RECVMSG with the provided buffer
+ * ring of own group, the buffers of the owner are indexed by the buffer id.
+ * The kernel completes the request when the ring is empty, it is submitted
+ * again with the next provided buffer. The send is IORING_OP_SENDMSG with the copy
+ * of the datagram in the send slot, the slot is reused after the completion.
+ * user_data of the completion path is the object with the tag in low bits.
+ */
+
+#ifndef EV_URING_SIZE
+#   define EV_URING_SIZE 1024
+#endif
+
+/* queued sends, above the limit the owner sends without the ring */
+#ifndef EV_URING_SEND_MAX
+#   define EV_URING_SEND_MAX 4096
+#endif
+
+#define EV_URING_CLOSE (POLLERR | POLLRDHUP)
+#define EV_URING_WAKEUP UINT64_MAX
+
+#define EV_URING_TAG_RECV 1
+#define EV_URING_TAG_SEND 2
+#define EV_URING_TAG_MASK 3
+
+#define EV_URING_RECV_MAX 32768 // buffers in the ring
+
+typedef struct
+{
+    uint8_t *buffer; // NULL if the id is free
+    size_t size;
+    void *opaque;
+} event_recv_slot_t;
+
+struct asc_event_recv_t
+{
+    int fd;
+    asc_event_recv_callback_t on_recv;
+    event_callback_t on_release;
+    event_callback_t on_error;
+    void *arg;
+
+    struct msghdr msg; // lengths of the name and the control data
+    uint16_t bgid;
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    uint16_t ring_tail;
+    uint16_t ring_mask;
+    int ring_count; // buffers in the kernel
+
+    /* buffers by the buffer id: io_uring_recvmsg_out, control and datagram */
+    event_recv_slot_t *slot;
+    uint16_t *slot_free;
+    int slot_free_count;
+
+    bool is_armed; // request is in the kernel
+    bool is_closed;
+
+    TAILQ_ENTRY(asc_event_recv_t) entries;
+};
+
+typedef struct event_send_t
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage addr;
+
+    asc_event_send_callback_t on_done;
+    void *arg;
+
+    uint8_t *buffer;
+    size_t capacity;
+
+    TAILQ_ENTRY(event_send_t) entries;
+} event_send_t;
+
+#define atomic_load(_ptr) __atomic_load_n(_ptr, __ATOMIC_ACQUIRE)
+#define atomic_store(_ptr, _val) __atomic_store_n(_ptr, _val, __ATOMIC_RELEASE)
+
+typedef struct
+{
+    TAILQ_HEAD(event_list_s, asc_event_t) event_list;
+    TAILQ_HEAD(closed_list_s, asc_event_t) closed_list;
+
+    /* completion path */
+    TAILQ_HEAD(recv_list_s, asc_event_recv_t) recv_closed_list;
+    TAILQ_HEAD(send_list_s, event_send_t) send_list; // queued
+    TAILQ_HEAD(send_free_s, event_send_t) send_free;
+    size_t send_count;
+    uint16_t bgid;
+
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_submit;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} event_observer_t;
+
+static event_observer_t event_observer;
+
+static int uring_enter(unsigned min_complete, unsigned flags, void *arg, size_t arg_size)
+{
+    const int ret = syscall(__NR_io_uring_enter, event_observer.fd
+                            , event_observer.sq_submit, min_complete
+                            , flags, arg, arg_size);
+    if(ret > 0)
+        event_observer.sq_submit -= ((unsigned)ret < event_observer.sq_submit)
+                                  ? (unsigned)ret
+                                  : event_observer.sq_submit;
+    return ret;
+}
+
+static struct io_uring_sqe * uring_sqe(void)
+{
+    const unsigned tail = *event_observer.sq_tail;
+    if(tail - atomic_load(event_observer.sq_head) >= event_observer.sq_entries)
+        uring_enter(0, 0, NULL, 0);
+
+    const unsigned index = tail & *event_observer.sq_mask;
+    struct io_uring_sqe *sqe = &event_observer.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    event_observer.sq_array[index] = index;
+    atomic_store(event_observer.sq_tail, tail + 1);
+    ++event_observer.sq_submit;
+
+    return sqe;
+}
+
+static void uring_poll_add(int fd, uint32_t mask, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    sqe->poll32_events = mask;
+    sqe->user_data = user_data;
+}
+
+void asc_event_core_init(void)
+{
+    memset(&event_observer, 0, sizeof(event_observer));
+    TAILQ_INIT(&event_observer.event_list);
+    TAILQ_INIT(&event_observer.closed_list);
+    TAILQ_INIT(&event_observer.recv_closed_list);
+    TAILQ_INIT(&event_observer.send_list);
+    TAILQ_INIT(&event_observer.send_free);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    /* completions of the datagrams and the sends of one iteration */
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = EV_URING_SIZE * 8;
+    event_observer.fd = syscall(__NR_io_uring_setup, EV_URING_SIZE, &params);
+    asc_assert(event_observer.fd != -1
+               , MSG("failed to init event observer [%s]")
+               , strerror(errno));
+    asc_assert(params.features & IORING_FEAT_EXT_ARG
+               , MSG("IORING_FEAT_EXT_ARG is not supported. Linux 5.11 required"));
+
+    event_observer.sq_entries = params.sq_entries;
+    event_observer.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    event_observer.cq_ring_size = params.cq_off.cqes
+                                + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(event_observer.cq_ring_size > event_observer.sq_ring_size)
+            event_observer.sq_ring_size = event_observer.cq_ring_size;
+        event_observer.cq_ring_size = 0;
+    }
+
+    event_observer.sq_ring = mmap(NULL, event_observer.sq_ring_size
+                                  , PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                                  , event_observer.fd, IORING_OFF_SQ_RING);
+    asc_assert(event_observer.sq_ring != MAP_FAILED
+               , MSG("failed to map submission ring [%s]"), strerror(errno));
+
+    event_observer.cq_ring = event_observer.sq_ring;
+    if(event_observer.cq_ring_size)
+    {
+        event_observer.cq_ring = mmap(NULL, event_observer.cq_ring_size
+                                      , PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                                      , event_observer.fd, IORING_OFF_CQ_RING);
+        asc_assert(event_observer.cq_ring != MAP_FAILED
+                   , MSG("failed to map completion ring [%s]"), strerror(errno));
+    }
+
+    event_observer.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    event_observer.sqes = (struct io_uring_sqe *)mmap(NULL, event_observer.sqes_size
+                                                      , PROT_READ | PROT_WRITE
+                                                      , MAP_SHARED | MAP_POPULATE
+                                                      , event_observer.fd, IORING_OFF_SQES);
+    asc_assert(event_observer.sqes != MAP_FAILED
+               , MSG("failed to map submission entries [%s]"), strerror(errno));
+
+    uint8_t *const sq = (uint8_t *)event_observer.sq_ring;
+    event_observer.sq_head = (unsigned *)(sq + params.sq_off.head);
+    event_observer.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    event_observer.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    event_observer.sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    uint8_t *const cq = (uint8_t *)event_observer.cq_ring;
+    event_observer.cq_head = (unsigned *)(cq + params.cq_off.head);
+    event_observer.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    event_observer.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    event_observer.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    asc_event_wakeup_open();
+    uring_poll_add(wakeup_fd[0], POLLIN, EV_URING_WAKEUP);
+}
+
+static void uring_recv_free(asc_event_recv_t *recv, bool is_registered)
+{
+    if(is_registered)
+    {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = recv->bgid;
+        syscall(__NR_io_uring_register, event_observer.fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    for(int i = 0; i <= recv->ring_mask; ++i)
+    {
+        if(recv->slot[i].buffer && recv->on_release)
+            recv->on_release(recv->slot[i].opaque);
+    }
+
+    munmap(recv->ring, recv->ring_size);
+    free(recv->slot);
+    free(recv->slot_free);
+    free(recv);
+}
+
+/* event is freed when the kernel has no references to it */
+static void asc_event_free_closed(bool is_all)
+{
+    asc_event_t *event, *next;
+    TAILQ_FOREACH_SAFE(event, &event_observer.closed_list, entries, next)
+    {
+        if(event->inflight == 0 || is_all)
+        {
+            TAILQ_REMOVE(&event_observer.closed_list, event, entries);
+            free(event);
+        }
+    }
+
+    asc_event_recv_t *recv, *recv_next;
+    TAILQ_FOREACH_SAFE(recv, &event_observer.recv_closed_list, entries, recv_next)
+    {
+        if(!recv->is_armed || is_all)
+        {
+            TAILQ_REMOVE(&event_observer.recv_closed_list, recv, entries);
+            uring_recv_free(recv, !is_all);
+        }
+    }
+}
+
+static void uring_send_free(void)
+{
+    event_send_t *send;
+    while((send = TAILQ_FIRST(&event_observer.send_list)) != NULL)
+    {
+        TAILQ_REMOVE(&event_observer.send_list, send, entries);
+        TAILQ_INSERT_TAIL(&event_observer.send_free, send, entries);
+    }
+    while((send = TAILQ_FIRST(&event_observer.send_free)) != NULL)
+    {
+        TAILQ_REMOVE(&event_observer.send_free, send, entries);
+        free(send->buffer);
+        free(send);
+    }
+    event_observer.send_count = 0;
+}
+
+void asc_event_core_destroy(void)
+{
+    if(!event_observer.fd)
+        return;
+
+    asc_event_t *prev_event = NULL;
+    asc_event_t *event;
+    while((event = TAILQ_FIRST(&event_observer.event_list)) != NULL)
+    {
+        asc_assert(event != prev_event
+                   , MSG("loop on asc_event_core_destroy() event:%p")
+                   , (void *)event);
+        if(event->on_error)
+            event->on_error(event->arg);
+        prev_event = event;
+    }
+
+    munmap(event_observer.sqes, event_observer.sqes_size);
+    if(event_observer.cq_ring_size)
+        munmap(event_observer.cq_ring, event_observer.cq_ring_size);
+    munmap(event_observer.sq_ring, event_observer.sq_ring_size);
+    close(event_observer.fd);
+    event_observer.fd = 0;
+
+    /* completions of the polls are not expected anymore */
+    asc_event_free_closed(true);
+    uring_send_free();
+
+    asc_event_wakeup_close();
+}
+
+static void asc_event_subscribe(asc_event_t *event)
+{
+    uint32_t mask = EV_URING_CLOSE;
+    if(event->on_read)
+        mask |= POLLIN;
+    if(event->on_write)
+        mask |= POLLOUT;
+
+    if(event->is_armed)
+    {
+        if(event->mask == mask)
+            return;
+
+        struct io_uring_sqe *sqe = uring_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)event;
+    }
+
+    uring_poll_add(event->fd, mask, (uintptr_t)event);
+    event->mask = mask;
+    event->is_armed = true;
+    ++event->inflight;
+}
+
+static void uring_recv_arm(asc_event_recv_t *recv)
+{
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = recv->fd;
+    sqe->addr = (uintptr_t)&recv->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = recv->bgid;
+    sqe->user_data = (uintptr_t)recv | EV_URING_TAG_RECV;
+    recv->is_armed = true;
+}
+
+static void uring_recv_complete(asc_event_recv_t *recv, int res, uint32_t flags)
+{
+    if(!(flags & IORING_CQE_F_MORE))
+        recv->is_armed = false;
+
+    if(flags & IORING_CQE_F_BUFFER)
+    {
+        const uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        const event_recv_slot_t slot = recv->slot[bid];
+        recv->slot[bid].buffer = NULL;
+        recv->slot_free[recv->slot_free_count++] = bid;
+        --recv->ring_count;
+
+        const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)slot.buffer;
+        const size_t skip = sizeof(*out) + recv->msg.msg_namelen + recv->msg.msg_controllen;
+
+        if(recv->is_closed)
+        {
+            if(recv->on_release)
+                recv->on_release(slot.opaque);
+        }
+        else if(res >= (int)skip)
+        {
+            /* truncated datagram: payloadlen is the size of the datagram */
+            size_t size = res - skip;
+            if(out->payloadlen < size)
+                size = out->payloadlen;
+
+            /* buffer goes to the owner */
+            is_main_loop_idle = false;
+            recv->on_recv(  recv->arg, slot.opaque, &slot.buffer[skip], size
+                          , &slot.buffer[sizeof(*out) + recv->msg.msg_namelen], out->controllen);
+        }
+        else
+            asc_event_recv_provide(recv, slot.buffer, slot.size, slot.opaque);
+    }
+
+    if(recv->is_closed || recv->is_armed)
+        return;
+
+    /* ENOBUFS - the ring is empty */
+    if(res < 0 && res != -ENOBUFS && res != -EINTR && res != -EAGAIN)
+    {
+        is_main_loop_idle = false;
+        recv->on_error(recv->arg);
+        if(recv->is_closed)
+            return;
+    }
+
+    /* the empty ring is armed by the next asc_event_recv_provide() */
+    if(recv->ring_count > 0)
+        uring_recv_arm(recv);
+}
+
+static void uring_send_complete(event_send_t *send, int res)
+{
+    TAILQ_REMOVE(&event_observer.send_list, send, entries);
+    TAILQ_INSERT_HEAD(&event_observer.send_free, send, entries);
+    --event_observer.send_count;
+
+    if(send->on_done)
+        send->on_done(send->arg, res);
+}
+
+void asc_event_core_loop(unsigned int timeout)
+{
+    struct __kernel_timespec ts =
+    {
+        .tv_sec = timeout / 1000,
+        .tv_nsec = (timeout % 1000) * 1000000,
+    };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uintptr_t)&ts;
+
+    const int ret = uring_enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG
+                                , &arg, sizeof(arg));
+    asc_clock_update();
+
+    if(ret == -1)
+    {
+        asc_assert(errno == EINTR || errno == ETIME || errno == EBUSY || errno == EAGAIN
+                   , MSG("event observer critical error [%s]"), strerror(errno));
+    }
+
+    unsigned head = *event_observer.cq_head;
+    const unsigned tail = atomic_load(event_observer.cq_tail);
+    asc_loopstat_begin((int)(tail - head));
+
+    for(; head != tail; ++head)
+    {
+        const struct io_uring_cqe *cqe = &event_observer.cqes[head & *event_observer.cq_mask];
+        const uint64_t user_data = cqe->user_data;
+        const int res = cqe->res;
+        const uint32_t flags = cqe->flags;
+        atomic_store(event_observer.cq_head, head + 1);
+
+        if(user_data == EV_URING_WAKEUP)
+        {
+            asc_event_wakeup_drain();
+            uring_poll_add(wakeup_fd[0], POLLIN, EV_URING_WAKEUP);
+            continue;
+        }
+
+        switch(user_data & EV_URING_TAG_MASK)
+        {
+            case EV_URING_TAG_RECV:
+                uring_recv_complete(  (asc_event_recv_t *)(uintptr_t)(user_data & ~EV_URING_TAG_MASK)
+                                    , res, flags);
+                continue;
+            case EV_URING_TAG_SEND:
+                uring_send_complete(  (event_send_t *)(uintptr_t)(user_data & ~EV_URING_TAG_MASK)
+                                    , res);
+                continue;
+            default:
+                break;
+        }
+
+        asc_event_t *event = (asc_event_t *)(uintptr_t)user_data;
+        if(!event)
+            continue; /* poll remove */
+
+        --event->inflight;
+        if(event->inflight > 0 || event->is_closed)
+            continue;
+        event->is_armed = false;
+
+        const bool is_rd = (res > 0) && (res & POLLIN);
+        const bool is_wr = (res > 0) && (res & POLLOUT);
+        const bool is_er = (res < 0 && res != -ECANCELED) || (res > 0 && (res & EV_URING_CLOSE));
+
+        /* callbacks of the closed event are cleared */
+        if(event->on_read && is_rd)
+        {
+            is_main_loop_idle = false;
+            event->on_read(event->arg);
+        }
+        if(event->on_error && is_er)
+        {
+            is_main_loop_idle = false;
+            event->on_error(event->arg);
+        }
+        if(event->on_write && is_wr)
+        {
+            is_main_loop_idle = false;
+            event->on_write(event->arg);
+        }
+
+        if(!event->is_closed)
+            asc_event_subscribe(event);
+    }
+
+    asc_event_free_closed(false);
+}
+
+asc_event_t * asc_event_init(int fd, void *arg)
+{
+    asc_event_t *event = (asc_event_t *)calloc(1, sizeof(asc_event_t));
+    event->fd = fd;
+    event->arg = arg;
+
+    TAILQ_INSERT_TAIL(&event_observer.event_list, event, entries);
+    asc_event_subscribe(event);
+
+    return event;
+}
+
+void asc_event_close(asc_event_t *event)
+{
+    if(!event)
+        return;
+
+    if(event->is_armed)
+    {
+        struct io_uring_sqe *sqe = uring_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)event;
+        event->is_armed = false;
+    }
+
+    event->is_closed = true;
+    event->on_read = NULL;
+    event->on_write = NULL;
+    event->on_error = NULL;
+
+    TAILQ_REMOVE(&event_observer.event_list, event, entries);
+    TAILQ_INSERT_TAIL(&event_observer.closed_list, event, entries);
+}
+
+asc_event_recv_t * asc_event_recv_init(  int fd, int count, size_t headroom
+                                       , asc_event_recv_callback_t on_recv
+                                       , event_callback_t on_release
+                                       , event_callback_t on_error, void *arg)
+{
+    asc_assert(headroom > sizeof(struct io_uring_recvmsg_out)
+               , "[core/event] headroom is too small for the receive metadata");
+
+    int entries = 1;
+    while(entries < count && entries < EV_URING_RECV_MAX)
+        entries *= 2;
+
+    asc_event_recv_t *recv = (asc_event_recv_t *)calloc(1, sizeof(asc_event_recv_t));
+    recv->fd = fd;
+    recv->on_recv = on_recv;
+    recv->on_release = on_release;
+    recv->on_error = on_error;
+    recv->arg = arg;
+    recv->msg.msg_controllen = headroom - sizeof(struct io_uring_recvmsg_out);
+    recv->ring_mask = entries - 1;
+
+    recv->ring_size = entries * sizeof(struct io_uring_buf);
+    recv->ring = (struct io_uring_buf_ring *)mmap(  NULL, recv->ring_size
+                                                  , PROT_READ | PROT_WRITE
+                                                  , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(recv->ring == MAP_FAILED)
+    {
+        free(recv);
+        return NULL;
+    }
+
+    /* group id is free after the unregister of the closed ring */
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)recv->ring;
+    reg.ring_entries = entries;
+    int ret = -1;
+    for(int i = 0; i < 16 && ret == -1; ++i)
+    {
+        reg.bgid = event_observer.bgid++;
+        ret = syscall(__NR_io_uring_register, event_observer.fd
+                      , IORING_REGISTER_PBUF_RING, &reg, 1);
+        if(ret == -1 && errno != EEXIST)
+            break;
+    }
+    if(ret == -1)
+    {
+        asc_log_debug(MSG("provided buffer ring is not supported [%s]"), strerror(errno));
+        munmap(recv->ring, recv->ring_size);
+        free(recv);
+        return NULL;
+    }
+    recv->bgid = reg.bgid;
+
+    recv->slot = (event_recv_slot_t *)calloc(entries, sizeof(event_recv_slot_t));
+    recv->slot_free = (uint16_t *)malloc(entries * sizeof(uint16_t));
+    for(int i = entries - 1; i >= 0; --i)
+        recv->slot_free[recv->slot_free_count++] = i;
+
+    return recv;
+}
+
+/* size - buffer with the headroom. the request is armed with the first buffer */
+void asc_event_recv_provide(asc_event_recv_t *recv, void *buffer, size_t size, void *opaque)
 {
-    int fd;
-    event_callback_t on_read;
-    event_callback_t on_write;
-    event_callback_t on_error;
-    void *arg;
-};
+    asc_assert(recv->slot_free_count > 0, "[core/event] receive ring is full");
+
+    const uint16_t bid = recv->slot_free[--recv->slot_free_count];
+    event_recv_slot_t *const slot = &recv->slot[bid];
+    slot->buffer = (uint8_t *)buffer;
+    slot->size = size;
+    slot->opaque = opaque;
+
+    struct io_uring_buf *buf = &recv->ring->bufs[recv->ring_tail & recv->ring_mask];
+    buf->addr = (uintptr_t)buffer;
+    buf->len = size;
+    buf->bid = bid;
+    ++recv->ring_tail;
+    atomic_store(&recv->ring->tail, recv->ring_tail);
+    ++recv->ring_count;
+
+    if(!recv->is_armed && !recv->is_closed)
+        uring_recv_arm(recv);
+}
+
+void asc_event_recv_close(asc_event_recv_t *recv)
+{
+    if(!recv)
+        return;
+
+    if(recv->is_armed)
+    {
+        struct io_uring_sqe *sqe = uring_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)recv | EV_URING_TAG_RECV;
+    }
+
+    recv->is_closed = true;
+    TAILQ_INSERT_TAIL(&event_observer.recv_closed_list, recv, entries);
+}
+
+/*
+ * Sends of the socket are submitted in order. The kernel waits for the
+ * space in the send buffer instead of EAGAIN, so the datagram may leave
+ * after the next one of the same socket only under the overflow
+ */
+bool asc_event_sendto(  int fd, const void *buffer, size_t size
+                      , const void *addr, size_t addr_size
+                      , asc_event_send_callback_t on_done, void *arg)
+{
+    if(event_observer.send_count >= EV_URING_SEND_MAX || addr_size > sizeof(struct sockaddr_storage))
+        return false;
+
+    event_send_t *send = TAILQ_FIRST(&event_observer.send_free);
+    if(send)
+        TAILQ_REMOVE(&event_observer.send_free, send, entries);
+    else
+        send = (event_send_t *)calloc(1, sizeof(event_send_t));
+
+    if(send->capacity < size)
+    {
+        free(send->buffer);
+        send->buffer = (uint8_t *)malloc(size);
+        send->capacity = size;
+    }
+    memcpy(send->buffer, buffer, size);
+    memcpy(&send->addr, addr, addr_size);
+
+    send->iov.iov_base = send->buffer;
+    send->iov.iov_len = size;
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_name = &send->addr;
+    send->msg.msg_namelen = addr_size;
+    send->msg.msg_iov = &send->iov;
+    send->msg.msg_iovlen = 1;
+    send->on_done = on_done;
+    send->arg = arg;
+
+    TAILQ_INSERT_TAIL(&event_observer.send_list, send, entries);
+    ++event_observer.send_count;
+
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)&send->msg;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t)send | EV_URING_TAG_SEND;
+
+    return true;
+}
 
-#if defined(EV_TYPE_KQUEUE) || defined(EV_TYPE_EPOLL)
+void asc_event_send_detach(void *arg)
+{
+    event_send_t *send;
+    TAILQ_FOREACH(send, &event_observer.send_list, entries)
+    {
+        if(send->arg == arg)
+            send->on_done = NULL;
+    }
+}
+
+#elif defined(EV_TYPE_KQUEUE) || defined(EV_TYPE_EPOLL)
 
 /*
  * ooooooooooo oooooooooo    ooooooo  ooooo       ooooo
@@ -84,19 +913,87 @@ struct asc_event_t
 
 typedef struct
 {
-    asc_list_t *event_list;
-    bool is_changed;
+    TAILQ_HEAD(event_list_s, asc_event_t) event_list;
+
+    /*
+     * closed events are freed after the batch of the kernel events,
+     * so the batch may point to them and is processed to the end
+     */
+    TAILQ_HEAD(closed_list_s, asc_event_t) closed_list;
+
+    /* writable edge events with on_write, called without the kernel */
+    TAILQ_HEAD(pending_list_s, asc_event_t) pending_list;
+    size_t pending_count;
 
     int fd;
     EV_OTYPE ed_list[EV_LIST_SIZE];
+
+    /* control events left for the next iteration, see EV_CONTROL_BUDGET */
+    uint64_t control_deferred;
+
+#if defined(EV_TYPE_KQUEUE)
+    /* filter changes, submitted with the next wait */
+    struct kevent change_list[EV_LIST_SIZE];
+    int change_count;
+#endif
 } event_observer_t;
 
 static event_observer_t event_observer;
 
+#if defined(EV_TYPE_KQUEUE)
+
+/*
+ * kqueue filters of the event in asc_event_t.mask. The write filter is
+ * EV_CLEAR | EV_DISPATCH: disabled by the kernel on the delivery and
+ * enabled again with the changelist, the changes of the loop pass cost
+ * no syscall.
+ */
+
+#define EV_KQ_READ      0x01 // read filter is added
+#define EV_KQ_WRITE     0x02 // write filter is added
+#define EV_KQ_WRITE_ON  0x04 // write filter is enabled
+
+static void kqueue_flush(void)
+{
+    const int ret = kevent(event_observer.fd
+                           , event_observer.change_list, event_observer.change_count
+                           , NULL, 0, NULL);
+    event_observer.change_count = 0;
+    asc_assert(ret != -1, MSG("failed to apply changelist [%s]"), strerror(errno));
+}
+
+static void kqueue_change(asc_event_t *event, int filter, int flags)
+{
+    if(event_observer.change_count == EV_LIST_SIZE)
+        kqueue_flush();
+
+    struct kevent *ed = &event_observer.change_list[event_observer.change_count++];
+    EV_SET(ed, event->fd, filter, flags, 0, 0, event);
+}
+
+/* the changes are dropped on close, the fd number may be reused */
+static void kqueue_change_drop(asc_event_t *event)
+{
+    int count = 0;
+    for(int i = 0; i < event_observer.change_count; ++i)
+    {
+        if(event_observer.change_list[i].udata == (void *)event)
+            continue;
+        if(count != i)
+            event_observer.change_list[count] = event_observer.change_list[i];
+        ++count;
+    }
+    event_observer.change_count = count;
+}
+
+#endif /* EV_TYPE_KQUEUE */
+
 void asc_event_core_init(void)
 {
     memset(&event_observer, 0, sizeof(event_observer));
-    event_observer.event_list = asc_list_init();
+    TAILQ_INIT(&event_observer.event_list);
+    TAILQ_INIT(&event_observer.pending_list);
+    TAILQ_INIT(&event_observer.closed_list);
 
 #if defined(EV_TYPE_KQUEUE)
     event_observer.fd = kqueue();
@@ -107,6 +1004,29 @@ void asc_event_core_init(void)
     asc_assert(event_observer.fd != -1
                , MSG("failed to init event observer [%s]")
                , strerror(errno));
+
+    asc_event_wakeup_open();
+
+    EV_OTYPE ed;
+#if defined(EV_TYPE_KQUEUE)
+    EV_SET(&ed, wakeup_fd[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+    const int ret = kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
+#else
+    ed.data.ptr = NULL;
+    ed.events = EPOLLIN;
+    const int ret = epoll_ctl(event_observer.fd, EPOLL_CTL_ADD, wakeup_fd[0], &ed);
+#endif
+    asc_assert(ret != -1, MSG("failed to attach wakeup fd [%s]"), strerror(errno));
+}
+
+static void asc_event_free_closed(void)
+{
+    asc_event_t *event;
+    while((event = TAILQ_FIRST(&event_observer.closed_list)) != NULL)
+    {
+        TAILQ_REMOVE(&event_observer.closed_list, event, entries);
+        free(event);
+    }
 }
 
 void asc_event_core_destroy(void)
@@ -117,12 +1037,12 @@ void asc_event_core_destroy(void)
     close(event_observer.fd);
     event_observer.fd = 0;
 
+    asc_event_wakeup_close();
+
     asc_event_t *prev_event = NULL;
-    for(asc_list_first(event_observer.event_list)
-        ; !asc_list_eol(event_observer.event_list)
-        ; asc_list_first(event_observer.event_list))
+    asc_event_t *event;
+    while((event = TAILQ_FIRST(&event_observer.event_list)) != NULL)
     {
-        asc_event_t *event = (asc_event_t *)asc_list_data(event_observer.event_list);
         asc_assert(event != prev_event
                    , MSG("loop on asc_event_core_destroy() event:%p")
                    , (void *)event);
@@ -131,117 +1051,255 @@ void asc_event_core_destroy(void)
         prev_event = event;
     }
 
-    asc_list_destroy(event_observer.event_list);
-    event_observer.event_list = NULL;
+    asc_event_free_closed();
 }
 
-void asc_event_core_loop(void)
+static void asc_event_subscribe(asc_event_t *event);
+
+static void asc_event_pending(asc_event_t *event)
 {
-    if(!asc_list_size(event_observer.event_list))
+    const bool is_pending = (event->is_writable && event->on_write != NULL);
+    if(is_pending == event->is_pending)
+        return;
+
+    event->is_pending = is_pending;
+    if(is_pending)
+    {
+        TAILQ_INSERT_TAIL(&event_observer.pending_list, event, pending_entries);
+        ++event_observer.pending_count;
+    }
+    else
+    {
+        TAILQ_REMOVE(&event_observer.pending_list, event, pending_entries);
+        --event_observer.pending_count;
+    }
+}
+
+/* one pass over the events pending before the call, the list is changed by callbacks */
+static void asc_event_pending_loop(void)
+{
+    size_t count = event_observer.pending_count;
+    while(count-- > 0)
+    {
+        asc_event_t *event = TAILQ_FIRST(&event_observer.pending_list);
+        if(!event)
+            break;
+
+        TAILQ_REMOVE(&event_observer.pending_list, event, pending_entries);
+        TAILQ_INSERT_TAIL(&event_observer.pending_list, event, pending_entries);
+
+        is_main_loop_idle = false;
+        event->on_write(event->arg);
+    }
+}
+
+static void asc_event_dispatch(EV_OTYPE *ed)
+{
+#if defined(EV_TYPE_KQUEUE)
+    asc_event_t *event = (asc_event_t *)ed->udata;
+    if(!event)
+    {
+        asc_event_wakeup_drain();
+        return;
+    }
+    if(ed->flags & EV_ERROR)
+    {
+        /* failed change of the changelist, ignored if the event is closed */
+        asc_assert(event->is_closed
+                   , MSG("failed to set fd=%d [%s]"), event->fd, strerror((int)ed->data));
+        return;
+    }
+    if(ed->filter == EVFILT_WRITE)
+        event->mask &= ~EV_KQ_WRITE_ON;
+    const bool is_rd = (ed->data > 0) && (ed->filter == EVFILT_READ);
+    const bool is_wr = (ed->data > 0) && (ed->filter == EVFILT_WRITE);
+    const bool is_er = (ed->flags & EV_EOF) && (!is_rd || is_wr);
+#else
+    asc_event_t *event = (asc_event_t *)ed->data.ptr;
+    if(!event)
+    {
+        asc_event_wakeup_drain();
+        return;
+    }
+    const bool is_rd = ed->events & EPOLLIN;
+    const bool is_wr = ed->events & EPOLLOUT;
+    const bool is_er = ed->events & EPOLLCLOSE;
+#endif
+    /* callbacks of the closed event are cleared */
+    if(event->on_read && is_rd)
+    {
+        is_main_loop_idle = false;
+        event->on_read(event->arg);
+    }
+    if(event->on_error && is_er)
+    {
+        is_main_loop_idle = false;
+        event->on_error(event->arg);
+    }
+    if(event->is_closed)
         return;
+    if(event->is_edge && is_wr)
+    {
+        /* called with the pending events */
+        event->is_writable = true;
+        asc_event_subscribe(event);
+    }
+    else if(event->on_write && is_wr)
+    {
+        is_main_loop_idle = false;
+        event->on_write(event->arg);
+    }
+#if defined(EV_TYPE_KQUEUE)
+    /* enables the dispatched write filter */
+    if(ed->filter == EVFILT_WRITE && !event->is_closed)
+        asc_event_subscribe(event);
+#endif
+}
+
+static inline asc_event_priority_t asc_event_ed_priority(const EV_OTYPE *ed)
+{
+#if defined(EV_TYPE_KQUEUE)
+    const asc_event_t *event = (const asc_event_t *)ed->udata;
+#else
+    const asc_event_t *event = (const asc_event_t *)ed->data.ptr;
+#endif
+    /* wakeup channel is drained with the input */
+    return (event) ? event->priority : ASC_EVENT_INPUT;
+}
+
+void asc_event_core_loop(unsigned int timeout)
+{
+    if(event_observer.pending_count)
+        timeout = 0;
 
 #if defined(EV_TYPE_KQUEUE)
-    static const struct timespec timeout = { 0, 0 };
-    const int ret = kevent(event_observer.fd, NULL, 0
-                           , event_observer.ed_list, EV_LIST_SIZE, &timeout);
+    const struct timespec ts =
+    {
+        .tv_sec = timeout / 1000,
+        .tv_nsec = (timeout % 1000) * 1000000,
+    };
+    const int ret = kevent(event_observer.fd
+                           , event_observer.change_list, event_observer.change_count
+                           , event_observer.ed_list, EV_LIST_SIZE, &ts);
+    event_observer.change_count = 0;
 #else
-    const int ret = epoll_wait(event_observer.fd, event_observer.ed_list, EV_LIST_SIZE, 0);
+    const int ret = epoll_wait(event_observer.fd, event_observer.ed_list, EV_LIST_SIZE
+                               , (int)timeout);
 #endif
 
+    asc_clock_update();
+    asc_loopstat_begin(ret);
+
     if(ret == -1)
     {
         asc_assert(errno == EINTR, MSG("event observer critical error [%s]"), strerror(errno));
         return;
     }
 
-    event_observer.is_changed = false;
+    /*
+     * data-plane input first, then output, then control. control events
+     * out of the budget are left in the kernel: level-triggered events are
+     * reported again on the next wait
+     */
+    int count[ASC_EVENT_PRIORITY_COUNT] = { 0 };
     for(int i = 0; i < ret; ++i)
+        ++count[asc_event_ed_priority(&event_observer.ed_list[i])];
+
+    static const asc_event_priority_t order[] =
+    {
+        ASC_EVENT_INPUT, ASC_EVENT_OUTPUT, ASC_EVENT_CONTROL,
+    };
+
+    uint64_t control_start = 0;
+    for(size_t p = 0; p < ASC_ARRAY_SIZE(order); ++p)
     {
-        EV_OTYPE *ed = &event_observer.ed_list[i];
+        const asc_event_priority_t priority = order[p];
+        if(!count[priority])
+            continue;
+
+        if(priority == ASC_EVENT_CONTROL)
+            control_start = asc_utime();
+
+        for(int i = 0; i < ret && count[priority] > 0; ++i)
+        {
+            EV_OTYPE *ed = &event_observer.ed_list[i];
+            if(asc_event_ed_priority(ed) != priority)
+                continue;
+            --count[priority];
+
+            if(   priority == ASC_EVENT_CONTROL
+               && asc_utime() - control_start >= EV_CONTROL_BUDGET
 #if defined(EV_TYPE_KQUEUE)
-        asc_event_t *event = (asc_event_t *)ed->udata;
-        const bool is_rd = (ed->data > 0) && (ed->filter == EVFILT_READ);
-        const bool is_wr = (ed->data > 0) && (ed->filter == EVFILT_WRITE);
-        const bool is_er = (ed->flags & ~EV_ADD) && (!is_rd || is_wr);
-#else
-        asc_event_t *event = (asc_event_t *)ed->data.ptr;
-        const bool is_rd = ed->events & EPOLLIN;
-        const bool is_wr = ed->events & EPOLLOUT;
-        const bool is_er = ed->events & EPOLLCLOSE;
+               /* the write filter is disabled on the delivery */
+               && ed->filter != EVFILT_WRITE
 #endif
-        if(event->on_read && is_rd)
-        {
-            is_main_loop_idle = false;
-            event->on_read(event->arg);
-            if(event_observer.is_changed)
-                break;
-        }
-        if(event->on_error && is_er)
-        {
-            is_main_loop_idle = false;
-            event->on_error(event->arg);
-            if(event_observer.is_changed)
-                break;
-        }
-        if(event->on_write && is_wr)
-        {
-            is_main_loop_idle = false;
-            event->on_write(event->arg);
-            if(event_observer.is_changed)
-                break;
+               )
+            {
+                ++event_observer.control_deferred;
+                is_main_loop_idle = false;
+                continue;
+            }
+
+            asc_event_dispatch(ed);
         }
     }
+
+    asc_event_pending_loop();
+    asc_event_free_closed();
 }
 
 static void asc_event_subscribe(asc_event_t *event)
 {
-    int ret = 0;
-    EV_OTYPE ed;
+    asc_event_pending(event);
 
 #if defined(EV_TYPE_KQUEUE)
-    do
+    uint32_t mask = event->mask;
+
+    if(event->on_read && !(mask & EV_KQ_READ))
     {
-        if(event->on_read)
-        {
-            EV_SET(&ed, event->fd, EVFILT_READ, EV_ADD | EV_EOF | EV_ERROR, 0, 0, event);
-            ret = kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
-            if(ret == -1)
-                break;
-        }
-        else
-        {
-            EV_SET(&ed, event->fd, EVFILT_READ, EV_DELETE, 0, 0, event);
-            kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
-        }
+        kqueue_change(event, EVFILT_READ, EV_ADD);
+        mask |= EV_KQ_READ;
+    }
+    else if(!event->on_read && (mask & EV_KQ_READ))
+    {
+        kqueue_change(event, EVFILT_READ, EV_DELETE);
+        mask &= ~EV_KQ_READ;
+    }
 
-        if(event->on_write)
-        {
-            EV_SET(&ed, event->fd, EVFILT_WRITE, EV_ADD | EV_EOF | EV_ERROR, 0, 0, event);
-            ret = kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
-            if(ret == -1)
-                break;
-        }
-        else
-        {
-            EV_SET(&ed, event->fd, EVFILT_WRITE, EV_DELETE, 0, 0, event);
-            kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
-        }
+    /* the write filter is not deleted, the toggle of on_write is the flag change */
+    const bool is_write = (event->on_write && !event->is_writable);
+    if(is_write && !(mask & EV_KQ_WRITE_ON))
+    {
+        kqueue_change(event, EVFILT_WRITE, (mask & EV_KQ_WRITE)
+                                           ? EV_ENABLE
+                                           : (EV_ADD | EV_CLEAR | EV_DISPATCH));
+        mask |= EV_KQ_WRITE | EV_KQ_WRITE_ON;
+    }
+    else if(!is_write && (mask & EV_KQ_WRITE_ON))
+    {
+        kqueue_change(event, EVFILT_WRITE, EV_DISABLE);
+        mask &= ~EV_KQ_WRITE_ON;
+    }
 
-        return;
-    } while(0);
+    event->mask = mask;
 
 #else /* EV_TYPE_EPOLL */
 
+    EV_OTYPE ed;
     ed.data.ptr = event;
     ed.events = EPOLLCLOSE;
     if(event->on_read)
         ed.events |= EPOLLIN;
-    if(event->on_write)
+    if(event->on_write && !event->is_writable)
         ed.events |= EPOLLOUT;
-    ret = epoll_ctl(event_observer.fd, EPOLL_CTL_MOD, event->fd, &ed);
-#endif
 
+    if(ed.events == event->mask)
+        return;
+
+    event->mask = ed.events;
+    const int ret = epoll_ctl(event_observer.fd, EPOLL_CTL_MOD, event->fd, &ed);
     asc_assert(ret != -1, MSG("failed to set fd=%d [%s]"), event->fd, strerror(errno));
+#endif
 }
 
 asc_event_t * asc_event_init(int fd, void *arg)
@@ -256,10 +1314,10 @@ asc_event_t * asc_event_init(int fd, void *arg)
     ed.events = EPOLLCLOSE;
     const int ret = epoll_ctl(event_observer.fd, EPOLL_CTL_ADD, event->fd, &ed);
     asc_assert(ret != -1, MSG("failed to attach fd=%d [%s]"), event->fd, strerror(errno));
+    event->mask = ed.events;
 #endif
 
-    asc_list_insert_tail(event_observer.event_list, event);
-    event_observer.is_changed = true;
+    TAILQ_INSERT_TAIL(&event_observer.event_list, event, entries);
 
     return event;
 }
@@ -270,28 +1328,39 @@ void asc_event_close(asc_event_t *event)
         return;
 
 #if defined(EV_TYPE_KQUEUE)
-    EV_OTYPE ed;
+    kqueue_change_drop(event);
 
-    if(event->on_read)
+    EV_OTYPE ed[2];
+    int count = 0;
+    if(event->mask & EV_KQ_READ)
     {
-        EV_SET(&ed, event->fd, EVFILT_READ, EV_DELETE, 0, 0, event);
-        kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
+        EV_SET(&ed[count], event->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        ++count;
     }
-    if(event->on_write)
+    if(event->mask & EV_KQ_WRITE)
     {
-        EV_SET(&ed, event->fd, EVFILT_WRITE, EV_DELETE, 0, 0, event);
-        kevent(event_observer.fd, &ed, 1, NULL, 0, NULL);
+        EV_SET(&ed[count], event->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        ++count;
     }
+    if(count > 0)
+        kevent(event_observer.fd, ed, count, NULL, 0, NULL);
+    event->mask = 0;
 
 #else /* EV_TYPE_EPOLL */
 
     epoll_ctl(event_observer.fd, EPOLL_CTL_DEL, event->fd, NULL);
 #endif
 
-    event_observer.is_changed = true;
-    asc_list_remove_item(event_observer.event_list, event);
+    event->is_writable = false;
+    asc_event_pending(event);
 
-    free(event);
+    event->is_closed = true;
+    event->on_read = NULL;
+    event->on_write = NULL;
+    event->on_error = NULL;
+
+    TAILQ_REMOVE(&event_observer.event_list, event, entries);
+    TAILQ_INSERT_TAIL(&event_observer.closed_list, event, entries);
 }
 
 #elif defined(EV_TYPE_POLL)
@@ -311,7 +1380,8 @@ typedef struct
     bool is_changed;
     int fd_count;
 
-    struct pollfd fd_list[EV_LIST_SIZE];
+    /* last item is reserved for the wakeup channel */
+    struct pollfd fd_list[EV_LIST_SIZE + 1];
 } event_observer_t;
 
 #define ED_SIZE (int)(sizeof(struct pollfd))
@@ -321,10 +1391,13 @@ static event_observer_t event_observer;
 void asc_event_core_init(void)
 {
     memset(&event_observer, 0, sizeof(event_observer));
+    asc_event_wakeup_open();
 }
 
 void asc_event_core_destroy(void)
 {
+    asc_event_wakeup_close();
+
     while(event_observer.fd_count > 0)
     {
         const int next_fd_count = event_observer.fd_count - 1;
@@ -339,18 +1412,28 @@ void asc_event_core_destroy(void)
     }
 }
 
-void asc_event_core_loop(void)
+void asc_event_core_loop(unsigned int timeout)
 {
-    if(!event_observer.fd_count)
-        return;
-
-    int ret = poll(event_observer.fd_list, event_observer.fd_count, 10);
+    struct pollfd *const wakeup = &event_observer.fd_list[event_observer.fd_count];
+    wakeup->fd = wakeup_fd[0];
+    wakeup->events = POLLIN;
+    wakeup->revents = 0;
+
+    int ret = poll(event_observer.fd_list, event_observer.fd_count + 1, (int)timeout);
+    asc_clock_update();
+    asc_loopstat_begin(ret);
     if(ret == -1)
     {
         asc_assert(errno == EINTR, MSG("event observer critical error [%s]"), strerror(errno));
         return;
     }
 
+    if(wakeup->revents)
+    {
+        --ret;
+        asc_event_wakeup_drain();
+    }
+
     event_observer.is_changed = false;
     for(int i = 0; i < event_observer.fd_count && ret > 0; ++i)
     {
@@ -496,10 +1579,20 @@ void asc_event_core_destroy(void)
     event_observer.event_list = NULL;
 }
 
-void asc_event_core_loop(void)
+void asc_event_core_loop(unsigned int timeout)
 {
+    /* without wakeup channel thread buffers have to be polled */
+    if(timeout > 1)
+        timeout = 1;
+
     if(!asc_list_size(event_observer.event_list))
+    {
+        if(timeout > 0)
+            asc_usleep(timeout * 1000);
+        asc_clock_update();
+        asc_loopstat_begin(0);
         return;
+    }
 
     fd_set rset;
     fd_set wset;
@@ -508,8 +1601,10 @@ void asc_event_core_loop(void)
     memcpy(&wset, &event_observer.wmaster, sizeof(wset));
     memcpy(&eset, &event_observer.emaster, sizeof(eset));
 
-    static struct timeval timeout = { .tv_sec = 0, .tv_usec = 0 };
-    const int ret = select(event_observer.max_fd + 1, &rset, &wset, &eset, &timeout);
+    struct timeval tv = { .tv_sec = 0, .tv_usec = timeout * 1000 };
+    const int ret = select(event_observer.max_fd + 1, &rset, &wset, &eset, &tv);
+    asc_clock_update();
+    asc_loopstat_begin(ret);
     if(ret == -1)
     {
 #ifdef _WIN32
@@ -660,3 +1755,77 @@ void asc_event_set_on_error(asc_event_t *event, event_callback_t on_error)
     event->on_error = on_error;
     asc_event_subscribe(event);
 }
+
+void asc_event_set_priority(asc_event_t *event, asc_event_priority_t priority)
+{
+    event->priority = priority;
+}
+
+void asc_event_set_edge(asc_event_t *event)
+{
+#if defined(EV_TYPE_EPOLL)
+    event->is_edge = true;
+#else
+    __uarg(event);
+#endif
+}
+
+void asc_event_write_blocked(asc_event_t *event)
+{
+    if(!event->is_writable)
+        return;
+
+    event->is_writable = false;
+    asc_event_subscribe(event);
+}
+
+#ifndef EV_TYPE_URING
+
+asc_event_recv_t * asc_event_recv_init(  int fd, int count, size_t headroom
+                                       , asc_event_recv_callback_t on_recv
+                                       , event_callback_t on_release
+                                       , event_callback_t on_error, void *arg)
+{
+    __uarg(fd);
+    __uarg(count);
+    __uarg(headroom);
+    __uarg(on_recv);
+    __uarg(on_release);
+    __uarg(on_error);
+    __uarg(arg);
+    return NULL;
+}
+
+void asc_event_recv_provide(asc_event_recv_t *recv, void *buffer, size_t size, void *opaque)
+{
+    __uarg(recv);
+    __uarg(buffer);
+    __uarg(size);
+    __uarg(opaque);
+}
+
+void asc_event_recv_close(asc_event_recv_t *recv)
+{
+    __uarg(recv);
+}
+
+bool asc_event_sendto(  int fd, const void *buffer, size_t size
+                      , const void *addr, size_t addr_size
+                      , asc_event_send_callback_t on_done, void *arg)
+{
+    __uarg(fd);
+    __uarg(buffer);
+    __uarg(size);
+    __uarg(addr);
+    __uarg(addr_size);
+    __uarg(on_done);
+    __uarg(arg);
+    return false;
+}
+
+void asc_event_send_detach(void *arg)
+{
+    __uarg(arg);
+}
+
+#endif /* !EV_TYPE_URING */
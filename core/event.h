@@ -27,14 +27,88 @@ typedef struct asc_event_t asc_event_t;
 typedef void (*event_callback_t)(void *);
 
 void asc_event_core_init(void);
-void asc_event_core_loop(void);
+void asc_event_core_loop(unsigned int timeout);
 void asc_event_core_destroy(void);
 
+void asc_event_core_wakeup(void);
+
 asc_event_t * asc_event_init(int fd, void *arg) __wur;
 void asc_event_set_on_read(asc_event_t *event, event_callback_t on_read);
 void asc_event_set_on_write(asc_event_t *event, event_callback_t on_write);
 void asc_event_set_on_error(asc_event_t *event, event_callback_t on_error);
 
+/*
+ * Edge mode (epoll only). Write readiness is kept in user space: EPOLLOUT is
+ * subscribed only after the owner gets EAGAIN and reports it with
+ * asc_event_write_blocked(), and is unsubscribed on the first notification.
+ * While the descriptor is writable on_write is called on each loop without
+ * epoll_ctl(), so the toggling of on_write costs nothing. The owner must
+ * report EAGAIN of each write.
+ */
+void asc_event_set_edge(asc_event_t *event);
+void asc_event_write_blocked(asc_event_t *event);
+
+/*
+ * Priority class (epoll and kqueue). Ready events are dispatched by class:
+ * input, output, control. Control events are dispatched while the time of
+ * the control class in the loop iteration is less than EV_CONTROL_BUDGET,
+ * others are reported by the kernel on the next iteration, so the admin
+ * load does not delay the stream reads. Default is ASC_EVENT_OUTPUT.
+ */
+typedef enum
+{
+    ASC_EVENT_OUTPUT = 0,   // data-plane output and the default
+    ASC_EVENT_INPUT,        // data-plane input: udp, dvr, asi
+    ASC_EVENT_CONTROL,      // http api, web ui, databases
+
+    ASC_EVENT_PRIORITY_COUNT
+} asc_event_priority_t;
+
+void asc_event_set_priority(asc_event_t *event, asc_event_priority_t priority);
+
 void asc_event_close(asc_event_t *event);
 
+/*
+ * Completion path (io_uring only). The multishot receive keeps one request
+ * in the kernel, each datagram is received to the buffer provided by the
+ * owner and delivered without the readiness event and the recv call.
+ * The buffer goes back to the owner with the datagram, the owner provides
+ * it again or the next one. The queued send copies the datagram and is
+ * submitted with the wait of the main loop, all sends of the loop iteration
+ * take one io_uring_enter().
+ * With other backends asc_event_recv_init() returns NULL and
+ * asc_event_sendto() returns false, the owner uses the readiness path.
+ * Main loop only.
+ */
+typedef struct asc_event_recv_t asc_event_recv_t;
+
+/*
+ * opaque - value of asc_event_recv_provide(), buffer - datagram in the provided buffer
+ * after the headroom, control - ancillary data of the datagram, see recvmsg()
+ */
+typedef void (*asc_event_recv_callback_t)(  void *arg, void *opaque
+                                          , const uint8_t *buffer, size_t size
+                                          , void *control, size_t control_size);
+/* result - bytes sent or -errno */
+typedef void (*asc_event_send_callback_t)(void *arg, int result);
+
+/*
+ * count - buffers in the kernel at once, headroom - bytes of the metadata before
+ * the datagram in each buffer. on_release gets opaque of the buffers kept by
+ * the kernel after the close. on_error is called on the receive error
+ */
+asc_event_recv_t * asc_event_recv_init(  int fd, int count, size_t headroom
+                                       , asc_event_recv_callback_t on_recv
+                                       , event_callback_t on_release
+                                       , event_callback_t on_error, void *arg) __wur;
+void asc_event_recv_provide(asc_event_recv_t *recv, void *buffer, size_t size, void *opaque);
+void asc_event_recv_close(asc_event_recv_t *recv);
+
+/* false if the send is not queued. on_done is optional */
+bool asc_event_sendto(  int fd, const void *buffer, size_t size
+                      , const void *addr, size_t addr_size
+                      , asc_event_send_callback_t on_done, void *arg) __wur;
+/* completions of the queued sends of arg are not reported */
+void asc_event_send_detach(void *arg);
+
 #endif /* _ASC_EVENT_H_ */
@@ -0,0 +1,520 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Exchange over the SOCK_SEQPACKET socket, one message per descriptor:
+ *      old -> new: "key\0tag\0" with the descriptor in SCM_RIGHTS
+ *      old -> new: "\0\0" - end of the list
+ *      new -> old: "R" - config is loaded, the old process exits
+ */
+
+#include "assert.h"
+#include "handover.h"
+#include "event.h"
+#include "list.h"
+#include "log.h"
+
+#ifndef _WIN32
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#endif
+
+#define MSG(_msg) "[core/handover] " _msg
+
+/* send and receive timeout of the exchange, ms */
+#define HANDOVER_TIMEOUT 5000
+#define HANDOVER_MESSAGE_SIZE 512
+
+typedef struct handover_fd_t
+{
+    char *key;
+    char *tag;
+    int fd; // -1 if taken
+
+    TAILQ_ENTRY(handover_fd_t) entries;
+} handover_fd_t;
+
+typedef struct handover_provider_t
+{
+    asc_handover_callback_t callback;
+    void *arg;
+
+    TAILQ_ENTRY(handover_provider_t) entries;
+} handover_provider_t;
+
+static struct
+{
+    char *path;
+
+    /* new process, until asc_handover_core_start() */
+    int peer_fd;
+    TAILQ_HEAD(handover_fd_list_s, handover_fd_t) fd_list;
+
+    /* old process */
+    int sock_fd;
+    asc_event_t *sock_event;
+    int client_fd; // new process
+    asc_event_t *client_event;
+    bool is_error; // failed to pass the descriptor
+    size_t pass_count;
+    TAILQ_HEAD(handover_provider_list_s, handover_provider_t) provider_list;
+} handover =
+{
+    .peer_fd = -1,
+    .fd_list = TAILQ_HEAD_INITIALIZER(handover.fd_list),
+    .sock_fd = -1,
+    .client_fd = -1,
+    .provider_list = TAILQ_HEAD_INITIALIZER(handover.provider_list),
+};
+
+#ifndef _WIN32
+
+static void handover_set_timeout(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = HANDOVER_TIMEOUT / 1000;
+    tv.tv_usec = (HANDOVER_TIMEOUT % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void handover_fd_free(handover_fd_t *item)
+{
+    if(item->fd != -1)
+    {
+        asc_log_debug(MSG("%s is not used"), item->key);
+        close(item->fd);
+    }
+    free(item->key);
+    free(item->tag);
+    free(item);
+}
+
+static void handover_fd_list_clear(void)
+{
+    handover_fd_t *item;
+    while((item = TAILQ_FIRST(&handover.fd_list)) != NULL)
+    {
+        TAILQ_REMOVE(&handover.fd_list, item, entries);
+        handover_fd_free(item);
+    }
+}
+
+/*
+ * New process: receives the descriptors before the config is loaded
+ */
+
+/* returns false on the end of the list */
+static bool handover_recv(int fd, bool *is_error)
+{
+    char buffer[HANDOVER_MESSAGE_SIZE];
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct iovec iov = { .iov_base = buffer, .iov_len = sizeof(buffer) - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+#ifdef MSG_CMSG_CLOEXEC
+    const ssize_t size = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+#else
+    const ssize_t size = recvmsg(fd, &msg, 0);
+#endif
+    if(size <= 0)
+    {
+        asc_log_error(MSG("failed to receive descriptor [%s]")
+                      , (size == 0) ? "connection closed" : strerror(errno));
+        *is_error = true;
+        return false;
+    }
+    buffer[size] = '\0';
+
+    int item_fd = -1;
+    const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&item_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    const size_t key_size = strlen(buffer);
+    if(key_size == 0)
+    {
+        if(item_fd != -1)
+            close(item_fd);
+        return false;
+    }
+
+    if(item_fd == -1 || msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+        asc_log_error(MSG("wrong message %s"), buffer);
+        if(item_fd != -1)
+            close(item_fd);
+        *is_error = true;
+        return false;
+    }
+
+    const char *tag = ((ssize_t)key_size + 1 < size) ? &buffer[key_size + 1] : "";
+
+    handover_fd_t *item = (handover_fd_t *)calloc(1, sizeof(handover_fd_t));
+    item->key = strdup(buffer);
+    item->tag = (tag[0] != '\0') ? strdup(tag) : NULL;
+    item->fd = item_fd;
+    TAILQ_INSERT_TAIL(&handover.fd_list, item, entries);
+
+    return true;
+}
+
+static void handover_connect(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handover.path, sizeof(addr.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    asc_assert(fd != -1, MSG("failed to open socket [%s]"), strerror(errno));
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        // the previous process is not running
+        close(fd);
+        return;
+    }
+
+    handover_set_timeout(fd);
+
+    bool is_error = false;
+    size_t count = 0;
+    while(handover_recv(fd, &is_error))
+        ++count;
+
+    if(is_error)
+    {
+        // the previous process continues, the devices are opened again
+        handover_fd_list_clear();
+        close(fd);
+        return;
+    }
+
+    asc_log_info(MSG("%zu descriptors are received from the previous process"), count);
+    handover.peer_fd = fd;
+}
+
+/*
+ * Old process: passes the descriptors to the new one
+ */
+
+static void handover_client_close(void)
+{
+    ASC_FREE(handover.client_event, asc_event_close);
+    if(handover.client_fd != -1)
+    {
+        close(handover.client_fd);
+        handover.client_fd = -1;
+    }
+}
+
+static void on_client_error(void *arg)
+{
+    __uarg(arg);
+    asc_log_warning(MSG("new process is failed, handover is aborted"));
+    handover_client_close();
+}
+
+static void on_client_read(void *arg)
+{
+    char value = 0;
+    const ssize_t size = recv(handover.client_fd, &value, sizeof(value), 0);
+    if(size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    if(size != 1 || value != 'R')
+    {
+        on_client_error(arg);
+        return;
+    }
+
+    /* the module destroy would release the descriptors of the new process */
+    asc_log_info(MSG("new process is started, exit"));
+    fflush(NULL);
+    _exit(0);
+}
+
+static bool handover_send(int fd, const char *key, const char *tag, int item_fd)
+{
+    char buffer[HANDOVER_MESSAGE_SIZE];
+    const int size = snprintf(buffer, sizeof(buffer), "%s%c%s", key, '\0', (tag) ? tag : "");
+    if(size < 0 || size >= (int)sizeof(buffer))
+        return false;
+
+    struct iovec iov = { .iov_base = buffer, .iov_len = (size_t)size + 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if(item_fd != -1)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &item_fd, sizeof(int));
+    }
+
+    return (sendmsg(fd, &msg, 0) == (ssize_t)iov.iov_len);
+}
+
+static void on_handover_accept(void *arg)
+{
+    __uarg(arg);
+
+    const int fd = accept(handover.sock_fd, NULL, NULL);
+    if(fd == -1)
+        return;
+
+    if(handover.client_fd != -1)
+    {
+        asc_log_warning(MSG("handover is in progress, connection is rejected"));
+        close(fd);
+        return;
+    }
+
+    handover_set_timeout(fd);
+    handover.client_fd = fd;
+    handover.is_error = false;
+    handover.pass_count = 0;
+
+    handover_provider_t *provider;
+    TAILQ_FOREACH(provider, &handover.provider_list, entries)
+        provider->callback(provider->arg);
+
+    if(handover.is_error || !handover_send(fd, "", NULL, -1))
+    {
+        asc_log_error(MSG("failed to pass descriptors, handover is aborted"));
+        handover_client_close();
+        return;
+    }
+
+    asc_log_info(MSG("%zu descriptors are passed to the new process"), handover.pass_count);
+
+    handover.client_event = asc_event_init(fd, NULL);
+    asc_event_set_on_read(handover.client_event, on_client_read);
+    asc_event_set_on_error(handover.client_event, on_client_error);
+}
+
+static void handover_listen(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handover.path, sizeof(addr.sun_path) - 1);
+
+    // the socket of the previous process is replaced, it exits anyway
+    unlink(handover.path);
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    asc_assert(fd != -1, MSG("failed to open socket [%s]"), strerror(errno));
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0)
+    {
+        asc_log_error(MSG("failed to listen on %s [%s]"), handover.path, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    handover.sock_fd = fd;
+    handover.sock_event = asc_event_init(fd, NULL);
+    asc_event_set_on_read(handover.sock_event, on_handover_accept);
+}
+
+void asc_handover_core_init(const char *path)
+{
+    if(!path)
+        return;
+
+    handover.path = strdup(path);
+    handover_connect();
+}
+
+void asc_handover_core_start(void)
+{
+    if(!handover.path)
+        return;
+
+    if(handover.peer_fd != -1)
+    {
+        const char value = 'R';
+        if(send(handover.peer_fd, &value, sizeof(value), 0) != sizeof(value))
+            asc_log_error(MSG("failed to release the previous process [%s]"), strerror(errno));
+
+        close(handover.peer_fd);
+        handover.peer_fd = -1;
+        handover_fd_list_clear();
+    }
+
+    handover_listen();
+}
+
+void asc_handover_core_destroy(void)
+{
+    handover_client_close();
+
+    ASC_FREE(handover.sock_event, asc_event_close);
+    if(handover.sock_fd != -1)
+    {
+        close(handover.sock_fd);
+        handover.sock_fd = -1;
+        unlink(handover.path);
+    }
+
+    if(handover.peer_fd != -1)
+    {
+        close(handover.peer_fd);
+        handover.peer_fd = -1;
+    }
+    handover_fd_list_clear();
+
+    handover_provider_t *provider;
+    while((provider = TAILQ_FIRST(&handover.provider_list)) != NULL)
+    {
+        TAILQ_REMOVE(&handover.provider_list, provider, entries);
+        free(provider);
+    }
+
+    ASC_FREE(handover.path, free);
+}
+
+void asc_handover_attach(asc_handover_callback_t callback, void *arg)
+{
+    handover_provider_t *provider = (handover_provider_t *)calloc(1, sizeof(handover_provider_t));
+    provider->callback = callback;
+    provider->arg = arg;
+    TAILQ_INSERT_TAIL(&handover.provider_list, provider, entries);
+}
+
+void asc_handover_detach(void *arg)
+{
+    handover_provider_t *provider;
+    TAILQ_FOREACH(provider, &handover.provider_list, entries)
+    {
+        if(provider->arg == arg)
+        {
+            TAILQ_REMOVE(&handover.provider_list, provider, entries);
+            free(provider);
+            return;
+        }
+    }
+}
+
+void asc_handover_pass(const char *key, const char *tag, int fd)
+{
+    if(handover.client_fd == -1 || handover.is_error || fd <= 0)
+        return;
+
+    if(!handover_send(handover.client_fd, key, tag, fd))
+    {
+        asc_log_error(MSG("failed to pass %s [%s]"), key, strerror(errno));
+        handover.is_error = true;
+        return;
+    }
+
+    ++handover.pass_count;
+}
+
+int asc_handover_take(const char *key, const char **tag)
+{
+    handover_fd_t *item;
+    TAILQ_FOREACH(item, &handover.fd_list, entries)
+    {
+        if(item->fd != -1 && !strcmp(item->key, key))
+        {
+            const int fd = item->fd;
+            item->fd = -1;
+            if(tag)
+                *tag = item->tag;
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+bool asc_handover_is_pending(void)
+{
+    return (handover.peer_fd != -1);
+}
+
+#else /* _WIN32 */
+
+void asc_handover_core_init(const char *path)
+{
+    if(path)
+        asc_log_error(MSG("handover is not supported on this platform"));
+}
+
+void asc_handover_core_start(void)
+{
+}
+
+void asc_handover_core_destroy(void)
+{
+}
+
+void asc_handover_attach(asc_handover_callback_t callback, void *arg)
+{
+    __uarg(callback);
+    __uarg(arg);
+}
+
+void asc_handover_detach(void *arg)
+{
+    __uarg(arg);
+}
+
+void asc_handover_pass(const char *key, const char *tag, int fd)
+{
+    __uarg(key);
+    __uarg(tag);
+    __uarg(fd);
+}
+
+int asc_handover_take(const char *key, const char **tag)
+{
+    __uarg(key);
+    __uarg(tag);
+    return -1;
+}
+
+bool asc_handover_is_pending(void)
+{
+    return false;
+}
+
+#endif /* _WIN32 */
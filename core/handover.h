@@ -0,0 +1,59 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_HANDOVER_H_
+#define _ASC_HANDOVER_H_ 1
+
+#include "base.h"
+
+/*
+ * Binary upgrade without the stream interruption. The process started with
+ * --handover PATH listens on the unix socket PATH. The new process started
+ * with the same option connects to it before the config is loaded and
+ * receives the descriptors of the old one (SCM_RIGHTS): the modules take
+ * them by the key instead of opening the devices and sockets again,
+ * the multicast groups are not left and the tuners are not retuned.
+ *
+ * The old process keeps the stream until the new one has loaded the config,
+ * the main loop of the new process is not started yet, so the shared
+ * descriptors are read by one process at a time. Then the old process exits
+ * without the module destroy: the close of the modules would leave
+ * the groups and clear the frontends that are used by the new process.
+ * If the new process fails before, the old one continues.
+ */
+
+typedef void (*asc_handover_callback_t)(void *arg);
+
+void asc_handover_core_init(const char *path);
+/* called after the config: releases the old process and starts the listener */
+void asc_handover_core_start(void);
+void asc_handover_core_destroy(void);
+
+/* old process: the callback passes the descriptors with asc_handover_pass() */
+void asc_handover_attach(asc_handover_callback_t callback, void *arg);
+void asc_handover_detach(void *arg);
+/* tag - optional string, the state of the descriptor, for example the tuning */
+void asc_handover_pass(const char *key, const char *tag, int fd);
+
+/* new process: -1 if the key is not passed. the key may be passed several times */
+int asc_handover_take(const char *key, const char **tag) __wur;
+bool asc_handover_is_pending(void) __wur;
+
+#endif /* _ASC_HANDOVER_H_ */
@@ -0,0 +1,399 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "assert.h"
+#include "job.h"
+#include "log.h"
+
+#ifndef _WIN32
+#   include <pthread.h>
+#endif
+
+#ifdef __linux__
+#   include <sys/prctl.h>
+#endif
+
+#define MSG(_msg) "[core/job] " _msg
+
+struct asc_job_group_t
+{
+    bool is_ordered;
+
+    // jobs with on_done, submitted and not completed on the main loop
+    TAILQ_HEAD(job_list_s, asc_job_t) list;
+};
+
+/*
+ * Main loop side. The completed jobs are delivered one by one: on_done may
+ * destroy any group, the group cancels the completion of own jobs.
+ */
+
+typedef struct
+{
+    asc_job_group_t *current; // group of the running on_done
+} job_delivery_t;
+
+static job_delivery_t delivery = { NULL };
+
+static void job_done(asc_job_t *job)
+{
+    asc_job_group_t *group = job->group;
+    job->is_ready = true;
+
+    if(!group)
+    {
+        job->on_done(job);
+        return;
+    }
+
+    if(!group->is_ordered)
+    {
+        TAILQ_REMOVE(&group->list, job, entries);
+        job->on_done(job);
+        return;
+    }
+
+    // the previous jobs of the ordered group are completed first
+    delivery.current = group;
+    while((job = TAILQ_FIRST(&group->list)) != NULL && job->is_ready)
+    {
+        TAILQ_REMOVE(&group->list, job, entries);
+        job->on_done(job);
+        if(delivery.current != group)
+            return; // destroyed by on_done
+    }
+    delivery.current = NULL;
+}
+
+asc_job_group_t * asc_job_group_init(bool is_ordered)
+{
+    asc_job_group_t *group = (asc_job_group_t *)calloc(1, sizeof(asc_job_group_t));
+    group->is_ordered = is_ordered;
+    TAILQ_INIT(&group->list);
+    return group;
+}
+
+#ifndef _WIN32
+
+/*
+ * oooooooooo    ooooooo     ooooooo   ooooo
+ *  888    888 o888   888o o888   888o  888
+ *  888oooo88  888     888 888     888  888
+ *  888        888o   o888 888o   o888  888      o
+ * o888o         88ooo88     88ooo88   o888ooooo88
+ *
+ * Jobs are submitted to the worker queues in turn. The worker takes jobs
+ * from own queue first, then from the queues of the others. pending is the
+ * count of the queued jobs, the idle workers sleep while it is zero.
+ */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    asc_job_t *head;
+    asc_job_t *tail;
+} job_queue_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // new job or close
+    pthread_cond_t done_cond;   // job completed, for asc_job_wait()
+
+    job_queue_t queue[ASC_JOB_THREADS_MAX];
+    bool is_queue_init;
+
+    pthread_t thread[ASC_JOB_THREADS_MAX];
+    int thread_count;
+    size_t submit;              // next queue, main loop only
+
+    size_t pending;
+    int wait_count;             // asc_job_wait() in progress
+    int refcount;
+    bool is_closed;
+} job_pool_t;
+
+static job_pool_t pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static asc_job_t * queue_pop(job_queue_t *queue)
+{
+    if(!__atomic_load_n(&queue->head, __ATOMIC_RELAXED))
+        return NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    asc_job_t *job = queue->head;
+    if(job)
+    {
+        __atomic_store_n(&queue->head, job->next, __ATOMIC_RELAXED);
+        if(!queue->head)
+            queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+static void queue_push(job_queue_t *queue, asc_job_t *job)
+{
+    pthread_mutex_lock(&queue->lock);
+    if(queue->tail)
+        queue->tail->next = job;
+    else
+        __atomic_store_n(&queue->head, job, __ATOMIC_RELAXED);
+    queue->tail = job;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* the owner may release the job when is_busy is cleared */
+static void job_complete(asc_job_t *job)
+{
+    /* is_busy is cleared after the post, see job_on_done() */
+    if(job->on_done)
+        asc_command_post(&job->done);
+    __atomic_store_n(&job->is_busy, false, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&pool.wait_count, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.done_cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+static void * job_loop(void *arg)
+{
+    const int id = (int)(intptr_t)arg;
+
+#ifdef __linux__
+    char name[16];
+    snprintf(name, sizeof(name), "job/%d", id);
+    prctl(PR_SET_NAME, name, 0, 0, 0);
+#endif
+
+    while(true)
+    {
+        asc_job_t *job = queue_pop(&pool.queue[id]);
+        if(!job)
+        {
+            const int count = __atomic_load_n(&pool.thread_count, __ATOMIC_ACQUIRE);
+            for(int i = 1; i < count && !job; ++i)
+                job = queue_pop(&pool.queue[(id + i) % count]);
+        }
+
+        if(job)
+        {
+            __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_ACQ_REL);
+            job->run(job);
+            job_complete(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        while(!__atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) && !pool.is_closed)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        const bool is_exit = (pool.is_closed && !pool.pending);
+        pthread_mutex_unlock(&pool.lock);
+
+        if(is_exit)
+            break;
+    }
+
+    return NULL;
+}
+
+static void job_on_done(asc_command_t *command)
+{
+    asc_job_t *job = (asc_job_t *)command->arg;
+
+    /* the worker is between the post and the clearing of is_busy */
+    asc_job_wait(job);
+    job_done(job);
+}
+
+bool asc_job_attach(int threads)
+{
+    if(threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads <= 0)
+        threads = 1;
+    if(threads > ASC_JOB_THREADS_MAX)
+        threads = ASC_JOB_THREADS_MAX;
+
+    if(!pool.is_queue_init)
+    {
+        for(int i = 0; i < ASC_JOB_THREADS_MAX; ++i)
+            pthread_mutex_init(&pool.queue[i].lock, NULL);
+        pool.is_queue_init = true;
+    }
+
+    if(pool.refcount == 0)
+        pool.is_closed = false;
+    ++pool.refcount;
+
+    while(pool.thread_count < threads)
+    {
+        const int id = pool.thread_count;
+        if(pthread_create(&pool.thread[id], NULL, job_loop, (void *)(intptr_t)id) != 0)
+        {
+            asc_log_error(MSG("failed to start thread [%s]"), strerror(errno));
+            break;
+        }
+        __atomic_store_n(&pool.thread_count, id + 1, __ATOMIC_RELEASE);
+    }
+
+    if(pool.thread_count == 0)
+    {
+        asc_job_detach();
+        return false;
+    }
+
+    return true;
+}
+
+void asc_job_detach(void)
+{
+    if(pool.refcount == 0 || --pool.refcount > 0)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.is_closed = true;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for(int i = 0; i < pool.thread_count; ++i)
+        pthread_join(pool.thread[i], NULL);
+    pool.thread_count = 0;
+}
+
+void asc_job_submit(asc_job_t *job, asc_job_group_t *group)
+{
+    job->is_busy = true;
+    job->is_ready = false;
+    job->next = NULL;
+    job->group = group;
+    job->done.run = job_on_done;
+    job->done.arg = job;
+
+    if(group)
+    {
+        asc_assert(job->on_done != NULL, MSG("on_done is required for the group"));
+        TAILQ_INSERT_TAIL(&group->list, job, entries);
+    }
+
+    if(pool.thread_count == 0)
+    {
+        // not attached, on the main loop
+        job->run(job);
+        job->is_busy = false;
+        if(job->on_done)
+            job_done(job);
+        return;
+    }
+
+    queue_push(&pool.queue[pool.submit % pool.thread_count], job);
+    ++pool.submit;
+
+    pthread_mutex_lock(&pool.lock);
+    __atomic_add_fetch(&pool.pending, 1, __ATOMIC_ACQ_REL);
+    pthread_cond_signal(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void asc_job_wait(asc_job_t *job)
+{
+    if(!__atomic_load_n(&job->is_busy, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    __atomic_add_fetch(&pool.wait_count, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&job->is_busy, __ATOMIC_SEQ_CST))
+        pthread_cond_wait(&pool.done_cond, &pool.lock);
+    __atomic_sub_fetch(&pool.wait_count, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void asc_job_group_destroy(asc_job_group_t *group)
+{
+    asc_job_t *job;
+    TAILQ_FOREACH(job, &group->list, entries)
+    {
+        asc_job_wait(job);
+        asc_command_cancel(&job->done);
+    }
+
+    if(delivery.current == group)
+        delivery.current = NULL;
+
+    free(group);
+}
+
+#else /* _WIN32 */
+
+bool asc_job_attach(int threads)
+{
+    __uarg(threads);
+    asc_log_error(MSG("worker threads are not supported"));
+    return false;
+}
+
+void asc_job_detach(void)
+{
+}
+
+void asc_job_submit(asc_job_t *job, asc_job_group_t *group)
+{
+    job->is_ready = false;
+    job->group = group;
+
+    if(group)
+    {
+        asc_assert(job->on_done != NULL, MSG("on_done is required for the group"));
+        TAILQ_INSERT_TAIL(&group->list, job, entries);
+    }
+
+    job->run(job);
+    job->is_busy = false;
+    if(job->on_done)
+        job_done(job);
+}
+
+void asc_job_wait(asc_job_t *job)
+{
+    __uarg(job);
+}
+
+void asc_job_group_destroy(asc_job_group_t *group)
+{
+    if(delivery.current == group)
+        delivery.current = NULL;
+
+    free(group);
+}
+
+#endif /* _WIN32 */
+
+bool asc_job_is_done(asc_job_t *job)
+{
+    return !__atomic_load_n(&job->is_busy, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,76 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_JOB_H_
+#define _ASC_JOB_H_ 1
+
+#include "base.h"
+#include "command.h"
+#include "list.h"
+
+/*
+ * Worker threads shared by all modules of the process, one per CPU.
+ * Each worker has own queue, the idle worker takes jobs from the queues
+ * of the others. The job is the part of the owner structure, the pool
+ * does not allocate memory.
+ *
+ * on_done is called on the main loop after run. Jobs of the ordered group
+ * are completed in order of submission, jobs of the unordered group
+ * in any order. The owner may poll the job with asc_job_is_done() instead.
+ * Completed jobs are delivered to the main loop with the command queue,
+ * see command.h.
+ */
+
+#define ASC_JOB_THREADS_MAX 64
+
+typedef struct asc_job_t asc_job_t;
+typedef struct asc_job_group_t asc_job_group_t;
+typedef void (*asc_job_callback_t)(asc_job_t *job);
+
+struct asc_job_t
+{
+    asc_job_callback_t run;     // called on the worker thread
+    asc_job_callback_t on_done; // called on the main loop, optional
+    void *arg;
+
+    /* private */
+    bool is_busy;               // submitted and not completed
+    bool is_ready;              // run is completed, on_done is pending
+    asc_job_group_t *group;
+    asc_job_t *next;            // worker queue
+    asc_command_t done;         // completion, worker to the main loop
+
+    TAILQ_ENTRY(asc_job_t) entries; // group list
+};
+
+/* threads - 0 for the CPU count. the pool is not reduced while attached */
+bool asc_job_attach(int threads) __wur;
+void asc_job_detach(void);
+
+void asc_job_submit(asc_job_t *job, asc_job_group_t *group);
+
+bool asc_job_is_done(asc_job_t *job) __wur;
+void asc_job_wait(asc_job_t *job);
+
+asc_job_group_t * asc_job_group_init(bool is_ordered) __wur;
+/* waits for the jobs of the group, pending on_done is not called */
+void asc_job_group_destroy(asc_job_group_t *group);
+
+#endif /* _ASC_JOB_H_ */
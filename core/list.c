@@ -33,6 +33,9 @@ struct asc_list_t
     size_t size;
     struct item_s *current;
     TAILQ_HEAD(list_head_s, item_s) list;
+
+    /* removed items are kept for reuse, linked with entries.tqe_next */
+    struct item_s *pool;
 };
 
 asc_list_t * asc_list_init(void)
@@ -41,15 +44,44 @@ asc_list_t * asc_list_init(void)
     TAILQ_INIT(&list->list);
     list->size = 0;
     list->current = NULL;
+    list->pool = NULL;
     return list;
 }
 
 void asc_list_destroy(asc_list_t *list)
 {
     asc_assert(list->current == NULL, "[core/list] list is not empty");
+
+    while(list->pool)
+    {
+        item_t *item = list->pool;
+        list->pool = TAILQ_NEXT(item, entries);
+        free(item);
+    }
+
     free(list);
 }
 
+static item_t * asc_list_item_alloc(asc_list_t *list, void *data)
+{
+    item_t *item = list->pool;
+    if(item)
+        list->pool = TAILQ_NEXT(item, entries);
+    else
+        item = (item_t *)malloc(sizeof(item_t));
+
+    item->data = data;
+    item->entries.tqe_next = NULL;
+    item->entries.tqe_prev = NULL;
+    return item;
+}
+
+static void asc_list_item_free(asc_list_t *list, item_t *item)
+{
+    TAILQ_NEXT(item, entries) = list->pool;
+    list->pool = item;
+}
+
 __asc_inline
 void asc_list_first(asc_list_t *list)
 {
@@ -85,30 +117,35 @@ size_t asc_list_size(asc_list_t *list)
 void asc_list_insert_head(asc_list_t *list, void *data)
 {
     ++list->size;
-    item_t *item = (item_t *)malloc(sizeof(item_t));
-    item->data = data;
-    item->entries.tqe_next = NULL;
-    item->entries.tqe_prev = NULL;
+    item_t *item = asc_list_item_alloc(list, data);
     TAILQ_INSERT_HEAD(&list->list, item, entries);
 }
 
 void asc_list_insert_tail(asc_list_t *list, void *data)
 {
     ++list->size;
-    item_t *item = (item_t *)malloc(sizeof(item_t));
-    item->data = data;
-    item->entries.tqe_next = NULL;
-    item->entries.tqe_prev = NULL;
+    item_t *item = asc_list_item_alloc(list, data);
     TAILQ_INSERT_TAIL(&list->list, item, entries);
 }
 
+/* before the current item, or to the tail at the end of list */
+void asc_list_insert_before(asc_list_t *list, void *data)
+{
+    ++list->size;
+    item_t *item = asc_list_item_alloc(list, data);
+    if(list->current)
+        TAILQ_INSERT_BEFORE(list->current, item, entries);
+    else
+        TAILQ_INSERT_TAIL(&list->list, item, entries);
+}
+
 void asc_list_remove_current(asc_list_t *list)
 {
     --list->size;
     asc_assert(list->current != NULL, "[core/list] failed to remove item");
     item_t *next = TAILQ_NEXT(list->current, entries);
     TAILQ_REMOVE(&list->list, list->current, entries);
-    free(list->current);
+    asc_list_item_free(list, list->current);
     list->current = next;
 }
 
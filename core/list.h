@@ -194,6 +194,13 @@ do
         (head2)->tqh_last = &(head2)->tqh_first;                                                \
 } while (0)
 
+/*
+ * Generic list. Removed items are kept in the list for reuse, so
+ * insert/remove doesn't hit the allocator after warm-up.
+ * For hot paths embed TAILQ_ENTRY() into the object instead, iteration
+ * with TAILQ_FOREACH() has no shared cursor.
+ */
+
 typedef struct asc_list_t asc_list_t;
 
 asc_list_t * asc_list_init(void) __wur;
@@ -207,6 +214,7 @@ size_t asc_list_size(asc_list_t *list) __wur;
 
 void asc_list_insert_head(asc_list_t *list, void *data);
 void asc_list_insert_tail(asc_list_t *list, void *data);
+void asc_list_insert_before(asc_list_t *list, void *data);
 
 void asc_list_remove_current(asc_list_t *list);
 void asc_list_remove_item(asc_list_t *list, void *data);
@@ -22,9 +22,15 @@
 
 #ifndef _WIN32
 #include <syslog.h>
+#include <sched.h>
+#include <pthread.h>
 #endif
 #include <stdarg.h>
 
+#ifndef _WIN32
+typedef struct log_async_t log_async_t;
+#endif
+
 static struct
 {
     int fd;
@@ -34,7 +40,9 @@ static struct
     char *filename;
 #ifndef _WIN32
     char *syslog;
+    log_async_t *async;
 #endif
+    uint32_t rate_limit;
 } __log =
 {
     0,
@@ -44,7 +52,9 @@ static struct
     NULL,
 #ifndef _WIN32
     NULL,
+    NULL,
 #endif
+    0,
 };
 
 enum
@@ -81,24 +91,79 @@ static const char * _get_type_str(int type)
     }
 }
 
-__fmt_printf(2, 0)
-static void _log(int type, const char *msg, va_list ap)
+/*
+ * Rate limit. Messages are counted by the format string, so all messages
+ * from the same place share the limit. If the limit is reached in the
+ * current second, messages are skipped and the count of skipped messages
+ * is added to the first message of the next second.
+ * Collisions in the table and races between threads only reset counters.
+ */
+
+#define LOG_RATE_TABLE_SIZE 256
+
+typedef struct
 {
-    char buffer[4096];
+    const char *key;
+    time_t time;
+    uint32_t count;
+    uint32_t suppressed;
+} log_rate_t;
 
-    size_t len_1 = 0; // to skip time stamp
-    time_t ct = time(NULL);
-    struct tm *sct = localtime(&ct);
-    len_1 = strftime(buffer, sizeof(buffer), "%b %d %X: ", sct);
+static log_rate_t log_rate_table[LOG_RATE_TABLE_SIZE];
 
-    size_t len_2 = len_1;
-    const char *type_str = _get_type_str(type);
-    len_2 += snprintf(&buffer[len_2], sizeof(buffer) - len_2, "%s: ", type_str);
-    len_2 += vsnprintf(&buffer[len_2], sizeof(buffer) - len_2, msg, ap);
+/* returns false if the message should be skipped */
+static bool _log_rate_check(const char *msg, time_t now, uint32_t *suppressed)
+{
+    const uintptr_t hash = (uintptr_t)msg;
+    log_rate_t *rate = &log_rate_table[(hash ^ (hash >> 8)) % LOG_RATE_TABLE_SIZE];
 
+    if(rate->key == msg && rate->time == now)
+    {
+        if(__atomic_add_fetch(&rate->count, 1, __ATOMIC_RELAXED) <= __log.rate_limit)
+            return true;
+        __atomic_add_fetch(&rate->suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    if(rate->key == msg)
+        *suppressed = __atomic_exchange_n(&rate->suppressed, 0, __ATOMIC_RELAXED);
+    else
+        rate->suppressed = 0;
+
+    rate->key = msg;
+    rate->time = now;
+    rate->count = 1;
+    return true;
+}
+
+/* formats type and message. returns length */
+__fmt_printf(4, 0)
+static size_t _log_format(char *buffer, size_t size, int type, const char *msg, va_list ap
+                          , uint32_t suppressed)
+{
+    int len = snprintf(buffer, size, "%s: ", _get_type_str(type));
+    len += vsnprintf(&buffer[len], size - len, msg, ap);
+    if((size_t)len >= size)
+        len = size - 1;
+
+    if(suppressed > 0)
+    {
+        len += snprintf(&buffer[len], size - len, " (%u similar messages skipped)", suppressed);
+        if((size_t)len >= size)
+            len = size - 1;
+    }
+
+    return len;
+}
+
+/* buffer is time stamp and formatted message, with the space for new line */
+static void _log_write(int type, char *buffer, size_t len_1, size_t len_2)
+{
 #ifndef _WIN32
     if(__log.syslog)
         syslog(_get_type_syslog(type), "%s", &buffer[len_1]);
+#else
+    __uarg(len_1);
 #endif
 
     buffer[len_2] = '\n';
@@ -133,6 +198,294 @@ static void _log(int type, const char *msg, va_list ap)
         fprintf(stderr, "[log] failed to write to the file [%s]\n", strerror(errno));
 }
 
+#ifndef _WIN32
+
+/*
+ *      o       oooooooo8 ooooo  oooo oooo   oooo  oooooooo8
+ *     888     888          888  88    8888o  88 o888     88
+ *    8  88     888oooooo     888      88 888o88 888
+ *   8oooo88           888    888      88   8888 888o     oo
+ * o88o  o888o o88oooo888    o888o    o88o    88  888oooo88
+ *
+ * Bounded multi-producer/single-consumer ring. Each record has own sequence
+ * number. Producer takes the record with compare-and-swap on head, formats
+ * the message into it and publishes it with the sequence number. Writer
+ * thread takes records in order, adds time stamp and writes them.
+ * If the ring is full the message is dropped and counted.
+ * Writer sleeps on the pipe, producer wakes it up if it is sleeping.
+ *
+ * Producers of the other threads may hold the ring at any time, so the ring
+ * is allocated once and kept for the process lifetime. The stop parks the
+ * writer: it unpublishes the ring, waits for the producers in progress and
+ * the writer exits when all reserved records are written.
+ */
+
+#define LOG_RECORD_SIZE 1024
+#define LOG_RING_SIZE 1024
+
+typedef struct
+{
+    size_t seq;
+    int type;
+    time_t time;
+    size_t size;
+    char text[LOG_RECORD_SIZE];
+} log_record_t;
+
+struct log_async_t
+{
+    log_record_t *ring;
+    size_t head; // producers
+    size_t tail; // writer
+
+    size_t dropped;
+    size_t producers; // in async_push(), see async_stop()
+
+    bool is_sleeping;
+    bool is_hup;
+    bool is_stop;
+    int wakeup_fd[2];
+
+    pthread_t thread;
+
+    // time stamp cache, writer only
+    time_t stamp_time;
+    char stamp[64];
+    size_t stamp_size;
+};
+
+static void _log_reopen(void);
+
+static void async_wakeup(log_async_t *async)
+{
+    if(__atomic_load_n(&async->is_sleeping, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&async->is_sleeping, false, __ATOMIC_SEQ_CST);
+        const char value = 0;
+        if(write(async->wakeup_fd[1], &value, sizeof(value)) == -1) {};
+    }
+}
+
+__fmt_printf(4, 0)
+static void async_push(log_async_t *async, int type, time_t now, const char *msg, va_list ap
+                       , uint32_t suppressed)
+{
+    log_record_t *record;
+    size_t pos = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+    while(1)
+    {
+        record = &async->ring[pos % LOG_RING_SIZE];
+        const size_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&async->head, &pos, pos + 1, true
+                                           , __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->type = type;
+    record->time = now;
+    record->size = _log_format(record->text, sizeof(record->text), type, msg, ap, suppressed);
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+
+    async_wakeup(async);
+}
+
+static void async_write(log_async_t *async, int type, time_t now, const char *text, size_t size)
+{
+    if(now != async->stamp_time)
+    {
+        struct tm sct;
+        localtime_r(&now, &sct);
+        async->stamp_time = now;
+        async->stamp_size = strftime(async->stamp, sizeof(async->stamp), "%b %d %X: ", &sct);
+    }
+
+    char buffer[sizeof(async->stamp) + LOG_RECORD_SIZE + 1];
+    memcpy(buffer, async->stamp, async->stamp_size);
+    memcpy(&buffer[async->stamp_size], text, size);
+    buffer[async->stamp_size + size] = '\0';
+
+    _log_write(type, buffer, async->stamp_size, async->stamp_size + size);
+}
+
+/* returns false if the ring is empty */
+static bool async_pop(log_async_t *async)
+{
+    log_record_t *record = &async->ring[async->tail % LOG_RING_SIZE];
+    if(__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != async->tail + 1)
+        return false;
+
+    async_write(async, record->type, record->time, record->text, record->size);
+
+    __atomic_store_n(&record->seq, async->tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    ++async->tail;
+    return true;
+}
+
+static bool async_is_empty(log_async_t *async)
+{
+    const log_record_t *record = &async->ring[async->tail % LOG_RING_SIZE];
+    return __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != async->tail + 1;
+}
+
+static void * async_loop(void *arg)
+{
+    log_async_t *async = (log_async_t *)arg;
+
+    while(1)
+    {
+        while(async_pop(async))
+            ;
+
+        const size_t dropped = __atomic_exchange_n(&async->dropped, 0, __ATOMIC_RELAXED);
+        if(dropped > 0)
+        {
+            char text[128];
+            const int size = snprintf(text, sizeof(text)
+                                      , "%s: [core/log] %zu messages dropped"
+                                      , _get_type_str(LOG_TYPE_WARNING), dropped);
+            async_write(async, LOG_TYPE_WARNING, time(NULL), text, size);
+        }
+
+        if(__atomic_exchange_n(&async->is_hup, false, __ATOMIC_SEQ_CST))
+            _log_reopen();
+
+        if(__atomic_load_n(&async->is_stop, __ATOMIC_SEQ_CST))
+        {
+            /* reserved record is not published yet */
+            if(async->tail != __atomic_load_n(&async->head, __ATOMIC_ACQUIRE))
+                sched_yield();
+            else if(async_is_empty(async))
+                break;
+            continue;
+        }
+
+        __atomic_store_n(&async->is_sleeping, true, __ATOMIC_SEQ_CST);
+        if(   !async_is_empty(async)
+           || __atomic_load_n(&async->is_hup, __ATOMIC_SEQ_CST)
+           || __atomic_load_n(&async->is_stop, __ATOMIC_SEQ_CST))
+        {
+            __atomic_store_n(&async->is_sleeping, false, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        char drain[64];
+        if(read(async->wakeup_fd[0], drain, sizeof(drain)) == -1 && errno != EINTR)
+            break;
+    }
+
+    return NULL;
+}
+
+/* allocated by the first start, not released, see async_stop() */
+static log_async_t *async_object = NULL;
+
+static bool async_start(void)
+{
+    log_async_t *async = async_object;
+    if(!async)
+    {
+        async = (log_async_t *)calloc(1, sizeof(log_async_t));
+        if(pipe(async->wakeup_fd) == -1)
+        {
+            fprintf(stderr, "[log] failed to open wakeup pipe [%s]\n", strerror(errno));
+            free(async);
+            return false;
+        }
+        fcntl(async->wakeup_fd[1], F_SETFL, fcntl(async->wakeup_fd[1], F_GETFL) | O_NONBLOCK);
+
+        async->ring = (log_record_t *)malloc(sizeof(log_record_t) * LOG_RING_SIZE);
+        for(size_t i = 0; i < LOG_RING_SIZE; ++i)
+            async->ring[i].seq = i;
+
+        async_object = async;
+    }
+
+    async->is_stop = false;
+    async->is_sleeping = false;
+
+    if(pthread_create(&async->thread, NULL, async_loop, async) != 0)
+    {
+        fprintf(stderr, "[log] failed to start thread\n");
+        return false;
+    }
+
+    __atomic_store_n(&__log.async, async, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+/* writes all queued messages and stops the thread. the ring is kept */
+static void async_stop(void)
+{
+    log_async_t *async = __log.async;
+    if(!async)
+        return;
+
+    __atomic_store_n(&__log.async, NULL, __ATOMIC_SEQ_CST);
+
+    /* the producer checks __log.async after the increment, see _log() */
+    while(__atomic_load_n(&async->producers, __ATOMIC_SEQ_CST) > 0)
+        sched_yield();
+
+    __atomic_store_n(&async->is_stop, true, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&async->is_sleeping, true, __ATOMIC_SEQ_CST);
+    async_wakeup(async);
+    pthread_join(async->thread, NULL);
+}
+
+#endif /* !_WIN32 */
+
+__fmt_printf(2, 0)
+static void _log(int type, const char *msg, va_list ap)
+{
+    const time_t ct = time(NULL);
+
+    uint32_t suppressed = 0;
+    if(__log.rate_limit > 0 && !_log_rate_check(msg, ct, &suppressed))
+        return;
+
+#ifndef _WIN32
+    log_async_t *async = __atomic_load_n(&__log.async, __ATOMIC_ACQUIRE);
+    if(async)
+    {
+        __atomic_add_fetch(&async->producers, 1, __ATOMIC_SEQ_CST);
+        const bool is_async = (__atomic_load_n(&__log.async, __ATOMIC_SEQ_CST) == async);
+        if(is_async)
+            async_push(async, type, ct, msg, ap, suppressed);
+        __atomic_sub_fetch(&async->producers, 1, __ATOMIC_SEQ_CST);
+        if(is_async)
+            return;
+    }
+#endif
+
+    char buffer[4096];
+
+    size_t len_1 = 0; // to skip time stamp
+    struct tm *sct = localtime(&ct);
+    len_1 = strftime(buffer, sizeof(buffer), "%b %d %X: ", sct);
+
+    // keep the space for new line
+    const size_t len_2 = len_1 + _log_format(  &buffer[len_1], sizeof(buffer) - len_1 - 1
+                                             , type, msg, ap, suppressed);
+
+    _log_write(type, buffer, len_1, len_2);
+}
+
 void asc_log_info(const char *msg, ...)
 {
     va_list ap;
@@ -173,7 +526,7 @@ bool asc_log_is_debug(void)
     return __log.debug;
 }
 
-void asc_log_hup(void)
+static void _log_reopen(void)
 {
     if(__log.fd > 1)
     {
@@ -199,8 +552,31 @@ void asc_log_hup(void)
     }
 }
 
+void asc_log_hup(void)
+{
+#ifndef _WIN32
+    /* called from the signal handler, file is reopened by the writer thread */
+    log_async_t *async = __atomic_load_n(&__log.async, __ATOMIC_ACQUIRE);
+    if(async)
+    {
+        __atomic_store_n(&async->is_hup, true, __ATOMIC_SEQ_CST);
+        async_wakeup(async);
+        return;
+    }
+#endif
+
+    _log_reopen();
+}
+
 void asc_log_core_destroy(void)
 {
+#ifndef _WIN32
+    async_stop();
+#endif
+
+    __log.rate_limit = 0;
+    memset(log_rate_table, 0, sizeof(log_rate_table));
+
     if(__log.fd != 1)
     {
         close(__log.fd);
@@ -241,8 +617,20 @@ void asc_log_set_color(bool val)
     __log.color = val;
 }
 
+void asc_log_set_rate_limit(int val)
+{
+    __log.rate_limit = (val > 0) ? (uint32_t)val : 0;
+}
+
 void asc_log_set_file(const char *val)
 {
+#ifndef _WIN32
+    /* writer thread uses the file */
+    const bool is_async = (__log.async != NULL);
+    if(is_async)
+        async_stop();
+#endif
+
     if(__log.filename)
     {
         free(__log.filename);
@@ -252,12 +640,21 @@ void asc_log_set_file(const char *val)
     if(val)
         __log.filename = strdup(val);
 
-    asc_log_hup();
+    _log_reopen();
+
+#ifndef _WIN32
+    if(is_async)
+        async_start();
+#endif
 }
 
 #ifndef _WIN32
 void asc_log_set_syslog(const char *val)
 {
+    const bool is_async = (__log.async != NULL);
+    if(is_async)
+        async_stop();
+
     if(__log.syslog)
     {
         closelog();
@@ -265,10 +662,21 @@ void asc_log_set_syslog(const char *val)
         __log.syslog = NULL;
     }
 
-    if(!val)
-        return;
+    if(val)
+    {
+        __log.syslog = strdup(val);
+        openlog(__log.syslog, LOG_PID | LOG_CONS, LOG_USER);
+    }
 
-    __log.syslog = strdup(val);
-    openlog(__log.syslog, LOG_PID | LOG_CONS, LOG_USER);
+    if(is_async)
+        async_start();
+}
+
+void asc_log_set_async(bool val)
+{
+    if(val && !__log.async)
+        async_start();
+    else if(!val)
+        async_stop();
 }
 #endif
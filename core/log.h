@@ -27,8 +27,10 @@ void asc_log_set_stdout(bool);
 void asc_log_set_debug(bool);
 void asc_log_set_color(bool);
 void asc_log_set_file(const char *);
+void asc_log_set_rate_limit(int);
 #ifndef _WIN32
 void asc_log_set_syslog(const char *);
+void asc_log_set_async(bool);
 #endif
 
 void asc_log_hup(void);
@@ -40,30 +40,39 @@ void astra_exit(void)
 
 void astra_abort(void)
 {
+#ifndef _WIN32
+    /* write queued messages before the backtrace */
+    asc_log_set_async(false);
+#endif
     asc_log_error("[main] abort execution");
 
 #ifdef WITH_LUA
     if(lua != NULL)
     {
         asc_log_error("[main] Lua backtrace:");
-
-        lua_Debug ar;
-        int level = 1;
-        while(lua_getstack(lua, level, &ar))
-        {
-            lua_getinfo(lua, "nSl", &ar);
-            asc_log_error("[main] %d: %s:%d -- %s [%s]"
-                          , level, ar.short_src, ar.currentline
-                          , (ar.name) ? ar.name : "<unknown>"
-                          , ar.what);
-            ++level;
-        }
+        astra_backtrace(lua, 1);
     }
 #endif /* WITH_LUA */
 
     abort();
 }
 
+#ifdef WITH_LUA
+void astra_backtrace(lua_State *L, int level)
+{
+    lua_Debug ar;
+    while(lua_getstack(L, level, &ar))
+    {
+        lua_getinfo(L, "nSl", &ar);
+        asc_log_error("[main] %d: %s:%d -- %s [%s]"
+                      , level, ar.short_src, ar.currentline
+                      , (ar.name) ? ar.name : "<unknown>"
+                      , ar.what);
+        ++level;
+    }
+}
+#endif /* WITH_LUA */
+
 void astra_reload(void)
 {
     longjmp(main_loop, 2);
@@ -35,4 +35,9 @@ void astra_exit(void) __noreturn;
 void astra_abort(void) __noreturn;
 void astra_reload(void) __noreturn;
 
+#ifdef WITH_LUA
+/* logs the Lua call stack from the level, 0 - the running function */
+void astra_backtrace(lua_State *L, int level);
+#endif /* WITH_LUA */
+
 #endif /* _ASC_LOOPCTL_H_ */
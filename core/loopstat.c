@@ -0,0 +1,232 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+#include "loopctl.h"
+#include "loopstat.h"
+
+#ifndef _WIN32
+#   include <pthread.h>
+#endif
+
+#define MSG(_msg) "[core/loopstat] " _msg
+
+/* watchdog check interval limits, milliseconds */
+#define WATCHDOG_PERIOD_MIN 1
+#define WATCHDOG_PERIOD_MAX 100
+
+asc_loopstat_t asc_loopstat;
+
+/*
+ * seq and start are written by the main thread and read by the watchdog.
+ * start is 0 while the main loop waits for the events.
+ */
+static struct
+{
+    uint64_t seq;
+    uint64_t start;
+    uint64_t stall_seq;
+
+    unsigned int threshold;
+
+#ifndef _WIN32
+    bool is_started;
+    bool is_stop;
+    pthread_t thread;
+#endif
+} loop_watchdog;
+
+static inline uint64_t hist_upper(size_t idx)
+{
+    if(idx < ASC_HIST_SUB_COUNT)
+        return idx;
+
+    const int shift = (int)(idx >> ASC_HIST_SUB_BITS) - 1;
+    const uint64_t low = (uint64_t)(ASC_HIST_SUB_COUNT + (idx & (ASC_HIST_SUB_COUNT - 1))) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+uint64_t asc_hist_percentile(const asc_hist_t *hist, double p)
+{
+    if(hist->count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)((double)hist->count * p / 100.0 + 0.5);
+    if(target < 1)
+        target = 1;
+
+    uint64_t sum = 0;
+    for(size_t i = 0; i < ASC_HIST_SIZE; ++i)
+    {
+        sum += hist->bucket[i];
+        if(sum >= target)
+        {
+            const uint64_t value = hist_upper(i);
+            return (value < hist->max) ? value : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void asc_hist_reset(asc_hist_t *hist)
+{
+    memset(hist, 0, sizeof(asc_hist_t));
+}
+
+void asc_loopstat_reset(void)
+{
+    memset(&asc_loopstat, 0, sizeof(asc_loopstat));
+}
+
+void asc_loopstat_begin(int events)
+{
+    if(events > 0)
+        asc_hist_add(&asc_loopstat.batch, (uint64_t)events);
+
+    __atomic_add_fetch(&loop_watchdog.seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&loop_watchdog.start, asc_loop_time, __ATOMIC_RELEASE);
+}
+
+void asc_loopstat_end(void)
+{
+    const uint64_t start = loop_watchdog.start;
+    if(!start)
+        return;
+
+    __atomic_store_n(&loop_watchdog.start, 0, __ATOMIC_RELEASE);
+
+    const uint64_t now = asc_utime();
+    const uint64_t time = (now > start) ? now - start : 0;
+    asc_hist_add(&asc_loopstat.iteration, time);
+
+    if(loop_watchdog.threshold && time >= loop_watchdog.threshold * 1000ULL)
+    {
+        asc_log_warning(MSG("main loop iteration took %llu ms")
+                        , (unsigned long long)(time / 1000));
+    }
+}
+
+#ifndef _WIN32
+
+static void on_stall_hook(lua_State *L, lua_Debug *ar)
+{
+    __uarg(ar);
+    lua_sethook(L, NULL, 0, 0);
+
+    /* the stalled iteration is finished before the Lua code */
+    if(__atomic_load_n(&loop_watchdog.stall_seq, __ATOMIC_ACQUIRE) != loop_watchdog.seq)
+        return;
+
+    asc_log_warning(MSG("Lua backtrace of the stalled iteration:"));
+    astra_backtrace(L, 0);
+}
+
+static void * watchdog_loop(void *arg)
+{
+    __uarg(arg);
+
+    while(!__atomic_load_n(&loop_watchdog.is_stop, __ATOMIC_ACQUIRE))
+    {
+        const unsigned int threshold = __atomic_load_n(&loop_watchdog.threshold, __ATOMIC_RELAXED);
+
+        unsigned int period = threshold / 4;
+        if(period < WATCHDOG_PERIOD_MIN)
+            period = WATCHDOG_PERIOD_MIN;
+        else if(period > WATCHDOG_PERIOD_MAX)
+            period = WATCHDOG_PERIOD_MAX;
+        asc_usleep(period * 1000);
+
+        /* seq is checked twice, so start belongs to the same iteration */
+        const uint64_t seq = __atomic_load_n(&loop_watchdog.seq, __ATOMIC_ACQUIRE);
+        const uint64_t start = __atomic_load_n(&loop_watchdog.start, __ATOMIC_ACQUIRE);
+        if(!start || seq != __atomic_load_n(&loop_watchdog.seq, __ATOMIC_ACQUIRE))
+            continue;
+        if(seq == loop_watchdog.stall_seq)
+            continue;
+
+        const uint64_t now = asc_utime();
+        if(now < start || now - start < threshold * 1000ULL)
+            continue;
+
+        __atomic_store_n(&loop_watchdog.stall_seq, seq, __ATOMIC_RELEASE);
+        asc_log_warning(MSG("main loop stall: iteration is running %llu ms")
+                        , (unsigned long long)((now - start) / 1000));
+
+        /* lua_sethook() is safe to call asynchronously */
+        if(lua)
+            lua_sethook(lua, on_stall_hook, LUA_MASKCOUNT, 1);
+    }
+
+    return NULL;
+}
+
+static void watchdog_stop(void)
+{
+    if(!loop_watchdog.is_started)
+        return;
+
+    __atomic_store_n(&loop_watchdog.is_stop, true, __ATOMIC_RELEASE);
+    pthread_join(loop_watchdog.thread, NULL);
+    loop_watchdog.is_started = false;
+    loop_watchdog.is_stop = false;
+}
+
+void asc_loopstat_watchdog(unsigned int threshold_ms)
+{
+    __atomic_store_n(&loop_watchdog.threshold, threshold_ms, __ATOMIC_RELAXED);
+
+    if(!threshold_ms)
+    {
+        watchdog_stop();
+        return;
+    }
+
+    if(loop_watchdog.is_started)
+        return;
+
+    const int ret = pthread_create(&loop_watchdog.thread, NULL, watchdog_loop, NULL);
+    if(ret != 0)
+    {
+        asc_log_error(MSG("failed to start watchdog thread [%s]"), strerror(ret));
+        return;
+    }
+    loop_watchdog.is_started = true;
+}
+
+#else
+
+void asc_loopstat_watchdog(unsigned int threshold_ms)
+{
+    /* iteration time is still logged by asc_loopstat_end() */
+    loop_watchdog.threshold = threshold_ms;
+}
+
+#endif /* !_WIN32 */
+
+void asc_loopstat_core_destroy(void)
+{
+#ifndef _WIN32
+    watchdog_stop();
+#endif
+    loop_watchdog.threshold = 0;
+    loop_watchdog.start = 0;
+    asc_loopstat_reset();
+}
@@ -0,0 +1,93 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_LOOPSTAT_H_
+#define _ASC_LOOPSTAT_H_ 1
+
+#include "base.h"
+#include "clock.h"
+
+/*
+ * Main loop statistics. The iteration is the time from the end of the event
+ * wait to the next wait: event, timer and thread callbacks. Values are kept in
+ * log-linear histograms, ASC_HIST_SUB_BITS linear sub-buckets in each power
+ * of two, so the relative error of a percentile is not more than 1/8.
+ */
+
+#define ASC_HIST_SUB_BITS 3
+#define ASC_HIST_SUB_COUNT (1 << ASC_HIST_SUB_BITS)
+#define ASC_HIST_SIZE ((64 - ASC_HIST_SUB_BITS + 1) * ASC_HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[ASC_HIST_SIZE];
+} asc_hist_t;
+
+typedef struct
+{
+    asc_hist_t iteration;   // iteration time, microseconds
+    asc_hist_t timer_late;  // timer shot after the scheduled time, microseconds
+    asc_hist_t batch;       // events returned by one wait
+    asc_hist_t callback;    // callback time, asc_profile_clock() cycles. sampled,
+                            // only while the profiler is enabled
+} asc_loopstat_t;
+
+extern asc_loopstat_t asc_loopstat;
+
+static inline size_t asc_hist_index(uint64_t value)
+{
+    if(value < ASC_HIST_SUB_COUNT)
+        return (size_t)value;
+
+    const int shift = 63 - __builtin_clzll(value) - ASC_HIST_SUB_BITS;
+    return ((size_t)(shift + 1) << ASC_HIST_SUB_BITS)
+         + (size_t)((value >> shift) & (ASC_HIST_SUB_COUNT - 1));
+}
+
+static inline void asc_hist_add(asc_hist_t *hist, uint64_t value)
+{
+    ++hist->count;
+    ++hist->bucket[asc_hist_index(value)];
+    if(value > hist->max)
+        hist->max = value;
+}
+
+/* upper bound of the bucket with the percentile, 0 < p <= 100 */
+uint64_t asc_hist_percentile(const asc_hist_t *hist, double p) __func_pure;
+void asc_hist_reset(asc_hist_t *hist);
+
+void asc_loopstat_reset(void);
+void asc_loopstat_core_destroy(void);
+
+/* called after the event wait with the number of the ready events */
+void asc_loopstat_begin(int events);
+/* called at the end of the main loop iteration */
+void asc_loopstat_end(void);
+
+/*
+ * Stall watchdog. The thread checks the main loop each threshold/4 ms, if the
+ * iteration takes longer than threshold it logs the warning and the Lua
+ * backtrace at the next Lua instruction in the main thread. 0 - stop.
+ */
+void asc_loopstat_watchdog(unsigned int threshold_ms);
+
+#endif /* _ASC_LOOPSTAT_H_ */
@@ -0,0 +1,394 @@
+/*
+ * Astra Core (Memory)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "assert.h"
+#include "memory.h"
+
+#ifdef WITH_MEMSTAT
+#   include "list.h"
+#   include "metrics.h"
+#endif
+
+#ifndef _WIN32
+#   include <sys/mman.h>
+#endif
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#   include <sys/syscall.h>
+#   ifndef MPOL_PREFERRED
+#       define MPOL_PREFERRED 1
+#   endif
+#endif
+
+#define MSG(_msg) "[core/memory] " _msg
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define PAGE_SIZE_MIN 4096
+
+static size_t ring_size(size_t size)
+{
+    const size_t align = (size >= HUGEPAGE_SIZE) ? HUGEPAGE_SIZE : PAGE_SIZE_MIN;
+    return (size + align - 1) & ~(align - 1);
+}
+
+#ifndef _WIN32
+
+static void ring_bind(void *ptr, size_t size, int numa_node)
+{
+#if defined(__linux__) && defined(__NR_mbind)
+    if(numa_node < 0 || numa_node >= (int)(sizeof(unsigned long) * 8))
+        return;
+
+    /* pages are not touched yet, the policy places them on the first write */
+    const unsigned long mask = 1UL << numa_node;
+    syscall(__NR_mbind, ptr, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+#else
+    __uarg(ptr);
+    __uarg(size);
+    __uarg(numa_node);
+#endif
+}
+
+static void * ring_map_huge(size_t size)
+{
+#ifdef MAP_HUGETLB
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE
+                     , MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(ptr != MAP_FAILED)
+        return ptr;
+#endif
+
+    /* aligned to the hugepage, so the whole buffer may be collapsed by THP */
+    uint8_t *map = (uint8_t *)mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE
+                                   , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED)
+        return NULL;
+
+    const size_t head = (HUGEPAGE_SIZE - ((uintptr_t)map & (HUGEPAGE_SIZE - 1)))
+                      & (HUGEPAGE_SIZE - 1);
+    if(head > 0)
+        munmap(map, head);
+    munmap(map + head + size, HUGEPAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(map + head, size, MADV_HUGEPAGE);
+#endif
+
+    return map + head;
+}
+
+#endif /* !_WIN32 */
+
+void * asc_ring_alloc(size_t size, int numa_node)
+{
+    size = ring_size(size);
+
+#ifdef _WIN32
+    __uarg(numa_node);
+    void *ptr = _aligned_malloc(size, PAGE_SIZE_MIN);
+#else
+    void *ptr = NULL;
+    if(size >= HUGEPAGE_SIZE)
+    {
+        ptr = ring_map_huge(size);
+    }
+    else
+    {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED)
+            ptr = NULL;
+    }
+
+    if(ptr)
+        ring_bind(ptr, size, numa_node);
+#endif
+
+    asc_assert(ptr != NULL, MSG("failed to allocate %zu bytes"), size);
+    return ptr;
+}
+
+void asc_ring_free(void *ptr, size_t size)
+{
+    if(!ptr)
+        return;
+
+#ifdef _WIN32
+    __uarg(size);
+    _aligned_free(ptr);
+#else
+    munmap(ptr, ring_size(size));
+#endif
+}
+
+void asc_ring_copy(void *dst, const void *src, size_t size)
+{
+#ifdef __SSE2__
+    if(size >= ASC_RING_COPY_MIN)
+    {
+        uint8_t *d = (uint8_t *)dst;
+        const uint8_t *s = (const uint8_t *)src;
+
+        /* non-temporal stores require 16-byte aligned destination */
+        const size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+
+        for(; size >= 64; size -= 64, d += 64, s += 64)
+        {
+            _mm_prefetch((const char *)&s[256], _MM_HINT_NTA);
+            const __m128i a = _mm_loadu_si128((const __m128i *)&s[0]);
+            const __m128i b = _mm_loadu_si128((const __m128i *)&s[16]);
+            const __m128i c = _mm_loadu_si128((const __m128i *)&s[32]);
+            const __m128i e = _mm_loadu_si128((const __m128i *)&s[48]);
+            _mm_stream_si128((__m128i *)&d[0], a);
+            _mm_stream_si128((__m128i *)&d[16], b);
+            _mm_stream_si128((__m128i *)&d[32], c);
+            _mm_stream_si128((__m128i *)&d[48], e);
+        }
+
+        for(; size >= 16; size -= 16, d += 16, s += 16)
+            _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+
+        _mm_sfence();
+        memcpy(d, s, size);
+        return;
+    }
+#endif
+
+    memcpy(dst, src, size);
+}
+
+/*
+ *  oooo     oooo ooooooooooo oooo     oooo  oooooooo8 ooooooooooo   o   ooooooooooo
+ *   8888o   888   888    88   8888o   888  888        88  888  88  888  88  888  88
+ *   88 888o8 88   888ooo8     88 888o8 88   888oooooo     888     8  88     888
+ *   88  888  88   888    oo   88  888  88          888    888    8oooo88    888
+ *  o88o  8  o88o o888ooo8888 o88o  8  o88o o88oooo888    o888o o88o  o888o o888o
+ *
+ */
+
+#ifdef WITH_MEMSTAT
+
+struct asc_memstat_t
+{
+    char *type;
+    char *name;
+
+    uint64_t bytes;
+    uint64_t count;
+
+    bool is_closed;
+    asc_metric_t *metric_list;
+};
+
+/* keeps the malloc() alignment for the user data */
+typedef union
+{
+    struct
+    {
+        asc_memstat_t *tag;
+        size_t size;
+    } h;
+    long double align_ld;
+    long long align_ll;
+    void *align_ptr;
+} memstat_header_t;
+
+static asc_list_t *memstat_list = NULL;
+
+static void memstat_account(asc_memstat_t *tag, int64_t size, int64_t count)
+{
+    __atomic_add_fetch(&tag->bytes, (uint64_t)size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tag->count, (uint64_t)count, __ATOMIC_RELAXED);
+}
+
+static void memstat_tag_free(asc_memstat_t *tag)
+{
+    free(tag->type);
+    free(tag->name);
+    free(tag);
+}
+
+/* removes destroyed tags without the live allocations. main thread only */
+static void memstat_prune(void)
+{
+    if(!memstat_list)
+        return;
+
+    asc_list_first(memstat_list);
+    while(!asc_list_eol(memstat_list))
+    {
+        asc_memstat_t *tag = (asc_memstat_t *)asc_list_data(memstat_list);
+        if(tag->is_closed
+           && __atomic_load_n(&tag->count, __ATOMIC_ACQUIRE) == 0
+           && __atomic_load_n(&tag->bytes, __ATOMIC_ACQUIRE) == 0)
+        {
+            memstat_tag_free(tag);
+            asc_list_remove_current(memstat_list);
+        }
+        else
+            asc_list_next(memstat_list);
+    }
+}
+
+asc_memstat_t * asc_memstat_init(const char *type, const char *name)
+{
+    if(!memstat_list)
+        memstat_list = asc_list_init();
+    else
+        memstat_prune();
+
+    asc_memstat_t *tag = (asc_memstat_t *)calloc(1, sizeof(asc_memstat_t));
+    asc_assert(tag != NULL, MSG("calloc() failed"));
+    tag->type = strdup(type ? type : "");
+    tag->name = strdup(name ? name : "");
+
+    char labels[256];
+    asc_metric_labels(labels, sizeof(labels), tag->type, tag->name);
+    asc_metric_register(&tag->metric_list
+                        , asc_metric_family("astra_memory_bytes", ASC_METRIC_GAUGE
+                                            , "Heap memory in use by the module instance")
+                        , labels, &tag->bytes, 1);
+    asc_metric_register(&tag->metric_list
+                        , asc_metric_family("astra_memory_allocations", ASC_METRIC_GAUGE
+                                            , "Live allocations of the module instance")
+                        , labels, &tag->count, 1);
+
+    asc_list_insert_tail(memstat_list, tag);
+    return tag;
+}
+
+void asc_memstat_destroy(asc_memstat_t *tag)
+{
+    if(!tag)
+        return;
+
+    /* series are removed now, the registry may be destroyed before the leak is freed */
+    asc_metric_unregister(&tag->metric_list);
+    tag->is_closed = true;
+
+    const uint64_t count = __atomic_load_n(&tag->count, __ATOMIC_ACQUIRE);
+    const uint64_t bytes = __atomic_load_n(&tag->bytes, __ATOMIC_ACQUIRE);
+    if(count || bytes)
+    {
+        asc_log_warning(MSG("%s \"%s\": leaked %llu bytes in %llu allocations")
+                        , tag->type, tag->name
+                        , (unsigned long long)bytes, (unsigned long long)count);
+    }
+
+    memstat_prune();
+}
+
+void asc_memstat_add(asc_memstat_t *tag, int64_t size)
+{
+    if(tag)
+        memstat_account(tag, size, 0);
+}
+
+void asc_memstat_walk(asc_memstat_callback_t callback, void *arg)
+{
+    if(!memstat_list)
+        return;
+
+    memstat_prune();
+    asc_list_for(memstat_list)
+    {
+        asc_memstat_t *tag = (asc_memstat_t *)asc_list_data(memstat_list);
+        callback(arg, tag->type, tag->name
+                 , __atomic_load_n(&tag->bytes, __ATOMIC_RELAXED)
+                 , __atomic_load_n(&tag->count, __ATOMIC_RELAXED)
+                 , tag->is_closed);
+    }
+}
+
+static void * memstat_attach(asc_memstat_t *tag, memstat_header_t *header, size_t size)
+{
+    if(!header)
+        return NULL;
+
+    header->h.tag = tag;
+    header->h.size = size;
+    if(tag)
+        memstat_account(tag, (int64_t)size, 1);
+
+    return header + 1;
+}
+
+void * asc_memstat_malloc(asc_memstat_t *tag, size_t size)
+{
+    memstat_header_t *header = (memstat_header_t *)malloc(sizeof(memstat_header_t) + size);
+    return memstat_attach(tag, header, size);
+}
+
+void * asc_memstat_calloc(asc_memstat_t *tag, size_t nmemb, size_t size)
+{
+    if(size && nmemb > (SIZE_MAX - sizeof(memstat_header_t)) / size)
+        return NULL;
+
+    size *= nmemb;
+    memstat_header_t *header = (memstat_header_t *)calloc(1, sizeof(memstat_header_t) + size);
+    return memstat_attach(tag, header, size);
+}
+
+void * asc_memstat_realloc(asc_memstat_t *tag, void *ptr, size_t size)
+{
+    if(!ptr)
+        return asc_memstat_malloc(tag, size);
+
+    memstat_header_t *header = (memstat_header_t *)ptr - 1;
+    asc_memstat_t *const prev_tag = header->h.tag;
+    const size_t prev_size = header->h.size;
+
+    header = (memstat_header_t *)realloc(header, sizeof(memstat_header_t) + size);
+    if(!header)
+        return NULL;
+
+    /* the allocation keeps the first tag */
+    header->h.size = size;
+    if(prev_tag)
+        memstat_account(prev_tag, (int64_t)size - (int64_t)prev_size, 0);
+
+    return header + 1;
+}
+
+void asc_memstat_free(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    memstat_header_t *header = (memstat_header_t *)ptr - 1;
+    asc_memstat_t *const tag = header->h.tag;
+    if(tag)
+    {
+        /* count is the last, prune checks it first */
+        __atomic_sub_fetch(&tag->bytes, (uint64_t)header->h.size, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&tag->count, 1, __ATOMIC_RELEASE);
+    }
+
+    free(header);
+}
+
+#endif /* WITH_MEMSTAT */
@@ -0,0 +1,116 @@
+/*
+ * Astra Core (Memory)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_MEMORY_H_
+#define _ASC_MEMORY_H_ 1
+
+#include "base.h"
+
+/*
+ * Large stream buffers: rings, sync buffers, write buffers. Memory is
+ * page aligned (suitable for O_DIRECT) and not initialized. Buffers of
+ * 2MB and more are rounded up to 2MB and backed by hugepages: reserved
+ * pages (MAP_HUGETLB) if available, transparent hugepages otherwise.
+ * numa_node is the preferred node of the pages, -1 - the node of the
+ * thread which writes the buffer first.
+ * Size of asc_ring_free() should be the same as on the allocation.
+ */
+
+void * asc_ring_alloc(size_t size, int numa_node) __wur;
+void asc_ring_free(void *ptr, size_t size);
+
+/*
+ * Copy to the ring which is read long after the write, like the fan-out
+ * ring of the clients. Stores bypass the cache (SSE2 movntdq), so the stream
+ * does not evict the working set of the other modules. Not for the buffers
+ * read right after the write: the reader gets the data from the memory.
+ * Copies of less than ASC_RING_COPY_MIN bytes and builds without SSE2 use
+ * memcpy(), on smaller copies the fence costs more than the saved misses.
+ * The stores are completed (sfence) before the return, the data may be
+ * published to the other thread right after.
+ */
+
+#define ASC_RING_COPY_MIN 4096
+
+void asc_ring_copy(void *dst, const void *src, size_t size);
+
+/*
+ * Memory accounting by the module type and instance. Built with
+ * --with-memstat (WITH_MEMSTAT), otherwise asc_malloc() and others are
+ * plain malloc() and the tag is NULL.
+ * Each allocation has a header with the tag and the size, so asc_free()
+ * does not need the tag and the memory may be released by other module.
+ * Counters are atomic, allocations are allowed in any thread. Tag is
+ * created and destroyed in the main thread. Tag destroyed with the live
+ * allocations is reported as the leak and kept while the memory is in use.
+ * Values are exported to the metrics registry: astra_memory_bytes and
+ * astra_memory_allocations with the type and name labels.
+ * asc_memstat_add() accounts the memory allocated in other way: rings, maps.
+ */
+
+typedef struct asc_memstat_t asc_memstat_t;
+
+/* type, name, bytes, allocations, is_closed: tag is destroyed, the memory is leaked */
+typedef void (*asc_memstat_callback_t)(  void *arg, const char *type, const char *name
+                                       , uint64_t bytes, uint64_t count, bool is_closed);
+
+#ifdef WITH_MEMSTAT
+
+asc_memstat_t * asc_memstat_init(const char *type, const char *name) __wur;
+void asc_memstat_destroy(asc_memstat_t *tag);
+void asc_memstat_add(asc_memstat_t *tag, int64_t size);
+void asc_memstat_walk(asc_memstat_callback_t callback, void *arg);
+
+void * asc_memstat_malloc(asc_memstat_t *tag, size_t size) __wur;
+void * asc_memstat_calloc(asc_memstat_t *tag, size_t nmemb, size_t size) __wur;
+void * asc_memstat_realloc(asc_memstat_t *tag, void *ptr, size_t size) __wur;
+void asc_memstat_free(void *ptr);
+
+#   define asc_malloc(_tag, _size) asc_memstat_malloc(_tag, _size)
+#   define asc_calloc(_tag, _nmemb, _size) asc_memstat_calloc(_tag, _nmemb, _size)
+#   define asc_realloc(_tag, _ptr, _size) asc_memstat_realloc(_tag, _ptr, _size)
+#   define asc_free(_ptr) asc_memstat_free(_ptr)
+
+#else
+
+static inline asc_memstat_t * asc_memstat_init(const char *type, const char *name)
+{
+    __uarg(type);
+    __uarg(name);
+    return NULL;
+}
+
+static inline void asc_memstat_destroy(asc_memstat_t *tag) { __uarg(tag); }
+static inline void asc_memstat_add(asc_memstat_t *tag, int64_t size) { __uarg(tag); __uarg(size); }
+
+static inline void asc_memstat_walk(asc_memstat_callback_t callback, void *arg)
+{
+    __uarg(callback);
+    __uarg(arg);
+}
+
+#   define asc_malloc(_tag, _size) ((void)(_tag), malloc(_size))
+#   define asc_calloc(_tag, _nmemb, _size) ((void)(_tag), calloc(_nmemb, _size))
+#   define asc_realloc(_tag, _ptr, _size) ((void)(_tag), realloc(_ptr, _size))
+#   define asc_free(_ptr) free(_ptr)
+
+#endif /* WITH_MEMSTAT */
+
+#endif /* _ASC_MEMORY_H_ */
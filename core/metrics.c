@@ -0,0 +1,323 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "assert.h"
+#include "metrics.h"
+
+#define MSG(_msg) "[core/metrics] " _msg
+
+/* initial size of the exposition buffer */
+#define METRIC_RENDER_SIZE (64 * 1024)
+
+struct asc_metric_family_t
+{
+    const char *name;
+    const char *help;
+    asc_metric_type_t type;
+
+    asc_metric_t *head;
+    asc_metric_t *tail;
+
+    asc_metric_family_t *next;
+};
+
+struct asc_metric_t
+{
+    asc_metric_family_t *family;
+    asc_metric_t *prev;
+    asc_metric_t *next;
+    asc_metric_t *owner_next;
+
+    const uint64_t *value;
+    uint32_t scale;
+
+    size_t prefix_size;
+    char prefix[]; // name{labels} with the trailing space
+};
+
+static struct
+{
+    asc_metric_family_t *head;
+    asc_metric_family_t *tail;
+
+    size_t render_size; // size of the previous exposition
+    uint32_t generation;
+} metric_observer;
+
+asc_metric_family_t * asc_metric_family(const char *name, asc_metric_type_t type
+                                        , const char *help)
+{
+    for(asc_metric_family_t *f = metric_observer.head; f; f = f->next)
+    {
+        if(!strcmp(f->name, name))
+            return f;
+    }
+
+    asc_metric_family_t *const family
+        = (asc_metric_family_t *)calloc(1, sizeof(asc_metric_family_t));
+    asc_assert(family != NULL, MSG("calloc() failed"));
+
+    family->name = name;
+    family->help = help;
+    family->type = type;
+
+    if(metric_observer.tail)
+        metric_observer.tail->next = family;
+    else
+        metric_observer.head = family;
+    metric_observer.tail = family;
+
+    return family;
+}
+
+void asc_metric_register(asc_metric_t **list, asc_metric_family_t *family
+                         , const char *labels, const uint64_t *value, uint32_t scale)
+{
+    const size_t name_size = strlen(family->name);
+    const size_t labels_size = (labels) ? strlen(labels) : 0;
+    const size_t prefix_size = name_size + ((labels_size) ? labels_size + 2 : 0) + 1;
+
+    asc_metric_t *const metric = (asc_metric_t *)malloc(sizeof(asc_metric_t) + prefix_size + 1);
+    asc_assert(metric != NULL, MSG("malloc() failed"));
+
+    char *c = metric->prefix;
+    memcpy(c, family->name, name_size);
+    c += name_size;
+    if(labels_size)
+    {
+        *c++ = '{';
+        memcpy(c, labels, labels_size);
+        c += labels_size;
+        *c++ = '}';
+    }
+    *c++ = ' ';
+    *c = '\0';
+
+    metric->prefix_size = prefix_size;
+    metric->family = family;
+    metric->value = value;
+    metric->scale = (scale) ? scale : 1;
+
+    metric->next = NULL;
+    metric->prev = family->tail;
+    if(family->tail)
+        family->tail->next = metric;
+    else
+        family->head = metric;
+    family->tail = metric;
+
+    metric->owner_next = *list;
+    *list = metric;
+
+    ++metric_observer.generation;
+}
+
+void asc_metric_unregister(asc_metric_t **list)
+{
+    asc_metric_t *metric = *list;
+    while(metric)
+    {
+        asc_metric_t *const owner_next = metric->owner_next;
+        asc_metric_family_t *const family = metric->family;
+
+        if(metric->prev)
+            metric->prev->next = metric->next;
+        else
+            family->head = metric->next;
+
+        if(metric->next)
+            metric->next->prev = metric->prev;
+        else
+            family->tail = metric->prev;
+
+        free(metric);
+        metric = owner_next;
+
+        ++metric_observer.generation;
+    }
+    *list = NULL;
+}
+
+size_t asc_metric_labels(char *dst, size_t size, const char *type, const char *name)
+{
+    const char *const key_list[] = { "type", "name" };
+    const char *const value_list[] = { type, name };
+
+    size_t skip = 0;
+    for(size_t i = 0; i < ASC_ARRAY_SIZE(key_list); ++i)
+    {
+        const char *value = value_list[i];
+        if(!value)
+            continue;
+
+        skip += snprintf(&dst[skip], (skip < size) ? size - skip : 0
+                         , "%s%s=\"", (skip) ? "," : "", key_list[i]);
+
+        for(; *value; ++value)
+        {
+            /* \, " and the line feed are escaped in the label values */
+            const char c = *value;
+            const char e = (c == '\\' || c == '"') ? c : ((c == '\n') ? 'n' : 0);
+            if(e)
+            {
+                if(skip + 2 < size)
+                {
+                    dst[skip] = '\\';
+                    dst[skip + 1] = e;
+                }
+                skip += 2;
+            }
+            else
+            {
+                if(skip + 1 < size)
+                    dst[skip] = c;
+                skip += 1;
+            }
+        }
+
+        if(skip + 1 < size)
+            dst[skip] = '"';
+        skip += 1;
+    }
+
+    if(size > 0)
+        dst[(skip < size) ? skip : size - 1] = '\0';
+
+    return skip;
+}
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t skip;
+} metric_render_t;
+
+static void render_reserve(metric_render_t *r, size_t size)
+{
+    if(r->skip + size <= r->size)
+        return;
+
+    while(r->skip + size > r->size)
+        r->size *= 2;
+
+    r->buffer = (char *)realloc(r->buffer, r->size);
+    asc_assert(r->buffer != NULL, MSG("realloc() failed"));
+}
+
+static void render_string(metric_render_t *r, const char *str, size_t size)
+{
+    render_reserve(r, size);
+    memcpy(&r->buffer[r->skip], str, size);
+    r->skip += size;
+}
+
+static void render_number(metric_render_t *r, uint64_t value)
+{
+    char digits[24];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while(value);
+
+    render_reserve(r, count + 1);
+    while(count > 0)
+        r->buffer[r->skip++] = digits[--count];
+    r->buffer[r->skip++] = '\n';
+}
+
+char * asc_metric_render(size_t *size)
+{
+    static const char *const type_list[] = { "counter", "gauge" };
+
+    metric_render_t r;
+    r.size = (metric_observer.render_size > METRIC_RENDER_SIZE)
+           ? metric_observer.render_size + metric_observer.render_size / 8
+           : METRIC_RENDER_SIZE;
+    r.skip = 0;
+    r.buffer = (char *)malloc(r.size);
+    asc_assert(r.buffer != NULL, MSG("malloc() failed"));
+
+    for(const asc_metric_family_t *f = metric_observer.head; f; f = f->next)
+    {
+        if(!f->head)
+            continue;
+
+        char header[512];
+        const int header_size = snprintf(header, sizeof(header)
+                                         , "# HELP %s %s\n# TYPE %s %s\n"
+                                         , f->name, f->help
+                                         , f->name, type_list[f->type]);
+        render_string(&r, header, ((size_t)header_size < sizeof(header))
+                                  ? (size_t)header_size
+                                  : sizeof(header) - 1);
+
+        for(const asc_metric_t *m = f->head; m; m = m->next)
+        {
+            render_string(&r, m->prefix, m->prefix_size);
+            render_number(&r, __atomic_load_n(m->value, __ATOMIC_RELAXED) * m->scale);
+        }
+    }
+
+    metric_observer.render_size = r.skip;
+    *size = r.skip;
+    return r.buffer;
+}
+
+void asc_metric_walk(asc_metric_walk_t fn, void *arg)
+{
+    for(const asc_metric_family_t *f = metric_observer.head; f; f = f->next)
+    {
+        for(const asc_metric_t *m = f->head; m; m = m->next)
+        {
+            fn(arg, m->prefix, m->prefix_size - 1, f->type
+               , __atomic_load_n(m->value, __ATOMIC_RELAXED) * m->scale);
+        }
+    }
+}
+
+uint32_t asc_metric_generation(void)
+{
+    return metric_observer.generation;
+}
+
+void asc_metric_core_destroy(void)
+{
+    asc_metric_family_t *family = metric_observer.head;
+    while(family)
+    {
+        asc_metric_family_t *const next = family->next;
+
+        asc_metric_t *metric = family->head;
+        while(metric)
+        {
+            asc_metric_t *const metric_next = metric->next;
+            free(metric);
+            metric = metric_next;
+        }
+
+        free(family);
+        family = next;
+    }
+
+    memset(&metric_observer, 0, sizeof(metric_observer));
+}
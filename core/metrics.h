@@ -0,0 +1,74 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_METRICS_H_
+#define _ASC_METRICS_H_ 1
+
+#include "base.h"
+
+/*
+ * Registry of the counters and gauges in the Prometheus text format.
+ * A series keeps the pointer to the value owned by the module, so the
+ * module updates its counter as before and the value is read on scrape only.
+ * Values written by the other threads should be aligned uint64_t.
+ */
+
+typedef enum
+{
+    ASC_METRIC_COUNTER = 0,
+    ASC_METRIC_GAUGE = 1,
+} asc_metric_type_t;
+
+typedef struct asc_metric_family_t asc_metric_family_t;
+typedef struct asc_metric_t asc_metric_t;
+
+/* returns the family by name, created on the first call. strings should be static */
+asc_metric_family_t * asc_metric_family(const char *name, asc_metric_type_t type
+                                        , const char *help) __wur;
+
+/*
+ * Adds the series to the owner list. labels is the text inside the braces,
+ * see asc_metric_labels(), copied. the value is multiplied by the scale
+ */
+void asc_metric_register(asc_metric_t **list, asc_metric_family_t *family
+                         , const char *labels, const uint64_t *value, uint32_t scale);
+/* removes all series of the owner list */
+void asc_metric_unregister(asc_metric_t **list);
+
+/* formats type="...",name="..." with the escaped values. returns the length */
+size_t asc_metric_labels(char *dst, size_t size, const char *type, const char *name);
+
+/* returns the text exposition, size is the length. free() by the caller */
+char * asc_metric_render(size_t *size) __wur;
+
+/*
+ * Calls the function for each series in the exposition order. series is
+ * name{labels} without the value, size is the length. The value is scaled
+ */
+typedef void (*asc_metric_walk_t)(void *arg, const char *series, size_t size
+                                  , asc_metric_type_t type, uint64_t value);
+void asc_metric_walk(asc_metric_walk_t fn, void *arg);
+
+/* changed on each register and unregister, the list of the series is the same otherwise */
+uint32_t asc_metric_generation(void) __wur;
+
+void asc_metric_core_destroy(void);
+
+#endif /* _ASC_METRICS_H_ */
@@ -1 +1 @@
-SOURCES="clock.c compat.c event.c list.c log.c loopctl.c socket.c strbuffer.c thread.c timer.c"
+SOURCES="clock.c command.c compat.c event.c handover.c job.c list.c log.c loopctl.c loopstat.c memory.c metrics.c profile.c resolve.c socket.c strbuffer.c thread.c timer.c"
@@ -0,0 +1,152 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "assert.h"
+#include "loopstat.h"
+#include "profile.h"
+
+#define PROFILE_HASH_SIZE 1024
+
+bool asc_profile_enabled = false;
+unsigned int asc_profile_tick = 0;
+
+static struct
+{
+    asc_profile_t *hash[PROFILE_HASH_SIZE];
+    asc_profile_t other;
+
+    uint64_t start_time;
+    uint64_t start_clock;
+} profile_observer;
+
+static inline size_t profile_hash(const void *owner)
+{
+    const uintptr_t x = (uintptr_t)owner;
+    return ((x >> 4) ^ (x >> 14)) & (PROFILE_HASH_SIZE - 1);
+}
+
+static void profile_reset(asc_profile_t *profile)
+{
+    profile->packets_in = 0;
+    profile->packets_out = 0;
+    profile->stream_calls = 0;
+    profile->stream_cycles = 0;
+    profile->child_cycles = 0;
+    profile->event_calls = 0;
+    profile->event_cycles = 0;
+}
+
+void asc_profile_core_destroy(void)
+{
+    asc_profile_enabled = false;
+    profile_reset(&profile_observer.other);
+}
+
+asc_profile_t * asc_profile_register(const void *owner, const char *type, const char *name)
+{
+    asc_profile_t *const profile = (asc_profile_t *)calloc(1, sizeof(asc_profile_t));
+    asc_assert(profile != NULL, "[core/profile] calloc() failed");
+
+    profile->owner = owner;
+    profile->type = type;
+    profile->name = (name) ? strdup(name) : NULL;
+
+    asc_profile_t **const head = &profile_observer.hash[profile_hash(owner)];
+    profile->next = *head;
+    *head = profile;
+
+    return profile;
+}
+
+void asc_profile_unregister(asc_profile_t *profile)
+{
+    asc_profile_t **ptr = &profile_observer.hash[profile_hash(profile->owner)];
+    for(; *ptr; ptr = &(*ptr)->next)
+    {
+        if(*ptr == profile)
+        {
+            *ptr = profile->next;
+            break;
+        }
+    }
+
+    free(profile->name);
+    free(profile);
+}
+
+void asc_profile_enable(bool is_enabled)
+{
+    asc_profile_enabled = is_enabled;
+    if(!is_enabled)
+        return;
+
+    for(size_t i = 0; i < PROFILE_HASH_SIZE; ++i)
+    {
+        for(asc_profile_t *profile = profile_observer.hash[i]; profile; profile = profile->next)
+            profile_reset(profile);
+    }
+    profile_reset(&profile_observer.other);
+
+    profile_observer.start_time = asc_utime();
+    profile_observer.start_clock = asc_profile_clock();
+}
+
+const asc_profile_t * asc_profile_other(void)
+{
+    return &profile_observer.other;
+}
+
+uint64_t asc_profile_time(void)
+{
+    return asc_utime() - profile_observer.start_time;
+}
+
+double asc_profile_cycles_us(void)
+{
+    const uint64_t time = asc_profile_time();
+    if(time == 0)
+        return 1.0;
+
+    return (double)(asc_profile_clock() - profile_observer.start_clock) / time;
+}
+
+void asc_profile_foreach(void (*callback)(void *, const asc_profile_t *), void *arg)
+{
+    for(size_t i = 0; i < PROFILE_HASH_SIZE; ++i)
+    {
+        for(asc_profile_t *profile = profile_observer.hash[i]; profile; profile = profile->next)
+            callback(arg, profile);
+    }
+}
+
+void asc_profile_event(const void *owner, uint64_t cycles)
+{
+    asc_profile_t *profile = profile_observer.hash[profile_hash(owner)];
+    while(profile && profile->owner != owner)
+        profile = profile->next;
+
+    if(!profile)
+        profile = &profile_observer.other;
+
+    profile->event_calls += ASC_PROFILE_SAMPLE;
+    profile->event_cycles += cycles * ASC_PROFILE_SAMPLE;
+
+    asc_hist_add(&asc_loopstat.callback, cycles);
+}
@@ -0,0 +1,113 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_PROFILE_H_
+#define _ASC_PROFILE_H_ 1
+
+#include "base.h"
+#include "clock.h"
+#include "loopstat.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#endif
+
+/*
+ * CPU time accounting by owner. Owner is the module instance, the same
+ * pointer as the arg of its socket, timer and thread callbacks. Callbacks
+ * are timed once in ASC_PROFILE_SAMPLE calls, the time is multiplied.
+ * Disabled by default, then the cost is one check of asc_profile_enabled.
+ */
+
+#define ASC_PROFILE_SAMPLE 16
+
+typedef struct asc_profile_t asc_profile_t;
+
+struct asc_profile_t
+{
+    const void *owner;
+    const char *type;
+    char *name;
+
+    uint64_t packets_in;
+    uint64_t packets_out;
+    uint64_t stream_calls;
+    uint64_t stream_cycles; // in the stream callbacks, including the children
+    uint64_t child_cycles;  // in the stream callbacks of the children
+    uint64_t event_calls;
+    uint64_t event_cycles;  // in the socket, timer and thread callbacks
+
+    asc_hist_t *latency; // sampled packet latency of the module stream
+
+    asc_profile_t *next; // hash chain
+};
+
+extern bool asc_profile_enabled;
+extern unsigned int asc_profile_tick;
+
+void asc_profile_core_destroy(void);
+
+/* type should be a static string, name is copied */
+asc_profile_t * asc_profile_register(const void *owner, const char *type, const char *name) __wur;
+void asc_profile_unregister(asc_profile_t *profile);
+
+/* starts accounting, counters are reset */
+void asc_profile_enable(bool is_enabled);
+
+/* callbacks with unknown owner are accounted here */
+const asc_profile_t * asc_profile_other(void) __func_pure;
+/* TSC cycles in one microsecond since asc_profile_enable() */
+double asc_profile_cycles_us(void);
+/* microseconds since asc_profile_enable() */
+uint64_t asc_profile_time(void);
+void asc_profile_foreach(void (*callback)(void *, const asc_profile_t *), void *arg);
+
+void asc_profile_event(const void *owner, uint64_t cycles);
+
+static inline uint64_t asc_profile_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return asc_utime();
+#endif
+}
+
+static inline bool asc_profile_sample(void)
+{
+    return ((++asc_profile_tick) & (ASC_PROFILE_SAMPLE - 1)) == 0;
+}
+
+#define asc_profile_callback(_owner, _call)                                                     \
+    {                                                                                           \
+        if(asc_profile_enabled && asc_profile_sample())                                         \
+        {                                                                                       \
+            const void *const __owner = _owner;                                                 \
+            const uint64_t __start = asc_profile_clock();                                       \
+            _call;                                                                              \
+            asc_profile_event(__owner, asc_profile_clock() - __start);                          \
+        }                                                                                       \
+        else                                                                                    \
+        {                                                                                       \
+            _call;                                                                              \
+        }                                                                                       \
+    }
+
+#endif /* _ASC_PROFILE_H_ */
@@ -0,0 +1,254 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host name cache for the clients: http_request, newcamd and others.
+ * getaddrinfo() is blocking, so the lookup is made in a thread and the
+ * waiters are called from the main loop. Concurrent lookups of the same
+ * host are merged into one. Resolved address is kept for RESOLVE_TTL,
+ * failed lookup is not repeated for RESOLVE_ERROR_TTL. If the lookup
+ * is failed but the host has been resolved before, the last address is used.
+ */
+
+#include "assert.h"
+#include "resolve.h"
+#include "clock.h"
+#include "list.h"
+#include "log.h"
+#include "thread.h"
+#include "timer.h"
+
+#ifdef _WIN32
+#   include <ws2tcpip.h>
+#else
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <netdb.h>
+#endif
+
+#define MSG(_msg) "[core/resolve %s] " _msg, entry->host
+
+#define RESOLVE_TTL (60 * 1000000ULL)
+#define RESOLVE_ERROR_TTL (5 * 1000000ULL)
+#define RESOLVE_STALE_TTL (600 * 1000000ULL) // keep the last address after expiration
+
+typedef struct
+{
+    char *host;
+
+    bool is_resolved; // addr is valid
+    char addr[16];
+    uint64_t expire;
+
+    // lookup thread
+    asc_thread_t *thread;
+    struct in_addr result;
+    int error;
+
+    asc_timer_t *dispatch;
+    asc_list_t *waiters;
+} resolve_entry_t;
+
+struct asc_resolve_t
+{
+    resolve_entry_t *entry;
+
+    asc_resolve_callback_t callback;
+    void *arg;
+};
+
+static asc_list_t *resolve_cache = NULL;
+
+static void entry_destroy(resolve_entry_t *entry)
+{
+    asc_list_destroy(entry->waiters);
+    free(entry->host);
+    free(entry);
+}
+
+static resolve_entry_t * entry_find(const char *host)
+{
+    if(!resolve_cache)
+        resolve_cache = asc_list_init();
+
+    const uint64_t now = asc_utime_coarse();
+    resolve_entry_t *found = NULL;
+
+    asc_list_first(resolve_cache);
+    while(!asc_list_eol(resolve_cache))
+    {
+        resolve_entry_t *entry = (resolve_entry_t *)asc_list_data(resolve_cache);
+
+        if(!strcmp(entry->host, host))
+            found = entry;
+        else if(   !entry->thread
+                && !entry->dispatch
+                && now > entry->expire + RESOLVE_STALE_TTL)
+        {
+            asc_list_remove_current(resolve_cache);
+            entry_destroy(entry);
+            continue;
+        }
+
+        asc_list_next(resolve_cache);
+    }
+
+    return found;
+}
+
+static void entry_dispatch(resolve_entry_t *entry)
+{
+    const char *addr = (entry->is_resolved) ? entry->addr : NULL;
+
+    /* callback may add and cancel waiters, always take the first one */
+    while(asc_list_size(entry->waiters) > 0)
+    {
+        asc_list_first(entry->waiters);
+        asc_resolve_t *resolve = (asc_resolve_t *)asc_list_data(entry->waiters);
+        asc_list_remove_current(entry->waiters);
+
+        resolve->entry = NULL;
+        resolve->callback(resolve->arg, addr);
+        free(resolve);
+    }
+}
+
+static void on_dispatch(void *arg)
+{
+    resolve_entry_t *entry = (resolve_entry_t *)arg;
+
+    asc_timer_destroy(entry->dispatch);
+    entry->dispatch = NULL;
+
+    entry_dispatch(entry);
+}
+
+static void thread_loop(void *arg)
+{
+    resolve_entry_t *entry = (resolve_entry_t *)arg;
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    entry->error = getaddrinfo(entry->host, NULL, &hints, &res);
+    if(entry->error == 0)
+    {
+        entry->result = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+}
+
+static void on_thread_close(void *arg)
+{
+    resolve_entry_t *entry = (resolve_entry_t *)arg;
+
+    asc_thread_destroy(entry->thread);
+    entry->thread = NULL;
+
+    const uint64_t now = asc_utime_coarse();
+
+    if(entry->error == 0)
+    {
+        entry->is_resolved = true;
+        snprintf(entry->addr, sizeof(entry->addr), "%s", inet_ntoa(entry->result));
+        entry->expire = now + RESOLVE_TTL;
+    }
+    else
+    {
+        if(entry->is_resolved)
+        {
+            asc_log_warning(MSG("getaddrinfo() failed [%s]. use last address %s")
+                            , gai_strerror(entry->error), entry->addr);
+        }
+        else
+        {
+            asc_log_error(MSG("getaddrinfo() failed [%s]"), gai_strerror(entry->error));
+        }
+        entry->expire = now + RESOLVE_ERROR_TTL;
+    }
+
+    entry_dispatch(entry);
+}
+
+const char * asc_resolve_cached(const char *host)
+{
+    if(inet_addr(host) != INADDR_NONE)
+        return host;
+
+    resolve_entry_t *entry = entry_find(host);
+    if(entry && entry->is_resolved && asc_utime_coarse() < entry->expire)
+        return entry->addr;
+
+    return NULL;
+}
+
+asc_resolve_t * asc_resolve(const char *host, asc_resolve_callback_t callback, void *arg)
+{
+    resolve_entry_t *entry = entry_find(host);
+    if(!entry)
+    {
+        entry = (resolve_entry_t *)calloc(1, sizeof(resolve_entry_t));
+        entry->host = strdup(host);
+        entry->waiters = asc_list_init();
+        asc_list_insert_tail(resolve_cache, entry);
+    }
+
+    asc_resolve_t *resolve = (asc_resolve_t *)calloc(1, sizeof(asc_resolve_t));
+    resolve->entry = entry;
+    resolve->callback = callback;
+    resolve->arg = arg;
+    asc_list_insert_tail(entry->waiters, resolve);
+
+    if(entry->thread)
+        return resolve; // lookup is in progress
+
+    if(entry->expire && asc_utime_coarse() < entry->expire)
+    {
+        /* result is cached. callback is never called before return */
+        if(!entry->dispatch)
+            entry->dispatch = asc_timer_init(0, on_dispatch, entry);
+        return resolve;
+    }
+
+    entry->thread = asc_thread_init(entry);
+    asc_thread_set_name(entry->thread, "resolver");
+    asc_thread_start(entry->thread, thread_loop, NULL, NULL, on_thread_close);
+
+    return resolve;
+}
+
+void asc_resolve_cancel(asc_resolve_t *resolve)
+{
+    if(!resolve)
+        return;
+
+    resolve_entry_t *entry = resolve->entry;
+    asc_list_remove_item(entry->waiters, resolve);
+    free(resolve);
+
+    if(entry->dispatch && asc_list_size(entry->waiters) == 0)
+    {
+        asc_timer_destroy(entry->dispatch);
+        entry->dispatch = NULL;
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_RESOLVE_H_
+#define _ASC_RESOLVE_H_ 1
+
+#include "base.h"
+
+typedef struct asc_resolve_t asc_resolve_t;
+
+/* addr is NULL if the host is not resolved */
+typedef void (*asc_resolve_callback_t)(void *arg, const char *addr);
+
+/* returns address if the host is numeric or resolved, otherwise NULL */
+const char * asc_resolve_cached(const char *host) __wur;
+
+/* callback is called once from the main loop. handle is not valid after the callback */
+asc_resolve_t * asc_resolve(const char *host, asc_resolve_callback_t callback, void *arg);
+void asc_resolve_cancel(asc_resolve_t *resolve);
+
+#endif /* _ASC_RESOLVE_H_ */
@@ -19,9 +19,13 @@
  */
 
 #include "assert.h"
+#include "clock.h"
 #include "socket.h"
 #include "event.h"
 #include "log.h"
+#include "profile.h"
+#include "timer.h"
+#include "trace.h"
 
 #ifdef _WIN32
 #   include <ws2tcpip.h>
@@ -37,15 +41,35 @@
 #       include <netinet/sctp.h>
 #   endif
 #   include <netdb.h>
+#   ifdef HAVE_SO_TXTIME
+#       include <linux/net_tstamp.h>
+#   endif
+#   ifdef HAVE_MSG_ZEROCOPY
+#       include <linux/errqueue.h>
+#   endif
+#   if defined(__linux__) && defined(SO_MEMINFO)
+#       include <linux/sock_diag.h>
+#   endif
 #endif
 
 #ifdef IGMP_EMULATION
 #   define IP_HEADER_SIZE 24
 #   define IGMP_HEADER_SIZE 8
+
+/* raw socket for the IGMP reports, opened on the first report */
+static int igmp_sock = -1;
 #endif
 
 #define MSG(_msg) "[core/socket %d] " _msg, sock->fd
 
+/* immutable, replaced on the change, see socket_fanout_publish() */
+typedef struct socket_fanout_t
+{
+    struct socket_fanout_t *retired; // next replaced list, see socket_fanout_reclaim()
+    int count;
+    struct sockaddr_in addr[];
+} socket_fanout_t;
+
 struct asc_socket_t
 {
     int fd;
@@ -54,17 +78,32 @@ struct asc_socket_t
     int protocol;
 
     asc_event_t *event;
+    asc_event_recv_t *recv; // see asc_socket_set_on_recv()
+    uint32_t send_errors; // see asc_socket_sendto_async()
+    bool is_edge; // see asc_socket_set_edge()
+    asc_event_priority_t priority; // see asc_socket_set_priority()
+    bool is_rxq_ovfl; // see asc_socket_set_rxq_ovfl()
+    uint32_t rx_dropped; // last SO_RXQ_OVFL value
 
     struct sockaddr_in addr;
     struct sockaddr_in sockaddr; /* recvfrom, sendto, set_sockaddr */
 
+    /* sendto: additional destinations, see asc_socket_add_destination() */
+    socket_fanout_t *fanout;
+    int fanout_users;
+    socket_fanout_t *fanout_retired; /* replaced lists, may be held by the sender */
+    asc_timer_t *fanout_timer;
+
     struct ip_mreq mreq;
+    struct in_addr mreq_source; /* INADDR_ANY for any-source multicast */
 
     /* Callbacks */
     void *arg;
     event_callback_t on_read;      /* data read */
     event_callback_t on_close;     /* error occured (connection closed) */
     event_callback_t on_ready;     /* data send is possible now */
+    event_callback_t on_zerocopy;  /* zerocopy completion in the error queue */
+    asc_socket_recv_callback_t on_recv; /* datagram received by the event loop */
 };
 
 /*
@@ -72,6 +111,54 @@ struct asc_socket_t
  * receiving multicast: socket(REUSEADDR | BIND) -> join() -> read() -> close()
  */
 
+/* sendto: capacity of the fan-out list and messages per sendmmsg() */
+#ifndef SOCKET_FANOUT_MAX
+#   define SOCKET_FANOUT_MAX 256
+#endif
+#define SOCKET_FANOUT_BATCH 256
+#ifndef SOCKET_FANOUT_RECLAIM_INTERVAL
+#   define SOCKET_FANOUT_RECLAIM_INTERVAL 100 // ms, retry to free the replaced lists
+#endif
+
+/* ancillary data of the received datagram: IP_PKTINFO, SCM_TIMESTAMPNS, SO_RXQ_OVFL */
+#define SOCKET_CMSG_SIZE 128
+
+/* closed objects are kept for the next accept() */
+#ifndef SOCKET_POOL_SIZE
+#   define SOCKET_POOL_SIZE 256
+#endif
+
+static asc_socket_t *socket_pool[SOCKET_POOL_SIZE];
+static size_t socket_pool_count = 0;
+
+static asc_socket_t * socket_alloc(void)
+{
+    if(socket_pool_count == 0)
+        return (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
+
+    asc_socket_t *sock = socket_pool[--socket_pool_count];
+    memset(sock, 0, sizeof(asc_socket_t));
+    return sock;
+}
+
+static void socket_fanout_free(socket_fanout_t *fanout)
+{
+    while(fanout)
+    {
+        socket_fanout_t *const next = fanout->retired;
+        free(fanout);
+        fanout = next;
+    }
+}
+
+static void socket_free(asc_socket_t *sock)
+{
+    if(socket_pool_count < SOCKET_POOL_SIZE)
+        socket_pool[socket_pool_count++] = sock;
+    else
+        free(sock);
+}
+
 void asc_socket_core_init(void)
 {
 #ifdef _WIN32
@@ -85,10 +172,19 @@ void asc_socket_core_init(void)
 
 void asc_socket_core_destroy(void)
 {
+    while(socket_pool_count > 0)
+        free(socket_pool[--socket_pool_count]);
+
+#ifdef IGMP_EMULATION
+    if(igmp_sock != -1)
+    {
+        close(igmp_sock);
+        igmp_sock = -1;
+    }
+#endif
+
 #ifdef _WIN32
     WSACleanup();
-#else
-    ;
 #endif
 }
 
@@ -129,7 +225,7 @@ static asc_socket_t * __socket_open(int family, int type, int protocol, void * a
 {
     const int fd = socket(family, type, protocol);
     asc_assert(fd != -1, "[core/socket] failed to open socket [%s]", asc_socket_error());
-    asc_socket_t *sock = (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
+    asc_socket_t *sock = socket_alloc();
     sock->fd = fd;
     sock->mreq.imr_multiaddr.s_addr = INADDR_NONE;
     sock->family = family;
@@ -163,6 +259,29 @@ asc_socket_t * asc_socket_open_sctp4(void * arg)
 #endif
 }
 
+asc_socket_t * asc_socket_open_fd(int fd, void * arg)
+{
+    asc_socket_t *sock = socket_alloc();
+    sock->fd = fd;
+    sock->mreq.imr_multiaddr.s_addr = INADDR_NONE;
+    sock->family = PF_INET;
+    sock->arg = arg;
+
+    socklen_t optlen = sizeof(sock->type);
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, (void *)&sock->type, &optlen);
+    sock->protocol = (sock->type == SOCK_DGRAM) ? IPPROTO_UDP : IPPROTO_TCP;
+#ifdef SO_PROTOCOL
+    optlen = sizeof(sock->protocol);
+    getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, (void *)&sock->protocol, &optlen);
+#endif
+
+    optlen = sizeof(sock->addr);
+    getsockname(fd, (struct sockaddr *)&sock->addr, &optlen);
+
+    asc_socket_set_nonblock(sock, true);
+    return sock;
+}
+
 /*
  *   oooooooo8 ooooo         ooooooo    oooooooo8 ooooooooooo
  * o888     88  888        o888   888o 888         888    88
@@ -194,6 +313,8 @@ void asc_socket_close(asc_socket_t *sock)
 
     if(sock->event)
         asc_event_close(sock->event);
+    ASC_FREE(sock->recv, asc_event_recv_close);
+    asc_event_send_detach(sock);
 
     if(sock->fd > 0)
     {
@@ -204,7 +325,10 @@ void asc_socket_close(asc_socket_t *sock)
 #endif
     }
     sock->fd = 0;
-    free(sock);
+    ASC_FREE(sock->fanout_timer, asc_timer_destroy);
+    ASC_FREE(sock->fanout, free);
+    socket_fanout_free(sock->fanout_retired);
+    socket_free(sock);
 }
 
 /*
@@ -219,8 +343,22 @@ void asc_socket_close(asc_socket_t *sock)
 static void __asc_socket_on_close(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
+#ifdef HAVE_MSG_ZEROCOPY
+    if(sock->on_zerocopy)
+    {
+        /* completions raise EPOLLERR without a pending socket error */
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, (void *)&error, &len);
+        if(error == 0)
+        {
+            asc_profile_callback(sock->arg, sock->on_zerocopy(sock->arg));
+            return;
+        }
+    }
+#endif
     if(sock->on_close)
-        sock->on_close(sock->arg);
+        asc_profile_callback(sock->arg, sock->on_close(sock->arg));
 }
 
 static void __asc_socket_on_connect(void *arg)
@@ -228,7 +366,7 @@ static void __asc_socket_on_connect(void *arg)
     asc_socket_t *sock = (asc_socket_t *)arg;
     asc_event_set_on_write(sock->event, NULL);
     event_callback_t __on_ready = sock->on_ready;
-    sock->on_ready(sock->arg);
+    asc_profile_callback(sock->arg, sock->on_ready(sock->arg));
     if(__on_ready == sock->on_ready)
         sock->on_ready = NULL;
 }
@@ -236,21 +374,21 @@ static void __asc_socket_on_connect(void *arg)
 static void __asc_socket_on_accept(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
-    sock->on_read(sock->arg);
+    asc_profile_callback(sock->arg, sock->on_read(sock->arg));
 }
 
 static void __asc_socket_on_read(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
     if(sock->on_read)
-        sock->on_read(sock->arg);
+        asc_profile_callback(sock->arg, sock->on_read(sock->arg));
 }
 
 static void __asc_socket_on_ready(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
     if(sock->on_ready)
-        sock->on_ready(sock->arg);
+        asc_profile_callback(sock->arg, sock->on_ready(sock->arg));
 }
 
 static bool __asc_socket_check_event(asc_socket_t *sock)
@@ -262,7 +400,12 @@ static bool __asc_socket_check_event(asc_socket_t *sock)
     if(sock->event == NULL)
     {
         if(is_callback == true)
+        {
             sock->event = asc_event_init(sock->fd, sock);
+            asc_event_set_priority(sock->event, sock->priority);
+            if(sock->is_edge)
+                asc_event_set_edge(sock->event);
+        }
     }
     else
     {
@@ -276,6 +419,11 @@ static bool __asc_socket_check_event(asc_socket_t *sock)
     return (sock->event != NULL);
 }
 
+void asc_socket_set_arg(asc_socket_t *sock, void *arg)
+{
+    sock->arg = arg;
+}
+
 void asc_socket_set_on_read(asc_socket_t *sock, event_callback_t on_read)
 {
     if(sock->on_read == on_read)
@@ -306,6 +454,94 @@ void asc_socket_set_on_ready(asc_socket_t * sock, event_callback_t on_ready)
     }
 }
 
+#ifndef _WIN32
+static void socket_cmsg(  asc_socket_t *sock, struct msghdr *msg
+                        , uint32_t *dst, uint64_t *time);
+
+static void __asc_socket_on_recv(  void *arg, void *opaque
+                                 , const uint8_t *buffer, size_t size
+                                 , void *control, size_t control_size)
+{
+    asc_socket_t *sock = (asc_socket_t *)arg;
+    asc_trace3(socket_recv, sock->fd, size, size);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = control_size;
+
+    uint64_t time = 0;
+    socket_cmsg(sock, &msg, NULL, &time);
+
+    asc_profile_callback(sock->arg, sock->on_recv(sock->arg, opaque, buffer, size, time));
+}
+
+static void __asc_socket_on_recv_error(void *arg)
+{
+    asc_socket_t *sock = (asc_socket_t *)arg;
+    if(sock->on_close)
+        asc_profile_callback(sock->arg, sock->on_close(sock->arg));
+}
+#endif
+
+/*
+ * Multishot receive of the io_uring backend instead of on_read. Datagrams are
+ * received to the buffers of asc_socket_recv_provide(), up to count buffers
+ * are kept by the kernel. The buffer with the datagram goes back to the owner
+ * in on_recv, buffers kept by the kernel on the close go to on_release.
+ * The receive error calls on_close
+ */
+bool asc_socket_set_on_recv(  asc_socket_t *sock, int count
+                            , asc_socket_recv_callback_t on_recv
+                            , event_callback_t on_release)
+{
+#ifndef _WIN32
+    asc_assert(sock->recv == NULL && sock->on_read == NULL, MSG("receive is defined already"));
+
+    sock->recv = asc_event_recv_init(  sock->fd, count, ASC_SOCKET_RECV_HEADROOM
+                                     , __asc_socket_on_recv, on_release
+                                     , __asc_socket_on_recv_error, sock);
+    if(!sock->recv)
+        return false;
+
+    sock->on_recv = on_recv;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(count);
+    __uarg(on_recv);
+    __uarg(on_release);
+    return false;
+#endif
+}
+
+/* size - buffer with ASC_SOCKET_RECV_HEADROOM bytes before the datagram */
+void asc_socket_recv_provide(asc_socket_t *sock, void *buffer, size_t size, void *opaque)
+{
+    asc_event_recv_provide(sock->recv, buffer, size, opaque);
+}
+
+/* all writes to the socket report EAGAIN, see asc_event_set_edge() */
+void asc_socket_set_edge(asc_socket_t *sock)
+{
+    sock->is_edge = true;
+    if(sock->event)
+        asc_event_set_edge(sock->event);
+}
+
+void asc_socket_set_priority(asc_socket_t *sock, asc_event_priority_t priority)
+{
+    sock->priority = priority;
+    if(sock->event)
+        asc_event_set_priority(sock->event, priority);
+}
+
+void asc_socket_write_blocked(asc_socket_t *sock)
+{
+    if(sock->event)
+        asc_event_write_blocked(sock->event);
+}
+
 void asc_socket_set_on_close(asc_socket_t *sock, event_callback_t on_close)
 {
     if(sock->on_close == on_close)
@@ -383,7 +619,10 @@ void asc_socket_listen(  asc_socket_t *sock
     sock->on_ready = NULL;
     sock->on_close = on_error;
     if(sock->event == NULL)
+    {
         sock->event = asc_event_init(sock->fd, sock);
+        asc_event_set_priority(sock->event, sock->priority);
+    }
 
     asc_event_set_on_read(sock->event, __asc_socket_on_accept);
     asc_event_set_on_write(sock->event, NULL);
@@ -399,21 +638,47 @@ void asc_socket_listen(  asc_socket_t *sock
  *
  */
 
+static bool __asc_socket_accept_empty(void)
+{
+#ifdef _WIN32
+    const int err = WSAGetLastError();
+    return (err == WSAEWOULDBLOCK || err == WSAECONNRESET);
+#else
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR);
+#endif
+}
+
 bool asc_socket_accept(asc_socket_t *sock, asc_socket_t **client_ptr, void * arg)
 {
-    asc_socket_t *client = (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
-    socklen_t sin_size = sizeof(client->addr);
-    client->fd = accept(sock->fd, (struct sockaddr *)&client->addr, &sin_size);
-    if(client->fd <= 0)
+    struct sockaddr_in addr;
+    socklen_t sin_size = sizeof(addr);
+#ifdef HAVE_ACCEPT4
+    const int fd = accept4(sock->fd, (struct sockaddr *)&addr, &sin_size
+                           , SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    const int fd = accept(sock->fd, (struct sockaddr *)&addr, &sin_size);
+#endif
+    *client_ptr = NULL;
+    if(fd <= 0)
     {
+        if(__asc_socket_accept_empty())
+            return true;
+
         asc_log_error(MSG("accept() failed [%s]"), asc_socket_error());
-        free(client);
-        *client_ptr = NULL;
         return false;
     }
 
+    asc_socket_t *client = socket_alloc();
+    client->fd = fd;
+    client->addr = addr;
+    client->mreq.imr_multiaddr.s_addr = INADDR_NONE;
+    client->family = sock->family;
+    client->type = sock->type;
+    client->protocol = sock->protocol;
     client->arg = arg;
+#ifndef HAVE_ACCEPT4
     asc_socket_set_nonblock(client, true);
+#endif
 
     *client_ptr = client;
     return true;
@@ -495,7 +760,10 @@ void asc_socket_connect(  asc_socket_t *sock, const char *addr, int port
     sock->on_ready = on_connect;
     sock->on_close = on_error;
     if(sock->event == NULL)
+    {
         sock->event = asc_event_init(sock->fd, sock);
+        asc_event_set_priority(sock->event, sock->priority);
+    }
 
     asc_event_set_on_read(sock->event, NULL);
     asc_event_set_on_write(sock->event, __asc_socket_on_connect);
@@ -513,13 +781,175 @@ void asc_socket_connect(  asc_socket_t *sock, const char *addr, int port
 
 ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size)
 {
+    const ssize_t ret = recv(sock->fd, buffer, size, 0);
+    asc_trace3(socket_recv, sock->fd, size, ret);
+    return ret;
+}
+
+#ifndef _WIN32
+/* ancillary data of the received datagram. dst and time could be NULL */
+static void socket_cmsg(  asc_socket_t *sock, struct msghdr *msg
+                        , uint32_t *dst, uint64_t *time)
+{
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+#ifdef SO_RXQ_OVFL
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(&sock->rx_dropped, CMSG_DATA(cmsg), sizeof(sock->rx_dropped));
+            continue;
+        }
+#endif
+#ifdef IP_PKTINFO
+        if(dst && cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+        {
+            struct in_pktinfo pktinfo;
+            memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+            *dst = pktinfo.ipi_addr.s_addr;
+            continue;
+        }
+#endif
+#ifdef SO_TIMESTAMPNS
+        if(time && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            *time = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+            continue;
+        }
+#endif
+    }
+}
+#endif
+
+/*
+ * Receive datagram with the kernel receive time in microseconds (CLOCK_REALTIME).
+ * Requires asc_socket_set_timestamp(). time is 0 if it is not known
+ */
+
+ssize_t asc_socket_recv_time(asc_socket_t *sock, void *buffer, size_t size, uint64_t *time)
+{
+    *time = 0;
+
+#ifndef _WIN32
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    uint8_t control[SOCKET_CMSG_SIZE];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t ret = recvmsg(sock->fd, &msg, 0);
+    asc_trace3(socket_recv, sock->fd, size, ret);
+    if(ret > 0)
+        socket_cmsg(sock, &msg, NULL, time);
+
+    return ret;
+#else
     return recv(sock->fd, buffer, size, 0);
+#endif
 }
 
 ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size)
 {
     socklen_t slen = sizeof(struct sockaddr_in);
-    return recvfrom(sock->fd, buffer, size, 0, (struct sockaddr *)&sock->sockaddr, &slen);
+    const ssize_t ret = recvfrom(sock->fd, buffer, size, 0
+                                 , (struct sockaddr *)&sock->sockaddr, &slen);
+    asc_trace3(socket_recv, sock->fd, size, ret);
+    return ret;
+}
+
+/*
+ * Receive up to count datagrams, one per iov item. Size of each datagram is
+ * stored in len, the receive time in time if it is not NULL (see
+ * asc_socket_recv_time()). Returns number of datagrams or -1 if there was
+ * nothing to read
+ */
+
+int asc_socket_recv_batch(asc_socket_t *sock, const struct iovec *iov, size_t *len
+                          , uint64_t *time, int count)
+{
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msg[count];
+    memset(msg, 0, sizeof(msg));
+    const bool is_control = (time || sock->is_rxq_ovfl);
+    uint8_t control[(is_control) ? count : 1][SOCKET_CMSG_SIZE];
+    for(int i = 0; i < count; ++i)
+    {
+        msg[i].msg_hdr.msg_iov = (struct iovec *)&iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+        if(is_control)
+        {
+            msg[i].msg_hdr.msg_control = control[i];
+            msg[i].msg_hdr.msg_controllen = SOCKET_CMSG_SIZE;
+        }
+    }
+
+    const int ret = recvmmsg(sock->fd, msg, count, 0, NULL);
+    asc_trace3(socket_recv_batch, sock->fd, count, ret);
+    for(int i = 0; i < ret; ++i)
+    {
+        len[i] = msg[i].msg_len;
+        if(time)
+            time[i] = 0;
+        if(is_control)
+            socket_cmsg(sock, &msg[i].msg_hdr, NULL, (time) ? &time[i] : NULL);
+    }
+
+    return ret;
+#else
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        const ssize_t ret = recv(sock->fd, iov[i].iov_base, iov[i].iov_len, 0);
+        if(ret <= 0)
+            return (i > 0) ? i : (int)ret;
+        len[i] = ret;
+        if(time)
+            time[i] = 0;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Receive datagram with the destination address (network order).
+ * Requires asc_socket_set_pktinfo(). dst is INADDR_NONE if it is not known.
+ * time is the receive time if it is not NULL, see asc_socket_recv_time()
+ */
+
+ssize_t asc_socket_recv_pktinfo(asc_socket_t *sock, void *buffer, size_t size
+                                , uint32_t *dst, uint64_t *time)
+{
+    *dst = INADDR_NONE;
+    if(time)
+        *time = 0;
+
+#if defined(IP_PKTINFO) && !defined(_WIN32)
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    uint8_t control[SOCKET_CMSG_SIZE];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t ret = recvmsg(sock->fd, &msg, 0);
+    asc_trace3(socket_recv, sock->fd, size, ret);
+    if(ret <= 0)
+        return ret;
+
+    socket_cmsg(sock, &msg, dst, time);
+
+    return ret;
+#else
+    return recv(sock->fd, buffer, size, 0);
+#endif
 }
 
 /*
@@ -534,24 +964,369 @@ ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size)
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size)
 {
     const ssize_t ret = send(sock->fd, buffer, size, 0);
+    asc_trace3(socket_send, sock->fd, size, ret);
     if(ret == -1)
     {
 #ifdef _WIN32
         const int err = WSAGetLastError();
         if(err == WSAEWOULDBLOCK)
+        {
+            asc_socket_write_blocked(sock);
             return 0;
+        }
 #else
         if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            asc_socket_write_blocked(sock);
             return 0;
+        }
 #endif
     }
     return ret;
 }
 
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int iovcnt)
+{
+#ifdef _WIN32
+    ssize_t total = 0;
+    for(int i = 0; i < iovcnt; ++i)
+    {
+        const ssize_t ret = asc_socket_send(sock, iov[i].iov_base, iov[i].iov_len);
+        if(ret == -1)
+            return (total > 0) ? total : -1;
+        total += ret;
+        if((size_t)ret != iov[i].iov_len)
+            break;
+    }
+    return total;
+#else
+    const ssize_t ret = writev(sock->fd, iov, iovcnt);
+    asc_trace3(socket_send, sock->fd, iovcnt, ret);
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        asc_socket_write_blocked(sock);
+        return 0;
+    }
+    return ret;
+#endif
+}
+
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const struct iovec *iov, int iovcnt)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+
+    const ssize_t ret = sendmsg(sock->fd, &msg, MSG_ZEROCOPY);
+    asc_trace3(socket_send, sock->fd, iovcnt, ret);
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        asc_socket_write_blocked(sock);
+        return 0;
+    }
+    return ret;
+#else
+    __uarg(sock);
+    __uarg(iov);
+    __uarg(iovcnt);
+    errno = ENOBUFS;
+    return -1;
+#endif
+}
+
+bool asc_socket_zerocopy_complete(asc_socket_t *sock, uint32_t *lo, uint32_t *hi)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+        struct cmsghdr align;
+    } control;
+
+    while(true)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        if(recvmsg(sock->fd, &msg, MSG_ERRQUEUE) == -1)
+            return false;
+
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg)
+            ; cmsg
+            ; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            const struct sock_extended_err *serr =
+                (const struct sock_extended_err *)CMSG_DATA(cmsg);
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            *lo = serr->ee_info;
+            *hi = serr->ee_data;
+            return true;
+        }
+    }
+#else
+    __uarg(sock);
+    __uarg(lo);
+    __uarg(hi);
+    return false;
+#endif
+}
+
+/*
+ * Fan-out list is read by the sender of any thread. The sender registers
+ * in fanout_users before it takes the list, the change replaces the list
+ * and releases the previous one when no sender holds it
+ */
+
+static const socket_fanout_t * socket_fanout_acquire(asc_socket_t *sock)
+{
+    if(!__atomic_load_n(&sock->fanout, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    __atomic_add_fetch(&sock->fanout_users, 1, __ATOMIC_SEQ_CST);
+    const socket_fanout_t *fanout = __atomic_load_n(&sock->fanout, __ATOMIC_SEQ_CST);
+    if(!fanout)
+        __atomic_sub_fetch(&sock->fanout_users, 1, __ATOMIC_SEQ_CST);
+
+    return fanout;
+}
+
+static inline void socket_fanout_release(asc_socket_t *sock)
+{
+    __atomic_sub_fetch(&sock->fanout_users, 1, __ATOMIC_SEQ_CST);
+}
+
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size)
 {
+    if(__atomic_load_n(&sock->fanout, __ATOMIC_ACQUIRE))
+    {
+        struct iovec iov;
+        iov.iov_base = (void *)buffer;
+        iov.iov_len = size;
+        return (asc_socket_sendto_batch(sock, &iov, 1) == 1) ? (ssize_t)size : -1;
+    }
+
     const socklen_t slen = sizeof(struct sockaddr_in);
-    return sendto(sock->fd, buffer, size, 0, (struct sockaddr *)&sock->sockaddr, slen);
+    const ssize_t ret = sendto(sock->fd, buffer, size, 0
+                               , (struct sockaddr *)&sock->sockaddr, slen);
+    asc_trace3(socket_send, sock->fd, size, ret);
+    return ret;
+}
+
+static void socket_on_send(void *arg, int result)
+{
+    asc_socket_t *sock = (asc_socket_t *)arg;
+    if(result < 0)
+        ++sock->send_errors;
+}
+
+/*
+ * Datagram is copied and sent with the next wait of the event loop, errors
+ * are counted, see asc_socket_send_errors(). Without the io_uring backend,
+ * with the fan-out list or the full queue it is asc_socket_sendto()
+ */
+
+ssize_t asc_socket_sendto_async(asc_socket_t *sock, const void *buffer, size_t size)
+{
+    if(   !__atomic_load_n(&sock->fanout, __ATOMIC_ACQUIRE)
+       && asc_event_sendto(  sock->fd, buffer, size, &sock->sockaddr, sizeof(struct sockaddr_in)
+                           , socket_on_send, sock))
+    {
+        asc_trace3(socket_send, sock->fd, size, (ssize_t)size);
+        return size;
+    }
+
+    return asc_socket_sendto(sock, buffer, size);
+}
+
+uint32_t asc_socket_send_errors(asc_socket_t *sock)
+{
+    const uint32_t count = sock->send_errors;
+    sock->send_errors = 0;
+    return count;
+}
+
+/*
+ * Each datagram goes to the address and to the fan-out list. Messages share
+ * the datagram buffer, one system call serves all destinations. Message which
+ * is failed is skipped, other destinations are not stalled by one of them
+ */
+
+static int socket_sendto_fanout(asc_socket_t *sock, const struct iovec *iov, int count
+                                , const struct sockaddr_in *fanout, int fanout_count)
+{
+    int failed = 0;
+    int saved_errno = 0;
+
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msg[SOCKET_FANOUT_BATCH];
+    memset(msg, 0, sizeof(msg));
+    int msg_count = 0;
+
+    for(int i = 0; i < count; ++i)
+    {
+        for(int j = -1; j < fanout_count; ++j)
+        {
+            struct msghdr *const hdr = &msg[msg_count].msg_hdr;
+            hdr->msg_name = (void *)((j < 0) ? &sock->sockaddr : &fanout[j]);
+            hdr->msg_namelen = sizeof(struct sockaddr_in);
+            hdr->msg_iov = (struct iovec *)&iov[i];
+            hdr->msg_iovlen = 1;
+            ++msg_count;
+
+            if(msg_count < SOCKET_FANOUT_BATCH && (i < count - 1 || j < fanout_count - 1))
+                continue;
+
+            int sent = 0;
+            while(sent < msg_count)
+            {
+                const int ret = sendmmsg(sock->fd, &msg[sent], msg_count - sent, 0);
+                asc_trace3(socket_send_batch, sock->fd, msg_count - sent, ret);
+                if(ret <= 0)
+                {
+                    saved_errno = errno;
+                    ++failed;
+                    ++sent;
+                }
+                else
+                    sent += ret;
+            }
+            msg_count = 0;
+        }
+    }
+#else
+    for(int i = 0; i < count; ++i)
+    {
+        for(int j = -1; j < fanout_count; ++j)
+        {
+            const struct sockaddr_in *addr = (j < 0) ? &sock->sockaddr : &fanout[j];
+            const ssize_t ret = sendto(sock->fd, iov[i].iov_base, iov[i].iov_len, 0
+                                       , (const struct sockaddr *)addr, sizeof(*addr));
+            asc_trace3(socket_send, sock->fd, iov[i].iov_len, ret);
+            if(ret == -1)
+            {
+                saved_errno = errno;
+                ++failed;
+            }
+        }
+    }
+#endif
+
+    if(failed == 0)
+        return count;
+
+    errno = saved_errno;
+    return -1;
+}
+
+/*
+ * Send count datagrams, one per iov item, to the address from
+ * asc_socket_set_sockaddr(). Returns number of sent datagrams or -1
+ */
+
+int asc_socket_sendto_batch(asc_socket_t *sock, const struct iovec *iov, int count)
+{
+    const socket_fanout_t *fanout = socket_fanout_acquire(sock);
+    if(fanout)
+    {
+        const int ret = socket_sendto_fanout(sock, iov, count, fanout->addr, fanout->count);
+        socket_fanout_release(sock);
+        return ret;
+    }
+
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msg[count];
+    memset(msg, 0, sizeof(msg));
+    for(int i = 0; i < count; ++i)
+    {
+        msg[i].msg_hdr.msg_name = &sock->sockaddr;
+        msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msg[i].msg_hdr.msg_iov = (struct iovec *)&iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = 0;
+    while(sent < count)
+    {
+        const int ret = sendmmsg(sock->fd, &msg[sent], count - sent, 0);
+        asc_trace3(socket_send_batch, sock->fd, count - sent, ret);
+        if(ret <= 0)
+            return (sent > 0) ? sent : -1;
+        sent += ret;
+    }
+    return sent;
+#else
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        if(asc_socket_sendto(sock, iov[i].iov_base, iov[i].iov_len) == -1)
+            return (i > 0) ? i : -1;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Send datagram with the departure time in microseconds of asc_utime().
+ * Requires asc_socket_set_txtime() and fq or etf qdisc on the interface
+ */
+
+ssize_t asc_socket_sendto_txtime(asc_socket_t *sock, const void *buffer, size_t size
+                                 , uint64_t txtime)
+{
+#ifdef HAVE_SO_TXTIME
+    struct iovec iov;
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = size;
+
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sock->sockaddr;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    const uint64_t txtime_ns = txtime * 1000;
+    memcpy(CMSG_DATA(cmsg), &txtime_ns, sizeof(txtime_ns));
+
+    ssize_t ret = sendmsg(sock->fd, &msg, 0);
+
+    /* destinations of the fan-out list leave at the same time */
+    const socket_fanout_t *fanout = socket_fanout_acquire(sock);
+    if(fanout)
+    {
+        for(int i = 0; i < fanout->count; ++i)
+        {
+            msg.msg_name = (void *)&fanout->addr[i];
+            if(sendmsg(sock->fd, &msg, 0) == -1)
+                ret = -1;
+        }
+        socket_fanout_release(sock);
+    }
+
+    return ret;
+#else
+    __uarg(txtime);
+    return asc_socket_sendto(sock, buffer, size);
+#endif
 }
 
 /*
@@ -630,11 +1405,183 @@ void asc_socket_set_sockaddr(asc_socket_t *sock, const char *addr, int port)
     sock->sockaddr.sin_port = htons(port);
 }
 
+/*
+ * Fan-out list. Datagrams of asc_socket_sendto*() are also sent to each
+ * destination of the list. The list is changed by the main thread only:
+ * the change makes a new copy and replaces the list, the sender of other
+ * thread completes the call with the previous one, see socket_fanout_acquire()
+ */
+
+static int socket_destination_find(asc_socket_t *sock, const struct sockaddr_in *addr)
+{
+    const socket_fanout_t *fanout = sock->fanout;
+    for(int i = 0; fanout && i < fanout->count; ++i)
+    {
+        if(   fanout->addr[i].sin_addr.s_addr == addr->sin_addr.s_addr
+           && fanout->addr[i].sin_port == addr->sin_port)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * the sender counts itself before it takes the list, so no users after the
+ * replacement means nobody holds the replaced lists
+ */
+static bool socket_fanout_reclaim(asc_socket_t *sock)
+{
+    if(   sock->fanout_retired
+       && __atomic_load_n(&sock->fanout_users, __ATOMIC_SEQ_CST) == 0)
+    {
+        socket_fanout_free(sock->fanout_retired);
+        sock->fanout_retired = NULL;
+    }
+
+    return (sock->fanout_retired == NULL);
+}
+
+static void on_fanout_reclaim(void *arg)
+{
+    asc_socket_t *sock = (asc_socket_t *)arg;
+    if(socket_fanout_reclaim(sock))
+        ASC_FREE(sock->fanout_timer, asc_timer_destroy);
+}
+
+/* fanout - new list or NULL if it is empty */
+static void socket_fanout_publish(asc_socket_t *sock, socket_fanout_t *fanout)
+{
+    socket_fanout_t *prev = __atomic_exchange_n(&sock->fanout, fanout, __ATOMIC_SEQ_CST);
+    if(prev)
+    {
+        prev->retired = sock->fanout_retired;
+        sock->fanout_retired = prev;
+    }
+
+    /* the sender of other thread holds the list, retry on the next tick */
+    if(!socket_fanout_reclaim(sock) && !sock->fanout_timer)
+    {
+        sock->fanout_timer = asc_timer_init(  SOCKET_FANOUT_RECLAIM_INTERVAL
+                                            , on_fanout_reclaim, sock);
+    }
+}
+
+/* copy of the list with the room for one more item */
+static socket_fanout_t * socket_fanout_copy(asc_socket_t *sock)
+{
+    const int count = (sock->fanout) ? sock->fanout->count : 0;
+    socket_fanout_t *fanout = (socket_fanout_t *)malloc(  sizeof(socket_fanout_t)
+                                                        + (count + 1) * sizeof(struct sockaddr_in));
+    fanout->retired = NULL;
+    fanout->count = count;
+    if(count > 0)
+        memcpy(fanout->addr, sock->fanout->addr, count * sizeof(struct sockaddr_in));
+
+    return fanout;
+}
+
+bool asc_socket_add_destination(asc_socket_t *sock, const char *addr, int port)
+{
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = sock->family;
+    dst.sin_addr.s_addr = inet_addr(addr);
+    dst.sin_port = htons(port);
+
+    if(dst.sin_addr.s_addr == INADDR_NONE)
+        return false;
+
+    if(socket_destination_find(sock, &dst) != -1)
+        return true;
+
+    if(asc_socket_destination_count(sock) >= SOCKET_FANOUT_MAX)
+        return false;
+
+    socket_fanout_t *fanout = socket_fanout_copy(sock);
+    fanout->addr[fanout->count] = dst;
+    ++fanout->count;
+    socket_fanout_publish(sock, fanout);
+    return true;
+}
+
+bool asc_socket_remove_destination(asc_socket_t *sock, const char *addr, int port)
+{
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = sock->family;
+    dst.sin_addr.s_addr = inet_addr(addr);
+    dst.sin_port = htons(port);
+
+    const int i = socket_destination_find(sock, &dst);
+    if(i == -1)
+        return false;
+
+    socket_fanout_t *fanout = NULL;
+    if(sock->fanout->count > 1)
+    {
+        fanout = socket_fanout_copy(sock);
+        --fanout->count;
+        fanout->addr[i] = fanout->addr[fanout->count];
+    }
+    socket_fanout_publish(sock, fanout);
+    return true;
+}
+
+int asc_socket_destination_count(asc_socket_t *sock)
+{
+    return (sock->fanout) ? sock->fanout->count : 0;
+}
+
+/*
+ * Datagrams dropped by the kernel on the receive queue overflow. Counter of
+ * the socket, wraps. Requires asc_socket_set_rxq_ovfl() and the datagrams
+ * received with the ancillary data: asc_socket_recv_time(),
+ * asc_socket_recv_batch() or asc_socket_recv_pktinfo()
+ */
+uint32_t asc_socket_rx_dropped(asc_socket_t *sock)
+{
+    return sock->rx_dropped;
+}
+
+/* bytes in the receive queue and the receive buffer size. false if not supported */
+bool asc_socket_rx_queue(asc_socket_t *sock, int *queue, int *size)
+{
+#if defined(__linux__) && defined(SO_MEMINFO)
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t optlen = sizeof(meminfo);
+    if(getsockopt(sock->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &optlen) != 0)
+        return false;
+    *queue = (int)meminfo[SK_MEMINFO_RMEM_ALLOC];
+    *size = (int)meminfo[SK_MEMINFO_RCVBUF];
+    return true;
+#else
+    __uarg(sock);
+    *queue = 0;
+    *size = 0;
+    return false;
+#endif
+}
+
 void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on)
 {
     setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (void *)&is_on, sizeof(is_on));
 }
 
+bool asc_socket_set_reuseport(asc_socket_t *sock, int is_on)
+{
+#ifdef SO_REUSEPORT
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, (void *)&is_on, sizeof(is_on)) == 0)
+        return true;
+
+    asc_log_warning(MSG("failed to set SO_REUSEPORT [%s]"), asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(is_on);
+#endif
+    return false;
+}
+
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on)
 {
     switch(sock->protocol)
@@ -656,11 +1603,110 @@ void asc_socket_set_non_delay(asc_socket_t *sock, int is_on)
     }
 }
 
+bool asc_socket_set_defer_accept(asc_socket_t *sock, int timeout)
+{
+#ifdef TCP_DEFER_ACCEPT
+    if(setsockopt(sock->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT
+                  , (void *)&timeout, sizeof(timeout)) == 0)
+    {
+        return true;
+    }
+
+    asc_log_warning(MSG("failed to set TCP_DEFER_ACCEPT [%s]"), asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(timeout);
+#endif
+    return false;
+}
+
+bool asc_socket_set_fastopen(asc_socket_t *sock, int qlen)
+{
+#ifdef TCP_FASTOPEN
+    if(setsockopt(sock->fd, IPPROTO_TCP, TCP_FASTOPEN, (void *)&qlen, sizeof(qlen)) == 0)
+        return true;
+
+    asc_log_warning(MSG("failed to set TCP_FASTOPEN [%s]"), asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(qlen);
+#endif
+    return false;
+}
+
+/* bytes per second, 0 - unlimited. applied by TCP pacing or by the fq qdisc */
+bool asc_socket_set_pacing_rate(asc_socket_t *sock, uint64_t rate)
+{
+#ifdef SO_MAX_PACING_RATE
+    const unsigned int value = (rate == 0 || rate >= UINT32_MAX) ? UINT32_MAX : rate;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_MAX_PACING_RATE
+                  , (void *)&value, sizeof(value)) == 0)
+    {
+        return true;
+    }
+
+    asc_log_warning(MSG("failed to set SO_MAX_PACING_RATE [%s]"), asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(rate);
+#endif
+    return false;
+}
+
+/* the socket is writable when the unsent data is below the size */
+bool asc_socket_set_notsent_lowat(asc_socket_t *sock, int size)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    if(setsockopt(sock->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void *)&size, sizeof(size)) == 0)
+        return true;
+
+    asc_log_warning(MSG("failed to set TCP_NOTSENT_LOWAT [%s]"), asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(size);
+#endif
+    return false;
+}
+
 void asc_socket_set_keep_alive(asc_socket_t *sock, int is_on)
 {
     setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&is_on, is_on);
 }
 
+bool asc_socket_set_txtime(asc_socket_t *sock)
+{
+#ifdef HAVE_SO_TXTIME
+    struct sock_txtime config;
+    config.clockid = CLOCK_MONOTONIC;
+    config.flags = 0;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_TXTIME, (void *)&config, sizeof(config)) == 0)
+        return true;
+
+    asc_log_error(MSG("failed to set SO_TXTIME [%s]"), asc_socket_error());
+#else
+    asc_log_error(MSG("SO_TXTIME is not available"));
+#endif
+    return false;
+}
+
+bool asc_socket_set_zerocopy(asc_socket_t *sock, event_callback_t on_zerocopy)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+    const int is_on = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, (void *)&is_on, sizeof(is_on)) == 0)
+    {
+        sock->on_zerocopy = on_zerocopy;
+        return true;
+    }
+
+    asc_log_error(MSG("failed to set SO_ZEROCOPY [%s]"), asc_socket_error());
+#else
+    __uarg(on_zerocopy);
+    asc_log_error(MSG("MSG_ZEROCOPY is not available"));
+#endif
+    return false;
+}
+
 void asc_socket_set_broadcast(asc_socket_t *sock, int is_on)
 {
     setsockopt(sock->fd, SOL_SOCKET, SO_BROADCAST, (void *)&is_on, sizeof(is_on));
@@ -813,6 +1859,50 @@ static void create_igmp_packet(uint8_t *buffer, uint8_t igmp_type, uint32_t dst_
 }
 #endif
 
+bool asc_socket_set_pktinfo(asc_socket_t *sock)
+{
+#if defined(IP_PKTINFO) && !defined(_WIN32)
+    const int optval = 1;
+    if(setsockopt(sock->fd, IPPROTO_IP, IP_PKTINFO, &optval, sizeof(optval)) == 0)
+        return true;
+    asc_log_error(MSG("failed to set IP_PKTINFO (%s)"), asc_socket_error());
+#else
+    __uarg(sock);
+#endif
+    return false;
+}
+
+/* drop counter of the receive queue, see asc_socket_rx_dropped() */
+bool asc_socket_set_rxq_ovfl(asc_socket_t *sock)
+{
+#ifdef SO_RXQ_OVFL
+    const int optval = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval)) == 0)
+    {
+        sock->is_rxq_ovfl = true;
+        return true;
+    }
+    asc_log_error(MSG("failed to set SO_RXQ_OVFL (%s)"), asc_socket_error());
+#else
+    __uarg(sock);
+#endif
+    return false;
+}
+
+/* kernel receive time of the datagrams, see asc_socket_recv_time() */
+bool asc_socket_set_timestamp(asc_socket_t *sock)
+{
+#ifdef SO_TIMESTAMPNS
+    const int optval = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, &optval, sizeof(optval)) == 0)
+        return true;
+    asc_log_error(MSG("failed to set SO_TIMESTAMPNS (%s)"), asc_socket_error());
+#else
+    __uarg(sock);
+#endif
+    return false;
+}
+
 void asc_socket_set_multicast_if(asc_socket_t *sock, const char *addr)
 {
     if(!addr)
@@ -842,11 +1932,30 @@ void asc_socket_set_multicast_loop(asc_socket_t *sock, int is_on)
 
 /* multicast_* */
 
-static int __asc_socket_multicast_cmd(asc_socket_t *sock, int cmd)
+static int __asc_socket_multicast_setsockopt(  asc_socket_t *sock, bool is_join
+                                             , const struct ip_mreq *mreq
+                                             , struct in_addr source)
 {
-    int r;
+    if(source.s_addr != INADDR_ANY)
+    {
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+        struct ip_mreq_source mreq_source;
+        memset(&mreq_source, 0, sizeof(mreq_source));
+        mreq_source.imr_multiaddr = mreq->imr_multiaddr;
+        mreq_source.imr_interface = mreq->imr_interface;
+        mreq_source.imr_sourceaddr = source;
+
+        const int cmd = (is_join) ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP;
+        return setsockopt(  sock->fd, IPPROTO_IP, cmd
+                          , (void *)&mreq_source, sizeof(mreq_source));
+#else
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
 
-    r = setsockopt(sock->fd, IPPROTO_IP, cmd, (void *)&sock->mreq, sizeof(sock->mreq));
+    const int cmd = (is_join) ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP;
+    const int r = setsockopt(sock->fd, IPPROTO_IP, cmd, (void *)mreq, sizeof(*mreq));
     if(r == -1)
         return -1;
 
@@ -855,45 +1964,91 @@ static int __asc_socket_multicast_cmd(asc_socket_t *sock, int cmd)
     memset(buffer, 0, IP_HEADER_SIZE + IGMP_HEADER_SIZE);
 
     struct sockaddr_in dst;
-    dst.sin_addr.s_addr = sock->mreq.imr_multiaddr.s_addr;
+    dst.sin_addr.s_addr = mreq->imr_multiaddr.s_addr;
     dst.sin_family = AF_INET;
 
     create_igmp_packet(buffer,
-        (cmd == IP_ADD_MEMBERSHIP) ? 0x16 : 0x17,
-        sock->mreq.imr_multiaddr.s_addr);
+        (is_join) ? 0x16 : 0x17,
+        mreq->imr_multiaddr.s_addr);
 
-    int raw_sock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
-    if(raw_sock == -1)
-        return -1;
-    r = sendto(raw_sock, &buffer, IP_HEADER_SIZE + IGMP_HEADER_SIZE, 0,
+    if(igmp_sock == -1)
+    {
+        igmp_sock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+        if(igmp_sock == -1)
+            return -1;
+    }
+    const int rr = sendto(igmp_sock, &buffer, IP_HEADER_SIZE + IGMP_HEADER_SIZE, 0,
         (struct sockaddr *)&dst, sizeof(struct sockaddr_in));
-    close(raw_sock);
-    if(r == -1)
+    if(rr == -1)
         return -1;
 #endif
 
     return 0;
 }
 
-void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char *localaddr)
+static int __asc_socket_multicast_cmd(asc_socket_t *sock, int cmd)
 {
-    memset(&sock->mreq, 0, sizeof(sock->mreq));
-    sock->mreq.imr_multiaddr.s_addr = inet_addr(addr);
-    if(sock->mreq.imr_multiaddr.s_addr == INADDR_NONE)
+    return __asc_socket_multicast_setsockopt(  sock, (cmd == IP_ADD_MEMBERSHIP)
+                                             , &sock->mreq, sock->mreq_source);
+}
+
+/* returns false if the address is not multicast or not valid */
+static bool __asc_socket_multicast_parse(  asc_socket_t *sock
+                                         , const char *addr, const char *localaddr
+                                         , const char *source
+                                         , struct ip_mreq *mreq, struct in_addr *mreq_source)
+{
+    memset(mreq, 0, sizeof(*mreq));
+    mreq_source->s_addr = INADDR_ANY;
+
+    mreq->imr_multiaddr.s_addr = inet_addr(addr);
+    if(mreq->imr_multiaddr.s_addr == INADDR_NONE)
     {
         asc_log_error(MSG("failed to join multicast \"%s\" (%s)"), addr, asc_socket_error());
-        return;
+        return false;
     }
-    if(!IN_MULTICAST(ntohl(sock->mreq.imr_multiaddr.s_addr)))
+    if(!IN_MULTICAST(ntohl(mreq->imr_multiaddr.s_addr)))
+        return false;
+
+    if(localaddr)
     {
-        sock->mreq.imr_multiaddr.s_addr = INADDR_NONE;
-        return;
+        mreq->imr_interface.s_addr = inet_addr(localaddr);
+        if(mreq->imr_interface.s_addr == INADDR_NONE)
+            mreq->imr_interface.s_addr = INADDR_ANY;
     }
-    if(localaddr)
+
+    if(source)
+    {
+        mreq_source->s_addr = inet_addr(source);
+        if(mreq_source->s_addr == INADDR_NONE)
+        {
+            asc_log_error(MSG("wrong multicast source \"%s\""), source);
+            mreq_source->s_addr = INADDR_ANY;
+        }
+    }
+
+    return true;
+}
+
+void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char *localaddr)
+{
+    asc_socket_multicast_join_source(sock, addr, localaddr, NULL);
+}
+
+/*
+ * Source-specific multicast (IGMPv3) if source is defined.
+ * IGMP emulation is made for any-source multicast only
+ */
+
+void asc_socket_multicast_join_source(  asc_socket_t *sock
+                                      , const char *addr, const char *localaddr
+                                      , const char *source)
+{
+    if(!__asc_socket_multicast_parse(sock, addr, localaddr, source
+                                     , &sock->mreq, &sock->mreq_source))
     {
-        sock->mreq.imr_interface.s_addr = inet_addr(localaddr);
-        if(sock->mreq.imr_interface.s_addr == INADDR_NONE)
-            sock->mreq.imr_interface.s_addr = INADDR_ANY;
+        sock->mreq.imr_multiaddr.s_addr = INADDR_NONE;
+        return;
     }
 
     if(__asc_socket_multicast_cmd(sock, IP_ADD_MEMBERSHIP) == -1)
@@ -904,6 +2059,47 @@ void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char
     }
 }
 
+/*
+ * Additional membership of the socket, is not stored in the socket.
+ * Used by the sockets shared between many groups
+ */
+
+bool asc_socket_multicast_add(  asc_socket_t *sock
+                              , const char *addr, const char *localaddr
+                              , const char *source)
+{
+    struct ip_mreq mreq;
+    struct in_addr mreq_source;
+    if(!__asc_socket_multicast_parse(sock, addr, localaddr, source, &mreq, &mreq_source))
+        return false;
+
+    if(__asc_socket_multicast_setsockopt(sock, true, &mreq, mreq_source) == -1)
+    {
+#ifndef _WIN32
+        // joined by the previous process, see handover.h
+        if(errno == EADDRINUSE)
+            return true;
+#endif
+        asc_log_error(MSG("failed to join multicast \"%s\" (%s)"), addr, asc_socket_error());
+        return false;
+    }
+
+    return true;
+}
+
+void asc_socket_multicast_drop(  asc_socket_t *sock
+                               , const char *addr, const char *localaddr
+                               , const char *source)
+{
+    struct ip_mreq mreq;
+    struct in_addr mreq_source;
+    if(!__asc_socket_multicast_parse(sock, addr, localaddr, source, &mreq, &mreq_source))
+        return;
+
+    if(__asc_socket_multicast_setsockopt(sock, false, &mreq, mreq_source) == -1)
+        asc_log_error(MSG("failed to leave multicast \"%s\" (%s)"), addr, asc_socket_error());
+}
+
 void asc_socket_multicast_leave(asc_socket_t *sock)
 {
     if(sock->mreq.imr_multiaddr.s_addr == INADDR_NONE)
@@ -24,6 +24,16 @@
 #include "base.h"
 #include "event.h"
 
+#ifndef _WIN32
+#   include <sys/uio.h>
+#else
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
 typedef struct asc_socket_t asc_socket_t;
 
 void asc_socket_core_init(void);
@@ -34,10 +44,29 @@ const char * asc_socket_error(void);
 asc_socket_t * asc_socket_open_tcp4(void * arg) __wur;
 asc_socket_t * asc_socket_open_udp4(void * arg) __wur;
 asc_socket_t * asc_socket_open_sctp4(void * arg) __wur;
+/* bound socket of the previous process, see handover.h */
+asc_socket_t * asc_socket_open_fd(int fd, void * arg) __wur;
 
+void asc_socket_set_arg(asc_socket_t *sock, void *arg);
 void asc_socket_set_on_read(asc_socket_t * sock, event_callback_t on_read);
 void asc_socket_set_on_close(asc_socket_t * sock, event_callback_t on_close);
 void asc_socket_set_on_ready(asc_socket_t * sock, event_callback_t on_ready);
+/* metadata before the datagram in the buffer of asc_socket_recv_provide() */
+#define ASC_SOCKET_RECV_HEADROOM 160
+/* opaque - value of asc_socket_recv_provide(), time - see asc_socket_recv_time() */
+typedef void (*asc_socket_recv_callback_t)(  void *arg, void *opaque
+                                           , const uint8_t *buffer, size_t size
+                                           , uint64_t time);
+/* datagrams are received by the event loop, see asc_event_recv_init(). false if not supported */
+bool asc_socket_set_on_recv(  asc_socket_t *sock, int count
+                            , asc_socket_recv_callback_t on_recv
+                            , event_callback_t on_release) __wur;
+void asc_socket_recv_provide(asc_socket_t *sock, void *buffer, size_t size, void *opaque);
+void asc_socket_set_edge(asc_socket_t *sock);
+/* see asc_event_set_priority(), applied to the event of the socket */
+void asc_socket_set_priority(asc_socket_t *sock, asc_event_priority_t priority);
+/* EAGAIN of the write bypassing asc_socket_send*(), e.g. sendfile() */
+void asc_socket_write_blocked(asc_socket_t *sock);
 
 void asc_socket_shutdown_recv(asc_socket_t *sock);
 void asc_socket_shutdown_send(asc_socket_t *sock);
@@ -47,15 +76,31 @@ void asc_socket_close(asc_socket_t *sock);
 bool asc_socket_bind(asc_socket_t *sock, const char *addr, int port) __wur;
 void asc_socket_listen(  asc_socket_t *sock
                        , event_callback_t on_accept, event_callback_t on_error);
+/* true with NULL client if the accept queue is empty, false on error */
 bool asc_socket_accept(asc_socket_t *sock, asc_socket_t **client_ptr, void *arg) __wur;
 void asc_socket_connect(  asc_socket_t *sock, const char *addr, int port
                         , event_callback_t on_connect, event_callback_t on_error);
 
 ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size) __wur;
 ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size) __wur;
+ssize_t asc_socket_recv_time(asc_socket_t *sock, void *buffer, size_t size, uint64_t *time) __wur;
+int asc_socket_recv_batch(asc_socket_t *sock, const struct iovec *iov, size_t *len
+                          , uint64_t *time, int count) __wur;
+ssize_t asc_socket_recv_pktinfo(asc_socket_t *sock, void *buffer, size_t size
+                                , uint32_t *dst, uint64_t *time) __wur;
 
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int iovcnt) __wur;
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const struct iovec *iov, int iovcnt) __wur;
+bool asc_socket_zerocopy_complete(asc_socket_t *sock, uint32_t *lo, uint32_t *hi) __wur;
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+int asc_socket_sendto_batch(asc_socket_t *sock, const struct iovec *iov, int count) __wur;
+ssize_t asc_socket_sendto_txtime(asc_socket_t *sock, const void *buffer, size_t size
+                                 , uint64_t txtime) __wur;
+/* queued sendto(), see asc_event_sendto(). Main loop only */
+ssize_t asc_socket_sendto_async(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+/* failed queued sends since the last call */
+uint32_t asc_socket_send_errors(asc_socket_t *sock) __wur;
 
 int asc_socket_fd(asc_socket_t *sock) __wur;
 const char * asc_socket_addr(asc_socket_t *sock) __wur;
@@ -63,17 +108,41 @@ int asc_socket_port(asc_socket_t *sock) __wur;
 
 void asc_socket_set_nonblock(asc_socket_t *sock, bool is_nonblock);
 void asc_socket_set_sockaddr(asc_socket_t *sock, const char *addr, int port);
+bool asc_socket_add_destination(asc_socket_t *sock, const char *addr, int port) __wur;
+bool asc_socket_remove_destination(asc_socket_t *sock, const char *addr, int port) __wur;
+int asc_socket_destination_count(asc_socket_t *sock) __wur;
+uint32_t asc_socket_rx_dropped(asc_socket_t *sock) __wur;
+bool asc_socket_rx_queue(asc_socket_t *sock, int *queue, int *size) __wur;
 void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on);
+bool asc_socket_set_reuseport(asc_socket_t *sock, int is_on) __wur;
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on);
+bool asc_socket_set_defer_accept(asc_socket_t *sock, int timeout);
+bool asc_socket_set_fastopen(asc_socket_t *sock, int qlen);
+bool asc_socket_set_pacing_rate(asc_socket_t *sock, uint64_t rate);
+bool asc_socket_set_notsent_lowat(asc_socket_t *sock, int size);
 void asc_socket_set_keep_alive(asc_socket_t *sock, int is_on);
 void asc_socket_set_broadcast(asc_socket_t *sock, int is_on);
 void asc_socket_set_timeout(asc_socket_t *sock, int rcvmsec, int sndmsec);
 void asc_socket_set_buffer(asc_socket_t *sock, int rcvbuf, int sndbuf);
+bool asc_socket_set_txtime(asc_socket_t *sock) __wur;
+bool asc_socket_set_zerocopy(asc_socket_t *sock, event_callback_t on_zerocopy) __wur;
+bool asc_socket_set_pktinfo(asc_socket_t *sock) __wur;
+bool asc_socket_set_timestamp(asc_socket_t *sock) __wur;
+bool asc_socket_set_rxq_ovfl(asc_socket_t *sock) __wur;
 
 void asc_socket_set_multicast_if(asc_socket_t *sock, const char *addr);
 void asc_socket_set_multicast_ttl(asc_socket_t *sock, int ttl);
 void asc_socket_set_multicast_loop(asc_socket_t *sock, int is_on);
 void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char *localaddr);
+void asc_socket_multicast_join_source(  asc_socket_t *sock
+                                      , const char *addr, const char *localaddr
+                                      , const char *source);
+bool asc_socket_multicast_add(  asc_socket_t *sock
+                              , const char *addr, const char *localaddr
+                              , const char *source) __wur;
+void asc_socket_multicast_drop(  asc_socket_t *sock
+                               , const char *addr, const char *localaddr
+                               , const char *source);
 void asc_socket_multicast_leave(asc_socket_t *sock);
 void asc_socket_multicast_renew(asc_socket_t *sock);
 
@@ -22,23 +22,97 @@
 #include "strbuffer.h"
 #include <stdarg.h>
 
+/*
+ * Buffer is a list of chunks. Chunks of the default size are kept in the
+ * cache and reused by the next buffers. Not thread safe, the cache is for
+ * the main loop only.
+ */
+
 #define MAX_BUFFER_SIZE 4096
+#define CHUNK_CACHE_SIZE 64
+#define MAX_HINT_SIZE (4 * 1024 * 1024)
 
 struct string_buffer_t
 {
-    char buffer[MAX_BUFFER_SIZE];
+    char *buffer;
     size_t size;
+    size_t capacity;
 
     string_buffer_t *last;
     string_buffer_t *next;
 };
 
+static string_buffer_t *chunk_cache = NULL;
+static int chunk_cache_count = 0;
+
+static string_buffer_t * chunk_alloc(size_t capacity)
+{
+    string_buffer_t *chunk;
+
+    if(capacity <= MAX_BUFFER_SIZE && chunk_cache)
+    {
+        chunk = chunk_cache;
+        chunk_cache = chunk->next;
+        --chunk_cache_count;
+    }
+    else
+    {
+        if(capacity < MAX_BUFFER_SIZE)
+            capacity = MAX_BUFFER_SIZE;
+
+        chunk = (string_buffer_t *)malloc(sizeof(string_buffer_t));
+        chunk->buffer = (char *)malloc(capacity);
+        chunk->capacity = capacity;
+    }
+
+    chunk->size = 0;
+    chunk->last = NULL;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void chunk_free(string_buffer_t *chunk)
+{
+    if(chunk->capacity == MAX_BUFFER_SIZE && chunk_cache_count < CHUNK_CACHE_SIZE)
+    {
+        chunk->next = chunk_cache;
+        chunk_cache = chunk;
+        ++chunk_cache_count;
+        return;
+    }
+
+    free(chunk->buffer);
+    free(chunk);
+}
+
+void string_buffer_cache_destroy(void)
+{
+    while(chunk_cache)
+    {
+        string_buffer_t *next = chunk_cache->next;
+        free(chunk_cache->buffer);
+        free(chunk_cache);
+        chunk_cache = next;
+    }
+    chunk_cache_count = 0;
+}
+
 string_buffer_t * string_buffer_alloc(void)
 {
-    string_buffer_t *buffer = (string_buffer_t *)malloc(sizeof(string_buffer_t));
-    buffer->size = 0;
+    string_buffer_t *buffer = chunk_alloc(MAX_BUFFER_SIZE);
+    buffer->last = buffer;
+    return buffer;
+}
+
+string_buffer_t * string_buffer_alloc_size(size_t size)
+{
+    /* size is untrusted in most cases (content-length) */
+    if(size > MAX_HINT_SIZE)
+        size = MAX_HINT_SIZE;
+
+    /* one byte for the null-terminator in string_buffer_release() */
+    string_buffer_t *buffer = chunk_alloc(size + 1);
     buffer->last = buffer;
-    buffer->next = NULL;
     return buffer;
 }
 
@@ -46,13 +120,10 @@ string_buffer_t * string_buffer_alloc(void)
 static __wur string_buffer_t * __string_buffer_last(string_buffer_t *buffer)
 {
     string_buffer_t *last = buffer->last;
-    if(last->size >= MAX_BUFFER_SIZE)
+    if(last->size >= last->capacity)
     {
-        last->next = (string_buffer_t *)malloc(sizeof(string_buffer_t));
+        last->next = chunk_alloc(MAX_BUFFER_SIZE);
         last = last->next;
-        last->size = 0;
-        last->last = NULL;
-        last->next = NULL;
         buffer->last = last;
     }
     return last;
@@ -73,34 +144,56 @@ void string_buffer_addlstring(string_buffer_t *buffer, const char *str, size_t s
     if(!size)
         size = strlen(str);
 
-    size_t skip = 0;
-    while(1)
+    const size_t cap = last->capacity - last->size;
+    if(cap >= size)
     {
-        const size_t cap = MAX_BUFFER_SIZE - last->size;
-        const size_t rem = size - skip;
-        if(cap >= rem)
+        memcpy(&last->buffer[last->size], str, size);
+        last->size += size;
+        return;
+    }
+
+    if(cap > 0)
+    {
+        memcpy(&last->buffer[last->size], str, cap);
+        last->size += cap;
+        str += cap;
+        size -= cap;
+    }
+
+    /* rest of the string in one chunk */
+    last->next = chunk_alloc(size);
+    last = last->next;
+    buffer->last = last;
+
+    memcpy(last->buffer, str, size);
+    last->size = size;
+}
+
+size_t string_buffer_size(const string_buffer_t *buffer)
+{
+    size_t size = 0;
+    for(const string_buffer_t *next = buffer; next; next = next->next)
+        size += next->size;
+    return size;
+}
+
+int string_buffer_iov(const string_buffer_t *buffer, size_t skip, struct iovec *iov, int count)
+{
+    int i = 0;
+    for(const string_buffer_t *next = buffer; next && i < count; next = next->next)
+    {
+        if(skip >= next->size)
         {
-            memcpy(&last->buffer[last->size], &str[skip], rem);
-            last->size += rem;
-            return;
+            skip -= next->size;
+            continue;
         }
-        else
-        {
-            if(cap > 0)
-            {
-                memcpy(&last->buffer[last->size], &str[skip], cap);
-                last->size += cap;
-                skip += cap;
-            }
 
-            last->next = (string_buffer_t *)malloc(sizeof(string_buffer_t));
-            last = last->next;
-            last->size = 0;
-            last->last = NULL;
-            last->next = NULL;
-            buffer->last = last;
-        }
+        iov[i].iov_base = &next->buffer[skip];
+        iov[i].iov_len = next->size - skip;
+        skip = 0;
+        ++i;
     }
+    return i;
 }
 
 void strung_buffer_addvastring(string_buffer_t *buffer, const char *str, va_list ap)
@@ -343,18 +436,27 @@ void string_buffer_addfstring(string_buffer_t *buffer, const char *str, ...)
 
 char * string_buffer_release(string_buffer_t *buffer, size_t *size)
 {
+    char *str;
     size_t skip;
-    string_buffer_t *next, *next_next;
 
-    for(skip = 0, next = buffer; next; next = next->next)
-        skip += next->size;
-
-    char *str = (char *)malloc(skip + 1);
-    for(skip = 0, next = buffer; next && (next_next = next->next, 1); next = next_next)
+    if(!buffer->next && buffer->size < buffer->capacity)
     {
-        memcpy(&str[skip], next->buffer, next->size);
-        skip += next->size;
-        free(next);
+        /* single chunk is passed without copy */
+        str = buffer->buffer;
+        skip = buffer->size;
+        free(buffer);
+    }
+    else
+    {
+        str = (char *)malloc(string_buffer_size(buffer) + 1);
+
+        string_buffer_t *next, *next_next;
+        for(skip = 0, next = buffer; next && (next_next = next->next, 1); next = next_next)
+        {
+            memcpy(&str[skip], next->buffer, next->size);
+            skip += next->size;
+            chunk_free(next);
+        }
     }
     str[skip] = 0;
 
@@ -367,17 +469,28 @@ char * string_buffer_release(string_buffer_t *buffer, size_t *size)
 #ifdef WITH_LUA
 void string_buffer_push(lua_State *L, string_buffer_t *buffer)
 {
+    if(!buffer->next)
+    {
+        lua_pushlstring(L, buffer->buffer, buffer->size);
+        chunk_free(buffer);
+        return;
+    }
+
+    const size_t size = string_buffer_size(buffer);
+
     luaL_Buffer b;
-    luaL_buffinit(L, &b);
+    char *str = luaL_buffinitsize(L, &b, size);
 
+    size_t skip = 0;
     string_buffer_t *next_next;
     for(string_buffer_t *next = buffer; next && (next_next = next->next, 1); next = next_next)
     {
-        luaL_addlstring(&b, next->buffer, next->size);
-        free(next);
+        memcpy(&str[skip], next->buffer, next->size);
+        skip += next->size;
+        chunk_free(next);
     }
 
-    luaL_pushresult(&b);
+    luaL_pushresultsize(&b, size);
 }
 #endif /* WITH_LUA */
 
@@ -386,6 +499,6 @@ void string_buffer_free(string_buffer_t *buffer)
     string_buffer_t *next_next;
     for(string_buffer_t *next = buffer; next && (next_next = next->next, 1); next = next_next)
     {
-        free(next);
+        chunk_free(next);
     }
 }
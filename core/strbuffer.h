@@ -23,11 +23,15 @@
 #define _ASC_STRBUFFER_H_ 1
 
 #include "base.h"
+#include "socket.h"
 
 typedef struct string_buffer_t string_buffer_t;
 
 string_buffer_t * string_buffer_alloc(void) __wur;
+/* size is the expected length of the string */
+string_buffer_t * string_buffer_alloc_size(size_t size) __wur;
 void string_buffer_free(string_buffer_t *buffer);
+void string_buffer_cache_destroy(void);
 
 void string_buffer_addchar(string_buffer_t *buffer, char c);
 void string_buffer_addlstring(string_buffer_t *buffer, const char *str, size_t size);
@@ -36,6 +40,11 @@ void strung_buffer_addvastring(string_buffer_t *buffer, const char *str, va_list
 void string_buffer_addfstring(string_buffer_t *buffer, const char *str, ...)
     __fmt_printf(2, 3);
 
+size_t string_buffer_size(const string_buffer_t *buffer) __wur;
+/* fills iov with the chunks since the skip bytes, returns count of the items */
+int string_buffer_iov(const string_buffer_t *buffer, size_t skip, struct iovec *iov, int count) __wur;
+
+/* single chunk buffer is released without copy */
 char * string_buffer_release(string_buffer_t *buffer, size_t *size) __wur;
 
 #ifdef WITH_LUA
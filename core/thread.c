@@ -19,32 +19,82 @@
  */
 
 #include "assert.h"
+#include "event.h"
 #include "thread.h"
 #include "list.h"
 #include "log.h"
 #include "loopctl.h"
+#include "memory.h"
+#include "profile.h"
+#include "trace.h"
 
 #ifdef _WIN32
 #   include <windows.h>
 #else
 #   include <pthread.h>
+#   include <sched.h>
+#endif
+
+#ifdef __linux__
+#   include <sys/prctl.h>
+#   include <sys/syscall.h>
+#   ifndef MPOL_PREFERRED
+#       define MPOL_PREFERRED 1
+#   endif
+#endif
+
+#ifdef WITH_EPOLL
+#   include <sys/eventfd.h>
 #endif
 
 #define MSG(_msg) "[core/thread] " _msg
 
+/*
+ * Single-producer/single-consumer ring. head is written by the producer
+ * only, tail by the consumer only (flush may move tail from either side,
+ * so tail is advanced with compare-and-swap). Indices are free-running,
+ * count is head - tail. Each index lives on its own cache line together
+ * with the cached copy of the opposite index.
+ * Producer signals the consumer on the empty to non-empty transition.
+ * Both sides publish own index before checking the opposite one (seq_cst),
+ * so the signal may be spurious but never lost.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+#define atomic_load(_ptr) __atomic_load_n(_ptr, __ATOMIC_ACQUIRE)
+#define atomic_store(_ptr, _val) __atomic_store_n(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_load_sc(_ptr) __atomic_load_n(_ptr, __ATOMIC_SEQ_CST)
+#define atomic_store_sc(_ptr, _val) __atomic_store_n(_ptr, _val, __ATOMIC_SEQ_CST)
+#define atomic_cas(_ptr, _expected, _val) \
+    __atomic_compare_exchange_n(_ptr, _expected, _val, false \
+                                , __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)
+
+/* on_read calls per wakeup, then yield to other events */
+#define THREAD_READ_LIMIT 256
+
 struct asc_thread_buffer_t
 {
     uint8_t *buffer;
     size_t size;
-    size_t read;
-    size_t write;
-    size_t count;
 
-#ifdef _WIN32
-    HANDLE mutex;
-#else
-    pthread_mutex_t mutex;
+    bool is_wakeup; // signal consumer on write
+#ifndef _WIN32
+    int wakeup_fd; // write end of the consumer wakeup channel
 #endif
+
+    uint8_t __pad_0[CACHE_LINE_SIZE];
+
+    size_t head; // producer
+    size_t head_tail; // last tail seen by producer
+
+    uint8_t __pad_1[CACHE_LINE_SIZE - sizeof(size_t) * 2];
+
+    size_t tail; // consumer
+    size_t tail_head; // last head seen by consumer
+    size_t tail_peek; // tail on asc_thread_buffer_peek()
+
+    uint8_t __pad_2[CACHE_LINE_SIZE - sizeof(size_t) * 3];
 };
 
 struct asc_thread_t
@@ -59,47 +109,45 @@ struct asc_thread_t
     bool is_started;
     bool is_closed;
 
+#ifdef __linux__
+    char name[16];
+    cpu_set_t cpus;
+    int priority;
+    int numa_node;
+#endif
+
 #ifdef _WIN32
     HANDLE thread;
 #else
     pthread_t thread;
+
+    int wakeup_fd[2];
+    asc_event_t *wakeup_event;
 #endif
+
+    TAILQ_ENTRY(asc_thread_t) entries;
 };
 
 typedef struct
 {
-    asc_list_t *thread_list;
+    TAILQ_HEAD(thread_list_s, asc_thread_t) thread_list;
     bool is_changed;
 } thread_observer_t;
 
 static thread_observer_t thread_observer;
 
-#ifdef _WIN32
-#   define asc_thread_mutex_init(_mutex) _mutex = CreateMutex(NULL, FALSE, NULL)
-#   define asc_thread_mutex_destroy(_mutex) CloseHandle(_mutex)
-#   define asc_thread_mutex_lock(_mutex) WaitForSingleObject(_mutex, INFINITE)
-#   define asc_thread_mutex_unlock(_mutex) ReleaseMutex(_mutex)
-#else
-#   define asc_thread_mutex_init(_mutex) pthread_mutex_init(&_mutex, NULL)
-#   define asc_thread_mutex_destroy(_mutex) pthread_mutex_destroy(&_mutex)
-#   define asc_thread_mutex_lock(_mutex) pthread_mutex_lock(&_mutex)
-#   define asc_thread_mutex_unlock(_mutex) pthread_mutex_unlock(&_mutex)
-#endif
-
 void asc_thread_core_init(void)
 {
     memset(&thread_observer, 0, sizeof(thread_observer));
-    thread_observer.thread_list = asc_list_init();
+    TAILQ_INIT(&thread_observer.thread_list);
 }
 
 void asc_thread_core_destroy(void)
 {
     asc_thread_t *prev_thread = NULL;
-    for(asc_list_first(thread_observer.thread_list)
-        ; !asc_list_eol(thread_observer.thread_list)
-        ; asc_list_first(thread_observer.thread_list))
+    asc_thread_t *thread;
+    while((thread = TAILQ_FIRST(&thread_observer.thread_list)) != NULL)
     {
-        asc_thread_t *thread = (asc_thread_t *)asc_list_data(thread_observer.thread_list);
         asc_assert(thread != prev_thread
                    , MSG("loop on asc_thread_core_destroy() thread:%p")
                    , (void *)thread);
@@ -107,23 +155,22 @@ void asc_thread_core_destroy(void)
             thread->on_close(thread->arg);
         prev_thread = thread;
     }
-
-    asc_list_destroy(thread_observer.thread_list);
-    thread_observer.thread_list = NULL;
 }
 
 void asc_thread_core_loop(void)
 {
     thread_observer.is_changed = false;
-    asc_list_for(thread_observer.thread_list)
+    asc_thread_t *thread;
+    TAILQ_FOREACH(thread, &thread_observer.thread_list, entries)
     {
-        asc_thread_t *thread = (asc_thread_t *)asc_list_data(thread_observer.thread_list);
         if(!thread->is_started)
             continue;
 
+#ifdef _WIN32
+        /* select() is not able to wait for a pipe, poll the buffer */
         if(thread->on_read)
         {
-            if(thread->buffer->count > 0)
+            if(atomic_load(&thread->buffer->head) != atomic_load(&thread->buffer->tail))
             {
                 is_main_loop_idle = false;
                 thread->on_read(thread->arg);
@@ -131,6 +178,7 @@ void asc_thread_core_loop(void)
                     break;
             }
         }
+#endif
 
         if(thread->on_close && thread->is_closed)
         {
@@ -142,18 +190,269 @@ void asc_thread_core_loop(void)
     }
 }
 
+static void thread_buffer_wakeup(asc_thread_buffer_t *buffer)
+{
+#ifdef _WIN32
+    asc_event_core_wakeup();
+#else
+    const uint64_t value = 1;
+    if(write(buffer->wakeup_fd, &value, sizeof(value)) == -1)
+    {
+        ; /* counter overflow or pipe is full, consumer is signaled anyway */
+    }
+#endif
+}
+
+#ifndef _WIN32
+
+static void thread_wakeup_open(asc_thread_t *thread)
+{
+#ifdef WITH_EPOLL
+    thread->wakeup_fd[0] = eventfd(0, EFD_NONBLOCK);
+    asc_assert(thread->wakeup_fd[0] != -1
+               , MSG("failed to open wakeup fd [%s]"), strerror(errno));
+    thread->wakeup_fd[1] = thread->wakeup_fd[0];
+#else
+    const int ret = pipe(thread->wakeup_fd);
+    asc_assert(ret != -1, MSG("failed to open wakeup pipe [%s]"), strerror(errno));
+    fcntl(thread->wakeup_fd[0], F_SETFL, fcntl(thread->wakeup_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(thread->wakeup_fd[1], F_SETFL, fcntl(thread->wakeup_fd[1], F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+static void thread_wakeup_close(asc_thread_t *thread)
+{
+    ASC_FREE(thread->wakeup_event, asc_event_close);
+
+    close(thread->wakeup_fd[0]);
+    if(thread->wakeup_fd[1] != thread->wakeup_fd[0])
+        close(thread->wakeup_fd[1]);
+
+    thread->wakeup_fd[0] = -1;
+    thread->wakeup_fd[1] = -1;
+}
+
+static bool thread_is_alive(asc_thread_t *thread)
+{
+    asc_thread_t *item;
+    TAILQ_FOREACH(item, &thread_observer.thread_list, entries)
+    {
+        if(item == thread)
+            return true;
+    }
+    return false;
+}
+
+static void on_thread_wakeup(void *arg)
+{
+    asc_thread_t *thread = (asc_thread_t *)arg;
+    asc_thread_buffer_t *buffer = thread->buffer;
+
+    uint8_t drain[64];
+    while(read(thread->wakeup_fd[0], drain, sizeof(drain)) > 0)
+        ;
+
+    for(int i = 0; i < THREAD_READ_LIMIT; ++i)
+    {
+        if(atomic_load_sc(&buffer->head) == atomic_load(&buffer->tail))
+            return;
+
+        thread_observer.is_changed = false;
+        asc_profile_callback(thread->arg, thread->on_read(thread->arg));
+        if(thread_observer.is_changed && !thread_is_alive(thread))
+            return;
+    }
+
+    /* data is still pending. come back on next loop iteration */
+    if(atomic_load_sc(&buffer->head) != atomic_load(&buffer->tail))
+        thread_buffer_wakeup(buffer);
+}
+
+static void on_thread_wakeup_error(void *arg)
+{
+    asc_thread_t *thread = (asc_thread_t *)arg;
+    thread->on_close(thread->arg);
+}
+
+#endif /* !_WIN32 */
+
 asc_thread_t * asc_thread_init(void *arg)
 {
     asc_thread_t *thread = (asc_thread_t *)calloc(1, sizeof(asc_thread_t));
 
     thread->arg = arg;
 
-    asc_list_insert_tail(thread_observer.thread_list, thread);
+#ifndef _WIN32
+    thread->wakeup_fd[0] = -1;
+    thread->wakeup_fd[1] = -1;
+#endif
+
+#ifdef __linux__
+    CPU_ZERO(&thread->cpus);
+    thread->numa_node = -1;
+#endif
+
+    TAILQ_INSERT_TAIL(&thread_observer.thread_list, thread, entries);
     thread_observer.is_changed = true;
 
     return thread;
 }
 
+/* attributes of the thread, see thread.h */
+
+void asc_thread_set_name(asc_thread_t *thread, const char *name)
+{
+#ifdef __linux__
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+#else
+    __uarg(thread);
+    __uarg(name);
+#endif
+}
+
+#ifdef __linux__
+/* CPU list: "0,2,4-6" */
+static bool thread_parse_cpus(cpu_set_t *set, const char *cpus)
+{
+    CPU_ZERO(set);
+
+    const char *p = cpus;
+    while(*p)
+    {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        if(end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+
+        long last = first;
+        p = end;
+        if(*p == '-')
+        {
+            ++p;
+            last = strtol(p, &end, 10);
+            if(end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+
+        for(long cpu = first; cpu <= last; ++cpu)
+            CPU_SET(cpu, set);
+
+        while(*p == ',' || *p == ' ' || *p == '\n')
+            ++p;
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+#endif
+
+bool asc_thread_set_cpus(asc_thread_t *thread, const char *cpus)
+{
+#ifdef __linux__
+    return thread_parse_cpus(&thread->cpus, cpus);
+#else
+    __uarg(thread);
+    __uarg(cpus);
+    return false;
+#endif
+}
+
+void asc_thread_set_priority(asc_thread_t *thread, int priority)
+{
+#ifdef __linux__
+    thread->priority = priority;
+#else
+    __uarg(thread);
+    __uarg(priority);
+#endif
+}
+
+int asc_thread_numa_node(asc_thread_t *thread)
+{
+#ifdef __linux__
+    return thread->numa_node;
+#else
+    __uarg(thread);
+    return -1;
+#endif
+}
+
+bool asc_thread_set_numa_node(asc_thread_t *thread, int node)
+{
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if(!fp)
+        return false;
+
+    char cpus[256];
+    const bool is_ok = (fgets(cpus, sizeof(cpus), fp) != NULL
+                        && thread_parse_cpus(&thread->cpus, cpus));
+    fclose(fp);
+    if(!is_ok)
+        return false;
+
+    thread->numa_node = node;
+    return true;
+#else
+    __uarg(thread);
+    __uarg(node);
+    return false;
+#endif
+}
+
+static void thread_apply_attr(asc_thread_t *thread)
+{
+#ifdef __linux__
+    if(thread->name[0])
+        prctl(PR_SET_NAME, thread->name, 0, 0, 0);
+
+    if(thread->numa_node >= 0 && thread->numa_node < (int)(sizeof(unsigned long) * 8))
+    {
+        const unsigned long mask = 1UL << thread->numa_node;
+        if(syscall(__NR_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) != 0)
+        {
+            asc_log_warning(MSG("%s: failed to set memory policy [%s]")
+                            , thread->name, strerror(errno));
+        }
+    }
+
+    if(CPU_COUNT(&thread->cpus) > 0
+       && sched_setaffinity(0, sizeof(cpu_set_t), &thread->cpus) != 0)
+    {
+        asc_log_warning(MSG("%s: failed to set CPU affinity [%s]")
+                        , thread->name, strerror(errno));
+    }
+
+    if(thread->priority > 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = thread->priority;
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(ret != 0)
+        {
+            asc_log_warning(MSG("%s: failed to set SCHED_FIFO priority %d [%s]")
+                            , thread->name, thread->priority, strerror(ret));
+        }
+    }
+    else if(thread->priority == ASC_THREAD_PRIORITY_IDLE)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        if(ret != 0)
+        {
+            asc_log_warning(MSG("%s: failed to set SCHED_IDLE [%s]")
+                            , thread->name, strerror(ret));
+        }
+    }
+#else
+    __uarg(thread);
+#endif
+}
+
 #ifdef _WIN32
 static DWORD WINAPI asc_thread_loop(void *arg)
 #else
@@ -162,9 +461,11 @@ static void * asc_thread_loop(void *arg)
 {
     asc_thread_t *thread = (asc_thread_t *)arg;
 
+    thread_apply_attr(thread);
     thread->is_started = true;
     thread->loop(thread->arg);
     thread->is_closed = true;
+    asc_event_core_wakeup();
 
 #ifdef _WIN32
     return 0;
@@ -192,6 +493,18 @@ void asc_thread_start(  asc_thread_t *thread
     thread->on_close = on_close;
     asc_assert(thread->on_close != NULL, MSG("on_close required"));
 
+    if(on_read)
+    {
+#ifndef _WIN32
+        thread_wakeup_open(thread);
+        thread->wakeup_event = asc_event_init(thread->wakeup_fd[0], thread);
+        asc_event_set_on_read(thread->wakeup_event, on_thread_wakeup);
+        asc_event_set_on_error(thread->wakeup_event, on_thread_wakeup_error);
+        thread->buffer->wakeup_fd = thread->wakeup_fd[1];
+#endif
+        thread->buffer->is_wakeup = true;
+    }
+
 #ifdef _WIN32
     DWORD tid;
     thread->thread = CreateThread(NULL, 0, &asc_thread_loop, thread, 0, &tid);
@@ -222,105 +535,189 @@ void asc_thread_destroy(asc_thread_t *thread)
     CloseHandle(thread->thread);
 #else
     pthread_join(thread->thread, NULL);
+
+    if(thread->wakeup_fd[0] != -1)
+    {
+        thread->buffer->is_wakeup = false;
+        thread_wakeup_close(thread);
+    }
 #endif
 
     thread_observer.is_changed = true;
-    asc_list_remove_item(thread_observer.thread_list, thread);
+    TAILQ_REMOVE(&thread_observer.thread_list, thread, entries);
 
     free(thread);
 }
 
-asc_thread_buffer_t * asc_thread_buffer_init(size_t size)
+asc_thread_buffer_t * asc_thread_buffer_init_numa(size_t size, int numa_node)
 {
     asc_thread_buffer_t *buffer = (asc_thread_buffer_t *)calloc(1, sizeof(asc_thread_buffer_t));
     buffer->size = size;
-    buffer->buffer = (uint8_t *)malloc(size);
-    asc_thread_mutex_init(buffer->mutex);
+    buffer->buffer = (uint8_t *)asc_ring_alloc(size, numa_node);
+#ifndef _WIN32
+    buffer->wakeup_fd = -1;
+#endif
     return buffer;
 }
 
+asc_thread_buffer_t * asc_thread_buffer_init(size_t size)
+{
+    return asc_thread_buffer_init_numa(size, -1);
+}
+
 void asc_thread_buffer_destroy(asc_thread_buffer_t *buffer)
 {
     if(!buffer)
         return;
-    free(buffer->buffer);
-    asc_thread_mutex_destroy(buffer->mutex);
+    asc_ring_free(buffer->buffer, buffer->size);
     free(buffer);
 }
 
 void asc_thread_buffer_flush(asc_thread_buffer_t *buffer)
 {
-    asc_thread_mutex_lock(buffer->mutex);
-    buffer->count = 0;
-    buffer->read = 0;
-    buffer->write = 0;
-    asc_thread_mutex_unlock(buffer->mutex);
+    const size_t head = atomic_load(&buffer->head);
+    size_t tail = atomic_load(&buffer->tail);
+    while(tail != head && !atomic_cas(&buffer->tail, &tail, head))
+        ;
 }
 
-ssize_t asc_thread_buffer_read(asc_thread_buffer_t *buffer, void *data, size_t size)
+/*
+ * Producer. Returns pointer to the contiguous free space and its length.
+ * Data becomes visible to the consumer after asc_thread_buffer_commit().
+ */
+
+uint8_t * asc_thread_buffer_reserve(asc_thread_buffer_t *buffer, size_t *size)
 {
-    asc_thread_mutex_lock(buffer->mutex);
-    if(size > buffer->count)
-        size = buffer->count;
+    const size_t head = buffer->head;
+    size_t space = buffer->size - (head - buffer->head_tail);
+    if(space < *size)
+    {
+        buffer->head_tail = atomic_load(&buffer->tail);
+        space = buffer->size - (head - buffer->head_tail);
+    }
 
+    const size_t skip = head % buffer->size;
+    const size_t tail = buffer->size - skip;
+    *size = (space < tail) ? space : tail;
+
+    return &buffer->buffer[skip];
+}
+
+void asc_thread_buffer_commit(asc_thread_buffer_t *buffer, size_t size)
+{
     if(!size)
+        return;
+
+    const size_t head = buffer->head;
+    if(!buffer->is_wakeup)
     {
-        asc_thread_mutex_unlock(buffer->mutex);
-        return 0;
+        atomic_store(&buffer->head, head + size);
+        return;
     }
 
-    const size_t next_read = buffer->read + size;
-    if(next_read < buffer->size)
+    atomic_store_sc(&buffer->head, head + size);
+    if(atomic_load_sc(&buffer->tail) == head)
+        thread_buffer_wakeup(buffer);
+}
+
+/*
+ * Consumer. Returns pointer to the contiguous pending data and its length.
+ * asc_thread_buffer_consume() returns false if the buffer was flushed by
+ * producer in the meantime, then the data is not valid.
+ */
+
+const uint8_t * asc_thread_buffer_peek(asc_thread_buffer_t *buffer, size_t *size)
+{
+    const size_t tail = atomic_load(&buffer->tail);
+    size_t count = buffer->tail_head - tail;
+    if(count < *size || count > buffer->size)
     {
-        memcpy(data, &buffer->buffer[buffer->read], size);
-        buffer->read += size;
+        buffer->tail_head = atomic_load(&buffer->head);
+        count = buffer->tail_head - tail;
     }
-    else if(next_read > buffer->size)
+
+    buffer->tail_peek = tail;
+
+    const size_t skip = tail % buffer->size;
+    const size_t head = buffer->size - skip;
+    *size = (count < head) ? count : head;
+
+    return &buffer->buffer[skip];
+}
+
+bool asc_thread_buffer_consume(asc_thread_buffer_t *buffer, size_t size)
+{
+    size_t tail = buffer->tail_peek;
+    return atomic_cas(&buffer->tail, &tail, tail + size);
+}
+
+ssize_t asc_thread_buffer_read(asc_thread_buffer_t *buffer, void *data, size_t size)
+{
+    const size_t tail = atomic_load(&buffer->tail);
+    const size_t count = atomic_load(&buffer->head) - tail;
+    if(size > count)
+        size = count;
+
+    if(!size)
+        return 0;
+
+    const size_t skip = tail % buffer->size;
+    const size_t next_read = skip + size;
+    if(next_read <= buffer->size)
     {
-        const size_t tail = buffer->size - buffer->read;
-        memcpy(data, &buffer->buffer[buffer->read], tail);
-        buffer->read = size - tail;
-        memcpy(&((uint8_t *)data)[tail], buffer->buffer, buffer->read);
+        memcpy(data, &buffer->buffer[skip], size);
     }
     else
     {
-        memcpy(data, &buffer->buffer[buffer->read], size);
-        buffer->read = 0;
+        const size_t head = buffer->size - skip;
+        memcpy(data, &buffer->buffer[skip], head);
+        memcpy(&((uint8_t *)data)[head], buffer->buffer, size - head);
     }
 
-    buffer->count -= size;
-    asc_thread_mutex_unlock(buffer->mutex);
+    size_t expected = tail;
+    if(!atomic_cas(&buffer->tail, &expected, tail + size))
+        return 0; // flushed
 
     return size;
 }
 
+size_t asc_thread_buffer_space(asc_thread_buffer_t *buffer)
+{
+    buffer->head_tail = atomic_load(&buffer->tail);
+    const size_t used = buffer->head - buffer->head_tail;
+    return (used < buffer->size) ? (buffer->size - used) : 0;
+}
+
 ssize_t asc_thread_buffer_write(asc_thread_buffer_t *buffer, const void *data, size_t size)
 {
     if(!size)
         return 0;
 
-    asc_thread_mutex_lock(buffer->mutex);
-    if(buffer->count + size > buffer->size)
+    const size_t head = buffer->head;
+    if(head - buffer->head_tail + size > buffer->size)
     {
-        asc_thread_mutex_unlock(buffer->mutex);
-        return -1; // buffer overflow
+        buffer->head_tail = atomic_load(&buffer->tail);
+        if(head - buffer->head_tail + size > buffer->size)
+        {
+            asc_trace3(thread_buffer_overflow, buffer, size, head - buffer->head_tail);
+            return -1; // buffer overflow
+        }
     }
 
-    if(buffer->write + size >= buffer->size)
+    const size_t skip = head % buffer->size;
+    const size_t next_write = skip + size;
+    if(next_write <= buffer->size)
     {
-        const size_t tail = buffer->size - buffer->write;
-        memcpy(&buffer->buffer[buffer->write], data, tail);
-        buffer->write = size - tail;
-        if(buffer->write > 0)
-            memcpy(buffer->buffer, &((uint8_t *)data)[tail], buffer->write);
+        memcpy(&buffer->buffer[skip], data, size);
     }
     else
     {
-        memcpy(&buffer->buffer[buffer->write], data, size);
-        buffer->write += size;
+        const size_t tail = buffer->size - skip;
+        memcpy(&buffer->buffer[skip], data, tail);
+        memcpy(buffer->buffer, &((const uint8_t *)data)[tail], size - tail);
     }
-    buffer->count += size;
-    asc_thread_mutex_unlock(buffer->mutex);
+
+    asc_thread_buffer_commit(buffer, size);
 
     return size;
 }
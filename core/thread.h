@@ -38,12 +38,39 @@ void asc_thread_start(  asc_thread_t *thread
                       , thread_callback_t on_close);
 void asc_thread_destroy(asc_thread_t *thread);
 
+/*
+ * Attributes of the thread, set before asc_thread_start() and applied by
+ * the thread itself on start. Linux only, ignored on other systems.
+ *  name      - shown in top/ps, up to 15 characters
+ *  cpus      - CPU list, e.g. "2,4-6"
+ *  priority  - SCHED_FIFO priority 1..99, requires CAP_SYS_NICE.
+ *              ASC_THREAD_PRIORITY_IDLE - SCHED_IDLE, runs on the idle CPU time only
+ *  numa_node - CPUs of the node and preferred memory of the node
+ */
+#define ASC_THREAD_PRIORITY_IDLE (-1)
+
+void asc_thread_set_name(asc_thread_t *thread, const char *name);
+bool asc_thread_set_cpus(asc_thread_t *thread, const char *cpus) __wur;
+void asc_thread_set_priority(asc_thread_t *thread, int priority);
+bool asc_thread_set_numa_node(asc_thread_t *thread, int node) __wur;
+int asc_thread_numa_node(asc_thread_t *thread) __wur;
+
 asc_thread_buffer_t * asc_thread_buffer_init(size_t buffer_size) __wur;
+/* ring on the NUMA node of the consumer, see asc_ring_alloc() */
+asc_thread_buffer_t * asc_thread_buffer_init_numa(size_t buffer_size, int numa_node) __wur;
 void asc_thread_buffer_destroy(asc_thread_buffer_t *buffer);
 
 void asc_thread_buffer_flush(asc_thread_buffer_t *buffer);
 
 ssize_t asc_thread_buffer_read(asc_thread_buffer_t *buffer, void *data, size_t size) __wur;
 ssize_t asc_thread_buffer_write(asc_thread_buffer_t *buffer, const void *data, size_t size) __wur;
+/* free space for the producer, in bytes */
+size_t asc_thread_buffer_space(asc_thread_buffer_t *buffer) __wur;
+
+uint8_t * asc_thread_buffer_reserve(asc_thread_buffer_t *buffer, size_t *size) __wur;
+void asc_thread_buffer_commit(asc_thread_buffer_t *buffer, size_t size);
+
+const uint8_t * asc_thread_buffer_peek(asc_thread_buffer_t *buffer, size_t *size) __wur;
+bool asc_thread_buffer_consume(asc_thread_buffer_t *buffer, size_t size) __wur;
 
 #endif /* _ASC_THREAD_H_ */
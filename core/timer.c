@@ -18,10 +18,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "assert.h"
 #include "clock.h"
 #include "timer.h"
-#include "list.h"
 #include "loopctl.h"
+#include "loopstat.h"
+#include "profile.h"
+#include "trace.h"
+
+#ifdef HAVE_TIMERFD
+#   include <sys/timerfd.h>
+#   include "event.h"
+#endif
+
+#define MSG(_msg) "[core/timer] " _msg
+
+/*
+ * Timers are stored in a binary min-heap ordered by next_shot.
+ * Insert and cancel are O(log n), the loop only touches expired timers.
+ */
+
+#define TIMER_HEAP_SIZE 64
 
 struct asc_timer_t
 {
@@ -30,77 +47,235 @@ struct asc_timer_t
 
     uint64_t interval;
     uint64_t next_shot;
+
+    size_t idx; // position in the heap
+    bool is_running;
+    bool is_precise; // asc_timer_init_us()
 };
 
-static asc_list_t *timer_list = NULL;
+typedef struct
+{
+    asc_timer_t **heap;
+    size_t size;
+    size_t count;
 
-void asc_timer_core_init(void)
+#ifdef HAVE_TIMERFD
+    /* armed to the shot of the nearest precise timer */
+    int fd;
+    asc_event_t *event;
+    uint64_t armed;
+#endif
+} timer_observer_t;
+
+static timer_observer_t timer_observer;
+
+static void timer_heap_set(size_t idx, asc_timer_t *timer)
 {
-    timer_list = asc_list_init();
+    timer_observer.heap[idx] = timer;
+    timer->idx = idx;
 }
 
-void asc_timer_core_destroy(void)
+static void timer_heap_up(size_t idx)
 {
-    asc_list_first(timer_list);
-    while(!asc_list_eol(timer_list))
+    asc_timer_t *const timer = timer_observer.heap[idx];
+    while(idx > 0)
     {
-        free(asc_list_data(timer_list));
-        asc_list_remove_current(timer_list);
+        const size_t parent = (idx - 1) / 2;
+        if(timer_observer.heap[parent]->next_shot <= timer->next_shot)
+            break;
+        timer_heap_set(idx, timer_observer.heap[parent]);
+        idx = parent;
     }
-    asc_list_destroy(timer_list);
-    timer_list = NULL;
+    timer_heap_set(idx, timer);
 }
 
-void asc_timer_core_loop(void)
+static void timer_heap_down(size_t idx)
 {
-    int is_detached = 0;
-
-    asc_list_for(timer_list)
+    asc_timer_t *const timer = timer_observer.heap[idx];
+    while(true)
     {
-        asc_timer_t *timer = (asc_timer_t *)asc_list_data(timer_list);
-        if(!timer->callback)
+        size_t child = idx * 2 + 1;
+        if(child >= timer_observer.count)
+            break;
+        if(child + 1 < timer_observer.count
+           && timer_observer.heap[child + 1]->next_shot < timer_observer.heap[child]->next_shot)
         {
-            ++is_detached;
-            continue;
+            ++child;
         }
+        if(timer->next_shot <= timer_observer.heap[child]->next_shot)
+            break;
+        timer_heap_set(idx, timer_observer.heap[child]);
+        idx = child;
+    }
+    timer_heap_set(idx, timer);
+}
 
-        const uint64_t cur = asc_utime();
-        if(cur >= timer->next_shot)
-        {
-            if(timer->interval == 0)
-            {
-                // one shot timer
-                is_main_loop_idle = false;
-                timer->callback(timer->arg);
-                timer->callback = NULL;
-                ++is_detached;
-            }
-            else
-            {
-                is_main_loop_idle = false;
-                timer->next_shot = cur + timer->interval;
-                timer->callback(timer->arg);
-            }
-        }
+static void timer_heap_insert(asc_timer_t *timer)
+{
+    if(timer_observer.count == timer_observer.size)
+    {
+        timer_observer.size *= 2;
+        timer_observer.heap = (asc_timer_t **)realloc(timer_observer.heap
+                                                      , timer_observer.size
+                                                        * sizeof(asc_timer_t *));
+        asc_assert(timer_observer.heap != NULL, MSG("failed to allocate timer heap"));
     }
 
-    if(!is_detached)
+    timer_heap_set(timer_observer.count, timer);
+    ++timer_observer.count;
+    timer_heap_up(timer->idx);
+}
+
+static void timer_heap_remove(asc_timer_t *timer)
+{
+    const size_t idx = timer->idx;
+    --timer_observer.count;
+    if(idx == timer_observer.count)
         return;
 
-    asc_list_first(timer_list);
-    while(!asc_list_eol(timer_list))
+    timer_heap_set(idx, timer_observer.heap[timer_observer.count]);
+    if(idx > 0 && timer_observer.heap[(idx - 1) / 2]->next_shot > timer_observer.heap[idx]->next_shot)
+        timer_heap_up(idx);
+    else
+        timer_heap_down(idx);
+}
+
+void asc_timer_core_init(void)
+{
+    memset(&timer_observer, 0, sizeof(timer_observer));
+    timer_observer.size = TIMER_HEAP_SIZE;
+    timer_observer.heap = (asc_timer_t **)malloc(TIMER_HEAP_SIZE * sizeof(asc_timer_t *));
+}
+
+void asc_timer_core_destroy(void)
+{
+    for(size_t i = 0; i < timer_observer.count; ++i)
+        free(timer_observer.heap[i]);
+
+    free(timer_observer.heap);
+    memset(&timer_observer, 0, sizeof(timer_observer));
+}
+
+void asc_timer_core_loop(void)
+{
+    if(!timer_observer.count)
+        return;
+
+    const uint64_t cur = asc_utime();
+
+    while(timer_observer.count > 0)
     {
-        asc_timer_t *timer = (asc_timer_t *)asc_list_data(timer_list);
-        if(timer->callback)
-            asc_list_next(timer_list);
-        else
+        asc_timer_t *const timer = timer_observer.heap[0];
+        if(timer->next_shot > cur)
+            break;
+
+        timer_heap_remove(timer);
+        asc_hist_add(&asc_loopstat.timer_late, cur - timer->next_shot);
+        asc_trace2(timer_fire, timer->arg, cur - timer->next_shot);
+
+        is_main_loop_idle = false;
+        timer->is_running = true;
+        asc_profile_callback(timer->arg, timer->callback(timer->arg));
+        timer->is_running = false;
+
+        // one shot timer or destroyed in the callback
+        if(timer->interval == 0 || !timer->callback)
         {
-            free(asc_list_data(timer_list));
-            asc_list_remove_current(timer_list);
+            free(timer);
+            continue;
         }
+
+        /* precise timer keeps the period without the drift of the loop */
+        if(timer->is_precise && timer->next_shot + timer->interval > cur)
+            timer->next_shot += timer->interval;
+        else
+            timer->next_shot = cur + timer->interval;
+        timer_heap_insert(timer);
     }
 }
 
+#ifdef HAVE_TIMERFD
+
+static void timerfd_close(void)
+{
+    ASC_FREE(timer_observer.event, asc_event_close);
+    close(timer_observer.fd);
+    timer_observer.fd = 0;
+    timer_observer.armed = 0;
+}
+
+static void on_timerfd_read(void *arg)
+{
+    __uarg(arg);
+
+    uint64_t expirations;
+    if(read(timer_observer.fd, &expirations, sizeof(expirations)) == -1)
+    {
+        ; /* woken up anyway */
+    }
+    timer_observer.armed = 0;
+}
+
+static void on_timerfd_error(void *arg)
+{
+    __uarg(arg);
+    timerfd_close();
+}
+
+static bool timerfd_arm(uint64_t next_shot)
+{
+    if(!timer_observer.event)
+    {
+        const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(fd == -1)
+            return false;
+
+        timer_observer.fd = fd;
+        timer_observer.event = asc_event_init(fd, NULL);
+        asc_event_set_on_read(timer_observer.event, on_timerfd_read);
+        asc_event_set_on_error(timer_observer.event, on_timerfd_error);
+    }
+
+    if(timer_observer.armed == next_shot)
+        return true;
+
+    /* asc_utime() and timerfd are on the same CLOCK_MONOTONIC */
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next_shot / 1000000;
+    its.it_value.tv_nsec = (next_shot % 1000000) * 1000;
+    if(timerfd_settime(timer_observer.fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        timerfd_close();
+        return false;
+    }
+
+    timer_observer.armed = next_shot;
+    return true;
+}
+
+#endif /* HAVE_TIMERFD */
+
+/* milliseconds until the nearest timer shot, but not more than limit */
+unsigned int asc_timer_core_timeout(unsigned int limit)
+{
+    if(!timer_observer.count)
+        return limit;
+
+    const uint64_t next_shot = timer_observer.heap[0]->next_shot;
+    const uint64_t cur = asc_utime();
+    if(next_shot <= cur)
+        return 0;
+
+#ifdef HAVE_TIMERFD
+    if(timer_observer.heap[0]->is_precise && timerfd_arm(next_shot))
+        return limit;
+#endif
+
+    const uint64_t timeout = (next_shot - cur + 999) / 1000;
+    return (timeout < limit) ? (unsigned int)timeout : limit;
+}
+
 asc_timer_t * asc_timer_init(unsigned int ms, void (*callback)(void *), void *arg)
 {
     asc_timer_t *const timer = (asc_timer_t *)calloc(1, sizeof(asc_timer_t));
@@ -110,7 +285,7 @@ asc_timer_t * asc_timer_init(unsigned int ms, void (*callback)(void *), void *ar
 
     timer->next_shot = asc_utime() + timer->interval;
 
-    asc_list_insert_tail(timer_list, timer);
+    timer_heap_insert(timer);
 
     return timer;
 }
@@ -123,10 +298,33 @@ asc_timer_t * asc_timer_one_shot(unsigned int ms, void (*callback)(void *), void
     return timer;
 }
 
+asc_timer_t * asc_timer_init_us(uint64_t usec, timer_callback_t callback, void *arg)
+{
+    asc_timer_t *const timer = (asc_timer_t *)calloc(1, sizeof(asc_timer_t));
+    timer->interval = usec;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->is_precise = true;
+
+    timer->next_shot = asc_utime() + timer->interval;
+
+    timer_heap_insert(timer);
+
+    return timer;
+}
+
 void asc_timer_destroy(asc_timer_t *timer)
 {
     if(!timer)
         return;
 
-    timer->callback = NULL;
+    if(timer->is_running)
+    {
+        // released in asc_timer_core_loop() after the callback
+        timer->callback = NULL;
+        return;
+    }
+
+    timer_heap_remove(timer);
+    free(timer);
 }
@@ -30,8 +30,17 @@ void asc_timer_core_init(void);
 void asc_timer_core_loop(void);
 void asc_timer_core_destroy(void);
 
+unsigned int asc_timer_core_timeout(unsigned int limit) __wur;
+
 asc_timer_t * asc_timer_init(unsigned int ms, timer_callback_t callback, void *arg) __wur;
 asc_timer_t * asc_timer_one_shot(unsigned int ms, timer_callback_t callback, void *arg);
+
+/*
+ * Timer with the interval in microseconds. On Linux the main loop is woken
+ * up by timerfd on the shot of the timer, so the timer does not depend on
+ * the millisecond timeout of the event wait.
+ */
+asc_timer_t * asc_timer_init_us(uint64_t usec, timer_callback_t callback, void *arg) __wur;
 void asc_timer_destroy(asc_timer_t *timer);
 
 #endif /* _ASC_TIMER_H_ */
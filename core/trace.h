@@ -0,0 +1,62 @@
+/*
+ * Astra Core
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASC_TRACE_H_
+#define _ASC_TRACE_H_ 1
+
+/*
+ * USDT probes of the provider "astra". With <sys/sdt.h> (systemtap-sdt-dev)
+ * each probe is a nop instruction and a note in the ELF, bpftrace or perf
+ * attach to it at run time. Without the header the probes are not compiled.
+ *
+ *      stream_send(module, count)          - packets sent by the module stream
+ *      socket_send(fd, size, ret)          - send, sendto. for writev and sendmsg
+ *                                            size is the count of the iov items
+ *      socket_send_batch(fd, count, ret)   - sendmmsg, count of the datagrams
+ *      socket_recv(fd, size, ret)          - recv, recvfrom, recvmsg
+ *      socket_recv_batch(fd, count, ret)   - recvmmsg, count of the datagrams
+ *      thread_buffer_overflow(buffer, size, used)
+ *      timer_fire(arg, late)               - late is in microseconds
+ *      decrypt_key_change(name, ca_stream, keys)
+ *                                          - keys: 1 even, 2 odd, 3 both
+ *      decrypt_batch_flush(name, count)    - packets in the descrambled batch
+ *      decrypt_batch_deadline(name, limit) - partial batch on the batch_latency
+ *                                            timer, limit is the batch size
+ *      newcamd_ecm_send(name, msg_id, table_id)
+ *                                          - ECM and EMM, table_id 0x80 or 0x81 is ECM
+ *      newcamd_ecm_recv(name, msg_id, rtt) - rtt is in microseconds
+ *
+ * Example: bpftrace -e 'usdt:./astra:astra:newcamd_ecm_recv { @rtt = hist(arg2); }'
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#   include <sys/sdt.h>
+#   define asc_trace0(_name) DTRACE_PROBE(astra, _name)
+#   define asc_trace1(_name, _a) DTRACE_PROBE1(astra, _name, _a)
+#   define asc_trace2(_name, _a, _b) DTRACE_PROBE2(astra, _name, _a, _b)
+#   define asc_trace3(_name, _a, _b, _c) DTRACE_PROBE3(astra, _name, _a, _b, _c)
+#else
+#   define asc_trace0(_name)
+#   define asc_trace1(_name, _a)
+#   define asc_trace2(_name, _a, _b)
+#   define asc_trace3(_name, _a, _b, _c)
+#endif
+
+#endif /* _ASC_TRACE_H_ */
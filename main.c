@@ -38,6 +38,7 @@ static void signal_handler(int signum)
         case SIGHUP:
             asc_log_hup();
             is_sighup = true;
+            asc_event_core_wakeup();
             return;
         case SIGPIPE:
             return;
@@ -98,6 +99,14 @@ int main(int argc, const char **argv)
     SetConsoleCtrlHandler((PHANDLER_ROUTINE)signal_handler, true);
 #endif
 
+    /* descriptors of the previous process are taken by the config, see core/handover.h */
+    static const char *handover_path = NULL;
+    for(int i = 1; i < argc - 1; ++i)
+    {
+        if(!strcmp(argv[i], "--handover"))
+            handover_path = argv[i + 1];
+    }
+
 astra_reload_entry:
 
     asc_srand();
@@ -105,9 +114,11 @@ astra_reload_entry:
     asc_timer_core_init();
     asc_socket_core_init();
     asc_event_core_init();
+    asc_handover_core_init(handover_path);
 
     lua = luaL_newstate();
     luaL_openlibs(lua);
+    astra_gc_init();
 
     /* load modules */
     for(int i = 0; astra_mods[i]; i++)
@@ -140,9 +151,6 @@ astra_reload_entry:
 
 #define GC_TIMEOUT (1 * 1000 * 1000)
 
-    uint64_t current_time = asc_utime();
-    uint64_t gc_check_timeout = current_time;
-
     /* start */
     const int main_loop_status = setjmp(main_loop);
     if(main_loop_status == 0)
@@ -179,13 +187,24 @@ astra_reload_entry:
                 luaL_error(lua, "[main] %s", lua_tostring(lua, -1));
         }
 
+        asc_handover_core_start();
+
         while(true)
         {
+            /* block until the nearest timer if previous iteration was idle */
+            const unsigned int timeout = (is_main_loop_idle)
+                                       ? asc_timer_core_timeout(GC_TIMEOUT / 1000)
+                                       : 0;
+
             is_main_loop_idle = true;
 
-            asc_event_core_loop();
+            asc_event_core_loop(timeout);
             asc_timer_core_loop();
             asc_thread_core_loop();
+            asc_command_core_loop();
+
+            if(module_lua_notify_flush())
+                is_main_loop_idle = false;
 
             if(is_sighup)
             {
@@ -202,26 +221,28 @@ astra_reload_entry:
             }
 
             if(is_main_loop_idle)
-            {
-                current_time = asc_utime();
-                if((current_time - gc_check_timeout) >= GC_TIMEOUT)
-                {
-                    gc_check_timeout = current_time;
-                    lua_gc(lua, LUA_GCCOLLECT, 0);
-                }
+                astra_gc_step();
 
-                asc_usleep(1000);
-            }
+            asc_loopstat_end();
         }
     }
 
     /* destroy */
+    asc_loopstat_core_destroy(); /* watchdog thread refers to the lua state */
     lua_close(lua);
+    module_stream_block_pool_destroy();
+    string_buffer_cache_destroy();
+    mpegts_pes_asm_pool_destroy();
+    mpegts_epg_destroy();
 
+    asc_handover_core_destroy();
     asc_event_core_destroy();
     asc_socket_core_destroy();
     asc_timer_core_destroy();
     asc_thread_core_destroy();
+    asc_command_core_destroy();
+    asc_profile_core_destroy();
+    asc_metric_core_destroy();
 
     asc_log_info("[main] %s", (main_loop_status == 2) ? "reload" : "exit");
     asc_log_core_destroy();
@@ -21,12 +21,16 @@
 #include <astra.h>
 
 #include <sys/ioctl.h>
+#include <poll.h>
 
 #define MSG(_msg) "[asi_input %d] " _msg, mod->adapter
 
 #define ASI_BUFFER_SIZE (1022 * TS_PACKET_SIZE)
 #define ASI_IOC_RXSETPF _IOW('?', 76, unsigned int [256])
 
+/* default size of the thread ring in MB, see option 'buffer_size' */
+#define ASI_THREAD_BUFFER_SIZE 8
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -37,8 +41,16 @@ struct module_data_t
     int fd;
     asc_event_t *event;
     uint8_t filter[MAX_PID / 8];
+    asc_timer_t *filter_timer; // filter is applied once for all PID changes of the loop
+
+    /* reader thread, see option 'thread' */
+    asc_thread_t *thread;
+    asc_thread_buffer_t *thread_output;
+    bool is_thread_started;
+    size_t thread_buffer_size;
 
     uint8_t buffer[ASI_BUFFER_SIZE];
+    size_t buffer_skip;
 };
 
 static void asi_on_error(void *arg)
@@ -52,19 +64,139 @@ static void asi_on_error(void *arg)
 }
 
 
+/* reads into mod->buffer, returns number of the complete packets or -1 on error */
+static ssize_t asi_read(module_data_t *mod)
+{
+    const ssize_t len = read(mod->fd
+                             , &mod->buffer[mod->buffer_skip]
+                             , ASI_BUFFER_SIZE - mod->buffer_skip);
+    if(len <= 0)
+        return -1;
+
+    mod->buffer_skip += len;
+    return mod->buffer_skip / TS_PACKET_SIZE;
+}
+
+/* incomplete packet is moved to the begin of the buffer */
+static void asi_read_done(module_data_t *mod, size_t count)
+{
+    const size_t size = count * TS_PACKET_SIZE;
+    mod->buffer_skip -= size;
+    if(mod->buffer_skip > 0)
+        memmove(mod->buffer, &mod->buffer[size], mod->buffer_skip);
+}
+
 static void asi_on_read(void *arg)
 {
     module_data_t *mod = arg;
 
-    const ssize_t len = read(mod->fd, mod->buffer, ASI_BUFFER_SIZE);
-    if(len <= 0)
+    const ssize_t count = asi_read(mod);
+    if(count < 0)
     {
         asi_on_error(mod);
         return;
     }
 
-    for(int i = 0; i < len; i += TS_PACKET_SIZE)
-        module_stream_send(mod, &mod->buffer[i]);
+    module_stream_send_batch(mod, mod->buffer, count);
+    asi_read_done(mod, count);
+}
+
+/*
+ * ooooooooooo ooooo ooooo oooooooooo  ooooooooooo      o      ooooooooo
+ * 88  888  88  888   888   888    888  888    88      888      888    88o
+ *     888      888ooo888   888oooo88   888ooo8       8  88     888    888
+ *     888      888   888   888  88o    888    oo    8oooo88    888    888
+ *    o888o    o888o o888o o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+/*
+ * With the option 'thread' the device is read by a dedicated thread into
+ * the lock-free thread ring, the main loop takes the packets by batches.
+ * Long main loop iterations only fill the ring, the device is still read.
+ */
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = arg;
+
+    mod->is_thread_started = false;
+    ASC_FREE(mod->thread, asc_thread_destroy);
+    ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
+}
+
+static void on_thread_read(void *arg)
+{
+    module_data_t *mod = arg;
+
+    // ring size is aligned to the packet size, packets are not wrapped
+    size_t size = TS_PACKET_SIZE;
+    const uint8_t *ptr = asc_thread_buffer_peek(mod->thread_output, &size);
+    const size_t count = size / TS_PACKET_SIZE;
+    if(count == 0)
+        return;
+
+    module_stream_send_batch(mod, ptr, count);
+    if(!asc_thread_buffer_consume(mod->thread_output, count * TS_PACKET_SIZE))
+        asc_log_debug(MSG("thread buffer flushed"));
+}
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = arg;
+
+    struct pollfd fds;
+    fds.fd = mod->fd;
+    fds.events = POLLIN;
+
+    mod->is_thread_started = true;
+
+    while(mod->is_thread_started)
+    {
+        const int ret = poll(&fds, 1, 100);
+        if(ret == 0)
+            continue;
+
+        if(ret < 0)
+        {
+            asc_log_error(MSG("poll() failed [%s]"), strerror(errno));
+            astra_abort();
+        }
+
+        const ssize_t count = asi_read(mod);
+        if(count < 0)
+        {
+            asc_log_error(MSG("asi read error [%s]"), strerror(errno));
+            astra_abort();
+        }
+
+        const ssize_t size = count * TS_PACKET_SIZE;
+        if(asc_thread_buffer_write(mod->thread_output, mod->buffer, size) != size)
+            asc_log_warning(MSG("thread buffer overflow"));
+
+        asi_read_done(mod, count);
+    }
+}
+
+/*
+ * ooooooooooo ooooo ooooo   ooooooooooo ooooooooooo oooooooooo
+ *  888    88   888   888    88  888  88  888    88   888    888
+ *  888ooo8     888   888        888      888ooo8     888oooo88
+ *  888         888   888      o 888      888    oo   888  88o
+ * o888o       o888o o888ooooo88 o888o    o888ooo8888 o888o  88o8
+ *
+ */
+
+static void on_filter_timer(void *arg)
+{
+    module_data_t *mod = arg;
+
+    mod->filter_timer = NULL;
+
+    if(ioctl(mod->fd, ASI_IOC_RXSETPF, mod->filter) < 0)
+    {
+        asc_log_error(MSG("failed to set PES filter [%s]"), strerror(errno));
+    }
 }
 
 
@@ -84,10 +216,8 @@ static void set_pid(module_data_t *mod, uint16_t pid, int is_set)
     else
         mod->filter[pid / 8] &= ~(0x01 << (pid % 8));
 
-    if(ioctl(mod->fd, ASI_IOC_RXSETPF, mod->filter) < 0)
-    {
-        asc_log_error(MSG("failed to set PES filter [%s]"), strerror(errno));
-    }
+    if(!mod->filter_timer)
+        mod->filter_timer = asc_timer_one_shot(0, on_filter_timer, mod);
 }
 
 static void join_pid(module_data_t *mod, uint16_t pid)
@@ -112,6 +242,15 @@ static void module_init(module_data_t *mod)
     }
     module_option_boolean("budget", &mod->budget);
 
+    bool is_thread = false;
+    module_option_boolean("thread", &is_thread);
+
+    int buffer_size = 0;
+    if(!module_option_number("buffer_size", &buffer_size) || buffer_size <= 0)
+        buffer_size = ASI_THREAD_BUFFER_SIZE;
+    mod->thread_buffer_size = (size_t)buffer_size * 1024 * 1024;
+    mod->thread_buffer_size -= mod->thread_buffer_size % TS_PACKET_SIZE;
+
     char dev_name[16];
     sprintf(dev_name, "/dev/asirx%d", mod->adapter);
     mod->fd = open(dev_name, O_RDONLY);
@@ -137,7 +276,21 @@ static void module_init(module_data_t *mod)
 
     fsync(mod->fd);
 
+    if(is_thread)
+    {
+        mod->thread = asc_thread_init(mod);
+        asc_thread_set_name(mod->thread, "asi_input");
+        module_option_thread(mod->thread);
+        mod->thread_output = asc_thread_buffer_init(mod->thread_buffer_size);
+        asc_thread_start(  mod->thread
+                         , thread_loop
+                         , on_thread_read, mod->thread_output
+                         , on_thread_close);
+        return;
+    }
+
     mod->event = asc_event_init(mod->fd, mod);
+    asc_event_set_priority(mod->event, ASC_EVENT_INPUT);
     asc_event_set_on_read(mod->event, asi_on_read);
     asc_event_set_on_error(mod->event, asi_on_error);
 }
@@ -146,7 +299,11 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
-    asc_event_close(mod->event);
+    if(mod->thread)
+        on_thread_close(mod);
+
+    ASC_FREE(mod->filter_timer, asc_timer_destroy);
+    ASC_FREE(mod->event, asc_event_close);
     if(mod->fd)
         close(mod->fd);
 }
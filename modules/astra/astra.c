@@ -25,16 +25,79 @@
  *      astra.version
  *                  - string, astra version string
  *      astra.debug - boolean, is a debug version
+ *      astra.reactor
+ *                  - number, index of the current reactor process (0 - master)
+ *      astra.reactors
+ *                  - number, total number of the reactor processes
  *
  * Methods:
  *      astra.abort()
  *                  - abort execution
  *      astra.exit()
  *                  - normal exit from astra
+ *      astra.fork(count)
+ *                  - start count-1 reactor processes with own event loop.
+ *                    must be called before any module, server, timer or
+ *                    thread is created, stream.lua calls it before the other
+ *                    options. returns reactor index
+ *      astra.profile([enable])
+ *                  - with boolean argument starts (counters are reset) or stops
+ *                    the CPU accounting by module instance, see core/profile.h.
+ *                    without arguments returns the report:
+ *                    { enabled, time, items = { { type, name, packets_in,
+ *                    packets_out, stream_calls, event_calls, stream_us, event_us,
+ *                    self_us, cpu }, ... } }. items are sorted by self_us,
+ *                    time is in microseconds, cpu is the self time per second
+ *      astra.loopstat([reset])
+ *                  - main loop histograms, see core/loopstat.h:
+ *                    { iteration, timer_late, batch, callback }, each is
+ *                    { count, p50, p90, p99, p999, max }. time is in microseconds,
+ *                    callback is collected while the profiler is enabled.
+ *                    with true argument the histograms are reset after the report
+ *      astra.watchdog(ms)
+ *                  - log the main loop iterations longer than ms with the Lua
+ *                    backtrace. 0 - disable
+ *      astra.latency([reset])
+ *                  - latency of the sampled packets by module instance, see
+ *                    module_stream_trace(): { { type, name, latency = { count,
+ *                    p50, p90, p99, p999, max } }, ... }. time since the ingress
+ *                    in microseconds when the instance sends the packet
+ *      astra.memstat()
+ *                  - heap usage by module instance, see core/memory.h:
+ *                    { enabled, bytes, count, types = { [type] = { bytes, count,
+ *                    items = { { name, bytes, count, leaked }, ... } } } }.
+ *                    leaked is true if the instance is destroyed with the live
+ *                    allocations. enabled is false without --with-memstat
+ *      astra.stream_graph()
+ *                  - stream nodes of the process, see module_stream_graph_foreach():
+ *                    { { id, type, name, parent, transparent, routed, packets,
+ *                    pids = { ... }, children = { ... }, edge = { packets, bytes,
+ *                    rate, byte_rate } }, ... }. parent and children are the ids,
+ *                    children are the receivers of the packets sent by the node.
+ *                    packets are sent by the node, edge is the packets received
+ *                    from the parent, rate is per second. type and name are
+ *                    defined for the module instances
  */
 
 #include <astra.h>
 
+#ifndef _WIN32
+#   include <signal.h>
+#   include <sys/wait.h>
+#   ifdef __linux__
+#       include <sys/prctl.h>
+#   endif
+#endif
+
+#define REACTOR_MAX 64
+#define REACTOR_KILL_TIMEOUT (5 * 1000 * 1000) // us, SIGKILL after SIGTERM
+
+static int reactor_id = 0;
+static int reactor_count = 1;
+#ifndef _WIN32
+static pid_t reactor_pid[REACTOR_MAX];
+#endif
+
 static int _astra_exit(lua_State *L)
 {
     __uarg(L);
@@ -56,6 +119,453 @@ static int _astra_reload(lua_State *L)
     return 0;
 }
 
+#ifndef _WIN32
+static void reactor_kill(void)
+{
+    if(reactor_id != 0)
+        return;
+
+    for(int i = 1; i < reactor_count; ++i)
+    {
+        if(reactor_pid[i] > 0)
+            kill(reactor_pid[i], SIGTERM);
+    }
+
+    /* reactors stop in parallel, the hung one is killed after the timeout */
+    const uint64_t deadline = asc_utime() + REACTOR_KILL_TIMEOUT;
+    for(int i = 1; i < reactor_count; ++i)
+    {
+        if(reactor_pid[i] <= 0)
+            continue;
+
+        while(waitpid(reactor_pid[i], NULL, WNOHANG) == 0)
+        {
+            if(asc_utime() >= deadline)
+            {
+                asc_log_warning("[astra.fork] reactor %d is not stopped. kill", i);
+                kill(reactor_pid[i], SIGKILL);
+                waitpid(reactor_pid[i], NULL, 0);
+                break;
+            }
+            asc_usleep(10 * 1000);
+        }
+        reactor_pid[i] = 0;
+    }
+    reactor_count = 1;
+}
+#endif
+
+static void reactor_set(lua_State *L)
+{
+    lua_getglobal(L, "astra");
+    lua_pushnumber(L, reactor_id);
+    lua_setfield(L, -2, "reactor");
+    lua_pushnumber(L, reactor_count);
+    lua_setfield(L, -2, "reactors");
+    lua_pop(L, 1);
+}
+
+typedef struct
+{
+    const asc_profile_t **list;
+    size_t count;
+    size_t size;
+} profile_list_t;
+
+static inline uint64_t profile_self(const asc_profile_t *profile)
+{
+    const uint64_t total = profile->stream_cycles + profile->event_cycles;
+    return (total > profile->child_cycles) ? total - profile->child_cycles : 0;
+}
+
+static void profile_list_append(void *arg, const asc_profile_t *profile)
+{
+    profile_list_t *const p = (profile_list_t *)arg;
+    if(p->count == p->size)
+    {
+        p->size = (p->size) ? p->size * 2 : 256;
+        p->list = (const asc_profile_t **)realloc(p->list, p->size * sizeof(asc_profile_t *));
+    }
+    p->list[p->count++] = profile;
+}
+
+static int profile_compare(const void *a, const void *b)
+{
+    const uint64_t x = profile_self(*(const asc_profile_t *const *)a);
+    const uint64_t y = profile_self(*(const asc_profile_t *const *)b);
+    return (x < y) - (x > y);
+}
+
+static void profile_push(lua_State *L, const asc_profile_t *profile, double cycles_us
+                         , uint64_t time)
+{
+    lua_newtable(L);
+
+    lua_pushstring(L, (profile->type) ? profile->type : "other");
+    lua_setfield(L, -2, "type");
+    if(profile->name)
+    {
+        lua_pushstring(L, profile->name);
+        lua_setfield(L, -2, "name");
+    }
+
+    lua_pushnumber(L, (lua_Number)profile->packets_in);
+    lua_setfield(L, -2, "packets_in");
+    lua_pushnumber(L, (lua_Number)profile->packets_out);
+    lua_setfield(L, -2, "packets_out");
+    lua_pushnumber(L, (lua_Number)profile->stream_calls);
+    lua_setfield(L, -2, "stream_calls");
+    lua_pushnumber(L, (lua_Number)profile->event_calls);
+    lua_setfield(L, -2, "event_calls");
+
+    lua_pushnumber(L, (lua_Number)profile->stream_cycles / cycles_us);
+    lua_setfield(L, -2, "stream_us");
+    lua_pushnumber(L, (lua_Number)profile->event_cycles / cycles_us);
+    lua_setfield(L, -2, "event_us");
+
+    const double self_us = (double)profile_self(profile) / cycles_us;
+    lua_pushnumber(L, self_us);
+    lua_setfield(L, -2, "self_us");
+    lua_pushnumber(L, (time > 0) ? self_us / time : 0);
+    lua_setfield(L, -2, "cpu");
+}
+
+static int _astra_profile(lua_State *L)
+{
+    if(lua_isboolean(L, 1))
+    {
+        asc_profile_enable(lua_toboolean(L, 1));
+        return 0;
+    }
+
+    lua_newtable(L);
+    lua_pushboolean(L, asc_profile_enabled);
+    lua_setfield(L, -2, "enabled");
+
+    const uint64_t time = asc_profile_time();
+    const double cycles_us = asc_profile_cycles_us();
+    lua_pushnumber(L, (lua_Number)time);
+    lua_setfield(L, -2, "time");
+
+    profile_list_t p = { NULL, 0, 0 };
+    asc_profile_foreach(profile_list_append, &p);
+    profile_list_append(&p, asc_profile_other());
+    qsort(p.list, p.count, sizeof(asc_profile_t *), profile_compare);
+
+    lua_newtable(L);
+    for(size_t i = 0; i < p.count; ++i)
+    {
+        profile_push(L, p.list[i], cycles_us, time);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "items");
+
+    free(p.list);
+    return 1;
+}
+
+static void loopstat_push(lua_State *L, const char *name, const asc_hist_t *hist, double scale)
+{
+    static const struct
+    {
+        const char *name;
+        double p;
+    } percentile_list[] =
+    {
+        { "p50", 50.0 },
+        { "p90", 90.0 },
+        { "p99", 99.0 },
+        { "p999", 99.9 },
+    };
+
+    lua_newtable(L);
+    lua_pushnumber(L, (lua_Number)hist->count);
+    lua_setfield(L, -2, "count");
+    for(size_t i = 0; i < ASC_ARRAY_SIZE(percentile_list); ++i)
+    {
+        const uint64_t value = asc_hist_percentile(hist, percentile_list[i].p);
+        lua_pushnumber(L, (lua_Number)value / scale);
+        lua_setfield(L, -2, percentile_list[i].name);
+    }
+    lua_pushnumber(L, (lua_Number)hist->max / scale);
+    lua_setfield(L, -2, "max");
+    lua_setfield(L, -2, name);
+}
+
+static int _astra_loopstat(lua_State *L)
+{
+    lua_newtable(L);
+    loopstat_push(L, "iteration", &asc_loopstat.iteration, 1.0);
+    loopstat_push(L, "timer_late", &asc_loopstat.timer_late, 1.0);
+    loopstat_push(L, "batch", &asc_loopstat.batch, 1.0);
+    loopstat_push(L, "callback", &asc_loopstat.callback, asc_profile_cycles_us());
+
+    if(lua_toboolean(L, 1))
+        asc_loopstat_reset();
+
+    return 1;
+}
+
+typedef struct
+{
+    lua_State *L;
+    bool is_reset;
+} latency_list_t;
+
+static void latency_push(void *arg, const asc_profile_t *profile)
+{
+    const latency_list_t *const p = (const latency_list_t *)arg;
+    lua_State *const L = p->L;
+    if(!profile->latency)
+        return;
+
+    lua_newtable(L);
+    lua_pushstring(L, profile->type);
+    lua_setfield(L, -2, "type");
+    if(profile->name)
+    {
+        lua_pushstring(L, profile->name);
+        lua_setfield(L, -2, "name");
+    }
+    loopstat_push(L, "latency", profile->latency, 1.0);
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+
+    if(p->is_reset)
+        asc_hist_reset(profile->latency);
+}
+
+static int _astra_latency(lua_State *L)
+{
+    latency_list_t p = { L, lua_toboolean(L, 1) };
+    lua_newtable(L);
+    asc_profile_foreach(latency_push, &p);
+    return 1;
+}
+
+typedef struct
+{
+    lua_State *L;
+    uint64_t bytes;
+    uint64_t count;
+} memstat_report_t;
+
+static void memstat_push(  void *arg, const char *type, const char *name
+                         , uint64_t bytes, uint64_t count, bool is_closed)
+{
+    memstat_report_t *const r = (memstat_report_t *)arg;
+    lua_State *const L = r->L;
+    r->bytes += bytes;
+    r->count += count;
+
+    // types table is on the top
+    lua_getfield(L, -1, type);
+    if(lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_setfield(L, -2, "items");
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, type);
+    }
+
+    lua_getfield(L, -1, "bytes");
+    lua_pushnumber(L, lua_tonumber(L, -1) + (lua_Number)bytes);
+    lua_setfield(L, -3, "bytes");
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "count");
+    lua_pushnumber(L, lua_tonumber(L, -1) + (lua_Number)count);
+    lua_setfield(L, -3, "count");
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "items");
+    lua_newtable(L);
+    lua_pushstring(L, name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, (lua_Number)bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)count);
+    lua_setfield(L, -2, "count");
+    lua_pushboolean(L, is_closed);
+    lua_setfield(L, -2, "leaked");
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+    lua_pop(L, 2);
+}
+
+static int _astra_memstat(lua_State *L)
+{
+    memstat_report_t r = { L, 0, 0 };
+
+    lua_newtable(L);
+    lua_pushboolean(L,
+#ifdef WITH_MEMSTAT
+                    1
+#else
+                    0
+#endif
+                    );
+    lua_setfield(L, -2, "enabled");
+
+    lua_newtable(L);
+    asc_memstat_walk(memstat_push, &r);
+    lua_setfield(L, -2, "types");
+
+    lua_pushnumber(L, (lua_Number)r.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)r.count);
+    lua_setfield(L, -2, "count");
+
+    return 1;
+}
+
+static void stream_graph_push(void *arg, module_stream_t *stream)
+{
+    lua_State *const L = (lua_State *)arg;
+    const asc_profile_t *const profile = stream->profile;
+
+    lua_newtable(L);
+    lua_pushnumber(L, stream->id);
+    lua_setfield(L, -2, "id");
+    if(profile)
+    {
+        lua_pushstring(L, profile->type);
+        lua_setfield(L, -2, "type");
+        if(profile->name)
+        {
+            lua_pushstring(L, profile->name);
+            lua_setfield(L, -2, "name");
+        }
+    }
+    if(stream->parent)
+    {
+        lua_pushnumber(L, stream->parent->id);
+        lua_setfield(L, -2, "parent");
+    }
+    lua_pushboolean(L, stream->is_transparent);
+    lua_setfield(L, -2, "transparent");
+    lua_pushboolean(L, stream->is_routed);
+    lua_setfield(L, -2, "routed");
+    lua_pushnumber(L, (lua_Number)stream->stat.packets);
+    lua_setfield(L, -2, "packets");
+
+    lua_newtable(L);
+    if(stream->pid_list)
+    {
+        MPEGTS_PID_MAP_FOREACH(stream->pid_list, pid)
+        {
+            lua_pushnumber(L, pid);
+            lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+        }
+    }
+    lua_setfield(L, -2, "pids");
+
+    lua_newtable(L);
+    for(size_t i = 0; i < stream->child_count; ++i)
+    {
+        lua_pushnumber(L, stream->child_list[i].stream->id);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "children");
+
+    const uint64_t rate = module_stream_graph_rate(stream);
+    lua_newtable(L);
+    lua_pushnumber(L, (lua_Number)stream->edge_packets);
+    lua_setfield(L, -2, "packets");
+    lua_pushnumber(L, (lua_Number)stream->edge_packets * TS_PACKET_SIZE);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)rate);
+    lua_setfield(L, -2, "rate");
+    lua_pushnumber(L, (lua_Number)rate * TS_PACKET_SIZE);
+    lua_setfield(L, -2, "byte_rate");
+    lua_setfield(L, -2, "edge");
+
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+}
+
+static int _astra_stream_graph(lua_State *L)
+{
+    lua_newtable(L);
+    module_stream_graph_foreach(stream_graph_push, L);
+    return 1;
+}
+
+static int _astra_watchdog(lua_State *L)
+{
+    const int threshold = luaL_checkinteger(L, 1);
+    if(threshold < 0)
+        luaL_error(L, "[astra.watchdog] threshold must be positive or 0");
+
+    asc_loopstat_watchdog((unsigned int)threshold);
+    return 0;
+}
+
+static int _astra_fork(lua_State *L)
+{
+    const int count = luaL_checkinteger(L, 1);
+    if(count < 1 || count > REACTOR_MAX)
+        luaL_error(L, "[astra.fork] count must be in range 1..%d", REACTOR_MAX);
+
+#ifdef _WIN32
+    if(count > 1)
+        asc_log_warning("[astra.fork] not supported on this platform");
+#else
+    if(reactor_id != 0)
+    {
+        /* reload in the reactor process */
+        lua_pushnumber(L, reactor_id);
+        return 1;
+    }
+
+    static bool is_atexit = false;
+    if(!is_atexit)
+    {
+        is_atexit = true;
+        atexit(reactor_kill);
+    }
+
+    /* previous instance on reload */
+    reactor_kill();
+
+    fflush(NULL);
+    for(int i = 1; i < count; ++i)
+    {
+        const pid_t pid = fork();
+        if(pid == -1)
+        {
+            asc_log_error("[astra.fork] fork() failed [%s]", strerror(errno));
+            break;
+        }
+
+        if(pid == 0)
+        {
+#ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+            /* epoll/kqueue instance is shared with the master after fork */
+            asc_event_core_destroy();
+            asc_event_core_init();
+            /* descriptors of the previous process belong to the master */
+            asc_handover_core_destroy();
+
+            reactor_id = i;
+            reactor_count = count;
+            reactor_set(L);
+
+            lua_pushnumber(L, reactor_id);
+            return 1;
+        }
+
+        reactor_pid[i] = pid;
+        reactor_count = i + 1;
+    }
+#endif
+
+    reactor_set(L);
+
+    lua_pushnumber(L, reactor_id);
+    return 1;
+}
+
 LUA_API int luaopen_astra(lua_State *L)
 {
     static luaL_Reg astra_api[] =
@@ -63,6 +573,13 @@ LUA_API int luaopen_astra(lua_State *L)
         { "exit", _astra_exit },
         { "abort", _astra_abort },
         { "reload", _astra_reload },
+        { "fork", _astra_fork },
+        { "profile", _astra_profile },
+        { "loopstat", _astra_loopstat },
+        { "latency", _astra_latency },
+        { "memstat", _astra_memstat },
+        { "stream_graph", _astra_stream_graph },
+        { "watchdog", _astra_watchdog },
         { NULL, NULL }
     };
 
@@ -83,5 +600,7 @@ LUA_API int luaopen_astra(lua_State *L)
 
     lua_setglobal(L, "astra");
 
+    reactor_set(L);
+
     return 1;
 }
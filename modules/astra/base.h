@@ -55,6 +55,20 @@ void sha1_init(sha1_ctx_t *context);
 void sha1_update(sha1_ctx_t *context, const uint8_t* data, size_t len);
 void sha1_final(sha1_ctx_t *context, uint8_t digest[SHA1_DIGEST_SIZE]);
 
+/* HMAC-SHA1, the contexts after the padded key */
+typedef struct
+{
+    sha1_ctx_t inner;
+    sha1_ctx_t outer;
+} hmac_sha1_t;
+
+void hmac_sha1_init(hmac_sha1_t *hmac, const uint8_t *key, size_t size);
+void hmac_sha1(const hmac_sha1_t *hmac, const uint8_t *data, size_t size
+               , uint8_t digest[SHA1_DIGEST_SIZE]);
+/* constant time compare of the digest */
+bool hmac_sha1_check(const hmac_sha1_t *hmac, const uint8_t *data, size_t size
+                     , const uint8_t digest[SHA1_DIGEST_SIZE]);
+
 /* base64.c */
 
 char * base64_encode(const void *in, size_t in_size, size_t *out_size);
@@ -77,6 +91,11 @@ void md5_final(md5_ctx_t *context, uint8_t digest[MD5_DIGEST_SIZE]);
 
 void md5_crypt(const char *pw, const char *salt, char passwd[36]);
 
+/* gc.c */
+
+void astra_gc_init(void);
+void astra_gc_step(void);
+
 /* iso8859.c */
 
 char * iso8859_decode(const uint8_t *data, size_t size);
@@ -7,7 +7,7 @@
 
 #include <astra.h>
 
-static uint32_t crc32_table[256] = {
+static const uint32_t crc32_table[256] = {
     0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
     0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
     0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
@@ -53,27 +53,83 @@ static uint32_t crc32_table[256] = {
     0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+/* tables for the slice-by-8, crc32_slice[k] is a byte followed by k zero bytes */
+static uint32_t crc32_slice[8][256];
+static bool is_crc32_init = false;
+
+#ifdef HAVE_CRC32_PCLMUL
+/* crc32b_pclmul.c, processes blocks of 16 bytes */
+uint32_t crc32b_pclmul(uint32_t crc, const uint8_t *buffer, size_t size);
+
+/* the folding is not faster for the short sections */
+#define CRC32_PCLMUL_MIN 64
+
+static bool is_crc32_pclmul = false;
+#endif
+
+static void crc32b_init(void)
+{
+    for(int i = 0; i < 256; ++i)
+    {
+        uint32_t crc = crc32_table[i];
+        crc32_slice[0][i] = crc;
+        for(int k = 1; k < 8; ++k)
+        {
+            crc = (crc << 8) ^ crc32_table[crc >> 24];
+            crc32_slice[k][i] = crc;
+        }
+    }
+
+#ifdef HAVE_CRC32_PCLMUL
+    __builtin_cpu_init();
+    is_crc32_pclmul = (   __builtin_cpu_supports("pclmul")
+                       && __builtin_cpu_supports("ssse3"));
+#endif
+
+    is_crc32_init = true;
+}
+
 uint32_t crc32b(const uint8_t *buffer, int size)
 {
-    register uint32_t crc = 0xffffffff;
+    if(!is_crc32_init)
+        crc32b_init();
+
+    uint32_t crc = 0xffffffff;
+
+#ifdef HAVE_CRC32_PCLMUL
+    if(is_crc32_pclmul && size >= CRC32_PCLMUL_MIN)
+    {
+        const int block_size = size & ~15;
+        crc = crc32b_pclmul(crc, buffer, block_size);
+        buffer += block_size;
+        size -= block_size;
+    }
+#endif
 
-    int n = (size + 7) / 8;
-    const int m = size % 8;
+    while(size >= 8)
+    {
+        const uint32_t a = crc ^ BUFFER_TO_U32(buffer);
+        const uint32_t b = BUFFER_TO_U32(&buffer[4]);
+
+        crc = crc32_slice[7][(a >> 24)       ]
+            ^ crc32_slice[6][(a >> 16) & 0xFF]
+            ^ crc32_slice[5][(a >> 8 ) & 0xFF]
+            ^ crc32_slice[4][(a      ) & 0xFF]
+            ^ crc32_slice[3][(b >> 24)       ]
+            ^ crc32_slice[2][(b >> 16) & 0xFF]
+            ^ crc32_slice[1][(b >> 8 ) & 0xFF]
+            ^ crc32_slice[0][(b      ) & 0xFF];
+
+        buffer += 8;
+        size -= 8;
+    }
 
-#define STEP { crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ (*buffer)) & 0xFF]; ++buffer; }
-    switch(m)
+    while(size > 0)
     {
-        case 0: do { STEP;
-        case 7:      STEP;
-        case 6:      STEP;
-        case 5:      STEP;
-        case 4:      STEP;
-        case 3:      STEP;
-        case 2:      STEP;
-        case 1:      STEP;
-                   } while (--n > 0);
+        crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ (*buffer)) & 0xFF];
+        ++buffer;
+        --size;
     }
-#undef STEP
 
     return crc;
 }
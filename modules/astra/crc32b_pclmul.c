@@ -0,0 +1,100 @@
+/*
+ * CRC-32b with the carry-less multiplication
+ *
+ * Based on "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" by V. Gopal, E. Ozturk et al. Intel, 2009
+ */
+
+/* built for the CPU with PCLMULQDQ, selected at runtime, see crc32b.c */
+
+#pragma GCC target("pclmul,ssse3")
+
+#include <astra.h>
+#include <immintrin.h>
+
+/* x^n mod P(x), P(x) = 0x104C11DB7 */
+#define K_576 0x8833794C
+#define K_512 0xE6228B11
+#define K_192 0xC5B9CD4C
+#define K_128 0xE8A45605
+#define K_96  0xF200AA66
+#define K_64  0x490D678D
+
+/* x^64 div P(x) */
+#define MU    0x104D101DF
+#define POLY  0x104C11DB7
+
+/* the first byte of the message is the highest degree */
+static inline __m128i load_block(const uint8_t *buffer, __m128i mask)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buffer), mask);
+}
+
+/* x * x^n + block, the upper and the lower halves are multiplied by the k */
+static inline __m128i fold(__m128i x, __m128i k, __m128i block)
+{
+    const __m128i h = _mm_clmulepi64_si128(x, k, 0x11);
+    const __m128i l = _mm_clmulepi64_si128(x, k, 0x00);
+    return _mm_xor_si128(_mm_xor_si128(h, l), block);
+}
+
+uint32_t crc32b_pclmul(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    const __m128i mask = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i k_128 = _mm_set_epi64x(K_192, K_128);
+
+    // register value is the part of the message
+    __m128i x = _mm_xor_si128(  load_block(buffer, mask)
+                              , _mm_slli_si128(_mm_cvtsi32_si128((int)crc), 12));
+    buffer += 16;
+    size -= 16;
+
+    if(size >= 64)
+    {
+        const __m128i k_512 = _mm_set_epi64x(K_576, K_512);
+
+        __m128i x1 = load_block(&buffer[0], mask);
+        __m128i x2 = load_block(&buffer[16], mask);
+        __m128i x3 = load_block(&buffer[32], mask);
+        buffer += 48;
+        size -= 48;
+
+        while(size >= 64)
+        {
+            x = fold(x, k_512, load_block(&buffer[0], mask));
+            x1 = fold(x1, k_512, load_block(&buffer[16], mask));
+            x2 = fold(x2, k_512, load_block(&buffer[32], mask));
+            x3 = fold(x3, k_512, load_block(&buffer[48], mask));
+            buffer += 64;
+            size -= 64;
+        }
+
+        x = fold(x, k_128, x1);
+        x = fold(x, k_128, x2);
+        x = fold(x, k_128, x3);
+    }
+
+    while(size >= 16)
+    {
+        x = fold(x, k_128, load_block(buffer, mask));
+        buffer += 16;
+        size -= 16;
+    }
+
+    // x * x^32 mod P(x): 128 -> 96 -> 64 bits and the Barrett reduction
+    const __m128i k_96 = _mm_set_epi64x(0, K_96);
+    const __m128i k_64 = _mm_set_epi64x(0, K_64);
+    const __m128i mu = _mm_set_epi64x(0, MU);
+    const __m128i poly = _mm_set_epi64x(0, POLY);
+
+    __m128i t = _mm_xor_si128(  _mm_clmulepi64_si128(x, k_96, 0x01)
+                              , _mm_slli_si128(_mm_move_epi64(x), 4));
+    t = _mm_xor_si128(  _mm_clmulepi64_si128(_mm_srli_si128(t, 8), k_64, 0x00)
+                      , _mm_move_epi64(t));
+
+    __m128i q = _mm_clmulepi64_si128(_mm_srli_epi64(t, 32), mu, 0x00);
+    q = _mm_srli_epi64(q, 32);
+    t = _mm_xor_si128(t, _mm_clmulepi64_si128(q, poly, 0x00));
+
+    return (uint32_t)_mm_cvtsi128_si32(t);
+}
@@ -0,0 +1,202 @@
+/*
+ * Astra Module: GC
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lua garbage collector scheduling. The main loop calls astra_gc_step() on
+ * each idle iteration, the collector makes small steps until the time budget
+ * is spent, so the collection is spread over the iterations.
+ *
+ * Methods:
+ *      gc.set({ options })
+ *                  - set collector options:
+ *                    mode      - string, "incremental" (default), "generational"
+ *                                or "full" - complete collection once per second
+ *                    step      - number, step size in kilobytes. default: 16
+ *                    budget    - number, time limit of the steps per iteration
+ *                                in microseconds. default: 500
+ *                    pause     - number, collector pause in percents
+ *                    stepmul   - number, collector speed in percents
+ *      gc.stat()
+ *                  - return table:
+ *                    mode      - string, current mode
+ *                    memory    - number, memory in use by Lua in kilobytes
+ *                    steps     - number, steps made by the main loop
+ *                    cycles    - number, completed collection cycles
+ *                    time      - number, total time of the steps in microseconds
+ *                    time_max  - number, longest iteration in microseconds
+ */
+
+#include <astra.h>
+
+#define GC_FULL_INTERVAL (1 * 1000 * 1000)
+
+typedef enum
+{
+    GC_MODE_INCREMENTAL = 0,
+    GC_MODE_GENERATIONAL,
+    GC_MODE_FULL,
+} gc_mode_t;
+
+static const char *gc_mode_name[] = { "incremental", "generational", "full" };
+
+static struct
+{
+    gc_mode_t mode;
+    int step; // KB
+    uint32_t budget; // us
+
+    uint64_t last_full;
+
+    uint64_t steps;
+    uint64_t cycles;
+    uint64_t time;
+    uint64_t time_max;
+} gc;
+
+static void gc_set_mode(gc_mode_t mode)
+{
+    gc.mode = mode;
+    lua_gc(lua, (mode == GC_MODE_GENERATIONAL) ? LUA_GCGEN : LUA_GCINC, 0);
+}
+
+void astra_gc_init(void)
+{
+    memset(&gc, 0, sizeof(gc));
+    gc.step = 16;
+    gc.budget = 500;
+    gc.last_full = asc_utime();
+    gc_set_mode(GC_MODE_INCREMENTAL);
+}
+
+void astra_gc_step(void)
+{
+    const uint64_t start = asc_utime();
+    uint64_t now = start;
+
+    if(gc.mode == GC_MODE_FULL)
+    {
+        if(now - gc.last_full < GC_FULL_INTERVAL)
+            return;
+        gc.last_full = now;
+
+        lua_gc(lua, LUA_GCCOLLECT, 0);
+        ++gc.steps;
+        ++gc.cycles;
+    }
+    else
+    {
+        do
+        {
+            ++gc.steps;
+            const bool is_cycle_done = lua_gc(lua, LUA_GCSTEP, gc.step);
+            now = asc_utime();
+            if(is_cycle_done)
+            {
+                ++gc.cycles;
+                break;
+            }
+        } while(now - start < gc.budget);
+    }
+
+    now = asc_utime();
+    const uint64_t elapsed = now - start;
+    gc.time += elapsed;
+    if(elapsed > gc.time_max)
+        gc.time_max = elapsed;
+}
+
+static int lua_gc_set(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    for(lua_pushnil(L); lua_next(L, 1); lua_pop(L, 1))
+    {
+        const char *var = lua_tostring(L, -2);
+
+        if(!strcmp(var, "mode"))
+        {
+            const char *val = luaL_checkstring(L, -1);
+            size_t i = 0;
+            for(; i < ASC_ARRAY_SIZE(gc_mode_name); ++i)
+            {
+                if(!strcmp(val, gc_mode_name[i]))
+                    break;
+            }
+            if(i == ASC_ARRAY_SIZE(gc_mode_name))
+                luaL_error(L, "[gc.set] unknown mode '%s'", val);
+            gc_set_mode((gc_mode_t)i);
+        }
+        else if(!strcmp(var, "step"))
+        {
+            const int val = luaL_checkinteger(L, -1);
+            gc.step = (val > 0) ? val : 1;
+        }
+        else if(!strcmp(var, "budget"))
+        {
+            const int val = luaL_checkinteger(L, -1);
+            gc.budget = (val > 0) ? (uint32_t)val : 0;
+        }
+        else if(!strcmp(var, "pause"))
+        {
+            lua_gc(L, LUA_GCSETPAUSE, luaL_checkinteger(L, -1));
+        }
+        else if(!strcmp(var, "stepmul"))
+        {
+            lua_gc(L, LUA_GCSETSTEPMUL, luaL_checkinteger(L, -1));
+        }
+    }
+
+    return 0;
+}
+
+static int lua_gc_stat(lua_State *L)
+{
+    lua_newtable(L);
+
+    lua_pushstring(L, gc_mode_name[gc.mode]);
+    lua_setfield(L, -2, "mode");
+    lua_pushnumber(L, lua_gc(L, LUA_GCCOUNT, 0));
+    lua_setfield(L, -2, "memory");
+    lua_pushnumber(L, (lua_Number)gc.steps);
+    lua_setfield(L, -2, "steps");
+    lua_pushnumber(L, (lua_Number)gc.cycles);
+    lua_setfield(L, -2, "cycles");
+    lua_pushnumber(L, (lua_Number)gc.time);
+    lua_setfield(L, -2, "time");
+    lua_pushnumber(L, (lua_Number)gc.time_max);
+    lua_setfield(L, -2, "time_max");
+
+    return 1;
+}
+
+LUA_API int luaopen_gc(lua_State *L)
+{
+    static const luaL_Reg api[] =
+    {
+        { "set", lua_gc_set },
+        { "stat", lua_gc_stat },
+        { NULL, NULL }
+    };
+
+    luaL_newlib(L, api);
+    lua_setglobal(L, "gc");
+
+    return 0;
+}
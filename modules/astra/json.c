@@ -18,8 +18,77 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Methods:
+ *      json.encode(table)
+ *                  - return string
+ *      json.decode(string)
+ *                  - return table or nil if the string is not valid
+ *      json.stream(string, callback)
+ *                  - parse without building the tables, callback(event, value)
+ *                    is called for each item. event is "object", "array",
+ *                    "end", "key" or "value". parsing is stopped if the
+ *                    callback returns false. returns true if the document
+ *                    is complete
+ *      json.load(filename [, callback])
+ *                  - decode the file, with callback works as json.stream()
+ *      json.save(filename, table)
+ *                  - encode table to the file, return boolean
+ */
+
 #include <astra.h>
 
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+#define JSON_DEPTH_MAX 256
+#define JSON_BUFFER_SIZE (64 * 1024)
+#define JSON_BUFFER_KEEP (1024 * 1024) // larger buffer is released after the call
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} json_buffer_t;
+
+static inline void buffer_reserve(json_buffer_t *buffer, size_t size)
+{
+    if(buffer->size + size <= buffer->capacity)
+        return;
+
+    size_t capacity = (buffer->capacity) ? buffer->capacity : JSON_BUFFER_SIZE;
+    while(capacity < buffer->size + size)
+        capacity *= 2;
+
+    buffer->data = (char *)realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+static inline void buffer_addchar(json_buffer_t *buffer, char c)
+{
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->size++] = c;
+}
+
+static inline void buffer_addlstring(json_buffer_t *buffer, const char *str, size_t size)
+{
+    buffer_reserve(buffer, size);
+    memcpy(&buffer->data[buffer->size], str, size);
+    buffer->size += size;
+}
+
+static void buffer_release(json_buffer_t *buffer)
+{
+    buffer->size = 0;
+    if(buffer->capacity > JSON_BUFFER_KEEP)
+    {
+        ASC_FREE(buffer->data, free);
+        buffer->capacity = 0;
+    }
+}
+
 /*
  * ooooooooooo oooo   oooo  oooooooo8   ooooooo  ooooooooo  ooooooooooo
  *  888    88   8888o  88 o888     88 o888   888o 888    88o 888    88
@@ -29,119 +98,233 @@
  *
  */
 
-static void walk_table(lua_State *L, string_buffer_t *buffer);
+/* encoder output, kept between the calls */
+static json_buffer_t encode_buffer;
+
+static void walk_table(lua_State *L, json_buffer_t *buffer, int depth);
 
-static void set_string(string_buffer_t *buffer, const char *str)
+/* returns length of the prefix without characters to escape */
+static inline size_t escape_scan(const uint8_t *str, size_t size)
 {
-    char c;
-    string_buffer_addchar(buffer, '"');
-    for(int i = 0; (c = str[i]) != '\0'; ++i)
+    size_t skip = 0;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    for(; skip + 16 <= size; skip += 16)
     {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&str[skip]);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v)); // v <= 0x1F
+        const int mask = _mm_movemask_epi8(m);
+        if(mask)
+            return skip + __builtin_ctz(mask);
+    }
+#endif
+
+    for(; skip < size; ++skip)
+    {
+        const uint8_t c = str[skip];
+        if(c < 0x20 || c == '"' || c == '\\')
+            break;
+    }
+
+    return skip;
+}
+
+static void set_string(json_buffer_t *buffer, const char *str, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    buffer_reserve(buffer, size + 2);
+    buffer_addchar(buffer, '"');
+
+    while(size > 0)
+    {
+        const size_t skip = escape_scan((const uint8_t *)str, size);
+        buffer_addlstring(buffer, str, skip);
+        str += skip;
+        size -= skip;
+        if(!size)
+            break;
+
+        const uint8_t c = (uint8_t)*str;
+        ++str;
+        --size;
+
         switch(c)
         {
             case '\\':
-                string_buffer_addlstring(buffer, "\\\\", 2);
+                buffer_addlstring(buffer, "\\\\", 2);
                 break;
             case '"':
-                string_buffer_addlstring(buffer, "\\\"", 2);
+                buffer_addlstring(buffer, "\\\"", 2);
                 break;
             case '\t':
-                string_buffer_addlstring(buffer, "\\t", 2);
+                buffer_addlstring(buffer, "\\t", 2);
                 break;
             case '\r':
-                string_buffer_addlstring(buffer, "\\r", 2);
+                buffer_addlstring(buffer, "\\r", 2);
                 break;
             case '\n':
-                string_buffer_addlstring(buffer, "\\n", 2);
+                buffer_addlstring(buffer, "\\n", 2);
+                break;
+            case '\b':
+                buffer_addlstring(buffer, "\\b", 2);
+                break;
+            case '\f':
+                buffer_addlstring(buffer, "\\f", 2);
                 break;
             default:
-                string_buffer_addchar(buffer, c);
+            {
+                const char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+                buffer_addlstring(buffer, u, sizeof(u));
                 break;
+            }
         }
     }
-    string_buffer_addchar(buffer, '"');
+
+    buffer_addchar(buffer, '"');
 }
 
-static void set_value(lua_State *L, string_buffer_t *buffer)
+static void set_number(json_buffer_t *buffer, lua_Number number)
+{
+    char str[32];
+
+    /* integers without snprintf */
+    if(number >= -9007199254740992.0 && number <= 9007199254740992.0)
+    {
+        const int64_t value = (int64_t)number;
+        if((lua_Number)value == number)
+        {
+            uint64_t u = (value < 0) ? (uint64_t)(-value) : (uint64_t)value;
+            char *ptr = &str[sizeof(str)];
+            do
+            {
+                *(--ptr) = '0' + (u % 10);
+                u /= 10;
+            } while(u);
+            if(value < 0)
+                *(--ptr) = '-';
+            buffer_addlstring(buffer, ptr, &str[sizeof(str)] - ptr);
+            return;
+        }
+    }
+
+    if(number != number || number - number != 0)
+    {
+        // NaN and infinity are not allowed in JSON
+        buffer_addlstring(buffer, "null", 4);
+        return;
+    }
+
+    const int size = snprintf(str, sizeof(str), "%.14g", number);
+    buffer_addlstring(buffer, str, size);
+}
+
+static void set_value(lua_State *L, json_buffer_t *buffer, int depth)
 {
     switch(lua_type(L, -1))
     {
         case LUA_TTABLE:
         {
-            walk_table(L, buffer);
+            walk_table(L, buffer, depth + 1);
             break;
         }
         case LUA_TBOOLEAN:
         {
             if(lua_toboolean(L, -1) == true)
-                string_buffer_addlstring(buffer, "true", 4);
+                buffer_addlstring(buffer, "true", 4);
             else
-                string_buffer_addlstring(buffer, "false", 5);
+                buffer_addlstring(buffer, "false", 5);
             break;
         }
         case LUA_TNUMBER:
         {
-            char number[32];
-            const int size = snprintf(number, sizeof(number), "%.14g", lua_tonumber(L, -1));
-            string_buffer_addlstring(buffer, number, size);
+            set_number(buffer, lua_tonumber(L, -1));
             break;
         }
         case LUA_TSTRING:
         {
-            set_string(buffer, lua_tostring(L, -1));
+            size_t size = 0;
+            const char *str = lua_tolstring(L, -1, &size);
+            set_string(buffer, str, size);
             break;
         }
         default:
+        {
+            buffer_addlstring(buffer, "null", 4);
             break;
+        }
     }
 }
 
-static void walk_table(lua_State *L, string_buffer_t *buffer)
+static void walk_table(lua_State *L, json_buffer_t *buffer, int depth)
 {
     luaL_checktype(L, -1, LUA_TTABLE);
+    if(depth > JSON_DEPTH_MAX)
+        luaL_error(L, "[json] table nesting is too deep");
+    luaL_checkstack(L, 3, "[json] table nesting is too deep");
 
-    int pairs_count = 0;
+    size_t pairs_count = 0;
     for(lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1))
         ++pairs_count;
 
-    const bool is_array = (luaL_len(L, -1) == pairs_count);
-    bool is_first = true;
-
+    const size_t array_size = lua_rawlen(L, -1);
 
-
-    if(is_array)
+    if(array_size == pairs_count)
     {
-        string_buffer_addchar(buffer, '[');
+        buffer_addchar(buffer, '[');
 
-        for(lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1))
+        for(size_t i = 1; i <= array_size; ++i)
         {
-            if(!is_first)
-                string_buffer_addchar(buffer, ',');
-            else
-                is_first = false;
+            if(i > 1)
+                buffer_addchar(buffer, ',');
 
-            set_value(L, buffer);
+            lua_rawgeti(L, -1, i);
+            set_value(L, buffer, depth);
+            lua_pop(L, 1);
         }
 
-        string_buffer_addchar(buffer, ']');
+        buffer_addchar(buffer, ']');
     }
     else
     {
-        string_buffer_addchar(buffer, '{');
+        buffer_addchar(buffer, '{');
 
+        bool is_first = true;
         for(lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1))
         {
+            /* lua_tostring() on the number key breaks lua_next() */
+            const int key_type = lua_type(L, -2);
+            if(key_type != LUA_TSTRING && key_type != LUA_TNUMBER)
+                continue;
+
             if(!is_first)
-                string_buffer_addchar(buffer, ',');
+                buffer_addchar(buffer, ',');
             else
                 is_first = false;
 
-            set_string(buffer, lua_tostring(L, -2));
-            string_buffer_addchar(buffer, ':');
-            set_value(L, buffer);
+            if(key_type == LUA_TSTRING)
+            {
+                size_t size = 0;
+                const char *key = lua_tolstring(L, -2, &size);
+                set_string(buffer, key, size);
+            }
+            else
+            {
+                buffer_addchar(buffer, '"');
+                set_number(buffer, lua_tonumber(L, -2));
+                buffer_addchar(buffer, '"');
+            }
+
+            buffer_addchar(buffer, ':');
+            set_value(L, buffer, depth);
         }
 
-        string_buffer_addchar(buffer, '}');
+        buffer_addchar(buffer, '}');
     }
 }
 
@@ -149,11 +332,11 @@ static int json_encode(lua_State *L)
 {
     luaL_checktype(L, -1, LUA_TTABLE);
 
-    string_buffer_t *buffer = string_buffer_alloc();
+    encode_buffer.size = 0;
+    walk_table(L, &encode_buffer, 1);
 
-    walk_table(L, buffer);
-
-    string_buffer_push(L, buffer);
+    lua_pushlstring(L, encode_buffer.data, encode_buffer.size);
+    buffer_release(&encode_buffer);
     return 1;
 }
 
@@ -164,355 +347,716 @@ static int json_encode(lua_State *L)
  *  888    888 888    oo 888o     oo 888o   o888 888    888 888    oo
  * o888ooo88  o888ooo8888 888oooo88    88ooo88  o888ooo88  o888ooo8888
  *
+ * Parser calls the handler for each item, the handler builds the tables or
+ * passes items to the Lua callback. Handler returns false to stop parsing.
+ * Input string should be null-terminated.
  */
 
-static int skip_sp(const char *str, int pos)
+typedef struct
+{
+    bool (*on_begin)(void *arg, bool is_array);
+    bool (*on_end)(void *arg, bool is_array);
+    bool (*on_key)(void *arg, const char *str, size_t size);
+    bool (*on_string)(void *arg, const char *str, size_t size);
+    bool (*on_number)(void *arg, lua_Number number);
+    bool (*on_boolean)(void *arg, bool value);
+    bool (*on_null)(void *arg);
+} json_handler_t;
+
+typedef struct
+{
+    const char *ptr;
+    const char *end;
+    int depth;
+
+    const json_handler_t *handler;
+    void *arg;
+
+    json_buffer_t scratch; // unescaped strings
+} json_parser_t;
+
+static bool parse_value(json_parser_t *parser);
+
+static bool skip_sp(json_parser_t *parser)
 {
-    do
+    const char *ptr = parser->ptr;
+
+    while(ptr < parser->end)
     {
-        switch(str[pos])
+        switch(*ptr)
         {
             case ' ':
             case '\t':
             case '\r':
             case '\n':
-                ++pos;
+                ++ptr;
                 continue;
-            case '\0':
+            case '/':
+            {
+                if(ptr + 1 >= parser->end || ptr[1] != '*')
+                    break;
+
+                const char *comment = &ptr[2];
+                for(; comment + 1 < parser->end; ++comment)
+                {
+                    if(comment[0] == '*' && comment[1] == '/')
+                        break;
+                }
+                if(comment + 1 >= parser->end)
+                    return false;
+
+                ptr = &comment[2];
+                continue;
+            }
             default:
-                return pos;
+                break;
         }
-    } while(true);
+        break;
+    }
+
+    parser->ptr = ptr;
+    return true;
 }
 
-static int skip_comment(const char *str, int pos)
+/* returns length of the prefix without the quote and the backslash */
+static inline size_t string_scan(const uint8_t *str, size_t size)
 {
-    char c;
-    for(; (c = str[pos]) != '\0'; ++pos)
+    size_t skip = 0;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    for(; skip + 16 <= size; skip += 16)
     {
-        if(c == '*' && str[pos + 1] == '/')
-            return pos + 2;
+        const __m128i v = _mm_loadu_si128((const __m128i *)&str[skip]);
+        const __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        const int mask = _mm_movemask_epi8(m);
+        if(mask)
+            return skip + __builtin_ctz(mask);
     }
+#endif
 
-    return -1;
+    for(; skip < size; ++skip)
+    {
+        if(str[skip] == '"' || str[skip] == '\\')
+            break;
+    }
+
+    return skip;
 }
 
-static int scan_string(lua_State *L, const char *str, int pos)
+static bool parse_hex4(const char *ptr, uint32_t *value)
 {
-    char c;
-    luaL_Buffer b;
-    luaL_buffinit(L, &b);
+    uint32_t result = 0;
+    for(int i = 0; i < 4; ++i)
+    {
+        const char c = ptr[i];
+        result <<= 4;
+        if(c >= '0' && c <= '9')
+            result |= c - '0';
+        else if(c >= 'a' && c <= 'f')
+            result |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')
+            result |= c - 'A' + 10;
+        else
+            return false;
+    }
+    *value = result;
+    return true;
+}
+
+static void put_utf8(json_buffer_t *buffer, uint32_t code)
+{
+    char utf8[4];
+    size_t size;
 
-    for(; (c = str[pos]) != '\0'; ++pos)
+    if(code < 0x80)
+    {
+        utf8[0] = (char)code;
+        size = 1;
+    }
+    else if(code < 0x800)
+    {
+        utf8[0] = (char)(0xC0 | (code >> 6));
+        utf8[1] = (char)(0x80 | (code & 0x3F));
+        size = 2;
+    }
+    else if(code < 0x10000)
+    {
+        utf8[0] = (char)(0xE0 | (code >> 12));
+        utf8[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (code & 0x3F));
+        size = 3;
+    }
+    else
     {
-        if(c == '"')
+        utf8[0] = (char)(0xF0 | (code >> 18));
+        utf8[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (code & 0x3F));
+        size = 4;
+    }
+
+    buffer_addlstring(buffer, utf8, size);
+}
+
+/* parser->ptr points after the opening quote */
+static bool parse_string(json_parser_t *parser, const char **str, size_t *size)
+{
+    const char *ptr = parser->ptr;
+    const char *end = parser->end;
+
+    size_t skip = string_scan((const uint8_t *)ptr, end - ptr);
+    if(ptr + skip >= end)
+        return false;
+
+    /* string without escapes is passed as is */
+    if(ptr[skip] == '"')
+    {
+        *str = ptr;
+        *size = skip;
+        parser->ptr = &ptr[skip + 1];
+        return true;
+    }
+
+    json_buffer_t *buffer = &parser->scratch;
+    buffer->size = 0;
+
+    while(true)
+    {
+        buffer_addlstring(buffer, ptr, skip);
+        ptr += skip;
+
+        if(ptr >= end)
+            return false;
+        if(*ptr == '"')
             break;
 
-        else if(c == '\\')
+        // backslash
+        ++ptr;
+        if(ptr >= end)
+            return false;
+
+        switch(*ptr)
         {
-            ++pos;
-            switch(str[pos])
+            case '/':
+                buffer_addchar(buffer, '/');
+                break;
+            case '\\':
+                buffer_addchar(buffer, '\\');
+                break;
+            case '"':
+                buffer_addchar(buffer, '"');
+                break;
+            case 't':
+                buffer_addchar(buffer, '\t');
+                break;
+            case 'r':
+                buffer_addchar(buffer, '\r');
+                break;
+            case 'n':
+                buffer_addchar(buffer, '\n');
+                break;
+            case 'b':
+                buffer_addchar(buffer, '\b');
+                break;
+            case 'f':
+                buffer_addchar(buffer, '\f');
+                break;
+            case 'u':
             {
-                case '/':
-                    luaL_addchar(&b, '/');
-                    break;
-                case '\\':
-                    luaL_addchar(&b, '\\');
-                    break;
-                case '"':
-                    luaL_addchar(&b, '"');
-                    break;
-                case 't':
-                    luaL_addchar(&b, '\t');
-                    break;
-                case 'r':
-                    luaL_addchar(&b, '\r');
-                    break;
-                case 'n':
-                    luaL_addchar(&b, '\n');
-                    break;
-                default:
-                    return -1;
+                uint32_t code;
+                if(end - ptr < 5 || !parse_hex4(&ptr[1], &code))
+                    return false;
+                ptr += 4;
+
+                // surrogate pair
+                uint32_t low;
+                if(   code >= 0xD800 && code <= 0xDBFF
+                   && end - ptr >= 7 && ptr[1] == '\\' && ptr[2] == 'u'
+                   && parse_hex4(&ptr[3], &low) && low >= 0xDC00 && low <= 0xDFFF)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    ptr += 6;
+                }
+
+                put_utf8(buffer, code);
+                break;
             }
+            default:
+                return false;
         }
 
-        else
-            luaL_addchar(&b, c);
+        ++ptr;
+        skip = string_scan((const uint8_t *)ptr, end - ptr);
     }
 
-    luaL_pushresult(&b);
-    return pos + 1;
+    *str = buffer->data;
+    *size = buffer->size;
+    parser->ptr = ptr + 1;
+    return true;
 }
 
-static int scan_number(lua_State *L, const char *str, int pos)
+static bool parse_number(json_parser_t *parser)
 {
-    char c;
-    double number = 0;
+    static const lua_Number pow10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    };
+
+    const char *ptr = parser->ptr;
+    const char *end = parser->end;
 
-    bool is_nn = false;
-    if(str[pos] == '-')
+    bool is_negative = false;
+    if(ptr < end && *ptr == '-')
     {
-        is_nn = true;
-        ++pos;
+        is_negative = true;
+        ++ptr;
     }
 
-    for(; (c = str[pos]) != '\0'; ++pos)
+    /*
+     * mantissa up to 15 digits is exact in double, so the integer or
+     * the integer divided by the power of 10 is rounded correctly
+     */
+    uint64_t value = 0;
+    int digits = 0;
+    for(; ptr < end && *ptr >= '0' && *ptr <= '9' && digits < 16; ++ptr, ++digits)
+        value = value * 10 + (*ptr - '0');
+
+    int fraction = 0;
+    if(digits > 0 && ptr < end && *ptr == '.')
     {
-        if(c >= '0' && c <= '9')
-        {
-            if(number > 0)
-                number *= 10;
-            number += c - '0';
-        }
-        else
-            break;
+        ++ptr;
+        for(; ptr < end && *ptr >= '0' && *ptr <= '9' && digits < 16; ++ptr, ++digits, ++fraction)
+            value = value * 10 + (*ptr - '0');
     }
 
-    if(c == '.')
+    lua_Number number;
+    if(   digits > 0 && digits < 16 && !(fraction == 0 && ptr[-1] == '.')
+       && (ptr >= end || (*ptr != 'e' && *ptr != 'E' && *ptr != '.' && !(*ptr >= '0' && *ptr <= '9'))))
     {
-        // TODO: fix that
-        ++pos;
-        for(; (c = str[pos]) != '\0'; ++pos)
-        {
-            if(c >= '0' && c <= '9')
-                ;
-            else
-                break;
-        }
+        number = (lua_Number)value;
+        if(fraction)
+            number /= pow10[fraction];
+        if(is_negative)
+            number = -number;
+    }
+    else
+    {
+        char *number_end = NULL;
+        number = strtod(parser->ptr, &number_end);
+        if(!number_end || number_end == parser->ptr || number_end > end)
+            return false;
+        ptr = number_end;
     }
 
-    if(is_nn)
-        number = 0 - number;
-
-    lua_pushnumber(L, number);
-
-    return pos;
+    parser->ptr = ptr;
+    return parser->handler->on_number(parser->arg, number);
 }
 
-static int scan_json(lua_State *L, const char *str, int pos);
+static bool parse_literal(json_parser_t *parser, const char *literal, size_t size)
+{
+    if((size_t)(parser->end - parser->ptr) < size || memcmp(parser->ptr, literal, size))
+        return false;
+    parser->ptr += size;
+    return true;
+}
 
-static int scan_object(lua_State *L, const char *str, int pos)
+static bool parse_container(json_parser_t *parser, bool is_array)
 {
-    do
+    const json_handler_t *handler = parser->handler;
+    const char close = (is_array) ? ']' : '}';
+
+    if(++parser->depth > JSON_DEPTH_MAX)
+        return false;
+
+    ++parser->ptr;
+    if(!handler->on_begin(parser->arg, is_array))
+        return false;
+
+    while(true)
     {
-        pos = skip_sp(str, pos);
-        char c = str[pos];
+        if(!skip_sp(parser) || parser->ptr >= parser->end)
+            return false;
 
-        if(c == '"')
-        {
-            ;
-        }
-        else if(c == ',')
+        const char c = *parser->ptr;
+        if(c == ',')
         {
-            ++pos;
+            ++parser->ptr;
             continue;
         }
-        else if(c == '}')
+        else if(c == close)
         {
-            ++pos;
-            return pos;
+            ++parser->ptr;
+            --parser->depth;
+            return handler->on_end(parser->arg, is_array);
         }
-        else
-        {
-            if(c == '/')
-            {
-                if(str[pos + 1] == '*')
-                {
-                    pos = skip_comment(str, pos + 2);
-                    continue;
-                }
-            }
 
-            return -1;
+        if(!is_array)
+        {
+            if(c != '"')
+                return false;
+
+            ++parser->ptr;
+            const char *key;
+            size_t key_size;
+            if(!parse_string(parser, &key, &key_size))
+                return false;
+            if(!handler->on_key(parser->arg, key, key_size))
+                return false;
+
+            if(!skip_sp(parser) || parser->ptr >= parser->end || *parser->ptr != ':')
+                return false;
+            ++parser->ptr;
         }
 
-        // key
-        pos = scan_string(L, str, pos + 1);
-        if(pos == -1)
-            return -1;
+        if(!parse_value(parser))
+            return false;
+    }
+}
 
-        pos = skip_sp(str, pos);
-        if(str[pos] != ':')
-        {
-            lua_pop(L, 1);
-            return -1;
-        }
+static bool parse_value(json_parser_t *parser)
+{
+    if(!skip_sp(parser) || parser->ptr >= parser->end)
+        return false;
 
-        // value
-        pos = skip_sp(str, pos + 1);
-        pos = scan_json(L, str, pos);
-        if(pos == -1)
+    const json_handler_t *handler = parser->handler;
+
+    switch(*parser->ptr)
+    {
+        case '{':
+            return parse_container(parser, false);
+        case '[':
+            return parse_container(parser, true);
+        case '"':
         {
-            lua_pop(L, 1);
-            return -1;
+            ++parser->ptr;
+            const char *str;
+            size_t size;
+            if(!parse_string(parser, &str, &size))
+                return false;
+            return handler->on_string(parser->arg, str, size);
         }
+        case 't':
+            return parse_literal(parser, "true", 4)
+                && handler->on_boolean(parser->arg, true);
+        case 'f':
+            return parse_literal(parser, "false", 5)
+                && handler->on_boolean(parser->arg, false);
+        case 'n':
+            return parse_literal(parser, "null", 4)
+                && handler->on_null(parser->arg);
+        default:
+            return parse_number(parser);
+    }
+}
+
+static bool json_parse(  const char *str, size_t size
+                       , const json_handler_t *handler, void *arg)
+{
+    json_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.ptr = str;
+    parser.end = str + size;
+    parser.handler = handler;
+    parser.arg = arg;
 
-        lua_settable(L, -3);
-    } while(true);
+    const bool result = parse_value(&parser);
+
+    free(parser.scratch.data);
+    return result;
 }
 
-static int scan_array(lua_State *L, const char *str, int pos)
+/* tables */
+
+typedef struct
 {
-    int key = 1;
-    do
-    {
-        pos = skip_sp(str, pos);
-        char c = str[pos];
+    lua_State *L;
+    int depth;
+    bool is_array[JSON_DEPTH_MAX + 1];
+    int index[JSON_DEPTH_MAX + 1];
+} json_tree_t;
 
-        if(c == ',')
-        {
-            ++pos;
-            continue;
-        }
-        else if(c == ']')
-        {
-            ++pos;
-            return pos;
-        }
-        else
-        {
-            if(c == '/')
-            {
-                if(str[pos + 1] == '*')
-                {
-                    pos = skip_comment(str, pos + 2);
-                    continue;
-                }
-            }
-        }
+static bool tree_store(json_tree_t *tree)
+{
+    lua_State *L = tree->L;
 
-        lua_pushnumber(L, key);
+    if(tree->depth == 0)
+        return true; // root value stays on the stack
 
-        pos = scan_json(L, str, pos);
-        if(pos == -1)
-        {
-            lua_pop(L, 1);
-            return -1;
-        }
+    if(tree->is_array[tree->depth])
+        lua_rawseti(L, -2, ++tree->index[tree->depth]);
+    else
+        lua_rawset(L, -3);
+
+    return true;
+}
+
+static bool tree_on_begin(void *arg, bool is_array)
+{
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_newtable(tree->L);
+    ++tree->depth;
+    tree->is_array[tree->depth] = is_array;
+    tree->index[tree->depth] = 0;
+    return true;
+}
+
+static bool tree_on_end(void *arg, bool is_array)
+{
+    __uarg(is_array);
+    json_tree_t *tree = (json_tree_t *)arg;
+    --tree->depth;
+    return tree_store(tree);
+}
+
+static bool tree_on_string(void *arg, const char *str, size_t size)
+{
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_pushlstring(tree->L, str, size);
+    return tree_store(tree);
+}
+
+static bool tree_on_key(void *arg, const char *str, size_t size)
+{
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_pushlstring(tree->L, str, size);
+    return true;
+}
 
-        lua_settable(L, -3);
-        ++key;
-    } while(true);
+static bool tree_on_number(void *arg, lua_Number number)
+{
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_pushnumber(tree->L, number);
+    return tree_store(tree);
 }
 
-static int scan_json(lua_State *L, const char *str, int pos)
+static bool tree_on_boolean(void *arg, bool value)
 {
-    pos = skip_sp(str, pos);
-    char c = str[pos];
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_pushboolean(tree->L, value);
+    return tree_store(tree);
+}
 
-    switch(c)
+static bool tree_on_null(void *arg)
+{
+    json_tree_t *tree = (json_tree_t *)arg;
+    lua_pushnil(tree->L);
+    return tree_store(tree);
+}
+
+static const json_handler_t tree_handler =
+{
+    .on_begin = tree_on_begin,
+    .on_end = tree_on_end,
+    .on_key = tree_on_key,
+    .on_string = tree_on_string,
+    .on_number = tree_on_number,
+    .on_boolean = tree_on_boolean,
+    .on_null = tree_on_null,
+};
+
+/* pushes the value or nil */
+static void json_decode_tree(lua_State *L, const char *str, size_t size)
+{
+    const int top = lua_gettop(L);
+
+    json_tree_t *tree = (json_tree_t *)malloc(sizeof(json_tree_t));
+    tree->L = L;
+    tree->depth = 0;
+
+    const bool result = lua_checkstack(L, JSON_DEPTH_MAX * 2 + 8)
+                     && json_parse(str, size, &tree_handler, tree);
+    free(tree);
+
+    if(!result || lua_gettop(L) != top + 1)
     {
-        case '\0':
-            return -1;
+        lua_settop(L, top);
+        lua_pushnil(L);
+    }
+}
 
-        case '{':
-        {
-            lua_newtable(L);
-            pos = scan_object(L, str, pos + 1);
-            if(pos == -1)
-                lua_pop(L, 1);
-            break;
-        }
+/* callback */
 
-        case '[':
-        {
-            lua_newtable(L);
-            pos = scan_array(L, str, pos + 1);
-            if(pos == -1)
-                lua_pop(L, 1);
-            break;
-        }
+typedef struct
+{
+    lua_State *L;
+    int idx_callback; // stack index
+    bool is_error; // error message is on the stack
+} json_stream_t;
 
-        case '/':
-        {
-            if(str[pos + 1] == '*')
-                pos = skip_comment(str, pos + 2);
-            else
-                pos = -1;
-            break;
-        }
+static bool stream_call(json_stream_t *stream, const char *event, int nargs)
+{
+    lua_State *L = stream->L;
 
-        case '"':
-        {
-            pos = scan_string(L, str, pos + 1);
-            break;
-        }
+    lua_pushvalue(L, stream->idx_callback);
+    lua_pushstring(L, event);
+    if(nargs)
+    {
+        lua_pushvalue(L, -3);
+        lua_remove(L, -4);
+    }
 
-        default:
-        {
-            if((c >= '0' && c <= '9') || (c == '-') || (c == '.'))
-            { // scan number
-                pos = scan_number(L, str, pos);
-            }
-            else if(!strncmp(&str[pos], "true", 4))
-            {
-                lua_pushboolean(L, true);
-                pos = pos + 4;
-            }
-            else if(!strncmp(&str[pos], "false", 5))
-            {
-                lua_pushboolean(L, false);
-                pos = pos + 5;
-            }
-            else if(!strncmp(&str[pos], "null", 4))
-            {
-                lua_pushnil(L);
-                pos = pos + 4;
-            }
-            break;
-        }
+    if(lua_pcall(L, 1 + nargs, 1, 0) != 0)
+    {
+        stream->is_error = true;
+        return false;
     }
 
-    return pos;
+    const bool result = !(lua_isboolean(L, -1) && !lua_toboolean(L, -1));
+    lua_pop(L, 1);
+    return result;
+}
+
+static bool stream_on_begin(void *arg, bool is_array)
+{
+    return stream_call((json_stream_t *)arg, (is_array) ? "array" : "object", 0);
+}
+
+static bool stream_on_end(void *arg, bool is_array)
+{
+    __uarg(is_array);
+    return stream_call((json_stream_t *)arg, "end", 0);
+}
+
+static bool stream_on_key(void *arg, const char *str, size_t size)
+{
+    json_stream_t *stream = (json_stream_t *)arg;
+    lua_pushlstring(stream->L, str, size);
+    return stream_call(stream, "key", 1);
+}
+
+static bool stream_on_string(void *arg, const char *str, size_t size)
+{
+    json_stream_t *stream = (json_stream_t *)arg;
+    lua_pushlstring(stream->L, str, size);
+    return stream_call(stream, "value", 1);
+}
+
+static bool stream_on_number(void *arg, lua_Number number)
+{
+    json_stream_t *stream = (json_stream_t *)arg;
+    lua_pushnumber(stream->L, number);
+    return stream_call(stream, "value", 1);
+}
+
+static bool stream_on_boolean(void *arg, bool value)
+{
+    json_stream_t *stream = (json_stream_t *)arg;
+    lua_pushboolean(stream->L, value);
+    return stream_call(stream, "value", 1);
+}
+
+static bool stream_on_null(void *arg)
+{
+    json_stream_t *stream = (json_stream_t *)arg;
+    lua_pushnil(stream->L);
+    return stream_call(stream, "value", 1);
+}
+
+static const json_handler_t stream_handler =
+{
+    .on_begin = stream_on_begin,
+    .on_end = stream_on_end,
+    .on_key = stream_on_key,
+    .on_string = stream_on_string,
+    .on_number = stream_on_number,
+    .on_boolean = stream_on_boolean,
+    .on_null = stream_on_null,
+};
+
+/* pushes boolean or the callback error, returns false on error */
+static bool json_decode_stream(lua_State *L, const char *str, size_t size, int idx_callback)
+{
+    json_stream_t stream =
+    {
+        .L = L,
+        .idx_callback = idx_callback,
+        .is_error = false,
+    };
+
+    const bool result = json_parse(str, size, &stream_handler, &stream);
+    if(stream.is_error)
+        return false;
+
+    lua_pushboolean(L, result);
+    return true;
 }
 
 static int json_decode(lua_State *L)
 {
-    luaL_checktype(L, -1, LUA_TSTRING);
-    const int top = lua_gettop(L);
-    scan_json(L, lua_tostring(L, -1), 0);
-    if(top == lua_gettop(L))
-        lua_pushnil(L);
+    luaL_checktype(L, 1, LUA_TSTRING);
+
+    size_t size = 0;
+    const char *str = lua_tolstring(L, 1, &size);
+    json_decode_tree(L, str, size);
+    return 1;
+}
+
+static int json_stream(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TSTRING);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    size_t size = 0;
+    const char *str = lua_tolstring(L, 1, &size);
+    if(!json_decode_stream(L, str, size, 2))
+        return lua_error(L);
     return 1;
 }
 
 static int json_load(lua_State *L)
 {
-    luaL_checktype(L, -1, LUA_TSTRING);
-    const char *filename = lua_tostring(L, -1);
+    const char *filename = luaL_checkstring(L, 1);
+    const bool is_stream = (lua_type(L, 2) == LUA_TFUNCTION);
+
     int fd = open(filename, O_RDONLY | O_BINARY);
-    if(fd <= 0)
+    if(fd == -1)
     {
         asc_log_error("[json] json.load(%s) failed to open [%s]", filename, strerror(errno));
         lua_pushnil(L);
         return 1;
     }
+
     struct stat sb;
     fstat(fd, &sb);
-    char *json = (char *)malloc(sb.st_size);
-    off_t skip = 0;
-    while(skip != sb.st_size)
+    const size_t size = sb.st_size;
+
+    char *json = (char *)malloc(size + 1);
+    size_t skip = 0;
+    while(skip != size)
     {
-        const ssize_t r = read(fd, &json[skip], sb.st_size - skip);
-        if(r == -1)
+        const ssize_t r = read(fd, &json[skip], size - skip);
+        if(r <= 0)
         {
             asc_log_error("[json] json.load(%s) failed to read [%s]", filename, strerror(errno));
-            lua_pushnil(L);
-            skip = 0;
             break;
         }
-        skip += sb.st_size;
+        skip += r;
     }
+    close(fd);
 
-    const int top = lua_gettop(L);
-    if(skip)
-        scan_json(L, json, 0);
-
-    if(top == lua_gettop(L))
+    if(skip != size)
+    {
+        free(json);
         lua_pushnil(L);
+        return 1;
+    }
+    json[size] = '\0';
 
-    close(fd);
-    free(json);
+    if(is_stream)
+    {
+        const bool is_ok = json_decode_stream(L, json, size, 2);
+        free(json);
+        if(!is_ok)
+            return lua_error(L);
+    }
+    else
+    {
+        json_decode_tree(L, json, size);
+        free(json);
+    }
 
     return 1;
 }
@@ -523,30 +1067,28 @@ static int json_save(lua_State *L)
     luaL_checktype(L, -1, LUA_TTABLE);
 
     const char *filename = lua_tostring(L, -2);
+
+    encode_buffer.size = 0;
+    walk_table(L, &encode_buffer, 1);
+
     int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
 #ifndef _WIN32
                   , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 #else
                   , S_IRUSR | S_IWUSR);
 #endif
-    if(fd <= 0)
+    if(fd == -1)
     {
         asc_log_error("[json] json.save(%s) failed to open [%s]", filename, strerror(errno));
+        buffer_release(&encode_buffer);
         lua_pushboolean(lua, false);
         return 1;
     }
 
-    string_buffer_t *buffer = string_buffer_alloc();
-
-    walk_table(L, buffer);
-
-    size_t json_size = 0;
-    char *json = string_buffer_release(buffer, &json_size);
-    const ssize_t w = write(fd, json, json_size);
+    const ssize_t w = write(fd, encode_buffer.data, encode_buffer.size);
     close(fd);
-    free(json);
 
-    if(w == (ssize_t)json_size)
+    if(w == (ssize_t)encode_buffer.size)
     {
         lua_pushboolean(lua, true);
     }
@@ -556,6 +1098,7 @@ static int json_save(lua_State *L)
         lua_pushboolean(lua, false);
     }
 
+    buffer_release(&encode_buffer);
     return 1;
 }
 
@@ -565,6 +1108,7 @@ LUA_API int luaopen_json(lua_State *L)
     {
         { "encode", json_encode },
         { "decode", json_decode },
+        { "stream", json_stream },
         { "load", json_load },
         { "save", json_save },
         { NULL, NULL }
@@ -29,6 +29,12 @@
  *                    syslog    - string, sending log to the syslog,
  *                                is not available under the windows
  *                    stdout    - boolean, writing log to the stdout, true by default
+ *                    async     - boolean, write log in the separate thread,
+ *                                is not available under the windows
+ *                    rate_limit
+ *                              - number, messages per second from the same place,
+ *                                0 - unlimited (default). messages from the
+ *                                scripts share one limit
  *      log.error(message)
  *                  - error message
  *      log.warning(message)
@@ -77,7 +83,16 @@ static int lua_log_set(lua_State *L)
             const char *val = luaL_checkstring(L, -1);
             asc_log_set_syslog((*val != '\0') ? val : NULL);
         }
+        else if(!strcmp(var, "async"))
+        {
+            luaL_checktype(L, -1, LUA_TBOOLEAN);
+            asc_log_set_async(lua_toboolean(L, -1));
+        }
 #endif
+        else if(!strcmp(var, "rate_limit"))
+        {
+            asc_log_set_rate_limit(luaL_checkinteger(L, -1));
+        }
         else if(!strcmp(var, "stdout"))
         {
             luaL_checktype(L, -1, LUA_TBOOLEAN);
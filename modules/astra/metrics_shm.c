@@ -0,0 +1,268 @@
+/*
+ * Astra Module: Metrics Shared Memory
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      metrics_shm
+ *
+ * Module Options:
+ *      path        - string, file on the tmpfs. default: "/dev/shm/astra-metrics"
+ *      capacity    - number, maximum count of the series. default: 16384
+ *      interval    - number, update interval in milliseconds. default: 1000
+ *
+ * Module Methods:
+ *      update()    - copy the metrics now
+ *      close()     - remove the file
+ *
+ * Read-only copy of the metrics registry (see core/metrics.h) for the
+ * external agents. The reader maps the file and does not touch the process.
+ *
+ * Layout, host byte order:
+ *      header, 64 bytes:
+ *          uint32_t magic          - 0x41534D54 "ASMT"
+ *          uint32_t version        - 1
+ *          uint32_t header_size    - offset of the first item
+ *          uint32_t item_size      - 256
+ *          uint32_t capacity
+ *          uint32_t count          - items in use
+ *          uint32_t generation     - changed when the list of the series changed
+ *          uint32_t pid
+ *          uint64_t sequence       - seqlock, odd while the writer is active
+ *          uint64_t time           - last update, unix time in microseconds
+ *      item, 256 bytes:
+ *          char     series[240]    - name{labels}, null-terminated, truncated
+ *          uint32_t type           - 0 - counter, 1 - gauge
+ *          uint32_t reserved
+ *          uint64_t value
+ *
+ * Reader: load sequence (acquire), retry while odd, copy the items, load
+ * sequence again and retry if it is changed. The items with the same
+ * generation keep their positions.
+ */
+
+#ifdef _WIN32
+#   error "metrics_shm module is not for win32"
+#else
+
+#include <astra.h>
+#include <sys/mman.h>
+
+#define MSG(_msg) "[metrics_shm %s] " _msg, mod->path
+
+#define METRICS_SHM_MAGIC 0x41534D54
+#define METRICS_SHM_VERSION 1
+#define METRICS_SHM_SERIES_SIZE 240
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t item_size;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t generation;
+    uint32_t pid;
+    uint64_t sequence;
+    uint64_t time;
+
+    uint8_t reserved[16];
+} metrics_shm_header_t;
+
+typedef struct
+{
+    char series[METRICS_SHM_SERIES_SIZE];
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t value;
+} metrics_shm_item_t;
+
+struct module_data_t
+{
+    const char *path;
+    uint32_t capacity;
+
+    int fd;
+    size_t size;
+    metrics_shm_header_t *header;
+    metrics_shm_item_t *item;
+
+    uint32_t count;
+    uint32_t generation;
+    bool is_overflow;
+
+    asc_timer_t *timer;
+};
+
+static void on_metric(void *arg, const char *series, size_t size
+                      , asc_metric_type_t type, uint64_t value)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->count >= mod->capacity)
+    {
+        if(!mod->is_overflow)
+        {
+            asc_log_warning(MSG("capacity is reached, increase option 'capacity'"));
+            mod->is_overflow = true;
+        }
+        return;
+    }
+
+    metrics_shm_item_t *item = &mod->item[mod->count++];
+    if(mod->generation == mod->header->generation)
+    {
+        // same list of the series, values only
+        item->value = value;
+        return;
+    }
+
+    if(size >= METRICS_SHM_SERIES_SIZE)
+        size = METRICS_SHM_SERIES_SIZE - 1;
+    memcpy(item->series, series, size);
+    memset(&item->series[size], 0, METRICS_SHM_SERIES_SIZE - size);
+    item->type = (uint32_t)type;
+    item->value = value;
+}
+
+static void metrics_shm_update(module_data_t *mod)
+{
+    metrics_shm_header_t *header = mod->header;
+
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    mod->count = 0;
+    mod->generation = asc_metric_generation();
+    asc_metric_walk(on_metric, mod);
+
+    header->count = mod->count;
+    header->generation = mod->generation;
+    header->time = asc_utime();
+
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void on_timer(void *arg)
+{
+    metrics_shm_update((module_data_t *)arg);
+}
+
+static void metrics_shm_close(module_data_t *mod)
+{
+    ASC_FREE(mod->timer, asc_timer_destroy);
+
+    if(mod->header)
+    {
+        munmap(mod->header, mod->size);
+        mod->header = NULL;
+        mod->item = NULL;
+    }
+
+    if(mod->fd != -1)
+    {
+        close(mod->fd);
+        mod->fd = -1;
+        unlink(mod->path);
+    }
+}
+
+static int method_update(module_data_t *mod)
+{
+    if(mod->header)
+        metrics_shm_update(mod);
+    return 0;
+}
+
+static int method_close(module_data_t *mod)
+{
+    metrics_shm_close(mod);
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    mod->fd = -1;
+
+    mod->path = "/dev/shm/astra-metrics";
+    module_option_string("path", &mod->path, NULL);
+
+    int capacity = 16384;
+    module_option_number("capacity", &capacity);
+    asc_assert(capacity > 0, MSG("option 'capacity' must be greater than 0"));
+    mod->capacity = (uint32_t)capacity;
+
+    int interval = 1000;
+    module_option_number("interval", &interval);
+    asc_assert(interval > 0, MSG("option 'interval' must be greater than 0"));
+
+    mod->size = sizeof(metrics_shm_header_t) + mod->capacity * sizeof(metrics_shm_item_t);
+
+    // the new file, the reader of the previous one keeps the old inode
+    unlink(mod->path);
+    mod->fd = open(mod->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(mod->fd == -1)
+    {
+        asc_log_error(MSG("open() failed [%s]"), strerror(errno));
+        astra_abort();
+    }
+
+    if(ftruncate(mod->fd, (off_t)mod->size) != 0)
+    {
+        asc_log_error(MSG("ftruncate() failed [%s]"), strerror(errno));
+        astra_abort();
+    }
+
+    void *ptr = mmap(NULL, mod->size, PROT_READ | PROT_WRITE, MAP_SHARED, mod->fd, 0);
+    if(ptr == MAP_FAILED)
+    {
+        asc_log_error(MSG("mmap() failed [%s]"), strerror(errno));
+        astra_abort();
+    }
+
+    mod->header = (metrics_shm_header_t *)ptr;
+    mod->item = (metrics_shm_item_t *)&mod->header[1];
+
+    mod->header->header_size = sizeof(metrics_shm_header_t);
+    mod->header->item_size = sizeof(metrics_shm_item_t);
+    mod->header->capacity = mod->capacity;
+    mod->header->pid = (uint32_t)getpid();
+    mod->header->version = METRICS_SHM_VERSION;
+    // the generation of the empty file never matches
+    mod->header->generation = asc_metric_generation() - 1;
+    metrics_shm_update(mod);
+    __atomic_store_n(&mod->header->magic, METRICS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    mod->timer = asc_timer_init(interval, on_timer, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    metrics_shm_close(mod);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "update", method_update },
+    { "close", method_close },
+};
+MODULE_LUA_REGISTER(metrics_shm)
+
+#endif
@@ -1,12 +1,12 @@
 
 SOURCES="module_lua.c module_stream.c crc32b.c"
 SOURCES="$SOURCES sha1.c base64.c md5.c rc4.c strhex.c"
-SOURCES="$SOURCES astra.c log.c timer.c utils.c json.c iso8859.c"
-MODULES="astra log timer utils json base64 sha1 md5 rc4 str2hex iso8859"
+SOURCES="$SOURCES astra.c log.c timer.c utils.c json.c iso8859.c gc.c"
+MODULES="astra log timer utils json base64 sha1 md5 rc4 str2hex iso8859 gc"
 
 if [ "$OS" != "mingw" ] ; then
-    SOURCES="$SOURCES pidfile.c"
-    MODULES="$MODULES pidfile"
+    SOURCES="$SOURCES pidfile.c metrics_shm.c"
+    MODULES="$MODULES pidfile metrics_shm"
 fi
 
 getifaddrs_test_c()
@@ -34,3 +34,30 @@ if check_getifaddrs ; then
 else
     echo "$MODULE/module.mk: warning: utils.ifaddrs() is not available" >&2
 fi
+
+# PCLMULQDQ. crc32b is selected at runtime, see crc32b.c
+
+pclmul_test_c()
+{
+    cat <<EOF
+#pragma GCC target("pclmul,ssse3")
+#include <immintrin.h>
+int main(void)
+{
+    __builtin_cpu_init();
+    __m128i v = _mm_setzero_si128();
+    v = _mm_shuffle_epi8(_mm_clmulepi64_si128(v, v, 0x00), v);
+    return __builtin_cpu_supports("pclmul") + _mm_cvtsi128_si32(v);
+}
+EOF
+}
+
+check_pclmul()
+{
+    pclmul_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_pclmul ; then
+    CFLAGS="$CFLAGS -DHAVE_CRC32_PCLMUL=1"
+    SOURCES="$SOURCES crc32b_pclmul.c"
+fi
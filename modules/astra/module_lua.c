@@ -20,6 +20,8 @@
 
 #include <astra.h>
 
+const char *module_lua_type = NULL;
+
 bool module_option_number(const char *name, int *number)
 {
     if(lua_type(lua, MODULE_OPTIONS_IDX) != LUA_TTABLE)
@@ -72,6 +74,21 @@ bool module_option_string(const char *name, const char **string, size_t *length)
     return result;
 }
 
+void module_option_thread(asc_thread_t *thread)
+{
+    const char *cpus = NULL;
+    if(module_option_string("thread_cpus", &cpus, NULL) && !asc_thread_set_cpus(thread, cpus))
+        asc_log_error("[%s] option 'thread_cpus' has wrong format", module_lua_type);
+
+    int value = -1;
+    if(module_option_number("thread_numa", &value) && !asc_thread_set_numa_node(thread, value))
+        asc_log_error("[%s] NUMA node %d is not found", module_lua_type, value);
+
+    value = 0;
+    if(module_option_number("thread_priority", &value))
+        asc_thread_set_priority(thread, value);
+}
+
 bool module_option_boolean(const char *name, bool *boolean)
 {
     if(lua_type(lua, MODULE_OPTIONS_IDX) != LUA_TTABLE)
@@ -101,3 +118,400 @@ bool module_option_boolean(const char *name, bool *boolean)
     lua_pop(lua, 1);
     return result;
 }
+
+/*
+ *    ooooooo  oooooooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
+ *  o888   888o 888    888 888   888    88 o888     88 88  888  88
+ *  888     888 888oooo88  888   888ooo8   888             888
+ *  888o   o888 888    888 888   888    oo 888o     oo     888
+ *    88ooo88  o888ooo888  888  o888ooo8888 888oooo88     o888o
+ *                      8o888
+ */
+
+/* upvalues: 1 - module_method_t, 2 - metatable of the class */
+static int module_lua_thunk(lua_State *L)
+{
+    const module_method_t *m = (const module_method_t *)lua_touserdata(L, lua_upvalueindex(1));
+    const module_lua_object_t *o = (const module_lua_object_t *)lua_touserdata(L, 1);
+
+    bool is_self = false;
+    if(o && lua_getmetatable(L, 1))
+    {
+        is_self = lua_rawequal(L, -1, lua_upvalueindex(2));
+        lua_pop(L, 1);
+    }
+    if(!is_self)
+        return luaL_error(L, "[%s] instance expected, use ':' to call the method", m->name);
+
+    return m->method(o->mod);
+}
+
+/* upvalue: method table of the class */
+static int module_lua_index(lua_State *L)
+{
+    lua_getuservalue(L, 1);
+    if(!lua_isnil(L, -1))
+    {
+        lua_pushvalue(L, 2);
+        lua_rawget(L, -2);
+        if(!lua_isnil(L, -1))
+            return 1;
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    return 1;
+}
+
+static int module_lua_newindex(lua_State *L)
+{
+    lua_getuservalue(L, 1);
+    if(lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, 1);
+    }
+
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 3);
+    lua_rawset(L, -3);
+    return 0;
+}
+
+void module_lua_class(  lua_State *L, const char *meta
+                      , const module_method_t *methods, size_t count
+                      , const luaL_Reg *meta_methods, lua_CFunction close)
+{
+    luaL_newmetatable(L, meta);
+    luaL_setfuncs(L, meta_methods, 0);
+
+    lua_newtable(L);
+    for(size_t i = 0; i < count; ++i)
+    {
+        const module_method_t *m = &methods[i];
+        if(!m->name)
+            break;
+
+        lua_pushlightuserdata(L, (void *)m);
+        lua_pushvalue(L, -3);
+        lua_pushcclosure(L, module_lua_thunk, 2);
+        // meta-methods are called by Lua with the object, like the methods
+        lua_setfield(L, (m->name[0] == '_' && m->name[1] == '_') ? -3 : -2, m->name);
+    }
+
+    lua_getfield(L, -1, "close");
+    if(lua_isnil(L, -1))
+    {
+        lua_pushcfunction(L, close);
+        lua_setfield(L, -3, "close");
+    }
+    lua_pop(L, 1);
+
+    lua_pushcclosure(L, module_lua_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, module_lua_newindex);
+    lua_setfield(L, -2, "__newindex");
+
+    lua_pop(L, 1); // metatable
+}
+
+/*
+ *  oooooooo8 ooooooooooo   o   ooooooooooo
+ * 888        88  888  88  888  88  888  88
+ *  888oooooo     888     8  88     888
+ *         888    888    8oooo88    888
+ * o88oooo888    o888o o88o  o888o o888o
+ *
+ */
+
+typedef struct
+{
+    void *data;
+    const module_stat_field_t *fields;
+} module_stat_t;
+
+static const char __module_stat[] = "__module_stat";
+
+/* returns false if the value is nil */
+static bool module_stat_push_field(const module_stat_t *stat, const module_stat_field_t *field)
+{
+    const uint8_t *ptr = (const uint8_t *)stat->data + field->offset;
+
+    switch(field->type)
+    {
+        case MODULE_STAT_INT:
+            lua_pushnumber(lua, *(const int *)ptr);
+            return true;
+        case MODULE_STAT_UINT32:
+            lua_pushnumber(lua, *(const uint32_t *)ptr);
+            return true;
+        case MODULE_STAT_UINT64:
+            lua_pushnumber(lua, (lua_Number)*(const uint64_t *)ptr);
+            return true;
+        case MODULE_STAT_SIZE:
+            lua_pushnumber(lua, (lua_Number)*(const size_t *)ptr);
+            return true;
+        case MODULE_STAT_BOOLEAN:
+            lua_pushboolean(lua, *(const bool *)ptr);
+            return true;
+        case MODULE_STAT_STRING:
+        {
+            const char *str = *(const char * const *)ptr;
+            if(!str)
+                return false;
+            lua_pushstring(lua, str);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static int module_stat_index(lua_State *L)
+{
+    const module_stat_t *stat = (const module_stat_t *)luaL_checkudata(L, 1, __module_stat);
+
+    if(stat->data && lua_type(L, 2) == LUA_TSTRING)
+    {
+        const char *key = lua_tostring(L, 2);
+        for(const module_stat_field_t *field = stat->fields; field->name; ++field)
+        {
+            if(strcmp(field->name, key))
+                continue;
+            if(!module_stat_push_field(stat, field))
+                lua_pushnil(L);
+            return 1;
+        }
+    }
+
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+/* fields in the declaration order, then the stored values */
+static int module_stat_next(lua_State *L)
+{
+    const module_stat_t *stat = (const module_stat_t *)luaL_checkudata(L, 1, __module_stat);
+    lua_settop(L, 2);
+
+    const module_stat_field_t *field = stat->fields;
+    bool is_field = true;
+
+    if(lua_type(L, 2) == LUA_TSTRING)
+    {
+        const char *key = lua_tostring(L, 2);
+        for(; field->name && strcmp(field->name, key); ++field)
+            ;
+        if(field->name)
+            ++field;
+        else
+            is_field = false;
+    }
+    else if(!lua_isnil(L, 2))
+    {
+        is_field = false;
+    }
+
+    if(is_field)
+    {
+        for(; stat->data && field->name; ++field)
+        {
+            lua_pushstring(L, field->name);
+            if(module_stat_push_field(stat, field))
+                return 2;
+            lua_pop(L, 1);
+        }
+
+        lua_pushnil(L);
+        lua_replace(L, 2);
+    }
+
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, 2);
+    if(lua_next(L, -2))
+        return 2;
+
+    lua_pushnil(L);
+    return 1;
+}
+
+static int module_stat_pairs(lua_State *L)
+{
+    luaL_checkudata(L, 1, __module_stat);
+    lua_pushcfunction(L, module_stat_next);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+int module_stat_init(void *data, const module_stat_field_t *fields)
+{
+    module_stat_t *stat = (module_stat_t *)lua_newuserdata(lua, sizeof(module_stat_t));
+    stat->data = data;
+    stat->fields = fields;
+
+    if(luaL_newmetatable(lua, __module_stat))
+    {
+        lua_pushcfunction(lua, module_stat_index);
+        lua_setfield(lua, -2, "__index");
+        lua_pushcfunction(lua, module_stat_pairs);
+        lua_setfield(lua, -2, "__pairs");
+    }
+    lua_setmetatable(lua, -2);
+
+    lua_newtable(lua);
+    lua_setuservalue(lua, -2);
+
+    return luaL_ref(lua, LUA_REGISTRYINDEX);
+}
+
+void module_stat_set_data(int idx_stat, void *data)
+{
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, idx_stat);
+    module_stat_t *stat = (module_stat_t *)lua_touserdata(lua, -1);
+    stat->data = data;
+    lua_pop(lua, 1);
+}
+
+void module_stat_set(int idx_stat, const char *name)
+{
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, idx_stat);
+    lua_getuservalue(lua, -1);
+    lua_pushvalue(lua, -3);
+    lua_setfield(lua, -2, name);
+    lua_pop(lua, 3); // uservalue, object, value
+}
+
+void module_stat_push(int idx_stat)
+{
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, idx_stat);
+}
+
+void module_stat_destroy(int idx_stat)
+{
+    module_stat_set_data(idx_stat, NULL);
+    luaL_unref(lua, LUA_REGISTRYINDEX, idx_stat);
+}
+
+/*
+ * oooo   oooo   ooooooo   ooooooooooo ooooo oooooooooo oooo   oooo
+ *  8888o  88  o888   888o 88  888  88  888   888    88   888  88
+ *  88 888o88  888     888     888      888   888ooo8       888
+ *  88   8888  888o   o888     888      888   888           888
+ * o88o    88    88ooo88      o888o    o888o o888o         o888o
+ *
+ */
+
+/*
+ * Queue is the array of triples: owner, callback, value. It is detached
+ * before the dispatch, the notifications of the callbacks are delivered on
+ * the next iteration. Canceled entries have callback false.
+ */
+
+static char __notify_queue;
+static char __notify_flush;
+static char __notify_dispatch;
+static int notify_count = 0;
+
+static const char notify_dispatch[] =
+    "local queue, count = ...\n"
+    "for i = 1, count, 3 do\n"
+    "    local callback = queue[i + 1]\n"
+    "    if callback then callback(queue[i + 2]) end\n"
+    "end\n";
+
+void module_lua_notify(void *owner, int idx_callback)
+{
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, &__notify_queue);
+    if(lua_isnil(lua, -1))
+    {
+        // new queue, or the previous one is gone with the Lua state on reload
+        lua_pop(lua, 1);
+        lua_newtable(lua);
+        lua_pushvalue(lua, -1);
+        lua_rawsetp(lua, LUA_REGISTRYINDEX, &__notify_queue);
+        notify_count = 0;
+    }
+
+    lua_pushlightuserdata(lua, owner);
+    lua_rawseti(lua, -2, ++notify_count);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, idx_callback);
+    lua_rawseti(lua, -2, ++notify_count);
+    lua_pushvalue(lua, -2);
+    lua_rawseti(lua, -2, ++notify_count);
+
+    lua_pop(lua, 2); // queue, value
+}
+
+static void notify_cancel(void *key, void *owner)
+{
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, key);
+    if(lua_istable(lua, -1))
+    {
+        const int count = (int)lua_rawlen(lua, -1);
+        for(int i = 1; i <= count; i += 3)
+        {
+            lua_rawgeti(lua, -1, i);
+            if(lua_touserdata(lua, -1) == owner)
+            {
+                lua_pushboolean(lua, 0);
+                lua_rawseti(lua, -3, i + 1);
+            }
+            lua_pop(lua, 1);
+        }
+    }
+    lua_pop(lua, 1);
+}
+
+void module_lua_notify_cancel(void *owner)
+{
+    if(notify_count > 0)
+        notify_cancel(&__notify_queue, owner);
+    notify_cancel(&__notify_flush, owner);
+}
+
+bool module_lua_notify_flush(void)
+{
+    if(notify_count == 0)
+        return false;
+
+    const int count = notify_count;
+    notify_count = 0;
+
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, &__notify_dispatch);
+    if(lua_isnil(lua, -1))
+    {
+        lua_pop(lua, 1);
+        const int ret = luaL_loadbuffer(  lua, notify_dispatch, sizeof(notify_dispatch) - 1
+                                        , "=notify");
+        asc_assert(ret == 0, "[module_lua] %s", lua_tostring(lua, -1));
+        lua_pushvalue(lua, -1);
+        lua_rawsetp(lua, LUA_REGISTRYINDEX, &__notify_dispatch);
+    }
+
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, &__notify_queue);
+    if(!lua_istable(lua, -1))
+    {
+        // the queue is gone with the Lua state on reload
+        lua_pop(lua, 2);
+        return false;
+    }
+    lua_pushvalue(lua, -1);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, &__notify_flush);
+    lua_pushnil(lua);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, &__notify_queue);
+
+    lua_pushnumber(lua, count);
+    lua_call(lua, 2, 0);
+
+    lua_pushnil(lua);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, &__notify_flush);
+
+    return true;
+}
@@ -33,73 +33,102 @@ typedef struct
 
 #define MODULE_OPTIONS_IDX 2
 
+/* name of the module in module_init(), for the profiler */
+extern const char *module_lua_type;
+
+/*
+ * Instance is the userdata with the metatable shared by all instances of the
+ * module, see module_lua_class(). Methods are resolved by __index in the
+ * method table of the class, the fields assigned by the script (__options
+ * and others) are kept in the user value of the object. Methods with the "__"
+ * prefix are the meta-methods, e.g. { "__call", module_call }.
+ *
+ * Modules without their own close method get the generic one: instance:close()
+ * calls module_destroy() right away, so the sockets, timers and buffers are
+ * released without waiting for the garbage collector. The memory of the
+ * instance is freed by __gc, module_destroy() is called only once.
+ */
+
+typedef struct
+{
+    module_data_t *mod;
+    bool is_closed;
+} module_lua_object_t;
+
+/* registers the metatable of the class with the methods and the meta-methods */
+void module_lua_class(  lua_State *L, const char *meta
+                      , const module_method_t *methods, size_t count
+                      , const luaL_Reg *meta_methods, lua_CFunction close);
+
 #define MODULE_LUA_METHODS()                                                                    \
     static const module_method_t __module_methods[] =
 
 #define MODULE_LUA_REGISTER(_name)                                                              \
     static const char __module_name[] = #_name;                                                 \
+    static const char __module_meta[] = "__module_" #_name;                                     \
     static int __module_tostring(lua_State *L)                                                  \
     {                                                                                           \
         lua_pushstring(L, __module_name);                                                       \
         return 1;                                                                               \
     }                                                                                           \
-    static int __module_thunk(lua_State *L)                                                     \
+    static int __module_close(lua_State *L)                                                     \
     {                                                                                           \
-        module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));           \
-        module_method_t *m = (module_method_t *)lua_touserdata(L, lua_upvalueindex(2));         \
-        return m->method(mod);                                                                  \
+        module_lua_object_t *o = (module_lua_object_t *)luaL_checkudata(L, 1, __module_meta);   \
+        if(!o->is_closed)                                                                       \
+        {                                                                                       \
+            o->is_closed = true;                                                                \
+            module_destroy(o->mod);                                                             \
+        }                                                                                       \
+        return 0;                                                                               \
     }                                                                                           \
     static int __module_delete(lua_State *L)                                                    \
     {                                                                                           \
-        module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));           \
-        module_destroy(mod);                                                                    \
-        free(mod);                                                                              \
+        module_lua_object_t *o = (module_lua_object_t *)lua_touserdata(L, 1);                   \
+        __module_close(L);                                                                      \
+        free(o->mod);                                                                           \
+        o->mod = NULL;                                                                          \
         return 0;                                                                               \
     }                                                                                           \
     static int __module_new(lua_State *L)                                                       \
     {                                                                                           \
-        size_t i;                                                                               \
-        static const luaL_Reg __meta_methods[] =                                                \
-        {                                                                                       \
-            { "__gc", __module_delete },                                                        \
-            { "__tostring", __module_tostring },                                                \
-        };                                                                                      \
+        const bool __has_options = (lua_gettop(L) == MODULE_OPTIONS_IDX);                       \
         module_data_t *mod = (module_data_t *)calloc(1, sizeof(module_data_t));                 \
-        lua_newtable(L);                                                                        \
-        lua_newtable(L);                                                                        \
-        for(i = 0; i < ASC_ARRAY_SIZE(__meta_methods); ++i)                                     \
-        {                                                                                       \
-            const luaL_Reg *m = &__meta_methods[i];                                             \
-            lua_pushlightuserdata(L, (void *)mod);                                              \
-            lua_pushcclosure(L, m->func, 1);                                                    \
-            lua_setfield(L, -2, m->name);                                                       \
-        }                                                                                       \
+        module_lua_object_t *o =                                                                \
+            (module_lua_object_t *)lua_newuserdata(L, sizeof(module_lua_object_t));             \
+        o->mod = mod;                                                                           \
+        o->is_closed = false;                                                                   \
+        luaL_getmetatable(L, __module_meta);                                                    \
         lua_setmetatable(L, -2);                                                                \
-        for(i = 0; i < ASC_ARRAY_SIZE(__module_methods); ++i)                                   \
-        {                                                                                       \
-            const module_method_t *m = &__module_methods[i];                                    \
-            if(!m->name) break;                                                                 \
-            lua_pushlightuserdata(L, (void *)mod);                                              \
-            lua_pushlightuserdata(L, (void *)m);                                                \
-            lua_pushcclosure(L, __module_thunk, 2);                                             \
-            lua_setfield(L, -2, m->name);                                                       \
-        }                                                                                       \
-        if(lua_gettop(L) == 3)                                                                  \
+        if(__has_options)                                                                       \
         {                                                                                       \
+            lua_newtable(L);                                                                    \
             lua_pushvalue(L, MODULE_OPTIONS_IDX);                                               \
-            lua_setfield(L, 3, "__options");                                                    \
+            lua_setfield(L, -2, "__options");                                                   \
+            lua_setuservalue(L, -2);                                                            \
         }                                                                                       \
+        const char *const __type = module_lua_type;                                             \
+        module_lua_type = __module_name;                                                        \
         module_init(mod);                                                                       \
+        module_lua_type = __type;                                                               \
         return 1;                                                                               \
     }                                                                                           \
     LUA_API int luaopen_##_name(lua_State *L)                                                   \
     {                                                                                           \
+        static const luaL_Reg object_methods[] =                                                \
+        {                                                                                       \
+            { "__gc", __module_delete },                                                        \
+            { "__tostring", __module_tostring },                                                \
+            { NULL, NULL }                                                                      \
+        };                                                                                      \
         static const luaL_Reg meta_methods[] =                                                  \
         {                                                                                       \
             { "__tostring", __module_tostring },                                                \
             { "__call", __module_new },                                                         \
             { NULL, NULL }                                                                      \
         };                                                                                      \
+        module_lua_class(  L, __module_meta                                                     \
+                         , __module_methods, ASC_ARRAY_SIZE(__module_methods)                   \
+                         , object_methods, __module_close);                                     \
         lua_newtable(L);                                                                        \
         lua_newtable(L);                                                                        \
         luaL_setfuncs(L, meta_methods, 0);                                                      \
@@ -112,4 +141,65 @@ bool module_option_number(const char *name, int *number);
 bool module_option_string(const char *name, const char **string, size_t *length);
 bool module_option_boolean(const char *name, bool *boolean);
 
+/*
+ * Thread options of the module, see asc_thread_set_cpus():
+ *      thread_cpus     - string, CPU list, e.g. "2,4-6"
+ *      thread_numa     - number, NUMA node
+ *      thread_priority - number, SCHED_FIFO priority 1..99, -1 - SCHED_IDLE
+ */
+void module_option_thread(asc_thread_t *thread);
+
+/*
+ * Stat object. Userdata with the read-only fields of the C struct, values
+ * are read on the access. Object is created once and passed to Lua on each
+ * status report, so the periodic monitoring makes no garbage.
+ * Nested objects and tables are stored in the object with module_stat_set().
+ */
+
+typedef enum
+{
+    MODULE_STAT_NONE = 0,
+    MODULE_STAT_INT,
+    MODULE_STAT_UINT32,
+    MODULE_STAT_UINT64,
+    MODULE_STAT_SIZE,
+    MODULE_STAT_BOOLEAN,
+    MODULE_STAT_STRING, // char *, nil if NULL
+} module_stat_type_t;
+
+typedef struct
+{
+    const char *name;
+    module_stat_type_t type;
+    size_t offset;
+} module_stat_field_t;
+
+#define MODULE_STAT_FIELD(_name, _type, _struct, _member)                                       \
+    { _name, _type, offsetof(_struct, _member) }
+
+#define MODULE_STAT_END { NULL, MODULE_STAT_NONE, 0 }
+
+/* returns reference in the registry */
+int module_stat_init(void *data, const module_stat_field_t *fields) __wur;
+/* data NULL makes all fields nil */
+void module_stat_set_data(int idx_stat, void *data);
+/* pops value and stores it in the object */
+void module_stat_set(int idx_stat, const char *name);
+void module_stat_push(int idx_stat);
+void module_stat_destroy(int idx_stat);
+
+/*
+ * Low-priority notifications. module_lua_notify() pops the value and queues
+ * it for the callback in the registry. The queue is delivered at the end of
+ * the loop iteration by one call into Lua, so bursts of the status reports
+ * do not delay the packet processing. The value is passed by reference,
+ * the reused stat object holds the latest data on the delivery.
+ * module_lua_notify_cancel() drops the pending notifications of the owner,
+ * call it on destroy. module_lua_notify_flush() returns false if the queue
+ * is empty.
+ */
+void module_lua_notify(void *owner, int idx_callback);
+void module_lua_notify_cancel(void *owner);
+bool module_lua_notify_flush(void);
+
 #endif /* _MODULE_LUA_H_ */
@@ -20,16 +20,374 @@
 
 #include <astra.h>
 
+#define CHILD_LIST_SIZE 4
+#define BLOCK_POOL_SIZE 1024
+#define FLOW_RETRY_INTERVAL 5 // ms
+#define GRAPH_RATE_INTERVAL (1000 * 1000) // us
+
+static struct
+{
+    module_stream_block_t *head;
+    size_t count;
+    asc_memstat_t *memstat; // blocks in use and in the pool
+} block_pool = { NULL, 0, NULL };
+
+static struct
+{
+    TAILQ_HEAD(, module_stream_t) list;
+    uint32_t next_id;
+} stream_graph = { TAILQ_HEAD_INITIALIZER(stream_graph.list), 0 };
+
+/*
+ * Transparent streams. The children of the transparent stream are kept in
+ * the child list of the first not transparent parent (the link) and receive
+ * the packets from it directly. The parent of the child is not changed.
+ * The transparent stream itself stays in the list of the link without
+ * callbacks, its own list is used only while it is detached.
+ */
+
+static module_stream_t *stream_link(module_stream_t *stream)
+{
+    while(stream->is_transparent && stream->parent)
+        stream = stream->parent;
+    return stream;
+}
+
+/* the child is attached to the stream through the transparent streams */
+static bool stream_is_ancestor(const module_stream_t *stream, const module_stream_t *child)
+{
+    for(const module_stream_t *parent = child->parent; parent; parent = parent->parent)
+    {
+        if(parent == stream)
+            return true;
+        if(!parent->is_transparent)
+            break;
+    }
+    return false;
+}
+
+/* item of the stream in the child list of the link */
+static module_stream_child_t *stream_child_item(module_stream_t *stream)
+{
+    if(!stream->parent)
+        return NULL;
+
+    module_stream_t *const link = stream_link(stream->parent);
+    for(size_t i = 0; i < link->child_count; ++i)
+    {
+        if(link->child_list[i].stream == stream)
+            return &link->child_list[i];
+    }
+    return NULL;
+}
+
+/*
+ * PID routing. A routed child is registered in the route table of the parent
+ * for each joined PID, packets are delivered only to the children joined to
+ * the PID. Other children receive every packet.
+ */
+
+void __module_stream_route_join(module_stream_t *stream, module_stream_t *child, uint16_t pid)
+{
+    stream = stream_link(stream);
+
+    if(!stream->route)
+    {
+        stream->route = (module_stream_route_t *)calloc(MAX_PID, sizeof(module_stream_route_t));
+        asc_assert(stream->route != NULL, "[module_stream] failed to allocate route table");
+    }
+
+    module_stream_route_t *const route = &stream->route[pid];
+    route->child_list = (module_stream_t **)realloc(route->child_list
+                                                    , (route->child_count + 1)
+                                                      * sizeof(module_stream_t *));
+    asc_assert(route->child_list != NULL, "[module_stream] failed to allocate route");
+    route->child_list[route->child_count] = child;
+    ++route->child_count;
+}
+
+void __module_stream_route_leave(module_stream_t *stream, module_stream_t *child, uint16_t pid)
+{
+    stream = stream_link(stream);
+
+    if(!stream->route)
+        return;
+
+    module_stream_route_t *const route = &stream->route[pid];
+    for(size_t i = 0; i < route->child_count; ++i)
+    {
+        if(route->child_list[i] == child)
+        {
+            --route->child_count;
+            memmove(&route->child_list[i], &route->child_list[i + 1]
+                    , (route->child_count - i) * sizeof(module_stream_t *));
+            break;
+        }
+    }
+}
+
+static void stream_route_attach(module_stream_t *stream, module_stream_t *child)
+{
+    MPEGTS_PID_MAP_FOREACH(child->pid_list, pid)
+        __module_stream_route_join(stream, child, pid);
+}
+
+static void stream_route_detach(module_stream_t *stream, module_stream_t *child)
+{
+    MPEGTS_PID_MAP_FOREACH(child->pid_list, pid)
+        __module_stream_route_leave(stream, child, pid);
+}
+
+static void stream_route_destroy(module_stream_t *stream)
+{
+    if(!stream->route)
+        return;
+
+    for(uint16_t pid = 0; pid < MAX_PID; ++pid)
+        free(stream->route[pid].child_list);
+
+    free(stream->route);
+    stream->route = NULL;
+}
+
+void __module_stream_set_route(module_stream_t *stream)
+{
+    asc_assert(stream->pid_list != NULL, "[module_stream] module_stream_demux_set() is required");
+
+    if(stream->is_routed)
+        return;
+    stream->is_routed = true;
+
+    module_stream_child_t *const item = stream_child_item(stream);
+    if(!item)
+        return;
+
+    item->is_routed = true;
+    stream_route_attach(stream_link(stream->parent), stream);
+}
+
+/* routed child skips the batch without joined PIDs */
+static bool stream_child_check_batch(const module_stream_t *child, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+        if(mpegts_pid_map_has(child->pid_list, TS_GET_PID(cur)))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Counters of the sent packets. Always on: the per-PID state costs a table
+ * lookup per packet, so the monitoring does not need a full analyze.
+ */
+
+/* a larger difference between PCR and arrival time is a discontinuity */
+#define STAT_PCR_JITTER_MAX 1000000
+
+static void stream_stat_pcr(module_stream_stat_t *stat, const uint8_t *ts, uint16_t pid)
+{
+    if(!stat->pcr_pid)
+        stat->pcr_pid = pid;
+    else if(stat->pcr_pid != pid)
+        return;
+
+    const uint64_t pcr = TS_GET_PCR(ts);
+    const uint64_t now = asc_loop_utime();
+
+    if(stat->pcr_time && pcr > stat->pcr_last && now >= stat->pcr_time)
+    {
+        const uint64_t pcr_us = (pcr - stat->pcr_last) / 27;
+        const uint64_t time_us = now - stat->pcr_time;
+        const uint64_t jitter = (pcr_us > time_us) ? (pcr_us - time_us) : (time_us - pcr_us);
+        if(jitter < STAT_PCR_JITTER_MAX && jitter > stat->pcr_jitter_max)
+            stat->pcr_jitter_max = jitter;
+    }
+
+    stat->pcr_last = pcr;
+    stat->pcr_time = now;
+}
+
+static void stream_stat_update(module_stream_stat_t *stat, const uint8_t *ts, size_t count)
+{
+    if(!stat->cc_list)
+    {
+        stat->cc_list = (uint8_t *)calloc(MAX_PID, sizeof(uint8_t));
+        asc_assert(stat->cc_list != NULL, "[module_stream] failed to allocate counters");
+    }
+
+    stat->packets += count;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+        if(cur[0] != 0x47)
+        {
+            ++stat->sync_errors;
+            continue;
+        }
+
+        const uint16_t pid = TS_GET_PID(cur);
+        if(pid == NULL_TS_PID)
+            continue;
+
+        if(TS_IS_SCRAMBLED(cur))
+            ++stat->sc_packets;
+
+        if(TS_IS_PCR(cur))
+            stream_stat_pcr(stat, cur, pid);
+
+        if(!TS_IS_PAYLOAD(cur))
+            continue;
+
+        const uint8_t cc = TS_GET_CC(cur);
+        const uint8_t last_cc = stat->cc_list[pid];
+        stat->cc_list[pid] = 0x10 | cc;
+
+        if(last_cc && ((last_cc + 1) & 0x0F) != cc)
+        {
+            ++stat->cc_errors;
+            if(!stat->cc_error_list)
+            {
+                stat->cc_error_list = (uint32_t *)calloc(MAX_PID, sizeof(uint32_t));
+                asc_assert(stat->cc_error_list != NULL
+                           , "[module_stream] failed to allocate counters");
+            }
+            ++stat->cc_error_list[pid];
+        }
+    }
+}
+
+/* returns a table with the counters, pcr_jitter is the maximum since the last call */
+int __module_stream_stat(module_stream_t *stream)
+{
+    module_stream_stat_t *const stat = &stream->stat;
+
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, stat->packets);
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, stat->packets * TS_PACKET_SIZE);
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, stat->cc_errors);
+    lua_setfield(lua, -2, "cc_errors");
+    lua_pushnumber(lua, stat->sc_packets);
+    lua_setfield(lua, -2, "sc_packets");
+    lua_pushnumber(lua, stat->sync_errors);
+    lua_setfield(lua, -2, "sync_errors");
+    lua_pushnumber(lua, stat->flow_waits);
+    lua_setfield(lua, -2, "flow_waits");
+    lua_pushnumber(lua, stat->flow_stalls);
+    lua_setfield(lua, -2, "flow_stalls");
+
+    if(stat->pcr_pid)
+    {
+        lua_pushnumber(lua, stat->pcr_pid);
+        lua_setfield(lua, -2, "pcr_pid");
+        lua_pushnumber(lua, stat->pcr_jitter_max);
+        lua_setfield(lua, -2, "pcr_jitter");
+        stat->pcr_jitter_max = 0;
+    }
+
+    if(stream->trace_hist)
+    {
+        const asc_hist_t *const hist = stream->trace_hist;
+        lua_newtable(lua);
+        lua_pushnumber(lua, hist->count);
+        lua_setfield(lua, -2, "count");
+        lua_pushnumber(lua, asc_hist_percentile(hist, 50.0));
+        lua_setfield(lua, -2, "p50");
+        lua_pushnumber(lua, asc_hist_percentile(hist, 99.0));
+        lua_setfield(lua, -2, "p99");
+        lua_pushnumber(lua, hist->max);
+        lua_setfield(lua, -2, "max");
+        lua_setfield(lua, -2, "latency");
+    }
+
+    lua_newtable(lua);
+    if(stat->cc_error_list)
+    {
+        for(uint16_t pid = 0; pid < MAX_PID; ++pid)
+        {
+            if(!stat->cc_error_list[pid])
+                continue;
+            lua_pushnumber(lua, stat->cc_error_list[pid]);
+            lua_rawseti(lua, -2, pid);
+        }
+    }
+    lua_setfield(lua, -2, "cc_error_list");
+
+    return 1;
+}
+
+static void stream_child_remove(module_stream_t *stream, size_t i)
+{
+    module_stream_t *const child = stream->child_list[i].stream;
+    if(child->is_routed && child->pid_list)
+        stream_route_detach(stream, child);
+
+    --stream->child_count;
+    memmove(&stream->child_list[i], &stream->child_list[i + 1]
+            , (stream->child_count - i) * sizeof(module_stream_child_t));
+}
+
+static void stream_child_insert(module_stream_t *stream, module_stream_t *child)
+{
+    if(stream->child_count == stream->child_size)
+    {
+        stream->child_size = (stream->child_size) ? (stream->child_size * 2) : CHILD_LIST_SIZE;
+        stream->child_list = (module_stream_child_t *)realloc(stream->child_list
+                                                              , stream->child_size
+                                                                * sizeof(module_stream_child_t));
+        asc_assert(stream->child_list != NULL, "[module_stream] failed to allocate child list");
+    }
+
+    /* attached transparent stream does not receive the packets */
+    const bool is_link = !(child->is_transparent && child->parent);
+
+    module_stream_child_t *const item = &stream->child_list[stream->child_count];
+    item->on_ts = (is_link) ? child->on_ts : NULL;
+    item->on_ts_batch = (is_link) ? child->on_ts_batch : NULL;
+    item->on_ts_block = (is_link) ? child->on_ts_block : NULL;
+    item->self = child->self;
+    item->stream = child;
+    item->is_routed = child->is_routed;
+    ++stream->child_count;
+
+    if(child->is_routed)
+        stream_route_attach(stream, child);
+}
+
 void __module_stream_detach(module_stream_t *stream, module_stream_t *child)
 {
-    asc_list_for(stream->childs)
+    module_stream_t *const link = stream_link(stream);
+
+    for(size_t i = 0; i < link->child_count; ++i)
     {
-        if(child == asc_list_data(stream->childs))
+        if(link->child_list[i].stream == child)
         {
-            asc_list_remove_current(stream->childs);
+            stream_child_remove(link, i);
             break;
         }
     }
+
+    /* the children of the transparent stream return to its own list */
+    if(child->is_transparent)
+    {
+        for(size_t i = 0; i < link->child_count;)
+        {
+            module_stream_t *const item = link->child_list[i].stream;
+            if(stream_is_ancestor(child, item))
+            {
+                stream_child_remove(link, i);
+                stream_child_insert(child, item);
+            }
+            else
+                ++i;
+        }
+    }
+
     child->parent = NULL;
 }
 
@@ -38,22 +396,602 @@ void __module_stream_attach(module_stream_t *stream, module_stream_t *child)
     if(child->parent)
         __module_stream_detach(child->parent, child);
     child->parent = stream;
-    asc_list_insert_tail(stream->childs, child);
+
+    module_stream_t *const link = stream_link(stream);
+    stream_child_insert(link, child);
+
+    /* the children of the transparent stream are moved to the link */
+    if(child->is_transparent)
+    {
+        while(child->child_count > 0)
+        {
+            module_stream_t *const item = child->child_list[0].stream;
+            stream_child_remove(child, 0);
+            stream_child_insert(link, item);
+        }
+    }
+}
+
+void __module_stream_set_transparent(module_stream_t *stream, bool is_transparent)
+{
+    if(stream->is_transparent == is_transparent)
+        return;
+
+    module_stream_t *const parent = stream->parent;
+    if(parent)
+        __module_stream_detach(parent, stream);
+    stream->is_transparent = is_transparent;
+    if(parent)
+        __module_stream_attach(parent, stream);
+}
+
+/*
+ * Metrics. The stream counters of the named module instances, labeled with
+ * the module type and the name
+ */
+
+static void stream_metric_register(module_stream_t *stream, const char *name)
+{
+    char labels[512];
+    asc_metric_labels(labels, sizeof(labels), module_lua_type, name);
+    stream->metric_labels = strdup(labels);
+
+    module_stream_stat_t *const stat = &stream->stat;
+
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_packets_total", ASC_METRIC_COUNTER
+                                            , "TS packets sent by the module")
+                        , labels, &stat->packets, 1);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_bytes_total", ASC_METRIC_COUNTER
+                                            , "Bytes sent by the module")
+                        , labels, &stat->packets, TS_PACKET_SIZE);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_cc_errors_total", ASC_METRIC_COUNTER
+                                            , "Continuity counter errors")
+                        , labels, &stat->cc_errors, 1);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_scrambled_packets_total"
+                                            , ASC_METRIC_COUNTER
+                                            , "Scrambled TS packets")
+                        , labels, &stat->sc_packets, 1);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_sync_errors_total", ASC_METRIC_COUNTER
+                                            , "TS packets without the sync byte")
+                        , labels, &stat->sync_errors, 1);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_flow_waits_total", ASC_METRIC_COUNTER
+                                            , "Producer pauses on the sink credit")
+                        , labels, &stat->flow_waits, 1);
+    asc_metric_register(&stream->metric_list
+                        , asc_metric_family("astra_stream_flow_stalls_total", ASC_METRIC_COUNTER
+                                            , "Sink queue reported full to the producer")
+                        , labels, &stat->flow_stalls, 1);
+}
+
+/*
+ * Flow control. The credit is requested by the producer, the graph below it
+ * is walked on each request. The child list of the link has the children of
+ * the transparent streams, their own lists are empty.
+ */
+
+size_t __module_stream_credit(module_stream_t *stream)
+{
+    size_t credit = STREAM_CREDIT_MAX;
+
+    if(stream->credit)
+    {
+        credit = stream->credit(stream->self);
+
+        const bool is_stalled = (credit == 0);
+        if(is_stalled && !stream->is_flow_stalled)
+            ++stream->stat.flow_stalls;
+        stream->is_flow_stalled = is_stalled;
+    }
+
+    for(size_t i = 0; i < stream->child_count && credit > 0; ++i)
+    {
+        const size_t child_credit = __module_stream_credit(stream->child_list[i].stream);
+        if(child_credit < credit)
+            credit = child_credit;
+    }
+
+    return credit;
+}
+
+static void stream_flow_resume(module_stream_t *stream)
+{
+    void (*on_credit)(module_data_t *mod) = stream->on_credit;
+    stream->on_credit = NULL;
+    ASC_FREE(stream->flow_timer, asc_timer_destroy);
+
+    if(on_credit)
+        on_credit(stream->self);
+}
+
+static void on_flow_retry(void *arg)
+{
+    module_stream_t *const stream = (module_stream_t *)arg;
+    stream->flow_timer = NULL;
+    stream_flow_resume(stream);
+}
+
+void __module_stream_wait(module_stream_t *stream, void (*on_credit)(module_data_t *mod))
+{
+    if(!stream->on_credit)
+        ++stream->stat.flow_waits;
+
+    /* the producer polls the credit on its own timer */
+    if(!on_credit)
+        return;
+
+    stream->on_credit = on_credit;
+    if(!stream->flow_timer)
+        stream->flow_timer = asc_timer_one_shot(FLOW_RETRY_INTERVAL, on_flow_retry, stream);
+}
+
+void __module_stream_credit_notify(module_stream_t *stream)
+{
+    module_stream_t *parent = stream->parent;
+    while(parent)
+    {
+        module_stream_t *const next = parent->parent;
+        if(parent->on_credit)
+            stream_flow_resume(parent);
+        parent = next;
+    }
 }
 
+/*
+ * Profiler. Packets and calls of the children are counted, the callback is
+ * timed once in ASC_PROFILE_SAMPLE calls. The time is charged to the child
+ * and to the child_cycles of the sender, to get the self time of each one.
+ * The time is not charged if the child is detached in the callback.
+ */
+
+static inline asc_profile_t *stream_profile_begin(module_stream_t *child, size_t count
+                                                  , uint64_t *start)
+{
+    asc_profile_t *const profile = child->profile;
+    if(!profile)
+        return NULL;
+
+    profile->packets_in += count;
+    ++profile->stream_calls;
+    if(!asc_profile_sample())
+        return NULL;
+
+    *start = asc_profile_clock();
+    return profile;
+}
+
+static inline void stream_profile_end(module_stream_t *stream, asc_profile_t *profile
+                                      , uint64_t start)
+{
+    const uint64_t cycles = (asc_profile_clock() - start) * ASC_PROFILE_SAMPLE;
+    profile->stream_cycles += cycles;
+    if(stream->profile)
+        stream->profile->child_cycles += cycles;
+}
+
+/* index of the next child, the callback may detach the child i and shift the list */
+static inline size_t stream_child_next(const module_stream_t *stream, size_t i
+                                       , const module_stream_t *child)
+{
+    return (i < stream->child_count && stream->child_list[i].stream == child) ? i + 1 : i;
+}
+
+static void stream_profile_send(module_stream_t *stream, const uint8_t *ts)
+{
+    uint64_t start = 0;
+
+    if(stream->profile)
+        ++stream->profile->packets_out;
+
+    for(size_t i = 0; i < stream->child_count;)
+    {
+        const module_stream_child_t *const item = &stream->child_list[i];
+        module_stream_t *const child = item->stream;
+        if(!item->on_ts || item->is_routed)
+        {
+            ++i;
+            continue;
+        }
+
+        asc_profile_t *const profile = stream_profile_begin(child, 1, &start);
+        ++child->edge_packets;
+        item->on_ts(item->self, ts);
+
+        const size_t next = stream_child_next(stream, i, child);
+        if(profile && next != i)
+            stream_profile_end(stream, profile, start);
+        i = next;
+    }
+
+    if(!stream->route)
+        return;
+
+    const module_stream_route_t *const route = &stream->route[TS_GET_PID(ts)];
+    size_t count = route->child_count;
+    for(size_t i = 0; i < count && i < route->child_count;)
+    {
+        module_stream_t *const child = route->child_list[i];
+        asc_profile_t *const profile = stream_profile_begin(child, 1, &start);
+        ++child->edge_packets;
+        child->on_ts(child->self, ts);
+
+        if(i < route->child_count && route->child_list[i] == child)
+        {
+            if(profile)
+                stream_profile_end(stream, profile, start);
+            ++i;
+        }
+        else
+            --count;
+    }
+}
+
+/*
+ * Tracing. module_stream_trace_time is not 0 only while the sampled packets
+ * are sent through the graph, see module_stream_send_block()
+ */
+
+uint64_t module_stream_trace_time = 0;
+
+void __module_stream_trace(module_stream_t *stream, uint64_t time)
+{
+    /* the block may be sent by the module in the several calls */
+    if(stream->trace_last == time)
+        return;
+    stream->trace_last = time;
+
+    if(!stream->trace_hist)
+    {
+        stream->trace_hist = (asc_hist_t *)calloc(1, sizeof(asc_hist_t));
+        asc_assert(stream->trace_hist != NULL, "[module_stream] calloc() failed");
+
+        /* internal streams may share the profile of the module */
+        if(stream->profile && stream->profile->owner == stream->self)
+            stream->profile->latency = stream->trace_hist;
+    }
+
+    const uint64_t now = asc_utime();
+    asc_hist_add(stream->trace_hist, (now > time) ? now - time : 0);
+}
+
+/* sends the batch or the block to the child i */
+static void stream_profile_child(module_stream_t *stream, size_t i, const uint8_t *ts
+                                 , size_t count, module_stream_block_t *block);
+
 void __module_stream_send(module_stream_t *stream, const uint8_t *ts)
 {
-    asc_list_for(stream->childs)
+    stream_stat_update(&stream->stat, ts, 1);
+    asc_trace2(stream_send, stream->self, 1);
+
+    if(module_stream_trace_time)
+        __module_stream_trace(stream, module_stream_trace_time);
+
+    if(asc_profile_enabled)
+    {
+        stream_profile_send(stream, ts);
+        return;
+    }
+
+    /* child_list is reloaded on each step: callback may attach or detach */
+    for(size_t i = 0; i < stream->child_count;)
+    {
+        const module_stream_child_t *const item = &stream->child_list[i];
+        module_stream_t *const child = item->stream;
+        if(item->on_ts && !item->is_routed)
+        {
+            ++child->edge_packets;
+            item->on_ts(item->self, ts);
+        }
+        i = stream_child_next(stream, i, child);
+    }
+
+    if(!stream->route)
+        return;
+
+    /* children joined in the callback receive the next packet */
+    const module_stream_route_t *const route = &stream->route[TS_GET_PID(ts)];
+    size_t count = route->child_count;
+    for(size_t i = 0; i < count && i < route->child_count;)
+    {
+        module_stream_t *const child = route->child_list[i];
+        ++child->edge_packets;
+        child->on_ts(child->self, ts);
+
+        if(i < route->child_count && route->child_list[i] == child)
+            ++i;
+        else
+            --count;
+    }
+}
+
+static void stream_child_send_batch(module_stream_t *stream, size_t i
+                                    , const uint8_t *ts, size_t count)
+{
+    const module_stream_child_t *const item = &stream->child_list[i];
+    if(item->on_ts_batch)
+    {
+        if(!item->is_routed || stream_child_check_batch(item->stream, ts, count))
+        {
+            item->stream->edge_packets += count;
+            item->on_ts_batch(item->self, ts, count);
+        }
+    }
+    else if(item->on_ts)
+    {
+        module_stream_t *const child = item->stream;
+        for(size_t j = 0; j < count; ++j)
+        {
+            /* callback may detach the child or resize child_list */
+            if(i >= stream->child_count || stream->child_list[i].stream != child)
+                break;
+            const module_stream_child_t *const cur = &stream->child_list[i];
+            const uint8_t *const cur_ts = &ts[j * TS_PACKET_SIZE];
+            if(cur->is_routed && !mpegts_pid_map_has(child->pid_list, TS_GET_PID(cur_ts)))
+                continue;
+            ++child->edge_packets;
+            cur->on_ts(cur->self, cur_ts);
+        }
+    }
+}
+
+void __module_stream_send_batch(module_stream_t *stream, const uint8_t *ts, size_t count)
+{
+    if(count == 0)
+        return;
+
+    if(count == 1)
+    {
+        __module_stream_send(stream, ts);
+        return;
+    }
+
+    stream_stat_update(&stream->stat, ts, count);
+    asc_trace2(stream_send, stream->self, count);
+
+    if(module_stream_trace_time)
+        __module_stream_trace(stream, module_stream_trace_time);
+
+    if(asc_profile_enabled)
+    {
+        if(stream->profile)
+            stream->profile->packets_out += count;
+        for(size_t i = 0; i < stream->child_count;)
+        {
+            module_stream_t *const child = stream->child_list[i].stream;
+            stream_profile_child(stream, i, ts, count, NULL);
+            i = stream_child_next(stream, i, child);
+        }
+        return;
+    }
+
+    for(size_t i = 0; i < stream->child_count;)
+    {
+        module_stream_t *const child = stream->child_list[i].stream;
+        stream_child_send_batch(stream, i, ts, count);
+        i = stream_child_next(stream, i, child);
+    }
+}
+
+void __module_stream_set_batch(module_stream_t *stream, stream_batch_callback_t on_ts_batch)
+{
+    stream->on_ts_batch = on_ts_batch;
+
+    module_stream_child_t *const item = stream_child_item(stream);
+    if(item && !stream->is_transparent)
+        item->on_ts_batch = on_ts_batch;
+}
+
+static void stream_child_send_block(module_stream_t *stream, size_t i
+                                    , module_stream_block_t *block)
+{
+    const module_stream_child_t *const item = &stream->child_list[i];
+    if(!item->on_ts_block)
+        stream_child_send_batch(stream, i, block->ts, block->count);
+    else if(!item->is_routed || stream_child_check_batch(item->stream, block->ts, block->count))
+    {
+        item->stream->edge_packets += block->count;
+        item->on_ts_block(item->self, block);
+    }
+}
+
+void __module_stream_send_block(module_stream_t *stream, module_stream_block_t *block)
+{
+    if(block->count == 0)
+        return;
+
+    stream_stat_update(&stream->stat, block->ts, block->count);
+    asc_trace2(stream_send, stream->self, block->count);
+
+    const uint64_t trace_time = module_stream_trace_time;
+    if(block->trace_time)
+        module_stream_trace_time = block->trace_time;
+    if(module_stream_trace_time)
+        __module_stream_trace(stream, module_stream_trace_time);
+
+    /* the block is shared if the sender or any next child receives it later */
+    const bool is_shared = block->is_shared;
+
+    if(asc_profile_enabled && stream->profile)
+        stream->profile->packets_out += block->count;
+
+    for(size_t i = 0; i < stream->child_count;)
+    {
+        module_stream_t *const child = stream->child_list[i].stream;
+        block->is_shared = is_shared || (i + 1 < stream->child_count);
+        if(asc_profile_enabled)
+            stream_profile_child(stream, i, block->ts, block->count, block);
+        else
+            stream_child_send_block(stream, i, block);
+        i = stream_child_next(stream, i, child);
+    }
+
+    block->is_shared = is_shared;
+    module_stream_trace_time = trace_time;
+}
+
+static void stream_profile_child(module_stream_t *stream, size_t i, const uint8_t *ts
+                                 , size_t count, module_stream_block_t *block)
+{
+    uint64_t start = 0;
+    module_stream_t *const child = stream->child_list[i].stream;
+    asc_profile_t *const profile = stream_profile_begin(child, count, &start);
+
+    if(block)
+        stream_child_send_block(stream, i, block);
+    else
+        stream_child_send_batch(stream, i, ts, count);
+
+    if(profile && i < stream->child_count && stream->child_list[i].stream == child)
+        stream_profile_end(stream, profile, start);
+}
+
+void __module_stream_set_block(module_stream_t *stream, stream_block_callback_t on_ts_block)
+{
+    stream->on_ts_block = on_ts_block;
+
+    module_stream_child_t *const item = stream_child_item(stream);
+    if(item && !stream->is_transparent)
+        item->on_ts_block = on_ts_block;
+}
+
+module_stream_block_t *module_stream_block_alloc(void)
+{
+    module_stream_block_t *block = block_pool.head;
+    if(block)
+    {
+        block_pool.head = block->next;
+        --block_pool.count;
+    }
+    else
+    {
+#ifdef WITH_MEMSTAT
+        if(!block_pool.memstat)
+            block_pool.memstat = asc_memstat_init("module_stream", "blocks");
+#endif
+        block = (module_stream_block_t *)asc_malloc(block_pool.memstat
+                                                    , sizeof(module_stream_block_t));
+        asc_assert(block != NULL, "[module_stream] failed to allocate block");
+    }
+
+    block->next = NULL;
+    block->refcount = 1;
+    block->is_shared = false;
+    block->ts = block->buffer;
+    block->count = 0;
+    block->trace_time = 0;
+
+    return block;
+}
+
+module_stream_block_t *module_stream_block_ref(module_stream_block_t *block)
+{
+    ++block->refcount;
+    return block;
+}
+
+module_stream_block_t *module_stream_block_writable(module_stream_block_t *block)
+{
+    if(block->refcount == 1 && !block->is_shared)
+        return block;
+
+    module_stream_block_t *const copy = module_stream_block_alloc();
+    memcpy(copy->buffer, block->ts, block->count * TS_PACKET_SIZE);
+    copy->count = block->count;
+    copy->trace_time = block->trace_time;
+
+    return copy;
+}
+
+uint8_t *module_stream_block_ts(module_stream_block_t *block)
+{
+    return &block->buffer[block->ts - block->buffer];
+}
+
+void module_stream_block_unref(module_stream_block_t *block)
+{
+    asc_assert(block->refcount > 0, "[module_stream] block double unref");
+
+    --block->refcount;
+    if(block->refcount > 0)
+        return;
+
+    if(block_pool.count >= BLOCK_POOL_SIZE)
+    {
+        asc_free(block);
+        return;
+    }
+
+    block->next = block_pool.head;
+    block_pool.head = block;
+    ++block_pool.count;
+}
+
+void module_stream_block_pool_destroy(void)
+{
+    while(block_pool.head)
     {
-        module_stream_t *i = (module_stream_t *)asc_list_data(stream->childs);
-        if(i->on_ts)
-            i->on_ts(i->self, ts);
+        module_stream_block_t *const next = block_pool.head->next;
+        asc_free(block_pool.head);
+        block_pool.head = next;
     }
+    block_pool.count = 0;
+
+    ASC_FREE(block_pool.memstat, asc_memstat_destroy);
 }
 
 void __module_stream_init(module_stream_t *stream)
 {
-    stream->childs = asc_list_init();
+    stream->child_list = NULL;
+    stream->child_count = 0;
+    stream->child_size = 0;
+    stream->is_routed = false;
+    stream->is_transparent = false;
+    stream->route = NULL;
+    stream->profile = NULL;
+    stream->metric_labels = NULL;
+    stream->metric_list = NULL;
+    stream->trace_hist = NULL;
+    stream->trace_last = 0;
+    stream->credit = NULL;
+    stream->on_credit = NULL;
+    stream->flow_timer = NULL;
+    stream->is_flow_stalled = false;
+    memset(&stream->stat, 0, sizeof(stream->stat));
+
+    stream->id = ++stream_graph.next_id;
+    stream->edge_packets = 0;
+    stream->edge_time = asc_loop_utime();
+    stream->edge_last = 0;
+    stream->edge_rate = 0;
+    TAILQ_INSERT_TAIL(&stream_graph.list, stream, graph_entries);
+}
+
+void __module_stream_profile(module_stream_t *stream)
+{
+    if(!module_lua_type || stream->profile)
+        return;
+
+    const char *name = NULL;
+    module_option_string("name", &name, NULL);
+    stream->profile = asc_profile_register(stream->self, module_lua_type, name);
+
+    if(name)
+        stream_metric_register(stream, name);
+}
+
+void __module_stream_metric(module_stream_t *stream, const char *family
+                            , asc_metric_type_t type, const char *help, const uint64_t *value)
+{
+    if(!stream->metric_labels)
+        return;
+
+    asc_metric_register(&stream->metric_list, asc_metric_family(family, type, help)
+                        , stream->metric_labels, value, 1);
 }
 
 void __module_stream_destroy(module_stream_t *stream)
@@ -61,13 +999,73 @@ void __module_stream_destroy(module_stream_t *stream)
     if(stream->parent)
         __module_stream_detach(stream->parent, stream);
 
-    asc_list_first(stream->childs);
-    while(!asc_list_eol(stream->childs))
+    /* the children of the transparent children stay with them */
+    while(stream->child_count > 0)
+    {
+        module_stream_t *child = stream->child_list[stream->child_count - 1].stream;
+        while(child->parent != stream)
+            child = child->parent;
+        __module_stream_detach(stream, child);
+    }
+
+    free(stream->child_list);
+    stream->child_list = NULL;
+    stream->child_count = 0;
+    stream->child_size = 0;
+
+    stream_route_destroy(stream);
+
+    stream->on_credit = NULL;
+    ASC_FREE(stream->flow_timer, asc_timer_destroy);
+
+    free(stream->stat.cc_list);
+    free(stream->stat.cc_error_list);
+    memset(&stream->stat, 0, sizeof(stream->stat));
+
+    asc_metric_unregister(&stream->metric_list);
+    free(stream->metric_labels);
+    stream->metric_labels = NULL;
+
+    if(stream->trace_hist)
+    {
+        if(stream->profile && stream->profile->latency == stream->trace_hist)
+            stream->profile->latency = NULL;
+        free(stream->trace_hist);
+        stream->trace_hist = NULL;
+    }
+
+    /* internal streams may share the profile of the module */
+    if(stream->profile && stream->profile->owner == stream->self)
+        asc_profile_unregister(stream->profile);
+    stream->profile = NULL;
+
+    if(stream->graph_entries.tqe_prev)
+    {
+        TAILQ_REMOVE(&stream_graph.list, stream, graph_entries);
+        stream->graph_entries.tqe_prev = NULL;
+    }
+}
+
+/*
+ * Graph introspection
+ */
+
+void module_stream_graph_foreach(void (*callback)(void *, module_stream_t *), void *arg)
+{
+    module_stream_t *stream;
+    TAILQ_FOREACH(stream, &stream_graph.list, graph_entries)
+        callback(arg, stream);
+}
+
+uint64_t module_stream_graph_rate(module_stream_t *stream)
+{
+    const uint64_t now = asc_loop_utime();
+    const uint64_t interval = now - stream->edge_time;
+    if(interval >= GRAPH_RATE_INTERVAL)
     {
-        module_stream_t *i = (module_stream_t *)asc_list_data(stream->childs);
-        i->parent = NULL;
-        asc_list_remove_current(stream->childs);
+        stream->edge_rate = (stream->edge_packets - stream->edge_last) * 1000000 / interval;
+        stream->edge_last = stream->edge_packets;
+        stream->edge_time = now;
     }
-    asc_list_destroy(stream->childs);
-    stream->childs = NULL;
+    return stream->edge_rate;
 }
@@ -26,21 +26,144 @@
 #include <core/asc.h>
 
 typedef struct module_stream_t module_stream_t;
+
+typedef void (*stream_callback_t)(module_data_t *mod, const uint8_t *ts);
+
+/* count packets of TS_PACKET_SIZE bytes, placed one after another */
+typedef void (*stream_batch_callback_t)(module_data_t *mod, const uint8_t *ts, size_t count);
+
+/*
+ * Shared block of packets. Producer allocates the block, fills it and sends
+ * with module_stream_send_block(). Consumer keeps module_stream_block_ref()
+ * instead of copy and releases it with module_stream_block_unref() when done.
+ * Packets in the block are read only, module_stream_block_writable() gives
+ * a block for the in-place changes.
+ */
+
+#define STREAM_BLOCK_SIZE 1472
+#define STREAM_BLOCK_COUNT (STREAM_BLOCK_SIZE / TS_PACKET_SIZE)
+#define STREAM_BLOCK_HEADROOM ASC_SOCKET_RECV_HEADROOM
+
+typedef struct module_stream_block_t module_stream_block_t;
+
+struct module_stream_block_t
+{
+    module_stream_block_t *next; // pool
+    size_t refcount;
+    bool is_shared; // the next children receive the same block
+
+    const uint8_t *ts; // pointer to the first packet in the buffer
+    size_t count;
+
+    uint64_t trace_time; // ingress time of the sampled block, see module_stream_trace()
+
+    /* receive metadata, the datagram goes to the buffer, see asc_socket_recv_provide() */
+    uint8_t headroom[STREAM_BLOCK_HEADROOM];
+    uint8_t buffer[STREAM_BLOCK_SIZE];
+};
+
+typedef void (*stream_block_callback_t)(module_data_t *mod, module_stream_block_t *block);
+
+/* returns the count of packets the sink accepts now, see module_stream_credit() */
+typedef size_t (*stream_credit_callback_t)(module_data_t *mod);
+
+#define STREAM_CREDIT_MAX ((size_t)-1)
+
+typedef struct
+{
+    stream_callback_t on_ts;
+    stream_batch_callback_t on_ts_batch;
+    stream_block_callback_t on_ts_block;
+    module_data_t *self;
+    module_stream_t *stream;
+    bool is_routed;
+} module_stream_child_t;
+
+/* routed children joined to the PID */
+typedef struct
+{
+    module_stream_t **child_list;
+    size_t child_count;
+} module_stream_route_t;
+
+/* counters of the packets sent by the stream, see module_stream:stream_stat() */
+typedef struct
+{
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t sc_packets;        // scrambled
+    uint64_t sync_errors;
+
+    uint8_t *cc_list;           // 0x10 | last CC by PID, allocated with the first packet
+    uint32_t *cc_error_list;    // CC errors by PID, allocated with the first error
+
+    // jitter of the first PCR PID against the arrival time
+    uint16_t pcr_pid;
+    uint64_t pcr_last;
+    uint64_t pcr_time;
+    uint64_t pcr_jitter_max;    // microseconds, reset on read
+
+    // flow control, see module_stream_credit()
+    uint64_t flow_waits;        // producer paused by the sinks
+    uint64_t flow_stalls;       // sink reported the full queue
+} module_stream_stat_t;
+
 struct module_stream_t
 {
     module_data_t *self;
     module_stream_t *parent;
 
     // stream
-    void (*on_ts)(module_data_t *mod, const uint8_t *ts);
+    stream_callback_t on_ts;
+    stream_batch_callback_t on_ts_batch;
+    stream_block_callback_t on_ts_block;
 
-    asc_list_t *childs;
+    // flat copy of the children for __module_stream_send()
+    module_stream_child_t *child_list;
+    size_t child_count;
+    size_t child_size;
 
     // demux
     void (*join_pid)(module_data_t *mod, uint16_t pid);
     void (*leave_pid)(module_data_t *mod, uint16_t pid);
 
-    uint8_t *pid_list;
+    // count of joins by PID, see mpegts_pid_map_t
+    struct mpegts_pid_map_t *pid_list;
+
+    // send only the joined PIDs to this child, see module_stream_demux_route()
+    bool is_routed;
+    // children receive the packets from the parent, see module_stream_set_transparent()
+    bool is_transparent;
+    // routed children by PID, allocated with the first routed child
+    module_stream_route_t *route;
+
+    module_stream_stat_t stat;
+
+    // module instance, see __module_stream_profile().
+    // internal streams of the module may keep the profile of the module stream
+    asc_profile_t *profile;
+
+    // series of the named module instance, see module_stream_metric()
+    char *metric_labels;
+    asc_metric_t *metric_list;
+
+    // latency of the sampled packets, allocated with the first one
+    asc_hist_t *trace_hist;
+    uint64_t trace_last;
+
+    // flow control: the queue of the sink, the producer waiting for the credit
+    stream_credit_callback_t credit;
+    void (*on_credit)(module_data_t *mod);
+    asc_timer_t *flow_timer;
+    bool is_flow_stalled;
+
+    // graph introspection, see module_stream_graph_foreach()
+    uint32_t id;
+    uint64_t edge_packets;      // passed to the stream by the parent or by the link
+    uint64_t edge_time;         // last rate sample
+    uint64_t edge_last;
+    uint64_t edge_rate;         // packets per second
+    TAILQ_ENTRY(module_stream_t) graph_entries;
 };
 
 #define MODULE_STREAM_DATA() module_stream_t __stream
@@ -51,12 +174,111 @@ void __module_stream_init(module_stream_t *stream);
 void __module_stream_destroy(module_stream_t *stream);
 void __module_stream_attach(module_stream_t *stream, module_stream_t *child);
 void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
+void __module_stream_send_batch(module_stream_t *stream, const uint8_t *ts, size_t count);
+void __module_stream_set_batch(module_stream_t *stream, stream_batch_callback_t on_ts_batch);
+void __module_stream_send_block(module_stream_t *stream, module_stream_block_t *block);
+void __module_stream_set_block(module_stream_t *stream, stream_block_callback_t on_ts_block);
+void __module_stream_set_transparent(module_stream_t *stream, bool is_transparent);
+
+/*
+ * registers the module instance in the profiler, and the stream counters
+ * in the metrics if the instance has the name option. called from module_init()
+ */
+void __module_stream_profile(module_stream_t *stream);
+/* adds the module counter with the labels of the stream counters */
+void __module_stream_metric(module_stream_t *stream, const char *family
+                            , asc_metric_type_t type, const char *help, const uint64_t *value);
+
+#define module_stream_metric(_mod, _family, _type, _help, _value)                               \
+    __module_stream_metric(&_mod->__stream, _family, _type, _help, _value)
+
+/*
+ * Latency tracing. The input sets trace_time of 1-in-N blocks to the ingress
+ * time, module_stream_send_block() keeps it in module_stream_trace_time while
+ * the block goes through the graph, so each module sending the packets in this
+ * call records the time since the ingress in its trace_hist, once per block.
+ * Modules holding the packets (the shift buffer, the output queue) save the
+ * stamp with the packet and restore it with module_stream_trace_set() when
+ * the packet is sent, or record the last hop with module_stream_trace().
+ */
+extern uint64_t module_stream_trace_time;
+
+/* returns the previous value */
+static inline uint64_t module_stream_trace_set(uint64_t time)
+{
+    const uint64_t prev = module_stream_trace_time;
+    module_stream_trace_time = time;
+    return prev;
+}
+
+/* records the time since the ingress, once for each stamp */
+void __module_stream_trace(module_stream_t *stream, uint64_t time);
+
+#define module_stream_trace(_mod, _time)                                                        \
+    __module_stream_trace(&_mod->__stream, _time)
+
+/*
+ * Flow control. A sink with the bounded queue sets the credit callback with
+ * module_stream_set_credit(). A producer that can wait (file playout, pushed
+ * HTTP ingest) sends no more than module_stream_credit(), the minimum of the
+ * sinks below it, and calls module_stream_wait() when it is limited. on_credit
+ * is called once, when a sink calls module_stream_credit_notify() after its
+ * queue is drained, or by the retry timer for the sinks drained by the other
+ * threads, on_credit is NULL if the producer polls on its own timer.
+ * Streams without sinks are not limited. Producers without flow control
+ * are not affected, the sinks still drop on overflow.
+ */
+size_t __module_stream_credit(module_stream_t *stream);
+void __module_stream_wait(module_stream_t *stream, void (*on_credit)(module_data_t *mod));
+void __module_stream_credit_notify(module_stream_t *stream);
+
+#define module_stream_set_credit(_mod, _credit)                                                 \
+    _mod->__stream.credit = _credit
+
+#define module_stream_credit(_mod)                                                              \
+    __module_stream_credit(&_mod->__stream)
+
+#define module_stream_wait(_mod, _on_credit)                                                    \
+    __module_stream_wait(&_mod->__stream, _on_credit)
+
+#define module_stream_credit_notify(_mod)                                                       \
+    __module_stream_credit_notify(&_mod->__stream)
+
+/*
+ * Stream graph. All streams of the process are listed in the order of
+ * the init. The edge is the stream and its parent: the edge counter is
+ * incremented by the count of the packets passed to the stream callback,
+ * once per batch. Children of the transparent stream are counted on
+ * the delivery from the link, the transparent stream itself receives nothing.
+ */
+void module_stream_graph_foreach(void (*callback)(void *, module_stream_t *), void *arg);
+/* packets per second of the edge, the rate is updated once a second */
+uint64_t module_stream_graph_rate(module_stream_t *stream);
+
+void __module_stream_set_route(module_stream_t *stream);
+int __module_stream_stat(module_stream_t *stream);
+void __module_stream_route_join(module_stream_t *stream, module_stream_t *child, uint16_t pid);
+void __module_stream_route_leave(module_stream_t *stream, module_stream_t *child, uint16_t pid);
+
+module_stream_block_t *module_stream_block_alloc(void) __wur;
+module_stream_block_t *module_stream_block_ref(module_stream_block_t *block);
+/*
+ * Returns the block itself if only the caller sees it (the block is not kept
+ * by anybody and is not sent to the next children), otherwise a copy.
+ * The copy is released by the caller, the block itself is not.
+ */
+module_stream_block_t *module_stream_block_writable(module_stream_block_t *block) __wur;
+/* writable pointer to the first packet of the block from module_stream_block_writable() */
+uint8_t *module_stream_block_ts(module_stream_block_t *block);
+void module_stream_block_unref(module_stream_block_t *block);
+void module_stream_block_pool_destroy(void);
 
 #define module_stream_init(_mod, _on_ts)                                                        \
     {                                                                                           \
         _mod->__stream.self = _mod;                                                             \
         _mod->__stream.on_ts = _on_ts;                                                          \
         __module_stream_init(&_mod->__stream);                                                  \
+        __module_stream_profile(&_mod->__stream);                                               \
         lua_getfield(lua, MODULE_OPTIONS_IDX, "upstream");                                      \
         if(lua_type(lua, -1) == LUA_TLIGHTUSERDATA)                                             \
         {                                                                                       \
@@ -68,7 +290,8 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
 
 #define module_stream_demux_set(_mod, _join_pid, _leave_pid)                                    \
     {                                                                                           \
-        _mod->__stream.pid_list = (uint8_t *)calloc(MAX_PID, sizeof(uint8_t));                  \
+        _mod->__stream.pid_list = (mpegts_pid_map_t *)malloc(sizeof(mpegts_pid_map_t));        \
+        mpegts_pid_map_init(_mod->__stream.pid_list, 0);                                        \
         _mod->__stream.join_pid = _join_pid;                                                    \
         _mod->__stream.leave_pid = _leave_pid;                                                  \
     }
@@ -79,13 +302,11 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
         {                                                                                       \
             if(_mod->__stream.pid_list)                                                         \
             {                                                                                   \
-                for(int __i = 0; __i < MAX_PID; ++__i)                                          \
+                MPEGTS_PID_MAP_FOREACH(_mod->__stream.pid_list, __i)                            \
                 {                                                                               \
-                    if(_mod->__stream.pid_list[__i])                                            \
-                    {                                                                           \
-                        module_stream_demux_leave_pid(_mod, __i);                               \
-                    }                                                                           \
+                    module_stream_demux_leave_pid(_mod, __i);                                   \
                 }                                                                               \
+                mpegts_pid_map_destroy(_mod->__stream.pid_list);                                \
                 free(_mod->__stream.pid_list);                                                  \
                 _mod->__stream.pid_list = NULL;                                                 \
             }                                                                                   \
@@ -97,22 +318,50 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
 #define module_stream_send(_mod, _ts)                                                           \
     __module_stream_send(&_mod->__stream, _ts)
 
+/* children without on_ts_batch receive the batch packet by packet */
+#define module_stream_send_batch(_mod, _ts, _count)                                             \
+    __module_stream_send_batch(&_mod->__stream, _ts, _count)
+
+#define module_stream_set_batch(_mod, _on_ts_batch)                                             \
+    __module_stream_set_batch(&_mod->__stream, _on_ts_batch)
+
+/* children without on_ts_block receive the block as a batch */
+#define module_stream_send_block(_mod, _block)                                                  \
+    __module_stream_send_block(&_mod->__stream, _block)
+
+#define module_stream_set_block(_mod, _on_ts_block)                                             \
+    __module_stream_set_block(&_mod->__stream, _on_ts_block)
+
+/*
+ * the module only forwards the packets: the children are attached to the upstream
+ * of the module directly, the module does not receive the packets and the stream
+ * counters of the module are not updated. module keeps the children and set_upstream()
+ */
+#define module_stream_set_transparent(_mod, _is_transparent)                                    \
+    __module_stream_set_transparent(&_mod->__stream, _is_transparent)
+
 // demux
 
+/* the parent sends to the module only the PIDs joined with module_stream_demux_join_pid() */
+#define module_stream_demux_route(_mod)                                                         \
+    __module_stream_set_route(&_mod->__stream)
+
 #define module_stream_demux_check_pid(_mod, _pid)                                               \
-    (_mod->__stream.pid_list[_pid] > 0)
+    mpegts_pid_map_has(_mod->__stream.pid_list, _pid)
 
 #define module_stream_demux_join_pid(_mod, _pid)                                                \
     {                                                                                           \
         const uint16_t __pid = _pid;                                                            \
         asc_assert(_mod->__stream.pid_list != NULL                                              \
                    , "%s:%d module_stream_demux_set() is required", __FILE__, __LINE__);        \
-        ++_mod->__stream.pid_list[__pid];                                                       \
-        if(_mod->__stream.pid_list[__pid] == 1                                                  \
-           && _mod->__stream.parent                                                             \
-           && _mod->__stream.parent->join_pid)                                                  \
+        const uintptr_t __count = mpegts_pid_map_get(_mod->__stream.pid_list, __pid) + 1;       \
+        mpegts_pid_map_set(_mod->__stream.pid_list, __pid, __count);                            \
+        if(__count == 1 && _mod->__stream.parent)                                               \
         {                                                                                       \
-            _mod->__stream.parent->join_pid(_mod->__stream.parent->self, __pid);                \
+            if(_mod->__stream.is_routed)                                                        \
+                __module_stream_route_join(_mod->__stream.parent, &_mod->__stream, __pid);      \
+            if(_mod->__stream.parent->join_pid)                                                 \
+                _mod->__stream.parent->join_pid(_mod->__stream.parent->self, __pid);            \
         }                                                                                       \
     }
 
@@ -121,14 +370,16 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
         const uint16_t __pid = _pid;                                                            \
         asc_assert(_mod->__stream.pid_list != NULL                                              \
                    , "%s:%d module_stream_demux_set() is required", __FILE__, __LINE__);        \
-        if(_mod->__stream.pid_list[__pid] > 0)                                                  \
+        const uintptr_t __count = mpegts_pid_map_get(_mod->__stream.pid_list, __pid);           \
+        if(__count > 0)                                                                         \
         {                                                                                       \
-            --_mod->__stream.pid_list[__pid];                                                   \
-            if(_mod->__stream.pid_list[__pid] == 0                                              \
-               && _mod->__stream.parent                                                         \
-               && _mod->__stream.parent->leave_pid)                                             \
+            mpegts_pid_map_set(_mod->__stream.pid_list, __pid, __count - 1);                    \
+            if(__count == 1 && _mod->__stream.parent)                                           \
             {                                                                                   \
-                _mod->__stream.parent->leave_pid(_mod->__stream.parent->self, __pid);           \
+                if(_mod->__stream.is_routed)                                                    \
+                    __module_stream_route_leave(_mod->__stream.parent, &_mod->__stream, __pid); \
+                if(_mod->__stream.parent->leave_pid)                                            \
+                    _mod->__stream.parent->leave_pid(_mod->__stream.parent->self, __pid);       \
             }                                                                                   \
         }                                                                                       \
         else                                                                                    \
@@ -145,9 +396,14 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
     {                                                                                           \
         lua_pushlightuserdata(lua, &mod->__stream);                                             \
         return 1;                                                                               \
+    }                                                                                           \
+    static int module_stream_stat(module_data_t *mod)                                           \
+    {                                                                                           \
+        return __module_stream_stat(&mod->__stream);                                            \
     }
 
 #define MODULE_STREAM_METHODS_REF()                                                             \
-    { "stream", module_stream_stream }
+    { "stream", module_stream_stream },                                                         \
+    { "stream_stat", module_stream_stat }
 
 #endif /* _MODULE_STREAM_H_ */
@@ -153,6 +153,61 @@ void sha1_final(sha1_ctx_t *context, uint8_t digest[SHA1_DIGEST_SIZE])
 #endif
 }
 
+#define SHA1_BLOCK_SIZE 64
+
+void hmac_sha1_init(hmac_sha1_t *hmac, const uint8_t *key, size_t size)
+{
+    uint8_t block[SHA1_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+
+    if(size > SHA1_BLOCK_SIZE)
+    {
+        sha1_ctx_t ctx;
+        sha1_init(&ctx);
+        sha1_update(&ctx, key, size);
+        sha1_final(&ctx, block);
+    }
+    else
+        memcpy(block, key, size);
+
+    uint8_t pad[SHA1_BLOCK_SIZE];
+
+    for(int i = 0; i < SHA1_BLOCK_SIZE; ++i)
+        pad[i] = block[i] ^ 0x36;
+    sha1_init(&hmac->inner);
+    sha1_update(&hmac->inner, pad, sizeof(pad));
+
+    for(int i = 0; i < SHA1_BLOCK_SIZE; ++i)
+        pad[i] = block[i] ^ 0x5C;
+    sha1_init(&hmac->outer);
+    sha1_update(&hmac->outer, pad, sizeof(pad));
+}
+
+void hmac_sha1(const hmac_sha1_t *hmac, const uint8_t *data, size_t size
+               , uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    uint8_t inner[SHA1_DIGEST_SIZE];
+    sha1_ctx_t ctx = hmac->inner;
+    sha1_update(&ctx, data, size);
+    sha1_final(&ctx, inner);
+
+    ctx = hmac->outer;
+    sha1_update(&ctx, inner, sizeof(inner));
+    sha1_final(&ctx, digest);
+}
+
+bool hmac_sha1_check(const hmac_sha1_t *hmac, const uint8_t *data, size_t size
+                     , const uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    uint8_t check[SHA1_DIGEST_SIZE];
+    hmac_sha1(hmac, data, size, check);
+
+    uint8_t diff = 0;
+    for(int i = 0; i < SHA1_DIGEST_SIZE; ++i)
+        diff |= check[i] ^ digest[i];
+    return (diff == 0);
+}
+
 static int lua_sha1(lua_State *L)
 {
     const char *data = luaL_checkstring(L, 1);
@@ -0,0 +1,634 @@
+/*
+ * Astra Module: Audio Monitor
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      audio_monitor
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name for the log and the metrics
+ *      pid         - number, PID of the audio stream
+ *      sample      - number, decode one PES of N, by default 4
+ *      silence     - number, momentary loudness in LUFS below that the audio
+ *                    is silent, by default -60
+ *      loud        - number, momentary loudness in LUFS above that the audio
+ *                    is too loud, by default -10
+ *
+ * The stream is passed as is. Sampled PES are decoded with libavcodec on the
+ * worker thread of the instance, the codec is detected by the first frame:
+ * MPEG audio, AAC ADTS or AC-3. The decoded audio is K-weighted and
+ * the momentary loudness (EBU R128, 400ms window) is measured on the decoded
+ * samples only, so with sample=4 the window covers about 1.6s of the stream.
+ * The worker cost is limited by the sample option and by the queue size, the
+ * PES are dropped if the worker is late.
+ *
+ * Metrics (see core/metrics.h), labels type="audio_monitor",name="...":
+ *      astra_audio_loudness_neg_lufs   - gauge, momentary loudness, -LUFS
+ *      astra_audio_silence             - gauge, 1 if the audio is silent
+ *      astra_audio_loud                - gauge, 1 if the audio is too loud
+ *      astra_audio_silence_total       - counter, silence events
+ *      astra_audio_loud_total          - counter, loud audio events
+ *      astra_audio_decoded_total       - counter, decoded PES
+ *      astra_audio_drops_total         - counter, PES dropped on the queue overflow
+ */
+
+#include <astra.h>
+#include <math.h>
+
+#include <libavcodec/avcodec.h>
+
+#define MSG(_msg) "[audio_monitor %s] " _msg, mod->name
+
+/* maximum size of the audio PES payload, larger PES are not sampled */
+#define MONITOR_ES_SIZE (64 * 1024)
+/* size of the queue to the worker */
+#define MONITOR_QUEUE_SIZE (256 * 1024)
+
+/* momentary loudness: 4 blocks of 100ms */
+#define MONITOR_BLOCK_COUNT 4
+#define MONITOR_CHANNELS 8
+
+/* loudness of the digital silence, reported as 0 LUFS is impossible */
+#define MONITOR_LOUDNESS_MIN -120.0
+
+/* queue item to the worker, followed by the ES payload */
+typedef struct
+{
+    uint32_t size;
+} monitor_item_t;
+
+/* queue item from the worker, one per 100ms block */
+typedef struct
+{
+    double loudness;
+} monitor_block_t;
+
+/* biquad, direct form II */
+typedef struct
+{
+    double b0, b1, b2;
+    double a1, a2;
+} monitor_filter_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    int pid;
+    int sample;
+    int silence;
+    int loud;
+
+    mpegts_pes_asm_t *pes;
+    int sample_skip;
+
+    // queue item to the worker
+    uint8_t *item;
+
+    bool is_thread_started;
+    asc_thread_t *thread;
+    asc_thread_buffer_t *thread_input; // sampled ES
+    asc_thread_buffer_t *thread_output; // loudness of the blocks
+
+    // metrics, updated on the main thread
+    asc_metric_t *metric_list;
+    uint64_t loudness;
+    uint64_t is_silence;
+    uint64_t is_loud;
+    uint64_t silence_count;
+    uint64_t loud_count;
+    uint64_t decoded;
+    uint64_t drops;
+
+    // used by the worker thread only
+    struct
+    {
+        AVCodec *decoder;
+        AVCodecContext *ctx;
+        AVCodecParserContext *parser;
+        AVFrame *frame;
+        AVPacket avpkt;
+        bool is_error;
+
+        uint8_t es[MONITOR_ES_SIZE + FF_INPUT_BUFFER_PADDING_SIZE];
+
+        // K-weighting, pre-filter and RLB filter of each channel
+        int sample_rate;
+        monitor_filter_t filter[2];
+        double state[MONITOR_CHANNELS][2][2];
+
+        // mean square sum of the current block and the last blocks
+        double block_sum;
+        int block_samples;
+        int block_size;
+        double block[MONITOR_BLOCK_COUNT];
+        int block_count;
+        int block_id;
+    } worker;
+};
+
+/*
+ * oooo   oooo       oooo     oooo ooooooooooo ooooo   ooooooo8 ooooo ooooo ooooooooooo
+ *  888  o88          88   88  88   888    88   888  o888    88  888   888  88  888  88
+ *  888888    ooooooo  88 888 88    888ooo8     888  888    oooo 888ooo888      888
+ *  888  88o            888 888     888    oo   888  888o    88  888   888      888
+ * o888o o888o           8   8     o888ooo8888 o888o  888ooo888 o888o o888o    o888o
+ *
+ */
+
+/* ITU-R BS.1770, the coefficients for the sample rate */
+static void filter_init(module_data_t *mod, int sample_rate)
+{
+    monitor_filter_t *const shelf = &mod->worker.filter[0];
+    monitor_filter_t *const highpass = &mod->worker.filter[1];
+
+    double f0 = 1681.974450955533;
+    double q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / sample_rate);
+    const double vh = pow(10.0, 3.999843853973347 / 20.0);
+    const double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+
+    shelf->b0 = (vh + vb * k / q + k * k) / a0;
+    shelf->b1 = 2.0 * (k * k - vh) / a0;
+    shelf->b2 = (vh - vb * k / q + k * k) / a0;
+    shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf->a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + k / q + k * k;
+
+    highpass->b0 = 1.0;
+    highpass->b1 = -2.0;
+    highpass->b2 = 1.0;
+    highpass->a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass->a2 = (1.0 - k / q + k * k) / a0;
+
+    memset(mod->worker.state, 0, sizeof(mod->worker.state));
+
+    mod->worker.sample_rate = sample_rate;
+    mod->worker.block_size = sample_rate / 10;
+    mod->worker.block_sum = 0.0;
+    mod->worker.block_samples = 0;
+    mod->worker.block_count = 0;
+    mod->worker.block_id = 0;
+}
+
+static inline double filter_run(const monitor_filter_t *f, double *state, double x)
+{
+    const double w = x - f->a1 * state[0] - f->a2 * state[1];
+    const double y = f->b0 * w + f->b1 * state[0] + f->b2 * state[1];
+    state[1] = state[0];
+    state[0] = w;
+    return y;
+}
+
+/* sample of the channel as -1.0 .. 1.0 */
+static inline double frame_sample(const AVFrame *frame, int format, int channels, int ch, int i)
+{
+    switch(format)
+    {
+        case AV_SAMPLE_FMT_S16:
+            return ((const int16_t *)frame->data[0])[i * channels + ch] / 32768.0;
+        case AV_SAMPLE_FMT_S16P:
+            return ((const int16_t *)frame->extended_data[ch])[i] / 32768.0;
+        case AV_SAMPLE_FMT_S32:
+            return ((const int32_t *)frame->data[0])[i * channels + ch] / 2147483648.0;
+        case AV_SAMPLE_FMT_S32P:
+            return ((const int32_t *)frame->extended_data[ch])[i] / 2147483648.0;
+        case AV_SAMPLE_FMT_FLT:
+            return ((const float *)frame->data[0])[i * channels + ch];
+        case AV_SAMPLE_FMT_FLTP:
+            return ((const float *)frame->extended_data[ch])[i];
+        default:
+            return 0.0;
+    }
+}
+
+/* channel weight, the LFE channel of 5.1 is skipped, surround channels +1.5dB */
+static inline double channel_weight(int channels, int ch)
+{
+    if(channels < 5 || ch < 3)
+        return 1.0;
+    if(channels == 6 && ch == 3)
+        return 0.0;
+    return 1.41;
+}
+
+static void block_complete(module_data_t *mod)
+{
+    mod->worker.block[mod->worker.block_id] = mod->worker.block_sum
+                                            / mod->worker.block_samples;
+    mod->worker.block_id = (mod->worker.block_id + 1) % MONITOR_BLOCK_COUNT;
+    if(mod->worker.block_count < MONITOR_BLOCK_COUNT)
+        ++mod->worker.block_count;
+
+    mod->worker.block_sum = 0.0;
+    mod->worker.block_samples = 0;
+
+    if(mod->worker.block_count < MONITOR_BLOCK_COUNT)
+        return;
+
+    double power = 0.0;
+    for(int i = 0; i < MONITOR_BLOCK_COUNT; ++i)
+        power += mod->worker.block[i];
+    power /= MONITOR_BLOCK_COUNT;
+
+    monitor_block_t block;
+    block.loudness = (power > 0.0) ? -0.691 + 10.0 * log10(power) : MONITOR_LOUDNESS_MIN;
+    if(block.loudness < MONITOR_LOUDNESS_MIN)
+        block.loudness = MONITOR_LOUDNESS_MIN;
+
+    asc_thread_buffer_write(mod->thread_output, &block, sizeof(block));
+}
+
+static void measure_frame(module_data_t *mod)
+{
+    const AVCodecContext *const ctx = mod->worker.ctx;
+    const AVFrame *const frame = mod->worker.frame;
+
+    if(ctx->sample_rate <= 0)
+        return;
+    if(ctx->sample_rate != mod->worker.sample_rate)
+        filter_init(mod, ctx->sample_rate);
+
+    const int channels = (ctx->channels < MONITOR_CHANNELS) ? ctx->channels : MONITOR_CHANNELS;
+
+    for(int i = 0; i < frame->nb_samples; ++i)
+    {
+        double sum = 0.0;
+        for(int ch = 0; ch < channels; ++ch)
+        {
+            const double weight = channel_weight(channels, ch);
+            if(weight == 0.0)
+                continue;
+
+            double x = frame_sample(frame, ctx->sample_fmt, ctx->channels, ch, i);
+            x = filter_run(&mod->worker.filter[0], mod->worker.state[ch][0], x);
+            x = filter_run(&mod->worker.filter[1], mod->worker.state[ch][1], x);
+            sum += weight * x * x;
+        }
+
+        mod->worker.block_sum += sum;
+        ++mod->worker.block_samples;
+        if(mod->worker.block_samples >= mod->worker.block_size)
+            block_complete(mod);
+    }
+}
+
+static bool decoder_open(module_data_t *mod, const uint8_t *es, size_t size)
+{
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+
+    for(size_t i = 0; i + 1 < size && codec_id == AV_CODEC_ID_NONE; ++i)
+    {
+        if(es[i] == 0xFF && (es[i + 1] & 0xF0) == 0xF0)
+        {
+            const uint8_t layer = (es[i + 1] & 0x06) >> 1;
+            codec_id = (layer == 0) ? AV_CODEC_ID_AAC
+                     : (layer == 1) ? AV_CODEC_ID_MP3
+                     : (layer == 2) ? AV_CODEC_ID_MP2
+                     : AV_CODEC_ID_MP1;
+        }
+        else if(es[i] == 0x0B && es[i + 1] == 0x77)
+            codec_id = AV_CODEC_ID_AC3;
+    }
+
+    if(codec_id == AV_CODEC_ID_NONE)
+        return false;
+
+    mod->worker.decoder = avcodec_find_decoder(codec_id);
+    if(!mod->worker.decoder)
+    {
+        asc_log_error(MSG("audio decoder is not found"));
+        mod->worker.is_error = true;
+        return false;
+    }
+
+    mod->worker.ctx = avcodec_alloc_context3(mod->worker.decoder);
+    mod->worker.parser = av_parser_init(codec_id);
+    if(!mod->worker.parser
+       || avcodec_open2(mod->worker.ctx, mod->worker.decoder, NULL) < 0)
+    {
+        asc_log_error(MSG("failed to open audio decoder"));
+        mod->worker.decoder = NULL;
+        mod->worker.is_error = true;
+        return false;
+    }
+
+    mod->worker.frame = avcodec_alloc_frame();
+    return true;
+}
+
+static void decode_es(module_data_t *mod, size_t size)
+{
+    const uint8_t *data = mod->worker.es;
+    memset(&mod->worker.es[size], 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    if(!mod->worker.decoder && !decoder_open(mod, data, size))
+        return;
+
+    while(size > 0)
+    {
+        uint8_t *out = NULL;
+        int out_size = 0;
+        const int len = av_parser_parse2(mod->worker.parser, mod->worker.ctx
+                                         , &out, &out_size, data, size
+                                         , AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if(len < 0)
+            break;
+        data += len;
+        size -= len;
+
+        if(!out_size)
+            continue;
+
+        av_init_packet(&mod->worker.avpkt);
+        mod->worker.avpkt.data = out;
+        mod->worker.avpkt.size = out_size;
+
+        avcodec_get_frame_defaults(mod->worker.frame);
+        int got_frame = 0;
+        if(avcodec_decode_audio4(mod->worker.ctx, mod->worker.frame, &got_frame
+                                 , &mod->worker.avpkt) < 0)
+        {
+            continue;
+        }
+        if(got_frame)
+            measure_frame(mod);
+    }
+}
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_thread_started = true;
+
+    while(mod->is_thread_started)
+    {
+        /* the item is written at once, the ES follows the header */
+        monitor_item_t item;
+        if(asc_thread_buffer_read(mod->thread_input, &item, sizeof(item)) != sizeof(item))
+        {
+            asc_usleep(1000);
+            continue;
+        }
+
+        if(asc_thread_buffer_read(mod->thread_input, mod->worker.es, item.size)
+           != (ssize_t)item.size)
+        {
+            continue;
+        }
+
+        if(!mod->worker.is_error)
+            decode_es(mod, item.size);
+    }
+}
+
+/*
+ * oooo     oooo      o      ooooo oooo   oooo
+ *  8888o   888      888      888   8888o  88
+ *  88 888o8 88     8  88     888   88 888o88
+ *  88  888  88    8oooo88    888   88   8888
+ * o88o  8  o88o o88o  o888o o888o o88o    88
+ *
+ */
+
+static void on_thread_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    monitor_block_t block;
+    if(asc_thread_buffer_read(mod->thread_output, &block, sizeof(block)) != sizeof(block))
+        return;
+
+    mod->loudness = (uint64_t)(-block.loudness + 0.5);
+
+    const bool is_silence = (block.loudness < mod->silence);
+    if(is_silence != (mod->is_silence != 0))
+    {
+        mod->is_silence = is_silence;
+        if(is_silence)
+        {
+            ++mod->silence_count;
+            asc_log_warning(MSG("silence: %.1f LUFS"), block.loudness);
+        }
+        else
+            asc_log_info(MSG("audio restored: %.1f LUFS"), block.loudness);
+    }
+
+    const bool is_loud = (block.loudness > mod->loud);
+    if(is_loud != (mod->is_loud != 0))
+    {
+        mod->is_loud = is_loud;
+        if(is_loud)
+        {
+            ++mod->loud_count;
+            asc_log_warning(MSG("loud audio: %.1f LUFS"), block.loudness);
+        }
+    }
+}
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_thread_started = false;
+
+    ASC_FREE(mod->thread, asc_thread_destroy);
+    ASC_FREE(mod->thread_input, asc_thread_buffer_destroy);
+    ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
+}
+
+/* skipped PES are not copied, the view of the assembler ring is released */
+static void on_pes(void *arg, const mpegts_pes_view_t *view)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->sample_skip > 0)
+    {
+        --mod->sample_skip;
+        return;
+    }
+    mod->sample_skip = mod->sample - 1;
+
+    const uint8_t *const header = view->buffer;
+    if(view->buffer_size < PES_HEADER_SIZE + 3 || header[0] != 0x00 || header[1] != 0x00
+       || header[2] != 0x01)
+    {
+        return;
+    }
+
+    const uint32_t skip = PES_HEADER_SIZE + 3 + header[8];
+    if(skip >= view->buffer_size || view->buffer_size - skip > MONITOR_ES_SIZE)
+        return;
+
+    monitor_item_t *const item = (monitor_item_t *)mod->item;
+    item->size = view->buffer_size - skip;
+
+    /* payload of the view, one or two parts of the ring */
+    uint8_t *dst = &mod->item[sizeof(monitor_item_t)];
+    uint32_t offset = skip;
+    for(int i = 0; i < 2; ++i)
+    {
+        if(offset >= view->size[i])
+        {
+            offset -= view->size[i];
+            continue;
+        }
+        const uint32_t size = view->size[i] - offset;
+        memcpy(dst, &view->data[i][offset], size);
+        dst += size;
+        offset = 0;
+    }
+
+    const size_t item_size = sizeof(monitor_item_t) + item->size;
+    if(asc_thread_buffer_write(mod->thread_input, mod->item, item_size) != (ssize_t)item_size)
+        ++mod->drops;
+    else
+        ++mod->decoded;
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    module_stream_send(mod, ts);
+
+    if(TS_GET_PID(ts) == mod->pid)
+        mpegts_pes_asm_mux(mod->pes, ts, on_pes, mod);
+}
+
+/* required */
+
+static void metric_init(module_data_t *mod)
+{
+    char labels[512];
+    asc_metric_labels(labels, sizeof(labels), "audio_monitor", mod->name);
+
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_loudness_neg_lufs", ASC_METRIC_GAUGE
+                                            , "Momentary loudness, negated LUFS")
+                        , labels, &mod->loudness, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_silence", ASC_METRIC_GAUGE
+                                            , "Audio is silent")
+                        , labels, &mod->is_silence, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_loud", ASC_METRIC_GAUGE
+                                            , "Audio is too loud")
+                        , labels, &mod->is_loud, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_silence_total", ASC_METRIC_COUNTER
+                                            , "Silence events")
+                        , labels, &mod->silence_count, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_loud_total", ASC_METRIC_COUNTER
+                                            , "Loud audio events")
+                        , labels, &mod->loud_count, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_decoded_total", ASC_METRIC_COUNTER
+                                            , "Sampled PES queued to the decoder")
+                        , labels, &mod->decoded, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_audio_drops_total", ASC_METRIC_COUNTER
+                                            , "Sampled PES dropped on the queue overflow")
+                        , labels, &mod->drops, 1);
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, on_ts);
+
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[audio_monitor] option 'name' is required");
+
+    if(!module_option_number("pid", &mod->pid) || mod->pid <= 0 || mod->pid >= NULL_TS_PID)
+    {
+        asc_log_error(MSG("option 'pid' is required"));
+        astra_abort();
+    }
+
+    mod->sample = 4;
+    module_option_number("sample", &mod->sample);
+    if(mod->sample < 1)
+        mod->sample = 1;
+
+    mod->silence = -60;
+    module_option_number("silence", &mod->silence);
+    mod->loud = -10;
+    module_option_number("loud", &mod->loud);
+
+    /* codecs are registered once for all instances */
+    static bool is_codec_init = false;
+    if(!is_codec_init)
+    {
+        is_codec_init = true;
+        avcodec_register_all();
+    }
+
+    mod->pes = mpegts_pes_asm_init(mod->pid);
+    mod->item = (uint8_t *)malloc(sizeof(monitor_item_t) + MONITOR_ES_SIZE);
+    mod->loudness = (uint64_t)(-MONITOR_LOUDNESS_MIN);
+
+    metric_init(mod);
+
+    mod->thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->thread, "audio_monitor");
+    mod->thread_input = asc_thread_buffer_init(MONITOR_QUEUE_SIZE);
+    mod->thread_output = asc_thread_buffer_init(MONITOR_QUEUE_SIZE);
+    asc_thread_start(  mod->thread
+                     , thread_loop
+                     , on_thread_read, mod->thread_output
+                     , on_thread_close);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    asc_metric_unregister(&mod->metric_list);
+
+    module_stream_destroy(mod);
+
+    /* the worker is stopped before its codec context is released */
+    if(mod->thread)
+        on_thread_close(mod);
+
+    if(mod->worker.parser)
+        av_parser_close(mod->worker.parser);
+    if(mod->worker.ctx)
+        avcodec_close(mod->worker.ctx);
+    if(mod->worker.frame)
+        avcodec_free_frame(&mod->worker.frame);
+
+    ASC_FREE(mod->item, free);
+    ASC_FREE(mod->pes, mpegts_pes_asm_destroy);
+}
+
+MODULE_STREAM_METHODS()
+
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF()
+};
+
+MODULE_LUA_REGISTER(audio_monitor)
@@ -18,9 +18,35 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      biss_encrypt
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      key         - string, BISS key, 16 chars length
+ *      threads     - number, encrypt on the job pool of the process (core/job.h),
+ *                    minimal size of the pool. default: 0 - on the main thread
+ */
+
 #include <astra.h>
 #include <dvbcsa/dvbcsa.h>
 
+/*
+ * Batch is collected in one storage while the previous is encrypting
+ * on the worker threads and the one before is sending.
+ */
+#define BISS_STORAGE_COUNT 3
+
+typedef struct
+{
+    asc_job_t job;
+
+    struct dvbcsa_bs_key_s *key;
+    uint8_t *buffer;
+    struct dvbcsa_bs_batch_s *batch;
+} biss_storage_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -36,40 +62,76 @@ struct module_data_t
     size_t storage_skip;
 
     int batch_skip;
-    uint8_t *batch_storage_recv;
-    uint8_t *batch_storage_send;
-    struct dvbcsa_bs_batch_s *batch;
+    biss_storage_t storage[BISS_STORAGE_COUNT];
+    biss_storage_t *storage_recv;
+    biss_storage_t *storage_job;  // in progress on the worker threads
+    biss_storage_t *storage_send;
+
+    bool is_threads;
 };
 
+static void on_encrypt_job(asc_job_t *job)
+{
+    biss_storage_t *storage = (biss_storage_t *)job->arg;
+    dvbcsa_bs_encrypt(storage->key, storage->batch, 184);
+}
+
+static biss_storage_t * storage_next(module_data_t *mod)
+{
+    for(int i = 0; i < BISS_STORAGE_COUNT; ++i)
+    {
+        biss_storage_t *storage = &mod->storage[i];
+        if(storage != mod->storage_job && storage != mod->storage_send)
+            return storage;
+    }
+
+    asc_assert(0, "[biss_encrypt] storage is not found");
+    return NULL;
+}
+
 static void process_ts(module_data_t *mod, const uint8_t *ts, uint8_t hdr_size)
 {
-    uint8_t *dst = &mod->batch_storage_recv[mod->storage_skip];
+    biss_storage_t *recv = mod->storage_recv;
+
+    uint8_t *dst = &recv->buffer[mod->storage_skip];
     memcpy(dst, ts, TS_PACKET_SIZE);
 
     if(hdr_size)
     {
         dst[3] |= 0x80;
-        mod->batch[mod->batch_skip].data = &dst[hdr_size];
-        mod->batch[mod->batch_skip].len = TS_PACKET_SIZE - hdr_size;
+        recv->batch[mod->batch_skip].data = &dst[hdr_size];
+        recv->batch[mod->batch_skip].len = TS_PACKET_SIZE - hdr_size;
         ++mod->batch_skip;
     }
 
-    if(mod->batch_storage_send)
-        module_stream_send(mod, &mod->batch_storage_send[mod->storage_skip]);
+    if(mod->storage_send)
+        module_stream_send(mod, &mod->storage_send->buffer[mod->storage_skip]);
 
     mod->storage_skip += TS_PACKET_SIZE;
 
     if(mod->storage_skip >= mod->storage_size)
     {
-        mod->batch[mod->batch_skip].data = NULL;
-        dvbcsa_bs_encrypt(mod->key, mod->batch, 184);
-        uint8_t *storage_tmp = mod->batch_storage_send;
-        mod->batch_storage_send = mod->batch_storage_recv;
-        if(!storage_tmp)
-            storage_tmp = malloc(mod->storage_size);
-        mod->batch_storage_recv = storage_tmp;
+        recv->batch[mod->batch_skip].data = NULL;
         mod->batch_skip = 0;
         mod->storage_skip = 0;
+
+        biss_storage_t *ready;
+        if(mod->is_threads)
+        {
+            ready = mod->storage_job;
+            if(ready)
+                asc_job_wait(&ready->job);
+            asc_job_submit(&recv->job, NULL);
+            mod->storage_job = recv;
+        }
+        else
+        {
+            dvbcsa_bs_encrypt(mod->key, recv->batch, 184);
+            ready = recv;
+        }
+
+        mod->storage_send = ready;
+        mod->storage_recv = storage_next(mod);
     }
 }
 
@@ -168,14 +230,27 @@ static void module_init(module_data_t *mod)
     key[3] = (key[0] + key[1] + key[2]) & 0xFF;
     key[7] = (key[4] + key[5] + key[6]) & 0xFF;
 
-    const int batch_size = dvbcsa_bs_batch_size();
-    mod->batch = calloc(batch_size + 1, sizeof(struct dvbcsa_bs_batch_s));
-    mod->storage_size = batch_size * TS_PACKET_SIZE;
-    mod->batch_storage_recv = malloc(mod->storage_size);
-
     mod->key = dvbcsa_bs_key_alloc();
     dvbcsa_bs_key_set(key, mod->key);
 
+    int threads = 0;
+    module_option_number("threads", &threads);
+    if(threads > 0)
+        mod->is_threads = asc_job_attach(threads);
+
+    const int batch_size = dvbcsa_bs_batch_size();
+    mod->storage_size = batch_size * TS_PACKET_SIZE;
+    for(int i = 0; i < BISS_STORAGE_COUNT; ++i)
+    {
+        biss_storage_t *storage = &mod->storage[i];
+        storage->job.run = on_encrypt_job;
+        storage->job.arg = storage;
+        storage->key = mod->key;
+        storage->buffer = malloc(mod->storage_size);
+        storage->batch = calloc(batch_size + 1, sizeof(struct dvbcsa_bs_batch_s));
+    }
+    mod->storage_recv = &mod->storage[0];
+
     mod->stream[0x00] = MPEGTS_PACKET_PAT;
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
     mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, 0);
@@ -185,6 +260,19 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
+    if(mod->is_threads)
+    {
+        if(mod->storage_job)
+            asc_job_wait(&mod->storage_job->job);
+        asc_job_detach();
+    }
+
+    for(int i = 0; i < BISS_STORAGE_COUNT; ++i)
+    {
+        free(mod->storage[i].buffer);
+        free(mod->storage[i].batch);
+    }
+
     dvbcsa_bs_key_free(mod->key);
 
     mpegts_psi_destroy(mod->pat);
@@ -3,5 +3,10 @@ if [ $LIBDVBCSA -ne 1 ] ; then
     ERROR="libdvbcsa is not found. use --with-libdvbcsa option"
 fi
 
+# worker threads are in the softcam module
+if ! echo "$APP_MODULES_LIST" | grep -q "softcam" ; then
+    ERROR="softcam module is required"
+fi
+
 SOURCES="biss_encrypt.c"
 MODULES="biss_encrypt"
@@ -28,6 +28,12 @@
 
 #define BUFFER_SIZE (1022 * TS_PACKET_SIZE)
 
+/* the decrypted stream is read from the sec device by blocks of SEC_READ_SIZE */
+#define SEC_READ_SIZE (64 * TS_PACKET_SIZE)
+
+/* headers are decoded by blocks of HEADER_BATCH_SIZE packets */
+#define HEADER_BATCH_SIZE 64
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -45,6 +51,11 @@ struct module_data_t
     /* */
     int enc_sec_fd;
 
+    // packets are not accepted by the sec device yet, see sec_write()
+    uint8_t *enc_buffer;
+    size_t enc_buffer_size;
+    size_t enc_buffer_skip;
+
     /* */
     int dec_sec_fd;
 
@@ -93,33 +104,66 @@ static void on_thread_read(void *arg)
 {
     module_data_t *mod = arg;
 
-    uint8_t ts[TS_PACKET_SIZE];
-    const ssize_t r = asc_thread_buffer_read(mod->sec_thread_output, ts, sizeof(ts));
-    if(r == sizeof(ts))
-        module_stream_send(mod, ts);
+    // BUFFER_SIZE is aligned to the packet size, packets are not wrapped
+    size_t size = TS_PACKET_SIZE;
+    const uint8_t *ptr = asc_thread_buffer_peek(mod->sec_thread_output, &size);
+    const size_t count = size / TS_PACKET_SIZE;
+    if(count == 0)
+        return;
+
+    module_stream_send_batch(mod, ptr, count);
+    if(!asc_thread_buffer_consume(mod->sec_thread_output, count * TS_PACKET_SIZE))
+        asc_log_debug(MSG("thread buffer flushed"));
+}
+
+static void thread_output(module_data_t *mod, const uint8_t *ts, size_t size)
+{
+    if(asc_thread_buffer_write(mod->sec_thread_output, ts, size) != (ssize_t)size)
+    {
+        ; // overflow
+    }
 }
 
 static void thread_loop(void *arg)
 {
     module_data_t *mod = arg;
-    uint8_t ts[TS_PACKET_SIZE];
+
+    uint8_t buffer[SEC_READ_SIZE];
+    size_t buffer_skip = 0;
 
     mod->dec_sec_fd = open(mod->dev_name, O_RDONLY);
 
     while(1)
     {
-        const ssize_t len = read(mod->dec_sec_fd, ts, sizeof(ts));
+        const ssize_t len = read(mod->dec_sec_fd
+                                 , &buffer[buffer_skip], sizeof(buffer) - buffer_skip);
         if(len == -1)
             break;
 
-        if(len == sizeof(ts) && ts[0] == 0x47)
+        // sends the synced packets by runs, skips the garbage to the next sync byte
+        const size_t size = buffer_skip + len;
+        size_t run = 0;
+        size_t i = 0;
+        while(i + TS_PACKET_SIZE <= size)
         {
-            const ssize_t r = asc_thread_buffer_write(mod->sec_thread_output, ts, sizeof(ts));
-            if(r != TS_PACKET_SIZE)
+            if(buffer[i] == 0x47)
             {
-                // overflow
+                i += TS_PACKET_SIZE;
+                continue;
             }
+
+            if(i > run)
+                thread_output(mod, &buffer[run], i - run);
+            ++i;
+            run = i;
         }
+        if(i > run)
+            thread_output(mod, &buffer[run], i - run);
+
+        // incomplete packet is moved to the begin of the buffer
+        buffer_skip = size - i;
+        if(buffer_skip > 0)
+            memmove(buffer, &buffer[i], buffer_skip);
     }
 }
 
@@ -132,7 +176,12 @@ static void sec_open(module_data_t *mod)
         astra_abort();
     }
 
+    mod->enc_buffer = malloc(BUFFER_SIZE);
+    mod->enc_buffer_size = 0;
+    mod->enc_buffer_skip = 0;
+
     mod->sec_thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->sec_thread, "ddci_sec");
     mod->sec_thread_output = asc_thread_buffer_init(BUFFER_SIZE);
     asc_thread_start(mod->sec_thread,
         thread_loop, on_thread_read, mod->sec_thread_output, on_thread_close);
@@ -146,6 +195,8 @@ static void sec_close(module_data_t *mod)
         mod->enc_sec_fd = 0;
     }
 
+    ASC_FREE(mod->enc_buffer, free);
+
     if(mod->sec_thread)
         on_thread_close(mod);
 }
@@ -229,13 +280,86 @@ static void ca_thread_loop(void *arg)
  *
  */
 
-static void on_ts(module_data_t *mod, const uint8_t *ts)
+/* returns the number of bytes written, the rest is kept by the caller */
+static size_t sec_write(module_data_t *mod, const uint8_t *ts, size_t size)
+{
+    const ssize_t len = write(mod->enc_sec_fd, ts, size);
+    if(len >= 0)
+        return (size_t)len;
+
+    if(errno != EAGAIN)
+        asc_log_error(MSG("sec write failed [%s]"), strerror(errno));
+    return 0;
+}
+
+/*
+ * The batch goes to the sec device with one write() without a copy.
+ * Only the tail that is not accepted by the device is kept in enc_buffer
+ * and written before the next batch.
+ */
+static void sec_send(module_data_t *mod, const uint8_t *ts, size_t size)
+{
+    if(mod->enc_buffer_size > 0)
+    {
+        const size_t len = sec_write(mod
+                                     , &mod->enc_buffer[mod->enc_buffer_skip]
+                                     , mod->enc_buffer_size);
+        mod->enc_buffer_skip += len;
+        mod->enc_buffer_size -= len;
+
+        if(mod->enc_buffer_size > 0)
+        {
+            if(mod->enc_buffer_skip + mod->enc_buffer_size + size > BUFFER_SIZE)
+            {
+                memmove(mod->enc_buffer
+                        , &mod->enc_buffer[mod->enc_buffer_skip], mod->enc_buffer_size);
+                mod->enc_buffer_skip = 0;
+            }
+            if(mod->enc_buffer_size + size > BUFFER_SIZE)
+            {
+                asc_log_error(MSG("sec write overflow, drop %zu packets")
+                              , size / TS_PACKET_SIZE);
+                return;
+            }
+            memcpy(&mod->enc_buffer[mod->enc_buffer_skip + mod->enc_buffer_size], ts, size);
+            mod->enc_buffer_size += size;
+            return;
+        }
+
+        mod->enc_buffer_skip = 0;
+    }
+
+    const size_t len = sec_write(mod, ts, size);
+    if(len < size)
+    {
+        memcpy(mod->enc_buffer, &ts[len], size - len);
+        mod->enc_buffer_size = size - len;
+    }
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
 {
     if(mod->ca->ca_fd > 0)
-        ca_on_ts(mod->ca, ts);
+    {
+        uint16_t pid[HEADER_BATCH_SIZE];
+        uint8_t cc[HEADER_BATCH_SIZE];
+        uint8_t flags[HEADER_BATCH_SIZE];
 
-    if(write(mod->enc_sec_fd, ts, TS_PACKET_SIZE) != TS_PACKET_SIZE)
-        asc_log_error(MSG("sec write failed"));
+        for(size_t i = 0; i < count; i += HEADER_BATCH_SIZE)
+        {
+            const size_t n = (count - i > HEADER_BATCH_SIZE) ? HEADER_BATCH_SIZE : count - i;
+            const uint8_t *ptr = &ts[i * TS_PACKET_SIZE];
+            mpegts_ts_headers(ptr, n, pid, cc, flags);
+            ca_on_ts_batch(mod->ca, ptr, pid, n);
+        }
+    }
+
+    sec_send(mod, ts, count * TS_PACKET_SIZE);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    on_ts_batch(mod, ts, 1);
 }
 
 static void join_pid(module_data_t *mod, uint16_t pid)
@@ -262,6 +386,7 @@ static int method_ca_set_pnr(module_data_t *mod)
 static void module_init(module_data_t *mod)
 {
     module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
     module_stream_demux_set(mod, join_pid, leave_pid);
 
     mod->ca = calloc(1, sizeof(dvb_ca_t));
@@ -294,6 +419,7 @@ static void module_init(module_data_t *mod)
     }
 
     mod->ca_thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->ca_thread, "ddci_ca");
     asc_thread_start(mod->ca_thread, ca_thread_loop, NULL, NULL, on_ca_thread_close);
 
     sec_open(mod);
@@ -28,11 +28,33 @@
 #include "dvb.h"
 #include <linux/dvb/net.h>
 
-static int count;
-static char dev_name[512];
+#include <pthread.h>
+
+/*
+ * The devices are listed first and probed at once, one thread for each device:
+ * NET_ADD_IF and the frontend open are slow on some drivers.
+ */
+
+typedef struct
+{
+    int adapter;
+    int device;
+
+    pthread_t thread;
+    bool is_thread;
+
+    bool is_busy;
+    const char *type;
+    char frontend[128];
+    char mac[64];
+    char error[128];
+} dvbls_item_t;
+
+static dvbls_item_t *item_list;
+static int item_count;
+static int item_size;
 
 static int adapter;
-static int device;
 
 static const char __adapter[] = "adapter";
 static const char __device[] = "device";
@@ -85,18 +107,18 @@ static int get_last_int(const char *str)
     return atoi(&str[i_pos]);
 }
 
-static void check_device_net(void)
+static void check_device_net(dvbls_item_t *item)
 {
-    sprintf(dev_name, "/dev/dvb/adapter%d/net%d", adapter, device);
+    char dev_name[64];
+    sprintf(dev_name, "/dev/dvb/adapter%d/net%d", item->adapter, item->device);
 
     int fd = open(dev_name, O_RDWR | O_NONBLOCK);
-    static char dvb_mac[] = "00:00:00:00:00:00";
 
     do
     {
         if(fd <= 0)
         {
-            lua_pushfstring(lua, "failed to open [%s]", strerror(errno));
+            snprintf(item->mac, sizeof(item->mac), "failed to open [%s]", strerror(errno));
             break;
         }
 
@@ -108,69 +130,59 @@ static void check_device_net(void)
         };
         if(ioctl(fd, NET_ADD_IF, &net) != 0)
         {
-            lua_pushfstring(lua, "NET_ADD_IF failed [%s]", strerror(errno));
+            snprintf(item->mac, sizeof(item->mac), "NET_ADD_IF failed [%s]", strerror(errno));
             break;
         }
 
         struct ifreq ifr;
         memset(&ifr, 0, sizeof(ifr));
-        sprintf(ifr.ifr_name, "dvb%d_%d", adapter, device);
+        sprintf(ifr.ifr_name, "dvb%d_%d", item->adapter, item->device);
 
         int sock = socket(PF_INET, SOCK_DGRAM, 0);
         if(ioctl(sock, SIOCGIFHWADDR, &ifr) != 0)
-            lua_pushfstring(lua, "SIOCGIFHWADDR failed [%s]", strerror(errno));
+        {
+            snprintf(item->mac, sizeof(item->mac), "SIOCGIFHWADDR failed [%s]", strerror(errno));
+        }
         else
         {
             const uint8_t *mac = (uint8_t *)ifr.ifr_hwaddr.sa_data;
-            sprintf(dvb_mac, "%02X:%02X:%02X:%02X:%02X:%02X"
+            sprintf(item->mac, "%02X:%02X:%02X:%02X:%02X:%02X"
                     , mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-            lua_pushstring(lua, dvb_mac);
         }
         close(sock);
 
         if(ioctl(fd, NET_REMOVE_IF, net.if_num) != 0)
         {
-            lua_pop(lua, 1);
-            lua_pushfstring(lua, "NET_REMOVE_IF failed [%s]", strerror(errno));
+            snprintf(item->mac, sizeof(item->mac), "NET_REMOVE_IF failed [%s]", strerror(errno));
         }
     } while(0);
 
     if(fd > 0)
         close(fd);
-
-    lua_setfield(lua, -2, "mac");
 }
 
-static void check_device_fe(void)
+static void check_device_fe(dvbls_item_t *item)
 {
-    sprintf(dev_name, "/dev/dvb/adapter%d/frontend%d", adapter, device);
-
-    bool is_busy = false;
+    char dev_name[64];
+    sprintf(dev_name, "/dev/dvb/adapter%d/frontend%d", item->adapter, item->device);
 
     int fd = open(dev_name, O_RDWR | O_NONBLOCK);
     if(fd <= 0)
     {
-        is_busy = true;
+        item->is_busy = true;
         fd = open(dev_name, O_RDONLY | O_NONBLOCK);
     }
 
-    static const char _error[] = "error";
-
     if(fd <= 0)
     {
-        lua_pushfstring(lua, "failed to open [%s]", strerror(errno));
-        lua_setfield(lua, -2, _error);
+        snprintf(item->error, sizeof(item->error), "failed to open [%s]", strerror(errno));
         return;
     }
 
-    lua_pushboolean(lua, is_busy);
-    lua_setfield(lua, -2, "busy");
-
     struct dvb_frontend_info feinfo;
     if(ioctl(fd, FE_GET_INFO, &feinfo) != 0)
     {
-        lua_pushstring(lua, "failed to get frontend type");
-        lua_setfield(lua, -2, _error);
+        snprintf(item->error, sizeof(item->error), "failed to get frontend type");
         close(fd);
         return;
     }
@@ -179,43 +191,49 @@ static void check_device_fe(void)
     switch(feinfo.type)
     {
         case FE_QPSK:
-            lua_pushstring(lua, "S");
+            item->type = "S";
             break;
         case FE_OFDM:
-            lua_pushstring(lua, "T");
+            item->type = "T";
             break;
         case FE_QAM:
-            lua_pushstring(lua, "C");
+            item->type = "C";
             break;
         case FE_ATSC:
-            lua_pushstring(lua, "ATSC");
+            item->type = "ATSC";
             break;
         default:
-            lua_pushfstring(lua, "unknown frontend type [%d]", feinfo.type);
-            lua_setfield(lua, -2, _error);
+            snprintf(item->error, sizeof(item->error)
+                     , "unknown frontend type [%d]", feinfo.type);
             return;
     }
-    lua_setfield(lua, -2, "type");
 
-    lua_pushstring(lua, feinfo.name);
-    lua_setfield(lua, -2, "frontend");
+    snprintf(item->frontend, sizeof(item->frontend), "%s", feinfo.name);
 
-    check_device_net();
+    check_device_net(item);
 }
 
-static void check_device(const char *item)
+static void * check_device_thread(void *arg)
 {
-    device = get_last_int(&item[(sizeof("/dev/dvb/adapter") - 1) + (sizeof("/net") - 1)]);
+    check_device_fe((dvbls_item_t *)arg);
+    return NULL;
+}
 
-    lua_newtable(lua);
-    lua_pushnumber(lua, adapter);
-    lua_setfield(lua, -2, __adapter);
-    lua_pushnumber(lua, device);
-    lua_setfield(lua, -2, __device);
-    check_device_fe();
+static void check_device(const char *item)
+{
+    if(item_count == item_size)
+    {
+        item_size = (item_size > 0) ? item_size * 2 : 16;
+        item_list = (dvbls_item_t *)realloc(item_list, item_size * sizeof(dvbls_item_t));
+        asc_assert(item_list != NULL, "[dvbls] failed to allocate device list");
+    }
 
-    ++count;
-    lua_rawseti(lua, -2, count);
+    dvbls_item_t *dvbls_item = &item_list[item_count];
+    memset(dvbls_item, 0, sizeof(dvbls_item_t));
+    dvbls_item->adapter = adapter;
+    dvbls_item->device =
+        get_last_int(&item[(sizeof("/dev/dvb/adapter") - 1) + (sizeof("/net") - 1)]);
+    ++item_count;
 }
 
 static void check_adapter(const char *item)
@@ -224,13 +242,64 @@ static void check_adapter(const char *item)
     iterate_dir(item, "net", check_device);
 }
 
+static void push_device(const dvbls_item_t *item, int idx)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, item->adapter);
+    lua_setfield(lua, -2, __adapter);
+    lua_pushnumber(lua, item->device);
+    lua_setfield(lua, -2, __device);
+
+    if(item->error[0])
+    {
+        lua_pushstring(lua, item->error);
+        lua_setfield(lua, -2, "error");
+    }
+    else
+    {
+        lua_pushboolean(lua, item->is_busy);
+        lua_setfield(lua, -2, "busy");
+        lua_pushstring(lua, item->type);
+        lua_setfield(lua, -2, "type");
+        lua_pushstring(lua, item->frontend);
+        lua_setfield(lua, -2, "frontend");
+        lua_pushstring(lua, item->mac);
+        lua_setfield(lua, -2, "mac");
+    }
+
+    lua_rawseti(lua, -2, idx);
+}
+
 static int dvbls_scan(lua_State *L)
 {
     __uarg(L);
 
-    count = 0;
-    lua_newtable(lua);
+    item_count = 0;
     iterate_dir("/dev/dvb", __adapter, check_adapter);
+
+    for(int i = 0; i < item_count; ++i)
+    {
+        dvbls_item_t *item = &item_list[i];
+        item->is_thread =
+            (pthread_create(&item->thread, NULL, check_device_thread, item) == 0);
+        if(!item->is_thread)
+            check_device_fe(item);
+    }
+
+    lua_newtable(lua);
+    for(int i = 0; i < item_count; ++i)
+    {
+        dvbls_item_t *item = &item_list[i];
+        if(item->is_thread)
+            pthread_join(item->thread, NULL);
+        push_device(item, i + 1);
+    }
+
+    free(item_list);
+    item_list = NULL;
+    item_size = 0;
+    item_count = 0;
+
     return 1;
 }
 
@@ -23,10 +23,15 @@
 #include "src/fe.h"
 #include "src/ca.h"
 
-#include <poll.h> // in dvb_thread_loop
+#include <poll.h> // in control_loop
+#include <sys/mman.h>
 
 #define MSG(_msg) "[dvb_input %d:%d] " _msg, mod->adapter, mod->device
 
+/* mmap mode: the kernel buffers, the buffer is dequeued when it is full */
+#define DVR_MMAP_COUNT 16
+#define DVR_MMAP_SIZE (64 * TS_PACKET_SIZE)
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -35,32 +40,49 @@ struct module_data_t
     int device;
 
     /* Base */
-    asc_thread_t *thread;
-    bool is_thread_started;
+    int control_status; // see control_append()
+    asc_thread_t *open_thread;
 
     asc_timer_t *status_timer;
     int idx_callback;
+    int idx_stat;
 
     /* DVR Config */
     bool no_dvr;
     int dvr_buffer_size;
+    bool dvr_mmap;
 
     /* DVR Base */
     int dvr_fd;
     asc_event_t *dvr_event;
     uint8_t dvr_buffer[1022 * TS_PACKET_SIZE];
 
+    // kernel buffers, see dvr_mmap_open()
+    uint8_t *dvr_mmap_list[DVR_MMAP_COUNT];
+    size_t dvr_mmap_size[DVR_MMAP_COUNT];
+    uint32_t dvr_mmap_count;
+    uint32_t dvr_handover_mmap; // buffers of the previous process, see handover_take()
+    bool dvr_reopen;
+
     uint32_t dvr_read;
 
     mpegts_psi_t *pat;
     int pat_error;
 
+    /* hot-spare, see method_standby() */
+    bool is_standby;
+    uint64_t standby_pmt[MAX_PID / 64]; // PMT PIDs of the last PAT
+
     /* DMX config */
     bool dmx_budget;
+    int dmx_pid_limit;
 
     /* DMX Base */
     char dmx_dev_name[32];
     int *dmx_fd_list;
+    int dmx_full_fd; // full TS filter above dmx_pid_limit, see dmx_sync()
+    int dmx_changed; // PID list is changed by the main thread
+    uint64_t dmx_handover_time; // filters of the previous process, see dmx_sync()
 
     int do_bounce;
 
@@ -68,11 +90,28 @@ struct module_data_t
     dvb_ca_t *ca;
 };
 
-#define THREAD_DELAY_FE (1 * 1000 * 1000)
-#define THREAD_DELAY_DMX (200 * 1000)
-#define THREAD_DELAY_CA (1 * 1000 * 1000)
+enum
+{
+    CONTROL_STATUS_NONE = 0,
+    CONTROL_STATUS_OPEN,    // added, devices are opened by the open thread
+    CONTROL_STATUS_READY,
+    CONTROL_STATUS_CLOSE,   // devices are closed by the control thread
+    CONTROL_STATUS_CLOSED,
+};
+
+/* PAT, CAT, NIT, SDT, EIT and others, delivered in the standby */
+#define STANDBY_SI_PID_MAX 0x20
+
+/* frontend and CA status is checked on each tick, dvr on each THREAD_DELAY_DVR */
+#define THREAD_DELAY_TICK (1 * 1000 * 1000)
 #define THREAD_DELAY_DVR (2 * 1000 * 1000)
 
+/* default PID count to set the full TS filter instead of the PID filters */
+#define DMX_PID_LIMIT 64
+
+/* filters of the previous process are kept while the channels join the PIDs */
+#define DMX_HANDOVER_GRACE (5 * 1000 * 1000)
+
 /*
  * ooooooooo  ooooo  oooo oooooooooo
  *  888    88o 888    88   888    888
@@ -84,6 +123,24 @@ struct module_data_t
 
 static void dvr_open(module_data_t *mod);
 static void dvr_close(module_data_t *mod);
+static void control_wakeup(void);
+
+static void standby_set_pat(module_data_t *mod, mpegts_psi_t *psi)
+{
+    memset(mod->standby_pmt, 0, sizeof(mod->standby_pmt));
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
+        mod->standby_pmt[pid / 64] |= (1ULL << (pid % 64));
+    }
+}
+
+static inline bool standby_is_psi(const module_data_t *mod, uint16_t pid)
+{
+    return (pid < STANDBY_SI_PID_MAX) || (mod->standby_pmt[pid / 64] & (1ULL << (pid % 64)));
+}
 
 static void on_pat(void *arg, mpegts_psi_t *psi)
 {
@@ -110,6 +167,13 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
                 mod->fe->do_retune = 1;
             mod->do_bounce = 1;
             mod->pat_error = 0;
+            control_wakeup();
+            if(mod->dvr_mmap_count > 0)
+            {
+                // the mapped buffer is in use, see dvr_mmap_on_read()
+                mod->dvr_reopen = true;
+                return;
+            }
             dvr_close(mod);
             dvr_open(mod);
         }
@@ -121,6 +185,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     }
 
     psi->crc32 = crc32;
+    standby_set_pat(mod, psi);
 }
 
 static void dvr_on_error(void *arg)
@@ -131,6 +196,50 @@ static void dvr_on_error(void *arg)
     dvr_open(mod);
 }
 
+/* headers are decoded by blocks of HEADER_BATCH_SIZE packets */
+#define HEADER_BATCH_SIZE 64
+
+static void dvr_send(module_data_t *mod, const uint8_t *buffer, size_t count)
+{
+    uint16_t pid[HEADER_BATCH_SIZE];
+    uint8_t cc[HEADER_BATCH_SIZE];
+    uint8_t flags[HEADER_BATCH_SIZE];
+
+    const uint8_t *ts = buffer;
+    size_t left = count;
+
+    while(left > 0)
+    {
+        const size_t n = (left > HEADER_BATCH_SIZE) ? HEADER_BATCH_SIZE : left;
+        mpegts_ts_headers(ts, n, pid, cc, flags);
+
+        if(mod->control_status == CONTROL_STATUS_READY && mod->ca->ca_fd > 0)
+            ca_on_ts_batch(mod->ca, ts, pid, n);
+
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(pid[i] == 0 && !(flags[i] & TS_FLAG_SYNC_ERROR))
+                mpegts_psi_mux(mod->pat, &ts[i * TS_PACKET_SIZE], on_pat, mod);
+        }
+
+        if(mod->is_standby)
+        {
+            // the tables keep the PID lists of the stream, ES is dropped
+            for(size_t i = 0; i < n; ++i)
+            {
+                if(standby_is_psi(mod, pid[i]))
+                    module_stream_send(mod, &ts[i * TS_PACKET_SIZE]);
+            }
+        }
+
+        ts += n * TS_PACKET_SIZE;
+        left -= n;
+    }
+
+    if(!mod->is_standby)
+        module_stream_send_batch(mod, buffer, count);
+}
+
 static void dvr_on_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -143,43 +252,180 @@ static void dvr_on_read(void *arg)
     }
     mod->dvr_read += len;
 
-    for(int i = 0; i < len; i += TS_PACKET_SIZE)
+    dvr_send(mod, mod->dvr_buffer, len / TS_PACKET_SIZE);
+}
+
+#ifdef DMX_REQBUFS
+
+/*
+ * The kernel fills the mapped buffers, so the packets are not copied with read().
+ * The buffer goes to the stream as a batch and is queued back right after that.
+ */
+
+static void dvr_mmap_on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    for(uint32_t i = 0; i < mod->dvr_mmap_count; ++i)
     {
-        const uint8_t *ts = &mod->dvr_buffer[i];
+        struct dmx_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        if(ioctl(mod->dvr_fd, DMX_DQBUF, &buffer) < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
 
-        if(mod->ca->ca_fd > 0)
-            ca_on_ts(mod->ca, ts);
+            dvr_on_error(mod);
+            return;
+        }
+
+        if(buffer.index >= mod->dvr_mmap_count || buffer.bytesused > mod->dvr_mmap_size[buffer.index])
+        {
+            asc_log_error(MSG("DMX_DQBUF: wrong buffer %u"), buffer.index);
+            dvr_on_error(mod);
+            return;
+        }
 
-        module_stream_send(mod, ts);
+        mod->dvr_read += buffer.bytesused;
+        dvr_send(mod, mod->dvr_mmap_list[buffer.index], buffer.bytesused / TS_PACKET_SIZE);
 
-        if(TS_IS_SYNC(ts) && TS_GET_PID(ts) == 0)
-            mpegts_psi_mux(mod->pat, ts, on_pat, mod);
+        if(mod->dvr_reopen)
+        {
+            mod->dvr_reopen = false;
+            dvr_close(mod);
+            dvr_open(mod);
+            return;
+        }
+
+        const uint32_t index = buffer.index;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.index = index;
+        if(ioctl(mod->dvr_fd, DMX_QBUF, &buffer) < 0)
+        {
+            asc_log_error(MSG("DMX_QBUF failed [%s]"), strerror(errno));
+            dvr_on_error(mod);
+            return;
+        }
     }
 }
 
+static bool dvr_mmap_open(module_data_t *mod)
+{
+    struct dmx_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = DVR_MMAP_COUNT;
+    request.size = DVR_MMAP_SIZE;
+
+    // the buffers of the previous process are requested and queued already
+    const bool is_handover = (mod->dvr_handover_mmap > 0);
+    if(is_handover)
+    {
+        request.count = mod->dvr_handover_mmap;
+        mod->dvr_handover_mmap = 0;
+    }
+    else if(ioctl(mod->dvr_fd, DMX_REQBUFS, &request) < 0 || request.count == 0)
+    {
+        asc_log_warning(MSG("DMX_REQBUFS failed, mmap is disabled [%s]"), strerror(errno));
+        return false;
+    }
+
+    if(request.count > DVR_MMAP_COUNT)
+        request.count = DVR_MMAP_COUNT;
+
+    for(uint32_t i = 0; i < request.count; ++i)
+    {
+        struct dmx_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.index = i;
+
+        if(ioctl(mod->dvr_fd, DMX_QUERYBUF, &buffer) < 0)
+        {
+            asc_log_error(MSG("DMX_QUERYBUF failed [%s]"), strerror(errno));
+            return false;
+        }
+
+        void *const map = mmap(  NULL, buffer.length, PROT_READ, MAP_SHARED
+                               , mod->dvr_fd, buffer.offset);
+        if(map == MAP_FAILED)
+        {
+            asc_log_error(MSG("failed to map dvr buffer [%s]"), strerror(errno));
+            return false;
+        }
+
+        mod->dvr_mmap_list[i] = (uint8_t *)map;
+        mod->dvr_mmap_size[i] = buffer.length;
+        mod->dvr_mmap_count = i + 1;
+
+        if(!is_handover && ioctl(mod->dvr_fd, DMX_QBUF, &buffer) < 0)
+        {
+            asc_log_error(MSG("DMX_QBUF failed [%s]"), strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif /* DMX_REQBUFS */
+
+static void dvr_mmap_close(module_data_t *mod)
+{
+    for(uint32_t i = 0; i < mod->dvr_mmap_count; ++i)
+        munmap(mod->dvr_mmap_list[i], mod->dvr_mmap_size[i]);
+
+    mod->dvr_mmap_count = 0;
+}
+
 static void dvr_open(module_data_t *mod)
 {
-    char dev_name[32];
-    sprintf(dev_name, "/dev/dvb/adapter%d/dvr%d", mod->adapter, mod->device);
-    mod->dvr_fd = open(dev_name, O_RDONLY | O_NONBLOCK);
+    // passed by the previous process with the buffer, see handover_take()
     if(mod->dvr_fd <= 0)
     {
-        asc_log_error(MSG("failed to open dvr [%s]"), strerror(errno));
-        mod->dvr_fd = 0;
-        return;
+        char dev_name[32];
+        sprintf(dev_name, "/dev/dvb/adapter%d/dvr%d", mod->adapter, mod->device);
+        mod->dvr_fd = open(dev_name, O_RDONLY | O_NONBLOCK);
+        if(mod->dvr_fd <= 0)
+        {
+            asc_log_error(MSG("failed to open dvr [%s]"), strerror(errno));
+            mod->dvr_fd = 0;
+            return;
+        }
+
+        if(mod->dvr_buffer_size > 0)
+        {
+            const uint64_t buffer_size = mod->dvr_buffer_size * 10 * 188 * 1024;
+            if(ioctl(mod->dvr_fd, DMX_SET_BUFFER_SIZE, buffer_size) < 0)
+            {
+                asc_log_error(MSG("DMX_SET_BUFFER_SIZE failed [%s]"), strerror(errno));
+                astra_abort();
+            }
+        }
     }
 
-    if(mod->dvr_buffer_size > 0)
+    mod->dvr_event = asc_event_init(mod->dvr_fd, mod);
+    asc_event_set_priority(mod->dvr_event, ASC_EVENT_INPUT);
+
+#ifdef DMX_REQBUFS
+    if(mod->dvr_mmap)
     {
-        const uint64_t buffer_size = mod->dvr_buffer_size * 10 * 188 * 1024;
-        if(ioctl(mod->dvr_fd, DMX_SET_BUFFER_SIZE, buffer_size) < 0)
+        if(dvr_mmap_open(mod))
         {
-            asc_log_error(MSG("DMX_SET_BUFFER_SIZE failed [%s]"), strerror(errno));
-            astra_abort();
+            asc_event_set_on_read(mod->dvr_event, dvr_mmap_on_read);
+            asc_event_set_on_error(mod->dvr_event, dvr_on_error);
+            return;
         }
+
+        // buffers are released with the descriptor
+        dvr_mmap_close(mod);
+        ASC_FREE(mod->dvr_event, asc_event_close);
+        close(mod->dvr_fd);
+        mod->dvr_fd = 0;
+        mod->dvr_mmap = false;
+        dvr_open(mod);
+        return;
     }
+#endif
 
-    mod->dvr_event = asc_event_init(mod->dvr_fd, mod);
     asc_event_set_on_read(mod->dvr_event, dvr_on_read);
     asc_event_set_on_error(mod->dvr_event, dvr_on_error);
 }
@@ -193,6 +439,8 @@ static void dvr_close(module_data_t *mod)
 
     ASC_FREE(mod->dvr_event, asc_event_close);
 
+    dvr_mmap_close(mod);
+
     close(mod->dvr_fd);
     mod->dvr_fd = 0;
 }
@@ -269,11 +517,82 @@ void dmx_set_pid(module_data_t *mod, uint16_t pid, int is_set)
     }
 }
 
+/*
+ * Applies the PID list of the stream with one pass, from the control thread.
+ * Above dmx_pid_limit PIDs one full TS filter replaces the PID filters,
+ * the PID filters are restored when the count is decreased by a quarter.
+ */
+static void dmx_sync(module_data_t *mod)
+{
+    if(mod->dmx_budget || !mod->dmx_fd_list || !mod->dmx_changed)
+        return;
+
+    mod->dmx_changed = 0;
+
+    bool is_handover = false;
+    if(mod->dmx_handover_time > 0)
+    {
+        if(asc_utime() < mod->dmx_handover_time)
+        {
+            is_handover = true;
+            mod->dmx_changed = 1; // unused filters are closed after the grace
+        }
+        else
+            mod->dmx_handover_time = 0;
+    }
+
+    const int count = mod->__stream.pid_list->count;
+
+    bool is_restore = false;
+    if(mod->dmx_pid_limit > 0)
+    {
+        if(!mod->dmx_full_fd && count > mod->dmx_pid_limit)
+        {
+            asc_log_debug(MSG("demux: %d PIDs, set full TS filter"), count);
+            mod->dmx_full_fd = __dmx_open(mod);
+            __dmx_join_pid(mod, mod->dmx_full_fd, MAX_PID);
+        }
+        else if(mod->dmx_full_fd && count <= mod->dmx_pid_limit - mod->dmx_pid_limit / 4)
+        {
+            asc_log_debug(MSG("demux: %d PIDs, set PID filters"), count);
+            is_restore = true; // full TS filter is closed after the PID filters
+        }
+    }
+    else if(mod->dmx_full_fd)
+        is_restore = true; // full TS filter of the previous process
+
+    if(is_handover)
+        is_restore = false;
+
+    const bool is_full = (mod->dmx_full_fd && !is_restore);
+
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        const bool is_set = (mpegts_pid_map_has(mod->__stream.pid_list, i) && !is_full);
+        if(is_set && mod->dmx_fd_list[i] == 0)
+            dmx_set_pid(mod, i, 1);
+        else if(!is_set && mod->dmx_fd_list[i] > 0 && !is_handover)
+            dmx_set_pid(mod, i, 0);
+    }
+
+    if(is_restore)
+    {
+        close(mod->dmx_full_fd);
+        mod->dmx_full_fd = 0;
+    }
+}
+
 void dmx_bounce(module_data_t *mod)
 {
     if(!mod->dmx_fd_list)
         return;
 
+    if(mod->dmx_full_fd)
+    {
+        ioctl(mod->dmx_full_fd, DMX_STOP);
+        ioctl(mod->dmx_full_fd, DMX_START);
+    }
+
     const int fd_max = (mod->dmx_budget) ? 1 : MAX_PID;
     for(int i = 0; i < fd_max; ++i)
     {
@@ -289,6 +608,10 @@ void dmx_open(module_data_t *mod)
 {
     sprintf(mod->dmx_dev_name, "/dev/dvb/adapter%d/demux%d", mod->adapter, mod->device);
 
+    // filters of the previous process, see handover_take()
+    if(mod->dmx_fd_list)
+        return;
+
     const int fd = __dmx_open(mod);
     if(fd <= 0)
     {
@@ -306,6 +629,7 @@ void dmx_open(module_data_t *mod)
     {
         close(fd);
         mod->dmx_fd_list = (int *)calloc(MAX_PID, sizeof(int));
+        mod->dmx_changed = 1;
     }
 }
 
@@ -322,6 +646,12 @@ void dmx_close(module_data_t *mod)
     }
     free(mod->dmx_fd_list);
     mod->dmx_fd_list = NULL;
+
+    if(mod->dmx_full_fd)
+    {
+        close(mod->dmx_full_fd);
+        mod->dmx_full_fd = 0;
+    }
 }
 
 /*
@@ -697,7 +1027,10 @@ static void module_options(module_data_t *mod)
         option_required(mod, __frequency);
 
     module_option_boolean("raw_signal", &mod->fe->raw_signal);
+    module_option_boolean("standby", &mod->is_standby);
     module_option_boolean("budget", &mod->dmx_budget);
+    mod->dmx_pid_limit = DMX_PID_LIMIT;
+    module_option_number("pid_limit", &mod->dmx_pid_limit);
     module_option_boolean("log_signal", &mod->fe->log_signal);
 
     if(mod->fe->type == DVB_TYPE_UNKNOWN)
@@ -707,6 +1040,15 @@ static void module_options(module_data_t *mod)
     if(mod->dvr_buffer_size > 200)
         asc_log_warning(MSG("buffer_size value is too large"));
 
+    module_option_boolean("mmap", &mod->dvr_mmap);
+#ifndef DMX_REQBUFS
+    if(mod->dvr_mmap)
+    {
+        asc_log_warning(MSG("mmap is not supported by the DVB API"));
+        mod->dvr_mmap = false;
+    }
+#endif
+
     static const char __modulation[] = "modulation";
     if(module_option_string(__modulation, &string_val, NULL))
     {
@@ -773,189 +1115,488 @@ static void module_options(module_data_t *mod)
  *
  */
 
-static void on_thread_close(void *arg)
+/*
+ * One control thread serves the frontends, CA and demuxes of all adapters.
+ * The thread sleeps in poll() on the frontend and CA events until the next
+ * status tick. The main thread wakes it up to add or remove an adapter,
+ * to apply the PID list or to bounce the demux.
+ * The devices are opened and tuned by a short-lived thread of each adapter,
+ * so all adapters are tuned at once on start.
+ */
+
+typedef struct
 {
-    module_data_t *mod = (module_data_t *)arg;
+    asc_thread_t *thread;
+    bool is_started;
+
+    pthread_mutex_t mutex;
+    asc_list_t *adapter_list; // module_data_t, locked with mutex
+
+    int wakeup_fd[2];
+
+    struct pollfd *fds;
+    module_data_t **fds_mod;
+    size_t fds_size;
+} dvb_control_t;
+
+static dvb_control_t *dvb_control = NULL;
+
+static void control_destroy(void);
 
-    mod->is_thread_started = false;
-    ASC_FREE(mod->thread, asc_thread_destroy);
+static void control_wakeup(void)
+{
+    if(!dvb_control)
+        return;
+
+    const uint8_t value = 1;
+    if(write(dvb_control->wakeup_fd[1], &value, sizeof(value)) == -1)
+    {
+        ; /* pipe is full, control thread is awake anyway */
+    }
 }
 
-static void thread_loop(void *arg)
+static bool is_control_master(module_data_t *mod)
 {
-    module_data_t *mod = (module_data_t *)arg;
+    return (mod->fe->type != DVB_TYPE_UNKNOWN);
+}
 
+static void control_open(module_data_t *mod)
+{
     fe_open(mod->fe);
-    ca_open(mod->ca);
-    dmx_open(mod);
 
-    nfds_t nfds = 0;
+    if(is_control_master(mod))
+    {
+        ca_open(mod->ca);
+        dmx_open(mod);
+    }
+    else if(!mod->no_dvr)
+        dmx_open(mod);
+}
 
-    struct pollfd fds[2];
-    memset(fds, 0, sizeof(fds));
+static void control_close(module_data_t *mod)
+{
+    fe_close(mod->fe);
+    if(is_control_master(mod))
+        ca_close(mod->ca);
+    dmx_close(mod);
+}
 
-    fds[nfds].fd = mod->fe->fe_fd;
-    fds[nfds].events = POLLIN;
-    ++nfds;
+static void control_sync(module_data_t *mod)
+{
+    if(!mod->dmx_fd_list)
+        return;
 
-    if(mod->ca->ca_fd)
+    if(mod->do_bounce)
     {
-        fds[nfds].fd = mod->ca->ca_fd;
-        fds[nfds].events = POLLIN;
-        ++nfds;
+        dmx_bounce(mod);
+        mod->do_bounce = 0;
     }
 
-    mod->is_thread_started = true;
+    dmx_sync(mod);
+}
+
+static void control_tick(module_data_t *mod, uint32_t tick)
+{
+    fe_loop(mod->fe, 0);
+
+    if(mod->ca->ca_fd > 0)
+        ca_loop(mod->ca, 0);
 
-    uint64_t current_time = asc_utime();
-    uint64_t fe_check_timeout = current_time;
-    uint64_t dmx_check_timeout = current_time;
-    uint64_t ca_check_timeout = current_time;
-    uint64_t dvr_check_timeout = current_time;
+    if(!mod->dmx_fd_list || tick % (THREAD_DELAY_DVR / THREAD_DELAY_TICK) != 0)
+        return;
 
-    while(mod->is_thread_started)
+    if(mod->fe->status & FE_HAS_LOCK)
     {
-        const int ret = poll(fds, nfds, 100);
+        if(mod->dvr_read == 0)
+            dmx_bounce(mod);
+        else
+            mod->dvr_read = 0;
+    }
+}
 
-        if(!mod->is_thread_started)
-            break;
+/* opens and closes the adapters, fills the poll list. returns the list size */
+static nfds_t control_prepare(void)
+{
+    asc_list_t *adapter_list = dvb_control->adapter_list;
 
-        if(ret < 0)
+    const size_t fds_size = 1 + asc_list_size(adapter_list) * 2;
+    if(fds_size > dvb_control->fds_size)
+    {
+        dvb_control->fds = (struct pollfd *)realloc(dvb_control->fds
+            , fds_size * sizeof(struct pollfd));
+        dvb_control->fds_mod = (module_data_t **)realloc(dvb_control->fds_mod
+            , fds_size * sizeof(module_data_t *));
+        asc_assert(dvb_control->fds != NULL && dvb_control->fds_mod != NULL
+            , "[dvb_input] failed to allocate poll list");
+        dvb_control->fds_size = fds_size;
+    }
+
+    struct pollfd *fds = dvb_control->fds;
+    memset(fds, 0, fds_size * sizeof(struct pollfd));
+
+    nfds_t nfds = 0;
+    fds[nfds].fd = dvb_control->wakeup_fd[0];
+    fds[nfds].events = POLLIN;
+    ++nfds;
+
+    asc_list_first(adapter_list);
+    while(!asc_list_eol(adapter_list))
+    {
+        module_data_t *mod = (module_data_t *)asc_list_data(adapter_list);
+
+        if(mod->control_status == CONTROL_STATUS_CLOSE)
         {
-            asc_log_error(MSG("poll() failed [%s]"), strerror(errno));
-            astra_abort();
+            control_close(mod);
+            asc_list_remove_current(adapter_list);
+            // the main thread releases the module right after that
+            mod->control_status = CONTROL_STATUS_CLOSED;
+            continue;
         }
 
-        if(ret > 0)
+        if(mod->control_status != CONTROL_STATUS_READY)
         {
-            if(fds[0].revents)
-                fe_loop(mod->fe, fds[0].revents & (POLLPRI | POLLIN));
-            if(mod->ca->ca_fd && fds[1].revents)
-                ca_loop(mod->ca, fds[1].revents & (POLLPRI | POLLIN));
+            asc_list_next(adapter_list);
+            continue;
         }
 
-        current_time = asc_utime();
+        control_sync(mod);
 
-        if(current_time >= fe_check_timeout + THREAD_DELAY_FE)
+        if(is_control_master(mod))
         {
-            fe_check_timeout = current_time;
-            fe_loop(mod->fe, 0);
+            fds[nfds].fd = mod->fe->fe_fd;
+            fds[nfds].events = POLLIN;
+            dvb_control->fds_mod[nfds] = mod;
+            ++nfds;
         }
 
-        if(mod->do_bounce)
+        if(mod->ca->ca_fd > 0)
         {
-            dmx_bounce(mod);
-            mod->do_bounce = 0;
+            fds[nfds].fd = mod->ca->ca_fd;
+            fds[nfds].events = POLLIN;
+            dvb_control->fds_mod[nfds] = mod;
+            ++nfds;
         }
 
-        if(!mod->dmx_budget && mod->dmx_fd_list &&
-            current_time >= dmx_check_timeout + THREAD_DELAY_DMX)
-        {
-            dmx_check_timeout = current_time;
+        asc_list_next(adapter_list);
+    }
 
-            for(int i = 0; i < MAX_PID; ++i)
-            {
-                if((mod->__stream.pid_list[i] > 0) && (mod->dmx_fd_list[i] == 0))
-                    dmx_set_pid(mod, i, 1);
-                else if((mod->__stream.pid_list[i] == 0) && (mod->dmx_fd_list[i] > 0))
-                    dmx_set_pid(mod, i, 0);
-            }
-        }
+    return nfds;
+}
+
+static void control_event(nfds_t nfds)
+{
+    struct pollfd *fds = dvb_control->fds;
+
+    if(fds[0].revents)
+    {
+        uint8_t drain[64];
+        while(read(fds[0].fd, drain, sizeof(drain)) > 0)
+            ;
+    }
+
+    for(nfds_t i = 1; i < nfds; ++i)
+    {
+        if(!fds[i].revents)
+            continue;
+
+        module_data_t *mod = dvb_control->fds_mod[i];
+        const int is_data = fds[i].revents & (POLLPRI | POLLIN);
+        if(fds[i].fd == mod->fe->fe_fd)
+            fe_loop(mod->fe, is_data);
+        else
+            ca_loop(mod->ca, is_data);
+    }
+}
+
+static void control_loop(void *arg)
+{
+    __uarg(arg);
 
-        if(mod->ca->ca_fd > 0 && current_time >= ca_check_timeout + THREAD_DELAY_CA)
+    uint64_t tick_time = asc_utime();
+    uint32_t tick = 0;
+
+    while(dvb_control->is_started)
+    {
+        pthread_mutex_lock(&dvb_control->mutex);
+        const nfds_t nfds = control_prepare();
+        pthread_mutex_unlock(&dvb_control->mutex);
+
+        uint64_t current_time = asc_utime();
+        const uint64_t tick_next = tick_time + THREAD_DELAY_TICK;
+        const int timeout = (current_time < tick_next)
+                          ? (int)((tick_next - current_time + 999) / 1000)
+                          : 0;
+
+        const int ret = poll(dvb_control->fds, nfds, timeout);
+
+        if(!dvb_control->is_started)
+            break;
+
+        if(ret < 0)
         {
-            ca_check_timeout = current_time;
-            ca_loop(mod->ca, 0);
+            asc_log_error("[dvb_input] poll() failed [%s]", strerror(errno));
+            astra_abort();
         }
 
-        if(current_time >= dvr_check_timeout + THREAD_DELAY_DVR)
+        pthread_mutex_lock(&dvb_control->mutex);
+
+        if(ret > 0)
+            control_event(nfds);
+
+        current_time = asc_utime();
+        if(current_time >= tick_next)
         {
-            dvr_check_timeout = current_time;
-            if(mod->fe->status & FE_HAS_LOCK)
+            tick_time = current_time;
+            ++tick;
+
+            asc_list_for(dvb_control->adapter_list)
             {
-                if(mod->dvr_read == 0)
-                    dmx_bounce(mod);
-                else
-                    mod->dvr_read = 0;
+                module_data_t *mod = (module_data_t *)asc_list_data(dvb_control->adapter_list);
+                if(mod->control_status == CONTROL_STATUS_READY)
+                    control_tick(mod, tick);
             }
         }
+
+        pthread_mutex_unlock(&dvb_control->mutex);
     }
+}
 
-    fe_close(mod->fe);
-    ca_close(mod->ca);
-    dmx_close(mod);
+static void open_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    control_open(mod);
+
+    pthread_mutex_lock(&dvb_control->mutex);
+    mod->control_status = CONTROL_STATUS_READY;
+    pthread_mutex_unlock(&dvb_control->mutex);
+
+    control_wakeup();
 }
 
-static void thread_loop_slave(void *arg)
+static void on_open_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
+    ASC_FREE(mod->open_thread, asc_thread_destroy);
+}
 
-    fe_open(mod->fe);
-    if(!mod->no_dvr)
+static void on_control_close(void *arg)
+{
+    __uarg(arg);
+    control_destroy();
+}
+
+static void control_init(void)
+{
+    dvb_control = (dvb_control_t *)calloc(1, sizeof(dvb_control_t));
+    asc_assert(dvb_control != NULL, "[dvb_input] failed to allocate control");
+
+    pthread_mutex_init(&dvb_control->mutex, NULL);
+    dvb_control->adapter_list = asc_list_init();
+
+    const int ret = pipe(dvb_control->wakeup_fd);
+    asc_assert(ret != -1, "[dvb_input] failed to open wakeup pipe [%s]", strerror(errno));
+    fcntl(dvb_control->wakeup_fd[0], F_SETFL, fcntl(dvb_control->wakeup_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(dvb_control->wakeup_fd[1], F_SETFL, fcntl(dvb_control->wakeup_fd[1], F_GETFL) | O_NONBLOCK);
+
+    dvb_control->is_started = true;
+    dvb_control->thread = asc_thread_init(NULL);
+    asc_thread_set_name(dvb_control->thread, "dvb_control");
+    asc_thread_start(dvb_control->thread, control_loop, NULL, NULL, on_control_close);
+}
+
+static void control_destroy(void)
+{
+    if(!dvb_control)
+        return;
+
+    dvb_control->is_started = false;
+    control_wakeup();
+    ASC_FREE(dvb_control->thread, asc_thread_destroy);
+
+    // on exit the adapters are closed without the control thread
+    asc_list_for(dvb_control->adapter_list)
     {
-        dmx_open(mod);
+        module_data_t *mod = (module_data_t *)asc_list_data(dvb_control->adapter_list);
+        ASC_FREE(mod->open_thread, asc_thread_destroy);
+        if(mod->control_status == CONTROL_STATUS_READY)
+            control_close(mod);
+        mod->control_status = CONTROL_STATUS_NONE;
     }
+    asc_list_destroy(dvb_control->adapter_list);
 
-    mod->is_thread_started = true;
+    close(dvb_control->wakeup_fd[0]);
+    close(dvb_control->wakeup_fd[1]);
+    pthread_mutex_destroy(&dvb_control->mutex);
 
-    uint64_t current_time = asc_utime();
-    uint64_t fe_check_timeout = current_time;
-    uint64_t dmx_check_timeout = current_time;
-    uint64_t dvr_check_timeout = current_time;
+    free(dvb_control->fds);
+    free(dvb_control->fds_mod);
+    free(dvb_control);
+    dvb_control = NULL;
+}
 
-    while(mod->is_thread_started)
-    {
-        asc_usleep(100 * 1000);
+/* starts to open the adapter, does not wait for the tuning */
+static void control_append(module_data_t *mod)
+{
+    if(!dvb_control)
+        control_init();
 
-        if(!mod->is_thread_started)
-            break;
+    pthread_mutex_lock(&dvb_control->mutex);
+    mod->control_status = CONTROL_STATUS_OPEN;
+    asc_list_insert_tail(dvb_control->adapter_list, mod);
+    pthread_mutex_unlock(&dvb_control->mutex);
 
-        current_time = asc_utime();
+    mod->open_thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->open_thread, "dvb_open");
+    asc_thread_start(mod->open_thread, open_loop, NULL, NULL, on_open_close);
+}
 
-        if(current_time >= fe_check_timeout + THREAD_DELAY_FE)
-        {
-            fe_check_timeout = current_time;
-            fe_loop(mod->fe, 0);
-        }
+/* waits until the devices of the adapter are opened */
+static void control_wait(module_data_t *mod)
+{
+    while(mod->control_status == CONTROL_STATUS_OPEN)
+        asc_usleep(500);
+}
 
-        if(mod->no_dvr)
-            continue;
+/*
+ * Handover, see core/handover.h. The frontend keeps the lock with the same
+ * tuning, the dvr and the demux filters are passed with the buffered packets.
+ * The CAM sessions are started again.
+ */
 
-        if(mod->do_bounce)
-        {
-            dmx_bounce(mod);
-            mod->do_bounce = 0;
-        }
+static void on_handover(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
 
-        if(!mod->dmx_budget && mod->dmx_fd_list &&
-            current_time >= dmx_check_timeout + THREAD_DELAY_DMX)
-        {
-            dmx_check_timeout = current_time;
+    if(!dvb_control)
+        return;
+
+    char key[64];
+    char tag[128];
 
-            for(int i = 0; i < MAX_PID; ++i)
+    pthread_mutex_lock(&dvb_control->mutex);
+
+    if(mod->control_status == CONTROL_STATUS_READY)
+    {
+        snprintf(key, sizeof(key), "dvb/%d.%d/frontend", mod->adapter, mod->device);
+        fe_tune_tag(mod->fe, tag, sizeof(tag));
+        asc_handover_pass(key, tag, mod->fe->fe_fd);
+
+        snprintf(key, sizeof(key), "dvb/%d.%d/ca", mod->adapter, mod->device);
+        asc_handover_pass(key, NULL, mod->ca->ca_fd);
+
+        snprintf(key, sizeof(key), "dvb/%d.%d/demux", mod->adapter, mod->device);
+        if(mod->dmx_fd_list)
+        {
+            const int fd_max = (mod->dmx_budget) ? 1 : MAX_PID;
+            for(int i = 0; i < fd_max; ++i)
             {
-                if((mod->__stream.pid_list[i] > 0) && (mod->dmx_fd_list[i] == 0))
-                    dmx_set_pid(mod, i, 1);
-                else if((mod->__stream.pid_list[i] == 0) && (mod->dmx_fd_list[i] > 0))
-                    dmx_set_pid(mod, i, 0);
+                if(!mod->dmx_fd_list[i])
+                    continue;
+                snprintf(tag, sizeof(tag), "%d", (mod->dmx_budget) ? MAX_PID : i);
+                asc_handover_pass(key, tag, mod->dmx_fd_list[i]);
             }
         }
+        snprintf(tag, sizeof(tag), "%d", MAX_PID);
+        asc_handover_pass(key, tag, mod->dmx_full_fd);
+    }
+
+    pthread_mutex_unlock(&dvb_control->mutex);
+
+    snprintf(key, sizeof(key), "dvb/%d.%d/dvr", mod->adapter, mod->device);
+    snprintf(tag, sizeof(tag), "mmap=%u", mod->dvr_mmap_count);
+    asc_handover_pass(key, (mod->dvr_mmap_count > 0) ? tag : NULL, mod->dvr_fd);
+}
+
+static void handover_take(module_data_t *mod)
+{
+    if(!asc_handover_is_pending())
+        return;
+
+    char key[64];
+    const char *tag = NULL;
+    int fd;
+
+    snprintf(key, sizeof(key), "dvb/%d.%d/frontend", mod->adapter, mod->device);
+    fd = asc_handover_take(key, &tag);
+    if(fd != -1)
+    {
+        char tune[128];
+        fe_tune_tag(mod->fe, tune, sizeof(tune));
+        mod->fe->fe_fd = fd;
+        mod->fe->is_handover = (tag && !strcmp(tag, tune));
+    }
 
-        if(current_time >= dvr_check_timeout + THREAD_DELAY_DVR)
+    snprintf(key, sizeof(key), "dvb/%d.%d/ca", mod->adapter, mod->device);
+    fd = asc_handover_take(key, NULL);
+    if(fd != -1)
+        mod->ca->ca_fd = fd;
+
+    snprintf(key, sizeof(key), "dvb/%d.%d/dvr", mod->adapter, mod->device);
+    fd = asc_handover_take(key, &tag);
+    if(fd != -1)
+    {
+        mod->dvr_fd = fd;
+
+        unsigned int count = 0;
+        if(tag && sscanf(tag, "mmap=%u", &count) == 1 && count > 0 && count <= DVR_MMAP_COUNT)
         {
-            dvr_check_timeout = current_time;
-            if(mod->fe->status & FE_HAS_LOCK)
-            {
-                if(mod->dvr_read == 0)
-                    dmx_bounce(mod);
-                else
-                    mod->dvr_read = 0;
-            }
+            mod->dvr_mmap = true;
+            mod->dvr_handover_mmap = count;
         }
     }
 
-    fe_close(mod->fe);
-    dmx_close(mod);
+    snprintf(key, sizeof(key), "dvb/%d.%d/demux", mod->adapter, mod->device);
+    while((fd = asc_handover_take(key, &tag)) != -1)
+    {
+        const int pid = (tag) ? atoi(tag) : -1;
+
+        if(!mod->dmx_fd_list)
+            mod->dmx_fd_list = (int *)calloc((mod->dmx_budget) ? 1 : MAX_PID, sizeof(int));
+
+        if(mod->dmx_budget && pid == MAX_PID && !mod->dmx_fd_list[0])
+            mod->dmx_fd_list[0] = fd;
+        else if(!mod->dmx_budget && pid == MAX_PID && !mod->dmx_full_fd)
+            mod->dmx_full_fd = fd;
+        else if(!mod->dmx_budget && pid >= 0 && pid < MAX_PID && !mod->dmx_fd_list[pid])
+            mod->dmx_fd_list[pid] = fd;
+        else
+            close(fd);
+    }
+
+    if(mod->dmx_budget && mod->dmx_fd_list && !mod->dmx_fd_list[0])
+        ASC_FREE(mod->dmx_fd_list, free);
+
+    if(mod->dmx_fd_list)
+    {
+        mod->dmx_changed = 1;
+        mod->dmx_handover_time = asc_utime() + DMX_HANDOVER_GRACE;
+    }
+}
+
+static void control_remove(module_data_t *mod)
+{
+    if(!dvb_control || mod->control_status == CONTROL_STATUS_NONE)
+        return;
+
+    ASC_FREE(mod->open_thread, asc_thread_destroy);
+
+    pthread_mutex_lock(&dvb_control->mutex);
+    mod->control_status = CONTROL_STATUS_CLOSE;
+    pthread_mutex_unlock(&dvb_control->mutex);
+
+    control_wakeup();
+
+    while(mod->control_status != CONTROL_STATUS_CLOSED)
+        asc_usleep(500);
+    mod->control_status = CONTROL_STATUS_NONE;
+
+    pthread_mutex_lock(&dvb_control->mutex);
+    const bool is_empty = (asc_list_size(dvb_control->adapter_list) == 0);
+    pthread_mutex_unlock(&dvb_control->mutex);
+
+    if(is_empty)
+        control_destroy();
 }
 
 /*
@@ -967,27 +1608,28 @@ static void thread_loop_slave(void *arg)
  *
  */
 
+static const module_stat_field_t fe_stat_fields[] =
+{
+    MODULE_STAT_FIELD("status", MODULE_STAT_INT, dvb_fe_t, status),
+    MODULE_STAT_FIELD("signal", MODULE_STAT_INT, dvb_fe_t, signal),
+    MODULE_STAT_FIELD("snr", MODULE_STAT_INT, dvb_fe_t, snr),
+    MODULE_STAT_FIELD("ber", MODULE_STAT_INT, dvb_fe_t, ber),
+    MODULE_STAT_FIELD("unc", MODULE_STAT_INT, dvb_fe_t, unc),
+    MODULE_STAT_END
+};
+
 static void on_status_timer(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
-    lua_newtable(lua);
-    lua_pushnumber(lua, mod->fe->status);
-    lua_setfield(lua, -2, "status");
-    lua_pushnumber(lua, mod->fe->signal);
-    lua_setfield(lua, -2, "signal");
-    lua_pushnumber(lua, mod->fe->snr);
-    lua_setfield(lua, -2, "snr");
-    lua_pushnumber(lua, mod->fe->ber);
-    lua_setfield(lua, -2, "ber");
-    lua_pushnumber(lua, mod->fe->unc);
-    lua_setfield(lua, -2, "unc");
-    lua_call(lua, 1, 0);
+    module_stat_push(mod->idx_stat);
+    module_lua_notify(mod, mod->idx_callback);
 }
 
 static int method_ca_set_pnr(module_data_t *mod)
 {
+    control_wait(mod);
+
     if(!mod->ca || !mod->ca->ca_fd)
         return 0;
 
@@ -997,18 +1639,42 @@ static int method_ca_set_pnr(module_data_t *mod)
     return 0;
 }
 
+/*
+ * Hot-spare adapter: tuned, the demux filters and the CA are set, but only
+ * the tables are delivered, so the descendants keep the PID lists ready.
+ * standby(false) delivers the full stream from the next DVR read.
+ */
+static int method_standby(module_data_t *mod)
+{
+    const bool is_standby = lua_toboolean(lua, 2);
+    if(is_standby == mod->is_standby)
+        return 0;
+
+    mod->is_standby = is_standby;
+    asc_log_info(MSG("%s"), (is_standby) ? "standby" : "active");
+    return 0;
+}
+
 static int method_close(module_data_t *mod)
 {
+    asc_handover_detach(mod);
     dvr_close(mod);
-    on_thread_close(mod);
+    control_remove(mod);
 
     ASC_FREE(mod->pat, mpegts_psi_destroy);
     ASC_FREE(mod->fe, free);
     ASC_FREE(mod->ca, free);
     ASC_FREE(mod->status_timer, asc_timer_destroy);
 
+    if(mod->idx_stat)
+    {
+        module_stat_destroy(mod->idx_stat);
+        mod->idx_stat = 0;
+    }
+
     if(mod->idx_callback)
     {
+        module_lua_notify_cancel(mod);
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
         mod->idx_callback = 0;
     }
@@ -1020,12 +1686,19 @@ static int method_close(module_data_t *mod)
 
 static void join_pid(module_data_t *mod, uint16_t pid)
 {
-    ++mod->__stream.pid_list[pid];
+    const uintptr_t count = mpegts_pid_map_get(mod->__stream.pid_list, pid);
+    mpegts_pid_map_set(mod->__stream.pid_list, pid, count + 1);
+    mod->dmx_changed = 1;
+    control_wakeup();
 }
 
 static void leave_pid(module_data_t *mod, uint16_t pid)
 {
-    --mod->__stream.pid_list[pid];
+    const uintptr_t count = mpegts_pid_map_get(mod->__stream.pid_list, pid);
+    if(count > 0)
+        mpegts_pid_map_set(mod->__stream.pid_list, pid, count - 1);
+    mod->dmx_changed = 1;
+    control_wakeup();
 }
 
 static void module_init(module_data_t *mod)
@@ -1042,6 +1715,7 @@ static void module_init(module_data_t *mod)
     if(lua_isfunction(lua, -1))
     {
         mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+        mod->idx_stat = module_stat_init(mod->fe, fe_stat_fields);
         mod->status_timer = asc_timer_init(1000, on_status_timer, mod);
     }
     else
@@ -1049,6 +1723,8 @@ static void module_init(module_data_t *mod)
 
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
 
+    handover_take(mod);
+
     if(!mod->no_dvr)
     {
         dvr_open(mod);
@@ -1056,13 +1732,8 @@ static void module_init(module_data_t *mod)
             return;
     }
 
-    mod->thread = asc_thread_init(mod);
-    asc_thread_start(mod->thread,
-        (mod->fe->type != DVB_TYPE_UNKNOWN) ? thread_loop : thread_loop_slave,
-        NULL, NULL, on_thread_close);
-
-    while(!mod->is_thread_started)
-        asc_usleep(500);
+    control_append(mod);
+    asc_handover_attach(on_handover, mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -1074,6 +1745,7 @@ MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
     { "ca_set_pnr", method_ca_set_pnr },
+    { "standby", method_standby },
     { "close", method_close },
     MODULE_STREAM_METHODS_REF()
 };
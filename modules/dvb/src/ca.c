@@ -274,8 +274,6 @@ static void application_information_event(dvb_ca_t *ca, uint8_t slot_id, uint16_
             asc_log_info(  MSG("CA: Module %s. 0x%02X 0x%04X 0x%04X")
                          , name, type, manufacturer, product);
             free(name);
-
-            ca->status = CA_MODULE_STATUS_APP_INFO;
             break;
         }
         default:
@@ -449,19 +447,74 @@ static void ca_pmt_send(  dvb_ca_t *ca, ca_pmt_t *ca_pmt
     ca_apdu_send(ca, slot_id, session_id, AOT_CA_PMT, ca_pmt->buffer, ca_pmt->buffer_size);
 }
 
+/* CA session of the slot, 0 if the CA_INFO is not received or the slot is initializing */
+static uint16_t ca_pmt_session(dvb_ca_t *ca, uint8_t slot_id, uint64_t current_time)
+{
+    ca_slot_t *slot = &ca->slots[slot_id];
+    if(!slot->ca_info_time || current_time < slot->ca_info_time + ca->pmt_delay)
+        return 0;
+
+    for(uint16_t session_id = 1; session_id < MAX_SESSIONS; ++session_id)
+    {
+        if(slot->sessions[session_id].resource_id == RI_CONDITIONAL_ACCESS_SUPPORT)
+            return session_id;
+    }
+
+    return 0;
+}
+
 static void ca_pmt_send_one(dvb_ca_t *ca, ca_pmt_t *ca_pmt, uint8_t list_manage, uint8_t cmd)
 {
+    const uint64_t current_time = asc_utime();
+
     for(int slot_id = 0; slot_id < ca->slots_num; ++slot_id)
     {
-        ca_slot_t *slot = &ca->slots[slot_id];
-        for(int session_id = 0; session_id < MAX_SESSIONS; ++session_id)
-        {
-            ca_session_t *session = &slot->sessions[session_id];
-            if(session->resource_id != RI_CONDITIONAL_ACCESS_SUPPORT)
-                continue;
+        /* the whole list is sent later, see ca_pmt_send_list() */
+        if(ca->slots[slot_id].is_first_ca_pmt)
+            continue;
 
+        const uint16_t session_id = ca_pmt_session(ca, slot_id, current_time);
+        if(session_id)
             ca_pmt_send(ca, ca_pmt, slot_id, session_id, list_manage, cmd);
+    }
+}
+
+/* all programs in one batch with the list management ONLY or FIRST, MORE..., LAST */
+static void ca_pmt_send_list(dvb_ca_t *ca, uint8_t slot_id, uint16_t session_id)
+{
+    int count = 0;
+    asc_list_for(ca->ca_pmt_list)
+    {
+        ca_pmt_t *ca_pmt = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
+        if(ca_pmt_build(  ca, ca_pmt, slot_id, session_id
+                        , CA_PMT_LM_ONLY, CA_PMT_CMD_OK_DESCRAMBLING))
+        {
+            ++count;
+        }
+    }
+
+    int idx = 0;
+    asc_list_for(ca->ca_pmt_list)
+    {
+        ca_pmt_t *ca_pmt = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
+
+        uint8_t list_manage = CA_PMT_LM_MORE;
+        if(count == 1)
+            list_manage = CA_PMT_LM_ONLY;
+        else if(idx == 0)
+            list_manage = CA_PMT_LM_FIRST;
+        else if(idx == count - 1)
+            list_manage = CA_PMT_LM_LAST;
+
+        if(!ca_pmt_build(  ca, ca_pmt, slot_id, session_id
+                         , list_manage, CA_PMT_CMD_OK_DESCRAMBLING))
+        {
+            continue;
         }
+        ++idx;
+
+        asc_log_debug(MSG("CA_PMT: pnr:%d list:%d/%d slot:%d"), ca_pmt->pnr, idx, count, slot_id);
+        ca_apdu_send(ca, slot_id, session_id, AOT_CA_PMT, ca_pmt->buffer, ca_pmt->buffer_size);
     }
 }
 
@@ -485,6 +538,12 @@ static void ca_pmt_send_all(dvb_ca_t *ca, uint8_t list_manage, uint8_t cmd)
     }
 }
 
+static void ca_pmt_free(ca_pmt_t *ca_pmt)
+{
+    mpegts_psi_destroy(ca_pmt->psi);
+    free(ca_pmt);
+}
+
 static void conditional_access_event(dvb_ca_t *ca, uint8_t slot_id, uint16_t session_id)
 {
     const uint32_t tag = ca_apdu_get_tag(ca, slot_id);
@@ -513,8 +572,10 @@ static void conditional_access_event(dvb_ca_t *ca, uint8_t slot_id, uint16_t ses
                              , caid, slot_id, session_id);
             }
 
-            ca->status = CA_MODULE_STATUS_CA_INFO;
-            ca->pmt_check_delay = asc_utime();
+            /* the program list is sent again after the CAM initialization */
+            ca_slot_t *slot = &ca->slots[slot_id];
+            slot->is_first_ca_pmt = true;
+            slot->ca_info_time = asc_utime();
             break;
         }
         case AOT_CA_UPDATE:
@@ -1430,6 +1491,7 @@ static void ca_slot_reset(dvb_ca_t *ca, uint8_t slot_id)
     slot->is_active = false;
     slot->is_busy = false;
     slot->is_first_ca_pmt = true;
+    slot->ca_info_time = 0;
 
     for(asc_list_first(slot->queue); !asc_list_eol(slot->queue); asc_list_first(slot->queue))
     {
@@ -1599,13 +1661,14 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         ca_pmt->buffer_size = 0;
         ca_pmt->psi = mpegts_psi_init(MPEGTS_PACKET_PMT, psi->pid);
         memcpy(ca_pmt->psi, psi, sizeof(mpegts_psi_t));
+        ca_pmt->psi->packets = NULL; // demux cache of the original PMT
 
         asc_list_for(ca->ca_pmt_list_new)
         {
             ca_pmt_t *ca_pmt_check = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new);
             if(ca_pmt_check->pnr == pnr)
             {
-                free(ca_pmt_check);
+                ca_pmt_free(ca_pmt_check);
                 asc_list_remove_current(ca->ca_pmt_list_new);
                 break;
             }
@@ -1634,6 +1697,16 @@ void ca_on_ts(dvb_ca_t *ca, const uint8_t *ts)
     }
 }
 
+/* pid is the list of decoded PIDs, only the PAT and the selected PMTs are passed to ca_on_ts */
+void ca_on_ts_batch(dvb_ca_t *ca, const uint8_t *ts, const uint16_t *pid, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(ca->stream[pid[i]] != MPEGTS_PACKET_UNKNOWN)
+            ca_on_ts(ca, &ts[i * TS_PACKET_SIZE]);
+    }
+}
+
 /*
  * oooooooooo      o       oooooooo8 ooooooooooo
  *  888    888    888     888         888    88
@@ -1702,16 +1775,20 @@ void ca_remove_pnr(dvb_ca_t *ca, uint16_t pnr)
 
 void ca_open(dvb_ca_t *ca)
 {
-    char dev_name[32];
-    sprintf(dev_name, "/dev/dvb/adapter%d/ca%d", ca->adapter, ca->device);
-
-    ca->ca_fd = open(dev_name, O_RDWR | O_NONBLOCK);
+    // passed by the previous process, the CAM sessions are started again
     if(ca->ca_fd <= 0)
     {
-        if(errno != ENOENT)
-            asc_log_error(MSG("CA: failed to open ca [%s]"), strerror(errno));
-        ca->ca_fd = 0;
-        return;
+        char dev_name[32];
+        sprintf(dev_name, "/dev/dvb/adapter%d/ca%d", ca->adapter, ca->device);
+
+        ca->ca_fd = open(dev_name, O_RDWR | O_NONBLOCK);
+        if(ca->ca_fd <= 0)
+        {
+            if(errno != ENOENT)
+                asc_log_error(MSG("CA: failed to open ca [%s]"), strerror(errno));
+            ca->ca_fd = 0;
+            return;
+        }
     }
 
     ca_caps_t caps;
@@ -1803,7 +1880,7 @@ void ca_close(dvb_ca_t *ca)
             ; !asc_list_eol(ca->ca_pmt_list)
             ; asc_list_first(ca->ca_pmt_list))
         {
-            free(asc_list_data(ca->ca_pmt_list));
+            ca_pmt_free((ca_pmt_t *)asc_list_data(ca->ca_pmt_list));
             asc_list_remove_current(ca->ca_pmt_list);
         }
         asc_list_destroy(ca->ca_pmt_list);
@@ -1816,7 +1893,7 @@ void ca_close(dvb_ca_t *ca)
             ; !asc_list_eol(ca->ca_pmt_list_new)
             ; asc_list_first(ca->ca_pmt_list_new))
         {
-            free(asc_list_data(ca->ca_pmt_list_new));
+            ca_pmt_free((ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new));
             asc_list_remove_current(ca->ca_pmt_list_new);
         }
 
@@ -1830,7 +1907,6 @@ void ca_close(dvb_ca_t *ca)
             ; !asc_list_eol(ca->ca_pmt_list_del)
             ; asc_list_first(ca->ca_pmt_list_del))
         {
-            free(asc_list_data(ca->ca_pmt_list_del));
             asc_list_remove_current(ca->ca_pmt_list_del);
         }
 
@@ -1866,6 +1942,13 @@ void ca_close(dvb_ca_t *ca)
     }
 }
 
+/*
+ * Changes are collected by the DVB thread between the batches and sent in one
+ * pass: removed programs are deselected, new and changed programs are added or
+ * updated. Each slot has own TPDU queue, so all slots receive the batch without
+ * waiting each other. A slot after the CAM initialization receives the whole
+ * program list, see ca_pmt_send_list().
+ */
 void ca_loop(dvb_ca_t *ca, int is_data)
 {
     if(is_data)
@@ -1876,111 +1959,82 @@ void ca_loop(dvb_ca_t *ca, int is_data)
 
     ca_slot_loop(ca);
 
-    switch(ca->status)
+    const uint64_t current_time = asc_utime();
+    if(current_time < ca->pmt_check_delay + ca->pmt_delay)
+        return;
+
+    bool is_sent = false;
+
+    pthread_mutex_lock(&ca->ca_mutex);
+
+    for(asc_list_first(ca->ca_pmt_list_del)
+        ; !asc_list_eol(ca->ca_pmt_list_del)
+        ; asc_list_first(ca->ca_pmt_list_del))
     {
-        case CA_MODULE_STATUS_READY:
-            break;
-        case CA_MODULE_STATUS_CA_INFO:
+        const uint16_t pnr = (uint16_t)(intptr_t)asc_list_data(ca->ca_pmt_list_del);
+        asc_list_remove_current(ca->ca_pmt_list_del);
+
+        asc_list_for(ca->ca_pmt_list)
         {
-            const uint64_t current_time = asc_utime();
-            if(current_time >= ca->pmt_check_delay + ca->pmt_delay)
+            ca_pmt_t *ca_pmt = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
+            if(ca_pmt->pnr == pnr)
             {
-                ca->pmt_check_delay = current_time;
-                ca->status = CA_MODULE_STATUS_READY;
+                asc_list_remove_current(ca->ca_pmt_list);
+                ca_pmt_send_one(ca, ca_pmt, CA_PMT_LM_UPDATE, CA_PMT_CMD_NOT_SELECTED);
+                ca_pmt_free(ca_pmt);
+                is_sent = true;
+                break;
             }
-            return;
         }
-        default:
-            return;
     }
 
-    if(asc_list_size(ca->ca_pmt_list_del) > 0)
+    for(asc_list_first(ca->ca_pmt_list_new)
+        ; !asc_list_eol(ca->ca_pmt_list_new)
+        ; asc_list_first(ca->ca_pmt_list_new))
     {
-        const uint64_t current_time = asc_utime();
-        if(current_time >= ca->pmt_check_delay + ca->pmt_delay)
-        {
-            ca->pmt_check_delay = current_time;
+        ca_pmt_t *ca_pmt = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new);
+        asc_list_remove_current(ca->ca_pmt_list_new);
 
-            pthread_mutex_lock(&ca->ca_mutex);
-            asc_list_first(ca->ca_pmt_list_del);
-            uint16_t pnr = (uint16_t)(intptr_t)asc_list_data(ca->ca_pmt_list_del);
-            asc_list_remove_current(ca->ca_pmt_list_del);
-
-            ca_pmt_t *ca_pmt = NULL;
-            asc_list_for(ca->ca_pmt_list)
+        bool is_update = false;
+        asc_list_for(ca->ca_pmt_list)
+        {
+            ca_pmt_t *ca_pmt_current = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
+            if(ca_pmt_current->pnr == ca_pmt->pnr)
             {
-                ca_pmt_t *p = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
-                if(p->pnr == pnr)
-                {
-                    asc_list_remove_current(ca->ca_pmt_list);
-                    ca_pmt = p;
-                    break;
-                }
+                is_update = true;
+                ca_pmt_free(ca_pmt_current);
+                asc_list_remove_current(ca->ca_pmt_list);
+                break;
             }
-
-            if(ca_pmt)
-                ca_pmt_send_one(ca, ca_pmt, CA_PMT_LM_UPDATE, CA_PMT_CMD_NOT_SELECTED);
-
-            pthread_mutex_unlock(&ca->ca_mutex);
         }
+
+        ca_pmt_send_one(  ca, ca_pmt
+                        , (is_update) ? CA_PMT_LM_UPDATE : CA_PMT_LM_ADD
+                        , CA_PMT_CMD_OK_DESCRAMBLING);
+        asc_list_insert_tail(ca->ca_pmt_list, ca_pmt);
+        is_sent = true;
     }
 
-    if(asc_list_size(ca->ca_pmt_list_new) > 0)
+    for(uint8_t slot_id = 0; slot_id < ca->slots_num; ++slot_id)
     {
-        const uint64_t current_time = asc_utime();
-        if(current_time >= ca->pmt_check_delay + ca->pmt_delay)
-        {
-            ca->pmt_check_delay = current_time;
-
-            pthread_mutex_lock(&ca->ca_mutex);
-
-            ca_pmt_t *ca_pmt = NULL;
-            asc_list_for(ca->ca_pmt_list_new)
-            {
-                ca_pmt_t *ca_pmt_check = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new);
-                if(ca_pmt == NULL)
-                {
-                    ca_pmt = ca_pmt_check;
-                }
-                else
-                {
-                    if(ca_pmt_check->pnr < ca_pmt->pnr)
-                        ca_pmt = ca_pmt_check;
-                }
-            }
-
-            bool is_update = false;
-            asc_list_for(ca->ca_pmt_list)
-            {
-                ca_pmt_t *ca_pmt_current = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list);
-                if(ca_pmt_current->pnr == ca_pmt->pnr)
-                {
-                    is_update = true;
-                    free(ca_pmt_current);
-                    asc_list_remove_current(ca->ca_pmt_list);
-                    break;
-                }
-            }
-
-            for(int slot_id = 0; slot_id < ca->slots_num; ++slot_id)
-            {
-                ca_slot_t *slot = &ca->slots[slot_id];
-                for(int session_id = 0; session_id < MAX_SESSIONS; ++session_id)
-                {
-                    ca_session_t *session = &slot->sessions[session_id];
-                    if(session->resource_id != RI_CONDITIONAL_ACCESS_SUPPORT)
-                        continue;
-
-                    ca_pmt_send(  ca, ca_pmt, slot_id, session_id
-                                , (is_update == true) ? CA_PMT_LM_UPDATE : CA_PMT_LM_ADD
-                                , CA_PMT_CMD_OK_DESCRAMBLING);
-                }
-            }
+        ca_slot_t *slot = &ca->slots[slot_id];
+        if(!slot->is_first_ca_pmt)
+            continue;
 
-            asc_list_remove_item(ca->ca_pmt_list_new, ca_pmt);
-            asc_list_insert_tail(ca->ca_pmt_list, ca_pmt);
+        const uint16_t session_id = ca_pmt_session(ca, slot_id, current_time);
+        if(!session_id)
+            continue;
 
-            pthread_mutex_unlock(&ca->ca_mutex);
+        slot->is_first_ca_pmt = false;
+        if(asc_list_size(ca->ca_pmt_list) > 0)
+        {
+            ca_pmt_send_list(ca, slot_id, session_id);
+            is_sent = true;
         }
     }
+
+    pthread_mutex_unlock(&ca->ca_mutex);
+
+    if(is_sent)
+        ca->pmt_check_delay = current_time;
 }
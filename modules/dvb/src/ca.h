@@ -30,14 +30,6 @@ typedef struct dvb_ca_t dvb_ca_t;
 #define MAX_SESSIONS (32 + 1)
 #define MAX_TPDU_SIZE 2048
 
-typedef enum
-{
-    CA_MODULE_STATUS_NONE = 0x00,
-    CA_MODULE_STATUS_APP_INFO = 0x01,
-    CA_MODULE_STATUS_CA_INFO = 0x02,
-    CA_MODULE_STATUS_READY = 0x03,
-} ca_module_status_t;
-
 typedef struct
 {
     uint8_t buffer[MAX_TPDU_SIZE];
@@ -59,7 +51,10 @@ typedef struct
 {
     bool is_active;
     bool is_busy;
-    bool is_first_ca_pmt;
+    bool is_first_ca_pmt; // the whole program list is not sent yet
+
+    // CA_INFO is received, programs are sent after pmt_delay from this time
+    uint64_t ca_info_time;
 
     // send
     asc_list_t *queue;
@@ -117,13 +112,12 @@ struct dvb_ca_t
 
     /* */
 
-    ca_module_status_t status;
-
     uint64_t pmt_delay;
-    uint64_t pmt_check_delay;
+    uint64_t pmt_check_delay; // time of the last batch of CA PMTs
 };
 
 void ca_on_ts(dvb_ca_t *ca, const uint8_t *ts);
+void ca_on_ts_batch(dvb_ca_t *ca, const uint8_t *ts, const uint16_t *pid, size_t count);
 void ca_append_pnr(dvb_ca_t *ca, uint16_t pnr);
 void ca_remove_pnr(dvb_ca_t *ca, uint16_t pnr);
 void ca_open(dvb_ca_t *ca);
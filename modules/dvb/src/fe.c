@@ -59,6 +59,117 @@ static void fe_clear(dvb_fe_t *fe)
  *
  */
 
+/*
+ * Signal statistics are sampled by one FE_GET_PROPERTY request instead of four
+ * legacy ioctls, each of them may go to the demodulator over I2C. The interval
+ * is doubled up to FE_STAT_INTERVAL_MAX status checks while the values are
+ * stable and is reset on change. The main thread reads the cached values.
+ */
+
+#define FE_STAT_INTERVAL_MAX 8
+
+static void fe_read_stat_legacy(dvb_fe_t *fe)
+{
+    if(ioctl(fe->fe_fd, FE_READ_SIGNAL_STRENGTH, &fe->signal) != 0)
+        fe->signal = -2;
+
+    if(ioctl(fe->fe_fd, FE_READ_SNR, &fe->snr) != 0)
+        fe->snr = -2;
+
+    if(ioctl(fe->fe_fd, FE_READ_BER, &fe->ber) != 0)
+        fe->ber = -2;
+
+    if(ioctl(fe->fe_fd, FE_READ_UNCORRECTED_BLOCKS, &fe->unc) != 0)
+        fe->unc = -2;
+}
+
+#if DVB_API >= 510
+/* first layer of the statistics, NULL if the driver has no value in this scale */
+static const struct dtv_stats * fe_stat_value(const struct dtv_property *prop, uint8_t scale)
+{
+    if(!prop->u.st.len || prop->u.st.stat[0].scale != scale)
+        return NULL;
+    return &prop->u.st.stat[0];
+}
+
+static bool fe_read_stat_v5(dvb_fe_t *fe)
+{
+    struct dtv_properties cmdseq;
+    struct dtv_property cmdlist[4];
+
+    DTV_PROPERTY_BEGIN(cmdseq, cmdlist);
+    DTV_PROPERTY_SET(cmdseq, cmdlist, DTV_STAT_SIGNAL_STRENGTH, 0);
+    DTV_PROPERTY_SET(cmdseq, cmdlist, DTV_STAT_CNR, 0);
+    DTV_PROPERTY_SET(cmdseq, cmdlist, DTV_STAT_POST_ERROR_BIT_COUNT, 0);
+    DTV_PROPERTY_SET(cmdseq, cmdlist, DTV_STAT_ERROR_BLOCK_COUNT, 0);
+
+    if(ioctl(fe->fe_fd, FE_GET_PROPERTY, &cmdseq) != 0)
+        return false;
+
+    // raw_signal: signal in dBm, snr in 0.1 dB. otherwise: 0 - 0xFFFF
+    const uint8_t scale = (fe->raw_signal) ? FE_SCALE_DECIBEL : FE_SCALE_RELATIVE;
+    const struct dtv_stats *signal = fe_stat_value(&cmdlist[0], scale);
+    const struct dtv_stats *snr = fe_stat_value(&cmdlist[1], scale);
+    if(!signal || !snr)
+        return false;
+
+    if(fe->raw_signal)
+    {
+        fe->signal = -signal->svalue / 1000;
+        fe->snr = snr->svalue / 100;
+    }
+    else
+    {
+        fe->signal = signal->uvalue;
+        fe->snr = snr->uvalue;
+    }
+
+    // counters: bit errors since the last sample, uncorrected blocks since the tune
+    const struct dtv_stats *ber = fe_stat_value(&cmdlist[2], FE_SCALE_COUNTER);
+    if(ber)
+    {
+        fe->ber = (fe->stat_ber_count && ber->uvalue >= fe->stat_ber_count)
+                ? (int)(ber->uvalue - fe->stat_ber_count)
+                : 0;
+        fe->stat_ber_count = ber->uvalue;
+    }
+    else
+        fe->ber = -2;
+
+    const struct dtv_stats *unc = fe_stat_value(&cmdlist[3], FE_SCALE_COUNTER);
+    fe->unc = (unc) ? (int)unc->uvalue : -2;
+
+    return true;
+}
+#endif
+
+static void fe_read_stat(dvb_fe_t *fe)
+{
+    const int signal = fe->signal;
+    const int snr = fe->snr;
+
+#if DVB_API >= 510
+    if(!fe->is_stat_legacy && !fe_read_stat_v5(fe))
+    {
+        asc_log_debug(MSG("DVBv5 statistics are not available"));
+        fe->is_stat_legacy = true;
+    }
+    if(fe->is_stat_legacy)
+        fe_read_stat_legacy(fe);
+#else
+    fe_read_stat_legacy(fe);
+#endif
+
+    // 1% for the relative values, 1dB for the raw values
+    const int threshold = (fe->raw_signal) ? 10 : 0xFFFF / 100;
+    if(abs(fe->signal - signal) > threshold || abs(fe->snr - snr) > threshold)
+        fe->stat_interval = 0;
+    else if(fe->stat_interval < FE_STAT_INTERVAL_MAX)
+        fe->stat_interval = (fe->stat_interval) ? fe->stat_interval * 2 : 1;
+
+    fe->stat_skip = fe->stat_interval;
+}
+
 static void fe_read_status(dvb_fe_t *fe, fe_status_t fe_status)
 {
     const char ss = (fe_status & FE_HAS_SIGNAL) ? 'S' : '_';
@@ -83,17 +194,10 @@ static void fe_read_status(dvb_fe_t *fe, fe_status_t fe_status)
 
     if(fe->lock)
     {
-        if(ioctl(fe->fe_fd, FE_READ_SIGNAL_STRENGTH, &fe->signal) != 0)
-            fe->signal = -2;
-
-        if(ioctl(fe->fe_fd, FE_READ_SNR, &fe->snr) != 0)
-            fe->snr = -2;
-
-        if(ioctl(fe->fe_fd, FE_READ_BER, &fe->ber) != 0)
-            fe->ber = -2;
-
-        if(ioctl(fe->fe_fd, FE_READ_UNCORRECTED_BLOCKS, &fe->unc) != 0)
-            fe->unc = -2;
+        if(fe->stat_skip > 0 && !fe->log_signal)
+            --fe->stat_skip;
+        else
+            fe_read_stat(fe);
 
         if(fe->log_signal)
         {
@@ -123,6 +227,9 @@ static void fe_read_status(dvb_fe_t *fe, fe_status_t fe_status)
         fe->snr = 0;
         fe->ber = 0;
         fe->unc = 0;
+        fe->stat_skip = 0;
+        fe->stat_interval = 0;
+        fe->stat_ber_count = 0;
 
         if(fe->do_retune == 0)
             fe->do_retune = 1;
@@ -495,21 +602,43 @@ static void fe_tune(dvb_fe_t *fe)
     }
 }
 
-void fe_open(dvb_fe_t *fe)
+void fe_tune_tag(dvb_fe_t *fe, char *tag, size_t size)
 {
-    char dev_name[32];
-    sprintf(dev_name, "/dev/dvb/adapter%d/frontend%d", fe->adapter, fe->device);
+    snprintf(  tag, size, "%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d"
+             , fe->type, fe->delivery_system, fe->frequency, fe->symbolrate
+             , fe->voltage, fe->tone, fe->diseqc, fe->uni_frequency, fe->uni_scr
+             , fe->modulation, fe->fec, fe->rolloff, fe->stream_id, fe->bandwidth);
+}
 
-    fe->fe_fd = open(dev_name,
-        (fe->type != DVB_TYPE_UNKNOWN) ? (O_RDWR | O_NONBLOCK) : (O_RDONLY | O_NONBLOCK));
+void fe_open(dvb_fe_t *fe)
+{
     if(fe->fe_fd <= 0)
     {
-        asc_log_error(MSG("failed to open frontend [%s]"), strerror(errno));
-        astra_abort();
+        char dev_name[32];
+        sprintf(dev_name, "/dev/dvb/adapter%d/frontend%d", fe->adapter, fe->device);
+
+        fe->fe_fd = open(dev_name,
+            (fe->type != DVB_TYPE_UNKNOWN) ? (O_RDWR | O_NONBLOCK) : (O_RDONLY | O_NONBLOCK));
+        if(fe->fe_fd <= 0)
+        {
+            asc_log_error(MSG("failed to open frontend [%s]"), strerror(errno));
+            astra_abort();
+        }
+    }
+
+    if(fe->type == DVB_TYPE_UNKNOWN)
+        return;
+
+    /* the lock of the previous process is kept with the same parameters */
+    if(fe->is_handover)
+    {
+        fe->is_handover = false;
+        fe_check_status(fe);
+        if(fe->lock)
+            return;
     }
 
-    if(fe->type != DVB_TYPE_UNKNOWN)
-        fe_tune(fe);
+    fe_tune(fe);
 }
 
 void fe_close(dvb_fe_t *fe)
@@ -79,6 +79,7 @@ struct dvb_fe_t
 
     /* FE Base */
     int fe_fd;
+    bool is_handover; // fe_fd is tuned by the previous process, see fe_open()
 
     int do_retune;
 
@@ -90,9 +91,17 @@ struct dvb_fe_t
     int snr;
     int ber;
     int unc;
+
+    /* FE Statistics, see fe_read_stat() */
+    bool is_stat_legacy;    // driver has no DVBv5 statistics
+    uint32_t stat_skip;     // status checks before the next sample
+    uint32_t stat_interval; // status checks between the samples
+    uint64_t stat_ber_count;
 };
 
 void fe_open(dvb_fe_t *fe);
+/* tuning parameters, the previous process passes the frontend with them */
+void fe_tune_tag(dvb_fe_t *fe, char *tag, size_t size);
 void fe_close(dvb_fe_t *fe);
 void fe_loop(dvb_fe_t *fe, int is_data);
 
@@ -0,0 +1,198 @@
+/*
+ * Astra Module: File Input Checkpoint
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checkpoint.h"
+
+#define MSG(_msg) "[file_input] " _msg
+
+#define CHECKPOINT_INTERVAL 2000 // ms
+#define CHECKPOINT_SIZE 21 // 20 digits and the new line
+
+struct file_checkpoint_t
+{
+    int fd;
+    const size_t *position;
+    size_t value; // stored on the last sweep
+
+    TAILQ_ENTRY(file_checkpoint_t) entries;
+};
+
+typedef struct
+{
+    int fd;
+    bool is_close; // the checkpoint is closed, the fd is closed after the write
+    char text[CHECKPOINT_SIZE + 1];
+} checkpoint_item_t;
+
+typedef TAILQ_HEAD(checkpoint_list_s, file_checkpoint_t) checkpoint_list_t;
+
+static struct
+{
+    checkpoint_list_t list;
+    checkpoint_list_t closed; // the last position is not written yet
+
+    asc_timer_t *timer;
+    bool is_attached;
+
+    // owned by the job while it is running
+    asc_job_t job;
+    checkpoint_item_t *item_list;
+    size_t item_count;
+    size_t item_size;
+} service =
+{
+    .list = TAILQ_HEAD_INITIALIZER(service.list),
+    .closed = TAILQ_HEAD_INITIALIZER(service.closed),
+};
+
+static void on_checkpoint_write(asc_job_t *job)
+{
+    __uarg(job);
+
+    for(size_t i = 0; i < service.item_count; ++i)
+    {
+        checkpoint_item_t *item = &service.item_list[i];
+        if(pwrite(item->fd, item->text, CHECKPOINT_SIZE, 0) != CHECKPOINT_SIZE)
+            {};
+        if(item->is_close)
+            close(item->fd);
+    }
+}
+
+static void checkpoint_item(int fd, size_t value, bool is_close)
+{
+    if(service.item_count == service.item_size)
+    {
+        service.item_size = (service.item_size) ? service.item_size * 2 : 64;
+        service.item_list = (checkpoint_item_t *)realloc(  service.item_list
+                                                         , service.item_size
+                                                         * sizeof(checkpoint_item_t));
+    }
+
+    checkpoint_item_t *item = &service.item_list[service.item_count++];
+    item->fd = fd;
+    item->is_close = is_close;
+    snprintf(item->text, sizeof(item->text), "%020zu\n", value);
+}
+
+/* collects the changed positions, false if nothing to write */
+static bool checkpoint_collect(void)
+{
+    service.item_count = 0;
+
+    file_checkpoint_t *checkpoint;
+    TAILQ_FOREACH(checkpoint, &service.list, entries)
+    {
+        const size_t value = *checkpoint->position;
+        if(value == checkpoint->value)
+            continue;
+
+        checkpoint->value = value;
+        checkpoint_item(checkpoint->fd, value, false);
+    }
+
+    while((checkpoint = TAILQ_FIRST(&service.closed)) != NULL)
+    {
+        TAILQ_REMOVE(&service.closed, checkpoint, entries);
+        checkpoint_item(checkpoint->fd, checkpoint->value, true);
+        free(checkpoint);
+    }
+
+    return (service.item_count > 0);
+}
+
+static void on_checkpoint_timer(void *arg)
+{
+    __uarg(arg);
+
+    if(!asc_job_is_done(&service.job))
+        return;
+
+    if(checkpoint_collect())
+        asc_job_submit(&service.job, NULL);
+}
+
+/* the last instance is closed: on the reload and on the exit the loop is not running */
+static void checkpoint_flush(void)
+{
+    asc_job_wait(&service.job);
+    if(checkpoint_collect())
+        on_checkpoint_write(&service.job);
+
+    ASC_FREE(service.timer, asc_timer_destroy);
+    ASC_FREE(service.item_list, free);
+    service.item_count = 0;
+    service.item_size = 0;
+
+    if(service.is_attached)
+    {
+        asc_job_detach();
+        service.is_attached = false;
+    }
+}
+
+file_checkpoint_t * file_checkpoint_open(const char *filename, size_t *position)
+{
+    const int fd = open(filename, O_CREAT | O_RDWR | O_BINARY
+#ifndef _WIN32
+                        , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+#else
+                        , S_IRUSR | S_IWUSR);
+#endif
+    if(fd == -1)
+    {
+        asc_log_error(MSG("failed to open lock file %s [%s]"), filename, strerror(errno));
+        return NULL;
+    }
+
+    char text[64];
+    const ssize_t len = pread(fd, text, sizeof(text) - 1, 0);
+    if(len > 0)
+    {
+        text[len] = '\0';
+        *position = strtoul(text, NULL, 10);
+    }
+
+    if(!service.timer)
+    {
+        service.job.run = on_checkpoint_write;
+        service.is_attached = asc_job_attach(1);
+        service.timer = asc_timer_init(CHECKPOINT_INTERVAL, on_checkpoint_timer, NULL);
+    }
+
+    file_checkpoint_t *checkpoint = (file_checkpoint_t *)calloc(1, sizeof(file_checkpoint_t));
+    checkpoint->fd = fd;
+    checkpoint->position = position;
+    checkpoint->value = *position;
+    TAILQ_INSERT_TAIL(&service.list, checkpoint, entries);
+
+    return checkpoint;
+}
+
+void file_checkpoint_close(file_checkpoint_t *checkpoint)
+{
+    TAILQ_REMOVE(&service.list, checkpoint, entries);
+    checkpoint->value = *checkpoint->position;
+    checkpoint->position = NULL;
+    TAILQ_INSERT_TAIL(&service.closed, checkpoint, entries);
+
+    if(TAILQ_EMPTY(&service.list))
+        checkpoint_flush();
+}
@@ -0,0 +1,46 @@
+/*
+ * Astra Module: File Input Checkpoint
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILE_CHECKPOINT_H_
+#define _FILE_CHECKPOINT_H_ 1
+
+#include <astra.h>
+
+/*
+ * Playout positions of the file_input lock files. The lock file is opened
+ * once, the positions of all instances are collected by one timer and
+ * written by pwrite() on the job pool (core/job.h). The position changed
+ * while the previous sweep is writing is written by the next one.
+ *
+ * The position is stored as the fixed width decimal number, the lock file
+ * is not truncated.
+ */
+
+typedef struct file_checkpoint_t file_checkpoint_t;
+
+/*
+ * position - the value is read on the sweep, the stored one is returned
+ * through it on the open. NULL if the lock file is not opened
+ */
+file_checkpoint_t * file_checkpoint_open(const char *filename, size_t *position);
+/* the last position is written by the next sweep */
+void file_checkpoint_close(file_checkpoint_t *checkpoint);
+
+#endif /* _FILE_CHECKPOINT_H_ */
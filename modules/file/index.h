@@ -0,0 +1,106 @@
+/*
+ * Astra Module: File Index
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILE_INDEX_H_
+#define _FILE_INDEX_H_ 1
+
+#include <astra.h>
+
+/*
+ * Index of the recorded segment, stored in "<segment>.idx":
+ *
+ *  header : "AIDX" | version (1) | packet size (1) | reserved (2)
+ *  record : PCR (8) | PTS (8) | offset << 8 | flags (8)
+ *
+ * All numbers are big-endian. Records follow in the file order, so
+ * offsets are increasing and PCR is increasing up to the wrap.
+ * PCR is in 27MHz units, PTS is in 90kHz units or FILE_INDEX_NO_PTS.
+ * Offset is the byte offset of the packet in the segment.
+ */
+
+#define FILE_INDEX_MAGIC "AIDX"
+#define FILE_INDEX_VERSION 1
+#define FILE_INDEX_HEADER_SIZE 8
+#define FILE_INDEX_RECORD_SIZE 24
+
+#define FILE_INDEX_NO_PTS UINT64_MAX
+
+#define FILE_INDEX_FLAG_RAI 0x01 // random access point, segment may start here
+#define FILE_INDEX_FLAG_PCR 0x02 // PCR is carried by the packet
+
+typedef struct
+{
+    uint64_t pcr;
+    uint64_t pts;
+    uint64_t offset;
+    uint8_t flags;
+} file_index_record_t;
+
+static inline void file_index_put_u64(uint8_t *buffer, uint64_t value)
+{
+    for(int i = 7; i >= 0; --i)
+    {
+        buffer[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static inline uint64_t file_index_get_u64(const uint8_t *buffer)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < 8; ++i)
+        value = (value << 8) | buffer[i];
+    return value;
+}
+
+static inline void file_index_header(uint8_t *buffer, uint8_t packet_size)
+{
+    memcpy(buffer, FILE_INDEX_MAGIC, 4);
+    buffer[4] = FILE_INDEX_VERSION;
+    buffer[5] = packet_size;
+    buffer[6] = 0;
+    buffer[7] = 0;
+}
+
+/* returns packet size of the indexed file or 0 if the header is not valid */
+static inline uint8_t file_index_check(const uint8_t *buffer)
+{
+    if(memcmp(buffer, FILE_INDEX_MAGIC, 4) || buffer[4] != FILE_INDEX_VERSION)
+        return 0;
+    return buffer[5];
+}
+
+static inline void file_index_put(uint8_t *buffer, const file_index_record_t *record)
+{
+    file_index_put_u64(&buffer[0], record->pcr);
+    file_index_put_u64(&buffer[8], record->pts);
+    file_index_put_u64(&buffer[16], (record->offset << 8) | record->flags);
+}
+
+static inline void file_index_get(const uint8_t *buffer, file_index_record_t *record)
+{
+    record->pcr = file_index_get_u64(&buffer[0]);
+    record->pts = file_index_get_u64(&buffer[8]);
+    const uint64_t value = file_index_get_u64(&buffer[16]);
+    record->offset = value >> 8;
+    record->flags = value & 0xFF;
+}
+
+#endif /* _FILE_INDEX_H_ */
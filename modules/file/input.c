@@ -24,16 +24,41 @@
  *
  * Module Options:
  *      filename    - string, input file name
- *      lock        - string, lock file name (to store reading position)
+ *      lock        - string, lock file name (to store reading position).
+ *                    written in the background, see checkpoint.h
  *      loop        - boolean, if true play a file in an infinite loop
  *      callback    - function, call function on EOF, without parameters
+ *      buffer_size - number, read block size, in megabytes [default : 2]
+ *      mmap        - boolean, map the file instead of reading blocks [default : true]
+ *      position    - number, start position in seconds, requires the index
+ *      flow_control
+ *                  - boolean, pause the playout while the sinks are full
+ *                    instead of the drop, see module_stream_credit()
+ *      thread_cpus, thread_numa, thread_priority
+ *                  - reading thread placement, see module_option_thread()
+ *
+ * Module Methods:
+ *      length      - return M2TS file length in seconds
+ *      seek(sec)   - start playing from the random access point at the position,
+ *                    in seconds from the beginning. requires the index
+ *
+ * Index "<filename>.idx" is written by the segmented file_output, see index.h
  */
 
 #include <astra.h>
+#include "index.h"
+#include "checkpoint.h"
+
+#ifndef _WIN32
+#   include <sys/mman.h>
+#endif
 
 #define MSG(_msg) "[file_input %s] " _msg, mod->filename
 
 #define INPUT_BUFFER_SIZE 2
+#define FLOW_WAIT_INTERVAL 1000 // us
+
+#define PCR_MAX ((1ULL << 33) * 300)
 
 struct module_data_t
 {
@@ -42,6 +67,8 @@ struct module_data_t
     const char *filename;
     const char *lock;
     bool loop;
+    bool is_mmap;
+    bool is_flow_control;
 
     int fd;
     int idx_callback;
@@ -54,23 +81,49 @@ struct module_data_t
 
     bool is_eof;
 
-    asc_timer_t *timer_skip;
+    file_checkpoint_t *checkpoint;
 
     asc_thread_t *thread;
     asc_thread_buffer_t *thread_output;
 
     uint32_t overflow;
-    uint8_t *buffer;
+    uint8_t *block; // pread() buffer
+    uint8_t *map; // mmap() of the file
+    size_t map_size;
+    uint8_t *buffer; // current block, points to the block or into the map
     uint32_t buffer_size;
     uint32_t buffer_skip;
     uint32_t buffer_end;
 
     uint64_t pcr;
     uint16_t pcr_pid;
+
+    bool is_seek; // set by seek(), handled by the thread
+    uint32_t seek_position;
 };
 
 /* module code */
 
+static void on_thread_read(void *arg);
+
+/* the reading thread waits for the space in the output buffer. returns the waiting time */
+static uint64_t flow_wait(module_data_t *mod, const uint8_t *ts)
+{
+    const uint64_t start = asc_utime();
+    while(mod->fd > 0)
+    {
+        asc_usleep(FLOW_WAIT_INTERVAL);
+        if(asc_thread_buffer_write(mod->thread_output, ts, TS_PACKET_SIZE) == TS_PACKET_SIZE)
+            break;
+    }
+    return asc_utime() - start;
+}
+
+static void on_flow_credit(module_data_t *mod)
+{
+    on_thread_read(mod);
+}
+
 static bool seek_pcr(module_data_t *mod, size_t *block_size, uint64_t *pcr)
 {
     const uint8_t packet_size = mod->m2ts_header + TS_PACKET_SIZE;
@@ -103,10 +156,226 @@ static inline uint32_t m2ts_time(const uint8_t *ts)
     return (ts[0] << 24) | (ts[1] << 16) | (ts[2] << 8) | (ts[3]);
 }
 
-static bool open_file(module_data_t *mod)
+#ifndef _WIN32
+static void map_close(module_data_t *mod)
+{
+    if(mod->map)
+    {
+        munmap(mod->map, mod->map_size);
+        mod->map = NULL;
+        mod->map_size = 0;
+    }
+}
+
+static bool map_open(module_data_t *mod)
 {
-    if(mod->fd)
+    map_close(mod);
+
+    if(!mod->file_size)
+        return false;
+
+    void *map = mmap(NULL, mod->file_size, PROT_READ, MAP_SHARED, mod->fd, 0);
+    if(map == MAP_FAILED)
+    {
+        asc_log_warning(MSG("mmap() failed [%s]. use pread()"), strerror(errno));
+        return false;
+    }
+
+    mod->map = (uint8_t *)map;
+    mod->map_size = mod->file_size;
+    madvise(mod->map, mod->map_size, MADV_SEQUENTIAL);
+
+    return true;
+}
+#endif /* !_WIN32 */
+
+/* loads block from the file_skip position, returns the block size */
+static size_t load_block(module_data_t *mod)
+{
+    mod->buffer_skip = 0;
+    mod->buffer_end = 0;
+
+#ifndef _WIN32
+    if(mod->map)
+    {
+        if(mod->file_skip + mod->buffer_size > mod->map_size)
+        {
+            // file is growing
+            struct stat sb;
+            if(!fstat(mod->fd, &sb) && (size_t)sb.st_size > mod->map_size)
+            {
+                mod->file_size = sb.st_size;
+                if(!map_open(mod))
+                    return 0;
+            }
+        }
+
+        if(mod->file_skip >= mod->map_size)
+            return 0;
+
+        size_t size = mod->map_size - mod->file_skip;
+        if(size > mod->buffer_size)
+        {
+            size = mod->buffer_size;
+
+            // read ahead the next block while this one is playing
+            const size_t next = mod->file_skip + size;
+            const size_t page = next & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+            size_t next_size = mod->map_size - page;
+            if(next_size > mod->buffer_size)
+                next_size = mod->buffer_size;
+            madvise(&mod->map[page], next_size, MADV_WILLNEED);
+        }
+
+        mod->buffer = &mod->map[mod->file_skip];
+        mod->buffer_end = size;
+        return size;
+    }
+#endif
+
+    if(!mod->block)
+        mod->block = (uint8_t *)malloc(mod->buffer_size);
+    mod->buffer = mod->block;
+
+    const ssize_t len = pread(mod->fd, mod->buffer, mod->buffer_size, mod->file_skip);
+    if(len <= 0)
+        return 0;
+
+    mod->buffer_end = len;
+    return len;
+}
+
+static void close_file(module_data_t *mod)
+{
+    if(mod->fd > 0)
+    {
         close(mod->fd);
+        mod->fd = 0;
+    }
+
+#ifndef _WIN32
+    map_close(mod);
+#endif
+}
+
+/* finds the first PCR from the start of the block */
+static bool seek_first_pcr(module_data_t *mod)
+{
+    size_t block_size = 0;
+    const uint8_t *ts = &mod->buffer[mod->m2ts_header];
+    if(mod->buffer_end >= (uint32_t)(mod->m2ts_header + TS_PACKET_SIZE) && TS_IS_PCR(ts))
+    {
+        const uint16_t pid = TS_GET_PID(ts);
+        if(mod->pcr_pid == 0)
+            mod->pcr_pid = pid;
+
+        if(mod->pcr_pid == pid)
+        {
+            mod->pcr = TS_GET_PCR(ts);
+            return true;
+        }
+    }
+
+    if(!seek_pcr(mod, &block_size, &mod->pcr))
+        return false;
+
+    mod->buffer_skip = block_size;
+    return true;
+}
+
+static uint64_t pcr_delta(uint64_t pcr_last, uint64_t pcr_current)
+{
+    return (pcr_current >= pcr_last)
+         ? (pcr_current - pcr_last)
+         : (PCR_MAX - pcr_last + pcr_current);
+}
+
+/* returns file offset of the random access point on the position, in seconds */
+static bool index_seek(module_data_t *mod, uint32_t position, size_t *offset)
+{
+    const size_t name_size = strlen(mod->filename);
+    char *index_name = (char *)malloc(name_size + sizeof(".idx"));
+    memcpy(index_name, mod->filename, name_size);
+    memcpy(&index_name[name_size], ".idx", sizeof(".idx"));
+
+    const int fd = open(index_name, O_RDONLY | O_BINARY);
+    free(index_name);
+    if(fd <= 0)
+    {
+        asc_log_warning(MSG("index is not found"));
+        return false;
+    }
+
+    struct stat sb;
+    uint8_t *index = NULL;
+    size_t index_size = 0;
+    if(!fstat(fd, &sb) && sb.st_size >= FILE_INDEX_HEADER_SIZE + FILE_INDEX_RECORD_SIZE)
+    {
+        index_size = sb.st_size;
+        index = (uint8_t *)malloc(index_size);
+        const ssize_t len = pread(fd, index, index_size, 0);
+        index_size = (len > 0) ? (size_t)len : 0;
+    }
+    close(fd);
+
+    const size_t count = (index_size > FILE_INDEX_HEADER_SIZE)
+                       ? (index_size - FILE_INDEX_HEADER_SIZE) / FILE_INDEX_RECORD_SIZE
+                       : 0;
+    if(!count || file_index_check(index) != mod->m2ts_header + TS_PACKET_SIZE)
+    {
+        asc_log_error(MSG("wrong index format"));
+        free(index);
+        return false;
+    }
+
+    const uint8_t *records = &index[FILE_INDEX_HEADER_SIZE];
+    file_index_record_t record;
+    file_index_get(records, &record);
+    const uint64_t pcr_start = record.pcr;
+    const uint64_t pcr_position = (uint64_t)position * 27000000;
+
+    // last record before the position, PCR is increasing up to the wrap
+    size_t lo = 0, hi = count;
+    while(hi - lo > 1)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        file_index_get(&records[mid * FILE_INDEX_RECORD_SIZE], &record);
+        if(pcr_delta(pcr_start, record.pcr) <= pcr_position)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // random access point, playing starts from the PCR before it
+    size_t i = lo;
+    for(; i > 0; --i)
+    {
+        file_index_get(&records[i * FILE_INDEX_RECORD_SIZE], &record);
+        if(record.flags & FILE_INDEX_FLAG_RAI)
+            break;
+    }
+    for(; i > 0; --i)
+    {
+        file_index_get(&records[i * FILE_INDEX_RECORD_SIZE], &record);
+        if(record.flags & FILE_INDEX_FLAG_PCR)
+            break;
+    }
+    file_index_get(&records[i * FILE_INDEX_RECORD_SIZE], &record);
+    free(index);
+
+    if(record.offset >= mod->file_size)
+    {
+        asc_log_error(MSG("index is out of the file"));
+        return false;
+    }
+
+    *offset = record.offset;
+    return true;
+}
+
+static bool open_file(module_data_t *mod)
+{
+    close_file(mod);
 
     mod->fd = open(mod->filename, O_RDONLY | O_BINARY);
     if(mod->fd <= 0)
@@ -119,6 +388,11 @@ static bool open_file(module_data_t *mod)
     fstat(mod->fd, &sb);
     mod->file_size = sb.st_size;
 
+#ifndef _WIN32
+    if(mod->is_mmap)
+        map_open(mod);
+#endif
+
     if(mod->file_skip)
     {
         if(mod->file_skip >= mod->file_size)
@@ -128,15 +402,12 @@ static bool open_file(module_data_t *mod)
         }
     }
 
-    const ssize_t len = pread(mod->fd, mod->buffer, mod->buffer_size, mod->file_skip);
-    if(len < 0)
+    if(load_block(mod) < M2TS_PACKET_SIZE + 4 + 1)
     {
         asc_log_error(MSG("failed to read file"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
-    mod->buffer_end = len;
 
     if(mod->buffer[0] == 0x47 && mod->buffer[TS_PACKET_SIZE] == 0x47)
         mod->m2ts_header = 0;
@@ -145,17 +416,14 @@ static bool open_file(module_data_t *mod)
     else
     {
         asc_log_error(MSG("wrong file format"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
 
-    size_t block_size = 0;
-    if(!seek_pcr(mod, &block_size, &mod->pcr))
+    if(!seek_first_pcr(mod))
     {
         asc_log_error(MSG("first PCR is not found"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
 
@@ -177,11 +445,25 @@ static bool open_file(module_data_t *mod)
         }
     }
 
-    mod->buffer_skip = block_size;
-
     return true;
 }
 
+static bool seek_file(module_data_t *mod, uint32_t position)
+{
+    size_t offset = 0;
+    if(!index_seek(mod, position, &offset))
+        return false;
+
+    mod->file_skip = offset;
+    if(!load_block(mod) || !TS_IS_SYNC((&mod->buffer[mod->m2ts_header])))
+    {
+        asc_log_error(MSG("wrong index offset"));
+        return false;
+    }
+
+    return seek_first_pcr(mod);
+}
+
 static void thread_loop(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -202,6 +484,22 @@ static void thread_loop(void *arg)
 
     while(mod->fd > 0)
     {
+        if(mod->is_seek)
+        {
+            mod->is_seek = false;
+            if(!seek_file(mod, mod->seek_position))
+            {
+                // restart from the beginning of the file
+                mod->file_skip = 0;
+                if(!open_file(mod))
+                {
+                    mod->is_eof = true;
+                    return;
+                }
+            }
+            reset = true;
+        }
+
         if(reset)
         {
             reset = false;
@@ -212,9 +510,7 @@ static void thread_loop(void *arg)
         {
             // try to load data
             mod->file_skip += mod->buffer_skip;
-            const ssize_t len = pread(mod->fd, mod->buffer, mod->buffer_size, mod->file_skip);
-            mod->buffer_end = (len > 0) ? len : 0;
-            mod->buffer_skip = 0;
+            load_block(mod);
             if(!seek_pcr(mod, &block_size, &pcr))
             {
                 if(!mod->loop)
@@ -267,7 +563,13 @@ static void thread_loop(void *arg)
                                                          , &mod->buffer[mod->buffer_skip]
                                                          , TS_PACKET_SIZE))
             {
-                ;
+                if(mod->is_flow_control)
+                {
+                    // the playout clock is shifted by the pause
+                    const uint64_t wait_time = flow_wait(mod, &mod->buffer[mod->buffer_skip]);
+                    block_time_total += wait_time;
+                    system_time_check += wait_time;
+                }
             }
             mod->buffer_skip += TS_PACKET_SIZE;
 
@@ -316,6 +618,9 @@ static void on_thread_close(void *arg)
     ASC_FREE(mod->thread, asc_thread_destroy);
     ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
 
+    // the thread is stopped, the map is not used
+    close_file(mod);
+
     if(mod->is_eof && mod->idx_callback)
     {
         lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
@@ -327,6 +632,34 @@ static void on_thread_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
+    size_t credit = STREAM_CREDIT_MAX;
+    if(mod->is_flow_control)
+    {
+        credit = module_stream_credit(mod);
+        if(credit == 0)
+        {
+            module_stream_wait(mod, on_flow_credit);
+            return;
+        }
+    }
+
+    size_t size = TS_PACKET_SIZE;
+    const uint8_t *ptr = asc_thread_buffer_peek(mod->thread_output, &size);
+    size_t count = size / TS_PACKET_SIZE;
+    if(count > credit)
+    {
+        count = credit;
+        module_stream_wait(mod, on_flow_credit);
+    }
+    if(count > 0)
+    {
+        module_stream_send_batch(mod, ptr, count);
+        if(!asc_thread_buffer_consume(mod->thread_output, count * TS_PACKET_SIZE))
+            asc_log_debug(MSG("thread buffer flushed"));
+        return;
+    }
+
+    /* packet is wrapped at the end of the buffer */
     uint8_t ts[TS_PACKET_SIZE];
     const ssize_t r = asc_thread_buffer_read(mod->thread_output, ts, TS_PACKET_SIZE);
     if(r != TS_PACKET_SIZE)
@@ -335,26 +668,6 @@ static void on_thread_read(void *arg)
     module_stream_send(mod, ts);
 }
 
-static void timer_skip_set(void *arg)
-{
-    module_data_t *mod = (module_data_t *)arg;
-    char skip_str[64];
-    int fd = open(mod->lock, O_CREAT | O_WRONLY | O_TRUNC
-#ifndef _WIN32
-                  , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-#else
-                  , S_IRUSR | S_IWUSR);
-#endif
-
-    if(fd > 0)
-    {
-        const int l = sprintf(skip_str, "%lu", mod->file_skip);
-        if(write(fd, skip_str, l) <= 0)
-            {};
-        close(fd);
-    }
-}
-
 /* methods */
 
 static int method_length(module_data_t *mod)
@@ -363,6 +676,13 @@ static int method_length(module_data_t *mod)
     return 1;
 }
 
+static int method_seek(module_data_t *mod)
+{
+    mod->seek_position = (uint32_t)luaL_checknumber(lua, 2);
+    mod->is_seek = true;
+    return 0;
+}
+
 /* required */
 
 static void module_init(module_data_t *mod)
@@ -373,22 +693,21 @@ static void module_init(module_data_t *mod)
     if(!module_option_number("buffer_size", &buffer_size) || buffer_size <= 0)
         buffer_size = INPUT_BUFFER_SIZE;
     mod->buffer_size = buffer_size * 1024 * 1024;
-    mod->buffer = malloc(mod->buffer_size);
+
+    mod->is_mmap = true;
+    module_option_boolean("mmap", &mod->is_mmap);
 
     bool check_length;
     if(module_option_boolean("check_length", &check_length) && check_length)
     {
         open_file(mod);
-        if(mod->fd > 0)
-        {
-            close(mod->fd);
-            mod->fd = 0;
-        }
+        close_file(mod);
         return;
     }
 
     module_option_string("lock", &mod->lock, NULL);
     module_option_boolean("loop", &mod->loop);
+    module_option_boolean("flow_control", &mod->is_flow_control);
 
     // store callback in registry
     lua_getfield(lua, 2, "callback");
@@ -400,20 +719,18 @@ static void module_init(module_data_t *mod)
     module_stream_init(mod, NULL);
 
     if(mod->lock)
+        mod->checkpoint = file_checkpoint_open(mod->lock, &mod->file_skip);
+
+    int position = 0;
+    if(module_option_number("position", &position) && position > 0)
     {
-        int fd = open(mod->lock, O_RDONLY);
-        if(fd)
-        {
-            char skip_str[64];
-            const int l = read(fd, skip_str, sizeof(skip_str));
-            if(l > 0)
-                mod->file_skip = strtoul(skip_str, NULL, 10);
-            close(fd);
-        }
-        mod->timer_skip = asc_timer_init(2000, timer_skip_set, mod);
+        mod->seek_position = position;
+        mod->is_seek = true;
     }
 
     mod->thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->thread, "file_input");
+    module_option_thread(mod->thread);
     mod->thread_output = asc_thread_buffer_init(mod->buffer_size);
     asc_thread_start(  mod->thread
                      , thread_loop
@@ -423,12 +740,14 @@ static void module_init(module_data_t *mod)
 
 static void module_destroy(module_data_t *mod)
 {
-    asc_timer_destroy(mod->timer_skip);
-
     if(mod->thread)
         on_thread_close(mod);
 
-    ASC_FREE(mod->buffer, free);
+    ASC_FREE(mod->checkpoint, file_checkpoint_close);
+
+    close_file(mod);
+    ASC_FREE(mod->block, free);
+    mod->buffer = NULL;
 
     if(mod->idx_callback)
     {
@@ -443,7 +762,8 @@ MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
-    { "length", method_length }
+    { "length", method_length },
+    { "seek", method_seek }
 };
 
 MODULE_LUA_REGISTER(file_input)
@@ -1,5 +1,10 @@
-SOURCES="input.c output.c"
-MODULES="file_input file_output"
+SOURCES="input.c output.c recorder.c checkpoint.c"
+MODULES="file_input file_output file_recorder"
+
+if [ "$OS" != "mingw" ] ; then
+    SOURCES="$SOURCES playlist.c"
+    MODULES="$MODULES file_playlist"
+fi
 
 posix_memalign_test_c()
 {
@@ -58,3 +63,22 @@ if check_aio ; then
         fi
     fi
 fi
+
+io_uring_test_c()
+{
+    cat <<EOF
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main(void) { return syscall(__NR_io_uring_setup, 0, NULL) + IORING_OP_WRITEV; }
+EOF
+}
+
+check_io_uring()
+{
+    io_uring_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if [ "$OS" = "linux" ] && check_io_uring ; then
+    CFLAGS="$CFLAGS -DHAVE_IO_URING=1"
+fi
@@ -28,13 +28,27 @@
  *      buffer_size - number, output buffer size. in kilobytes [default : 32]
  *      aio         - boolean, use aio [default : false]
  *      directio    - boolean, try to avoid all caching operations [default : false]
+ *      uring       - boolean, use io_uring, several writes in flight [default : false]
+ *      segment     - number, start new file every N seconds [default : 0]
+ *      segment_size - number, start new file every N megabytes [default : 0]
+ *      index       - boolean, write index next to each segment [default : true]
+ *
+ * Segmented recording:
+ *      segments are started on the random access point or on the PCR if the
+ *      stream has no RAI flags. file name of the segment is the filename with
+ *      the start time (unix time) before the extension:
+ *      /rec/ch1.ts -> /rec/ch1-1420070400.ts, /rec/ch1-1420070400.ts.idx
+ *      index format is described in index.h
  *
  * Module Methods:
- *      status      - return table with items:
+ *      status      - return object with items, the same object on each call:
  *                    size      - number, current file size
+ *                    segment   - string, current segment file name
+ *                    segments  - number, segments started
  */
 
 #include <astra.h>
+#include "index.h"
 
 #ifdef HAVE_AIO
 #   include <aio.h>
@@ -43,13 +57,46 @@
 #   endif
 #endif
 
+#ifdef HAVE_IO_URING
+#   include <sys/syscall.h>
+#   include <sys/mman.h>
+#   include <sys/uio.h>
+#   include <sys/eventfd.h>
+#   include <linux/io_uring.h>
+#endif
+
 #define FILE_BUFFER_SIZE 32
 
+/* io_uring: write buffers of each output and the size of the shared ring */
+#define FILE_URING_BUFFERS 8
+#define FILE_URING_ENTRIES 1024
+#define FILE_URING_CQ_ENTRIES 8192
+
+/* segments: index records in memory, PCR interval of records without RAI */
+#define FILE_INDEX_BUFFER_SIZE 256
+#define FILE_INDEX_INTERVAL (27000000ULL)
+/* time to wait for the segment boundary before the forced cut, in microseconds */
+#define FILE_SEGMENT_WAIT (5 * 1000 * 1000)
+
+#define PCR_MAX ((1ULL << 33) * 300)
+
+#define IS_SEGMENT(_mod) (_mod->config.segment || _mod->config.segment_size)
+
 #define ALIGN 4096
 #define align(_size) ((_size / ALIGN) * ALIGN)
 
 #define MSG(_msg) "[file_output %s] " _msg, mod->config.filename
 
+#ifdef HAVE_IO_URING
+typedef struct
+{
+    module_data_t *mod;
+    uint8_t *buffer;
+    struct iovec iov;
+    bool is_busy; // write in flight
+} file_uring_buffer_t;
+#endif
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -68,6 +115,14 @@ struct module_data_t
 #ifdef HAVE_LIBAIO
         bool aio_kernel;
 #endif
+
+#ifdef HAVE_IO_URING
+        bool uring;
+#endif
+
+        uint64_t segment; // in microseconds
+        uint64_t segment_size;
+        bool index;
     } config;
 
     int fd;
@@ -83,20 +138,749 @@ struct module_data_t
     struct iocb *io[1];
 #endif
 
+#ifdef HAVE_IO_URING
+    file_uring_buffer_t uring_list[FILE_URING_BUFFERS];
+    int uring_current; // buffer of on_ts(), mod->buffer
+    int uring_inflight;
+    uint64_t uring_offset; // file offset of the next write
+#endif
+
     size_t file_size;
 
+    /* segmented recording */
+    char *segment_name;
+    uint32_t segment_count;
+    uint64_t segment_bytes; // written and buffered bytes of the segment
+    uint64_t segment_time; // asc_utime() of the segment start
+    bool is_segment_pcr;
+    uint64_t segment_pcr;
+    bool is_rotate; // waiting for the segment boundary
+    uint64_t rotate_time;
+
+    uint16_t pcr_pid;
+    bool is_pcr;
+    uint64_t pcr;
+    bool is_rai; // stream marks random access points
+
+    int index_fd;
+    uint8_t *index_buffer;
+    size_t index_skip;
+    bool is_index_pcr;
+    uint64_t index_pcr;
+
     uint8_t packet_size;
     size_t buffer_size;
     size_t buffer_skip;
     uint8_t *buffer; // write buffer
+
+    int idx_stat;
 };
 
+static void buffer_append(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->packet_size == TS_PACKET_SIZE)
+    {
+        memcpy(&mod->buffer[mod->buffer_skip], ts, TS_PACKET_SIZE);
+        mod->buffer_skip += TS_PACKET_SIZE;
+    }
+    else
+    {
+        const uint64_t t = asc_utime() / 1000;
+        mod->buffer[0 + mod->buffer_skip] = (t >> 24) & 0xFF;
+        mod->buffer[1 + mod->buffer_skip] = (t >> 16) & 0xFF;
+        mod->buffer[2 + mod->buffer_skip] = (t >>  8) & 0xFF;
+        mod->buffer[3 + mod->buffer_skip] = (t      ) & 0xFF;
+        memcpy(&mod->buffer[4 + mod->buffer_skip], ts, TS_PACKET_SIZE);
+        mod->buffer_skip += M2TS_PACKET_SIZE;
+    }
+
+    mod->segment_bytes += mod->packet_size;
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * ooooo  oooo oooooooooo  ooooo oooo   oooo  ooooooo8
+ *  888    88   888    888  888   8888o  88 o888    88
+ *  888    88   888oooo88   888   88 888o88 888    oooo
+ *  888    88   888  88o    888   88   8888 888o    88
+ *   888oo88   o888o  88o8 o888o o88o    88  888ooo888
+ *
+ * One ring serves all outputs. Each output fills its buffers in turn,
+ * the full buffer is queued without a copy and the next one is filled
+ * while the write is in flight. Queued writes of all outputs are submitted
+ * at once by a zero timer, the completions are reaped on the ring eventfd.
+ */
+
+typedef struct
+{
+    int fd;
+    int event_fd;
+    asc_event_t *event;
+    asc_timer_t *submit_timer;
+    int refcount;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t sq_pending; // queued, not submitted
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+} file_uring_t;
+
+static file_uring_t *file_uring = NULL;
+
+static int uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, file_uring->fd
+                        , to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_on_write(file_uring_buffer_t *item, int res)
+{
+    module_data_t *mod = item->mod;
+
+    item->is_busy = false;
+    --mod->uring_inflight;
+
+    if(res < 0)
+    {
+        if(!mod->error)
+        {
+            asc_log_error(MSG("io_uring write error: %s"), strerror(-res));
+            mod->error = true;
+        }
+        return;
+    }
+
+    mod->file_size += res;
+    if((size_t)res != item->iov.iov_len && !mod->error)
+    {
+        asc_log_error(MSG("io_uring short write"));
+        mod->error = true;
+    }
+}
+
+static void uring_reap(void)
+{
+    uint32_t head = *file_uring->cq_head;
+    const uint32_t tail = __atomic_load_n(file_uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while(head != tail)
+    {
+        const struct io_uring_cqe *cqe = &file_uring->cqes[head & file_uring->cq_mask];
+        uring_on_write((file_uring_buffer_t *)(uintptr_t)cqe->user_data, cqe->res);
+        ++head;
+    }
+
+    __atomic_store_n(file_uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_submit(void)
+{
+    while(file_uring->sq_pending > 0)
+    {
+        const int ret = uring_enter(file_uring->sq_pending, 0, 0);
+        if(ret >= 0)
+        {
+            file_uring->sq_pending -= ret;
+            continue;
+        }
+
+        if(errno == EINTR)
+            continue;
+
+        if(errno == EAGAIN || errno == EBUSY)
+        {
+            // completion queue is full, wait for the one write
+            uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+            uring_reap();
+            continue;
+        }
+
+        asc_log_error("[file_output] io_uring_enter() failed [%s]", strerror(errno));
+        astra_abort();
+    }
+}
+
+static void on_uring_submit(void *arg)
+{
+    __uarg(arg);
+
+    file_uring->submit_timer = NULL;
+    uring_submit();
+}
+
+static void on_uring_event(void *arg)
+{
+    __uarg(arg);
+
+    uint64_t value;
+    if(read(file_uring->event_fd, &value, sizeof(value)) != sizeof(value))
+    {
+        ; /* counter is empty */
+    }
+
+    uring_reap();
+}
+
+static void uring_queue(file_uring_buffer_t *item, int fd, uint64_t offset)
+{
+    if(file_uring->sq_pending == file_uring->sq_entries)
+        uring_submit();
+
+    const uint32_t tail = *file_uring->sq_tail;
+    const uint32_t index = tail & file_uring->sq_mask;
+
+    struct io_uring_sqe *sqe = &file_uring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)&item->iov;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t)item;
+
+    file_uring->sq_array[index] = index;
+    __atomic_store_n(file_uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++file_uring->sq_pending;
+
+    if(!file_uring->submit_timer)
+        file_uring->submit_timer = asc_timer_one_shot(0, on_uring_submit, NULL);
+}
+
+static void uring_close(void)
+{
+    if(!file_uring)
+        return;
+
+    --file_uring->refcount;
+    if(file_uring->refcount > 0)
+        return;
+
+    ASC_FREE(file_uring->submit_timer, asc_timer_destroy);
+    ASC_FREE(file_uring->event, asc_event_close);
+    if(file_uring->event_fd > 0)
+        close(file_uring->event_fd);
+
+    if(file_uring->sqes)
+        munmap(file_uring->sqes, file_uring->sqes_size);
+    if(file_uring->cq_ring)
+        munmap(file_uring->cq_ring, file_uring->cq_ring_size);
+    if(file_uring->sq_ring)
+        munmap(file_uring->sq_ring, file_uring->sq_ring_size);
+    close(file_uring->fd);
+
+    free(file_uring);
+    file_uring = NULL;
+}
+
+static bool uring_open(void)
+{
+    if(file_uring)
+    {
+        ++file_uring->refcount;
+        return true;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+#ifdef IORING_SETUP_CQSIZE
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = FILE_URING_CQ_ENTRIES;
+#endif
+
+    const int fd = (int)syscall(__NR_io_uring_setup, FILE_URING_ENTRIES, &params);
+    if(fd < 0)
+    {
+        asc_log_error("[file_output] io_uring_setup() failed [%s]", strerror(errno));
+        return false;
+    }
+
+    file_uring = (file_uring_t *)calloc(1, sizeof(file_uring_t));
+    asc_assert(file_uring != NULL, "[file_output] failed to allocate io_uring");
+    file_uring->fd = fd;
+    file_uring->refcount = 1;
+
+    file_uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    file_uring->cq_ring_size = params.cq_off.cqes
+                             + params.cq_entries * sizeof(struct io_uring_cqe);
+    file_uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *sq_ring = mmap(NULL, file_uring->sq_ring_size, PROT_READ | PROT_WRITE
+                         , MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void *cq_ring = mmap(NULL, file_uring->cq_ring_size, PROT_READ | PROT_WRITE
+                         , MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, file_uring->sqes_size, PROT_READ | PROT_WRITE
+                      , MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    file_uring->sq_ring = (sq_ring != MAP_FAILED) ? sq_ring : NULL;
+    file_uring->cq_ring = (cq_ring != MAP_FAILED) ? cq_ring : NULL;
+    file_uring->sqes = (sqes != MAP_FAILED) ? (struct io_uring_sqe *)sqes : NULL;
+
+    file_uring->event_fd = eventfd(0, EFD_NONBLOCK);
+
+    if(   !file_uring->sq_ring || !file_uring->cq_ring || !file_uring->sqes
+       || file_uring->event_fd <= 0
+       || syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD
+                  , &file_uring->event_fd, 1) != 0)
+    {
+        asc_log_error("[file_output] failed to init io_uring [%s]", strerror(errno));
+        uring_close();
+        return false;
+    }
+
+    uint8_t *sq_ptr = (uint8_t *)file_uring->sq_ring;
+    file_uring->sq_head = (uint32_t *)&sq_ptr[params.sq_off.head];
+    file_uring->sq_tail = (uint32_t *)&sq_ptr[params.sq_off.tail];
+    file_uring->sq_array = (uint32_t *)&sq_ptr[params.sq_off.array];
+    file_uring->sq_mask = *(uint32_t *)&sq_ptr[params.sq_off.ring_mask];
+    file_uring->sq_entries = params.sq_entries;
+
+    uint8_t *cq_ptr = (uint8_t *)file_uring->cq_ring;
+    file_uring->cq_head = (uint32_t *)&cq_ptr[params.cq_off.head];
+    file_uring->cq_tail = (uint32_t *)&cq_ptr[params.cq_off.tail];
+    file_uring->cq_mask = *(uint32_t *)&cq_ptr[params.cq_off.ring_mask];
+    file_uring->cqes = (struct io_uring_cqe *)&cq_ptr[params.cq_off.cqes];
+
+    file_uring->event = asc_event_init(file_uring->event_fd, NULL);
+    asc_event_set_on_read(file_uring->event, on_uring_event);
+
+    return true;
+}
+
+static void uring_buffer_init(module_data_t *mod)
+{
+    for(int i = 0; i < FILE_URING_BUFFERS; ++i)
+    {
+        file_uring_buffer_t *item = &mod->uring_list[i];
+        item->mod = mod;
+        item->buffer = (uint8_t *)asc_ring_alloc(mod->buffer_size, -1);
+    }
+
+    mod->uring_current = 0;
+    mod->buffer = mod->uring_list[0].buffer;
+}
+
+/* queues the current buffer, returns false if the next buffer is still in flight */
+static bool uring_write(module_data_t *mod)
+{
+    size_t size = mod->buffer_skip;
+#ifdef O_DIRECT
+    if(mod->config.directio)
+        size = align(size);
+#endif
+    if(!size)
+        return true;
+
+    const int next = (mod->uring_current + 1) % FILE_URING_BUFFERS;
+    file_uring_buffer_t *next_item = &mod->uring_list[next];
+    if(next_item->is_busy)
+    {
+        if(!mod->error)
+        {
+            asc_log_error(MSG("io_uring writes in progress. Try to increase buffer size"));
+            mod->error = true;
+        }
+        return false;
+    }
+
+    file_uring_buffer_t *item = &mod->uring_list[mod->uring_current];
+    item->iov.iov_base = item->buffer;
+    item->iov.iov_len = size;
+    item->is_busy = true;
+    ++mod->uring_inflight;
+    uring_queue(item, mod->fd, mod->uring_offset);
+    mod->uring_offset += size;
+
+    // unaligned tail of the O_DIRECT write goes to the next buffer
+    mod->buffer_skip -= size;
+    if(mod->buffer_skip)
+        memcpy(next_item->buffer, &item->buffer[size], mod->buffer_skip);
+
+    mod->uring_current = next;
+    mod->buffer = next_item->buffer;
+    return true;
+}
+
+static void uring_on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->buffer_skip + mod->packet_size > mod->buffer_size || !ts)
+    {
+        if(!uring_write(mod) || !ts)
+            return;
+    }
+
+    buffer_append(mod, ts);
+}
+
+/* waits for the writes in flight, the tail is written without O_DIRECT */
+static void uring_flush(module_data_t *mod)
+{
+    uring_submit();
+    while(mod->uring_inflight > 0)
+    {
+        uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+        uring_reap();
+    }
+
+    if(mod->buffer_skip > 0 && !mod->error)
+    {
+#ifdef O_DIRECT
+        if(mod->config.directio)
+            fcntl(mod->fd, F_SETFL, fcntl(mod->fd, F_GETFL) & ~O_DIRECT);
+#endif
+        const ssize_t len = pwrite(mod->fd, mod->buffer, mod->buffer_skip, mod->uring_offset);
+        if(len > 0)
+            mod->file_size += len;
+        mod->buffer_skip = 0;
+    }
+}
+
+static void uring_destroy(module_data_t *mod)
+{
+    if(!mod->uring_list[0].buffer)
+        return;
+
+    uring_flush(mod);
+
+    for(int i = 0; i < FILE_URING_BUFFERS; ++i)
+    {
+        asc_ring_free(mod->uring_list[i].buffer, mod->buffer_size);
+        mod->uring_list[i].buffer = NULL;
+    }
+    mod->buffer = NULL;
+
+    uring_close();
+}
+
+#endif /* HAVE_IO_URING */
+
+static int file_open(module_data_t *mod, const char *filename, int flags)
+{
+    flags |= O_CREAT | O_WRONLY | O_BINARY;
+    int mode = S_IRUSR | S_IWUSR;
+
+#ifdef HAVE_IO_URING
+    // writes in flight are placed by the offset
+    if(mod->config.uring)
+        flags &= ~O_APPEND;
+#endif
+
+#ifdef HAVE_AIO
+    flags |= O_NONBLOCK;
+    mode |= S_IRGRP | S_IROTH;
+#endif
+
+#ifdef O_DIRECT
+    if(mod->config.directio)
+        flags |= O_DIRECT;
+#endif
+
+    return open(filename, flags, mode);
+}
+
+/*
+ *  oooooooo8 ooooooooooo  ooooooo8  oooo     oooo ooooooooooo oooo   oooo ooooooooooo
+ * 888         888    88 o888    88   8888o   888   888    88   8888o  88  88  888  88
+ *  888oooooo  888ooo8   888    oooo  88 888o8 88   888ooo8     88 888o88      888
+ *         888 888    oo 888o    88   88  888  88   888    oo   88   8888      888
+ * o88oooo888 o888ooo8888 888ooo888  o88o  8  o88o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static uint64_t pcr_delta(uint64_t pcr_last, uint64_t pcr_current)
+{
+    return (pcr_current >= pcr_last)
+         ? (pcr_current - pcr_last)
+         : (PCR_MAX - pcr_last + pcr_current);
+}
+
+static char * segment_name(module_data_t *mod, uint64_t start, int seq)
+{
+    const char *filename = mod->config.filename;
+    const char *ext = strrchr(filename, '.');
+    const char *dir = strrchr(filename, '/');
+    if(!ext || (dir && ext < dir))
+        ext = &filename[strlen(filename)];
+
+    char suffix[48];
+    if(seq > 0)
+        snprintf(suffix, sizeof(suffix), "-%"PRIu64"-%d", start, seq);
+    else
+        snprintf(suffix, sizeof(suffix), "-%"PRIu64, start);
+
+    const size_t base_size = ext - filename;
+    const size_t suffix_size = strlen(suffix);
+    const size_t ext_size = strlen(ext);
+
+    char *name = (char *)malloc(base_size + suffix_size + ext_size + 1);
+    memcpy(name, filename, base_size);
+    memcpy(&name[base_size], suffix, suffix_size);
+    memcpy(&name[base_size + suffix_size], ext, ext_size + 1);
+
+    return name;
+}
+
+static void index_flush(module_data_t *mod)
+{
+    if(mod->index_fd <= 0 || !mod->index_skip)
+        return;
+
+    if(write(mod->index_fd, mod->index_buffer, mod->index_skip) != (ssize_t)mod->index_skip)
+    {
+        asc_log_error(MSG("index write error: %s"), strerror(errno));
+        close(mod->index_fd);
+        mod->index_fd = 0;
+    }
+
+    mod->index_skip = 0;
+}
+
+static void index_append(module_data_t *mod, const uint8_t *ts, uint8_t flags)
+{
+    file_index_record_t record;
+    record.pcr = mod->pcr;
+    record.pts = FILE_INDEX_NO_PTS;
+    record.offset = mod->segment_bytes;
+    record.flags = flags;
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(   TS_IS_PAYLOAD_START(ts) && payload
+       && payload <= &ts[TS_PACKET_SIZE - PES_VIEW_HEADER_SIZE]
+       && PES_BUFFER_GET_HEADER(payload) == 0x000001)
+    {
+        const struct { const uint8_t *buffer; } pes_header = { payload };
+        const __typeof__(pes_header) *pes = &pes_header;
+        if(__PES_IS_PTS(pes))
+            record.pts = PES_GET_PTS(pes);
+    }
+
+    if(mod->index_skip + FILE_INDEX_RECORD_SIZE > FILE_INDEX_BUFFER_SIZE * FILE_INDEX_RECORD_SIZE)
+        index_flush(mod);
+
+    file_index_put(&mod->index_buffer[mod->index_skip], &record);
+    mod->index_skip += FILE_INDEX_RECORD_SIZE;
+
+    mod->is_index_pcr = mod->is_pcr;
+    mod->index_pcr = mod->pcr;
+}
+
+static void segment_close(module_data_t *mod)
+{
+    if(mod->fd > 0)
+    {
+#ifdef HAVE_IO_URING
+        if(mod->config.uring)
+            uring_flush(mod);
+        else
+#endif
+        if(mod->buffer_skip > 0 && !mod->error)
+        {
+#ifdef O_DIRECT
+            if(mod->config.directio)
+                fcntl(mod->fd, F_SETFL, fcntl(mod->fd, F_GETFL) & ~O_DIRECT);
+#endif
+            const ssize_t len = write(mod->fd, mod->buffer, mod->buffer_skip);
+            if(len > 0)
+                mod->file_size += len;
+        }
+
+        close(mod->fd);
+        mod->fd = 0;
+    }
+    mod->buffer_skip = 0;
+
+    if(mod->index_fd > 0)
+    {
+        index_flush(mod);
+        close(mod->index_fd);
+        mod->index_fd = 0;
+    }
+}
+
+static bool segment_open(module_data_t *mod)
+{
+    const uint64_t start = (uint64_t)time(NULL);
+
+    mod->segment_time = asc_utime();
+    mod->is_segment_pcr = mod->is_pcr;
+    mod->segment_pcr = mod->pcr;
+    mod->segment_bytes = 0;
+    mod->file_size = 0;
+    mod->error = false;
+#ifdef HAVE_IO_URING
+    mod->uring_offset = 0;
+#endif
+
+    ASC_FREE(mod->segment_name, free);
+    for(int seq = 0; seq < 100 && !mod->segment_name; ++seq)
+    {
+        char *name = segment_name(mod, start, seq);
+        mod->fd = file_open(mod, name, O_EXCL);
+        if(mod->fd > 0)
+            mod->segment_name = name;
+        else
+            free(name);
+
+        if(mod->fd <= 0 && errno != EEXIST)
+            break;
+    }
+
+    if(mod->fd <= 0)
+    {
+        asc_log_error(MSG("failed to open segment [%s]"), strerror(errno));
+        mod->fd = 0;
+        return false;
+    }
+
+    ++mod->segment_count;
+
+    if(mod->config.index)
+    {
+        const size_t name_size = strlen(mod->segment_name);
+        char *index_name = (char *)malloc(name_size + sizeof(".idx"));
+        memcpy(index_name, mod->segment_name, name_size);
+        memcpy(&index_name[name_size], ".idx", sizeof(".idx"));
+
+        mod->index_fd = open(index_name, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY
+                             , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if(mod->index_fd <= 0)
+        {
+            asc_log_error(MSG("failed to open index %s [%s]"), index_name, strerror(errno));
+            mod->index_fd = 0;
+        }
+        free(index_name);
+
+        file_index_header(mod->index_buffer, mod->packet_size);
+        mod->index_skip = FILE_INDEX_HEADER_SIZE;
+        mod->is_index_pcr = false;
+    }
+
+    return true;
+}
+
+/* returns false if the packet should be dropped */
+static bool segment_on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    uint8_t flags = 0;
+
+    if(TS_IS_PCR(ts))
+    {
+        if(mod->pcr_pid == 0)
+            mod->pcr_pid = pid;
+
+        if(mod->pcr_pid == pid)
+        {
+            mod->pcr = TS_GET_PCR(ts);
+            mod->is_pcr = true;
+            flags |= FILE_INDEX_FLAG_PCR;
+
+            // segment started before the first PCR
+            if(!mod->is_segment_pcr)
+            {
+                mod->is_segment_pcr = true;
+                mod->segment_pcr = mod->pcr;
+            }
+        }
+    }
+
+    if(mod->pcr_pid == pid && mod->pcr_pid != 0 && TS_IS_RAI(ts))
+    {
+        mod->is_rai = true;
+        flags |= FILE_INDEX_FLAG_RAI;
+    }
+
+    if(!mod->is_rotate)
+    {
+        uint64_t duration;
+        if(mod->is_pcr && mod->is_segment_pcr)
+            duration = pcr_delta(mod->segment_pcr, mod->pcr) / 27;
+        else
+            duration = asc_utime() - mod->segment_time;
+
+        if(   (mod->config.segment && duration >= mod->config.segment)
+           || (mod->config.segment_size && mod->segment_bytes >= mod->config.segment_size))
+        {
+            mod->is_rotate = true;
+            mod->rotate_time = asc_utime();
+        }
+    }
+
+    if(mod->is_rotate)
+    {
+        bool is_boundary;
+        if(mod->is_rai)
+            is_boundary = (flags & FILE_INDEX_FLAG_RAI);
+        else if(mod->is_pcr)
+            is_boundary = (flags & FILE_INDEX_FLAG_PCR);
+        else
+            is_boundary = true;
+
+        if(!is_boundary && asc_utime() - mod->rotate_time >= FILE_SEGMENT_WAIT)
+            is_boundary = true;
+
+        if(is_boundary)
+        {
+            mod->is_rotate = false;
+            segment_close(mod);
+            segment_open(mod);
+        }
+    }
+
+    if(mod->fd <= 0)
+        return false;
+
+    if(mod->index_fd > 0 && flags)
+    {
+        if(   (flags & FILE_INDEX_FLAG_RAI)
+           || !mod->is_index_pcr
+           || pcr_delta(mod->index_pcr, mod->pcr) >= FILE_INDEX_INTERVAL)
+        {
+            index_append(mod, ts, flags);
+        }
+    }
+
+    return true;
+}
+
 /* stream_ts callbacks */
 
 static void module_destroy(module_data_t *mod);
 
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
+    if(IS_SEGMENT(mod))
+    {
+        if(ts)
+        {
+            if(!segment_on_ts(mod, ts))
+                return;
+        }
+        else if(mod->fd <= 0)
+            return;
+    }
+
+#ifdef HAVE_IO_URING
+    if(mod->config.uring)
+    {
+        uring_on_ts(mod, ts);
+        return;
+    }
+#endif
+
     if(mod->buffer_skip + mod->packet_size > mod->buffer_size || !ts)
     {
         ssize_t size;
@@ -201,32 +985,35 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
             return;
     }
 
-    if(mod->packet_size == TS_PACKET_SIZE)
-    {
-        memcpy(&mod->buffer[mod->buffer_skip], ts, TS_PACKET_SIZE);
-        mod->buffer_skip += TS_PACKET_SIZE;
-    }
-    else
-    {
-        const uint64_t t = asc_utime() / 1000;
-        mod->buffer[0 + mod->buffer_skip] = (t >> 24) & 0xFF;
-        mod->buffer[1 + mod->buffer_skip] = (t >> 16) & 0xFF;
-        mod->buffer[2 + mod->buffer_skip] = (t >>  8) & 0xFF;
-        mod->buffer[3 + mod->buffer_skip] = (t      ) & 0xFF;
-        memcpy(&mod->buffer[4 + mod->buffer_skip], ts, TS_PACKET_SIZE);
-        mod->buffer_skip += M2TS_PACKET_SIZE;
-    }
+    buffer_append(mod, ts);
 }
 
 /* methods */
 
-static int method_status(module_data_t *mod)
+static const module_stat_field_t status_fields[] =
+{
+    MODULE_STAT_FIELD("size", MODULE_STAT_SIZE, module_data_t, file_size),
+    MODULE_STAT_END
+};
+
+static const module_stat_field_t status_segment_fields[] =
 {
-    lua_newtable(lua);
+    MODULE_STAT_FIELD("size", MODULE_STAT_SIZE, module_data_t, file_size),
+    MODULE_STAT_FIELD("segment", MODULE_STAT_STRING, module_data_t, segment_name),
+    MODULE_STAT_FIELD("segments", MODULE_STAT_UINT32, module_data_t, segment_count),
+    MODULE_STAT_END
+};
 
-    lua_pushnumber(lua, mod->file_size);
-    lua_setfield(lua, -2, "size");
+static int method_status(module_data_t *mod)
+{
+    if(!mod->idx_stat)
+    {
+        mod->idx_stat = module_stat_init(  mod
+                                         , (IS_SEGMENT(mod)) ? status_segment_fields
+                                                             : status_fields);
+    }
 
+    module_stat_push(mod->idx_stat);
     return 1;
 }
 
@@ -257,47 +1044,82 @@ static void module_init(module_data_t *mod)
     mod->config.aio_kernel = mod->config.aio && mod->config.directio;
 #endif
 
-    int buffer_size = FILE_BUFFER_SIZE;
-    module_option_number("buffer_size", &buffer_size);
-    mod->buffer_size = buffer_size * 1024;
-
-#if defined(HAVE_POSIX_MEMALIGN) && defined(O_DIRECT)
+#ifdef HAVE_IO_URING
+    module_option_boolean("uring", &mod->config.uring);
+    if(mod->config.uring)
+    {
 #ifdef HAVE_AIO
-    if(mod->config.directio && !mod->config.aio)
-#else
-    if(mod->config.directio)
+        mod->config.aio = false;
 #endif
-    {
-        if(posix_memalign((void **)&mod->buffer, ALIGN, mod->buffer_size))
+#ifdef HAVE_LIBAIO
+        mod->config.aio_kernel = false;
+#endif
+        if(!uring_open())
         {
-            asc_log_error(MSG("cannot malloc aligned memory"));
-            astra_abort();
+            asc_log_warning(MSG("io_uring is not available, use write()"));
+            mod->config.uring = false;
         }
     }
-    else
 #endif
-    {
-        mod->buffer = malloc(mod->buffer_size);
-    }
 
-    int flags = O_CREAT | O_APPEND | O_WRONLY | O_BINARY;
-    int mode = S_IRUSR | S_IWUSR;
+    int segment = 0;
+    module_option_number("segment", &segment);
+    mod->config.segment = (uint64_t)segment * 1000 * 1000;
+
+    int segment_size = 0;
+    module_option_number("segment_size", &segment_size);
+    mod->config.segment_size = (uint64_t)segment_size * 1024 * 1024;
+
+    if(IS_SEGMENT(mod))
+    {
+        mod->config.index = true;
+        module_option_boolean("index", &mod->config.index);
+        if(mod->config.index)
+            mod->index_buffer = (uint8_t *)malloc(FILE_INDEX_BUFFER_SIZE * FILE_INDEX_RECORD_SIZE);
 
 #ifdef HAVE_AIO
-    flags |= O_NONBLOCK;
-    mode |= S_IRGRP | S_IROTH;
+        if(mod->config.aio)
+        {
+            asc_log_warning(MSG("aio is not supported with segments, use write()"));
+            mod->config.aio = false;
+        }
+#endif
+#ifdef HAVE_LIBAIO
+        mod->config.aio_kernel = false;
 #endif
+    }
 
-#ifdef O_DIRECT
-    if(mod->config.directio)
-        flags |= O_DIRECT;
+    int buffer_size = FILE_BUFFER_SIZE;
+    module_option_number("buffer_size", &buffer_size);
+    mod->buffer_size = buffer_size * 1024;
+
+#ifdef HAVE_IO_URING
+    if(mod->config.uring)
+        uring_buffer_init(mod);
+    else
 #endif
+    {
+        /* page aligned for O_DIRECT */
+        mod->buffer = asc_ring_alloc(mod->buffer_size, -1);
+    }
+
+    if(IS_SEGMENT(mod))
+    {
+        if(!segment_open(mod))
+            astra_abort();
+
+        module_stream_init(mod, on_ts);
+        return;
+    }
 
-    mod->fd = open(mod->config.filename, flags, mode);
+    mod->fd = file_open(mod, mod->config.filename, O_APPEND);
 
     struct stat st;
     fstat(mod->fd, &st);
     mod->file_size = st.st_size;
+#ifdef HAVE_IO_URING
+    mod->uring_offset = st.st_size;
+#endif
 
     if(mod->fd <= 0)
     {
@@ -311,15 +1133,7 @@ static void module_init(module_data_t *mod)
 #ifdef HAVE_LIBAIO
         if(mod->config.aio_kernel)
         {
-#ifdef HAVE_POSIX_MEMALIGN
-            if(posix_memalign(&mod->buffer_aio, ALIGN, mod->buffer_size))
-            {
-                asc_log_error(MSG("cannot malloc aligned memory"));
-                astra_abort();
-            }
-#else /* !HAVE_POSIX_MEMALIGN */
-            mod->buffer_aio = malloc(mod->buffer_size);
-#endif /* HAVE_POSIX_MEMALIGN */
+            mod->buffer_aio = asc_ring_alloc(mod->buffer_size, -1);
             memset(&mod->ctx, 0, sizeof(mod->ctx));
             io_queue_init(1, &mod->ctx);
             mod->io[0] = NULL;
@@ -327,7 +1141,7 @@ static void module_init(module_data_t *mod)
         else
 #endif /* HAVE_LIBAIO */
         { /* !mod->aio_kernel */
-            mod->buffer_aio = malloc(mod->buffer_size);
+            mod->buffer_aio = asc_ring_alloc(mod->buffer_size, -1);
 
             memset(&mod->aiocb, 0, sizeof(struct aiocb));
             mod->aiocb.aio_fildes = mod->fd;
@@ -345,6 +1159,12 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
+    if(mod->idx_stat)
+    {
+        module_stat_destroy(mod->idx_stat);
+        mod->idx_stat = 0;
+    }
+
 #ifdef HAVE_AIO
     if(mod->config.aio)
     {
@@ -368,16 +1188,30 @@ static void module_destroy(module_data_t *mod)
         on_ts(mod, NULL); /* Flush buffer */
 #endif
 
+    if(IS_SEGMENT(mod))
+    {
+        segment_close(mod);
+        ASC_FREE(mod->segment_name, free);
+        ASC_FREE(mod->index_buffer, free);
+    }
+
+#ifdef HAVE_IO_URING
+    if(mod->config.uring)
+        uring_destroy(mod);
+#endif
+
     if(mod->fd > 0)
     {
         close(mod->fd);
         mod->fd = 0;
     }
 
-    ASC_FREE(mod->buffer, free);
+    asc_ring_free(mod->buffer, mod->buffer_size);
+    mod->buffer = NULL;
 
 #ifdef HAVE_AIO
-    ASC_FREE(mod->buffer_aio, free);
+    asc_ring_free(mod->buffer_aio, mod->buffer_size);
+    mod->buffer_aio = NULL;
 #endif
 }
 
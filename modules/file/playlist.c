@@ -0,0 +1,863 @@
+/*
+ * Astra Module: File Playlist
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      file_playlist
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      playlist    - list, file names (TS or M2TS), played one after another
+ *      loop        - boolean, start the list again after the last file
+ *      callback    - function, called with the file name on start of each file,
+ *                    and without parameters on the end of the list
+ *      buffer_size - number, read ahead of the next file, in megabytes [default : 2]
+ *
+ * Module Methods:
+ *      append(filename)
+ *                  - add file to the end of the list, the stopped playlist
+ *                    continues from this file
+ *      skip()      - switch to the next file
+ *      stat()      - return table: file, index, count, overflow, errors
+ *
+ * Files are played without gaps: the next file is opened and read ahead
+ * while the current one is playing, PCR, PTS and DTS of the next file are
+ * shifted to continue the timeline of the previous one, and continuity
+ * counters are continued on each PID. Tables are passed as is, files with
+ * the different PSI should have the different version numbers.
+ *
+ * All playlists are paced by one thread, packets and events of all instances
+ * are passed to the main thread through one buffer.
+ */
+
+#include <astra.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define MSG(_msg) "[file_playlist %s] " _msg, mod->name
+
+#define PLAYLIST_BUFFER_SIZE 2
+#define PLAYLIST_MAX 256 // instances on the thread
+#define PLAYLIST_BATCH 32 // packets in the record
+#define PLAYLIST_IDLE 10000 // us, the thread checks new instances and commands
+#define PLAYLIST_OUTPUT_SIZE (4 * 1024 * 1024)
+
+#define PCR_MAX ((1ULL << 33) * 300)
+#define PCR_BLOCK_MAX (500 * 27000) // 500ms
+#define PTS_MASK ((1ULL << 33) - 1)
+#define CC_UNSET 0xFF
+
+enum
+{
+    PLAYLIST_RECORD_DATA = 0,
+    PLAYLIST_RECORD_FILE, // file is started, value is the index in the playlist
+    PLAYLIST_RECORD_END, // end of the playlist
+};
+
+typedef struct
+{
+    uint16_t slot;
+    uint16_t gen;
+    uint16_t type;
+    uint16_t count; // packets after the record
+    uint32_t value;
+} playlist_record_t;
+
+typedef struct
+{
+    int fd;
+    uint8_t *map;
+    size_t size;
+
+    uint32_t index; // position in the playlist
+    uint8_t m2ts_header;
+    uint16_t pcr_pid;
+    uint64_t pcr; // first PCR
+    size_t pcr_skip; // offset of the first PCR packet
+} playlist_file_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    bool loop;
+    int idx_callback;
+    size_t buffer_size;
+
+    uint16_t slot;
+    uint16_t gen;
+
+    /* shared with the thread, protected by the core mutex */
+    char **files;
+    uint32_t files_count;
+    uint32_t files_size;
+    uint32_t next_index; // next file to open
+    bool is_skip;
+
+    /* thread */
+    bool is_end;
+    uint32_t end_count; // playlist size on the end, the thread waits for append()
+    bool is_timeline; // output PCR is started
+    playlist_file_t file; // playing file
+    playlist_file_t next; // read ahead
+
+    size_t skip; // next packet of the file
+    size_t pcr_pos; // PCR packet of the block
+    bool is_tail; // packets after the last PCR of the file
+
+    uint32_t block_count;
+    uint32_t block_index; // sent packets of the block
+    uint64_t block_pcr; // block duration, in PCR ticks
+    uint64_t block_start; // system time of the block start, in us
+    uint64_t pcr; // source PCR of the block
+    uint64_t pcr_out; // output PCR of the block
+    uint64_t pcr_offset; // output PCR = source PCR + offset
+    uint64_t pcr_packet; // PCR ticks per packet, for the file tail
+
+    uint8_t cc_last[MAX_PID]; // last output CC
+    uint8_t cc_delta[MAX_PID]; // CC shift of the file
+
+    uint32_t current; // index of the playing file
+    uint64_t overflow;
+    uint32_t errors;
+};
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+
+    asc_thread_t *thread;
+    asc_thread_buffer_t *output;
+    bool is_started;
+
+    module_data_t *list[PLAYLIST_MAX];
+    uint32_t count;
+    uint16_t gen;
+} playlist_core_t;
+
+static playlist_core_t playlist_core = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * oooooooooo ooooo ooooo       ooooooooooo
+ *  888    88  888   888         888    88
+ *  888ooo8    888   888         888ooo8
+ *  888        888   888      o  888    oo
+ * o888o      o888o o888ooooo88 o888ooo8888
+ *
+ */
+
+static void file_close(playlist_file_t *file)
+{
+    if(file->map)
+    {
+        munmap(file->map, file->size);
+        file->map = NULL;
+    }
+
+    if(file->fd > 0)
+    {
+        close(file->fd);
+        file->fd = 0;
+    }
+}
+
+static bool file_open(module_data_t *mod, playlist_file_t *file, uint32_t index)
+{
+    const char *filename = mod->files[index];
+    memset(file, 0, sizeof(playlist_file_t));
+    file->index = index;
+
+    file->fd = open(filename, O_RDONLY | O_BINARY);
+    if(file->fd <= 0)
+    {
+        file->fd = 0;
+        asc_log_error(MSG("failed to open %s [%s]"), filename, strerror(errno));
+        return false;
+    }
+
+    struct stat sb;
+    if(fstat(file->fd, &sb) != 0 || sb.st_size < 2 * M2TS_PACKET_SIZE)
+    {
+        asc_log_error(MSG("failed to read %s"), filename);
+        file_close(file);
+        return false;
+    }
+    file->size = sb.st_size;
+
+    void *map = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if(map == MAP_FAILED)
+    {
+        asc_log_error(MSG("mmap() failed %s [%s]"), filename, strerror(errno));
+        file_close(file);
+        return false;
+    }
+    file->map = (uint8_t *)map;
+    madvise(file->map, file->size, MADV_SEQUENTIAL);
+
+    // read ahead the head of the file while the previous one is playing
+    const size_t head = (file->size > mod->buffer_size) ? mod->buffer_size : file->size;
+    madvise(file->map, head, MADV_WILLNEED);
+
+    const uint8_t *buffer = file->map;
+    if(buffer[0] == 0x47 && buffer[TS_PACKET_SIZE] == 0x47)
+        file->m2ts_header = 0;
+    else if(buffer[4] == 0x47 && buffer[4 + M2TS_PACKET_SIZE] == 0x47)
+        file->m2ts_header = 4;
+    else
+    {
+        asc_log_error(MSG("wrong file format %s"), filename);
+        file_close(file);
+        return false;
+    }
+
+    const size_t packet_size = file->m2ts_header + TS_PACKET_SIZE;
+    for(size_t skip = 0; skip + packet_size <= head; skip += packet_size)
+    {
+        const uint8_t *ts = &buffer[skip + file->m2ts_header];
+        if(TS_IS_PCR(ts))
+        {
+            file->pcr_pid = TS_GET_PID(ts);
+            file->pcr = TS_GET_PCR(ts);
+            file->pcr_skip = skip;
+            return true;
+        }
+    }
+
+    asc_log_error(MSG("first PCR is not found %s"), filename);
+    file_close(file);
+    return false;
+}
+
+/* opens the next file of the playlist, skips files with errors */
+static bool file_prefetch(module_data_t *mod)
+{
+    for(uint32_t i = 0; i < mod->files_count; ++i)
+    {
+        if(mod->next_index >= mod->files_count)
+        {
+            if(!mod->loop)
+                return false;
+            mod->next_index = 0;
+        }
+
+        const uint32_t index = mod->next_index++;
+        if(file_open(mod, &mod->next, index))
+            return true;
+
+        ++mod->errors;
+    }
+
+    return false;
+}
+
+static uint64_t pcr_delta(uint64_t pcr_last, uint64_t pcr_current)
+{
+    return (pcr_current >= pcr_last)
+         ? (pcr_current - pcr_last)
+         : (PCR_MAX - pcr_last + pcr_current);
+}
+
+/*
+ * ooooooooooo  oooooooo8
+ *  888    88 o888     88
+ *  888ooo8   888
+ *  888    oo 888o     oo
+ * o888ooo8888 888oooo88
+ *
+ */
+
+static inline void pes_shift_ts(uint8_t *p, uint64_t offset)
+{
+    uint64_t ts = ((uint64_t)(p[0] & 0x0E) << 29)
+                | ((uint64_t)(p[1]       ) << 22)
+                | ((uint64_t)(p[2] & 0xFE) << 14)
+                | ((uint64_t)(p[3]       ) << 7 )
+                | ((uint64_t)(p[4]       ) >> 1 );
+    ts = (ts + offset) & PTS_MASK;
+
+    p[0] = (p[0] & 0xF1) | ((ts >> 29) & 0x0E);
+    p[1] = (ts >> 22) & 0xFF;
+    p[2] = ((ts >> 14) & 0xFE) | 0x01;
+    p[3] = (ts >> 7) & 0xFF;
+    p[4] = ((ts << 1) & 0xFE) | 0x01;
+}
+
+/* continues the timeline and the continuity counters of the previous file */
+static void packet_rewrite(module_data_t *mod, uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(TS_IS_PAYLOAD(ts))
+    {
+        const uint8_t cc = TS_GET_CC(ts);
+        if(mod->cc_delta[pid] == CC_UNSET)
+        {
+            mod->cc_delta[pid] = (mod->cc_last[pid] == CC_UNSET)
+                               ? 0
+                               : ((mod->cc_last[pid] + 1 - cc) & 0x0F);
+        }
+        const uint8_t cc_out = (cc + mod->cc_delta[pid]) & 0x0F;
+        TS_SET_CC(ts, cc_out);
+        mod->cc_last[pid] = cc_out;
+    }
+    else if(mod->cc_last[pid] != CC_UNSET)
+    {
+        TS_SET_CC(ts, mod->cc_last[pid]);
+    }
+
+    if(!mod->pcr_offset)
+        return;
+
+    if(TS_IS_PCR(ts))
+        TS_SET_PCR(ts, (TS_GET_PCR(ts) + mod->pcr_offset) % PCR_MAX);
+
+    if(!TS_IS_PAYLOAD_START(ts) || TS_IS_SCRAMBLED(ts))
+        return;
+
+    uint8_t *pes = TS_GET_PAYLOAD(ts);
+    if(!pes || pes + PES_VIEW_HEADER_SIZE > ts + TS_PACKET_SIZE)
+        return;
+    if(pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01)
+        return;
+
+    // stream_id without the optional PES header, see PES_IS_SYNTAX_SPEC()
+    const uint8_t stream_id = pes[3];
+    if(   stream_id == 0xBC || stream_id == 0xBE || stream_id == 0xBF
+       || (stream_id >= 0xF0 && stream_id <= 0xF2)
+       || stream_id == 0xF8 || stream_id == 0xFF)
+    {
+        return;
+    }
+
+    const uint64_t pts_offset = mod->pcr_offset / 300;
+    if(pes[7] & 0x80)
+        pes_shift_ts(&pes[9], pts_offset);
+    if((pes[7] & 0xC0) == 0xC0)
+        pes_shift_ts(&pes[14], pts_offset);
+}
+
+/*
+ * ooooooooooo ooooo ooooo oooooooooo  ooooooooooo      o      ooooooooo
+ * 88  888  88  888   888   888    888  888    88      888      888    88o
+ *     888      888ooo888   888oooo88   888ooo8       8  88     888    888
+ *     888      888   888   888  88o    888    oo    8oooo88    888    888
+ *    o888o    o888o o888o o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+static void thread_send(module_data_t *mod, uint16_t type, uint32_t value
+                        , uint8_t *record, uint16_t count)
+{
+    const playlist_record_t header =
+    {
+        .slot = mod->slot,
+        .gen = mod->gen,
+        .type = type,
+        .count = count,
+        .value = value,
+    };
+    memcpy(record, &header, sizeof(header));
+
+    const ssize_t size = sizeof(playlist_record_t) + count * TS_PACKET_SIZE;
+    if(asc_thread_buffer_write(playlist_core.output, record, size) != size)
+        ++mod->overflow;
+}
+
+static void thread_event(module_data_t *mod, uint16_t type, uint32_t value)
+{
+    uint8_t record[sizeof(playlist_record_t)];
+    thread_send(mod, type, value, record, 0);
+}
+
+/* switches to the read ahead file, returns false on the end of the playlist */
+static bool channel_switch(module_data_t *mod, uint64_t now)
+{
+    file_close(&mod->file);
+
+    if(!mod->next.map && !file_prefetch(mod))
+    {
+        mod->end_count = mod->files_count;
+        if(!mod->is_end)
+        {
+            mod->is_end = true;
+            thread_event(mod, PLAYLIST_RECORD_END, 0);
+        }
+        return false;
+    }
+
+    mod->file = mod->next;
+    memset(&mod->next, 0, sizeof(playlist_file_t));
+
+    if(!mod->is_timeline)
+    {
+        mod->is_timeline = true;
+        mod->pcr_out = mod->file.pcr;
+        mod->pcr_offset = 0;
+        mod->block_start = now;
+    }
+    else
+    {
+        // offset is aligned to the PTS tick, PCR and PTS are shifted equally
+        mod->pcr_offset = pcr_delta(mod->file.pcr, mod->pcr_out);
+        mod->pcr_offset -= mod->pcr_offset % 300;
+    }
+
+    if(mod->is_end)
+    {
+        // playlist is continued by append()
+        mod->is_end = false;
+        mod->block_start = now;
+    }
+
+    mod->skip = 0;
+    mod->pcr_pos = mod->file.pcr_skip;
+    mod->pcr = mod->file.pcr;
+    mod->is_tail = false;
+    mod->block_count = 0;
+    mod->block_index = 0;
+    memset(mod->cc_delta, CC_UNSET, sizeof(mod->cc_delta));
+
+    mod->current = mod->file.index;
+    thread_event(mod, PLAYLIST_RECORD_FILE, mod->file.index);
+
+    file_prefetch(mod);
+    return true;
+}
+
+/* finds the next PCR and sets the block boundaries, false if the file is over */
+static bool channel_block(module_data_t *mod)
+{
+    const playlist_file_t *file = &mod->file;
+    const size_t packet_size = file->m2ts_header + TS_PACKET_SIZE;
+
+    while(!mod->is_tail)
+    {
+        size_t pos = mod->pcr_pos + packet_size;
+        for(; pos + packet_size <= file->size; pos += packet_size)
+        {
+            const uint8_t *ts = &file->map[pos + file->m2ts_header];
+            if(TS_IS_PCR(ts) && TS_GET_PID(ts) == file->pcr_pid)
+                break;
+        }
+
+        if(pos + packet_size > file->size)
+        {
+            mod->is_tail = true;
+            break;
+        }
+
+        const uint64_t pcr = TS_GET_PCR((&file->map[pos + file->m2ts_header]));
+        const uint64_t block_pcr = pcr_delta(mod->pcr, pcr);
+        mod->pcr_pos = pos;
+        mod->pcr = pcr;
+
+        if(block_pcr == 0 || block_pcr > PCR_BLOCK_MAX)
+        {
+            // PCR discontinuity in the file, the output timeline is continued
+            asc_log_error(MSG("block time out of range: %"PRIu64"ms")
+                          , block_pcr / 27000);
+            mod->skip = pos;
+            mod->pcr_offset = pcr_delta(pcr, mod->pcr_out);
+            mod->pcr_offset -= mod->pcr_offset % 300;
+            continue;
+        }
+
+        mod->block_count = (pos - mod->skip) / packet_size;
+        mod->block_index = 0;
+        mod->block_pcr = block_pcr;
+        mod->pcr_packet = block_pcr / mod->block_count;
+        return true;
+    }
+
+    // packets after the last PCR are paced with the rate of the last block
+    mod->block_count = (file->size - mod->skip) / packet_size;
+    mod->block_index = 0;
+    mod->block_pcr = mod->block_count * mod->pcr_packet;
+    return (mod->block_count > 0);
+}
+
+/* sends packets on time, returns the system time of the next packet */
+static uint64_t channel_send(module_data_t *mod, uint64_t now)
+{
+    uint8_t record[sizeof(playlist_record_t) + PLAYLIST_BATCH * TS_PACKET_SIZE];
+    uint16_t count = 0;
+
+    if(mod->is_skip)
+    {
+        mod->is_skip = false;
+        if(mod->file.map)
+        {
+            // output timeline is continued from the current packet
+            if(mod->block_count)
+            {
+                mod->pcr_out += mod->block_pcr * mod->block_index / mod->block_count;
+                mod->pcr_out %= PCR_MAX;
+            }
+            mod->block_start = now;
+            mod->block_count = 0;
+            mod->is_tail = true;
+            mod->skip = mod->file.size;
+        }
+    }
+
+    if(!mod->file.map)
+    {
+        if(mod->is_end && mod->end_count == mod->files_count)
+            return now + PLAYLIST_IDLE;
+        if(!channel_switch(mod, now))
+            return now + PLAYLIST_IDLE;
+    }
+
+    uint64_t due = now;
+    while(true)
+    {
+        if(mod->block_index >= mod->block_count)
+        {
+            if(mod->block_count)
+            {
+                mod->block_start += mod->block_pcr / 27;
+                mod->pcr_out = (mod->pcr_out + mod->block_pcr) % PCR_MAX;
+                mod->block_count = 0;
+            }
+
+            if(!channel_block(mod))
+            {
+                if(count)
+                {
+                    thread_send(mod, PLAYLIST_RECORD_DATA, 0, record, count);
+                    count = 0;
+                }
+                if(!channel_switch(mod, now))
+                    return now + PLAYLIST_IDLE;
+                continue;
+            }
+        }
+
+        due = mod->block_start
+            + mod->block_pcr * mod->block_index / mod->block_count / 27;
+        if(due > now)
+        {
+            if(due > now + 1000000 + mod->block_pcr / 27)
+            {
+                asc_log_warning(MSG("system time changed"));
+                mod->block_start = now;
+                continue;
+            }
+            break;
+        }
+        if(now > due + 100000)
+        {
+            asc_log_warning(MSG("wrong syncing time. -%"PRIu64"ms"), (now - due) / 1000);
+            mod->block_start = now
+                             - mod->block_pcr * mod->block_index / mod->block_count / 27;
+        }
+
+        const playlist_file_t *file = &mod->file;
+        uint8_t *ts = &record[sizeof(playlist_record_t) + count * TS_PACKET_SIZE];
+        memcpy(ts, &file->map[mod->skip + file->m2ts_header], TS_PACKET_SIZE);
+        mod->skip += file->m2ts_header + TS_PACKET_SIZE;
+        ++mod->block_index;
+
+        if(TS_IS_SYNC(ts))
+        {
+            packet_rewrite(mod, ts);
+            ++count;
+        }
+
+        if(count == PLAYLIST_BATCH)
+        {
+            thread_send(mod, PLAYLIST_RECORD_DATA, 0, record, count);
+            count = 0;
+        }
+    }
+
+    if(count)
+        thread_send(mod, PLAYLIST_RECORD_DATA, 0, record, count);
+
+    return due;
+}
+
+static void thread_loop(void *arg)
+{
+    __uarg(arg);
+
+    while(playlist_core.is_started)
+    {
+        const uint64_t now = asc_utime();
+        uint64_t wait = PLAYLIST_IDLE;
+
+        // main thread waits for the lock at most one pass over the instances
+        pthread_mutex_lock(&playlist_core.mutex);
+        for(uint32_t i = 0; i < PLAYLIST_MAX; ++i)
+        {
+            module_data_t *mod = playlist_core.list[i];
+            if(!mod)
+                continue;
+
+            const uint64_t next = channel_send(mod, now);
+            if(next > now && next - now < wait)
+                wait = next - now;
+        }
+        pthread_mutex_unlock(&playlist_core.mutex);
+
+        const uint64_t spent = asc_utime() - now;
+        if(wait > spent + 100)
+            asc_usleep(wait - spent);
+    }
+}
+
+static void on_thread_read(void *arg)
+{
+    __uarg(arg);
+
+    uint8_t data[PLAYLIST_BATCH * TS_PACKET_SIZE];
+    playlist_record_t header;
+
+    while(playlist_core.output)
+    {
+        if(asc_thread_buffer_read(playlist_core.output, &header, sizeof(header))
+           != sizeof(header))
+        {
+            return;
+        }
+
+        // the record is committed at once, the packets are available
+        const ssize_t size = header.count * TS_PACKET_SIZE;
+        if(size && asc_thread_buffer_read(playlist_core.output, data, size) != size)
+            return;
+
+        module_data_t *mod = playlist_core.list[header.slot];
+        if(!mod || mod->gen != header.gen)
+            continue;
+
+        switch(header.type)
+        {
+            case PLAYLIST_RECORD_DATA:
+                module_stream_send_batch(mod, data, header.count);
+                break;
+            case PLAYLIST_RECORD_FILE:
+                asc_log_info(MSG("play %s"), mod->files[header.value]);
+                if(mod->idx_callback)
+                {
+                    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+                    lua_pushstring(lua, mod->files[header.value]);
+                    lua_call(lua, 1, 0);
+                }
+                break;
+            case PLAYLIST_RECORD_END:
+                asc_log_info(MSG("end of the playlist"));
+                if(mod->idx_callback)
+                {
+                    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+                    lua_call(lua, 0, 0);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void on_thread_close(void *arg)
+{
+    __uarg(arg);
+
+    playlist_core.is_started = false;
+    ASC_FREE(playlist_core.thread, asc_thread_destroy);
+    ASC_FREE(playlist_core.output, asc_thread_buffer_destroy);
+}
+
+static void core_attach(module_data_t *mod)
+{
+    uint32_t slot = 0;
+    for(; slot < PLAYLIST_MAX; ++slot)
+    {
+        if(!playlist_core.list[slot])
+            break;
+    }
+    asc_assert(slot < PLAYLIST_MAX, MSG("too many instances, limit: %d"), PLAYLIST_MAX);
+
+    mod->slot = slot;
+    mod->gen = ++playlist_core.gen;
+
+    pthread_mutex_lock(&playlist_core.mutex);
+    playlist_core.list[slot] = mod;
+    ++playlist_core.count;
+    pthread_mutex_unlock(&playlist_core.mutex);
+
+    if(playlist_core.thread)
+        return;
+
+    playlist_core.thread = asc_thread_init(NULL);
+    asc_thread_set_name(playlist_core.thread, "file_playlist");
+    playlist_core.output = asc_thread_buffer_init(PLAYLIST_OUTPUT_SIZE);
+    playlist_core.is_started = true;
+    asc_thread_start(  playlist_core.thread
+                     , thread_loop
+                     , on_thread_read, playlist_core.output
+                     , on_thread_close);
+}
+
+static void core_detach(module_data_t *mod)
+{
+    pthread_mutex_lock(&playlist_core.mutex);
+    playlist_core.list[mod->slot] = NULL;
+    --playlist_core.count;
+    pthread_mutex_unlock(&playlist_core.mutex);
+
+    if(!playlist_core.count && playlist_core.thread)
+        on_thread_close(NULL);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static void playlist_append(module_data_t *mod, const char *filename)
+{
+    if(mod->files_count == mod->files_size)
+    {
+        mod->files_size = (mod->files_size) ? mod->files_size * 2 : 16;
+        mod->files = (char **)realloc(mod->files, mod->files_size * sizeof(char *));
+    }
+    mod->files[mod->files_count] = strdup(filename);
+    ++mod->files_count;
+}
+
+static int method_append(module_data_t *mod)
+{
+    const char *filename = luaL_checkstring(lua, 2);
+
+    // the stopped playlist is continued by the thread from the new file
+    pthread_mutex_lock(&playlist_core.mutex);
+    playlist_append(mod, filename);
+    pthread_mutex_unlock(&playlist_core.mutex);
+
+    return 0;
+}
+
+static int method_skip(module_data_t *mod)
+{
+    pthread_mutex_lock(&playlist_core.mutex);
+    mod->is_skip = true;
+    pthread_mutex_unlock(&playlist_core.mutex);
+    return 0;
+}
+
+static int method_stat(module_data_t *mod)
+{
+    pthread_mutex_lock(&playlist_core.mutex);
+    const bool is_play = (mod->file.map != NULL);
+    const uint32_t current = mod->current;
+    pthread_mutex_unlock(&playlist_core.mutex);
+
+    lua_newtable(lua);
+    if(is_play)
+    {
+        lua_pushstring(lua, mod->files[current]);
+        lua_setfield(lua, -2, "file");
+        lua_pushnumber(lua, current + 1);
+        lua_setfield(lua, -2, "index");
+    }
+    lua_pushnumber(lua, mod->files_count);
+    lua_setfield(lua, -2, "count");
+    lua_pushnumber(lua, (lua_Number)mod->overflow);
+    lua_setfield(lua, -2, "overflow");
+    lua_pushnumber(lua, mod->errors);
+    lua_setfield(lua, -2, "errors");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[file_playlist] option 'name' is required");
+
+    int buffer_size = 0;
+    if(!module_option_number("buffer_size", &buffer_size) || buffer_size <= 0)
+        buffer_size = PLAYLIST_BUFFER_SIZE;
+    mod->buffer_size = (size_t)buffer_size * 1024 * 1024;
+
+    module_option_boolean("loop", &mod->loop);
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "playlist");
+    if(lua_istable(lua, -1))
+    {
+        const int count = luaL_len(lua, -1);
+        for(int i = 1; i <= count; ++i)
+        {
+            lua_rawgeti(lua, -1, i);
+            asc_assert(lua_type(lua, -1) == LUA_TSTRING, MSG("option 'playlist': wrong type"));
+            playlist_append(mod, lua_tostring(lua, -1));
+            lua_pop(lua, 1);
+        }
+    }
+    lua_pop(lua, 1); // playlist
+
+    // store callback in registry
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
+    if(lua_type(lua, -1) == LUA_TFUNCTION)
+        mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    memset(mod->cc_last, CC_UNSET, sizeof(mod->cc_last));
+    memset(mod->cc_delta, CC_UNSET, sizeof(mod->cc_delta));
+
+    module_stream_init(mod, NULL);
+
+    core_attach(mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    core_detach(mod);
+
+    file_close(&mod->file);
+    file_close(&mod->next);
+
+    for(uint32_t i = 0; i < mod->files_count; ++i)
+        free(mod->files[i]);
+    ASC_FREE(mod->files, free);
+
+    if(mod->idx_callback)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+        mod->idx_callback = 0;
+    }
+
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "append", method_append },
+    { "skip", method_skip },
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(file_playlist)
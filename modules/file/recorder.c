@@ -0,0 +1,478 @@
+/*
+ * Astra Module: File Recorder
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      file_recorder
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, name for the log messages
+ *      filename    - string, dump file name, the trigger time (unix time) is
+ *                    added before the extension: /rec/ch1.ts -> /rec/ch1-1420070400.ts
+ *      duration    - number, seconds of the stream before the trigger. default: 10
+ *      post        - number, seconds of the stream after the trigger. default: 2
+ *      bitrate     - number, maximum bitrate in Mbit/s, the ring size is
+ *                    duration * bitrate. default: 20
+ *      cc_burst    - number, dump on N CC errors in one second. default: 0 - off
+ *      pcr_jump    - number, dump on the PCR discontinuity, difference between
+ *                    the PCR and the receiving time in milliseconds. default: 0 - off
+ *      holdoff     - number, seconds between the automatic dumps. default: 60
+ *      callback    - function(data), called when the dump is written,
+ *                    data.filename and data.reason
+ *
+ * Module Methods:
+ *      dump([reason])
+ *                  - dump the ring after the post interval, the reason is
+ *                    a string for the log. returns false if the dump is in progress
+ *
+ * The stream is passed to the next modules as is. The last packets are
+ * kept in the ring, the ring is written to the file by the thread on the
+ * trigger, so the recording costs one memcpy per packet. The decrypt
+ * failures and the HTTP commands call dump() from the Lua callbacks.
+ */
+
+#include <astra.h>
+
+#define MSG(_msg) "[file_recorder %s] " _msg, mod->name
+
+/* packets of the ring with one receiving time */
+#define RECORDER_BLOCK_PACKETS 512
+
+#define PCR_MAX ((1ULL << 33) * 300)
+
+typedef struct
+{
+    uint8_t *buffer;
+    uint64_t *block_time;
+    size_t count; // packets
+} recorder_ring_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    const char *filename;
+    uint64_t duration; // us
+    uint64_t post; // us
+    uint64_t holdoff; // us
+    uint32_t cc_burst;
+    uint64_t pcr_jump; // us
+    int idx_callback;
+
+    recorder_ring_t ring;
+    recorder_ring_t spare;
+    size_t write; // packets, total
+    size_t block_count;
+
+    /* triggers */
+    uint8_t cc[MAX_PID];
+    uint32_t cc_errors;
+    uint64_t cc_time;
+
+    uint16_t pcr_pid;
+    uint64_t pcr_last;
+    uint64_t pcr_time;
+
+    uint64_t dump_time; // last trigger
+    asc_timer_t *dump_timer; // post interval
+    char dump_reason[64];
+
+    /* thread */
+    asc_thread_t *thread;
+    recorder_ring_t dump;
+    size_t dump_total; // write counter of the ring
+    size_t dump_skip; // packets to skip, older than duration
+    char *dump_name;
+    int dump_error;
+};
+
+static bool ring_init(module_data_t *mod, recorder_ring_t *ring)
+{
+    ring->count = mod->block_count * RECORDER_BLOCK_PACKETS;
+    ring->buffer = (uint8_t *)malloc(ring->count * TS_PACKET_SIZE);
+    ring->block_time = (uint64_t *)calloc(mod->block_count, sizeof(uint64_t));
+    return (ring->buffer != NULL && ring->block_time != NULL);
+}
+
+static void ring_free(recorder_ring_t *ring)
+{
+    ASC_FREE(ring->buffer, free);
+    ASC_FREE(ring->block_time, free);
+}
+
+static char * dump_name(module_data_t *mod, uint64_t start)
+{
+    const char *filename = mod->filename;
+    const char *ext = strrchr(filename, '.');
+    const char *dir = strrchr(filename, '/');
+    if(!ext || (dir && ext < dir))
+        ext = &filename[strlen(filename)];
+
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), "-%"PRIu64, start);
+
+    const size_t base_size = ext - filename;
+    const size_t suffix_size = strlen(suffix);
+    const size_t ext_size = strlen(ext);
+
+    char *name = (char *)malloc(base_size + suffix_size + ext_size + 1);
+    memcpy(name, filename, base_size);
+    memcpy(&name[base_size], suffix, suffix_size);
+    memcpy(&name[base_size + suffix_size], ext, ext_size + 1);
+
+    return name;
+}
+
+/*
+ * ooooooooooo ooooo ooooo oooooooooo  ooooooooooo      o      oooooooooo
+ * 88  888  88  888   888   888    888  888    88      888      888    888
+ *     888      888ooo888   888oooo88   888ooo8       8  88     888    888
+ *     888      888   888   888  88o    888    oo    8oooo88    888    888
+ *    o888o    o888o o888o o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+static bool dump_write(module_data_t *mod, int fd, size_t from, size_t to)
+{
+    const uint8_t *ptr = &mod->dump.buffer[from * TS_PACKET_SIZE];
+    size_t size = (to - from) * TS_PACKET_SIZE;
+    while(size > 0)
+    {
+        const ssize_t ret = write(fd, ptr, size);
+        if(ret <= 0)
+            return false;
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const int fd = open(mod->dump_name, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY
+                        , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd == -1)
+    {
+        mod->dump_error = errno;
+        return;
+    }
+
+    const size_t count = mod->dump.count;
+    size_t first = 0;
+    size_t total = mod->dump_total;
+    if(total > count)
+    {
+        first = total % count;
+        total = count;
+    }
+    first = (first + mod->dump_skip) % count;
+    total -= mod->dump_skip;
+
+    const size_t tail = (first + total > count) ? count - first : total;
+    if(   !dump_write(mod, fd, first, first + tail)
+       || !dump_write(mod, fd, 0, total - tail))
+    {
+        mod->dump_error = errno;
+    }
+
+    close(fd);
+}
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    ASC_FREE(mod->thread, asc_thread_destroy);
+
+    if(mod->dump_error)
+    {
+        asc_log_error(MSG("failed to write %s [%s]")
+                      , mod->dump_name, strerror(mod->dump_error));
+    }
+    else
+    {
+        asc_log_info(MSG("dump is written to %s"), mod->dump_name);
+
+        if(mod->idx_callback)
+        {
+            lua_newtable(lua);
+            lua_pushstring(lua, mod->dump_name);
+            lua_setfield(lua, -2, "filename");
+            lua_pushstring(lua, mod->dump_reason);
+            lua_setfield(lua, -2, "reason");
+            module_lua_notify(mod, mod->idx_callback);
+        }
+    }
+
+    // the written ring is the spare for the next dump
+    if(mod->spare.buffer)
+        ring_free(&mod->dump);
+    else
+        mod->spare = mod->dump;
+    memset(&mod->dump, 0, sizeof(mod->dump));
+
+    ASC_FREE(mod->dump_name, free);
+}
+
+static void on_dump_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    mod->dump_timer = NULL;
+
+    if(!mod->spare.buffer && !ring_init(mod, &mod->spare))
+    {
+        ring_free(&mod->spare);
+        asc_log_error(MSG("failed to allocate the ring for the dump"));
+        return;
+    }
+
+    const size_t filled = (mod->write < mod->ring.count) ? mod->write : mod->ring.count;
+    if(!filled)
+        return;
+
+    // the ring is sized by the bitrate, the blocks older than the duration are skipped
+    const uint64_t now = asc_utime();
+    const uint64_t limit = mod->duration + mod->post;
+    // the slot of the oldest block is shared with the current one, the time
+    // of the next block is the end of the previous block
+    const size_t first = mod->write - filled;
+    const size_t block_last = (mod->write - 1) / RECORDER_BLOCK_PACKETS;
+    size_t skip = 0;
+    for(size_t block = first / RECORDER_BLOCK_PACKETS; block < block_last; ++block)
+    {
+        const size_t next = block + 1;
+        if(now - mod->ring.block_time[next % mod->block_count] <= limit)
+            break;
+        skip = next * RECORDER_BLOCK_PACKETS - first;
+    }
+
+    mod->dump = mod->ring;
+    mod->dump_total = mod->write;
+    mod->dump_skip = skip;
+    mod->dump_name = dump_name(mod, (uint64_t)time(NULL));
+    mod->dump_error = 0;
+
+    mod->ring = mod->spare;
+    memset(&mod->spare, 0, sizeof(mod->spare));
+    mod->write = 0;
+
+    mod->thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->thread, "file_recorder");
+    asc_thread_set_priority(mod->thread, ASC_THREAD_PRIORITY_IDLE);
+    asc_thread_start(mod->thread, thread_loop, NULL, NULL, on_thread_close);
+}
+
+static bool dump_trigger(module_data_t *mod, const char *reason, bool is_auto)
+{
+    if(mod->dump_timer || mod->thread)
+        return false;
+
+    const uint64_t now = asc_utime();
+    if(is_auto && mod->dump_time && now - mod->dump_time < mod->holdoff)
+        return false;
+
+    asc_log_warning(MSG("dump is triggered: %s"), reason);
+    mod->dump_time = now;
+    snprintf(mod->dump_reason, sizeof(mod->dump_reason), "%s", reason);
+    // the timer is called when the stream is stopped too
+    mod->dump_timer = asc_timer_one_shot(  (unsigned int)(mod->post / 1000)
+                                         , on_dump_timer, mod);
+
+    return true;
+}
+
+/*
+ *   oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
+ *  888        88  888  88  888    888  888    88      888      8888o   888
+ *   888oooooo     888      888oooo88   888ooo8       8  88     88 888o8 88
+ *          888    888      888  88o    888    oo    8oooo88    88  888  88
+ *  o88oooo888    o888o    o888o  88o8 o888ooo8888 o88o  o888o o88o  8  o88o
+ *
+ */
+
+static void check_cc(module_data_t *mod, const uint8_t *ts, uint64_t now)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == NULL_TS_PID || !TS_IS_PAYLOAD(ts))
+        return;
+
+    const uint8_t cc = TS_GET_CC(ts);
+    const uint8_t last_cc = mod->cc[pid];
+    mod->cc[pid] = 0x10 | cc;
+    if(!last_cc || ((last_cc + 1) & 0x0F) == cc || (last_cc & 0x0F) == cc)
+        return;
+
+    if(now - mod->cc_time > 1000000)
+    {
+        mod->cc_time = now;
+        mod->cc_errors = 0;
+    }
+    if(++mod->cc_errors == mod->cc_burst)
+        dump_trigger(mod, "CC error burst", true);
+}
+
+static void check_pcr(module_data_t *mod, const uint8_t *ts, uint64_t now)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    if(!mod->pcr_pid)
+        mod->pcr_pid = pid;
+    else if(pid != mod->pcr_pid)
+        return;
+
+    const uint64_t pcr = TS_GET_PCR(ts);
+    if(mod->pcr_time)
+    {
+        const uint64_t pcr_delta = (pcr >= mod->pcr_last)
+                                 ? (pcr - mod->pcr_last)
+                                 : (PCR_MAX - mod->pcr_last + pcr);
+        const uint64_t pcr_us = pcr_delta / 27;
+        const uint64_t time_us = now - mod->pcr_time;
+        const uint64_t diff = (pcr_us > time_us) ? (pcr_us - time_us) : (time_us - pcr_us);
+        if(diff > mod->pcr_jump)
+            dump_trigger(mod, "PCR discontinuity", true);
+    }
+    mod->pcr_last = pcr;
+    mod->pcr_time = now;
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    module_stream_send(mod, ts);
+
+    const size_t offset = mod->write % mod->ring.count;
+    if(!(offset % RECORDER_BLOCK_PACKETS))
+        mod->ring.block_time[offset / RECORDER_BLOCK_PACKETS] = asc_utime();
+
+    memcpy(&mod->ring.buffer[offset * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++mod->write;
+
+    if(mod->cc_burst || mod->pcr_jump)
+    {
+        const uint64_t now = asc_utime();
+        if(mod->cc_burst)
+            check_cc(mod, ts, now);
+        if(mod->pcr_jump && TS_IS_PCR(ts))
+            check_pcr(mod, ts, now);
+    }
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_dump(module_data_t *mod)
+{
+    const char *reason = (lua_isstring(lua, 2)) ? lua_tostring(lua, 2) : "manual";
+    lua_pushboolean(lua, dump_trigger(mod, reason, false));
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[file_recorder] option 'name' is required");
+
+    module_option_string("filename", &mod->filename, NULL);
+    asc_assert(mod->filename != NULL, MSG("option 'filename' is required"));
+
+    int duration = 10;
+    module_option_number("duration", &duration);
+    asc_assert(duration > 0, MSG("option 'duration' must be greater than 0"));
+    mod->duration = (uint64_t)duration * 1000000;
+
+    int post = 2;
+    module_option_number("post", &post);
+    asc_assert(post >= 0, MSG("option 'post' must be positive"));
+    mod->post = (uint64_t)post * 1000000;
+
+    int bitrate = 20;
+    module_option_number("bitrate", &bitrate);
+    asc_assert(bitrate > 0, MSG("option 'bitrate' must be greater than 0"));
+
+    int holdoff = 60;
+    module_option_number("holdoff", &holdoff);
+    mod->holdoff = (uint64_t)((holdoff > 0) ? holdoff : 0) * 1000000;
+
+    int cc_burst = 0;
+    module_option_number("cc_burst", &cc_burst);
+    mod->cc_burst = (cc_burst > 0) ? (uint32_t)cc_burst : 0;
+
+    int pcr_jump = 0;
+    module_option_number("pcr_jump", &pcr_jump);
+    mod->pcr_jump = (uint64_t)((pcr_jump > 0) ? pcr_jump : 0) * 1000;
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
+    if(lua_isfunction(lua, -1))
+        mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    // the ring keeps the duration and the post interval at the maximum bitrate
+    const uint64_t packets = (uint64_t)bitrate * 1000000 / 8 / TS_PACKET_SIZE
+                           * (uint64_t)(duration + post);
+    mod->block_count = (size_t)((packets + RECORDER_BLOCK_PACKETS - 1) / RECORDER_BLOCK_PACKETS);
+    if(!ring_init(mod, &mod->ring))
+    {
+        asc_log_error(MSG("failed to allocate the ring"));
+        astra_abort();
+    }
+
+    module_stream_init(mod, on_ts);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->dump_timer, asc_timer_destroy);
+    if(mod->thread)
+    {
+        ASC_FREE(mod->thread, asc_thread_destroy);
+        ring_free(&mod->dump);
+        ASC_FREE(mod->dump_name, free);
+    }
+
+    ring_free(&mod->ring);
+    ring_free(&mod->spare);
+
+    if(mod->idx_callback)
+    {
+        module_lua_notify_cancel(mod);
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+        mod->idx_callback = 0;
+    }
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "dump", method_dump }
+};
+MODULE_LUA_REGISTER(file_recorder)
@@ -0,0 +1,449 @@
+/*
+ * Astra Module: HLS Input
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      hls_input
+ *
+ * Module Options:
+ *      name        - string, name for the log messages
+ *      prebuffer   - number, segments in the queue to start the playout.
+ *                    default: 2
+ *
+ * Module Methods:
+ *      push(content, discontinuity)
+ *                  - append MPEG-TS segment to the queue. discontinuity is true
+ *                    if the timestamps of the segment are not continued
+ *      queued()    - return number of the segments in the queue
+ *      close()     - drop the queue
+ *
+ * Playout of the downloaded segments. Playlists and segments are fetched
+ * by the script with the http_request (see init_input_module.hls in base.lua),
+ * the module paces the packets by the PCR.
+ */
+
+#include "http.h"
+
+#define MSG(_msg) "[hls_input %s] " _msg, mod->name
+
+#define HLS_SYNC_INTERVAL 1 // ms
+#define HLS_BLOCK_TIME_MAX 500000 // us
+
+typedef struct hls_segment_t hls_segment_t;
+
+struct hls_segment_t
+{
+    uint8_t *buffer;
+    size_t count; // packets
+    bool is_discontinuity;
+
+    TAILQ_ENTRY(hls_segment_t) entries;
+};
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    size_t prebuffer;
+
+    TAILQ_HEAD(hls_queue_s, hls_segment_t) queue;
+    size_t queue_count;
+    size_t skip; // read position in the first segment, in packets
+
+    bool is_started;
+    bool is_pcr; // read position is on the PCR packet
+    bool is_reset;
+    uint64_t pcr;
+
+    uint32_t ts_count;
+    uint64_t ts_sync;
+    uint64_t block_time_total;
+    uint64_t block_time_tail;
+};
+
+/*
+ *  oooooooo8 ooooooooooo  ooooooo8 oooo     oooo ooooooooooo oooo   oooo ooooooooooo
+ * 888         888    88 o888    88  8888o   888   888    88   8888o  88  88  888  88
+ *  888oooooo  888ooo8   888    oooo 88 888o8 88   888ooo8     88 888o88      888
+ *         888 888    oo 888o    88  88  888  88   888    oo   88   8888      888
+ * o88oooo888 o888ooo8888 888ooo888 o88o  8  o88o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static void queue_pop(module_data_t *mod)
+{
+    hls_segment_t *segment = TAILQ_FIRST(&mod->queue);
+    TAILQ_REMOVE(&mod->queue, segment, entries);
+    --mod->queue_count;
+    mod->skip = 0;
+
+    free(segment->buffer);
+    free(segment);
+}
+
+static void queue_clear(module_data_t *mod)
+{
+    while(!TAILQ_EMPTY(&mod->queue))
+        queue_pop(mod);
+}
+
+/* sends count packets from the read position, completed segments are released */
+static void queue_send(module_data_t *mod, size_t count)
+{
+    while(count > 0)
+    {
+        hls_segment_t *segment = TAILQ_FIRST(&mod->queue);
+
+        size_t batch = segment->count - mod->skip;
+        if(batch > count)
+            batch = count;
+
+        module_stream_send_batch(mod, &segment->buffer[mod->skip * TS_PACKET_SIZE], batch);
+
+        mod->skip += batch;
+        count -= batch;
+        if(mod->skip == segment->count)
+            queue_pop(mod);
+    }
+}
+
+/*
+ * Packets from the read position to the next PCR packet. Stops on the
+ * segment with the discontinuity. Returns false if the queue is ended first
+ */
+static bool seek_pcr(  module_data_t *mod
+                     , size_t *block_count, uint64_t *pcr
+                     , bool *is_discontinuity)
+{
+    hls_segment_t *segment = TAILQ_FIRST(&mod->queue);
+    size_t skip = mod->skip;
+    size_t count = 0;
+
+    *is_discontinuity = false;
+
+    if(mod->is_pcr)
+    {
+        // current PCR packet is the first packet of the block
+        ++skip;
+        ++count;
+    }
+
+    while(segment)
+    {
+        for(; skip < segment->count; ++skip, ++count)
+        {
+            const uint8_t *ts = &segment->buffer[skip * TS_PACKET_SIZE];
+            if(TS_IS_PCR(ts))
+            {
+                *block_count = count;
+                *pcr = TS_GET_PCR(ts);
+                return true;
+            }
+        }
+
+        segment = TAILQ_NEXT(segment, entries);
+        skip = 0;
+
+        if(segment && segment->is_discontinuity && count > 0)
+        {
+            *block_count = count;
+            *is_discontinuity = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ *  oooooooo8 ooooo  oooo oooo   oooo  oooooooo8
+ * 888         888  88    8888o  88 o888     88
+ *  888oooooo    888      88 888o88 888
+ *         888   888      88   8888 888o     oo
+ * o88oooo888   o888o    o88o    88  888oooo88
+ *
+ * One scheduler timer serves all inputs as the synced http_request: on each
+ * tick every input sends packets of the current PCR block which are due by
+ * now. Packets out of the timing (before the first PCR, on the discontinuity
+ * and on the PCR jump) are sent at once, the clock is restarted.
+ */
+
+typedef struct
+{
+    asc_list_t *list;
+    asc_timer_t *timer;
+} hls_sync_t;
+
+static hls_sync_t hls_sync = { NULL, NULL };
+
+/* returns false if the queue is ended */
+static bool sync_next_block(module_data_t *mod)
+{
+    while(true)
+    {
+        size_t block_count = 0;
+        uint64_t pcr = 0;
+        bool is_discontinuity = false;
+
+        if(!seek_pcr(mod, &block_count, &pcr, &is_discontinuity))
+            return false;
+
+        if(is_discontinuity)
+        {
+            asc_log_debug(MSG("discontinuity"));
+            queue_send(mod, block_count);
+            mod->is_pcr = false;
+            continue;
+        }
+
+        if(!mod->is_pcr)
+        {
+            queue_send(mod, block_count);
+            mod->is_pcr = true;
+            mod->is_reset = true;
+            mod->pcr = pcr;
+            continue;
+        }
+
+        const uint64_t block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
+        mod->pcr = pcr;
+        if(block_time == 0 || block_time > HLS_BLOCK_TIME_MAX)
+        {
+            asc_log_debug(  MSG("block time out of range: %"PRIu64"ms block_size:%lu")
+                          , (uint64_t)(block_time / 1000), block_count);
+
+            queue_send(mod, block_count);
+            mod->is_reset = true;
+            continue;
+        }
+
+        if(mod->is_reset)
+        {
+            mod->is_reset = false;
+            mod->block_time_total = asc_utime();
+        }
+
+        mod->ts_count = block_count;
+        mod->ts_sync = block_time / block_count;
+        mod->block_time_tail = block_time % block_count;
+
+        return true;
+    }
+}
+
+/* returns false if the input should be buffered again */
+static bool sync_send(module_data_t *mod, uint64_t now)
+{
+    while(true)
+    {
+        if(!mod->ts_count && !sync_next_block(mod))
+            return false;
+
+        if(mod->block_time_total > now)
+            return true;
+
+        uint32_t count = 1;
+        if(mod->ts_sync > 0)
+            count += (now - mod->block_time_total) / mod->ts_sync;
+        if(count > mod->ts_count)
+            count = mod->ts_count;
+
+        queue_send(mod, count);
+        mod->ts_count -= count;
+        mod->block_time_total += (uint64_t)count * mod->ts_sync;
+
+        if(mod->ts_count > 0)
+            return true;
+
+        // block is completed
+        mod->block_time_total += mod->block_time_tail;
+
+        if(now > mod->block_time_total + 100000)
+        {
+            asc_log_warning(  MSG("wrong syncing time. -%"PRIu64"ms")
+                            , (now - mod->block_time_total) / 1000);
+            mod->is_reset = true;
+        }
+    }
+}
+
+static void on_sync_timer(void *arg)
+{
+    __uarg(arg);
+
+    const uint64_t now = asc_utime();
+
+    asc_list_first(hls_sync.list);
+    while(!asc_list_eol(hls_sync.list))
+    {
+        module_data_t *mod = (module_data_t *)asc_list_data(hls_sync.list);
+        if(!sync_send(mod, now))
+        {
+            asc_log_warning(MSG("queue is empty. buffering..."));
+            mod->is_started = false;
+            asc_list_remove_current(hls_sync.list);
+            continue;
+        }
+        asc_list_next(hls_sync.list);
+    }
+
+    if(!asc_list_size(hls_sync.list))
+    {
+        ASC_FREE(hls_sync.timer, asc_timer_destroy);
+        ASC_FREE(hls_sync.list, asc_list_destroy);
+    }
+}
+
+static void sync_start(module_data_t *mod)
+{
+    if(!hls_sync.list)
+    {
+        hls_sync.list = asc_list_init();
+        hls_sync.timer = asc_timer_init(HLS_SYNC_INTERVAL, on_sync_timer, NULL);
+    }
+
+    // the block is completed on the next PCR, the clock is restarted
+    mod->is_reset = true;
+    mod->is_started = true;
+    asc_list_insert_tail(hls_sync.list, mod);
+}
+
+static void sync_stop(module_data_t *mod)
+{
+    if(!mod->is_started)
+        return;
+
+    mod->is_started = false;
+    asc_list_remove_item(hls_sync.list, mod);
+
+    if(!asc_list_size(hls_sync.list))
+    {
+        ASC_FREE(hls_sync.timer, asc_timer_destroy);
+        ASC_FREE(hls_sync.list, asc_list_destroy);
+    }
+}
+
+/*
+ * oooo     oooo ooooooooooo ooooooooooo ooooo ooooo  ooooooo  ooooooooo   oooooooo8
+ *  8888o   888   888    88  88  888  88  888   888 o888   888o 888    88o 888
+ *  88 888o8 88   888ooo8        888      888ooo888 888     888 888    888  888oooooo
+ *  88  888  88   888    oo      888      888   888 888o   o888 888    888         888
+ * o88o  8  o88o o888ooo8888    o888o    o888o o888o  88ooo88  o888ooo88   o88oooo888
+ *
+ */
+
+static int method_push(module_data_t *mod)
+{
+    size_t size = 0;
+    const uint8_t *content = (const uint8_t *)luaL_checklstring(lua, 2, &size);
+    const bool is_discontinuity = lua_toboolean(lua, 3);
+
+    hls_segment_t *segment = (hls_segment_t *)calloc(1, sizeof(hls_segment_t));
+    segment->buffer = (uint8_t *)malloc(size - size % TS_PACKET_SIZE + TS_PACKET_SIZE);
+    segment->is_discontinuity = is_discontinuity;
+
+    // packets are aligned in the segment buffer, garbage is skipped
+    size_t skip = 0;
+    size_t lost = 0;
+    while(skip + TS_PACKET_SIZE <= size)
+    {
+        if(!TS_IS_SYNC((&content[skip])))
+        {
+            ++skip;
+            ++lost;
+            continue;
+        }
+
+        memcpy(&segment->buffer[segment->count * TS_PACKET_SIZE]
+               , &content[skip], TS_PACKET_SIZE);
+        ++segment->count;
+        skip += TS_PACKET_SIZE;
+    }
+
+    if(lost > 0)
+        asc_log_debug(MSG("segment is not aligned. skip %lu bytes"), lost);
+
+    if(!segment->count)
+    {
+        asc_log_error(MSG("segment without MPEG-TS packets"));
+        free(segment->buffer);
+        free(segment);
+        return 0;
+    }
+
+    if(TAILQ_EMPTY(&mod->queue) && is_discontinuity)
+        mod->is_pcr = false;
+
+    TAILQ_INSERT_TAIL(&mod->queue, segment, entries);
+    ++mod->queue_count;
+
+    if(!mod->is_started && mod->queue_count >= mod->prebuffer)
+        sync_start(mod);
+
+    return 0;
+}
+
+static int method_queued(module_data_t *mod)
+{
+    lua_pushnumber(lua, mod->queue_count);
+    return 1;
+}
+
+static int method_close(module_data_t *mod)
+{
+    sync_stop(mod);
+    queue_clear(mod);
+    mod->is_pcr = false;
+    mod->ts_count = 0;
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[hls_input] option 'name' is required");
+
+    int prebuffer = 2;
+    module_option_number("prebuffer", &prebuffer);
+    asc_assert(prebuffer > 0, MSG("option 'prebuffer' must be greater than 0"));
+    mod->prebuffer = prebuffer;
+
+    TAILQ_INIT(&mod->queue);
+
+    module_stream_init(mod, NULL);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    method_close(mod);
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "push", method_push },
+    { "queued", method_queued },
+    { "close", method_close },
+};
+
+MODULE_LUA_REGISTER(hls_input)
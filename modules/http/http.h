@@ -9,6 +9,8 @@
 
 typedef struct http_response_t http_response_t;
 typedef struct http_client_t http_client_t;
+typedef struct http2_t http2_t;
+typedef struct http2_stream_t http2_stream_t;
 
 struct http_client_t
 {
@@ -22,9 +24,15 @@ struct http_client_t
     char buffer[HTTP_BUFFER_SIZE];
     size_t buffer_skip;
     size_t chunk_left;
+    size_t pipeline;    // next request bytes stored at the end of the buffer
+
+    // keep-alive
+    bool is_keep_alive;
+    asc_timer_t *idle_timer;
 
     // request
     int status;         // 1 - empty line is found, 2 - request ready, 3 - release
+    size_t eoh_skip;    // end of headers search position
     int idx_request;
     int idx_callback;   // route callback
 
@@ -32,6 +40,21 @@ struct http_client_t
     bool is_content_length;
     string_buffer_t *content;
 
+    // admission control of the route, see route_admit()
+    void *route;
+    bool is_admitted;   // holds the route slot until the response is sent
+    bool is_queued;
+    uint64_t queue_time;
+    TAILQ_ENTRY(http_client_t) queue_entries;
+
+    // HTTP/2 connection, see http2.c. h2_stream is set on the stream clients
+    http2_t *h2;
+    http2_stream_t *h2_stream;
+
+    // TLS handshake in progress, see tls.c
+    void *tls;
+    event_callback_t on_tls_done;
+
     // response
     event_callback_t on_send;
     event_callback_t on_read;
@@ -50,15 +73,63 @@ void http_response_send(http_client_t *client);
 void http_client_warning(http_client_t *client, const char *message, ...);
 void http_client_error(http_client_t *client, const char *message, ...);
 void http_client_close(http_client_t *client);
+void http_client_complete(http_client_t *client);
 
 void http_client_redirect(http_client_t *client, int code, const char *location);
 void http_client_abort(http_client_t *client, int code, const char *text);
 
+/* socket of the HTTP/1 client, DATA frames of the HTTP/2 stream. 0 - try later */
+ssize_t http_client_send(http_client_t *client, const void *buffer, size_t size);
+ssize_t http_client_sendv(http_client_t *client, const struct iovec *iov, int iovcnt);
+void http_client_set_on_read(http_client_t *client, event_callback_t on_read);
+void http_client_set_on_ready(http_client_t *client, event_callback_t on_ready);
+
+// HTTP/2
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_SIZE 24
+
+/* stream client of the connection and its request, see server.c */
+http_client_t * http_server_stream_open(http_client_t *client);
+void http_server_stream_request(http_client_t *client);
+
+void http2_init(http_client_t *client, int idle_timeout);
+void http2_close(http_client_t *client);
+void http2_stream_close(http_client_t *client);
+void http2_stream_response(http_client_t *client);
+ssize_t http2_stream_send(http_client_t *client, const void *buffer, size_t size);
+ssize_t http2_stream_sendv(http_client_t *client, const struct iovec *iov, int iovcnt);
+void http2_stream_set_on_ready(http_client_t *client, event_callback_t on_ready);
+
+// TLS
+
+typedef struct http_tls_t http_tls_t;
+
+/* returns NULL if the certificate or the key is not loaded */
+http_tls_t * http_tls_init(const char *cert, const char *key);
+void http_tls_destroy(http_tls_t *tls);
+
+/* makes the handshake, then the socket is served by on_read as the plain socket */
+bool http_tls_accept(http_tls_t *tls, http_client_t *client, event_callback_t on_read);
+void http_tls_free(http_client_t *client);
+
+// WebSocket
+
+typedef struct http_websocket_topic_t http_websocket_topic_t;
+
+/* topic is shared by name. producer keeps the handle until close */
+http_websocket_topic_t * http_websocket_topic_open(const char *name);
+void http_websocket_topic_close(http_websocket_topic_t *topic);
+
+/* sends text frame to all subscribers of the topic */
+void http_websocket_publish(http_websocket_topic_t *topic, const char *data, size_t size);
+
 // Utils
 
 void lua_string_to_lower(const char *str, size_t size);
 void lua_url_decode(const char *str, size_t size);
 bool lua_parse_query(const char *str, size_t size);
+bool http_check_query(const char *str, size_t size);
 bool lua_safe_path(const char *str, size_t size);
 
 #endif /* _HTTP_H_ */
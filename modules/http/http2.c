@@ -0,0 +1,1613 @@
+/*
+ * Astra Module: HTTP/2
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HTTP/2 connection of the http_server (RFC 7540, cleartext with prior
+ * knowledge). The connection client is switched to HTTP/2 by the preface,
+ * see client_parse(). Each stream is an http_client_t of its own: request
+ * headers are decoded with HPACK (RFC 7541) and passed to the server as the
+ * HTTP/1 request text, so routing, the request table and the admission are
+ * the same. Response head made by http_response_code()/http_response_header()
+ * is converted to the HEADERS frame, the body is sent with
+ * http_client_send() as the DATA frames in the limits of the flow control.
+ *
+ * Frames are queued to the output buffer of the connection and sent from
+ * the on_ready callback. DATA is queued while the buffer is below
+ * H2_OUTPUT_LIMIT, then on_ready of the streams is called in turn.
+ */
+
+#include "http.h"
+#include <ctype.h>
+
+#define H2_FRAME_HEADER 9
+#define H2_MAX_FRAME (16 * 1024)        // SETTINGS_MAX_FRAME_SIZE, default value
+#define H2_INPUT_SIZE (2 * (H2_FRAME_HEADER + H2_MAX_FRAME))
+#define H2_BLOCK_SIZE (64 * 1024)       // HEADERS with CONTINUATION
+#define H2_OUTPUT_SIZE (64 * 1024)
+#define H2_OUTPUT_LIMIT (256 * 1024)
+#define H2_MAX_STREAMS 128
+#define H2_WINDOW 65535
+#define H2_TABLE_SIZE 4096              // SETTINGS_HEADER_TABLE_SIZE, default value
+#define H2_TABLE_ENTRY 32
+#define H2_DISPATCH_ROUNDS 16
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x01
+#define H2_FLAG_ACK 0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED 0x08
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+typedef struct
+{
+    char *name;
+    size_t name_size;
+    char *value;
+    size_t value_size;
+} hpack_field_t;
+
+struct http2_stream_t
+{
+    http2_t *h2;
+    http_client_t *client;
+    uint32_t id;
+
+    int64_t window;             // send window
+    event_callback_t on_ready;  // see http_client_set_on_ready()
+
+    bool is_headers;            // HEADERS of the response is sent
+    bool is_end;                // END_STREAM is sent
+    int64_t content_left;       // Content-Length of the response, -1 if not defined
+    bool is_request;            // request is passed to the server
+    bool is_reset;              // RST_STREAM is received
+    uint32_t error;             // RST_STREAM code if the response is not started
+
+    size_t head_size;           // request head in the client buffer
+    uint8_t *body;
+    size_t body_size;
+
+    TAILQ_ENTRY(http2_stream_t) entries;
+};
+
+struct http2_t
+{
+    http_client_t *client;      // NULL if the connection is closed
+    int busy;                   // callbacks in progress. see h2_release()
+    bool is_goaway;             // GOAWAY is queued, close when the output is sent
+
+    TAILQ_HEAD(http2_stream_list_s, http2_stream_t) streams;
+    size_t stream_count;
+    uint32_t last_stream_id;
+    uint32_t events;            // progress of the streams, see h2_on_ready()
+
+    int idle_timeout;
+    asc_timer_t *idle_timer;
+
+    uint8_t *input;
+    size_t input_count;
+
+    // header block
+    uint8_t *block;
+    size_t block_count;
+    uint32_t block_stream;
+    bool block_end_stream;
+
+    // decoded request fields, one line per field
+    char *fields;
+    size_t fields_count;
+    bool is_fields_overflow;
+
+    // HPACK dynamic table of the decoder, the newest entry is first
+    hpack_field_t table[H2_TABLE_SIZE / H2_TABLE_ENTRY];
+    size_t table_count;
+    size_t table_size;
+    size_t table_max;
+
+    uint8_t *output;
+    size_t output_size;
+    size_t output_skip;
+    size_t output_count;
+
+    int64_t window;             // connection send window
+    int64_t initial_window;     // SETTINGS_INITIAL_WINDOW_SIZE of the peer
+    size_t max_frame;           // SETTINGS_MAX_FRAME_SIZE of the peer
+};
+
+/*
+ * HPACK
+ */
+
+static const struct
+{
+    const char *name;
+    const char *value;
+} hpack_static[] =
+{
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+#define HPACK_STATIC_COUNT (sizeof(hpack_static) / sizeof(hpack_static[0]))
+#define HPACK_EOS 256
+
+/* code of the symbol, from the most significant bit of the length */
+static const struct
+{
+    uint32_t code;
+    uint8_t size;
+} hpack_huffman[HPACK_EOS + 1] =
+{
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 }, { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+    { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 }, { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+    { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 }, { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 }, { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+    { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 }, { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+    { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 }, { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 }, { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+    { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 }, { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+    { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 }, { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 }, { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+    { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 }, { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+    { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 }, { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 }, { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+    { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 }, { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+    { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 }, { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 }, { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+    { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 }, { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+    { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 }, { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 }, { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+    { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 }, { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+    { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 }, { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 }, { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+    { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 }, { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+    { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 }, { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 }, { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+    { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 }, { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+    { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 }, { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 }, { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+    { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 }, { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+    { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 }, { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 }, { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+    { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 }, { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+/* decoding tree, built on first use. child < 0 is the symbol -(child + 1) */
+static int16_t hpack_tree[HPACK_EOS][2];
+static int hpack_tree_count = 0;
+
+static void hpack_tree_init(void)
+{
+    hpack_tree_count = 1;
+    for(int symbol = 0; symbol <= HPACK_EOS; ++symbol)
+    {
+        const uint32_t code = hpack_huffman[symbol].code;
+        const int size = hpack_huffman[symbol].size;
+
+        int node = 0;
+        for(int i = size - 1; i > 0; --i)
+        {
+            const int bit = (code >> i) & 1;
+            if(!hpack_tree[node][bit])
+                hpack_tree[node][bit] = hpack_tree_count++;
+            node = hpack_tree[node][bit];
+        }
+        hpack_tree[node][code & 1] = -(symbol + 1);
+    }
+}
+
+static bool hpack_huffman_decode(  const uint8_t *src, size_t size
+                                 , char *dst, size_t dst_size, size_t *dst_count)
+{
+    if(!hpack_tree_count)
+        hpack_tree_init();
+
+    size_t count = 0;
+    int node = 0;
+    int depth = 0; // bits of the incomplete symbol, padding at the end
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        for(int b = 7; b >= 0; --b)
+        {
+            const int child = hpack_tree[node][(src[i] >> b) & 1];
+            if(child > 0)
+            {
+                node = child;
+                ++depth;
+                continue;
+            }
+
+            const int symbol = -child - 1;
+            if(symbol == HPACK_EOS || count >= dst_size)
+                return false;
+
+            dst[count++] = (char)symbol;
+            node = 0;
+            depth = 0;
+        }
+    }
+
+    if(depth > 7)
+        return false;
+
+    *dst_count = count;
+    return true;
+}
+
+static bool hpack_integer(  const uint8_t **ptr, const uint8_t *end
+                          , int prefix, size_t *value)
+{
+    const uint8_t *p = *ptr;
+    if(p >= end)
+        return false;
+
+    const size_t mask = (1 << prefix) - 1;
+    size_t v = *p & mask;
+    ++p;
+
+    if(v == mask)
+    {
+        int shift = 0;
+        uint8_t b;
+        do
+        {
+            if(p >= end || shift > 28)
+                return false;
+            b = *p;
+            ++p;
+            v += (size_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while(b & 0x80);
+    }
+
+    *ptr = p;
+    *value = v;
+    return true;
+}
+
+static bool hpack_string(  const uint8_t **ptr, const uint8_t *end
+                         , char *dst, size_t dst_size, size_t *dst_count)
+{
+    if(*ptr >= end)
+        return false;
+
+    const bool is_huffman = (**ptr & 0x80);
+    size_t size;
+    if(!hpack_integer(ptr, end, 7, &size))
+        return false;
+    if(size > (size_t)(end - *ptr))
+        return false;
+
+    const uint8_t *src = *ptr;
+    *ptr += size;
+
+    if(is_huffman)
+        return hpack_huffman_decode(src, size, dst, dst_size, dst_count);
+
+    if(size > dst_size)
+        return false;
+    memcpy(dst, src, size);
+    *dst_count = size;
+    return true;
+}
+
+static void hpack_table_evict(http2_t *h2, size_t size)
+{
+    while(h2->table_count > 0 && h2->table_size + size > h2->table_max)
+    {
+        hpack_field_t *field = &h2->table[--h2->table_count];
+        h2->table_size -= field->name_size + field->value_size + H2_TABLE_ENTRY;
+        free(field->name);
+    }
+}
+
+static void hpack_table_insert(  http2_t *h2
+                               , const char *name, size_t name_size
+                               , const char *value, size_t value_size)
+{
+    const size_t size = name_size + value_size + H2_TABLE_ENTRY;
+    if(size > h2->table_max)
+    {
+        hpack_table_evict(h2, h2->table_max + 1);
+        return;
+    }
+
+    // copy before eviction, name could be in the evicted entry
+    char *copy = (char *)malloc(name_size + value_size + 1);
+    memcpy(copy, name, name_size);
+    memcpy(&copy[name_size], value, value_size);
+
+    hpack_table_evict(h2, size);
+
+    memmove(&h2->table[1], &h2->table[0], h2->table_count * sizeof(hpack_field_t));
+    hpack_field_t *field = &h2->table[0];
+    field->name = copy;
+    field->name_size = name_size;
+    field->value = &copy[name_size];
+    field->value_size = value_size;
+
+    ++h2->table_count;
+    h2->table_size += size;
+}
+
+static bool hpack_table_get(  http2_t *h2, size_t index
+                            , const char **name, size_t *name_size
+                            , const char **value, size_t *value_size)
+{
+    if(index == 0)
+        return false;
+
+    if(index <= HPACK_STATIC_COUNT)
+    {
+        *name = hpack_static[index - 1].name;
+        *name_size = strlen(*name);
+        *value = hpack_static[index - 1].value;
+        *value_size = strlen(*value);
+        return true;
+    }
+
+    index -= HPACK_STATIC_COUNT + 1;
+    if(index >= h2->table_count)
+        return false;
+
+    const hpack_field_t *field = &h2->table[index];
+    *name = field->name;
+    *name_size = field->name_size;
+    *value = field->value;
+    *value_size = field->value_size;
+    return true;
+}
+
+/* stores the request field as "name: value\r\n" */
+static void h2_field(  http2_t *h2
+                     , const char *name, size_t name_size
+                     , const char *value, size_t value_size)
+{
+    const size_t size = name_size + value_size + 4;
+    if(h2->fields_count + size > HTTP_BUFFER_SIZE)
+    {
+        h2->is_fields_overflow = true;
+        return;
+    }
+
+    for(size_t i = 0; i < value_size; ++i)
+    {
+        if(value[i] == '\r' || value[i] == '\n' || value[i] == '\0')
+        {
+            h2->is_fields_overflow = true;
+            return;
+        }
+    }
+
+    char *dst = &h2->fields[h2->fields_count];
+    memcpy(dst, name, name_size);
+    dst += name_size;
+    *(dst++) = ':';
+    *(dst++) = ' ';
+    memcpy(dst, value, value_size);
+    dst += value_size;
+    *(dst++) = '\r';
+    *(dst++) = '\n';
+    h2->fields_count += size;
+}
+
+/* decodes the header block to the request fields. false on the compression error */
+static bool hpack_decode(http2_t *h2, const uint8_t *ptr, size_t size)
+{
+    const uint8_t *end = &ptr[size];
+
+    char name_buffer[1024];
+    char value_buffer[HTTP_BUFFER_SIZE];
+
+    h2->fields_count = 0;
+    h2->is_fields_overflow = false;
+
+    while(ptr < end)
+    {
+        const uint8_t b = *ptr;
+
+        const char *name;
+        size_t name_size;
+        const char *value;
+        size_t value_size;
+        size_t index;
+
+        if(b & 0x80)
+        {
+            // indexed
+            if(!hpack_integer(&ptr, end, 7, &index))
+                return false;
+            if(!hpack_table_get(h2, index, &name, &name_size, &value, &value_size))
+                return false;
+
+            h2_field(h2, name, name_size, value, value_size);
+            continue;
+        }
+
+        if((b & 0xE0) == 0x20)
+        {
+            // dynamic table size update
+            if(!hpack_integer(&ptr, end, 5, &index) || index > H2_TABLE_SIZE)
+                return false;
+            h2->table_max = index;
+            hpack_table_evict(h2, 0);
+            continue;
+        }
+
+        // literal with incremental indexing, without indexing, never indexed
+        const bool is_indexing = (b & 0x40);
+        if(!hpack_integer(&ptr, end, (is_indexing) ? 6 : 4, &index))
+            return false;
+
+        if(index > 0)
+        {
+            const char *unused_value;
+            size_t unused_size;
+            if(!hpack_table_get(h2, index, &name, &name_size, &unused_value, &unused_size))
+                return false;
+        }
+        else
+        {
+            if(!hpack_string(&ptr, end, name_buffer, sizeof(name_buffer), &name_size))
+                return false;
+            name = name_buffer;
+        }
+
+        if(!hpack_string(&ptr, end, value_buffer, sizeof(value_buffer), &value_size))
+            return false;
+        value = value_buffer;
+
+        h2_field(h2, name, name_size, value, value_size);
+
+        if(is_indexing)
+            hpack_table_insert(h2, name, name_size, value, value_size);
+    }
+
+    return true;
+}
+
+static uint8_t * hpack_encode_integer(uint8_t *dst, uint8_t flags, int prefix, size_t value)
+{
+    const size_t mask = (1 << prefix) - 1;
+    if(value < mask)
+    {
+        *(dst++) = flags | value;
+        return dst;
+    }
+
+    *(dst++) = flags | mask;
+    value -= mask;
+    while(value >= 0x80)
+    {
+        *(dst++) = 0x80 | (value & 0x7F);
+        value >>= 7;
+    }
+    *(dst++) = value;
+    return dst;
+}
+
+static uint8_t * hpack_encode_string(uint8_t *dst, const char *str, size_t size)
+{
+    dst = hpack_encode_integer(dst, 0x00, 7, size);
+    memcpy(dst, str, size);
+    return &dst[size];
+}
+
+/*
+ * Connection
+ */
+
+static void h2_on_ready(void *arg);
+
+static void h2_kick(http2_t *h2)
+{
+    if(h2->client)
+        asc_socket_set_on_ready(h2->client->sock, h2_on_ready);
+}
+
+/* reserves size bytes at the end of the output */
+static uint8_t * h2_output(http2_t *h2, size_t size)
+{
+    if(h2->output_count + size > h2->output_size)
+    {
+        if(h2->output_skip > 0)
+        {
+            h2->output_count -= h2->output_skip;
+            memmove(h2->output, &h2->output[h2->output_skip], h2->output_count);
+            h2->output_skip = 0;
+        }
+
+        if(h2->output_count + size > h2->output_size)
+        {
+            while(h2->output_count + size > h2->output_size)
+                h2->output_size *= 2;
+            h2->output = (uint8_t *)realloc(h2->output, h2->output_size);
+        }
+    }
+
+    uint8_t *ptr = &h2->output[h2->output_count];
+    h2->output_count += size;
+    return ptr;
+}
+
+static void h2_frame(  http2_t *h2, uint8_t type, uint8_t flags, uint32_t stream_id
+                     , const void *payload, size_t size)
+{
+    uint8_t *ptr = h2_output(h2, H2_FRAME_HEADER + size);
+    ptr[0] = (size >> 16) & 0xFF;
+    ptr[1] = (size >> 8) & 0xFF;
+    ptr[2] = size & 0xFF;
+    ptr[3] = type;
+    ptr[4] = flags;
+    ptr[5] = (stream_id >> 24) & 0x7F;
+    ptr[6] = (stream_id >> 16) & 0xFF;
+    ptr[7] = (stream_id >> 8) & 0xFF;
+    ptr[8] = stream_id & 0xFF;
+    if(size > 0)
+        memcpy(&ptr[H2_FRAME_HEADER], payload, size);
+
+    h2_kick(h2);
+}
+
+static void h2_frame_u32(http2_t *h2, uint8_t type, uint32_t stream_id, uint32_t value)
+{
+    const uint8_t payload[4] =
+    {
+        (value >> 24) & 0xFF, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF
+    };
+    h2_frame(h2, type, 0, stream_id, payload, sizeof(payload));
+}
+
+static void h2_goaway(http2_t *h2, uint32_t error)
+{
+    if(h2->is_goaway)
+        return;
+
+    if(error != H2_NO_ERROR)
+        http_client_warning(h2->client, "http/2 connection error:%u", error);
+
+    const uint32_t id = h2->last_stream_id;
+    const uint8_t payload[8] =
+    {
+        (id >> 24) & 0x7F, (id >> 16) & 0xFF, (id >> 8) & 0xFF, id & 0xFF,
+        (error >> 24) & 0xFF, (error >> 16) & 0xFF, (error >> 8) & 0xFF, error & 0xFF
+    };
+    h2_frame(h2, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    h2->is_goaway = true;
+}
+
+static size_t h2_output_pending(http2_t *h2)
+{
+    return h2->output_count - h2->output_skip;
+}
+
+static void h2_free(http2_t *h2)
+{
+    while(h2->table_count > 0)
+        free(h2->table[--h2->table_count].name);
+
+    free(h2->input);
+    free(h2->block);
+    free(h2->fields);
+    free(h2->output);
+    free(h2);
+}
+
+/* the connection could be closed by the callbacks. true if it is still open */
+static bool h2_release(http2_t *h2)
+{
+    --h2->busy;
+    if(h2->client)
+        return true;
+
+    if(!h2->busy)
+        h2_free(h2);
+    return false;
+}
+
+static void on_h2_idle(void *arg)
+{
+    http2_t *h2 = (http2_t *)arg;
+    h2->idle_timer = NULL;
+    h2_goaway(h2, H2_NO_ERROR);
+}
+
+/*
+ * Streams
+ */
+
+static http2_stream_t * h2_stream_find(http2_t *h2, uint32_t id)
+{
+    http2_stream_t *stream;
+    TAILQ_FOREACH(stream, &h2->streams, entries)
+    {
+        if(stream->id == id)
+            return stream;
+    }
+    return NULL;
+}
+
+static http2_stream_t * h2_stream_open(http2_t *h2, uint32_t id)
+{
+    http_client_t *client = http_server_stream_open(h2->client);
+
+    http2_stream_t *stream = (http2_stream_t *)calloc(1, sizeof(http2_stream_t));
+    stream->h2 = h2;
+    stream->client = client;
+    stream->id = id;
+    stream->window = h2->initial_window;
+
+    client->h2 = h2;
+    client->h2_stream = stream;
+
+    TAILQ_INSERT_TAIL(&h2->streams, stream, entries);
+    ++h2->stream_count;
+
+    ASC_FREE(h2->idle_timer, asc_timer_destroy);
+
+    return stream;
+}
+
+static void h2_stream_reset(http2_stream_t *stream, uint32_t error)
+{
+    stream->error = error;
+    http_client_close(stream->client);
+}
+
+static void h2_reset(http2_t *h2, uint32_t id, uint32_t error)
+{
+    h2_frame_u32(h2, H2_RST_STREAM, id, error);
+}
+
+/* request line and headers of the stream from the decoded fields */
+static bool h2_stream_head(http2_stream_t *stream)
+{
+    http2_t *h2 = stream->h2;
+    http_client_t *client = stream->client;
+
+    const char *method = NULL, *path = NULL, *authority = NULL;
+    size_t method_size = 0, path_size = 0, authority_size = 0;
+
+    // pseudo-header fields
+    size_t skip = 0;
+    while(skip < h2->fields_count)
+    {
+        const char *line = &h2->fields[skip];
+        const char *eol = (const char *)memchr(line, '\r', h2->fields_count - skip);
+        skip = (eol - h2->fields) + 2;
+
+        if(line[0] != ':')
+            continue;
+
+        const char *value = (const char *)memchr(line, ' ', eol - line) + 1;
+        const size_t value_size = eol - value;
+
+        if(!strncmp(line, ":method:", 8))
+        {
+            method = value;
+            method_size = value_size;
+        }
+        else if(!strncmp(line, ":path:", 6))
+        {
+            path = value;
+            path_size = value_size;
+        }
+        else if(!strncmp(line, ":authority:", 11))
+        {
+            authority = value;
+            authority_size = value_size;
+        }
+    }
+
+    if(!method || !path || !path_size || memchr(path, ' ', path_size))
+        return false;
+
+    int size = snprintf(  client->buffer, HTTP_BUFFER_SIZE
+                        , "%.*s %.*s HTTP/2.0\r\n"
+                        , (int)method_size, method
+                        , (int)path_size, path);
+    if(authority && size < HTTP_BUFFER_SIZE)
+    {
+        size += snprintf(  &client->buffer[size], HTTP_BUFFER_SIZE - size
+                         , "Host: %.*s\r\n"
+                         , (int)authority_size, authority);
+    }
+    if(size >= HTTP_BUFFER_SIZE)
+        return false;
+
+    // regular fields. body size is set with the request
+    skip = 0;
+    while(skip < h2->fields_count)
+    {
+        const char *line = &h2->fields[skip];
+        const char *eol = (const char *)memchr(line, '\r', h2->fields_count - skip);
+        const size_t line_size = (eol - line) + 2;
+        skip += line_size;
+
+        if(line[0] == ':')
+            continue;
+        if(line_size > 16 && !strncmp(line, "content-length:", 15))
+            continue;
+        if(line_size > 12 && !strncmp(line, "connection:", 11))
+            continue;
+
+        if(size + line_size > HTTP_BUFFER_SIZE)
+            return false;
+        memcpy(&client->buffer[size], line, line_size);
+        size += line_size;
+    }
+
+    stream->head_size = size;
+    return true;
+}
+
+/* END_STREAM is received, passes the request to the server */
+static void h2_stream_request(http2_stream_t *stream)
+{
+    http_client_t *client = stream->client;
+    stream->is_request = true;
+
+    size_t size = stream->head_size;
+    if(stream->body_size > 0)
+    {
+        size += snprintf(  &client->buffer[size], HTTP_BUFFER_SIZE - size
+                         , "Content-Length: %zu\r\n", stream->body_size);
+    }
+
+    if(size + 2 + stream->body_size > HTTP_BUFFER_SIZE)
+    {
+        h2_stream_reset(stream, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+
+    client->buffer[size++] = '\r';
+    client->buffer[size++] = '\n';
+    if(stream->body_size > 0)
+    {
+        memcpy(&client->buffer[size], stream->body, stream->body_size);
+        size += stream->body_size;
+        ASC_FREE(stream->body, free);
+        stream->body_size = 0;
+    }
+
+    client->buffer_skip = size;
+    http_server_stream_request(client);
+}
+
+/*
+ * Frames
+ */
+
+static void h2_headers(http2_t *h2)
+{
+    const uint32_t id = h2->block_stream;
+    const bool is_end_stream = h2->block_end_stream;
+
+    const bool is_ok = hpack_decode(h2, h2->block, h2->block_count);
+    h2->block_count = 0;
+    h2->block_stream = 0;
+
+    if(!is_ok)
+    {
+        h2_goaway(h2, H2_COMPRESSION_ERROR);
+        return;
+    }
+
+    http2_stream_t *stream = h2_stream_find(h2, id);
+    if(stream)
+    {
+        // trailer fields are ignored
+        if(is_end_stream && !stream->is_request)
+            h2_stream_request(stream);
+        return;
+    }
+
+    if(id <= h2->last_stream_id || !(id & 1))
+        return;
+    h2->last_stream_id = id;
+
+    if(h2->is_goaway)
+        return;
+
+    if(h2->stream_count >= H2_MAX_STREAMS)
+    {
+        h2_reset(h2, id, H2_REFUSED_STREAM);
+        return;
+    }
+
+    if(h2->is_fields_overflow)
+    {
+        h2_reset(h2, id, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    stream = h2_stream_open(h2, id);
+    if(!h2_stream_head(stream))
+    {
+        h2_stream_reset(stream, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if(is_end_stream)
+        h2_stream_request(stream);
+}
+
+static void h2_block(http2_t *h2, const uint8_t *payload, size_t size, uint8_t flags)
+{
+    if(h2->block_count + size > H2_BLOCK_SIZE)
+    {
+        h2_goaway(h2, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+
+    memcpy(&h2->block[h2->block_count], payload, size);
+    h2->block_count += size;
+
+    if(flags & H2_FLAG_END_HEADERS)
+        h2_headers(h2);
+}
+
+/* strips padding. false if the frame is malformed */
+static bool h2_padding(const uint8_t **payload, size_t *size, uint8_t flags)
+{
+    if(flags & H2_FLAG_PADDED)
+    {
+        if(*size < 1)
+            return false;
+        const size_t pad = (*payload)[0];
+        *payload += 1;
+        *size -= 1;
+        if(pad > *size)
+            return false;
+        *size -= pad;
+    }
+    return true;
+}
+
+static void h2_settings(http2_t *h2, const uint8_t *payload, size_t size)
+{
+    for(size_t i = 0; i + 6 <= size; i += 6)
+    {
+        const uint16_t id = (payload[i] << 8) | payload[i + 1];
+        const uint32_t value = ((uint32_t)payload[i + 2] << 24)
+                             | ((uint32_t)payload[i + 3] << 16)
+                             | ((uint32_t)payload[i + 4] << 8)
+                             | ((uint32_t)payload[i + 5]);
+
+        if(id == H2_SETTINGS_INITIAL_WINDOW_SIZE)
+        {
+            if(value > 0x7FFFFFFF)
+            {
+                h2_goaway(h2, H2_FLOW_CONTROL_ERROR);
+                return;
+            }
+
+            const int64_t delta = (int64_t)value - h2->initial_window;
+            h2->initial_window = value;
+
+            http2_stream_t *stream;
+            TAILQ_FOREACH(stream, &h2->streams, entries)
+                stream->window += delta;
+        }
+        else if(id == H2_SETTINGS_MAX_FRAME_SIZE)
+        {
+            if(value < H2_MAX_FRAME || value > 0xFFFFFF)
+            {
+                h2_goaway(h2, H2_PROTOCOL_ERROR);
+                return;
+            }
+            h2->max_frame = value;
+        }
+    }
+
+    h2_frame(h2, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    ++h2->events;
+}
+
+static void h2_data(  http2_t *h2, uint32_t id, uint8_t flags
+                    , const uint8_t *payload, size_t size)
+{
+    // received bytes are consumed at once
+    if(size > 0)
+        h2_frame_u32(h2, H2_WINDOW_UPDATE, 0, size);
+
+    if(!h2_padding(&payload, &size, flags))
+    {
+        h2_goaway(h2, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    http2_stream_t *stream = h2_stream_find(h2, id);
+    if(!stream || stream->is_request)
+        return;
+
+    if(stream->body_size + size > HTTP_BUFFER_SIZE)
+    {
+        h2_stream_reset(stream, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+
+    if(size > 0)
+    {
+        stream->body = (uint8_t *)realloc(stream->body, stream->body_size + size);
+        memcpy(&stream->body[stream->body_size], payload, size);
+        stream->body_size += size;
+    }
+
+    if(flags & H2_FLAG_END_STREAM)
+        h2_stream_request(stream);
+    else if(size > 0)
+        h2_frame_u32(h2, H2_WINDOW_UPDATE, id, size);
+}
+
+static void h2_frame_process(  http2_t *h2, uint8_t type, uint8_t flags, uint32_t id
+                             , const uint8_t *payload, size_t size)
+{
+    if(h2->block_stream && type != H2_CONTINUATION)
+    {
+        h2_goaway(h2, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    switch(type)
+    {
+        case H2_DATA:
+            if(!id)
+                break;
+            h2_data(h2, id, flags, payload, size);
+            return;
+
+        case H2_HEADERS:
+            if(!id || !h2_padding(&payload, &size, flags))
+                break;
+            if(flags & H2_FLAG_PRIORITY)
+            {
+                if(size < 5)
+                    break;
+                payload += 5;
+                size -= 5;
+            }
+            h2->block_stream = id;
+            h2->block_end_stream = (flags & H2_FLAG_END_STREAM);
+            h2_block(h2, payload, size, flags);
+            return;
+
+        case H2_CONTINUATION:
+            if(!id || id != h2->block_stream)
+                break;
+            h2_block(h2, payload, size, flags);
+            return;
+
+        case H2_PRIORITY:
+            return;
+
+        case H2_RST_STREAM:
+        {
+            if(!id || size != 4)
+                break;
+            http2_stream_t *stream = h2_stream_find(h2, id);
+            if(stream)
+            {
+                stream->is_reset = true;
+                http_client_close(stream->client);
+            }
+            return;
+        }
+
+        case H2_SETTINGS:
+            if(id || (size % 6) != 0)
+                break;
+            if(!(flags & H2_FLAG_ACK))
+                h2_settings(h2, payload, size);
+            return;
+
+        case H2_PING:
+            if(id || size != 8)
+                break;
+            if(!(flags & H2_FLAG_ACK))
+                h2_frame(h2, H2_PING, H2_FLAG_ACK, 0, payload, size);
+            return;
+
+        case H2_GOAWAY:
+            // the peer closes the connection after the active streams
+            return;
+
+        case H2_WINDOW_UPDATE:
+        {
+            if(size != 4)
+                break;
+            const uint32_t increment = ((uint32_t)(payload[0] & 0x7F) << 24)
+                                     | ((uint32_t)payload[1] << 16)
+                                     | ((uint32_t)payload[2] << 8)
+                                     | ((uint32_t)payload[3]);
+            if(!id)
+            {
+                h2->window += increment;
+            }
+            else
+            {
+                http2_stream_t *stream = h2_stream_find(h2, id);
+                if(!stream)
+                    return;
+                stream->window += increment;
+            }
+            ++h2->events;
+            h2_kick(h2);
+            return;
+        }
+
+        default:
+            // PUSH_PROMISE is not allowed for the client, unknown types are ignored
+            if(type != H2_PUSH_PROMISE)
+                return;
+            break;
+    }
+
+    h2_goaway(h2, H2_PROTOCOL_ERROR);
+}
+
+static void h2_input(http2_t *h2)
+{
+    ++h2->busy;
+
+    size_t skip = 0;
+    while(!h2->is_goaway && h2->input_count - skip >= H2_FRAME_HEADER)
+    {
+        const uint8_t *frame = &h2->input[skip];
+        const size_t size = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+        if(size > H2_MAX_FRAME)
+        {
+            h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+            break;
+        }
+
+        if(h2->input_count - skip < H2_FRAME_HEADER + size)
+            break;
+
+        const uint32_t id = ((uint32_t)(frame[5] & 0x7F) << 24)
+                          | ((uint32_t)frame[6] << 16)
+                          | ((uint32_t)frame[7] << 8)
+                          | ((uint32_t)frame[8]);
+
+        h2_frame_process(h2, frame[3], frame[4], id, &frame[H2_FRAME_HEADER], size);
+        if(!h2->client)
+            break;
+
+        skip += H2_FRAME_HEADER + size;
+    }
+
+    if(!h2_release(h2))
+        return;
+
+    h2->input_count -= skip;
+    if(h2->input_count > 0 && skip > 0)
+        memmove(h2->input, &h2->input[skip], h2->input_count);
+}
+
+static void h2_on_read(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http2_t *h2 = client->h2;
+
+    const ssize_t size = asc_socket_recv(  client->sock
+                                         , &h2->input[h2->input_count]
+                                         , H2_INPUT_SIZE - h2->input_count);
+    if(size <= 0)
+    {
+        http_client_close(client);
+        return;
+    }
+
+    if(h2->is_goaway)
+        return;
+
+    h2->input_count += size;
+    h2_input(h2);
+}
+
+/* sends the output. false if the connection is closed on error */
+static bool h2_flush(http2_t *h2)
+{
+    http_client_t *client = h2->client;
+
+    while(h2_output_pending(h2) > 0)
+    {
+        const ssize_t send_size = asc_socket_send(  client->sock
+                                                  , &h2->output[h2->output_skip]
+                                                  , h2_output_pending(h2));
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send http/2 frames [%s]"
+                              , asc_socket_error());
+            http_client_close(client);
+            return false;
+        }
+        if(send_size == 0)
+            break;
+
+        h2->output_skip += send_size;
+    }
+
+    if(h2->output_skip == h2->output_count)
+    {
+        h2->output_skip = 0;
+        h2->output_count = 0;
+    }
+
+    return true;
+}
+
+static void h2_on_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http2_t *h2 = client->h2;
+
+    if(!h2_flush(h2))
+        return;
+
+    bool is_idle = true;
+
+    ++h2->busy;
+    for(int round = 0; round < H2_DISPATCH_ROUNDS; ++round)
+    {
+        if(h2_output_pending(h2) >= H2_OUTPUT_LIMIT)
+        {
+            is_idle = false;
+            break;
+        }
+
+        const uint32_t events = h2->events;
+
+        http2_stream_t *stream, *next;
+        for(stream = TAILQ_FIRST(&h2->streams); stream; stream = next)
+        {
+            next = TAILQ_NEXT(stream, entries);
+            if(stream->on_ready)
+            {
+                stream->on_ready(stream->client);
+                if(!h2->client)
+                    break;
+            }
+        }
+
+        if(!h2->client || h2->events == events)
+            break;
+
+        is_idle = false;
+    }
+    if(!h2_release(h2))
+        return;
+
+    if(!h2_flush(h2))
+        return;
+
+    if(h2_output_pending(h2) > 0)
+        return;
+
+    if(h2->is_goaway)
+    {
+        http_client_close(client);
+        return;
+    }
+
+    if(is_idle)
+        asc_socket_set_on_ready(client->sock, NULL);
+}
+
+/*
+ * Server API
+ */
+
+void http2_init(http_client_t *client, int idle_timeout)
+{
+    http2_t *h2 = (http2_t *)calloc(1, sizeof(http2_t));
+    h2->client = client;
+    TAILQ_INIT(&h2->streams);
+
+    h2->window = H2_WINDOW;
+    h2->initial_window = H2_WINDOW;
+    h2->max_frame = H2_MAX_FRAME;
+    h2->table_max = H2_TABLE_SIZE;
+    h2->idle_timeout = idle_timeout;
+
+    h2->input = (uint8_t *)malloc(H2_INPUT_SIZE);
+    h2->block = (uint8_t *)malloc(H2_BLOCK_SIZE);
+    h2->fields = (char *)malloc(HTTP_BUFFER_SIZE);
+    h2->output_size = H2_OUTPUT_SIZE;
+    h2->output = (uint8_t *)malloc(h2->output_size);
+
+    client->h2 = h2;
+
+    static const uint8_t settings[] =
+    {
+        0x00, H2_SETTINGS_MAX_CONCURRENT_STREAMS, 0x00, 0x00, 0x00, H2_MAX_STREAMS,
+    };
+    h2_frame(h2, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+
+    if(h2->idle_timeout > 0)
+        h2->idle_timer = asc_timer_one_shot(h2->idle_timeout, on_h2_idle, h2);
+
+    // frames after the preface
+    h2->input_count = client->buffer_skip - HTTP2_PREFACE_SIZE;
+    memcpy(h2->input, &client->buffer[HTTP2_PREFACE_SIZE], h2->input_count);
+    client->buffer_skip = 0;
+
+    asc_socket_set_on_read(client->sock, h2_on_read);
+    h2_input(h2);
+}
+
+/* the connection is closed. closes the streams, called from on_client_close() */
+void http2_close(http_client_t *client)
+{
+    http2_t *h2 = client->h2;
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    ASC_FREE(h2->idle_timer, asc_timer_destroy);
+
+    h2->client = NULL;
+    h2->is_goaway = true;
+
+    http2_stream_t *stream;
+    while((stream = TAILQ_FIRST(&h2->streams)) != NULL)
+        http_client_close(stream->client);
+
+    client->h2 = NULL;
+
+    if(!h2->busy)
+        h2_free(h2);
+}
+
+/* the stream is closed by the server or by the route module */
+void http2_stream_close(http_client_t *client)
+{
+    http2_stream_t *stream = client->h2_stream;
+    http2_t *h2 = stream->h2;
+
+    if(h2->client && !stream->is_reset && !stream->is_end)
+    {
+        if(stream->is_headers)
+            h2_frame(h2, H2_DATA, H2_FLAG_END_STREAM, stream->id, NULL, 0);
+        else
+            h2_reset(h2, stream->id, (stream->error) ? stream->error : H2_INTERNAL_ERROR);
+    }
+
+    TAILQ_REMOVE(&h2->streams, stream, entries);
+    --h2->stream_count;
+    ++h2->events;
+
+    if(stream->body)
+        free(stream->body);
+    free(stream);
+
+    client->h2 = NULL;
+    client->h2_stream = NULL;
+
+    if(h2->client && !h2->stream_count && h2->idle_timeout > 0 && !h2->idle_timer)
+        h2->idle_timer = asc_timer_one_shot(h2->idle_timeout, on_h2_idle, h2);
+}
+
+/* converts the response head in the client buffer to the HEADERS frame */
+void http2_stream_response(http_client_t *client)
+{
+    http2_stream_t *stream = client->h2_stream;
+    http2_t *h2 = stream->h2;
+
+    const char *head = client->buffer;
+    const size_t head_size = client->chunk_left;
+
+    uint8_t block[HTTP_BUFFER_SIZE + 64];
+    uint8_t *dst = block;
+
+    // status line
+    const char *eol = (const char *)memchr(head, '\n', head_size);
+    const char *sp = (const char *)memchr(head, ' ', head_size);
+    const int code = (sp) ? atoi(&sp[1]) : 500;
+
+    stream->content_left = -1;
+
+    static const int status_index[][2] =
+    {
+        { 200, 8 }, { 204, 9 }, { 206, 10 }, { 304, 11 },
+        { 400, 12 }, { 404, 13 }, { 500, 14 },
+    };
+
+    size_t index = 0;
+    for(size_t i = 0; i < ASC_ARRAY_SIZE(status_index); ++i)
+    {
+        if(status_index[i][0] == code)
+        {
+            index = status_index[i][1];
+            break;
+        }
+    }
+
+    if(index)
+    {
+        dst = hpack_encode_integer(dst, 0x80, 7, index);
+    }
+    else
+    {
+        char status[8];
+        const int status_size = snprintf(status, sizeof(status), "%03d", code % 1000);
+        dst = hpack_encode_integer(dst, 0x00, 4, 8);
+        dst = hpack_encode_string(dst, status, status_size);
+    }
+
+    // header lines, literal without indexing
+    size_t skip = (eol) ? (size_t)(eol - head) + 1 : head_size;
+    while(skip < head_size)
+    {
+        const char *line = &head[skip];
+        eol = (const char *)memchr(line, '\n', head_size - skip);
+        if(!eol)
+            break;
+        skip = (eol - head) + 1;
+
+        const char *colon = (const char *)memchr(line, ':', eol - line);
+        if(!colon)
+            continue; // empty line
+
+        char name[128];
+        const size_t name_size = colon - line;
+        if(name_size == 0 || name_size >= sizeof(name))
+            continue;
+        for(size_t i = 0; i < name_size; ++i)
+            name[i] = tolower((unsigned char)line[i]);
+        name[name_size] = '\0';
+
+        // connection-specific fields are not allowed
+        if(   !strcmp(name, "connection")
+           || !strcmp(name, "keep-alive")
+           || !strcmp(name, "transfer-encoding")
+           || !strcmp(name, "upgrade")
+           || !strcmp(name, "proxy-connection"))
+        {
+            continue;
+        }
+
+        const char *value = &colon[1];
+        while(value < eol && *value == ' ')
+            ++value;
+        const char *value_end = eol;
+        while(value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' '))
+            --value_end;
+
+        if(!strcmp(name, "content-length"))
+            stream->content_left = strtoll(value, NULL, 10);
+
+        index = 0;
+        for(size_t i = 15; i <= HPACK_STATIC_COUNT; ++i)
+        {
+            if(!strcmp(name, hpack_static[i - 1].name))
+            {
+                index = i;
+                break;
+            }
+        }
+
+        if(index)
+        {
+            dst = hpack_encode_integer(dst, 0x00, 4, index);
+        }
+        else
+        {
+            *(dst++) = 0x00;
+            dst = hpack_encode_string(dst, name, name_size);
+        }
+        dst = hpack_encode_string(dst, value, value_end - value);
+    }
+
+    // response without content ends with HEADERS
+    if(client->is_head || stream->content_left == 0 || code == 204 || code == 304)
+        stream->is_end = true;
+
+    // HEADERS and CONTINUATION
+    const size_t block_size = dst - block;
+    size_t block_skip = 0;
+    uint8_t type = H2_HEADERS;
+    uint8_t flags = (stream->is_end) ? H2_FLAG_END_STREAM : 0;
+    do
+    {
+        size_t size = block_size - block_skip;
+        if(size > h2->max_frame)
+            size = h2->max_frame;
+        else
+            flags |= H2_FLAG_END_HEADERS;
+
+        h2_frame(h2, type, flags, stream->id, &block[block_skip], size);
+        block_skip += size;
+        type = H2_CONTINUATION;
+        flags = 0;
+    } while(block_skip < block_size);
+
+    stream->is_headers = true;
+    ++h2->events;
+
+    client->chunk_left = 0;
+    client->buffer_skip = 0;
+}
+
+ssize_t http2_stream_send(http_client_t *client, const void *buffer, size_t size)
+{
+    http2_stream_t *stream = client->h2_stream;
+    http2_t *h2 = stream->h2;
+
+    if(!h2->client || (stream->is_end && size > 0))
+        return -1;
+
+    size_t total = 0;
+    while(total < size)
+    {
+        const size_t pending = h2_output_pending(h2);
+        if(pending >= H2_OUTPUT_LIMIT)
+            break;
+
+        int64_t frame_size = size - total;
+        if(frame_size > stream->window)
+            frame_size = stream->window;
+        if(frame_size > h2->window)
+            frame_size = h2->window;
+        if(frame_size > (int64_t)h2->max_frame)
+            frame_size = h2->max_frame;
+        if(frame_size > (int64_t)(H2_OUTPUT_LIMIT - pending))
+            frame_size = H2_OUTPUT_LIMIT - pending;
+        if(stream->content_left >= 0 && frame_size > stream->content_left)
+            frame_size = stream->content_left;
+        if(frame_size <= 0)
+            break;
+
+        // the last DATA frame of the Content-Length ends the stream
+        uint8_t flags = 0;
+        if(stream->content_left >= 0)
+        {
+            stream->content_left -= frame_size;
+            if(stream->content_left == 0)
+            {
+                flags = H2_FLAG_END_STREAM;
+                stream->is_end = true;
+            }
+        }
+
+        h2_frame(  h2, H2_DATA, flags, stream->id
+                 , &((const uint8_t *)buffer)[total], frame_size);
+
+        stream->window -= frame_size;
+        h2->window -= frame_size;
+        total += frame_size;
+    }
+
+    if(total > 0)
+        ++h2->events;
+
+    return total;
+}
+
+ssize_t http2_stream_sendv(http_client_t *client, const struct iovec *iov, int iovcnt)
+{
+    ssize_t total = 0;
+    for(int i = 0; i < iovcnt; ++i)
+    {
+        const ssize_t send_size = http2_stream_send(client, iov[i].iov_base, iov[i].iov_len);
+        if(send_size == -1)
+            return -1;
+        total += send_size;
+        if((size_t)send_size != iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+
+void http2_stream_set_on_ready(http_client_t *client, event_callback_t on_ready)
+{
+    http2_stream_t *stream = client->h2_stream;
+    http2_t *h2 = stream->h2;
+
+    if(stream->on_ready == on_ready)
+        return;
+
+    stream->on_ready = on_ready;
+    ++h2->events;
+
+    if(on_ready)
+        h2_kick(h2);
+}
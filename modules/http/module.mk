@@ -1,13 +1,64 @@
-SOURCES="parser.c utils.c server.c request.c \
+SOURCES="parser.c utils.c server.c http2.c request.c hls_input.c \
 modules/redirect.c \
 modules/static.c \
 modules/websocket.c \
 modules/upstream.c \
-modules/downstream.c"
+modules/downstream.c \
+modules/hls.c \
+modules/timeshift.c \
+modules/cache.c \
+modules/metrics.c \
+modules/graph.c \
+modules/epg.c"
 
-MODULES="http_server http_request \
+MODULES="http_server http_request hls_input \
 http_redirect \
 http_static \
 http_websocket \
 http_upstream \
-http_downstream"
+http_downstream \
+hls_output \
+timeshift \
+http_cache \
+http_metrics \
+http_stream_graph \
+http_epg"
+
+# HTTPS: OpenSSL 3 makes the handshake, the traffic is encrypted by the kernel
+
+ktls_test_c()
+{
+    cat <<EOF2
+#include <openssl/ssl.h>
+#include <linux/tls.h>
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+#   error "OpenSSL 3 is required"
+#endif
+int main(void)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_free(ctx);
+    return TLS_1_2_VERSION;
+}
+EOF2
+}
+
+check_ktls()
+{
+    ktls_test_c | $APP_C -Werror $APP_CFLAGS -o .link-test -x c - $APP_LDFLAGS -lssl -lcrypto >/dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        rm -f .link-test
+        return 0
+    else
+        return 1
+    fi
+}
+
+if check_ktls ; then
+    SOURCES="$SOURCES tls.c"
+    CFLAGS="-DHAVE_HTTP_TLS=1"
+    LDFLAGS="-lssl -lcrypto"
+else
+    echo "$MODULE: warning: OpenSSL 3 or linux/tls.h is not found. HTTPS disabled" >&2
+fi
@@ -0,0 +1,429 @@
+/*
+ * Astra Module: HTTP Module: Response Cache
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_cache
+ *
+ * Module Options:
+ *      name        - string, name for the log messages. default: "cache"
+ *      ttl         - number, lifetime of the rendered content in milliseconds.
+ *                    default: 1000
+ *      callback    - function(request, done), renders the content and calls
+ *                    done(content, content_type) at once or later.
+ *                    done(nil) replies 404, the response is not cached
+ *
+ * Module Methods:
+ *      invalidate()
+ *                  - drop all cached content, the next request renders it again
+ *      stat()      - return table: hit, miss, entries
+ *
+ * Usage:
+ *      The instance is a route of the http_server, or it is called from the
+ *      route function as cache(server, client, request) after the checks.
+ *      The route function passes the request nil to the cache too.
+ *
+ * Content is cached by the request URI and sent from the shared buffer.
+ * Requests received while the content is rendered wait for the same render.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#define MSG(_msg) "[http_cache %s] " _msg, mod->name
+
+#define HTTP_CACHE_SIZE 32
+#define HTTP_CACHE_PENDING_TIMEOUT (10 * 1000000) // us, render without done()
+
+typedef struct http_cache_entry_t http_cache_entry_t;
+
+struct http_cache_entry_t
+{
+    size_t refcount; // cache and clients
+
+    uint64_t id;
+    char *key;
+    uint64_t time;
+    uint32_t gen;
+    bool is_ready;
+
+    char *content;
+    size_t content_size;
+    char *content_type;
+
+    TAILQ_HEAD(cache_wait_list_s, http_response_t) wait_list;
+};
+
+struct module_data_t
+{
+    const char *name;
+    uint64_t ttl;
+    int idx_callback;
+
+    http_cache_entry_t *entry[HTTP_CACHE_SIZE];
+    uint64_t entry_id;
+    uint32_t gen;
+
+    uint64_t hit;
+    uint64_t miss;
+};
+
+struct http_response_t
+{
+    http_client_t *client;
+    http_cache_entry_t *entry;
+    size_t skip;
+    bool is_wait;
+
+    TAILQ_ENTRY(http_response_t) entries;
+};
+
+/*
+ * client->mod - http_server module
+ * client->response - response of the http_cache module
+ */
+
+static void entry_unref(http_cache_entry_t *entry)
+{
+    --entry->refcount;
+    if(entry->refcount > 0)
+        return;
+
+    free(entry->key);
+    free(entry->content);
+    free(entry->content_type);
+    free(entry);
+}
+
+static bool entry_is_fresh(module_data_t *mod, const http_cache_entry_t *entry, uint64_t now)
+{
+    if(!entry->is_ready)
+        return (now - entry->time < HTTP_CACHE_PENDING_TIMEOUT);
+
+    return (entry->gen == mod->gen && now - entry->time < mod->ttl);
+}
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    if(response->is_wait)
+        TAILQ_REMOVE(&response->entry->wait_list, response, entries);
+    entry_unref(response->entry);
+
+    free(response);
+    client->response = NULL;
+}
+
+/* clients waiting for the removed render are not going to be replied */
+static void entry_remove(module_data_t *mod, int i)
+{
+    http_cache_entry_t *entry = mod->entry[i];
+    mod->entry[i] = NULL;
+
+    http_response_t *response;
+    while((response = TAILQ_FIRST(&entry->wait_list)) != NULL)
+    {
+        http_client_t *client = response->client;
+        response_free(client);
+        http_client_abort(client, 503, NULL);
+    }
+
+    entry_unref(entry);
+}
+
+static void on_ready_send(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    const http_cache_entry_t *entry = response->entry;
+
+    const ssize_t send_size = http_client_send(  client
+                                               , &entry->content[response->skip]
+                                               , entry->content_size - response->skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send content [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+    if(response->skip == entry->content_size)
+    {
+        response_free(client);
+        http_client_complete(client);
+    }
+}
+
+static void response_send(http_client_t *client)
+{
+    const http_cache_entry_t *entry = client->response->entry;
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: %s", entry->content_type);
+    http_response_header(client, "Content-Length: %lu", (unsigned long)entry->content_size);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
+    http_response_send(client);
+}
+
+/* Stack: 1 - content, 2 - content_type. Upvalues: 1 - instance, 2 - module, 3 - entry id */
+static int entry_done(lua_State *L)
+{
+    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(2));
+    const uint64_t id = (uint64_t)lua_tonumber(L, lua_upvalueindex(3));
+
+    int i = 0;
+    for(; i < HTTP_CACHE_SIZE; ++i)
+    {
+        if(mod->entry[i] && mod->entry[i]->id == id)
+            break;
+    }
+    if(i == HTTP_CACHE_SIZE || mod->entry[i]->is_ready)
+        return 0; // replaced or done() is called again
+
+    http_cache_entry_t *entry = mod->entry[i];
+    const bool is_content = lua_isstring(L, 1);
+    if(is_content)
+    {
+        size_t size = 0;
+        const char *content = lua_tolstring(L, 1, &size);
+        entry->content = (char *)malloc(size);
+        memcpy(entry->content, content, size);
+        entry->content_size = size;
+        entry->content_type = strdup(lua_isstring(L, 2)
+                                     ? lua_tostring(L, 2)
+                                     : "application/octet-stream");
+        entry->is_ready = true;
+        entry->time = asc_utime();
+    }
+
+    http_response_t *response;
+    while((response = TAILQ_FIRST(&entry->wait_list)) != NULL)
+    {
+        http_client_t *client = response->client;
+        if(is_content)
+        {
+            TAILQ_REMOVE(&entry->wait_list, response, entries);
+            response->is_wait = false;
+            response_send(client);
+        }
+        else
+        {
+            response_free(client);
+            http_client_abort(client, 404, NULL);
+        }
+    }
+
+    if(!is_content)
+        entry_remove(mod, i);
+
+    return 0;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_free(client);
+        return 0;
+    }
+
+    lua_getfield(lua, 4, "request_uri");
+    const char *key = lua_tostring(lua, -1);
+    if(!key)
+    {
+        lua_pop(lua, 1);
+        http_client_abort(client, 400, NULL);
+        return 0;
+    }
+
+    const uint64_t now = asc_utime();
+
+    int slot = -1;
+    http_cache_entry_t *entry = NULL;
+    for(int i = 0; i < HTTP_CACHE_SIZE; ++i)
+    {
+        http_cache_entry_t *item = mod->entry[i];
+        if(!item)
+        {
+            if(slot == -1)
+                slot = i;
+            continue;
+        }
+
+        if(strcmp(item->key, key) != 0)
+        {
+            if(!entry_is_fresh(mod, item, now))
+                entry_remove(mod, i);
+            if(!mod->entry[i] && slot == -1)
+                slot = i;
+            continue;
+        }
+
+        if(entry_is_fresh(mod, item, now))
+            entry = item;
+        else
+        {
+            entry_remove(mod, i);
+            slot = i;
+        }
+        break;
+    }
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->client = client;
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = NULL;
+
+    if(entry)
+    {
+        lua_pop(lua, 1); // key
+        ++mod->hit;
+        ++entry->refcount;
+        response->entry = entry;
+
+        if(entry->is_ready)
+            response_send(client);
+        else
+        {
+            response->is_wait = true;
+            TAILQ_INSERT_TAIL(&entry->wait_list, response, entries);
+        }
+        return 0;
+    }
+
+    ++mod->miss;
+
+    if(slot == -1)
+    {
+        // all entries are fresh, the oldest is replaced
+        slot = 0;
+        for(int i = 1; i < HTTP_CACHE_SIZE; ++i)
+        {
+            if(mod->entry[i]->time < mod->entry[slot]->time)
+                slot = i;
+        }
+        entry_remove(mod, slot);
+    }
+
+    entry = (http_cache_entry_t *)calloc(1, sizeof(http_cache_entry_t));
+    entry->refcount = 2; // cache and client
+    entry->id = ++mod->entry_id;
+    entry->key = strdup(key);
+    entry->time = now;
+    entry->gen = mod->gen;
+    TAILQ_INIT(&entry->wait_list);
+    mod->entry[slot] = entry;
+    lua_pop(lua, 1); // key
+
+    response->entry = entry;
+    response->is_wait = true;
+    TAILQ_INSERT_TAIL(&entry->wait_list, response, entries);
+
+    // done() keeps the instance, the module is not destroyed before the call
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+    lua_pushvalue(lua, 4);
+    lua_pushvalue(lua, 1);
+    lua_pushlightuserdata(lua, (void *)mod);
+    lua_pushnumber(lua, (lua_Number)entry->id);
+    lua_pushcclosure(lua, entry_done, 3);
+    lua_call(lua, 2, 0);
+
+    return 0;
+}
+
+static int method_invalidate(module_data_t *mod)
+{
+    ++mod->gen;
+    return 0;
+}
+
+static int method_stat(module_data_t *mod)
+{
+    int count = 0;
+    for(int i = 0; i < HTTP_CACHE_SIZE; ++i)
+    {
+        if(mod->entry[i])
+            ++count;
+    }
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->hit);
+    lua_setfield(lua, -2, "hit");
+    lua_pushnumber(lua, (lua_Number)mod->miss);
+    lua_setfield(lua, -2, "miss");
+    lua_pushnumber(lua, count);
+    lua_setfield(lua, -2, "entries");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    mod->name = "cache";
+    module_option_string("name", &mod->name, NULL);
+
+    int ttl = 1000;
+    module_option_number("ttl", &ttl);
+    asc_assert(ttl >= 0, MSG("option 'ttl' must be positive"));
+    mod->ttl = (uint64_t)ttl * 1000;
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
+    asc_assert(lua_isfunction(lua, -1), MSG("option 'callback' is required"));
+    mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    // clients keep the entries, the waiting clients are released by the server
+    for(int i = 0; i < HTTP_CACHE_SIZE; ++i)
+    {
+        if(mod->entry[i])
+            entry_remove(mod, i);
+    }
+
+    if(mod->idx_callback)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+        mod->idx_callback = 0;
+    }
+}
+
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    { "invalidate", method_invalidate },
+    { "stat", method_stat },
+};
+
+MODULE_LUA_REGISTER(http_cache)
@@ -18,12 +18,33 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_downstream
+ *
+ * Module Options:
+ *      callback    - function, called with (server, client, request).
+ *                    request.stream is the stream of the pushed content
+ *      buffer_size - number, receive buffer size in KiB. default: 256
+ *      socket_size - number, SO_RCVBUF size in KiB. default: system
+ *
+ * Each client receives into its own buffer with one recv() per event,
+ * aligned packets are sent to the stream as one batch.
+ */
+
 #include <astra.h>
 #include "../http.h"
 
+#define MSG(_msg) "[http_downstream] " _msg
+
+#define DEFAULT_BUFFER_SIZE 256
+
 struct module_data_t
 {
     int idx_callback;
+
+    size_t buffer_size;
+    int socket_size;
 };
 
 struct http_response_t
@@ -32,65 +53,70 @@ struct http_response_t
 
     module_data_t *mod;
 
-    uint8_t buffer[TS_PACKET_SIZE];
-    size_t buffer_skip;
+    uint8_t *buffer;
+    size_t buffer_skip; // received bytes, less than a packet between reads
+
+    bool is_error_message;
 };
 
 /*
  * client->mod - http_server module
- * client->response->mod - http_upstream module
+ * client->response->mod - http_downstream module
  */
 
 static void on_downstream_read(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    uint8_t *buffer = response->buffer;
 
-    ssize_t size = asc_socket_recv(client->sock, client->buffer, HTTP_BUFFER_SIZE);
+    const ssize_t size = asc_socket_recv(  client->sock
+                                         , &buffer[response->buffer_skip]
+                                         , response->mod->buffer_size - response->buffer_skip);
     if(size <= 0)
     {
-        if(errno == EAGAIN)
+        if(size == -1 && errno == EAGAIN)
             return;
 
         http_client_close(client);
         return;
     }
 
-    ssize_t skip = 0;
+    const size_t end = response->buffer_skip + size;
+    size_t skip = 0;
 
-    if(client->response->buffer_skip > 0)
+    while(skip + TS_PACKET_SIZE <= end)
     {
-        skip = TS_PACKET_SIZE - client->response->buffer_skip;
-        uint8_t *dst = &client->response->buffer[client->response->buffer_skip];
-        if(size < skip)
-        {
-            memcpy(dst, client->buffer, size);
-            client->response->buffer_skip += size;
-        }
-        else
+        if(buffer[skip] != 0x47)
         {
-            memcpy(dst, client->buffer, skip);
-            module_stream_send(client->response, client->response->buffer);
-            client->response->buffer_skip = 0;
+            const uint8_t *sync = (const uint8_t *)memchr(  &buffer[skip + 1], 0x47
+                                                          , end - skip - 1);
+            const size_t drop = (sync) ? (size_t)(sync - &buffer[skip]) : (end - skip);
+
+            if(!response->is_error_message)
+            {
+                http_client_error(client, "wrong stream format. drop %zu bytes", drop);
+                response->is_error_message = true;
+            }
+
+            skip += drop;
+            continue;
         }
-    }
-
-    while(skip < size)
-    {
-        const uint8_t *ts = (const uint8_t *)&client->buffer[skip];
 
-        const size_t remain = size - skip;
-        if(remain < TS_PACKET_SIZE)
+        size_t count = 1;
+        while(   skip + (count + 1) * TS_PACKET_SIZE <= end
+              && buffer[skip + count * TS_PACKET_SIZE] == 0x47)
         {
-            memcpy(client->response->buffer, ts, remain);
-            client->response->buffer_skip = remain;
-            break;
-        }
-        else
-        {
-            module_stream_send(client->response, ts);
-            skip += TS_PACKET_SIZE;
+            ++count;
         }
+
+        module_stream_send_batch(response, &buffer[skip], count);
+        skip += count * TS_PACKET_SIZE;
     }
+
+    response->buffer_skip = end - skip;
+    if(response->buffer_skip > 0 && skip > 0)
+        memmove(buffer, &buffer[skip], response->buffer_skip);
 }
 
 static void on_downstream_send(void *arg)
@@ -149,20 +175,35 @@ static int module_call(module_data_t *mod)
 
             module_stream_destroy(client->response);
 
+            free(client->response->buffer);
             free(client->response);
             client->response = NULL;
         }
         return 0;
     }
 
+    // request body is received in the socket callbacks, HTTP/2 stream has no socket
+    if(client->h2_stream)
+    {
+        http_client_abort(client, 505, "upload requires HTTP/1.1");
+        return 0;
+    }
+
     client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
     client->response->mod = mod;
+    client->response->buffer = (uint8_t *)malloc(mod->buffer_size);
+
+    if(mod->socket_size > 0)
+        asc_socket_set_buffer(client->sock, mod->socket_size, 0);
+    asc_socket_set_priority(client->sock, ASC_EVENT_INPUT);
 
     client->on_send = on_downstream_send;
 
     // like module_stream_init()
     client->response->__stream.self = (void *)client;
     client->response->__stream.on_ts = NULL;
+    client->response->__stream.on_ts_batch = NULL;
+    client->response->__stream.on_ts_block = NULL;
     __module_stream_init(&client->response->__stream);
 
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
@@ -179,24 +220,20 @@ static int module_call(module_data_t *mod)
     return 0;
 }
 
-static int __module_call(lua_State *L)
-{
-    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
-    return module_call(mod);
-}
-
 static void module_init(module_data_t *mod)
 {
     lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
     asc_assert(lua_isfunction(lua, -1), "[http_downstream] option 'callback' is required");
     mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
 
-    // Set callback for http route
-    lua_getmetatable(lua, 3);
-    lua_pushlightuserdata(lua, (void *)mod);
-    lua_pushcclosure(lua, __module_call, 1);
-    lua_setfield(lua, -2, "__call");
-    lua_pop(lua, 1);
+    int buffer_size = DEFAULT_BUFFER_SIZE;
+    module_option_number("buffer_size", &buffer_size);
+    asc_assert(buffer_size > 0, MSG("option 'buffer_size' must be greater than 0"));
+    mod->buffer_size = buffer_size * 1024;
+
+    int socket_size = 0;
+    if(module_option_number("socket_size", &socket_size) && socket_size > 0)
+        mod->socket_size = socket_size * 1024;
 }
 
 static void module_destroy(module_data_t *mod)
@@ -210,6 +247,7 @@ static void module_destroy(module_data_t *mod)
 
 MODULE_LUA_METHODS()
 {
+    { "__call", module_call },
     { NULL, NULL }
 };
 
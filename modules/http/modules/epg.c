@@ -0,0 +1,250 @@
+/*
+ * Astra Module: HTTP Module: EPG
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_epg
+ *
+ * Module Options:
+ *      no options
+ *
+ * Route handler with the JSON of the EPG store, see modules/mpegts/src/epg.c.
+ * Without the query the page is a list of the services. With the query
+ * sid=N[&tsid=N&onid=N] the page is a list of the events of the service
+ * from the current one. Strings are taken from the store as is.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+struct module_data_t
+{
+    int unused;
+};
+
+struct http_response_t
+{
+    char *content;
+    size_t size;
+    size_t skip;
+};
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    client->response = NULL;
+
+    free(response->content);
+    free(response);
+}
+
+static void json_string(string_buffer_t *buffer, const char *key, const char *value)
+{
+    string_buffer_addfstring(buffer, "\"%s\":\"", key);
+    for(; *value; ++value)
+    {
+        const uint8_t c = *value;
+        if(c == '"' || c == '\\')
+        {
+            string_buffer_addchar(buffer, '\\');
+            string_buffer_addchar(buffer, c);
+        }
+        else if(c < 0x20)
+        {
+            string_buffer_addchar(buffer, '\\');
+            string_buffer_addfstring(buffer, "u%04x", c);
+        }
+        else
+            string_buffer_addchar(buffer, c);
+    }
+    string_buffer_addchar(buffer, '"');
+}
+
+static void render_service(void *arg, const mpegts_epg_service_t *service)
+{
+    string_buffer_t *buffer = (string_buffer_t *)arg;
+
+    if(string_buffer_size(buffer) > 1)
+        string_buffer_addchar(buffer, ',');
+
+    string_buffer_addfstring(buffer, "{\"onid\":%d,\"tsid\":%d,\"sid\":%d,\"type\":%d"
+                             , service->onid, service->tsid, service->sid, service->type);
+    if(service->name)
+    {
+        string_buffer_addchar(buffer, ',');
+        json_string(buffer, "name", service->name);
+    }
+    if(service->provider)
+    {
+        string_buffer_addchar(buffer, ',');
+        json_string(buffer, "provider", service->provider);
+    }
+    string_buffer_addchar(buffer, '}');
+}
+
+static void render_events(string_buffer_t *buffer, const mpegts_epg_service_t *service)
+{
+    size_t count = 0;
+    const mpegts_epg_event_t *event = mpegts_epg_events(service, time(NULL), &count);
+
+    for(size_t i = 0; i < count; ++i, ++event)
+    {
+        if(i > 0)
+            string_buffer_addchar(buffer, ',');
+
+        string_buffer_addfstring(  buffer
+                                 , "{\"event_id\":%d,\"start\":%lld,\"duration\":%u"
+                                   ",\"running_status\":%d"
+                                 , event->event_id, (long long)event->start
+                                 , event->duration, event->running_status);
+        if(event->lang[0])
+        {
+            string_buffer_addchar(buffer, ',');
+            json_string(buffer, "lang", event->lang);
+        }
+        if(event->name)
+        {
+            string_buffer_addchar(buffer, ',');
+            json_string(buffer, "name", event->name);
+        }
+        if(event->text)
+        {
+            string_buffer_addchar(buffer, ',');
+            json_string(buffer, "text", event->text);
+        }
+        string_buffer_addchar(buffer, '}');
+    }
+}
+
+static int query_number(int idx, const char *key)
+{
+    int value = -1;
+    lua_getfield(lua, idx, key);
+    if(lua_isstring(lua, -1))
+        value = atoi(lua_tostring(lua, -1));
+    lua_pop(lua, 1);
+    return value;
+}
+
+static void on_ready_send_epg(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->skip >= response->size)
+    {
+        response_free(client);
+        http_client_complete(client);
+        return;
+    }
+
+    const size_t left = response->size - response->skip;
+    const ssize_t send_size = http_client_send(  client
+                                               , &response->content[response->skip]
+                                               , left);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send epg [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    __uarg(mod);
+
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_free(client);
+        return 0;
+    }
+
+    int sid = -1, tsid = -1, onid = -1;
+    lua_getfield(lua, 4, "query");
+    if(lua_istable(lua, -1))
+    {
+        const int query = lua_gettop(lua);
+        sid = query_number(query, "sid");
+        tsid = query_number(query, "tsid");
+        onid = query_number(query, "onid");
+    }
+    lua_pop(lua, 1);
+
+    string_buffer_t *buffer = string_buffer_alloc();
+    string_buffer_addchar(buffer, '[');
+    if(sid < 0)
+        mpegts_epg_foreach(render_service, buffer);
+    else
+    {
+        const mpegts_epg_service_t *service = mpegts_epg_service(onid, tsid, sid);
+        if(!service)
+        {
+            string_buffer_free(buffer);
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
+        render_events(buffer, service);
+    }
+    string_buffer_addchar(buffer, ']');
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->content = string_buffer_release(buffer, &response->size);
+
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_epg;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: application/json; charset=utf-8");
+    http_response_header(client, "Content-Length: %zu", response->size);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
+    http_response_send(client);
+
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    { NULL, NULL }
+};
+
+MODULE_LUA_REGISTER(http_epg)
@@ -0,0 +1,278 @@
+/*
+ * Astra Module: HTTP Module: Stream Graph
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_stream_graph
+ *
+ * Module Options:
+ *      no options
+ *
+ * Route handler with the stream graph of the process, see
+ * module_stream_graph_foreach(). The page is JSON with the same fields
+ * as astra.stream_graph(), with the query format=dot the page is
+ * the Graphviz digraph: nodes are the streams, edges are labeled with
+ * the packet rate and the bitrate.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+struct module_data_t
+{
+    int unused;
+};
+
+struct http_response_t
+{
+    char *content;
+    size_t size;
+    size_t skip;
+};
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    client->response = NULL;
+
+    free(response->content);
+    free(response);
+}
+
+/*
+ * escapes the quote and the backslash. control characters are \uXXXX
+ * in JSON and skipped in DOT. format of string_buffer_addfstring() has
+ * the escape sequences, so the backslash is added with addchar
+ */
+static void add_escaped(string_buffer_t *buffer, const char *value, bool is_json)
+{
+    for(; *value; ++value)
+    {
+        const uint8_t c = *value;
+        if(c == '"' || c == '\\')
+        {
+            string_buffer_addchar(buffer, '\\');
+            string_buffer_addchar(buffer, c);
+        }
+        else if(c < 0x20)
+        {
+            if(is_json)
+            {
+                string_buffer_addchar(buffer, '\\');
+                string_buffer_addfstring(buffer, "u%04x", c);
+            }
+        }
+        else
+            string_buffer_addchar(buffer, c);
+    }
+}
+
+static void add_string(string_buffer_t *buffer, const char *value)
+{
+    string_buffer_addchar(buffer, '"');
+    add_escaped(buffer, value, true);
+    string_buffer_addchar(buffer, '"');
+}
+
+static void render_json(void *arg, module_stream_t *stream)
+{
+    string_buffer_t *buffer = (string_buffer_t *)arg;
+    const asc_profile_t *const profile = stream->profile;
+
+    if(string_buffer_size(buffer) > 1)
+        string_buffer_addchar(buffer, ',');
+
+    string_buffer_addfstring(buffer, "{\"id\":%u", stream->id);
+    if(profile)
+    {
+        string_buffer_addlstring(buffer, ",\"type\":", 8);
+        add_string(buffer, profile->type);
+        if(profile->name)
+        {
+            string_buffer_addlstring(buffer, ",\"name\":", 8);
+            add_string(buffer, profile->name);
+        }
+    }
+    if(stream->parent)
+        string_buffer_addfstring(buffer, ",\"parent\":%u", stream->parent->id);
+
+    string_buffer_addfstring(buffer, ",\"transparent\":%s,\"routed\":%s,\"packets\":%llu"
+                             , (stream->is_transparent) ? "true" : "false"
+                             , (stream->is_routed) ? "true" : "false"
+                             , (unsigned long long)stream->stat.packets);
+
+    string_buffer_addlstring(buffer, ",\"pids\":[", 9);
+    if(stream->pid_list)
+    {
+        bool is_first = true;
+        MPEGTS_PID_MAP_FOREACH(stream->pid_list, pid)
+        {
+            string_buffer_addfstring(buffer, (is_first) ? "%d" : ",%d", pid);
+            is_first = false;
+        }
+    }
+
+    string_buffer_addlstring(buffer, "],\"children\":[", 14);
+    for(size_t i = 0; i < stream->child_count; ++i)
+    {
+        string_buffer_addfstring(buffer, (i == 0) ? "%u" : ",%u"
+                                 , stream->child_list[i].stream->id);
+    }
+
+    const uint64_t rate = module_stream_graph_rate(stream);
+    string_buffer_addfstring(  buffer
+                             , "],\"edge\":{\"packets\":%llu,\"bytes\":%llu"
+                               ",\"rate\":%llu,\"byte_rate\":%llu}}"
+                             , (unsigned long long)stream->edge_packets
+                             , (unsigned long long)stream->edge_packets * TS_PACKET_SIZE
+                             , (unsigned long long)rate
+                             , (unsigned long long)rate * TS_PACKET_SIZE);
+}
+
+static void render_dot(void *arg, module_stream_t *stream)
+{
+    string_buffer_t *buffer = (string_buffer_t *)arg;
+    const asc_profile_t *const profile = stream->profile;
+
+    /* label lines are separated with \n of DOT */
+    string_buffer_addfstring(buffer, "  n%u [label=\"", stream->id);
+    add_escaped(buffer, (profile) ? profile->type : "stream", false);
+    if(profile && profile->name)
+    {
+        string_buffer_addchar(buffer, '\\');
+        string_buffer_addchar(buffer, 'n');
+        add_escaped(buffer, profile->name, false);
+    }
+    string_buffer_addfstring(buffer, "\"%s];\n", (stream->is_transparent) ? ",style=dashed" : "");
+
+    if(!stream->parent)
+        return;
+
+    const uint64_t rate = module_stream_graph_rate(stream);
+    string_buffer_addfstring(  buffer
+                             , "  n%u -> n%u [label=\"%llu pps\\\\n%llu Kbit/s\"];\n"
+                             , stream->parent->id, stream->id
+                             , (unsigned long long)rate
+                             , (unsigned long long)(rate * TS_PACKET_SIZE * 8 / 1000));
+}
+
+static void on_ready_send_graph(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->skip >= response->size)
+    {
+        response_free(client);
+        http_client_complete(client);
+        return;
+    }
+
+    const size_t left = response->size - response->skip;
+    const ssize_t send_size = http_client_send(  client
+                                               , &response->content[response->skip]
+                                               , left);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send stream graph [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    __uarg(mod);
+
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_free(client);
+        return 0;
+    }
+
+    bool is_dot = false;
+    lua_getfield(lua, 4, "query");
+    if(lua_istable(lua, -1))
+    {
+        lua_getfield(lua, -1, "format");
+        is_dot = (lua_isstring(lua, -1) && !strcmp(lua_tostring(lua, -1), "dot"));
+        lua_pop(lua, 1);
+    }
+    lua_pop(lua, 1);
+
+    string_buffer_t *buffer = string_buffer_alloc();
+    if(is_dot)
+    {
+        string_buffer_addlstring(buffer, "digraph astra {\n", 16);
+        module_stream_graph_foreach(render_dot, buffer);
+        string_buffer_addlstring(buffer, "}\n", 2);
+    }
+    else
+    {
+        string_buffer_addchar(buffer, '[');
+        module_stream_graph_foreach(render_json, buffer);
+        string_buffer_addchar(buffer, ']');
+    }
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->content = string_buffer_release(buffer, &response->size);
+
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_graph;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, (is_dot)
+                                 ? "Content-Type: text/vnd.graphviz; charset=utf-8"
+                                 : "Content-Type: application/json; charset=utf-8");
+    http_response_header(client, "Content-Length: %zu", response->size);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
+    http_response_send(client);
+
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    { NULL, NULL }
+};
+
+MODULE_LUA_REGISTER(http_stream_graph)
@@ -0,0 +1,715 @@
+/*
+ * Astra Module: HTTP Module: HLS Output
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      hls_output
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, name for the log messages. default: "hls"
+ *      duration    - number, target duration of the segment in seconds. default: 5
+ *      count       - number, count of the segments in the playlist. default: 5
+ *
+ * Usage:
+ *      The instance is a route of the http_server with the wildcard path,
+ *      for example "/hls/channel/" with the "*" suffix. Playlist is any path
+ *      ending with ".m3u8", segments are "<sequence>.ts" relative to it.
+ *
+ * Segment starts with the random access point on the PCR PID, or with PCR
+ * if the stream has no RAI flags. PAT and PMT are repeated at the begin of
+ * each segment. Segments are kept in memory as the shared stream blocks,
+ * each client sends the same blocks without copy.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#define MSG(_msg) "[hls_output %s] " _msg, mod->name
+
+#define PCR_MAX ((1ULL << 33) * 300)
+
+#define HLS_IOV_SIZE 64
+#define HLS_RING_RESERVE 2 // segments available after removal from the playlist
+
+static const char __path[] = "path";
+
+typedef struct
+{
+    size_t refcount; // ring and clients
+
+    uint64_t seq;
+    uint64_t duration; // microseconds
+    size_t size;
+
+    module_stream_block_t **block_list;
+    size_t block_count;
+    size_t block_size;
+} hls_segment_t;
+
+/* last single-packet section of the table */
+typedef struct
+{
+    uint8_t ts[TS_PACKET_SIZE];
+    bool is_valid;
+} hls_psi_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    uint64_t duration;
+    int count;
+
+    // segments: oldest first
+    hls_segment_t **ring;
+    size_t ring_size;
+    size_t ring_count;
+    uint64_t seq;
+
+    hls_segment_t *segment; // current segment
+    module_stream_block_t *block; // packets received with on_ts()
+
+    char *playlist;
+    size_t playlist_size;
+
+    // segmenter
+    hls_psi_t pat;
+    hls_psi_t pmt;
+    uint16_t pmt_pid;
+
+    uint16_t pcr_pid;
+    uint64_t pcr;
+    bool is_pcr;
+    bool is_rai; // stream has RAI flags on the PCR PID
+
+    bool is_segment_pcr;
+    uint64_t segment_pcr;
+    uint64_t segment_time;
+
+    bool is_rotate;
+    uint64_t rotate_time;
+};
+
+struct http_response_t
+{
+    hls_segment_t *segment;
+    size_t block_read;
+    size_t block_skip;
+
+    char *content;
+    size_t content_size;
+    size_t content_skip;
+};
+
+/*
+ * client->mod - http_server module
+ * client->response - response of the hls_output module
+ */
+
+/*
+ *  oooooooo8 ooooooooooo  oooooooo8 oooo     oooo ooooooooooo oooo   oooo ooooooooooo
+ * 888         888    88 o888     88  8888o   888   888    88   8888o  88  88  888  88
+ *  888oooooo  888ooo8   888    oooooo 88 888o8 88   888ooo8     88 888o88      888
+ *         888 888    oo 888o    o888  88  888  88   888    oo   88   8888      888
+ * o88oooo888 o888ooo8888 888ooo888   o88o  8  o88o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static uint64_t pcr_delta(uint64_t pcr_last, uint64_t pcr_current)
+{
+    return (pcr_current >= pcr_last)
+         ? (pcr_current - pcr_last)
+         : (PCR_MAX - pcr_last + pcr_current);
+}
+
+static void segment_push(hls_segment_t *segment, module_stream_block_t *block)
+{
+    if(segment->block_count == segment->block_size)
+    {
+        segment->block_size = (segment->block_size) ? (segment->block_size * 2) : 256;
+        segment->block_list = (module_stream_block_t **)realloc(
+            segment->block_list, segment->block_size * sizeof(module_stream_block_t *));
+    }
+
+    segment->block_list[segment->block_count++] = block;
+    segment->size += block->count * TS_PACKET_SIZE;
+}
+
+static void segment_unref(hls_segment_t *segment)
+{
+    --segment->refcount;
+    if(segment->refcount > 0)
+        return;
+
+    for(size_t i = 0; i < segment->block_count; ++i)
+        module_stream_block_unref(segment->block_list[i]);
+
+    free(segment->block_list);
+    free(segment);
+}
+
+static void block_flush(module_data_t *mod)
+{
+    if(!mod->block)
+        return;
+
+    if(mod->segment && mod->block->count > 0)
+        segment_push(mod->segment, mod->block);
+    else
+        module_stream_block_unref(mod->block);
+
+    mod->block = NULL;
+}
+
+static void block_append(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!mod->block)
+            mod->block = module_stream_block_alloc();
+
+        module_stream_block_t *block = mod->block;
+        memcpy(  &block->buffer[block->count * TS_PACKET_SIZE]
+               , &ts[i * TS_PACKET_SIZE], TS_PACKET_SIZE);
+        ++block->count;
+
+        if(block->count == STREAM_BLOCK_COUNT)
+            block_flush(mod);
+    }
+}
+
+static void playlist_update(module_data_t *mod)
+{
+    const size_t skip = (mod->ring_count > (size_t)mod->count)
+                      ? (mod->ring_count - mod->count)
+                      : 0;
+
+    uint64_t target = mod->duration;
+    for(size_t i = skip; i < mod->ring_count; ++i)
+    {
+        if(mod->ring[i]->duration > target)
+            target = mod->ring[i]->duration;
+    }
+
+    /* playlist size is almost the same on each update */
+    string_buffer_t *buffer = string_buffer_alloc_size(mod->playlist_size);
+    string_buffer_addfstring(  buffer
+                             , "#EXTM3U\n"
+                               "#EXT-X-VERSION:3\n"
+                               "#EXT-X-TARGETDURATION:%" PRIu64 "\n"
+                               "#EXT-X-MEDIA-SEQUENCE:%" PRIu64 "\n"
+                             , (target + 999999) / 1000000
+                             , mod->ring[skip]->seq);
+
+    for(size_t i = skip; i < mod->ring_count; ++i)
+    {
+        const hls_segment_t *segment = mod->ring[i];
+        string_buffer_addfstring(  buffer
+                                 , "#EXTINF:%" PRIu64 ".%03" PRIu64 ",\n%" PRIu64 ".ts\n"
+                                 , segment->duration / 1000000
+                                 , (segment->duration % 1000000) / 1000
+                                 , segment->seq);
+    }
+
+    free(mod->playlist);
+    mod->playlist = string_buffer_release(buffer, &mod->playlist_size);
+}
+
+static void segment_close(module_data_t *mod)
+{
+    block_flush(mod);
+
+    hls_segment_t *segment = mod->segment;
+    mod->segment = NULL;
+    if(!segment)
+        return;
+
+    if(mod->is_pcr && mod->is_segment_pcr)
+        segment->duration = pcr_delta(mod->segment_pcr, mod->pcr) / 27;
+    else
+        segment->duration = asc_utime() - mod->segment_time;
+
+    if(mod->ring_count == mod->ring_size)
+    {
+        segment_unref(mod->ring[0]);
+        --mod->ring_count;
+        memmove(&mod->ring[0], &mod->ring[1], mod->ring_count * sizeof(hls_segment_t *));
+    }
+    mod->ring[mod->ring_count++] = segment;
+
+    playlist_update(mod);
+}
+
+static void segment_open(module_data_t *mod)
+{
+    hls_segment_t *segment = (hls_segment_t *)calloc(1, sizeof(hls_segment_t));
+    segment->refcount = 1;
+    segment->seq = mod->seq++;
+    mod->segment = segment;
+
+    // segment is decoded without the previous one
+    if(mod->pat.is_valid)
+        block_append(mod, mod->pat.ts, 1);
+    if(mod->pmt.is_valid)
+        block_append(mod, mod->pmt.ts, 1);
+
+    mod->is_segment_pcr = mod->is_pcr;
+    mod->segment_pcr = mod->pcr;
+    mod->segment_time = asc_utime();
+}
+
+/* keeps the table packet if the section is not split between packets */
+static const uint8_t * psi_update(hls_psi_t *psi, const uint8_t *ts)
+{
+    if(!TS_IS_PAYLOAD_START(ts))
+    {
+        psi->is_valid = false;
+        return NULL;
+    }
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return NULL;
+
+    const size_t payload_size = TS_PACKET_SIZE - (payload - ts);
+    const uint8_t *section = &payload[1 + payload[0]];
+    if(   (size_t)(section - payload) + PSI_HEADER_SIZE > payload_size
+       || (size_t)(section - payload) + PSI_BUFFER_GET_SIZE(section) > payload_size)
+    {
+        psi->is_valid = false;
+        return NULL;
+    }
+
+    const size_t section_size = PSI_BUFFER_GET_SIZE(section);
+    if(section_size < 8 + CRC32_SIZE)
+        return NULL;
+
+    const uint8_t *crc = &section[section_size - CRC32_SIZE];
+    const uint32_t crc32 = (crc[0] << 24) | (crc[1] << 16) | (crc[2] << 8) | crc[3];
+    if(crc32 != crc32b(section, section_size - CRC32_SIZE))
+        return NULL;
+
+    memcpy(psi->ts, ts, TS_PACKET_SIZE);
+    psi->is_valid = true;
+
+    return section;
+}
+
+static void on_pat(module_data_t *mod, const uint8_t *section)
+{
+    const size_t section_size = PSI_BUFFER_GET_SIZE(section);
+    for(size_t i = 8; i + 4 <= section_size - CRC32_SIZE; i += 4)
+    {
+        const uint16_t pnr = (section[i] << 8) | section[i + 1];
+        if(pnr == 0)
+            continue; // NIT
+
+        const uint16_t pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+        if(mod->pmt_pid != pid)
+        {
+            mod->pmt_pid = pid;
+            mod->pmt.is_valid = false;
+        }
+        return;
+    }
+}
+
+/* returns true if the segment should be started with the packet */
+static bool segment_check(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0)
+    {
+        const uint8_t *section = psi_update(&mod->pat, ts);
+        if(section && section[0] == 0x00)
+            on_pat(mod, section);
+    }
+    else if(pid == mod->pmt_pid)
+        psi_update(&mod->pmt, ts);
+
+    bool is_pcr = false;
+    if(TS_IS_PCR(ts))
+    {
+        if(mod->pcr_pid == 0)
+            mod->pcr_pid = pid;
+
+        if(mod->pcr_pid == pid)
+        {
+            mod->pcr = TS_GET_PCR(ts);
+            mod->is_pcr = true;
+            is_pcr = true;
+
+            // segment started before the first PCR
+            if(!mod->is_segment_pcr)
+            {
+                mod->is_segment_pcr = true;
+                mod->segment_pcr = mod->pcr;
+            }
+        }
+    }
+
+    bool is_rai = false;
+    if(mod->pcr_pid == pid && mod->pcr_pid != 0 && TS_IS_RAI(ts))
+    {
+        mod->is_rai = true;
+        is_rai = true;
+    }
+
+    const uint64_t now = asc_utime();
+
+    if(!mod->is_rotate)
+    {
+        uint64_t duration;
+        if(mod->is_pcr && mod->is_segment_pcr)
+            duration = pcr_delta(mod->segment_pcr, mod->pcr) / 27;
+        else
+            duration = now - mod->segment_time;
+
+        if(duration < mod->duration)
+            return false;
+
+        mod->is_rotate = true;
+        mod->rotate_time = now;
+    }
+
+    bool is_boundary;
+    if(mod->is_rai || !mod->segment)
+        is_boundary = is_rai; // the first segment waits for RAI
+    else if(mod->is_pcr)
+        is_boundary = is_pcr;
+    else
+        is_boundary = true;
+
+    if(!is_boundary && now - mod->rotate_time >= mod->duration)
+        is_boundary = true;
+
+    if(!is_boundary)
+        return false;
+
+    mod->is_rotate = false;
+    return true;
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(segment_check(mod, ts))
+    {
+        segment_close(mod);
+        segment_open(mod);
+    }
+
+    if(mod->segment)
+        block_append(mod, ts, 1);
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        on_ts(mod, &ts[i * TS_PACKET_SIZE]);
+}
+
+static void on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    // packets before the segment boundary are copied, the block is not split
+    size_t head = 0;
+    for(size_t i = 0; i < block->count; ++i)
+    {
+        const uint8_t *ts = &block->ts[i * TS_PACKET_SIZE];
+        if(!segment_check(mod, ts))
+            continue;
+
+        if(mod->segment && i > head)
+            block_append(mod, &block->ts[head * TS_PACKET_SIZE], i - head);
+        segment_close(mod);
+        segment_open(mod);
+        head = i;
+    }
+
+    if(!mod->segment)
+        return;
+
+    if(head == 0 && !mod->block)
+        segment_push(mod->segment, module_stream_block_ref(block));
+    else
+    {
+        block_append(mod, &block->ts[head * TS_PACKET_SIZE], block->count - head);
+        if(head == 0)
+            block_flush(mod);
+    }
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
+ * 888         888    88   8888o  88   888    88o
+ *  888oooooo  888ooo8     88 888o88   888    888
+ *         888 888    oo   88   8888   888    888
+ * o88oooo888 o888ooo8888 o88o    88  o888ooo88
+ *
+ */
+
+static void response_free(http_response_t *response)
+{
+    if(response->segment)
+        segment_unref(response->segment);
+
+    free(response->content);
+    free(response);
+}
+
+static void response_done(http_client_t *client)
+{
+    response_free(client->response);
+    client->response = NULL;
+
+    http_client_complete(client);
+}
+
+static void on_ready_send_segment(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    const hls_segment_t *segment = response->segment;
+
+    if(response->block_read == segment->block_count)
+    {
+        response_done(client);
+        return;
+    }
+
+    struct iovec iov[HLS_IOV_SIZE] = { { 0 } };
+    int iovcnt = 0;
+
+    size_t skip = response->block_skip;
+    for(  size_t i = response->block_read
+        ; i < segment->block_count && iovcnt < HLS_IOV_SIZE
+        ; ++i)
+    {
+        const module_stream_block_t *block = segment->block_list[i];
+        iov[iovcnt].iov_base = (void *)&block->ts[skip];
+        iov[iovcnt].iov_len = block->count * TS_PACKET_SIZE - skip;
+        ++iovcnt;
+        skip = 0;
+    }
+
+    const ssize_t send_size = http_client_sendv(client, iov, iovcnt);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send segment [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    size_t sent = send_size;
+    for(int i = 0; sent > 0 && i < iovcnt; ++i)
+    {
+        if(sent < iov[i].iov_len)
+        {
+            response->block_skip += sent;
+            break;
+        }
+
+        sent -= iov[i].iov_len;
+        ++response->block_read;
+        response->block_skip = 0;
+    }
+
+    if(response->block_read == segment->block_count)
+        response_done(client);
+}
+
+static void on_ready_send_playlist(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    const ssize_t send_size = http_client_send(  client
+                                               , &response->content[response->content_skip]
+                                               , response->content_size - response->content_skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send playlist [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->content_skip += send_size;
+    if(response->content_skip == response->content_size)
+        response_done(client);
+}
+
+static void response_headers(http_client_t *client, const char *content_type, size_t size)
+{
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: %s", content_type);
+    http_response_header(client, "Content-Length: %lu", (unsigned long)size);
+    http_response_header(client, "Access-Control-Allow-Origin: *");
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
+}
+
+static bool parse_segment(const char *name, uint64_t *seq)
+{
+    uint64_t value = 0;
+    const char *c = name;
+    for(; *c >= '0' && *c <= '9'; ++c)
+        value = value * 10 + (*c - '0');
+
+    if(c == name || strcmp(c, ".ts"))
+        return false;
+
+    *seq = value;
+    return true;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+        {
+            response_free(client->response);
+            client->response = NULL;
+        }
+        return 0;
+    }
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
+    lua_getfield(lua, -1, __path);
+    const char *path = lua_tostring(lua, -1);
+    lua_pop(lua, 2); // request + path
+
+    const char *name = strrchr(path, '/');
+    name = (name) ? (name + 1) : path;
+    const char *ext = strrchr(name, '.');
+
+    if(ext && !strcmp(ext, ".m3u8"))
+    {
+        if(!mod->playlist)
+        {
+            http_client_abort(client, 503, "playlist is not ready");
+            return 0;
+        }
+
+        http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+        response->content = (char *)malloc(mod->playlist_size);
+        memcpy(response->content, mod->playlist, mod->playlist_size);
+        response->content_size = mod->playlist_size;
+
+        client->response = response;
+        client->on_send = NULL;
+        client->on_read = NULL;
+        client->on_ready = on_ready_send_playlist;
+
+        response_headers(client, "application/vnd.apple.mpegurl", response->content_size);
+        http_response_header(client, "Cache-Control: no-cache");
+        http_response_send(client);
+        return 0;
+    }
+
+    uint64_t seq = 0;
+    hls_segment_t *segment = NULL;
+    if(parse_segment(name, &seq) && mod->ring_count > 0 && seq >= mod->ring[0]->seq)
+    {
+        const uint64_t idx = seq - mod->ring[0]->seq;
+        if(idx < mod->ring_count)
+            segment = mod->ring[idx];
+    }
+
+    if(!segment)
+    {
+        http_client_abort(client, 404, NULL);
+        return 0;
+    }
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->segment = segment;
+    ++segment->refcount;
+
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_segment;
+    // HTTP/2 connection is shared by the streams, keeps own class
+    if(!client->h2_stream)
+        asc_socket_set_priority(client->sock, ASC_EVENT_OUTPUT);
+
+    response_headers(client, "video/MP2T", segment->size);
+    http_response_send(client);
+
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    mod->name = "hls";
+    module_option_string("name", &mod->name, NULL);
+
+    int duration = 5;
+    module_option_number("duration", &duration);
+    asc_assert(duration > 0, MSG("option 'duration' must be greater than 0"));
+    mod->duration = (uint64_t)duration * 1000000;
+
+    mod->count = 5;
+    module_option_number("count", &mod->count);
+    asc_assert(mod->count > 0, MSG("option 'count' must be greater than 0"));
+
+    mod->ring_size = mod->count + HLS_RING_RESERVE;
+    mod->ring = (hls_segment_t **)calloc(mod->ring_size, sizeof(hls_segment_t *));
+
+    // the first segment starts with the first random access point
+    mod->is_rotate = true;
+    mod->rotate_time = asc_utime();
+    mod->segment_time = mod->rotate_time;
+
+    module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+    module_stream_set_block(mod, on_ts_block);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->block, module_stream_block_unref);
+    ASC_FREE(mod->segment, segment_unref);
+
+    for(size_t i = 0; i < mod->ring_count; ++i)
+        segment_unref(mod->ring[i]);
+    mod->ring_count = 0;
+    ASC_FREE(mod->ring, free);
+
+    ASC_FREE(mod->playlist, free);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    MODULE_STREAM_METHODS_REF(),
+};
+
+MODULE_LUA_REGISTER(hls_output)
@@ -0,0 +1,132 @@
+/*
+ * Astra Module: HTTP Module: Metrics
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_metrics
+ *
+ * Module Options:
+ *      no options
+ *
+ * Route handler with the Prometheus text exposition of the metrics registry,
+ * see core/metrics.h. The page is made in C without the Lua callbacks.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+struct module_data_t
+{
+    int unused;
+};
+
+struct http_response_t
+{
+    char *content;
+    size_t size;
+    size_t skip;
+};
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    client->response = NULL;
+
+    free(response->content);
+    free(response);
+}
+
+static void on_ready_send_metrics(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->skip >= response->size)
+    {
+        response_free(client);
+        http_client_complete(client);
+        return;
+    }
+
+    const size_t left = response->size - response->skip;
+    const ssize_t send_size = http_client_send(  client
+                                               , &response->content[response->skip]
+                                               , left);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send metrics [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    __uarg(mod);
+
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_free(client);
+        return 0;
+    }
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->content = asc_metric_render(&response->size);
+
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_metrics;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: text/plain; version=0.0.4; charset=utf-8");
+    http_response_header(client, "Content-Length: %zu", response->size);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
+    http_response_send(client);
+
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    { NULL, NULL }
+};
+
+MODULE_LUA_REGISTER(http_metrics)
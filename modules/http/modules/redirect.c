@@ -40,12 +40,6 @@ static int module_call(module_data_t *mod)
     return 0;
 }
 
-static int __module_call(lua_State *L)
-{
-    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
-    return module_call(mod);
-}
-
 static void module_init(module_data_t *mod)
 {
     module_option_string("location", &mod->location, NULL);
@@ -53,13 +47,6 @@ static void module_init(module_data_t *mod)
 
     mod->code = 302;
     module_option_number("code", &mod->code);
-
-    // Set callback for http route
-    lua_getmetatable(lua, 3);
-    lua_pushlightuserdata(lua, (void *)mod);
-    lua_pushcclosure(lua, __module_call, 1);
-    lua_setfield(lua, -2, "__call");
-    lua_pop(lua, 1);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -69,6 +56,7 @@ static void module_destroy(module_data_t *mod)
 
 MODULE_LUA_METHODS()
 {
+    { "__call", module_call },
     { NULL, NULL }
 };
 
@@ -31,8 +31,42 @@
 #   endif
 #endif
 
+#ifdef HAVE_INOTIFY
+#   include <sys/inotify.h>
+#endif
+
 #include "../http.h"
 
+#define MSG(_msg) "[http_static] " _msg
+
+#define STATIC_CACHE_SIZE 128
+#define STATIC_CHECK_INTERVAL (1 * 1000000ULL)
+
+#ifdef HAVE_INOTIFY
+#   define STATIC_INOTIFY_MASK \
+        (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+#endif
+
+/* opened file. shared between the cache and the responses */
+typedef struct
+{
+    size_t refcount;
+
+    char *filename;
+    int fd;
+    int wd; // inotify watch or -1
+
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    uint64_t check_time; // next stat() if the file is not watched
+
+    char *mime;
+    char etag[48];
+    char last_modified[32];
+} static_file_t;
+
 struct module_data_t
 {
     const char *path;
@@ -41,80 +75,376 @@ struct module_data_t
     size_t block_size;
 
     const char *default_mime;
+
+    int cache_size;
+    asc_list_t *cache; // recently used first
+
+    int inotify_fd;
+    asc_event_t *inotify_event;
 };
 
 struct http_response_t
 {
     module_data_t *mod;
+    static_file_t *file;
 
-    int file_fd;
     int sock_fd;
 
     off_t file_skip;
-    off_t file_size;
+    off_t file_end;
 };
 
 static const char __path[] = "path";
+static const char __headers[] = "headers";
 
 /*
  * client->mod - http_server module
  * client->response->mod - http_static module
  */
 
+/*
+ *   oooooooo8     o       oooooooo8 ooooo ooooo ooooooooooo
+ * o888     88    888    o888     88  888   888   888    88
+ * 888           8  88   888          888ooo888   888ooo8
+ * 888o     oo  8oooo88  888o     oo  888   888   888    oo
+ *  888oooo88 o88o  o888o 888oooo88  o888o o888o o888ooo8888
+ *
+ */
+
+static void file_unref(static_file_t *file)
+{
+    --file->refcount;
+    if(file->refcount > 0)
+        return;
+
+    close(file->fd);
+    free(file->mime);
+    free(file->filename);
+    free(file);
+}
+
+static void file_unwatch(module_data_t *mod, static_file_t *file)
+{
+#ifdef HAVE_INOTIFY
+    if(file->wd == -1)
+        return;
+
+    // hard links of the same file share the watch
+    asc_list_for(mod->cache)
+    {
+        const static_file_t *item = (const static_file_t *)asc_list_data(mod->cache);
+        if(item != file && item->wd == file->wd)
+            return;
+    }
+
+    inotify_rm_watch(mod->inotify_fd, file->wd);
+    file->wd = -1;
+#else
+    __uarg(mod);
+    __uarg(file);
+#endif
+}
+
+static void cache_remove(module_data_t *mod, static_file_t *file)
+{
+    asc_list_remove_item(mod->cache, file);
+    file_unwatch(mod, file);
+    file_unref(file);
+}
+
+static void cache_flush(module_data_t *mod)
+{
+    if(!mod->cache)
+        return;
+
+    while(asc_list_size(mod->cache) > 0)
+    {
+        asc_list_first(mod->cache);
+        cache_remove(mod, (static_file_t *)asc_list_data(mod->cache));
+    }
+}
+
+#ifdef HAVE_INOTIFY
+
+static void on_inotify_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while(1)
+    {
+        const ssize_t len = read(mod->inotify_fd, buffer, sizeof(buffer));
+        if(len <= 0)
+            break;
+
+        for(ssize_t skip = 0; skip < len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)&buffer[skip];
+            skip += sizeof(struct inotify_event) + event->len;
+
+            // watch is removed by the kernel
+            const bool is_ignored = (event->mask & IN_IGNORED) != 0;
+
+            asc_list_first(mod->cache);
+            while(!asc_list_eol(mod->cache))
+            {
+                static_file_t *file = (static_file_t *)asc_list_data(mod->cache);
+                if(file->wd != event->wd)
+                {
+                    asc_list_next(mod->cache);
+                    continue;
+                }
+
+                asc_list_remove_current(mod->cache);
+                if(is_ignored)
+                    file->wd = -1;
+                else
+                    file_unwatch(mod, file);
+                file_unref(file);
+            }
+        }
+    }
+}
+
+static void on_inotify_error(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    asc_log_error(MSG("inotify failed. check files with stat()"));
+
+    cache_flush(mod);
+    ASC_FREE(mod->inotify_event, asc_event_close);
+    close(mod->inotify_fd);
+    mod->inotify_fd = -1;
+}
+
+#endif /* HAVE_INOTIFY */
+
+static const char * lua_get_mime(module_data_t *mod, const char *path)
+{
+    const char *mime = mod->default_mime;
+    size_t dot = 0;
+    for(size_t i = 0; true; ++i)
+    {
+        const char c = path[i];
+        if(!c)
+            break;
+        else if(c == '/')
+            dot = 0;
+        else if(c == '.')
+            dot = i;
+    }
+
+    if(dot == 0)
+        return mime;
+    const char *extension = &path[dot + 1];
+
+    lua_getglobal(lua, "mime");
+    if(lua_istable(lua, -1))
+    {
+        lua_getfield(lua, -1, extension);
+        if(lua_isstring(lua, -1))
+            mime = lua_tostring(lua, -1);
+        lua_pop(lua, 1); // extension
+    }
+    lua_pop(lua, 1); // mime
+    return mime;
+}
+
+/* checks the file without inotify. returns false if the file is changed */
+static bool file_check(static_file_t *file)
+{
+    const uint64_t now = asc_utime_coarse();
+    if(now < file->check_time)
+        return true;
+
+    struct stat sb;
+    if(   stat(file->filename, &sb) == -1
+       || sb.st_dev != file->dev
+       || sb.st_ino != file->ino
+       || sb.st_size != file->size
+       || sb.st_mtime != file->mtime)
+    {
+        return false;
+    }
+
+    file->check_time = now + STATIC_CHECK_INTERVAL;
+    return true;
+}
+
+/* returns referenced file from the cache or opens it. NULL with errno on error */
+static static_file_t * file_open(module_data_t *mod, const char *filename)
+{
+    asc_list_for(mod->cache)
+    {
+        static_file_t *file = (static_file_t *)asc_list_data(mod->cache);
+        if(strcmp(file->filename, filename))
+            continue;
+
+        if(file->wd == -1 && !file_check(file))
+        {
+            cache_remove(mod, file);
+            break;
+        }
+
+        asc_list_remove_current(mod->cache);
+        asc_list_insert_head(mod->cache, file);
+
+        ++file->refcount;
+        return file;
+    }
+
+    const int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
+
+    struct stat sb;
+    if(fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode))
+    {
+        close(fd);
+        errno = EISDIR;
+        return NULL;
+    }
+
+    static_file_t *file = (static_file_t *)calloc(1, sizeof(static_file_t));
+    file->refcount = 1;
+    file->filename = strdup(filename);
+    file->fd = fd;
+    file->wd = -1;
+    file->size = sb.st_size;
+    file->dev = sb.st_dev;
+    file->ino = sb.st_ino;
+    file->mtime = sb.st_mtime;
+    file->check_time = asc_utime_coarse() + STATIC_CHECK_INTERVAL;
+    file->mime = strdup(lua_get_mime(mod, filename));
+
+    snprintf(  file->etag, sizeof(file->etag), "\"%llx-%llx\""
+             , (unsigned long long)file->mtime, (unsigned long long)file->size);
+
+    struct tm tm;
+    gmtime_r(&file->mtime, &tm);
+    strftime(  file->last_modified, sizeof(file->last_modified)
+             , "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    if(mod->cache_size == 0)
+        return file;
+
+#ifdef HAVE_INOTIFY
+    if(mod->inotify_fd != -1)
+        file->wd = inotify_add_watch(mod->inotify_fd, filename, STATIC_INOTIFY_MASK);
+#endif
+
+    if(asc_list_size(mod->cache) >= (size_t)mod->cache_size)
+    {
+        static_file_t *last = NULL;
+        asc_list_for(mod->cache)
+            last = (static_file_t *)asc_list_data(mod->cache);
+        cache_remove(mod, last);
+    }
+
+    ++file->refcount;
+    asc_list_insert_head(mod->cache, file);
+
+    return file;
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
+ * 888         888    88   8888o  88   888    88o
+ *  888oooooo  888ooo8     88 888o88   888    888
+ *         888 888    oo   88   8888   888    888
+ * o88oooo888 o888ooo8888 o88o    88  o888ooo88
+ *
+ */
+
+static void response_free(http_response_t *response)
+{
+    file_unref(response->file);
+    free(response);
+}
+
 static void on_ready_send_file(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
 
+    if(response->file_skip >= response->file_end)
+    {
+        response_free(response);
+        client->response = NULL;
+        http_client_complete(client);
+        return;
+    }
+
+    const int file_fd = response->file->fd;
+    const off_t file_left = response->file_end - response->file_skip;
+
     ssize_t send_size;
 
-    if(!response->mod->block_size)
+    // HTTP/2 stream sends the DATA frames, the file is read to the buffer
+    if(!response->mod->block_size || client->h2_stream)
     {
-        const ssize_t len = pread(  response->file_fd
-                                  , client->buffer, HTTP_BUFFER_SIZE
+        const size_t block_size = (file_left > HTTP_BUFFER_SIZE)
+                                ? HTTP_BUFFER_SIZE
+                                : (size_t)file_left;
+        const ssize_t len = pread(  file_fd
+                                  , client->buffer, block_size
                                   , response->file_skip);
         if(len <= 0)
             send_size = -1;
         else
-            send_size = asc_socket_send(client->sock, client->buffer, len);
+            send_size = http_client_send(client, client->buffer, len);
     }
     else
     {
+        const size_t block_size = (file_left > (off_t)response->mod->block_size)
+                                ? response->mod->block_size
+                                : (size_t)file_left;
+
 #if defined(__linux)
 
+        // descriptor is shared, the offset is kept by the response
+        off_t offset = response->file_skip;
         send_size = sendfile(  response->sock_fd
-                             , response->file_fd
-                             , NULL, response->mod->block_size);
+                             , file_fd
+                             , &offset, block_size);
+        if(send_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            asc_socket_write_blocked(client->sock);
+            send_size = 0;
+        }
 
 #elif defined(__APPLE__)
 
-        off_t block_size = response->mod->block_size;
-        const int r = sendfile(  response->file_fd
+        off_t len = block_size;
+        const int r = sendfile(  file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , &block_size, NULL, 0);
+                               , &len, NULL, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN && len > 0))
+            send_size = len;
         else
             send_size = -1;
 
 #elif defined(__FreeBSD__)
 
-        off_t block_size = 0;
-        const int r = sendfile(  response->file_fd
+        off_t len = 0;
+        const int r = sendfile(  file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , response->mod->block_size, NULL
-                               , &block_size, 0);
+                               , block_size, NULL
+                               , &len, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN && len > 0))
+            send_size = len;
         else
             send_size = -1;
 
 #else
 
+        __uarg(block_size);
         send_size = -1;
 
 #endif
@@ -128,40 +458,65 @@ static void on_ready_send_file(void *arg)
     }
 
     response->file_skip += send_size;
-
-    if(response->file_skip >= response->file_size)
-        http_client_close(client);
 }
 
-static const char * lua_get_mime(http_client_t *client, const char *path)
+/* single range only: "bytes=first-last", "bytes=first-", "bytes=-suffix" */
+static int parse_range(const char *range, off_t size, off_t *first, off_t *last)
 {
-    const char *mime = client->response->mod->default_mime;
-    size_t dot = 0;
-    for(size_t i = 0; true; ++i)
+    if(strncmp(range, "bytes=", 6) || strchr(range, ','))
+        return 0; // ignored, whole file is sent
+
+    const char *c = &range[6];
+    char *end = NULL;
+
+    if(*c == '-')
     {
-        const char c = path[i];
-        if(!c)
-            break;
-        else if(c == '/')
-            dot = 0;
-        else if(c == '.')
-            dot = i;
+        const long long suffix = strtoll(c + 1, &end, 10);
+        if(end == c + 1 || *end)
+            return 0;
+        if(suffix <= 0 || size == 0)
+            return -1;
+
+        *first = (suffix < size) ? (size - suffix) : 0;
+        *last = size - 1;
+        return 1;
     }
 
-    if(dot == 0)
-        return mime;
-    const char *extension = &path[dot + 1];
+    const long long range_first = strtoll(c, &end, 10);
+    if(end == c || *end != '-' || range_first < 0)
+        return 0;
 
-    lua_getglobal(lua, "mime");
-    if(lua_istable(lua, -1))
+    c = end + 1;
+    long long range_last = size - 1;
+    if(*c)
     {
-        lua_getfield(lua, -1, extension);
-        if(lua_isstring(lua, -1))
-            mime = lua_tostring(lua, -1);
-        lua_pop(lua, 1); // extension
+        range_last = strtoll(c, &end, 10);
+        if(*end || range_last < range_first)
+            return 0;
+        if(range_last >= size)
+            range_last = size - 1;
     }
-    lua_pop(lua, 1); // mime
-    return mime;
+
+    if(range_first >= size)
+        return -1;
+
+    *first = range_first;
+    *last = range_last;
+    return 1;
+}
+
+static bool etag_match(const char *value, const char *etag)
+{
+    return (!strcmp(value, "*") || strstr(value, etag) != NULL);
+}
+
+static void response_headers(http_client_t *client, const static_file_t *file)
+{
+    http_response_header(client, "ETag: %s", file->etag);
+    http_response_header(client, "Last-Modified: %s", file->last_modified);
+    http_response_header(client, (client->is_keep_alive)
+                                 ? "Connection: keep-alive"
+                                 : "Connection: close");
 }
 
 /* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
@@ -173,71 +528,119 @@ static int module_call(module_data_t *mod)
     {
         if(client->response)
         {
-            close(client->response->file_fd);
-            free(client->response);
+            response_free(client->response);
             client->response = NULL;
         }
         return 0;
     }
 
-    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
-    client->response->mod = mod;
-    client->on_send = NULL;
-    client->on_read = NULL;
-    client->on_ready = on_ready_send_file;
-    client->response->sock_fd = asc_socket_fd(client->sock);
-
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
-    lua_getfield(lua, -1, __path);
+    const int request = lua_gettop(lua);
+    lua_getfield(lua, request, __path);
     const char *path = lua_tostring(lua, -1);
-    lua_pop(lua, 2); // request + path
 
-    char *filename = (char *)malloc(PATH_MAX);
-    sprintf(filename, "%s%s", mod->path, &path[mod->path_skip]);
-    client->response->file_fd = open(filename, O_RDONLY);
-    free(filename);
-    if(client->response->file_fd == -1)
-    {
-        http_client_warning(client, "file not found %s", path);
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s", mod->path, &path[mod->path_skip]);
 
-        free(client->response);
-        client->response = NULL;
+    static_file_t *file = file_open(mod, filename);
+    if(!file)
+    {
+        if(errno == EISDIR)
+            http_client_warning(client, "wrong file type %s", path);
+        else
+            http_client_warning(client, "file not found %s", path);
 
+        lua_settop(lua, request - 1);
         http_client_abort(client, 404, NULL);
         return 0;
     }
 
-    struct stat sb;
-    fstat(client->response->file_fd, &sb);
+    int code = 200;
+    off_t range_first = 0;
+    off_t range_last = file->size - 1;
+
+    lua_getfield(lua, request, __headers);
+    const int headers = lua_gettop(lua);
 
-    if(!S_ISREG(sb.st_mode))
+    lua_getfield(lua, headers, "if-none-match");
+    if(lua_isstring(lua, -1))
+    {
+        if(etag_match(lua_tostring(lua, -1), file->etag))
+            code = 304;
+    }
+    else
     {
-        http_client_warning(client, "wrong file type %s", path);
+        lua_getfield(lua, headers, "if-modified-since");
+        if(lua_isstring(lua, -1) && !strcmp(lua_tostring(lua, -1), file->last_modified))
+            code = 304;
+        lua_pop(lua, 1); // if-modified-since
+    }
+    lua_pop(lua, 1); // if-none-match
 
-        close(client->response->file_fd);
-        free(client->response);
-        client->response = NULL;
+    if(code == 200)
+    {
+        lua_getfield(lua, headers, "range");
+        if(lua_isstring(lua, -1))
+        {
+            const int r = parse_range(lua_tostring(lua, -1), file->size
+                                      , &range_first, &range_last);
+            if(r == 1)
+                code = 206;
+            else if(r == -1)
+                code = 416;
+        }
+        lua_pop(lua, 1); // range
+    }
 
-        http_client_abort(client, 404, NULL);
+    lua_settop(lua, request - 1);
+
+    if(code == 416)
+    {
+        file_unref(file);
+        http_client_abort(client, 416, NULL);
         return 0;
     }
 
-    client->response->file_size = sb.st_size;
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->mod = mod;
+    response->file = file;
+    response->sock_fd = asc_socket_fd(client->sock);
 
-    http_response_code(client, 200, NULL);
-    http_response_header(client, "Content-Length: %lu", client->response->file_size);
-    http_response_header(client, "Content-Type: %s", lua_get_mime(client, path));
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_file;
+
+    http_response_code(client, code, NULL);
+
+    if(code == 304)
+    {
+        // nothing to send, response is completed on the first on_ready
+        response_headers(client, file);
+        http_response_send(client);
+        return 0;
+    }
+
+    response->file_skip = range_first;
+    response->file_end = range_last + 1;
+
+    http_response_header(client, "Content-Length: %llu"
+                         , (unsigned long long)(response->file_end - response->file_skip));
+    if(code == 206)
+    {
+        http_response_header(client, "Content-Range: bytes %llu-%llu/%llu"
+                             , (unsigned long long)range_first
+                             , (unsigned long long)range_last
+                             , (unsigned long long)file->size);
+    }
+    http_response_header(client, "Content-Type: %s", file->mime);
+    http_response_header(client, "Accept-Ranges: bytes");
+    response_headers(client, file);
     http_response_send(client);
 
     return 0;
 }
 
-static int __module_call(lua_State *L)
-{
-    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
-    return module_call(mod);
-}
-
 static void module_init(module_data_t *mod)
 {
     lua_getfield(lua, MODULE_OPTIONS_IDX, __path);
@@ -271,21 +674,45 @@ static void module_init(module_data_t *mod)
     asc_assert(stat(mod->path, &s) != -1, "[http_static] path is not found");
     asc_assert(S_ISDIR(s.st_mode), "[http_static] path is not directory");
 
-    // Set callback for http route
-    lua_getmetatable(lua, 3);
-    lua_pushlightuserdata(lua, (void *)mod);
-    lua_pushcclosure(lua, __module_call, 1);
-    lua_setfield(lua, -2, "__call");
-    lua_pop(lua, 1);
+    mod->cache_size = STATIC_CACHE_SIZE;
+    module_option_number("cache", &mod->cache_size);
+    if(mod->cache_size < 0)
+        mod->cache_size = 0;
+    mod->cache = asc_list_init();
+
+    mod->inotify_fd = -1;
+#ifdef HAVE_INOTIFY
+    if(mod->cache_size > 0)
+    {
+        mod->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(mod->inotify_fd != -1)
+        {
+            mod->inotify_event = asc_event_init(mod->inotify_fd, mod);
+            asc_event_set_on_read(mod->inotify_event, on_inotify_read);
+            asc_event_set_on_error(mod->inotify_event, on_inotify_error);
+        }
+        else
+            asc_log_warning(MSG("inotify_init1() failed [%s]"), strerror(errno));
+    }
+#endif
 }
 
 static void module_destroy(module_data_t *mod)
 {
-    __uarg(mod);
+    cache_flush(mod);
+    ASC_FREE(mod->cache, asc_list_destroy);
+
+    ASC_FREE(mod->inotify_event, asc_event_close);
+    if(mod->inotify_fd != -1)
+    {
+        close(mod->inotify_fd);
+        mod->inotify_fd = -1;
+    }
 }
 
 MODULE_LUA_METHODS()
 {
+    { "__call", module_call },
     { NULL, NULL }
 };
 
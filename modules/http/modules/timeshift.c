@@ -0,0 +1,740 @@
+/*
+ * Astra Module: HTTP Module: Timeshift
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      timeshift
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, name for the log messages. default: "timeshift"
+ *      duration    - number, kept duration of the stream in seconds. default: 1800
+ *
+ * Module Methods:
+ *      stat()      - return table: duration (seconds in memory), blocks, clients
+ *
+ * Usage:
+ *      The instance is a route of the http_server. Query "?offset=-600" starts
+ *      the stream 600 seconds before the live, without offset the stream
+ *      starts with the last random access point. Stream is sent in real time
+ *      from the start position.
+ *
+ * The stream is kept in memory as the shared stream blocks, all clients send
+ * the same blocks without copy. Each random access point on the PCR PID (or
+ * each PCR if the stream has no RAI flags) starts a new block and is stored
+ * in the index, the start position is found with the binary search. PAT and
+ * PMT are sent before the first block.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#define MSG(_msg) "[timeshift %s] " _msg, mod->name
+
+#define TIMESHIFT_IOV_SIZE 64
+#define TIMESHIFT_TICK 20 // ms, the clients are checked for the pending blocks
+#define TIMESHIFT_RING_SIZE 4096
+
+typedef struct
+{
+    module_stream_block_t *block;
+    uint64_t time; // receiving time, microseconds
+} timeshift_entry_t;
+
+/* last single-packet section of the table */
+typedef struct
+{
+    uint8_t ts[TS_PACKET_SIZE];
+    bool is_valid;
+} timeshift_psi_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    uint64_t duration;
+
+    // blocks, position is the absolute sequence number of the block
+    timeshift_entry_t *ring;
+    size_t ring_mask;
+    uint64_t ring_begin;
+    uint64_t ring_end;
+
+    // sequence numbers of the blocks with the random access point
+    uint64_t *index;
+    size_t index_mask;
+    uint64_t index_begin;
+    uint64_t index_end;
+
+    module_stream_block_t *block; // packets received with on_ts()
+    bool is_access; // the block starts with the random access point
+
+    timeshift_psi_t pat;
+    timeshift_psi_t pmt;
+    uint16_t pmt_pid;
+
+    uint16_t pcr_pid;
+    bool is_rai; // stream has RAI flags on the PCR PID
+
+    asc_timer_t *timer;
+    size_t client_count;
+    TAILQ_HEAD(timeshift_client_list_s, http_response_t) client_list;
+};
+
+struct http_response_t
+{
+    module_data_t *mod;
+    http_client_t *client;
+
+    uint64_t seq; // next block
+    module_stream_block_t *block; // partially sent block, kept if it is removed from the ring
+    size_t skip; // sent bytes of the block
+    uint64_t delay; // sending time of the block is the block time + delay
+    bool is_busy;
+
+    uint8_t psi[2 * TS_PACKET_SIZE];
+    size_t psi_size;
+    size_t psi_skip;
+
+    TAILQ_ENTRY(http_response_t) entries;
+};
+
+/*
+ * client->mod - http_server module
+ * client->response - response of the timeshift module
+ */
+
+/*
+ * oooooooooo  ooooo oooo   oooo  ooooooo8
+ *  888    888  888   8888o  88 o888    88
+ *  888oooo88   888   88 888o88 888    oooooo
+ *  888  88o    888   88   8888 888o    oo88
+ * o888o  88o8 o888o o88o    88  888ooo888
+ *
+ */
+
+static inline timeshift_entry_t * ring_get(module_data_t *mod, uint64_t seq)
+{
+    return &mod->ring[seq & mod->ring_mask];
+}
+
+static inline uint64_t index_get(module_data_t *mod, uint64_t idx)
+{
+    return mod->index[idx & mod->index_mask];
+}
+
+static void ring_grow(module_data_t *mod)
+{
+    const size_t size = (mod->ring_mask + 1) * 2;
+    timeshift_entry_t *ring = (timeshift_entry_t *)malloc(size * sizeof(timeshift_entry_t));
+    for(uint64_t seq = mod->ring_begin; seq < mod->ring_end; ++seq)
+        ring[seq & (size - 1)] = *ring_get(mod, seq);
+
+    free(mod->ring);
+    mod->ring = ring;
+    mod->ring_mask = size - 1;
+}
+
+static void index_grow(module_data_t *mod)
+{
+    const size_t size = (mod->index_mask + 1) * 2;
+    uint64_t *index = (uint64_t *)malloc(size * sizeof(uint64_t));
+    for(uint64_t idx = mod->index_begin; idx < mod->index_end; ++idx)
+        index[idx & (size - 1)] = index_get(mod, idx);
+
+    free(mod->index);
+    mod->index = index;
+    mod->index_mask = size - 1;
+}
+
+/* removes the blocks older than the duration */
+static void ring_expire(module_data_t *mod, uint64_t now)
+{
+    while(mod->ring_begin < mod->ring_end)
+    {
+        timeshift_entry_t *entry = ring_get(mod, mod->ring_begin);
+        if(entry->time + mod->duration > now)
+            break;
+
+        module_stream_block_unref(entry->block);
+        entry->block = NULL;
+        ++mod->ring_begin;
+    }
+
+    while(mod->index_begin < mod->index_end && index_get(mod, mod->index_begin) < mod->ring_begin)
+        ++mod->index_begin;
+}
+
+static void ring_push(module_data_t *mod, module_stream_block_t *block)
+{
+    const uint64_t now = asc_utime();
+    ring_expire(mod, now);
+
+    if(mod->ring_end - mod->ring_begin > mod->ring_mask)
+        ring_grow(mod);
+
+    if(mod->is_access)
+    {
+        mod->is_access = false;
+        if(mod->index_end - mod->index_begin > mod->index_mask)
+            index_grow(mod);
+        mod->index[mod->index_end & mod->index_mask] = mod->ring_end;
+        ++mod->index_end;
+    }
+
+    timeshift_entry_t *entry = ring_get(mod, mod->ring_end);
+    entry->block = block;
+    entry->time = now;
+    ++mod->ring_end;
+}
+
+/* first random access point received at the time or later, false if not found */
+static bool index_search(module_data_t *mod, uint64_t time, uint64_t *seq)
+{
+    // the oldest blocks are removed soon, the client starts with the margin
+    if(mod->ring_begin < mod->ring_end)
+    {
+        const uint64_t begin = ring_get(mod, mod->ring_begin)->time + mod->duration / 10;
+        if(time < begin)
+            time = begin;
+    }
+
+    uint64_t lo = mod->index_begin;
+    uint64_t hi = mod->index_end;
+    while(lo < hi)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if(ring_get(mod, index_get(mod, mid))->time < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == mod->index_end)
+        return false;
+
+    *seq = index_get(mod, lo);
+    return true;
+}
+
+static void block_flush(module_data_t *mod)
+{
+    if(!mod->block)
+        return;
+
+    if(mod->block->count > 0)
+        ring_push(mod, mod->block);
+    else
+        module_stream_block_unref(mod->block);
+
+    mod->block = NULL;
+}
+
+static void block_append(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!mod->block)
+            mod->block = module_stream_block_alloc();
+
+        module_stream_block_t *block = mod->block;
+        memcpy(  &block->buffer[block->count * TS_PACKET_SIZE]
+               , &ts[i * TS_PACKET_SIZE], TS_PACKET_SIZE);
+        ++block->count;
+
+        if(block->count == STREAM_BLOCK_COUNT)
+            block_flush(mod);
+    }
+}
+
+/* keeps the table packet if the section is not split between packets */
+static const uint8_t * psi_update(timeshift_psi_t *psi, const uint8_t *ts)
+{
+    if(!TS_IS_PAYLOAD_START(ts))
+    {
+        psi->is_valid = false;
+        return NULL;
+    }
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return NULL;
+
+    const size_t payload_size = TS_PACKET_SIZE - (payload - ts);
+    const uint8_t *section = &payload[1 + payload[0]];
+    if(   (size_t)(section - payload) + PSI_HEADER_SIZE > payload_size
+       || (size_t)(section - payload) + PSI_BUFFER_GET_SIZE(section) > payload_size)
+    {
+        psi->is_valid = false;
+        return NULL;
+    }
+
+    const size_t section_size = PSI_BUFFER_GET_SIZE(section);
+    if(section_size < 8 + CRC32_SIZE)
+        return NULL;
+
+    const uint8_t *crc = &section[section_size - CRC32_SIZE];
+    const uint32_t crc32 = (crc[0] << 24) | (crc[1] << 16) | (crc[2] << 8) | crc[3];
+    if(crc32 != crc32b(section, section_size - CRC32_SIZE))
+        return NULL;
+
+    memcpy(psi->ts, ts, TS_PACKET_SIZE);
+    psi->is_valid = true;
+
+    return section;
+}
+
+static void on_pat(module_data_t *mod, const uint8_t *section)
+{
+    const size_t section_size = PSI_BUFFER_GET_SIZE(section);
+    for(size_t i = 8; i + 4 <= section_size - CRC32_SIZE; i += 4)
+    {
+        const uint16_t pnr = (section[i] << 8) | section[i + 1];
+        if(pnr == 0)
+            continue; // NIT
+
+        const uint16_t pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+        if(mod->pmt_pid != pid)
+        {
+            mod->pmt_pid = pid;
+            mod->pmt.is_valid = false;
+        }
+        return;
+    }
+}
+
+/* returns true if the packet is the random access point */
+static bool access_check(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0)
+    {
+        const uint8_t *section = psi_update(&mod->pat, ts);
+        if(section && section[0] == 0x00)
+            on_pat(mod, section);
+        return false;
+    }
+    else if(pid == mod->pmt_pid)
+    {
+        psi_update(&mod->pmt, ts);
+        return false;
+    }
+
+    if(TS_IS_PCR(ts) && mod->pcr_pid == 0)
+        mod->pcr_pid = pid;
+
+    if(mod->pcr_pid != pid || mod->pcr_pid == 0)
+        return false;
+
+    if(TS_IS_RAI(ts))
+    {
+        mod->is_rai = true;
+        return true;
+    }
+
+    return (!mod->is_rai && TS_IS_PCR(ts));
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(access_check(mod, ts))
+    {
+        block_flush(mod);
+        mod->is_access = true;
+    }
+
+    block_append(mod, ts, 1);
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        on_ts(mod, &ts[i * TS_PACKET_SIZE]);
+}
+
+static void on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    // packets before the access point are copied, the block is not split
+    size_t head = 0;
+    for(size_t i = 0; i < block->count; ++i)
+    {
+        const uint8_t *ts = &block->ts[i * TS_PACKET_SIZE];
+        if(!access_check(mod, ts))
+            continue;
+
+        if(i > head)
+            block_append(mod, &block->ts[head * TS_PACKET_SIZE], i - head);
+        block_flush(mod);
+        mod->is_access = true;
+        head = i;
+    }
+
+    if(head == 0 && !mod->block)
+        ring_push(mod, module_stream_block_ref(block));
+    else
+    {
+        block_append(mod, &block->ts[head * TS_PACKET_SIZE], block->count - head);
+        if(head == 0)
+            block_flush(mod);
+    }
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
+ * 888         888    88   8888o  88   888    88o
+ *  888oooooo  888ooo8     88 888o88   888    888
+ *         888 888    oo   88   8888   888    888
+ * o88oooo888 o888ooo8888 o88o    88  o888ooo88
+ *
+ */
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    module_data_t *mod = response->mod;
+
+    TAILQ_REMOVE(&mod->client_list, response, entries);
+    --mod->client_count;
+
+    ASC_FREE(response->block, module_stream_block_unref);
+    free(response);
+    client->response = NULL;
+}
+
+static bool response_pending(const http_response_t *response, uint64_t now)
+{
+    module_data_t *mod = response->mod;
+
+    if(response->psi_skip < response->psi_size || response->block)
+        return true;
+    if(response->seq >= mod->ring_end)
+        return false;
+    if(response->seq < mod->ring_begin)
+        return true; // position is expired, the client is moved forward
+
+    return ring_get(mod, response->seq)->time + response->delay <= now;
+}
+
+static void on_ready_send(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    module_data_t *mod = response->mod;
+
+    if(response->psi_skip < response->psi_size)
+    {
+        const ssize_t send_size = asc_socket_send(  client->sock
+                                                  , &response->psi[response->psi_skip]
+                                                  , response->psi_size - response->psi_skip);
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        response->psi_skip += send_size;
+        if(response->psi_skip < response->psi_size)
+            return;
+    }
+
+    if(response->block)
+    {
+        const module_stream_block_t *block = response->block;
+        const ssize_t send_size = asc_socket_send(  client->sock
+                                                  , &block->ts[response->skip]
+                                                  , block->count * TS_PACKET_SIZE
+                                                    - response->skip);
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        response->skip += send_size;
+        if(response->skip < block->count * TS_PACKET_SIZE)
+            return;
+
+        ASC_FREE(response->block, module_stream_block_unref);
+        response->skip = 0;
+        ++response->seq;
+    }
+
+    const uint64_t now = asc_utime();
+
+    if(response->seq < mod->ring_begin)
+    {
+        // client is slower than the stream, continue from the oldest access point
+        uint64_t seq = 0;
+        if(!index_search(mod, 0, &seq))
+        {
+            http_client_error(client, "position is expired");
+            http_client_close(client);
+            return;
+        }
+
+        http_client_warning(client, "position is expired, skip %" PRIu64 " blocks"
+                            , seq - response->seq);
+        response->seq = seq;
+        response->delay = now - ring_get(mod, seq)->time;
+    }
+
+    struct iovec iov[TIMESHIFT_IOV_SIZE];
+    int iovcnt = 0;
+
+    for(  uint64_t seq = response->seq
+        ; seq < mod->ring_end && iovcnt < TIMESHIFT_IOV_SIZE
+        ; ++seq)
+    {
+        const timeshift_entry_t *entry = ring_get(mod, seq);
+        if(entry->time + response->delay > now)
+            break;
+
+        iov[iovcnt].iov_base = (void *)entry->block->ts;
+        iov[iovcnt].iov_len = entry->block->count * TS_PACKET_SIZE;
+        ++iovcnt;
+    }
+
+    if(iovcnt > 0)
+    {
+        const ssize_t send_size = asc_socket_sendv(client->sock, iov, iovcnt);
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        size_t sent = send_size;
+        for(int i = 0; sent > 0 && i < iovcnt; ++i)
+        {
+            if(sent < iov[i].iov_len)
+            {
+                response->skip = sent;
+                response->block = module_stream_block_ref(ring_get(mod, response->seq)->block);
+                break;
+            }
+
+            sent -= iov[i].iov_len;
+            ++response->seq;
+        }
+    }
+
+    if(!response_pending(response, now))
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_busy = false;
+    }
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+
+    ring_expire(mod, now);
+
+    http_response_t *response;
+    TAILQ_FOREACH(response, &mod->client_list, entries)
+    {
+        if(response->is_busy || !response_pending(response, now))
+            continue;
+
+        response->is_busy = true;
+        asc_socket_set_on_ready(response->client->sock, on_ready_send);
+    }
+}
+
+static void on_read(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+
+    ssize_t size = asc_socket_recv(client->sock, client->buffer, HTTP_BUFFER_SIZE);
+    if(size <= 0)
+        http_client_close(client);
+}
+
+static int query_number(int idx, const char *key, int *value)
+{
+    lua_getfield(lua, idx, key);
+    const bool is_set = lua_isstring(lua, -1);
+    if(is_set)
+        *value = atoi(lua_tostring(lua, -1));
+    lua_pop(lua, 1);
+    return is_set;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_free(client);
+        return 0;
+    }
+
+    // stream is sent from the socket callbacks, HTTP/2 stream has no socket
+    if(client->h2_stream)
+    {
+        http_client_abort(client, 505, "timeshift requires HTTP/1.1");
+        return 0;
+    }
+
+    int offset = 0;
+    lua_getfield(lua, 4, "query");
+    if(lua_istable(lua, -1))
+        query_number(lua_gettop(lua), "offset", &offset);
+    lua_pop(lua, 1);
+
+    const uint64_t now = asc_utime();
+    ring_expire(mod, now);
+
+    uint64_t seq = 0;
+    bool is_found = false;
+    if(offset < 0)
+        is_found = index_search(mod, now - (uint64_t)(-offset) * 1000000, &seq);
+    if(!is_found && mod->index_end > mod->index_begin)
+    {
+        // live or the offset is after the last access point
+        seq = index_get(mod, mod->index_end - 1);
+        is_found = true;
+    }
+
+    if(!is_found)
+    {
+        http_client_abort(client, 503, "stream is not ready");
+        return 0;
+    }
+
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->mod = mod;
+    response->client = client;
+    response->seq = seq;
+    response->delay = now - ring_get(mod, seq)->time;
+
+    // stream is decoded from the middle, the current tables go first
+    if(mod->pat.is_valid)
+    {
+        memcpy(&response->psi[response->psi_size], mod->pat.ts, TS_PACKET_SIZE);
+        response->psi_size += TS_PACKET_SIZE;
+    }
+    if(mod->pmt.is_valid)
+    {
+        memcpy(&response->psi[response->psi_size], mod->pmt.ts, TS_PACKET_SIZE);
+        response->psi_size += TS_PACKET_SIZE;
+    }
+
+    TAILQ_INSERT_TAIL(&mod->client_list, response, entries);
+    ++mod->client_count;
+
+    // the response header is sent first, then the server restores on_ready
+    response->is_busy = true;
+    client->response = response;
+    client->on_send = NULL;
+    client->on_read = on_read;
+    client->on_ready = on_ready_send;
+    asc_socket_set_priority(client->sock, ASC_EVENT_OUTPUT);
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, "Pragma: no-cache");
+    http_response_header(client, "Content-Type: video/MP2T");
+    http_response_header(client, "Connection: close");
+    http_response_send(client);
+
+    return 0;
+}
+
+static int method_stat(module_data_t *mod)
+{
+    uint64_t duration = 0;
+    if(mod->ring_end > mod->ring_begin)
+        duration = ring_get(mod, mod->ring_end - 1)->time - ring_get(mod, mod->ring_begin)->time;
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)(duration / 1000000));
+    lua_setfield(lua, -2, "duration");
+    lua_pushnumber(lua, (lua_Number)(mod->ring_end - mod->ring_begin));
+    lua_setfield(lua, -2, "blocks");
+    lua_pushnumber(lua, mod->client_count);
+    lua_setfield(lua, -2, "clients");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    mod->name = "timeshift";
+    module_option_string("name", &mod->name, NULL);
+
+    int duration = 1800;
+    module_option_number("duration", &duration);
+    asc_assert(duration > 0, MSG("option 'duration' must be greater than 0"));
+    mod->duration = (uint64_t)duration * 1000000;
+
+    mod->ring_mask = TIMESHIFT_RING_SIZE - 1;
+    mod->ring = (timeshift_entry_t *)calloc(TIMESHIFT_RING_SIZE, sizeof(timeshift_entry_t));
+    mod->index_mask = TIMESHIFT_RING_SIZE - 1;
+    mod->index = (uint64_t *)calloc(TIMESHIFT_RING_SIZE, sizeof(uint64_t));
+
+    TAILQ_INIT(&mod->client_list);
+    mod->timer = asc_timer_init(TIMESHIFT_TICK, on_timer, mod);
+
+    module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+    module_stream_set_block(mod, on_ts_block);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    // clients refer to the blocks of the ring
+    http_response_t *response;
+    while((response = TAILQ_FIRST(&mod->client_list)) != NULL)
+    {
+        http_client_t *client = response->client;
+        response_free(client);
+        http_client_close(client);
+    }
+
+    ASC_FREE(mod->timer, asc_timer_destroy);
+    ASC_FREE(mod->block, module_stream_block_unref);
+
+    for(uint64_t seq = mod->ring_begin; seq < mod->ring_end; ++seq)
+        module_stream_block_unref(ring_get(mod, seq)->block);
+    ASC_FREE(mod->ring, free);
+    ASC_FREE(mod->index, free);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "__call", module_call },
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+
+MODULE_LUA_REGISTER(timeshift)
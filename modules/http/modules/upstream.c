@@ -19,124 +19,1732 @@
  */
 
 #include <astra.h>
+#include <ctype.h>
+
+#if defined(__linux) && defined(HAVE_MEMFD_CREATE)
+#   define UPSTREAM_SENDFILE
+#   include <sys/mman.h>
+#   include <sys/sendfile.h>
+#endif
+
 #include "../http.h"
 
 #define DEFAULT_BUFFER_SIZE (1024 * 1024)
 #define DEFAULT_BUFFER_FILL (128 * 1024)
 
+#define DEFAULT_GOP_SIZE (2 * 1024 * 1024)
+#define GOP_PMT_COUNT 8
+
+#define DEFAULT_POOL_SIZE 64
+#define DEFAULT_RING_POOL_SIZE 4
+
+#define DEFAULT_SESSION_LINGER 5000
+
+/* percent of buffer_budget, above it the new buffers are reduced */
+#define BUDGET_SHRINK 50
+
+/* percent of the stream rate, the client is able to catch up after a stall */
+#define DEFAULT_PACING 150
+#define PACING_WINDOW 1000000
+#define PACING_SNDBUF_MS 200
+#define PACING_SNDBUF_MIN (64 * 1024)
+#define PACING_SNDBUF_MAX (4 * 1024 * 1024)
+#define PACING_NOTSENT_LOWAT (64 * 1024)
+#define SESSION_KEY_SIZE 1024
+
+#define UPSTREAM_IOV_SIZE 64
+
+/* pinning pages costs more than a copy for the small writes */
+#define ZEROCOPY_MIN_SIZE (32 * 1024)
+#define ZEROCOPY_LIST_SIZE 32
+
+typedef struct upstream_ring_t upstream_ring_t;
+typedef struct upstream_zerocopy_t upstream_zerocopy_t;
+typedef struct upstream_gop_t upstream_gop_t;
+typedef struct upstream_session_t upstream_session_t;
+
+/* stream rate in bytes per second, measured in the windows of PACING_WINDOW */
+typedef struct
+{
+    uint64_t time;
+    uint64_t bytes;
+    uint64_t byterate;
+} upstream_rate_t;
+
+/*
+ * Shared ring for the clients with option shared=true.
+ * Each client keeps only the read cursor. Cursors and the write position
+ * are absolute offsets since the ring was created.
+ */
+
+struct upstream_ring_t
+{
+    MODULE_STREAM_DATA();
+
+    uint8_t *buffer;
+    size_t size;
+    uint64_t write;
+
+    // memfd for the clients with option sendfile=true, or -1
+    int fd;
+
+    // rate of the stream for the clients with pacing
+    upstream_rate_t rate;
+
+    // offset of the last random access point, for the clients with fast_start=true.
+    // begins with the last PAT before the key frame if the stream has one
+    bool is_fast_start;
+    bool is_rap;
+    uint64_t rap;
+    bool is_pat;
+    uint64_t pat;
+
+    // null packets are not written, shared by the clients with strip_null=true
+    bool is_strip_null;
+
+    // all clients and clients waiting for buffer_fill
+    TAILQ_HEAD(ring_client_list_s, http_response_t) client_list;
+    TAILQ_HEAD(ring_idle_list_s, http_response_t) idle_list;
+
+    TAILQ_ENTRY(upstream_ring_t) entries;
+};
+
+/*
+ * Blocks of the one sendmsg(MSG_ZEROCOPY) call. The kernel reads the
+ * pages until the completion with the call sequence number is received.
+ */
+
+struct upstream_zerocopy_t
+{
+    uint32_t seq;
+    bool is_done;
+    int count;
+    module_stream_block_t *block[UPSTREAM_IOV_SIZE];
+};
+
+/*
+ * Fast start index of the upstream, shared by the clients with the option
+ * fast_start=true. Keeps the blocks since the last random access point and
+ * the last single-packet PAT and PMT. A new client receives the PSI and the
+ * key frame at once instead of waiting for the next one.
+ */
+
+struct upstream_gop_t
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_block_t **block_list;
+    size_t block_size;
+    size_t block_read;
+    size_t block_count;
+    size_t buffer_count;
+    size_t buffer_size;
+    bool is_valid; // the first block has the random access point
+
+    // private block for packets received with on_ts()
+    module_stream_block_t *block;
+
+    uint8_t pat[TS_PACKET_SIZE];
+    bool is_pat;
+    uint16_t pmt_pid[GOP_PMT_COUNT];
+    uint8_t pmt[GOP_PMT_COUNT][TS_PACKET_SIZE];
+    bool is_pmt[GOP_PMT_COUNT];
+    size_t pmt_count;
+
+    TAILQ_HEAD(gop_client_list_s, http_response_t) client_list;
+    TAILQ_ENTRY(upstream_gop_t) entries;
+};
+
+/*
+ * Input session for the clients with the same source, option session=key.
+ * The first viewer opens the input with the session_open callback, the
+ * viewers share one ring attached to it. When the last viewer is gone, the
+ * input is kept for session_linger milliseconds, then session_close is called.
+ */
+
+struct upstream_session_t
+{
+    module_data_t *mod;
+
+    char *key;
+    int idx_data; // values returned by session_open, passed to session_close
+    module_stream_t *upstream;
+
+    int viewers;
+    asc_timer_t *linger_timer;
+
+    TAILQ_ENTRY(upstream_session_t) entries;
+};
+
+/*
+ * Slow client policy:
+ * flush - drop the queue (default for the per-client queue)
+ * skip  - drop the oldest data, keep buffer_fill (default for the shared ring)
+ * drop  - disconnect the client
+ */
+
+/*
+ * Buffer budget of the process, shared by all instances. The per-client
+ * queue reserves buffer_size, the shared ring reserves own size while it
+ * is allocated (in the pool too). Above BUDGET_SHRINK percent of the limit
+ * the new reservation is reduced in proportion to the free memory, down to
+ * the twice of buffer_fill. The client which does not fit is refused.
+ */
+
+typedef struct
+{
+    uint64_t limit; // option buffer_budget, 0 - unlimited
+    uint64_t used;
+    uint64_t shrunk;
+    uint64_t refused;
+} upstream_budget_t;
+
+static upstream_budget_t budget = { 0, 0, 0, 0 };
+
+typedef enum
+{
+    UPSTREAM_OVERFLOW_DEFAULT = 0,
+    UPSTREAM_OVERFLOW_FLUSH = 1,
+    UPSTREAM_OVERFLOW_SKIP = 2,
+    UPSTREAM_OVERFLOW_DROP = 3,
+} upstream_overflow_t;
+
 struct module_data_t
 {
     int idx_callback;
+
+    TAILQ_HEAD(ring_list_s, upstream_ring_t) ring_list;
+
+    // released objects for reuse
+    http_response_t **pool;
+    size_t pool_count;
+    size_t pool_size;
+
+    TAILQ_HEAD(ring_pool_s, upstream_ring_t) ring_pool;
+    size_t ring_pool_count;
+    size_t ring_pool_size;
+
+    TAILQ_HEAD(gop_list_s, upstream_gop_t) gop_list;
+
+    TAILQ_HEAD(session_list_s, upstream_session_t) session_list;
+    int idx_session_open;
+    int idx_session_close;
+    int session_linger;
+
+    // metrics, registered if the module has the name option
+    asc_metric_t *metric_list;
+    uint64_t clients;
+    uint64_t overflows;
+    uint64_t overflow_bytes;
+    uint64_t drops;
+    uint64_t sessions;
+    uint64_t buffer_bytes; // reserved in the budget by the clients and rings
+    uint64_t budget_refused;
+
+    // heap usage of the clients, rings and sessions, see asc_memstat_init()
+    asc_memstat_t *memstat;
 };
 
 struct http_response_t
 {
     MODULE_STREAM_DATA();
 
-    module_data_t *mod;
+    module_data_t *mod;
+    http_client_t *client;
+
+    // shared mode
+    upstream_ring_t *ring;
+    uint64_t ring_read;
+    size_t ring_pad; // stuffing to complete the packet cut by the overflow skip
+    TAILQ_ENTRY(http_response_t) ring_entries;
+    TAILQ_ENTRY(http_response_t) idle_entries;
+
+    upstream_session_t *session;
+
+    // fast start index, per-client queue only
+    upstream_gop_t *gop;
+    TAILQ_ENTRY(http_response_t) gop_entries;
+
+    // queue of the shared blocks
+    module_stream_block_t **block_list;
+    size_t block_size;
+    size_t block_count;
+    size_t block_read;
+    size_t block_write;
+    size_t block_skip; // bytes of the first block already sent
+
+    // blocks held until the zerocopy completion
+    upstream_zerocopy_t *zerocopy_list;
+    size_t zerocopy_read;
+    size_t zerocopy_count;
+    uint32_t zerocopy_seq; // sequence number of the next zerocopy send
+
+    // private block for packets received with on_ts()
+    module_stream_block_t *block;
+
+    size_t buffer_count; // bytes in the queue
+    size_t buffer_size;
+    size_t buffer_fill;
+    size_t buffer_reserved; // per-client queue, see budget_reserve()
+
+    // per-client pacing, percent of the stream rate, 0 - disabled
+    int pacing;
+    upstream_rate_t rate; // per-client queue only, the ring has own
+    uint64_t pacing_rate;
+    int sndbuf;
+
+    upstream_overflow_t overflow;
+    int overflow_limit; // disconnect after this number of overflows, 0 - never
+    int overflow_count;
+    uint64_t overflow_bytes;
+    bool is_drop;
+    asc_timer_t *drop_timer;
+
+    bool is_socket_busy;
+    bool is_flow_control; // per-client queue only, the free space is the credit
+    bool is_strip_null;
+};
+
+/*
+ * client->mod - http_server module
+ * client->response->mod - http_upstream module
+ */
+
+/* returns true when the window is complete and byterate is updated */
+static bool rate_update(upstream_rate_t *rate, size_t size)
+{
+    const uint64_t now = asc_loop_utime();
+    rate->bytes += size;
+
+    if(rate->time == 0)
+    {
+        rate->time = now;
+        return false;
+    }
+
+    const uint64_t interval = now - rate->time;
+    if(interval < PACING_WINDOW)
+        return false;
+
+    rate->byterate = rate->bytes * 1000000 / interval;
+    rate->bytes = 0;
+    rate->time = now;
+    return true;
+}
+
+/* size of the new buffer in the budget now, 0 if it does not fit */
+static size_t budget_grant(size_t size, size_t fill)
+{
+    size_t min_size = fill * 2;
+    if(min_size > size)
+        min_size = size;
+
+    if(!budget.limit)
+        return size;
+
+    const uint64_t shrink = budget.limit * BUDGET_SHRINK / 100;
+    if(budget.used + size <= shrink)
+        return size;
+
+    // full size at the threshold, nothing at the limit
+    const uint64_t free_size = (budget.used < budget.limit) ? budget.limit - budget.used : 0;
+    uint64_t grant = (uint64_t)size * free_size / (budget.limit - shrink);
+    if(grant > free_size)
+        grant = free_size;
+    if(grant > size)
+        grant = size;
+
+    return (grant >= min_size) ? (size_t)grant : 0;
+}
+
+/* returns the reserved size, 0 if the budget is exhausted */
+static size_t budget_reserve(module_data_t *mod, size_t size, size_t fill)
+{
+    const size_t grant = budget_grant(size, fill);
+    if(!grant)
+    {
+        ++budget.refused;
+        ++mod->budget_refused;
+        return 0;
+    }
+
+    if(grant < size)
+        ++budget.shrunk;
+
+    budget.used += grant;
+    mod->buffer_bytes += grant;
+    return grant;
+}
+
+static void budget_release(module_data_t *mod, size_t size)
+{
+    budget.used -= size;
+    mod->buffer_bytes -= size;
+}
+
+/*
+ * Limits the socket to the stream rate with a margin, so the client receives
+ * the data evenly instead of the bursts of buffer_fill. The send buffer keeps
+ * PACING_SNDBUF_MS of the stream, updated when the rate is changed by 25%.
+ */
+static void pacing_update(http_response_t *response, uint64_t byterate)
+{
+    if(!response->pacing || byterate == 0)
+        return;
+
+    const uint64_t pacing_rate = byterate * response->pacing / 100;
+    const uint64_t delta = (pacing_rate > response->pacing_rate)
+                         ? (pacing_rate - response->pacing_rate)
+                         : (response->pacing_rate - pacing_rate);
+    if(delta * 4 < response->pacing_rate)
+        return;
+
+    asc_socket_t *sock = response->client->sock;
+    if(!asc_socket_set_pacing_rate(sock, pacing_rate))
+    {
+        response->pacing = 0;
+        return;
+    }
+    response->pacing_rate = pacing_rate;
+
+    // the memfd ring requires the fixed size, see ring_attach()
+    if(response->ring && response->ring->fd != -1)
+        return;
+
+    // the kernel doubles the value, so the size is aligned to the page
+    uint64_t sndbuf = (pacing_rate * PACING_SNDBUF_MS / 1000) & ~(uint64_t)4095;
+    if(sndbuf < PACING_SNDBUF_MIN)
+        sndbuf = PACING_SNDBUF_MIN;
+    else if(sndbuf > PACING_SNDBUF_MAX)
+        sndbuf = PACING_SNDBUF_MAX;
+
+    if((int)sndbuf != response->sndbuf)
+    {
+        asc_socket_set_buffer(sock, 0, sndbuf);
+        response->sndbuf = sndbuf;
+    }
+}
+
+static void upstream_flush(http_response_t *response)
+{
+    while(response->block_count > 0)
+    {
+        module_stream_block_unref(response->block_list[response->block_read]);
+        response->block_read = (response->block_read + 1) % response->block_size;
+        --response->block_count;
+    }
+
+    if(response->block)
+    {
+        module_stream_block_unref(response->block);
+        response->block = NULL;
+    }
+
+    response->block_read = 0;
+    response->block_write = 0;
+    response->block_skip = 0;
+    response->buffer_count = 0;
+}
+
+static void zerocopy_release(http_response_t *response)
+{
+    while(response->zerocopy_count > 0)
+    {
+        upstream_zerocopy_t *item = &response->zerocopy_list[response->zerocopy_read];
+        if(!item->is_done)
+            break;
+
+        for(int i = 0; i < item->count; ++i)
+            module_stream_block_unref(item->block[i]);
+
+        response->zerocopy_read = (response->zerocopy_read + 1) % ZEROCOPY_LIST_SIZE;
+        --response->zerocopy_count;
+    }
+}
+
+static void zerocopy_flush(http_response_t *response)
+{
+    /* client is gone. data left in the socket queue is not needed anymore */
+    for(size_t i = 0; i < response->zerocopy_count; ++i)
+    {
+        const size_t idx = (response->zerocopy_read + i) % ZEROCOPY_LIST_SIZE;
+        response->zerocopy_list[idx].is_done = true;
+    }
+    zerocopy_release(response);
+
+    asc_free(response->zerocopy_list);
+    response->zerocopy_list = NULL;
+}
+
+static void on_upstream_zerocopy(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    bool is_complete = false;
+    uint32_t lo, hi;
+    while(asc_socket_zerocopy_complete(client->sock, &lo, &hi))
+    {
+        is_complete = true;
+        if(!response || !response->zerocopy_list)
+            continue;
+
+        for(size_t i = 0; i < response->zerocopy_count; ++i)
+        {
+            const size_t idx = (response->zerocopy_read + i) % ZEROCOPY_LIST_SIZE;
+            upstream_zerocopy_t *item = &response->zerocopy_list[idx];
+            // wrap-safe check: lo <= seq <= hi
+            if(item->seq - lo <= hi - lo)
+                item->is_done = true;
+        }
+    }
+
+    if(!is_complete)
+    {
+        // error event without completions: connection is closed
+        http_client_close(client);
+        return;
+    }
+
+    if(response && response->zerocopy_list)
+        zerocopy_release(response);
+}
+
+static ssize_t upstream_sendv(http_client_t *client, const struct iovec *iov, int iovcnt)
+{
+    http_response_t *response = client->response;
+
+    if(   !response->zerocopy_list
+       || response->zerocopy_count == ZEROCOPY_LIST_SIZE
+       || response->buffer_count < ZEROCOPY_MIN_SIZE)
+    {
+        return asc_socket_sendv(client->sock, iov, iovcnt);
+    }
+
+    const ssize_t send_size = asc_socket_sendv_zerocopy(client->sock, iov, iovcnt);
+    if(send_size == -1 && errno == ENOBUFS)
+    {
+        // locked memory limit is reached
+        return asc_socket_sendv(client->sock, iov, iovcnt);
+    }
+    if(send_size <= 0)
+        return send_size;
+
+    const size_t idx = (response->zerocopy_read + response->zerocopy_count)
+                     % ZEROCOPY_LIST_SIZE;
+    upstream_zerocopy_t *item = &response->zerocopy_list[idx];
+    item->seq = response->zerocopy_seq++;
+    item->is_done = false;
+    item->count = 0;
+    ++response->zerocopy_count;
+
+    // hold each block touched by the call, sent or not
+    size_t sent = send_size;
+    size_t block_idx = response->block_read;
+    for(int i = 0; i < iovcnt; ++i)
+    {
+        item->block[item->count++] =
+            module_stream_block_ref(response->block_list[block_idx]);
+        if(sent <= iov[i].iov_len)
+            break;
+        sent -= iov[i].iov_len;
+        block_idx = (block_idx + 1) % response->block_size;
+    }
+
+    return send_size;
+}
+
+static void on_upstream_drop(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    client->response->drop_timer = NULL;
+    ++client->response->mod->drops;
+    http_client_warning(  client, "slow client. drop after %d overflows"
+                        , client->response->overflow_count);
+    http_client_close(client);
+}
+
+/* counters are available in Lua with server:data(client) */
+static bool upstream_overflow_stat(http_client_t *client, size_t size)
+{
+    http_response_t *response = client->response;
+
+    ++response->overflow_count;
+    response->overflow_bytes += size;
+    ++response->mod->overflows;
+    response->mod->overflow_bytes += size;
+
+    if(!client->idx_data)
+    {
+        lua_newtable(lua);
+        client->idx_data = luaL_ref(lua, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_data);
+    lua_pushnumber(lua, response->overflow_count);
+    lua_setfield(lua, -2, "overflow_count");
+    lua_pushnumber(lua, response->overflow_bytes);
+    lua_setfield(lua, -2, "overflow_bytes");
+    lua_pop(lua, 1);
+
+    return (   response->overflow == UPSTREAM_OVERFLOW_DROP
+            || (   response->overflow_limit > 0
+                && response->overflow_count >= response->overflow_limit));
+}
+
+static void on_upstream_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->block_count > 0)
+    {
+        struct iovec iov[UPSTREAM_IOV_SIZE];
+        int iovcnt = 0;
+
+        size_t idx = response->block_read;
+        size_t skip = response->block_skip;
+        while(iovcnt < UPSTREAM_IOV_SIZE && (size_t)iovcnt < response->block_count)
+        {
+            const module_stream_block_t *block = response->block_list[idx];
+            iov[iovcnt].iov_base = (void *)&block->ts[skip];
+            iov[iovcnt].iov_len = block->count * TS_PACKET_SIZE - skip;
+            ++iovcnt;
+            idx = (idx + 1) % response->block_size;
+            skip = 0;
+        }
+
+        const ssize_t send_size = upstream_sendv(client, iov, iovcnt);
+
+        if(send_size > 0)
+        {
+            response->buffer_count -= send_size;
+
+            size_t sent = send_size;
+            for(int i = 0; sent > 0 && i < iovcnt; ++i)
+            {
+                if(sent < iov[i].iov_len)
+                {
+                    response->block_skip += sent;
+                    break;
+                }
+
+                sent -= iov[i].iov_len;
+                module_stream_block_unref(response->block_list[response->block_read]);
+                response->block_read = (response->block_read + 1) % response->block_size;
+                --response->block_count;
+                response->block_skip = 0;
+            }
+
+            if(response->is_flow_control)
+                __module_stream_credit_notify(&response->__stream);
+        }
+        else if(send_size == -1)
+        {
+            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
+                              , response->buffer_count, asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+    }
+
+    if(response->block_count == 0)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+}
+
+/* random access point: the RAI flag or the key frame start code of the video PES */
+static bool upstream_is_rap(const uint8_t *ts)
+{
+    if(TS_IS_RAI(ts))
+        return true;
+    if(!TS_IS_PAYLOAD_START(ts))
+        return false;
+
+    const uint8_t *const payload = TS_GET_PAYLOAD(ts);
+    const uint8_t *const end = &ts[TS_PACKET_SIZE];
+    if(   !payload
+       || payload + PES_HEADER_SIZE + 3 > end
+       || payload[0] != 0x00 || payload[1] != 0x00 || payload[2] != 0x01
+       || (payload[3] & 0xF0) != 0xE0)
+    {
+        return false;
+    }
+
+    for(const uint8_t *ptr = payload + PES_HEADER_SIZE + 3 + payload[8]; ptr + 4 < end; ++ptr)
+    {
+        if(ptr[0] != 0x00 || ptr[1] != 0x00 || ptr[2] != 0x01)
+            continue;
+
+        const uint8_t nal = ptr[3];
+        if(nal == 0xB3) // MPEG-2 sequence header
+            return true;
+        if(!(nal & 0x80) && ((nal & 0x1F) == 5 || (nal & 0x1F) == 7)) // H.264 IDR, SPS
+            return true;
+        if(nal == 0x40 && ptr[4] == 0x01) // HEVC VPS
+            return true;
+    }
+
+    return false;
+}
+
+static bool upstream_block_is_rap(const module_stream_block_t *block)
+{
+    for(size_t i = 0; i < block->count; ++i)
+    {
+        if(upstream_is_rap(&block->ts[i * TS_PACKET_SIZE]))
+            return true;
+    }
+    return false;
+}
+
+static void upstream_drop_block(http_response_t *response)
+{
+    module_stream_block_t *block = response->block_list[response->block_read];
+    response->buffer_count -= block->count * TS_PACKET_SIZE - response->block_skip;
+    module_stream_block_unref(block);
+    response->block_read = (response->block_read + 1) % response->block_size;
+    --response->block_count;
+    response->block_skip = 0;
+}
+
+static size_t upstream_skip(http_response_t *response)
+{
+    const size_t buffer_count = response->buffer_count;
+
+    // the partially sent block should be finished to keep the packets aligned
+    module_stream_block_t *head = NULL;
+    size_t head_skip = 0;
+    if(response->block_count > 0 && response->block_skip > 0)
+    {
+        head = module_stream_block_ref(response->block_list[response->block_read]);
+        head_skip = response->block_skip;
+        upstream_drop_block(response);
+    }
+
+    while(response->block_count > 0 && response->buffer_count > response->buffer_fill)
+        upstream_drop_block(response);
+
+    // begin with the random access point if the queue has one
+    size_t idx = response->block_read;
+    for(size_t i = 0; i < response->block_count; ++i)
+    {
+        if(upstream_block_is_rap(response->block_list[idx]))
+        {
+            while(i-- > 0)
+                upstream_drop_block(response);
+            break;
+        }
+        idx = (idx + 1) % response->block_size;
+    }
+
+    if(head)
+    {
+        response->block_read = (response->block_read + response->block_size - 1)
+                             % response->block_size;
+        response->block_list[response->block_read] = head;
+        response->block_skip = head_skip;
+        response->buffer_count += head->count * TS_PACKET_SIZE - head_skip;
+        ++response->block_count;
+    }
+
+    return buffer_count - response->buffer_count;
+}
+
+static void upstream_drop(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    upstream_flush(response);
+    if(response->is_socket_busy)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+
+    // closing here breaks the stream tree, so do it on the next loop
+    response->is_drop = true;
+    response->drop_timer = asc_timer_one_shot(0, on_upstream_drop, client);
+}
+
+static bool upstream_check_overflow(http_client_t *client, size_t size)
+{
+    http_response_t *response = client->response;
+
+    if(response->is_drop)
+        return true;
+
+    size_t buffer_count = response->buffer_count + size;
+    if(response->block)
+        buffer_count += response->block->count * TS_PACKET_SIZE;
+
+    if(buffer_count < response->buffer_size)
+        return false;
+
+    if(response->overflow != UPSTREAM_OVERFLOW_SKIP)
+    {
+        const size_t flush_size = buffer_count - size;
+        upstream_flush(response);
+        if(response->is_socket_busy)
+        {
+            asc_socket_set_on_ready(client->sock, NULL);
+            response->is_socket_busy = false;
+        }
+
+        if(upstream_overflow_stat(client, flush_size))
+            upstream_drop(client);
+
+        return true;
+    }
+
+    const size_t skip_size = upstream_skip(response);
+    if(response->block_count == 0 && response->is_socket_busy)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+
+    if(upstream_overflow_stat(client, skip_size))
+    {
+        upstream_drop(client);
+        return true;
+    }
+
+    return false;
+}
+
+static void upstream_push(http_client_t *client, module_stream_block_t *block)
+{
+    http_response_t *response = client->response;
+
+    response->block_list[response->block_write] = block;
+    response->block_write = (response->block_write + 1) % response->block_size;
+    ++response->block_count;
+    response->buffer_count += block->count * TS_PACKET_SIZE;
+
+    if(response->pacing && rate_update(&response->rate, block->count * TS_PACKET_SIZE))
+        pacing_update(response, response->rate.byterate);
+
+    if(   response->is_socket_busy == false
+       && response->buffer_count >= response->buffer_fill)
+    {
+        asc_socket_set_on_ready(client->sock, on_upstream_ready);
+        response->is_socket_busy = true;
+    }
+}
+
+static void on_ts(void *arg, const uint8_t *ts)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(upstream_check_overflow(client, TS_PACKET_SIZE))
+        return;
+
+    if(!response->block)
+        response->block = module_stream_block_alloc();
+
+    module_stream_block_t *block = response->block;
+    memcpy(&block->buffer[block->count * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++block->count;
+
+    if(block->count == STREAM_BLOCK_COUNT)
+    {
+        response->block = NULL;
+        upstream_push(client, block);
+    }
+}
+
+static void on_ts_batch(void *arg, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        on_ts(arg, &ts[i * TS_PACKET_SIZE]);
+}
+
+static void on_ts_block(void *arg, module_stream_block_t *block);
+
+/* strip_null=true. The block without null packets is queued as is */
+
+typedef struct
+{
+    http_client_t *client;
+    module_stream_block_t *block;
+} upstream_strip_t;
+
+static void strip_on_ts(void *arg, const uint8_t *ts)
+{
+    if(TS_GET_PID(ts) != NULL_TS_PID)
+        on_ts(arg, ts);
+}
+
+static void strip_on_run(void *arg, const uint8_t *ts, size_t count)
+{
+    upstream_strip_t *strip = (upstream_strip_t *)arg;
+
+    if(strip->block && ts == strip->block->ts && count == strip->block->count)
+        on_ts_block(strip->client, strip->block);
+    else
+        on_ts_batch(strip->client, ts, count);
+}
+
+static void strip_on_ts_batch(void *arg, const uint8_t *ts, size_t count)
+{
+    upstream_strip_t strip = { (http_client_t *)arg, NULL };
+    mpegts_ts_strip_null(ts, count, strip_on_run, &strip);
+}
+
+static void strip_on_ts_block(void *arg, module_stream_block_t *block)
+{
+    upstream_strip_t strip = { (http_client_t *)arg, block };
+    mpegts_ts_strip_null(block->ts, block->count, strip_on_run, &strip);
+}
+
+static void on_ts_block(void *arg, module_stream_block_t *block)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(upstream_check_overflow(client, block->count * TS_PACKET_SIZE))
+        return;
+
+    if(response->block)
+    {
+        upstream_push(client, response->block);
+        response->block = NULL;
+    }
+
+    upstream_push(client, module_stream_block_ref(block));
+}
+
+static void gop_drop(upstream_gop_t *gop)
+{
+    module_stream_block_t *block = gop->block_list[gop->block_read];
+    gop->buffer_count -= block->count * TS_PACKET_SIZE;
+    module_stream_block_unref(block);
+    gop->block_read = (gop->block_read + 1) % gop->block_size;
+    --gop->block_count;
+}
+
+/* single-packet sections only, the longer PSI comes to the client with the stream */
+static const uint8_t * gop_psi_section(const uint8_t *ts)
+{
+    if(!TS_IS_PAYLOAD_START(ts))
+        return NULL;
+
+    const uint8_t *const payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return NULL;
+
+    const uint8_t *const section = payload + 1 + payload[0];
+    const uint8_t *const end = &ts[TS_PACKET_SIZE];
+    if(section + PSI_HEADER_SIZE > end || section + PSI_BUFFER_GET_SIZE(section) > end)
+        return NULL;
+
+    return section;
+}
+
+static void gop_psi(upstream_gop_t *gop, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0)
+    {
+        const uint8_t *const section = gop_psi_section(ts);
+        if(!section || section[0] != 0x00)
+            return;
+
+        const size_t size = PSI_BUFFER_GET_SIZE(section);
+        const uint8_t *const cached = (gop->is_pat) ? gop_psi_section(gop->pat) : NULL;
+        const bool is_changed = (   !cached
+                                 || (size_t)PSI_BUFFER_GET_SIZE(cached) != size
+                                 || memcmp(cached, section, size) != 0);
+
+        memcpy(gop->pat, ts, TS_PACKET_SIZE);
+        gop->is_pat = true;
+        if(!is_changed)
+            return;
+
+        gop->pmt_count = 0;
+        const uint8_t *const item_end = section + size - CRC32_SIZE;
+        for(const uint8_t *item = &section[8]
+            ; item + 4 <= item_end && gop->pmt_count < GOP_PMT_COUNT
+            ; item += 4)
+        {
+            const uint16_t pnr = (item[0] << 8) | item[1];
+            if(pnr == 0)
+                continue; // NIT
+
+            gop->pmt_pid[gop->pmt_count] = ((item[2] & 0x1F) << 8) | item[3];
+            gop->is_pmt[gop->pmt_count] = false;
+            ++gop->pmt_count;
+        }
+        return;
+    }
+
+    for(size_t i = 0; i < gop->pmt_count; ++i)
+    {
+        if(gop->pmt_pid[i] != pid)
+            continue;
+
+        const uint8_t *const section = gop_psi_section(ts);
+        if(section && section[0] == 0x02)
+        {
+            memcpy(gop->pmt[i], ts, TS_PACKET_SIZE);
+            gop->is_pmt[i] = true;
+        }
+        return;
+    }
+}
+
+static void gop_push(upstream_gop_t *gop, module_stream_block_t *block)
+{
+    bool is_rap = false;
+    for(size_t i = 0; i < block->count; ++i)
+    {
+        const uint8_t *const ts = &block->ts[i * TS_PACKET_SIZE];
+        gop_psi(gop, ts);
+        if(!is_rap)
+            is_rap = upstream_is_rap(ts);
+    }
+
+    const size_t size = block->count * TS_PACKET_SIZE;
+
+    if(is_rap)
+    {
+        // the buffer begins with the key frame
+        while(gop->block_count > 0)
+            gop_drop(gop);
+        gop->is_valid = true;
+    }
+    else
+    {
+        // the group is too long, wait for the next key frame
+        while(   gop->block_count > 0
+              && (   gop->block_count == gop->block_size
+                  || gop->buffer_count + size > gop->buffer_size))
+        {
+            gop_drop(gop);
+            gop->is_valid = false;
+        }
+
+        if(!gop->is_valid)
+        {
+            module_stream_block_unref(block);
+            return;
+        }
+    }
+
+    gop->block_list[(gop->block_read + gop->block_count) % gop->block_size] = block;
+    ++gop->block_count;
+    gop->buffer_count += size;
+}
+
+static void on_gop_ts(void *arg, const uint8_t *ts)
+{
+    upstream_gop_t *gop = (upstream_gop_t *)arg;
+
+    if(!gop->block)
+        gop->block = module_stream_block_alloc();
+
+    module_stream_block_t *block = gop->block;
+    memcpy(&block->buffer[block->count * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++block->count;
+
+    if(block->count == STREAM_BLOCK_COUNT)
+    {
+        gop->block = NULL;
+        gop_push(gop, block);
+    }
+}
+
+static void on_gop_ts_batch(void *arg, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        on_gop_ts(arg, &ts[i * TS_PACKET_SIZE]);
+}
+
+static void on_gop_ts_block(void *arg, module_stream_block_t *block)
+{
+    upstream_gop_t *gop = (upstream_gop_t *)arg;
+
+    if(gop->block)
+    {
+        gop_push(gop, gop->block);
+        gop->block = NULL;
+    }
+
+    gop_push(gop, module_stream_block_ref(block));
+}
+
+static void gop_free(upstream_gop_t *gop)
+{
+    while(gop->block_count > 0)
+        gop_drop(gop);
+    if(gop->block)
+        module_stream_block_unref(gop->block);
+
+    asc_free(gop->block_list);
+    asc_free(gop);
+}
+
+static void gop_destroy(module_data_t *mod, upstream_gop_t *gop)
+{
+    http_response_t *response;
+    while((response = TAILQ_FIRST(&gop->client_list)))
+    {
+        TAILQ_REMOVE(&gop->client_list, response, gop_entries);
+        response->gop = NULL;
+    }
+
+    module_stream_destroy(gop);
+    TAILQ_REMOVE(&mod->gop_list, gop, entries);
+    gop_free(gop);
+}
+
+/* should be called before upstream_attach(), the index receives the packets first */
+static void gop_attach(http_response_t *response, module_stream_t *upstream)
+{
+    module_data_t *mod = response->mod;
+
+    upstream_gop_t *gop;
+    TAILQ_FOREACH(gop, &mod->gop_list, entries)
+    {
+        if(gop->__stream.parent == upstream)
+            break;
+    }
+
+    if(!gop)
+    {
+        gop = (upstream_gop_t *)asc_calloc(mod->memstat, 1, sizeof(upstream_gop_t));
+        gop->buffer_size = DEFAULT_GOP_SIZE;
+        gop->block_size = gop->buffer_size / TS_PACKET_SIZE + 1;
+        gop->block_list = (module_stream_block_t **)asc_calloc(
+            mod->memstat, gop->block_size, sizeof(module_stream_block_t *));
+        TAILQ_INIT(&gop->client_list);
+        TAILQ_INSERT_TAIL(&mod->gop_list, gop, entries);
+
+        // like module_stream_init()
+        gop->__stream.self = (void *)gop;
+        gop->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_gop_ts;
+        gop->__stream.on_ts_batch =
+            (void (*)(module_data_t *, const uint8_t *, size_t))on_gop_ts_batch;
+        gop->__stream.on_ts_block =
+            (void (*)(module_data_t *, module_stream_block_t *))on_gop_ts_block;
+        __module_stream_init(&gop->__stream);
+        __module_stream_attach(upstream, &gop->__stream);
+    }
+
+    response->gop = gop;
+    TAILQ_INSERT_TAIL(&gop->client_list, response, gop_entries);
+}
+
+static void gop_detach(http_response_t *response)
+{
+    upstream_gop_t *gop = response->gop;
+    if(!gop)
+        return;
+
+    TAILQ_REMOVE(&gop->client_list, response, gop_entries);
+    response->gop = NULL;
+
+    if(TAILQ_EMPTY(&gop->client_list))
+        gop_destroy(response->mod, gop);
+}
+
+/* queues the cached PSI and the blocks since the key frame, after upstream_attach() */
+static void gop_seed(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    upstream_gop_t *gop = response->gop;
+    if(!gop || !gop->is_valid)
+        return;
+
+    const size_t block_size = (gop->block) ? gop->block->count * TS_PACKET_SIZE : 0;
+    if(gop->buffer_count + block_size + STREAM_BLOCK_SIZE >= response->buffer_size)
+        return;
+
+    if(gop->is_pat)
+    {
+        module_stream_block_t *psi = module_stream_block_alloc();
+        memcpy(psi->buffer, gop->pat, TS_PACKET_SIZE);
+        psi->count = 1;
+        for(size_t i = 0; i < gop->pmt_count && psi->count < STREAM_BLOCK_COUNT; ++i)
+        {
+            if(!gop->is_pmt[i])
+                continue;
+            memcpy(&psi->buffer[psi->count * TS_PACKET_SIZE], gop->pmt[i], TS_PACKET_SIZE);
+            ++psi->count;
+        }
+        upstream_push(client, psi);
+    }
+
+    size_t idx = gop->block_read;
+    for(size_t i = 0; i < gop->block_count; ++i)
+    {
+        upstream_push(client, module_stream_block_ref(gop->block_list[idx]));
+        idx = (idx + 1) % gop->block_size;
+    }
+
+    if(block_size > 0)
+    {
+        response->block = module_stream_block_alloc();
+        memcpy(response->block->buffer, gop->block->buffer, block_size);
+        response->block->count = gop->block->count;
+    }
+
+    // the response header is sent first, then the server restores on_ready
+    if(response->is_socket_busy)
+        client->on_ready = on_upstream_ready;
+}
+
+static void on_ring_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    upstream_ring_t *ring = response->ring;
+    if(!ring)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        return;
+    }
+
+    uint64_t pending = ring->write - response->ring_read;
+    if(pending > ring->size)
+    {
+        /*
+         * ring is written with whole packets, the read continues from
+         * the packet boundary. the rest of the partially sent packet is
+         * overwritten, it is completed with the stuffing bytes
+         */
+        uint64_t read = ring->write;
+        if(response->overflow != UPSTREAM_OVERFLOW_FLUSH)
+        {
+            read -= response->buffer_fill;
+            read += (TS_PACKET_SIZE - read % TS_PACKET_SIZE) % TS_PACKET_SIZE;
+        }
+        const uint64_t skip = read - response->ring_read;
+
+        if(upstream_overflow_stat(client, skip))
+        {
+            http_client_warning(client, "shared buffer overflow. drop client");
+            http_client_close(client);
+            return;
+        }
+
+        const size_t partial = response->ring_read % TS_PACKET_SIZE;
+        if(partial > 0)
+            response->ring_pad = TS_PACKET_SIZE - partial;
+
+        response->ring_read = read;
+        pending = ring->write - response->ring_read;
+
+        http_client_warning(client, "shared buffer overflow. skip %llu bytes"
+                            , (unsigned long long)skip);
+    }
+
+    if(response->ring_pad > 0)
+    {
+        uint8_t pad[TS_PACKET_SIZE];
+        memset(pad, 0xFF, response->ring_pad);
+        const ssize_t send_size = asc_socket_send(client->sock, pad, response->ring_pad);
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        response->ring_pad -= send_size;
+        if(response->ring_pad > 0)
+            return;
+    }
+
+    if(pending > 0)
+    {
+        // data may wrap the end of the ring
+        struct iovec iov[2];
+        int iovcnt = 1;
+
+        const size_t skip = response->ring_read % ring->size;
+        size_t block_size = ring->size - skip;
+        if(block_size > pending)
+            block_size = pending;
+
+        iov[0].iov_base = &ring->buffer[skip];
+        iov[0].iov_len = block_size;
+        if(block_size < pending)
+        {
+            iov[1].iov_base = ring->buffer;
+            iov[1].iov_len = pending - block_size;
+            block_size = pending;
+            ++iovcnt;
+        }
+
+        ssize_t send_size;
+#ifdef UPSTREAM_SENDFILE
+        if(ring->fd != -1)
+        {
+            // one call per ring segment. the rest on the next ready event
+            off_t offset = skip;
+            send_size = sendfile(  asc_socket_fd(client->sock), ring->fd, &offset
+                                 , iov[0].iov_len);
+            if(send_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                asc_socket_write_blocked(client->sock);
+                send_size = 0;
+            }
+        }
+        else
+#endif
+            send_size = asc_socket_sendv(client->sock, iov, iovcnt);
+
+        if(send_size > 0)
+        {
+            response->ring_read += send_size;
+        }
+        else if(send_size == -1)
+        {
+            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
+                              , block_size, asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+    }
+
+    if(response->ring_read == ring->write)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+        TAILQ_INSERT_TAIL(&ring->idle_list, response, idle_entries);
+    }
+}
+
+static void ring_write(upstream_ring_t *ring, const uint8_t *data, size_t size)
+{
+    if(ring->is_fast_start)
+    {
+        for(size_t i = 0; i < size; i += TS_PACKET_SIZE)
+        {
+            const uint8_t *const ts = &data[i];
+            if(TS_GET_PID(ts) == 0 && TS_IS_PAYLOAD_START(ts))
+            {
+                ring->pat = ring->write + i;
+                ring->is_pat = true;
+            }
+            else if(upstream_is_rap(ts))
+            {
+                ring->rap = (ring->is_pat) ? ring->pat : ring->write + i;
+                ring->is_rap = true;
+                ring->is_pat = false;
+            }
+        }
+    }
+
+    if(rate_update(&ring->rate, size))
+    {
+        http_response_t *response;
+        TAILQ_FOREACH(response, &ring->client_list, ring_entries)
+            pacing_update(response, ring->rate.byterate);
+    }
+
+    while(size > 0)
+    {
+        const size_t skip = ring->write % ring->size;
+        size_t block_size = ring->size - skip;
+        if(block_size > size)
+            block_size = size;
+
+        asc_ring_copy(&ring->buffer[skip], data, block_size);
+        ring->write += block_size;
+        data += block_size;
+        size -= block_size;
+    }
+
+    http_response_t *response, *next;
+    TAILQ_FOREACH_SAFE(response, &ring->idle_list, idle_entries, next)
+    {
+        if(ring->write - response->ring_read < response->buffer_fill)
+            continue;
+
+        TAILQ_REMOVE(&ring->idle_list, response, idle_entries);
+        asc_socket_set_on_ready(response->client->sock, on_ring_ready);
+        response->is_socket_busy = true;
+    }
+}
+
+static void on_ring_ts(void *arg, const uint8_t *ts)
+{
+    ring_write((upstream_ring_t *)arg, ts, TS_PACKET_SIZE);
+}
+
+static void on_ring_ts_batch(void *arg, const uint8_t *ts, size_t count)
+{
+    ring_write((upstream_ring_t *)arg, ts, count * TS_PACKET_SIZE);
+}
+
+static void on_ring_ts_block(void *arg, module_stream_block_t *block)
+{
+    ring_write((upstream_ring_t *)arg, block->ts, block->count * TS_PACKET_SIZE);
+}
+
+static void strip_on_ring_ts(void *arg, const uint8_t *ts)
+{
+    if(TS_GET_PID(ts) != NULL_TS_PID)
+        ring_write((upstream_ring_t *)arg, ts, TS_PACKET_SIZE);
+}
+
+static void strip_on_ring_run(void *arg, const uint8_t *ts, size_t count)
+{
+    ring_write((upstream_ring_t *)arg, ts, count * TS_PACKET_SIZE);
+}
+
+static void strip_on_ring_ts_batch(void *arg, const uint8_t *ts, size_t count)
+{
+    mpegts_ts_strip_null(ts, count, strip_on_ring_run, arg);
+}
+
+static void strip_on_ring_ts_block(void *arg, module_stream_block_t *block)
+{
+    mpegts_ts_strip_null(block->ts, block->count, strip_on_ring_run, arg);
+}
+
+static void ring_free(module_data_t *mod, upstream_ring_t *ring)
+{
+    asc_memstat_add(mod->memstat, -(int64_t)ring->size);
+    budget_release(mod, ring->size);
+
+#ifdef UPSTREAM_SENDFILE
+    if(ring->fd != -1)
+    {
+        munmap(ring->buffer, ring->size);
+        close(ring->fd);
+        asc_free(ring);
+        return;
+    }
+#endif
+
+    asc_ring_free(ring->buffer, ring->size);
+    asc_free(ring);
+}
+
+static void ring_destroy(module_data_t *mod, upstream_ring_t *ring)
+{
+    http_response_t *response;
+    while((response = TAILQ_FIRST(&ring->client_list)))
+    {
+        TAILQ_REMOVE(&ring->client_list, response, ring_entries);
+        response->ring = NULL;
+        response->session = NULL;
+    }
+
+    module_stream_destroy(ring);
+    TAILQ_REMOVE(&mod->ring_list, ring, entries);
+
+    if(mod->ring_pool_count < mod->ring_pool_size)
+    {
+        TAILQ_INSERT_TAIL(&mod->ring_pool, ring, entries);
+        ++mod->ring_pool_count;
+        return;
+    }
+
+    ring_free(mod, ring);
+}
+
+/* returns NULL if the ring does not fit in the budget */
+static upstream_ring_t * ring_alloc(  module_data_t *mod, size_t size, size_t fill
+                                    , bool is_sendfile)
+{
+    upstream_ring_t *ring;
+    TAILQ_FOREACH(ring, &mod->ring_pool, entries)
+    {
+        if(ring->size == size && (ring->fd != -1) == is_sendfile)
+            break;
+    }
+
+    if(!ring && budget.limit > 0 && !budget_grant(size, fill))
+    {
+        // the idle rings are released first
+        while((ring = TAILQ_FIRST(&mod->ring_pool)))
+        {
+            TAILQ_REMOVE(&mod->ring_pool, ring, entries);
+            ring_free(mod, ring);
+        }
+        mod->ring_pool_count = 0;
+    }
+
+    if(ring)
+    {
+        TAILQ_REMOVE(&mod->ring_pool, ring, entries);
+        --mod->ring_pool_count;
+
+        uint8_t *buffer = ring->buffer;
+        const int fd = ring->fd;
+        memset(ring, 0, sizeof(upstream_ring_t));
+        ring->buffer = buffer;
+        ring->fd = fd;
+        ring->size = size;
+        return ring;
+    }
+
+    size = budget_reserve(mod, size, fill);
+    if(!size)
+        return NULL;
 
-    uint8_t *buffer;
-    size_t buffer_count;
-    size_t buffer_read;
-    size_t buffer_write;
+    ring = (upstream_ring_t *)asc_calloc(mod->memstat, 1, sizeof(upstream_ring_t));
+    ring->size = size;
+    ring->fd = -1;
+    asc_memstat_add(mod->memstat, (int64_t)size);
 
-    size_t buffer_size;
-    size_t buffer_fill;
+#ifdef UPSTREAM_SENDFILE
+    if(is_sendfile)
+    {
+        // the ring pages are sent to the sockets directly from the page cache
+        ring->fd = memfd_create("http_upstream", MFD_CLOEXEC);
+        if(ring->fd != -1 && ftruncate(ring->fd, size) == 0)
+        {
+            void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+            if(buffer != MAP_FAILED)
+            {
+                ring->buffer = (uint8_t *)buffer;
+                return ring;
+            }
+        }
 
-    bool is_socket_busy;
-};
+        asc_log_error("[http_upstream] failed to create memfd ring [%s]", strerror(errno));
+        if(ring->fd != -1)
+        {
+            close(ring->fd);
+            ring->fd = -1;
+        }
+    }
+#else
+    __uarg(is_sendfile);
+#endif
 
-/*
- * client->mod - http_server module
- * client->response->mod - http_upstream module
- */
+    ring->buffer = (uint8_t *)asc_ring_alloc(size, -1);
+    return ring;
+}
 
-static void on_upstream_ready(void *arg)
+/* returns false if the new ring does not fit in the budget */
+static bool ring_attach(  http_response_t *response, module_stream_t *upstream
+                        , bool is_sendfile, bool is_fast_start)
 {
-    http_client_t *client = (http_client_t *)arg;
-    http_response_t *response = client->response;
+    module_data_t *mod = response->mod;
 
-    if(response->buffer_count > 0)
+    upstream_ring_t *ring;
+    TAILQ_FOREACH(ring, &mod->ring_list, entries)
     {
-        size_t block_size = (response->buffer_write > response->buffer_read)
-                          ? (response->buffer_write - response->buffer_read)
-                          : (response->buffer_size - response->buffer_read);
+        if(   ring->__stream.parent == upstream
+           && (ring->fd != -1) == is_sendfile
+           && ring->is_strip_null == response->is_strip_null)
+        {
+            break;
+        }
+    }
 
-        if(block_size > response->buffer_count)
-            block_size = response->buffer_count;
+    if(!ring)
+    {
+        ring = ring_alloc(mod, response->buffer_size, response->buffer_fill, is_sendfile);
+        if(!ring)
+            return false;
 
-        const ssize_t send_size = asc_socket_send(  client->sock
-                                                  , &response->buffer[response->buffer_read]
-                                                  , block_size);
+        TAILQ_INIT(&ring->client_list);
+        TAILQ_INIT(&ring->idle_list);
+        TAILQ_INSERT_TAIL(&mod->ring_list, ring, entries);
 
-        if(send_size > 0)
+        // like module_stream_init()
+        ring->__stream.self = (void *)ring;
+        ring->is_strip_null = response->is_strip_null;
+        if(ring->is_strip_null)
         {
-            response->buffer_count -= send_size;
-            response->buffer_read += send_size;
-            if(response->buffer_read >= response->buffer_size)
-                response->buffer_read = 0;
+            ring->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))strip_on_ring_ts;
+            ring->__stream.on_ts_batch =
+                (void (*)(module_data_t *, const uint8_t *, size_t))strip_on_ring_ts_batch;
+            ring->__stream.on_ts_block =
+                (void (*)(module_data_t *, module_stream_block_t *))strip_on_ring_ts_block;
         }
-        else if(send_size == -1)
+        else
         {
-            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
-                              , block_size, asc_socket_error());
-            http_client_close(client);
-            return;
+            ring->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ring_ts;
+            ring->__stream.on_ts_batch =
+                (void (*)(module_data_t *, const uint8_t *, size_t))on_ring_ts_batch;
+            ring->__stream.on_ts_block =
+                (void (*)(module_data_t *, module_stream_block_t *))on_ring_ts_block;
         }
+        __module_stream_init(&ring->__stream);
+        __module_stream_attach(upstream, &ring->__stream);
     }
 
-    if(response->buffer_count == 0)
+    response->ring = ring;
+    response->ring_read = ring->write;
+
+    if(ring->fd != -1)
     {
-        asc_socket_set_on_ready(client->sock, NULL);
-        response->is_socket_busy = false;
+        // the socket queue refers to the ring pages, so it should be
+        // sent before the writer comes back to the same position
+        asc_socket_set_buffer(response->client->sock, 0, ring->size / 4);
     }
-}
-
-static void on_ts(void *arg, const uint8_t *ts)
-{
-    http_client_t *client = (http_client_t *)arg;
-    http_response_t *response = client->response;
+    TAILQ_INSERT_TAIL(&ring->client_list, response, ring_entries);
 
-    if(response->buffer_count + TS_PACKET_SIZE >= response->buffer_size)
+    if(is_fast_start)
     {
-        // overflow
-        response->buffer_count = 0;
-        response->buffer_read = 0;
-        response->buffer_write = 0;
-        if(response->is_socket_busy)
+        ring->is_fast_start = true;
+
+        // begin with the last key frame if it is not going to be overwritten soon
+        if(ring->is_rap && ring->write - ring->rap < ring->size / 2)
         {
-            asc_socket_set_on_ready(client->sock, NULL);
-            response->is_socket_busy = false;
+            response->ring_read = ring->rap;
+
+            // the response header is sent first, then the server restores on_ready
+            response->is_socket_busy = true;
+            response->client->on_ready = on_ring_ready;
+            return true;
         }
+    }
+
+    TAILQ_INSERT_TAIL(&ring->idle_list, response, idle_entries);
+    return true;
+}
+
+static void ring_detach(http_response_t *response)
+{
+    upstream_ring_t *ring = response->ring;
+    if(!ring)
         return;
+
+    if(!response->is_socket_busy)
+        TAILQ_REMOVE(&ring->idle_list, response, idle_entries);
+    TAILQ_REMOVE(&ring->client_list, response, ring_entries);
+    response->ring = NULL;
+
+    if(TAILQ_EMPTY(&ring->client_list))
+        ring_destroy(response->mod, ring);
+}
+
+/* scheme and host are case-insensitive, the empty query and options are ignored */
+static void session_key(char *dst, const char *src)
+{
+    size_t i = 0;
+    const char *const host = strstr(src, "://");
+    const char *const path = (host) ? strpbrk(&host[3], "/?#") : NULL;
+
+    for(; src[i] && i < SESSION_KEY_SIZE - 1; ++i)
+    {
+        const bool is_lower = (!host || !path || &src[i] < path);
+        dst[i] = (is_lower) ? tolower((unsigned char)src[i]) : src[i];
     }
 
-    const size_t buffer_write = response->buffer_write + TS_PACKET_SIZE;
-    if(buffer_write < response->buffer_size)
+    while(i > 0 && (dst[i - 1] == '?' || dst[i - 1] == '#'))
+        --i;
+    dst[i] = '\0';
+}
+
+static void session_destroy(upstream_session_t *session)
+{
+    module_data_t *mod = session->mod;
+
+    TAILQ_REMOVE(&mod->session_list, session, entries);
+    --mod->sessions;
+
+    ASC_FREE(session->linger_timer, asc_timer_destroy);
+
+    if(mod->idx_session_close)
     {
-        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
-        response->buffer_write = buffer_write;
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_session_close);
+        lua_pushstring(lua, session->key);
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, session->idx_data);
+        lua_call(lua, 2, 0);
     }
-    else if(buffer_write > response->buffer_size)
+
+    luaL_unref(lua, LUA_REGISTRYINDEX, session->idx_data);
+    asc_free(session->key);
+    asc_free(session);
+}
+
+static upstream_session_t * session_find(module_data_t *mod, const char *name)
+{
+    char key[SESSION_KEY_SIZE];
+    session_key(key, name);
+
+    upstream_session_t *session;
+    TAILQ_FOREACH(session, &mod->session_list, entries)
     {
-        const size_t ts_head = response->buffer_size - response->buffer_write;
-        memcpy(&response->buffer[response->buffer_write], ts, ts_head);
-        response->buffer_write = TS_PACKET_SIZE - ts_head;
-        memcpy(response->buffer, &ts[ts_head], response->buffer_write);
+        if(!strcmp(session->key, key))
+            return session;
     }
-    else
+
+    return NULL;
+}
+
+static void on_session_linger(void *arg)
+{
+    upstream_session_t *session = (upstream_session_t *)arg;
+    session->linger_timer = NULL;
+    session_destroy(session);
+}
+
+static upstream_session_t * session_open(http_client_t *client, const char *name)
+{
+    module_data_t *mod = client->response->mod;
+
+    upstream_session_t *session = session_find(mod, name);
+    if(!session)
     {
-        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
-        response->buffer_write = 0;
+        if(!mod->idx_session_open)
+            return NULL;
+
+        char key[SESSION_KEY_SIZE];
+        session_key(key, name);
+
+        // session_open(key) returns the upstream and the value for session_close
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_session_open);
+        lua_pushstring(lua, key);
+        lua_call(lua, 1, 2);
+
+        if(!lua_islightuserdata(lua, -2))
+        {
+            lua_pop(lua, 2);
+            return NULL;
+        }
+
+        session = (upstream_session_t *)asc_calloc(mod->memstat, 1, sizeof(upstream_session_t));
+        session->mod = mod;
+        const size_t key_size = strlen(key) + 1;
+        session->key = (char *)asc_malloc(mod->memstat, key_size);
+        memcpy(session->key, key, key_size);
+        session->idx_data = luaL_ref(lua, LUA_REGISTRYINDEX);
+        session->upstream = (module_stream_t *)lua_touserdata(lua, -1);
+        lua_pop(lua, 1);
+
+        TAILQ_INSERT_TAIL(&mod->session_list, session, entries);
+        ++mod->sessions;
     }
-    response->buffer_count += TS_PACKET_SIZE;
 
-    if(   response->is_socket_busy == false
-       && response->buffer_count >= response->buffer_fill)
+    ASC_FREE(session->linger_timer, asc_timer_destroy);
+    ++session->viewers;
+    client->response->session = session;
+
+    return session;
+}
+
+static void session_release(http_response_t *response)
+{
+    upstream_session_t *session = response->session;
+    if(!session)
+        return;
+
+    response->session = NULL;
+    if(--session->viewers > 0)
+        return;
+
+    if(session->mod->session_linger > 0)
     {
-        asc_socket_set_on_ready(client->sock, on_upstream_ready);
-        response->is_socket_busy = true;
+        session->linger_timer = asc_timer_one_shot(  session->mod->session_linger
+                                                   , on_session_linger, session);
     }
+    else
+        session_destroy(session);
 }
 
 static void on_upstream_read(void *arg)
@@ -148,11 +1756,66 @@ static void on_upstream_read(void *arg)
         http_client_close(client);
 }
 
+/* packets the queue takes before the overflow, the private block is counted too */
+static size_t upstream_credit(http_client_t *client)
+{
+    const http_response_t *response = client->response;
+
+    size_t used = response->buffer_count;
+    if(response->block)
+        used += response->block->count * TS_PACKET_SIZE;
+    if(used >= response->buffer_size)
+        return 0;
+
+    return (response->buffer_size - used) / TS_PACKET_SIZE;
+}
+
+static void upstream_attach(http_response_t *response, module_stream_t *upstream)
+{
+    // each block has one packet at least
+    const size_t block_size = response->buffer_size / TS_PACKET_SIZE + 1;
+    if(response->block_size != block_size)
+    {
+        asc_free(response->block_list);
+        response->block_size = block_size;
+        response->block_list = (module_stream_block_t **)asc_calloc(
+            response->mod->memstat, response->block_size, sizeof(module_stream_block_t *));
+    }
+
+    // like module_stream_init()
+    response->__stream.self = (void *)response->client;
+    if(response->is_strip_null)
+    {
+        response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))strip_on_ts;
+        response->__stream.on_ts_batch =
+            (void (*)(module_data_t *, const uint8_t *, size_t))strip_on_ts_batch;
+        response->__stream.on_ts_block =
+            (void (*)(module_data_t *, module_stream_block_t *))strip_on_ts_block;
+    }
+    else
+    {
+        response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
+        response->__stream.on_ts_batch =
+            (void (*)(module_data_t *, const uint8_t *, size_t))on_ts_batch;
+        response->__stream.on_ts_block =
+            (void (*)(module_data_t *, module_stream_block_t *))on_ts_block;
+    }
+    __module_stream_init(&response->__stream);
+    if(response->is_flow_control)
+        response->__stream.credit = (stream_credit_callback_t)upstream_credit;
+    __module_stream_attach(upstream, &response->__stream);
+}
+
 static void on_upstream_send(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
 
     module_stream_t *upstream = NULL;
+    const char *session = NULL;
+    bool is_shared = false;
+    bool is_zerocopy = false;
+    bool is_sendfile = false;
+    bool is_fast_start = false;
 
     client->response->buffer_size = DEFAULT_BUFFER_SIZE;
     client->response->buffer_fill = DEFAULT_BUFFER_FILL;
@@ -164,6 +1827,12 @@ static void on_upstream_send(void *arg)
             upstream = (module_stream_t *)lua_touserdata(lua, -1);
         lua_pop(lua, 1);
 
+        // clients of the session share the input and the ring
+        lua_getfield(lua, 3, "session");
+        if(lua_isstring(lua, -1))
+            session = lua_tostring(lua, -1);
+        lua_pop(lua, 1);
+
         lua_getfield(lua, 3, "buffer_size");
         if(lua_isnumber(lua, -1))
         {
@@ -182,6 +1851,70 @@ static void on_upstream_send(void *arg)
         }
         lua_pop(lua, 1);
 
+        lua_getfield(lua, 3, "shared");
+        if(lua_isboolean(lua, -1))
+            is_shared = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // shared ring only. Clients are fed from the memfd with sendfile()
+        lua_getfield(lua, 3, "sendfile");
+        if(lua_isboolean(lua, -1))
+            is_sendfile = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // new client begins with the last key frame
+        lua_getfield(lua, 3, "fast_start");
+        if(lua_isboolean(lua, -1))
+            is_fast_start = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // per-client queue only. The shared ring is overwritten in place
+        lua_getfield(lua, 3, "zerocopy");
+        if(lua_isboolean(lua, -1))
+            is_zerocopy = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // per-client queue only. The producer with flow_control=true
+        // waits for the slow client instead of the overflow
+        lua_getfield(lua, 3, "flow_control");
+        if(lua_isboolean(lua, -1))
+            client->response->is_flow_control = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // null packets are dropped, the client receives VBR stream
+        lua_getfield(lua, 3, "strip_null");
+        if(lua_isboolean(lua, -1))
+            client->response->is_strip_null = lua_toboolean(lua, -1);
+        lua_pop(lua, 1);
+
+        // true or percent of the stream rate
+        lua_getfield(lua, 3, "pacing");
+        if(lua_isboolean(lua, -1))
+            client->response->pacing = lua_toboolean(lua, -1) ? DEFAULT_PACING : 0;
+        else if(lua_isnumber(lua, -1))
+            client->response->pacing = lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+
+        lua_getfield(lua, 3, "overflow");
+        if(lua_isstring(lua, -1))
+        {
+            const char *overflow = lua_tostring(lua, -1);
+            if(!strcmp(overflow, "drop"))
+                client->response->overflow = UPSTREAM_OVERFLOW_DROP;
+            else if(!strcmp(overflow, "skip"))
+                client->response->overflow = UPSTREAM_OVERFLOW_SKIP;
+            else if(!strcmp(overflow, "flush"))
+                client->response->overflow = UPSTREAM_OVERFLOW_FLUSH;
+            else
+                http_client_warning(client, "unknown overflow policy '%s'", overflow);
+        }
+        lua_pop(lua, 1);
+
+        lua_getfield(lua, 3, "overflow_limit");
+        if(lua_isnumber(lua, -1))
+            client->response->overflow_limit = lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+
         if(client->response->buffer_size <= client->response->buffer_fill)
         {
             http_client_error(client, "buffer_size must be greater than buffer_fill");
@@ -194,23 +1927,81 @@ static void on_upstream_send(void *arg)
         upstream = (module_stream_t *)lua_touserdata(lua, 3);
     }
 
+    client->response->client = client;
+
+    if(session)
+    {
+        upstream_session_t *s = session_open(client, session);
+        if(!s)
+        {
+            http_client_abort(client, 404, NULL);
+            return;
+        }
+        upstream = s->upstream;
+        is_shared = true;
+    }
+
     if(!upstream)
     {
         http_client_abort(client, 500, ":send() client instance required");
         return;
     }
 
-    client->response->buffer = (uint8_t *)malloc(client->response->buffer_size);
-
-    // like module_stream_init()
-    client->response->__stream.self = (void *)client;
-    client->response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
-    __module_stream_init(&client->response->__stream);
-    __module_stream_attach(upstream, &client->response->__stream);
-
     client->on_read = on_upstream_read;
     client->on_ready = NULL;
 
+    if(client->response->pacing > 0)
+    {
+        if(client->response->pacing < 100)
+            client->response->pacing = 100;
+        asc_socket_set_notsent_lowat(client->sock, PACING_NOTSENT_LOWAT);
+    }
+
+    if(client->response->overflow == UPSTREAM_OVERFLOW_DEFAULT)
+    {
+        client->response->overflow = (is_shared)
+                                   ? UPSTREAM_OVERFLOW_SKIP
+                                   : UPSTREAM_OVERFLOW_FLUSH;
+    }
+
+    if(is_shared)
+    {
+        if(!ring_attach(client->response, upstream, is_sendfile, is_fast_start))
+        {
+            http_client_abort(client, 503, "buffer budget exhausted");
+            return;
+        }
+        pacing_update(client->response, client->response->ring->rate.byterate);
+    }
+    else
+    {
+        // the queue may be reduced to fit in the budget
+        const size_t buffer_size = budget_reserve(  client->response->mod
+                                                  , client->response->buffer_size
+                                                  , client->response->buffer_fill);
+        if(!buffer_size)
+        {
+            http_client_abort(client, 503, "buffer budget exhausted");
+            return;
+        }
+        client->response->buffer_size = buffer_size;
+        client->response->buffer_reserved = buffer_size;
+
+        if(is_fast_start)
+            gop_attach(client->response, upstream);
+
+        upstream_attach(client->response, upstream);
+
+        if(is_fast_start)
+            gop_seed(client);
+
+        if(is_zerocopy && asc_socket_set_zerocopy(client->sock, on_upstream_zerocopy))
+        {
+            client->response->zerocopy_list = (upstream_zerocopy_t *)asc_calloc(
+                client->response->mod->memstat, ZEROCOPY_LIST_SIZE, sizeof(upstream_zerocopy_t));
+        }
+    }
+
     const char *content_type = lua_isstring(lua, 4)
                              ? lua_tostring(lua, 4)
                              : "application/octet-stream";
@@ -223,6 +2014,49 @@ static void on_upstream_send(void *arg)
     http_response_send(client);
 }
 
+static http_response_t * response_alloc(module_data_t *mod)
+{
+    if(mod->pool_count == 0)
+        return (http_response_t *)asc_calloc(mod->memstat, 1, sizeof(http_response_t));
+
+    http_response_t *response = mod->pool[--mod->pool_count];
+
+    // keep the block queue if buffer_size is not changed
+    module_stream_block_t **block_list = response->block_list;
+    const size_t block_size = response->block_size;
+    memset(response, 0, sizeof(http_response_t));
+    response->block_list = block_list;
+    response->block_size = block_size;
+
+    return response;
+}
+
+static void response_free(module_data_t *mod, http_response_t *response)
+{
+    if(response->block_list)
+        upstream_flush(response);
+
+    if(response->buffer_reserved)
+    {
+        budget_release(mod, response->buffer_reserved);
+        response->buffer_reserved = 0;
+    }
+
+    if(response->zerocopy_list)
+        zerocopy_flush(response);
+
+    ASC_FREE(response->drop_timer, asc_timer_destroy);
+
+    if(mod->pool_count < mod->pool_size)
+    {
+        mod->pool[mod->pool_count++] = response;
+        return;
+    }
+
+    asc_free(response->block_list);
+    asc_free(response);
+}
+
 static int module_call(module_data_t *mod)
 {
     http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
@@ -231,23 +2065,38 @@ static int module_call(module_data_t *mod)
     {
         if(client->response)
         {
-            lua_rawgeti(lua, LUA_REGISTRYINDEX, client->response->mod->idx_callback);
+            /* callback may run the gc and destroy the module */
+            http_response_t *response = client->response;
+            client->response = NULL;
+
+            module_stream_destroy(response);
+            ring_detach(response);
+            gop_detach(response);
+            session_release(response);
+
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, response->mod->idx_callback);
+            --response->mod->clients;
+            response_free(response->mod, response);
+
             lua_pushvalue(lua, 2);
             lua_pushvalue(lua, 3);
             lua_pushvalue(lua, 4);
             lua_call(lua, 3, 0);
-
-            module_stream_destroy(client->response);
-
-            free(client->response->buffer);
-            free(client->response);
-            client->response = NULL;
         }
         return 0;
     }
 
-    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    // stream is sent from the socket callbacks, HTTP/2 stream has no socket
+    if(client->h2_stream)
+    {
+        http_client_abort(client, 505, "stream requires HTTP/1.1");
+        return 0;
+    }
+
+    client->response = response_alloc(mod);
     client->response->mod = mod;
+    ++mod->clients;
+    asc_socket_set_priority(client->sock, ASC_EVENT_OUTPUT);
 
     client->on_send = on_upstream_send;
 
@@ -260,10 +2109,42 @@ static int module_call(module_data_t *mod)
     return 0;
 }
 
-static int __module_call(lua_State *L)
+static void upstream_metric_init(module_data_t *mod, const char *name)
 {
-    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
-    return module_call(mod);
+    char labels[512];
+    asc_metric_labels(labels, sizeof(labels), "http_upstream", name);
+
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_clients", ASC_METRIC_GAUGE
+                                            , "Connected HTTP clients")
+                        , labels, &mod->clients, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_overflows_total"
+                                            , ASC_METRIC_COUNTER
+                                            , "Client buffer overflows")
+                        , labels, &mod->overflows, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_overflow_bytes_total"
+                                            , ASC_METRIC_COUNTER
+                                            , "Bytes dropped on the client buffer overflows")
+                        , labels, &mod->overflow_bytes, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_drops_total", ASC_METRIC_COUNTER
+                                            , "Slow clients disconnected")
+                        , labels, &mod->drops, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_sessions", ASC_METRIC_GAUGE
+                                            , "Open input sessions")
+                        , labels, &mod->sessions, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_buffer_bytes", ASC_METRIC_GAUGE
+                                            , "Client buffers reserved in the buffer budget")
+                        , labels, &mod->buffer_bytes, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_http_upstream_budget_refused_total"
+                                            , ASC_METRIC_COUNTER
+                                            , "Clients refused by the buffer budget")
+                        , labels, &mod->budget_refused, 1);
 }
 
 static void module_init(module_data_t *mod)
@@ -272,6 +2153,47 @@ static void module_init(module_data_t *mod)
     asc_assert(lua_isfunction(lua, -1), "[http_upstream] option 'callback' is required");
     mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
 
+    TAILQ_INIT(&mod->ring_list);
+    TAILQ_INIT(&mod->ring_pool);
+    TAILQ_INIT(&mod->gop_list);
+    TAILQ_INIT(&mod->session_list);
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "session_open");
+    if(lua_isfunction(lua, -1))
+    {
+        mod->idx_session_open = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+        lua_getfield(lua, MODULE_OPTIONS_IDX, "session_close");
+        if(lua_isfunction(lua, -1))
+            mod->idx_session_close = luaL_ref(lua, LUA_REGISTRYINDEX);
+        else
+            lua_pop(lua, 1);
+    }
+    else
+        lua_pop(lua, 1);
+
+    mod->session_linger = DEFAULT_SESSION_LINGER;
+    module_option_number("session_linger", &mod->session_linger);
+
+    // max count of idle responses and shared rings kept for reuse
+    int pool_size = DEFAULT_POOL_SIZE;
+    module_option_number("pool_size", &pool_size);
+    if(pool_size > 0)
+    {
+        mod->pool_size = pool_size;
+        mod->pool = (http_response_t **)calloc(mod->pool_size, sizeof(http_response_t *));
+    }
+
+    int ring_pool_size = DEFAULT_RING_POOL_SIZE;
+    module_option_number("ring_pool_size", &ring_pool_size);
+    if(ring_pool_size > 0)
+        mod->ring_pool_size = ring_pool_size;
+
+    // megabytes, process-wide: the last instance with the option sets the limit
+    int buffer_budget = 0;
+    if(module_option_number("buffer_budget", &buffer_budget) && buffer_budget >= 0)
+        budget.limit = (uint64_t)buffer_budget * 1024 * 1024;
+
     // Deprecated
     bool is_deprecated = false;
 
@@ -289,26 +2211,130 @@ static void module_init(module_data_t *mod)
         asc_log_error("[http_upstream] deprecated usage of the buffer_size/buffer_fill options");
     //
 
-    // Set callback for http route
-    lua_getmetatable(lua, 3);
-    lua_pushlightuserdata(lua, (void *)mod);
-    lua_pushcclosure(lua, __module_call, 1);
-    lua_setfield(lua, -2, "__call");
-    lua_pop(lua, 1);
+    // instance name for the metrics
+    const char *name = NULL;
+    module_option_string("name", &name, NULL);
+    if(name)
+        upstream_metric_init(mod, name);
+    mod->memstat = asc_memstat_init("http_upstream", name);
 }
 
 static void module_destroy(module_data_t *mod)
 {
+    asc_metric_unregister(&mod->metric_list);
+
+    upstream_ring_t *ring;
+    while((ring = TAILQ_FIRST(&mod->ring_list)))
+        ring_destroy(mod, ring);
+
+    upstream_gop_t *gop;
+    while((gop = TAILQ_FIRST(&mod->gop_list)))
+        gop_destroy(mod, gop);
+
+    // the inputs are released with the values returned by session_open
+    upstream_session_t *session;
+    while((session = TAILQ_FIRST(&mod->session_list)))
+    {
+        TAILQ_REMOVE(&mod->session_list, session, entries);
+        ASC_FREE(session->linger_timer, asc_timer_destroy);
+        luaL_unref(lua, LUA_REGISTRYINDEX, session->idx_data);
+        asc_free(session->key);
+        asc_free(session);
+    }
+    mod->sessions = 0;
+
+    if(mod->idx_session_open)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_session_open);
+        mod->idx_session_open = 0;
+    }
+
+    if(mod->idx_session_close)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_session_close);
+        mod->idx_session_close = 0;
+    }
+
+    while((ring = TAILQ_FIRST(&mod->ring_pool)))
+    {
+        TAILQ_REMOVE(&mod->ring_pool, ring, entries);
+        ring_free(mod, ring);
+    }
+    mod->ring_pool_count = 0;
+
+    if(mod->pool)
+    {
+        while(mod->pool_count > 0)
+        {
+            http_response_t *response = mod->pool[--mod->pool_count];
+            asc_free(response->block_list);
+            asc_free(response);
+        }
+
+        free(mod->pool);
+        mod->pool = NULL;
+    }
+
     if(mod->idx_callback)
     {
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
         mod->idx_callback = 0;
     }
+
+    ASC_FREE(mod->memstat, asc_memstat_destroy);
+}
+
+/* returns the count of viewers of the session, or nil if the session is not open */
+static int method_session(module_data_t *mod)
+{
+    const char *name = luaL_checkstring(lua, 2);
+
+    upstream_session_t *session = session_find(mod, name);
+    if(!session)
+    {
+        lua_pushnil(lua);
+        return 1;
+    }
+
+    lua_pushnumber(lua, session->viewers);
+    return 1;
+}
+
+/*
+ * returns the buffer budget of the process: limit, used, shrunk, refused and
+ * grant - bytes of the new client with buffer_size and buffer_fill (Kb,
+ * optional) now, 0 if the client is refused
+ */
+static int method_budget(module_data_t *mod)
+{
+    __uarg(mod);
+
+    size_t buffer_size = DEFAULT_BUFFER_SIZE;
+    size_t buffer_fill = DEFAULT_BUFFER_FILL;
+    if(lua_isnumber(lua, 2) && lua_tonumber(lua, 2) > 0)
+        buffer_size = lua_tonumber(lua, 2) * 1024;
+    if(lua_isnumber(lua, 3) && lua_tonumber(lua, 3) > 0)
+        buffer_fill = lua_tonumber(lua, 3) * 1024;
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, budget.limit);
+    lua_setfield(lua, -2, "limit");
+    lua_pushnumber(lua, budget.used);
+    lua_setfield(lua, -2, "used");
+    lua_pushnumber(lua, budget.shrunk);
+    lua_setfield(lua, -2, "shrunk");
+    lua_pushnumber(lua, budget.refused);
+    lua_setfield(lua, -2, "refused");
+    lua_pushnumber(lua, budget_grant(buffer_size, buffer_fill));
+    lua_setfield(lua, -2, "grant");
+    return 1;
 }
 
 MODULE_LUA_METHODS()
 {
-    { NULL, NULL }
+    { "__call", module_call },
+    { "session", method_session },
+    { "budget", method_budget },
 };
 
 MODULE_LUA_REGISTER(http_upstream)
@@ -18,6 +18,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_websocket
+ *
+ * Module Options:
+ *      callback    - function, called on the incoming message with
+ *                    (server, client, message). message is nil on close
+ *
+ * Module Methods:
+ *      subscribe(client, topic)
+ *                  - send messages published to the topic to the client
+ *      unsubscribe(client, topic)
+ *      publish(topic, message)
+ *                  - send message to all subscribers of the topic
+ *
+ * Outgoing frames are appended to the send buffer of the client and the
+ * buffer is flushed with one send() when the socket is ready, so all
+ * messages queued in the same loop iteration leave in one write.
+ * C modules publish with http_websocket_publish() without Lua.
+ */
+
 #include <astra.h>
 #include "../http.h"
 
@@ -28,17 +49,25 @@
 #define FRAME_SIZE16_SIZE 2
 #define FRAME_SIZE64_SIZE 8
 
+#define FRAME_HEADER_MAX (FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE)
+
+#define WEBSOCKET_BUFFER_SIZE (16 * 1024)
+#define WEBSOCKET_BUFFER_LIMIT (8 * 1024 * 1024) // client is too slow
+
+#define MSG(_msg) "[http_websocket] " _msg
+
 struct module_data_t
 {
     int idx_callback;
 };
 
-typedef struct
+struct http_websocket_topic_t
 {
-    uint8_t *buffer;
-    size_t size;
-    size_t skip;
-} frame_t;
+    size_t refcount; // producers and subscriptions
+
+    char *name;
+    asc_list_t *clients;
+};
 
 struct http_response_t
 {
@@ -50,7 +79,15 @@ struct http_response_t
     uint8_t frame_key[FRAME_KEY_SIZE];
     uint8_t frame_key_i;
 
-    asc_list_t *frame_queue;
+    // send buffer
+    uint8_t *buffer;
+    size_t buffer_size;
+    size_t buffer_skip;
+    size_t buffer_end;
+    bool is_ready; // 101 response is sent
+    asc_timer_t *close_timer; // client is dropped on the send buffer overflow
+
+    asc_list_t *topics;
 };
 
 /*
@@ -60,87 +97,185 @@ struct http_response_t
 
 static const char __websocket_magic[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
+static asc_list_t *topic_list = NULL;
+
+/*
+ *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
+ * 888         888    88   8888o  88   888    88o
+ *  888oooooo  888ooo8     88 888o88   888    888
+ *         888 888    oo   88   8888   888    888
+ * o88oooo888 o888ooo8888 o88o    88  o888ooo88
+ *
+ */
+
+static size_t frame_header(uint8_t *header, size_t size)
+{
+    header[0] = 0x81; // FIN + text frame
+
+    if(size <= 125)
+    {
+        header[1] = size & 0xFF;
+        return FRAME_HEADER_SIZE + FRAME_SIZE8_SIZE;
+    }
+    else if(size <= 0xFFFF)
+    {
+        header[1] = 126;
+        header[2] = (size >> 8) & 0xFF;
+        header[3] = (size     ) & 0xFF;
+        return FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
+    }
+
+    header[1] = 127;
+    const uint64_t size64 = size;
+    for(int i = 0; i < 8; ++i)
+        header[2 + i] = (size64 >> (56 - i * 8)) & 0xFF;
+    return FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
+}
+
 static void on_websocket_ready(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
 
-    asc_list_first(response->frame_queue);
-    frame_t *frame = (frame_t *)asc_list_data(response->frame_queue);
+    response->is_ready = true;
 
-    ssize_t size = asc_socket_send(  client->sock
-                                   , &frame->buffer[frame->skip]
-                                   , frame->size - frame->skip);
-    if(size <= 0)
+    if(response->buffer_skip == response->buffer_end)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        return;
+    }
+
+    const ssize_t size = asc_socket_send(  client->sock
+                                         , &response->buffer[response->buffer_skip]
+                                         , response->buffer_end - response->buffer_skip);
+    if(size == -1)
     {
         http_client_error(client, "failed to send data [%s]", asc_socket_error());
         http_client_close(client);
         return;
     }
 
-    frame->skip += size;
+    response->buffer_skip += size;
 
-    if(frame->size == frame->skip)
+    if(response->buffer_skip == response->buffer_end)
     {
-        free(frame->buffer);
-        free(frame);
-        asc_list_remove_current(response->frame_queue);
-        if(asc_list_eol(response->frame_queue))
-            asc_socket_set_on_ready(client->sock, NULL);
+        response->buffer_skip = 0;
+        response->buffer_end = 0;
+        asc_socket_set_on_ready(client->sock, NULL);
     }
 }
 
-/* Stack: 1 - server, 2 - client, 3 - response */
-static void on_websocket_send(void *arg)
+static void on_websocket_overflow(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
-    http_response_t *response = client->response;
 
-    const char *str = lua_tostring(lua, 3);
-    const int str_size = luaL_len(lua, 3);
+    ASC_FREE(client->response->close_timer, asc_timer_destroy);
+    http_client_close(client);
+}
+
+/* appends frame to the send buffer. returns false if the client is too slow */
+static bool frame_append(  http_client_t *client
+                         , const uint8_t *header, size_t header_size
+                         , const char *data, size_t data_size)
+{
+    http_response_t *response = client->response;
+    if(response->close_timer)
+        return false;
 
-    frame_t *frame = malloc(sizeof(frame_t));
+    const size_t frame_size = header_size + data_size;
+    const size_t pending = response->buffer_end - response->buffer_skip;
 
-    if(str_size <= 125)
+    if(pending + frame_size > WEBSOCKET_BUFFER_LIMIT)
     {
-        frame->size = FRAME_HEADER_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
-
-        frame->buffer[1] = str_size & 0xFF;
+        http_client_error(client, "send buffer overflow. drop connection");
+        asc_socket_set_on_read(client->sock, NULL);
+        asc_socket_set_on_ready(client->sock, NULL);
+        // publish may iterate a list of the clients, close later
+        response->close_timer = asc_timer_init(0, on_websocket_overflow, client);
+        return false;
     }
-    else if(str_size <= 0xFFFF)
+
+    if(response->buffer_end + frame_size > response->buffer_size)
     {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
+        if(response->buffer_skip > 0)
+        {
+            memmove(response->buffer, &response->buffer[response->buffer_skip], pending);
+            response->buffer_skip = 0;
+            response->buffer_end = pending;
+        }
+
+        if(response->buffer_end + frame_size > response->buffer_size)
+        {
+            size_t buffer_size = (response->buffer_size) ? response->buffer_size
+                                                         : WEBSOCKET_BUFFER_SIZE;
+            while(buffer_size < response->buffer_end + frame_size)
+                buffer_size *= 2;
 
-        frame->buffer[1] = 126;
-        frame->buffer[2] = (str_size >> 8) & 0xFF;
-        frame->buffer[3] = (str_size     ) & 0xFF;
+            response->buffer = (uint8_t *)realloc(response->buffer, buffer_size);
+            response->buffer_size = buffer_size;
+        }
     }
-    else
+
+    memcpy(&response->buffer[response->buffer_end], header, header_size);
+    memcpy(&response->buffer[response->buffer_end + header_size], data, data_size);
+
+    // socket is armed by the first frame in the buffer
+    if(response->is_ready && pending == 0)
+        asc_socket_set_on_ready(client->sock, on_websocket_ready);
+
+    response->buffer_end += frame_size;
+    return true;
+}
+
+/* Stack: 1 - server, 2 - client, 3 - response */
+static void on_websocket_send(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+
+    size_t str_size = 0;
+    const char *str = lua_tolstring(lua, 3, &str_size);
+    if(!str)
+        return;
+
+    uint8_t header[FRAME_HEADER_MAX];
+    const size_t header_size = frame_header(header, str_size);
+    frame_append(client, header, header_size, str, str_size);
+}
+
+/*
+ * oooooooooo  ooooooooooo      o      ooooooooo
+ *  888    888  888    88      888      888    88o
+ *  888oooo88   888ooo8       8  88     888    888
+ *  888  88o    888    oo    8oooo88    888    888
+ * o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+/* XOR with the frame key, 8 bytes per step */
+static void frame_unmask(uint8_t *data, size_t size, const uint8_t *key, uint8_t *key_i)
+{
+    const uint8_t k = *key_i;
+
+    uint8_t mask[8];
+    for(int i = 0; i < 8; ++i)
+        mask[i] = key[(k + i) & 3];
+
+    uint64_t mask64;
+    memcpy(&mask64, mask, sizeof(mask64));
+
+    size_t skip = 0;
+    for(; skip + sizeof(uint64_t) <= size; skip += sizeof(uint64_t))
     {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
-
-        frame->buffer[1] = 127;
-        frame->buffer[2] = 0;
-        frame->buffer[3] = 0;
-        frame->buffer[4] = 0;
-        frame->buffer[5] = 0;
-        frame->buffer[6] = (str_size >> 24) & 0xFF;
-        frame->buffer[7] = (str_size >> 16) & 0xFF;
-        frame->buffer[8] = (str_size >> 8 ) & 0xFF;
-        frame->buffer[9] = (str_size      ) & 0xFF;
+        uint64_t value;
+        memcpy(&value, &data[skip], sizeof(value));
+        value ^= mask64;
+        memcpy(&data[skip], &value, sizeof(value));
     }
 
-    frame->buffer[0] = 0x81;
-    memcpy(&frame->buffer[frame->size], str, str_size);
-    frame->size += str_size;
-    frame->skip = 0;
+    for(; skip < size; ++skip)
+        data[skip] ^= mask[skip & 7];
 
-    asc_list_insert_tail(response->frame_queue, frame);
-    if(asc_list_size(response->frame_queue) == 1)
-        asc_socket_set_on_ready(client->sock, on_websocket_ready);
+    *key_i = (k + size) & 3;
 }
 
 static void on_websocket_read(void *arg)
@@ -245,14 +380,7 @@ static void on_websocket_read(void *arg)
         return;
     }
 
-    // TODO: SSE
-    uint32_t skip = 0;
-    while(skip < (uint32_t)size)
-    {
-        data[skip] ^= response->frame_key[response->frame_key_i];
-        ++skip;
-        response->frame_key_i = (response->frame_key_i + 1) % 4;
-    }
+    frame_unmask(data, size, response->frame_key, &response->frame_key_i);
 
     if(response->data_size == (uint32_t)size)
     {
@@ -300,6 +428,123 @@ static void on_websocket_read(void *arg)
     }
 }
 
+/*
+ * ooooooooooo  ooooooo  oooooooooo ooooo  oooooooo8
+ * 88  888  88 o888   888o 888    888 888 o888     88
+ *     888     888     888 888oooo88  888 888
+ *     888     888o   o888 888        888 888o     oo
+ *    o888o      88ooo88  o888o      o888o 888oooo88
+ *
+ */
+
+http_websocket_topic_t * http_websocket_topic_open(const char *name)
+{
+    if(!topic_list)
+        topic_list = asc_list_init();
+
+    asc_list_for(topic_list)
+    {
+        http_websocket_topic_t *topic = (http_websocket_topic_t *)asc_list_data(topic_list);
+        if(!strcmp(topic->name, name))
+        {
+            ++topic->refcount;
+            return topic;
+        }
+    }
+
+    http_websocket_topic_t *topic =
+        (http_websocket_topic_t *)calloc(1, sizeof(http_websocket_topic_t));
+    topic->refcount = 1;
+    topic->name = strdup(name);
+    topic->clients = asc_list_init();
+    asc_list_insert_tail(topic_list, topic);
+
+    return topic;
+}
+
+void http_websocket_topic_close(http_websocket_topic_t *topic)
+{
+    --topic->refcount;
+    if(topic->refcount > 0)
+        return;
+
+    asc_list_remove_item(topic_list, topic);
+    asc_list_destroy(topic->clients);
+    free(topic->name);
+    free(topic);
+
+    if(asc_list_size(topic_list) == 0)
+        ASC_FREE(topic_list, asc_list_destroy);
+}
+
+void http_websocket_publish(  http_websocket_topic_t *topic
+                            , const char *data, size_t size)
+{
+    if(asc_list_size(topic->clients) == 0)
+        return;
+
+    uint8_t header[FRAME_HEADER_MAX];
+    const size_t header_size = frame_header(header, size);
+
+    asc_list_for(topic->clients)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(topic->clients);
+        frame_append(client, header, header_size, data, size);
+    }
+}
+
+static bool topic_subscribe(http_client_t *client, const char *name)
+{
+    http_response_t *response = client->response;
+
+    asc_list_for(response->topics)
+    {
+        const http_websocket_topic_t *topic =
+            (const http_websocket_topic_t *)asc_list_data(response->topics);
+        if(!strcmp(topic->name, name))
+            return false;
+    }
+
+    http_websocket_topic_t *topic = http_websocket_topic_open(name);
+    asc_list_insert_tail(topic->clients, client);
+    asc_list_insert_tail(response->topics, topic);
+
+    return true;
+}
+
+static void topic_unsubscribe(http_client_t *client, http_websocket_topic_t *topic)
+{
+    asc_list_remove_item(client->response->topics, topic);
+    asc_list_remove_item(topic->clients, client);
+    http_websocket_topic_close(topic);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  ooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static void response_free(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    while(asc_list_size(response->topics) > 0)
+    {
+        asc_list_first(response->topics);
+        topic_unsubscribe(client, (http_websocket_topic_t *)asc_list_data(response->topics));
+    }
+    asc_list_destroy(response->topics);
+
+    ASC_FREE(response->close_timer, asc_timer_destroy);
+    free(response->buffer);
+    free(response);
+    client->response = NULL;
+}
+
 static int module_call(module_data_t *mod)
 {
     http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
@@ -319,25 +564,18 @@ static int module_call(module_data_t *mod)
                 string_buffer_free(client->content);
                 client->content = NULL;
             }
-            if(client->response->frame_queue)
-            {
-                for(  asc_list_first(client->response->frame_queue)
-                    ; !asc_list_eol(client->response->frame_queue)
-                    ; asc_list_remove_current(client->response->frame_queue))
-                {
-                    frame_t *frame = (frame_t *)asc_list_data(client->response->frame_queue);
-                    free(frame->buffer);
-                    free(frame);
-                }
-                asc_list_destroy(client->response->frame_queue);
-                client->response->frame_queue = NULL;
-            }
-            free(client->response);
-            client->response = NULL;
+            response_free(client);
         }
         return 0;
     }
 
+    // connection upgrade is not defined for HTTP/2
+    if(client->h2_stream)
+    {
+        http_client_abort(client, 505, "websocket requires HTTP/1.1");
+        return 0;
+    }
+
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
     lua_getfield(lua, -1, "headers");
 
@@ -377,12 +615,12 @@ static int module_call(module_data_t *mod)
 
     lua_pop(lua, 2); // request + headers
 
-    client->response = calloc(1, sizeof(http_response_t));
+    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
     client->response->mod = mod;
-    client->response->frame_queue = asc_list_init();
+    client->response->topics = asc_list_init();
     client->on_send = on_websocket_send;
     client->on_read = on_websocket_read;
-    client->on_ready = NULL;
+    client->on_ready = on_websocket_ready;
 
     http_response_code(client, 101, "Switching Protocols");
     http_response_header(client, "Upgrade: websocket");
@@ -397,24 +635,11 @@ static int module_call(module_data_t *mod)
     return 0;
 }
 
-static int __module_call(lua_State *L)
-{
-    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
-    return module_call(mod);
-}
-
 static void module_init(module_data_t *mod)
 {
     lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
     asc_assert(lua_isfunction(lua, -1), "[http_websocket] option 'callback' is required");
     mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
-
-    // Set callback for http route
-    lua_getmetatable(lua, 3);
-    lua_pushlightuserdata(lua, (void *)mod);
-    lua_pushcclosure(lua, __module_call, 1);
-    lua_setfield(lua, -2, "__call");
-    lua_pop(lua, 1);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -426,9 +651,87 @@ static void module_destroy(module_data_t *mod)
     }
 }
 
+/* websocket client of the module or NULL */
+static http_client_t * lua_get_client(module_data_t *mod, int idx)
+{
+    if(!lua_islightuserdata(lua, idx))
+        return NULL;
+
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, idx);
+    if(   client->on_send != on_websocket_send
+       || !client->response
+       || client->response->mod != mod)
+    {
+        return NULL;
+    }
+
+    return client;
+}
+
+/* Stack: 1 - instance, 2 - client, 3 - topic */
+static int method_subscribe(module_data_t *mod)
+{
+    http_client_t *client = lua_get_client(mod, 2);
+    asc_assert(client != NULL, MSG(":subscribe() websocket client required"));
+    const char *name = luaL_checkstring(lua, 3);
+
+    lua_pushboolean(lua, topic_subscribe(client, name));
+    return 1;
+}
+
+/* Stack: 1 - instance, 2 - client, 3 - topic */
+static int method_unsubscribe(module_data_t *mod)
+{
+    http_client_t *client = lua_get_client(mod, 2);
+    if(!client)
+        return 0; // client is closed
+    const char *name = luaL_checkstring(lua, 3);
+
+    asc_list_for(client->response->topics)
+    {
+        http_websocket_topic_t *topic =
+            (http_websocket_topic_t *)asc_list_data(client->response->topics);
+        if(!strcmp(topic->name, name))
+        {
+            topic_unsubscribe(client, topic);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Stack: 1 - instance, 2 - topic, 3 - message */
+static int method_publish(module_data_t *mod)
+{
+    __uarg(mod);
+
+    const char *name = luaL_checkstring(lua, 2);
+    size_t size = 0;
+    const char *data = luaL_checklstring(lua, 3, &size);
+
+    if(!topic_list)
+        return 0;
+
+    asc_list_for(topic_list)
+    {
+        http_websocket_topic_t *topic = (http_websocket_topic_t *)asc_list_data(topic_list);
+        if(!strcmp(topic->name, name))
+        {
+            http_websocket_publish(topic, data, size);
+            break;
+        }
+    }
+
+    return 0;
+}
+
 MODULE_LUA_METHODS()
 {
-    { NULL, NULL }
+    { "__call", module_call },
+    { "subscribe", method_subscribe },
+    { "unsubscribe", method_unsubscribe },
+    { "publish", method_publish }
 };
 
 MODULE_LUA_REGISTER(http_websocket)
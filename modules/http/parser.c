@@ -63,28 +63,74 @@ bool parse_skip_space(const char *str, size_t size, size_t *skip)
 }
 
 bool parse_skip_line(const char *str, size_t size, size_t *skip)
+{
+    const size_t _skip = *skip;
+    if(_skip >= size)
+        return false;
+
+    const char *eol = (const char *)memchr(&str[_skip], '\n', size - _skip);
+    if(!eol)
+        return false;
+
+    const size_t line_end = eol - str;
+
+    // '\r' is allowed only before '\n'
+    if(   line_end > _skip
+       && memchr(&str[_skip], '\r', line_end - _skip - 1) != NULL)
+    {
+        return false;
+    }
+
+    *skip = line_end + 1;
+    return true;
+}
+
+size_t http_parse_eoh(const char *str, size_t size, size_t *skip)
 {
     size_t _skip = *skip;
 
     while(_skip < size)
     {
-        switch(str[_skip])
+        const char *eol = (const char *)memchr(&str[_skip], '\n', size - _skip);
+        if(!eol)
         {
-            case '\n':
-                *skip = _skip + 1;
-                return true;
-            case '\r':
-                if(_skip + 1 >= size || str[_skip + 1] != '\n')
-                    return false;
-                *skip = _skip + 2;
-                return true;
-            default:
-                ++_skip;
+            _skip = size;
+            break;
+        }
+
+        const size_t lf = eol - str;
+        if(lf + 1 >= size)
+        {
+            _skip = lf; // check again with more data
+            break;
+        }
+
+        if(str[lf + 1] == '\n')
+        {
+            *skip = 0;
+            return lf + 2;
+        }
+
+        if(str[lf + 1] == '\r')
+        {
+            if(lf + 2 >= size)
+            {
+                _skip = lf;
                 break;
+            }
+
+            if(str[lf + 2] == '\n' && lf > 0 && str[lf - 1] == '\r')
+            {
+                *skip = 0;
+                return lf + 3;
+            }
         }
+
+        _skip = lf + 1;
     }
 
-    return false;
+    *skip = _skip;
+    return 0;
 }
 
 /*
@@ -186,7 +232,6 @@ bool http_parse_request(const char *str, size_t size, parse_match_t *match)
 
 bool http_parse_header(const char *str, size_t size, parse_match_t *match)
 {
-    size_t skip = 0;
     match[0].so = 0;
     match[1].so = 0;
     match[1].eo = 0;
@@ -194,50 +239,36 @@ bool http_parse_header(const char *str, size_t size, parse_match_t *match)
     if(size == 0)
         return false;
 
-    while(1)
+    // eol
+    if(str[0] == '\n')
     {
-        if(skip >= size)
+        match[0].eo = 1;
+        return true;
+    }
+    else if(str[0] == '\r')
+    {
+        if(size < 2 || str[1] != '\n')
             return false;
 
-        const char c = str[skip];
-        if(c == ':')
-            break;
-        else if(c == '\n')
-        {
-            if(skip > 0)
-                return false;
-
-            // eol
-            match[1].eo = 0;
-            match[0].eo = skip + 1;
-            return true;
-        }
-        else if(c == '\r')
-        {
-            if(skip > 0)
-                return false;
-            if(skip + 1 >= size || str[skip + 1] != '\n')
-                return false;
-
-            // eol
-            match[1].eo = 0;
-            match[0].eo = skip + 2;
-            return true;
-        }
-
-        ++skip;
+        match[0].eo = 2;
+        return true;
     }
-    match[1].eo = skip;
 
-    // parse value
-    match[2].so = match[1].eo + 1; // skip ':'
-    if(!parse_skip_space(str, size, &match[2].so))
+    size_t skip = 0;
+    if(!parse_skip_line(str, size, &skip))
         return false;
 
-    skip = match[2].so;
-    if(!parse_skip_line(str, size, &skip))
+    const size_t line_size = parse_get_line_size(str, skip);
+    const char *colon = (const char *)memchr(str, ':', line_size);
+    if(!colon)
         return false;
-    match[2].eo = parse_get_line_size(str, skip);
+    match[1].eo = colon - str;
+
+    // parse value
+    match[2].so = match[1].eo + 1; // skip ':'
+    while(match[2].so < line_size && (str[match[2].so] == ' ' || str[match[2].so] == '\t'))
+        ++match[2].so;
+    match[2].eo = line_size;
 
     match[0].eo = skip;
     return true;
@@ -35,6 +35,12 @@ bool parse_skip_line(const char *str, size_t size, size_t *skip);
 #define parse_get_line_size(_str, _skip)                                                        \
     (((_skip >= 2) && (_str[_skip - 2] == '\r')) ? (_skip - 2) : (_skip - 1))
 
+/*
+ * searches the empty line from *skip. returns size of the headers or 0.
+ * *skip keeps the position to resume the search when more data is received
+ */
+size_t http_parse_eoh(const char *str, size_t size, size_t *skip);
+
 bool http_parse_request(const char *, size_t size, parse_match_t *);
 bool http_parse_response(const char *, size_t size, parse_match_t *);
 bool http_parse_header(const char *, size_t size, parse_match_t *);
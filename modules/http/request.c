@@ -32,7 +32,14 @@
  *      content     - string, request content
  *      stream      - boolean, true to read MPEG-TS stream
  *      sync        - boolean or number, enable stream synchronization
+ *      flow_control
+ *                  - boolean, with sync. slow down the playout while the sinks
+ *                    are full instead of the drop, the socket reading is
+ *                    paused when the sync buffer is full
  *      sctp        - boolean, use sctp instead of tcp
+ *      pool        - boolean, take an idle connection to the same host and port
+ *                    and return the connection after the complete response.
+ *                    not used with stream, upstream and sctp. default: true
  *      timeout     - number, request timeout
  *      callback    - function,
  *      upstream    - object, stream instance returned by module_instance:stream()
@@ -55,6 +62,8 @@ struct module_data_t
         int port;
         const char *path;
         bool sync;
+        bool sctp;
+        bool flow_control;
     } config;
 
     int timeout_ms;
@@ -64,6 +73,13 @@ struct module_data_t
 
     asc_socket_t *sock;
     asc_timer_t *timeout;
+    asc_resolve_t *resolve;
+
+    // connection pool
+    bool is_pool;
+    bool is_reused; // connection is taken from the pool
+    bool is_keep_alive; // both sides allow the next request
+    bool is_reusable; // response is complete, connection may be returned to the pool
 
     bool is_socket_busy;
 
@@ -77,6 +93,7 @@ struct module_data_t
         size_t size;
 
         int idx_body;
+        bool is_content;
     } request;
 
     bool is_head;
@@ -86,6 +103,7 @@ struct module_data_t
     // response
     char buffer[HTTP_BUFFER_SIZE];
     size_t buffer_skip;
+    size_t eoh_skip; // end of headers search position
     size_t chunk_left;
 
     int idx_response;
@@ -112,10 +130,6 @@ struct module_data_t
     } receiver;
 
     // stream
-    bool is_thread_started;
-    asc_thread_t *thread;
-    asc_thread_buffer_t *thread_output;
-
     struct
     {
         uint8_t *buffer;
@@ -124,8 +138,31 @@ struct module_data_t
         size_t buffer_read;
         size_t buffer_write;
         size_t buffer_fill;
+
+        bool is_started; // stream is paced by the sync scheduler
+        bool is_paused; // buffer is full, socket reading is stopped
+        bool reset;
+
+        // current block
+        size_t next_block;
+        uint32_t ts_count; // packets left in the block
+        uint32_t ts_sync; // time per packet
+        uint32_t block_time_tail;
+        uint64_t block_time_total; // time of the next packet
     } sync;
 
+    // stream framing: de-chunking and TS sync before the stream or the sync buffer
+    struct
+    {
+        size_t skip; // unframed bytes at the begin of the framing buffer
+        bool is_synced;
+
+        size_t chunk_left;
+        char chunk_line[32];
+        size_t chunk_line_size;
+        bool is_last_chunk;
+    } frame;
+
     uint64_t pcr;
 };
 
@@ -194,18 +231,159 @@ void timeout_callback(void *arg)
     on_close(mod);
 }
 
-static void on_thread_close(void *arg);
+/*
+ * oooooooooo    ooooooo     ooooooo   ooooo
+ *  888    888 o888   888o o888   888o  888
+ *  888oooo88  888     888 888     888  888
+ *  888        888o   o888 888o   o888  888      o
+ * o888o         88ooo88     88ooo88   o888ooooo88
+ *
+ */
+
+/*
+ * Idle keep-alive connections, shared by all http_request instances.
+ * Connection is returned to the pool on close, if the response is complete
+ * and both sides allow the next request. Parked socket is closed if the
+ * server closes the connection, sends anything or the idle timer expires.
+ */
+
+#define HTTP_POOL_IDLE_TIMEOUT (15 * 1000)
+#define HTTP_POOL_HOST_LIMIT 16 // idle connections per host and port
+
+typedef struct
+{
+    char *host;
+    int port;
+
+    asc_socket_t *sock;
+    asc_timer_t *idle_timer;
+} http_pool_item_t;
+
+static asc_list_t *http_pool = NULL;
+
+static void pool_item_destroy(http_pool_item_t *item)
+{
+    asc_list_remove_item(http_pool, item);
+    if(asc_list_size(http_pool) == 0)
+        ASC_FREE(http_pool, asc_list_destroy);
+
+    ASC_FREE(item->idle_timer, asc_timer_destroy);
+    free(item->host);
+    free(item);
+}
+
+static void on_pool_close(void *arg)
+{
+    http_pool_item_t *item = (http_pool_item_t *)arg;
+
+    asc_socket_close(item->sock);
+    pool_item_destroy(item);
+}
+
+static bool pool_put(module_data_t *mod)
+{
+    size_t count = 0;
+    if(http_pool)
+    {
+        asc_list_for(http_pool)
+        {
+            http_pool_item_t *item = (http_pool_item_t *)asc_list_data(http_pool);
+            if(item->port == mod->config.port && !strcmp(item->host, mod->config.host))
+                ++count;
+        }
+    }
+    else
+        http_pool = asc_list_init();
+
+    if(count >= HTTP_POOL_HOST_LIMIT)
+        return false;
+
+    http_pool_item_t *item = (http_pool_item_t *)calloc(1, sizeof(http_pool_item_t));
+    item->host = strdup(mod->config.host);
+    item->port = mod->config.port;
+    item->sock = mod->sock;
+
+    asc_socket_set_arg(item->sock, item);
+    asc_socket_set_on_ready(item->sock, NULL);
+    asc_socket_set_on_read(item->sock, on_pool_close);
+    asc_socket_set_on_close(item->sock, on_pool_close);
+    item->idle_timer = asc_timer_init(HTTP_POOL_IDLE_TIMEOUT, on_pool_close, item);
+
+    /* most recent connection is taken first, others are expired */
+    asc_list_insert_head(http_pool, item);
+
+    return true;
+}
+
+static asc_socket_t * pool_get(module_data_t *mod)
+{
+    if(!http_pool)
+        return NULL;
+
+    asc_list_for(http_pool)
+    {
+        http_pool_item_t *item = (http_pool_item_t *)asc_list_data(http_pool);
+        if(item->port != mod->config.port || strcmp(item->host, mod->config.host))
+            continue;
+
+        asc_socket_t *sock = item->sock;
+        pool_item_destroy(item);
+
+        asc_socket_set_on_read(sock, NULL);
+        asc_socket_set_on_close(sock, NULL);
+        asc_socket_set_arg(sock, mod);
+
+        return sock;
+    }
+
+    return NULL;
+}
+
+static void sync_stop(module_data_t *mod);
+static void connect_start(module_data_t *mod, bool is_pool);
 
 static void on_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    if(mod->thread)
-        on_thread_close(mod);
+    sync_stop(mod);
+
+    if(mod->resolve)
+    {
+        asc_resolve_cancel(mod->resolve);
+        mod->resolve = NULL;
+    }
 
     if(!mod->sock)
         return;
 
+    if(   mod->is_reused
+       && mod->request.status > 0
+       && !mod->request.is_content
+       && mod->status == 0
+       && mod->buffer_skip == 0)
+    {
+        /* idle connection is closed by the server before the response.
+         * request is repeated on a new connection */
+        mod->is_reused = false;
+        ASC_FREE(mod->sock, asc_socket_close);
+
+        if(mod->request.status == 1)
+            free((void *)mod->request.buffer);
+        mod->request.buffer = NULL;
+        mod->request.status = 0;
+
+        if(mod->timeout)
+            asc_timer_destroy(mod->timeout);
+        mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
+
+        connect_start(mod, false);
+        return;
+    }
+
+    const bool is_reusable = (mod->is_reusable && !mod->receiver.callback.ptr);
+    mod->is_reusable = false;
+
     if(mod->receiver.callback.ptr)
     {
         mod->receiver.callback.fn(mod->receiver.arg, NULL, 0);
@@ -214,7 +392,8 @@ static void on_close(void *arg)
         mod->receiver.callback.ptr = NULL;
     }
 
-    asc_socket_close(mod->sock);
+    if(!is_reusable || !pool_put(mod))
+        asc_socket_close(mod->sock);
     mod->sock = NULL;
 
     if(mod->timeout)
@@ -272,7 +451,7 @@ static void on_close(void *arg)
 
     if(mod->sync.buffer)
     {
-        free(mod->sync.buffer);
+        asc_ring_free(mod->sync.buffer, mod->sync.buffer_size);
         mod->sync.buffer = NULL;
     }
 
@@ -301,6 +480,23 @@ static void on_close(void *arg)
     }
 }
 
+static void on_read(void *arg);
+
+/* connection error, socket is not returned to the pool */
+static void on_error(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    mod->is_reusable = false;
+
+    /* server is closed the connection after the response,
+     * the rest of the content is still in the socket */
+    while(mod->sock && mod->status == 2 && mod->content)
+        on_read(mod);
+
+    if(mod->sock)
+        on_close(mod);
+}
+
 /*
  *  oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
  * 888        88  888  88  888    888  888    88      888      8888o   888
@@ -310,296 +506,507 @@ static void on_close(void *arg)
  *
  */
 
+/* the sync buffer is aligned by the framing, packets are not wrapped */
 static bool seek_pcr(  module_data_t *mod
                      , size_t *block_size, size_t *next_block
                      , uint64_t *pcr)
 {
-    size_t count;
+    size_t skip = mod->sync.buffer_read + TS_PACKET_SIZE;
+    if(skip >= mod->sync.buffer_size)
+        skip = 0;
+
+    for(  size_t count = TS_PACKET_SIZE
+        ; count < mod->sync.buffer_count
+        ; count += TS_PACKET_SIZE)
+    {
+        const uint8_t *ts = &mod->sync.buffer[skip];
+        if(TS_IS_PCR(ts))
+        {
+            *block_size = count;
+            *next_block = skip;
+            *pcr = TS_GET_PCR(ts);
+
+            return true;
+        }
+
+        skip += TS_PACKET_SIZE;
+        if(skip >= mod->sync.buffer_size)
+            skip = 0;
+    }
+
+    return false;
+}
+
+/*
+ * Synced streams are paced on the main loop. One scheduler timer serves
+ * all of them: on each tick every stream sends packets of the current
+ * PCR block which are due by now. Socket reading stops while the buffer
+ * is full and continues when the paced packets free the space.
+ */
+
+#define HTTP_SYNC_INTERVAL 1 // ms
+
+typedef struct
+{
+    asc_list_t *list;
+    asc_timer_t *timer;
+} http_sync_t;
+
+static http_sync_t http_sync = { NULL, NULL };
+
+static void on_sync_read(void *arg);
+
+/* no space for the framing buffer and the next packet */
+static inline bool sync_is_full(const module_data_t *mod)
+{
+    return (mod->sync.buffer_size - mod->sync.buffer_count < mod->frame.skip + TS_PACKET_SIZE);
+}
 
-    while(1)
+static void sync_buffering(module_data_t *mod)
+{
+    asc_log_info(MSG("buffering..."));
+
+    mod->sync.buffer_count = 0;
+    mod->sync.buffer_write = 0;
+    mod->sync.buffer_read = 0;
+    mod->sync.ts_count = 0;
+
+    if(mod->sync.is_paused)
     {
-        if(mod->sync.buffer_count < 2 * TS_PACKET_SIZE)
+        mod->sync.is_paused = false;
+        asc_socket_set_on_read(mod->sock, on_sync_read);
+    }
+}
+
+/* sends count packets from the read position */
+static void sync_send_packets(module_data_t *mod, uint32_t count)
+{
+    while(count > 0)
+    {
+        size_t batch = (mod->sync.buffer_size - mod->sync.buffer_read) / TS_PACKET_SIZE;
+        if(batch > count)
+            batch = count;
+
+        module_stream_send_batch(mod, &mod->sync.buffer[mod->sync.buffer_read], batch);
+
+        mod->sync.buffer_read += batch * TS_PACKET_SIZE;
+        if(mod->sync.buffer_read >= mod->sync.buffer_size)
+            mod->sync.buffer_read = 0;
+        count -= batch;
+    }
+}
+
+/* returns false if the stream should be buffered again */
+static bool sync_next_block(module_data_t *mod)
+{
+    while(true)
+    {
+        size_t block_size = 0, next_block = 0;
+        uint64_t pcr;
+
+        if(!seek_pcr(mod, &block_size, &next_block, &pcr))
+        {
+            asc_log_error(MSG("next PCR is not found"));
             return false;
+        }
+
+        const uint64_t block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
+        mod->pcr = pcr;
+        if(block_time == 0 || block_time > 500000)
+        {
+            asc_log_debug(  MSG("block time out of range: %"PRIu64"ms block_size:%lu")
+                          , (uint64_t)(block_time / 1000), block_size);
 
-        count = mod->sync.buffer_read + TS_PACKET_SIZE;
-        if(count >= mod->sync.buffer_size)
-            count -= mod->sync.buffer_size;
+            mod->sync.buffer_count -= block_size;
+            mod->sync.buffer_read = next_block;
+            mod->sync.reset = true;
+            continue;
+        }
 
-        if(   mod->sync.buffer[mod->sync.buffer_read] == 0x47
-           && mod->sync.buffer[count] == 0x47)
+        if(mod->sync.reset)
         {
-            break;
+            mod->sync.reset = false;
+            mod->sync.block_time_total = asc_utime();
         }
 
-        ++mod->sync.buffer_read;
-        if(mod->sync.buffer_read >= mod->sync.buffer_size)
-            mod->sync.buffer_read = 0;
+        mod->sync.next_block = next_block;
+        mod->sync.ts_count = block_size / TS_PACKET_SIZE;
+        mod->sync.ts_sync = block_time / mod->sync.ts_count;
+        mod->sync.block_time_tail = block_time % mod->sync.ts_count;
 
-        --mod->sync.buffer_count;
+        return true;
     }
+}
 
-    uint8_t *ptr, ts[TS_PACKET_SIZE];
+/* returns false if the stream should be buffered again */
+static bool sync_send(module_data_t *mod, uint64_t now)
+{
+    while(true)
+    {
+        if(!mod->sync.ts_count && !sync_next_block(mod))
+            return false;
 
-    size_t next_skip, skip = mod->sync.buffer_read + TS_PACKET_SIZE;
-    if(skip >= mod->sync.buffer_size)
-        skip -= mod->sync.buffer_size;
+        if(mod->sync.block_time_total > now)
+            break;
 
-    for(  count = TS_PACKET_SIZE
-        ; count < mod->sync.buffer_count
-        ; count += TS_PACKET_SIZE)
-    {
-        ptr = &mod->sync.buffer[skip];
+        uint32_t count = 1;
+        if(mod->sync.ts_sync > 0)
+            count += (now - mod->sync.block_time_total) / mod->sync.ts_sync;
+        if(count > mod->sync.ts_count)
+            count = mod->sync.ts_count;
 
-        next_skip = skip + TS_PACKET_SIZE;
-        if(next_skip > mod->sync.buffer_size)
+        bool is_limited = false;
+        if(mod->config.flow_control)
         {
-            const size_t packet_head = mod->sync.buffer_size - skip;
-            memcpy(ts, ptr, packet_head);
-            next_skip -= mod->sync.buffer_size;
-            memcpy(&ts[packet_head], mod->sync.buffer, next_skip);
-            ptr = ts;
+            const size_t credit = module_stream_credit(mod);
+            if(credit < count)
+            {
+                // the sync timer polls the credit, on_credit is not required
+                module_stream_wait(mod, NULL);
+                count = credit;
+                is_limited = true;
+            }
         }
 
-        if(TS_IS_PCR(ptr))
+        sync_send_packets(mod, count);
+        mod->sync.buffer_count -= count * TS_PACKET_SIZE;
+        mod->sync.ts_count -= count;
+        mod->sync.block_time_total += (uint64_t)count * mod->sync.ts_sync;
+
+        if(is_limited)
         {
-            *block_size = count;
-            *next_block = skip;
-            *pcr = TS_GET_PCR(ptr);
+            // the clock waits for the sinks instead of the burst on the next tick
+            mod->sync.block_time_total = now + mod->sync.ts_sync;
+            break;
+        }
 
-            return true;
+        if(mod->sync.ts_count > 0)
+            break;
+
+        // block is completed
+        mod->sync.buffer_read = mod->sync.next_block;
+        mod->sync.block_time_total += mod->sync.block_time_tail;
+
+        if(now > mod->sync.block_time_total + 100000)
+        {
+            asc_log_warning(  MSG("wrong syncing time. -%"PRIu64"ms")
+                            , (now - mod->sync.block_time_total) / 1000);
+            mod->sync.reset = true;
         }
+    }
 
-        skip = (next_skip == mod->sync.buffer_size) ? 0 : next_skip;
+    if(mod->sync.is_paused && !sync_is_full(mod))
+    {
+        mod->sync.is_paused = false;
+        asc_socket_set_on_read(mod->sock, on_sync_read);
     }
 
-    return false;
+    return true;
 }
 
-static void on_thread_close(void *arg)
+static void on_sync_timer(void *arg)
 {
-    module_data_t *mod = (module_data_t *)arg;
+    __uarg(arg);
 
-    mod->is_thread_started = false;
+    const uint64_t now = asc_utime();
 
-    if(mod->thread)
+    asc_list_first(http_sync.list);
+    while(!asc_list_eol(http_sync.list))
     {
-        asc_thread_destroy(mod->thread);
-        mod->thread = NULL;
+        module_data_t *mod = (module_data_t *)asc_list_data(http_sync.list);
+        if(!sync_send(mod, now))
+        {
+            mod->sync.is_started = false;
+            asc_list_remove_current(http_sync.list);
+            sync_buffering(mod);
+            continue;
+        }
+        asc_list_next(http_sync.list);
     }
 
-    if(mod->thread_output)
+    if(!asc_list_size(http_sync.list))
     {
-        asc_thread_buffer_destroy(mod->thread_output);
-        mod->thread_output = NULL;
+        ASC_FREE(http_sync.timer, asc_timer_destroy);
+        ASC_FREE(http_sync.list, asc_list_destroy);
     }
-
-    on_close(mod);
 }
 
-static void on_thread_read(void *arg)
+static void sync_start(module_data_t *mod)
 {
-    module_data_t *mod = (module_data_t *)arg;
+    size_t block_size = 0, next_block = 0;
+    if(!seek_pcr(mod, &block_size, &next_block, &mod->pcr))
+    {
+        asc_log_error(MSG("first PCR is not found"));
+        sync_buffering(mod);
+        return;
+    }
+
+    mod->sync.buffer_count -= block_size;
+    mod->sync.buffer_read = next_block;
+    mod->sync.ts_count = 0;
+    mod->sync.reset = true;
 
-    uint8_t ts[TS_PACKET_SIZE];
-    const ssize_t r = asc_thread_buffer_read(mod->thread_output, ts, sizeof(ts));
-    if(r == sizeof(ts))
-        module_stream_send(mod, ts);
+    if(!http_sync.list)
+    {
+        http_sync.list = asc_list_init();
+        http_sync.timer = asc_timer_init(HTTP_SYNC_INTERVAL, on_sync_timer, NULL);
+    }
+
+    mod->sync.is_started = true;
+    asc_list_insert_tail(http_sync.list, mod);
 }
 
-static void thread_loop(void *arg)
+static void sync_stop(module_data_t *mod)
 {
-    module_data_t *mod = (module_data_t *)arg;
+    if(!mod->sync.is_started)
+        return;
 
-    uint8_t *ptr, ts[TS_PACKET_SIZE];
+    mod->sync.is_started = false;
+    asc_list_remove_item(http_sync.list, mod);
+}
 
-    mod->is_thread_started = true;
+/*
+ * ooooooooooo oooooooooo       o      oooo     oooo ooooo oooo   oooo  ooooooo8
+ *  888    88   888    888     888      8888o   888   888   8888o  88 o888    88
+ *  888ooo8     888oooo88     8  88     88 888o8 88   888   88 888o88 888    oooo
+ *  888         888  88o     8oooo88    88  888  88   888   88   8888 888o    88
+ * o888o       o888o  88o8 o88o  o888o o88o  8  o88o o888o o88o    88  888ooo888
+ *
+ * Received data is de-chunked in place, then aligned packets are found
+ * with memchr() and sent to the stream (or the sync buffer) as runs.
+ * Only chunk headers and the resync are checked byte by byte.
+ */
 
-    while(mod->is_thread_started)
-    {
-        // block sync
-        uint64_t   pcr
-                 , system_time, system_time_check
-                 , block_time, block_time_total = 0;
-        size_t block_size = 0, next_block;
+/* removes chunk headers in place, returns payload size or -1 on error */
+static ssize_t frame_dechunk(module_data_t *mod, uint8_t *buffer, size_t size)
+{
+    size_t skip = 0, payload = 0;
 
-        bool reset = true;
+    while(skip < size && !mod->frame.is_last_chunk)
+    {
+        if(mod->frame.chunk_left > 0)
+        {
+            size_t len = size - skip;
+            if(len > mod->frame.chunk_left)
+                len = mod->frame.chunk_left;
 
-        asc_log_info(MSG("buffering..."));
+            if(payload != skip)
+                memmove(&buffer[payload], &buffer[skip], len);
 
-        // flush
-        mod->sync.buffer_count = 0;
-        mod->sync.buffer_write = 0;
-        mod->sync.buffer_read = 0;
+            payload += len;
+            skip += len;
+            mod->frame.chunk_left -= len;
+            continue;
+        }
 
-        // check timeout
-        system_time_check = asc_utime();
+        // chunk header, CRLF of the previous chunk is an empty line
+        const char c = buffer[skip++];
+        if(c == '\r')
+            continue;
 
-        while(   mod->is_thread_started
-              && mod->sync.buffer_write < mod->sync.buffer_size)
+        if(c != '\n')
         {
-            system_time = asc_utime();
-
-            const ssize_t size = asc_socket_recv(  mod->sock
-                                                 , &mod->sync.buffer[mod->sync.buffer_write]
-                                                 , mod->sync.buffer_size - mod->sync.buffer_write);
-            if(size > 0)
-            {
-                system_time_check = system_time;
-                mod->sync.buffer_write += size;
-            }
-            else
-            {
-                if(system_time - system_time_check >= (uint32_t)mod->timeout_ms * 1000)
-                {
-                    asc_log_error(MSG("receiving timeout"));
-                    return;
-                }
-                asc_usleep(1000);
-            }
+            if(mod->frame.chunk_line_size >= sizeof(mod->frame.chunk_line))
+                return -1;
+            mod->frame.chunk_line[mod->frame.chunk_line_size++] = c;
+            continue;
         }
-        mod->sync.buffer_count = mod->sync.buffer_write;
-        if(mod->sync.buffer_write == mod->sync.buffer_size)
-            mod->sync.buffer_write = 0;
 
-        if(!seek_pcr(mod, &block_size, &next_block, &mod->pcr))
+        const size_t line_size = mod->frame.chunk_line_size;
+        mod->frame.chunk_line_size = 0;
+        if(!line_size)
+            continue;
+
+        size_t chunk_size = 0, i = 0;
+        for(; i < line_size; ++i)
         {
-            asc_log_error(MSG("first PCR is not found"));
-            return;
+            const char h = mod->frame.chunk_line[i];
+            if(h >= '0' && h <= '9')
+                chunk_size = (chunk_size << 4) | (h - '0');
+            else if(h >= 'a' && h <= 'f')
+                chunk_size = (chunk_size << 4) | (h - 'a' + 0x0A);
+            else if(h >= 'A' && h <= 'F')
+                chunk_size = (chunk_size << 4) | (h - 'A' + 0x0A);
+            else
+                break;
         }
+        if(i == 0 || (i < line_size && mod->frame.chunk_line[i] != ';'))
+            return -1;
 
-        mod->sync.buffer_count -= block_size;
-        mod->sync.buffer_read = next_block;
+        if(!chunk_size)
+            mod->frame.is_last_chunk = true;
+        mod->frame.chunk_left = chunk_size;
+    }
 
-        reset = true;
+    return payload;
+}
 
-        while(mod->is_thread_started)
-        {
-            if(reset)
-            {
-                reset = false;
-                block_time_total = asc_utime();
-            }
+static void frame_emit(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    if(!mod->config.sync)
+    {
+        module_stream_send_batch(mod, ts, count);
+        return;
+    }
 
-            if(   mod->is_thread_started
-               && mod->sync.buffer_count < mod->sync.buffer_size)
-            {
-                const size_t tail = (mod->sync.buffer_read > mod->sync.buffer_write)
-                                  ? (mod->sync.buffer_read - mod->sync.buffer_write)
-                                  : (mod->sync.buffer_size - mod->sync.buffer_write);
-
-                const ssize_t l = asc_socket_recv(  mod->sock
-                                                  , &mod->sync.buffer[mod->sync.buffer_write]
-                                                  , tail);
-                if(l > 0)
-                {
-                    mod->sync.buffer_write += l;
-                    if(mod->sync.buffer_write >= mod->sync.buffer_size)
-                        mod->sync.buffer_write = 0;
-                    mod->sync.buffer_count += l;
-                }
-            }
+    // sync buffer size is aligned, runs are split on the packet boundary
+    size_t size = count * TS_PACKET_SIZE;
+    while(size > 0)
+    {
+        size_t tail = mod->sync.buffer_size - mod->sync.buffer_write;
+        if(tail > size)
+            tail = size;
+
+        memcpy(&mod->sync.buffer[mod->sync.buffer_write], ts, tail);
+        mod->sync.buffer_write += tail;
+        if(mod->sync.buffer_write >= mod->sync.buffer_size)
+            mod->sync.buffer_write = 0;
+        mod->sync.buffer_count += tail;
+
+        ts += tail;
+        size -= tail;
+    }
+}
 
-            // get PCR
-            if(!seek_pcr(mod, &block_size, &next_block, &pcr))
+/* sends aligned packets, returns size of the tail moved to the buffer begin */
+static size_t frame_packets(module_data_t *mod, uint8_t *buffer, size_t size)
+{
+    size_t skip = 0;
+
+    while(skip < size)
+    {
+        if(!mod->frame.is_synced)
+        {
+            const uint8_t *ptr = (const uint8_t *)memchr(&buffer[skip], 0x47, size - skip);
+            if(!ptr)
             {
-                asc_log_error(MSG("next PCR is not found"));
+                skip = size;
                 break;
             }
-            block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
-            mod->pcr = pcr;
-            if(block_time == 0 || block_time > 500000)
-            {
-                asc_log_debug(  MSG("block time out of range: %"PRIu64"ms block_size:%lu")
-                              , (uint64_t)(block_time / 1000), block_size);
 
-                mod->sync.buffer_count -= block_size;
-                mod->sync.buffer_read = next_block;
+            skip = ptr - buffer;
+            if(skip + TS_PACKET_SIZE >= size)
+                break; // wait for the next packet to check sync
 
-                reset = true;
+            if(buffer[skip + TS_PACKET_SIZE] != 0x47)
+            {
+                ++skip;
                 continue;
             }
 
-            system_time = asc_utime();
-            if(block_time_total > system_time + 100)
-                asc_usleep(block_time_total - system_time);
+            mod->frame.is_synced = true;
+        }
 
-            const uint32_t ts_count = block_size / TS_PACKET_SIZE;
-            const uint32_t ts_sync = block_time / ts_count;
-            const uint32_t block_time_tail = block_time % ts_count;
+        size_t count = 0;
+        const size_t limit = (size - skip) / TS_PACKET_SIZE;
+        while(count < limit && buffer[skip + count * TS_PACKET_SIZE] == 0x47)
+            ++count;
 
-            system_time_check = asc_utime();
+        // sync is lost inside the last packet of the run
+        if(count > 0 && count < limit)
+            --count;
 
-            while(mod->is_thread_started && mod->sync.buffer_read != next_block)
-            {
-                // sending
-                ptr = &mod->sync.buffer[mod->sync.buffer_read];
-                size_t next_packet = mod->sync.buffer_read + TS_PACKET_SIZE;
-                if(next_packet < mod->sync.buffer_size)
-                {
-                    mod->sync.buffer_read = next_packet;
-                }
-                else if(next_packet > mod->sync.buffer_size)
-                {
-                    const size_t packet_head = mod->sync.buffer_size - mod->sync.buffer_read;
-                    memcpy(ts, ptr, packet_head);
-                    mod->sync.buffer_read = next_packet - mod->sync.buffer_size;
-                    memcpy(&ts[packet_head], mod->sync.buffer, mod->sync.buffer_read);
-                    ptr = ts;
-                }
-                else /* next_packet == mod->sync.buffer_size */
-                {
-                    mod->sync.buffer_read = 0;
-                }
+        if(count > 0)
+        {
+            frame_emit(mod, &buffer[skip], count);
+            skip += count * TS_PACKET_SIZE;
+        }
 
-                const ssize_t write_size = asc_thread_buffer_write(  mod->thread_output
-                                                                   , ptr
-                                                                   , TS_PACKET_SIZE);
-                if(write_size != TS_PACKET_SIZE)
-                {
-                    // overflow
-                }
+        if(count < limit)
+        {
+            asc_log_debug(MSG("sync lost"));
+            mod->frame.is_synced = false;
+            ++skip;
+            continue;
+        }
 
-                system_time = asc_utime();
-                block_time_total += ts_sync;
+        break; // tail is not a complete packet
+    }
 
-                if(  (system_time < system_time_check) /* <-0s */
-                   ||(system_time > system_time_check + 1000000)) /* >+1s */
-                {
-                    asc_log_warning(MSG("system time changed"));
+    const size_t tail = size - skip;
+    if(tail > 0 && skip > 0)
+        memmove(buffer, &buffer[skip], tail);
 
-                    mod->sync.buffer_read = next_block;
+    return tail;
+}
 
-                    reset = true;
-                    break;
-                }
-                system_time_check = system_time;
+/* frames size bytes received after the framing tail, returns false on error */
+static bool frame_data(module_data_t *mod, uint8_t *buffer, size_t size)
+{
+    if(mod->is_chunked)
+    {
+        const ssize_t payload = frame_dechunk(mod, &buffer[mod->frame.skip], size);
+        if(payload < 0)
+        {
+            asc_log_error(MSG("invalid chunk"));
+            return false;
+        }
+        size = payload;
+    }
 
-                if(block_time_total > system_time + 100)
-                    asc_usleep(block_time_total - system_time);
-            }
-            mod->sync.buffer_count -= block_size;
+    mod->frame.skip = frame_packets(mod, buffer, mod->frame.skip + size);
 
-            if(reset)
-                continue;
+    if(mod->frame.is_last_chunk)
+    {
+        asc_log_warning(MSG("last chunk is received"));
+        return false;
+    }
 
-            system_time = asc_utime();
-            if(system_time > block_time_total + 100000)
-            {
-                asc_log_warning(  MSG("wrong syncing time. -%"PRIu64"ms")
-                                , (system_time - block_time_total) / 1000);
-                reset = true;
-            }
+    return true;
+}
 
-            block_time_total += block_time_tail;
-        }
+/* staging buffer of the framing: sync buffer is filled from the response buffer */
+static inline uint8_t * frame_buffer(module_data_t *mod, size_t *size)
+{
+    if(mod->config.sync)
+    {
+        *size = HTTP_BUFFER_SIZE;
+        return (uint8_t *)mod->buffer;
     }
+
+    *size = mod->sync.buffer_size;
+    return mod->sync.buffer;
+}
+
+static void on_sync_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    size_t buffer_size;
+    uint8_t *buffer = frame_buffer(mod, &buffer_size);
+
+    // framed data should fit in the sync buffer
+    size_t limit = mod->sync.buffer_size - mod->sync.buffer_count;
+    if(limit > buffer_size)
+        limit = buffer_size;
+
+    const ssize_t size = asc_socket_recv(  mod->sock
+                                         , &buffer[mod->frame.skip]
+                                         , limit - mod->frame.skip);
+    if(size <= 0 || !frame_data(mod, buffer, size))
+    {
+        on_close(mod);
+        return;
+    }
+
+    mod->is_active = true;
+
+    if(!sync_is_full(mod))
+        return;
+
+    mod->sync.is_paused = true;
+    asc_socket_set_on_read(mod->sock, NULL);
+
+    if(!mod->sync.is_started)
+        sync_start(mod);
 }
 
 static void check_is_active(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    if(mod->is_active)
+    // reading of the synced stream is stopped while the buffer is full
+    if(mod->is_active || mod->sync.is_paused)
     {
         mod->is_active = false;
         return;
@@ -613,44 +1020,19 @@ static void on_ts_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    ssize_t size = asc_socket_recv(  mod->sock
-                                   , &mod->sync.buffer[mod->sync.buffer_write]
-                                   , mod->sync.buffer_size - mod->sync.buffer_write);
-    if(size <= 0)
+    size_t buffer_size;
+    uint8_t *buffer = frame_buffer(mod, &buffer_size);
+
+    const ssize_t size = asc_socket_recv(  mod->sock
+                                         , &buffer[mod->frame.skip]
+                                         , buffer_size - mod->frame.skip);
+    if(size <= 0 || !frame_data(mod, buffer, size))
     {
         on_close(mod);
         return;
     }
 
     mod->is_active = true;
-    mod->sync.buffer_write += size;
-    mod->sync.buffer_read = 0;
-
-    while(1)
-    {
-        while(mod->sync.buffer[mod->sync.buffer_read] != 0x47)
-        {
-            ++mod->sync.buffer_read;
-            if(mod->sync.buffer_read >= mod->sync.buffer_write)
-            {
-                mod->sync.buffer_write = 0;
-                return;
-            }
-        }
-
-        const size_t next = mod->sync.buffer_read + TS_PACKET_SIZE;
-        if(next > mod->sync.buffer_write)
-        {
-            const size_t tail = mod->sync.buffer_write - mod->sync.buffer_read;
-            if(tail > 0)
-                memmove(mod->sync.buffer, &mod->sync.buffer[mod->sync.buffer_read], tail);
-            mod->sync.buffer_write = tail;
-            return;
-        }
-
-        module_stream_send(mod, &mod->sync.buffer[mod->sync.buffer_read]);
-        mod->sync.buffer_read += TS_PACKET_SIZE;
-    }
 }
 
 /*
@@ -677,6 +1059,7 @@ static void on_read(void *arg)
                                    , HTTP_BUFFER_SIZE - mod->buffer_skip);
     if(size <= 0)
     {
+        mod->is_reusable = false;
         on_close(mod);
         return;
     }
@@ -690,6 +1073,7 @@ static void on_read(void *arg)
     if(mod->status == 3)
     {
         asc_log_warning(MSG("received data after response"));
+        mod->is_reusable = false;
         return;
     }
 
@@ -699,26 +1083,10 @@ static void on_read(void *arg)
 
     if(mod->status == 0)
     {
-        // check empty line
-        while(skip < mod->buffer_skip)
-        {
-            if(   skip + 1 < mod->buffer_skip
-               && mod->buffer[skip + 0] == '\n' && mod->buffer[skip + 1] == '\n')
-            {
-                eoh = skip + 2;
-                mod->status = 1;
-                break;
-            }
-            else if(   skip + 3 < mod->buffer_skip
-                    && mod->buffer[skip + 0] == '\r' && mod->buffer[skip + 1] == '\n'
-                    && mod->buffer[skip + 2] == '\r' && mod->buffer[skip + 3] == '\n')
-            {
-                eoh = skip + 4;
-                mod->status = 1;
-                break;
-            }
-            ++skip;
-        }
+        // search continues from the last checked line
+        eoh = http_parse_eoh(mod->buffer, mod->buffer_skip, &mod->eoh_skip);
+        if(eoh > 0)
+            mod->status = 1;
 
         if(mod->status != 1)
             return;
@@ -757,6 +1125,10 @@ static void on_read(void *arg)
         lua_pushlstring(lua, &mod->buffer[m[1].so], m[1].eo - m[1].so);
         lua_setfield(lua, response, __version);
 
+        const bool is_http_1_1 = (   m[1].eo - m[1].so == sizeof(__default_version) - 1
+                                  && !strncmp(  &mod->buffer[m[1].so], __default_version
+                                              , sizeof(__default_version) - 1));
+
         mod->status_code = atoi(&mod->buffer[m[2].so]);
         lua_pushnumber(lua, mod->status_code);
         lua_setfield(lua, response, __code);
@@ -813,7 +1185,8 @@ static void on_read(void *arg)
         }
 
         lua_getfield(lua, headers, "content-length");
-        if(lua_isnumber(lua, -1))
+        const bool is_length = lua_isnumber(lua, -1);
+        if(is_length)
         {
             mod->chunk_left = lua_tonumber(lua, -1);
             if(mod->chunk_left > 0)
@@ -831,7 +1204,24 @@ static void on_read(void *arg)
         }
         lua_pop(lua, 1); // transfer-encoding
 
-        if(mod->is_content_length || mod->is_chunked)
+        mod->is_keep_alive = false;
+        if(   mod->is_pool
+           && !mod->is_connection_close
+           && mod->request.status == 3
+           && mod->status_code >= 200)
+        {
+            lua_getfield(lua, headers, "connection");
+            const char *connection = lua_isstring(lua, -1) ? lua_tostring(lua, -1) : NULL;
+            if(connection)
+                mod->is_keep_alive = (strcasecmp(connection, __keep_alive) == 0);
+            else
+                mod->is_keep_alive = is_http_1_1;
+            lua_pop(lua, 1); // connection
+        }
+
+        if(mod->is_content_length)
+            mod->content = string_buffer_alloc_size(mod->chunk_left);
+        else if(mod->is_chunked)
             mod->content = string_buffer_alloc();
 
         lua_pop(lua, 2); // headers + response
@@ -842,6 +1232,7 @@ static void on_read(void *arg)
            || (mod->status_code == 304))
         {
             mod->status = 3;
+            mod->is_reusable = (mod->is_keep_alive && mod->buffer_skip == skip);
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
             callback(mod);
@@ -862,36 +1253,48 @@ static void on_read(void *arg)
             lua_setfield(lua, -2, __stream);
             callback(mod);
 
-            mod->sync.buffer = (uint8_t *)malloc(mod->sync.buffer_size);
+            mod->sync.buffer = (uint8_t *)asc_ring_alloc(mod->sync.buffer_size, -1);
+            memset(&mod->frame, 0, sizeof(mod->frame));
 
-            if(!mod->config.sync)
-            {
-                mod->timeout = asc_timer_init(mod->timeout_ms, check_is_active, mod);
+            mod->timeout = asc_timer_init(mod->timeout_ms, check_is_active, mod);
+            asc_socket_set_on_ready(mod->sock, NULL);
 
-                asc_socket_set_on_read(mod->sock, on_ts_read);
-                asc_socket_set_on_ready(mod->sock, NULL);
-            }
-            else
+            if(mod->config.sync)
             {
-                asc_socket_set_on_read(mod->sock, NULL);
-                asc_socket_set_on_ready(mod->sock, NULL);
-                asc_socket_set_on_close(mod->sock, NULL);
-
-                mod->thread = asc_thread_init(mod);
-                mod->thread_output = asc_thread_buffer_init(mod->sync.buffer_size);
-                asc_thread_start(  mod->thread
-                                 , thread_loop
-                                 , on_thread_read, mod->thread_output
-                                 , on_thread_close);
+                asc_socket_set_on_read(mod->sock, on_sync_read);
+                sync_buffering(mod);
             }
+            else
+                asc_socket_set_on_read(mod->sock, on_ts_read);
 
+            // body received with the headers
+            size_t buffer_size;
+            uint8_t *buffer = frame_buffer(mod, &buffer_size);
+            const size_t body_size = mod->buffer_skip - skip;
             mod->buffer_skip = 0;
+            if(body_size > 0)
+            {
+                memmove(buffer, &mod->buffer[skip], body_size);
+                if(!frame_data(mod, buffer, body_size))
+                {
+                    on_close(mod);
+                    return;
+                }
+
+                if(mod->config.sync && sync_is_full(mod))
+                {
+                    mod->sync.is_paused = true;
+                    asc_socket_set_on_read(mod->sock, NULL);
+                    sync_start(mod);
+                }
+            }
             return;
         }
 
         if(!mod->content)
         {
             mod->status = 3;
+            mod->is_reusable = (mod->is_keep_alive && is_length && mod->buffer_skip == skip);
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
             callback(mod);
@@ -944,6 +1347,12 @@ static void on_read(void *arg)
 
                 if(!mod->chunk_left)
                 {
+                    /* last chunk without trailer */
+                    mod->is_reusable = (   mod->is_keep_alive
+                                        && mod->buffer_skip - skip == 2
+                                        && mod->buffer[skip] == '\r'
+                                        && mod->buffer[skip + 1] == '\n');
+
                     lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
                     string_buffer_push(lua, mod->content);
                     mod->content = NULL;
@@ -995,6 +1404,8 @@ static void on_read(void *arg)
         }
         else
         {
+            mod->is_reusable = (mod->is_keep_alive && mod->chunk_left == tail);
+
             string_buffer_addlstring(mod->content, &mod->buffer[skip], mod->chunk_left);
             mod->chunk_left = 0;
 
@@ -1162,6 +1573,8 @@ static void lua_make_request(module_data_t *mod)
         mod->request.idx_body = luaL_ref(lua, LUA_REGISTRYINDEX);
     else
         lua_pop(lua, 1);
+
+    mod->request.is_content = (mod->request.idx_body != 0);
 }
 
 static void on_connect(void *arg)
@@ -1182,6 +1595,50 @@ static void on_connect(void *arg)
     asc_socket_set_on_ready(mod->sock, on_ready_send_request);
 }
 
+static void on_resolve(void *arg, const char *addr)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->resolve = NULL;
+
+    if(!addr)
+    {
+        mod->request.status = -1;
+        call_error(mod, "failed to resolve host");
+        on_close(mod);
+        return;
+    }
+
+    asc_socket_connect(mod->sock, addr, mod->config.port, on_connect, on_error);
+}
+
+static void connect_start(module_data_t *mod, bool is_pool)
+{
+    if(is_pool)
+    {
+        mod->sock = pool_get(mod);
+        if(mod->sock)
+        {
+            /* request is sent from the next loop iteration as for the new connection */
+            mod->is_reused = true;
+            asc_socket_set_on_close(mod->sock, on_error);
+            asc_socket_set_on_ready(mod->sock, on_connect);
+            return;
+        }
+    }
+
+    if(mod->config.sctp)
+        mod->sock = asc_socket_open_sctp4(mod);
+    else
+        mod->sock = asc_socket_open_tcp4(mod);
+
+    const char *addr = asc_resolve_cached(mod->config.host);
+    if(addr)
+        asc_socket_connect(mod->sock, addr, mod->config.port, on_connect, on_error);
+    else
+        mod->resolve = asc_resolve(mod->config.host, on_resolve, mod);
+}
+
 static void on_upstream_ready(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -1296,6 +1753,8 @@ static int method_set_receiver(module_data_t *mod)
 static int method_send(module_data_t *mod)
 {
     mod->status = 0;
+    mod->eoh_skip = 0;
+    mod->is_reusable = false;
 
     if(mod->timeout)
         asc_timer_destroy(mod->timeout);
@@ -1352,7 +1811,11 @@ static void module_init(module_data_t *mod)
         else
             value = 1;
 
+        module_option_boolean("flow_control", &mod->config.flow_control);
+
+        // aligned by the packet size, packets are not wrapped in the sync buffer
         mod->sync.buffer_size = value * 1024 * 1024;
+        mod->sync.buffer_size -= mod->sync.buffer_size % TS_PACKET_SIZE;
     }
 
     lua_getfield(lua, MODULE_OPTIONS_IDX, "upstream");
@@ -1365,7 +1828,7 @@ static void module_init(module_data_t *mod)
         int value = 1024;
         module_option_number("buffer_size", &value);
         mod->sync.buffer_size = value * 1024;
-        mod->sync.buffer = (uint8_t *)malloc(mod->sync.buffer_size);
+        mod->sync.buffer = (uint8_t *)asc_ring_alloc(mod->sync.buffer_size, -1);
 
         value = 128;
         module_option_number("buffer_fill", &value);
@@ -1378,14 +1841,14 @@ static void module_init(module_data_t *mod)
     mod->timeout_ms *= 1000;
     mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
 
-    bool sctp = false;
-    module_option_boolean("sctp", &sctp);
-    if(sctp == true)
-        mod->sock = asc_socket_open_sctp4(mod);
-    else
-        mod->sock = asc_socket_open_tcp4(mod);
+    module_option_boolean("sctp", &mod->config.sctp);
+
+    mod->is_pool = true;
+    module_option_boolean("pool", &mod->is_pool);
+    if(mod->is_stream || mod->__stream.self || mod->config.sctp)
+        mod->is_pool = false;
 
-    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_close);
+    connect_start(mod, mod->is_pool);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -28,7 +28,41 @@
  *      server_name  - string, default value: "Astra"
  *      http_version - string, default value: "HTTP/1.1"
  *      sctp         - boolean, use sctp instead of tcp
- *      route        - list, format: { { "/path", callback }, ... }
+ *      workers      - number, count of reactors listening on the same port
+ *                     (SO_REUSEPORT). see astra.fork(). default: 1
+ *      pool_size    - number, max count of idle client objects kept for reuse.
+ *                     default: 64
+ *      keep_alive   - number, idle timeout in seconds for persistent connections.
+ *                     0 - close connection after each response. default: 15
+ *      defer_accept - number, seconds to wait for the request before accept
+ *                     (TCP_DEFER_ACCEPT). default: 0 - disabled
+ *      fastopen     - number, queue length of TCP Fast Open requests.
+ *                     default: 0 - disabled
+ *      http2        - boolean, accept HTTP/2 connections with prior knowledge
+ *                     (cleartext, the client starts with the preface).
+ *                     default: true
+ *      tls_cert     - string, PEM file with the certificate chain. enables HTTPS,
+ *                     the traffic is encrypted by the kernel TLS, see tls.c
+ *      tls_key      - string, PEM file with the private key
+ *      route        - list, format: { { "/path", callback [, admission ] }, ... }
+ *                     admission - table, optional. paces the new requests of the route:
+ *                     * limit - number, max requests in progress (callback is called,
+ *                       response is not sent yet). default: 0 - unlimited
+ *                     * rate - number, new requests per second (token bucket).
+ *                       default: 0 - unlimited
+ *                     * burst - number, bucket size. default: rate
+ *                     * queue - number, max count of the deferred requests. default: 0
+ *                     * queue_timeout - number, ms in the queue. default: 1000
+ *                     * retry_after - number, seconds in the Retry-After header of
+ *                       the 503 response for the rejected requests. default: 1
+ *                     * bypass - function(request), returns true for the requests
+ *                       which skip the admission, e.g. already active channels
+ *                     * ready - function(), returns false while the new requests
+ *                       should wait in the queue, e.g. the memory budget is full
+ *                     path is matched exactly or up to "*" at the end. the first
+ *                     matching route of the list is used. routes are compiled into
+ *                     the prefix tree on start, the lookup does not depend on
+ *                     the count of routes
  *
  * Module Methods:
  *      port()      - return number, server port
@@ -59,15 +93,55 @@ struct module_data_t
     const char *http_version;
 
     asc_list_t *routes;
+    struct route_node_t *route_tree;
 
     asc_socket_t *sock;
     asc_list_t *clients;
+
+    // released clients for reuse
+    http_client_t **pool;
+    size_t pool_count;
+    size_t pool_size;
+
+    int keep_alive;
+    bool is_http2;
+
+    http_tls_t *tls;
+
+    // drains the admission queues while one of them is not empty
+    asc_timer_t *admission_timer;
 };
 
+#define DEFAULT_POOL_SIZE 64
+#define ACCEPT_BATCH_SIZE 64
+#define DEFAULT_KEEP_ALIVE 15
+#define TLS_HANDSHAKE_TIMEOUT 10000
+
+#define ADMISSION_INTERVAL 10
+#define DEFAULT_QUEUE_TIMEOUT 1000
+#define DEFAULT_RETRY_AFTER 1
+
 typedef struct
 {
     const char *path;
     int idx_callback;
+    int order; // position in the list, the first matching route is used
+
+    // admission control
+    bool is_admission;
+    int limit;
+    int active;
+    double rate;
+    double burst;
+    double tokens;
+    uint64_t tokens_time;
+    int queue_size;
+    int queue_count;
+    int queue_timeout;
+    int retry_after;
+    int idx_bypass;
+    int idx_ready;
+    TAILQ_HEAD(route_queue_s, http_client_t) queue;
 } route_t;
 
 static const char __method[] = "method";
@@ -78,9 +152,14 @@ static const char __headers[] = "headers";
 static const char __content[] = "content";
 static const char __code[] = "code";
 static const char __message[] = "message";
+static const char __raw[] = "__raw";
+static const char __request_uri[] = "request_uri";
+
+static const char __http_request[] = "http_request";
 
 static const char __content_length[] = "Content-Length: ";
 static const char __connection_close[] = "Connection: close";
+static const char __connection_keep_alive[] = "Connection: keep-alive";
 
 /*
  *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
@@ -103,6 +182,31 @@ static void callback(http_client_t *client)
     lua_call(lua, 3, 0);
 }
 
+static http_client_t * client_alloc(module_data_t *mod)
+{
+    if(mod->pool_count == 0)
+        return (http_client_t *)calloc(1, sizeof(http_client_t));
+
+    http_client_t *client = mod->pool[--mod->pool_count];
+
+    // buffer is not required to be clean
+    memset(client, 0, offsetof(http_client_t, buffer));
+    memset(&client->buffer_skip, 0
+           , sizeof(http_client_t) - offsetof(http_client_t, buffer_skip));
+
+    return client;
+}
+
+static void client_free(module_data_t *mod, http_client_t *client)
+{
+    if(mod->pool_count < mod->pool_size)
+        mod->pool[mod->pool_count++] = client;
+    else
+        free(client);
+}
+
+static void route_release(http_client_t *client);
+
 static void on_client_close(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
@@ -111,9 +215,33 @@ static void on_client_close(void *arg)
     if(!client->sock)
         return;
 
-    asc_socket_close(client->sock);
+    // stream of the HTTP/2 connection shares the socket
+    const bool is_stream = (client->h2_stream != NULL);
+    if(is_stream)
+    {
+        http2_stream_close(client);
+    }
+    else
+    {
+        if(client->h2)
+            http2_close(client);
+        asc_socket_close(client->sock);
+    }
     client->sock = NULL;
 
+#ifdef HAVE_HTTP_TLS
+    if(client->tls)
+        http_tls_free(client);
+#endif
+
+    ASC_FREE(client->idle_timer, asc_timer_destroy);
+
+    if(client->route)
+    {
+        route_release(client);
+        client->route = NULL;
+    }
+
     if(client->status == 3)
     {
         client->status = 0;
@@ -147,35 +275,256 @@ static void on_client_close(void *arg)
         client->content = NULL;
     }
 
-    asc_list_remove_item(mod->clients, client);
-    free(client);
+    if(!is_stream)
+        asc_list_remove_item(mod->clients, client);
+    client_free(mod, client);
 }
 
-static bool routecmp(const char *path, const char *route)
+/*
+ * Route tree. Node is a character of the path, the route is kept in the node
+ * of its last character or of the "*". The lookup walks the request path once
+ * and takes the first route of the list among the matching ones
+ */
+
+typedef struct route_node_t route_node_t;
+
+struct route_node_t
 {
-    size_t skip = 0;
-    while(1)
+    char c;
+    route_t *route;     // path ends here
+    route_t *wildcard;  // "*" here, the rest of the path is any
+    route_node_t *child;
+    route_node_t *next;
+};
+
+static route_node_t * route_node_child(route_node_t *node, char c, bool is_create)
+{
+    route_node_t *child = node->child;
+    for(; child; child = child->next)
     {
-        const char cp = path[skip];
-        const char cr = route[skip];
+        if(child->c == c)
+            return child;
+    }
 
-        if(cp == cr)
-        {
-            if(cp == '\0')
-                return true;
+    if(!is_create)
+        return NULL;
 
-            ++skip;
+    child = (route_node_t *)calloc(1, sizeof(route_node_t));
+    child->c = c;
+    child->next = node->child;
+    node->child = child;
+    return child;
+}
+
+static void route_tree_insert(route_node_t *root, route_t *route)
+{
+    route_node_t *node = root;
+    for(const char *path = route->path; ; ++path)
+    {
+        if(*path == '*')
+        {
+            if(!node->wildcard)
+                node->wildcard = route;
+            return;
         }
-        else
+        if(*path == '\0')
         {
-            if(cr == '*')
-                return true;
+            if(!node->route)
+                node->route = route;
+            return;
+        }
+        node = route_node_child(node, *path, true);
+    }
+}
+
+static void route_tree_destroy(route_node_t *node)
+{
+    while(node)
+    {
+        route_node_t *const next = node->next;
+        route_tree_destroy(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+static inline route_t * route_first(route_t *a, route_t *b)
+{
+    return (!a || (b && b->order < a->order)) ? b : a;
+}
 
+static route_t * route_tree_find(route_node_t *node, const char *path)
+{
+    route_t *match = NULL;
+    for(; node; ++path)
+    {
+        match = route_first(match, node->wildcard);
+        if(*path == '\0')
+        {
+            match = route_first(match, node->route);
             break;
         }
+        node = route_node_child(node, *path, false);
+    }
+    return match;
+}
+
+/*
+ *      o      ooooooooo  oooo     oooo ooooo  oooooooo8   oooooooo8 ooooo  ooooooo  oooo   oooo
+ *     888      888    88o 8888o   888   888  888         888         888 o888   888o 8888o  88
+ *    8  88     888    888 88 888o8 88   888   888oooooo   888oooooo  888 888     888 88 888o88
+ *   8oooo88    888    888 88  888  88   888          888         888 888 888o   o888 88   8888
+ * o88o  o888o o888ooo88  o88o  8  o88o o888o o88oooo888  o88oooo888 o888o  88ooo88  o88o    88
+ *
+ */
+
+static void client_reject(http_client_t *client, int retry_after);
+
+static bool route_ready(route_t *route)
+{
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, route->idx_ready);
+    lua_call(lua, 0, 1);
+    const bool is_ready = lua_toboolean(lua, -1);
+    lua_pop(lua, 1);
+
+    return is_ready;
+}
+
+/* true if the route has a free slot and a token. takes them */
+static bool route_admit(route_t *route)
+{
+    if(route->limit > 0 && route->active >= route->limit)
+        return false;
+
+    if(route->idx_ready && !route_ready(route))
+        return false;
+
+    if(route->rate > 0)
+    {
+        const uint64_t now = asc_utime();
+        route->tokens += (double)(now - route->tokens_time) * route->rate / 1000000.0;
+        route->tokens_time = now;
+        if(route->tokens > route->burst)
+            route->tokens = route->burst;
+
+        if(route->tokens < 1.0)
+            return false;
+
+        route->tokens -= 1.0;
+    }
+
+    ++route->active;
+    return true;
+}
+
+/* the response is started or the client is gone. frees the slot of the route */
+static void route_release(http_client_t *client)
+{
+    route_t *route = (route_t *)client->route;
+
+    if(client->is_queued)
+    {
+        TAILQ_REMOVE(&route->queue, client, queue_entries);
+        --route->queue_count;
+        client->is_queued = false;
+    }
+
+    if(client->is_admitted)
+    {
+        --route->active;
+        client->is_admitted = false;
+    }
+}
+
+static bool route_bypass(route_t *route, http_client_t *client)
+{
+    if(!route->idx_bypass)
+        return false;
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, route->idx_bypass);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
+    lua_call(lua, 1, 1);
+    const bool is_bypass = lua_toboolean(lua, -1);
+    lua_pop(lua, 1);
+
+    return is_bypass;
+}
+
+static void on_admission_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+    bool is_queued = false;
+
+    asc_list_for(mod->routes)
+    {
+        route_t *route = (route_t *)asc_list_data(mod->routes);
+
+        http_client_t *client;
+        while((client = TAILQ_FIRST(&route->queue)))
+        {
+            if(now - client->queue_time >= (uint64_t)route->queue_timeout * 1000)
+            {
+                route_release(client);
+                client_reject(client, route->retry_after);
+                continue;
+            }
+
+            if(!route_admit(route))
+                break;
+
+            route_release(client);
+            client->is_admitted = true;
+            client->status = 3;
+            callback(client);
+
+            // the server is closed by the callback
+            if(!mod->sock)
+                return;
+        }
+
+        if(!TAILQ_EMPTY(&route->queue))
+            is_queued = true;
+    }
+
+    if(!is_queued)
+        ASC_FREE(mod->admission_timer, asc_timer_destroy);
+}
+
+/* calls the route callback now, defers the request to the queue, or rejects it */
+static void client_dispatch(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
+    route_t *route = (route_t *)client->route;
+
+    if(route->is_admission && !route_bypass(route, client))
+    {
+        if(!TAILQ_EMPTY(&route->queue) || !route_admit(route))
+        {
+            if(route->queue_count >= route->queue_size)
+            {
+                client_reject(client, route->retry_after);
+                return;
+            }
+
+            client->is_queued = true;
+            client->queue_time = asc_utime();
+            TAILQ_INSERT_TAIL(&route->queue, client, queue_entries);
+            ++route->queue_count;
+
+            if(!mod->admission_timer)
+            {
+                mod->admission_timer = asc_timer_init(  ADMISSION_INTERVAL
+                                                      , on_admission_timer, mod);
+            }
+            return;
+        }
+
+        client->is_admitted = true;
     }
 
-    return false;
+    client->status = 3;
+    callback(client);
 }
 
 /*
@@ -187,50 +536,49 @@ static bool routecmp(const char *path, const char *route)
  *
  */
 
-static void on_client_read(void *arg)
+/* moves bytes after the request to the end of the buffer */
+static void client_pipeline_save(http_client_t *client, size_t request_size)
 {
-    http_client_t *client = (http_client_t *)arg;
-    module_data_t *mod = client->mod;
-
-    ssize_t size = asc_socket_recv(  client->sock
-                                   , &client->buffer[client->buffer_skip]
-                                   , HTTP_BUFFER_SIZE - client->buffer_skip);
-    if(size <= 0)
+    const size_t left = (client->buffer_skip > request_size)
+                      ? (client->buffer_skip - request_size)
+                      : 0;
+    if(left > 0)
     {
-        on_client_close(client);
-        return;
-    }
-
-    if(client->status == 3)
-    {
-        asc_log_warning(MSG("received data after request"));
-        return;
+        memmove(  &client->buffer[HTTP_BUFFER_SIZE - left]
+                , &client->buffer[request_size]
+                , left);
     }
+    client->pipeline = left;
+    client->buffer_skip = 0;
+}
 
-    char *uri_host = NULL;
-    size_t uri_host_size = 0;
+static void client_parse(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
 
     size_t eoh = 0; // end of headers
     size_t skip = 0;
-    client->buffer_skip += size;
 
     if(client->status == 0)
     {
-        // check empty line
-        while(skip < client->buffer_skip)
+        if(   mod->is_http2
+           && !client->h2_stream
+           && client->buffer[0] == 'P'
+           && !strncmp(client->buffer, HTTP2_PREFACE
+                       , (client->buffer_skip < HTTP2_PREFACE_SIZE)
+                         ? client->buffer_skip
+                         : HTTP2_PREFACE_SIZE))
         {
-            if(   client->buffer[skip + 0] == '\r'
-               && client->buffer[skip + 1] == '\n'
-               && client->buffer[skip + 2] == '\r'
-               && client->buffer[skip + 3] == '\n')
-            {
-                eoh = skip + 4;
-                client->status = 1; // empty line is found
-                break;
-            }
-            ++skip;
+            if(client->buffer_skip >= HTTP2_PREFACE_SIZE)
+                http2_init(client, mod->keep_alive * 1000);
+            return;
         }
 
+        // search continues from the last checked line
+        eoh = http_parse_eoh(client->buffer, client->buffer_skip, &client->eoh_skip);
+        if(eoh > 0)
+            client->status = 1; // empty line is found
+
         if(client->status != 1)
             return;
     }
@@ -257,27 +605,13 @@ static void on_client_read(void *arg)
             return;
         }
 
-        lua_newtable(lua);
-        const int request = lua_gettop(lua);
-
-        lua_pushvalue(lua, -1);
-        if(client->idx_request)
-            luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_request);
-        client->idx_request = luaL_ref(lua, LUA_REGISTRYINDEX);
-
-        lua_pushstring(lua, asc_socket_addr(client->sock));
-        lua_setfield(lua, request, "addr");
-        lua_pushnumber(lua, asc_socket_port(client->sock));
-        lua_setfield(lua, request, "port");
-
-        lua_pushlstring(lua, &client->buffer[m[1].so], m[1].eo - m[1].so);
-        const char *method = lua_tostring(lua, -1);
-        lua_setfield(lua, request, __method);
+        client->is_head = (   m[1].eo - m[1].so == 4
+                           && !strncmp(&client->buffer[m[1].so], "HEAD", 4));
 
-        client->is_head = (strcmp(method, "HEAD") == 0);
-
-        lua_pushlstring(lua, &client->buffer[m[2].so], m[2].eo - m[2].so);
-        lua_setfield(lua, request, "request_uri");
+        // HTTP/1.1 connection is persistent by default
+        client->is_keep_alive = (   mod->keep_alive > 0
+                                 && m[3].eo - m[3].so == 8
+                                 && !strncmp(&client->buffer[m[3].so], "HTTP/1.1", 8));
 
         size_t path_skip = m[2].so;
         if(client->buffer[path_skip] != '/' && client->buffer[path_skip] != '*')
@@ -287,51 +621,63 @@ static void on_client_read(void *arg)
             if(client->buffer[path_skip + 1] != '/' || client->buffer[path_skip + 2] != '/')
             {
                 asc_log_error(MSG("failed to parse request URI"));
-                lua_pop(lua, 1); // request
                 on_client_close(client);
                 return;
             }
             path_skip += 3;
 
-            skip = path_skip;
             while(path_skip < m[2].eo && client->buffer[path_skip] != '/')
                 ++path_skip;
-
-            uri_host = &client->buffer[skip];
-            uri_host_size = path_skip - skip;
         }
 
         skip = path_skip;
         while(path_skip < m[2].eo && client->buffer[path_skip] != '?')
             ++path_skip;
 
+        if(path_skip < m[2].eo && !http_check_query(&client->buffer[path_skip + 1]
+                                                    , m[2].eo - path_skip - 1))
+        {
+            asc_log_error(MSG("failed to parse query line"));
+            on_client_close(client);
+            return;
+        }
+
+        /*
+         * Request table keeps request line and headers as a raw string.
+         * method, version, request_uri, query and headers are parsed
+         * on first access. see http_request_index()
+         */
+
+        lua_createtable(lua, 0, 8);
+        const int request = lua_gettop(lua);
+        luaL_getmetatable(lua, __http_request);
+        lua_setmetatable(lua, request);
+
+        lua_pushvalue(lua, -1);
+        if(client->idx_request)
+            luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_request);
+        client->idx_request = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+        lua_pushstring(lua, asc_socket_addr(client->sock));
+        lua_setfield(lua, request, "addr");
+        lua_pushnumber(lua, asc_socket_port(client->sock));
+        lua_setfield(lua, request, "port");
+
+        lua_pushlstring(lua, client->buffer, eoh);
+        lua_setfield(lua, request, __raw);
+
         const bool is_safe = lua_safe_path(&client->buffer[skip], path_skip - skip);
         const char *path = lua_tostring(lua, -1);
         lua_setfield(lua, request, __path);
 
+        lua_pop(lua, 1); // request
+
         if(!is_safe)
         {
-            lua_pop(lua, 1); // request
             http_client_redirect(client, 302, path);
             return;
         }
 
-        if(path_skip < m[2].eo)
-        {
-            ++path_skip; // skip '?'
-            if(!lua_parse_query(&client->buffer[path_skip], m[2].eo - path_skip))
-            {
-                asc_log_error(MSG("failed to parse query line"));
-                lua_pop(lua, 2); // query + request
-                on_client_close(client);
-                return;
-            }
-            lua_setfield(lua, request, __query);
-        }
-
-        lua_pushlstring(lua, &client->buffer[m[3].so], m[3].eo - m[3].so);
-        lua_setfield(lua, request, __version);
-
         skip = m[0].eo;
 
 /*
@@ -343,11 +689,6 @@ static void on_client_read(void *arg)
  *
  */
 
-        lua_newtable(lua);
-        lua_pushvalue(lua, -1);
-        lua_setfield(lua, request, __headers);
-        const int headers = lua_gettop(lua);
-
         while(skip < eoh)
         {
             if(!http_parse_header(&client->buffer[skip], eoh - skip, m))
@@ -364,44 +705,41 @@ static void on_client_read(void *arg)
                 break;
             }
 
-            lua_string_to_lower(&client->buffer[skip], m[1].eo);
-            lua_pushlstring(lua, &client->buffer[skip + m[2].so], m[2].eo - m[2].so);
-            lua_settable(lua, headers);
-
-            skip += m[0].eo;
-        }
-
-        if(uri_host)
-        {
-            lua_pushlstring(lua, uri_host, uri_host_size);
-            lua_setfield(lua, headers, "host");
-        }
+            const char *key = &client->buffer[skip];
+            const size_t key_size = m[1].eo;
+            const char *value = &client->buffer[skip + m[2].so];
+            const size_t value_size = m[2].eo - m[2].so;
 
-        lua_getfield(lua, headers, "content-length");
-        if(lua_isnumber(lua, -1))
-        {
-            client->chunk_left = lua_tonumber(lua, -1);
-            if(client->chunk_left > 0)
+            if(key_size == 14 && !strncasecmp(key, "content-length", 14))
             {
-                if(client->content)
-                    string_buffer_free(client->content);
-                client->content = string_buffer_alloc();
-                client->is_content_length = true;
+                client->chunk_left = strtoul(value, NULL, 10);
+                if(client->chunk_left > 0)
+                {
+                    if(client->content)
+                        string_buffer_free(client->content);
+                    client->content = string_buffer_alloc_size(client->chunk_left);
+                    client->is_content_length = true;
+                }
+            }
+            else if(key_size == 10 && !strncasecmp(key, "connection", 10))
+            {
+                if(mod->keep_alive == 0)
+                    ;
+                else if(value_size == 5 && !strncasecmp(value, "close", 5))
+                    client->is_keep_alive = false;
+                else if(value_size == 10 && !strncasecmp(value, "keep-alive", 10))
+                    client->is_keep_alive = true;
             }
-        }
-        lua_pop(lua, 1); // content-length
 
-        lua_pop(lua, 2); // headers + request
+            skip += m[0].eo;
+        }
 
         client->idx_callback = 0;
-        asc_list_for(mod->routes)
+        route_t *const route = route_tree_find(mod->route_tree, path);
+        if(route)
         {
-            route_t *route = (route_t *)asc_list_data(mod->routes);
-            if(routecmp(path, route->path))
-            {
-                client->idx_callback = route->idx_callback;
-                break;
-            }
+            client->idx_callback = route->idx_callback;
+            client->route = route;
         }
 
         if(!client->idx_callback)
@@ -413,8 +751,8 @@ static void on_client_read(void *arg)
 
         if(!client->content)
         {
-            client->status = 3;
-            callback(client);
+            client_pipeline_save(client, skip);
+            client_dispatch(client);
             return;
         }
 
@@ -449,6 +787,7 @@ static void on_client_read(void *arg)
         {
             string_buffer_addlstring(client->content,
                 &client->buffer[skip], client->chunk_left);
+            const size_t request_size = skip + client->chunk_left;
             client->chunk_left = 0;
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
@@ -457,8 +796,9 @@ static void on_client_read(void *arg)
             lua_setfield(lua, -2, __content);
             lua_pop(lua, 1); // request
 
-            client->status = 3;
-            callback(client);
+            client_pipeline_save(client, request_size);
+            client_dispatch(client);
+            return;
         }
 
         client->buffer_skip = 0;
@@ -466,6 +806,94 @@ static void on_client_read(void *arg)
     }
 }
 
+static void on_client_read(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    module_data_t *mod = client->mod;
+
+    ssize_t size = asc_socket_recv(  client->sock
+                                   , &client->buffer[client->buffer_skip]
+                                   , HTTP_BUFFER_SIZE - client->buffer_skip);
+    if(size <= 0)
+    {
+        on_client_close(client);
+        return;
+    }
+
+    ASC_FREE(client->idle_timer, asc_timer_destroy);
+
+    if(client->status == 3 || client->is_queued)
+    {
+        asc_log_warning(MSG("received data after request"));
+        return;
+    }
+
+    client->buffer_skip += size;
+    client_parse(client);
+}
+
+static void on_client_idle(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    client->idle_timer = NULL;
+    on_client_close(client);
+}
+
+/* response is sent. release request and wait for the next one */
+static void client_keep_alive(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
+
+    client->status = 0;
+    client->eoh_skip = 0;
+    client->idx_callback = 0;
+    client->route = NULL;
+    client->is_head = false;
+    client->is_content_length = false;
+    client->is_keep_alive = false;
+    client->chunk_left = 0;
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = NULL;
+
+    if(client->idx_content)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_content);
+        client->idx_content = 0;
+    }
+
+    if(client->idx_request)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_request);
+        client->idx_request = 0;
+    }
+
+    if(client->content)
+    {
+        string_buffer_free(client->content);
+        client->content = NULL;
+    }
+
+    // restore pipelined request
+    if(client->pipeline > 0)
+    {
+        memmove(  client->buffer
+                , &client->buffer[HTTP_BUFFER_SIZE - client->pipeline]
+                , client->pipeline);
+    }
+    client->buffer_skip = client->pipeline;
+    client->pipeline = 0;
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    asc_socket_set_on_read(client->sock, on_client_read);
+
+    if(client->buffer_skip > 0)
+        client_parse(client);
+    else
+        client->idle_timer = asc_timer_one_shot(mod->keep_alive * 1000, on_client_idle, client);
+}
+
 /*
  *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
  * 888         888    88   8888o  88   888    88o
@@ -493,9 +921,9 @@ static void on_ready_send_content(void *arg)
                               ? HTTP_BUFFER_SIZE
                               : client->chunk_left;
 
-    const ssize_t send_size = asc_socket_send(  client->sock
-                                              , (void *)&content[client->buffer_skip]
-                                              , content_send);
+    const ssize_t send_size = http_client_send(  client
+                                               , &content[client->buffer_skip]
+                                               , content_send);
     if(send_size == -1)
     {
         asc_log_error(MSG("failed to send content [%s]"), asc_socket_error());
@@ -506,7 +934,12 @@ static void on_ready_send_content(void *arg)
     client->chunk_left -= send_size;
 
     if(client->chunk_left == 0)
-        on_client_close(client);
+    {
+        if(client->is_keep_alive)
+            client_keep_alive(client);
+        else
+            on_client_close(client);
+    }
 }
 
 /* Stack: 1 - server, 2 - client, 3 - response */
@@ -554,8 +987,14 @@ static int method_send(module_data_t *mod)
         client->on_ready = on_ready_send_content;
     }
     else
+    {
         lua_pop(lua, 1); // content
 
+        // response without Content-Length ends with connection close
+        client->is_keep_alive = false;
+    }
+
+    bool is_connection = false;
     lua_getfield(lua, idx_response, __headers);
     if(lua_istable(lua, -1))
     {
@@ -563,10 +1002,30 @@ static int method_send(module_data_t *mod)
         {
             const char *header = lua_tostring(lua, -1);
             http_response_header(client, "%s", header);
+
+            if(!strncasecmp(header, "connection:", 11))
+            {
+                is_connection = true;
+                for(const char *c = &header[11]; *c; ++c)
+                {
+                    if(!strncasecmp(c, "close", 5))
+                    {
+                        client->is_keep_alive = false;
+                        break;
+                    }
+                }
+            }
         }
     }
     lua_pop(lua, 1); // headers
 
+    if(!is_connection && client->idx_content)
+    {
+        http_response_header(client, "%s", (client->is_keep_alive)
+                                           ? __connection_keep_alive
+                                           : __connection_close);
+    }
+
     http_response_send(client);
 
     return 0;
@@ -590,9 +1049,9 @@ static void on_ready_send_response(void *arg)
                               ? HTTP_BUFFER_SIZE
                               : client->chunk_left;
 
-    const ssize_t send_size = asc_socket_send(  client->sock
-                                              , &client->buffer[client->buffer_skip]
-                                              , content_send);
+    const ssize_t send_size = http_client_send(  client
+                                               , &client->buffer[client->buffer_skip]
+                                               , content_send);
     if(send_size == -1)
     {
         asc_log_error(MSG("failed to send response [%s]"), asc_socket_error());
@@ -609,8 +1068,14 @@ static void on_ready_send_response(void *arg)
         {
             client->buffer_skip = 0;
 
-            asc_socket_set_on_read(client->sock, client->on_read);
-            asc_socket_set_on_ready(client->sock, client->on_ready);
+            http_client_set_on_read(client, client->on_read);
+            http_client_set_on_ready(client, client->on_ready);
+            return;
+        }
+
+        if(client->idx_content && client->is_keep_alive)
+        {
+            client_keep_alive(client);
             return;
         }
 
@@ -623,6 +1088,7 @@ static const char * http_code(int code)
     switch(code)
     {
         case 200: return "Ok";
+        case 206: return "Partial Content";
 
         case 301: return "Moved Permanently";
         case 302: return "Found";
@@ -633,12 +1099,14 @@ static const char * http_code(int code)
         case 403: return "Forbidden";
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
         case 429: return "Too Many Requests";
 
         case 500: return "Internal Server Error";
         case 501: return "Not Implemented";
         case 502: return "Bad Gateway";
         case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
 
         default:  return "Status Code Undefined";
     }
@@ -649,12 +1117,15 @@ void http_response_code(http_client_t *client, int code, const char *message)
     if(!message)
         message = http_code(code);
 
-    client->chunk_left  = snprintf(client->buffer, HTTP_BUFFER_SIZE
+    // keep pipelined request at the end of the buffer
+    const size_t buffer_size = HTTP_BUFFER_SIZE - client->pipeline;
+
+    client->chunk_left  = snprintf(client->buffer, buffer_size
                                    , "%s %d %s\r\n"
                                    , client->mod->http_version, code, message);
 
     client->chunk_left += snprintf(&client->buffer[client->chunk_left]
-                                   , HTTP_BUFFER_SIZE - client->chunk_left
+                                   , buffer_size - client->chunk_left
                                    , "Server: %s\r\n"
                                    , client->mod->server_name);
 }
@@ -665,7 +1136,7 @@ void http_response_header(http_client_t *client, const char *header, ...)
     va_start(ap, header);
 
     client->chunk_left += vsnprintf(&client->buffer[client->chunk_left]
-                                    , HTTP_BUFFER_SIZE - client->chunk_left
+                                    , HTTP_BUFFER_SIZE - client->pipeline - client->chunk_left
                                     , header, ap);
     client->buffer[client->chunk_left + 0] = '\r';
     client->buffer[client->chunk_left + 1] = '\n';
@@ -676,14 +1147,21 @@ void http_response_header(http_client_t *client, const char *header, ...)
 
 void http_response_send(http_client_t *client)
 {
+    if(client->is_admitted)
+        route_release(client);
+
     client->buffer[client->chunk_left + 0] = '\r';
     client->buffer[client->chunk_left + 1] = '\n';
     client->chunk_left += 2;
 
     client->buffer_skip = 0;
 
-    asc_socket_set_on_read(client->sock, NULL);
-    asc_socket_set_on_ready(client->sock, on_ready_send_response);
+    // HEADERS frame is queued, on_ready_send_response() switches to the content
+    if(client->h2_stream)
+        http2_stream_response(client);
+
+    http_client_set_on_read(client, NULL);
+    http_client_set_on_ready(client, on_ready_send_response);
 }
 
 void http_client_warning(http_client_t *client, const char *message, ...)
@@ -719,7 +1197,52 @@ void http_client_close(http_client_t *client)
     on_client_close(client);
 }
 
-void http_client_abort(http_client_t *client, int code, const char *text)
+/* response is sent by the route module. client->response should be released */
+void http_client_complete(http_client_t *client)
+{
+    if(client->is_keep_alive)
+        client_keep_alive(client);
+    else
+        on_client_close(client);
+}
+
+ssize_t http_client_send(http_client_t *client, const void *buffer, size_t size)
+{
+    if(client->h2_stream)
+        return http2_stream_send(client, buffer, size);
+
+    return asc_socket_send(client->sock, buffer, size);
+}
+
+ssize_t http_client_sendv(http_client_t *client, const struct iovec *iov, int iovcnt)
+{
+    if(client->h2_stream)
+        return http2_stream_sendv(client, iov, iovcnt);
+
+    return asc_socket_sendv(client->sock, iov, iovcnt);
+}
+
+/* HTTP/2 stream has no reads, the client is closed with RST_STREAM */
+void http_client_set_on_read(http_client_t *client, event_callback_t on_read)
+{
+    if(client->h2_stream)
+        return;
+
+    asc_socket_set_on_read(client->sock, on_read);
+}
+
+void http_client_set_on_ready(http_client_t *client, event_callback_t on_ready)
+{
+    if(client->h2_stream)
+    {
+        http2_stream_set_on_ready(client, on_ready);
+        return;
+    }
+
+    asc_socket_set_on_ready(client->sock, on_ready);
+}
+
+static void client_abort(http_client_t *client, int code, const char *text, int retry_after)
 {
     module_data_t *mod = client->mod;
 
@@ -750,13 +1273,30 @@ void http_client_abort(http_client_t *client, int code, const char *text)
     client->on_read = NULL;
     client->on_ready = on_ready_send_content;
 
+    // connection is closed after the content, the route callback releases the client
+    client->is_keep_alive = false;
+
     http_response_code(client, code, message);
     http_response_header(client, "Content-Type: text/html");
     http_response_header(client, "%s%d", __content_length, content_length);
+    if(retry_after > 0)
+        http_response_header(client, "Retry-After: %d", retry_after);
     http_response_header(client, __connection_close);
     http_response_send(client);
 }
 
+void http_client_abort(http_client_t *client, int code, const char *text)
+{
+    client_abort(client, code, text, 0);
+}
+
+/* the request is not admitted. the route callback is not called */
+static void client_reject(http_client_t *client, int retry_after)
+{
+    client->route = NULL;
+    client_abort(client, 503, "server is busy", retry_after);
+}
+
 void http_client_redirect(http_client_t *client, int code, const char *location)
 {
     if(!code)
@@ -795,9 +1335,12 @@ static void on_server_close(void *arg)
     if(!mod->sock)
         return;
 
+    asc_handover_detach(mod);
     asc_socket_close(mod->sock);
     mod->sock = NULL;
 
+    ASC_FREE(mod->admission_timer, asc_timer_destroy);
+
     if(mod->clients)
     {
         http_client_t *prev_client = NULL;
@@ -817,6 +1360,15 @@ static void on_server_close(void *arg)
         mod->clients = NULL;
     }
 
+    if(mod->pool)
+    {
+        while(mod->pool_count > 0)
+            free(mod->pool[--mod->pool_count]);
+
+        free(mod->pool);
+        mod->pool = NULL;
+    }
+
     if(mod->routes)
     {
         for(  asc_list_first(mod->routes)
@@ -825,6 +1377,10 @@ static void on_server_close(void *arg)
         {
             route_t *route = (route_t *)asc_list_data(mod->routes);
             luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_callback);
+            if(route->idx_bypass)
+                luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_bypass);
+            if(route->idx_ready)
+                luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_ready);
             free(route);
             asc_list_remove_current(mod->routes);
         }
@@ -832,6 +1388,11 @@ static void on_server_close(void *arg)
         asc_list_destroy(mod->routes);
         mod->routes = NULL;
     }
+    ASC_FREE(mod->route_tree, route_tree_destroy);
+
+#ifdef HAVE_HTTP_TLS
+    ASC_FREE(mod->tls, http_tls_destroy);
+#endif
 
     if(mod->idx_self)
     {
@@ -844,26 +1405,73 @@ static void on_server_accept(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    http_client_t *client = (http_client_t *)calloc(1, sizeof(http_client_t));
-    client->mod = mod;
-    client->idx_server = mod->idx_self;
-
-    if(!asc_socket_accept(mod->sock, &client->sock, client))
+    /* accept queue is drained with one wakeup */
+    for(int i = 0; i < ACCEPT_BATCH_SIZE; ++i)
     {
-        free(client);
-        on_server_close(mod);
-        astra_abort(); // TODO: try to restart server
+        asc_socket_t *sock = NULL;
+        if(!asc_socket_accept(mod->sock, &sock, NULL))
+        {
+            on_server_close(mod);
+            astra_abort(); // TODO: try to restart server
+        }
+        if(!sock)
+            break;
+
+        http_client_t *client = client_alloc(mod);
+        client->mod = mod;
+        client->idx_server = mod->idx_self;
+        client->sock = sock;
+        asc_socket_set_arg(sock, client);
+
+        /* all writes report EAGAIN, on_ready is toggled without epoll_ctl() */
+        asc_socket_set_edge(client->sock);
+        /* API and web UI. stream responses switch the client to the output */
+        asc_socket_set_priority(client->sock, ASC_EVENT_CONTROL);
+
+        asc_list_insert_tail(mod->clients, client);
+
+        asc_log_debug(MSG("client connected %s:%d (%lu clients)")
+                          , asc_socket_addr(client->sock)
+                          , asc_socket_port(client->sock)
+                          , asc_list_size(mod->clients));
+
+        asc_socket_set_on_close(client->sock, on_client_close);
+
+#ifdef HAVE_HTTP_TLS
+        if(mod->tls)
+        {
+            if(!http_tls_accept(mod->tls, client, on_client_read))
+            {
+                on_client_close(client);
+                continue;
+            }
+            client->idle_timer = asc_timer_one_shot(  TLS_HANDSHAKE_TIMEOUT
+                                                    , on_client_idle, client);
+            continue;
+        }
+#endif
+
+        asc_socket_set_on_read(client->sock, on_client_read);
     }
+}
 
-    asc_list_insert_tail(mod->clients, client);
+/* new stream of the HTTP/2 connection. it is not in the client list */
+http_client_t * http_server_stream_open(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
 
-    asc_log_debug(MSG("client connected %s:%d (%lu clients)")
-                      , asc_socket_addr(client->sock)
-                      , asc_socket_port(client->sock)
-                      , asc_list_size(mod->clients));
+    http_client_t *stream = client_alloc(mod);
+    stream->mod = mod;
+    stream->idx_server = mod->idx_self;
+    stream->sock = client->sock;
 
-    asc_socket_set_on_read(client->sock, on_client_read);
-    asc_socket_set_on_close(client->sock, on_client_close);
+    return stream;
+}
+
+/* request of the stream is in the buffer */
+void http_server_stream_request(http_client_t *client)
+{
+    client_parse(client);
 }
 
 /*
@@ -932,17 +1540,169 @@ static bool lua_is_call(int idx)
 
     if(lua_isfunction(lua, idx))
         is_call = true;
-    else if(lua_istable(lua, idx))
+    else if(luaL_getmetafield(lua, idx, "__call"))
     {
-        lua_getmetatable(lua, idx);
-        lua_getfield(lua, -1, "__call");
+        // module instance or table with the __call meta-method
         is_call = lua_isfunction(lua, -1);
-        lua_pop(lua, 2);
+        lua_pop(lua, 1);
     }
 
     return is_call;
 }
 
+/*
+ * __index of the request table. Parses field from the raw request and
+ * stores result in the table.
+ * Stack: 1 - request, 2 - key
+ */
+static int http_request_index(lua_State *L)
+{
+    const char *key = lua_tostring(L, 2);
+    if(!key)
+        return 0;
+
+    lua_getfield(L, 1, __raw);
+    size_t raw_size = 0;
+    const char *raw = lua_tolstring(L, -1, &raw_size);
+    if(!raw)
+        return 0;
+
+    parse_match_t m[4];
+    if(!http_parse_request(raw, raw_size, m))
+        return 0;
+
+    const char *uri_host = NULL;
+    size_t uri_host_size = 0;
+
+    size_t path_skip = m[2].so;
+    if(raw[path_skip] != '/' && raw[path_skip] != '*')
+    {
+        while(path_skip < m[2].eo && raw[path_skip] != ':')
+            ++path_skip;
+        path_skip += 3;
+
+        const size_t skip = path_skip;
+        while(path_skip < m[2].eo && raw[path_skip] != '/')
+            ++path_skip;
+
+        uri_host = &raw[skip];
+        uri_host_size = path_skip - skip;
+    }
+
+    if(!strcmp(key, __method))
+        lua_pushlstring(L, &raw[m[1].so], m[1].eo - m[1].so);
+    else if(!strcmp(key, __version))
+        lua_pushlstring(L, &raw[m[3].so], m[3].eo - m[3].so);
+    else if(!strcmp(key, __request_uri))
+        lua_pushlstring(L, &raw[m[2].so], m[2].eo - m[2].so);
+    else if(!strcmp(key, __query))
+    {
+        while(path_skip < m[2].eo && raw[path_skip] != '?')
+            ++path_skip;
+        if(path_skip >= m[2].eo)
+            return 0;
+
+        ++path_skip; // skip '?'
+        lua_parse_query(&raw[path_skip], m[2].eo - path_skip);
+    }
+    else if(!strcmp(key, __headers))
+    {
+        lua_newtable(L);
+        const int headers = lua_gettop(L);
+
+        size_t skip = m[0].eo;
+        while(skip < raw_size && http_parse_header(&raw[skip], raw_size - skip, m))
+        {
+            if(m[1].eo == 0)
+                break; /* empty line */
+
+            lua_string_to_lower(&raw[skip], m[1].eo);
+            lua_pushlstring(L, &raw[skip + m[2].so], m[2].eo - m[2].so);
+            lua_settable(L, headers);
+
+            skip += m[0].eo;
+        }
+
+        if(uri_host)
+        {
+            lua_pushlstring(L, uri_host, uri_host_size);
+            lua_setfield(L, headers, "host");
+        }
+    }
+    else
+        return 0;
+
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 1);
+
+    return 1;
+}
+
+static void route_admission_init(route_t *route)
+{
+    const int admission = lua_gettop(lua);
+
+    lua_getfield(lua, admission, "limit");
+    if(lua_isnumber(lua, -1))
+        route->limit = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    lua_getfield(lua, admission, "rate");
+    if(lua_isnumber(lua, -1))
+        route->rate = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    route->burst = (route->rate > 1.0) ? route->rate : 1.0;
+    lua_getfield(lua, admission, "burst");
+    if(lua_isnumber(lua, -1) && lua_tonumber(lua, -1) >= 1.0)
+        route->burst = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    route->tokens = route->burst;
+    route->tokens_time = asc_utime();
+
+    lua_getfield(lua, admission, "queue");
+    if(lua_isnumber(lua, -1))
+        route->queue_size = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    route->queue_timeout = DEFAULT_QUEUE_TIMEOUT;
+    lua_getfield(lua, admission, "queue_timeout");
+    if(lua_isnumber(lua, -1))
+        route->queue_timeout = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    route->retry_after = DEFAULT_RETRY_AFTER;
+    lua_getfield(lua, admission, "retry_after");
+    if(lua_isnumber(lua, -1))
+        route->retry_after = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    lua_getfield(lua, admission, "bypass");
+    if(lua_isfunction(lua, -1))
+        route->idx_bypass = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    lua_getfield(lua, admission, "ready");
+    if(lua_isfunction(lua, -1))
+        route->idx_ready = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    route->is_admission = (route->limit > 0 || route->rate > 0 || route->idx_ready);
+}
+
+static void on_server_handover(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    char key[64];
+    snprintf(key, sizeof(key), "http/%s:%d", mod->addr, mod->port);
+    asc_handover_pass(key, NULL, asc_socket_fd(mod->sock));
+}
+
 static void module_init(module_data_t *mod)
 {
     module_option_string("addr", &mod->addr, NULL);
@@ -958,8 +1718,37 @@ static void module_init(module_data_t *mod)
     mod->http_version = "HTTP/1.1";
     module_option_string("http_version", &mod->http_version, NULL);
 
+    mod->keep_alive = DEFAULT_KEEP_ALIVE;
+    module_option_number("keep_alive", &mod->keep_alive);
+
+    mod->is_http2 = true;
+    module_option_boolean("http2", &mod->is_http2);
+
+    const char *tls_cert = NULL;
+    module_option_string("tls_cert", &tls_cert, NULL);
+    if(tls_cert)
+    {
+#ifdef HAVE_HTTP_TLS
+        const char *tls_key = tls_cert;
+        module_option_string("tls_key", &tls_key, NULL);
+        mod->tls = http_tls_init(tls_cert, tls_key);
+        asc_assert(mod->tls != NULL, MSG("failed to initialize TLS"));
+#else
+        asc_log_error(MSG("TLS is not available, requires OpenSSL 3 and linux/tls.h"));
+        astra_abort();
+#endif
+    }
+
+    if(luaL_newmetatable(lua, __http_request))
+    {
+        lua_pushcfunction(lua, http_request_index);
+        lua_setfield(lua, -2, "__index");
+    }
+    lua_pop(lua, 1); // metatable
+
     // store routes in registry
     mod->routes = asc_list_init();
+    mod->route_tree = (route_node_t *)calloc(1, sizeof(route_node_t));
     lua_getfield(lua, MODULE_OPTIONS_IDX, "route");
     asc_assert(lua_istable(lua, -1), MSG("option 'route' is required"));
     for(lua_pushnil(lua); lua_next(lua, -2); lua_pop(lua, 1))
@@ -983,12 +1772,20 @@ static void module_init(module_data_t *mod)
         } while(0);
         asc_assert(is_ok, MSG("route format: { { \"/path\", callback }, ... }"));
 
-        route_t *route = (route_t *)malloc(sizeof(route_t));
+        route_t *route = (route_t *)calloc(1, sizeof(route_t));
         route->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
         route->path = lua_tostring(lua, -1);
         lua_pop(lua, 1); // path
 
+        TAILQ_INIT(&route->queue);
+        lua_rawgeti(lua, -1, 3); // admission
+        if(lua_istable(lua, -1))
+            route_admission_init(route);
+        lua_pop(lua, 1);
+
+        route->order = asc_list_size(mod->routes);
         asc_list_insert_tail(mod->routes, route);
+        route_tree_insert(mod->route_tree, route);
     }
     lua_pop(lua, 1); // route
 
@@ -998,20 +1795,59 @@ static void module_init(module_data_t *mod)
 
     mod->clients = asc_list_init();
 
-    bool sctp = false;
-    module_option_boolean("sctp", &sctp);
-    if(sctp == true)
-        mod->sock = asc_socket_open_sctp4(mod);
-    else
-        mod->sock = asc_socket_open_tcp4(mod);
+    int pool_size = DEFAULT_POOL_SIZE;
+    module_option_number("pool_size", &pool_size);
+    if(pool_size > 0)
+    {
+        mod->pool_size = pool_size;
+        mod->pool = (http_client_t **)calloc(mod->pool_size, sizeof(http_client_t *));
+    }
 
-    asc_socket_set_reuseaddr(mod->sock, 1);
-    if(!asc_socket_bind(mod->sock, mod->addr, mod->port))
+    // listening socket of the previous process, the connections in the backlog are kept
+    char key[64];
+    snprintf(key, sizeof(key), "http/%s:%d", mod->addr, mod->port);
+    const int fd = asc_handover_take(key, NULL);
+    if(fd != -1)
+        mod->sock = asc_socket_open_fd(fd, mod);
+    else
     {
-        on_server_close(mod);
-        astra_abort(); // TODO: try to restart server
+        bool sctp = false;
+        module_option_boolean("sctp", &sctp);
+        if(sctp == true)
+            mod->sock = asc_socket_open_sctp4(mod);
+        else
+            mod->sock = asc_socket_open_tcp4(mod);
+
+        asc_socket_set_reuseaddr(mod->sock, 1);
+
+        int workers = 1;
+        module_option_number("workers", &workers);
+        if(workers > 1 && !asc_socket_set_reuseport(mod->sock, 1))
+        {
+            on_server_close(mod);
+            astra_abort();
+        }
+
+        if(!asc_socket_bind(mod->sock, mod->addr, mod->port))
+        {
+            on_server_close(mod);
+            astra_abort(); // TODO: try to restart server
+        }
     }
+
+    int defer_accept = 0;
+    module_option_number("defer_accept", &defer_accept);
+    if(defer_accept > 0)
+        asc_socket_set_defer_accept(mod->sock, defer_accept);
+
+    int fastopen = 0;
+    module_option_number("fastopen", &fastopen);
+    if(fastopen > 0)
+        asc_socket_set_fastopen(mod->sock, fastopen);
+
     asc_socket_listen(mod->sock, on_server_accept, on_server_close);
+    if(mod->sock)
+        asc_handover_attach(on_server_handover, mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -0,0 +1,170 @@
+/*
+ * Astra Module: HTTP TLS
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HTTPS with the kernel TLS. OpenSSL makes the handshake and passes the
+ * session keys to the socket (SO_ULP "tls"), then the client is served as
+ * the plain HTTP client: recv, send, sendmsg and sendfile of the modules
+ * are encrypted by the kernel or by the NIC.
+ *
+ * The connection is closed if the kernel does not accept the keys of both
+ * directions: the tls kernel module is not loaded or the cipher is not
+ * supported. OpenSSL before 3.2 offloads the receiving side of TLS 1.2 only.
+ */
+
+#include "http.h"
+
+#ifdef HAVE_HTTP_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#define MSG(_msg) "[http_server] " _msg
+
+/* kernel TLS: AES-GCM and ChaCha20-Poly1305 */
+#define TLS_CIPHER_LIST "ECDHE+AESGCM:ECDHE+CHACHA20"
+
+struct http_tls_t
+{
+    SSL_CTX *ctx;
+};
+
+static void tls_log_error(const char *message)
+{
+    char error[256];
+    ERR_error_string_n(ERR_get_error(), error, sizeof(error));
+    asc_log_error(MSG("%s [%s]"), message, error);
+}
+
+http_tls_t * http_tls_init(const char *cert, const char *key)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if(!ctx)
+    {
+        tls_log_error("SSL_CTX_new() failed");
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+#endif
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    // the tickets are written after the handshake, the socket belongs to the kernel then
+    SSL_CTX_set_num_tickets(ctx, 0);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    if(   !SSL_CTX_set_cipher_list(ctx, TLS_CIPHER_LIST)
+       || !SSL_CTX_use_certificate_chain_file(ctx, cert)
+       || !SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM)
+       || !SSL_CTX_check_private_key(ctx))
+    {
+        tls_log_error("failed to load the certificate");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    http_tls_t *tls = (http_tls_t *)calloc(1, sizeof(http_tls_t));
+    tls->ctx = ctx;
+    return tls;
+}
+
+void http_tls_destroy(http_tls_t *tls)
+{
+    SSL_CTX_free(tls->ctx);
+    free(tls);
+}
+
+void http_tls_free(http_client_t *client)
+{
+    SSL_free((SSL *)client->tls);
+    client->tls = NULL;
+}
+
+static void on_tls_handshake(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    SSL *ssl = (SSL *)client->tls;
+
+    ERR_clear_error();
+    const int ret = SSL_do_handshake(ssl);
+    if(ret != 1)
+    {
+        switch(SSL_get_error(ssl, ret))
+        {
+            case SSL_ERROR_WANT_READ:
+                asc_socket_set_on_ready(client->sock, NULL);
+                return;
+            case SSL_ERROR_WANT_WRITE:
+                asc_socket_set_on_ready(client->sock, on_tls_handshake);
+                return;
+            default:
+                asc_log_debug(MSG("TLS handshake failed %s:%d")
+                              , asc_socket_addr(client->sock), asc_socket_port(client->sock));
+                http_client_close(client);
+                return;
+        }
+    }
+
+    if(!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+    {
+        static bool is_reported = false;
+        if(!is_reported)
+        {
+            asc_log_error(MSG("kernel TLS is not available for %s (%s). load the tls module")
+                          , SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+            is_reported = true;
+        }
+        http_client_close(client);
+        return;
+    }
+
+    // the keys are in the kernel, the socket BIO does not close the descriptor
+    http_tls_free(client);
+
+    // the request received with the last handshake message is left in the
+    // socket and decrypted by the kernel on the next read
+    asc_socket_set_on_ready(client->sock, NULL);
+    asc_socket_set_on_read(client->sock, client->on_tls_done);
+    client->on_tls_done = NULL;
+}
+
+bool http_tls_accept(http_tls_t *tls, http_client_t *client
+                     , event_callback_t on_read)
+{
+    SSL *ssl = SSL_new(tls->ctx);
+    if(!ssl)
+        return false;
+
+    if(!SSL_set_fd(ssl, asc_socket_fd(client->sock)))
+    {
+        SSL_free(ssl);
+        return false;
+    }
+    SSL_set_accept_state(ssl);
+
+    client->tls = ssl;
+    client->on_tls_done = on_read;
+    asc_socket_set_on_read(client->sock, on_tls_handshake);
+
+    return true;
+}
+
+#endif /* HAVE_HTTP_TLS */
@@ -99,6 +99,18 @@ bool lua_parse_query(const char *str, size_t size)
     return (skip == size);
 }
 
+/* same as lua_parse_query() but without lua table */
+bool http_check_query(const char *str, size_t size)
+{
+    size_t skip = 0;
+    parse_match_t m[3];
+
+    while(skip < size && http_parse_query(&str[skip], size - skip, m))
+        skip += m[0].eo;
+
+    return (skip == size);
+}
+
 bool lua_safe_path(const char *str, size_t size)
 {
     size_t skip = 0;
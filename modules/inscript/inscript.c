@@ -25,6 +25,98 @@
 
 static const char __module_name[] = "inscript";
 
+/*
+ * Compiled user scripts are kept between reloads. The chunk is loaded again
+ * if the file modification time or size is changed.
+ */
+
+typedef struct script_chunk_t script_chunk_t;
+
+struct script_chunk_t
+{
+    char *path;
+    time_t mtime;
+    off_t size;
+    ino_t ino;
+
+    char *data;
+    size_t data_size;
+
+    script_chunk_t *next;
+};
+
+static script_chunk_t *script_cache = NULL;
+
+static int chunk_writer(lua_State *L, const void *p, size_t size, void *arg)
+{
+    __uarg(L);
+
+    if(size > 0)
+        string_buffer_addlstring((string_buffer_t *)arg, (const char *)p, size);
+
+    return 0;
+}
+
+static int load_script(const char *path)
+{
+    struct stat sb;
+    if(!path || stat(path, &sb) != 0)
+        return luaL_loadfile(lua, path);
+
+    script_chunk_t *chunk = script_cache;
+    for(; chunk; chunk = chunk->next)
+    {
+        if(!strcmp(chunk->path, path))
+            break;
+    }
+
+    if(   chunk
+       && chunk->mtime == sb.st_mtime
+       && chunk->size == sb.st_size
+       && chunk->ino == sb.st_ino)
+    {
+        return luaL_loadbuffer(lua, chunk->data, chunk->data_size, path);
+    }
+
+    const int load = luaL_loadfile(lua, path);
+    if(load != 0)
+        return load;
+
+    if(!chunk)
+    {
+        chunk = (script_chunk_t *)calloc(1, sizeof(script_chunk_t));
+        chunk->path = strdup(path);
+        chunk->next = script_cache;
+        script_cache = chunk;
+    }
+    else
+    {
+        ASC_FREE(chunk->data, free);
+    }
+
+    /* debug info is kept for errors in the user scripts */
+    string_buffer_t *buffer = string_buffer_alloc();
+    lua_dump(lua, chunk_writer, buffer);
+    chunk->data = string_buffer_release(buffer, &chunk->data_size);
+    chunk->mtime = sb.st_mtime;
+    chunk->size = sb.st_size;
+    chunk->ino = sb.st_ino;
+
+    return 0;
+}
+
+static int fn_dofile(lua_State *L)
+{
+    const char *path = luaL_optstring(L, 1, NULL);
+    lua_settop(L, 1);
+
+    if(load_script(path) != 0)
+        return lua_error(L);
+
+    lua_call(L, 0, LUA_MULTRET);
+    return lua_gettop(L) - 1;
+}
+
 static int load_inscript(const char *buffer, size_t size, const char *name)
 {
     int load;
@@ -77,7 +169,7 @@ static int fn_inscript_callback(lua_State *L)
 
     if(!strcmp(script, "-"))
     {
-        load = luaL_dofile(lua, NULL);
+        load = luaL_loadfile(lua, NULL) || lua_pcall(lua, 0, LUA_MULTRET, 0);
         argv_idx += 1;
     }
     else if(!strcmp(script, "--stream"))
@@ -112,7 +204,18 @@ static int fn_inscript_callback(lua_State *L)
     }
     else if(!access(script, R_OK))
     {
-        load = luaL_dofile(lua, script);
+        /* application may track scripts for the incremental reload */
+        lua_getglobal(lua, "load_config");
+        if(lua_isfunction(lua, -1))
+        {
+            lua_pushstring(lua, script);
+            load = lua_pcall(lua, 1, 0, 0);
+        }
+        else
+        {
+            lua_pop(lua, 1);
+            load = load_script(script) || lua_pcall(lua, 0, LUA_MULTRET, 0);
+        }
         argv_idx += 1;
     }
     if(load != 0)
@@ -137,6 +240,9 @@ LUA_API int luaopen_inscript(lua_State *L)
     lua_pushcclosure(L, fn_inscript_callback, 0);
     lua_setglobal(L, __module_name);
 
+    lua_pushcfunction(L, fn_dofile);
+    lua_setglobal(L, "dofile");
+
     return 1;
 }
 
@@ -158,6 +264,14 @@ LUA_API int luaopen_inscript(lua_State *L)
 #   endif
 #endif
 
+#ifndef INSCRIPT_SOURCE
+#   include <lua/lua.h>
+#   include <lua/lauxlib.h>
+#   include <lua/lobject.h>
+#   include <lua/lstate.h>
+#   include <lua/lundump.h>
+#endif
+
 #define MAX_BUFFER_SIZE 4096
 
 typedef struct string_buffer_t string_buffer_t;
@@ -359,6 +473,58 @@ static string_buffer_t * parse(const char *source)
     return buffer;
 }
 
+#ifndef INSCRIPT_SOURCE
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} dump_buffer_t;
+
+static int dump_writer(lua_State *L, const void *p, size_t size, void *arg)
+{
+    (void)L;
+
+    dump_buffer_t *dump = (dump_buffer_t *)arg;
+    if(dump->size + size > dump->capacity)
+    {
+        while(dump->size + size > dump->capacity)
+            dump->capacity = (dump->capacity) ? dump->capacity * 2 : 64 * 1024;
+        dump->data = realloc(dump->data, dump->capacity);
+    }
+
+    memcpy(&dump->data[dump->size], p, size);
+    dump->size += size;
+
+    return 0;
+}
+
+/* compiles script into the stripped bytecode */
+static char * compile(const char *name, const char *script, size_t *size)
+{
+    lua_State *L = luaL_newstate();
+
+    char chunkname[64];
+    snprintf(chunkname, sizeof(chunkname), "=%s", name);
+
+    if(luaL_loadbuffer(L, script, strlen(script), chunkname) != 0)
+    {
+        fprintf(stderr, "Failed to compile script: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return NULL;
+    }
+
+    dump_buffer_t dump = { NULL, 0, 0 };
+    luaU_dump(L, getproto(L->top - 1), dump_writer, &dump, 1);
+    lua_close(L);
+
+    *size = dump.size;
+    return dump.data;
+}
+
+#endif /* !INSCRIPT_SOURCE */
+
 static void print_block(uint8_t *block, size_t len)
 {
     printf("  ");
@@ -419,6 +585,14 @@ int main(int argc, char const *argv[])
     }
     script[skip] = 0;
 
+#ifndef INSCRIPT_SOURCE
+    char *bytecode = compile(argv[1], script, &skip);
+    free(script);
+    if(!bytecode)
+        return -1;
+    script = bytecode;
+#endif
+
     printf("static unsigned char %s[] = {\n", argv[1]);
     const size_t tail = skip % 8;
     const size_t limit = skip - tail;
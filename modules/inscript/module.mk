@@ -2,4 +2,5 @@
 SOURCES="inscript.c"
 MODULES="inscript"
 
-make -C $MODULE
+# custom compiler may be a cross-compiler, bytecode is not portable
+make -C $MODULE INSCRIPT_SOURCE=$ARG_CC
@@ -0,0 +1,319 @@
+/*
+ * Astra Module: MixAudio
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "layer2.h"
+
+#define L2_SBLIMIT 32
+#define L2_GRANULES 12 // 3 samples of each subband in the granule
+#define L2_BOUND 4 // intensity bound of the output frame, mode extension 0
+
+#define L2_MODE_JOINT_STEREO 1
+#define L2_MODE_MONO 3
+
+/* ISO/IEC 11172-3 and 13818-3, Layer II */
+
+static const uint16_t l2_bitrate[2][16] =
+{
+    /* MPEG-2 LSF */
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+    /* MPEG-1 */
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+};
+
+static const uint16_t l2_srate[4][4] =
+{
+    /* 2.5 */ { 11025, 12000, 8000, 0 },
+    /*   R */ { 0, 0, 0, 0 },
+    /*   2 */ { 22050, 24000, 16000, 0 },
+    /*   1 */ { 44100, 48000, 32000, 0 },
+};
+
+static const uint8_t l2_sblimit[5] = { 27, 30, 8, 12, 30 };
+
+/* bits of one sample, negative - bits of the group of three samples */
+static const int8_t l2_quant_bits[17] =
+{
+    -5, -7, 3, -10, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+};
+
+/* quantization class by the allocation index - 1 */
+static const uint8_t l2_class_a[15] = { 0, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static const uint8_t l2_class_b[15] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 16 };
+static const uint8_t l2_class_c[7] = { 0, 1, 2, 3, 4, 5, 16 };
+static const uint8_t l2_class_d[3] = { 0, 1, 16 };
+static const uint8_t l2_class_e[15] = { 0, 1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const uint8_t l2_class_f[7] = { 0, 1, 3, 4, 5, 6, 7 };
+static const uint8_t l2_class_g[3] = { 0, 1, 3 };
+
+static const uint8_t * l2_subband(int table, int sb, int *nbal)
+{
+    switch(table)
+    {
+        case 0:
+        case 1:
+            if(sb < 3) { *nbal = 4; return l2_class_a; }
+            if(sb < 11) { *nbal = 4; return l2_class_b; }
+            if(sb < 23) { *nbal = 3; return l2_class_c; }
+            *nbal = 2;
+            return l2_class_d;
+        case 2:
+        case 3:
+            if(sb < 2) { *nbal = 4; return l2_class_e; }
+            *nbal = 3;
+            return l2_class_f;
+        default:
+            if(sb < 4) { *nbal = 4; return l2_class_e; }
+            if(sb < 11) { *nbal = 3; return l2_class_f; }
+            *nbal = 2;
+            return l2_class_g;
+    }
+}
+
+static int l2_table(bool is_lsf, int ch_bitrate, int srate)
+{
+    if(is_lsf)
+        return 4;
+    if((srate == 48000 && ch_bitrate >= 56) || (ch_bitrate >= 56 && ch_bitrate <= 80))
+        return 0;
+    if(srate != 48000 && ch_bitrate >= 96)
+        return 1;
+    if(srate != 32000 && ch_bitrate <= 48)
+        return 2;
+    return 3;
+}
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size; // bits
+    size_t pos;
+} l2_bits_t;
+
+static uint32_t bits_get(l2_bits_t *b, int n)
+{
+    uint32_t value = 0;
+    while(n > 0)
+    {
+        const size_t byte = b->pos >> 3;
+        const int left = 8 - (int)(b->pos & 7);
+        const int take = (n < left) ? n : left;
+        const uint8_t c = (b->pos < b->size) ? b->data[byte] : 0;
+        value = (value << take) | ((c >> (left - take)) & ((1 << take) - 1));
+        b->pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+/* dst is zeroed, the overflow is checked by the caller */
+static void bits_put(l2_bits_t *b, uint32_t value, int n)
+{
+    while(n > 0)
+    {
+        const size_t byte = b->pos >> 3;
+        const int left = 8 - (int)(b->pos & 7);
+        const int take = (n < left) ? n : left;
+        if(b->pos < b->size)
+            b->data[byte] |= ((value >> (n - take)) & ((1 << take) - 1)) << (left - take);
+        b->pos += take;
+        n -= take;
+    }
+}
+
+bool mpa_l2_copy_channel(const uint8_t *src, size_t size, uint8_t *dst, int channel)
+{
+    if(size < 4 || src[0] != 0xFF || (src[1] & 0xE0) != 0xE0)
+        return false;
+
+    const int version = (src[1] & 0x18) >> 3;
+    const int layer = (src[1] & 0x06) >> 1;
+    const bool is_crc = !(src[1] & 0x01);
+    const int bitrate = l2_bitrate[(version == 3) ? 1 : 0][(src[2] & 0xF0) >> 4];
+    const int srate = l2_srate[version][(src[2] & 0x0C) >> 2];
+    const int padding = (src[2] & 0x02) >> 1;
+    const int mode = (src[3] & 0xC0) >> 6;
+    const int mode_ext = (src[3] & 0x30) >> 4;
+
+    if(layer != 2 || version == 1 || !bitrate || !srate || mode == L2_MODE_MONO)
+        return false;
+    if((size_t)(144000 * bitrate / srate + padding) != size)
+        return false;
+
+    const int table = l2_table(version != 3, bitrate / 2, srate);
+    const int sblimit = l2_sblimit[table];
+    int bound = (mode == L2_MODE_JOINT_STEREO) ? (mode_ext + 1) * 4 : sblimit;
+    if(bound > sblimit)
+        bound = sblimit;
+
+    /* source channel only, the other channel is skipped */
+    uint8_t alloc[L2_SBLIMIT];
+    uint8_t scfsi[L2_SBLIMIT];
+    uint8_t scf[L2_SBLIMIT][3];
+    uint16_t sample[L2_GRANULES][L2_SBLIMIT][3];
+
+    l2_bits_t r = { (uint8_t *)src, size * 8, 32 };
+    if(is_crc)
+        r.pos += 16;
+
+    uint8_t alloc_other[L2_SBLIMIT];
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        int nbal;
+        l2_subband(table, sb, &nbal);
+        if(sb < bound)
+        {
+            const uint8_t a0 = bits_get(&r, nbal);
+            const uint8_t a1 = bits_get(&r, nbal);
+            alloc[sb] = (channel == 0) ? a0 : a1;
+            alloc_other[sb] = (channel == 0) ? a1 : a0;
+        }
+        else
+        {
+            alloc[sb] = bits_get(&r, nbal);
+            alloc_other[sb] = alloc[sb];
+        }
+    }
+
+    uint8_t scfsi_other[L2_SBLIMIT];
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        for(int ch = 0; ch < 2; ++ch)
+        {
+            const bool is_source = (ch == channel);
+            const uint8_t a = (is_source) ? alloc[sb] : alloc_other[sb];
+            if(!a)
+                continue;
+            const uint8_t value = bits_get(&r, 2);
+            if(is_source)
+                scfsi[sb] = value;
+            else
+                scfsi_other[sb] = value;
+        }
+    }
+
+    /* scfsi: 0 - three scale factors, 1 and 3 - two, 2 - one */
+    static const uint8_t scf_count[4] = { 3, 2, 1, 2 };
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        for(int ch = 0; ch < 2; ++ch)
+        {
+            const bool is_source = (ch == channel);
+            const uint8_t a = (is_source) ? alloc[sb] : alloc_other[sb];
+            if(!a)
+                continue;
+            const int count = scf_count[(is_source) ? scfsi[sb] : scfsi_other[sb]];
+            for(int i = 0; i < count; ++i)
+            {
+                const uint8_t value = bits_get(&r, 6);
+                if(is_source)
+                    scf[sb][i] = value;
+            }
+        }
+    }
+
+    for(int gr = 0; gr < L2_GRANULES; ++gr)
+    {
+        for(int sb = 0; sb < sblimit; ++sb)
+        {
+            int nbal;
+            const uint8_t *const quant = l2_subband(table, sb, &nbal);
+            const int ch_count = (sb < bound) ? 2 : 1;
+            for(int ch = 0; ch < ch_count; ++ch)
+            {
+                const bool is_source = (sb >= bound || ch == channel);
+                const uint8_t a = (is_source) ? alloc[sb] : alloc_other[sb];
+                if(!a)
+                    continue;
+                const int bits = l2_quant_bits[quant[a - 1]];
+                const int count = (bits < 0) ? 1 : 3;
+                for(int i = 0; i < count; ++i)
+                {
+                    const uint16_t value = bits_get(&r, (bits < 0) ? -bits : bits);
+                    if(is_source)
+                        sample[gr][sb][i] = value;
+                }
+            }
+        }
+    }
+
+    if(r.pos > r.size)
+        return false;
+
+    /* joint stereo, mode extension 0, without CRC */
+    memset(dst, 0, size);
+    dst[0] = src[0];
+    dst[1] = src[1] | 0x01;
+    dst[2] = src[2];
+    dst[3] = (L2_MODE_JOINT_STEREO << 6) | (src[3] & 0x0F);
+
+    const int out_bound = (L2_BOUND < sblimit) ? L2_BOUND : sblimit;
+    l2_bits_t w = { dst, size * 8, 32 };
+
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        int nbal;
+        l2_subband(table, sb, &nbal);
+        bits_put(&w, alloc[sb], nbal);
+        if(sb < out_bound)
+            bits_put(&w, alloc[sb], nbal);
+    }
+
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        if(!alloc[sb])
+            continue;
+        bits_put(&w, scfsi[sb], 2);
+        bits_put(&w, scfsi[sb], 2);
+    }
+
+    for(int sb = 0; sb < sblimit; ++sb)
+    {
+        if(!alloc[sb])
+            continue;
+        const int count = scf_count[scfsi[sb]];
+        for(int ch = 0; ch < 2; ++ch)
+        {
+            for(int i = 0; i < count; ++i)
+                bits_put(&w, scf[sb][i], 6);
+        }
+    }
+
+    for(int gr = 0; gr < L2_GRANULES; ++gr)
+    {
+        for(int sb = 0; sb < sblimit; ++sb)
+        {
+            if(!alloc[sb])
+                continue;
+
+            int nbal;
+            const uint8_t *const quant = l2_subband(table, sb, &nbal);
+            const int bits = l2_quant_bits[quant[alloc[sb] - 1]];
+            const int count = (bits < 0) ? 1 : 3;
+            const int ch_count = (sb < out_bound) ? 2 : 1;
+            for(int ch = 0; ch < ch_count; ++ch)
+            {
+                for(int i = 0; i < count; ++i)
+                    bits_put(&w, sample[gr][sb][i], (bits < 0) ? -bits : bits);
+            }
+        }
+    }
+
+    return w.pos <= w.size;
+}
@@ -0,0 +1,41 @@
+/*
+ * Astra Module: MixAudio
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MIXAUDIO_LAYER2_H_
+#define _MIXAUDIO_LAYER2_H_ 1
+
+#include <astra.h>
+
+/*
+ * MPEG audio Layer II channel copy without the decoding. The frame is written
+ * in the joint stereo mode with the intensity bound 4: the subbands below the
+ * bound keep the samples of the source channel for both channels, the upper
+ * subbands have one set of the samples and the same scale factors for both
+ * channels. So the output channels are equal to the source channel, the
+ * quantized values are not changed.
+ *
+ * channel - 0 copy the left channel to the right, 1 - the right to the left.
+ * dst should have size bytes. Returns false if the frame is not Layer II
+ * stereo, the frame size is not equal to size, or the bits of the source
+ * channel do not fit the frame, then the frame should be transcoded.
+ */
+bool mpa_l2_copy_channel(const uint8_t *src, size_t size, uint8_t *dst, int channel);
+
+#endif /* _MIXAUDIO_LAYER2_H_ */
@@ -27,14 +27,46 @@
  *      direction   - string, audio channel copying direction,
  *                    "LL" (by default) replace right channel to the left
  *                    "RR" replace left channel to the right
+ *      transcode   - boolean, decode and encode all frames with libavcodec,
+ *                    by default Layer II stereo frames are remixed without
+ *                    the decoding
+ *
+ * Audio PES are transcoded on the worker thread of the instance. The main
+ * thread queues the complete PES, the worker decodes all frames of the PES,
+ * mixes and encodes them, and returns the PES with the original header, so
+ * PTS is kept. Mono payload is returned as is without the decoding.
+ *
+ * Layer II frames are remixed in the compressed domain (see layer2.h): the
+ * quantized samples of the source channel are written for both channels.
+ * Frames that could not be remixed this way are transcoded with libavcodec.
  */
 
 #include <astra.h>
 
 #include <libavcodec/avcodec.h>
 
+#include "layer2.h"
+
 #define MSG(_msg) "[mixaudio] " _msg
 
+/* maximum size of the audio PES, larger PES are dropped */
+#define MIXAUDIO_PES_SIZE (64 * 1024)
+/* size of the queues to the worker and back */
+#define MIXAUDIO_QUEUE_SIZE (1024 * 1024)
+
+typedef enum
+{
+    MIXAUDIO_FRAME_TRANSCODE = 0,
+    MIXAUDIO_FRAME_PASS = 1,
+} mixaudio_frame_type_t;
+
+/* queue item header, followed by the PES */
+typedef struct
+{
+    uint32_t size;
+    uint32_t type;
+} mixaudio_frame_t;
+
 typedef enum
 {
     MIXAUDIO_DIRECTION_NONE = 0,
@@ -48,31 +80,51 @@ struct module_data_t
 
     int pid;
     mixaudio_direction_t direction;
+    bool is_transcode; // libavcodec only
 
-    // ffmpeg
-    AVPacket davpkt;
-    AVPacket eavpkt;
+    // PES packets
+    mpegts_pes_t *pes_i; // input
+    mpegts_pes_t *pes_o; // output, returned by the worker
 
-    AVFrame *frame;
+    // queue item to the worker
+    uint8_t *frame;
+    uint64_t drops;
 
-    AVCodec *decoder;
-    AVCodecContext *ctx_decode;
-    AVCodec *encoder;
-    AVCodecContext *ctx_encode;
+    bool is_thread_started;
+    asc_thread_t *thread;
+    asc_thread_buffer_t *thread_input; // PES to transcode
+    asc_thread_buffer_t *thread_output; // transcoded PES
 
-    // PES packets
-    mpegts_pes_t *pes_i; // input
-    mpegts_pes_t *pes_o; // output
+    // used by the worker thread only
+    struct
+    {
+        AVPacket davpkt;
+        AVPacket eavpkt;
+
+        AVFrame *frame;
 
-    // mpeg frame size
-    size_t fsize;
+        AVCodec *decoder;
+        AVCodecContext *ctx_decode;
+        AVCodec *encoder;
+        AVCodecContext *ctx_encode;
 
-    // splitted frame buffer
-    uint8_t fbuffer[8192];
-    size_t fbuffer_skip;
+        bool is_error; // decoder is not available, PES are returned as is
 
-    int count;
-    int max_count;
+        // mpeg frame size
+        size_t fsize;
+
+        // splitted frame buffer
+        uint8_t fbuffer[8192];
+        size_t fbuffer_skip;
+
+        // remixed frame, compressed domain
+        uint8_t mix[8192];
+
+        mpegts_pes_t *pes; // input
+        // output queue item
+        uint8_t out[sizeof(mixaudio_frame_t) + MIXAUDIO_PES_SIZE];
+        size_t out_size;
+    } worker;
 };
 
 // buffer16[i  ] - L
@@ -96,87 +148,135 @@ void mix_buffer_rr(uint8_t *buffer, int buffer_size)
         buffer16[i] = buffer16[i+1];
 }
 
-/* callbacks */
+/*
+ * oooo     oooo  ooooooo  oooooooooo  oooo   oooo ooooooooooo oooooooooo
+ *  88   88  88 o888   888o 888    888  888  o88    888    88   888    888
+ *   88 888 88  888     888 888oooo88   888888      888ooo8     888oooo88
+ *    888 888   888o   o888 888  88o    888  88o    888    oo   888  88o
+ *     8   8      88ooo88  o888o  88o8 o888o o888o o888ooo8888 o888o  88o8
+ *
+ */
+
+static void worker_send(module_data_t *mod, const uint8_t *pes, size_t size
+                        , mixaudio_frame_type_t type)
+{
+    mixaudio_frame_t *const frame = (mixaudio_frame_t *)mod->worker.out;
+    frame->size = size;
+    frame->type = type;
+    if(pes != &mod->worker.out[sizeof(mixaudio_frame_t)])
+        memcpy(&mod->worker.out[sizeof(mixaudio_frame_t)], pes, size);
+
+    const size_t item_size = sizeof(mixaudio_frame_t) + size;
+    if(asc_thread_buffer_write(mod->thread_output, mod->worker.out, item_size)
+       != (ssize_t)item_size)
+    {
+        asc_log_debug(MSG("output queue overflow"));
+    }
+}
 
-static void pack_es(module_data_t *mod, uint8_t *data, size_t size)
+/* encoded frames are collected in the output PES with the header of the input PES */
+static void pack_es(module_data_t *mod, const uint8_t *data, size_t size)
 {
-    // hack to set PTS from source PES
-    if(!mod->pes_o->buffer_size)
+    uint8_t *const pes = &mod->worker.out[sizeof(mixaudio_frame_t)];
+
+    if(!mod->worker.out_size)
     {
         // copy PES header from original PES
-        const size_t pes_hdr = 6 + 3 + mod->pes_i->buffer[8];
-        memcpy(mod->pes_o->buffer, mod->pes_i->buffer, pes_hdr);
-        mod->pes_o->buffer_size = pes_hdr;
+        const size_t pes_hdr = PES_HEADER_SIZE + 3 + mod->worker.pes->buffer[8];
+        memcpy(pes, mod->worker.pes->buffer, pes_hdr);
+        mod->worker.out_size = pes_hdr;
     }
 
-    mpegts_pes_add_data(mod->pes_o, data, size);
-    ++mod->count;
-
-    if(mod->count == mod->max_count)
+    if(mod->worker.out_size + size > MIXAUDIO_PES_SIZE)
     {
-        mpegts_pes_demux(mod->pes_o
-                         , (ts_callback_t)__module_stream_send
-                         , &mod->__stream);
-        mod->pes_o->buffer_size = 0;
-        mod->count = 0;
+        asc_log_error(MSG("output PES is too large"));
+        return;
     }
+
+    memcpy(&pes[mod->worker.out_size], data, size);
+    mod->worker.out_size += size;
+}
+
+static void pack_flush(module_data_t *mod)
+{
+    if(!mod->worker.out_size)
+        return;
+
+    uint8_t *const pes = &mod->worker.out[sizeof(mixaudio_frame_t)];
+    const size_t pes_size = mod->worker.out_size - PES_HEADER_SIZE;
+    pes[4] = (pes_size > 0xFFFF) ? 0x00 : ((pes_size >> 8) & 0xFF);
+    pes[5] = (pes_size > 0xFFFF) ? 0x00 : ((pes_size     ) & 0xFF);
+
+    worker_send(mod, pes, mod->worker.out_size, MIXAUDIO_FRAME_TRANSCODE);
+    mod->worker.out_size = 0;
 }
 
 static bool transcode(module_data_t *mod, const uint8_t *data)
 {
-    av_init_packet(&mod->davpkt);
+    if(!mod->is_transcode)
+    {
+        const int channel = (mod->direction == MIXAUDIO_DIRECTION_LL) ? 0 : 1;
+        if(mpa_l2_copy_channel(data, mod->worker.fsize, mod->worker.mix, channel))
+        {
+            pack_es(mod, mod->worker.mix, mod->worker.fsize);
+            return true;
+        }
+    }
+
+    av_init_packet(&mod->worker.davpkt);
 
-    mod->davpkt.data = (uint8_t *)data;
-    mod->davpkt.size = mod->fsize;
+    mod->worker.davpkt.data = (uint8_t *)data;
+    mod->worker.davpkt.size = mod->worker.fsize;
 
-    while(mod->davpkt.size > 0)
+    while(mod->worker.davpkt.size > 0)
     {
         int got_frame = 0;
 
-        if(!mod->frame)
-            mod->frame = avcodec_alloc_frame();
+        if(!mod->worker.frame)
+            mod->worker.frame = avcodec_alloc_frame();
         else
-            avcodec_get_frame_defaults(mod->frame);
+            avcodec_get_frame_defaults(mod->worker.frame);
 
-        const int len_d = avcodec_decode_audio4(mod->ctx_decode, mod->frame
-                                                , &got_frame, &mod->davpkt);
+        const int len_d = avcodec_decode_audio4(mod->worker.ctx_decode, mod->worker.frame
+                                                , &got_frame, &mod->worker.davpkt);
 
         if(len_d < 0)
         {
             asc_log_error(MSG("error while decoding"));
-            mod->fsize = 0;
-            mod->davpkt.size = 0;
+            mod->worker.fsize = 0;
+            mod->worker.davpkt.size = 0;
             return false;
         }
         if(got_frame)
         {
             const int data_size
                 = av_samples_get_buffer_size(NULL
-                                             , mod->ctx_decode->channels
-                                             , mod->frame->nb_samples
-                                             , mod->ctx_decode->sample_fmt
+                                             , mod->worker.ctx_decode->channels
+                                             , mod->worker.frame->nb_samples
+                                             , mod->worker.ctx_decode->sample_fmt
                                              , 1);
 
             if(mod->direction == MIXAUDIO_DIRECTION_LL)
-                mix_buffer_ll(mod->frame->data[0], data_size);
+                mix_buffer_ll(mod->worker.frame->data[0], data_size);
             else
-                mix_buffer_rr(mod->frame->data[0], data_size);
+                mix_buffer_rr(mod->worker.frame->data[0], data_size);
 
             int got_packet = 0;
-            av_init_packet(&mod->eavpkt);
-            mod->eavpkt.data = NULL;
-            mod->eavpkt.size = 0;
-            if(avcodec_encode_audio2(mod->ctx_encode, &mod->eavpkt, mod->frame, &got_packet) >= 0
+            av_init_packet(&mod->worker.eavpkt);
+            mod->worker.eavpkt.data = NULL;
+            mod->worker.eavpkt.size = 0;
+            if(avcodec_encode_audio2(mod->worker.ctx_encode, &mod->worker.eavpkt
+                                     , mod->worker.frame, &got_packet) >= 0
                && got_packet)
             {
                 // TODO: read http://bbs.rosoo.net/thread-14926-1-1.html
-                pack_es(mod, mod->eavpkt.data, mod->eavpkt.size);
-                av_free_packet(&mod->eavpkt);
+                pack_es(mod, mod->worker.eavpkt.data, mod->worker.eavpkt.size);
+                av_free_packet(&mod->worker.eavpkt);
             }
         }
 
-        mod->davpkt.size -= len_d;
-        mod->davpkt.data += len_d;
+        mod->worker.davpkt.size -= len_d;
+        mod->worker.davpkt.data += len_d;
     }
 
     return true;
@@ -216,20 +316,79 @@ const uint16_t mpeg_srate[4][4] = {
 /*   1 */ { 44100, 48000, 32000, 0 }
 };
 
-static void mux_pes(void *arg, mpegts_pes_t *pes)
+static inline const uint8_t * pes_es(const mpegts_pes_t *pes)
 {
-    module_data_t *mod = arg;
-
-    const uint8_t *ptr;
     if(PES_IS_SYNTAX_SPEC(pes))
-        ptr = &pes->buffer[PES_HEADER_SIZE + 3 + pes->buffer[8]];
+        return &pes->buffer[PES_HEADER_SIZE + 3 + pes->buffer[8]];
     else
-        ptr = &pes->buffer[PES_HEADER_SIZE];
+        return &pes->buffer[PES_HEADER_SIZE];
+}
 
-    const uint8_t *const ptr_end = pes->buffer + pes->buffer_size;
-    const size_t es_size = ptr_end - ptr;
+static bool decoder_open(module_data_t *mod, uint8_t mpeg_v)
+{
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    switch(mpeg_v)
+    {
+        case 0:
+        case 2:
+            codec_id = AV_CODEC_ID_MP2;
+            break;
+        case 3:
+            codec_id = AV_CODEC_ID_MP1;
+            break;
+        default:
+            break;
+    }
+
+    mod->worker.decoder = avcodec_find_decoder(codec_id);
+    if(!mod->worker.decoder)
+    {
+        asc_log_error(MSG("mp3 decoder is not found"));
+        return false;
+    }
+
+    mod->worker.ctx_decode = avcodec_alloc_context3(mod->worker.decoder);
+    if(avcodec_open2(mod->worker.ctx_decode, mod->worker.decoder, NULL) < 0)
+    {
+        mod->worker.decoder = NULL;
+        asc_log_error(MSG("failed to open mp3 decoder"));
+        return false;
+    }
+
+    return true;
+}
 
-    if(!mod->fbuffer_skip)
+/* opened by the worker on the first frame, not on the config load */
+static bool encoder_open(module_data_t *mod)
+{
+    mod->worker.encoder = avcodec_find_encoder(CODEC_ID_MP2);
+    if(!mod->worker.encoder)
+    {
+        asc_log_error(MSG("mp3 encoder is not found"));
+        return false;
+    }
+
+    mod->worker.ctx_encode = avcodec_alloc_context3(mod->worker.encoder);
+    mod->worker.ctx_encode->bit_rate = 192000;
+    mod->worker.ctx_encode->sample_rate = 48000;
+    mod->worker.ctx_encode->channels = 2;
+    mod->worker.ctx_encode->sample_fmt = AV_SAMPLE_FMT_S16;
+    mod->worker.ctx_encode->channel_layout = av_get_channel_layout("stereo");
+    if(avcodec_open2(mod->worker.ctx_encode, mod->worker.encoder, NULL) < 0)
+    {
+        asc_log_error(MSG("failed to open mp3 encoder"));
+        return false;
+    }
+
+    return true;
+}
+
+static void transcode_pes(module_data_t *mod, size_t size)
+{
+    const uint8_t *ptr = pes_es(mod->worker.pes);
+    const uint8_t *const ptr_end = mod->worker.pes->buffer + size;
+
+    if(!mod->worker.fbuffer_skip)
     {
         while(ptr < ptr_end - 1)
         {
@@ -239,84 +398,54 @@ static void mux_pes(void *arg, mpegts_pes_t *pes)
         }
     }
 
-    if(!mod->fsize)
+    if(!mod->worker.fsize)
     {
         const uint8_t mpeg_v = (ptr[1] & 0x18) >> 3; // version
         const uint8_t mpeg_l = (ptr[1] & 0x06) >> 1; // layer
-        // const uint8_t mpeg_c = (ptr[3] & 0xC0) >> 6; // channel mode
         const uint8_t mpeg_br = (ptr[2] & 0xF0) >> 4; // bitrate
         const uint8_t mpeg_sr = (ptr[2] & 0x0C) >> 2; // sampling rate
         const uint8_t mpeg_p = (ptr[2] & 0x02) >> 1; // padding
         const uint8_t brate_id = mpeg_brate_id[mpeg_v][mpeg_l];
         const uint16_t br = mpeg_brate[brate_id][mpeg_br];
         const uint16_t sr = mpeg_srate[mpeg_v][mpeg_sr];
-        mod->fsize = (144 * br * 1000) / (sr + mpeg_p);
-
-        asc_log_debug(MSG("set frame size = %lu"), mod->fsize);
+        if(!sr)
+            return;
+        mod->worker.fsize = (144 * br * 1000) / (sr + mpeg_p);
+        if(!mod->worker.fsize || mod->worker.fsize > sizeof(mod->worker.fbuffer))
+        {
+            mod->worker.fsize = 0;
+            return;
+        }
 
-        if(!(es_size % mod->fsize))
-            mod->max_count = es_size / mod->fsize;
-        else
-            mod->max_count = 8;
+        asc_log_debug(MSG("set frame size = %zu"), mod->worker.fsize);
 
-        if(!mod->decoder)
+        if(   (!mod->worker.decoder && !decoder_open(mod, mpeg_v))
+           || (!mod->worker.encoder && !encoder_open(mod)))
         {
-            enum AVCodecID codec_id = AV_CODEC_ID_NONE;
-            switch(mpeg_v)
-            {
-                case 0:
-                case 2:
-                    codec_id = AV_CODEC_ID_MP2;
-                    break;
-                case 3:
-                    codec_id = AV_CODEC_ID_MP1;
-                    break;
-                default:
-                    break;
-            }
-
-            int is_err = 1;
-            do
-            {
-                mod->decoder = avcodec_find_decoder(codec_id);
-                if(!mod->decoder)
-                {
-                    asc_log_error(MSG("mp3 decoder is not found"));
-                    break;
-                }
-
-                mod->ctx_decode = avcodec_alloc_context3(mod->decoder);
-                if(avcodec_open2(mod->ctx_decode, mod->decoder, NULL) < 0)
-                {
-                    mod->decoder = NULL;
-                    asc_log_error(MSG("failed to open mp3 decoder"));
-                    break;
-                }
-
-                is_err = 0;
-            } while(0);
-
-            if(is_err)
-            {
-                mod->direction = MIXAUDIO_DIRECTION_NONE;
-                return;
-            }
+            mod->worker.is_error = true;
+            worker_send(mod, mod->worker.pes->buffer, size, MIXAUDIO_FRAME_PASS);
+            return;
         }
     }
 
-    if(mod->fbuffer_skip)
+    if(mod->worker.fbuffer_skip)
     {
-        const size_t rlen = mod->fsize - mod->fbuffer_skip;
-        memcpy(&mod->fbuffer[mod->fbuffer_skip], ptr, rlen);
-        mod->fbuffer_skip = 0;
-        if(!transcode(mod, mod->fbuffer))
+        const size_t rlen = mod->worker.fsize - mod->worker.fbuffer_skip;
+        if(ptr + rlen > ptr_end)
+        {
+            mod->worker.fbuffer_skip = 0;
+            return;
+        }
+        memcpy(&mod->worker.fbuffer[mod->worker.fbuffer_skip], ptr, rlen);
+        mod->worker.fbuffer_skip = 0;
+        if(!transcode(mod, mod->worker.fbuffer))
             return;
         ptr += rlen;
     }
 
     while(1)
     {
-        const uint8_t *const nptr = ptr + mod->fsize;
+        const uint8_t *const nptr = ptr + mod->worker.fsize;
         if(nptr < ptr_end)
         {
             if(!transcode(mod, ptr))
@@ -330,11 +459,121 @@ static void mux_pes(void *arg, mpegts_pes_t *pes)
         }
         else /* nptr > ptr_end */
         {
-            mod->fbuffer_skip = ptr_end - ptr;
-            memcpy(mod->fbuffer, ptr, mod->fbuffer_skip);
+            mod->worker.fbuffer_skip = ptr_end - ptr;
+            memcpy(mod->worker.fbuffer, ptr, mod->worker.fbuffer_skip);
+            break;
+        }
+    }
+
+    pack_flush(mod);
+}
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_thread_started = true;
+
+    while(mod->is_thread_started)
+    {
+        /* the item is written at once, the PES follows the header */
+        mixaudio_frame_t frame;
+        if(asc_thread_buffer_read(mod->thread_input, &frame, sizeof(frame)) != sizeof(frame))
+        {
+            asc_usleep(1000);
+            continue;
+        }
+
+        if(asc_thread_buffer_read(mod->thread_input, mod->worker.pes->buffer, frame.size)
+           != (ssize_t)frame.size)
+        {
+            continue;
+        }
+
+        if(frame.type == MIXAUDIO_FRAME_PASS || mod->worker.is_error)
+            worker_send(mod, mod->worker.pes->buffer, frame.size, MIXAUDIO_FRAME_PASS);
+        else
+            transcode_pes(mod, frame.size);
+    }
+}
+
+/*
+ * oooo     oooo      o      ooooo oooo   oooo
+ *  8888o   888      888      888   8888o  88
+ *  88 888o8 88     8  88     888   88 888o88
+ *  88  888  88    8oooo88    888   88   8888
+ * o88o  8  o88o o88o  o888o o888o o88o    88
+ *
+ */
+
+/* returns the transcoded PES in order, the demux keeps the continuity counter */
+static void on_thread_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mixaudio_frame_t frame;
+    if(asc_thread_buffer_read(mod->thread_output, &frame, sizeof(frame)) != sizeof(frame))
+        return;
+
+    if(asc_thread_buffer_read(mod->thread_output, mod->pes_o->buffer, frame.size)
+       != (ssize_t)frame.size)
+    {
+        return;
+    }
+
+    mod->pes_o->buffer_size = frame.size;
+    mpegts_pes_demux(mod->pes_o
+                     , (ts_callback_t)__module_stream_send
+                     , &mod->__stream);
+    mod->pes_o->buffer_size = 0;
+}
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_thread_started = false;
+
+    ASC_FREE(mod->thread, asc_thread_destroy);
+    ASC_FREE(mod->thread_input, asc_thread_buffer_destroy);
+    ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
+}
+
+static void mux_pes(void *arg, mpegts_pes_t *pes)
+{
+    module_data_t *mod = arg;
+
+    if(pes->buffer_size > MIXAUDIO_PES_SIZE)
+    {
+        asc_log_error(MSG("PES is too large: %u"), pes->buffer_size);
+        return;
+    }
+
+    /* channel mode of the first frame, 3 - single channel */
+    mixaudio_frame_type_t type = MIXAUDIO_FRAME_TRANSCODE;
+    const uint8_t *ptr = pes_es(pes);
+    const uint8_t *const ptr_end = pes->buffer + pes->buffer_size;
+    for(; ptr < ptr_end - 3; ++ptr)
+    {
+        if(ptr[0] == 0xFF && (ptr[1] & 0xF0) == 0xF0)
+        {
+            if(((ptr[3] & 0xC0) >> 6) == 3)
+                type = MIXAUDIO_FRAME_PASS;
             break;
         }
     }
+
+    mixaudio_frame_t *const frame = (mixaudio_frame_t *)mod->frame;
+    frame->size = pes->buffer_size;
+    frame->type = type;
+    memcpy(&mod->frame[sizeof(mixaudio_frame_t)], pes->buffer, pes->buffer_size);
+
+    const size_t item_size = sizeof(mixaudio_frame_t) + pes->buffer_size;
+    if(asc_thread_buffer_write(mod->thread_input, mod->frame, item_size) != (ssize_t)item_size)
+    {
+        ++mod->drops;
+        asc_log_debug(MSG("worker queue overflow"));
+    }
 }
 
 static void on_ts(module_data_t *mod, const uint8_t *ts)
@@ -400,52 +639,58 @@ static void module_init(module_data_t *mod)
     else if(!strcasecmp(direction, "RR"))
         mod->direction = MIXAUDIO_DIRECTION_RR;
 
-    av_log_set_callback(ffmpeg_log_callback);
+    module_option_boolean("transcode", &mod->is_transcode);
 
-    avcodec_register_all();
-    do
+    /* codecs are registered once for all instances */
+    static bool is_codec_init = false;
+    if(!is_codec_init)
     {
-        mod->encoder = avcodec_find_encoder(CODEC_ID_MP2);
-        if(!mod->encoder)
-        {
-            asc_log_error(MSG("mp3 encoder is not found"));
-            astra_abort();
-        }
-        mod->ctx_encode = avcodec_alloc_context3(mod->encoder);
-        mod->ctx_encode->bit_rate = 192000;
-        mod->ctx_encode->sample_rate = 48000;
-        mod->ctx_encode->channels = 2;
-        mod->ctx_encode->sample_fmt = AV_SAMPLE_FMT_S16;
-        mod->ctx_encode->channel_layout = av_get_channel_layout("stereo");
-        if(avcodec_open2(mod->ctx_encode, mod->encoder, NULL) < 0)
-        {
-            asc_log_error(MSG("failed to open mp3 encoder"));
-            astra_abort();
-        }
-
-        av_init_packet(&mod->davpkt);
+        is_codec_init = true;
+        av_log_set_callback(ffmpeg_log_callback);
+        avcodec_register_all();
+    }
 
-        mod->pes_i = mpegts_pes_init(MPEGTS_PACKET_AUDIO, mod->pid, 0);
-        mod->pes_o = mpegts_pes_init(MPEGTS_PACKET_AUDIO, mod->pid, 0);
-    } while(0);
+    av_init_packet(&mod->worker.davpkt);
+
+    mod->pes_i = mpegts_pes_init(MPEGTS_PACKET_AUDIO, mod->pid, 0);
+    mod->pes_o = mpegts_pes_init(MPEGTS_PACKET_AUDIO, mod->pid, 0);
+    mod->worker.pes = mpegts_pes_init(MPEGTS_PACKET_AUDIO, mod->pid, 0);
+    mod->frame = (uint8_t *)malloc(sizeof(mixaudio_frame_t) + MIXAUDIO_PES_SIZE);
+
+    mod->thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->thread, "mixaudio");
+    mod->thread_input = asc_thread_buffer_init(MIXAUDIO_QUEUE_SIZE);
+    mod->thread_output = asc_thread_buffer_init(MIXAUDIO_QUEUE_SIZE);
+    asc_thread_start(  mod->thread
+                     , thread_loop
+                     , on_thread_read, mod->thread_output
+                     , on_thread_close);
 }
 
 static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
-    if(mod->ctx_encode)
-        avcodec_close(mod->ctx_encode);
-    if(mod->ctx_decode)
-        avcodec_close(mod->ctx_decode);
-    if(mod->frame)
-        avcodec_free_frame(&mod->frame);
-    av_free_packet(&mod->davpkt);
+    /* the worker is stopped before its codec contexts are released */
+    if(mod->thread)
+        on_thread_close(mod);
+
+    if(mod->worker.ctx_encode)
+        avcodec_close(mod->worker.ctx_encode);
+    if(mod->worker.ctx_decode)
+        avcodec_close(mod->worker.ctx_decode);
+    if(mod->worker.frame)
+        avcodec_free_frame(&mod->worker.frame);
+    av_free_packet(&mod->worker.davpkt);
+
+    ASC_FREE(mod->frame, free);
 
     if(mod->pes_i)
         mpegts_pes_destroy(mod->pes_i);
     if(mod->pes_o)
         mpegts_pes_destroy(mod->pes_o);
+    if(mod->worker.pes)
+        mpegts_pes_destroy(mod->worker.pes);
 }
 
 MODULE_STREAM_METHODS()
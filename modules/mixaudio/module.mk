@@ -1,4 +1,4 @@
-SOURCES="mixaudio.c"
+SOURCES="mixaudio.c layer2.c"
 MODULES="mixaudio"
 
 check_cflags()
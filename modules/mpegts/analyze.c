@@ -25,14 +25,27 @@
  * Module Options:
  *      upstream    - object, stream instance returned by module_instance:stream()
  *      name        - string, analyzer name
- *      rate_stat   - boolean, dump bitrate with 10ms interval
+ *      rate_stat   - boolean, measure bitrate in 10ms intervals. the quantiles
+ *                    of the last second are data.rate and the metric
+ *                    astra_analyze_rate_kbps
  *      join_pid    - boolean, request all SI tables on the upstream module
+ *      tr101290    - boolean, measure TR 101 290 priority 1 and 2 indicators
+ *      async       - boolean, analyze a copy of the stream on the worker thread,
+ *                    off the data path. the copy is lossy, the packets dropped
+ *                    while the thread is late are counted in total.tap_drops
+ *      thread_cpus, thread_numa, thread_priority
+ *                  - worker thread placement, see module_option_thread().
+ *                    default priority is SCHED_IDLE
  *      callback    - function(data), events callback:
  *                    data.error    - string,
  *                    data.psi      - table, psi information (PAT, PMT, CAT, SDT)
  *                    data.analyze  - table, per pid information: errors, bitrate
  *                    data.on_air   - boolean, comes with data.analyze, stream status
- *                    data.rate     - table, rate_stat array
+ *                    data.tr101290 - table, comes with data.analyze, error counters
+ *                    data.rate     - table, comes with data.analyze, rate_stat
+ *                                    in kbit/s: min, p50, p95, p99, max
+ *                    with data.analyze the data is the stat object, reused on
+ *                    each interval. values are valid until the next interval
  */
 
 #include <astra.h>
@@ -49,6 +62,17 @@ typedef struct
     uint32_t cc_error;  // Continuity Counter
     uint32_t sc_error;  // Scrambled
     uint32_t pes_error; // PES header
+
+    // values of the last interval, see on_check_stat()
+    int idx_stat;
+    struct
+    {
+        int pid;
+        uint32_t bitrate;
+        uint32_t cc_error;
+        uint32_t sc_error;
+        uint32_t pes_error;
+    } stat;
 } analyze_item_t;
 
 typedef struct
@@ -57,6 +81,33 @@ typedef struct
     uint32_t crc;
 } pmt_checksum_t;
 
+#define RATE_INTERVAL 10000 // us
+#define RATE_RING_SIZE 100 // intervals of the last second
+#define RATE_QUANTILE_COUNT 5
+
+/* per PID state of the worker thread, see the TAP section */
+typedef struct
+{
+    uint32_t type; // written by the main thread
+
+    // taken and reset by the main thread
+    uint32_t packets;
+    uint32_t cc_error;
+    uint32_t sc_error;
+    uint32_t pes_error;
+
+    // worker thread only
+    uint8_t cc;
+    uint8_t gap;
+} analyze_tap_item_t;
+
+/* packets dropped by the tap, written before the next packets */
+typedef struct
+{
+    uint64_t position; // bytes written to the tap before the gap
+    uint64_t count;
+} analyze_tap_gap_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -67,6 +118,8 @@ struct module_data_t
     int bitrate_limit;
     bool join_pid;
 
+    mpegts_tr101290_t *tr101290;
+
     bool cc_check; // to skip initial cc errors
     bool video_check; // increase bitrate_limit for channel with video stream
 
@@ -75,7 +128,7 @@ struct module_data_t
     uint16_t tsid;
 
     asc_timer_t *check_stat;
-    analyze_item_t *stream[MAX_PID];
+    mpegts_pid_map_t stream; // analyze_item_t * by PID
 
     mpegts_psi_t *pat;
     mpegts_psi_t *cat;
@@ -89,15 +142,80 @@ struct module_data_t
     uint8_t sdt_max_section_id;
     uint32_t *sdt_checksum_list;
 
-    // rate_stat
+    // status report, objects are reused between the intervals
+    int idx_stat;
+    int idx_stat_total;
+    int idx_stat_tr101290;
+    int stat_items; // items in the "analyze" table
+    struct
+    {
+        bool on_air;
+        uint32_t bitrate;
+        uint32_t cc_errors;
+        uint32_t pes_errors;
+        bool scrambled;
+        uint32_t tap_drops;
+    } stat;
+    mpegts_tr101290_stat_t tr101290_stat;
+
+    // rate_stat. packets in the intervals of RATE_INTERVAL, the ring is
+    // written by the worker thread in async mode
     uint64_t last_ts;
     uint32_t ts_count;
-    int rate_count;
-    int rate[10];
+    uint32_t rate_ring[RATE_RING_SIZE];
+    size_t rate_write;
+    uint64_t rate_value[RATE_QUANTILE_COUNT]; // kbit/s, see rate_stat_update()
+    int idx_stat_rate;
+    asc_metric_t *metric_list;
+
+    // async mode. the tap and the gap list are written by on_ts(),
+    // records are written by the worker
+    bool is_tap_started;
+    asc_thread_t *tap_thread;
+    asc_thread_buffer_t *tap;
+    asc_thread_buffer_t *tap_gap_list;
+    asc_thread_buffer_t *tap_record;
+    analyze_tap_item_t *tap_item; // by PID
+    uint32_t tap_drops; // since the last interval
+    uint64_t tap_write; // bytes written to the tap
+    uint64_t tap_gap_count; // dropped packets, not reported to the worker
+
+    // worker thread only
+    uint64_t tap_read;
+    analyze_tap_gap_t tap_gap_next;
+    bool is_tap_gap_next;
+    uint8_t tap_gap;
+    uint64_t tap_stat_time;
+    mpegts_tr101290_stat_t tap_tr101290; // reports since the last interval
+
+    asc_memstat_t *memstat;
 };
 
 #define MSG(_msg) "[analyze %s] " _msg, mod->name
 
+static inline analyze_item_t * stream_get(module_data_t *mod, uint16_t pid)
+{
+    return (analyze_item_t *)mpegts_pid_map_get(&mod->stream, pid);
+}
+
+static analyze_item_t * stream_item(module_data_t *mod, uint16_t pid)
+{
+    analyze_item_t *item = stream_get(mod, pid);
+    if(!item)
+    {
+        item = (analyze_item_t *)asc_calloc(mod->memstat, 1, sizeof(analyze_item_t));
+        mpegts_pid_map_set(&mod->stream, pid, (uintptr_t)item);
+    }
+    return item;
+}
+
+/* the worker thread learns the PID types from the PSI parsed by the main thread */
+static inline void tap_set_type(module_data_t *mod, uint16_t pid, uint32_t type)
+{
+    if(mod->tap_item)
+        __atomic_store_n(&mod->tap_item[pid].type, type, __ATOMIC_RELAXED);
+}
+
 static const char __pid[] = "pid";
 static const char __crc32[] = "crc32";
 static const char __pnr[] = "pnr";
@@ -109,13 +227,11 @@ static const char __callback[] = "callback";
 
 static void callback(module_data_t *mod)
 {
-    asc_assert((lua_type(lua, -1) == LUA_TTABLE), "table required");
+    asc_assert(  (lua_type(lua, -1) == LUA_TTABLE || lua_type(lua, -1) == LUA_TUSERDATA)
+               , "table required");
 
-    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
-    lua_pushvalue(lua, -2);
-    lua_call(lua, 1, 0);
-
-    lua_pop(lua, 1); // data
+    // delivered with the other notifications after the current events
+    module_lua_notify(mod, mod->idx_callback);
 }
 
 /*
@@ -187,32 +303,33 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         lua_setfield(lua, -2, __pid);
         lua_settable(lua, -3); // append to the "programs" table
 
-        if(!mod->stream[pid])
-            mod->stream[pid] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
+        analyze_item_t *item = stream_item(mod, pid);
 
         if(pnr != 0)
         {
-            mod->stream[pid]->type = MPEGTS_PACKET_PMT;
+            item->type = MPEGTS_PACKET_PMT;
             if(mod->join_pid)
                 module_stream_demux_join_pid(mod, pid);
             ++ mod->pmt_count;
         }
         else
         {
-            mod->stream[pid]->type = MPEGTS_PACKET_NIT;
+            item->type = MPEGTS_PACKET_NIT;
             if(mod->join_pid)
                 module_stream_demux_join_pid(mod, pid);
         }
+        tap_set_type(mod, pid, item->type);
     }
     lua_setfield(lua, -2, "programs");
 
     if(mod->pmt_checksum_list)
     {
-        free(mod->pmt_checksum_list);
+        asc_free(mod->pmt_checksum_list);
         mod->pmt_checksum_list = NULL;
     }
     if(mod->pmt_count > 0)
-        mod->pmt_checksum_list = (pmt_checksum_t *)calloc(mod->pmt_count, sizeof(pmt_checksum_t));
+        mod->pmt_checksum_list = (pmt_checksum_t *)asc_calloc(
+            mod->memstat, mod->pmt_count, sizeof(pmt_checksum_t));
 
     callback(mod);
 }
@@ -294,7 +411,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     const uint32_t crc32 = PSI_GET_CRC32(psi);
 
     // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
+    if(!mpegts_psi_check_crc32(psi))
     {
         lua_newtable(lua);
 
@@ -380,10 +497,8 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         lua_pushnumber(lua, streams_count++);
         lua_newtable(lua);
 
-        if(!mod->stream[pid])
-            mod->stream[pid] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-
-        mod->stream[pid]->type = mpegts_pes_type(type);
+        analyze_item_t *item = stream_item(mod, pid);
+        item->type = mpegts_pes_type(type);
 
         lua_pushnumber(lua, pid);
         lua_setfield(lua, -2, __pid);
@@ -402,10 +517,10 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
                 switch(desc_pointer[0])
                 {
                     case 0x59:
-                        mod->stream[pid]->type = MPEGTS_PACKET_SUB;
+                        item->type = MPEGTS_PACKET_SUB;
                         break;
                     case 0x6A:
-                        mod->stream[pid]->type = MPEGTS_PACKET_AUDIO;
+                        item->type = MPEGTS_PACKET_AUDIO;
                         break;
                     default:
                         break;
@@ -413,8 +528,9 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
             }
         }
         lua_setfield(lua, -2, __descriptors);
+        tap_set_type(mod, pid, item->type);
 
-        lua_pushstring(lua, mpegts_type_name(mod->stream[pid]->type));
+        lua_pushstring(lua, mpegts_type_name(item->type));
         lua_setfield(lua, -2, "type_name");
 
         lua_pushnumber(lua, type);
@@ -422,7 +538,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
 
         lua_settable(lua, -3); // append to the "streams" table
 
-        if(mod->stream[pid]->type == MPEGTS_PACKET_VIDEO)
+        if(item->type == MPEGTS_PACKET_VIDEO)
             mod->video_check = true;
     }
     lua_setfield(lua, -2, "streams");
@@ -452,7 +568,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     const uint32_t crc32 = PSI_GET_CRC32(psi);
 
     // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
+    if(!mpegts_psi_check_crc32(psi))
     {
         lua_newtable(lua);
 
@@ -470,7 +586,8 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     {
         const uint8_t max_section_id = SDT_GET_LAST_SECTION_NUMBER(psi);
         mod->sdt_max_section_id = max_section_id;
-        mod->sdt_checksum_list = (uint32_t *)calloc(max_section_id + 1, sizeof(uint32_t));
+        mod->sdt_checksum_list = (uint32_t *)asc_calloc(
+            mod->memstat, max_section_id + 1, sizeof(uint32_t));
     }
     const uint8_t section_id = SDT_GET_SECTION_NUMBER(psi);
     if(section_id > mod->sdt_max_section_id)
@@ -484,7 +601,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     if(mod->sdt_checksum_list[section_id] != 0)
     {
         // Reload stream
-        free(mod->sdt_checksum_list);
+        asc_free(mod->sdt_checksum_list);
         mod->sdt_checksum_list = NULL;
         return;
     }
@@ -546,62 +663,136 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
  *
  */
 
-static void append_rate(module_data_t *mod, int rate)
+static const uint8_t rate_quantile[RATE_QUANTILE_COUNT] = { 0, 50, 95, 99, 100 };
+
+static inline void append_rate(module_data_t *mod, uint32_t rate)
 {
-    mod->rate[mod->rate_count] = rate;
-    ++mod->rate_count;
-    if(mod->rate_count >= (int)(sizeof(mod->rate)/sizeof(*mod->rate)))
+    mod->rate_ring[mod->rate_write % RATE_RING_SIZE] = rate;
+    ++mod->rate_write;
+}
+
+/*
+ * now is the arrival time of the packets in microseconds.
+ * count 0 closes the intervals without packets
+ */
+static void rate_stat_append(module_data_t *mod, size_t count, uint64_t now)
+{
+    mod->ts_count += count;
+
+    uint64_t diff_interval = 0;
+    const uint64_t cur = now / RATE_INTERVAL;
+
+    if(cur != mod->last_ts)
     {
-        lua_newtable(lua);
-        lua_newtable(lua);
-        for(int i = 0; i < mod->rate_count; ++i)
+        if(mod->last_ts != 0 && cur > mod->last_ts)
+            diff_interval = cur - mod->last_ts;
+
+        mod->last_ts = cur;
+    }
+
+    if(diff_interval > 0)
+    {
+        if(diff_interval > 1)
         {
-            lua_pushnumber(lua, i + 1);
-            lua_pushnumber(lua, mod->rate[i]);
-            lua_settable(lua, -3);
+            if(diff_interval > RATE_RING_SIZE)
+                diff_interval = RATE_RING_SIZE;
+            for(; diff_interval > 0; --diff_interval)
+                append_rate(mod, 0);
         }
-        lua_setfield(lua, -2, "rate");
-        callback(mod);
-        mod->rate_count = 0;
+
+        append_rate(mod, mod->ts_count);
+        mod->ts_count = 0;
     }
 }
 
-static void on_ts(module_data_t *mod, const uint8_t *ts)
+static int rate_compare(const void *a, const void *b)
 {
-    if(mod->rate_stat)
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* quantiles of the intervals in the ring, in kbit/s */
+static void rate_stat_update(module_data_t *mod, uint64_t now, uint64_t *value)
+{
+    rate_stat_append(mod, 0, now);
+
+    const size_t count = (mod->rate_write < RATE_RING_SIZE) ? mod->rate_write : RATE_RING_SIZE;
+    if(count == 0)
     {
-        ++mod->ts_count;
+        memset(value, 0, sizeof(uint64_t) * RATE_QUANTILE_COUNT);
+        return;
+    }
 
-        uint64_t diff_interval = 0;
-        const uint64_t cur = asc_utime() / 10000;
+    uint32_t rate[RATE_RING_SIZE];
+    memcpy(rate, mod->rate_ring, count * sizeof(uint32_t));
+    qsort(rate, count, sizeof(uint32_t), rate_compare);
 
-        if(cur != mod->last_ts)
-        {
-            if(mod->last_ts != 0 && cur > mod->last_ts)
-                diff_interval = cur - mod->last_ts;
+    for(size_t i = 0; i < RATE_QUANTILE_COUNT; ++i)
+    {
+        const uint64_t packets = rate[(count - 1) * rate_quantile[i] / 100];
+        value[i] = packets * TS_PACKET_SIZE * 8 * (1000000 / RATE_INTERVAL) / 1000;
+    }
+}
 
-            mod->last_ts = cur;
-        }
+static void rate_metric_init(module_data_t *mod)
+{
+    static const char *const quantile[RATE_QUANTILE_COUNT] = { "0", "0.5", "0.95", "0.99", "1" };
 
-        if(diff_interval > 0)
-        {
-            if(diff_interval > 1)
-            {
-                for(; diff_interval > 0; --diff_interval)
-                    append_rate(mod, 0);
-            }
+    asc_metric_family_t *const family =
+        asc_metric_family("astra_analyze_rate_kbps", ASC_METRIC_GAUGE
+                          , "Bitrate of the 10ms intervals of the last second");
 
-            append_rate(mod, mod->ts_count);
-            mod->ts_count = 0;
-        }
+    char labels[512];
+    const size_t skip = asc_metric_labels(labels, sizeof(labels), "analyze", mod->name);
+    for(size_t i = 0; i < RATE_QUANTILE_COUNT; ++i)
+    {
+        snprintf(&labels[skip], sizeof(labels) - skip, ",quantile=\"%s\"", quantile[i]);
+        asc_metric_register(&mod->metric_list, family, labels, &mod->rate_value[i], 1);
+    }
+}
+
+/* tables with the Lua reports, in async mode the worker returns the packets */
+static bool analyze_is_psi(mpegts_packet_type_t type)
+{
+    return (   type == MPEGTS_PACKET_PAT
+            || type == MPEGTS_PACKET_CAT
+            || type == MPEGTS_PACKET_PMT
+            || type == MPEGTS_PACKET_SDT);
+}
+
+static void analyze_psi(module_data_t *mod, const uint8_t *ts
+                        , uint16_t pid, mpegts_packet_type_t type)
+{
+    switch(type)
+    {
+        case MPEGTS_PACKET_PAT:
+            mpegts_psi_mux(mod->pat, ts, on_pat, mod);
+            break;
+        case MPEGTS_PACKET_CAT:
+            mpegts_psi_mux(mod->cat, ts, on_cat, mod);
+            break;
+        case MPEGTS_PACKET_PMT:
+            mod->pmt->pid = pid;
+            mpegts_psi_mux(mod->pmt, ts, on_pmt, mod);
+            break;
+        case MPEGTS_PACKET_SDT:
+            mpegts_psi_mux(mod->sdt, ts, on_sdt, mod);
+            break;
+        default:
+            break;
     }
+}
 
-    const uint16_t pid = TS_GET_PID(ts);
+/* header fields are decoded by the caller, see mpegts_ts_headers() */
+static void analyze_ts(module_data_t *mod, const uint8_t *ts
+                       , uint16_t pid, uint8_t cc, uint8_t flags)
+{
     analyze_item_t *item = NULL;
-    if(ts[0] == 0x47 && pid < MAX_PID)
-        item = mod->stream[pid];
+    if(!(flags & TS_FLAG_SYNC_ERROR))
+        item = stream_get(mod, pid);
     if(!item)
-        item = mod->stream[NULL_TS_PID];
+        item = stream_get(mod, NULL_TS_PID);
 
     ++item->packets;
 
@@ -609,47 +800,27 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         return;
 
     if(item->type & (MPEGTS_PACKET_PSI | MPEGTS_PACKET_SI))
-    {
-        switch(item->type)
-        {
-            case MPEGTS_PACKET_PAT:
-                mpegts_psi_mux(mod->pat, ts, on_pat, mod);
-                break;
-            case MPEGTS_PACKET_CAT:
-                mpegts_psi_mux(mod->cat, ts, on_cat, mod);
-                break;
-            case MPEGTS_PACKET_PMT:
-                mod->pmt->pid = pid;
-                mpegts_psi_mux(mod->pmt, ts, on_pmt, mod);
-                break;
-            case MPEGTS_PACKET_SDT:
-                mpegts_psi_mux(mod->sdt, ts, on_sdt, mod);
-                break;
-            default:
-                break;
-        }
-    }
+        analyze_psi(mod, ts, pid, item->type);
 
     // Analyze
 
     // skip packets without payload
-    if(!TS_IS_PAYLOAD(ts))
+    if(!(flags & TS_FLAG_PAYLOAD))
         return;
 
-    const uint8_t cc = TS_GET_CC(ts);
     const uint8_t last_cc = (item->cc + 1) & 0x0F;
     item->cc = cc;
 
     if(cc != last_cc)
         ++item->cc_error;
 
-    if(TS_IS_SCRAMBLED(ts))
+    if(flags & TS_FLAG_SCRAMBLED)
         ++item->sc_error;
 
     if(!(item->type & MPEGTS_PACKET_PES))
         return;
 
-    if(item->type == MPEGTS_PACKET_VIDEO && TS_IS_PAYLOAD_START(ts))
+    if(item->type == MPEGTS_PACKET_VIDEO && (flags & TS_FLAG_PAYLOAD_START))
     {
         const uint8_t *payload = TS_GET_PAYLOAD(ts);
         if(payload && PES_BUFFER_GET_HEADER(payload) != 0x000001)
@@ -657,6 +828,369 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
     }
 }
 
+/* headers are decoded by blocks of HEADER_BATCH_SIZE packets */
+#define HEADER_BATCH_SIZE 64
+
+/*
+ * ooooooooooo   o   oooooooooo
+ * 88  888  88  888   888    888
+ *     888     8  88  888oooo88
+ *     888    8oooo88 888
+ *    o888o o88o  o888o o888o
+ *
+ */
+
+/*
+ * Async mode. on_ts() only copies the packets into the lossy tap buffer.
+ * The worker thread counts the packets, checks CC and PES headers and runs
+ * TR 101 290. PSI packets, rate_stat and TR 101 290 reports are returned to
+ * the main thread by the records of TS_PACKET_SIZE bytes, Lua is called by
+ * the main thread only. The batch is dropped if the tap is full. The gap and
+ * its position are reported before the next write, at this position the
+ * worker skips the CC check and adds the dropped packets to the rate.
+ */
+
+#define TAP_BUFFER_SIZE (16384 * TS_PACKET_SIZE)
+#define TAP_GAP_LIST_SIZE (256 * sizeof(analyze_tap_gap_t))
+#define TAP_RECORD_BUFFER_SIZE (1024 * TS_PACKET_SIZE)
+#define TAP_BATCH_SIZE (256 * TS_PACKET_SIZE)
+#define TAP_IDLE_INTERVAL 2000 // us
+#define TAP_STAT_INTERVAL 1000000 // us
+
+/* first byte of the record, PSI packets are returned as is */
+#define TAP_RECORD_RATE 0x01
+#define TAP_RECORD_TR101290 0x02
+
+/* worker thread */
+static void tap_record(module_data_t *mod, uint8_t type, const void *data, size_t size)
+{
+    uint8_t record[TS_PACKET_SIZE];
+    record[0] = type;
+    memcpy(&record[4], data, size);
+    if(asc_thread_buffer_write(mod->tap_record, record, TS_PACKET_SIZE) != TS_PACKET_SIZE)
+    {
+        ; // the main thread is late, the report is lost
+    }
+}
+
+static void tap_ts(module_data_t *mod, const uint8_t *ts
+                   , uint16_t pid, uint8_t cc, uint8_t flags)
+{
+    uint32_t type = MPEGTS_PACKET_UNKNOWN;
+    if(!(flags & TS_FLAG_SYNC_ERROR))
+        type = __atomic_load_n(&mod->tap_item[pid].type, __ATOMIC_RELAXED);
+    if(type == MPEGTS_PACKET_UNKNOWN)
+    {
+        pid = NULL_TS_PID;
+        type = MPEGTS_PACKET_NULL;
+    }
+
+    analyze_tap_item_t *const item = &mod->tap_item[pid];
+    __atomic_fetch_add(&item->packets, 1, __ATOMIC_RELAXED);
+
+    if(type == MPEGTS_PACKET_NULL)
+        return;
+
+    if(analyze_is_psi((mpegts_packet_type_t)type)
+       && asc_thread_buffer_write(mod->tap_record, ts, TS_PACKET_SIZE) != TS_PACKET_SIZE)
+    {
+        ; // the section is dropped by the CC check of the main thread
+    }
+
+    // skip packets without payload
+    if(!(flags & TS_FLAG_PAYLOAD))
+        return;
+
+    const uint8_t last_cc = (item->cc + 1) & 0x0F;
+    item->cc = cc;
+
+    if(item->gap != mod->tap_gap)
+        item->gap = mod->tap_gap;
+    else if(cc != last_cc)
+        __atomic_fetch_add(&item->cc_error, 1, __ATOMIC_RELAXED);
+
+    if(flags & TS_FLAG_SCRAMBLED)
+        __atomic_fetch_add(&item->sc_error, 1, __ATOMIC_RELAXED);
+
+    if(type == MPEGTS_PACKET_VIDEO && (flags & TS_FLAG_PAYLOAD_START))
+    {
+        const uint8_t *payload = TS_GET_PAYLOAD(ts);
+        if(payload && PES_BUFFER_GET_HEADER(payload) != 0x000001)
+            __atomic_fetch_add(&item->pes_error, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* returns the bytes to process before the next gap */
+static size_t tap_check_gap(module_data_t *mod, size_t size)
+{
+    // the gap is reported before the packets, it is read after the peek
+    if(!mod->is_tap_gap_next)
+    {
+        mod->is_tap_gap_next = (asc_thread_buffer_read(  mod->tap_gap_list
+                                                       , &mod->tap_gap_next
+                                                       , sizeof(analyze_tap_gap_t))
+                                == sizeof(analyze_tap_gap_t));
+        if(!mod->is_tap_gap_next)
+            return size;
+    }
+
+    if(mod->tap_gap_next.position == mod->tap_read)
+    {
+        mod->is_tap_gap_next = false;
+        mod->ts_count += mod->tap_gap_next.count;
+        ++mod->tap_gap;
+        if(mod->tr101290)
+            mpegts_tr101290_discontinuity(mod->tr101290);
+        return tap_check_gap(mod, size);
+    }
+
+    const uint64_t tail = mod->tap_gap_next.position - mod->tap_read;
+    return (tail < size) ? (size_t)tail : size;
+}
+
+static void tap_process(module_data_t *mod, const uint8_t *ts, size_t count, uint64_t now)
+{
+    if(mod->rate_stat)
+        rate_stat_append(mod, count, now);
+
+    if(mod->tr101290)
+        mpegts_tr101290_process(mod->tr101290, ts, count, now);
+
+    uint16_t pid[HEADER_BATCH_SIZE];
+    uint8_t cc[HEADER_BATCH_SIZE];
+    uint8_t flags[HEADER_BATCH_SIZE];
+
+    while(count > 0)
+    {
+        const size_t n = (count > HEADER_BATCH_SIZE) ? HEADER_BATCH_SIZE : count;
+        mpegts_ts_headers(ts, n, pid, cc, flags);
+
+        for(size_t i = 0; i < n; ++i)
+            tap_ts(mod, &ts[i * TS_PACKET_SIZE], pid[i], cc[i], flags[i]);
+
+        ts += n * TS_PACKET_SIZE;
+        count -= n;
+    }
+}
+
+static void tap_thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    while(mod->is_tap_started)
+    {
+        size_t size = TS_PACKET_SIZE;
+        const uint8_t *ptr = asc_thread_buffer_peek(mod->tap, &size);
+        const uint64_t now = asc_utime();
+
+        if(size >= TS_PACKET_SIZE)
+        {
+            if(size > TAP_BATCH_SIZE)
+                size = TAP_BATCH_SIZE;
+            size -= size % TS_PACKET_SIZE;
+            size = tap_check_gap(mod, size);
+
+            tap_process(mod, ptr, size / TS_PACKET_SIZE, now);
+            if(!asc_thread_buffer_consume(mod->tap, size))
+                asc_log_debug(MSG("tap buffer flushed"));
+            mod->tap_read += size;
+        }
+        else
+            asc_usleep(TAP_IDLE_INTERVAL);
+
+        if(now - mod->tap_stat_time >= TAP_STAT_INTERVAL)
+        {
+            mod->tap_stat_time = now;
+
+            if(mod->tr101290)
+            {
+                // timeouts are counted without the incoming packets as well
+                mpegts_tr101290_stat_t stat;
+                mpegts_tr101290_process(mod->tr101290, NULL, 0, now);
+                mpegts_tr101290_stat(mod->tr101290, &stat);
+                tap_record(mod, TAP_RECORD_TR101290, &stat, sizeof(stat));
+            }
+
+            if(mod->rate_stat)
+            {
+                uint64_t value[RATE_QUANTILE_COUNT];
+                rate_stat_update(mod, now, value);
+                tap_record(mod, TAP_RECORD_RATE, value, sizeof(value));
+            }
+        }
+    }
+}
+
+/* main thread */
+static void on_tap_record(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    uint8_t record[TS_PACKET_SIZE];
+
+    // Lua callback is able to close the instance
+    while(   mod->tap_record
+          && asc_thread_buffer_read(mod->tap_record, record, TS_PACKET_SIZE) == TS_PACKET_SIZE)
+    {
+        switch(record[0])
+        {
+            case 0x47:
+            {
+                const uint16_t pid = TS_GET_PID(record);
+                const analyze_item_t *item = stream_get(mod, pid);
+                if(item)
+                    analyze_psi(mod, record, pid, item->type);
+                break;
+            }
+            case TAP_RECORD_RATE:
+                memcpy(mod->rate_value, &record[4], sizeof(mod->rate_value));
+                break;
+            case TAP_RECORD_TR101290:
+            {
+                // all counters are uint32_t, the reports are summed until on_check_stat()
+                uint32_t stat[sizeof(mpegts_tr101290_stat_t) / sizeof(uint32_t)];
+                memcpy(stat, &record[4], sizeof(stat));
+                uint32_t *const total = (uint32_t *)&mod->tap_tr101290;
+                for(size_t i = 0; i < sizeof(stat) / sizeof(*stat); ++i)
+                    total[i] += stat[i];
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/* main thread. counters of the worker are moved to the items */
+static void tap_collect(module_data_t *mod)
+{
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
+    {
+        analyze_item_t *const item = stream_get(mod, i);
+        analyze_tap_item_t *const tap_item = &mod->tap_item[i];
+
+        item->packets += __atomic_exchange_n(&tap_item->packets, 0, __ATOMIC_RELAXED);
+        item->cc_error += __atomic_exchange_n(&tap_item->cc_error, 0, __ATOMIC_RELAXED);
+        item->sc_error += __atomic_exchange_n(&tap_item->sc_error, 0, __ATOMIC_RELAXED);
+        item->pes_error += __atomic_exchange_n(&tap_item->pes_error, 0, __ATOMIC_RELAXED);
+    }
+
+    mod->stat.tap_drops = mod->tap_drops;
+    mod->tap_drops = 0;
+
+    memcpy(&mod->tr101290_stat, &mod->tap_tr101290, sizeof(mpegts_tr101290_stat_t));
+    memset(&mod->tap_tr101290, 0, sizeof(mpegts_tr101290_stat_t));
+}
+
+/* main thread. the batch is dropped as a whole if the worker is late */
+static void tap_write(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    const size_t size = count * TS_PACKET_SIZE;
+
+    if(mod->tap_gap_count > 0 && asc_thread_buffer_space(mod->tap) >= size)
+    {
+        const analyze_tap_gap_t gap = { mod->tap_write, mod->tap_gap_count };
+        if(asc_thread_buffer_write(mod->tap_gap_list, &gap, sizeof(gap)) == sizeof(gap))
+            mod->tap_gap_count = 0;
+    }
+
+    if(mod->tap_gap_count > 0
+       || asc_thread_buffer_write(mod->tap, ts, size) != (ssize_t)size)
+    {
+        mod->tap_drops += count;
+        mod->tap_gap_count += count;
+        return;
+    }
+
+    mod->tap_write += size;
+}
+
+static void tap_stop(module_data_t *mod)
+{
+    mod->is_tap_started = false;
+    ASC_FREE(mod->tap_thread, asc_thread_destroy);
+    ASC_FREE(mod->tap, asc_thread_buffer_destroy);
+    ASC_FREE(mod->tap_gap_list, asc_thread_buffer_destroy);
+    ASC_FREE(mod->tap_record, asc_thread_buffer_destroy);
+    ASC_FREE(mod->tap_item, asc_free);
+}
+
+static void on_tap_close(void *arg)
+{
+    tap_stop((module_data_t *)arg);
+}
+
+static void tap_start(module_data_t *mod)
+{
+    mod->tap_item = (analyze_tap_item_t *)asc_calloc(
+        mod->memstat, MAX_PID, sizeof(analyze_tap_item_t));
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
+        mod->tap_item[i].type = stream_get(mod, i)->type;
+
+    mod->tap = asc_thread_buffer_init(TAP_BUFFER_SIZE);
+    mod->tap_gap_list = asc_thread_buffer_init(TAP_GAP_LIST_SIZE);
+    mod->tap_record = asc_thread_buffer_init(TAP_RECORD_BUFFER_SIZE);
+    mod->tap_stat_time = asc_utime();
+    mod->is_tap_started = true;
+
+    mod->tap_thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->tap_thread, "analyze");
+    asc_thread_set_priority(mod->tap_thread, ASC_THREAD_PRIORITY_IDLE);
+    module_option_thread(mod->tap_thread);
+    asc_thread_start(  mod->tap_thread
+                     , tap_thread_loop
+                     , on_tap_record, mod->tap_record
+                     , on_tap_close);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->tap)
+    {
+        tap_write(mod, ts, 1);
+        return;
+    }
+
+    if(mod->rate_stat)
+        rate_stat_append(mod, 1, asc_loop_utime());
+
+    if(mod->tr101290)
+        mpegts_tr101290_process(mod->tr101290, ts, 1, asc_loop_utime());
+
+    analyze_ts(mod, ts, TS_GET_PID(ts), TS_GET_CC(ts), TS_GET_FLAGS(ts));
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    if(mod->tap)
+    {
+        tap_write(mod, ts, count);
+        return;
+    }
+
+    if(mod->rate_stat)
+        rate_stat_append(mod, count, asc_loop_utime());
+
+    if(mod->tr101290)
+        mpegts_tr101290_process(mod->tr101290, ts, count, asc_loop_utime());
+
+    uint16_t pid[HEADER_BATCH_SIZE];
+    uint8_t cc[HEADER_BATCH_SIZE];
+    uint8_t flags[HEADER_BATCH_SIZE];
+
+    while(count > 0)
+    {
+        const size_t n = (count > HEADER_BATCH_SIZE) ? HEADER_BATCH_SIZE : count;
+        mpegts_ts_headers(ts, n, pid, cc, flags);
+
+        for(size_t i = 0; i < n; ++i)
+            analyze_ts(mod, &ts[i * TS_PACKET_SIZE], pid[i], cc[i], flags[i]);
+
+        ts += n * TS_PACKET_SIZE;
+        count -= n;
+    }
+}
+
 /*
  *  oooooooo8 ooooooooooo   o   ooooooooooo
  * 888        88  888  88  888  88  888  88
@@ -666,12 +1200,88 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
  *
  */
 
-static void on_check_stat(void *arg)
+static const module_stat_field_t analyze_stat_fields[] =
 {
-    module_data_t *mod = (module_data_t *)arg;
+    MODULE_STAT_FIELD("on_air", MODULE_STAT_BOOLEAN, module_data_t, stat.on_air),
+    MODULE_STAT_END
+};
 
+static const module_stat_field_t analyze_stat_total_fields[] =
+{
+    MODULE_STAT_FIELD("bitrate", MODULE_STAT_UINT32, module_data_t, stat.bitrate),
+    MODULE_STAT_FIELD("cc_errors", MODULE_STAT_UINT32, module_data_t, stat.cc_errors),
+    MODULE_STAT_FIELD("pes_errors", MODULE_STAT_UINT32, module_data_t, stat.pes_errors),
+    MODULE_STAT_FIELD("scrambled", MODULE_STAT_BOOLEAN, module_data_t, stat.scrambled),
+    MODULE_STAT_FIELD("tap_drops", MODULE_STAT_UINT32, module_data_t, stat.tap_drops),
+    MODULE_STAT_END
+};
+
+static const module_stat_field_t analyze_stat_item_fields[] =
+{
+    MODULE_STAT_FIELD(__pid, MODULE_STAT_INT, analyze_item_t, stat.pid),
+    MODULE_STAT_FIELD("bitrate", MODULE_STAT_UINT32, analyze_item_t, stat.bitrate),
+    MODULE_STAT_FIELD("cc_error", MODULE_STAT_UINT32, analyze_item_t, stat.cc_error),
+    MODULE_STAT_FIELD("sc_error", MODULE_STAT_UINT32, analyze_item_t, stat.sc_error),
+    MODULE_STAT_FIELD("pes_error", MODULE_STAT_UINT32, analyze_item_t, stat.pes_error),
+    MODULE_STAT_END
+};
+
+static const module_stat_field_t analyze_stat_rate_fields[] =
+{
+    MODULE_STAT_FIELD("min", MODULE_STAT_UINT64, module_data_t, rate_value[0]),
+    MODULE_STAT_FIELD("p50", MODULE_STAT_UINT64, module_data_t, rate_value[1]),
+    MODULE_STAT_FIELD("p95", MODULE_STAT_UINT64, module_data_t, rate_value[2]),
+    MODULE_STAT_FIELD("p99", MODULE_STAT_UINT64, module_data_t, rate_value[3]),
+    MODULE_STAT_FIELD("max", MODULE_STAT_UINT64, module_data_t, rate_value[4]),
+    MODULE_STAT_END
+};
+
+#define TR101290_FIELD(_name)                                                                   \
+    MODULE_STAT_FIELD(#_name, MODULE_STAT_UINT32, mpegts_tr101290_stat_t, _name)
+
+static const module_stat_field_t analyze_stat_tr101290_fields[] =
+{
+    TR101290_FIELD(sync_loss),
+    TR101290_FIELD(sync_byte_error),
+    TR101290_FIELD(pat_error),
+    TR101290_FIELD(cc_error),
+    TR101290_FIELD(pmt_error),
+    TR101290_FIELD(pid_error),
+
+    TR101290_FIELD(transport_error),
+    TR101290_FIELD(crc_error),
+    TR101290_FIELD(pcr_repetition_error),
+    TR101290_FIELD(pcr_discontinuity_error),
+    TR101290_FIELD(pcr_accuracy_error),
+    TR101290_FIELD(pts_error),
+    TR101290_FIELD(cat_error),
+    MODULE_STAT_END
+};
+
+/* "analyze" table is rebuilt only if the new PID is found, items are never removed */
+static void stat_items_update(module_data_t *mod)
+{
     int items_count = 1;
     lua_newtable(lua);
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
+    {
+        analyze_item_t *item = stream_get(mod, i);
+
+        if(!item->idx_stat)
+            item->idx_stat = module_stat_init(item, analyze_stat_item_fields);
+
+        lua_pushnumber(lua, items_count++);
+        module_stat_push(item->idx_stat);
+        lua_settable(lua, -3);
+    }
+    module_stat_set(mod->idx_stat, "analyze");
+}
+
+static void on_check_stat(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    int items_count = 0;
 
     bool on_air = true;
 
@@ -684,35 +1294,26 @@ static void on_check_stat(void *arg)
                                  ? ((uint32_t)mod->bitrate_limit)
                                  : ((mod->video_check) ? 256 : 32);
 
-    lua_newtable(lua);
-    for(int i = 0; i < MAX_PID; ++i)
+    if(mod->tap)
+        tap_collect(mod);
+
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
     {
-        analyze_item_t *item = mod->stream[i];
+        analyze_item_t *item = stream_get(mod, i);
 
-        if(!item)
-            continue;
+        ++items_count;
 
         if(!mod->cc_check)
             item->cc_error = 0;
 
-        lua_pushnumber(lua, items_count++);
-        lua_newtable(lua);
-
-        lua_pushnumber(lua, i);
-        lua_setfield(lua, -2, __pid);
-
         const uint32_t item_bitrate = (item->packets * TS_PACKET_SIZE * 8) / 1000;
         bitrate += item_bitrate;
 
-        lua_pushnumber(lua, item_bitrate);
-        lua_setfield(lua, -2, "bitrate");
-
-        lua_pushnumber(lua, item->cc_error);
-        lua_setfield(lua, -2, "cc_error");
-        lua_pushnumber(lua, item->sc_error);
-        lua_setfield(lua, -2, "sc_error");
-        lua_pushnumber(lua, item->pes_error);
-        lua_setfield(lua, -2, "pes_error");
+        item->stat.pid = i;
+        item->stat.bitrate = item_bitrate;
+        item->stat.cc_error = item->cc_error;
+        item->stat.sc_error = item->sc_error;
+        item->stat.pes_error = item->pes_error;
 
         cc_errors += item->cc_error;
         pes_errors += item->pes_error;
@@ -732,23 +1333,28 @@ static void on_check_stat(void *arg)
         item->cc_error = 0;
         item->sc_error = 0;
         item->pes_error = 0;
+    }
 
-        lua_settable(lua, -3);
+    if(items_count != mod->stat_items)
+    {
+        mod->stat_items = items_count;
+        stat_items_update(mod);
     }
-    lua_setfield(lua, -2, "analyze");
 
-    lua_newtable(lua);
+    mod->stat.bitrate = bitrate;
+    mod->stat.cc_errors = cc_errors;
+    mod->stat.pes_errors = pes_errors;
+    mod->stat.scrambled = scrambled;
+
+    if(mod->tr101290 && !mod->tap)
     {
-        lua_pushnumber(lua, bitrate);
-        lua_setfield(lua, -2, "bitrate");
-        lua_pushnumber(lua, cc_errors);
-        lua_setfield(lua, -2, "cc_errors");
-        lua_pushnumber(lua, pes_errors);
-        lua_setfield(lua, -2, "pes_errors");
-        lua_pushboolean(lua, scrambled);
-        lua_setfield(lua, -2, "scrambled");
+        // timeouts are counted without the incoming packets as well
+        mpegts_tr101290_process(mod->tr101290, NULL, 0, asc_utime());
+        mpegts_tr101290_stat(mod->tr101290, &mod->tr101290_stat);
     }
-    lua_setfield(lua, -2, "total");
+
+    if(mod->rate_stat && !mod->tap)
+        rate_stat_update(mod, asc_loop_utime(), mod->rate_value);
 
     if(!mod->cc_check)
         mod->cc_check = true;
@@ -760,9 +1366,9 @@ static void on_check_stat(void *arg)
     if(mod->pmt_ready == 0 || mod->pmt_ready != mod->pmt_count)
         on_air = false;
 
-    lua_pushboolean(lua, on_air);
-    lua_setfield(lua, -2, "on_air");
+    mod->stat.on_air = on_air;
 
+    module_stat_push(mod->idx_stat);
     callback(mod);
 }
 
@@ -779,6 +1385,7 @@ static void module_init(module_data_t *mod)
 {
     module_option_string("name", &mod->name, NULL);
     asc_assert(mod->name != NULL, "[analyze] option 'name' is required");
+    mod->memstat = asc_memstat_init("analyze", mod->name);
 
     lua_getfield(lua, MODULE_OPTIONS_IDX, __callback);
     asc_assert(lua_isfunction(lua, -1), MSG("option 'callback' is required"));
@@ -789,7 +1396,13 @@ static void module_init(module_data_t *mod)
     module_option_number("bitrate_limit", &mod->bitrate_limit);
     module_option_boolean("join_pid", &mod->join_pid);
 
+    bool tr101290 = false;
+    module_option_boolean("tr101290", &tr101290);
+    if(tr101290)
+        mod->tr101290 = mpegts_tr101290_init();
+
     module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
     if(mod->join_pid)
     {
         module_stream_demux_set(mod, NULL, NULL);
@@ -799,26 +1412,47 @@ static void module_init(module_data_t *mod)
         module_stream_demux_join_pid(mod, 0x12);
     }
 
+    mpegts_pid_map_init(&mod->stream, (uintptr_t)NULL);
+
     // PAT
-    mod->stream[0x00] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x00]->type = MPEGTS_PACKET_PAT;
+    stream_item(mod, 0x00)->type = MPEGTS_PACKET_PAT;
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0x00);
     // CAT
-    mod->stream[0x01] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x01]->type = MPEGTS_PACKET_CAT;
+    stream_item(mod, 0x01)->type = MPEGTS_PACKET_CAT;
     mod->cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 0x01);
     // SDT
-    mod->stream[0x11] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x11]->type = MPEGTS_PACKET_SDT;
+    stream_item(mod, 0x11)->type = MPEGTS_PACKET_SDT;
     mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
     // EIT
-    mod->stream[0x12] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x12]->type = MPEGTS_PACKET_EIT;
+    stream_item(mod, 0x12)->type = MPEGTS_PACKET_EIT;
     // PMT
     mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
     // NULL
-    mod->stream[NULL_TS_PID] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[NULL_TS_PID]->type = MPEGTS_PACKET_NULL;
+    stream_item(mod, NULL_TS_PID)->type = MPEGTS_PACKET_NULL;
+
+    mod->idx_stat = module_stat_init(mod, analyze_stat_fields);
+    mod->idx_stat_total = module_stat_init(mod, analyze_stat_total_fields);
+    module_stat_push(mod->idx_stat_total);
+    module_stat_set(mod->idx_stat, "total");
+    if(mod->tr101290)
+    {
+        mod->idx_stat_tr101290 = module_stat_init(  &mod->tr101290_stat
+                                                  , analyze_stat_tr101290_fields);
+        module_stat_push(mod->idx_stat_tr101290);
+        module_stat_set(mod->idx_stat, "tr101290");
+    }
+    if(mod->rate_stat)
+    {
+        mod->idx_stat_rate = module_stat_init(mod, analyze_stat_rate_fields);
+        module_stat_push(mod->idx_stat_rate);
+        module_stat_set(mod->idx_stat, "rate");
+        rate_metric_init(mod);
+    }
+
+    bool is_async = false;
+    module_option_boolean("async", &is_async);
+    if(is_async)
+        tap_start(mod);
 
     mod->check_stat = asc_timer_init(1000, on_check_stat, mod);
 }
@@ -827,17 +1461,38 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
+    // the worker uses the PSI and TR 101 290 objects
+    tap_stop(mod);
+
+    if(mod->tr101290)
+    {
+        mpegts_tr101290_destroy(mod->tr101290);
+        mod->tr101290 = NULL;
+    }
+
     if(mod->idx_callback)
     {
+        module_lua_notify_cancel(mod);
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
         mod->idx_callback = 0;
     }
 
-    for(int i = 0; i < MAX_PID; ++i)
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
     {
-        if(mod->stream[i])
-            free(mod->stream[i]);
+        analyze_item_t *item = stream_get(mod, i);
+        if(item->idx_stat)
+            module_stat_destroy(item->idx_stat);
+        asc_free(item);
     }
+    mpegts_pid_map_destroy(&mod->stream);
+
+    asc_metric_unregister(&mod->metric_list);
+    if(mod->idx_stat_rate)
+        module_stat_destroy(mod->idx_stat_rate);
+    if(mod->idx_stat_tr101290)
+        module_stat_destroy(mod->idx_stat_tr101290);
+    module_stat_destroy(mod->idx_stat_total);
+    module_stat_destroy(mod->idx_stat);
 
     mpegts_psi_destroy(mod->pat);
     mpegts_psi_destroy(mod->cat);
@@ -847,9 +1502,11 @@ static void module_destroy(module_data_t *mod)
     asc_timer_destroy(mod->check_stat);
 
     if(mod->pmt_checksum_list)
-        free(mod->pmt_checksum_list);
+        asc_free(mod->pmt_checksum_list);
     if(mod->sdt_checksum_list)
-        free(mod->sdt_checksum_list);
+        asc_free(mod->sdt_checksum_list);
+
+    ASC_FREE(mod->memstat, asc_memstat_destroy);
 }
 
 MODULE_STREAM_METHODS()
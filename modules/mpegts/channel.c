@@ -29,16 +29,36 @@
  *      pid         - list, join PID in list
  *      no_sdt      - boolean, do not join SDT table
  *      no_eit      - boolean, do not join EIT table
+ *      no_eit_schedule - boolean, pass only EIT present/following, drop the schedule
+ *      eit_rate    - number, EIT output limit in Kbit/s. unchanged schedule
+ *                    sections are dropped over the limit
  *      cas         - boolean, join CAT, ECM, EMM tables
  *      set_pnr     - number, replace original PNR
  *      map         - list, map PID by stream type, item format: "type=pid"
  *                    type: video, audio, rus, eng... and other languages code
  *                     pid: number identifier in range 32-8190
  *      filter      - list, drop PID
+ *      cache       - string, warm start file of the instance. PAT, PMT and SDT
+ *                    of the program are stored and used on the next start until
+ *                    the tables are received
+ *
+ * Channels with the same upstream share one SI demux: PAT, CAT, SDT and EIT
+ * are assembled once per transport stream and each section is delivered to
+ * the channels subscribed to the table.
  */
 
 #include <astra.h>
 
+/* EIT present/following 0x4E and schedule 0x50-0x5F */
+#define EIT_TABLE_COUNT 17
+#define EIT_SECTION_COUNT 256
+
+typedef struct
+{
+    uint32_t crc32;         // original section
+    uint32_t custom_crc32;  // section with set_pnr
+} eit_section_t;
+
 typedef struct
 {
     char type[6];
@@ -59,6 +79,8 @@ struct module_data_t
         int set_pnr;
         bool no_sdt;
         bool no_eit;
+        bool no_eit_schedule;
+        int eit_rate;
         bool no_reload;
         bool cas;
 
@@ -68,7 +90,7 @@ struct module_data_t
 
     /* */
     asc_list_t *map;
-    uint16_t pid_map[MAX_PID];
+    mpegts_pid_map_t pid_map; // 0 - pass, MAX_PID - filtered, custom PID otherwise
     uint8_t custom_ts[TS_PACKET_SIZE];
 
     mpegts_psi_t *pat;
@@ -77,7 +99,8 @@ struct module_data_t
     mpegts_psi_t *sdt;
     mpegts_psi_t *eit;
 
-    mpegts_packet_type_t stream[MAX_PID];
+    mpegts_pid_map_t stream; // mpegts_packet_type_t by PID
+    mpegts_pid_map_t pmt_pid_list; // PIDs joined by PMT, see pmt_join_pid()
 
     uint16_t tsid;
     mpegts_psi_t *custom_pat;
@@ -91,40 +114,281 @@ struct module_data_t
     uint32_t *sdt_checksum_list;
 
     uint8_t eit_cc;
+    eit_section_t *eit_section_list[EIT_TABLE_COUNT];
+    int64_t eit_rate_budget;
+    uint64_t eit_rate_time;
 
     uint8_t pat_version;
     asc_timer_t *si_timer;
+
+    struct si_demux_t *si_demux;
+
+    mpegts_cache_t *cache;
+    asc_timer_t *cache_timer;
 };
 
 #define MSG(_msg) "[channel %s] " _msg, mod->config.name
 
-static void stream_reload(module_data_t *mod)
+#define STREAM_TYPE(_pid) ((mpegts_packet_type_t)mpegts_pid_map_get(&mod->stream, _pid))
+#define STREAM_SET_TYPE(_pid, _type) mpegts_pid_map_set(&mod->stream, _pid, _type)
+#define PID_MAP(_pid) ((uint16_t)mpegts_pid_map_get(&mod->pid_map, _pid))
+#define PID_MAP_SET(_pid, _value) mpegts_pid_map_set(&mod->pid_map, _pid, _value)
+#define PMT_PID(_pid) mpegts_pid_map_get(&mod->pmt_pid_list, _pid)
+#define PMT_PID_SET(_pid, _value) mpegts_pid_map_set(&mod->pmt_pid_list, _pid, _value)
+
+static void on_pat(void *arg, mpegts_psi_t *psi);
+static void on_cat(void *arg, mpegts_psi_t *psi);
+static void on_sdt(void *arg, mpegts_psi_t *psi);
+static void on_eit(void *arg, mpegts_psi_t *psi);
+
+/* warm start cache records */
+#define CACHE_PAT MPEGTS_CACHE_KEY(0x00, 0x00)
+#define CACHE_PMT MPEGTS_CACHE_KEY(0x02, 0x00)
+#define CACHE_SDT MPEGTS_CACHE_KEY(0x42, 0x11)
+
+/*
+ *  oooooooo8 ooooo      ooooooooo  ooooooooooo oooo     oooo ooooo  oooo ooooo  oooo
+ * 888         888        888    88o 888    88   8888o   888   888    88    888  88
+ *  888oooooo  888        888    888 888ooo8     88 888o8 88   888    88      888
+ *         888 888        888    888 888    oo   88  888  88   888    88     88 888
+ * o88oooo888 o888o      o888ooo88  o888ooo8888 o88o  8  o88o   888oo88   o88o  o888o
+ *
+ */
+
+/* SI tables assembled by the shared demux */
+#define SI_DEMUX_TABLE_COUNT 4
+
+static const uint16_t si_demux_pid[SI_DEMUX_TABLE_COUNT] = { 0x00, 0x01, 0x11, 0x12 };
+
+typedef struct si_demux_t si_demux_t;
+
+struct si_demux_t
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_t *upstream;
+    size_t refcount;
+
+    struct
+    {
+        mpegts_psi_t *psi;
+
+        module_data_t **channel_list;
+        size_t channel_count;
+    } table[SI_DEMUX_TABLE_COUNT];
+};
+
+static asc_list_t *si_demux_list = NULL;
+
+static int si_demux_table(uint16_t pid)
+{
+    for(int i = 0; i < SI_DEMUX_TABLE_COUNT; ++i)
+    {
+        if(si_demux_pid[i] == pid)
+            return i;
+    }
+    return -1;
+}
+
+/* copies the section to the channel and calls the channel's own handler */
+static void si_demux_deliver(module_data_t *mod, mpegts_psi_t *psi)
+{
+    mpegts_psi_t *dst;
+    psi_callback_t callback;
+
+    switch(psi->pid)
+    {
+        case 0x00:
+            dst = mod->pat;
+            callback = on_pat;
+            break;
+        case 0x01:
+            dst = mod->cat;
+            callback = on_cat;
+            break;
+        case 0x11:
+            dst = mod->sdt;
+            callback = on_sdt;
+            break;
+        case 0x12:
+            // on_eit() drops the other services, skip the copy as well
+            if(EIT_GET_PNR(psi) != mod->config.pnr)
+                return;
+            if(mod->config.no_eit_schedule && psi->buffer[0] != 0x4E)
+                return;
+            dst = mod->eit;
+            callback = on_eit;
+            break;
+        default:
+            return;
+    }
+
+    memcpy(dst->buffer, psi->buffer, psi->buffer_size);
+    dst->buffer_size = psi->buffer_size;
+    callback(mod, dst);
+}
+
+static void on_si_demux_section(void *arg, mpegts_psi_t *psi)
+{
+    si_demux_t *demux = (si_demux_t *)arg;
+
+    const int i = si_demux_table(psi->pid);
+    if(i < 0)
+        return;
+
+    for(size_t c = 0; c < demux->table[i].channel_count; ++c)
+        si_demux_deliver(demux->table[i].channel_list[c], psi);
+}
+
+static void on_si_demux_ts(module_data_t *arg, const uint8_t *ts)
 {
-    memset(mod->stream, 0, sizeof(mod->stream));
+    si_demux_t *demux = (si_demux_t *)arg;
 
-    for(int __i = 0; __i < MAX_PID; ++__i)
+    const uint16_t pid = TS_GET_PID(ts);
+    if(!module_stream_demux_check_pid(demux, pid))
+        return;
+
+    const int i = si_demux_table(pid);
+    if(i >= 0)
+        mpegts_psi_mux(demux->table[i].psi, ts, on_si_demux_section, demux);
+}
+
+static si_demux_t *si_demux_attach(module_stream_t *upstream)
+{
+    if(!si_demux_list)
+        si_demux_list = asc_list_init();
+
+    asc_list_for(si_demux_list)
     {
-        if(mod->__stream.pid_list[__i])
-            module_stream_demux_leave_pid(mod, __i);
+        si_demux_t *demux = (si_demux_t *)asc_list_data(si_demux_list);
+        // the upstream detaches the demux when it is destroyed
+        if(demux->upstream == upstream && demux->__stream.parent == upstream)
+        {
+            ++demux->refcount;
+            return demux;
+        }
     }
 
+    si_demux_t *demux = (si_demux_t *)calloc(1, sizeof(si_demux_t));
+    demux->upstream = upstream;
+    demux->refcount = 1;
+
+    demux->table[0].psi = mpegts_psi_init(MPEGTS_PACKET_PAT, 0x00);
+    demux->table[1].psi = mpegts_psi_init(MPEGTS_PACKET_CAT, 0x01);
+    demux->table[2].psi = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
+    demux->table[3].psi = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+
+    demux->__stream.self = (module_data_t *)demux;
+    demux->__stream.on_ts = on_si_demux_ts;
+    __module_stream_init(&demux->__stream);
+    module_stream_demux_set(demux, NULL, NULL);
+    module_stream_demux_route(demux);
+    __module_stream_attach(upstream, &demux->__stream);
+
+    asc_list_insert_tail(si_demux_list, demux);
+
+    return demux;
+}
+
+static void si_demux_join(si_demux_t *demux, module_data_t *mod, uint16_t pid)
+{
+    const int i = si_demux_table(pid);
+    asc_assert(i >= 0, "[channel] pid %d is not an SI table", pid);
+
+    for(size_t c = 0; c < demux->table[i].channel_count; ++c)
+    {
+        if(demux->table[i].channel_list[c] == mod)
+            return;
+    }
+
+    const size_t count = demux->table[i].channel_count;
+    demux->table[i].channel_list = (module_data_t **)realloc(demux->table[i].channel_list
+                                                            , sizeof(module_data_t *) * (count + 1));
+    demux->table[i].channel_list[count] = mod;
+    demux->table[i].channel_count = count + 1;
+
+    if(count == 0)
+        module_stream_demux_join_pid(demux, pid);
+}
+
+static void si_demux_detach(si_demux_t *demux, module_data_t *mod)
+{
+    for(int i = 0; i < SI_DEMUX_TABLE_COUNT; ++i)
+    {
+        for(size_t c = 0; c < demux->table[i].channel_count; ++c)
+        {
+            if(demux->table[i].channel_list[c] != mod)
+                continue;
+
+            --demux->table[i].channel_count;
+            memmove(&demux->table[i].channel_list[c], &demux->table[i].channel_list[c + 1]
+                    , sizeof(module_data_t *) * (demux->table[i].channel_count - c));
+
+            if(demux->table[i].channel_count == 0)
+                module_stream_demux_leave_pid(demux, si_demux_pid[i]);
+            break;
+        }
+    }
+
+    --demux->refcount;
+    if(demux->refcount > 0)
+        return;
+
+    module_stream_destroy(demux);
+
+    for(int i = 0; i < SI_DEMUX_TABLE_COUNT; ++i)
+    {
+        mpegts_psi_destroy(demux->table[i].psi);
+        free(demux->table[i].channel_list);
+    }
+
+    asc_list_remove_item(si_demux_list, demux);
+    free(demux);
+
+    if(asc_list_size(si_demux_list) == 0)
+    {
+        asc_list_destroy(si_demux_list);
+        si_demux_list = NULL;
+    }
+}
+
+/* the passthrough modes need the packets of the table, not the sections */
+static void join_si_table(module_data_t *mod, uint16_t pid)
+{
+    const bool is_pass = (pid == 0x11 && mod->config.pass_sdt)
+                      || (pid == 0x12 && mod->config.pass_eit);
+
+    if(mod->si_demux && !is_pass)
+        si_demux_join(mod->si_demux, mod, pid);
+    else
+        module_stream_demux_join_pid(mod, pid);
+}
+
+static void stream_reload(module_data_t *mod)
+{
+    mpegts_pid_map_clear(&mod->stream);
+    mpegts_pid_map_clear(&mod->pmt_pid_list);
+
+    MPEGTS_PID_MAP_FOREACH(mod->__stream.pid_list, __i)
+        module_stream_demux_leave_pid(mod, __i);
+
     mod->pat->crc32 = 0;
     mod->pmt->crc32 = 0;
 
-    mod->stream[0x00] = MPEGTS_PACKET_PAT;
-    module_stream_demux_join_pid(mod, 0x00);
+    STREAM_SET_TYPE(0x00, MPEGTS_PACKET_PAT);
+    join_si_table(mod, 0x00);
 
     if(mod->config.cas)
     {
         mod->cat->crc32 = 0;
-        mod->stream[0x01] = MPEGTS_PACKET_CAT;
-        module_stream_demux_join_pid(mod, 0x01);
+        STREAM_SET_TYPE(0x01, MPEGTS_PACKET_CAT);
+        join_si_table(mod, 0x01);
     }
 
     if(mod->config.no_sdt == false)
     {
-        mod->stream[0x11] = MPEGTS_PACKET_SDT;
-        module_stream_demux_join_pid(mod, 0x11);
+        STREAM_SET_TYPE(0x11, MPEGTS_PACKET_SDT);
+        join_si_table(mod, 0x11);
         if(mod->sdt_checksum_list)
         {
             free(mod->sdt_checksum_list);
@@ -134,10 +398,19 @@ static void stream_reload(module_data_t *mod)
 
     if(mod->config.no_eit == false)
     {
-        mod->stream[0x12] = MPEGTS_PACKET_EIT;
-        module_stream_demux_join_pid(mod, 0x12);
+        STREAM_SET_TYPE(0x12, MPEGTS_PACKET_EIT);
+        join_si_table(mod, 0x12);
 
-        mod->stream[0x14] = MPEGTS_PACKET_TDT;
+        for(int i = 0; i < EIT_TABLE_COUNT; ++i)
+        {
+            if(mod->eit_section_list[i])
+            {
+                free(mod->eit_section_list[i]);
+                mod->eit_section_list[i] = NULL;
+            }
+        }
+
+        STREAM_SET_TYPE(0x14, MPEGTS_PACKET_TDT);
         module_stream_demux_join_pid(mod, 0x14);
     }
 
@@ -199,9 +472,27 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         return;
     }
 
+    const uint8_t *pointer;
+
     // reload stream
     if(psi->crc32 != 0)
     {
+        // other programs are changed, the custom PAT is the same
+        PAT_ITEMS_FOREACH(psi, pointer)
+        {
+            if(PAT_ITEM_GET_PNR(psi, pointer) == mod->config.pnr)
+                break;
+        }
+        if(   !PAT_ITEMS_EOL(psi, pointer)
+           && PAT_ITEM_GET_PID(psi, pointer) == mod->pmt->pid
+           && PAT_GET_TSID(psi) == mod->tsid
+           && STREAM_TYPE(mod->pmt->pid) == MPEGTS_PACKET_PMT)
+        {
+            psi->crc32 = crc32;
+            mpegts_psi_demux(mod->custom_pat, (ts_callback_t)__module_stream_send, &mod->__stream);
+            return;
+        }
+
         asc_log_warning(MSG("PAT changed. Reload stream info"));
         stream_reload(mod);
     }
@@ -210,7 +501,6 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
 
     mod->tsid = PAT_GET_TSID(psi);
 
-    const uint8_t *pointer;
 
     PAT_ITEMS_FOREACH(psi, pointer)
     {
@@ -224,7 +514,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         if(pnr == mod->config.pnr)
         {
             const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
-            mod->stream[pid] = MPEGTS_PACKET_PMT;
+            STREAM_SET_TYPE(pid, MPEGTS_PACKET_PMT);
             module_stream_demux_join_pid(mod, pid);
             mod->pmt->pid = pid;
             mod->pmt->crc32 = 0;
@@ -239,6 +529,9 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         return;
     }
 
+    if(mod->cache)
+        mpegts_cache_set_psi(mod->cache, CACHE_PAT, psi);
+
     const uint8_t pat_version = PAT_GET_VERSION(mod->custom_pat) + 1;
     PAT_INIT(mod->custom_pat, mod->tsid, pat_version);
     memcpy(PAT_ITEMS_FIRST(mod->custom_pat), pointer, 4);
@@ -263,7 +556,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
                || (!strcmp(map_item->type, "pmt")) )
             {
                 map_item->is_set = true;
-                mod->pid_map[mod->pmt->pid] = map_item->custom_pid;
+                PID_MAP_SET(mod->pmt->pid, map_item->custom_pid);
 
                 uint8_t *custom_pointer = PAT_ITEMS_FIRST(mod->custom_pat);
                 PAT_ITEM_SET_PID(mod->custom_pat, custom_pointer, map_item->custom_pid);
@@ -284,7 +577,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     mpegts_psi_demux(mod->custom_pat, (ts_callback_t)__module_stream_send, &mod->__stream);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+        STREAM_SET_TYPE(psi->pid, MPEGTS_PACKET_UNKNOWN);
 }
 
 /*
@@ -335,11 +628,11 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
         if(desc_pointer[0] == 0x09)
         {
             const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-            if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+            if(STREAM_TYPE(ca_pid) == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
             {
-                mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                if(mod->pid_map[ca_pid] == MAX_PID)
-                    mod->pid_map[ca_pid] = 0;
+                STREAM_SET_TYPE(ca_pid, MPEGTS_PACKET_CA);
+                if(PID_MAP(ca_pid) == MAX_PID)
+                    PID_MAP_SET(ca_pid, 0);
                 module_stream_demux_join_pid(mod, ca_pid);
             }
         }
@@ -352,7 +645,7 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
     mpegts_psi_demux(mod->custom_cat, (ts_callback_t)__module_stream_send, &mod->__stream);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+        STREAM_SET_TYPE(psi->pid, MPEGTS_PACKET_UNKNOWN);
 }
 
 /*
@@ -376,7 +669,7 @@ static uint16_t map_custom_pid(module_data_t *mod, uint16_t pid, const char *typ
            || (!strcmp(map_item->type, type)) )
         {
             map_item->is_set = true;
-            mod->pid_map[pid] = map_item->custom_pid;
+            PID_MAP_SET(pid, map_item->custom_pid);
 
             return map_item->custom_pid;
         }
@@ -384,6 +677,68 @@ static uint16_t map_custom_pid(module_data_t *mod, uint16_t pid, const char *typ
     return 0;
 }
 
+#define PMT_PID_JOINED 1
+#define PMT_PID_UPDATED 2
+
+/* the PID of the previous PMT is already joined */
+static void pmt_join_pid(module_data_t *mod, uint16_t pid, mpegts_packet_type_t type)
+{
+    STREAM_SET_TYPE(pid, type);
+    if(!PMT_PID(pid))
+        module_stream_demux_join_pid(mod, pid);
+    PMT_PID_SET(pid, PMT_PID_UPDATED);
+}
+
+static inline bool pmt_check_ca_pid(module_data_t *mod, uint16_t ca_pid)
+{
+    if(ca_pid == NULL_TS_PID)
+        return false;
+
+    return (   STREAM_TYPE(ca_pid) == MPEGTS_PACKET_UNKNOWN
+            || PMT_PID(ca_pid) == PMT_PID_JOINED);
+}
+
+/* the updated PMT is parsed over the previous, the map is applied again */
+static void pmt_update_begin(module_data_t *mod)
+{
+    if(!mod->map)
+        return;
+
+    MPEGTS_PID_MAP_FOREACH(&mod->pmt_pid_list, i)
+    {
+        if(PID_MAP(i) != MAX_PID)
+            PID_MAP_SET(i, 0);
+    }
+
+    asc_list_for(mod->map)
+    {
+        map_item_t *map_item = (map_item_t *)asc_list_data(mod->map);
+        if(map_item->is_set && map_item->custom_pid != mod->custom_pmt->pid)
+            map_item->is_set = false;
+    }
+}
+
+/* leave the PIDs which are not referenced by the updated PMT */
+static void pmt_update_end(module_data_t *mod)
+{
+    MPEGTS_PID_MAP_FOREACH(&mod->pmt_pid_list, i)
+    {
+        switch(PMT_PID(i))
+        {
+            case PMT_PID_JOINED:
+                STREAM_SET_TYPE(i, MPEGTS_PACKET_UNKNOWN);
+                PMT_PID_SET(i, 0);
+                module_stream_demux_leave_pid(mod, i);
+                break;
+            case PMT_PID_UPDATED:
+                PMT_PID_SET(i, PMT_PID_JOINED);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 static void on_pmt(void *arg, mpegts_psi_t *psi)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -411,16 +766,18 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         return;
     }
 
-    // reload stream
+    // update stream, only the changed PIDs are joined or left
     if(psi->crc32 != 0)
     {
-        asc_log_warning(MSG("PMT changed. Reload stream info"));
-        stream_reload(mod);
-        return;
+        asc_log_warning(MSG("PMT changed. Update stream info"));
+        pmt_update_begin(mod);
     }
 
     psi->crc32 = crc32;
 
+    if(mod->cache)
+        mpegts_cache_set_psi(mod->cache, CACHE_PMT, psi);
+
     uint16_t skip = 12;
     memcpy(mod->custom_pmt->buffer, psi->buffer, 10);
 
@@ -437,12 +794,11 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
                 continue;
 
             const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-            if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+            if(pmt_check_ca_pid(mod, ca_pid))
             {
-                mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                if(mod->pid_map[ca_pid] == MAX_PID)
-                    mod->pid_map[ca_pid] = 0;
-                module_stream_demux_join_pid(mod, ca_pid);
+                if(PID_MAP(ca_pid) == MAX_PID)
+                    PID_MAP_SET(ca_pid, 0);
+                pmt_join_pid(mod, ca_pid, MPEGTS_PACKET_CA);
             }
         }
 
@@ -467,7 +823,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     {
         const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
 
-        if(mod->pid_map[pid] == MAX_PID) // skip filtered pid
+        if(PID_MAP(pid) == MAX_PID) // skip filtered pid
             continue;
 
         const uint8_t item_type = PMT_ITEM_GET_TYPE(psi, pointer);
@@ -479,8 +835,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         memcpy(&mod->custom_pmt->buffer[skip], pointer, 5);
         skip += 5;
 
-        mod->stream[pid] = MPEGTS_PACKET_PES;
-        module_stream_demux_join_pid(mod, pid);
+        pmt_join_pid(mod, pid, MPEGTS_PACKET_PES);
 
         if(pid == pcr_pid)
             join_pcr = false;
@@ -495,12 +850,11 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
                     continue;
 
                 const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-                if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+                if(pmt_check_ca_pid(mod, ca_pid))
                 {
-                    mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                    if(mod->pid_map[ca_pid] == MAX_PID)
-                        mod->pid_map[ca_pid] = 0;
-                    module_stream_demux_join_pid(mod, ca_pid);
+                    if(PID_MAP(ca_pid) == MAX_PID)
+                        PID_MAP_SET(ca_pid, 0);
+                    pmt_join_pid(mod, ca_pid, MPEGTS_PACKET_CA);
                 }
             }
             else if(desc_type == 0x0A)
@@ -578,16 +932,17 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
 
     if(join_pcr)
     {
-        mod->stream[pcr_pid] = MPEGTS_PACKET_PES;
-        if(mod->pid_map[pcr_pid] == MAX_PID)
-            mod->pid_map[pcr_pid] = 0;
-        module_stream_demux_join_pid(mod, pcr_pid);
+        if(PID_MAP(pcr_pid) == MAX_PID)
+            PID_MAP_SET(pcr_pid, 0);
+        pmt_join_pid(mod, pcr_pid, MPEGTS_PACKET_PES);
     }
 
+    pmt_update_end(mod);
+
     if(mod->map)
     {
-        if(mod->pid_map[pcr_pid])
-            PMT_SET_PCR(mod->custom_pmt, mod->pid_map[pcr_pid]);
+        if(PID_MAP(pcr_pid))
+            PMT_SET_PCR(mod->custom_pmt, PID_MAP(pcr_pid));
     }
 
     PSI_SET_SIZE(mod->custom_pmt);
@@ -595,7 +950,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     mpegts_psi_demux(mod->custom_pmt, (ts_callback_t)__module_stream_send, &mod->__stream);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+        STREAM_SET_TYPE(psi->pid, MPEGTS_PACKET_UNKNOWN);
 }
 
 /*
@@ -620,7 +975,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     const uint32_t crc32 = PSI_GET_CRC32(psi);
 
     // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
+    if(!mpegts_psi_check_crc32(psi))
     {
         asc_log_error(MSG("SDT checksum error"));
         return;
@@ -666,6 +1021,9 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     if(SDT_ITEMS_EOL(psi, pointer))
         return;
 
+    if(mod->cache)
+        mpegts_cache_set_psi(mod->cache, CACHE_SDT, psi);
+
     mod->sdt_original_section_id = section_id;
 
     memcpy(mod->custom_sdt->buffer, psi->buffer, 11); // copy SDT header
@@ -689,7 +1047,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     mpegts_psi_demux(mod->custom_sdt, (ts_callback_t)__module_stream_send, &mod->__stream);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+        STREAM_SET_TYPE(psi->pid, MPEGTS_PACKET_UNKNOWN);
 }
 
 /*
@@ -701,13 +1059,44 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
  *
  */
 
+/* token bucket in bytes * 1000000 for eit_rate, the burst is one second */
+static bool eit_rate_check(module_data_t *mod, size_t size, bool is_forced)
+{
+    if(!mod->config.eit_rate)
+        return true;
+
+    const int64_t rate = (int64_t)mod->config.eit_rate * 1000 / 8;
+    const uint64_t now = asc_loop_utime();
+
+    uint64_t elapsed = now - mod->eit_rate_time;
+    if(elapsed > 1000000)
+        elapsed = 1000000;
+    mod->eit_rate_budget += (int64_t)elapsed * rate;
+    mod->eit_rate_time = now;
+    if(mod->eit_rate_budget > rate * 1000000)
+        mod->eit_rate_budget = rate * 1000000;
+
+    // pointer field and TS headers are counted as well
+    const int64_t ts_size = (int64_t)((size + 1 + TS_BODY_SIZE - 1) / TS_BODY_SIZE) * TS_PACKET_SIZE;
+    const int64_t cost = ts_size * 1000000;
+    if(!is_forced && mod->eit_rate_budget < cost)
+        return false;
+
+    mod->eit_rate_budget -= cost;
+    return true;
+}
+
 static void on_eit(void *arg, mpegts_psi_t *psi)
 {
     module_data_t *mod = (module_data_t *)arg;
 
     const uint8_t table_id = psi->buffer[0];
-    const bool is_actual_eit = (table_id == 0x4E || (table_id >= 0x50 && table_id <= 0x5F));
-    if(!is_actual_eit)
+    int table;
+    if(table_id == 0x4E)
+        table = 0;
+    else if(table_id >= 0x50 && table_id <= 0x5F && !mod->config.no_eit_schedule)
+        table = 1 + table_id - 0x50;
+    else
         return;
 
     if(mod->tsid != EIT_GET_TSID(psi))
@@ -716,14 +1105,37 @@ static void on_eit(void *arg, mpegts_psi_t *psi)
     if(mod->config.pnr != EIT_GET_PNR(psi))
         return;
 
+    // sections are cached by the checksum, the repeated ones are not rebuilt
+    if(!mod->eit_section_list[table])
+    {
+        mod->eit_section_list[table] =
+            (eit_section_t *)calloc(EIT_SECTION_COUNT, sizeof(eit_section_t));
+    }
+    eit_section_t *const section = &mod->eit_section_list[table][EIT_GET_SECTION_NUMBER(psi)];
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    const bool is_changed = (section->crc32 != crc32);
+
+    // present/following is small, only the schedule is limited
+    if(!eit_rate_check(mod, psi->buffer_size, is_changed || table == 0))
+        return;
+
     psi->cc = mod->eit_cc;
 
     if(mod->config.set_pnr)
     {
         EIT_SET_PNR(psi, mod->config.set_pnr);
-        PSI_SET_CRC32(psi);
+        if(is_changed)
+        {
+            PSI_SET_CRC32(psi);
+            section->custom_crc32 = PSI_GET_CRC32(psi);
+        }
+        else
+            PSI_PUT_CRC32(psi, section->custom_crc32);
     }
 
+    section->crc32 = crc32;
+
     mpegts_psi_demux(psi, (ts_callback_t)__module_stream_send, &mod->__stream);
 
     mod->eit_cc = psi->cc;
@@ -747,7 +1159,7 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
     if(pid == NULL_TS_PID)
         return;
 
-    switch(mod->stream[pid])
+    switch(STREAM_TYPE(pid))
     {
         case MPEGTS_PACKET_PES:
             break;
@@ -776,12 +1188,12 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
             break;
     }
 
-    if(mod->pid_map[pid] == MAX_PID)
+    const uint16_t custom_pid = PID_MAP(pid);
+    if(custom_pid == MAX_PID)
         return;
 
     if(mod->map)
     {
-        const uint16_t custom_pid = mod->pid_map[pid];
         if(custom_pid)
         {
             memcpy(mod->custom_ts, ts, TS_PACKET_SIZE);
@@ -794,6 +1206,149 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
     module_stream_send(mod, ts);
 }
 
+/* packet goes to the output as is or with the PID from the map, see on_ts() */
+static inline bool is_ts_out(module_data_t *mod, uint16_t pid)
+{
+    if(pid == NULL_TS_PID || !module_stream_demux_check_pid(mod, pid))
+        return false;
+
+    switch(STREAM_TYPE(pid))
+    {
+        case MPEGTS_PACKET_PES:
+            break;
+        case MPEGTS_PACKET_PAT:
+        case MPEGTS_PACKET_CAT:
+        case MPEGTS_PACKET_PMT:
+        case MPEGTS_PACKET_UNKNOWN:
+            return false;
+        case MPEGTS_PACKET_SDT:
+            if(!mod->config.pass_sdt)
+                return false;
+            break;
+        case MPEGTS_PACKET_EIT:
+            if(!mod->config.pass_eit)
+                return false;
+            break;
+        default:
+            break;
+    }
+
+    return (PID_MAP(pid) != MAX_PID);
+}
+
+/* packet goes to the output as is */
+static inline bool is_ts_pass(module_data_t *mod, uint16_t pid)
+{
+    return is_ts_out(mod, pid) && !(mod->map && PID_MAP(pid));
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    const uint8_t *pass = ts;
+    size_t pass_count = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+
+        if(is_ts_pass(mod, TS_GET_PID(cur)))
+        {
+            if(pass_count == 0)
+                pass = cur;
+            ++pass_count;
+            continue;
+        }
+
+        if(pass_count > 0)
+        {
+            module_stream_send_batch(mod, pass, pass_count);
+            pass_count = 0;
+        }
+
+        on_ts(mod, cur);
+    }
+
+    if(pass_count > 0)
+        module_stream_send_batch(mod, pass, pass_count);
+}
+
+static void on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    bool is_remap = false;
+
+    for(size_t i = 0; i < block->count; ++i)
+    {
+        const uint8_t *const cur = &block->ts[i * TS_PACKET_SIZE];
+        const uint16_t pid = TS_GET_PID(cur);
+        if(!is_ts_out(mod, pid))
+        {
+            on_ts_batch(mod, block->ts, block->count);
+            return;
+        }
+        if(mod->map && PID_MAP(pid))
+            is_remap = true;
+    }
+
+    if(!is_remap)
+    {
+        module_stream_send_block(mod, block);
+        return;
+    }
+
+    /* the PIDs are changed in place, the block is copied only if it is shared */
+    module_stream_block_t *const out = module_stream_block_writable(block);
+    uint8_t *const ts = module_stream_block_ts(out);
+
+    for(size_t i = 0; i < out->count; ++i)
+    {
+        uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+        const uint16_t custom_pid = PID_MAP(TS_GET_PID(cur));
+        if(custom_pid)
+            TS_SET_PID(cur, custom_pid);
+    }
+
+    module_stream_send_block(mod, out);
+
+    if(out != block)
+        module_stream_block_unref(out);
+}
+
+/*
+ * Warm start. Tables of the previous run are parsed as received, the PIDs of
+ * the program are joined before the upstream delivers PAT and PMT. The live
+ * tables with the other checksum replace them as the usual change.
+ */
+
+static void on_cache_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    mod->cache_timer = NULL;
+
+    // the tables are parsed on init, before the downstream is attached
+    on_si_timer(mod);
+}
+
+static void cache_warm_start(module_data_t *mod)
+{
+    if(!mpegts_cache_get_psi(mod->cache, CACHE_PAT, mod->pat))
+        return;
+    on_pat(mod, mod->pat);
+    if(!mod->custom_pat->buffer_size)
+        return;
+
+    if(mpegts_cache_get_psi(mod->cache, CACHE_PMT, mod->pmt))
+        on_pmt(mod, mod->pmt);
+
+    if(mod->sdt && !mod->config.pass_sdt
+       && mpegts_cache_get_psi(mod->cache, CACHE_SDT, mod->sdt))
+    {
+        on_sdt(mod, mod->sdt);
+    }
+
+    asc_log_debug(MSG("warm start"));
+    mod->cache_timer = asc_timer_one_shot(1, on_cache_timer, mod);
+}
+
 /*
  * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
  *  8888o   888 o888   888o 888    88o 888    88   888         888    88
@@ -805,8 +1360,15 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
 
 static void module_init(module_data_t *mod)
 {
+    mpegts_pid_map_init(&mod->pid_map, 0);
+    mpegts_pid_map_init(&mod->stream, MPEGTS_PACKET_UNKNOWN);
+    mpegts_pid_map_init(&mod->pmt_pid_list, 0);
+
     module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+    module_stream_set_block(mod, on_ts_block);
     module_stream_demux_set(mod, NULL, NULL);
+    module_stream_demux_route(mod);
 
     module_option_string("name", &mod->config.name, NULL);
     asc_assert(mod->config.name != NULL, "[channel] option 'name' is required");
@@ -817,18 +1379,21 @@ static void module_init(module_data_t *mod)
 
         module_option_boolean("cas", &mod->config.cas);
 
+        if(mod->__stream.parent)
+            mod->si_demux = si_demux_attach(mod->__stream.parent);
+
         mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
         mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
         mod->custom_pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
         mod->custom_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
-        mod->stream[0] = MPEGTS_PACKET_PAT;
-        module_stream_demux_join_pid(mod, 0);
+        STREAM_SET_TYPE(0, MPEGTS_PACKET_PAT);
+        join_si_table(mod, 0);
         if(mod->config.cas)
         {
             mod->cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 1);
             mod->custom_cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 1);
-            mod->stream[1] = MPEGTS_PACKET_CAT;
-            module_stream_demux_join_pid(mod, 1);
+            STREAM_SET_TYPE(1, MPEGTS_PACKET_CAT);
+            join_si_table(mod, 1);
         }
 
         module_option_boolean("no_sdt", &mod->config.no_sdt);
@@ -836,23 +1401,23 @@ static void module_init(module_data_t *mod)
         {
             mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
             mod->custom_sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
-            mod->stream[0x11] = MPEGTS_PACKET_SDT;
-            module_stream_demux_join_pid(mod, 0x11);
-
+            STREAM_SET_TYPE(0x11, MPEGTS_PACKET_SDT);
             module_option_boolean("pass_sdt", &mod->config.pass_sdt);
+            join_si_table(mod, 0x11);
         }
 
         module_option_boolean("no_eit", &mod->config.no_eit);
         if(mod->config.no_eit == false)
         {
             mod->eit = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
-            mod->stream[0x12] = MPEGTS_PACKET_EIT;
-            module_stream_demux_join_pid(mod, 0x12);
+            STREAM_SET_TYPE(0x12, MPEGTS_PACKET_EIT);
+            module_option_boolean("pass_eit", &mod->config.pass_eit);
+            module_option_boolean("no_eit_schedule", &mod->config.no_eit_schedule);
+            module_option_number("eit_rate", &mod->config.eit_rate);
+            join_si_table(mod, 0x12);
 
-            mod->stream[0x14] = MPEGTS_PACKET_TDT;
+            STREAM_SET_TYPE(0x14, MPEGTS_PACKET_TDT);
             module_stream_demux_join_pid(mod, 0x14);
-
-            module_option_boolean("pass_eit", &mod->config.pass_eit);
         }
 
         module_option_boolean("no_reload", &mod->config.no_reload);
@@ -867,7 +1432,7 @@ static void module_init(module_data_t *mod)
             lua_foreach(lua, -2)
             {
                 const int pid = lua_tonumber(lua, -1);
-                mod->stream[pid] = MPEGTS_PACKET_PES;
+                STREAM_SET_TYPE(pid, MPEGTS_PACKET_PES);
                 module_stream_demux_join_pid(mod, pid);
             }
         }
@@ -910,7 +1475,7 @@ static void module_init(module_data_t *mod)
         lua_foreach(lua, -2)
         {
             const int pid = lua_tonumber(lua, -1);
-            mod->pid_map[pid] = MAX_PID;
+            PID_MAP_SET(pid, MAX_PID);
         }
     }
     lua_pop(lua, 1); // filter
@@ -918,20 +1483,34 @@ static void module_init(module_data_t *mod)
     lua_getfield(lua, MODULE_OPTIONS_IDX, "filter~");
     if(lua_istable(lua, -1))
     {
-        for(uint32_t i = 0; i < ASC_ARRAY_SIZE(mod->pid_map); ++i)
-            mod->pid_map[i] = MAX_PID;
+        mpegts_pid_map_destroy(&mod->pid_map);
+        mpegts_pid_map_init(&mod->pid_map, MAX_PID);
 
         lua_foreach(lua, -2)
         {
             const int pid = lua_tonumber(lua, -1);
-            mod->pid_map[pid] = 0;
+            PID_MAP_SET(pid, 0);
         }
     }
     lua_pop(lua, 1); // filter~
+
+    const char *cache = NULL;
+    module_option_string("cache", &cache, NULL);
+    if(cache && mod->pat)
+    {
+        mod->cache = mpegts_cache_open(cache);
+        cache_warm_start(mod);
+    }
 }
 
 static void module_destroy(module_data_t *mod)
 {
+    if(mod->si_demux)
+    {
+        si_demux_detach(mod->si_demux, mod);
+        mod->si_demux = NULL;
+    }
+
     module_stream_destroy(mod);
 
     mpegts_psi_destroy(mod->pat);
@@ -956,6 +1535,12 @@ static void module_destroy(module_data_t *mod)
     if(mod->eit)
         mpegts_psi_destroy(mod->eit);
 
+    for(int i = 0; i < EIT_TABLE_COUNT; ++i)
+    {
+        if(mod->eit_section_list[i])
+            free(mod->eit_section_list[i]);
+    }
+
     if(mod->map)
     {
         for(asc_list_first(mod->map); !asc_list_eol(mod->map); asc_list_first(mod->map))
@@ -968,6 +1553,13 @@ static void module_destroy(module_data_t *mod)
 
     if(mod->si_timer)
         asc_timer_destroy(mod->si_timer);
+
+    ASC_FREE(mod->cache_timer, asc_timer_destroy);
+    ASC_FREE(mod->cache, mpegts_cache_close);
+
+    mpegts_pid_map_destroy(&mod->pid_map);
+    mpegts_pid_map_destroy(&mod->stream);
+    mpegts_pid_map_destroy(&mod->pmt_pid_list);
 }
 
 MODULE_STREAM_METHODS()
@@ -0,0 +1,227 @@
+/*
+ * Astra Module: MPEG-TS (EPG)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Collects SDT and EIT (actual and other, present/following and schedule)
+ * of the upstream into the shared EPG store, see src/epg.c. All instances
+ * fill the same store, so one feed with the EIT of other transport streams
+ * serves the whole network. Strings are decoded once on change.
+ *
+ * Module Name:
+ *      epg
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *
+ * Module Methods:
+ *      services()  - list of services: onid, tsid, sid, type, name, provider
+ *      events(sid [, tsid [, onid]])
+ *                  - events of the service from the current one:
+ *                    event_id, start, duration, running_status, lang, name, text
+ */
+
+#include <astra.h>
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+
+    mpegts_psi_t *sdt;
+    mpegts_psi_t *eit;
+
+    uint32_t sdt_crc32_error;
+    uint32_t eit_crc32_error;
+};
+
+#define MSG(_msg) "[epg %s] " _msg, mod->name
+
+static void on_sdt(void *arg, mpegts_psi_t *psi)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        if(!mod->sdt_crc32_error++)
+            asc_log_error(MSG("SDT checksum error"));
+        return;
+    }
+
+    mpegts_epg_sdt(psi);
+}
+
+static void on_eit(void *arg, mpegts_psi_t *psi)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        if(!mod->eit_crc32_error++)
+            asc_log_error(MSG("EIT checksum error"));
+        return;
+    }
+
+    mpegts_epg_eit(psi);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    switch(TS_GET_PID(ts))
+    {
+        case 0x11:
+            mpegts_psi_mux(mod->sdt, ts, on_sdt, mod);
+            break;
+        case 0x12:
+            mpegts_psi_mux(mod->eit, ts, on_eit, mod);
+            break;
+        default:
+            break;
+    }
+}
+
+/* methods */
+
+static void push_service(void *arg, const mpegts_epg_service_t *service)
+{
+    int *count = (int *)arg;
+
+    lua_pushnumber(lua, ++(*count));
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, service->onid);
+    lua_setfield(lua, -2, "onid");
+    lua_pushnumber(lua, service->tsid);
+    lua_setfield(lua, -2, "tsid");
+    lua_pushnumber(lua, service->sid);
+    lua_setfield(lua, -2, "sid");
+    lua_pushnumber(lua, service->type);
+    lua_setfield(lua, -2, "type");
+    if(service->name)
+    {
+        lua_pushstring(lua, service->name);
+        lua_setfield(lua, -2, "name");
+    }
+    if(service->provider)
+    {
+        lua_pushstring(lua, service->provider);
+        lua_setfield(lua, -2, "provider");
+    }
+
+    lua_settable(lua, -3);
+}
+
+static int method_services(module_data_t *mod)
+{
+    __uarg(mod);
+
+    int count = 0;
+    lua_newtable(lua);
+    mpegts_epg_foreach(push_service, &count);
+    return 1;
+}
+
+static int method_events(module_data_t *mod)
+{
+    __uarg(mod);
+
+    const uint16_t sid = luaL_checkinteger(lua, 2);
+    const int tsid = luaL_optinteger(lua, 3, -1);
+    const int onid = luaL_optinteger(lua, 4, -1);
+
+    const mpegts_epg_service_t *service = mpegts_epg_service(onid, tsid, sid);
+    if(!service)
+    {
+        lua_pushnil(lua);
+        return 1;
+    }
+
+    size_t count = 0;
+    const mpegts_epg_event_t *event = mpegts_epg_events(service, time(NULL), &count);
+
+    lua_newtable(lua);
+    for(size_t i = 0; i < count; ++i, ++event)
+    {
+        lua_pushnumber(lua, i + 1);
+        lua_newtable(lua);
+
+        lua_pushnumber(lua, event->event_id);
+        lua_setfield(lua, -2, "event_id");
+        lua_pushnumber(lua, event->start);
+        lua_setfield(lua, -2, "start");
+        lua_pushnumber(lua, event->duration);
+        lua_setfield(lua, -2, "duration");
+        lua_pushnumber(lua, event->running_status);
+        lua_setfield(lua, -2, "running_status");
+        if(event->lang[0])
+        {
+            lua_pushstring(lua, event->lang);
+            lua_setfield(lua, -2, "lang");
+        }
+        if(event->name)
+        {
+            lua_pushstring(lua, event->name);
+            lua_setfield(lua, -2, "name");
+        }
+        if(event->text)
+        {
+            lua_pushstring(lua, event->text);
+            lua_setfield(lua, -2, "text");
+        }
+
+        lua_settable(lua, -3);
+    }
+
+    return 1;
+}
+
+/* required */
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[epg] option 'name' is required");
+
+    module_stream_init(mod, on_ts);
+    module_stream_demux_set(mod, NULL, NULL);
+    module_stream_demux_join_pid(mod, 0x11);
+    module_stream_demux_join_pid(mod, 0x12);
+
+    mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
+    mod->eit = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    mpegts_psi_destroy(mod->sdt);
+    mpegts_psi_destroy(mod->eit);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "services", method_services },
+    { "events", method_events },
+    MODULE_STREAM_METHODS_REF()
+};
+MODULE_LUA_REGISTER(epg)
@@ -1,3 +1,31 @@
-SOURCES="src/pcr.c src/psi.c src/pes.c src/types.c"
-SOURCES="$SOURCES analyze.c channel.c transmit.c"
-MODULES="analyze channel transmit"
+SOURCES="src/pcr.c src/pidmap.c src/psi.c src/pes.c src/types.c src/header.c src/tr101290.c src/epg.c src/cache.c"
+SOURCES="$SOURCES analyze.c channel.c transmit.c switch.c epg.c mpts_mux.c shaper.c"
+MODULES="analyze channel transmit switch epg mpts_mux shaper"
+
+# AVX2. mpegts_ts_headers() is selected at runtime, see src/header.c
+
+avx2_test_c()
+{
+    cat <<EOF
+#pragma GCC target("avx2")
+#include <immintrin.h>
+int main(void)
+{
+    static const int buffer[8] = { 0 };
+    __builtin_cpu_init();
+    __m256i v = _mm256_i32gather_epi32(buffer, _mm256_setzero_si256(), 1);
+    v = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+    return __builtin_cpu_supports("avx2") + _mm256_extract_epi32(v, 0);
+}
+EOF
+}
+
+check_avx2()
+{
+    avx2_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_avx2 ; then
+    CFLAGS="-DHAVE_TS_HEADERS_AVX2=1"
+    SOURCES="$SOURCES src/header_avx2.c"
+fi
@@ -47,6 +47,7 @@
 #define TS_IS_PAYLOAD_START(_ts) ((TS_IS_PAYLOAD(_ts) && (_ts[1] & 0x40)))
 #define TS_IS_AF(_ts) ((_ts[3] & 0x20))
 #define TS_IS_SCRAMBLED(_ts) ((_ts[3] & 0xC0))
+#define TS_IS_RAI(_ts) ((TS_IS_AF(_ts) && (_ts[4] > 0) && (_ts[5] & 0x40)))
 
 #define TS_GET_PID(_ts) ((uint16_t)(((_ts[1] & 0x1F) << 8) | _ts[2]))
 #define TS_SET_PID(_ts, _pid)                                                                   \
@@ -69,6 +70,72 @@
 
 typedef void (*ts_callback_t)(void *, const uint8_t *);
 
+/*
+ * Sparse table of the values by PID, see src/pidmap.c. Bitmap of the PIDs
+ * with the count of the set bits before each word, values of the set PIDs
+ * are stored in the dense array ordered by PID. About 1.3KB instead of the
+ * array of MAX_PID values. Unset PID has the default value, set to the
+ * default value removes the PID.
+ */
+
+typedef struct mpegts_pid_map_t
+{
+    uint64_t bits[MAX_PID / 64];
+    uint16_t rank[MAX_PID / 64]; // set bits in the previous words
+    uint16_t count;
+    uint16_t size;
+    uintptr_t value_default;
+    uintptr_t *value;
+} mpegts_pid_map_t;
+
+void mpegts_pid_map_init(mpegts_pid_map_t *map, uintptr_t value_default);
+void mpegts_pid_map_destroy(mpegts_pid_map_t *map);
+void mpegts_pid_map_clear(mpegts_pid_map_t *map);
+void mpegts_pid_map_set(mpegts_pid_map_t *map, uint16_t pid, uintptr_t value);
+/* next set PID after pid, MAX_PID if not found */
+int mpegts_pid_map_next(const mpegts_pid_map_t *map, int pid) __wur;
+
+static inline bool mpegts_pid_map_has(const mpegts_pid_map_t *map, uint16_t pid)
+{
+    return (map->bits[pid >> 6] >> (pid & 63)) & 1;
+}
+
+static inline uintptr_t mpegts_pid_map_get(const mpegts_pid_map_t *map, uint16_t pid)
+{
+    const uint64_t word = map->bits[pid >> 6];
+    const uint64_t bit = 1ULL << (pid & 63);
+    if(!(word & bit))
+        return map->value_default;
+
+    return map->value[map->rank[pid >> 6] + __builtin_popcountll(word & (bit - 1))];
+}
+
+#define MPEGTS_PID_MAP_FOREACH(_map, _pid)                                                          for(int _pid = mpegts_pid_map_next(_map, -1)                                                        ; _pid < MAX_PID                                                                                ; _pid = mpegts_pid_map_next(_map, _pid))
+
+/* header flags of the packet, see mpegts_ts_headers() */
+#define TS_FLAG_SYNC_ERROR      0x01 // first byte is not 0x47
+#define TS_FLAG_PRIORITY        0x02
+#define TS_FLAG_PAYLOAD_START   0x04 // raw bit, without the payload check of TS_IS_PAYLOAD_START
+#define TS_FLAG_ERROR           0x08 // transport error indicator
+#define TS_FLAG_PAYLOAD         0x10
+#define TS_FLAG_AF              0x20
+#define TS_FLAG_SCRAMBLED       0xC0
+
+#define TS_GET_FLAGS(_ts) ((uint8_t)(                                                           \
+    (_ts[3] & 0xF0) | ((_ts[1] >> 4) & 0x0E) | ((_ts[0] != 0x47) ? TS_FLAG_SYNC_ERROR : 0)))
+
+/* decodes PID, CC and flags of count packets into the arrays */
+void mpegts_ts_headers(const uint8_t *ts, size_t count
+                       , uint16_t *pid, uint8_t *cc, uint8_t *flags);
+
+/*
+ * Passes the runs of the packets between the null packets (PID 0x1FFF) to
+ * on_run. PIDs are decoded by mpegts_ts_headers(). Returns the count of the
+ * dropped packets, 0 - on_run is called once with all packets
+ */
+typedef void (*mpegts_ts_run_t)(void *arg, const uint8_t *ts, size_t count);
+size_t mpegts_ts_strip_null(const uint8_t *ts, size_t count, mpegts_ts_run_t on_run, void *arg);
+
 /*
  * ooooooooooo ooooo  oooo oooooooooo ooooooooooo  oooooooo8
  * 88  888  88   888  88    888    888 888    88  888
@@ -124,6 +191,17 @@ void mpegts_desc_to_lua(const uint8_t *desc);
 
 #define PSI_BUFFER_GET_SIZE(_b) (PSI_HEADER_SIZE + (((_b[1] & 0x0f) << 8) | _b[2]))
 
+/* section header with the version and the section number */
+#define PSI_CHECK_HEADER_SIZE 8
+#define PSI_CHECK_CACHE_SIZE 4
+
+typedef struct
+{
+    uint16_t size;
+    uint32_t crc32;
+    uint8_t header[PSI_CHECK_HEADER_SIZE];
+} mpegts_psi_check_t;
+
 typedef struct
 {
     mpegts_packet_type_t type;
@@ -132,13 +210,22 @@ typedef struct
 
     uint32_t crc32;
 
-    // demux
-    uint8_t ts[TS_PACKET_SIZE];
+    // demux. packets of the last section, see mpegts_psi_demux()
+    uint8_t *packets;
+    uint16_t packets_size;
+    uint16_t packets_pid;
+    uint16_t packets_buffer_size;
+    uint32_t packets_crc32;
 
     // mux
     uint16_t buffer_size;
     uint16_t buffer_skip;
+    bool is_complete; // buffer contains the last section passed to the callback
     uint8_t buffer[PSI_MAX_SIZE];
+
+    // sections with the verified checksum
+    mpegts_psi_check_t check[PSI_CHECK_CACHE_SIZE];
+    uint8_t check_skip;
 } mpegts_psi_t;
 
 typedef void (*psi_callback_t)(void *, mpegts_psi_t *);
@@ -149,6 +236,8 @@ void mpegts_psi_destroy(mpegts_psi_t *psi);
 void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callback, void *arg);
 void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg);
 
+bool mpegts_psi_check_crc32(mpegts_psi_t *psi) __wur;
+
 #define PSI_CALC_CRC32(_psi) crc32b(_psi->buffer, _psi->buffer_size - CRC32_SIZE)
 
 // with inline function we have nine more instructions
@@ -158,15 +247,17 @@ void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg);
     (_psi->buffer[_psi->buffer_size - CRC32_SIZE + 2] << 8 ) |                                  \
     (_psi->buffer[_psi->buffer_size - CRC32_SIZE + 3]      ) )
 
-#define PSI_SET_CRC32(_psi)                                                                     \
+#define PSI_PUT_CRC32(_psi, _crc)                                                               \
     {                                                                                           \
-        const uint32_t __crc = PSI_CALC_CRC32(_psi);                                            \
+        const uint32_t __crc = _crc;                                                            \
         _psi->buffer[_psi->buffer_size - CRC32_SIZE + 0] = __crc >> 24;                         \
         _psi->buffer[_psi->buffer_size - CRC32_SIZE + 1] = __crc >> 16;                         \
         _psi->buffer[_psi->buffer_size - CRC32_SIZE + 2] = __crc >> 8;                          \
         _psi->buffer[_psi->buffer_size - CRC32_SIZE + 3] = __crc & 0xFF;                        \
     }
 
+#define PSI_SET_CRC32(_psi) PSI_PUT_CRC32(_psi, PSI_CALC_CRC32(_psi))
+
 #define PSI_SET_SIZE(_psi)                                                                      \
     {                                                                                           \
         const uint16_t __size = _psi->buffer_size - PSI_HEADER_SIZE;                            \
@@ -220,6 +311,41 @@ void mpegts_pes_destroy(mpegts_pes_t *pes);
 void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callback, void *arg);
 void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
+/*
+ * PES assembler, see src/pes.c. The payload is collected in the pooled ring,
+ * the complete PES is given to the callback as the view of the ring.
+ */
+
+#define PES_VIEW_HEADER_SIZE 19 /* PES header with PTS and DTS */
+
+typedef struct mpegts_pes_asm_t mpegts_pes_asm_t;
+
+typedef struct
+{
+    uint16_t pid;
+
+    // one part, or two parts if the PES wraps the end of the ring
+    const uint8_t *data[2];
+    uint32_t size[2];
+    uint32_t buffer_size;
+
+    // first PES_VIEW_HEADER_SIZE bytes, contiguous for PES_GET_PTS() and PES_GET_DTS()
+    const uint8_t *buffer;
+
+    uint64_t time; // asc_loop_utime() of the first packet
+} mpegts_pes_view_t;
+
+typedef void (*pes_view_callback_t)(void *, const mpegts_pes_view_t *);
+
+mpegts_pes_asm_t * mpegts_pes_asm_init(uint16_t pid) __wur;
+void mpegts_pes_asm_destroy(mpegts_pes_asm_t *pes);
+void mpegts_pes_asm_mux(  mpegts_pes_asm_t *pes, const uint8_t *ts
+                        , pes_view_callback_t callback, void *arg);
+void mpegts_pes_asm_pool_destroy(void);
+
+/* contiguous payload of the view, copied only if the PES wraps the ring */
+const uint8_t * mpegts_pes_view_data(const mpegts_pes_view_t *view);
+
 #define PES_IS_SYNTAX_SPEC(_pes)                                                                \
     (                                                                                           \
         _pes->buffer[3] != 0xBC && /* program_stream_map */                                     \
@@ -612,6 +738,8 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
         _psi->buffer[4] = __pnr & 0xFF;                                                         \
     }
 
+#define EIT_GET_SECTION_NUMBER(_psi) (_psi->buffer[6])
+
 #define EIT_GET_TSID(_psi) ((_psi->buffer[8] << 8) | _psi->buffer[9])
 #define EIT_GET_ONID(_psi) ((_psi->buffer[10] << 8) | _psi->buffer[11])
 
@@ -700,4 +828,123 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
 uint64_t mpegts_pcr_block_us(uint64_t *pcr_last, const uint64_t *pcr_current);
 
+/*
+ * TR 101 290
+ */
+
+/* priority 1 and 2 indicators, see src/tr101290.c */
+typedef struct
+{
+    // priority 1
+    uint32_t sync_loss;
+    uint32_t sync_byte_error;
+    uint32_t pat_error;
+    uint32_t cc_error;
+    uint32_t pmt_error;
+    uint32_t pid_error;
+
+    // priority 2
+    uint32_t transport_error;
+    uint32_t crc_error;
+    uint32_t pcr_repetition_error;
+    uint32_t pcr_discontinuity_error;
+    uint32_t pcr_accuracy_error;
+    uint32_t pts_error;
+    uint32_t cat_error;
+} mpegts_tr101290_stat_t;
+
+typedef struct mpegts_tr101290_t mpegts_tr101290_t;
+
+mpegts_tr101290_t * mpegts_tr101290_init(void) __wur;
+void mpegts_tr101290_destroy(mpegts_tr101290_t *tr);
+
+/* now is the arrival time of the packets in microseconds, count 0 checks the timeouts only */
+void mpegts_tr101290_process(mpegts_tr101290_t *tr, const uint8_t *ts, size_t count, uint64_t now);
+/* packets are lost knowingly, the next CC and PCR interval are not checked */
+void mpegts_tr101290_discontinuity(mpegts_tr101290_t *tr);
+/* copies the counters and resets them */
+void mpegts_tr101290_stat(mpegts_tr101290_t *tr, mpegts_tr101290_stat_t *stat);
+
+/*
+ * EPG and SI store, see src/epg.c. Shared by all instances, so the services of
+ * the many transport streams (SDT and EIT other) are kept in one place. Names
+ * are decoded to UTF-8 once, when the service or the event is changed.
+ */
+
+#define EPG_EVENT_MAX 1024
+
+typedef struct mpegts_epg_table_t mpegts_epg_table_t;
+
+typedef struct
+{
+    uint16_t event_id;
+    uint8_t version;
+    uint8_t running_status;
+    uint32_t crc32; // event loop item, the strings are decoded if it is changed
+
+    time_t start;
+    uint32_t duration; // seconds
+
+    char lang[4];
+    char *name;
+    char *text;
+} mpegts_epg_event_t;
+
+typedef struct
+{
+    uint16_t onid;
+    uint16_t tsid;
+    uint16_t sid;
+
+    uint8_t type;
+    uint32_t crc32; // SDT item
+    char *name;
+    char *provider;
+
+    // sorted by the start time
+    mpegts_epg_event_t *event_list;
+    size_t event_count;
+    size_t event_size;
+
+    // EIT sections already stored: table_id, version and section bitmap
+    mpegts_epg_table_t *table_list;
+    size_t table_count;
+} mpegts_epg_service_t;
+
+typedef void (*epg_service_callback_t)(void *, const mpegts_epg_service_t *);
+
+/* SDT and EIT sections with the verified checksum */
+void mpegts_epg_sdt(const mpegts_psi_t *psi);
+void mpegts_epg_eit(const mpegts_psi_t *psi);
+
+/* onid and tsid less than 0 match any value */
+const mpegts_epg_service_t * mpegts_epg_service(int onid, int tsid, uint16_t sid) __wur;
+void mpegts_epg_foreach(epg_service_callback_t callback, void *arg);
+/* events of the service since the time */
+const mpegts_epg_event_t * mpegts_epg_events(  const mpegts_epg_service_t *service
+                                             , time_t since, size_t *count) __wur;
+
+void mpegts_epg_destroy(void);
+
+/*
+ * Warm start cache, see src/cache.c. Records of the instance are kept in the
+ * local file: sections and control words of the last run, so the stream is
+ * started without waiting for the tables and the ECM responses.
+ */
+
+typedef struct mpegts_cache_t mpegts_cache_t;
+
+#define MPEGTS_CACHE_KEY(_type, _id) (((uint32_t)(_type) << 16) | ((_id) & 0xFFFF))
+
+mpegts_cache_t * mpegts_cache_open(const char *path) __wur;
+/* the pending changes are written */
+void mpegts_cache_close(mpegts_cache_t *cache);
+
+const uint8_t * mpegts_cache_get(mpegts_cache_t *cache, uint32_t key, size_t *size) __wur;
+/* the file is written with the delay, the equal record is skipped */
+void mpegts_cache_set(mpegts_cache_t *cache, uint32_t key, const void *data, size_t size);
+
+bool mpegts_cache_get_psi(mpegts_cache_t *cache, uint32_t key, mpegts_psi_t *psi) __wur;
+void mpegts_cache_set_psi(mpegts_cache_t *cache, uint32_t key, const mpegts_psi_t *psi);
+
 #endif /* _MPEGTS_H_ */
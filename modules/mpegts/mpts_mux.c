@@ -0,0 +1,875 @@
+/*
+ * Astra Module: MPEG-TS (MPTS Multiplexer)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Constant bitrate multiplexer. Each input is a single program stream,
+ * the program is remapped to the free PIDs of the output and its PMT is
+ * rewritten. PAT, SDT and NIT are generated from the options and sent from
+ * the packet cache of mpegts_psi_demux().
+ *
+ * Output is a sequence of the packet slots of the virtual clock with the
+ * given bitrate. Each slot takes the PSI packet, otherwise the queued packet
+ * of the input with the earliest deadline, otherwise the null packet.
+ * Deadline of the packet is the ideal arrival time plus delay, ideal arrival
+ * of the PCR packet follows the PCR of the program, so the network jitter
+ * is not passed to the output. PCR is restamped by the difference between
+ * the slot time and the deadline.
+ *
+ * Slots are produced by the timer in blocks of STREAM_BLOCK_COUNT packets,
+ * use udp_output with the sync option to send them smooth.
+ *
+ * Module Name:
+ *      mpts_mux
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      bitrate     - number, output bitrate in kbit/s
+ *      delay       - number, milliseconds of the program delay. default: 100
+ *      tsid        - number, transport stream id. default: 1
+ *      onid        - number, original network id. default: 1
+ *      network_id  - number, NIT is sent if defined
+ *      network_name
+ *                  - string, name of the network for NIT
+ *      inputs      - list of the programs:
+ *                    upstream - object, stream instance returned by module_instance:stream()
+ *                    pnr      - number, program number. default: program number of the input
+ *                    name     - string, service name for SDT
+ *                    provider - string, service provider for SDT
+ *                    type     - number, service type. default: 1
+ */
+
+#include <astra.h>
+
+#define MSG(_msg) "[mpts_mux %s] " _msg, mod->name
+
+#define MUX_MAX_INPUTS 32
+#define MUX_QUEUE_SIZE 4096
+#define MUX_PSI_QUEUE_SIZE 256
+#define MUX_TIMER_INTERVAL 10
+#define MUX_PAT_INTERVAL (100 * 1000)
+#define MUX_SDT_INTERVAL (1000 * 1000)
+#define MUX_LAG_MAX (200 * 1000)
+#define MUX_PID_FIRST 0x0100
+#define MUX_NIT_PID 0x0010
+
+#define PCR_MAX ((UINT64_C(1) << 33) * 300)
+#define PCR_RESET (27000000)
+
+typedef struct
+{
+    uint8_t ts[TS_PACKET_SIZE];
+    int64_t deadline;
+    bool is_pcr;
+} mux_packet_t;
+
+typedef struct
+{
+    /* stream.self points to the input, see on_input_ts() */
+    module_stream_t stream;
+    module_data_t *mod;
+    int id;
+
+    int pnr_option;
+    uint16_t pnr;
+    uint8_t service_type;
+    uint8_t service_desc[2 + 2 * 256];
+    uint16_t service_desc_size;
+
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pmt;
+    mpegts_psi_t *custom_pmt;
+    uint16_t pcr_pid;
+
+    uint16_t pid_map[MAX_PID];
+
+    int64_t pcr_offset;
+    bool is_pcr_offset;
+    int64_t deadline_last;
+
+    mux_packet_t *queue;
+    size_t queue_head;
+    size_t queue_count;
+} mux_input_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    uint16_t tsid;
+    uint16_t onid;
+    int network_id;
+    const char *network_name;
+    int64_t delay;
+
+    mux_input_t *input;
+    int input_count;
+
+    /* input id owning the output PID */
+    uint8_t pid_owner[MAX_PID];
+
+    mpegts_psi_t *pat;
+    mpegts_psi_t *sdt;
+    mpegts_psi_t *nit;
+    bool is_sdt_error;
+
+    uint8_t psi_queue[MUX_PSI_QUEUE_SIZE][TS_PACKET_SIZE];
+    size_t psi_head;
+    size_t psi_count;
+    uint64_t pat_time;
+    uint64_t sdt_time;
+
+    /* virtual clock in 27MHz units since start */
+    uint64_t start;
+    int64_t slot_time;
+    uint64_t slot_step;
+    uint64_t slot_rem;
+    uint64_t slot_rem_step;
+    uint64_t bitrate;
+
+    module_stream_block_t *block;
+
+    asc_timer_t *timer;
+
+    uint64_t null_count;
+    uint64_t drop_count;
+    uint64_t late_count;
+};
+
+static const uint8_t null_ts[TS_PACKET_SIZE] = { 0x47, 0x1F, 0xFF, 0x10 };
+
+/*
+ *  oooooooo8 ooooo
+ * 888         888
+ *  888oooooo  888
+ *         888 888
+ * o88oooo888 o888o
+ *
+ */
+
+static void on_psi_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->psi_count >= MUX_PSI_QUEUE_SIZE)
+        return;
+
+    const size_t tail = (mod->psi_head + mod->psi_count) % MUX_PSI_QUEUE_SIZE;
+    memcpy(mod->psi_queue[tail], ts, TS_PACKET_SIZE);
+    ++mod->psi_count;
+}
+
+/* buffer is built with the previous version, the version is changed with the content */
+static void mux_table_update(mpegts_psi_t *psi)
+{
+    uint32_t crc32 = PSI_CALC_CRC32(psi);
+    if(psi->crc32 && crc32 != psi->crc32)
+    {
+        const uint8_t version = PAT_GET_VERSION(psi) + 1;
+        PAT_SET_VERSION(psi, version);
+        crc32 = PSI_CALC_CRC32(psi);
+    }
+
+    psi->crc32 = crc32;
+    PSI_PUT_CRC32(psi, crc32);
+}
+
+static void mux_update_pat(module_data_t *mod)
+{
+    mpegts_psi_t *psi = mod->pat;
+
+    PAT_INIT(psi, mod->tsid, PAT_GET_VERSION(psi));
+    if(mod->network_id >= 0)
+        PAT_ITEMS_APPEND(psi, 0, MUX_NIT_PID);
+
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        const mux_input_t *input = &mod->input[i];
+        if(input->custom_pmt->buffer_size)
+            PAT_ITEMS_APPEND(psi, input->pnr, input->custom_pmt->pid);
+    }
+
+    mux_table_update(psi);
+}
+
+static void mux_update_sdt(module_data_t *mod)
+{
+    mpegts_psi_t *psi = mod->sdt;
+    uint8_t *const b = psi->buffer;
+    const uint8_t version = PAT_GET_VERSION(psi);
+
+    b[0] = 0x42;
+    b[1] = 0xF0;
+    b[3] = mod->tsid >> 8;
+    b[4] = mod->tsid & 0xFF;
+    b[5] = 0x01;
+    PAT_SET_VERSION(psi, version);
+    b[6] = 0x00;
+    b[7] = 0x00;
+    b[8] = mod->onid >> 8;
+    b[9] = mod->onid & 0xFF;
+    b[10] = 0xFF;
+
+    size_t skip = 11;
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        const mux_input_t *input = &mod->input[i];
+        if(!input->pnr)
+            continue;
+
+        const uint16_t desc_size = input->service_desc_size;
+        if(skip + 5 + desc_size + CRC32_SIZE > 1024)
+        {
+            if(!mod->is_sdt_error)
+            {
+                asc_log_error(MSG("SDT is too large. service %d is skipped"), input->pnr);
+                mod->is_sdt_error = true;
+            }
+            continue;
+        }
+
+        uint8_t *const item = &b[skip];
+        item[0] = input->pnr >> 8;
+        item[1] = input->pnr & 0xFF;
+        item[2] = 0xFC;
+        /* running_status: running, free_CA_mode: 0 */
+        item[3] = 0x80 | ((desc_size >> 8) & 0x0F);
+        item[4] = desc_size & 0xFF;
+        memcpy(&item[5], input->service_desc, desc_size);
+        skip += 5 + desc_size;
+    }
+
+    psi->buffer_size = skip + CRC32_SIZE;
+    PSI_SET_SIZE(psi);
+    mux_table_update(psi);
+}
+
+static void mux_update_nit(module_data_t *mod)
+{
+    mpegts_psi_t *psi = mod->nit;
+    uint8_t *const b = psi->buffer;
+    const uint8_t version = PAT_GET_VERSION(psi);
+
+    b[0] = 0x40;
+    b[1] = 0xF0;
+    b[3] = mod->network_id >> 8;
+    b[4] = mod->network_id & 0xFF;
+    b[5] = 0x01;
+    PAT_SET_VERSION(psi, version);
+    b[6] = 0x00;
+    b[7] = 0x00;
+
+    /* network_name_descriptor */
+    size_t name_size = (mod->network_name) ? strlen(mod->network_name) : 0;
+    if(name_size > 0xFF)
+        name_size = 0xFF;
+    size_t skip = 10;
+    if(name_size)
+    {
+        b[skip++] = 0x40;
+        b[skip++] = name_size;
+        memcpy(&b[skip], mod->network_name, name_size);
+        skip += name_size;
+    }
+    b[8] = 0xF0 | (((skip - 10) >> 8) & 0x0F);
+    b[9] = (skip - 10) & 0xFF;
+
+    /* transport stream loop with service_list_descriptor */
+    uint8_t *const ts_loop = &b[skip];
+    skip += 2;
+    uint8_t *const ts_item = &b[skip];
+    ts_item[0] = mod->tsid >> 8;
+    ts_item[1] = mod->tsid & 0xFF;
+    ts_item[2] = mod->onid >> 8;
+    ts_item[3] = mod->onid & 0xFF;
+    skip += 6;
+
+    uint8_t *const desc = &b[skip];
+    desc[0] = 0x41;
+    skip += 2;
+    for(int i = 0; i < mod->input_count && (desc[1] + 3) <= 0xFF; ++i)
+    {
+        const mux_input_t *input = &mod->input[i];
+        if(!input->pnr)
+            continue;
+
+        b[skip + 0] = input->pnr >> 8;
+        b[skip + 1] = input->pnr & 0xFF;
+        b[skip + 2] = input->service_type;
+        skip += 3;
+    }
+    desc[1] = &b[skip] - &desc[2];
+
+    const uint16_t desc_size = &b[skip] - desc;
+    ts_item[4] = 0xF0 | ((desc_size >> 8) & 0x0F);
+    ts_item[5] = desc_size & 0xFF;
+
+    const uint16_t loop_size = &b[skip] - ts_item;
+    ts_loop[0] = 0xF0 | ((loop_size >> 8) & 0x0F);
+    ts_loop[1] = loop_size & 0xFF;
+
+    psi->buffer_size = skip + CRC32_SIZE;
+    PSI_SET_SIZE(psi);
+    mux_table_update(psi);
+}
+
+static void mux_update_si(module_data_t *mod)
+{
+    mux_update_pat(mod);
+    mux_update_sdt(mod);
+    if(mod->nit)
+        mux_update_nit(mod);
+}
+
+/*
+ * oooooooooo ooooo ooooo       oooo     oooo      o      oooooooooo
+ *  888    888 888   888         8888o   888      888      888    888
+ *  888oooo88  888    888        88 888o8 88     8  88     888oooo88
+ *  888        888   888         88  888  88    8oooo88    888
+ * o888o      o888o o888o       o88o  8  o88o o88o  o888o o888o
+ *
+ */
+
+static void mux_pid_release(module_data_t *mod, mux_input_t *input)
+{
+    for(int pid = 0; pid < MAX_PID; ++pid)
+    {
+        const uint16_t custom_pid = input->pid_map[pid];
+        if(custom_pid)
+        {
+            mod->pid_owner[custom_pid] = 0;
+            input->pid_map[pid] = 0;
+        }
+    }
+}
+
+static uint16_t mux_pid_map(module_data_t *mod, mux_input_t *input, uint16_t pid)
+{
+    if(input->pid_map[pid])
+        return input->pid_map[pid];
+
+    /* the same PID if it is free, otherwise the first free */
+    uint16_t custom_pid = pid;
+    if(custom_pid < 0x20 || custom_pid >= NULL_TS_PID || mod->pid_owner[custom_pid])
+    {
+        for(custom_pid = MUX_PID_FIRST; custom_pid < NULL_TS_PID; ++custom_pid)
+        {
+            if(!mod->pid_owner[custom_pid])
+                break;
+        }
+        if(custom_pid == NULL_TS_PID)
+        {
+            asc_log_error(MSG("input #%d: no free PID for %d"), input->id, pid);
+            return 0;
+        }
+    }
+
+    mod->pid_owner[custom_pid] = input->id;
+    input->pid_map[pid] = custom_pid;
+    return custom_pid;
+}
+
+/* CA_descriptor is followed by the ECM or EMM PID */
+static void mux_map_ca(module_data_t *mod, mux_input_t *input, uint8_t *desc)
+{
+    if(desc[0] != 0x09 || desc[1] < 4)
+        return;
+
+    const uint16_t custom_pid = mux_pid_map(mod, input, DESC_CA_PID(desc));
+    desc[4] = (desc[4] & ~0x1F) | ((custom_pid >> 8) & 0x1F);
+    desc[5] = custom_pid & 0xFF;
+}
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    mux_input_t *input = (mux_input_t *)arg;
+    module_data_t *mod = input->mod;
+
+    if(psi->buffer[0] != 0x02)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        asc_log_error(MSG("input #%d: PMT checksum error"), input->id);
+        return;
+    }
+    psi->crc32 = crc32;
+
+    if(!input->pnr_option)
+        input->pnr = PMT_GET_PNR(psi);
+
+    mux_pid_release(mod, input);
+
+    mpegts_psi_t *custom_pmt = input->custom_pmt;
+    const uint8_t version = PMT_GET_VERSION(custom_pmt);
+    memcpy(custom_pmt->buffer, psi->buffer, psi->buffer_size);
+    custom_pmt->buffer_size = psi->buffer_size;
+    custom_pmt->pid = mux_pid_map(mod, input, psi->pid);
+    PMT_SET_VERSION(custom_pmt, version);
+    PMT_SET_PNR(custom_pmt, input->pnr);
+
+    input->pcr_pid = PMT_GET_PCR(psi);
+    if(input->pcr_pid != NULL_TS_PID)
+        PMT_SET_PCR(custom_pmt, mux_pid_map(mod, input, input->pcr_pid));
+    input->is_pcr_offset = false;
+
+    uint8_t *desc;
+    PMT_DESC_FOREACH(custom_pmt, desc)
+    {
+        mux_map_ca(mod, input, desc);
+    }
+
+    uint8_t *pointer;
+    PMT_ITEMS_FOREACH(custom_pmt, pointer)
+    {
+        const uint16_t pid = PMT_ITEM_GET_PID(custom_pmt, pointer);
+        PMT_ITEM_SET_PID(custom_pmt, pointer, mux_pid_map(mod, input, pid));
+
+        PMT_ITEM_DESC_FOREACH(pointer, desc)
+        {
+            mux_map_ca(mod, input, desc);
+        }
+    }
+
+    mux_table_update(custom_pmt);
+    mux_update_si(mod);
+
+    asc_log_info(MSG("input #%d: program %d, PMT PID %d")
+                 , input->id, input->pnr, custom_pmt->pid);
+}
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    mux_input_t *input = (mux_input_t *)arg;
+    module_data_t *mod = input->mod;
+
+    if(psi->buffer[0] != 0x00)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        asc_log_error(MSG("input #%d: PAT checksum error"), input->id);
+        return;
+    }
+    psi->crc32 = crc32;
+
+    /* the first program of the input */
+    uint16_t pmt_pid = 0;
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        if(PAT_ITEM_GET_PNR(psi, pointer) != 0)
+        {
+            pmt_pid = PAT_ITEM_GET_PID(psi, pointer);
+            break;
+        }
+    }
+
+    if(!pmt_pid || pmt_pid == input->pmt->pid)
+        return;
+
+    mux_pid_release(mod, input);
+    input->pmt->pid = pmt_pid;
+    input->pmt->crc32 = 0;
+    input->queue_count = 0;
+    mux_update_si(mod);
+}
+
+static void on_input_ts(module_data_t *arg, const uint8_t *ts)
+{
+    mux_input_t *input = (mux_input_t *)arg;
+    module_data_t *mod = input->mod;
+
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == 0)
+    {
+        mpegts_psi_mux(input->pat, ts, on_pat, input);
+        return;
+    }
+    if(pid == input->pmt->pid)
+    {
+        mpegts_psi_mux(input->pmt, ts, on_pmt, input);
+        return;
+    }
+
+    const uint16_t custom_pid = input->pid_map[pid];
+    if(!custom_pid)
+        return;
+
+    if(input->queue_count >= MUX_QUEUE_SIZE)
+    {
+        input->queue_head = (input->queue_head + 1) % MUX_QUEUE_SIZE;
+        --input->queue_count;
+        ++mod->drop_count;
+    }
+
+    const size_t tail = (input->queue_head + input->queue_count) % MUX_QUEUE_SIZE;
+    mux_packet_t *packet = &input->queue[tail];
+    ++input->queue_count;
+
+    memcpy(packet->ts, ts, TS_PACKET_SIZE);
+    TS_SET_PID(packet->ts, custom_pid);
+
+    const int64_t arrival = (int64_t)(asc_loop_utime() - mod->start) * 27;
+    int64_t deadline = arrival + mod->delay;
+
+    packet->is_pcr = (pid == input->pcr_pid && TS_IS_PCR(ts));
+    if(packet->is_pcr)
+    {
+        /* ideal arrival follows the program clock */
+        const int64_t pcr = TS_GET_PCR(ts);
+        int64_t delta = arrival - pcr - input->pcr_offset;
+        if(!input->is_pcr_offset || delta > PCR_RESET || delta < -PCR_RESET)
+        {
+            input->pcr_offset = arrival - pcr;
+            input->is_pcr_offset = true;
+            delta = 0;
+        }
+        input->pcr_offset += delta / 16;
+        deadline = pcr + input->pcr_offset + mod->delay;
+    }
+
+    if(deadline < input->deadline_last)
+        deadline = input->deadline_last;
+    input->deadline_last = deadline;
+    packet->deadline = deadline;
+}
+
+/*
+ *  oooooooo8    oooooooo8 ooooo ooooo ooooooooooo ooooooooo  ooooo  oooo oooo
+ * 888         o888     88  888   888   888    88   888    88o 888    88   888
+ *  888oooooo  888          888ooo888   888ooo8     888    888 888    88   888
+ *         888 888o     oo  888   888   888    oo   888    888 888    88   888      o
+ * o88oooo888   888oooo88  o888o o888o o888ooo8888 o888ooo88    888oo88   o888ooooo88
+ *
+ */
+
+static void mux_emit(module_data_t *mod, const uint8_t *ts)
+{
+    if(!mod->block)
+        mod->block = module_stream_block_alloc();
+
+    module_stream_block_t *block = mod->block;
+    memcpy(&block->buffer[block->count * TS_PACKET_SIZE], ts, TS_PACKET_SIZE);
+    ++block->count;
+
+    if(block->count == STREAM_BLOCK_COUNT)
+    {
+        mod->block = NULL;
+        module_stream_send_block(mod, block);
+        module_stream_block_unref(block);
+    }
+}
+
+static void mux_slot(module_data_t *mod)
+{
+    if(mod->psi_count)
+    {
+        mux_emit(mod, mod->psi_queue[mod->psi_head]);
+        mod->psi_head = (mod->psi_head + 1) % MUX_PSI_QUEUE_SIZE;
+        --mod->psi_count;
+        return;
+    }
+
+    mux_input_t *select = NULL;
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        mux_input_t *input = &mod->input[i];
+        if(   input->queue_count
+           && (   !select
+               ||   input->queue[input->queue_head].deadline
+                  < select->queue[select->queue_head].deadline))
+        {
+            select = input;
+        }
+    }
+
+    if(!select)
+    {
+        ++mod->null_count;
+        mux_emit(mod, null_ts);
+        return;
+    }
+
+    mux_packet_t *packet = &select->queue[select->queue_head];
+    select->queue_head = (select->queue_head + 1) % MUX_QUEUE_SIZE;
+    --select->queue_count;
+
+    const int64_t shift = mod->slot_time - packet->deadline;
+    if(shift > 0)
+        ++mod->late_count;
+
+    if(packet->is_pcr)
+    {
+        int64_t pcr = ((int64_t)TS_GET_PCR(packet->ts) + shift) % (int64_t)PCR_MAX;
+        if(pcr < 0)
+            pcr += PCR_MAX;
+        TS_SET_PCR(packet->ts, pcr);
+    }
+
+    mux_emit(mod, packet->ts);
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_utime();
+
+    if(now >= mod->pat_time + MUX_PAT_INTERVAL)
+    {
+        mod->pat_time = now;
+        mpegts_psi_demux(mod->pat, on_psi_ts, mod);
+        for(int i = 0; i < mod->input_count; ++i)
+        {
+            mpegts_psi_t *custom_pmt = mod->input[i].custom_pmt;
+            if(custom_pmt->buffer_size)
+                mpegts_psi_demux(custom_pmt, on_psi_ts, mod);
+        }
+    }
+
+    if(now >= mod->sdt_time + MUX_SDT_INTERVAL)
+    {
+        mod->sdt_time = now;
+        mpegts_psi_demux(mod->sdt, on_psi_ts, mod);
+        if(mod->nit)
+            mpegts_psi_demux(mod->nit, on_psi_ts, mod);
+    }
+
+    const int64_t time = (int64_t)(now - mod->start) * 27;
+    if(time - mod->slot_time > MUX_LAG_MAX * 27)
+    {
+        asc_log_warning(MSG("output is late for %lldms. skip")
+                        , (long long)((time - mod->slot_time) / 27000));
+        mod->slot_time = time;
+    }
+
+    while(mod->slot_time <= time)
+    {
+        mux_slot(mod);
+
+        mod->slot_time += mod->slot_step;
+        mod->slot_rem += mod->slot_rem_step;
+        if(mod->slot_rem >= mod->bitrate)
+        {
+            mod->slot_rem -= mod->bitrate;
+            ++mod->slot_time;
+        }
+    }
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+/* strings with non-ASCII characters are marked as UTF-8 */
+static uint8_t mux_desc_string(uint8_t *dst, const char *str)
+{
+    if(!str)
+    {
+        dst[0] = 0;
+        return 1;
+    }
+
+    size_t size = strlen(str);
+    bool is_ascii = true;
+    for(size_t i = 0; i < size; ++i)
+    {
+        if((uint8_t)str[i] >= 0x80)
+        {
+            is_ascii = false;
+            break;
+        }
+    }
+
+    size_t skip = 1;
+    if(!is_ascii)
+        dst[skip++] = 0x15;
+
+    if(size > 0xFF - skip)
+        size = 0xFF - skip;
+    memcpy(&dst[skip], str, size);
+    dst[0] = skip - 1 + size;
+    return skip + size;
+}
+
+static void mux_input_init(module_data_t *mod, mux_input_t *input)
+{
+    const int idx = lua_gettop(lua);
+
+    lua_getfield(lua, idx, "upstream");
+    asc_assert(lua_type(lua, -1) == LUA_TLIGHTUSERDATA
+               , MSG("input #%d: option 'upstream' is required"), input->id);
+    module_stream_t *upstream = (module_stream_t *)lua_touserdata(lua, -1);
+    lua_pop(lua, 1);
+
+    lua_getfield(lua, idx, "pnr");
+    if(lua_isnumber(lua, -1))
+    {
+        input->pnr_option = lua_tonumber(lua, -1);
+        input->pnr = input->pnr_option;
+    }
+    lua_pop(lua, 1);
+
+    lua_getfield(lua, idx, "type");
+    input->service_type = (lua_isnumber(lua, -1)) ? lua_tonumber(lua, -1) : 1;
+    lua_pop(lua, 1);
+
+    /* service_descriptor */
+    uint8_t *desc = input->service_desc;
+    desc[0] = 0x48;
+    desc[2] = input->service_type;
+    size_t skip = 3;
+    lua_getfield(lua, idx, "provider");
+    skip += mux_desc_string(&desc[skip], lua_tostring(lua, -1));
+    lua_pop(lua, 1);
+    lua_getfield(lua, idx, "name");
+    skip += mux_desc_string(&desc[skip], lua_tostring(lua, -1));
+    lua_pop(lua, 1);
+    if(skip > 2 + 0xFF)
+        skip = 2 + 0xFF;
+    desc[1] = skip - 2;
+    input->service_desc_size = skip;
+
+    input->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    input->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    input->custom_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    input->queue = (mux_packet_t *)malloc(sizeof(mux_packet_t) * MUX_QUEUE_SIZE);
+
+    input->stream.self = (module_data_t *)input;
+    input->stream.on_ts = on_input_ts;
+    __module_stream_init(&input->stream);
+    input->stream.profile = mod->__stream.profile;
+    __module_stream_attach(upstream, &input->stream);
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[mpts_mux] option 'name' is required");
+
+    int value = 0;
+    module_option_number("bitrate", &value);
+    asc_assert(value > 0, MSG("option 'bitrate' is required"));
+    mod->bitrate = (uint64_t)value * 1000;
+
+    value = 100;
+    module_option_number("delay", &value);
+    mod->delay = (int64_t)value * 1000 * 27;
+
+    value = 1;
+    module_option_number("tsid", &value);
+    mod->tsid = value;
+
+    value = 1;
+    module_option_number("onid", &value);
+    mod->onid = value;
+
+    mod->network_id = -1;
+    module_option_number("network_id", &mod->network_id);
+    module_option_string("network_name", &mod->network_name, NULL);
+
+    module_stream_init(mod, NULL);
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "inputs");
+    asc_assert(lua_istable(lua, -1), MSG("option 'inputs' is required"));
+    mod->input_count = luaL_len(lua, -1);
+    asc_assert(mod->input_count > 0 && mod->input_count <= MUX_MAX_INPUTS
+               , MSG("option 'inputs': 1..%d items expected"), MUX_MAX_INPUTS);
+
+    mod->input = (mux_input_t *)calloc(mod->input_count, sizeof(mux_input_t));
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        mux_input_t *input = &mod->input[i];
+        input->mod = mod;
+        input->id = i + 1;
+
+        lua_rawgeti(lua, -1, i + 1);
+        asc_assert(lua_istable(lua, -1), MSG("option 'inputs': wrong type"));
+        mux_input_init(mod, input);
+        lua_pop(lua, 1);
+    }
+    lua_pop(lua, 1); // inputs
+
+    mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0x00);
+    mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
+    if(mod->network_id >= 0)
+        mod->nit = mpegts_psi_init(MPEGTS_PACKET_NIT, MUX_NIT_PID);
+    mux_update_si(mod);
+
+    /* slot duration in 27MHz units: integer part and remainder of the bitrate */
+    const uint64_t slot_bits = (uint64_t)TS_PACKET_SIZE * 8 * 27000000;
+    mod->slot_step = slot_bits / mod->bitrate;
+    mod->slot_rem_step = slot_bits % mod->bitrate;
+
+    module_stream_metric(mod, "astra_mpts_mux_null_packets_total", ASC_METRIC_COUNTER
+                         , "Null packets of the output", &mod->null_count);
+    module_stream_metric(mod, "astra_mpts_mux_dropped_packets_total", ASC_METRIC_COUNTER
+                         , "Input packets dropped on the queue overflow", &mod->drop_count);
+    module_stream_metric(mod, "astra_mpts_mux_late_packets_total", ASC_METRIC_COUNTER
+                         , "Packets sent after the deadline", &mod->late_count);
+
+    mod->start = asc_utime();
+    mod->timer = asc_timer_init(MUX_TIMER_INTERVAL, on_timer, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->timer, asc_timer_destroy);
+
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        mux_input_t *input = &mod->input[i];
+        __module_stream_destroy(&input->stream);
+        ASC_FREE(input->pat, mpegts_psi_destroy);
+        ASC_FREE(input->pmt, mpegts_psi_destroy);
+        ASC_FREE(input->custom_pmt, mpegts_psi_destroy);
+        ASC_FREE(input->queue, free);
+    }
+    ASC_FREE(mod->input, free);
+
+    ASC_FREE(mod->block, module_stream_block_unref);
+
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->pat, mpegts_psi_destroy);
+    ASC_FREE(mod->sdt, mpegts_psi_destroy);
+    ASC_FREE(mod->nit, mpegts_psi_destroy);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF()
+};
+MODULE_LUA_REGISTER(mpts_mux)
@@ -0,0 +1,348 @@
+/*
+ * Astra Module: MPEG-TS (Shaper)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bitrate cap with the PID priority. Token bucket of the burst size is
+ * filled with the bitrate. Each PID has the class from PAT and PMT of the
+ * stream, packet of the class is passed only if the bucket has more tokens
+ * than the reserve of the class, so on the congestion EIT schedule is
+ * dropped first, then teletext, subtitles and data, then the secondary audio.
+ * Video, the first audio, PSI and ECM are dropped only above the cap.
+ * Decision is made on the start of PES or section, the rest of the unit
+ * follows it.
+ *
+ * Module Name:
+ *      shaper
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *      bitrate     - number, bitrate cap in kbit/s
+ *      burst       - number, bucket size in milliseconds of the bitrate. default: 100
+ */
+
+#include <astra.h>
+
+#define MSG(_msg) "[shaper %s] " _msg, mod->name
+
+typedef enum
+{
+    SHAPER_CLASS_MAIN = 0,
+    SHAPER_CLASS_AUDIO = 1,
+    SHAPER_CLASS_SUB = 2,
+    SHAPER_CLASS_EIT = 3,
+    SHAPER_CLASS_COUNT = 4
+} shaper_class_t;
+
+/* pid_state */
+#define STATE_DROP 0x01
+#define STATE_PASS 0x02
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+
+    uint64_t rate;      // bytes per second
+    int64_t size;       // bucket size in bytes
+    int64_t tokens;
+    uint64_t last_time;
+
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pmt[MAX_PID];
+
+    uint8_t pid_class[MAX_PID];
+    uint8_t pid_state[MAX_PID];
+
+    uint64_t drop_count[SHAPER_CLASS_COUNT];
+};
+
+/*
+ * oooooooooo   oooooooo8 ooooo
+ *  888    888 888         888
+ *  888oooo88   888oooooo  888
+ *  888                888 888
+ * o888o       o88oooo888 o888o
+ *
+ */
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(psi->buffer[0] != 0x02)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        asc_log_error(MSG("PMT checksum error"));
+        return;
+    }
+    psi->crc32 = crc32;
+
+    bool is_audio = false;
+
+    const uint8_t *pointer;
+    PMT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
+        const uint8_t item_type = PMT_ITEM_GET_TYPE(psi, pointer);
+        mpegts_packet_type_t mpegts_type = mpegts_pes_type(item_type);
+
+        const uint8_t *desc_pointer;
+        PMT_ITEM_DESC_FOREACH(pointer, desc_pointer)
+        {
+            if(item_type != 0x06)
+                break;
+
+            switch(desc_pointer[0])
+            {
+                case 0x56:
+                case 0x59:
+                    mpegts_type = MPEGTS_PACKET_SUB;
+                    break;
+                case 0x6A:
+                case 0x7A:
+                case 0x7C:
+                    mpegts_type = MPEGTS_PACKET_AUDIO;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        switch(mpegts_type)
+        {
+            case MPEGTS_PACKET_VIDEO:
+                mod->pid_class[pid] = SHAPER_CLASS_MAIN;
+                break;
+            case MPEGTS_PACKET_AUDIO:
+                mod->pid_class[pid] = (is_audio) ? SHAPER_CLASS_AUDIO : SHAPER_CLASS_MAIN;
+                is_audio = true;
+                break;
+            default:
+                mod->pid_class[pid] = SHAPER_CLASS_SUB;
+                break;
+        }
+    }
+
+    /* PCR is not dropped even if it is on the data PID */
+    const uint16_t pcr_pid = PMT_GET_PCR(psi);
+    mod->pid_class[pcr_pid] = SHAPER_CLASS_MAIN;
+}
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(psi->buffer[0] != 0x00)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        asc_log_error(MSG("PAT checksum error"));
+        return;
+    }
+    psi->crc32 = crc32;
+
+    for(int i = 0; i < MAX_PID; ++i)
+        ASC_FREE(mod->pmt[i], mpegts_psi_destroy);
+    memset(mod->pid_class, SHAPER_CLASS_MAIN, sizeof(mod->pid_class));
+    memset(mod->pid_state, 0, sizeof(mod->pid_state));
+    mod->pid_class[0x12] = SHAPER_CLASS_EIT;
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pnr = PAT_ITEM_GET_PNR(psi, pointer);
+        const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
+        if(pnr && pid < NULL_TS_PID && !mod->pmt[pid])
+            mod->pmt[pid] = mpegts_psi_init(MPEGTS_PACKET_PMT, pid);
+    }
+}
+
+/*
+ *  oooooooo8 ooooo ooooo      o      oooooooooo ooooooooooo oooooooooo
+ * 888         888   888      888      888    888 888    88   888    888
+ *  888oooooo  888ooo888     8  88     888oooo88  888ooo8     888oooo88
+ *         888 888   888    8oooo88    888        888    oo   888  88o
+ * o88oooo888 o888o o888o o88o  o888o o888o      o888ooo8888 o888o  88o8
+ *
+ */
+
+static void shaper_refill(module_data_t *mod)
+{
+    const uint64_t now = asc_loop_utime();
+    if(now <= mod->last_time)
+        return;
+
+    mod->tokens += (now - mod->last_time) * mod->rate / 1000000;
+    if(mod->tokens > mod->size)
+        mod->tokens = mod->size;
+    mod->last_time = now;
+}
+
+/* EIT schedule sections are dropped before present/following */
+static uint8_t shaper_eit_class(const uint8_t *ts)
+{
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return SHAPER_CLASS_EIT;
+
+    const size_t skip = 1 + payload[0];
+    if(payload + skip >= ts + TS_PACKET_SIZE)
+        return SHAPER_CLASS_EIT;
+
+    const uint8_t table_id = payload[skip];
+    return (table_id == 0x4E || table_id == 0x4F) ? SHAPER_CLASS_SUB : SHAPER_CLASS_EIT;
+}
+
+static bool shaper_check(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0)
+        mpegts_psi_mux(mod->pat, ts, on_pat, mod);
+    else if(mod->pmt[pid])
+        mpegts_psi_mux(mod->pmt[pid], ts, on_pmt, mod);
+
+    uint8_t pid_class = mod->pid_class[pid];
+    if(pid_class != SHAPER_CLASS_MAIN)
+    {
+        if(TS_IS_PAYLOAD_START(ts))
+        {
+            if(pid == 0x12)
+            {
+                pid_class = shaper_eit_class(ts);
+                mod->pid_class[pid] = pid_class;
+            }
+
+            /* the reserve of the class is the part of the bucket */
+            const int64_t reserve = TS_PACKET_SIZE + mod->size * pid_class / SHAPER_CLASS_COUNT;
+            mod->pid_state[pid] = (mod->tokens >= reserve) ? STATE_PASS : STATE_DROP;
+        }
+
+        if(mod->pid_state[pid] != STATE_PASS)
+        {
+            ++mod->drop_count[pid_class];
+            return false;
+        }
+    }
+
+    if(mod->tokens < TS_PACKET_SIZE)
+    {
+        mod->pid_state[pid] = STATE_DROP;
+        ++mod->drop_count[pid_class];
+        return false;
+    }
+
+    mod->tokens -= TS_PACKET_SIZE;
+    return true;
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    shaper_refill(mod);
+
+    /* passed packets are sent with one call for each sequence */
+    size_t first = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!shaper_check(mod, &ts[i * TS_PACKET_SIZE]))
+        {
+            if(i > first)
+                module_stream_send_batch(mod, &ts[first * TS_PACKET_SIZE], i - first);
+            first = i + 1;
+        }
+    }
+
+    if(count > first)
+        module_stream_send_batch(mod, &ts[first * TS_PACKET_SIZE], count - first);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    on_ts_batch(mod, ts, 1);
+}
+
+/* required */
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[shaper] option 'name' is required");
+
+    int value = 0;
+    module_option_number("bitrate", &value);
+    asc_assert(value > 0, MSG("option 'bitrate' is required"));
+    mod->rate = (uint64_t)value * 1000 / 8;
+
+    value = 100;
+    module_option_number("burst", &value);
+    mod->size = mod->rate * value / 1000;
+    if(mod->size < TS_PACKET_SIZE * SHAPER_CLASS_COUNT * 2)
+        mod->size = TS_PACKET_SIZE * SHAPER_CLASS_COUNT * 2;
+    mod->tokens = mod->size;
+    mod->last_time = asc_utime();
+
+    module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+
+    mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mod->pid_class[0x12] = SHAPER_CLASS_EIT;
+
+    module_stream_metric(mod, "astra_shaper_audio_dropped_total", ASC_METRIC_COUNTER
+                         , "Packets of the secondary audio dropped"
+                         , &mod->drop_count[SHAPER_CLASS_AUDIO]);
+    module_stream_metric(mod, "astra_shaper_sub_dropped_total", ASC_METRIC_COUNTER
+                         , "Packets of the subtitles, teletext, data and EIT p/f dropped"
+                         , &mod->drop_count[SHAPER_CLASS_SUB]);
+    module_stream_metric(mod, "astra_shaper_eit_dropped_total", ASC_METRIC_COUNTER
+                         , "Packets of the EIT schedule dropped"
+                         , &mod->drop_count[SHAPER_CLASS_EIT]);
+    module_stream_metric(mod, "astra_shaper_main_dropped_total", ASC_METRIC_COUNTER
+                         , "Packets of the video, the first audio and PSI dropped"
+                         , &mod->drop_count[SHAPER_CLASS_MAIN]);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->pat, mpegts_psi_destroy);
+    for(int i = 0; i < MAX_PID; ++i)
+        ASC_FREE(mod->pmt[i], mpegts_psi_destroy);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF()
+};
+MODULE_LUA_REGISTER(shaper)
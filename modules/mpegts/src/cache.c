@@ -0,0 +1,274 @@
+/*
+ * Astra Module: MPEG-TS (Warm start cache)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Records are kept in memory and written to the file with a delay, so the
+ * frequent updates (control words) make one write. The file is replaced with
+ * rename(), the reader never sees the partial file. Format:
+ *      magic, version
+ *      records: key (4 bytes), size (2 bytes), data
+ * Numbers are in the host byte order, the file is not moved between hosts.
+ * On the handover the delayed write is made at once, the new process loads
+ * the file with the config.
+ */
+
+#include "../mpegts.h"
+#include <fcntl.h>
+
+#define MSG(_msg) "[mpegts/cache %s] " _msg, cache->path
+
+#define CACHE_MAGIC 0x43545341 /* ASTC */
+#define CACHE_VERSION 1
+#define CACHE_FLUSH_DELAY 1000 // ms
+#define CACHE_FILE_MAX (64 * 1024)
+
+typedef struct
+{
+    uint32_t key;
+    uint16_t size;
+    uint8_t *data;
+} cache_record_t;
+
+struct mpegts_cache_t
+{
+    char *path;
+
+    cache_record_t *record_list;
+    size_t record_count;
+
+    asc_timer_t *flush_timer;
+};
+
+static cache_record_t * cache_record(mpegts_cache_t *cache, uint32_t key)
+{
+    for(size_t i = 0; i < cache->record_count; ++i)
+    {
+        if(cache->record_list[i].key == key)
+            return &cache->record_list[i];
+    }
+    return NULL;
+}
+
+static void cache_store(mpegts_cache_t *cache, uint32_t key, const void *data, size_t size)
+{
+    cache_record_t *record = cache_record(cache, key);
+    if(!record)
+    {
+        cache->record_list = (cache_record_t *)realloc(cache->record_list
+                                                       , sizeof(cache_record_t)
+                                                         * (cache->record_count + 1));
+        record = &cache->record_list[cache->record_count];
+        ++cache->record_count;
+
+        record->key = key;
+        record->data = NULL;
+    }
+
+    record->data = (uint8_t *)realloc(record->data, size);
+    memcpy(record->data, data, size);
+    record->size = size;
+}
+
+static void cache_load(mpegts_cache_t *cache)
+{
+    const int fd = open(cache->path, O_RDONLY);
+    if(fd == -1)
+        return;
+
+    uint8_t *buffer = (uint8_t *)malloc(CACHE_FILE_MAX);
+    const ssize_t size = read(fd, buffer, CACHE_FILE_MAX);
+    close(fd);
+
+    uint32_t header[2];
+    if(size < (ssize_t)sizeof(header))
+    {
+        free(buffer);
+        return;
+    }
+
+    memcpy(header, buffer, sizeof(header));
+    if(header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION)
+    {
+        asc_log_warning(MSG("wrong format, skip"));
+        free(buffer);
+        return;
+    }
+
+    size_t skip = sizeof(header);
+    while(skip + 6 <= (size_t)size)
+    {
+        uint32_t key;
+        uint16_t record_size;
+        memcpy(&key, &buffer[skip], 4);
+        memcpy(&record_size, &buffer[skip + 4], 2);
+        skip += 6;
+
+        if(skip + record_size > (size_t)size)
+        {
+            asc_log_warning(MSG("file is truncated"));
+            break;
+        }
+
+        cache_store(cache, key, &buffer[skip], record_size);
+        skip += record_size;
+    }
+
+    free(buffer);
+}
+
+static void cache_flush(mpegts_cache_t *cache)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.tmp", cache->path);
+
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+    {
+        asc_log_error(MSG("failed to open %s [%s]"), path, strerror(errno));
+        return;
+    }
+
+    size_t size = 8;
+    for(size_t i = 0; i < cache->record_count; ++i)
+        size += 6 + cache->record_list[i].size;
+
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    const uint32_t header[2] = { CACHE_MAGIC, CACHE_VERSION };
+    memcpy(buffer, header, sizeof(header));
+
+    size_t skip = sizeof(header);
+    for(size_t i = 0; i < cache->record_count; ++i)
+    {
+        const cache_record_t *record = &cache->record_list[i];
+        memcpy(&buffer[skip], &record->key, 4);
+        memcpy(&buffer[skip + 4], &record->size, 2);
+        memcpy(&buffer[skip + 6], record->data, record->size);
+        skip += 6 + record->size;
+    }
+
+    const ssize_t ret = write(fd, buffer, size);
+    close(fd);
+    free(buffer);
+
+    if(ret != (ssize_t)size)
+    {
+        asc_log_error(MSG("failed to write %s [%s]"), path, strerror(errno));
+        unlink(path);
+        return;
+    }
+
+    if(rename(path, cache->path) != 0)
+    {
+        asc_log_error(MSG("failed to rename %s [%s]"), path, strerror(errno));
+        unlink(path);
+    }
+}
+
+static void on_flush_timer(void *arg)
+{
+    mpegts_cache_t *cache = (mpegts_cache_t *)arg;
+    cache->flush_timer = NULL;
+    cache_flush(cache);
+}
+
+static void on_handover(void *arg)
+{
+    mpegts_cache_t *cache = (mpegts_cache_t *)arg;
+    if(cache->flush_timer)
+    {
+        ASC_FREE(cache->flush_timer, asc_timer_destroy);
+        cache_flush(cache);
+    }
+}
+
+mpegts_cache_t * mpegts_cache_open(const char *path)
+{
+    mpegts_cache_t *cache = (mpegts_cache_t *)calloc(1, sizeof(mpegts_cache_t));
+    cache->path = strdup(path);
+    cache_load(cache);
+    asc_handover_attach(on_handover, cache);
+    return cache;
+}
+
+void mpegts_cache_close(mpegts_cache_t *cache)
+{
+    asc_handover_detach(cache);
+
+    if(cache->flush_timer)
+    {
+        asc_timer_destroy(cache->flush_timer);
+        cache_flush(cache);
+    }
+
+    for(size_t i = 0; i < cache->record_count; ++i)
+        free(cache->record_list[i].data);
+    free(cache->record_list);
+    free(cache->path);
+    free(cache);
+}
+
+const uint8_t * mpegts_cache_get(mpegts_cache_t *cache, uint32_t key, size_t *size)
+{
+    const cache_record_t *record = cache_record(cache, key);
+    if(!record)
+        return NULL;
+
+    *size = record->size;
+    return record->data;
+}
+
+void mpegts_cache_set(mpegts_cache_t *cache, uint32_t key, const void *data, size_t size)
+{
+    asc_assert(size <= UINT16_MAX, MSG("record is too large"));
+
+    const cache_record_t *record = cache_record(cache, key);
+    if(record && record->size == size && !memcmp(record->data, data, size))
+        return;
+
+    cache_store(cache, key, data, size);
+
+    if(!cache->flush_timer)
+        cache->flush_timer = asc_timer_one_shot(CACHE_FLUSH_DELAY, on_flush_timer, cache);
+}
+
+/* PSI section with the buffer_size and the checksum, see mpegts_cache_set() */
+void mpegts_cache_set_psi(mpegts_cache_t *cache, uint32_t key, const mpegts_psi_t *psi)
+{
+    mpegts_cache_set(cache, key, psi->buffer, psi->buffer_size);
+}
+
+/* false if the record is not found or it is not the valid section */
+bool mpegts_cache_get_psi(mpegts_cache_t *cache, uint32_t key, mpegts_psi_t *psi)
+{
+    size_t size = 0;
+    const uint8_t *data = mpegts_cache_get(cache, key, &size);
+    if(!data || size < 3 + CRC32_SIZE || size > PSI_MAX_SIZE)
+        return false;
+
+    memcpy(psi->buffer, data, size);
+    psi->buffer_size = size;
+    if((size_t)PSI_BUFFER_GET_SIZE(data) != size || !mpegts_psi_check_crc32(psi))
+    {
+        psi->buffer_size = 0;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,466 @@
+/*
+ * Astra Module: MPEG-TS (EPG)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Services are kept in the open addressing table by (onid, tsid, sid).
+ * EIT sections are skipped by the table version and the section bitmap
+ * before the parsing, an event is decoded again only if the checksum of
+ * its loop item is changed. The queries return the decoded strings as is.
+ */
+
+#include "../mpegts.h"
+
+#define MSG(_msg) "[mpegts/epg] " _msg
+
+#define EPG_HASH_SIZE 256
+/* ended events are kept for this time, seconds */
+#define EPG_EVENT_KEEP 3600
+
+struct mpegts_epg_table_t
+{
+    uint8_t table_id;
+    uint8_t version;
+    uint8_t section[256 / 8]; // received sections of the version
+};
+
+static struct
+{
+    mpegts_epg_service_t **slot;
+    size_t size; // power of 2
+    size_t count;
+} epg_store;
+
+static inline size_t service_hash(uint16_t onid, uint16_t tsid, uint16_t sid)
+{
+    uint64_t key = ((uint64_t)onid << 32) | ((uint32_t)tsid << 16) | sid;
+    key ^= key >> 29;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 32;
+    return key & (epg_store.size - 1);
+}
+
+/* slot of the service or the empty slot for it */
+static mpegts_epg_service_t ** store_slot(uint16_t onid, uint16_t tsid, uint16_t sid)
+{
+    size_t i = service_hash(onid, tsid, sid);
+    while(epg_store.slot[i])
+    {
+        const mpegts_epg_service_t *const s = epg_store.slot[i];
+        if(s->sid == sid && s->tsid == tsid && s->onid == onid)
+            break;
+        i = (i + 1) & (epg_store.size - 1);
+    }
+    return &epg_store.slot[i];
+}
+
+static void store_grow(void)
+{
+    mpegts_epg_service_t **const slot = epg_store.slot;
+    const size_t size = epg_store.size;
+
+    epg_store.size = (size) ? size * 2 : EPG_HASH_SIZE;
+    epg_store.slot = (mpegts_epg_service_t **)calloc(  epg_store.size
+                                                     , sizeof(mpegts_epg_service_t *));
+    asc_assert(epg_store.slot != NULL, MSG("calloc() failed"));
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        mpegts_epg_service_t *const s = slot[i];
+        if(s)
+            *store_slot(s->onid, s->tsid, s->sid) = s;
+    }
+
+    free(slot);
+}
+
+static mpegts_epg_service_t * store_service(uint16_t onid, uint16_t tsid, uint16_t sid)
+{
+    if((epg_store.count + 1) * 4 > epg_store.size * 3)
+        store_grow();
+
+    mpegts_epg_service_t **const slot = store_slot(onid, tsid, sid);
+    if(*slot)
+        return *slot;
+
+    mpegts_epg_service_t *const service
+        = (mpegts_epg_service_t *)calloc(1, sizeof(mpegts_epg_service_t));
+    asc_assert(service != NULL, MSG("calloc() failed"));
+
+    service->onid = onid;
+    service->tsid = tsid;
+    service->sid = sid;
+
+    *slot = service;
+    ++epg_store.count;
+
+    return service;
+}
+
+/* text with the DVB charset prefix, NULL if empty */
+static char * epg_text(const uint8_t *data, size_t size)
+{
+    return (size > 0) ? iso8859_decode(data, size) : NULL;
+}
+
+/*
+ *  oooooooo8 ooooooooo   ooooooooooo
+ * 888         888    88o 88  888  88
+ *  888oooooo  888    888     888
+ *         888 888    888     888
+ * o88oooo888 o888ooo88      o888o
+ *
+ */
+
+static void service_descriptor(mpegts_epg_service_t *service, const uint8_t *desc)
+{
+    // tag, length, service_type, provider_length, provider, name_length, name
+    const uint8_t *const end = &desc[2 + desc[1]];
+    if(desc[1] < 3)
+        return;
+
+    service->type = desc[2];
+
+    const uint8_t *ptr = &desc[3];
+    const uint8_t provider_size = *ptr++;
+    if(ptr + provider_size + 1 > end)
+        return;
+    service->provider = epg_text(ptr, provider_size);
+    ptr += provider_size;
+
+    const uint8_t name_size = *ptr++;
+    if(ptr + name_size > end)
+        return;
+    service->name = epg_text(ptr, name_size);
+}
+
+void mpegts_epg_sdt(const mpegts_psi_t *psi)
+{
+    if(psi->buffer[0] != 0x42 && psi->buffer[0] != 0x46)
+        return;
+    if(psi->buffer_size < 11 + CRC32_SIZE)
+        return;
+
+    const uint16_t tsid = SDT_GET_TSID(psi);
+    const uint16_t onid = (psi->buffer[8] << 8) | psi->buffer[9];
+    const uint8_t *const end = &psi->buffer[psi->buffer_size - CRC32_SIZE];
+
+    const uint8_t *pointer;
+    SDT_ITEMS_FOREACH(psi, pointer)
+    {
+        const size_t item_size = 5 + __SDT_ITEM_DESC_SIZE(pointer);
+        if(pointer + item_size > end)
+            break;
+
+        mpegts_epg_service_t *const service
+            = store_service(onid, tsid, SDT_ITEM_GET_SID(psi, pointer));
+
+        const uint32_t crc32 = crc32b(pointer, item_size);
+        if(service->crc32 == crc32)
+            continue;
+        service->crc32 = crc32;
+
+        ASC_FREE(service->name, free);
+        ASC_FREE(service->provider, free);
+
+        const uint8_t *desc;
+        SDT_ITEM_DESC_FOREACH(pointer, desc)
+        {
+            if(desc[0] == 0x48)
+            {
+                service_descriptor(service, desc);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * ooooooooooo ooooo ooooooooooo
+ *  888    88   888  88  888  88
+ *  888ooo8     888      888
+ *  888    oo   888      888
+ * o888ooo8888 o888o    o888o
+ *
+ */
+
+/* returns true if the section of the table version is already stored */
+static bool service_table_check(  mpegts_epg_service_t *service
+                                , uint8_t table_id, uint8_t version, uint8_t section)
+{
+    mpegts_epg_table_t *table = NULL;
+    for(size_t i = 0; i < service->table_count; ++i)
+    {
+        if(service->table_list[i].table_id == table_id)
+        {
+            table = &service->table_list[i];
+            break;
+        }
+    }
+
+    if(!table)
+    {
+        service->table_list = (mpegts_epg_table_t *)realloc(
+            service->table_list, (service->table_count + 1) * sizeof(mpegts_epg_table_t));
+        asc_assert(service->table_list != NULL, MSG("realloc() failed"));
+        table = &service->table_list[service->table_count++];
+        table->table_id = table_id;
+        table->version = version;
+        memset(table->section, 0, sizeof(table->section));
+    }
+    else if(table->version != version)
+    {
+        table->version = version;
+        memset(table->section, 0, sizeof(table->section));
+    }
+
+    const uint8_t bit = 1 << (section & 7);
+    if(table->section[section >> 3] & bit)
+        return true;
+
+    table->section[section >> 3] |= bit;
+    return false;
+}
+
+static void event_clear(mpegts_epg_event_t *event)
+{
+    ASC_FREE(event->name, free);
+    ASC_FREE(event->text, free);
+}
+
+static void event_remove(mpegts_epg_service_t *service, size_t idx)
+{
+    event_clear(&service->event_list[idx]);
+    --service->event_count;
+    memmove(  &service->event_list[idx], &service->event_list[idx + 1]
+            , (service->event_count - idx) * sizeof(mpegts_epg_event_t));
+}
+
+static mpegts_epg_event_t * event_insert(mpegts_epg_service_t *service, time_t start)
+{
+    if(service->event_count == EPG_EVENT_MAX)
+        event_remove(service, 0);
+
+    if(service->event_count == service->event_size)
+    {
+        service->event_size = (service->event_size) ? service->event_size * 2 : 16;
+        service->event_list = (mpegts_epg_event_t *)realloc(
+            service->event_list, service->event_size * sizeof(mpegts_epg_event_t));
+        asc_assert(service->event_list != NULL, MSG("realloc() failed"));
+    }
+
+    size_t idx = service->event_count;
+    while(idx > 0 && service->event_list[idx - 1].start > start)
+        --idx;
+
+    memmove(  &service->event_list[idx + 1], &service->event_list[idx]
+            , (service->event_count - idx) * sizeof(mpegts_epg_event_t));
+    ++service->event_count;
+
+    mpegts_epg_event_t *const event = &service->event_list[idx];
+    memset(event, 0, sizeof(mpegts_epg_event_t));
+    event->start = start;
+    return event;
+}
+
+static void short_event_descriptor(mpegts_epg_event_t *event, const uint8_t *desc)
+{
+    // tag, length, ISO 639 language, name_length, name, text_length, text
+    const uint8_t *const end = &desc[2 + desc[1]];
+    if(desc[1] < 5)
+        return;
+
+    for(int i = 0; i < 3; ++i)
+        event->lang[i] = (desc[2 + i] > 0x1F && desc[2 + i] < 0x7F) ? desc[2 + i] : '.';
+    event->lang[3] = '\0';
+
+    const uint8_t *ptr = &desc[5];
+    const uint8_t name_size = *ptr++;
+    if(ptr + name_size + 1 > end)
+        return;
+    event->name = epg_text(ptr, name_size);
+    ptr += name_size;
+
+    const uint8_t text_size = *ptr++;
+    if(ptr + text_size > end)
+        return;
+    event->text = epg_text(ptr, text_size);
+}
+
+static void service_event(mpegts_epg_service_t *service, const uint8_t *item, uint8_t version)
+{
+    const uint16_t event_id = EIT_ITEM_GET_EID(item);
+    const uint32_t crc32 = crc32b(item, 12 + EIT_ITEM_DESC_SIZE(item));
+    const time_t start = EIT_ITEM_START_UT(item);
+
+    for(size_t i = 0; i < service->event_count; ++i)
+    {
+        mpegts_epg_event_t *const event = &service->event_list[i];
+        if(event->event_id != event_id)
+            continue;
+
+        if(event->crc32 == crc32)
+        {
+            event->version = version;
+            return;
+        }
+
+        event_remove(service, i);
+        break;
+    }
+
+    mpegts_epg_event_t *const event = event_insert(service, start);
+    event->event_id = event_id;
+    event->version = version;
+    event->running_status = EIT_GET_RUN_STAT(item);
+    event->crc32 = crc32;
+    event->duration = EIT_ITEM_DURATION_SEC(item);
+
+    const uint8_t *desc;
+    EIT_ITEM_DESC_FOREACH(item, desc)
+    {
+        if(desc[0] == 0x4D)
+        {
+            short_event_descriptor(event, desc);
+            break;
+        }
+    }
+}
+
+static void service_prune(mpegts_epg_service_t *service, time_t now)
+{
+    size_t skip = 0;
+    for(size_t i = 0; i < service->event_count; ++i)
+    {
+        mpegts_epg_event_t *const event = &service->event_list[i];
+        if(event->start + (time_t)event->duration + EPG_EVENT_KEEP < now)
+        {
+            event_clear(event);
+            continue;
+        }
+        if(skip != i)
+            service->event_list[skip] = *event;
+        ++skip;
+    }
+    service->event_count = skip;
+}
+
+void mpegts_epg_eit(const mpegts_psi_t *psi)
+{
+    const uint8_t table_id = psi->buffer[0];
+    if(table_id < 0x4E || table_id > 0x6F)
+        return;
+    if(psi->buffer_size < 14 + CRC32_SIZE)
+        return;
+
+    mpegts_epg_service_t *const service
+        = store_service(EIT_GET_ONID(psi), EIT_GET_TSID(psi), EIT_GET_PNR(psi));
+
+    const uint8_t version = (psi->buffer[5] & 0x3E) >> 1;
+    if(service_table_check(service, table_id, version, EIT_GET_SECTION_NUMBER(psi)))
+        return;
+
+    const uint8_t *const end = &psi->buffer[psi->buffer_size - CRC32_SIZE];
+
+    const uint8_t *item;
+    EIT_ITEMS_FOREACH(psi, item)
+    {
+        if(item + 12 > end || item + 12 + EIT_ITEM_DESC_SIZE(item) > end)
+            break;
+        service_event(service, item, version);
+    }
+
+    service_prune(service, time(NULL));
+}
+
+/*
+ *   ooooooo  ooooo  oooo ooooooooooo oooooooooo ooooo  oooo
+ * o888   888o 888    88   888    88   888    888  888  88
+ * 888     888 888    88   888ooo8     888oooo88     888
+ * 888o  8o888 888    88   888    oo   888  88o      888
+ *   88ooo88    888oo88   o888ooo8888 o888o  88o8   o888o
+ *       88o8
+ */
+
+const mpegts_epg_service_t * mpegts_epg_service(int onid, int tsid, uint16_t sid)
+{
+    if(!epg_store.count)
+        return NULL;
+
+    if(onid >= 0 && tsid >= 0)
+        return *store_slot(onid, tsid, sid);
+
+    for(size_t i = 0; i < epg_store.size; ++i)
+    {
+        const mpegts_epg_service_t *const s = epg_store.slot[i];
+        if(   s && s->sid == sid
+           && (onid < 0 || s->onid == onid)
+           && (tsid < 0 || s->tsid == tsid))
+        {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+void mpegts_epg_foreach(epg_service_callback_t callback, void *arg)
+{
+    for(size_t i = 0; i < epg_store.size; ++i)
+    {
+        if(epg_store.slot[i])
+            callback(arg, epg_store.slot[i]);
+    }
+}
+
+const mpegts_epg_event_t * mpegts_epg_events(  const mpegts_epg_service_t *service
+                                             , time_t since, size_t *count)
+{
+    size_t i = 0;
+    while(   i < service->event_count
+          && service->event_list[i].start + (time_t)service->event_list[i].duration <= since)
+    {
+        ++i;
+    }
+
+    *count = service->event_count - i;
+    return &service->event_list[i];
+}
+
+void mpegts_epg_destroy(void)
+{
+    for(size_t i = 0; i < epg_store.size; ++i)
+    {
+        mpegts_epg_service_t *const service = epg_store.slot[i];
+        if(!service)
+            continue;
+
+        for(size_t j = 0; j < service->event_count; ++j)
+            event_clear(&service->event_list[j]);
+
+        free(service->event_list);
+        free(service->table_list);
+        free(service->name);
+        free(service->provider);
+        free(service);
+    }
+
+    free(epg_store.slot);
+    memset(&epg_store, 0, sizeof(epg_store));
+}
@@ -0,0 +1,92 @@
+/*
+ * Astra Module: MPEG-TS (TS header classification)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../mpegts.h"
+
+#ifdef HAVE_TS_HEADERS_AVX2
+/* header_avx2.c, processes blocks of 8 packets */
+size_t mpegts_ts_headers_avx2(const uint8_t *ts, size_t count
+                              , uint16_t *pid, uint8_t *cc, uint8_t *flags);
+
+static bool is_ts_headers_init = false;
+static bool is_ts_headers_avx2 = false;
+#endif
+
+void mpegts_ts_headers(const uint8_t *ts, size_t count
+                       , uint16_t *pid, uint8_t *cc, uint8_t *flags)
+{
+    size_t i = 0;
+
+#ifdef HAVE_TS_HEADERS_AVX2
+    if(!is_ts_headers_init)
+    {
+        __builtin_cpu_init();
+        is_ts_headers_avx2 = __builtin_cpu_supports("avx2");
+        is_ts_headers_init = true;
+    }
+
+    if(is_ts_headers_avx2)
+        i = mpegts_ts_headers_avx2(ts, count, pid, cc, flags);
+#endif
+
+    for(; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+
+        pid[i] = TS_GET_PID(cur);
+        cc[i] = TS_GET_CC(cur);
+        flags[i] = TS_GET_FLAGS(cur);
+    }
+}
+
+#define TS_STRIP_CHUNK 64
+
+size_t mpegts_ts_strip_null(const uint8_t *ts, size_t count, mpegts_ts_run_t on_run, void *arg)
+{
+    uint16_t pid[TS_STRIP_CHUNK];
+    uint8_t cc[TS_STRIP_CHUNK];
+    uint8_t flags[TS_STRIP_CHUNK];
+
+    size_t dropped = 0;
+    size_t run = 0; // first packet of the current run
+
+    for(size_t chunk = 0; chunk < count; chunk += TS_STRIP_CHUNK)
+    {
+        const size_t n = (count - chunk < TS_STRIP_CHUNK) ? count - chunk : TS_STRIP_CHUNK;
+        mpegts_ts_headers(&ts[chunk * TS_PACKET_SIZE], n, pid, cc, flags);
+
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(pid[i] != NULL_TS_PID)
+                continue;
+
+            const size_t pos = chunk + i;
+            if(pos > run)
+                on_run(arg, &ts[run * TS_PACKET_SIZE], pos - run);
+            run = pos + 1;
+            ++dropped;
+        }
+    }
+
+    if(count > run)
+        on_run(arg, &ts[run * TS_PACKET_SIZE], count - run);
+
+    return dropped;
+}
@@ -0,0 +1,73 @@
+/*
+ * Astra Module: MPEG-TS (TS header classification, AVX2)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* built for the CPU with AVX2, selected at runtime, see header.c */
+
+#pragma GCC target("avx2")
+
+#include "../mpegts.h"
+#include <immintrin.h>
+
+/* returns the number of decoded packets, the tail is left to the caller */
+size_t mpegts_ts_headers_avx2(const uint8_t *ts, size_t count
+                              , uint16_t *pid, uint8_t *cc, uint8_t *flags)
+{
+    const __m256i offset = _mm256_setr_epi32(0 * TS_PACKET_SIZE, 1 * TS_PACKET_SIZE
+                                             , 2 * TS_PACKET_SIZE, 3 * TS_PACKET_SIZE
+                                             , 4 * TS_PACKET_SIZE, 5 * TS_PACKET_SIZE
+                                             , 6 * TS_PACKET_SIZE, 7 * TS_PACKET_SIZE);
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i sync = _mm256_set1_epi32(0x47);
+    const __m256i sync_error = _mm256_set1_epi32(TS_FLAG_SYNC_ERROR);
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        // the first 4 bytes of the 8 packets, byte 0 is the lowest
+        const __m256i h = _mm256_i32gather_epi32((const int *)&ts[i * TS_PACKET_SIZE]
+                                                 , offset, 1);
+
+        const __m256i b0 = _mm256_and_si256(h, byte_mask);
+        const __m256i b1 = _mm256_and_si256(_mm256_srli_epi32(h, 8), byte_mask);
+        const __m256i b2 = _mm256_and_si256(_mm256_srli_epi32(h, 16), byte_mask);
+        const __m256i b3 = _mm256_srli_epi32(h, 24);
+
+        const __m256i v_pid = _mm256_or_si256(
+            _mm256_slli_epi32(_mm256_and_si256(b1, _mm256_set1_epi32(0x1F)), 8), b2);
+        const __m256i v_cc = _mm256_and_si256(b3, _mm256_set1_epi32(0x0F));
+        __m256i v_flags = _mm256_or_si256(
+            _mm256_and_si256(b3, _mm256_set1_epi32(0xF0)),
+            _mm256_and_si256(_mm256_srli_epi32(b1, 4), _mm256_set1_epi32(0x0E)));
+        v_flags = _mm256_or_si256(v_flags
+                                  , _mm256_andnot_si256(_mm256_cmpeq_epi32(b0, sync), sync_error));
+
+        // 32 to 16 bits packs each 128-bit lane, the permute restores the order
+        const __m256i p16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v_pid, v_pid), 0x08);
+        _mm_storeu_si128((__m128i *)&pid[i], _mm256_castsi256_si128(p16));
+
+        // cc to the low lane, flags to the high lane, then 16 to 8 bits
+        const __m256i c16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v_cc, v_flags), 0xD8);
+        const __m256i c8 = _mm256_packus_epi16(c16, c16);
+        _mm_storel_epi64((__m128i *)&cc[i], _mm256_castsi256_si128(c8));
+        _mm_storel_epi64((__m128i *)&flags[i], _mm256_extracti128_si256(c8, 1));
+    }
+
+    return i;
+}
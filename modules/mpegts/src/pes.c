@@ -63,7 +63,7 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
         {
             pes->buffer_size = pes->buffer_skip;
             pes->buffer_skip = 0;
-            pes->block_time_total = asc_utime() - pes->block_time_begin;
+            pes->block_time_total = asc_loop_utime() - pes->block_time_begin;
             callback(arg, pes);
         }
 
@@ -74,7 +74,7 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
             return;
 
         pes->buffer_size = PES_BUFFER_GET_SIZE(payload);
-        pes->block_time_begin = asc_utime();
+        pes->block_time_begin = asc_loop_utime();
 
         memcpy(pes->buffer, payload, payload_len);
         pes->buffer_skip = payload_len;
@@ -103,7 +103,7 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
         if(pes->buffer_size == pes->buffer_skip)
         {
             pes->buffer_skip = 0;
-            pes->block_time_total = asc_utime() - pes->block_time_begin;
+            pes->block_time_total = asc_loop_utime() - pes->block_time_begin;
             callback(arg, pes);
         }
     }
@@ -189,3 +189,248 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg)
             pes->ts[1] = pes->ts[1] & ~0x40; /* unset PUSI */
     } while(pes->buffer_skip != pes->buffer_size);
 }
+
+/*
+ * PES assembler.
+ *
+ * The TS buffers of the stream are reused after the callback, so the payload
+ * is copied once into the ring. The complete PES is given as the view of the
+ * ring without the copy: one part, or two parts if the PES wraps the end.
+ * The view stays valid until the ring is overwritten, at least until the
+ * callback returns. Rings are taken from the pool and returned on destroy.
+ */
+
+#define PES_RING_SIZE PES_MAX_SIZE
+#define PES_RING_POOL_SIZE 16
+
+struct mpegts_pes_asm_t
+{
+    uint16_t pid;
+    uint8_t cc;
+    bool is_started;
+
+    uint8_t *ring;
+    uint32_t begin; // first byte of the current PES
+    uint32_t skip;  // collected bytes of the current PES
+    uint32_t size;  // expected size, 0 if not limited (video)
+
+    uint64_t time;
+
+    uint8_t header[PES_VIEW_HEADER_SIZE];
+};
+
+typedef struct pes_ring_t pes_ring_t;
+
+struct pes_ring_t
+{
+    pes_ring_t *next;
+};
+
+static struct
+{
+    pes_ring_t *head;
+    size_t count;
+
+    uint8_t *flat; // contiguous copy of the wrapped PES, see mpegts_pes_view_data()
+} ring_pool = { NULL, 0, NULL };
+
+static uint8_t * ring_alloc(void)
+{
+    pes_ring_t *const ring = ring_pool.head;
+    if(ring)
+    {
+        ring_pool.head = ring->next;
+        --ring_pool.count;
+        return (uint8_t *)ring;
+    }
+
+    uint8_t *const buffer = (uint8_t *)malloc(PES_RING_SIZE);
+    asc_assert(buffer != NULL, "[pes] failed to allocate ring");
+    return buffer;
+}
+
+static void ring_free(uint8_t *buffer)
+{
+    if(ring_pool.count >= PES_RING_POOL_SIZE)
+    {
+        free(buffer);
+        return;
+    }
+
+    pes_ring_t *const ring = (pes_ring_t *)buffer;
+    ring->next = ring_pool.head;
+    ring_pool.head = ring;
+    ++ring_pool.count;
+}
+
+void mpegts_pes_asm_pool_destroy(void)
+{
+    while(ring_pool.head)
+    {
+        pes_ring_t *const next = ring_pool.head->next;
+        free(ring_pool.head);
+        ring_pool.head = next;
+    }
+    ring_pool.count = 0;
+
+    if(ring_pool.flat)
+    {
+        free(ring_pool.flat);
+        ring_pool.flat = NULL;
+    }
+}
+
+mpegts_pes_asm_t * mpegts_pes_asm_init(uint16_t pid)
+{
+    mpegts_pes_asm_t *const pes = (mpegts_pes_asm_t *)calloc(1, sizeof(mpegts_pes_asm_t));
+    asc_assert(pes != NULL, "[pes] failed to allocate assembler");
+
+    pes->pid = pid;
+    pes->ring = ring_alloc();
+
+    return pes;
+}
+
+void mpegts_pes_asm_destroy(mpegts_pes_asm_t *pes)
+{
+    if(!pes)
+        return;
+
+    ring_free(pes->ring);
+    free(pes);
+}
+
+static void pes_asm_write(mpegts_pes_asm_t *pes, const uint8_t *data, uint32_t size)
+{
+    uint32_t pos = pes->begin + pes->skip;
+    if(pos >= PES_RING_SIZE)
+        pos -= PES_RING_SIZE;
+
+    const uint32_t tail = PES_RING_SIZE - pos;
+    if(size <= tail)
+        memcpy(&pes->ring[pos], data, size);
+    else
+    {
+        memcpy(&pes->ring[pos], data, tail);
+        memcpy(pes->ring, &data[tail], size - tail);
+    }
+
+    pes->skip += size;
+}
+
+static void pes_asm_complete(  mpegts_pes_asm_t *pes, uint32_t size
+                             , pes_view_callback_t callback, void *arg)
+{
+    mpegts_pes_view_t view;
+    view.pid = pes->pid;
+    view.buffer_size = size;
+    view.time = pes->time;
+
+    const uint32_t tail = PES_RING_SIZE - pes->begin;
+    view.data[0] = &pes->ring[pes->begin];
+    if(size <= tail)
+    {
+        view.size[0] = size;
+        view.data[1] = NULL;
+        view.size[1] = 0;
+    }
+    else
+    {
+        view.size[0] = tail;
+        view.data[1] = pes->ring;
+        view.size[1] = size - tail;
+    }
+
+    if(view.size[0] >= PES_VIEW_HEADER_SIZE || view.size[1] == 0)
+        view.buffer = view.data[0];
+    else
+    {
+        const uint32_t head = view.size[0];
+        const uint32_t rest = ((size < PES_VIEW_HEADER_SIZE) ? size : PES_VIEW_HEADER_SIZE) - head;
+        memcpy(pes->header, view.data[0], head);
+        memcpy(&pes->header[head], view.data[1], rest);
+        view.buffer = pes->header;
+    }
+
+    // next PES begins after the current, the view remains valid for a while
+    pes->begin += size;
+    if(pes->begin >= PES_RING_SIZE)
+        pes->begin -= PES_RING_SIZE;
+    pes->skip = 0;
+    pes->is_started = false;
+
+    callback(arg, &view);
+}
+
+void mpegts_pes_asm_mux(  mpegts_pes_asm_t *pes, const uint8_t *ts
+                        , pes_view_callback_t callback, void *arg)
+{
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return;
+
+    const uint8_t payload_len = ts + TS_PACKET_SIZE - payload;
+    const uint8_t cc = TS_GET_CC(ts);
+
+    if(TS_IS_PAYLOAD_START(ts))
+    {
+        // PES without the size is completed by the next one
+        if(pes->is_started)
+            pes_asm_complete(pes, pes->skip, callback, arg);
+
+        if(payload_len < PES_HEADER_SIZE)
+            return;
+
+        if(PES_BUFFER_GET_HEADER(payload) != 0x000001)
+            return;
+
+        pes->is_started = true;
+        pes->size = PES_BUFFER_GET_SIZE(payload);
+        if(pes->size == PES_HEADER_SIZE)
+            pes->size = 0;
+        pes->time = asc_loop_utime();
+    }
+    else
+    {
+        if(!pes->is_started)
+            return;
+
+        if(((pes->cc + 1) & 0x0F) != cc)
+        { // discontinuity error
+            pes->skip = 0;
+            pes->is_started = false;
+            return;
+        }
+    }
+
+    pes->cc = cc;
+
+    if(pes->skip + payload_len > PES_RING_SIZE)
+    {
+        pes->skip = 0;
+        pes->is_started = false;
+        return;
+    }
+
+    pes_asm_write(pes, payload, payload_len);
+
+    if(pes->size && pes->skip >= pes->size)
+        pes_asm_complete(pes, pes->size, callback, arg);
+}
+
+const uint8_t * mpegts_pes_view_data(const mpegts_pes_view_t *view)
+{
+    if(view->size[1] == 0)
+        return view->data[0];
+
+    if(!ring_pool.flat)
+    {
+        ring_pool.flat = (uint8_t *)malloc(PES_RING_SIZE);
+        asc_assert(ring_pool.flat != NULL, "[pes] failed to allocate buffer");
+    }
+
+    memcpy(ring_pool.flat, view->data[0], view->size[0]);
+    memcpy(&ring_pool.flat[view->size[0]], view->data[1], view->size[1]);
+
+    return ring_pool.flat;
+}
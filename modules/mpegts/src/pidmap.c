@@ -0,0 +1,120 @@
+/*
+ * Astra Module: MPEG-TS (PID map)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../mpegts.h"
+
+/*
+ * Lookup is a bit test and popcount of one word. Insert and remove move
+ * the tail of the dense array, PIDs are changed only with PSI.
+ */
+
+#define PID_MAP_WORDS (MAX_PID / 64)
+#define PID_MAP_SIZE 8
+
+void mpegts_pid_map_init(mpegts_pid_map_t *map, uintptr_t value_default)
+{
+    memset(map, 0, sizeof(mpegts_pid_map_t));
+    map->value_default = value_default;
+}
+
+void mpegts_pid_map_destroy(mpegts_pid_map_t *map)
+{
+    ASC_FREE(map->value, free);
+    map->count = 0;
+    map->size = 0;
+    memset(map->bits, 0, sizeof(map->bits));
+    memset(map->rank, 0, sizeof(map->rank));
+}
+
+void mpegts_pid_map_clear(mpegts_pid_map_t *map)
+{
+    map->count = 0;
+    memset(map->bits, 0, sizeof(map->bits));
+    memset(map->rank, 0, sizeof(map->rank));
+}
+
+static inline size_t pid_map_index(const mpegts_pid_map_t *map, uint16_t pid)
+{
+    const uint64_t bit = 1ULL << (pid & 63);
+    return map->rank[pid >> 6] + __builtin_popcountll(map->bits[pid >> 6] & (bit - 1));
+}
+
+static void pid_map_remove(mpegts_pid_map_t *map, uint16_t pid)
+{
+    const size_t idx = pid_map_index(map, pid);
+    --map->count;
+    memmove(&map->value[idx], &map->value[idx + 1], (map->count - idx) * sizeof(uintptr_t));
+
+    map->bits[pid >> 6] &= ~(1ULL << (pid & 63));
+    for(size_t i = (pid >> 6) + 1; i < PID_MAP_WORDS; ++i)
+        --map->rank[i];
+}
+
+void mpegts_pid_map_set(mpegts_pid_map_t *map, uint16_t pid, uintptr_t value)
+{
+    const bool is_set = mpegts_pid_map_has(map, pid);
+
+    if(value == map->value_default)
+    {
+        if(is_set)
+            pid_map_remove(map, pid);
+        return;
+    }
+
+    const size_t idx = pid_map_index(map, pid);
+    if(is_set)
+    {
+        map->value[idx] = value;
+        return;
+    }
+
+    if(map->count == map->size)
+    {
+        map->size = (map->size) ? (map->size * 2) : PID_MAP_SIZE;
+        map->value = (uintptr_t *)realloc(map->value, map->size * sizeof(uintptr_t));
+        asc_assert(map->value != NULL, "[mpegts pid_map] failed to allocate values");
+    }
+
+    memmove(&map->value[idx + 1], &map->value[idx], (map->count - idx) * sizeof(uintptr_t));
+    map->value[idx] = value;
+    ++map->count;
+
+    map->bits[pid >> 6] |= 1ULL << (pid & 63);
+    for(size_t i = (pid >> 6) + 1; i < PID_MAP_WORDS; ++i)
+        ++map->rank[i];
+}
+
+int mpegts_pid_map_next(const mpegts_pid_map_t *map, int pid)
+{
+    ++pid;
+    if(pid >= MAX_PID)
+        return MAX_PID;
+
+    size_t w = pid >> 6;
+    uint64_t word = map->bits[w] & (~0ULL << (pid & 63));
+    while(!word)
+    {
+        if(++w >= PID_MAP_WORDS)
+            return MAX_PID;
+        word = map->bits[w];
+    }
+
+    return (int)(w << 6) + __builtin_ctzll(word);
+}
@@ -28,7 +28,12 @@ mpegts_psi_t * mpegts_psi_init(mpegts_packet_type_t type, uint16_t pid)
     psi->cc = 0;
     psi->buffer_size = 0;
     psi->buffer_skip = 0;
+    psi->is_complete = false;
     psi->crc32 = 0;
+    memset(psi->check, 0, sizeof(psi->check));
+    psi->check_skip = 0;
+    psi->packets = NULL;
+    psi->packets_size = 0;
     return psi;
 }
 
@@ -37,9 +42,67 @@ void mpegts_psi_destroy(mpegts_psi_t *psi)
     if(!psi)
         return;
 
+    if(psi->packets)
+        free(psi->packets);
+
     free(psi);
 }
 
+/* size, header and checksum of the section are equal to the buffered section */
+static inline bool psi_is_repeat(const mpegts_psi_t *psi, const uint8_t *section, size_t size)
+{
+    if(!psi->is_complete || psi->buffer_size != size)
+        return false;
+
+    const size_t crc32_skip = size - CRC32_SIZE;
+    const size_t header_size = (crc32_skip < PSI_CHECK_HEADER_SIZE)
+                             ? crc32_skip
+                             : PSI_CHECK_HEADER_SIZE;
+
+    return (   !memcmp(&psi->buffer[crc32_skip], &section[crc32_skip], CRC32_SIZE)
+            && !memcmp(psi->buffer, section, header_size));
+}
+
+/*
+ * Checks the section checksum. The checksum of the repeated sections is not
+ * calculated again, the section is compared by the size, the header and
+ * the CRC32 field with few last verified sections.
+ */
+bool mpegts_psi_check_crc32(mpegts_psi_t *psi)
+{
+    const size_t size = psi->buffer_size;
+    if(size < PSI_HEADER_SIZE + CRC32_SIZE)
+        return false;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    const size_t header_size = (size - CRC32_SIZE < PSI_CHECK_HEADER_SIZE)
+                             ? size - CRC32_SIZE
+                             : PSI_CHECK_HEADER_SIZE;
+
+    for(int i = 0; i < PSI_CHECK_CACHE_SIZE; ++i)
+    {
+        const mpegts_psi_check_t *check = &psi->check[i];
+        if(   check->size == size
+           && check->crc32 == crc32
+           && !memcmp(check->header, psi->buffer, header_size))
+        {
+            return true;
+        }
+    }
+
+    if(crc32 != PSI_CALC_CRC32(psi))
+        return false;
+
+    mpegts_psi_check_t *check = &psi->check[psi->check_skip];
+    psi->check_skip = (psi->check_skip + 1) % PSI_CHECK_CACHE_SIZE;
+
+    check->size = size;
+    check->crc32 = crc32;
+    memcpy(check->header, psi->buffer, header_size);
+
+    return true;
+}
+
 void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callback, void *arg)
 {
     const uint8_t *payload = TS_GET_PAYLOAD(ts);
@@ -84,17 +147,18 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
                     return;
                 }
                 psi->buffer_skip = 0;
+                psi->is_complete = true;
                 callback(arg, psi);
             }
             payload += ptr_field;
         }
         while(((payload - ts) < TS_PACKET_SIZE) && (payload[0] != 0xff))
         {
-            psi->buffer_size = 0;
-
             const uint8_t remain = (ts + TS_PACKET_SIZE) - payload;
             if(remain < 3)
             {
+                psi->buffer_size = 0;
+                psi->is_complete = false;
                 memcpy(psi->buffer, payload, remain);
                 psi->buffer_skip = remain;
                 break;
@@ -102,23 +166,36 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
 
             const size_t psi_buffer_size = PSI_BUFFER_GET_SIZE(payload);
             if(psi_buffer_size <= 3 || psi_buffer_size > PSI_MAX_SIZE)
+            {
+                psi->buffer_size = 0;
                 break;
+            }
 
             const size_t cpy_len = (ts + TS_PACKET_SIZE) - payload;
             if(cpy_len > TS_BODY_SIZE)
+            {
+                psi->buffer_size = 0;
                 break;
+            }
 
-            psi->buffer_size = psi_buffer_size;
             if(psi_buffer_size > cpy_len)
             {
+                psi->buffer_size = psi_buffer_size;
+                psi->is_complete = false;
                 memcpy(psi->buffer, payload, cpy_len);
                 psi->buffer_skip = cpy_len;
                 break;
             }
             else
             {
-                memcpy(psi->buffer, payload, psi_buffer_size);
+                // repeated section is already in the buffer
+                if(!psi_is_repeat(psi, payload, psi_buffer_size))
+                {
+                    psi->buffer_size = psi_buffer_size;
+                    memcpy(psi->buffer, payload, psi_buffer_size);
+                }
                 psi->buffer_skip = 0;
+                psi->is_complete = true;
                 callback(arg, psi);
                 payload += psi_buffer_size;
             }
@@ -154,6 +231,7 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
         {
             memcpy(&psi->buffer[psi->buffer_skip], payload, remain);
             psi->buffer_skip = 0;
+            psi->is_complete = true;
             callback(arg, psi);
         }
         else
@@ -165,20 +243,17 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
     psi->cc = cc;
 } /* mpegts_psi_mux */
 
-void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg)
+/* TS packets of the section with the pointer field */
+#define PSI_PACKETS_MAX ((PSI_MAX_SIZE + 1 + TS_BODY_SIZE - 1) / TS_BODY_SIZE)
+
+static void psi_packetize(mpegts_psi_t *psi)
 {
     const size_t buffer_size = psi->buffer_size;
-    if(!buffer_size)
-        return;
 
-    uint8_t *ts = psi->ts;
+    if(!psi->packets)
+        psi->packets = malloc(PSI_PACKETS_MAX * TS_PACKET_SIZE);
 
-    ts[0] = 0x47;
-    ts[1] = 0x40 /* PUSI */ | psi->pid >> 8;
-    ts[2] = psi->pid & 0xff;
-    ts[4] = 0x00;
-
-    const uint8_t ts_3 = 0x10; /* payload without adaptation field */
+    uint8_t *ts = psi->packets;
 
     // 1 - pointer field
     size_t ts_skip = TS_HEADER_SIZE + 1;
@@ -187,6 +262,17 @@ void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg)
 
     while(buffer_skip < buffer_size)
     {
+        ts[0] = 0x47;
+        ts[1] = psi->pid >> 8;
+        ts[2] = psi->pid & 0xff;
+        ts[3] = 0x10; /* payload without adaptation field */
+
+        if(ts_skip == 5)
+        {
+            ts[1] |= 0x40; /* PUSI */
+            ts[4] = 0x00;
+        }
+
         const size_t buffer_tail = buffer_size - buffer_skip;
         if(buffer_tail < ts_size)
         {
@@ -196,18 +282,45 @@ void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg)
         }
 
         memcpy(&ts[ts_skip], &psi->buffer[buffer_skip], ts_size);
-        ts[3] = ts_3 | psi->cc;
-
         buffer_skip += ts_size;
+
+        ts_skip = TS_HEADER_SIZE;
+        ts_size = TS_BODY_SIZE;
+        ts += TS_PACKET_SIZE;
+    }
+
+    psi->packets_size = ts - psi->packets;
+    psi->packets_pid = psi->pid;
+    psi->packets_buffer_size = buffer_size;
+    psi->packets_crc32 = PSI_GET_CRC32(psi);
+}
+
+/*
+ * The packets are cached by the pid, the size and the CRC32 field of the section.
+ * Tables are updated with PSI_SET_CRC32(), only the continuity counter is changed
+ * for each demux of the same section.
+ */
+void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg)
+{
+    const size_t buffer_size = psi->buffer_size;
+    if(buffer_size < CRC32_SIZE)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(   !psi->packets
+       || psi->packets_pid != psi->pid
+       || psi->packets_buffer_size != buffer_size
+       || psi->packets_crc32 != crc32)
+    {
+        psi_packetize(psi);
+    }
+
+    for(size_t skip = 0; skip < psi->packets_size; skip += TS_PACKET_SIZE)
+    {
+        uint8_t *ts = &psi->packets[skip];
+        TS_SET_CC(ts, psi->cc);
         psi->cc = (psi->cc + 1) & 0x0F;
 
         callback(arg, ts);
-
-        if(ts_skip == 5)
-        {
-            ts_skip = TS_HEADER_SIZE;
-            ts_size = TS_BODY_SIZE;
-            ts[1] &= ~0x40; /* turn off pusi bit */
-        }
     }
 } /* mpegts_packet_demux */
@@ -0,0 +1,489 @@
+/*
+ * Astra Module: MPEG-TS (TR 101 290)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ETSI TR 101 290 priority 1 and 2 measurements.
+ *
+ * The state is an array of the last CC and an index of the PIDs referenced
+ * by PAT and PMT. Timeouts are checked by the arrival time, PCR intervals
+ * by the PCR values. PCR accuracy compares the PCR with the value expected
+ * from the packet position and the previous PCR interval, so it is only
+ * meaningful for constant bitrate streams.
+ */
+
+#include "../mpegts.h"
+
+#define SYNC_LOSS_COUNT 2           // corrupted sync bytes in a row
+#define SYNC_ACQUIRE_COUNT 5        // good sync bytes in a row
+
+#define PAT_INTERVAL 500000         // us
+#define PMT_INTERVAL 500000         // us
+#define PID_INTERVAL 5000000        // us
+#define PTS_INTERVAL 700000         // us
+#define CHECK_INTERVAL 100000       // us, timeouts
+
+#define PCR_INTERVAL (40 * 27000)           // 27MHz
+#define PCR_DISCONTINUITY (100 * 27000)     // 27MHz
+#define PCR_ACCURACY 500                    // ns
+#define PCR_MAX ((1ULL << 33) * 300)
+
+#define ITEM_PMT 0x01
+#define ITEM_ES  0x02
+#define ITEM_PTS 0x04   // video and audio
+#define ITEM_PCR 0x08
+
+typedef struct
+{
+    uint16_t pid;
+    uint16_t pmt_pid;   // owner of the ES
+    uint8_t type;
+
+    uint64_t last_time; // last packet, for PMT the last section
+    uint64_t pts_time;
+
+    uint64_t pcr_last;
+    uint64_t pcr_packet;        // position of the last PCR, 0 if not set
+    uint64_t pcr_delta;         // previous interval
+    uint64_t pcr_delta_packets;
+
+    mpegts_psi_t *psi;  // PMT
+    uint32_t crc32;
+} tr_item_t;
+
+struct mpegts_tr101290_t
+{
+    mpegts_tr101290_stat_t stat;
+
+    uint64_t now;
+    uint64_t packets;   // position of the current packet
+
+    bool is_sync;
+    uint8_t sync_bad;
+    uint8_t sync_good;
+
+    uint8_t cc[MAX_PID];        // 0x10 | last CC, 0 if not set
+    uint16_t index[MAX_PID];    // 1 + position in item_list, 0 if not referenced
+
+    tr_item_t *item_list;
+    size_t item_count;
+    size_t item_size;
+
+    mpegts_psi_t *pat;
+    uint64_t pat_time;
+    uint32_t pat_crc32;
+
+    mpegts_psi_t *cat;
+    bool is_cat;
+    bool is_scrambled;  // since the last check
+
+    uint64_t check_time;
+};
+
+/*
+ * Items
+ */
+
+static tr_item_t *item_append(mpegts_tr101290_t *tr, uint16_t pid, uint8_t type, uint16_t pmt_pid)
+{
+    if(tr->index[pid])
+    {
+        tr_item_t *const item = &tr->item_list[tr->index[pid] - 1];
+        item->type |= type;
+        return item;
+    }
+
+    if(tr->item_count == tr->item_size)
+    {
+        tr->item_size = (tr->item_size) ? (tr->item_size * 2) : 16;
+        tr->item_list = (tr_item_t *)realloc(tr->item_list, tr->item_size * sizeof(tr_item_t));
+        asc_assert(tr->item_list != NULL, "[tr101290] failed to allocate items");
+    }
+
+    tr_item_t *const item = &tr->item_list[tr->item_count];
+    memset(item, 0, sizeof(tr_item_t));
+    item->pid = pid;
+    item->pmt_pid = pmt_pid;
+    item->type = type;
+    item->last_time = tr->now;
+    if(type & ITEM_PMT)
+        item->psi = mpegts_psi_init(MPEGTS_PACKET_PMT, pid);
+
+    ++tr->item_count;
+    tr->index[pid] = tr->item_count;
+
+    return item;
+}
+
+/* removes the ES of the PMT, or all items if pmt_pid is MAX_PID */
+static void item_remove(mpegts_tr101290_t *tr, uint16_t pmt_pid)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < tr->item_count; ++i)
+    {
+        tr_item_t *const item = &tr->item_list[i];
+        const bool is_remove = (pmt_pid == MAX_PID)
+                            || (!(item->type & ITEM_PMT) && item->pmt_pid == pmt_pid);
+        if(is_remove)
+        {
+            if(item->psi)
+                mpegts_psi_destroy(item->psi);
+            continue;
+        }
+
+        if(count != i)
+            tr->item_list[count] = *item;
+        ++count;
+    }
+    tr->item_count = count;
+
+    memset(tr->index, 0, sizeof(tr->index));
+    for(size_t i = 0; i < tr->item_count; ++i)
+        tr->index[tr->item_list[i].pid] = i + 1;
+}
+
+/*
+ * Tables
+ */
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_tr101290_t *tr = (mpegts_tr101290_t *)arg;
+
+    if(psi->buffer[0] != 0x00)
+    {
+        ++tr->stat.pat_error;
+        return;
+    }
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        ++tr->stat.crc_error;
+        return;
+    }
+
+    tr->pat_time = tr->now;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == tr->pat_crc32)
+        return;
+    tr->pat_crc32 = crc32;
+
+    item_remove(tr, MAX_PID);
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        if(PAT_ITEM_GET_PNR(psi, pointer))
+            item_append(tr, PAT_ITEM_GET_PID(psi, pointer), ITEM_PMT, 0);
+    }
+}
+
+static void on_cat(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_tr101290_t *tr = (mpegts_tr101290_t *)arg;
+
+    if(psi->buffer[0] != 0x01)
+    {
+        ++tr->stat.cat_error;
+        return;
+    }
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        ++tr->stat.crc_error;
+        return;
+    }
+
+    tr->is_cat = true;
+}
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_tr101290_t *tr = (mpegts_tr101290_t *)arg;
+
+    if(psi->buffer[0] != 0x02 || !tr->index[psi->pid])
+        return;
+
+    if(!mpegts_psi_check_crc32(psi))
+    {
+        ++tr->stat.crc_error;
+        return;
+    }
+
+    tr_item_t *item = &tr->item_list[tr->index[psi->pid] - 1];
+    item->last_time = tr->now;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == item->crc32)
+        return;
+    item->crc32 = crc32;
+
+    const uint16_t pmt_pid = psi->pid;
+    item_remove(tr, pmt_pid);
+
+    const uint16_t pcr_pid = PMT_GET_PCR(psi);
+    if(pcr_pid != NULL_TS_PID)
+        item_append(tr, pcr_pid, ITEM_PCR, pmt_pid);
+
+    const uint8_t *pointer;
+    PMT_ITEMS_FOREACH(psi, pointer)
+    {
+        const mpegts_packet_type_t type = mpegts_pes_type(PMT_ITEM_GET_TYPE(psi, pointer));
+        const bool is_pts = (type == MPEGTS_PACKET_VIDEO || type == MPEGTS_PACKET_AUDIO);
+        item_append(tr, PMT_ITEM_GET_PID(psi, pointer)
+                    , ITEM_ES | ((is_pts) ? ITEM_PTS : 0), pmt_pid);
+    }
+}
+
+/*
+ * Packets
+ */
+
+static void check_pcr(mpegts_tr101290_t *tr, tr_item_t *item, const uint8_t *ts)
+{
+    const uint64_t pcr = TS_GET_PCR(ts);
+    const bool is_discontinuity = (ts[5] & 0x80);
+
+    if(item->pcr_packet && !is_discontinuity)
+    {
+        const uint64_t delta = (pcr + PCR_MAX - item->pcr_last) % PCR_MAX;
+        const uint64_t delta_packets = tr->packets - item->pcr_packet;
+
+        if(delta == 0 || delta > PCR_DISCONTINUITY)
+        {
+            ++tr->stat.pcr_discontinuity_error;
+            item->pcr_delta_packets = 0;
+        }
+        else
+        {
+            if(delta > PCR_INTERVAL)
+                ++tr->stat.pcr_repetition_error;
+
+            if(item->pcr_delta_packets)
+            {
+                const uint64_t expected = item->pcr_delta * delta_packets
+                                        / item->pcr_delta_packets;
+                const uint64_t error = (delta > expected) ? (delta - expected) : (expected - delta);
+                if(error * 1000 / 27 > PCR_ACCURACY)
+                    ++tr->stat.pcr_accuracy_error;
+            }
+
+            item->pcr_delta = delta;
+            item->pcr_delta_packets = delta_packets;
+        }
+    }
+    else
+        item->pcr_delta_packets = 0;
+
+    item->pcr_last = pcr;
+    item->pcr_packet = tr->packets;
+}
+
+static void check_pts(mpegts_tr101290_t *tr, tr_item_t *item, const uint8_t *ts)
+{
+    const uint8_t *const payload = TS_GET_PAYLOAD(ts);
+    if(!payload || (payload - ts) + 9 > TS_PACKET_SIZE)
+        return;
+
+    if(PES_BUFFER_GET_HEADER(payload) != 0x000001 || !(payload[7] & 0x80))
+        return;
+
+    if(item->pts_time && tr->now - item->pts_time > PTS_INTERVAL)
+        ++tr->stat.pts_error;
+    item->pts_time = tr->now;
+}
+
+static void check_timeout(mpegts_tr101290_t *tr)
+{
+    const uint64_t now = tr->now;
+    if(now - tr->check_time < CHECK_INTERVAL)
+        return;
+    tr->check_time = now;
+
+    if(now - tr->pat_time > PAT_INTERVAL)
+    {
+        ++tr->stat.pat_error;
+        tr->pat_time = now;
+    }
+
+    for(size_t i = 0; i < tr->item_count; ++i)
+    {
+        tr_item_t *const item = &tr->item_list[i];
+
+        if(now - item->last_time > ((item->type & ITEM_PMT) ? PMT_INTERVAL : PID_INTERVAL))
+        {
+            if(item->type & ITEM_PMT)
+                ++tr->stat.pmt_error;
+            else
+                ++tr->stat.pid_error;
+            item->last_time = now;
+        }
+
+        if(item->pts_time && now - item->pts_time > PTS_INTERVAL)
+        {
+            ++tr->stat.pts_error;
+            item->pts_time = now;
+        }
+    }
+
+    if(tr->is_scrambled && !tr->is_cat)
+        ++tr->stat.cat_error;
+    tr->is_scrambled = false;
+}
+
+void mpegts_tr101290_process(mpegts_tr101290_t *tr, const uint8_t *ts, size_t count, uint64_t now)
+{
+    tr->now = now;
+    if(!tr->pat_time)
+    {
+        tr->pat_time = now;
+        tr->check_time = now;
+    }
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+        ++tr->packets;
+
+        if(cur[0] != 0x47)
+        {
+            ++tr->stat.sync_byte_error;
+            tr->sync_good = 0;
+            if(tr->sync_bad < SYNC_LOSS_COUNT)
+                ++tr->sync_bad;
+            if(tr->is_sync && tr->sync_bad >= SYNC_LOSS_COUNT)
+            {
+                tr->is_sync = false;
+                ++tr->stat.sync_loss;
+            }
+            continue;
+        }
+
+        tr->sync_bad = 0;
+        if(!tr->is_sync && ++tr->sync_good >= SYNC_ACQUIRE_COUNT)
+            tr->is_sync = true;
+
+        if(cur[1] & 0x80)
+        {
+            ++tr->stat.transport_error;
+            continue;
+        }
+
+        const uint16_t pid = TS_GET_PID(cur);
+        if(pid == NULL_TS_PID)
+            continue;
+
+        const bool is_scrambled = TS_IS_SCRAMBLED(cur);
+
+        if(TS_IS_PAYLOAD(cur))
+        {
+            const uint8_t cc = TS_GET_CC(cur);
+            const uint8_t last_cc = tr->cc[pid];
+            tr->cc[pid] = 0x10 | cc;
+
+            // one duplicate packet is allowed, discontinuity_indicator resets the counter
+            if(last_cc
+               && ((last_cc + 1) & 0x0F) != cc
+               && (last_cc & 0x0F) != cc
+               && !(TS_IS_AF(cur) && cur[4] > 0 && (cur[5] & 0x80)))
+            {
+                ++tr->stat.cc_error;
+            }
+        }
+
+        if(pid == 0x00)
+        {
+            if(is_scrambled)
+                ++tr->stat.pat_error;
+            else
+                mpegts_psi_mux(tr->pat, cur, on_pat, tr);
+            continue;
+        }
+
+        if(pid == 0x01)
+        {
+            if(!is_scrambled)
+                mpegts_psi_mux(tr->cat, cur, on_cat, tr);
+            continue;
+        }
+
+        if(is_scrambled)
+            tr->is_scrambled = true;
+
+        if(!tr->index[pid])
+            continue;
+
+        tr_item_t *const item = &tr->item_list[tr->index[pid] - 1];
+
+        if(item->type & ITEM_PCR && TS_IS_PCR(cur))
+            check_pcr(tr, item, cur);
+
+        if(item->type & ITEM_PTS && TS_IS_PAYLOAD_START(cur) && !is_scrambled)
+            check_pts(tr, item, cur);
+
+        if(item->type & ITEM_PMT)
+        {
+            // the callback may reallocate item_list
+            if(is_scrambled)
+                ++tr->stat.pmt_error;
+            else
+                mpegts_psi_mux(item->psi, cur, on_pmt, tr);
+        }
+        else
+            item->last_time = now;
+    }
+
+    check_timeout(tr);
+}
+
+void mpegts_tr101290_discontinuity(mpegts_tr101290_t *tr)
+{
+    memset(tr->cc, 0, sizeof(tr->cc));
+    for(size_t i = 0; i < tr->item_count; ++i)
+        tr->item_list[i].pcr_packet = 0;
+}
+
+void mpegts_tr101290_stat(mpegts_tr101290_t *tr, mpegts_tr101290_stat_t *stat)
+{
+    memcpy(stat, &tr->stat, sizeof(mpegts_tr101290_stat_t));
+    memset(&tr->stat, 0, sizeof(mpegts_tr101290_stat_t));
+}
+
+mpegts_tr101290_t * mpegts_tr101290_init(void)
+{
+    mpegts_tr101290_t *tr = (mpegts_tr101290_t *)calloc(1, sizeof(mpegts_tr101290_t));
+    asc_assert(tr != NULL, "[tr101290] failed to allocate");
+
+    tr->is_sync = true;
+    tr->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0x00);
+    tr->cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 0x01);
+
+    return tr;
+}
+
+void mpegts_tr101290_destroy(mpegts_tr101290_t *tr)
+{
+    item_remove(tr, MAX_PID);
+    free(tr->item_list);
+
+    mpegts_psi_destroy(tr->pat);
+    mpegts_psi_destroy(tr->cat);
+    free(tr);
+}
@@ -0,0 +1,364 @@
+/*
+ * Astra Module: MPEG-TS (Switch)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hot standby. All inputs are attached and receive the stream, only the
+ * active one is sent to the children. Input is down if there are no packets
+ * for the timeout or set_state() marks it off air. The first input in
+ * the priority order which is up becomes active. Switch is done on the PCR
+ * packet of the new input or after switch_wait. CC is continued from the
+ * previous input and the first PCR of each PID has discontinuity_indicator.
+ *
+ * Module Name:
+ *      switch
+ *
+ * Module Options:
+ *      name        - string, channel name
+ *      timeout     - number, milliseconds without packets to mark input down.
+ *                    default: 500
+ *      switch_wait - number, milliseconds to wait the PCR packet. default: 200
+ *      revert      - number, seconds before return to the input with higher priority.
+ *                    0 - stay on the current input while it is up. default: 5
+ *      callback    - function(id), called after switch. called from timer,
+ *                    not from the packet path
+ *
+ * Module Methods:
+ *      set_upstream(id, stream)
+ *                  - attach stream instance to the input id (1..16).
+ *                    nil to detach
+ *      set_state(id, on_air)
+ *                  - set analyzer state of the input
+ *      active()    - return id of the active input, 0 if no active input
+ */
+
+#include <astra.h>
+
+#define MSG(_msg) "[switch %s] " _msg, mod->name
+
+#define SWITCH_MAX_INPUTS 16
+#define SWITCH_TIMER_INTERVAL 50
+
+#define CC_KNOWN 0x10
+#define MAP_REMAP 0x80
+#define MAP_PCR 0x40
+
+typedef struct
+{
+    /* stream.self points to the input, see on_input_ts() */
+    module_stream_t stream;
+    module_data_t *mod;
+    int id;
+
+    bool on_air;
+    bool is_up;
+    uint64_t last_time;
+    uint64_t up_time;
+} switch_input_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    uint64_t timeout;
+    uint64_t switch_wait;
+    uint64_t revert;
+    int idx_callback;
+
+    switch_input_t input[SWITCH_MAX_INPUTS];
+
+    switch_input_t *active;
+    switch_input_t *pending;
+    uint64_t pending_time;
+    bool is_switched;
+    bool is_notify;
+
+    asc_timer_t *timer;
+
+    uint8_t cc_last[MAX_PID];   // CC_KNOWN | last output CC
+    uint8_t cc_map[MAX_PID];    // MAP_* | CC offset of the active input
+
+    uint8_t buffer[TS_PACKET_SIZE];
+};
+
+static void switch_activate(module_data_t *mod, switch_input_t *input)
+{
+    mod->active = input;
+    mod->pending = NULL;
+    mod->is_notify = true;
+
+    /* first packet of each PID computes the CC offset */
+    const uint8_t map = (mod->is_switched) ? (MAP_REMAP | MAP_PCR) : MAP_REMAP;
+    memset(mod->cc_map, map, sizeof(mod->cc_map));
+    mod->is_switched = true;
+}
+
+static void switch_send(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    const uint8_t cc = TS_GET_CC(ts);
+    uint8_t map = mod->cc_map[pid];
+
+    if(map & MAP_REMAP)
+    {
+        uint8_t offset = 0;
+        const uint8_t last = mod->cc_last[pid];
+        if(last & CC_KNOWN)
+        {
+            const uint8_t next = (TS_IS_PAYLOAD(ts)) ? (last + 1) : last;
+            offset = (next - cc) & 0x0F;
+        }
+        map = (map & MAP_PCR) | offset;
+        mod->cc_map[pid] = map;
+    }
+
+    if(!map)
+    {
+        mod->cc_last[pid] = CC_KNOWN | cc;
+        module_stream_send(mod, ts);
+        return;
+    }
+
+    uint8_t *const buffer = mod->buffer;
+    memcpy(buffer, ts, TS_PACKET_SIZE);
+    TS_SET_CC(buffer, cc + (map & 0x0F));
+
+    if((map & MAP_PCR) && TS_IS_PCR(buffer))
+    {
+        buffer[5] |= 0x80; // discontinuity_indicator
+        mod->cc_map[pid] = map & ~MAP_PCR;
+    }
+
+    mod->cc_last[pid] = CC_KNOWN | TS_GET_CC(buffer);
+    module_stream_send(mod, buffer);
+}
+
+static void on_input_ts(module_data_t *arg, const uint8_t *ts)
+{
+    switch_input_t *input = (switch_input_t *)arg;
+    module_data_t *mod = input->mod;
+
+    input->last_time = asc_loop_utime();
+
+    if(input == mod->active)
+    {
+        switch_send(mod, ts);
+        return;
+    }
+
+    if(input != mod->pending)
+        return;
+
+    if(   TS_IS_PCR(ts)
+       || !mod->active
+       || input->last_time - mod->pending_time >= mod->switch_wait)
+    {
+        switch_activate(mod, input);
+        switch_send(mod, ts);
+    }
+}
+
+static void switch_select(module_data_t *mod, uint64_t now)
+{
+    switch_input_t *best = NULL;
+
+    for(int i = 0; i < SWITCH_MAX_INPUTS; ++i)
+    {
+        switch_input_t *input = &mod->input[i];
+
+        const bool is_up = (   input->stream.parent
+                            && input->on_air
+                            && input->last_time > 0
+                            && now - input->last_time < mod->timeout);
+
+        if(is_up != input->is_up)
+        {
+            input->is_up = is_up;
+            input->up_time = now;
+            if(!is_up && input->stream.parent)
+                asc_log_warning(MSG("input #%d is down"), input->id);
+        }
+
+        if(is_up && !best)
+            best = input;
+    }
+
+    switch_input_t *target = mod->active;
+    if(!best)
+        target = NULL;
+    else if(!mod->active || !mod->active->is_up)
+        target = best;
+    else if(   best < mod->active
+            && mod->revert > 0
+            && now - best->up_time >= mod->revert)
+        target = best;
+
+    if(!target)
+    {
+        mod->pending = NULL;
+        return;
+    }
+
+    if(target == mod->active)
+    {
+        mod->pending = NULL;
+    }
+    else if(target != mod->pending)
+    {
+        mod->pending = target;
+        mod->pending_time = now;
+    }
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    switch_select(mod, asc_utime());
+
+    if(mod->is_notify && mod->active)
+    {
+        mod->is_notify = false;
+        asc_log_debug(MSG("active input #%d"), mod->active->id);
+
+        if(mod->idx_callback)
+        {
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+            lua_pushnumber(lua, mod->active->id);
+            lua_call(lua, 1, 0);
+        }
+    }
+}
+
+static switch_input_t * check_input(module_data_t *mod)
+{
+    const int id = luaL_checkinteger(lua, 2);
+    if(id < 1 || id > SWITCH_MAX_INPUTS)
+        luaL_error(lua, MSG("input id should be in range 1..%d"), SWITCH_MAX_INPUTS);
+    return &mod->input[id - 1];
+}
+
+static int method_set_upstream(module_data_t *mod)
+{
+    switch_input_t *input = check_input(mod);
+
+    if(input->stream.parent)
+    {
+        __module_stream_destroy(&input->stream);
+        __module_stream_init(&input->stream);
+        input->stream.profile = mod->__stream.profile;
+    }
+
+    if(input == mod->active)
+        mod->active = NULL;
+    if(input == mod->pending)
+        mod->pending = NULL;
+
+    input->last_time = 0;
+    input->on_air = true;
+
+    if(lua_type(lua, 3) == LUA_TLIGHTUSERDATA)
+    {
+        __module_stream_attach((module_stream_t *)lua_touserdata(lua, 3), &input->stream);
+    }
+
+    return 0;
+}
+
+static int method_set_state(module_data_t *mod)
+{
+    switch_input_t *input = check_input(mod);
+    input->on_air = lua_toboolean(lua, 3);
+    switch_select(mod, asc_utime());
+    return 0;
+}
+
+static int method_active(module_data_t *mod)
+{
+    lua_pushnumber(lua, (mod->active) ? mod->active->id : 0);
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[switch] option 'name' is required");
+
+    int value = 500;
+    module_option_number("timeout", &value);
+    mod->timeout = (uint64_t)value * 1000;
+
+    value = 200;
+    module_option_number("switch_wait", &value);
+    mod->switch_wait = (uint64_t)value * 1000;
+
+    value = 5;
+    module_option_number("revert", &value);
+    mod->revert = (uint64_t)value * 1000 * 1000;
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
+    if(lua_isfunction(lua, -1))
+        mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    module_stream_init(mod, NULL);
+
+    for(int i = 0; i < SWITCH_MAX_INPUTS; ++i)
+    {
+        switch_input_t *input = &mod->input[i];
+        input->stream.self = (module_data_t *)input;
+        input->stream.on_ts = on_input_ts;
+        __module_stream_init(&input->stream);
+        input->stream.profile = mod->__stream.profile;
+        input->mod = mod;
+        input->id = i + 1;
+        input->on_air = true;
+    }
+
+    mod->timer = asc_timer_init(SWITCH_TIMER_INTERVAL, on_timer, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->timer, asc_timer_destroy);
+
+    for(int i = 0; i < SWITCH_MAX_INPUTS; ++i)
+        __module_stream_destroy(&mod->input[i].stream);
+
+    module_stream_destroy(mod);
+
+    if(mod->idx_callback)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+        mod->idx_callback = 0;
+    }
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    { "set_upstream", method_set_upstream },
+    { "set_state", method_set_state },
+    { "active", method_active },
+    MODULE_STREAM_METHODS_REF()
+};
+
+MODULE_LUA_REGISTER(switch)
@@ -24,30 +24,158 @@
  *
  * Module Options:
  *      upstream    - object, stream instance returned by module_instance:stream()
+ *      psi_cache   - boolean, keep the last PAT and PMT packets. the packets are sent
+ *                    before the stream of the new upstream, so the downstream gets
+ *                    the tables without waiting of the next repetition. default: false
+ *                    without the cache the module is transparent, the children
+ *                    receive the packets from the upstream directly
+ *
+ * Module Methods:
+ *      set_upstream(stream)
+ *                  - attach stream instance
  */
 
 #include <astra.h>
 
+#define PSI_CACHE_PMT_MAX 8
+
+typedef struct
+{
+    uint16_t pid;
+    bool is_set;
+    uint8_t ts[TS_PACKET_SIZE];
+} psi_cache_item_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
+
+    bool psi_cache;
+
+    psi_cache_item_t pat;
+    psi_cache_item_t pmt[PSI_CACHE_PMT_MAX];
+    size_t pmt_count;
 };
 
+/* returns a section if it is complete in the single packet */
+static const uint8_t * psi_cache_section(const uint8_t *ts)
+{
+    if(!TS_IS_PAYLOAD_START(ts))
+        return NULL;
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return NULL;
+
+    const uint8_t *section = payload + 1 + payload[0];
+    const uint8_t *end = ts + TS_PACKET_SIZE;
+    if(section + 3 > end)
+        return NULL;
+
+    const size_t section_length = ((section[1] & 0x0F) << 8) | section[2];
+    if(section_length < 9 || section + 3 + section_length > end)
+        return NULL;
+
+    return section;
+}
+
+static void psi_cache_pat(module_data_t *mod, const uint8_t *ts)
+{
+    const uint8_t *section = psi_cache_section(ts);
+    if(!section || section[0] != 0x00)
+        return;
+
+    if(mod->pat.is_set && !memcmp(mod->pat.ts + 4, ts + 4, TS_BODY_SIZE))
+        return;
+
+    memcpy(mod->pat.ts, ts, TS_PACKET_SIZE);
+    mod->pat.is_set = true;
+
+    /* program loop, without the header and crc32 */
+    const size_t section_length = ((section[1] & 0x0F) << 8) | section[2];
+    const uint8_t *item = section + 8;
+    const uint8_t *end = section + 3 + section_length - 4;
+
+    mod->pmt_count = 0;
+    for(; item + 4 <= end && mod->pmt_count < PSI_CACHE_PMT_MAX; item += 4)
+    {
+        const uint16_t pnr = (item[0] << 8) | item[1];
+        if(pnr == 0)
+            continue; // NIT
+
+        psi_cache_item_t *pmt = &mod->pmt[mod->pmt_count++];
+        pmt->pid = ((item[2] & 0x1F) << 8) | item[3];
+        pmt->is_set = false;
+    }
+}
+
+static void psi_cache_pmt(module_data_t *mod, const uint8_t *ts, uint16_t pid)
+{
+    for(size_t i = 0; i < mod->pmt_count; ++i)
+    {
+        psi_cache_item_t *pmt = &mod->pmt[i];
+        if(pmt->pid != pid)
+            continue;
+
+        const uint8_t *section = psi_cache_section(ts);
+        if(section && section[0] == 0x02)
+        {
+            memcpy(pmt->ts, ts, TS_PACKET_SIZE);
+            pmt->is_set = true;
+        }
+        return;
+    }
+}
+
+static void psi_cache_send(module_data_t *mod)
+{
+    if(!mod->pat.is_set)
+        return;
+
+    module_stream_send(mod, mod->pat.ts);
+    for(size_t i = 0; i < mod->pmt_count; ++i)
+    {
+        if(mod->pmt[i].is_set)
+            module_stream_send(mod, mod->pmt[i].ts);
+    }
+}
+
 static int method_set_upstream(module_data_t *mod)
 {
     if(lua_type(lua, 2) == LUA_TLIGHTUSERDATA)
-        __module_stream_attach((module_stream_t *)lua_touserdata(lua, 2), &mod->__stream);
+    {
+        module_stream_t *upstream = (module_stream_t *)lua_touserdata(lua, 2);
+        const bool is_new = (mod->__stream.parent != upstream);
+        __module_stream_attach(upstream, &mod->__stream);
+
+        if(mod->psi_cache && is_new)
+            psi_cache_send(mod);
+    }
     return 0;
 }
 
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
+    if(mod->psi_cache)
+    {
+        const uint16_t pid = TS_GET_PID(ts);
+        if(pid == 0)
+            psi_cache_pat(mod, ts);
+        else if(mod->pmt_count > 0)
+            psi_cache_pmt(mod, ts, pid);
+    }
+
     module_stream_send(mod, ts);
 }
 
 static void module_init(module_data_t *mod)
 {
+    module_option_boolean("psi_cache", &mod->psi_cache);
     module_stream_init(mod, on_ts);
+
+    /* without the cache the packets go from the upstream to the children directly */
+    if(!mod->psi_cache)
+        module_stream_set_transparent(mod, true);
 }
 
 static void module_destroy(module_data_t *mod)
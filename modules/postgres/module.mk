@@ -15,5 +15,5 @@ postgres_configure()
 }
 
 if ! postgres_configure ; then
-    ERROR="PostgreSQL or libpq not found"
+    ERROR="libpq 14 or newer not found"
 fi
@@ -18,30 +18,377 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Queries are sent in the pipeline mode, each query is followed by the sync
+ * point, so a failed query doesn't abort the next ones. Rows of insert() are
+ * collected in batches and sent with COPY, the pipeline is drained before
+ * the COPY and restored after.
+ *
+ * Module Name:
+ *      postgres
+ *
+ * Module Options:
+ *      connect_string - string, libpq connection string
+ *      queue_size  - number, limit of the queued requests. default: 4096
+ *      pipeline    - number, limit of the requests in the pipeline. default: 64
+ *      batch_size  - number, limit of the rows in the COPY batch. default: 1000
+ *
+ * Module Methods:
+ *      query({ query = "...", params = { ... }, callback = function })
+ *                  - send query. $1, $2... in the query are replaced with params
+ *      prepare({ name = "...", query = "..." })
+ *                  - prepare statement. statements are prepared again on reconnect
+ *      execute({ name = "...", params = { ... }, callback = function })
+ *                  - execute prepared statement
+ *      insert({ table = "...", columns = { ... }, row = { ... } })
+ *                  - add row to the COPY batch. batches are sent on timer
+ *      stat()
+ *                  - return table: queue, pipeline, sent, dropped, rows
+ *
+ * query(), execute() and insert() return false if the queue is full.
+ * callback is optional, without callback errors are logged.
+ */
+
 #include <astra.h>
 #include <postgresql/libpq-events.h>
 
+#ifndef LIBPQ_HAS_PIPELINING
+#   error "libpq 14 or newer is required"
+#endif
+
 #define MSG(_msg) "[postgres] " _msg
 
-typedef struct
+#define PG_TIMER_INTERVAL 50
+#define PG_RECONNECT_INTERVAL (2 * 1000 * 1000)
+#define PG_COPY_CHUNK_SIZE (64 * 1024)
+
+typedef enum
+{
+    QUERY_SIMPLE = 0,
+    QUERY_PREPARE,
+    QUERY_EXECUTE,
+    QUERY_COPY,
+} query_type_t;
+
+typedef enum
 {
+    COPY_WAIT_READY = 0,
+    COPY_SEND_DATA,
+    COPY_SEND_END,
+    COPY_WAIT_RESULT,
+} copy_state_t;
+
+typedef struct query_item_t query_item_t;
+
+struct query_item_t
+{
+    query_type_t type;
     int callback;
+    bool is_result;
+
+    char *query; // query, statement name, or COPY command
+    char *statement; // QUERY_PREPARE only
+
+    int params_count;
+    char **params;
+
+    char *copy;
+    size_t copy_size;
+    size_t copy_skip;
+    int copy_rows;
+    copy_state_t copy_state;
+
+    TAILQ_ENTRY(query_item_t) entries;
+};
+
+typedef struct statement_t statement_t;
+
+struct statement_t
+{
+    char *name;
     char *query;
-    bool queued;
-} query_item_t;
+
+    TAILQ_ENTRY(statement_t) entries;
+};
+
+typedef struct copy_batch_t copy_batch_t;
+
+struct copy_batch_t
+{
+    char *command;
+    string_buffer_t *rows;
+    int rows_count;
+
+    TAILQ_ENTRY(copy_batch_t) entries;
+};
+
+typedef TAILQ_HEAD(query_list_t, query_item_t) query_list_t;
 
 struct module_data_t
 {
     const char *connect_string;
+    int queue_size;
+    int pipeline;
+    int batch_size;
 
     PGconn *conn;
-    asc_list_t *query;
+    asc_event_t *event;
     asc_timer_t *query_timer;
-    query_item_t *current_task;
     int is_connected;
     int conn_last_state;
+    uint64_t reconnect_time;
+
+    bool is_copy;
+    bool is_write;
+
+    query_list_t queue;
+    int queue_count;
+    query_list_t sent;
+    int sent_count;
+
+    TAILQ_HEAD(statement_list_t, statement_t) statements;
+    TAILQ_HEAD(copy_batch_list_t, copy_batch_t) batches;
+
+    uint64_t sent_total;
+    uint64_t dropped;
+    uint64_t rows;
 };
 
+static void pg_process(module_data_t *mod);
+
+static char * pg_dup_value(lua_State *L, int idx)
+{
+    switch(lua_type(L, idx))
+    {
+        case LUA_TBOOLEAN:
+            return strdup(lua_toboolean(L, idx) ? "t" : "f");
+        case LUA_TNUMBER:
+        case LUA_TSTRING:
+            return strdup(lua_tostring(L, idx));
+        default:
+            return NULL;
+    }
+}
+
+static void pg_item_params(query_item_t *item, lua_State *L, int idx)
+{
+    lua_getfield(L, idx, "params");
+    if(lua_istable(L, -1))
+    {
+        const int params = lua_gettop(L);
+        item->params_count = lua_rawlen(L, params);
+        if(item->params_count > 0)
+        {
+            item->params = (char **)calloc(item->params_count, sizeof(char *));
+            for(int i = 0; i < item->params_count; ++i)
+            {
+                lua_rawgeti(L, params, i + 1);
+                item->params[i] = pg_dup_value(L, -1);
+                lua_pop(L, 1);
+            }
+        }
+    }
+    lua_pop(L, 1);
+}
+
+static int pg_item_callback(lua_State *L, int idx)
+{
+    int callback = LUA_NOREF;
+
+    lua_getfield(L, idx, "callback");
+    if(lua_isfunction(L, -1))
+        callback = luaL_ref(L, LUA_REGISTRYINDEX);
+    else
+        lua_pop(L, 1);
+
+    return callback;
+}
+
+static void pg_item_free(query_item_t *item)
+{
+    if(item->callback != LUA_NOREF)
+        luaL_unref(lua, LUA_REGISTRYINDEX, item->callback);
+
+    for(int i = 0; i < item->params_count; ++i)
+        ASC_FREE(item->params[i], free);
+    ASC_FREE(item->params, free);
+    ASC_FREE(item->query, free);
+    ASC_FREE(item->statement, free);
+    ASC_FREE(item->copy, free);
+
+    free(item);
+}
+
+static bool pg_queue(module_data_t *mod, query_item_t *item)
+{
+    if(mod->queue_count >= mod->queue_size)
+    {
+        if(!mod->dropped)
+            asc_log_error(MSG("queue is full. drop requests"));
+        ++mod->dropped;
+        pg_item_free(item);
+        return false;
+    }
+
+    TAILQ_INSERT_TAIL(&mod->queue, item, entries);
+    ++mod->queue_count;
+    return true;
+}
+
+static void pg_queue_prepare(module_data_t *mod, statement_t *statement, bool is_head)
+{
+    query_item_t *item = (query_item_t *)calloc(1, sizeof(query_item_t));
+    item->type = QUERY_PREPARE;
+    item->callback = LUA_NOREF;
+    item->query = strdup(statement->name);
+    item->statement = strdup(statement->query);
+
+    /* prepared statements are not limited by the queue size */
+    if(is_head)
+        TAILQ_INSERT_HEAD(&mod->queue, item, entries);
+    else
+        TAILQ_INSERT_TAIL(&mod->queue, item, entries);
+    ++mod->queue_count;
+}
+
+static void pg_callback(module_data_t *mod, query_item_t *item, PGresult *res)
+{
+    const ExecStatusType status = (res) ? PQresultStatus(res) : PGRES_FATAL_ERROR;
+    const char *msg = NULL;
+
+    switch(status)
+    {
+        case PGRES_COMMAND_OK:
+        case PGRES_TUPLES_OK:
+        case PGRES_COPY_IN:
+            break;
+        default:
+            msg = (res) ? PQresultErrorMessage(res) : PQerrorMessage(mod->conn);
+            if(!msg || !msg[0])
+                msg = PQresStatus(status);
+            break;
+    }
+
+    if(item->callback == LUA_NOREF)
+    {
+        if(msg)
+            asc_log_error(MSG("%s"), msg);
+        return;
+    }
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, item->callback);
+    lua_newtable(lua);
+
+    if(msg)
+    {
+        lua_pushstring(lua, msg);
+        lua_setfield(lua, -2, "error");
+    }
+    else
+    {
+        const int fields = PQnfields(res);
+        const int tuples = PQntuples(res);
+
+        lua_createtable(lua, fields, 0);
+        for(int i = 0; i < fields; i++)
+        {
+            lua_pushstring(lua, PQfname(res, i));
+            lua_rawseti(lua, -2, i + 1);
+        }
+        lua_setfield(lua, -2, "columns");
+
+        lua_createtable(lua, tuples, 0);
+        for(int i = 0; i < tuples; i++)
+        {
+            lua_createtable(lua, fields, 0);
+            for(int f = 0; f < fields; f++)
+            {
+                lua_pushlstring(lua, PQgetvalue(res, i, f), PQgetlength(res, i, f));
+                lua_rawseti(lua, -2, f + 1);
+            }
+            lua_rawseti(lua, -2, i + 1);
+        }
+        lua_setfield(lua, -2, "data");
+    }
+
+    lua_call(lua, 1, 0);
+}
+
+static void pg_flush(module_data_t *mod);
+
+static void pg_on_read(void *arg);
+static void pg_on_write(void *arg);
+static void pg_on_error(void *arg);
+
+static void pg_connect(module_data_t *mod)
+{
+    mod->is_connected = 0;
+    mod->conn_last_state = -1;
+    mod->conn = PQconnectStart(mod->connect_string);
+    PQsetnonblocking(mod->conn, 1);
+}
+
+static void pg_on_connected(module_data_t *mod)
+{
+    if(!PQenterPipelineMode(mod->conn))
+        asc_log_error(MSG("failed to enter pipeline mode: %s"), PQerrorMessage(mod->conn));
+
+    mod->event = asc_event_init(PQsocket(mod->conn), mod);
+    asc_event_set_priority(mod->event, ASC_EVENT_CONTROL);
+    asc_event_set_on_read(mod->event, pg_on_read);
+    asc_event_set_on_error(mod->event, pg_on_error);
+    mod->is_write = false;
+
+    /* statements before the queued requests, the order is kept */
+    statement_t *statement;
+    TAILQ_FOREACH_REVERSE(statement, &mod->statements, statement_list_t, entries)
+        pg_queue_prepare(mod, statement, true);
+
+    pg_process(mod);
+}
+
+static void pg_reset(module_data_t *mod)
+{
+    asc_log_error(MSG("connection to database has been lost"));
+
+    ASC_FREE(mod->event, asc_event_close);
+    ASC_FREE(mod->conn, PQfinish);
+
+    /* requests from the pipeline are sent again after reconnect */
+    query_item_t *item, *item_prev;
+    TAILQ_FOREACH_REVERSE_SAFE(item, &mod->sent, query_list_t, entries, item_prev)
+    {
+        TAILQ_REMOVE(&mod->sent, item, entries);
+        if(item->type == QUERY_PREPARE)
+        {
+            pg_item_free(item);
+            continue;
+        }
+
+        item->is_result = false;
+        item->copy_skip = 0;
+        item->copy_state = COPY_WAIT_READY;
+        TAILQ_INSERT_HEAD(&mod->queue, item, entries);
+        ++mod->queue_count;
+    }
+    mod->sent_count = 0;
+
+    /* prepared statements are queued again on connect */
+    TAILQ_FOREACH_SAFE(item, &mod->queue, entries, item_prev)
+    {
+        if(item->type == QUERY_PREPARE)
+        {
+            TAILQ_REMOVE(&mod->queue, item, entries);
+            --mod->queue_count;
+            pg_item_free(item);
+        }
+    }
+
+    mod->is_copy = false;
+    mod->is_connected = -1;
+    mod->reconnect_time = asc_utime();
+}
+
 static void pg_connection_poll(module_data_t *mod)
 {
     int state = PQconnectPoll(mod->conn);
@@ -54,14 +401,16 @@ static void pg_connection_poll(module_data_t *mod)
     switch(state)
     {
         case PGRES_POLLING_FAILED:
-            asc_log_info(MSG("Connection to database has been failed"));
+            asc_log_info(MSG("Connection to database has been failed: %s"),
+                         PQerrorMessage(mod->conn));
+            ASC_FREE(mod->conn, PQfinish);
             mod->is_connected = -1;
-            if(mod->current_task)
-                mod->current_task->queued = 0;
+            mod->reconnect_time = asc_utime();
             break;
         case PGRES_POLLING_OK:
             asc_log_info(MSG("Successfully connected to database"));
             mod->is_connected = 1;
+            pg_on_connected(mod);
             break;
         case PGRES_POLLING_ACTIVE:
         case PGRES_POLLING_READING:
@@ -70,152 +419,558 @@ static void pg_connection_poll(module_data_t *mod)
     }
 }
 
-static char * pg_error(module_data_t *mod, bool show_msg)
+static int pg_send_item(module_data_t *mod, query_item_t *item)
 {
-    char *msg = PQerrorMessage(mod->conn);
-    if(msg[0])
+    switch(item->type)
     {
-        if(show_msg)
-            asc_log_error(MSG("%s"), msg);
-
-        return msg;
+        case QUERY_SIMPLE:
+            if(!item->params_count)
+                return PQsendQueryParams(mod->conn, item->query, 0, NULL, NULL, NULL, NULL, 0);
+            return PQsendQueryParams(  mod->conn, item->query
+                                     , item->params_count, NULL
+                                     , (const char * const *)item->params, NULL, NULL, 0);
+        case QUERY_PREPARE:
+            return PQsendPrepare(mod->conn, item->query, item->statement, 0, NULL);
+        case QUERY_EXECUTE:
+            return PQsendQueryPrepared(  mod->conn, item->query
+                                       , item->params_count
+                                       , (const char * const *)item->params, NULL, NULL, 0);
+        case QUERY_COPY:
+            return PQsendQuery(mod->conn, item->query);
     }
 
-    return NULL;
+    return 0;
 }
 
-static void pg_connect(module_data_t *mod)
+static void pg_send(module_data_t *mod)
 {
-    mod->is_connected = 0;
-    mod->conn_last_state = -1;
-    mod->conn = PQconnectStart(mod->connect_string);
-    PQsetnonblocking(mod->conn, 1);
-    pg_connection_poll(mod);
+    query_item_t *item;
+    while(!mod->is_copy && (item = TAILQ_FIRST(&mod->queue)))
+    {
+        if(item->type == QUERY_COPY)
+        {
+            /* COPY is not allowed in the pipeline mode */
+            if(mod->sent_count > 0)
+                break;
+            if(PQpipelineStatus(mod->conn) != PQ_PIPELINE_OFF)
+            {
+                if(!PQexitPipelineMode(mod->conn))
+                    break;
+            }
+        }
+        else
+        {
+            if(mod->sent_count >= mod->pipeline)
+                break;
+            if(PQpipelineStatus(mod->conn) == PQ_PIPELINE_OFF)
+            {
+                if(!PQenterPipelineMode(mod->conn))
+                    break;
+            }
+        }
+
+        TAILQ_REMOVE(&mod->queue, item, entries);
+        --mod->queue_count;
+
+        if(!pg_send_item(mod, item))
+        {
+            pg_callback(mod, item, NULL);
+            pg_item_free(item);
+
+            if(PQstatus(mod->conn) == CONNECTION_BAD)
+            {
+                pg_reset(mod);
+                return;
+            }
+            continue;
+        }
+
+        if(item->type == QUERY_COPY)
+            mod->is_copy = true;
+        else
+            PQpipelineSync(mod->conn);
+
+        TAILQ_INSERT_TAIL(&mod->sent, item, entries);
+        ++mod->sent_count;
+        ++mod->sent_total;
+    }
 }
 
-static void process_query(module_data_t *mod)
+static void pg_item_done(module_data_t *mod, query_item_t *item)
 {
-    if(!mod->current_task)
+    TAILQ_REMOVE(&mod->sent, item, entries);
+    --mod->sent_count;
+    pg_item_free(item);
+}
+
+/* returns false if more data or write buffer is required */
+static bool pg_copy(module_data_t *mod, query_item_t *item)
+{
+    PGresult *res;
+
+    while(true)
     {
-        asc_list_for(mod->query)
+        switch(item->copy_state)
         {
-            mod->current_task = asc_list_data(mod->query);
-            asc_list_remove_current(mod->query);
-            break;
+            case COPY_WAIT_READY:
+                if(PQisBusy(mod->conn))
+                    return false;
+
+                res = PQgetResult(mod->conn);
+                if(res && PQresultStatus(res) == PGRES_COPY_IN)
+                {
+                    item->copy_state = COPY_SEND_DATA;
+                }
+                else
+                {
+                    item->is_result = true;
+                    item->copy_state = COPY_WAIT_RESULT;
+                    pg_callback(mod, item, res);
+                }
+                if(res)
+                    PQclear(res);
+                if(mod->is_connected != 1)
+                    return false;
+                break;
+
+            case COPY_SEND_DATA:
+                while(item->copy_skip < item->copy_size)
+                {
+                    size_t size = item->copy_size - item->copy_skip;
+                    if(size > PG_COPY_CHUNK_SIZE)
+                        size = PG_COPY_CHUNK_SIZE;
+
+                    const int ret = PQputCopyData(  mod->conn
+                                                  , &item->copy[item->copy_skip]
+                                                  , (int)size);
+                    if(ret == 0)
+                        return false;
+                    if(ret < 0)
+                        break;
+
+                    item->copy_skip += size;
+                }
+                item->copy_state = COPY_SEND_END;
+                break;
+
+            case COPY_SEND_END:
+                if(PQputCopyEnd(mod->conn, NULL) == 0)
+                    return false;
+                item->copy_state = COPY_WAIT_RESULT;
+                break;
+
+            case COPY_WAIT_RESULT:
+                if(PQisBusy(mod->conn))
+                    return false;
+
+                res = PQgetResult(mod->conn);
+                if(res)
+                {
+                    if(!item->is_result)
+                    {
+                        item->is_result = true;
+                        if(PQresultStatus(res) == PGRES_COMMAND_OK)
+                            mod->rows += item->copy_rows;
+                        pg_callback(mod, item, res);
+                    }
+                    PQclear(res);
+                    if(mod->is_connected != 1)
+                        return false;
+                    break;
+                }
+
+                mod->is_copy = false;
+                pg_item_done(mod, item);
+                return true;
         }
     }
+}
+
+static void pg_results(module_data_t *mod)
+{
+    bool is_null = false;
 
-    if(mod->current_task)
+    query_item_t *item;
+    while((item = TAILQ_FIRST(&mod->sent)))
     {
-        if(!mod->current_task->queued)
+        if(item->type == QUERY_COPY)
         {
-            if(PQsendQuery(mod->conn, mod->current_task->query))
-                mod->current_task->queued = 1;
+            if(!pg_copy(mod, item))
+                return;
+            continue;
         }
 
-        if(PQconsumeInput(mod->conn))
+        if(PQisBusy(mod->conn))
+            return;
+
+        PGresult *res = PQgetResult(mod->conn);
+        if(!res)
         {
-            // When return code of PQisBusy is zero then PQgetResult is nonblocking
-            if(!PQisBusy(mod->conn))
-            {
-                PGresult *res = PQgetResult(mod->conn);
-                if(res)
-                {
-                    char *msg = pg_error(mod, false);
+            /* end of the query results, sync point is next */
+            if(is_null)
+                return;
+            is_null = true;
+            continue;
+        }
+        is_null = false;
 
-                    lua_newtable(lua);
+        if(PQresultStatus(res) == PGRES_PIPELINE_SYNC)
+        {
+            PQclear(res);
+            pg_item_done(mod, item);
+            continue;
+        }
 
-                    if(msg)
-                    {
-                        lua_pushstring(lua, msg);
-                        lua_setfield(lua, -2, "error");
-                    }
-                    else
-                    {
-                        lua_newtable(lua);
-                        for(int i = 0; i < PQnfields(res); i++)
-                        {
-                            lua_pushstring(lua, PQfname(res, i));
-                            lua_rawseti(lua, -2, i+1);
-                        }
-                        lua_setfield(lua, -2, "columns");
-
-                        lua_newtable(lua);
-                        for(int i = 0; i < PQntuples(res); i++)
-                        {
-                            lua_newtable(lua);
-                            for(int f = 0; f < PQnfields(res); f++)
-                            {
-                                lua_pushstring(lua, PQgetvalue(res, i, f));
-                                lua_rawseti(lua, -2, f+1);
-                            }
-                            lua_rawseti(lua, -2, i+1);
-                        }
-
-                        lua_setfield(lua, -2, "data");
-                    }
+        if(!item->is_result)
+        {
+            item->is_result = true;
+            pg_callback(mod, item, res);
+        }
+        PQclear(res);
+    }
+}
 
-                    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->current_task->callback);
-                    lua_pushvalue(lua, -2);
+static void pg_flush(module_data_t *mod)
+{
+    const int ret = PQflush(mod->conn);
+    if(ret < 0)
+    {
+        pg_reset(mod);
+        return;
+    }
 
-                    lua_call(lua, 1, 0);
+    const bool is_write = (ret == 1);
+    if(is_write != mod->is_write)
+    {
+        mod->is_write = is_write;
+        asc_event_set_on_write(mod->event, (is_write) ? pg_on_write : NULL);
+    }
+}
 
-                    lua_pop(lua, 1);
+static void pg_process(module_data_t *mod)
+{
+    if(mod->is_connected != 1)
+        return;
 
-                    luaL_unref(lua, LUA_REGISTRYINDEX, mod->current_task->callback);
-                    free(mod->current_task);
-                    mod->current_task = NULL;
+    pg_send(mod);
+    if(mod->is_connected == 1)
+        pg_flush(mod);
+}
 
-                    PQclear(res);
-                }
-            }
+static void pg_on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!PQconsumeInput(mod->conn))
+    {
+        asc_log_error(MSG("%s"), PQerrorMessage(mod->conn));
+        pg_reset(mod);
+        return;
+    }
+
+    pg_results(mod);
+    pg_process(mod);
+}
+
+static void pg_on_write(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    pg_flush(mod);
+    if(mod->is_connected != 1)
+        return;
+
+    /* continue COPY data */
+    if(mod->is_copy)
+    {
+        pg_results(mod);
+        pg_process(mod);
+    }
+}
+
+static void pg_on_error(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    pg_reset(mod);
+}
+
+static void pg_copy_value(string_buffer_t *buffer, lua_State *L, int idx)
+{
+    switch(lua_type(L, idx))
+    {
+        case LUA_TBOOLEAN:
+            string_buffer_addchar(buffer, lua_toboolean(L, idx) ? 't' : 'f');
+            return;
+        case LUA_TNUMBER:
+        case LUA_TSTRING:
+            break;
+        default:
+            string_buffer_addlstring(buffer, "\\N", 2);
+            return;
+    }
+
+    size_t size = 0;
+    const char *str = lua_tolstring(L, idx, &size);
+    size_t skip = 0;
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        char c;
+        switch(str[i])
+        {
+            case '\\': c = '\\'; break;
+            case '\t': c = 't'; break;
+            case '\n': c = 'n'; break;
+            case '\r': c = 'r'; break;
+            default: continue;
         }
-        else
-            pg_error(mod, true);
 
+        if(i > skip)
+            string_buffer_addlstring(buffer, &str[skip], i - skip);
+        string_buffer_addchar(buffer, '\\');
+        string_buffer_addchar(buffer, c);
+        skip = i + 1;
+    }
+
+    if(size > skip)
+        string_buffer_addlstring(buffer, &str[skip], size - skip);
+}
+
+static bool pg_batch_queue(module_data_t *mod, copy_batch_t *batch)
+{
+    query_item_t *item = (query_item_t *)calloc(1, sizeof(query_item_t));
+    item->type = QUERY_COPY;
+    item->callback = LUA_NOREF;
+    item->query = strdup(batch->command);
+    item->copy = string_buffer_release(batch->rows, &item->copy_size);
+    item->copy_rows = batch->rows_count;
+
+    batch->rows = NULL;
+    batch->rows_count = 0;
+
+    return pg_queue(mod, item);
+}
+
+static void pg_batch_flush(module_data_t *mod)
+{
+    copy_batch_t *batch;
+    TAILQ_FOREACH(batch, &mod->batches, entries)
+    {
+        if(batch->rows_count > 0)
+            pg_batch_queue(mod, batch);
     }
 }
 
+static copy_batch_t * pg_batch_get(module_data_t *mod, const char *command)
+{
+    copy_batch_t *batch;
+    TAILQ_FOREACH(batch, &mod->batches, entries)
+    {
+        if(!strcmp(batch->command, command))
+            return batch;
+    }
+
+    batch = (copy_batch_t *)calloc(1, sizeof(copy_batch_t));
+    batch->command = strdup(command);
+    TAILQ_INSERT_TAIL(&mod->batches, batch, entries);
+
+    return batch;
+}
+
 static void on_query_timer(void *arg)
 {
-    module_data_t *mod = arg;
+    module_data_t *mod = (module_data_t *)arg;
 
-    pg_connection_poll(mod);
-    if(mod->is_connected == -1)
-        pg_connect(mod);
-    else if(mod->is_connected == 1)
-        process_query(mod);
+    switch(mod->is_connected)
+    {
+        case -1:
+            if(asc_utime() - mod->reconnect_time >= PG_RECONNECT_INTERVAL)
+                pg_connect(mod);
+            break;
+        case 0:
+            pg_connection_poll(mod);
+            break;
+        default:
+            pg_batch_flush(mod);
+            pg_process(mod);
+            break;
+    }
 }
 
 static int method_query(module_data_t *mod)
 {
-    query_item_t *query_item = calloc(1, sizeof(query_item_t));
+    luaL_checktype(lua, 2, LUA_TTABLE);
+
+    lua_getfield(lua, 2, "query");
+    const char *query = lua_tostring(lua, -1);
+    lua_pop(lua, 1);
+    if(!query)
+        luaL_error(lua, MSG("query() option 'query' is required"));
+
+    query_item_t *item = (query_item_t *)calloc(1, sizeof(query_item_t));
+    item->type = QUERY_SIMPLE;
+    item->query = strdup(query);
+    pg_item_params(item, lua, 2);
+    item->callback = pg_item_callback(lua, 2);
+
+    lua_pushboolean(lua, pg_queue(mod, item));
+    pg_process(mod);
+
+    return 1;
+}
+
+static int method_prepare(module_data_t *mod)
+{
+    luaL_checktype(lua, 2, LUA_TTABLE);
+
+    lua_getfield(lua, 2, "name");
+    const char *name = lua_tostring(lua, -1);
+    lua_getfield(lua, 2, "query");
+    const char *query = lua_tostring(lua, -1);
+    if(!name || !query)
+        luaL_error(lua, MSG("prepare() options 'name' and 'query' are required"));
+
+    statement_t *statement;
+    TAILQ_FOREACH(statement, &mod->statements, entries)
+    {
+        if(!strcmp(statement->name, name))
+            luaL_error(lua, MSG("prepare() statement '%s' already exists"), name);
+    }
+
+    statement = (statement_t *)calloc(1, sizeof(statement_t));
+    statement->name = strdup(name);
+    statement->query = strdup(query);
+    TAILQ_INSERT_TAIL(&mod->statements, statement, entries);
+    lua_pop(lua, 2);
+
+    if(mod->is_connected == 1)
+    {
+        pg_queue_prepare(mod, statement, false);
+        pg_process(mod);
+    }
+
+    return 0;
+}
+
+static int method_execute(module_data_t *mod)
+{
+    luaL_checktype(lua, 2, LUA_TTABLE);
+
+    lua_getfield(lua, 2, "name");
+    const char *name = lua_tostring(lua, -1);
+    lua_pop(lua, 1);
+    if(!name)
+        luaL_error(lua, MSG("execute() option 'name' is required"));
+
+    query_item_t *item = (query_item_t *)calloc(1, sizeof(query_item_t));
+    item->type = QUERY_EXECUTE;
+    item->query = strdup(name);
+    pg_item_params(item, lua, 2);
+    item->callback = pg_item_callback(lua, 2);
+
+    lua_pushboolean(lua, pg_queue(mod, item));
+    pg_process(mod);
+
+    return 1;
+}
+
+static int method_insert(module_data_t *mod)
+{
+    luaL_checktype(lua, 2, LUA_TTABLE);
+
+    lua_getfield(lua, 2, "table");
+    const char *table = lua_tostring(lua, -1);
+    if(!table)
+        luaL_error(lua, MSG("insert() option 'table' is required"));
+
+    lua_getfield(lua, 2, "row");
+    luaL_checktype(lua, -1, LUA_TTABLE);
+    const int row = lua_gettop(lua);
 
+    /* batches are keyed by the COPY command */
+    lua_pushfstring(lua, "COPY %s", table);
+    int command = 1;
+
+    lua_getfield(lua, 2, "columns");
     if(lua_istable(lua, -1))
     {
-        lua_getfield(lua, -1, "query");
-        if(lua_isstring(lua, -1))
-            query_item->query = (char*)lua_tostring(lua, -1);
+        const int columns = lua_gettop(lua);
+        const int columns_count = lua_rawlen(lua, columns);
+        for(int i = 0; i < columns_count; ++i)
+        {
+            lua_pushstring(lua, (i == 0) ? " (" : ",");
+            lua_rawgeti(lua, columns, i + 1);
+            if(!lua_isstring(lua, -1))
+                luaL_error(lua, MSG("insert() option 'columns' should contain strings"));
+            command += 2;
+        }
+        if(columns_count > 0)
+        {
+            lua_pushstring(lua, ")");
+            ++command;
+        }
+        lua_remove(lua, columns);
+    }
+    else
         lua_pop(lua, 1);
 
-        lua_getfield(lua, -1, "callback");
-        if(lua_isfunction(lua, -1))
-            query_item->callback = luaL_ref(lua, LUA_REGISTRYINDEX);
-        else
-            asc_log_error("option 'callback' is required");
+    lua_pushstring(lua, " FROM STDIN");
+    lua_concat(lua, command + 1);
+    copy_batch_t *batch = pg_batch_get(mod, lua_tostring(lua, -1));
+    lua_pop(lua, 1);
+
+    if(!batch->rows_count && mod->queue_count >= mod->queue_size)
+    {
+        ++mod->dropped;
+        lua_pop(lua, 2);
+        lua_pushboolean(lua, false);
+        return 1;
+    }
+
+    if(!batch->rows)
+        batch->rows = string_buffer_alloc();
+
+    const int values = lua_rawlen(lua, row);
+    for(int i = 0; i < values; ++i)
+    {
+        if(i > 0)
+            string_buffer_addchar(batch->rows, '\t');
+        lua_rawgeti(lua, row, i + 1);
+        pg_copy_value(batch->rows, lua, -1);
         lua_pop(lua, 1);
     }
+    string_buffer_addchar(batch->rows, '\n');
+    ++batch->rows_count;
+
+    lua_pop(lua, 2);
 
-    if(query_item->query && query_item->callback)
+    bool ret = true;
+    if(batch->rows_count >= mod->batch_size)
     {
-        asc_list_insert_tail(mod->query, query_item);
-        if(mod->is_connected == 1)
-            process_query(mod);
+        ret = pg_batch_queue(mod, batch);
+        pg_process(mod);
     }
-    else
-        free(query_item);
 
-    return 0;
+    lua_pushboolean(lua, ret);
+    return 1;
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->queue_count);
+    lua_setfield(lua, -2, "queue");
+    lua_pushnumber(lua, mod->sent_count);
+    lua_setfield(lua, -2, "pipeline");
+    lua_pushnumber(lua, (lua_Number)mod->sent_total);
+    lua_setfield(lua, -2, "sent");
+    lua_pushnumber(lua, (lua_Number)mod->dropped);
+    lua_setfield(lua, -2, "dropped");
+    lua_pushnumber(lua, (lua_Number)mod->rows);
+    lua_setfield(lua, -2, "rows");
+
+    return 1;
 }
 
 static void module_init(module_data_t *mod)
@@ -223,47 +978,70 @@ static void module_init(module_data_t *mod)
     module_option_string("connect_string", &mod->connect_string, NULL);
     asc_assert(mod->connect_string, MSG("option 'connect_string' is required"));
 
+    mod->queue_size = 4096;
+    module_option_number("queue_size", &mod->queue_size);
+    mod->pipeline = 64;
+    module_option_number("pipeline", &mod->pipeline);
+    mod->batch_size = 1000;
+    module_option_number("batch_size", &mod->batch_size);
+
+    asc_assert(mod->queue_size > 0, MSG("option 'queue_size' must be positive"));
+    asc_assert(mod->pipeline > 0, MSG("option 'pipeline' must be positive"));
+    asc_assert(mod->batch_size > 0, MSG("option 'batch_size' must be positive"));
+
+    TAILQ_INIT(&mod->queue);
+    TAILQ_INIT(&mod->sent);
+    TAILQ_INIT(&mod->statements);
+    TAILQ_INIT(&mod->batches);
+
     pg_connect(mod);
 
-    mod->query = asc_list_init();
-    mod->query_timer = asc_timer_init(50, on_query_timer, mod);
+    mod->query_timer = asc_timer_init(PG_TIMER_INTERVAL, on_query_timer, mod);
 }
 
 static void module_destroy(module_data_t *mod)
 {
-    if(mod->conn)
-        PQfinish(mod->conn);
+    ASC_FREE(mod->query_timer, asc_timer_destroy);
+    ASC_FREE(mod->event, asc_event_close);
+    ASC_FREE(mod->conn, PQfinish);
 
-    if(mod->query_timer)
+    query_item_t *item, *item_next;
+    TAILQ_FOREACH_SAFE(item, &mod->sent, entries, item_next)
     {
-        asc_timer_destroy(mod->query_timer);
-        mod->query_timer = NULL;
+        TAILQ_REMOVE(&mod->sent, item, entries);
+        pg_item_free(item);
     }
-
-    if(mod->query)
+    TAILQ_FOREACH_SAFE(item, &mod->queue, entries, item_next)
     {
-        asc_list_for(mod->query)
-        {
-            query_item_t *query_item = asc_list_data(mod->query);
-            luaL_unref(lua, LUA_REGISTRYINDEX, query_item->callback);
-            free(query_item);
-            asc_list_remove_current(mod->query);
-        }
+        TAILQ_REMOVE(&mod->queue, item, entries);
+        pg_item_free(item);
+    }
 
-        asc_list_destroy(mod->query);
-        mod->query = NULL;
+    statement_t *statement, *statement_next;
+    TAILQ_FOREACH_SAFE(statement, &mod->statements, entries, statement_next)
+    {
+        TAILQ_REMOVE(&mod->statements, statement, entries);
+        free(statement->name);
+        free(statement->query);
+        free(statement);
     }
 
-    if(mod->current_task)
+    copy_batch_t *batch, *batch_next;
+    TAILQ_FOREACH_SAFE(batch, &mod->batches, entries, batch_next)
     {
-        luaL_unref(lua, LUA_REGISTRYINDEX, mod->current_task->callback);
-        free(mod->current_task);
-        mod->current_task = NULL;
+        TAILQ_REMOVE(&mod->batches, batch, entries);
+        ASC_FREE(batch->rows, string_buffer_free);
+        free(batch->command);
+        free(batch);
     }
 }
 
 MODULE_LUA_METHODS()
 {
     { "query", method_query },
+    { "prepare", method_prepare },
+    { "execute", method_execute },
+    { "insert", method_insert },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(postgres)
@@ -0,0 +1,502 @@
+/*
+ * Astra Module: RIST Input
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      rist_input
+ *
+ * Module Options:
+ *      addr        - string, source IP address
+ *      port        - number, source RTP port, RTCP is the next port. default: 1968
+ *      localaddr   - string, IP address of the local interface
+ *      socket_size - number, socket buffer size
+ *      latency     - number, delay of the stream in milliseconds, time to receive
+ *                            the lost datagrams. default: 1000
+ *      rtt         - number, interval between the NACK of the same datagram
+ *                            in milliseconds. default: 50
+ *      buffer      - number, count of the datagrams in the reorder buffer.
+ *                            default: 4096
+ *
+ * Module Methods:
+ *      stat()      - return table, counters of the received, recovered and
+ *                    lost datagrams
+ *
+ * Datagrams are released in the RTP sequence order after the latency.
+ * Missing datagrams are requested from the sender with the Generic NACK
+ * until the release time. Works with any RTP sender, the retransmission
+ * is requested only if RTCP is received from the sender.
+ */
+
+#include "rist.h"
+
+#define MSG(_msg) "[rist_input %s:%d] " _msg, mod->addr, mod->port
+
+#define RIST_TICK_INTERVAL 5 // ms
+#define RIST_NACK_MAX 64 // items in one RTCP packet
+#define RIST_STAT_INTERVAL (10 * 1000000ULL)
+
+typedef struct
+{
+    uint64_t time; // arrival, or the gap detection for the missing datagram
+    uint64_t nack_time; // next request
+    bool is_present;
+
+    size_t size;
+    uint8_t payload[RIST_PAYLOAD_SIZE];
+} rist_slot_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *addr;
+    int port;
+
+    uint64_t latency;
+    uint64_t rtt;
+
+    asc_socket_t *sock; // RTP
+    asc_socket_t *rtcp;
+    bool is_rtcp_peer; // sender address is known from its RTCP
+    asc_timer_t *timer_tick;
+    uint64_t report_time;
+
+    uint32_t ssrc;
+    uint32_t sender_ssrc;
+    char cname[32];
+
+    // reorder buffer, indexed by the RTP sequence number
+    rist_slot_t *ring;
+    uint32_t ring_size;
+    uint32_t ring_mask;
+
+    bool is_started;
+    uint16_t head; // next datagram to release
+    uint16_t tail; // next expected datagram
+    uint32_t missing;
+
+    uint64_t received;
+    uint64_t recovered;
+    uint64_t lost;
+    uint64_t dropped; // duplicates and late datagrams
+
+    uint64_t stat_time;
+    uint64_t stat_lost;
+    uint64_t stat_recovered;
+
+    bool is_error_message;
+};
+
+static inline rist_slot_t * ring_slot(module_data_t *mod, uint16_t seq)
+{
+    return &mod->ring[seq & mod->ring_mask];
+}
+
+/* releases the head datagram: to the stream or as lost */
+static void release_head(module_data_t *mod)
+{
+    rist_slot_t *slot = ring_slot(mod, mod->head);
+
+    if(slot->is_present)
+    {
+        slot->is_present = false;
+        if(slot->size > 0)
+            module_stream_send_batch(mod, slot->payload, slot->size / TS_PACKET_SIZE);
+    }
+    else
+    {
+        ++mod->lost;
+        --mod->missing;
+    }
+
+    ++mod->head;
+}
+
+static void release(module_data_t *mod, uint64_t now)
+{
+    while(mod->head != mod->tail)
+    {
+        const rist_slot_t *slot = ring_slot(mod, mod->head);
+        if(now < slot->time + mod->latency)
+            break;
+        release_head(mod);
+    }
+}
+
+static void on_datagram(module_data_t *mod, const uint8_t *buffer, size_t len)
+{
+    if(len < RTP_HEADER_SIZE || (buffer[0] >> 6) != 2)
+        return;
+
+    size_t skip = RTP_HEADER_SIZE + (buffer[0] & 0x0F) * 4;
+    if(RTP_IS_EXT(buffer))
+    {
+        if(len < skip + 4)
+            return;
+        skip += ((buffer[skip + 2] << 8) | buffer[skip + 3]) * 4 + 4;
+    }
+    if(skip > len)
+        return;
+
+    size_t size = len - skip;
+    if(size % TS_PACKET_SIZE)
+    {
+        if(!mod->is_error_message)
+        {
+            asc_log_error(MSG("wrong stream format. drop %zu bytes")
+                          , size % TS_PACKET_SIZE);
+            mod->is_error_message = true;
+        }
+        size -= size % TS_PACKET_SIZE;
+    }
+    if(size > RIST_PAYLOAD_SIZE)
+        size = RIST_PAYLOAD_SIZE;
+
+    const uint16_t seq = rist_get_u16(&buffer[2]);
+    const uint64_t now = asc_utime();
+
+    if(!mod->is_started)
+    {
+        mod->is_started = true;
+        mod->head = seq;
+        mod->tail = seq;
+    }
+
+    const int16_t ahead = (int16_t)(seq - mod->tail);
+    if(ahead >= 0)
+    {
+        // window is full, oldest datagrams are released before the latency
+        while((uint16_t)(seq - mod->head) >= mod->ring_size)
+            release_head(mod);
+
+        if(mod->head == mod->tail)
+        {
+            // nothing to wait for after the long gap
+            mod->head = seq;
+            mod->tail = seq;
+        }
+
+        // datagrams between the tail and the received one are missing
+        for(; mod->tail != seq; ++mod->tail)
+        {
+            rist_slot_t *slot = ring_slot(mod, mod->tail);
+            slot->is_present = false;
+            slot->time = now;
+            slot->nack_time = now;
+            ++mod->missing;
+        }
+        ++mod->tail;
+    }
+    else
+    {
+        rist_slot_t *slot = ring_slot(mod, seq);
+        if((int16_t)(seq - mod->head) < 0 || slot->is_present)
+        {
+            ++mod->dropped;
+            return;
+        }
+
+        ++mod->recovered;
+        --mod->missing;
+    }
+
+    rist_slot_t *slot = ring_slot(mod, seq);
+    if(ahead >= 0)
+        slot->time = now;
+    slot->is_present = true;
+    slot->size = size;
+    memcpy(slot->payload, &buffer[skip], size);
+    ++mod->received;
+
+    release(mod, now);
+}
+
+static void on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    uint8_t buffer[RTCP_BUFFER_SIZE + RTP_HEADER_SIZE];
+    while(1)
+    {
+        const ssize_t len = asc_socket_recv(mod->sock, buffer, sizeof(buffer));
+        if(len <= 0)
+            return;
+        on_datagram(mod, buffer, len);
+    }
+}
+
+/*
+ *   oooooooo8 ooooooooooo  oooooooo8 ooooooooooo
+ * o888     88 88  888  88 o888     88 88  888  88
+ * 888             888     888             888
+ * 888o     oo     888     888o     oo     888
+ *  888oooo88     o888o     888oooo88     o888o
+ *
+ */
+
+static void on_rtcp_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    uint8_t buffer[RTCP_BUFFER_SIZE];
+    const ssize_t len = asc_socket_recvfrom(mod->rtcp, buffer, sizeof(buffer));
+    if(len < RTCP_HEADER_SIZE + 4 || (buffer[0] >> 6) != 2)
+        return;
+
+    // sender address is stored by recvfrom(), NACK goes there
+    if(buffer[1] == RTCP_PT_SR)
+    {
+        mod->sender_ssrc = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+        mod->is_rtcp_peer = true;
+    }
+}
+
+static void rtcp_send(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    if(asc_socket_sendto(mod->rtcp, buffer, size) == -1)
+        asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+}
+
+/* RR and SDES, keeps the return path open */
+static void send_report(module_data_t *mod)
+{
+    uint8_t buffer[RTCP_BUFFER_SIZE];
+
+    size_t size = rist_rtcp_begin(buffer, 0, RTCP_PT_RR, mod->ssrc);
+    rist_rtcp_end(buffer, size);
+    size += rist_rtcp_sdes(&buffer[size], mod->ssrc, mod->cname);
+
+    rtcp_send(mod, buffer, size);
+}
+
+static void send_nack(module_data_t *mod, uint64_t now)
+{
+    uint8_t buffer[RTCP_BUFFER_SIZE];
+    size_t size = 0;
+    int count = 0;
+
+    uint16_t pid = 0;
+    uint16_t blp = 0;
+    bool is_pid = false;
+
+    for(uint16_t seq = mod->head; seq != mod->tail; ++seq)
+    {
+        rist_slot_t *slot = ring_slot(mod, seq);
+        if(slot->is_present || now < slot->nack_time)
+            continue;
+
+        // no time to receive the answer
+        if(slot->time + mod->latency < now + mod->rtt / 2)
+            continue;
+
+        slot->nack_time = now + mod->rtt;
+
+        if(is_pid && (uint16_t)(seq - pid) <= 16)
+        {
+            blp |= 1 << ((uint16_t)(seq - pid) - 1);
+            continue;
+        }
+
+        if(is_pid)
+        {
+            if(size == 0)
+            {
+                size = rist_rtcp_begin(buffer, RTCP_FMT_NACK, RTCP_PT_RTPFB, mod->ssrc);
+                rist_put_u32(&buffer[size], mod->sender_ssrc);
+                size += 4;
+            }
+            rist_put_u16(&buffer[size + 0], pid);
+            rist_put_u16(&buffer[size + 2], blp);
+            size += 4;
+            ++count;
+
+            if(count == RIST_NACK_MAX)
+            {
+                rist_rtcp_end(buffer, size);
+                rtcp_send(mod, buffer, size);
+                size = 0;
+                count = 0;
+            }
+        }
+
+        pid = seq;
+        blp = 0;
+        is_pid = true;
+    }
+
+    if(is_pid)
+    {
+        if(size == 0)
+        {
+            size = rist_rtcp_begin(buffer, RTCP_FMT_NACK, RTCP_PT_RTPFB, mod->ssrc);
+            rist_put_u32(&buffer[size], mod->sender_ssrc);
+            size += 4;
+        }
+        rist_put_u16(&buffer[size + 0], pid);
+        rist_put_u16(&buffer[size + 2], blp);
+        size += 4;
+    }
+
+    if(size > 0)
+    {
+        rist_rtcp_end(buffer, size);
+        rtcp_send(mod, buffer, size);
+    }
+}
+
+static void on_timer_tick(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+
+    if(mod->is_started)
+        release(mod, now);
+
+    if(mod->is_rtcp_peer)
+    {
+        if(mod->missing > 0)
+            send_nack(mod, now);
+
+        if(now >= mod->report_time)
+        {
+            mod->report_time = now + RIST_REPORT_INTERVAL * 1000;
+            send_report(mod);
+        }
+    }
+
+    if(now >= mod->stat_time)
+    {
+        mod->stat_time = now + RIST_STAT_INTERVAL;
+        if(mod->lost != mod->stat_lost || mod->recovered != mod->stat_recovered)
+        {
+            asc_log_warning(MSG("recovered:%llu lost:%llu")
+                            , (unsigned long long)(mod->recovered - mod->stat_recovered)
+                            , (unsigned long long)(mod->lost - mod->stat_lost));
+            mod->stat_lost = mod->lost;
+            mod->stat_recovered = mod->recovered;
+        }
+    }
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->received);
+    lua_setfield(lua, -2, "received");
+    lua_pushnumber(lua, (lua_Number)mod->recovered);
+    lua_setfield(lua, -2, "recovered");
+    lua_pushnumber(lua, (lua_Number)mod->lost);
+    lua_setfield(lua, -2, "lost");
+    lua_pushnumber(lua, (lua_Number)mod->dropped);
+    lua_setfield(lua, -2, "dropped");
+    return 1;
+}
+
+static asc_socket_t * socket_open(module_data_t *mod, int port)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+#ifdef _WIN32
+    if(!asc_socket_bind(sock, NULL, port))
+#else
+    if(!asc_socket_bind(sock, mod->addr, port))
+#endif
+        astra_abort();
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(sock, value, 0);
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    asc_socket_multicast_join(sock, mod->addr, localaddr);
+
+    return sock;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    module_option_string("addr", &mod->addr, NULL);
+    asc_assert(mod->addr != NULL, "[rist_input] option 'addr' is required");
+
+    mod->port = 1968;
+    module_option_number("port", &mod->port);
+    asc_assert((mod->port % 2) == 0, MSG("option 'port' should be even"));
+
+    int value = 1000;
+    module_option_number("latency", &value);
+    mod->latency = (uint64_t)((value > 0) ? value : 0) * 1000;
+
+    value = 50;
+    module_option_number("rtt", &value);
+    mod->rtt = (uint64_t)((value > 0) ? value : 1) * 1000;
+
+    value = RIST_RING_SIZE;
+    module_option_number("buffer", &value);
+    if(value > RIST_RING_MAX)
+        value = RIST_RING_MAX;
+    mod->ring_size = 64;
+    while(mod->ring_size < (uint32_t)value)
+        mod->ring_size *= 2;
+    mod->ring_mask = mod->ring_size - 1;
+    mod->ring = (rist_slot_t *)calloc(mod->ring_size, sizeof(rist_slot_t));
+
+    mod->ssrc = (uint32_t)rand() & ~0x01;
+    snprintf(mod->cname, sizeof(mod->cname), "astra-%08x", mod->ssrc);
+
+    mod->sock = socket_open(mod, mod->port);
+    asc_socket_set_on_read(mod->sock, on_read);
+
+    mod->rtcp = socket_open(mod, mod->port + 1);
+    asc_socket_set_on_read(mod->rtcp, on_rtcp_read);
+
+    mod->stat_time = asc_utime() + RIST_STAT_INTERVAL;
+    mod->timer_tick = asc_timer_init(RIST_TICK_INTERVAL, on_timer_tick, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->timer_tick, asc_timer_destroy);
+
+    if(mod->sock)
+    {
+        asc_socket_multicast_leave(mod->sock);
+        ASC_FREE(mod->sock, asc_socket_close);
+    }
+    if(mod->rtcp)
+    {
+        asc_socket_multicast_leave(mod->rtcp);
+        ASC_FREE(mod->rtcp, asc_socket_close);
+    }
+
+    ASC_FREE(mod->ring, free);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(rist_input)
@@ -0,0 +1,2 @@
+SOURCES="input.c output.c"
+MODULES="rist_input rist_output"
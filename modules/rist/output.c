@@ -0,0 +1,340 @@
+/*
+ * Astra Module: RIST Output
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      rist_output
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      addr        - string, destination IP address
+ *      port        - number, destination RTP port, RTCP is the next port. default: 1968
+ *      ttl         - number, time to live
+ *      localaddr   - string, IP address of the local interface
+ *      socket_size - number, socket buffer size
+ *      buffer      - number, count of the datagrams kept for the retransmission.
+ *                            default: 4096
+ *
+ * Module Methods:
+ *      stat()      - return table, counters of the sent and retransmitted datagrams
+ */
+
+#include "rist.h"
+
+#define MSG(_msg) "[rist_output %s:%d] " _msg, mod->addr, mod->port
+
+/* same datagram is not sent again if requested by several receivers */
+#define RETRANSMIT_HOLD 10000
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *addr;
+    int port;
+
+    asc_socket_t *sock; // RTP
+    asc_socket_t *rtcp; // reports, NACK from the receivers
+    asc_timer_t *timer_report;
+
+    uint32_t ssrc;
+    uint16_t seq;
+    char cname[32];
+
+    uint8_t packet[RIST_DATAGRAM_SIZE];
+    size_t packet_skip;
+
+    // retransmission ring, indexed by the RTP sequence number
+    uint8_t *ring;
+    uint64_t *ring_time; // last retransmission time
+    uint32_t ring_size;
+    uint32_t ring_mask;
+
+    uint64_t sent;
+    uint64_t retransmitted;
+    uint64_t expired; // requested datagrams not found in the ring
+};
+
+static void datagram_send(module_data_t *mod)
+{
+    uint8_t *packet = mod->packet;
+    rist_put_u16(&packet[2], mod->seq);
+    rist_put_u32(&packet[4], rist_rtp_time());
+
+    const uint32_t slot = mod->seq & mod->ring_mask;
+    memcpy(&mod->ring[slot * RIST_DATAGRAM_SIZE], packet, RIST_DATAGRAM_SIZE);
+    mod->ring_time[slot] = 0;
+
+    ++mod->seq;
+    ++mod->sent;
+
+    if(asc_socket_sendto(mod->sock, packet, RIST_DATAGRAM_SIZE) == -1)
+        asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    memcpy(&mod->packet[mod->packet_skip], ts, TS_PACKET_SIZE);
+    mod->packet_skip += TS_PACKET_SIZE;
+
+    if(mod->packet_skip == RIST_DATAGRAM_SIZE)
+    {
+        datagram_send(mod);
+        mod->packet_skip = RTP_HEADER_SIZE;
+    }
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    while(count > 0)
+    {
+        size_t block = (RIST_DATAGRAM_SIZE - mod->packet_skip) / TS_PACKET_SIZE;
+        if(block > count)
+            block = count;
+
+        const size_t block_size = block * TS_PACKET_SIZE;
+        memcpy(&mod->packet[mod->packet_skip], ts, block_size);
+        mod->packet_skip += block_size;
+        ts += block_size;
+        count -= block;
+
+        if(mod->packet_skip == RIST_DATAGRAM_SIZE)
+        {
+            datagram_send(mod);
+            mod->packet_skip = RTP_HEADER_SIZE;
+        }
+    }
+}
+
+/*
+ * oooooooooo  ooooooooooo  ooooooo  ooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
+ *  888    888  888    88 o888   888o 888    88   888    88  888        88  888  88
+ *  888oooo88   888ooo8   888     888 888    88   888ooo8     888oooooo     888
+ *  888  88o    888    oo 888o  8o888 888    88   888    oo          888    888
+ * o888o  88o8 o888ooo8888  88ooo88    888oo88   o888ooo8888 o88oooo888    o888o
+ *                               88o8
+ */
+
+static void retransmit(module_data_t *mod, uint16_t seq)
+{
+    // datagram is sent and still in the ring
+    const uint16_t age = (uint16_t)(mod->seq - seq);
+    if(age == 0 || age > mod->ring_size || age > mod->sent)
+    {
+        ++mod->expired;
+        return;
+    }
+
+    const uint32_t slot = seq & mod->ring_mask;
+    const uint64_t now = asc_utime();
+    if(mod->ring_time[slot] && now - mod->ring_time[slot] < RETRANSMIT_HOLD)
+        return;
+    mod->ring_time[slot] = now;
+
+    uint8_t *packet = &mod->ring[slot * RIST_DATAGRAM_SIZE];
+    packet[11] |= 0x01; // retransmission flag
+    if(asc_socket_sendto(mod->sock, packet, RIST_DATAGRAM_SIZE) == -1)
+        asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+    packet[11] &= ~0x01;
+
+    ++mod->retransmitted;
+}
+
+static void on_rtcp_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    uint8_t buffer[RTCP_BUFFER_SIZE];
+    const ssize_t len = asc_socket_recvfrom(mod->rtcp, buffer, sizeof(buffer));
+    if(len <= 0)
+        return;
+
+    size_t skip = 0;
+    while(skip + RTCP_HEADER_SIZE + 4 <= (size_t)len)
+    {
+        const uint8_t *rtcp = &buffer[skip];
+        if((rtcp[0] >> 6) != 2)
+            break;
+
+        const size_t size = (rist_get_u16(&rtcp[2]) + 1) * 4;
+        if(skip + size > (size_t)len)
+            break;
+
+        const uint8_t fmt = rtcp[0] & 0x1F;
+        const uint8_t pt = rtcp[1];
+
+        if(pt == RTCP_PT_RTPFB && fmt == RTCP_FMT_NACK)
+        {
+            // header, sender SSRC, media SSRC, then PID + BLP items
+            for(size_t i = 12; i + 4 <= size; i += 4)
+            {
+                const uint16_t pid = rist_get_u16(&rtcp[i]);
+                const uint16_t blp = rist_get_u16(&rtcp[i + 2]);
+
+                retransmit(mod, pid);
+                for(int bit = 0; bit < 16; ++bit)
+                {
+                    if(blp & (1 << bit))
+                        retransmit(mod, pid + bit + 1);
+                }
+            }
+        }
+        else if(pt == RTCP_PT_APP && size >= 12 && !memcmp(&rtcp[8], "RIST", 4))
+        {
+            // range NACK: first sequence + count of the next datagrams
+            for(size_t i = 12; i + 4 <= size; i += 4)
+            {
+                const uint16_t first = rist_get_u16(&rtcp[i]);
+                const uint16_t extra = rist_get_u16(&rtcp[i + 2]);
+                for(uint32_t n = 0; n <= extra; ++n)
+                    retransmit(mod, first + n);
+            }
+        }
+
+        skip += size;
+    }
+}
+
+static void on_timer_report(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    uint8_t buffer[RTCP_BUFFER_SIZE];
+
+    // SR without report blocks
+    size_t size = rist_rtcp_begin(buffer, 0, RTCP_PT_SR, mod->ssrc);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    const uint64_t ntp_frac = ((uint64_t)tv.tv_usec << 32) / 1000000;
+    rist_put_u32(&buffer[size + 0], (uint32_t)(tv.tv_sec + 2208988800UL));
+    rist_put_u32(&buffer[size + 4], (uint32_t)ntp_frac);
+    rist_put_u32(&buffer[size + 8], rist_rtp_time());
+    rist_put_u32(&buffer[size + 12], (uint32_t)mod->sent);
+    rist_put_u32(&buffer[size + 16], (uint32_t)(mod->sent * RIST_PAYLOAD_SIZE));
+    size += 20;
+    rist_rtcp_end(buffer, size);
+
+    size += rist_rtcp_sdes(&buffer[size], mod->ssrc, mod->cname);
+
+    // recvfrom() changes the destination, reports go to the receiver port
+    asc_socket_set_sockaddr(mod->rtcp, mod->addr, mod->port + 1);
+    if(asc_socket_sendto(mod->rtcp, buffer, size) == -1)
+        asc_log_warning(MSG("error on report [%s]"), asc_socket_error());
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->sent);
+    lua_setfield(lua, -2, "sent");
+    lua_pushnumber(lua, (lua_Number)mod->retransmitted);
+    lua_setfield(lua, -2, "retransmitted");
+    lua_pushnumber(lua, (lua_Number)mod->expired);
+    lua_setfield(lua, -2, "expired");
+    return 1;
+}
+
+static asc_socket_t * socket_open(module_data_t *mod, int port)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+    if(!asc_socket_bind(sock, NULL, 0))
+        astra_abort();
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(sock, 0, value);
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    if(localaddr)
+        asc_socket_set_multicast_if(sock, localaddr);
+
+    value = 32;
+    module_option_number("ttl", &value);
+    asc_socket_set_multicast_ttl(sock, value);
+
+    asc_socket_multicast_join(sock, mod->addr, NULL);
+    asc_socket_set_sockaddr(sock, mod->addr, port);
+
+    return sock;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("addr", &mod->addr, NULL);
+    asc_assert(mod->addr != NULL, "[rist_output] option 'addr' is required");
+
+    mod->port = 1968;
+    module_option_number("port", &mod->port);
+    asc_assert((mod->port % 2) == 0, MSG("option 'port' should be even"));
+
+    int buffer = RIST_RING_SIZE;
+    module_option_number("buffer", &buffer);
+    if(buffer > RIST_RING_MAX)
+        buffer = RIST_RING_MAX;
+    mod->ring_size = 64;
+    while(mod->ring_size < (uint32_t)buffer)
+        mod->ring_size *= 2;
+    mod->ring_mask = mod->ring_size - 1;
+    mod->ring = (uint8_t *)malloc(mod->ring_size * RIST_DATAGRAM_SIZE);
+    mod->ring_time = (uint64_t *)calloc(mod->ring_size, sizeof(uint64_t));
+
+    // the lowest bit is the retransmission flag
+    mod->ssrc = (uint32_t)rand() & ~0x01;
+    mod->seq = (uint16_t)rand();
+    snprintf(mod->cname, sizeof(mod->cname), "astra-%08x", mod->ssrc);
+
+    mod->packet[0] = 0x80; // RTP version
+    mod->packet[1] = RTP_PT_MP2T;
+    rist_put_u32(&mod->packet[8], mod->ssrc);
+    mod->packet_skip = RTP_HEADER_SIZE;
+
+    mod->sock = socket_open(mod, mod->port);
+
+    mod->rtcp = socket_open(mod, mod->port + 1);
+    asc_socket_set_on_read(mod->rtcp, on_rtcp_read);
+
+    mod->timer_report = asc_timer_init(RIST_REPORT_INTERVAL, on_timer_report, mod);
+
+    module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    ASC_FREE(mod->timer_report, asc_timer_destroy);
+    ASC_FREE(mod->rtcp, asc_socket_close);
+    ASC_FREE(mod->sock, asc_socket_close);
+
+    ASC_FREE(mod->ring, free);
+    ASC_FREE(mod->ring_time, free);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(rist_output)
@@ -0,0 +1,112 @@
+/*
+ * Astra Module: RIST
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RIST_H_
+#define _RIST_H_ 1
+
+#include <astra.h>
+
+/*
+ * RTP with NACK based retransmission, the RIST simple profile layout:
+ * RTP is sent to the even port, RTCP is sent to the next port.
+ * The sender keeps the last datagrams in the ring and sends again the
+ * datagrams requested with the RTCP Generic NACK (RFC 4585) or with the
+ * RIST range NACK. Retransmitted datagram has the lowest bit of the SSRC.
+ */
+
+#define RTP_HEADER_SIZE 12
+#define RTP_PT_MP2T 33
+
+#define RTP_IS_EXT(_data) ((_data[0] & 0x10))
+#define RTP_EXT_SIZE(_data) \
+    (((_data[RTP_HEADER_SIZE + 2] << 8) | _data[RTP_HEADER_SIZE + 3]) * 4 + 4)
+
+#define RIST_PAYLOAD_COUNT 7
+#define RIST_PAYLOAD_SIZE (RIST_PAYLOAD_COUNT * TS_PACKET_SIZE)
+#define RIST_DATAGRAM_SIZE (RTP_HEADER_SIZE + RIST_PAYLOAD_SIZE)
+
+#define RTCP_PT_SR 200
+#define RTCP_PT_RR 201
+#define RTCP_PT_SDES 202
+#define RTCP_PT_APP 204
+#define RTCP_PT_RTPFB 205
+#define RTCP_FMT_NACK 1
+
+#define RTCP_HEADER_SIZE 4
+#define RTCP_BUFFER_SIZE 1460
+
+#define RIST_REPORT_INTERVAL 100 // ms, RTCP reports from both sides
+#define RIST_RING_SIZE 4096 // datagrams, default
+#define RIST_RING_MAX 32768 // a half of the RTP sequence space
+
+static inline uint16_t rist_get_u16(const uint8_t *buffer)
+{
+    return (buffer[0] << 8) | buffer[1];
+}
+
+static inline void rist_put_u16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (value >> 8) & 0xFF;
+    buffer[1] = (value     ) & 0xFF;
+}
+
+static inline void rist_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >>  8) & 0xFF;
+    buffer[3] = (value      ) & 0xFF;
+}
+
+/* RTP timestamp, 90kHz */
+static inline uint32_t rist_rtp_time(void)
+{
+    return (uint32_t)(asc_utime() * 9 / 100);
+}
+
+/* appends RTCP header. length is set by rist_rtcp_end() */
+static inline size_t rist_rtcp_begin(uint8_t *buffer, uint8_t count, uint8_t pt, uint32_t ssrc)
+{
+    buffer[0] = 0x80 | (count & 0x1F);
+    buffer[1] = pt;
+    rist_put_u32(&buffer[4], ssrc);
+    return RTCP_HEADER_SIZE + 4;
+}
+
+static inline void rist_rtcp_end(uint8_t *buffer, size_t size)
+{
+    rist_put_u16(&buffer[2], (uint16_t)(size / 4 - 1));
+}
+
+/* SDES with CNAME item, padded to 32 bits */
+static inline size_t rist_rtcp_sdes(uint8_t *buffer, uint32_t ssrc, const char *cname)
+{
+    size_t size = rist_rtcp_begin(buffer, 1, RTCP_PT_SDES, ssrc);
+    const size_t cname_size = strlen(cname);
+    buffer[size++] = 1; // CNAME
+    buffer[size++] = (uint8_t)cname_size;
+    memcpy(&buffer[size], cname, cname_size);
+    size += cname_size;
+    do { buffer[size++] = 0; } while(size % 4);
+    rist_rtcp_end(buffer, size);
+    return size;
+}
+
+#endif /* _RIST_H_ */
@@ -0,0 +1,291 @@
+/*
+ * Astra Module: Shared Memory Input
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      shm_input
+ *
+ * Module Options:
+ *      name        - string, stream name of the shm_output, the object is
+ *                    /dev/shm/astra-<name>. the input waits for the object
+ *                    and opens it again if the writer creates the new one
+ *      thread_cpus, thread_numa, thread_priority
+ *                  - reading thread placement, see module_option_thread()
+ *
+ * Module Methods:
+ *      stat()      - return table, counters of the received and the skipped blocks
+ */
+
+#include "shm.h"
+
+#define MSG(_msg) "[shm_input %s] " _msg, mod->name
+
+#define SHM_CHECK_INTERVAL 1000 // ms, the object is opened or replaced
+#define SHM_WAIT_TIMEOUT 100 // ms, the thread checks the stop flag
+#define SHM_INPUT_BUFFER (1024 * SHM_BLOCK_COUNT * TS_PACKET_SIZE)
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    char path[SHM_NAME_SIZE];
+
+    shm_header_t *header;
+    size_t size;
+    ino_t ino;
+
+    asc_timer_t *timer_check;
+
+    // thread options, the thread is started on attach
+    const char *thread_cpus;
+    int thread_numa;
+    int thread_priority;
+
+    bool is_thread_started;
+    asc_thread_t *thread;
+    asc_thread_buffer_t *thread_output;
+
+    // written by the thread
+    uint64_t received;
+    uint64_t skipped; // blocks overwritten by the writer before the read
+    uint64_t overflow; // blocks not passed to the main thread
+};
+
+/*
+ * ooooooooooo ooooo ooooo oooooooooo  ooooooooooo      o      ooooooooo
+ * 88  888  88  888   888   888    888  888    88      888      888    88o
+ *     888      888ooo888   888oooo88   888ooo8       8  88     888    888
+ *     888      888   888   888  88o    888    oo    8oooo88    888    888
+ *    o888o    o888o o888o o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    shm_header_t *const header = mod->header;
+    const uint64_t ring_size = header->ring_size;
+
+    uint8_t block[SHM_BLOCK_COUNT * TS_PACKET_SIZE];
+    uint64_t tail = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+    while(mod->is_thread_started)
+    {
+        const uint64_t head = __atomic_load_n(&header->head, __ATOMIC_SEQ_CST);
+        if(head == tail)
+        {
+            /* the writer checks waiters after the head, one of both sees the other */
+            __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+            const uint32_t futex = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+            if(__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) == tail)
+                shm_futex_wait(&header->futex, futex, SHM_WAIT_TIMEOUT);
+            __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        if(head < tail)
+        {
+            /* the writer is started again with the same object */
+            tail = head;
+            continue;
+        }
+
+        if(head - tail >= ring_size)
+        {
+            mod->skipped += head - tail;
+            tail = head;
+            continue;
+        }
+
+        const shm_block_t *const src = shm_block(header, tail);
+        uint32_t count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+        if(count > SHM_BLOCK_COUNT)
+            count = SHM_BLOCK_COUNT;
+        memcpy(block, src->ts, count * TS_PACKET_SIZE);
+
+        /* the slot is written again while the block is copied */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&header->head, __ATOMIC_RELAXED) - tail >= ring_size)
+            continue;
+
+        ++tail;
+        ++mod->received;
+
+        const ssize_t size = count * TS_PACKET_SIZE;
+        if(asc_thread_buffer_write(mod->thread_output, block, size) != size)
+            ++mod->overflow;
+    }
+}
+
+static void on_thread_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    // ring size is aligned to the packet size, packets are not wrapped
+    size_t size = TS_PACKET_SIZE;
+    const uint8_t *ptr = asc_thread_buffer_peek(mod->thread_output, &size);
+    const size_t count = size / TS_PACKET_SIZE;
+    if(count == 0)
+        return;
+
+    module_stream_send_batch(mod, ptr, count);
+    if(!asc_thread_buffer_consume(mod->thread_output, count * TS_PACKET_SIZE))
+        asc_log_debug(MSG("thread buffer flushed"));
+}
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_thread_started = false;
+    ASC_FREE(mod->thread, asc_thread_destroy);
+    ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
+}
+
+/*
+ *  oooooooo8 ooooo ooooo oooo     oooo
+ * 888         888   888   8888o   888
+ *  888oooooo  888ooo888   88 888o8 88
+ *         888 888   888   88  888  88
+ * o88oooo888 o888o o888o o88o  8  o88o
+ *
+ */
+
+static void shm_close(module_data_t *mod)
+{
+    if(mod->thread)
+        on_thread_close(mod);
+
+    if(mod->header)
+    {
+        munmap(mod->header, mod->size);
+        mod->header = NULL;
+    }
+}
+
+static void shm_check(module_data_t *mod)
+{
+    const int fd = shm_open(mod->path, O_RDWR, 0);
+    if(fd == -1)
+        return;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (mod->header && st.st_ino == mod->ino))
+    {
+        close(fd);
+        return;
+    }
+
+    shm_close(mod);
+
+    shm_header_t *header = NULL;
+    if((size_t)st.st_size > sizeof(shm_header_t))
+    {
+        header = (shm_header_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE
+                                      , MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if(!header || header == MAP_FAILED)
+        return;
+
+    if(   __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+       || header->version != SHM_VERSION
+       || header->block_size != sizeof(shm_block_t)
+       || shm_size(header->ring_size) != (size_t)st.st_size)
+    {
+        /* the writer may be initializing the object, checked again with the timer */
+        munmap(header, st.st_size);
+        return;
+    }
+
+    mod->header = header;
+    mod->size = st.st_size;
+    mod->ino = st.st_ino;
+    asc_log_debug(MSG("attached to %s, %u blocks"), mod->path, header->ring_size);
+
+    mod->thread = asc_thread_init(mod);
+    asc_thread_set_name(mod->thread, "shm_input");
+    if(mod->thread_cpus && !asc_thread_set_cpus(mod->thread, mod->thread_cpus))
+        asc_log_error(MSG("option 'thread_cpus' has wrong format"));
+    if(mod->thread_numa >= 0 && !asc_thread_set_numa_node(mod->thread, mod->thread_numa))
+        asc_log_error(MSG("NUMA node %d is not found"), mod->thread_numa);
+    if(mod->thread_priority > 0)
+        asc_thread_set_priority(mod->thread, mod->thread_priority);
+    mod->thread_output = asc_thread_buffer_init(SHM_INPUT_BUFFER);
+    mod->is_thread_started = true;
+    asc_thread_start(  mod->thread
+                     , thread_loop
+                     , on_thread_read, mod->thread_output
+                     , on_thread_close);
+}
+
+static void on_timer_check(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    shm_check(mod);
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->received);
+    lua_setfield(lua, -2, "received");
+    lua_pushnumber(lua, (lua_Number)mod->skipped);
+    lua_setfield(lua, -2, "skipped");
+    lua_pushnumber(lua, (lua_Number)mod->overflow);
+    lua_setfield(lua, -2, "overflow");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[shm_input] option 'name' is required");
+    shm_name(mod->path, mod->name);
+
+    /* see module_option_thread(), the options are applied on each attach */
+    module_option_string("thread_cpus", &mod->thread_cpus, NULL);
+    mod->thread_numa = -1;
+    module_option_number("thread_numa", &mod->thread_numa);
+    module_option_number("thread_priority", &mod->thread_priority);
+
+    module_stream_init(mod, NULL);
+
+    shm_check(mod);
+    mod->timer_check = asc_timer_init(SHM_CHECK_INTERVAL, on_timer_check, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->timer_check, asc_timer_destroy);
+    shm_close(mod);
+
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(shm_input)
@@ -0,0 +1,6 @@
+SOURCES="input.c output.c"
+MODULES="shm_input shm_output"
+
+if [ "$OS" != "linux" ] ; then
+    ERROR="Linux required"
+fi
@@ -0,0 +1,204 @@
+/*
+ * Astra Module: Shared Memory Output
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      shm_output
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, stream name, the object is /dev/shm/astra-<name>
+ *      buffer      - number, count of the blocks of 7 packets in the ring.
+ *                            default: 4096
+ *
+ * Module Methods:
+ *      stat()      - return table, count of the published blocks
+ */
+
+#include "shm.h"
+
+#define MSG(_msg) "[shm_output %s] " _msg, mod->name
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    char path[SHM_NAME_SIZE];
+
+    shm_header_t *header;
+    size_t size;
+
+    shm_block_t *block; // current block in the ring
+    uint64_t head;
+};
+
+static void block_publish(module_data_t *mod)
+{
+    ++mod->head;
+    __atomic_store_n(&mod->header->head, mod->head, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&mod->header->waiters, __ATOMIC_SEQ_CST))
+    {
+        __atomic_add_fetch(&mod->header->futex, 1, __ATOMIC_SEQ_CST);
+        shm_futex_wake(&mod->header->futex);
+    }
+
+    mod->block = shm_block(mod->header, mod->head);
+    mod->block->count = 0;
+}
+
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    while(count > 0)
+    {
+        shm_block_t *const block = mod->block;
+
+        size_t block_count = SHM_BLOCK_COUNT - block->count;
+        if(block_count > count)
+            block_count = count;
+
+        memcpy(&block->ts[block->count * TS_PACKET_SIZE], ts, block_count * TS_PACKET_SIZE);
+        block->count += block_count;
+        ts += block_count * TS_PACKET_SIZE;
+        count -= block_count;
+
+        if(block->count == SHM_BLOCK_COUNT)
+            block_publish(mod);
+    }
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    on_ts_batch(mod, ts, 1);
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->head);
+    lua_setfield(lua, -2, "blocks");
+    return 1;
+}
+
+/* the ring of the previous writer is used if it has the same size, readers keep going */
+static bool shm_reuse(module_data_t *mod, int fd, uint32_t ring_size)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size != shm_size(ring_size))
+        return false;
+
+    shm_header_t *header = (shm_header_t *)mmap(NULL, mod->size, PROT_READ | PROT_WRITE
+                                                , MAP_SHARED, fd, 0);
+    if(header == MAP_FAILED)
+        return false;
+
+    if(   header->magic != SHM_MAGIC
+       || header->version != SHM_VERSION
+       || header->ring_size != ring_size
+       || header->block_size != sizeof(shm_block_t))
+    {
+        munmap(header, mod->size);
+        return false;
+    }
+
+    mod->header = header;
+    return true;
+}
+
+static void shm_open_ring(module_data_t *mod, uint32_t ring_size)
+{
+    mod->size = shm_size(ring_size);
+
+    int fd = shm_open(mod->path, O_RDWR | O_CREAT, 0660);
+    asc_assert(fd != -1, MSG("failed to open %s [%s]"), mod->path, strerror(errno));
+
+    if(shm_reuse(mod, fd, ring_size))
+    {
+        close(fd);
+        mod->head = __atomic_load_n(&mod->header->head, __ATOMIC_ACQUIRE);
+        return;
+    }
+
+    /* readers of the previous object see the new inode and open it again */
+    close(fd);
+    shm_unlink(mod->path);
+    fd = shm_open(mod->path, O_RDWR | O_CREAT | O_EXCL, 0660);
+    asc_assert(fd != -1, MSG("failed to open %s [%s]"), mod->path, strerror(errno));
+
+    const int ret = ftruncate(fd, mod->size);
+    asc_assert(ret == 0, MSG("failed to allocate %s [%s]"), mod->path, strerror(errno));
+
+    mod->header = (shm_header_t *)mmap(NULL, mod->size, PROT_READ | PROT_WRITE
+                                       , MAP_SHARED, fd, 0);
+    asc_assert(mod->header != MAP_FAILED, MSG("failed to map %s [%s]"), mod->path, strerror(errno));
+    close(fd);
+
+    mod->header->ring_size = ring_size;
+    mod->header->block_size = sizeof(shm_block_t);
+    mod->header->version = SHM_VERSION;
+    __atomic_store_n(&mod->header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    mod->head = 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[shm_output] option 'name' is required");
+    shm_name(mod->path, mod->name);
+
+    int buffer = SHM_RING_SIZE;
+    module_option_number("buffer", &buffer);
+    if(buffer > SHM_RING_MAX)
+        buffer = SHM_RING_MAX;
+    uint32_t ring_size = 64;
+    while(ring_size < (uint32_t)buffer)
+        ring_size *= 2;
+
+    shm_open_ring(mod, ring_size);
+    mod->block = shm_block(mod->header, mod->head);
+    mod->block->count = 0;
+
+    module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    if(mod->header)
+    {
+        /* the tail of the stream */
+        if(mod->block->count > 0)
+            block_publish(mod);
+
+        munmap(mod->header, mod->size);
+        mod->header = NULL;
+    }
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(shm_output)
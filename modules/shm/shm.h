@@ -0,0 +1,104 @@
+/*
+ * Astra Module: Shared Memory
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SHM_H_
+#define _SHM_H_ 1
+
+#include <astra.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Stream between the processes on the same host. The object in /dev/shm
+ * has the header and the ring of the blocks. One writer (shm_output) puts
+ * the block into the slot and publishes it with the head counter. Any count
+ * of readers (shm_input) follow the head with own position, the writer does
+ * not wait for them: the reader lagging by the ring size skips to the head.
+ * The block is valid if the writer has not reached the slot again while
+ * the reader copied it. Readers sleep on the futex word, the writer wakes
+ * them only if somebody sleeps.
+ */
+
+#define SHM_MAGIC 0x41535453 // ASTS
+#define SHM_VERSION 1
+
+#define SHM_BLOCK_COUNT 7 // packets in the block
+#define SHM_RING_SIZE 4096 // blocks, default
+#define SHM_RING_MAX 262144
+
+#define SHM_NAME_SIZE 256
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t reserved;
+    uint8_t ts[SHM_BLOCK_COUNT * TS_PACKET_SIZE];
+} shm_block_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size; // blocks, power of two
+    uint32_t block_size; // sizeof(shm_block_t)
+
+    // the writer and the readers use the different cache lines
+    uint8_t reserved_1[48];
+    uint64_t head; // published blocks
+    uint8_t reserved_2[56];
+    uint32_t futex; // changed on publish if waiters is set
+    uint32_t waiters; // sleeping readers
+} shm_header_t;
+
+static inline size_t shm_size(uint32_t ring_size)
+{
+    return sizeof(shm_header_t) + (size_t)ring_size * sizeof(shm_block_t);
+}
+
+static inline shm_block_t * shm_block(shm_header_t *header, uint64_t position)
+{
+    shm_block_t *ring = (shm_block_t *)&header[1];
+    return &ring[position & (header->ring_size - 1)];
+}
+
+/* object name in /dev/shm */
+static inline void shm_name(char *buffer, const char *name)
+{
+    snprintf(buffer, SHM_NAME_SIZE, "/astra-%s", name);
+}
+
+static inline void shm_futex_wake(uint32_t *futex)
+{
+    syscall(SYS_futex, futex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static inline void shm_futex_wait(uint32_t *futex, uint32_t value, uint32_t timeout_ms)
+{
+    const struct timespec timeout =
+    {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000
+    };
+    syscall(SYS_futex, futex, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+#endif /* _SHM_H_ */
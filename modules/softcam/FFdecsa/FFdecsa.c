@@ -20,6 +20,27 @@
 
 #undef DEBUG
 
+// runtime dispatch: the default build is the baseline kernel with
+// base_ prefix, FFdecsa_avx2.c builds the same code with avx2_ prefix
+#if defined(FFDECSA_AVX2) && !defined(FFDECSA_NAME)
+#define FFDECSA_NAME(_n) base_##_n
+#define FFDECSA_DISPATCH
+#endif
+
+#ifdef FFDECSA_NAME
+#define get_internal_parallelism FFDECSA_NAME(get_internal_parallelism)
+#define get_suggested_cluster_size FFDECSA_NAME(get_suggested_cluster_size)
+#define get_key_struct FFDECSA_NAME(get_key_struct)
+#define free_key_struct FFDECSA_NAME(free_key_struct)
+#define set_control_words FFDECSA_NAME(set_control_words)
+#define set_even_control_word FFDECSA_NAME(set_even_control_word)
+#define set_odd_control_word FFDECSA_NAME(set_odd_control_word)
+#define get_control_words FFDECSA_NAME(get_control_words)
+#define decrypt_packets FFDECSA_NAME(decrypt_packets)
+#define stream_cypher_group_init FFDECSA_NAME(stream_cypher_group_init)
+#define stream_cypher_group_normal FFDECSA_NAME(stream_cypher_group_normal)
+#endif
+
 #include <core/compat.h>
 
 #include "FFdecsa.h"
@@ -57,6 +78,7 @@
 #define PARALLEL_128_SSE     1285
 #define PARALLEL_128_SSE2    1286
 #define PARALLEL_256_8INT    2560
+#define PARALLEL_256_AVX2    2561
 
 //////// our choice //////////////// our choice //////////////// our choice //////////////// our choice ////////
 #ifndef PARALLEL_MODE
@@ -98,6 +120,8 @@
 #include "parallel_128_sse2.h"
 #elif PARALLEL_MODE==PARALLEL_256_8INT
 #include "parallel_256_8int.h"
+#elif PARALLEL_MODE==PARALLEL_256_AVX2
+#include "parallel_256_avx2.h"
 #else
 #error "unknown/undefined parallel mode"
 #endif
@@ -912,3 +936,76 @@ DBG(dump_mem("23jd_after_ib_decrypt_data ",encp[g],8,8));
 
   return advanced;
 }
+
+//-----------------------------------RUNTIME DISPATCH
+
+#ifdef FFDECSA_NAME
+const struct ffdecsa_kernel_t FFDECSA_NAME(kernel) = {
+  .parallelism = get_internal_parallelism,
+  .cluster_size = get_suggested_cluster_size,
+  .key_alloc = get_key_struct,
+  .key_free = free_key_struct,
+  .set_cw = set_control_words,
+  .set_even_cw = set_even_control_word,
+  .set_odd_cw = set_odd_control_word,
+  .decrypt = decrypt_packets,
+};
+#endif
+
+#ifdef FFDECSA_DISPATCH
+#undef get_internal_parallelism
+#undef get_suggested_cluster_size
+#undef get_key_struct
+#undef free_key_struct
+#undef set_control_words
+#undef set_even_control_word
+#undef set_odd_control_word
+#undef get_control_words
+#undef decrypt_packets
+
+extern const struct ffdecsa_kernel_t avx2_kernel;
+
+static const struct ffdecsa_kernel_t *kernel=NULL;
+
+// key structures depend on the kernel, so it is selected once
+const struct ffdecsa_kernel_t *ffdecsa_kernel(void){
+  if(!kernel){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) kernel=&avx2_kernel;
+    else kernel=&base_kernel;
+  }
+  return kernel;
+}
+
+int get_internal_parallelism(void){
+  return ffdecsa_kernel()->parallelism();
+}
+
+int get_suggested_cluster_size(void){
+  return ffdecsa_kernel()->cluster_size();
+}
+
+void *get_key_struct(void){
+  return ffdecsa_kernel()->key_alloc();
+}
+
+void free_key_struct(void *keys){
+  kernel->key_free(keys);
+}
+
+void set_control_words(void *keys, const unsigned char *even, const unsigned char *odd){
+  kernel->set_cw(keys,even,odd);
+}
+
+void set_even_control_word(void *keys, const unsigned char *even){
+  kernel->set_even_cw(keys,even);
+}
+
+void set_odd_control_word(void *keys, const unsigned char *odd){
+  kernel->set_odd_cw(keys,odd);
+}
+
+int decrypt_packets(void *keys, unsigned char **cluster){
+  return kernel->decrypt(keys,cluster);
+}
+#endif
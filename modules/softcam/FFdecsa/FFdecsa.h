@@ -59,4 +59,22 @@ void set_odd_control_word(void *keys, const unsigned char *odd);
 // Please read doc/how_to_use.txt.
 int decrypt_packets(void *keys, unsigned char **cluster);
 
+// -- kernel selected at runtime by the CPU features
+// Builds with FFDECSA_AVX2 contain the baseline and AVX2 kernels, the
+// functions above are routed to the fastest one for this CPU.
+struct ffdecsa_kernel_t {
+  int (*parallelism)(void);
+  int (*cluster_size)(void);
+  void *(*key_alloc)(void);
+  void (*key_free)(void *keys);
+  void (*set_cw)(void *keys, const unsigned char *even, const unsigned char *odd);
+  void (*set_even_cw)(void *keys, const unsigned char *even);
+  void (*set_odd_cw)(void *keys, const unsigned char *odd);
+  int (*decrypt)(void *keys, unsigned char **cluster);
+};
+
+#ifdef FFDECSA_AVX2
+const struct ffdecsa_kernel_t *ffdecsa_kernel(void);
+#endif
+
 #endif
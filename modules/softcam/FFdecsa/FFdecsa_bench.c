@@ -0,0 +1,196 @@
+/* FFdecsa -- fast decsa algorithm
+ *
+ * Copyright (C) 2003-2004  fatih89r
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Correctness and speed of all parallel modes on this CPU, one core.
+// Not a part of the astra binary:
+//      make ffdecsa-bench && ./ffdecsa-bench [packets]
+// Each mode is FFdecsa.c built by FFdecsa_mode.c, the list of the modes is
+// FFDECSA_BENCH_MODES of the Makefile, built with the optimization level of
+// astra. The last line is the fastest correct mode with the configure.sh
+// option to select it, the modes of the CPU which are not supported are skipped.
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "FFdecsa.h"
+#include "FFdecsa_test_testcases.h"
+
+#define BENCH_PACKETS_DEFAULT (100*1000)
+
+#define MODE_GENERIC(X) \
+  X(320,"32_4CHAR",NULL) X(321,"32_4CHARA",NULL) X(322,"32_INT",NULL) \
+  X(640,"64_8CHAR",NULL) X(641,"64_8CHARA",NULL) X(642,"64_2INT",NULL) X(643,"64_LONG",NULL) \
+  X(1280,"128_16CHAR",NULL) X(1281,"128_16CHARA",NULL) X(1282,"128_4INT",NULL) \
+  X(1283,"128_2LONG",NULL) X(2560,"256_8INT",NULL)
+
+#ifdef FFDECSA_BENCH_X86
+#define MODE_X86(X) \
+  X(644,"64_MMX","mmx") X(1284,"128_2MMX","mmx") X(1285,"128_SSE","sse") X(1286,"128_SSE2","sse2")
+#else
+#define MODE_X86(X)
+#endif
+
+#ifdef FFDECSA_BENCH_AVX2
+#define MODE_AVX2(X) X(2561,"256_AVX2","avx2")
+#else
+#define MODE_AVX2(X)
+#endif
+
+#define MODE_LIST(X) MODE_GENERIC(X) MODE_X86(X) MODE_AVX2(X)
+
+#define MODE_EXTERN(_m,_name,_cpu) extern const struct ffdecsa_kernel_t mode##_m##_kernel;
+MODE_LIST(MODE_EXTERN)
+
+struct bench_mode_t {
+  int mode;
+  const char *name;
+  const char *cpu; // required feature, NULL for the plain C
+  const struct ffdecsa_kernel_t *kernel;
+};
+
+#define MODE_ITEM(_m,_name,_cpu) { _m, _name, _cpu, &mode##_m##_kernel },
+static const struct bench_mode_t mode_list[] = { MODE_LIST(MODE_ITEM) };
+
+static int is_cpu_supported(const char *cpu){
+  if(!cpu) return 1;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if(!strcmp(cpu,"mmx")) return __builtin_cpu_supports("mmx");
+  if(!strcmp(cpu,"sse")) return __builtin_cpu_supports("sse");
+  if(!strcmp(cpu,"sse2")) return __builtin_cpu_supports("sse2");
+  if(!strcmp(cpu,"avx2")) return __builtin_cpu_supports("avx2");
+#endif
+  return 0;
+}
+
+// byte 3 is the TS header with the scrambling bits, it is cleared by the decrypt
+static int compare(const unsigned char *p1, const unsigned char *p2){
+  int i;
+  for(i=0;i<188;i++){
+    if(i!=3 && p1[i]!=p2[i]) return 0;
+  }
+  return 1;
+}
+
+static int check_one(const struct ffdecsa_kernel_t *k, void *keys,
+                     unsigned char *even, unsigned char *odd,
+                     unsigned char *encrypted, unsigned char *expected){
+  unsigned char buf[188];
+  unsigned char *cluster[3];
+
+  k->set_cw(keys,even,odd);
+  memcpy(buf,encrypted,188);
+  cluster[0]=buf;cluster[1]=buf+188;cluster[2]=NULL;
+  k->decrypt(keys,cluster);
+  return compare(buf,expected);
+}
+
+static int check_vectors(const struct ffdecsa_kernel_t *k, void *keys){
+  int ok=1;
+  ok&=check_one(k,keys,test_invalid_key,test_1_key,test_1_encrypted,test_1_expected);
+  ok&=check_one(k,keys,test_2_key,test_invalid_key,test_2_encrypted,test_2_expected);
+  ok&=check_one(k,keys,test_3_key,test_invalid_key,test_3_encrypted,test_3_expected);
+  ok&=check_one(k,keys,test_p_10_0_key,test_invalid_key,test_p_10_0_encrypted,test_p_10_0_expected);
+  ok&=check_one(k,keys,test_p_1_6_key,test_invalid_key,test_p_1_6_encrypted,test_p_1_6_expected);
+  return ok;
+}
+
+// clusters of the suggested size, as the decrypt module calls the engine
+static double run_speed(const struct ffdecsa_kernel_t *k, void *keys,
+                        unsigned char *buf, int count, int *ok){
+  struct timeval tvs,tve;
+  unsigned char *cluster[3];
+  const int cluster_size=k->cluster_size();
+  int i,done;
+
+  for(i=0;i<count;i++) memcpy(&buf[188*i],test_2_encrypted,188);
+  k->set_cw(keys,test_2_key,test_invalid_key);
+
+  gettimeofday(&tvs,NULL);
+  for(done=0;done<count;){
+    int end=done+cluster_size;
+    if(end>count) end=count;
+    while(done<end){
+      cluster[0]=&buf[188*done];cluster[1]=&buf[188*end];cluster[2]=NULL;
+      const int n=k->decrypt(keys,cluster);
+      if(n<=0){ *ok=0; return 0; }
+      done+=n;
+    }
+  }
+  gettimeofday(&tve,NULL);
+
+  for(i=0;i<count;i++){
+    if(!compare(&buf[188*i],test_2_expected)){
+      *ok=0;
+      break;
+    }
+  }
+
+  const double time=(tve.tv_sec-tvs.tv_sec)+1e-6*(tve.tv_usec-tvs.tv_usec);
+  return (time>0) ? (count/time) : 0;
+}
+
+int main(int argc, char **argv){
+  const int count=(argc>1 && atoi(argv[1])>0) ? atoi(argv[1]) : BENCH_PACKETS_DEFAULT;
+  unsigned char *buf=malloc(188*count);
+  const struct bench_mode_t *best=NULL;
+  double best_pps=0;
+  int failed=0;
+  size_t i;
+
+  printf("%-6s %-12s %5s %8s %7s %12s %10s\n",
+         "mode","name","par","cluster","result","pkts/s","Mbit/s");
+
+  for(i=0;i<sizeof(mode_list)/sizeof(mode_list[0]);i++){
+    const struct bench_mode_t *m=&mode_list[i];
+    if(!is_cpu_supported(m->cpu)){
+      printf("%-6d %-12s %5s %8s %7s\n",m->mode,m->name,"-","-","skip");
+      continue;
+    }
+
+    void *keys=m->kernel->key_alloc();
+    int ok=check_vectors(m->kernel,keys);
+    const double pps=run_speed(m->kernel,keys,buf,count,&ok);
+    m->kernel->key_free(keys);
+
+    printf("%-6d %-12s %5d %8d %7s %12.0f %10.1f\n",
+           m->mode,m->name,m->kernel->parallelism(),m->kernel->cluster_size(),
+           ok ? "ok" : "FAILED",pps,pps*184*8/1000000);
+
+    if(!ok){
+      failed=1;
+      continue;
+    }
+    if(pps>best_pps){
+      best_pps=pps;
+      best=m;
+    }
+  }
+
+  free(buf);
+
+  if(best && best->mode==2561)
+    printf("best: %d %s, selected at runtime by the default build\n",best->mode,best->name);
+  else if(best)
+    printf("best: %d %s, ./configure.sh CFLAGS=\"-DPARALLEL_MODE=%d\"\n",best->mode,best->name,best->mode);
+
+  return failed ? 10 : 0;
+}
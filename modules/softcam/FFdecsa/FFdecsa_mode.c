@@ -0,0 +1,31 @@
+/* FFdecsa -- fast decsa algorithm
+ *
+ * Copyright (C) 2003-2004  fatih89r
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// one parallel mode for FFdecsa_bench.c, built with -DPARALLEL_MODE=<number>.
+// the kernel is exported as mode<number>_kernel
+
+#if PARALLEL_MODE==2561
+#pragma GCC target("avx2")
+#endif
+
+#define FFDECSA_MODE_PASTE(_m,_n) mode##_m##_##_n
+#define FFDECSA_MODE_NAME(_m,_n) FFDECSA_MODE_PASTE(_m,_n)
+#define FFDECSA_NAME(_n) FFDECSA_MODE_NAME(PARALLEL_MODE,_n)
+
+#include "FFdecsa.c"
@@ -0,0 +1,82 @@
+/* FFdecsa -- fast decsa algorithm
+ *
+ * Copyright (C) 2007 Dark Avenger
+ *               2003-2004  fatih89r
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <immintrin.h>
+
+#define MEMALIGN __attribute__((aligned(32)))
+
+union __u256i {
+	unsigned int u[8];
+	__m256i v;
+};
+
+static const union __u256i ff0 = {{0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U}};
+static const union __u256i ff1 = {{0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU}};
+
+typedef __m256i group;
+#define GROUP_PARALLELISM 256
+#define FF0() ff0.v
+#define FF1() ff1.v
+#define FFAND(a,b) _mm256_and_si256((a),(b))
+#define FFOR(a,b)  _mm256_or_si256((a),(b))
+#define FFXOR(a,b) _mm256_xor_si256((a),(b))
+#define FFNOT(a)   _mm256_xor_si256((a),FF1())
+#define MALLOC(X)  _mm_malloc(X,32)
+#define FREE(X)    _mm_free(X)
+
+/* BATCH */
+
+static const union __u256i ff29 = {{0x29292929U, 0x29292929U, 0x29292929U, 0x29292929U, 0x29292929U, 0x29292929U, 0x29292929U, 0x29292929U}};
+static const union __u256i ff02 = {{0x02020202U, 0x02020202U, 0x02020202U, 0x02020202U, 0x02020202U, 0x02020202U, 0x02020202U, 0x02020202U}};
+static const union __u256i ff04 = {{0x04040404U, 0x04040404U, 0x04040404U, 0x04040404U, 0x04040404U, 0x04040404U, 0x04040404U, 0x04040404U}};
+static const union __u256i ff10 = {{0x10101010U, 0x10101010U, 0x10101010U, 0x10101010U, 0x10101010U, 0x10101010U, 0x10101010U, 0x10101010U}};
+static const union __u256i ff40 = {{0x40404040U, 0x40404040U, 0x40404040U, 0x40404040U, 0x40404040U, 0x40404040U, 0x40404040U, 0x40404040U}};
+static const union __u256i ff80 = {{0x80808080U, 0x80808080U, 0x80808080U, 0x80808080U, 0x80808080U, 0x80808080U, 0x80808080U, 0x80808080U}};
+
+typedef __m256i batch;
+#define BYTES_PER_BATCH 32
+#define B_FFN_ALL_29() ff29.v
+#define B_FFN_ALL_02() ff02.v
+#define B_FFN_ALL_04() ff04.v
+#define B_FFN_ALL_10() ff10.v
+#define B_FFN_ALL_40() ff40.v
+#define B_FFN_ALL_80() ff80.v
+
+#define B_FFAND(a,b) FFAND(a,b)
+#define B_FFOR(a,b)  FFOR(a,b)
+#define B_FFXOR(a,b) FFXOR(a,b)
+#define B_FFSH8L(a,n) _mm256_slli_epi64((a),(n))
+#define B_FFSH8R(a,n) _mm256_srli_epi64((a),(n))
+
+#define M_EMPTY()
+
+#undef BEST_SPAN
+#define BEST_SPAN            32
+
+#undef XOR_BEST_BY
+static inline void XOR_BEST_BY(unsigned char *d, unsigned char *s1, unsigned char *s2)
+{
+	__m256i vs1 = _mm256_load_si256((__m256i*)s1);
+	__m256i vs2 = _mm256_load_si256((__m256i*)s2);
+	vs1 = _mm256_xor_si256(vs1, vs2);
+	_mm256_store_si256((__m256i*)d, vs1);
+}
+
+#include "fftable.h"
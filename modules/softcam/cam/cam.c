@@ -20,6 +20,368 @@
 
 #include "../module_cam.h"
 
+/*
+ * ECM cache, shared by all decrypt modules and cam backends.
+ * Decrypt modules with the same ECM send one request to the card server,
+ * the response is delivered to all of them.
+ */
+
+#define ECM_CACHE_SIZE 64
+#define ECM_CACHE_TIME (20 * 1000 * 1000)  /* keys lifetime, us */
+#define ECM_CACHE_WAIT (5 * 1000 * 1000)   /* resend the pending request, us */
+
+typedef struct
+{
+    module_decrypt_t *decrypt;
+    void *arg;
+} ecm_request_t;
+
+typedef struct
+{
+    bool is_used;
+    bool is_ready;
+    uint64_t time;
+
+    uint16_t caid;
+    uint16_t ecm_pid;
+    uint32_t crc;
+
+    ecm_request_t owner;    /* request in progress */
+    asc_list_t *wait_list;  /* other requests for the same ECM */
+
+    uint16_t ecm_size;
+    uint8_t ecm[EM_MAX_SIZE];
+
+    uint8_t response[3 + 0xFF];
+} ecm_cache_t;
+
+static ecm_cache_t ecm_cache[ECM_CACHE_SIZE];
+
+static void ecm_cache_clear(ecm_cache_t *item)
+{
+    if(item->wait_list)
+    {
+        for(  asc_list_first(item->wait_list)
+            ; !asc_list_eol(item->wait_list)
+            ; asc_list_first(item->wait_list))
+        {
+            free(asc_list_data(item->wait_list));
+            asc_list_remove_current(item->wait_list);
+        }
+        asc_list_destroy(item->wait_list);
+        item->wait_list = NULL;
+    }
+
+    item->is_used = false;
+    item->is_ready = false;
+    item->owner.decrypt = NULL;
+    item->owner.arg = NULL;
+}
+
+/* the owner is gone or too slow, the first waiter sends the request again */
+static void ecm_cache_resend(ecm_cache_t *item)
+{
+    item->owner.decrypt = NULL;
+
+    if(item->wait_list)
+    {
+        asc_list_first(item->wait_list);
+        if(!asc_list_eol(item->wait_list))
+        {
+            ecm_request_t *request = asc_list_data(item->wait_list);
+            asc_list_remove_current(item->wait_list);
+            item->owner = *request;
+            free(request);
+        }
+    }
+
+    if(!item->owner.decrypt)
+    {
+        ecm_cache_clear(item);
+        return;
+    }
+
+    item->time = asc_utime_coarse();
+
+    module_cam_t *cam = item->owner.decrypt->cam;
+    cam->send_em(cam->self, item->owner.decrypt, item->owner.arg, item->ecm, item->ecm_size);
+}
+
+static void ecm_cache_expire(uint64_t now)
+{
+    for(int i = 0; i < ECM_CACHE_SIZE; ++i)
+    {
+        ecm_cache_t *item = &ecm_cache[i];
+        if(!item->is_used)
+            continue;
+
+        if(item->is_ready)
+        {
+            if(now - item->time > ECM_CACHE_TIME)
+                ecm_cache_clear(item);
+        }
+        else if(now - item->time > ECM_CACHE_WAIT)
+            ecm_cache_resend(item);
+    }
+}
+
+/* remove requests of the decrypt module, or of all modules on the cam if decrypt is NULL */
+static void ecm_cache_flush(module_cam_t *cam, module_decrypt_t *decrypt)
+{
+    ecm_cluster_flush(cam, decrypt);
+
+    for(int i = 0; i < ECM_CACHE_SIZE; ++i)
+    {
+        ecm_cache_t *item = &ecm_cache[i];
+        if(!item->is_used || item->is_ready)
+            continue;
+
+        if(item->wait_list)
+        {
+            asc_list_first(item->wait_list);
+            while(!asc_list_eol(item->wait_list))
+            {
+                ecm_request_t *request = asc_list_data(item->wait_list);
+                if((decrypt) ? (request->decrypt == decrypt) : (request->decrypt->cam == cam))
+                {
+                    free(request);
+                    asc_list_remove_current(item->wait_list);
+                }
+                else
+                    asc_list_next(item->wait_list);
+            }
+        }
+
+        module_decrypt_t *owner = item->owner.decrypt;
+        if((decrypt) ? (owner == decrypt) : (owner->cam == cam))
+            ecm_cache_resend(item);
+    }
+}
+
+void module_cam_send_ecm(  module_decrypt_t *decrypt, void *arg, uint16_t ecm_pid
+                         , const uint8_t *buffer, uint16_t size)
+{
+    module_cam_t *cam = decrypt->cam;
+
+    if(cam->send_ecm)
+    {
+        cam->send_ecm(cam->self, decrypt, arg, ecm_pid, buffer, size);
+        return;
+    }
+
+    const uint64_t now = asc_utime_coarse();
+    ecm_cache_expire(now);
+
+    const uint32_t crc = crc32b(buffer, size);
+
+    ecm_cache_t *item = NULL;
+    ecm_cache_t *slot = NULL;
+    for(int i = 0; i < ECM_CACHE_SIZE; ++i)
+    {
+        ecm_cache_t *i_item = &ecm_cache[i];
+        if(!i_item->is_used)
+        {
+            if(!slot || slot->is_used)
+                slot = i_item;
+            continue;
+        }
+
+        if(   i_item->crc == crc
+           && i_item->caid == cam->caid
+           && i_item->ecm_pid == ecm_pid
+           && i_item->ecm_size == size
+           && !memcmp(i_item->ecm, buffer, size))
+        {
+            item = i_item;
+            break;
+        }
+
+        // replace the oldest keys if the cache is full
+        if(i_item->is_ready && (!slot || (slot->is_used && i_item->time < slot->time)))
+            slot = i_item;
+    }
+
+    if(item)
+    {
+        if(item->is_ready)
+        {
+            decrypt->on_cam_response(decrypt->self, arg, item->response);
+            return;
+        }
+
+        if(item->owner.decrypt == decrypt && item->owner.arg == arg)
+        {
+            // requested again, the previous request is lost
+            item->time = now;
+            cam->send_em(cam->self, decrypt, arg, buffer, size);
+            return;
+        }
+
+        if(!item->wait_list)
+            item->wait_list = asc_list_init();
+
+        ecm_request_t *request = malloc(sizeof(ecm_request_t));
+        request->decrypt = decrypt;
+        request->arg = arg;
+        asc_list_insert_tail(item->wait_list, request);
+        return;
+    }
+
+    if(slot)
+    {
+        ecm_cache_clear(slot);
+
+        slot->is_used = true;
+        slot->time = now;
+        slot->caid = cam->caid;
+        slot->ecm_pid = ecm_pid;
+        slot->crc = crc;
+        slot->owner.decrypt = decrypt;
+        slot->owner.arg = arg;
+        slot->ecm_size = size;
+        memcpy(slot->ecm, buffer, size);
+
+        // the answer of the other node is delivered as the response of the cam
+        if(ecm_cluster_request(decrypt, arg, buffer, size))
+            return;
+    }
+
+    cam->send_em(cam->self, decrypt, arg, buffer, size);
+}
+
+void module_cam_ecm_response(module_decrypt_t *decrypt, void *arg, const uint8_t *data)
+{
+    ecm_cache_t *item = NULL;
+    for(int i = 0; i < ECM_CACHE_SIZE; ++i)
+    {
+        ecm_cache_t *i_item = &ecm_cache[i];
+        if(   i_item->is_used
+           && !i_item->is_ready
+           && i_item->owner.decrypt == decrypt
+           && i_item->owner.arg == arg)
+        {
+            item = i_item;
+            break;
+        }
+    }
+
+    if(!item)
+        return;
+
+    asc_list_t *wait_list = item->wait_list;
+    item->wait_list = NULL;
+
+    if(data[2] == 16)
+    {
+        item->is_ready = true;
+        item->time = asc_utime_coarse();
+        item->owner.decrypt = NULL;
+        item->owner.arg = NULL;
+        memcpy(item->response, data, 3 + data[2]);
+        ecm_cluster_publish(item->caid, item->ecm, item->ecm_size, data);
+    }
+    else
+    {
+        // not found. next request goes to the card server again
+        ecm_cache_clear(item);
+    }
+
+    if(!wait_list)
+        return;
+
+    for(  asc_list_first(wait_list)
+        ; !asc_list_eol(wait_list)
+        ; asc_list_first(wait_list))
+    {
+        ecm_request_t *request = asc_list_data(wait_list);
+        asc_list_remove_current(wait_list);
+        request->decrypt->on_cam_response(request->decrypt->self, request->arg, data);
+        free(request);
+    }
+    asc_list_destroy(wait_list);
+}
+
+/*
+ * EMM filter, shared by all decrypt modules. Decrypt modules on the same
+ * multiplex receive the same shared and global EMMs, the card server gets
+ * each EMM once in EMM_CACHE_TIME. Address of the EMM is checked before by
+ * check_em() of the CAS module against UA and the providers of the cam.
+ */
+
+#define EMM_CACHE_WAYS 4
+#define EMM_CACHE_SIZE (256 * EMM_CACHE_WAYS)
+#define EMM_CACHE_TIME (60 * 1000 * 1000)  /* us */
+
+typedef struct
+{
+    module_cam_t *cam;
+    uint64_t time;
+    uint32_t crc;
+    uint16_t size;
+} emm_cache_t;
+
+static emm_cache_t emm_cache[EMM_CACHE_SIZE];
+
+static void emm_cache_flush(module_cam_t *cam)
+{
+    for(int i = 0; i < EMM_CACHE_SIZE; ++i)
+    {
+        if(emm_cache[i].cam == cam)
+            emm_cache[i].cam = NULL;
+    }
+}
+
+bool module_cam_send_emm(module_decrypt_t *decrypt, const uint8_t *buffer, uint16_t size)
+{
+    module_cam_t *cam = decrypt->cam;
+
+    const uint64_t now = asc_utime_coarse();
+    const uint32_t crc = crc32b(buffer, size);
+
+    const size_t set = (crc ^ (uint32_t)(uintptr_t)cam) % (EMM_CACHE_SIZE / EMM_CACHE_WAYS);
+    emm_cache_t *const ways = &emm_cache[set * EMM_CACHE_WAYS];
+    emm_cache_t *slot = &ways[0];
+    for(int i = 0; i < EMM_CACHE_WAYS; ++i)
+    {
+        emm_cache_t *item = &ways[i];
+        if(   item->cam == cam
+           && item->crc == crc
+           && item->size == size
+           && now - item->time < EMM_CACHE_TIME)
+        {
+            return false;
+        }
+
+        // free or the oldest
+        if(slot->cam && (!item->cam || item->time < slot->time))
+            slot = item;
+    }
+
+    if(cam->emm_rate > 0)
+    {
+        const uint64_t second = now / 1000000;
+        if(cam->emm_time != second)
+        {
+            cam->emm_time = second;
+            memset(cam->emm_count, 0, sizeof(cam->emm_count));
+        }
+
+        // dropped EMM is not cached, the next repetition is sent
+        uint16_t *count = &cam->emm_count[buffer[0] & 0x0F];
+        if(*count >= cam->emm_rate)
+            return false;
+        ++(*count);
+    }
+
+    slot->cam = cam;
+    slot->time = now;
+    slot->crc = crc;
+    slot->size = size;
+
+    cam->send_em(cam->self, decrypt, NULL, buffer, size);
+    return true;
+}
+
 em_packet_t * module_cam_queue_pop(module_cam_t *cam)
 {
     asc_list_first(cam->packet_queue);
@@ -30,6 +392,83 @@ em_packet_t * module_cam_queue_pop(module_cam_t *cam)
     return packet;
 }
 
+#define EM_IS_ECM(_buffer) (((_buffer)[0] & ~0x01) == 0x80)
+
+/* EMMs are dropped from the head of the queue over this limit */
+#define EMM_QUEUE_MAX 64
+
+/*
+ * ECMs are served before EMMs. A new ECM replaces the pending one of the same
+ * stream, identical EMMs are queued once. Returns false if the packet is dropped.
+ */
+bool module_cam_queue_push(module_cam_t *cam, em_packet_t *packet)
+{
+    const bool is_ecm = EM_IS_ECM(packet->buffer);
+
+    size_t emm_count = 0;
+    em_packet_t *emm_head = NULL;
+
+    asc_list_first(cam->packet_queue);
+    while(!asc_list_eol(cam->packet_queue))
+    {
+        em_packet_t *queue_item = asc_list_data(cam->packet_queue);
+
+        if(!EM_IS_ECM(queue_item->buffer))
+        {
+            if(!emm_head)
+                emm_head = queue_item;
+            ++emm_count;
+
+            if(   !is_ecm
+               && queue_item->buffer_size == packet->buffer_size
+               && !memcmp(queue_item->buffer, packet->buffer, packet->buffer_size))
+            {
+                asc_free(packet);
+                return false;
+            }
+        }
+        else if(   is_ecm
+                && queue_item->decrypt == packet->decrypt
+                && queue_item->arg == packet->arg)
+        {
+            // the previous ECM of the stream is not actual
+            asc_list_remove_current(cam->packet_queue);
+            const bool is_same = (   queue_item->buffer_size == packet->buffer_size
+                                  && !memcmp(queue_item->buffer, packet->buffer, packet->buffer_size));
+            if(!is_same)
+            {
+                asc_log_warning(  "[cam] drop old packet (pnr:%d drop:0x%02X set:0x%02X)"
+                                , packet->decrypt->pnr, queue_item->buffer[0], packet->buffer[0]);
+            }
+            asc_free(queue_item);
+            continue;
+        }
+
+        asc_list_next(cam->packet_queue);
+    }
+
+    if(!is_ecm)
+    {
+        if(emm_count >= EMM_QUEUE_MAX)
+        {
+            asc_list_remove_item(cam->packet_queue, emm_head);
+            asc_free(emm_head);
+        }
+        asc_list_insert_tail(cam->packet_queue, packet);
+        return true;
+    }
+
+    // after the pending ECMs, before the first EMM
+    asc_list_for(cam->packet_queue)
+    {
+        em_packet_t *queue_item = asc_list_data(cam->packet_queue);
+        if(!EM_IS_ECM(queue_item->buffer))
+            break;
+    }
+    asc_list_insert_before(cam->packet_queue, packet);
+    return true;
+}
+
 void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt)
 {
     asc_list_first(cam->packet_queue);
@@ -38,7 +477,7 @@ void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt)
         em_packet_t *packet = asc_list_data(cam->packet_queue);
         if(!decrypt || packet->decrypt == decrypt)
         {
-            free(packet);
+            asc_free(packet);
             asc_list_remove_current(cam->packet_queue);
         }
         else
@@ -55,7 +494,7 @@ void module_cam_ready(module_cam_t *cam)
         ; asc_list_next(cam->decrypt_list))
     {
         module_decrypt_t *__decrypt = asc_list_data(cam->decrypt_list);
-        on_cam_ready(__decrypt->self);
+        __decrypt->on_cam_ready(__decrypt->self);
     }
 }
 
@@ -68,8 +507,10 @@ void module_cam_reset(module_cam_t *cam)
         ; asc_list_next(cam->decrypt_list))
     {
         module_decrypt_t *__decrypt = asc_list_data(cam->decrypt_list);
-        on_cam_error(__decrypt->self);
+        __decrypt->on_cam_error(__decrypt->self);
     }
+    ecm_cache_flush(cam, NULL);
+    emm_cache_flush(cam);
     for(  asc_list_first(cam->prov_list)
         ; !asc_list_eol(cam->prov_list)
         ; asc_list_first(cam->prov_list))
@@ -84,12 +525,13 @@ void module_cam_attach_decrypt(module_cam_t *cam, module_decrypt_t *decrypt)
     cam->connect(cam->self);
     asc_list_insert_tail(cam->decrypt_list, decrypt);
     if(cam->is_ready)
-        on_cam_ready(decrypt->self);
+        decrypt->on_cam_ready(decrypt->self);
 }
 
 void module_cam_detach_decrypt(module_cam_t *cam, module_decrypt_t *decrypt)
 {
     module_cam_queue_flush(cam, decrypt);
+    ecm_cache_flush(cam, decrypt);
     asc_list_remove_item(cam->decrypt_list, decrypt);
     if(asc_list_size(cam->decrypt_list) == 0)
         cam->disconnect(cam->self);
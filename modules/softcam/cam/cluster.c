@@ -0,0 +1,675 @@
+/*
+ * Astra Module: SoftCAM. ECM Cluster
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ECM cache of the nodes on the multicast group. The ECM which is not found
+ * in the local cache (see cam.c) is looked up in the answers of the other
+ * nodes. If not found the node announces the request (claim) and sends
+ * the ECM to the card server, the response is published to the group.
+ * The nodes with the same ECM wait for the answer of the claimed node
+ * instead of the card server, the card server gets one request per cluster.
+ *
+ * The nodes with the same ECM at the same time hold the own request for the
+ * hold time, the claim of the node with the lower id wins. If the answer is
+ * not received in the timeout the node sends the ECM to the own card server.
+ *
+ * Datagram, big-endian:
+ *      0   4   magic "ECC1"
+ *      4   1   type: 1 - claim, 2 - answer
+ *      5   1   reserved, 0
+ *      6   4   node id
+ *      10  8   timestamp, milliseconds since the Epoch
+ *      18  16  key, SHA1 of CAID and the ECM section
+ *      34  19  answer only: response of the cam, 3 bytes header and 16 bytes CW
+ *      end 20  HMAC-SHA1 of the datagram with the shared secret
+ *
+ * The answer has the keys for the ECM itself, a replayed answer is harmless.
+ * Datagrams out of the time window are dropped anyway.
+ *
+ * Module Name:
+ *      ecm_cluster
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      addr        - string, multicast group
+ *      port        - number, UDP port
+ *      secret      - string, shared secret of the HMAC
+ *      localaddr   - string, IP address of the local interface
+ *      ttl         - number, multicast time to live. default: 1
+ *      cache       - number, seconds, lifetime of the answer. default: 10
+ *      hold        - number, milliseconds to wait for the claims of the
+ *                    other nodes before the request. default: 20
+ *      timeout     - number, milliseconds to wait for the answer of the
+ *                    other node. default: 3000
+ *      window      - number, seconds, maximum difference of the timestamp and
+ *                    the local clock. default: 30
+ *
+ * Module Methods:
+ *      stat()      - return table: node, hit, wait, timeout, claim, answer,
+ *                    received, auth_failed
+ */
+
+#include <astra.h>
+#include "../module_cam.h"
+
+#define MSG(_msg) "[ecm_cluster %s] " _msg, mod->name
+
+#define CLUSTER_MAGIC "ECC1"
+#define CLUSTER_HEADER_SIZE 34
+#define CLUSTER_RESPONSE_SIZE (3 + 16)
+#define CLUSTER_BUFFER_SIZE 1500
+#define CLUSTER_KEY_SIZE 16
+#define CLUSTER_SIZE 256
+#define CLUSTER_TIMER 10 // ms, hold and timeout check
+
+#define CLUSTER_CLAIM 1
+#define CLUSTER_ANSWER 2
+
+typedef struct
+{
+    bool is_used;
+    bool is_ready; // answered
+    uint32_t node; // claimed by
+    uint64_t time; // claim or answer, us
+
+    uint8_t key[CLUSTER_KEY_SIZE];
+    uint8_t response[CLUSTER_RESPONSE_SIZE];
+} cluster_item_t;
+
+/* request waiting for the hold or for the answer of the other node */
+typedef struct
+{
+    module_cam_t *cam;
+    module_decrypt_t *decrypt;
+    void *arg;
+
+    bool is_hold;
+    uint64_t deadline; // us
+    uint8_t key[CLUSTER_KEY_SIZE];
+
+    uint16_t ecm_size;
+    uint8_t ecm[EM_MAX_SIZE];
+} cluster_request_t;
+
+struct module_data_t
+{
+    const char *name;
+    uint32_t node;
+
+    uint64_t cache; // us
+    uint64_t hold; // us
+    uint64_t timeout; // us
+    uint64_t window; // ms
+
+    hmac_sha1_t hmac;
+    asc_socket_t *sock;
+    asc_timer_t *timer;
+
+    cluster_item_t items[CLUSTER_SIZE];
+    asc_list_t *request_list;
+
+    /* the answer of the cluster is not published again */
+    bool is_delivering;
+
+    uint64_t hit;
+    uint64_t wait;
+    uint64_t timeout_count;
+    uint64_t claim;
+    uint64_t answer;
+    uint64_t received;
+    uint64_t auth_failed;
+
+    uint8_t buffer[CLUSTER_BUFFER_SIZE];
+};
+
+static module_data_t *cluster = NULL;
+
+static uint64_t wall_time_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void cluster_key(uint16_t caid, const uint8_t *ecm, uint16_t size
+                        , uint8_t key[CLUSTER_KEY_SIZE])
+{
+    const uint8_t caid_be[2] = { caid >> 8, caid & 0xFF };
+
+    sha1_ctx_t ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, caid_be, sizeof(caid_be));
+    sha1_update(&ctx, ecm, size);
+
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    sha1_final(&ctx, digest);
+    memcpy(key, digest, CLUSTER_KEY_SIZE);
+}
+
+/*
+ * ooooo ooooooooooo ooooooooooo oooo     oooo
+ *  888  88  888  88  888    88   8888o   888
+ *  888      888      888ooo8     88 888o8 88
+ *  888      888      888    oo   88  888  88
+ * o888o    o888o    o888ooo8888 o88o  8  o88o
+ *
+ */
+
+static cluster_item_t * item_find(module_data_t *mod, const uint8_t *key, uint64_t now)
+{
+    for(int i = 0; i < CLUSTER_SIZE; ++i)
+    {
+        cluster_item_t *item = &mod->items[i];
+        if(!item->is_used || memcmp(item->key, key, CLUSTER_KEY_SIZE) != 0)
+            continue;
+
+        const uint64_t lifetime = (item->is_ready) ? mod->cache : mod->timeout;
+        if(now - item->time > lifetime)
+        {
+            item->is_used = false;
+            return NULL;
+        }
+        return item;
+    }
+    return NULL;
+}
+
+/* free or the oldest item */
+static cluster_item_t * item_get(module_data_t *mod, const uint8_t *key, uint64_t now)
+{
+    cluster_item_t *item = item_find(mod, key, now);
+    if(item)
+        return item;
+
+    item = &mod->items[0];
+    for(int i = 0; i < CLUSTER_SIZE; ++i)
+    {
+        cluster_item_t *i_item = &mod->items[i];
+        if(!i_item->is_used)
+        {
+            item = i_item;
+            break;
+        }
+        if(i_item->time < item->time)
+            item = i_item;
+    }
+
+    memset(item, 0, sizeof(cluster_item_t));
+    item->is_used = true;
+    item->time = now;
+    memcpy(item->key, key, CLUSTER_KEY_SIZE);
+    return item;
+}
+
+static void cluster_send(module_data_t *mod, uint8_t type, const uint8_t *key
+                         , const uint8_t *response)
+{
+    if(!mod->sock)
+        return;
+
+    uint8_t buffer[CLUSTER_HEADER_SIZE + CLUSTER_RESPONSE_SIZE + SHA1_DIGEST_SIZE];
+    memcpy(buffer, CLUSTER_MAGIC, 4);
+    buffer[4] = type;
+    buffer[5] = 0;
+    for(int i = 0; i < 4; ++i)
+        buffer[6 + i] = (uint8_t)(mod->node >> (24 - i * 8));
+    const uint64_t timestamp = wall_time_ms();
+    for(int i = 0; i < 8; ++i)
+        buffer[10 + i] = (uint8_t)(timestamp >> (56 - i * 8));
+    memcpy(&buffer[18], key, CLUSTER_KEY_SIZE);
+
+    size_t size = CLUSTER_HEADER_SIZE;
+    if(response)
+    {
+        memcpy(&buffer[size], response, CLUSTER_RESPONSE_SIZE);
+        size += CLUSTER_RESPONSE_SIZE;
+    }
+    hmac_sha1(&mod->hmac, buffer, size, &buffer[size]);
+    size += SHA1_DIGEST_SIZE;
+
+    if(asc_socket_sendto(mod->sock, buffer, size) != (ssize_t)size)
+        asc_log_debug(MSG("sendto() failed (%s)"), asc_socket_error());
+}
+
+/*
+ * oooooooooo  ooooooooooo  ooooooo  ooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
+ *  888    888  888    88 o888   888o 888    88   888    88  888        88  888  88
+ *  888oooo88   888ooo8   888     888 888    88   888ooo8     888oooooo     888
+ *  888  88o    888    oo 888o  8o888 888    88   888    oo          888    888
+ * o888o  88o8 o888ooo8888  88ooo88    888oo88   o888ooo8888 o88oooo888    o888o
+ *                               88o8
+ */
+
+static void request_add(module_data_t *mod, module_decrypt_t *decrypt, void *arg
+                        , const uint8_t *key, bool is_hold, uint64_t deadline
+                        , const uint8_t *buffer, uint16_t size)
+{
+    cluster_request_t *request = malloc(sizeof(cluster_request_t));
+    request->cam = decrypt->cam;
+    request->decrypt = decrypt;
+    request->arg = arg;
+    request->is_hold = is_hold;
+    request->deadline = deadline;
+    memcpy(request->key, key, CLUSTER_KEY_SIZE);
+    request->ecm_size = size;
+    memcpy(request->ecm, buffer, size);
+    asc_list_insert_tail(mod->request_list, request);
+}
+
+/* the cam or the decrypt module may send the next ECM from the callback */
+static void request_deliver(module_data_t *mod, const uint8_t *key, const uint8_t *response)
+{
+    asc_list_first(mod->request_list);
+    while(!asc_list_eol(mod->request_list))
+    {
+        cluster_request_t *request = asc_list_data(mod->request_list);
+        if(memcmp(request->key, key, CLUSTER_KEY_SIZE) != 0)
+        {
+            asc_list_next(mod->request_list);
+            continue;
+        }
+
+        asc_list_remove_current(mod->request_list);
+        ++mod->hit;
+
+        mod->is_delivering = true;
+        request->decrypt->on_cam_response(request->decrypt->self, request->arg, response);
+        mod->is_delivering = false;
+
+        free(request);
+        asc_list_first(mod->request_list);
+    }
+}
+
+/* claim of the node with the lower id, the hold requests wait for the answer */
+static void request_yield(module_data_t *mod, const uint8_t *key, uint64_t now)
+{
+    asc_list_for(mod->request_list)
+    {
+        cluster_request_t *request = asc_list_data(mod->request_list);
+        if(request->is_hold && !memcmp(request->key, key, CLUSTER_KEY_SIZE))
+        {
+            request->is_hold = false;
+            request->deadline = now + mod->timeout;
+            ++mod->wait;
+        }
+    }
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+
+    asc_list_first(mod->request_list);
+    while(!asc_list_eol(mod->request_list))
+    {
+        cluster_request_t *request = asc_list_data(mod->request_list);
+        if(now < request->deadline)
+        {
+            asc_list_next(mod->request_list);
+            continue;
+        }
+
+        asc_list_remove_current(mod->request_list);
+
+        if(!request->is_hold)
+        {
+            ++mod->timeout_count;
+            asc_log_debug(MSG("answer is not received (pnr:%d)"), request->decrypt->pnr);
+        }
+
+        module_cam_t *cam = request->cam;
+        cam->send_em(cam->self, request->decrypt, request->arg, request->ecm, request->ecm_size);
+
+        free(request);
+        asc_list_first(mod->request_list);
+    }
+}
+
+/*
+ * oooooooooo  ooooooooooo  oooooooo8 ooooooooooo ooooo ooooo  oooo ooooooooooo
+ *  888    888  888    88 o888     88  888    88   888   888    88   888    88
+ *  888oooo88   888ooo8   888          888ooo8     888    888  88    888ooo8
+ *  888  88o    888    oo 888o     oo  888    oo   888     88888     888    oo
+ * o888o  88o8 o888ooo8888 888oooo88  o888ooo8888 o888o     888     o888ooo8888
+ *
+ */
+
+static void on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const ssize_t len = asc_socket_recv(mod->sock, mod->buffer, sizeof(mod->buffer));
+    if(len <= 0)
+        return;
+
+    const uint8_t *buffer = mod->buffer;
+    if(   len < CLUSTER_HEADER_SIZE + SHA1_DIGEST_SIZE
+       || memcmp(buffer, CLUSTER_MAGIC, 4) != 0)
+    {
+        ++mod->auth_failed;
+        return;
+    }
+
+    const size_t size = len - SHA1_DIGEST_SIZE;
+    if(!hmac_sha1_check(&mod->hmac, buffer, size, &buffer[size]))
+    {
+        ++mod->auth_failed;
+        return;
+    }
+
+    const uint32_t node = (buffer[6] << 24) | (buffer[7] << 16) | (buffer[8] << 8) | buffer[9];
+    if(node == mod->node)
+        return; /* multicast loop */
+
+    ++mod->received;
+
+    uint64_t timestamp = 0;
+    for(int i = 10; i < 18; ++i)
+        timestamp = (timestamp << 8) | buffer[i];
+
+    const uint64_t wall = wall_time_ms();
+    const uint64_t diff = (wall > timestamp) ? (wall - timestamp) : (timestamp - wall);
+    if(diff > mod->window)
+        return;
+
+    const uint8_t *key = &buffer[18];
+    const uint64_t now = asc_utime();
+
+    switch(buffer[4])
+    {
+        case CLUSTER_CLAIM:
+        {
+            if(size != CLUSTER_HEADER_SIZE)
+                return;
+
+            cluster_item_t *item = item_find(mod, key, now);
+            if(!item)
+            {
+                item = item_get(mod, key, now);
+                item->node = node;
+            }
+            else if(!item->is_ready && node < item->node)
+            {
+                if(item->node == mod->node)
+                    request_yield(mod, key, now);
+                item->node = node;
+                item->time = now;
+            }
+            break;
+        }
+        case CLUSTER_ANSWER:
+        {
+            if(size != CLUSTER_HEADER_SIZE + CLUSTER_RESPONSE_SIZE)
+                return;
+
+            const uint8_t *response = &buffer[CLUSTER_HEADER_SIZE];
+            if(response[2] != 16)
+                return;
+
+            cluster_item_t *item = item_get(mod, key, now);
+            item->is_ready = true;
+            item->node = node;
+            item->time = now;
+            memcpy(item->response, response, CLUSTER_RESPONSE_SIZE);
+
+            request_deliver(mod, key, item->response);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void on_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    asc_log_error(MSG("socket is closed"));
+    ASC_FREE(mod->sock, asc_socket_close);
+}
+
+/*
+ *   oooooooo8     o      oooo     oooo
+ * o888     88    888      8888o   888
+ * 888           8  88     88 888o8 88
+ * 888o     oo  8oooo88    88  888  88
+ *  888oooo88 o88o  o888o o88o  8  o88o
+ *
+ */
+
+bool ecm_cluster_request(  module_decrypt_t *decrypt, void *arg
+                         , const uint8_t *buffer, uint16_t size)
+{
+    module_data_t *mod = cluster;
+    if(!mod || !mod->sock)
+        return false;
+
+    uint8_t key[CLUSTER_KEY_SIZE];
+    cluster_key(decrypt->cam->caid, buffer, size, key);
+
+    const uint64_t now = asc_utime();
+    cluster_item_t *item = item_find(mod, key, now);
+    if(item && item->is_ready)
+    {
+        ++mod->hit;
+        mod->is_delivering = true;
+        decrypt->on_cam_response(decrypt->self, arg, item->response);
+        mod->is_delivering = false;
+        return true;
+    }
+
+    if(item && item->node != mod->node)
+    {
+        ++mod->wait;
+        request_add(mod, decrypt, arg, key, false, item->time + mod->timeout, buffer, size);
+        return true;
+    }
+
+    if(!item)
+    {
+        item = item_get(mod, key, now);
+        item->node = mod->node;
+        ++mod->claim;
+        cluster_send(mod, CLUSTER_CLAIM, key, NULL);
+    }
+
+    if(!mod->hold)
+        return false;
+
+    request_add(mod, decrypt, arg, key, true, now + mod->hold, buffer, size);
+    return true;
+}
+
+void ecm_cluster_publish(  uint16_t caid, const uint8_t *ecm, uint16_t ecm_size
+                         , const uint8_t *data)
+{
+    module_data_t *mod = cluster;
+    if(!mod || mod->is_delivering || data[2] != 16)
+        return;
+
+    uint8_t key[CLUSTER_KEY_SIZE];
+    cluster_key(caid, ecm, ecm_size, key);
+
+    const uint64_t now = asc_utime();
+    cluster_item_t *item = item_get(mod, key, now);
+    item->is_ready = true;
+    item->node = mod->node;
+    item->time = now;
+    memcpy(item->response, data, CLUSTER_RESPONSE_SIZE);
+
+    ++mod->answer;
+    cluster_send(mod, CLUSTER_ANSWER, key, item->response);
+}
+
+/* requests of the decrypt module, or of all modules on the cam if decrypt is NULL */
+void ecm_cluster_flush(module_cam_t *cam, module_decrypt_t *decrypt)
+{
+    module_data_t *mod = cluster;
+    if(!mod)
+        return;
+
+    asc_list_first(mod->request_list);
+    while(!asc_list_eol(mod->request_list))
+    {
+        cluster_request_t *request = asc_list_data(mod->request_list);
+        if((decrypt) ? (request->decrypt == decrypt) : (request->cam == cam))
+        {
+            free(request);
+            asc_list_remove_current(mod->request_list);
+        }
+        else
+            asc_list_next(mod->request_list);
+    }
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, mod->node);
+    lua_setfield(lua, -2, "node");
+    lua_pushnumber(lua, (lua_Number)mod->hit);
+    lua_setfield(lua, -2, "hit");
+    lua_pushnumber(lua, (lua_Number)mod->wait);
+    lua_setfield(lua, -2, "wait");
+    lua_pushnumber(lua, (lua_Number)mod->timeout_count);
+    lua_setfield(lua, -2, "timeout");
+    lua_pushnumber(lua, (lua_Number)mod->claim);
+    lua_setfield(lua, -2, "claim");
+    lua_pushnumber(lua, (lua_Number)mod->answer);
+    lua_setfield(lua, -2, "answer");
+    lua_pushnumber(lua, (lua_Number)mod->received);
+    lua_setfield(lua, -2, "received");
+    lua_pushnumber(lua, (lua_Number)mod->auth_failed);
+    lua_setfield(lua, -2, "auth_failed");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[ecm_cluster] option 'name' is required");
+    asc_assert(cluster == NULL, MSG("only one instance is allowed"));
+
+    const char *addr = NULL;
+    module_option_string("addr", &addr, NULL);
+    asc_assert(addr != NULL, MSG("option 'addr' is required"));
+
+    int port = 0;
+    module_option_number("port", &port);
+    asc_assert(port > 0 && port <= 0xFFFF, MSG("option 'port' is required"));
+
+    const char *secret = NULL;
+    size_t secret_size = 0;
+    module_option_string("secret", &secret, &secret_size);
+    asc_assert(secret && secret_size > 0, MSG("option 'secret' is required"));
+    hmac_sha1_init(&mod->hmac, (const uint8_t *)secret, secret_size);
+
+    int value = 10;
+    module_option_number("cache", &value);
+    mod->cache = (uint64_t)value * 1000000;
+
+    value = 20;
+    module_option_number("hold", &value);
+    mod->hold = (uint64_t)value * 1000;
+
+    value = 3000;
+    module_option_number("timeout", &value);
+    mod->timeout = (uint64_t)value * 1000;
+
+    value = 30;
+    module_option_number("window", &value);
+    mod->window = (uint64_t)value * 1000;
+
+    // random id, the lower id wins the claim
+    const uint64_t seed = asc_utime() ^ ((uint64_t)getpid() << 32);
+    mod->node = crc32b((const uint8_t *)&seed, sizeof(seed));
+
+    mod->request_list = asc_list_init();
+    cluster = mod;
+
+    mod->sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(mod->sock, 1);
+    if(!asc_socket_bind(mod->sock, addr, port))
+    {
+        asc_log_error(MSG("failed to bind %s:%d"), addr, port);
+        ASC_FREE(mod->sock, asc_socket_close);
+        return;
+    }
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    if(localaddr)
+        asc_socket_set_multicast_if(mod->sock, localaddr);
+
+    value = 1;
+    module_option_number("ttl", &value);
+    asc_socket_set_multicast_ttl(mod->sock, value);
+
+    asc_socket_multicast_join(mod->sock, addr, localaddr);
+    asc_socket_set_sockaddr(mod->sock, addr, port);
+
+    asc_socket_set_on_read(mod->sock, on_read);
+    asc_socket_set_on_close(mod->sock, on_close);
+
+    mod->timer = asc_timer_init(CLUSTER_TIMER, on_timer, mod);
+
+    asc_log_info(MSG("node %08X"), mod->node);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    if(cluster == mod)
+        cluster = NULL;
+
+    ASC_FREE(mod->timer, asc_timer_destroy);
+    if(mod->sock)
+    {
+        asc_socket_multicast_leave(mod->sock);
+        ASC_FREE(mod->sock, asc_socket_close);
+    }
+
+    if(mod->request_list)
+    {
+        for(  asc_list_first(mod->request_list)
+            ; !asc_list_eol(mod->request_list)
+            ; asc_list_first(mod->request_list))
+        {
+            free(asc_list_data(mod->request_list));
+            asc_list_remove_current(mod->request_list);
+        }
+        ASC_FREE(mod->request_list, asc_list_destroy);
+    }
+}
+
+MODULE_LUA_METHODS()
+{
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(ecm_cluster)
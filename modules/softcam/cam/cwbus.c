@@ -0,0 +1,568 @@
+/*
+ * Astra Module: SoftCAM. Control Word Bus
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Control words pushed by the external key server to the UDP port or to the
+ * multicast group. The card server decodes each ECM once and publishes the
+ * keys, all decrypt modules of the service receive the keys from the bus
+ * without requests. ECMs are not sent anywhere: the decrypt module is
+ * subscribed to the service by the ECM and receives the current keys at once.
+ *
+ * Datagram, big-endian:
+ *      0   4   magic "CWB1"
+ *      4   8   timestamp, milliseconds since the Epoch
+ *      12  2   record count
+ *      14      records, 18 bytes each:
+ *              0   2   CAID
+ *              2   2   PNR of the service (cas_pnr of the decrypt module)
+ *              4   2   ECM PID
+ *              6   1   parity: 0 - even, 1 - odd
+ *              7   1   reserved, 0
+ *              8   2   validity, seconds. 0 - until the next key
+ *              10  8   control word
+ *      end 20  HMAC-SHA1 of the datagram with the shared secret
+ *
+ * The datagram is dropped if the signature is wrong or the timestamp is out
+ * of the window. The key is dropped if the key of the same parity has a newer
+ * timestamp: the replayed datagram does not bring the old keys back.
+ *
+ * Module Name:
+ *      cw_bus
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      caid        - number, CAID of the services. selects the CAS module of
+ *                    the decrypt, records with other CAID are dropped
+ *      secret      - string, shared secret of the HMAC
+ *      addr        - string, multicast group or local address.
+ *                    default: 0.0.0.0
+ *      port        - number, UDP port
+ *      localaddr   - string, IP address of the local interface for multicast
+ *      socket_size - number, socket buffer size
+ *      window      - number, seconds, maximum difference of the timestamp and
+ *                    the local clock. default: 30
+ *
+ * Module Methods:
+ *      cam()       - return cam instance for the decrypt module
+ *      stat()      - return table: received, records, auth_failed, replayed,
+ *                    services, subscribers, delivered
+ */
+
+#include <astra.h>
+#include "../module_cam.h"
+
+#define MSG(_msg) "[cw_bus %s] " _msg, mod->name
+
+#define CW_BUS_MAGIC "CWB1"
+#define CW_BUS_HEADER_SIZE 14
+#define CW_BUS_RECORD_SIZE 18
+#define CW_BUS_BUFFER_SIZE 1500
+#define CW_BUS_HASH_SIZE 1024
+#define CW_BUS_TIMER 10000 // ms, cleanup of the subscribers
+
+typedef struct cw_service_t cw_service_t;
+
+/* decrypt module and the stream of the ECM PID */
+typedef struct
+{
+    module_decrypt_t *decrypt;
+    void *arg;
+} cw_subscriber_t;
+
+struct cw_service_t
+{
+    uint16_t pnr;
+    uint16_t ecm_pid;
+
+    uint8_t cw[16];
+    uint64_t timestamp[2]; // ms, of the key source
+    uint64_t expire[2]; // us, 0 - not expired
+
+    asc_list_t *subscribers;
+
+    cw_service_t *next;
+};
+
+struct module_data_t
+{
+    MODULE_CAM_DATA();
+
+    const char *name;
+    uint64_t window; // ms
+
+    asc_socket_t *sock;
+    asc_timer_t *timer;
+
+    hmac_sha1_t hmac;
+
+    cw_service_t *hash[CW_BUS_HASH_SIZE];
+    uint32_t service_count;
+
+    uint64_t received;
+    uint64_t records;
+    uint64_t auth_failed;
+    uint64_t replayed;
+    uint64_t delivered;
+
+    uint8_t buffer[CW_BUS_BUFFER_SIZE];
+};
+
+/*
+ *  oooooooo8 ooooooooooo oooooooooo ooooo  oooo ooooo  oooooooo8 ooooooooooo
+ * 888         888    88   888    888 888    88   888 o888     88  888    88
+ *  888oooooo  888ooo8     888oooo88   888  88    888 888          888ooo8
+ *         888 888    oo   888  88o     88888     888 888o     oo  888    oo
+ * o88oooo888 o888ooo8888 o888o  88o8    888     o888o 888oooo88  o888ooo8888
+ *
+ */
+
+static inline uint32_t service_hash(uint16_t pnr, uint16_t ecm_pid)
+{
+    return ((uint32_t)pnr * 31 + ecm_pid) % CW_BUS_HASH_SIZE;
+}
+
+static cw_service_t * service_find(module_data_t *mod, uint16_t pnr, uint16_t ecm_pid)
+{
+    cw_service_t *service = mod->hash[service_hash(pnr, ecm_pid)];
+    while(service)
+    {
+        if(service->pnr == pnr && service->ecm_pid == ecm_pid)
+            return service;
+        service = service->next;
+    }
+    return NULL;
+}
+
+static cw_service_t * service_get(module_data_t *mod, uint16_t pnr, uint16_t ecm_pid)
+{
+    cw_service_t *service = service_find(mod, pnr, ecm_pid);
+    if(service)
+        return service;
+
+    const uint32_t hash = service_hash(pnr, ecm_pid);
+    service = asc_calloc(mod->__cam.memstat, 1, sizeof(cw_service_t));
+    service->pnr = pnr;
+    service->ecm_pid = ecm_pid;
+    service->subscribers = asc_list_init();
+    service->next = mod->hash[hash];
+    mod->hash[hash] = service;
+    ++mod->service_count;
+
+    return service;
+}
+
+static void service_clear_subscribers(cw_service_t *service)
+{
+    for(  asc_list_first(service->subscribers)
+        ; !asc_list_eol(service->subscribers)
+        ; asc_list_first(service->subscribers))
+    {
+        free(asc_list_data(service->subscribers));
+        asc_list_remove_current(service->subscribers);
+    }
+}
+
+static bool service_is_valid(const cw_service_t *service, int parity, uint64_t now)
+{
+    return service->timestamp[parity] && (!service->expire[parity] || service->expire[parity] > now);
+}
+
+static bool is_attached(module_data_t *mod, module_decrypt_t *decrypt)
+{
+    asc_list_for(mod->__cam.decrypt_list)
+    {
+        if(asc_list_data(mod->__cam.decrypt_list) == decrypt)
+            return true;
+    }
+    return false;
+}
+
+/* response of the cam, the expired key is replaced with zeros */
+static void service_response(cw_service_t *service, int parity, uint8_t *data)
+{
+    const uint64_t now = asc_utime();
+
+    data[0] = 0x80 | parity;
+    data[1] = 0x00;
+    data[2] = 16;
+    for(int i = 0; i < 2; ++i)
+    {
+        uint8_t *cw = &data[3 + i * 8];
+        if(service_is_valid(service, i, now))
+            memcpy(cw, &service->cw[i * 8], 8);
+        else
+            memset(cw, 0, 8);
+    }
+}
+
+/* keys of the service to all subscribers, detached decrypt modules are removed */
+static void service_deliver(module_data_t *mod, cw_service_t *service, int parity)
+{
+    uint8_t data[3 + 16];
+    service_response(service, parity, data);
+
+    asc_list_first(service->subscribers);
+    while(!asc_list_eol(service->subscribers))
+    {
+        cw_subscriber_t *subscriber = asc_list_data(service->subscribers);
+        if(!is_attached(mod, subscriber->decrypt))
+        {
+            free(subscriber);
+            asc_list_remove_current(service->subscribers);
+            continue;
+        }
+
+        ++mod->delivered;
+        subscriber->decrypt->on_cam_response(subscriber->decrypt->self, subscriber->arg, data);
+        asc_list_next(service->subscribers);
+    }
+}
+
+/*
+ * oooooooooo  ooooooooooo  oooooooo8 ooooooooooo ooooo ooooo  oooo ooooooooooo
+ *  888    888  888    88 o888     88  888    88   888   888    88   888    88
+ *  888oooo88   888ooo8   888          888ooo8     888    888  88    888ooo8
+ *  888  88o    888    oo 888o     oo  888    oo   888     88888     888    oo
+ * o888o  88o8 o888ooo8888 888oooo88  o888ooo8888 o888o     888     o888ooo8888
+ *
+ */
+
+static uint64_t wall_time_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void on_record(module_data_t *mod, const uint8_t *record, uint64_t timestamp)
+{
+    const uint16_t caid = (record[0] << 8) | record[1];
+    if(caid != mod->__cam.caid)
+        return;
+
+    const uint16_t pnr = (record[2] << 8) | record[3];
+    const uint16_t ecm_pid = ((record[4] << 8) | record[5]) & 0x1FFF;
+    const int parity = record[6] & 0x01;
+    const uint16_t validity = (record[8] << 8) | record[9];
+    const uint8_t *cw = &record[10];
+
+    cw_service_t *service = service_get(mod, pnr, ecm_pid);
+    if(timestamp <= service->timestamp[parity])
+    {
+        ++mod->replayed;
+        return;
+    }
+
+    uint8_t *key = &service->cw[parity * 8];
+    const bool is_changed = (  !service_is_valid(service, parity, asc_utime())
+                             || memcmp(key, cw, 8) != 0);
+
+    // checksum of the key, see on_cam_response() of the decrypt module
+    memcpy(key, cw, 8);
+    key[3] = (key[0] + key[1] + key[2]) & 0xFF;
+    key[7] = (key[4] + key[5] + key[6]) & 0xFF;
+
+    service->timestamp[parity] = timestamp;
+    service->expire[parity] = (validity) ? (asc_utime() + (uint64_t)validity * 1000000) : 0;
+
+    if(is_changed)
+        service_deliver(mod, service, parity);
+}
+
+static void on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const ssize_t len = asc_socket_recv(mod->sock, mod->buffer, sizeof(mod->buffer));
+    if(len <= 0)
+        return;
+
+    ++mod->received;
+
+    const uint8_t *buffer = mod->buffer;
+    if(len < CW_BUS_HEADER_SIZE + SHA1_DIGEST_SIZE || memcmp(buffer, CW_BUS_MAGIC, 4) != 0)
+    {
+        ++mod->auth_failed;
+        return;
+    }
+
+    const size_t size = len - SHA1_DIGEST_SIZE;
+    if(!hmac_sha1_check(&mod->hmac, buffer, size, &buffer[size]))
+    {
+        ++mod->auth_failed;
+        return;
+    }
+
+    uint64_t timestamp = 0;
+    for(int i = 4; i < 12; ++i)
+        timestamp = (timestamp << 8) | buffer[i];
+
+    const uint64_t now = wall_time_ms();
+    const uint64_t diff = (now > timestamp) ? (now - timestamp) : (timestamp - now);
+    if(diff > mod->window)
+    {
+        ++mod->replayed;
+        return;
+    }
+
+    const size_t count = (buffer[12] << 8) | buffer[13];
+    if(CW_BUS_HEADER_SIZE + count * CW_BUS_RECORD_SIZE != size)
+    {
+        asc_log_error(MSG("wrong datagram size %zd for %zu records"), len, count);
+        return;
+    }
+
+    mod->records += count;
+    for(size_t i = 0; i < count; ++i)
+        on_record(mod, &buffer[CW_BUS_HEADER_SIZE + i * CW_BUS_RECORD_SIZE], timestamp);
+}
+
+static void on_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    asc_log_error(MSG("socket is closed"));
+    ASC_FREE(mod->sock, asc_socket_close);
+}
+
+/* subscribers of the detached decrypt modules */
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    for(int i = 0; i < CW_BUS_HASH_SIZE; ++i)
+    {
+        for(cw_service_t *service = mod->hash[i]; service; service = service->next)
+        {
+            asc_list_first(service->subscribers);
+            while(!asc_list_eol(service->subscribers))
+            {
+                cw_subscriber_t *subscriber = asc_list_data(service->subscribers);
+                if(is_attached(mod, subscriber->decrypt))
+                {
+                    asc_list_next(service->subscribers);
+                    continue;
+                }
+                free(subscriber);
+                asc_list_remove_current(service->subscribers);
+            }
+        }
+    }
+}
+
+/*
+ *   oooooooo8     o      oooo     oooo
+ * o888     88    888      8888o   888
+ * 888           8  88     88 888o8 88
+ * 888o     oo  8oooo88    88  888  88
+ *  888oooo88 o88o  o888o o88o  8  o88o
+ *
+ */
+
+static void cw_bus_connect(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+static void cw_bus_disconnect(module_data_t *mod)
+{
+    for(int i = 0; i < CW_BUS_HASH_SIZE; ++i)
+    {
+        for(cw_service_t *service = mod->hash[i]; service; service = service->next)
+            service_clear_subscribers(service);
+    }
+}
+
+/* EMMs are not used by the bus */
+static void cw_bus_send_em(  module_data_t *mod
+                           , module_decrypt_t *decrypt, void *arg
+                           , const uint8_t *buffer, uint16_t size)
+{
+    __uarg(mod);
+    __uarg(decrypt);
+    __uarg(arg);
+    __uarg(buffer);
+    __uarg(size);
+}
+
+/* subscription of the stream, the current keys are delivered at once */
+static void cw_bus_send_ecm(  module_data_t *mod
+                            , module_decrypt_t *decrypt, void *arg, uint16_t ecm_pid
+                            , const uint8_t *buffer, uint16_t size)
+{
+    __uarg(size);
+
+    const uint16_t pnr = (decrypt->cas_pnr) ? decrypt->cas_pnr : decrypt->pnr;
+    cw_service_t *service = service_get(mod, pnr, ecm_pid);
+
+    cw_subscriber_t *subscriber = NULL;
+    asc_list_for(service->subscribers)
+    {
+        cw_subscriber_t *i = asc_list_data(service->subscribers);
+        if(i->decrypt == decrypt)
+        {
+            subscriber = i;
+            break;
+        }
+    }
+    if(!subscriber)
+    {
+        subscriber = malloc(sizeof(cw_subscriber_t));
+        subscriber->decrypt = decrypt;
+        asc_list_insert_tail(service->subscribers, subscriber);
+    }
+    // the stream is replaced on PMT change
+    subscriber->arg = arg;
+
+    const uint64_t now = asc_utime();
+    if(!service_is_valid(service, 0, now) && !service_is_valid(service, 1, now))
+        return;
+
+    uint8_t data[3 + 16];
+    service_response(service, buffer[0] & 0x01, data);
+    ++mod->delivered;
+    decrypt->on_cam_response(decrypt->self, arg, data);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_stat(module_data_t *mod)
+{
+    uint32_t subscribers = 0;
+    for(int i = 0; i < CW_BUS_HASH_SIZE; ++i)
+    {
+        for(cw_service_t *service = mod->hash[i]; service; service = service->next)
+            subscribers += asc_list_size(service->subscribers);
+    }
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, (lua_Number)mod->received);
+    lua_setfield(lua, -2, "received");
+    lua_pushnumber(lua, (lua_Number)mod->records);
+    lua_setfield(lua, -2, "records");
+    lua_pushnumber(lua, (lua_Number)mod->auth_failed);
+    lua_setfield(lua, -2, "auth_failed");
+    lua_pushnumber(lua, (lua_Number)mod->replayed);
+    lua_setfield(lua, -2, "replayed");
+    lua_pushnumber(lua, mod->service_count);
+    lua_setfield(lua, -2, "services");
+    lua_pushnumber(lua, subscribers);
+    lua_setfield(lua, -2, "subscribers");
+    lua_pushnumber(lua, (lua_Number)mod->delivered);
+    lua_setfield(lua, -2, "delivered");
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[cw_bus] option 'name' is required");
+
+    int caid = 0;
+    module_option_number("caid", &caid);
+    asc_assert(caid > 0 && caid <= 0xFFFF, MSG("option 'caid' is required"));
+
+    const char *secret = NULL;
+    size_t secret_size = 0;
+    module_option_string("secret", &secret, &secret_size);
+    asc_assert(secret && secret_size > 0, MSG("option 'secret' is required"));
+    hmac_sha1_init(&mod->hmac, (const uint8_t *)secret, secret_size);
+
+    int port = 0;
+    module_option_number("port", &port);
+    asc_assert(port > 0 && port <= 0xFFFF, MSG("option 'port' is required"));
+
+    const char *addr = "0.0.0.0";
+    module_option_string("addr", &addr, NULL);
+
+    int window = 30;
+    module_option_number("window", &window);
+    mod->window = (uint64_t)window * 1000;
+
+    module_cam_init(mod, cw_bus_connect, cw_bus_disconnect, cw_bus_send_em);
+    mod->__cam.send_ecm = cw_bus_send_ecm;
+    mod->__cam.caid = (uint16_t)caid;
+    mod->__cam.disable_emm = true;
+
+    mod->sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(mod->sock, 1);
+    if(!asc_socket_bind(mod->sock, addr, port))
+    {
+        asc_log_error(MSG("failed to bind %s:%d"), addr, port);
+        ASC_FREE(mod->sock, asc_socket_close);
+        return;
+    }
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(mod->sock, value, 0);
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    asc_socket_multicast_join(mod->sock, addr, localaddr);
+
+    asc_socket_set_on_read(mod->sock, on_read);
+    asc_socket_set_on_close(mod->sock, on_close);
+
+    mod->timer = asc_timer_init(CW_BUS_TIMER, on_timer, mod);
+
+    // keys are expected from the bus, the decrypt modules start at once
+    module_cam_ready(&mod->__cam);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_cam_destroy(mod);
+
+    ASC_FREE(mod->timer, asc_timer_destroy);
+    if(mod->sock)
+    {
+        asc_socket_multicast_leave(mod->sock);
+        ASC_FREE(mod->sock, asc_socket_close);
+    }
+
+    for(int i = 0; i < CW_BUS_HASH_SIZE; ++i)
+    {
+        cw_service_t *service = mod->hash[i];
+        while(service)
+        {
+            cw_service_t *next = service->next;
+            service_clear_subscribers(service);
+            asc_list_destroy(service->subscribers);
+            asc_free(service);
+            service = next;
+        }
+        mod->hash[i] = NULL;
+    }
+}
+
+MODULE_CAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_CAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(cw_bus)
@@ -0,0 +1,770 @@
+/*
+ * Astra Module: SoftCAM. CAM Group
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Several card servers with the same card behind one cam object. Each ECM
+ * goes to the ready backend with the lowest expected response time: average
+ * RTT weighted by the success rate, not measured backends are tried first.
+ * If the response is not received in the hedge time the ECM is sent to the
+ * next backend as well, the first valid response is used. "Not found" moves
+ * the ECM to the next backend at once. EMMs are sent to all ready backends.
+ *
+ * Module Name:
+ *      cam_group
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      cam         - list, cam instances returned by cam_module_instance:cam().
+ *                    the first ready backend gives CAID and the providers
+ *      hedge       - number, milliseconds to wait for the response before the
+ *                    ECM is sent to the next backend. default: 500
+ *      timeout     - number, milliseconds to wait for the response of any
+ *                    backend. default: 5000
+ *      emm_rate    - number, EMMs per second of each table id, 0 - not limited.
+ *                    default: 20
+ *
+ * Module Methods:
+ *      cam()       - return cam instance for the decrypt module
+ *      stat()      - return list of the backends: ready, rtt (ms), success (%),
+ *                    ok, fail, timeout, hedged
+ */
+
+#include <astra.h>
+#include "../module_cam.h"
+
+#define MSG(_msg) "[cam_group %s] " _msg, mod->name
+
+#define CAM_GROUP_MAX 8
+#define CAM_GROUP_PROV_MAX 16
+#define CAM_GROUP_PROV_SIZE (3 + 8) /* ident + sa, see newcamd.c */
+#define CAM_GROUP_TIMER 50 // ms, hedge and timeout check
+
+/* success rate, 1/1000 */
+#define SUCCESS_MAX 1000
+#define SUCCESS_MIN 50
+
+typedef struct group_member_t group_member_t;
+
+/* group as the decrypt module on the backend, self of the link is group_link_t */
+typedef struct
+{
+    module_decrypt_t link;
+    group_member_t *member;
+    int backend;
+} group_link_t;
+
+/* decrypt module attached to the group, has own link on each backend for the pnr */
+struct group_member_t
+{
+    module_data_t *mod;
+    module_decrypt_t *decrypt;
+    group_link_t link[CAM_GROUP_MAX];
+};
+
+typedef struct
+{
+    module_data_t *mod;
+    module_cam_t *cam;
+    module_decrypt_t link; // ready and error events, self is group_backend_t
+
+    uint64_t rtt; // average, us. 0 - not measured
+    uint32_t success; // average, 1/1000
+
+    uint64_t ok;
+    uint64_t fail;
+    uint64_t timeout;
+    uint64_t hedged;
+} group_backend_t;
+
+/* ECM in progress, by the decrypt module and the stream */
+typedef struct
+{
+    group_member_t *member;
+    void *arg;
+
+    bool is_done;
+    uint8_t sent; // mask of the backends
+    uint8_t pending;
+    uint64_t time; // first send
+    uint64_t last_time; // last send, for the hedge
+    uint64_t send_time[CAM_GROUP_MAX];
+
+    uint16_t ecm_size;
+    uint8_t ecm[EM_MAX_SIZE];
+} group_request_t;
+
+struct module_data_t
+{
+    MODULE_CAM_DATA();
+
+    const char *name;
+    uint64_t hedge; // us
+    uint64_t timeout; // us
+
+    group_backend_t backend[CAM_GROUP_MAX];
+    int backend_count;
+    int primary; // backend of CAID and the providers, -1 if not ready
+
+    bool is_connected;
+    asc_list_t *member_list;
+    asc_list_t *request_list;
+    asc_timer_t *timer;
+
+    uint8_t prov_buffer[CAM_GROUP_PROV_MAX * CAM_GROUP_PROV_SIZE];
+};
+
+static void on_link_ready(module_data_t *arg);
+static void on_link_error(module_data_t *arg);
+static void on_link_response(module_data_t *arg, void *stream, const uint8_t *data);
+
+/*
+ * oooooooooo      o       oooooooo8 oooo   oooo ooooooooooo oooo   oooo ooooooooo
+ *  888    888    888    o888     88  888  o88    888    88   8888o  88   888    88o
+ *  888oooo88    8  88   888          888888      888ooo8     88 888o88   888    888
+ *  888    888  8oooo88  888o     oo  888  88o    888    oo   88   8888   888    888
+ * o888ooo888 o88o  o888o 888oooo88  o888o o888o o888ooo8888 o88o    88  o888ooo88
+ *
+ */
+
+/* expected response time, us */
+static inline uint64_t backend_score(const group_backend_t *backend)
+{
+    const uint32_t success = (backend->success > SUCCESS_MIN) ? backend->success : SUCCESS_MIN;
+    return backend->rtt * SUCCESS_MAX / success;
+}
+
+static void backend_result(group_backend_t *backend, bool is_ok, uint64_t rtt)
+{
+    backend->rtt = (backend->rtt) ? ((backend->rtt * 7 + rtt) / 8) : rtt;
+    backend->success = (backend->success * 7 + ((is_ok) ? SUCCESS_MAX : 0)) / 8;
+}
+
+/* the best ready backend which has not received the ECM, -1 if not found */
+static int backend_select(module_data_t *mod, uint8_t exclude)
+{
+    int best = -1;
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        const group_backend_t *backend = &mod->backend[i];
+        if(!backend->cam->is_ready || (exclude & (1 << i)))
+            continue;
+
+        if(best == -1 || backend_score(backend) < backend_score(&mod->backend[best]))
+            best = i;
+    }
+    return best;
+}
+
+/*
+ * oooooooooo  ooooooooooo  ooooooo  ooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
+ *  888    888  888    88 o888   888o 888    88   888    88  888        88  888  88
+ *  888oooo88   888ooo8   888     888 888    88   888ooo8     888oooooo     888
+ *  888  88o    888    oo 888o  8o888 888    88   888    oo          888    888
+ * o888o  88o8 o888ooo8888  88ooo88    888oo88   o888ooo8888 o88oooo888    o888o
+ *                               88o8
+ */
+
+static void request_send(module_data_t *mod, group_request_t *request, int b)
+{
+    group_member_t *member = request->member;
+    group_link_t *link = &member->link[b];
+    link->link.pnr = member->decrypt->pnr;
+    link->link.cas_pnr = member->decrypt->cas_pnr;
+
+    const uint64_t now = asc_utime();
+    request->sent |= (1 << b);
+    request->pending |= (1 << b);
+    request->send_time[b] = now;
+    request->last_time = now;
+
+    module_cam_t *cam = mod->backend[b].cam;
+    cam->send_em(cam->self, &link->link, request->arg, request->ecm, request->ecm_size);
+}
+
+/* ECM goes to the next backend, false if all ready backends have received it */
+static bool request_next(module_data_t *mod, group_request_t *request)
+{
+    const int b = backend_select(mod, request->sent);
+    if(b == -1)
+        return false;
+
+    request_send(mod, request, b);
+    return true;
+}
+
+static group_request_t * request_find(module_data_t *mod, group_member_t *member, void *arg)
+{
+    asc_list_for(mod->request_list)
+    {
+        group_request_t *request = asc_list_data(mod->request_list);
+        if(request->member == member && request->arg == arg)
+            return request;
+    }
+    return NULL;
+}
+
+static void request_free(module_data_t *mod, group_request_t *request)
+{
+    asc_list_remove_item(mod->request_list, request);
+    asc_free(request);
+}
+
+/*
+ * the response is delivered after the request is done, the decrypt module
+ * may send the next ECM of the stream from the callback
+ */
+static void request_response(module_data_t *mod, group_request_t *request, const uint8_t *data)
+{
+    module_decrypt_t *decrypt = request->member->decrypt;
+    void *arg = request->arg;
+
+    request->is_done = true;
+    if(!request->pending)
+        request_free(mod, request);
+
+    asc_list_for(mod->__cam.decrypt_list)
+    {
+        if(asc_list_data(mod->__cam.decrypt_list) == decrypt)
+        {
+            decrypt->on_cam_response(decrypt->self, arg, data);
+            return;
+        }
+    }
+}
+
+/* all backends have failed, the decrypt module requests ECM again */
+static void request_fail(module_data_t *mod, group_request_t *request)
+{
+    uint8_t data[3 + 16];
+    memset(data, 0, sizeof(data));
+    data[0] = request->ecm[0];
+
+    request_response(mod, request, data);
+}
+
+/*
+ * oooo     oooo ooooooooooo oooo     oooo oooooooooo  ooooooooooo oooooooooo
+ *  8888o   888   888    88   8888o   888   888    888  888    88   888    888
+ *  88 888o8 88   888ooo8     88 888o8 88   888oooo88   888ooo8     888oooo88
+ *  88  888  88   888    oo   88  888  88   888    888  888    oo   888  88o
+ * o88o  8  o88o o888ooo8888 o88o  8  o88o o888ooo888  o888ooo8888 o888o  88o8
+ *
+ */
+
+static group_member_t * member_get(module_data_t *mod, module_decrypt_t *decrypt)
+{
+    asc_list_for(mod->member_list)
+    {
+        group_member_t *member = asc_list_data(mod->member_list);
+        if(member->decrypt == decrypt)
+            return member;
+    }
+
+    group_member_t *member = calloc(1, sizeof(group_member_t));
+    member->mod = mod;
+    member->decrypt = decrypt;
+    asc_list_insert_tail(mod->member_list, member);
+
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        group_link_t *link = &member->link[i];
+        link->member = member;
+        link->backend = i;
+        link->link.self = (module_data_t *)link;
+        link->link.cam = mod->backend[i].cam;
+        link->link.pnr = decrypt->pnr;
+        link->link.cas_pnr = decrypt->cas_pnr;
+        link->link.on_cam_ready = on_link_ready;
+        link->link.on_cam_error = on_link_error;
+        link->link.on_cam_response = on_link_response;
+        module_cam_attach_decrypt(link->link.cam, &link->link);
+    }
+
+    return member;
+}
+
+static void member_destroy(module_data_t *mod, group_member_t *member)
+{
+    asc_list_first(mod->request_list);
+    while(!asc_list_eol(mod->request_list))
+    {
+        group_request_t *request = asc_list_data(mod->request_list);
+        if(request->member == member)
+        {
+            asc_free(request);
+            asc_list_remove_current(mod->request_list);
+        }
+        else
+            asc_list_next(mod->request_list);
+    }
+
+    for(int i = 0; i < mod->backend_count; ++i)
+        module_cam_detach_decrypt(mod->backend[i].cam, &member->link[i].link);
+
+    asc_list_remove_item(mod->member_list, member);
+    free(member);
+}
+
+/* members of the detached decrypt modules */
+static void member_cleanup(module_data_t *mod)
+{
+    asc_list_first(mod->member_list);
+    while(!asc_list_eol(mod->member_list))
+    {
+        group_member_t *member = asc_list_data(mod->member_list);
+
+        bool is_attached = false;
+        asc_list_for(mod->__cam.decrypt_list)
+        {
+            if(asc_list_data(mod->__cam.decrypt_list) == member->decrypt)
+            {
+                is_attached = true;
+                break;
+            }
+        }
+
+        if(is_attached)
+        {
+            asc_list_next(mod->member_list);
+            continue;
+        }
+
+        member_destroy(mod, member);
+        asc_list_first(mod->member_list);
+    }
+}
+
+/*
+ * ooooo       ooooo oooo   oooo oooo   oooo
+ *  888         888   8888o  88   888  o88
+ *  888         888   88 888o88   888888
+ *  888      o  888   88   8888   888  88o
+ * o888ooooo88 o888o o88o    88  o888o o888o
+ *
+ */
+
+/* readiness of the backend is tracked by the backend link */
+static void on_link_ready(module_data_t *arg)
+{
+    __uarg(arg);
+}
+
+static void on_link_error(module_data_t *arg)
+{
+    __uarg(arg);
+}
+
+static void on_link_response(module_data_t *arg, void *stream, const uint8_t *data)
+{
+    group_link_t *link = (group_link_t *)arg;
+    module_data_t *mod = link->member->mod;
+    const int b = link->backend;
+
+    if((data[0] & ~0x01) != 0x80)
+        return; /* Skip EMM */
+
+    group_request_t *request = request_find(mod, link->member, stream);
+    if(!request || !(request->pending & (1 << b)))
+        return; /* expired or replaced with the next ECM */
+
+    request->pending &= ~(1 << b);
+
+    group_backend_t *backend = &mod->backend[b];
+    const bool is_ok = (data[2] == 16);
+    backend_result(backend, is_ok, asc_utime() - request->send_time[b]);
+    if(is_ok)
+        ++backend->ok;
+    else
+        ++backend->fail;
+
+    if(request->is_done)
+    {
+        if(!request->pending)
+            request_free(mod, request);
+        return;
+    }
+
+    if(is_ok)
+    {
+        request_response(mod, request, data);
+        return;
+    }
+
+    // not found, the next backend in order of the score
+    if(request_next(mod, request))
+        return;
+
+    if(!request->pending)
+        request_response(mod, request, data);
+}
+
+/*
+ * ooooooooo  oooo   oooo oooooooooo ooooooooooo ooooooooooo
+ * 888    88o  8888o  88   888    888 888    88  88  888  88
+ * 888    888  88 888o88   888oooo88  888ooo8        888
+ * 888    888  88   8888   888  88o   888    oo      888
+ * o888ooo88  o88o    88  o888o  88o8 o888ooo8888    o888o
+ *
+ */
+
+/* the first ready backend gives CAID, UA and the providers to the group */
+static void group_update(module_data_t *mod)
+{
+    module_cam_t *cam = &mod->__cam;
+
+    int primary = -1;
+    bool disable_emm = true;
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        const module_cam_t *backend_cam = mod->backend[i].cam;
+        if(!backend_cam->is_ready)
+            continue;
+
+        if(primary == -1)
+            primary = i;
+        if(!backend_cam->disable_emm)
+            disable_emm = false;
+    }
+
+    if(primary == -1)
+    {
+        mod->primary = -1;
+        if(cam->is_ready)
+        {
+            asc_log_warning(MSG("all backends are down"));
+            module_cam_reset(cam);
+        }
+        return;
+    }
+
+    cam->disable_emm = disable_emm;
+    if(primary == mod->primary)
+        return;
+
+    const module_cam_t *primary_cam = mod->backend[primary].cam;
+    if(cam->is_ready && cam->caid != primary_cam->caid)
+    {
+        asc_log_warning(MSG("CaID changed 0x%04X -> 0x%04X"), cam->caid, primary_cam->caid);
+        module_cam_reset(cam);
+        cam->disable_emm = disable_emm;
+    }
+
+    mod->primary = primary;
+    cam->caid = primary_cam->caid;
+    memcpy(cam->ua, primary_cam->ua, sizeof(cam->ua));
+
+    for(  asc_list_first(cam->prov_list)
+        ; !asc_list_eol(cam->prov_list)
+        ; asc_list_first(cam->prov_list))
+    {
+        asc_list_remove_current(cam->prov_list);
+    }
+
+    int prov_count = 0;
+    asc_list_for(primary_cam->prov_list)
+    {
+        if(prov_count >= CAM_GROUP_PROV_MAX)
+            break;
+
+        uint8_t *p = &mod->prov_buffer[prov_count * CAM_GROUP_PROV_SIZE];
+        memcpy(p, asc_list_data(primary_cam->prov_list), CAM_GROUP_PROV_SIZE);
+        asc_list_insert_tail(cam->prov_list, p);
+        ++prov_count;
+    }
+
+    asc_log_info(MSG("primary backend #%d CaID=0x%04X"), primary + 1, cam->caid);
+
+    if(!cam->is_ready)
+        module_cam_ready(cam);
+}
+
+static void on_backend_ready(module_data_t *arg)
+{
+    group_backend_t *backend = (group_backend_t *)arg;
+    group_update(backend->mod);
+}
+
+static void on_backend_error(module_data_t *arg)
+{
+    group_backend_t *backend = (group_backend_t *)arg;
+    module_data_t *mod = backend->mod;
+    const int b = (int)(backend - mod->backend);
+
+    // the queue of the backend is flushed, requests are sent again on the timer
+    asc_list_for(mod->request_list)
+    {
+        group_request_t *request = asc_list_data(mod->request_list);
+        request->pending &= ~(1 << b);
+    }
+
+    group_update(mod);
+}
+
+static void on_backend_response(module_data_t *arg, void *stream, const uint8_t *data)
+{
+    __uarg(arg);
+    __uarg(stream);
+    __uarg(data);
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t now = asc_utime();
+
+    member_cleanup(mod);
+
+    // hedge and failover, the response is not delivered here
+    asc_list_for(mod->request_list)
+    {
+        group_request_t *request = asc_list_data(mod->request_list);
+        if(request->is_done || now - request->time >= mod->timeout)
+            continue;
+
+        if(!request->pending)
+            request_next(mod, request);
+        else if(mod->hedge && now - request->last_time >= mod->hedge)
+        {
+            const int b = backend_select(mod, request->sent);
+            if(b != -1)
+            {
+                ++mod->backend[b].hedged;
+                request_send(mod, request, b);
+            }
+        }
+    }
+
+    // expired, restart the loop after each callback
+    asc_list_first(mod->request_list);
+    while(!asc_list_eol(mod->request_list))
+    {
+        group_request_t *request = asc_list_data(mod->request_list);
+        const bool is_stalled = (!request->is_done && !request->pending);
+        if(!is_stalled && now - request->time < mod->timeout)
+        {
+            asc_list_next(mod->request_list);
+            continue;
+        }
+
+        for(int i = 0; i < mod->backend_count; ++i)
+        {
+            if(!(request->pending & (1 << i)))
+                continue;
+
+            group_backend_t *backend = &mod->backend[i];
+            ++backend->timeout;
+            backend_result(backend, false, now - request->send_time[i]);
+        }
+        request->pending = 0;
+
+        if(request->is_done)
+            request_free(mod, request);
+        else
+        {
+            asc_log_warning(MSG("ECM 0x%02X is not received (pnr:%d)")
+                            , request->ecm[0], request->member->decrypt->pnr);
+            request_fail(mod, request);
+        }
+        asc_list_first(mod->request_list);
+    }
+}
+
+static void group_connect(module_data_t *mod)
+{
+    if(mod->is_connected)
+        return;
+    mod->is_connected = true;
+
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        group_backend_t *backend = &mod->backend[i];
+        module_cam_attach_decrypt(backend->cam, &backend->link);
+    }
+
+    mod->timer = asc_timer_init(CAM_GROUP_TIMER, on_timer, mod);
+}
+
+static void group_disconnect(module_data_t *mod)
+{
+    if(!mod->is_connected)
+        return;
+    mod->is_connected = false;
+
+    ASC_FREE(mod->timer, asc_timer_destroy);
+
+    for(  asc_list_first(mod->member_list)
+        ; !asc_list_eol(mod->member_list)
+        ; asc_list_first(mod->member_list))
+    {
+        member_destroy(mod, asc_list_data(mod->member_list));
+    }
+
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        group_backend_t *backend = &mod->backend[i];
+        module_cam_detach_decrypt(backend->cam, &backend->link);
+    }
+
+    mod->primary = -1;
+    module_cam_reset(&mod->__cam);
+}
+
+static void group_send_em(  module_data_t *mod
+                          , module_decrypt_t *decrypt, void *arg
+                          , const uint8_t *buffer, uint16_t size)
+{
+    if(!mod->__cam.is_ready)
+        return;
+
+    group_member_t *member = member_get(mod, decrypt);
+
+    if((buffer[0] & ~0x01) != 0x80)
+    {
+        // EMM
+        for(int i = 0; i < mod->backend_count; ++i)
+        {
+            module_cam_t *cam = mod->backend[i].cam;
+            if(!cam->is_ready || cam->disable_emm)
+                continue;
+
+            group_link_t *link = &member->link[i];
+            link->link.pnr = decrypt->pnr;
+            link->link.cas_pnr = decrypt->cas_pnr;
+            cam->send_em(cam->self, &link->link, arg, buffer, size);
+        }
+        return;
+    }
+
+    // the previous ECM of the stream is not actual
+    group_request_t *request = request_find(mod, member, arg);
+    if(request)
+        request_free(mod, request);
+
+    request = asc_calloc(mod->__cam.memstat, 1, sizeof(group_request_t));
+    request->member = member;
+    request->arg = arg;
+    request->time = asc_utime();
+    request->ecm_size = size;
+    memcpy(request->ecm, buffer, size);
+    asc_list_insert_tail(mod->request_list, request);
+
+    if(!request_next(mod, request))
+        request_fail(mod, request);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    for(int i = 0; i < mod->backend_count; ++i)
+    {
+        const group_backend_t *backend = &mod->backend[i];
+
+        lua_pushnumber(lua, i + 1);
+        lua_newtable(lua);
+
+        lua_pushboolean(lua, backend->cam->is_ready);
+        lua_setfield(lua, -2, "ready");
+        lua_pushnumber(lua, (lua_Number)backend->rtt / 1000);
+        lua_setfield(lua, -2, "rtt");
+        lua_pushnumber(lua, (lua_Number)backend->success / 10);
+        lua_setfield(lua, -2, "success");
+        lua_pushnumber(lua, (lua_Number)backend->ok);
+        lua_setfield(lua, -2, "ok");
+        lua_pushnumber(lua, (lua_Number)backend->fail);
+        lua_setfield(lua, -2, "fail");
+        lua_pushnumber(lua, (lua_Number)backend->timeout);
+        lua_setfield(lua, -2, "timeout");
+        lua_pushnumber(lua, (lua_Number)backend->hedged);
+        lua_setfield(lua, -2, "hedged");
+
+        lua_settable(lua, -3);
+    }
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->name, NULL);
+    asc_assert(mod->name != NULL, "[cam_group] option 'name' is required");
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "cam");
+    asc_assert(lua_istable(lua, -1), MSG("option 'cam' is required"));
+    lua_foreach(lua, -2)
+    {
+        asc_assert(  lua_type(lua, -1) == LUA_TLIGHTUSERDATA
+                   , MSG("option 'cam' required list of cam-module instances"));
+        asc_assert(  mod->backend_count < CAM_GROUP_MAX
+                   , MSG("option 'cam' is limited to %d instances"), CAM_GROUP_MAX);
+
+        group_backend_t *backend = &mod->backend[mod->backend_count];
+        backend->mod = mod;
+        backend->cam = lua_touserdata(lua, -1);
+        backend->success = SUCCESS_MAX;
+        backend->link.self = (module_data_t *)backend;
+        backend->link.cam = backend->cam;
+        backend->link.on_cam_ready = on_backend_ready;
+        backend->link.on_cam_error = on_backend_error;
+        backend->link.on_cam_response = on_backend_response;
+        ++mod->backend_count;
+    }
+    lua_pop(lua, 1);
+    asc_assert(mod->backend_count > 0, MSG("option 'cam' is empty"));
+
+    int value = 500;
+    module_option_number("hedge", &value);
+    mod->hedge = (uint64_t)value * 1000;
+
+    value = 5000;
+    module_option_number("timeout", &value);
+    mod->timeout = (uint64_t)value * 1000;
+
+    mod->primary = -1;
+    mod->member_list = asc_list_init();
+    mod->request_list = asc_list_init();
+
+    module_cam_init(mod, group_connect, group_disconnect, group_send_em);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    group_disconnect(mod);
+
+    module_cam_destroy(mod);
+
+    asc_list_destroy(mod->member_list);
+    asc_list_destroy(mod->request_list);
+}
+
+MODULE_CAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_CAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(cam_group)
@@ -34,6 +34,15 @@
 #define ECM_HEADER_SIZE 3
 #define ECM_PAYLOAD_SIZE (CSA_KEY_SIZE * 2)
 
+#define NEWCAMD_WINDOW_MAX 64
+
+typedef struct
+{
+    em_packet_t *packet;    // NULL if the slot is free
+    uint16_t msg_id;
+    uint64_t sendtime;
+} newcamd_request_t;
+
 typedef union {
     uint8_t a[CSA_KEY_SIZE];
     uint64_t l;
@@ -57,10 +66,12 @@ struct module_data_t
         uint8_t key[KEY_SIZE];
 
         bool disable_emm;
+        int window;
     } config;
 
     int status;
     asc_socket_t *sock;
+    asc_resolve_t *resolve;
     asc_timer_t *timeout;
 
     uint8_t *prov_buffer;
@@ -73,12 +84,19 @@ struct module_data_t
     } triple_des;
 
     uint16_t msg_id;        // curren message id
-    em_packet_t *packet;    // current packet
     csa_key_t last_key[2];  // NDS
 
+    // requests waiting for the response, matched by the message id
+    newcamd_request_t request_list[NEWCAMD_WINDOW_MAX];
+    int request_count;
+    uint64_t recvtime;      // last message from the server
+    bool is_keepalive;      // reply is in the buffer
+
     uint8_t buffer[NEWCAMD_MSG_SIZE];
     size_t payload_size;    // to send
     size_t buffer_skip;     // to recv
+
+    uint8_t send_buffer[NEWCAMD_MSG_SIZE];
 };
 
 typedef enum {
@@ -157,6 +175,71 @@ static uint8_t xor_sum(const uint8_t *mem, int len)
  *
  */
 
+static void on_newcamd_ready(void *arg);
+static void on_timeout(void *arg);
+
+/* the timer is set for the oldest request */
+static void newcamd_timeout_update(module_data_t *mod)
+{
+    if(mod->timeout)
+    {
+        asc_timer_destroy(mod->timeout);
+        mod->timeout = NULL;
+    }
+
+    if(mod->request_count == 0)
+        return;
+
+    uint64_t sendtime = UINT64_MAX;
+    for(int i = 0; i < NEWCAMD_WINDOW_MAX; ++i)
+    {
+        const newcamd_request_t *request = &mod->request_list[i];
+        if(request->packet && request->sendtime < sendtime)
+            sendtime = request->sendtime;
+    }
+
+    const uint64_t now = asc_utime();
+    const uint64_t deadline = sendtime + (uint64_t)mod->config.timeout * 1000;
+    const unsigned int ms = (deadline > now) ? ((deadline - now) / 1000 + 1) : 1;
+    mod->timeout = asc_timer_init(ms, on_timeout, mod);
+}
+
+static void newcamd_request_free(module_data_t *mod, newcamd_request_t *request)
+{
+    asc_free(request->packet);
+    request->packet = NULL;
+    --mod->request_count;
+}
+
+/* drop the expired requests. returns false if the server does not respond at all */
+static bool newcamd_expire(module_data_t *mod)
+{
+    const uint64_t now = asc_utime();
+    const uint64_t timeout = (uint64_t)mod->config.timeout * 1000;
+
+    bool is_expired = false;
+    for(int i = 0; i < NEWCAMD_WINDOW_MAX; ++i)
+    {
+        newcamd_request_t *request = &mod->request_list[i];
+        if(!request->packet || now - request->sendtime < timeout)
+            continue;
+
+        asc_log_error(  MSG("response timeout (id:%d type:0x%02X)")
+                      , request->msg_id, request->packet->buffer[0]);
+        newcamd_request_free(mod, request);
+        is_expired = true;
+    }
+
+    if(is_expired && now - mod->recvtime >= timeout)
+        return false;
+
+    newcamd_timeout_update(mod);
+    if(asc_list_size(mod->__cam.packet_queue) > 0)
+        asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+
+    return true;
+}
+
 static void on_timeout(void *arg)
 {
     module_data_t *mod = arg;
@@ -172,6 +255,16 @@ static void on_timeout(void *arg)
         case 0:
             asc_log_error(MSG("connection timeout"));
             break;
+        case 3:
+            if(mod->request_count > 0)
+            {
+                if(newcamd_expire(mod))
+                    return;
+                asc_log_error(MSG("server is not responding"));
+                break;
+            }
+            asc_log_error(MSG("response timeout"));
+            break;
         default:
             asc_log_error(MSG("response timeout"));
             break;
@@ -187,6 +280,7 @@ static void on_newcamd_close(void *arg)
     if(!mod->sock)
         return;
 
+    ASC_FREE(mod->resolve, asc_resolve_cancel);
     asc_socket_close(mod->sock);
     mod->sock = NULL;
 
@@ -204,11 +298,13 @@ static void on_newcamd_close(void *arg)
         mod->prov_buffer = NULL;
     }
 
-    if(mod->packet)
+    for(int i = 0; i < NEWCAMD_WINDOW_MAX; ++i)
     {
-        free(mod->packet);
-        mod->packet = NULL;
+        newcamd_request_t *request = &mod->request_list[i];
+        if(request->packet)
+            newcamd_request_free(mod, request);
     }
+    mod->is_keepalive = false;
 
     if(mod->status == 0)
         asc_log_error(MSG("connection failed"));
@@ -233,46 +329,29 @@ static void on_newcamd_close(void *arg)
  *
  */
 
-static void on_newcamd_ready(void *arg)
+/* pad, encrypt and send the message. returns false if the connection is closed */
+static bool newcamd_send_msg(module_data_t *mod, uint8_t *msg, size_t payload_size)
 {
-    module_data_t *mod = arg;
-
-    memset(mod->buffer, 0, NEWCAMD_HEADER_SIZE);
+    uint8_t *buffer = &msg[NEWCAMD_HEADER_SIZE];
 
-    uint8_t *buffer = &mod->buffer[NEWCAMD_HEADER_SIZE];
+    buffer[1] = (payload_size >> 8) & 0x0F;
+    buffer[2] = (payload_size     ) & 0xFF;
 
-    if(mod->packet)
-    {
-        memcpy(buffer, mod->packet->buffer, mod->packet->buffer_size);
-        mod->payload_size = mod->packet->buffer_size - 3;
-
-        mod->msg_id = (mod->msg_id + 1) & 0xFFFF;
-        mod->buffer[2] = mod->msg_id >> 8;
-        mod->buffer[3] = mod->msg_id & 0xff;
-
-        const uint16_t pnr = mod->packet->decrypt->cas_pnr;
-        mod->buffer[4] = pnr >> 8;
-        mod->buffer[5] = pnr & 0xff;
-    }
-
-    buffer[1] = (mod->payload_size >> 8) & 0x0F;
-    buffer[2] = (mod->payload_size     ) & 0xFF;
-
-    size_t packet_size = NEWCAMD_HEADER_SIZE + 3 + mod->payload_size;
+    size_t packet_size = NEWCAMD_HEADER_SIZE + 3 + payload_size;
     const uint8_t no_pad_bytes = (8 - ((packet_size - 1) % 8)) % 8;
 
     if((packet_size + no_pad_bytes + 1) >= (NEWCAMD_MSG_SIZE - 8))
     {
         asc_log_error(MSG("failed to pad message"));
         newcamd_reconnect(mod, true);
-        return;
+        return false;
     }
 
     DES_cblock pad_bytes;
     DES_random_key((DES_cblock *)pad_bytes);
-    memcpy(&mod->buffer[packet_size], pad_bytes, no_pad_bytes);
+    memcpy(&msg[packet_size], pad_bytes, no_pad_bytes);
     packet_size += no_pad_bytes;
-    mod->buffer[packet_size] = xor_sum(&mod->buffer[2], packet_size - 2);
+    msg[packet_size] = xor_sum(&msg[2], packet_size - 2);
     ++packet_size;
 
     // encrypt
@@ -282,24 +361,92 @@ static void on_newcamd_ready(void *arg)
     {
         asc_log_error(MSG("failed to encrypt message"));
         newcamd_reconnect(mod, true);
-        return;
+        return false;
     }
-    memcpy(&mod->buffer[packet_size], ivec, sizeof(ivec));
-    DES_ede2_cbc_encrypt(  &mod->buffer[2], &mod->buffer[2], packet_size - 2
+    memcpy(&msg[packet_size], ivec, sizeof(ivec));
+    DES_ede2_cbc_encrypt(  &msg[2], &msg[2], packet_size - 2
                          , &mod->triple_des.ks1, &mod->triple_des.ks2
                          , (DES_cblock *)ivec, DES_ENCRYPT);
     packet_size += sizeof(ivec);
 
-    mod->buffer[0] = ((packet_size - 2) >> 8) & 0xFF;
-    mod->buffer[1] = ((packet_size - 2)     ) & 0xFF;
+    msg[0] = ((packet_size - 2) >> 8) & 0xFF;
+    msg[1] = ((packet_size - 2)     ) & 0xFF;
 
-    if(asc_socket_send(mod->sock, mod->buffer, packet_size) != (ssize_t)packet_size)
+    if(asc_socket_send(mod->sock, msg, packet_size) != (ssize_t)packet_size)
     {
         asc_log_error(MSG("failed to send message"));
         newcamd_reconnect(mod, true);
+        return false;
+    }
+
+    return true;
+}
+
+/* send queued packets while the window has free slots */
+static void newcamd_send_queue(module_data_t *mod)
+{
+    while(mod->request_count < mod->config.window)
+    {
+        newcamd_request_t *request = NULL;
+        for(int i = 0; i < NEWCAMD_WINDOW_MAX; ++i)
+        {
+            if(!mod->request_list[i].packet)
+            {
+                request = &mod->request_list[i];
+                break;
+            }
+        }
+
+        em_packet_t *packet = module_cam_queue_pop(&mod->__cam);
+        if(!packet)
+            break;
+
+        // the recv buffer may contain a part of the response
+        uint8_t *msg = mod->send_buffer;
+        memset(msg, 0, NEWCAMD_HEADER_SIZE);
+        memcpy(&msg[NEWCAMD_HEADER_SIZE], packet->buffer, packet->buffer_size);
+
+        mod->msg_id = (mod->msg_id + 1) & 0xFFFF;
+        msg[2] = mod->msg_id >> 8;
+        msg[3] = mod->msg_id & 0xff;
+
+        const uint16_t pnr = packet->decrypt->cas_pnr;
+        msg[4] = pnr >> 8;
+        msg[5] = pnr & 0xff;
+
+        if(!newcamd_send_msg(mod, msg, packet->buffer_size - 3))
+        {
+            asc_free(packet);
+            return;
+        }
+
+        request->packet = packet;
+        request->msg_id = mod->msg_id;
+        request->sendtime = asc_utime();
+        ++mod->request_count;
+        asc_trace3(newcamd_ecm_send, mod->config.name, request->msg_id, packet->buffer[0]);
+    }
+
+    asc_socket_set_on_ready(mod->sock, NULL);
+
+    if(!mod->timeout)
+        newcamd_timeout_update(mod);
+}
+
+static void on_newcamd_ready(void *arg)
+{
+    module_data_t *mod = arg;
+
+    if(mod->status == 3 && !mod->is_keepalive)
+    {
+        newcamd_send_queue(mod);
         return;
     }
 
+    memset(mod->buffer, 0, NEWCAMD_HEADER_SIZE);
+    if(!newcamd_send_msg(mod, mod->buffer, mod->payload_size))
+        return;
+
     asc_socket_set_on_ready(mod->sock, NULL);
 
     mod->buffer_skip = 0;
@@ -307,6 +454,13 @@ static void on_newcamd_ready(void *arg)
 
     if(!mod->timeout)
         mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
+
+    if(mod->is_keepalive)
+    {
+        mod->is_keepalive = false;
+        if(asc_list_size(mod->__cam.packet_queue) > 0)
+            asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+    }
 }
 
 /*
@@ -391,38 +545,64 @@ static void on_newcamd_read_packet(void *arg)
 
     if(mod->status == 3)
     {
-        if(!mod->packet && msg_type == NEWCAMD_MSG_KEEPALIVE)
+        mod->recvtime = asc_utime();
+
+        if(mod->request_count == 0 && msg_type == NEWCAMD_MSG_KEEPALIVE)
         {
             buffer[0] = NEWCAMD_MSG_KEEPALIVE;
             buffer[1] = 0;
             buffer[2] = 0;
             mod->payload_size = 0;
+            mod->is_keepalive = true;
 
             asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
             return;
         }
 
-        if(!mod->packet || msg_type < 0x80 || msg_type > 0x8F)
+        if(mod->request_count == 0 || msg_type < 0x80 || msg_type > 0x8F)
         {
             asc_log_warning(MSG("unknown packet type [0x%02X]"), msg_type);
             return;
         }
 
-        asc_timer_destroy(mod->timeout);
-        mod->timeout = NULL;
+        const uint16_t msg_id = (mod->buffer[2] << 8) | mod->buffer[3];
+        newcamd_request_t *request = NULL;
+        for(int i = 0; i < NEWCAMD_WINDOW_MAX; ++i)
+        {
+            newcamd_request_t *i_request = &mod->request_list[i];
+            if(!i_request->packet)
+                continue;
+            // without pipelining the response is for the only request
+            if(i_request->msg_id == msg_id || mod->config.window == 1)
+            {
+                request = i_request;
+                break;
+            }
+        }
+        if(!request)
+        {
+            asc_log_warning(MSG("unknown message id [%d]"), msg_id);
+            return;
+        }
+
+        em_packet_t *packet = request->packet;
+        request->packet = NULL;
+        --mod->request_count;
+        asc_trace3(newcamd_ecm_recv, mod->config.name, msg_id, asc_utime() - request->sendtime);
+
+        newcamd_timeout_update(mod);
+        if(asc_list_size(mod->__cam.packet_queue) > 0)
+            asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
 
         asc_list_for(mod->__cam.decrypt_list)
         {
-            if(asc_list_data(mod->__cam.decrypt_list) == mod->packet->decrypt)
+            if(asc_list_data(mod->__cam.decrypt_list) == packet->decrypt)
                 break;
         }
         if(asc_list_eol(mod->__cam.decrypt_list))
         {
             /* the decrypt module was detached */
-            free(mod->packet);
-            mod->packet = module_cam_queue_pop(&mod->__cam);
-            if(mod->packet)
-                asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+            asc_free(packet);
             return;
         }
 
@@ -443,27 +623,23 @@ static void on_newcamd_read_packet(void *arg)
                 mod->last_key[0].l = key_0.l;
             }
 
-            memcpy(mod->packet->buffer, buffer, ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE);
-            mod->packet->buffer_size = ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE;
+            memcpy(packet->buffer, buffer, ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE);
+            packet->buffer_size = ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE;
         }
         else if(mod->payload_size == 0)
         {
-            memcpy(mod->packet->buffer, buffer, ECM_HEADER_SIZE);
-            mod->packet->buffer_size = ECM_HEADER_SIZE;
+            memcpy(packet->buffer, buffer, ECM_HEADER_SIZE);
+            packet->buffer_size = ECM_HEADER_SIZE;
         }
         else
         {
-            mod->packet->buffer[2] = 0x00;
-            mod->packet->buffer[3] = 0x00;
-            mod->packet->buffer_size = ECM_HEADER_SIZE;
+            packet->buffer[2] = 0x00;
+            packet->buffer[3] = 0x00;
+            packet->buffer_size = ECM_HEADER_SIZE;
         }
 
-        on_cam_response(mod->packet->decrypt->self, mod->packet->arg, mod->packet->buffer);
-        free(mod->packet);
-
-        mod->packet = module_cam_queue_pop(&mod->__cam);
-        if(mod->packet)
-            asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+        packet->decrypt->on_cam_response(packet->decrypt->self, packet->arg, packet->buffer);
+        asc_free(packet);
     }
     else if(mod->status == 1)
     {
@@ -529,6 +705,8 @@ static void on_newcamd_read_packet(void *arg)
         asc_timer_destroy(mod->timeout);
         mod->timeout = NULL;
 
+        mod->recvtime = asc_utime();
+
         module_cam_ready(&mod->__cam);
     }
 }
@@ -589,6 +767,22 @@ static void on_newcamd_connect(void *arg)
     asc_socket_set_on_read(mod->sock, on_newcamd_read_init);
 }
 
+static void on_newcamd_resolve(void *arg, const char *addr)
+{
+    module_data_t *mod = arg;
+
+    mod->resolve = NULL;
+
+    if(!addr)
+    {
+        asc_log_error(MSG("failed to resolve host"));
+        newcamd_reconnect(mod, true);
+        return;
+    }
+
+    asc_socket_connect(mod->sock, addr, mod->config.port, on_newcamd_connect, on_newcamd_close);
+}
+
 static void newcamd_connect(module_data_t *mod)
 {
     if(mod->sock)
@@ -599,9 +793,13 @@ static void newcamd_connect(module_data_t *mod)
     mod->buffer_skip = 0;
 
     mod->sock = asc_socket_open_tcp4(mod);
-    asc_socket_connect(  mod->sock
-                       , mod->config.host, mod->config.port
-                       , on_newcamd_connect, on_newcamd_close);
+
+    /* host name is resolved in the thread, the main loop is not blocked */
+    const char *addr = asc_resolve_cached(mod->config.host);
+    if(addr)
+        asc_socket_connect(mod->sock, addr, mod->config.port, on_newcamd_connect, on_newcamd_close);
+    else
+        mod->resolve = asc_resolve(mod->config.host, on_newcamd_resolve, mod);
 
     mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
 }
@@ -639,39 +837,18 @@ void newcamd_send_em(  module_data_t *mod
         return;
     }
 
-    em_packet_t *packet = malloc(sizeof(em_packet_t));
+    em_packet_t *packet = asc_malloc(mod->__cam.memstat, sizeof(em_packet_t));
     memcpy(packet->buffer, buffer, size);
     packet->buffer_size = size;
     packet->decrypt = decrypt;
     packet->arg = arg;
 
-    if(packet->buffer[0] == 0x80 || packet->buffer[0] == 0x81)
-    {
-        asc_list_for(mod->__cam.packet_queue)
-        {
-            em_packet_t *queue_item = asc_list_data(mod->__cam.packet_queue);
-            if(   queue_item->decrypt == decrypt
-               && queue_item->arg == arg
-               && (queue_item->buffer[0] == 0x80 || queue_item->buffer[0] == 0x81))
-            {
-                asc_log_warning(  MSG("drop old packet (pnr:%d drop:0x%02X set:0x%02X)")
-                                , decrypt->pnr, queue_item->buffer[0], packet->buffer[0]);
-                asc_list_remove_current(mod->__cam.packet_queue);
-                free(queue_item);
-                break;
-            }
-        }
-    }
-
-    if(mod->packet)
-    {
-        // newcamd is busy
-        asc_list_insert_tail(mod->__cam.packet_queue, packet);
+    if(!module_cam_queue_push(&mod->__cam, packet))
         return;
-    }
 
-    mod->packet = packet;
-    asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+    // newcamd is busy if the window is full
+    if(mod->request_count < mod->config.window)
+        asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
 }
 
 static void module_init(module_data_t *mod)
@@ -705,6 +882,14 @@ static void module_init(module_data_t *mod)
         mod->config.timeout = 8;
     mod->config.timeout *= 1000;
 
+    // requests in flight, matched by the message id. default: 1 - no pipelining
+    mod->config.window = 1;
+    module_option_number("window", &mod->config.window);
+    if(mod->config.window < 1)
+        mod->config.window = 1;
+    else if(mod->config.window > NEWCAMD_WINDOW_MAX)
+        mod->config.window = NEWCAMD_WINDOW_MAX;
+
     module_cam_init(mod, newcamd_connect, newcamd_disconnect, newcamd_send_em);
 }
 
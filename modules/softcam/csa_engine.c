@@ -0,0 +1,813 @@
+/*
+ * Astra Module: SoftCAM
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "csa_engine.h"
+
+#ifndef FFDECSA
+#   define FFDECSA 1
+#endif
+
+#ifndef LIBDVBCSA
+#   define LIBDVBCSA 0
+#endif
+
+#if FFDECSA == 1
+#   include "FFdecsa/FFdecsa.h"
+#endif
+
+#if LIBDVBCSA == 1
+#   include <dvbcsa/dvbcsa.h>
+#endif
+
+#if FFDECSA != 1 && LIBDVBCSA != 1
+#   error "DVB-CSA is not defined"
+#endif
+
+#define MSG(_msg) "[csa_engine] " _msg
+
+/*
+ * ooooooooooo ooooooooooo      o
+ *  888    88   888    88      888
+ *  888ooo8     888ooo8       8  88
+ *  888         888          8oooo88
+ * o888o       o888o       o88o  o888o
+ *
+ */
+
+#if FFDECSA == 1
+
+static size_t ffdecsa_batch_size(void)
+{
+    return get_suggested_cluster_size();
+}
+
+static void * ffdecsa_key_init(void)
+{
+    return get_key_struct();
+}
+
+static void ffdecsa_key_destroy(void *key)
+{
+    free_key_struct(key);
+}
+
+static void ffdecsa_key_set(void *key, const uint8_t *even, const uint8_t *odd)
+{
+    if(even)
+        set_even_control_word(key, even);
+    if(odd)
+        set_odd_control_word(key, odd);
+}
+
+static void * ffdecsa_batch_init(size_t size)
+{
+    // range per packet and the end of the cluster
+    return calloc(size * 2 + 2, sizeof(uint8_t *));
+}
+
+static void ffdecsa_batch_destroy(void *batch)
+{
+    free(batch);
+}
+
+static void ffdecsa_decrypt(void *key, void *batch, uint8_t **packets, size_t count)
+{
+    uint8_t **cluster = batch;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        cluster[i * 2    ] = packets[i];
+        cluster[i * 2 + 1] = packets[i] + TS_PACKET_SIZE;
+    }
+    cluster[count * 2] = NULL;
+
+    size_t i = 0;
+    while(i < count)
+        i += decrypt_packets(key, cluster);
+}
+
+static const csa_engine_t ffdecsa =
+{
+    .name = "ffdecsa",
+    .key_size = 8,
+    .batch_size = ffdecsa_batch_size,
+    .key_init = ffdecsa_key_init,
+    .key_destroy = ffdecsa_key_destroy,
+    .key_set = ffdecsa_key_set,
+    .batch_init = ffdecsa_batch_init,
+    .batch_destroy = ffdecsa_batch_destroy,
+    .decrypt = ffdecsa_decrypt,
+};
+
+#endif /* FFDECSA == 1 */
+
+/*
+ * ooooo       ooooo oooooooooo  ooooooooo  ooooo  oooo  oooooooo8   oooooooo8      o
+ *  888         888   888    888  888    88o 888    88 o888     88  888           888
+ *  888         888   888oooo88   888    888  888  88  888           888oooooo   8  88
+ *  888      o  888   888    888  888    888   88888   888o     oo         888  8oooo88
+ * o888ooooo88 o888o o888ooo888  o888ooo88      888     888oooo88  o88oooo888 o88o  o888o
+ *
+ */
+
+#if LIBDVBCSA == 1
+
+typedef struct
+{
+    struct dvbcsa_bs_key_s *even;
+    struct dvbcsa_bs_key_s *odd;
+} libdvbcsa_key_t;
+
+typedef struct
+{
+    struct dvbcsa_bs_batch_s *even;
+    struct dvbcsa_bs_batch_s *odd;
+} libdvbcsa_batch_t;
+
+static size_t libdvbcsa_batch_size(void)
+{
+    return dvbcsa_bs_batch_size();
+}
+
+static void * libdvbcsa_key_init(void)
+{
+    libdvbcsa_key_t *key = malloc(sizeof(libdvbcsa_key_t));
+    key->even = dvbcsa_bs_key_alloc();
+    key->odd = dvbcsa_bs_key_alloc();
+    return key;
+}
+
+static void libdvbcsa_key_destroy(void *arg)
+{
+    libdvbcsa_key_t *key = arg;
+    dvbcsa_bs_key_free(key->even);
+    dvbcsa_bs_key_free(key->odd);
+    free(key);
+}
+
+static void libdvbcsa_key_set(void *arg, const uint8_t *even, const uint8_t *odd)
+{
+    libdvbcsa_key_t *key = arg;
+    if(even)
+        dvbcsa_bs_key_set(even, key->even);
+    if(odd)
+        dvbcsa_bs_key_set(odd, key->odd);
+}
+
+static void * libdvbcsa_batch_init(size_t size)
+{
+    libdvbcsa_batch_t *batch = malloc(sizeof(libdvbcsa_batch_t));
+    batch->even = calloc(size + 1, sizeof(struct dvbcsa_bs_batch_s));
+    batch->odd = calloc(size + 1, sizeof(struct dvbcsa_bs_batch_s));
+    return batch;
+}
+
+static void libdvbcsa_batch_destroy(void *arg)
+{
+    libdvbcsa_batch_t *batch = arg;
+    free(batch->even);
+    free(batch->odd);
+    free(batch);
+}
+
+static void libdvbcsa_decrypt(void *arg_key, void *arg_batch, uint8_t **packets, size_t count)
+{
+    libdvbcsa_key_t *key = arg_key;
+    libdvbcsa_batch_t *batch = arg_batch;
+    size_t even_count = 0;
+    size_t odd_count = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *ts = packets[i];
+        const uint8_t sc = TS_IS_SCRAMBLED(ts);
+        ts[3] &= ~0xC0;
+
+        if(!TS_IS_PAYLOAD(ts))
+            continue;
+
+        const size_t hdr_size = (TS_IS_AF(ts)) ? (4 + ts[4] + 1) : 4;
+        if(hdr_size >= TS_PACKET_SIZE)
+            continue;
+
+        struct dvbcsa_bs_batch_s *item;
+        if(sc == 0x80)
+            item = &batch->even[even_count++];
+        else if(sc == 0xC0)
+            item = &batch->odd[odd_count++];
+        else
+            continue;
+
+        item->data = &ts[hdr_size];
+        item->len = TS_PACKET_SIZE - hdr_size;
+    }
+
+    if(even_count > 0)
+    {
+        batch->even[even_count].data = NULL;
+        dvbcsa_bs_decrypt(key->even, batch->even, TS_BODY_SIZE);
+    }
+
+    if(odd_count > 0)
+    {
+        batch->odd[odd_count].data = NULL;
+        dvbcsa_bs_decrypt(key->odd, batch->odd, TS_BODY_SIZE);
+    }
+}
+
+static const csa_engine_t libdvbcsa =
+{
+    .name = "libdvbcsa",
+    .key_size = 8,
+    .batch_size = libdvbcsa_batch_size,
+    .key_init = libdvbcsa_key_init,
+    .key_destroy = libdvbcsa_key_destroy,
+    .key_set = libdvbcsa_key_set,
+    .batch_init = libdvbcsa_batch_init,
+    .batch_destroy = libdvbcsa_batch_destroy,
+    .decrypt = libdvbcsa_decrypt,
+};
+
+#endif /* LIBDVBCSA == 1 */
+
+/*
+ *   oooooooo8 ooooo  oooooooo8  oooooooo8      o
+ * o888     88  888  888        888            888
+ * 888          888   888oooooo  888oooooo    8  88
+ * 888o     oo  888         888        888   8oooo88
+ *  888oooo88  o888o o88oooo888 o88oooo888 o88o  o888o
+ *
+ */
+
+/*
+ * DVB-CISSA (ETSI TS 103 127): AES-128-CBC over the TS payload, the IV is
+ * restarted on each packet, the residual block of the payload is in clear.
+ * CBC decryption has no dependency between the blocks, the kernel takes
+ * the blocks of the consecutive packets into the parallel AES lanes.
+ *
+ * AES-NI is selected at runtime, ARMv8-AES on the build with the crypto
+ * extension (-march=armv8-a+crypto), the table code otherwise.
+ */
+
+#define CISSA_ROUNDS 10
+#define CISSA_BLOCK_SIZE 16
+#define CISSA_BATCH_SIZE 64
+#define CISSA_LANES 8
+
+static const uint8_t cissa_iv[CISSA_BLOCK_SIZE] =
+{
+    'D', 'V', 'B', 'T', 'M', 'C', 'P', 'T', 'A', 'E', 'S', 'C', 'I', 'S', 'S', 'A'
+};
+
+typedef struct
+{
+    uint8_t rk[CISSA_ROUNDS + 1][CISSA_BLOCK_SIZE];
+} cissa_schedule_t;
+
+typedef struct
+{
+    // round keys of the equivalent inverse cipher, in the order of use
+    cissa_schedule_t even;
+    cissa_schedule_t odd;
+} cissa_key_t;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t blocks;
+} cissa_item_t;
+
+typedef struct
+{
+    cissa_item_t *even;
+    cissa_item_t *odd;
+} cissa_batch_t;
+
+typedef void (*cissa_kernel_t)(const cissa_schedule_t *schedule
+                               , const cissa_item_t *items, size_t count);
+
+static const uint8_t aes_sbox[256] =
+{
+    0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+    0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+    0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+    0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+    0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+    0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+    0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+    0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+    0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+    0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+    0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+    0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+    0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+    0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+    0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+    0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+static const uint8_t aes_inv_sbox[256] =
+{
+    0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38, 0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
+    0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87, 0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
+    0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D, 0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
+    0x08, 0x2E, 0xA1, 0x66, 0x28, 0xD9, 0x24, 0xB2, 0x76, 0x5B, 0xA2, 0x49, 0x6D, 0x8B, 0xD1, 0x25,
+    0x72, 0xF8, 0xF6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xD4, 0xA4, 0x5C, 0xCC, 0x5D, 0x65, 0xB6, 0x92,
+    0x6C, 0x70, 0x48, 0x50, 0xFD, 0xED, 0xB9, 0xDA, 0x5E, 0x15, 0x46, 0x57, 0xA7, 0x8D, 0x9D, 0x84,
+    0x90, 0xD8, 0xAB, 0x00, 0x8C, 0xBC, 0xD3, 0x0A, 0xF7, 0xE4, 0x58, 0x05, 0xB8, 0xB3, 0x45, 0x06,
+    0xD0, 0x2C, 0x1E, 0x8F, 0xCA, 0x3F, 0x0F, 0x02, 0xC1, 0xAF, 0xBD, 0x03, 0x01, 0x13, 0x8A, 0x6B,
+    0x3A, 0x91, 0x11, 0x41, 0x4F, 0x67, 0xDC, 0xEA, 0x97, 0xF2, 0xCF, 0xCE, 0xF0, 0xB4, 0xE6, 0x73,
+    0x96, 0xAC, 0x74, 0x22, 0xE7, 0xAD, 0x35, 0x85, 0xE2, 0xF9, 0x37, 0xE8, 0x1C, 0x75, 0xDF, 0x6E,
+    0x47, 0xF1, 0x1A, 0x71, 0x1D, 0x29, 0xC5, 0x89, 0x6F, 0xB7, 0x62, 0x0E, 0xAA, 0x18, 0xBE, 0x1B,
+    0xFC, 0x56, 0x3E, 0x4B, 0xC6, 0xD2, 0x79, 0x20, 0x9A, 0xDB, 0xC0, 0xFE, 0x78, 0xCD, 0x5A, 0xF4,
+    0x1F, 0xDD, 0xA8, 0x33, 0x88, 0x07, 0xC7, 0x31, 0xB1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xEC, 0x5F,
+    0x60, 0x51, 0x7F, 0xA9, 0x19, 0xB5, 0x4A, 0x0D, 0x2D, 0xE5, 0x7A, 0x9F, 0x93, 0xC9, 0x9C, 0xEF,
+    0xA0, 0xE0, 0x3B, 0x4D, 0xAE, 0x2A, 0xF5, 0xB0, 0xC8, 0xEB, 0xBB, 0x3C, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2B, 0x04, 0x7E, 0xBA, 0x77, 0xD6, 0x26, 0xE1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0C, 0x7D,
+};
+
+static inline uint8_t aes_xtime(uint8_t a)
+{
+    return (uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1B : 0x00));
+}
+
+/* InvMixColumns is MixColumns after the {04}x{00}{05} product */
+static void aes_inv_mix_columns(uint8_t *s)
+{
+    for(int c = 0; c < 16; c += 4)
+    {
+        const uint8_t u = aes_xtime(aes_xtime(s[c] ^ s[c + 2]));
+        const uint8_t v = aes_xtime(aes_xtime(s[c + 1] ^ s[c + 3]));
+        s[c] ^= u;
+        s[c + 1] ^= v;
+        s[c + 2] ^= u;
+        s[c + 3] ^= v;
+
+        const uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+        const uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+        s[c    ] = a0 ^ t ^ aes_xtime(a0 ^ a1);
+        s[c + 1] = a1 ^ t ^ aes_xtime(a1 ^ a2);
+        s[c + 2] = a2 ^ t ^ aes_xtime(a2 ^ a3);
+        s[c + 3] = a3 ^ t ^ aes_xtime(a3 ^ a0);
+    }
+}
+
+/* InvShiftRows and InvSubBytes, the state is column-major */
+static void aes_inv_shift_sub(uint8_t *s)
+{
+    uint8_t t[CISSA_BLOCK_SIZE];
+    for(int c = 0; c < 4; ++c)
+    {
+        for(int r = 0; r < 4; ++r)
+            t[((c + r) & 3) * 4 + r] = aes_inv_sbox[s[c * 4 + r]];
+    }
+    memcpy(s, t, sizeof(t));
+}
+
+static void cissa_schedule(cissa_schedule_t *schedule, const uint8_t *key)
+{
+    uint8_t (*rk)[CISSA_BLOCK_SIZE] = schedule->rk;
+    uint8_t w[CISSA_ROUNDS + 1][CISSA_BLOCK_SIZE];
+    memcpy(w[0], key, CISSA_BLOCK_SIZE);
+
+    uint8_t rcon = 0x01;
+    for(int i = 1; i <= CISSA_ROUNDS; ++i)
+    {
+        const uint8_t *p = w[i - 1];
+        uint8_t *n = w[i];
+
+        n[0] = p[0] ^ aes_sbox[p[13]] ^ rcon;
+        n[1] = p[1] ^ aes_sbox[p[14]];
+        n[2] = p[2] ^ aes_sbox[p[15]];
+        n[3] = p[3] ^ aes_sbox[p[12]];
+        for(int j = 4; j < CISSA_BLOCK_SIZE; ++j)
+            n[j] = p[j] ^ n[j - 4];
+
+        rcon = aes_xtime(rcon);
+    }
+
+    memcpy(rk[0], w[CISSA_ROUNDS], CISSA_BLOCK_SIZE);
+    for(int i = 1; i < CISSA_ROUNDS; ++i)
+    {
+        memcpy(rk[i], w[CISSA_ROUNDS - i], CISSA_BLOCK_SIZE);
+        aes_inv_mix_columns(rk[i]);
+    }
+    memcpy(rk[CISSA_ROUNDS], w[0], CISSA_BLOCK_SIZE);
+}
+
+static void aes_decrypt_block(const cissa_schedule_t *schedule, uint8_t *s)
+{
+    const uint8_t (*rk)[CISSA_BLOCK_SIZE] = schedule->rk;
+    for(int j = 0; j < CISSA_BLOCK_SIZE; ++j)
+        s[j] ^= rk[0][j];
+
+    for(int i = 1; i < CISSA_ROUNDS; ++i)
+    {
+        aes_inv_shift_sub(s);
+        aes_inv_mix_columns(s);
+        for(int j = 0; j < CISSA_BLOCK_SIZE; ++j)
+            s[j] ^= rk[i][j];
+    }
+
+    aes_inv_shift_sub(s);
+    for(int j = 0; j < CISSA_BLOCK_SIZE; ++j)
+        s[j] ^= rk[CISSA_ROUNDS][j];
+}
+
+static void table_decrypt(const cissa_schedule_t *schedule, const cissa_item_t *items, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t prev[CISSA_BLOCK_SIZE];
+        uint8_t cipher[CISSA_BLOCK_SIZE];
+        memcpy(prev, cissa_iv, CISSA_BLOCK_SIZE);
+
+        uint8_t *block = items[i].data;
+        for(size_t b = 0; b < items[i].blocks; ++b, block += CISSA_BLOCK_SIZE)
+        {
+            memcpy(cipher, block, CISSA_BLOCK_SIZE);
+            aes_decrypt_block(schedule, block);
+            for(int j = 0; j < CISSA_BLOCK_SIZE; ++j)
+                block[j] ^= prev[j];
+            memcpy(prev, cipher, CISSA_BLOCK_SIZE);
+        }
+    }
+}
+
+/*
+ * The lanes are filled block by block over the packets of the batch. The
+ * ciphertext is loaded before the store of the lanes, the previous block
+ * of CBC is kept in the register.
+ */
+
+#ifdef CISSA_AESNI
+
+#pragma GCC push_options
+#pragma GCC target("aes,sse2")
+
+#include <wmmintrin.h>
+
+static inline __attribute__((always_inline))
+void aesni_lanes(const __m128i *rk, const __m128i *c, const __m128i *p
+                 , uint8_t **dst, size_t n)
+{
+    __m128i s[CISSA_LANES];
+
+    for(size_t k = 0; k < n; ++k)
+        s[k] = _mm_xor_si128(c[k], rk[0]);
+    for(int i = 1; i < CISSA_ROUNDS; ++i)
+    {
+        for(size_t k = 0; k < n; ++k)
+            s[k] = _mm_aesdec_si128(s[k], rk[i]);
+    }
+    for(size_t k = 0; k < n; ++k)
+    {
+        s[k] = _mm_aesdeclast_si128(s[k], rk[CISSA_ROUNDS]);
+        _mm_storeu_si128((__m128i *)dst[k], _mm_xor_si128(s[k], p[k]));
+    }
+}
+
+static void aesni_decrypt(const cissa_schedule_t *schedule, const cissa_item_t *items, size_t count)
+{
+    __m128i rk[CISSA_ROUNDS + 1];
+    for(int i = 0; i <= CISSA_ROUNDS; ++i)
+        rk[i] = _mm_loadu_si128((const __m128i *)schedule->rk[i]);
+    const __m128i iv = _mm_loadu_si128((const __m128i *)cissa_iv);
+
+    __m128i c[CISSA_LANES];
+    __m128i p[CISSA_LANES];
+    uint8_t *dst[CISSA_LANES];
+    __m128i prev = iv;
+    size_t n = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *block = items[i].data;
+        for(size_t b = 0; b < items[i].blocks; ++b, block += CISSA_BLOCK_SIZE)
+        {
+            dst[n] = block;
+            c[n] = _mm_loadu_si128((const __m128i *)block);
+            p[n] = (b == 0) ? iv : prev;
+            prev = c[n];
+
+            if(++n == CISSA_LANES)
+            {
+                aesni_lanes(rk, c, p, dst, CISSA_LANES);
+                n = 0;
+            }
+        }
+    }
+
+    if(n > 0)
+        aesni_lanes(rk, c, p, dst, n);
+}
+
+#pragma GCC pop_options
+
+#endif /* CISSA_AESNI */
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#define CISSA_ARMV8 1
+
+#include <arm_neon.h>
+
+/* AESD is AddRoundKey, InvShiftRows and InvSubBytes, the same schedule */
+static inline __attribute__((always_inline))
+void armv8_lanes(const uint8x16_t *rk, const uint8x16_t *c, const uint8x16_t *p
+                 , uint8_t **dst, size_t n)
+{
+    uint8x16_t s[CISSA_LANES];
+
+    for(size_t k = 0; k < n; ++k)
+        s[k] = c[k];
+    for(int i = 0; i < CISSA_ROUNDS - 1; ++i)
+    {
+        for(size_t k = 0; k < n; ++k)
+            s[k] = vaesimcq_u8(vaesdq_u8(s[k], rk[i]));
+    }
+    for(size_t k = 0; k < n; ++k)
+    {
+        s[k] = vaesdq_u8(s[k], rk[CISSA_ROUNDS - 1]);
+        s[k] = veorq_u8(s[k], rk[CISSA_ROUNDS]);
+        vst1q_u8(dst[k], veorq_u8(s[k], p[k]));
+    }
+}
+
+static void armv8_decrypt(const cissa_schedule_t *schedule, const cissa_item_t *items, size_t count)
+{
+    uint8x16_t rk[CISSA_ROUNDS + 1];
+    for(int i = 0; i <= CISSA_ROUNDS; ++i)
+        rk[i] = vld1q_u8(schedule->rk[i]);
+    const uint8x16_t iv = vld1q_u8(cissa_iv);
+
+    uint8x16_t c[CISSA_LANES];
+    uint8x16_t p[CISSA_LANES];
+    uint8_t *dst[CISSA_LANES];
+    uint8x16_t prev = iv;
+    size_t n = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *block = items[i].data;
+        for(size_t b = 0; b < items[i].blocks; ++b, block += CISSA_BLOCK_SIZE)
+        {
+            dst[n] = block;
+            c[n] = vld1q_u8(block);
+            p[n] = (b == 0) ? iv : prev;
+            prev = c[n];
+
+            if(++n == CISSA_LANES)
+            {
+                armv8_lanes(rk, c, p, dst, CISSA_LANES);
+                n = 0;
+            }
+        }
+    }
+
+    if(n > 0)
+        armv8_lanes(rk, c, p, dst, n);
+}
+
+#endif /* __aarch64__ */
+
+static cissa_kernel_t cissa_kernel = NULL;
+
+static size_t cissa_batch_size(void)
+{
+    return CISSA_BATCH_SIZE;
+}
+
+static cissa_kernel_t cissa_kernel_select(void)
+{
+#if defined(CISSA_AESNI)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("aes"))
+        return aesni_decrypt;
+#elif defined(CISSA_ARMV8)
+    return armv8_decrypt;
+#endif
+    return table_decrypt;
+}
+
+static void * cissa_key_init(void)
+{
+    if(!cissa_kernel)
+        cissa_kernel = cissa_kernel_select();
+
+    return calloc(1, sizeof(cissa_key_t));
+}
+
+static void cissa_key_destroy(void *key)
+{
+    free(key);
+}
+
+static void cissa_key_set(void *arg, const uint8_t *even, const uint8_t *odd)
+{
+    cissa_key_t *key = arg;
+    if(even)
+        cissa_schedule(&key->even, even);
+    if(odd)
+        cissa_schedule(&key->odd, odd);
+}
+
+static void * cissa_batch_init(size_t size)
+{
+    cissa_batch_t *batch = malloc(sizeof(cissa_batch_t));
+    batch->even = calloc(size, sizeof(cissa_item_t));
+    batch->odd = calloc(size, sizeof(cissa_item_t));
+    return batch;
+}
+
+static void cissa_batch_destroy(void *arg)
+{
+    cissa_batch_t *batch = arg;
+    free(batch->even);
+    free(batch->odd);
+    free(batch);
+}
+
+static void cissa_decrypt(void *arg_key, void *arg_batch, uint8_t **packets, size_t count)
+{
+    cissa_key_t *key = arg_key;
+    cissa_batch_t *batch = arg_batch;
+    size_t even_count = 0;
+    size_t odd_count = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *ts = packets[i];
+        const uint8_t sc = TS_IS_SCRAMBLED(ts);
+        ts[3] &= ~0xC0;
+
+        if(!TS_IS_PAYLOAD(ts))
+            continue;
+
+        const size_t hdr_size = (TS_IS_AF(ts)) ? (4 + ts[4] + 1) : 4;
+        if(hdr_size + CISSA_BLOCK_SIZE > TS_PACKET_SIZE)
+            continue;
+
+        cissa_item_t *item;
+        if(sc == 0x80)
+            item = &batch->even[even_count++];
+        else if(sc == 0xC0)
+            item = &batch->odd[odd_count++];
+        else
+            continue;
+
+        item->data = &ts[hdr_size];
+        item->blocks = (TS_PACKET_SIZE - hdr_size) / CISSA_BLOCK_SIZE;
+    }
+
+    if(even_count > 0)
+        cissa_kernel(&key->even, batch->even, even_count);
+    if(odd_count > 0)
+        cissa_kernel(&key->odd, batch->odd, odd_count);
+}
+
+static const csa_engine_t cissa =
+{
+    .name = "cissa",
+    .key_size = 16,
+    .batch_size = cissa_batch_size,
+    .key_init = cissa_key_init,
+    .key_destroy = cissa_key_destroy,
+    .key_set = cissa_key_set,
+    .batch_init = cissa_batch_init,
+    .batch_destroy = cissa_batch_destroy,
+    .decrypt = cissa_decrypt,
+};
+
+/*
+ *  oooooooo8 ooooooooooo ooooo       ooooooooooo  oooooooo8 ooooooooooo
+ * 888         888    88   888         888    88 o888     88 88  888  88
+ *  888oooooo  888ooo8     888         888ooo8   888             888
+ *         888 888    oo   888      o  888    oo 888o     oo     888
+ * o88oooo888 o888ooo8888 o888ooooo88 o888ooo8888 888oooo88     o888o
+ *
+ */
+
+static const csa_engine_t *engine_list[] =
+{
+#if FFDECSA == 1
+    &ffdecsa,
+#endif
+#if LIBDVBCSA == 1
+    &libdvbcsa,
+#endif
+    NULL
+};
+
+/* engine for the "auto" option, selected once */
+static const csa_engine_t *engine_auto = NULL;
+
+/* measuring time per engine, usec */
+#define BENCH_TIME (20 * 1000)
+
+/* descrambles the synthetic batches, returns the speed in Mbit/s */
+static uint64_t csa_engine_bench(const csa_engine_t *engine)
+{
+    static const uint8_t cw[8] = { 0x11, 0x22, 0x33, 0x66, 0x44, 0x55, 0x66, 0xFF };
+
+    const size_t count = engine->batch_size();
+    uint8_t *buffer = malloc(count * TS_PACKET_SIZE);
+    uint8_t **packets = malloc(count * sizeof(uint8_t *));
+    for(size_t i = 0; i < count; ++i)
+    {
+        packets[i] = &buffer[i * TS_PACKET_SIZE];
+        memset(packets[i], (int)i, TS_PACKET_SIZE);
+    }
+
+    void *key = engine->key_init();
+    void *batch = engine->batch_init(count);
+    engine->key_set(key, cw, cw);
+
+    uint64_t size = 0;
+    uint64_t elapsed = 0;
+    const uint64_t start = asc_utime();
+    do
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            uint8_t *ts = packets[i];
+            ts[0] = 0x47;
+            ts[1] = 0x01;
+            ts[2] = 0x00;
+            ts[3] = 0x90 | (i & 0x0F);
+        }
+
+        engine->decrypt(key, batch, packets, count);
+        size += count * TS_PACKET_SIZE;
+        elapsed = asc_utime() - start;
+    } while(elapsed < BENCH_TIME);
+
+    engine->batch_destroy(batch);
+    engine->key_destroy(key);
+    free(packets);
+    free(buffer);
+
+    return (size * 8) / elapsed;
+}
+
+static const csa_engine_t * csa_engine_select(void)
+{
+    if(engine_list[1] == NULL)
+        return engine_list[0];
+
+    const csa_engine_t *engine = NULL;
+    uint64_t engine_speed = 0;
+
+    for(int i = 0; engine_list[i]; ++i)
+    {
+        const uint64_t speed = csa_engine_bench(engine_list[i]);
+        asc_log_debug(MSG("%s: %"PRIu64" Mbit/s"), engine_list[i]->name, speed);
+
+        if(!engine || speed > engine_speed)
+        {
+            engine = engine_list[i];
+            engine_speed = speed;
+        }
+    }
+
+    asc_log_info(MSG("select %s. %"PRIu64" Mbit/s"), engine->name, engine_speed);
+    return engine;
+}
+
+const csa_engine_t * csa_engine_get(const char *name)
+{
+    if(!name || !strcmp(name, "auto"))
+    {
+        if(!engine_auto)
+            engine_auto = csa_engine_select();
+        return engine_auto;
+    }
+
+    for(int i = 0; engine_list[i]; ++i)
+    {
+        if(!strcmp(engine_list[i]->name, name))
+            return engine_list[i];
+    }
+
+    // other cipher, selected by name only
+    if(!strcmp(cissa.name, name))
+        return &cissa;
+
+    return NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * Astra Module: SoftCAM
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSA_ENGINE_H_
+#define _CSA_ENGINE_H_ 1
+
+#include <astra.h>
+
+/*
+ * TS descramblers built in this binary. The engines take a batch of the
+ * scrambled TS packets, descramble the payload with the key of the packet
+ * parity and clear the scrambling control bits.
+ *
+ * DVB-CSA: ffdecsa and libdvbcsa, 8 bytes control word.
+ * DVB-CISSA: cissa, AES-128-CBC with 16 bytes key. not selected by "auto"
+ */
+
+typedef struct
+{
+    const char *name;
+    size_t key_size;                // even or odd key, bytes
+
+    size_t (*batch_size)(void);     // packets per batch
+
+    void * (*key_init)(void);       // even and odd key
+    void (*key_destroy)(void *key);
+    void (*key_set)(void *key, const uint8_t *even, const uint8_t *odd);
+
+    void * (*batch_init)(size_t size);
+    void (*batch_destroy)(void *batch);
+
+    // the batch and the key can be used on the worker thread
+    void (*decrypt)(void *key, void *batch, uint8_t **packets, size_t count);
+} csa_engine_t;
+
+/* NULL, "auto" - the fastest DVB-CSA engine on this host */
+const csa_engine_t * csa_engine_get(const char *name) __wur;
+
+#endif /* _CSA_ENGINE_H_ */
@@ -26,30 +26,30 @@
  *      upstream    - object, stream instance returned by module_instance:stream()
  *      name        - string, channel name
  *      biss        - string, BISS key, 16 chars length. example: biss = "1122330044556600"
+ *                    32 chars length for the "cissa" engine, the key of both parities
  *      cam         - object, cam instance returned by cam_module_instance:cam()
  *      cas_data    - string, additional paramters for CAS
  *      cas_pnr     - number, original PNR
+ *      threads     - number, descramble on the job pool of the process (core/job.h),
+ *                    minimal size of the pool. default: 0 - on the main thread
+ *      engine      - string, DVB-CSA engine: "ffdecsa", "libdvbcsa".
+ *                    default: "auto" - the fastest engine on this host
+ *                    "cissa" - DVB-CISSA (AES-128), with the biss key only
+ *      cache       - string, warm start file of the instance. PAT, PMT and the
+ *                    last control words are stored, on the next start the
+ *                    stream is descrambled before the first ECM response
+ *      batch_latency
+ *                  - number, milliseconds. limits the delay of the packets in
+ *                    the batch: the partial batch is descrambled on the timer,
+ *                    and the batch size is reduced to the count of the packets
+ *                    received in this time, measured each second.
+ *                    for the low bitrate services. default: 0 - the full batch
  */
 
 #include <astra.h>
 #include "module_cam.h"
 #include "cas/cas_list.h"
-
-#ifndef FFDECSA
-#   define FFDECSA 1
-#endif
-
-#ifndef LIBDVBCSA
-#   define LIBDVBCSA 0
-#endif
-
-#if FFDECSA == 1
-#   include "FFdecsa/FFdecsa.h"
-#elif LIBDVBCSA == 1
-#   include <dvbcsa/dvbcsa.h>
-#else
-#   error "DVB-CSA is not defined"
-#endif
+#include "csa_engine.h"
 
 typedef struct
 {
@@ -57,27 +57,23 @@ typedef struct
     uint16_t ecm_pid;
 
     bool is_keys;
-    uint8_t parity;
-
-#if FFDECSA == 1
 
     void *keys;
-    uint8_t **batch;
-
-#elif LIBDVBCSA == 1
-
-    struct dvbcsa_bs_key_s *even_key;
-    struct dvbcsa_bs_key_s *odd_key;
-    struct dvbcsa_bs_batch_s *batch;
-
-#endif
-
+    void *batch;
+    uint8_t **packets;
     size_t batch_skip;
 
     int new_key_id;  // 0 - not, 1 - first key, 2 - second key, 3 - both keys
     uint8_t new_key[16];
 
     uint64_t sendtime;
+
+    // crypto period by the parity of the scrambled packets
+    uint8_t flip_parity;
+    uint64_t flip_time;
+    uint64_t period;
+    uint64_t key_time[2];   // last update of the even and odd keys
+    bool is_prefetch;       // ECM is requested again in the current period
 } ca_stream_t;
 
 typedef struct
@@ -87,6 +83,34 @@ typedef struct
     ca_stream_t *ca_stream;
 } el_stream_t;
 
+#define DECRYPT_TRACE_SIZE 8
+
+/* positions of the sampled packets in the buffer, in order */
+typedef struct
+{
+    uint64_t time[DECRYPT_TRACE_SIZE]; // ingress time
+    size_t pos[DECRYPT_TRACE_SIZE];
+    size_t read;
+    size_t count;
+} decrypt_trace_t;
+
+/* clusters in progress on the worker threads, per module */
+#define DECRYPT_JOB_MAX 4
+
+typedef struct
+{
+    asc_job_t job;
+
+    ca_stream_t *ca_stream;
+    const csa_engine_t *engine;
+
+    void *batch;
+    uint8_t **packets;
+    size_t batch_skip;
+
+    size_t size; // storage bytes which are ready on completion
+} decrypt_job_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -102,6 +126,7 @@ struct module_data_t
     asc_list_t *el_list;
     asc_list_t *ca_list;
 
+    const csa_engine_t *engine;
     size_t batch_size;
 
     struct
@@ -110,28 +135,128 @@ struct module_data_t
         size_t size;
         size_t count;
         size_t dsc_count;
+        size_t job_count; // bytes waiting for the worker threads
         size_t read;
         size_t write;
     } storage;
 
+    decrypt_job_t *job_list; // ring, NULL if descramble on the main thread
+    size_t job_read;
+    size_t job_count;
+
+    /*
+     * delay of the stream, the tail of the storage. packets are descrambled
+     * when the cursor passes them, the storage is larger by the shift size
+     */
     struct
     {
-        uint8_t *buffer;
         size_t size;
         size_t count;
-        size_t read;
-        size_t write;
+        size_t read; // position in the storage
     } shift;
 
+    /* sampled packets in the storage, see module_stream_trace() */
+    decrypt_trace_t storage_trace;
+
+    asc_timer_t *prefetch_timer;
+
+    /* partial batch, see on_batch_timer() */
+    struct
+    {
+        uint64_t latency; // us, 0 - disabled
+        size_t limit; // packets, up to batch_size
+        asc_timer_t *timer;
+        uint64_t pending_time; // first packet after the last flush, 0 - none
+
+        uint64_t rate_time;
+        uint64_t rate_count; // scrambled packets since rate_time
+    } batch;
+
+    /* Metrics */
+    uint64_t ecm_found;
+    uint64_t ecm_not_found;
+    uint64_t ecm_response_time; // last, milliseconds
+
     /* Base */
-    mpegts_psi_t *stream[MAX_PID];
+    mpegts_pid_map_t stream; // mpegts_psi_t * by PID
     mpegts_psi_t *pmt;
+
+    mpegts_cache_t *cache;
 };
 
 #define BISS_CAID 0x2600
+
+#define BATCH_TIMER_MIN 5 // ms
+#define BATCH_RATE_INTERVAL (1000 * 1000) // us
+
+/* warm start cache records, control words by the ECM PID */
+#define CACHE_PAT MPEGTS_CACHE_KEY(0x00, 0x00)
+#define CACHE_PMT MPEGTS_CACHE_KEY(0x02, 0x00)
+#define CACHE_CW(_ecm_pid) MPEGTS_CACHE_KEY(0x80, _ecm_pid)
+
+/* control words without the crypto period are used for this time, seconds */
+#define CACHE_CW_TTL 20
+
+typedef struct
+{
+    int64_t time; // unix time of the response
+    uint32_t period; // milliseconds, 0 if not known
+    uint8_t key[16];
+} cache_cw_t;
+
 #define MSG(_msg) "[decrypt %s] " _msg, mod->name
 
-void ca_stream_set_keys(ca_stream_t *ca_stream, const uint8_t *even, const uint8_t *odd);
+static inline mpegts_psi_t * stream_get(module_data_t *mod, uint16_t pid)
+{
+    return (mpegts_psi_t *)mpegts_pid_map_get(&mod->stream, pid);
+}
+
+static inline void stream_set(module_data_t *mod, uint16_t pid, mpegts_psi_t *psi)
+{
+    mpegts_pid_map_set(&mod->stream, pid, (uintptr_t)psi);
+}
+
+void ca_stream_set_keys(  module_data_t *mod, ca_stream_t *ca_stream
+                        , const uint8_t *even, const uint8_t *odd)
+{
+    mod->engine->key_set(ca_stream->keys, even, odd);
+    asc_trace3(decrypt_key_change, mod->name, ca_stream, ((even) ? 1 : 0) | ((odd) ? 2 : 0));
+}
+
+/* keys of the previous run are valid till the end of the next crypto period */
+static void ca_stream_warm_start(module_data_t *mod, ca_stream_t *ca_stream)
+{
+    size_t size = 0;
+    const uint8_t *data = mpegts_cache_get(mod->cache, CACHE_CW(ca_stream->ecm_pid), &size);
+    if(!data || size != sizeof(cache_cw_t))
+        return;
+
+    cache_cw_t cw;
+    memcpy(&cw, data, sizeof(cw));
+
+    const int64_t ttl = (cw.period > 0) ? (cw.period * 2 / 1000 + 1) : CACHE_CW_TTL;
+    const int64_t age = (int64_t)time(NULL) - cw.time;
+    if(age < 0 || age > ttl)
+        return;
+
+    memcpy(ca_stream->new_key, cw.key, sizeof(cw.key));
+    ca_stream_set_keys(mod, ca_stream, &cw.key[0], &cw.key[8]);
+    ca_stream->is_keys = true;
+    ca_stream->period = (uint64_t)cw.period * 1000;
+
+    asc_log_debug(MSG("ECM pid:%d keys from cache, %"PRId64"s ago")
+                  , ca_stream->ecm_pid, age);
+}
+
+static void ca_stream_cache_keys(module_data_t *mod, ca_stream_t *ca_stream)
+{
+    cache_cw_t cw;
+    memset(&cw, 0, sizeof(cw));
+    cw.time = time(NULL);
+    cw.period = ca_stream->period / 1000;
+    memcpy(cw.key, ca_stream->new_key, sizeof(cw.key));
+    mpegts_cache_set(mod->cache, CACHE_CW(ca_stream->ecm_pid), &cw, sizeof(cw));
+}
 
 ca_stream_t * ca_stream_init(module_data_t *mod, uint16_t ecm_pid)
 {
@@ -139,12 +264,8 @@ ca_stream_t * ca_stream_init(module_data_t *mod, uint16_t ecm_pid)
     asc_list_for(mod->ca_list)
     {
         ca_stream = asc_list_data(mod->ca_list);
-#if FFDECSA == 1
-        return ca_stream;
-#else
         if(ca_stream->ecm_pid == ecm_pid)
             return ca_stream;
-#endif
     }
 
     ca_stream = malloc(sizeof(ca_stream_t));
@@ -152,59 +273,46 @@ ca_stream_t * ca_stream_init(module_data_t *mod, uint16_t ecm_pid)
 
     ca_stream->ecm_pid = ecm_pid;
 
-#if FFDECSA == 1
-
-    ca_stream->keys = get_key_struct();
-    ca_stream->batch = calloc(mod->batch_size * 2 + 2, sizeof(uint8_t *));
-
-#elif LIBDVBCSA == 1
-
-    ca_stream->even_key = dvbcsa_bs_key_alloc();
-    ca_stream->odd_key = dvbcsa_bs_key_alloc();
-    ca_stream->batch = calloc(mod->batch_size + 1, sizeof(struct dvbcsa_bs_batch_s));
-
-#endif
+    ca_stream->keys = mod->engine->key_init();
+    ca_stream->batch = mod->engine->batch_init(mod->batch_size);
+    ca_stream->packets = calloc(mod->batch_size, sizeof(uint8_t *));
 
     asc_list_insert_tail(mod->ca_list, ca_stream);
 
+    if(mod->cache && ecm_pid != NULL_TS_PID)
+        ca_stream_warm_start(mod, ca_stream);
+
     return ca_stream;
 }
 
-void ca_stream_destroy(ca_stream_t *ca_stream)
+void ca_stream_destroy(module_data_t *mod, ca_stream_t *ca_stream)
 {
-#if FFDECSA == 1
-
-    free_key_struct(ca_stream->keys);
-    free(ca_stream->batch);
-
-#elif LIBDVBCSA == 1
-
-    dvbcsa_bs_key_free(ca_stream->even_key);
-    dvbcsa_bs_key_free(ca_stream->odd_key);
-    free(ca_stream->batch);
-
-#endif
+    mod->engine->key_destroy(ca_stream->keys);
+    mod->engine->batch_destroy(ca_stream->batch);
+    free(ca_stream->packets);
 
     free(ca_stream);
 }
 
-void ca_stream_set_keys(ca_stream_t *ca_stream, const uint8_t *even, const uint8_t *odd)
-{
-#if FFDECSA == 1
+/* keys for the parity are expected to be changed not often than this interval */
+#define FLIP_MIN_INTERVAL (1 * 1000 * 1000)
 
-    if(even)
-        set_even_control_word(ca_stream->keys, even);
-    if(odd)
-        set_odd_control_word(ca_stream->keys, odd);
+static inline void ca_stream_check_parity(ca_stream_t *ca_stream, uint8_t parity)
+{
+    if(parity == ca_stream->flip_parity)
+        return;
 
-#elif LIBDVBCSA == 1
+    const uint64_t now = asc_utime();
+    ca_stream->flip_parity = parity;
 
-    if(even)
-        dvbcsa_bs_key_set(even, ca_stream->even_key);
-    if(odd)
-        dvbcsa_bs_key_set(odd, ca_stream->odd_key);
+    // packets of the previous parity may remain for a while in the other pids
+    if(ca_stream->flip_time != 0 && now - ca_stream->flip_time < FLIP_MIN_INTERVAL)
+        return;
 
-#endif
+    if(ca_stream->flip_time != 0)
+        ca_stream->period = now - ca_stream->flip_time;
+    ca_stream->flip_time = now;
+    ca_stream->is_prefetch = false;
 }
 
 static void module_decrypt_cas_init(module_data_t *mod)
@@ -218,8 +326,12 @@ static void module_decrypt_cas_init(module_data_t *mod)
     asc_assert(mod->__decrypt.cas != NULL, MSG("CAS with CAID:0x%04X not found"), mod->caid);
 }
 
+static void decrypt_wait(module_data_t *mod);
+
 static void module_decrypt_cas_destroy(module_data_t *mod)
 {
+    decrypt_wait(mod);
+
     if(mod->__decrypt.cas)
     {
         free(mod->__decrypt.cas->self);
@@ -247,33 +359,33 @@ static void module_decrypt_cas_destroy(module_data_t *mod)
         ; asc_list_remove_current(mod->ca_list))
     {
         ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
-        ca_stream_destroy(ca_stream);
+        ca_stream_destroy(mod, ca_stream);
     }
 }
 
 static void stream_reload(module_data_t *mod)
 {
-    mod->stream[0]->crc32 = 0;
+    stream_get(mod, 0)->crc32 = 0;
 
-    for(int i = 1; i < MAX_PID; ++i)
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
     {
-        if(mod->stream[i])
-        {
-            mpegts_psi_destroy(mod->stream[i]);
-            mod->stream[i] = NULL;
-        }
+        if(i == 0)
+            continue;
+        mpegts_psi_destroy(stream_get(mod, i));
+        stream_set(mod, i, NULL);
     }
 
     module_decrypt_cas_destroy(mod);
 
     mod->storage.count = 0;
     mod->storage.dsc_count = 0;
+    mod->storage.job_count = 0;
     mod->storage.read = 0;
     mod->storage.write = 0;
+    mod->storage_trace.count = 0;
 
     mod->shift.count = 0;
     mod->shift.read = 0;
-    mod->shift.write = 0;
 }
 
 /*
@@ -301,16 +413,32 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         return;
     }
 
+    const uint8_t *pointer;
+
     // reload stream
     if(psi->crc32 != 0)
     {
+        // other programs are changed, PMT of the program is the same
+        PAT_ITEMS_FOREACH(psi, pointer)
+        {
+            if(PAT_ITEM_GET_PNR(psi, pointer) != 0)
+                break;
+        }
+        if(   !PAT_ITEMS_EOL(psi, pointer)
+           && PAT_ITEM_GET_PNR(psi, pointer) == mod->__decrypt.pnr
+           && stream_get(mod, PAT_ITEM_GET_PID(psi, pointer))
+           && stream_get(mod, PAT_ITEM_GET_PID(psi, pointer))->type == MPEGTS_PACKET_PMT)
+        {
+            psi->crc32 = crc32;
+            return;
+        }
+
         asc_log_warning(MSG("PAT changed. Reload stream info"));
         stream_reload(mod);
     }
 
     psi->crc32 = crc32;
 
-    const uint8_t *pointer;
     PAT_ITEMS_FOREACH(psi, pointer)
     {
         const uint16_t pnr = PAT_ITEM_GET_PNR(psi, pointer);
@@ -318,7 +446,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
             continue; // skip NIT
 
         const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
-        if(mod->stream[pid])
+        if(stream_get(mod, pid))
             asc_log_error(MSG("Skip PMT pid:%d"), pid);
         else
         {
@@ -326,7 +454,10 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
             if(mod->__decrypt.cas_pnr == 0)
                 mod->__decrypt.cas_pnr = pnr;
 
-            mod->stream[pid] = mpegts_psi_init(MPEGTS_PACKET_PMT, pid);
+            stream_set(mod, pid, mpegts_psi_init(MPEGTS_PACKET_PMT, pid));
+
+            if(mod->cache)
+                mpegts_cache_set_psi(mod->cache, CACHE_PAT, psi);
         }
 
         break;
@@ -335,7 +466,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     if(mod->__decrypt.cam && mod->__decrypt.cam->is_ready)
     {
         module_decrypt_cas_init(mod);
-        mod->stream[1] = mpegts_psi_init(MPEGTS_PACKET_CAT, 1);
+        stream_set(mod, 1, mpegts_psi_init(MPEGTS_PACKET_CAT, 1));
     }
 }
 
@@ -356,16 +487,16 @@ static bool __cat_check_desc(module_data_t *mod, const uint8_t *desc)
     if(pid == NULL_TS_PID)
         return false;
 
-    if(mod->stream[pid])
+    if(stream_get(mod, pid))
     {
-        if(!(mod->stream[pid]->type & MPEGTS_PACKET_CA))
+        if(!(stream_get(mod, pid)->type & MPEGTS_PACKET_CA))
         {
             asc_log_warning(MSG("Skip EMM pid:%d"), pid);
             return false;
         }
     }
     else
-        mod->stream[pid] = mpegts_psi_init(MPEGTS_PACKET_CA, pid);
+        stream_set(mod, pid, mpegts_psi_init(MPEGTS_PACKET_CA, pid));
 
     if(mod->disable_emm || mod->__decrypt.cam->disable_emm)
         return false;
@@ -374,7 +505,7 @@ static bool __cat_check_desc(module_data_t *mod, const uint8_t *desc)
        && DESC_CA_CAID(desc) == mod->caid
        && module_cas_check_descriptor(mod->__decrypt.cas, desc))
     {
-        mod->stream[pid]->type = MPEGTS_PACKET_EMM;
+        stream_get(mod, pid)->type = MPEGTS_PACKET_EMM;
         asc_log_info(MSG("Select EMM pid:%d"), pid);
         return true;
     }
@@ -443,8 +574,8 @@ static ca_stream_t * __pmt_check_desc(  module_data_t *mod
     if(pid == NULL_TS_PID)
         return NULL;
 
-    if(mod->stream[pid] == NULL)
-        mod->stream[pid] = mpegts_psi_init(MPEGTS_PACKET_CA, pid);
+    if(stream_get(mod, pid) == NULL)
+        stream_set(mod, pid, mpegts_psi_init(MPEGTS_PACKET_CA, pid));
 
     do
     {
@@ -452,7 +583,7 @@ static ca_stream_t * __pmt_check_desc(  module_data_t *mod
             break;
         if(is_ecm_selected)
             break;
-        if(!(mod->stream[pid]->type & MPEGTS_PACKET_CA))
+        if(!(stream_get(mod, pid)->type & MPEGTS_PACKET_CA))
             break;
 
         if(mod->ecm_pid == 0)
@@ -475,7 +606,7 @@ static ca_stream_t * __pmt_check_desc(  module_data_t *mod
                 return ca_stream;
         }
 
-        mod->stream[pid]->type = MPEGTS_PACKET_ECM;
+        stream_get(mod, pid)->type = MPEGTS_PACKET_ECM;
         asc_log_info(MSG("Select ECM pid:%d"), pid);
         return ca_stream_init(mod, pid);
     } while(0);
@@ -484,6 +615,128 @@ static ca_stream_t * __pmt_check_desc(  module_data_t *mod
     return NULL;
 }
 
+static bool ca_stream_is_used(module_data_t *mod, ca_stream_t *ca_stream)
+{
+    asc_list_for(mod->el_list)
+    {
+        el_stream_t *el_stream = asc_list_data(mod->el_list);
+        if(el_stream->ca_stream == ca_stream)
+            return true;
+    }
+    return false;
+}
+
+static void decrypt(module_data_t *mod);
+
+/*
+ * The packets are delayed in the storage, up to DECRYPT_TRACE_SIZE sampled
+ * packets are kept. The stamp is restored
+ * when the packet at the saved position is sent, the other packets are sent
+ * without it.
+ */
+
+static inline void decrypt_trace_put(decrypt_trace_t *trace, uint64_t time, size_t pos)
+{
+    if(!time || trace->count >= DECRYPT_TRACE_SIZE)
+        return;
+
+    /* first packet of the sampled block */
+    const size_t last = (trace->read + trace->count + DECRYPT_TRACE_SIZE - 1) % DECRYPT_TRACE_SIZE;
+    if(trace->count > 0 && trace->time[last] == time)
+        return;
+
+    const size_t i = (trace->read + trace->count) % DECRYPT_TRACE_SIZE;
+    trace->time[i] = time;
+    trace->pos[i] = pos;
+    ++trace->count;
+}
+
+static inline uint64_t decrypt_trace_take(decrypt_trace_t *trace, size_t pos)
+{
+    if(!trace->count || trace->pos[trace->read] != pos)
+        return 0;
+
+    const uint64_t time = trace->time[trace->read];
+    trace->read = (trace->read + 1) % DECRYPT_TRACE_SIZE;
+    --trace->count;
+    return time;
+}
+
+static void storage_send(module_data_t *mod)
+{
+    const uint64_t trace_time
+        = module_stream_trace_set(decrypt_trace_take(&mod->storage_trace, mod->storage.read));
+    module_stream_send(mod, &mod->storage.buffer[mod->storage.read]);
+    module_stream_trace_set(trace_time);
+
+    mod->storage.read += TS_PACKET_SIZE;
+    if(mod->storage.read == mod->storage.size)
+        mod->storage.read = 0;
+    mod->storage.count -= TS_PACKET_SIZE;
+}
+
+/* storage bytes which are passed by the shift cursor */
+static inline size_t storage_shifted(const module_data_t *mod)
+{
+    return mod->storage.count - mod->shift.count;
+}
+
+/* release ECM streams which are not referenced by the updated PMT */
+static void ca_stream_sweep(module_data_t *mod, ca_stream_t *ca_stream_g)
+{
+    bool is_stale = false;
+    asc_list_for(mod->ca_list)
+    {
+        ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+        if(ca_stream != ca_stream_g && !ca_stream_is_used(mod, ca_stream))
+        {
+            is_stale = true;
+            break;
+        }
+    }
+    if(!is_stale)
+        return;
+
+    // stored packets of the stale streams are descrambled with the current keys
+    decrypt(mod);
+    decrypt_wait(mod);
+
+    asc_list_first(mod->ca_list);
+    while(!asc_list_eol(mod->ca_list))
+    {
+        ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+        mpegts_psi_t *ecm = stream_get(mod, ca_stream->ecm_pid);
+
+        // BISS stream has no ECM
+        if(   ca_stream == ca_stream_g
+           || !ecm || ecm->type != MPEGTS_PACKET_ECM
+           || ca_stream_is_used(mod, ca_stream))
+        {
+            asc_list_next(mod->ca_list);
+            continue;
+        }
+
+        asc_log_info(MSG("Release ECM pid:%d"), ca_stream->ecm_pid);
+        ecm->type = MPEGTS_PACKET_CA;
+        ca_stream_destroy(mod, ca_stream);
+        asc_list_remove_current(mod->ca_list);
+    }
+
+    if(asc_list_size(mod->ca_list) > 0)
+        return;
+
+    // without CA the packets are sent as is, see on_ts()
+    while(mod->storage.count > 0)
+        storage_send(mod);
+    mod->storage.dsc_count = 0;
+    mod->storage.read = 0;
+    mod->storage.write = 0;
+    mod->storage_trace.count = 0;
+
+    mod->shift.count = 0;
+    mod->shift.read = 0;
+}
+
 static void on_pmt(void *arg, mpegts_psi_t *psi)
 {
     module_data_t *mod = arg;
@@ -513,16 +766,26 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         return;
     }
 
-    // reload stream
-    if(psi->crc32 != 0)
+    // update stream, the CAS and the keys of the selected ECM are kept
+    const bool is_update = (psi->crc32 != 0);
+    if(is_update)
     {
-        asc_log_warning(MSG("PMT changed. Reload stream info"));
-        stream_reload(mod);
-        return;
+        asc_log_warning(MSG("PMT changed. Update stream info"));
+
+        for(  asc_list_first(mod->el_list)
+            ; !asc_list_eol(mod->el_list)
+            ; asc_list_remove_current(mod->el_list))
+        {
+            el_stream_t *el_stream = asc_list_data(mod->el_list);
+            free(el_stream);
+        }
     }
 
     psi->crc32 = crc32;
 
+    if(mod->cache)
+        mpegts_cache_set_psi(mod->cache, CACHE_PMT, psi);
+
     // Make custom PMT and set descriptors for CAS
     mod->pmt->pid = psi->pid;
 
@@ -602,6 +865,9 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     PSI_SET_SIZE(mod->pmt);
     PSI_SET_CRC32(mod->pmt);
 
+    if(is_update)
+        ca_stream_sweep(mod, ca_stream_g);
+
     mpegts_psi_demux(  mod->pmt
                      , (void (*)(void *, const uint8_t *))__module_stream_send
                      , &mod->__stream);
@@ -616,6 +882,81 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
  *
  */
 
+/*
+ * The key for the next period is usually received in the first half of the current.
+ * If it is not received near the parity change (lost ECM or failed response),
+ * the next ECM is sent again, without waiting for the change of the ECM type.
+ */
+static void on_prefetch(void *arg)
+{
+    module_data_t *mod = arg;
+
+    if(!mod->__decrypt.cas)
+        return;
+
+    const uint64_t now = asc_utime();
+
+    asc_list_for(mod->ca_list)
+    {
+        ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+        if(ca_stream->period == 0 || ca_stream->is_prefetch)
+            continue;
+
+        const int next = (ca_stream->flip_parity == 0x80) ? 1 : 0;
+        if(ca_stream->key_time[next] > ca_stream->flip_time)
+            continue;
+
+        if(now - ca_stream->flip_time < ca_stream->period * 3 / 4)
+            continue;
+
+        asc_log_debug(  MSG("%s key is not received. request ECM again")
+                      , (next == 0) ? "even" : "odd");
+        ca_stream->is_prefetch = true;
+        ca_stream->ecm_type = 0x00;
+    }
+}
+
+/*
+ * Low bitrate service fills the batch for a long time. The batch size is
+ * reduced to the packets received in the batch_latency time, and the
+ * partial batch is descrambled on the timer. Stored packets are sent on
+ * the flush, otherwise they wait for the next packets of the stream.
+ */
+static void on_batch_timer(void *arg)
+{
+    module_data_t *mod = arg;
+
+    const uint64_t now = asc_loop_utime();
+
+    if(now - mod->batch.rate_time >= BATCH_RATE_INTERVAL)
+    {
+        const uint64_t count = mod->batch.rate_count * mod->batch.latency
+                             / (now - mod->batch.rate_time);
+        if(count < 1)
+            mod->batch.limit = 1;
+        else if(count < mod->batch_size)
+            mod->batch.limit = (size_t)count;
+        else
+            mod->batch.limit = mod->batch_size;
+
+        mod->batch.rate_time = now;
+        mod->batch.rate_count = 0;
+    }
+
+    if(!mod->batch.pending_time || now - mod->batch.pending_time < mod->batch.latency)
+        return;
+
+    asc_trace2(decrypt_batch_deadline, mod->name, mod->batch.limit);
+    decrypt(mod);
+    decrypt_wait(mod);
+
+    while(mod->storage.dsc_count > 0)
+    {
+        storage_send(mod);
+        mod->storage.dsc_count -= TS_PACKET_SIZE;
+    }
+}
+
 static void on_em(void *arg, mpegts_psi_t *psi)
 {
     module_data_t *mod = arg;
@@ -656,6 +997,10 @@ static void on_em(void *arg, mpegts_psi_t *psi)
 
         ca_stream->ecm_type = em_type;
         ca_stream->sendtime = asc_utime();
+
+        module_cam_send_ecm(  &mod->__decrypt, ca_stream, ca_stream->ecm_pid
+                            , psi->buffer, psi->buffer_size);
+        return;
     }
     else if(em_type >= 0x82 && em_type <= 0x8F)
     { /* EMM */
@@ -664,16 +1009,11 @@ static void on_em(void *arg, mpegts_psi_t *psi)
 
         if(!module_cas_check_em(mod->__decrypt.cas, psi))
             return;
+
+        module_cam_send_emm(&mod->__decrypt, psi->buffer, psi->buffer_size);
     }
     else
-    {
         asc_log_error(MSG("wrong packet type 0x%02X"), em_type);
-        return;
-    }
-
-    mod->__decrypt.cam->send_em(  mod->__decrypt.cam->self
-                                , &mod->__decrypt, ca_stream
-                                , psi->buffer, psi->buffer_size);
 }
 
 /*
@@ -685,52 +1025,99 @@ static void on_em(void *arg, mpegts_psi_t *psi)
  *
  */
 
-static void decrypt(module_data_t *mod)
+static void on_decrypt_job(asc_job_t *job)
 {
-    asc_list_for(mod->ca_list)
+    decrypt_job_t *item = (decrypt_job_t *)job->arg;
+    item->engine->decrypt(  item->ca_stream->keys, item->batch
+                          , item->packets, item->batch_skip);
+}
+
+/* release the storage of the completed jobs, in order of submission */
+static void decrypt_complete(module_data_t *mod)
+{
+    while(mod->job_count > 0)
     {
-        ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+        decrypt_job_t *item = &mod->job_list[mod->job_read];
+        if(!asc_job_is_done(&item->job))
+            break;
 
-        if(ca_stream->batch_skip > 0)
-        {
+        mod->storage.dsc_count += item->size;
+        mod->storage.job_count -= item->size;
+        mod->job_read = (mod->job_read + 1) % DECRYPT_JOB_MAX;
+        --mod->job_count;
+    }
+}
 
-#if FFDECSA == 1
+static void decrypt_wait(module_data_t *mod)
+{
+    for(size_t i = 0; i < mod->job_count; ++i)
+    {
+        const size_t idx = (mod->job_read + i) % DECRYPT_JOB_MAX;
+        asc_job_wait(&mod->job_list[idx].job);
+    }
+    decrypt_complete(mod);
+}
 
-            ca_stream->batch[ca_stream->batch_skip] = NULL;
+static void decrypt_submit(module_data_t *mod, ca_stream_t *ca_stream)
+{
+    if(mod->job_count == DECRYPT_JOB_MAX)
+    {
+        asc_job_wait(&mod->job_list[mod->job_read].job);
+        decrypt_complete(mod);
+    }
 
-            size_t i = 0, i_size = ca_stream->batch_skip / 2;
-            while(i < i_size)
-                i += decrypt_packets(ca_stream->keys, ca_stream->batch);
+    const size_t idx = (mod->job_read + mod->job_count) % DECRYPT_JOB_MAX;
+    decrypt_job_t *item = &mod->job_list[idx];
+    ++mod->job_count;
 
-#elif LIBDVBCSA == 1
+    // the stream batch is filled again while the job is in progress
+    item->ca_stream = ca_stream;
+    item->batch_skip = ca_stream->batch_skip;
+    memcpy(item->packets, ca_stream->packets, ca_stream->batch_skip * sizeof(uint8_t *));
+    item->size = 0;
 
-            ca_stream->batch[ca_stream->batch_skip].data = NULL;
+    asc_job_submit(&item->job, NULL);
+}
 
-            if(ca_stream->parity == 0x80)
-                dvbcsa_bs_decrypt(ca_stream->even_key, ca_stream->batch, TS_BODY_SIZE);
-            else if(ca_stream->parity == 0xC0)
-                dvbcsa_bs_decrypt(ca_stream->odd_key, ca_stream->batch, TS_BODY_SIZE);
+static void decrypt(module_data_t *mod)
+{
+    mod->batch.pending_time = 0;
 
-#endif
+    asc_list_for(mod->ca_list)
+    {
+        ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+
+        if(ca_stream->batch_skip > 0)
+        {
+            asc_trace2(decrypt_batch_flush, mod->name, ca_stream->batch_skip);
+            if(mod->job_list)
+                decrypt_submit(mod, ca_stream);
+            else
+                mod->engine->decrypt(  ca_stream->keys, ca_stream->batch
+                                     , ca_stream->packets, ca_stream->batch_skip);
 
             ca_stream->batch_skip = 0;
         }
 
+        // keys are in use by the workers until the previous clusters are ready
+        if(ca_stream->new_key_id != 0)
+            decrypt_wait(mod);
+
         // check new key
         switch(ca_stream->new_key_id)
         {
             case 0:
                 break;
             case 1:
-                ca_stream_set_keys(ca_stream, &ca_stream->new_key[0], NULL);
+                ca_stream_set_keys(mod, ca_stream, &ca_stream->new_key[0], NULL);
                 ca_stream->new_key_id = 0;
                 break;
             case 2:
-                ca_stream_set_keys(ca_stream, NULL, &ca_stream->new_key[8]);
+                ca_stream_set_keys(mod, ca_stream, NULL, &ca_stream->new_key[8]);
                 ca_stream->new_key_id = 0;
                 break;
             case 3:
-                ca_stream_set_keys(  ca_stream
+                ca_stream_set_keys(  mod, ca_stream
                                    , &ca_stream->new_key[0]
                                    , &ca_stream->new_key[8]);
                 ca_stream->new_key_id = 0;
@@ -738,37 +1125,53 @@ static void decrypt(module_data_t *mod)
         }
     }
 
-    mod->storage.dsc_count = mod->storage.count;
+    if(!mod->job_list)
+    {
+        mod->storage.dsc_count = storage_shifted(mod);
+        return;
+    }
+
+    // packets stored after the previous submit are ready with the last job
+    const size_t size = storage_shifted(mod) - mod->storage.dsc_count - mod->storage.job_count;
+    if(mod->job_count > 0)
+    {
+        const size_t idx = (mod->job_read + mod->job_count - 1) % DECRYPT_JOB_MAX;
+        mod->job_list[idx].size += size;
+        mod->storage.job_count += size;
+    }
+    else
+        mod->storage.dsc_count += size;
 }
 
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
     const uint16_t pid = TS_GET_PID(ts);
+    mpegts_psi_t *psi = stream_get(mod, pid);
 
     if(pid == 0)
     {
-        mpegts_psi_mux(mod->stream[pid], ts, on_pat, mod);
+        mpegts_psi_mux(psi, ts, on_pat, mod);
     }
     else if(pid == 1)
     {
-        if(mod->stream[pid])
-            mpegts_psi_mux(mod->stream[pid], ts, on_cat, mod);
+        if(psi)
+            mpegts_psi_mux(psi, ts, on_cat, mod);
         return;
     }
     else if(pid == NULL_TS_PID)
     {
         return;
     }
-    else if(mod->stream[pid])
+    else if(psi)
     {
-        switch(mod->stream[pid]->type)
+        switch(psi->type)
         {
             case MPEGTS_PACKET_PMT:
-                mpegts_psi_mux(mod->stream[pid], ts, on_pmt, mod);
+                mpegts_psi_mux(psi, ts, on_pmt, mod);
                 return;
             case MPEGTS_PACKET_ECM:
             case MPEGTS_PACKET_EMM:
-                mpegts_psi_mux(mod->stream[pid], ts, on_em, mod);
+                mpegts_psi_mux(psi, ts, on_em, mod);
             case MPEGTS_PACKET_CA:
                 return;
             default:
@@ -782,109 +1185,140 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         return;
     }
 
-    if(mod->shift.buffer)
+    // the only copy of the packet, descrambled in place and sent from the storage
+    decrypt_trace_put(&mod->storage_trace, module_stream_trace_time, mod->storage.write);
+    uint8_t *dst = &mod->storage.buffer[mod->storage.write];
+    memcpy(dst, ts, TS_PACKET_SIZE);
+
+    mod->storage.write += TS_PACKET_SIZE;
+    if(mod->storage.write == mod->storage.size)
+        mod->storage.write = 0;
+    mod->storage.count += TS_PACKET_SIZE;
+
+    if(mod->shift.size)
     {
-        memcpy(&mod->shift.buffer[mod->shift.write], ts, TS_PACKET_SIZE);
-        mod->shift.write += TS_PACKET_SIZE;
-        if(mod->shift.write == mod->shift.size)
-            mod->shift.write = 0;
         mod->shift.count += TS_PACKET_SIZE;
-
         if(mod->shift.count < mod->shift.size)
             return;
 
-        ts = &mod->shift.buffer[mod->shift.read];
+        dst = &mod->storage.buffer[mod->shift.read];
         mod->shift.read += TS_PACKET_SIZE;
-        if(mod->shift.read == mod->shift.size)
+        if(mod->shift.read == mod->storage.size)
             mod->shift.read = 0;
         mod->shift.count -= TS_PACKET_SIZE;
     }
 
-    uint8_t *dst = &mod->storage.buffer[mod->storage.write];
-    memcpy(dst, ts, TS_PACKET_SIZE);
+    const uint8_t sc = TS_IS_SCRAMBLED(dst);
+    if(sc)
+    {
+        ca_stream_t *ca_stream = NULL;
+        asc_list_for(mod->el_list)
+        {
+            el_stream_t *el_stream = asc_list_data(mod->el_list);
+            if(el_stream->es_pid == pid)
+            {
+                ca_stream = el_stream->ca_stream;
+                break;
+            }
+        }
+        if(!ca_stream)
+        {
+            asc_list_first(mod->ca_list);
+            ca_stream = asc_list_data(mod->ca_list);
+        }
 
-    mod->storage.write += TS_PACKET_SIZE;
-    if(mod->storage.write == mod->storage.size)
-        mod->storage.write = 0;
-    mod->storage.count += TS_PACKET_SIZE;
+        ca_stream_check_parity(ca_stream, sc);
 
-#if FFDECSA == 1
+        // the engine descrambles packets of both parities in the batch
+        ca_stream->packets[ca_stream->batch_skip] = dst;
+        ++ca_stream->batch_skip;
 
-    asc_list_first(mod->ca_list);
-    ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
+        if(mod->batch.latency)
+        {
+            ++mod->batch.rate_count;
+            if(!mod->batch.pending_time)
+                mod->batch.pending_time = asc_loop_utime();
+        }
 
-    ca_stream->batch[ca_stream->batch_skip    ] = dst;
-    ca_stream->batch[ca_stream->batch_skip + 1] = dst + TS_PACKET_SIZE;
-    ca_stream->batch_skip += 2;
+        if(ca_stream->batch_skip >= mod->batch.limit)
+            decrypt(mod);
+    }
 
-    if(ca_stream->batch_skip >= mod->batch_size * 2)
+    if(mod->storage.count >= mod->storage.size)
+    {
         decrypt(mod);
+        decrypt_wait(mod);
+    }
+    else if(mod->job_count > 0)
+        decrypt_complete(mod);
 
-#elif LIBDVBCSA == 1
-
-    const uint8_t sc = TS_IS_SCRAMBLED(dst);
-    if(sc)
+    if(mod->storage.dsc_count > 0)
     {
-        dst[3] &= ~0xC0;
+        storage_send(mod);
+        mod->storage.dsc_count -= TS_PACKET_SIZE;
+    }
+}
 
-        int hdr_size = 0;
+/* without CA the ES packets are sent as is, see on_ts() */
+static inline bool is_ts_pass(module_data_t *mod, uint16_t pid)
+{
+    if(asc_list_size(mod->ca_list) > 0)
+        return false;
 
-        if(TS_IS_PAYLOAD(ts))
-        {
-            if(TS_IS_AF(ts))
-                hdr_size = 4 + dst[4] + 1;
-            else
-                hdr_size = 4;
-        }
+    if(pid == 0 || pid == 1 || pid == NULL_TS_PID)
+        return false;
 
-        if(hdr_size)
-        {
-            ca_stream_t *ca_stream = NULL;
-            asc_list_for(mod->el_list)
-            {
-                el_stream_t *el_stream = asc_list_data(mod->el_list);
-                if(el_stream->es_pid == pid)
-                {
-                    ca_stream = el_stream->ca_stream;
-                    break;
-                }
-            }
-            if(!ca_stream)
-            {
-                asc_list_first(mod->ca_list);
-                ca_stream = asc_list_data(mod->ca_list);
-            }
+    const mpegts_psi_t *psi = stream_get(mod, pid);
+    if(!psi)
+        return true;
 
-            if(ca_stream->parity != sc)
-            {
-                if(ca_stream->parity != 0x00)
-                    decrypt(mod);
-                ca_stream->parity = sc;
-            }
+    return (   psi->type != MPEGTS_PACKET_PMT
+            && !(psi->type & MPEGTS_PACKET_CA));
+}
 
-            ca_stream->batch[ca_stream->batch_skip].data = &dst[hdr_size];
-            ca_stream->batch[ca_stream->batch_skip].len = TS_PACKET_SIZE - hdr_size;
-            ++ca_stream->batch_skip;
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    const uint8_t *pass = ts;
+    size_t pass_count = 0;
 
-            if(ca_stream->batch_skip >= mod->batch_size)
-                decrypt(mod);
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *const cur = &ts[i * TS_PACKET_SIZE];
+
+        if(is_ts_pass(mod, TS_GET_PID(cur)))
+        {
+            if(pass_count == 0)
+                pass = cur;
+            ++pass_count;
+            continue;
         }
-    }
 
-#endif
+        if(pass_count > 0)
+        {
+            module_stream_send_batch(mod, pass, pass_count);
+            pass_count = 0;
+        }
 
-    if(mod->storage.count >= mod->storage.size)
-        decrypt(mod);
+        on_ts(mod, cur);
+    }
 
-    if(mod->storage.dsc_count > 0)
+    if(pass_count > 0)
+        module_stream_send_batch(mod, pass, pass_count);
+}
+
+static void on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    for(size_t i = 0; i < block->count; ++i)
     {
-        module_stream_send(mod, &mod->storage.buffer[mod->storage.read]);
-        mod->storage.read += TS_PACKET_SIZE;
-        if(mod->storage.read == mod->storage.size)
-            mod->storage.read = 0;
-        mod->storage.dsc_count -= TS_PACKET_SIZE;
-        mod->storage.count -= TS_PACKET_SIZE;
+        const uint8_t *const ts = &block->ts[i * TS_PACKET_SIZE];
+        if(!is_ts_pass(mod, TS_GET_PID(ts)))
+        {
+            on_ts_batch(mod, block->ts, block->count);
+            return;
+        }
     }
+
+    module_stream_send_block(mod, block);
 }
 
 /*
@@ -896,22 +1330,58 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
  *
  */
 
-void on_cam_ready(module_data_t *mod)
+/*
+ * Warm start. PAT and PMT of the previous run are parsed as received: the CAS
+ * is initialized and the ECM is selected, the control words are loaded by
+ * ca_stream_init(). The live tables with the other checksum reload the stream.
+ */
+static void cache_warm_start(module_data_t *mod)
+{
+    if(!mod->cache)
+        return;
+
+    mpegts_psi_t *pat = stream_get(mod, 0);
+    if(!mpegts_cache_get_psi(mod->cache, CACHE_PAT, pat))
+        return;
+    on_pat(mod, pat);
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(pat, pointer)
+    {
+        if(PAT_ITEM_GET_PNR(pat, pointer) != 0)
+            break;
+    }
+    if(PAT_ITEMS_EOL(pat, pointer))
+        return;
+
+    mpegts_psi_t *pmt = stream_get(mod, PAT_ITEM_GET_PID(pat, pointer));
+    if(!pmt || pmt->type != MPEGTS_PACKET_PMT)
+        return;
+
+    if(mpegts_cache_get_psi(mod->cache, CACHE_PMT, pmt))
+        on_pmt(mod, pmt);
+}
+
+static void on_cam_ready(module_data_t *mod)
 {
     mod->caid = mod->__decrypt.cam->caid;
 
     stream_reload(mod);
+    cache_warm_start(mod);
 }
 
-void on_cam_error(module_data_t *mod)
+static void on_cam_error(module_data_t *mod)
 {
     mod->caid = 0x0000;
 
     module_decrypt_cas_destroy(mod);
 }
 
-void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
+static void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
 {
+    // deliver to the decrypt modules which are waiting for the same ECM
+    module_cam_ecm_response(&mod->__decrypt, arg, data);
+
     ca_stream_t *ca_stream = arg;
     asc_list_for(mod->ca_list)
     {
@@ -947,22 +1417,32 @@ void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
         is_keys_ok = true;
     } while(0);
 
+    const uint64_t responsetime = (asc_utime() - ca_stream->sendtime) / 1000;
+    mod->ecm_response_time = responsetime;
+
     if(is_keys_ok)
     {
+        ++mod->ecm_found;
+
         // Set keys
+        const uint64_t now = asc_utime();
         if(ca_stream->new_key[11] == data[14] && ca_stream->new_key[15] == data[18])
         {
             ca_stream->new_key_id = 1;
             memcpy(&ca_stream->new_key[0], &data[3], 8);
+            ca_stream->key_time[0] = now;
         }
         else if(ca_stream->new_key[3] == data[6] && ca_stream->new_key[7] == data[10])
         {
             ca_stream->new_key_id = 2;
             memcpy(&ca_stream->new_key[8], &data[11], 8);
+            ca_stream->key_time[1] = now;
         }
         else
         {
             ca_stream->new_key_id = 3;
+            ca_stream->key_time[0] = now;
+            ca_stream->key_time[1] = now;
             memcpy(ca_stream->new_key, &data[3], 16);
             if(ca_stream->is_keys)
                 asc_log_warning(MSG("Both keys changed"));
@@ -970,12 +1450,14 @@ void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
                 ca_stream->is_keys = true;
         }
 
+        if(mod->cache)
+            ca_stream_cache_keys(mod, ca_stream);
+
         if(asc_log_is_debug())
         {
             char key_1[17], key_2[17];
             hex_to_str(key_1, &data[3], 8);
             hex_to_str(key_2, &data[11], 8);
-            const uint64_t responsetime = (asc_utime() - ca_stream->sendtime) / 1000;
             asc_log_debug(  MSG("ECM Found id:0x%02X time:%"PRIu64"ms key:%s:%s")
                           , data[0], responsetime, key_1, key_2);
         }
@@ -983,7 +1465,7 @@ void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
     }
     else
     {
-        const uint64_t responsetime = (asc_utime() - ca_stream->sendtime) / 1000;
+        ++mod->ecm_not_found;
         asc_log_error(  MSG("ECM Not Found id:0x%02X time:%"PRIu64"ms size:%d")
                       , data[0], responsetime, data[2]);
     }
@@ -1001,48 +1483,104 @@ void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data)
 static void module_init(module_data_t *mod)
 {
     module_stream_init(mod, on_ts);
+    module_stream_set_batch(mod, on_ts_batch);
+    module_stream_set_block(mod, on_ts_block);
+
+    module_stream_metric(mod, "astra_decrypt_ecm_found_total", ASC_METRIC_COUNTER
+                         , "ECM responses with the valid keys", &mod->ecm_found);
+    module_stream_metric(mod, "astra_decrypt_ecm_not_found_total", ASC_METRIC_COUNTER
+                         , "ECM responses without the keys", &mod->ecm_not_found);
+    module_stream_metric(mod, "astra_decrypt_ecm_response_ms", ASC_METRIC_GAUGE
+                         , "Response time of the last ECM, milliseconds"
+                         , &mod->ecm_response_time);
 
     mod->__decrypt.self = mod;
+    mod->__decrypt.on_cam_ready = on_cam_ready;
+    mod->__decrypt.on_cam_error = on_cam_error;
+    mod->__decrypt.on_cam_response = on_cam_response;
 
     module_option_string("name", &mod->name, NULL);
     asc_assert(mod->name != NULL, "[decrypt] option 'name' is required");
 
-    mod->stream[0] = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mpegts_pid_map_init(&mod->stream, (uintptr_t)NULL);
+    stream_set(mod, 0, mpegts_psi_init(MPEGTS_PACKET_PAT, 0));
     mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
 
     mod->ca_list = asc_list_init();
     mod->el_list = asc_list_init();
 
-#if FFDECSA == 1
+    const char *engine = NULL;
+    module_option_string("engine", &engine, NULL);
+    mod->engine = csa_engine_get(engine);
+    asc_assert(mod->engine != NULL, MSG("engine '%s' is not available"), engine);
+    mod->batch_size = mod->engine->batch_size();
+    mod->batch.limit = mod->batch_size;
 
-    mod->batch_size = get_suggested_cluster_size();
+    int threads = 0;
+    module_option_number("threads", &threads);
+    if(threads > 0 && asc_job_attach(threads))
+    {
+        mod->job_list = calloc(DECRYPT_JOB_MAX, sizeof(decrypt_job_t));
+        for(int i = 0; i < DECRYPT_JOB_MAX; ++i)
+        {
+            decrypt_job_t *item = &mod->job_list[i];
+            item->job.run = on_decrypt_job;
+            item->job.arg = item;
+            item->engine = mod->engine;
+            item->batch = mod->engine->batch_init(mod->batch_size);
+            item->packets = calloc(mod->batch_size, sizeof(uint8_t *));
+        }
+    }
 
-#elif LIBDVBCSA == 1
+    int shift = 0;
+    module_option_number("shift", &shift);
+    if(shift > 0)
+        mod->shift.size = (shift * 1000 * 1000) / (TS_PACKET_SIZE * 8) * (TS_PACKET_SIZE);
 
-    mod->batch_size = dvbcsa_bs_batch_size();
+    // room for the clusters in progress and for the shift
+    const size_t storage_count = (mod->job_list) ? (4 + DECRYPT_JOB_MAX) : 4;
+    mod->storage.size = mod->batch_size * storage_count * TS_PACKET_SIZE + mod->shift.size;
+    mod->storage.buffer = asc_ring_alloc(mod->storage.size, -1);
 
-#endif
+    const char *cache = NULL;
+    module_option_string("cache", &cache, NULL);
+    if(cache)
+        mod->cache = mpegts_cache_open(cache);
 
-    mod->storage.size = mod->batch_size * 4 * TS_PACKET_SIZE;
-    mod->storage.buffer = malloc(mod->storage.size);
+    int batch_latency = 0;
+    module_option_number("batch_latency", &batch_latency);
+    if(batch_latency > 0)
+    {
+        mod->batch.latency = (uint64_t)batch_latency * 1000;
+        mod->batch.rate_time = asc_loop_utime();
+        const int interval = (batch_latency / 2 > BATCH_TIMER_MIN)
+                           ? batch_latency / 2
+                           : BATCH_TIMER_MIN;
+        mod->batch.timer = asc_timer_init(interval, on_batch_timer, mod);
+    }
 
     const char *biss_key = NULL;
     size_t biss_length = 0;
     module_option_string("biss", &biss_key, &biss_length);
     if(biss_key)
     {
-        asc_assert(biss_length == 16, MSG("biss key must be 16 char length"));
+        const size_t key_size = mod->engine->key_size;
+        asc_assert(  biss_length == key_size * 2
+                   , MSG("biss key must be %zu char length"), key_size * 2);
 
         mod->caid = BISS_CAID;
         mod->disable_emm = true;
 
-        uint8_t key[8];
-        str_to_hex(biss_key, key, sizeof(key));
-        key[3] = (key[0] + key[1] + key[2]) & 0xFF;
-        key[7] = (key[4] + key[5] + key[6]) & 0xFF;
+        uint8_t key[16];
+        str_to_hex(biss_key, key, key_size);
+        if(key_size == 8)
+        {
+            key[3] = (key[0] + key[1] + key[2]) & 0xFF;
+            key[7] = (key[4] + key[5] + key[6]) & 0xFF;
+        }
 
         ca_stream_t *biss = ca_stream_init(mod, NULL_TS_PID);
-        ca_stream_set_keys(biss, key, key);
+        ca_stream_set_keys(mod, biss, key, key);
     }
 
     lua_getfield(lua, 2, "cam");
@@ -1050,6 +1588,9 @@ static void module_init(module_data_t *mod)
     {
         asc_assert(  lua_type(lua, -1) == LUA_TLIGHTUSERDATA
                    , "option 'cam' required cam-module instance");
+        // the cam response is a pair of DVB-CSA control words
+        asc_assert(  mod->engine->key_size == 8
+                   , MSG("engine '%s' is not supported with cam"), mod->engine->name);
         mod->__decrypt.cam = lua_touserdata(lua, -1);
 
         int cas_pnr = 0;
@@ -1069,18 +1610,13 @@ static void module_init(module_data_t *mod)
         module_option_number("ecm_pid", &mod->ecm_pid);
 
         module_cam_attach_decrypt(mod->__decrypt.cam, &mod->__decrypt);
-    }
-    lua_pop(lua, 1);
 
-    int shift = 0;
-    module_option_number("shift", &shift);
-    if(shift > 0)
-    {
-        mod->shift.size = (shift * 1000 * 1000) / (TS_PACKET_SIZE * 8) * (TS_PACKET_SIZE);
-        mod->shift.buffer = malloc(mod->shift.size);
+        mod->prefetch_timer = asc_timer_init(500, on_prefetch, mod);
     }
+    lua_pop(lua, 1);
 
     stream_reload(mod);
+    cache_warm_start(mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -1093,33 +1629,43 @@ static void module_destroy(module_data_t *mod)
         mod->__decrypt.cam = NULL;
     }
 
+    if(mod->prefetch_timer)
+        asc_timer_destroy(mod->prefetch_timer);
+    ASC_FREE(mod->batch.timer, asc_timer_destroy);
+
     module_decrypt_cas_destroy(mod);
 
     if(mod->caid == BISS_CAID)
     {
         asc_list_first(mod->ca_list);
         ca_stream_t *ca_stream = asc_list_data(mod->ca_list);
-        ca_stream_destroy(ca_stream);
+        ca_stream_destroy(mod, ca_stream);
         asc_list_remove_current(mod->ca_list);
     }
 
     asc_list_destroy(mod->ca_list);
     asc_list_destroy(mod->el_list);
 
-    free(mod->storage.buffer);
-
-    if(mod->shift.buffer)
-        free(mod->shift.buffer);
-
-    for(int i = 0; i < MAX_PID; ++i)
+    if(mod->job_list)
     {
-        if(mod->stream[i])
+        for(int i = 0; i < DECRYPT_JOB_MAX; ++i)
         {
-            mpegts_psi_destroy(mod->stream[i]);
-            mod->stream[i] = NULL;
+            mod->engine->batch_destroy(mod->job_list[i].batch);
+            free(mod->job_list[i].packets);
         }
+        free(mod->job_list);
+        asc_job_detach();
     }
+
+    asc_ring_free(mod->storage.buffer, mod->storage.size);
+
+
+    MPEGTS_PID_MAP_FOREACH(&mod->stream, i)
+        mpegts_psi_destroy(stream_get(mod, i));
+    mpegts_pid_map_destroy(&mod->stream);
     mpegts_psi_destroy(mod->pmt);
+
+    ASC_FREE(mod->cache, mpegts_cache_close);
 }
 
 MODULE_STREAM_METHODS()
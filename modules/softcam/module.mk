@@ -9,19 +9,25 @@ if [ $FFDECSA -ne 1 -a $LIBDVBCSA -ne 1 ] ; then
     ERROR="DVB-CSA is not found"
 fi
 
-SOURCES_CSA=""
+# the engines are selected at runtime, see csa_engine.c
+
+SOURCES_CSA="csa_engine.c"
 
 if [ $FFDECSA -eq 1 ] ; then
-    SOURCES_CSA="FFdecsa/FFdecsa.c"
+    SOURCES_CSA="$SOURCES_CSA FFdecsa/FFdecsa.c"
     CFLAGS="-DFFDECSA=1"
-elif [ $LIBDVBCSA -eq 1 ]; then
-    CFLAGS="-DLIBDVBCSA=1"
+else
+    CFLAGS="-DFFDECSA=0"
+fi
+
+if [ $LIBDVBCSA -eq 1 ] ; then
+    CFLAGS="$CFLAGS -DLIBDVBCSA=1"
 fi
 
-SOURCES_CAM="cam/cam.c"
+SOURCES_CAM="cam/cam.c cam/group.c cam/cwbus.c cam/cluster.c"
 SOURCES_CAS="cas/bulcrypt.c cas/conax.c cas/cryptoworks.c cas/dgcrypt.c cas/dre.c cas/exset.c cas/griffin.c cas/irdeto.c cas/mediaguard.c cas/nagra.c cas/viaccess.c cas/videoguard.c"
 
-MODULES="decrypt"
+MODULES="decrypt cam_group cw_bus ecm_cluster"
 
 libssl_test_c()
 {
@@ -94,7 +100,15 @@ check_sse2()
     fi
 }
 
-if [ $FFDECSA -eq 1 ] ; then
+# parallel mode of the user: ./configure.sh CFLAGS="-DPARALLEL_MODE=..."
+# the fastest one for the CPU is reported by "make ffdecsa-bench"
+
+FFDECSA_MODE=0
+if echo "$APP_CFLAGS" | grep -q "\-DPARALLEL_MODE=" ; then
+    FFDECSA_MODE=1
+fi
+
+if [ $FFDECSA -eq 1 -a $FFDECSA_MODE -eq 0 ] ; then
     if check_sse2 ; then
         CFLAGS="$CFLAGS -DPARALLEL_MODE=1286"
     else
@@ -102,3 +116,70 @@ if [ $FFDECSA -eq 1 ] ; then
         CFLAGS="$CFLAGS -DPARALLEL_MODE=642"
     fi
 fi
+
+# AVX2. selected at runtime, see FFdecsa/FFdecsa.c
+
+avx2_test_c()
+{
+    cat <<EOF
+#pragma GCC target("avx2")
+#include <immintrin.h>
+int main(void)
+{
+    __builtin_cpu_init();
+    __m256i v = _mm256_setzero_si256();
+    v = _mm256_xor_si256(_mm256_slli_epi64(v, 1), v);
+    return __builtin_cpu_supports("avx2") + _mm256_extract_epi32(v, 0);
+}
+EOF
+}
+
+check_avx2()
+{
+    avx2_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o .link-test -x c - >/dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        rm -f .link-test
+        return 0
+    else
+        return 1
+    fi
+}
+
+if [ $FFDECSA -eq 1 -a $FFDECSA_MODE -eq 0 ] ; then
+    if check_avx2 ; then
+        CFLAGS="$CFLAGS -DFFDECSA_AVX2=1"
+        SOURCES="$SOURCES FFdecsa/FFdecsa_avx2.c"
+    fi
+fi
+
+# AES-NI of the DVB-CISSA engine. selected at runtime, see csa_engine.c
+
+aesni_test_c()
+{
+    cat <<EOF
+#pragma GCC target("aes,sse2")
+#include <wmmintrin.h>
+int main(void)
+{
+    __builtin_cpu_init();
+    __m128i v = _mm_setzero_si128();
+    v = _mm_aesdec_si128(v, v);
+    return __builtin_cpu_supports("aes") + _mm_cvtsi128_si32(v);
+}
+EOF
+}
+
+check_aesni()
+{
+    aesni_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o .link-test -x c - >/dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        rm -f .link-test
+        return 0
+    else
+        return 1
+    fi
+}
+
+if check_aesni ; then
+    CFLAGS="$CFLAGS -DCISSA_AESNI=1"
+fi
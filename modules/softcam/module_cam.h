@@ -72,11 +72,23 @@ struct module_cam_t
     asc_list_t *decrypt_list;
     asc_list_t *packet_queue;
 
+    /* EMMs per second of each table id, 0 - not limited. see module_cam_send_emm() */
+    int emm_rate;
+    uint64_t emm_time;
+    uint16_t emm_count[16];
+
+    /* queued packets and requests, see asc_memstat_init() */
+    asc_memstat_t *memstat;
+
     void (*connect)(module_data_t *mod);
     void (*disconnect)(module_data_t *mod);
     void (*send_em)(  module_data_t *mod
                     , module_decrypt_t *decrypt, void *arg
                     , const uint8_t *buffer, uint16_t size);
+    /* ECM without the shared cache, optional. the keys are pushed by the cam */
+    void (*send_ecm)(  module_data_t *mod
+                     , module_decrypt_t *decrypt, void *arg, uint16_t ecm_pid
+                     , const uint8_t *buffer, uint16_t size);
 };
 
 #define MODULE_CAM_DATA() module_cam_t __cam
@@ -88,8 +100,26 @@ void module_cam_ready(module_cam_t *cam);
 void module_cam_reset(module_cam_t *cam);
 
 em_packet_t * module_cam_queue_pop(module_cam_t *cam);
+bool module_cam_queue_push(module_cam_t *cam, em_packet_t *packet);
 void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt);
 
+/* ECM requests through the cache shared by all decrypt modules */
+void module_cam_send_ecm(  module_decrypt_t *decrypt, void *arg, uint16_t ecm_pid
+                         , const uint8_t *buffer, uint16_t size);
+void module_cam_ecm_response(module_decrypt_t *decrypt, void *arg, const uint8_t *data);
+
+/* ECM cache of the nodes, see cam/cluster.c. false if the request is not taken */
+bool ecm_cluster_request(  module_decrypt_t *decrypt, void *arg
+                         , const uint8_t *buffer, uint16_t size);
+void ecm_cluster_publish(  uint16_t caid, const uint8_t *ecm, uint16_t ecm_size
+                         , const uint8_t *data);
+void ecm_cluster_flush(module_cam_t *cam, module_decrypt_t *decrypt);
+
+/* EMMs through the filter shared by all decrypt modules, false if the EMM is dropped */
+bool module_cam_send_emm(module_decrypt_t *decrypt, const uint8_t *buffer, uint16_t size);
+
+#define EMM_RATE_DEFAULT 20
+
 #define module_cam_init(_mod, _connect, _disconnect, _send_em)                                  \
     {                                                                                           \
         _mod->__cam.self = _mod;                                                                \
@@ -99,6 +129,11 @@ void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt);
         _mod->__cam.connect = _connect;                                                         \
         _mod->__cam.disconnect = _disconnect;                                                   \
         _mod->__cam.send_em = _send_em;                                                         \
+        _mod->__cam.emm_rate = EMM_RATE_DEFAULT;                                                \
+        module_option_number("emm_rate", &_mod->__cam.emm_rate);                                \
+        const char *__cam_name = NULL;                                                          \
+        module_option_string("name", &__cam_name, NULL);                                        \
+        _mod->__cam.memstat = asc_memstat_init("cam", __cam_name);                              \
     }
 
 #define module_cam_destroy(_mod)                                                                \
@@ -113,6 +148,7 @@ void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt);
         asc_list_destroy(_mod->__cam.decrypt_list);                                             \
         asc_list_destroy(_mod->__cam.prov_list);                                                \
         asc_list_destroy(_mod->__cam.packet_queue);                                             \
+        ASC_FREE(_mod->__cam.memstat, asc_memstat_destroy);                                     \
     }
 
 #define MODULE_CAM_METHODS()                                                                    \
@@ -183,12 +219,13 @@ struct module_decrypt_t
 
     module_cam_t *cam;
     module_cas_t *cas;
+
+    /* events of the cam, the receiver is the decrypt module or the cam group */
+    void (*on_cam_ready)(module_data_t *mod);
+    void (*on_cam_error)(module_data_t *mod);
+    void (*on_cam_response)(module_data_t *mod, void *arg, const uint8_t *data);
 };
 
 #define MODULE_DECRYPT_DATA() module_decrypt_t __decrypt
 
-void on_cam_ready(module_data_t *mod);
-void on_cam_error(module_data_t *mod);
-void on_cam_response(module_data_t *mod, void *arg, const uint8_t *data);
-
 #endif /* _MODULE_CAM_H_ */
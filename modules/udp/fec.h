@@ -0,0 +1,179 @@
+/*
+ * Astra Module: UDP FEC
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_FEC_H_
+#define _UDP_FEC_H_ 1
+
+#include <astra.h>
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+/*
+ * SMPTE 2022-1 FEC. Media datagrams are placed in the matrix of L columns
+ * and D rows in the order of the RTP sequence number. Each column is
+ * protected with one FEC datagram sent to the port + 2, each row is
+ * protected with one FEC datagram sent to the port + 4.
+ *
+ * FEC datagram is RTP header followed by the FEC header:
+ *
+ *  SN base (2) | length recovery (2) | E, PT recovery (1) | mask (3)
+ *  TS recovery (4) | X, D, type, index (1) | offset (1) | NA (1) | SN base ext (1)
+ *
+ * and XOR of the media payloads, padded with zeros to the longest one.
+ */
+
+#define FEC_RTP_HEADER_SIZE 12
+#define FEC_HEADER_SIZE 16
+#define FEC_PAYLOAD_SIZE 1460
+#define FEC_PT 96
+
+#define FEC_COLUMN_PORT 2
+#define FEC_ROW_PORT 4
+
+#define FEC_L_MAX 20
+#define FEC_D_MAX 20
+#define FEC_LD_MAX 100
+
+typedef struct
+{
+    uint16_t snbase;
+    uint8_t offset;
+    uint8_t na;
+    bool is_row;
+
+    uint16_t length_recovery;
+    uint8_t pt_recovery;
+    uint32_t ts_recovery;
+
+    size_t size;
+    uint8_t payload[FEC_PAYLOAD_SIZE];
+} fec_packet_t;
+
+/* dst ^= src */
+static inline void fec_xor(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t skip = 0;
+
+#ifdef __SSE2__
+    for(; skip + 16 <= size; skip += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)&dst[skip]);
+        const __m128i b = _mm_loadu_si128((const __m128i *)&src[skip]);
+        _mm_storeu_si128((__m128i *)&dst[skip], _mm_xor_si128(a, b));
+    }
+#endif
+
+    for(; skip + sizeof(uint64_t) <= size; skip += sizeof(uint64_t))
+    {
+        uint64_t a, b;
+        memcpy(&a, &dst[skip], sizeof(a));
+        memcpy(&b, &src[skip], sizeof(b));
+        a ^= b;
+        memcpy(&dst[skip], &a, sizeof(a));
+    }
+
+    for(; skip < size; ++skip)
+        dst[skip] ^= src[skip];
+}
+
+/* adds media datagram (RTP header and payload) to the FEC packet */
+static inline void fec_packet_add(fec_packet_t *fec, const uint8_t *rtp, size_t size)
+{
+    const size_t payload_size = size - FEC_RTP_HEADER_SIZE;
+
+    fec->length_recovery ^= (uint16_t)payload_size;
+    fec->pt_recovery ^= rtp[1] & 0x7F;
+    fec->ts_recovery ^= (rtp[4] << 24) | (rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+
+    if(payload_size > fec->size)
+    {
+        memset(&fec->payload[fec->size], 0, payload_size - fec->size);
+        fec->size = payload_size;
+    }
+    fec_xor(fec->payload, &rtp[FEC_RTP_HEADER_SIZE], payload_size);
+}
+
+static inline void fec_packet_reset(fec_packet_t *fec, uint16_t snbase)
+{
+    fec->snbase = snbase;
+    fec->length_recovery = 0;
+    fec->pt_recovery = 0;
+    fec->ts_recovery = 0;
+    fec->size = 0;
+}
+
+/* FEC header, returns header size */
+static inline size_t fec_header_put(uint8_t *buffer, const fec_packet_t *fec)
+{
+    buffer[0] = (fec->snbase >> 8) & 0xFF;
+    buffer[1] = (fec->snbase     ) & 0xFF;
+    buffer[2] = (fec->length_recovery >> 8) & 0xFF;
+    buffer[3] = (fec->length_recovery     ) & 0xFF;
+    buffer[4] = 0x80 | fec->pt_recovery; // E
+    buffer[5] = 0;
+    buffer[6] = 0;
+    buffer[7] = 0;
+    buffer[8] = (fec->ts_recovery >> 24) & 0xFF;
+    buffer[9] = (fec->ts_recovery >> 16) & 0xFF;
+    buffer[10] = (fec->ts_recovery >> 8) & 0xFF;
+    buffer[11] = (fec->ts_recovery     ) & 0xFF;
+    buffer[12] = (fec->is_row) ? 0x40 : 0x00; // D, type 0 (XOR), index 0
+    buffer[13] = fec->offset;
+    buffer[14] = fec->na;
+    buffer[15] = 0;
+    return FEC_HEADER_SIZE;
+}
+
+/* parses FEC datagram, returns false if the datagram is not valid */
+static inline bool fec_packet_parse(fec_packet_t *fec, const uint8_t *buffer, size_t size)
+{
+    if(size < FEC_RTP_HEADER_SIZE || (buffer[0] >> 6) != 2)
+        return false;
+
+    size_t skip = FEC_RTP_HEADER_SIZE + (buffer[0] & 0x0F) * 4;
+    if(size < skip + FEC_HEADER_SIZE)
+        return false;
+
+    const uint8_t *header = &buffer[skip];
+    skip += FEC_HEADER_SIZE;
+
+    // XOR only, no extension
+    if((header[12] & 0x38) || (header[12] & 0x80) || !header[13] || !header[14])
+        return false;
+    if(size - skip > FEC_PAYLOAD_SIZE)
+        return false;
+
+    fec->snbase = (header[0] << 8) | header[1];
+    fec->length_recovery = (header[2] << 8) | header[3];
+    fec->pt_recovery = header[4] & 0x7F;
+    fec->ts_recovery = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+    fec->is_row = (header[12] & 0x40) != 0;
+    fec->offset = header[13];
+    fec->na = header[14];
+
+    fec->size = size - skip;
+    memcpy(fec->payload, &buffer[skip], fec->size);
+
+    return true;
+}
+
+#endif /* _UDP_FEC_H_ */
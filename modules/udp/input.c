@@ -27,17 +27,105 @@
  *      port        - number, source UDP port
  *      localaddr   - string, IP address of the local interface
  *      socket_size - number, socket buffer size
+ *      source      - string, source address for the source-specific multicast (IGMPv3)
+ *      shared      - boolean, use one socket for all groups on the same port.
+ *                            datagrams are passed by the destination address.
+ *                            net.ipv4.igmp_max_memberships limits count of groups
  *      renew       - number, renewing multicast subscription interval in seconds
+ *      igmp_rate   - number, multicast joins and leaves per second of the process,
+ *                            the last defined value is used. default: 200,
+ *                            0 - without the pacing. see membership.h
  *      rtp         - boolean, use RTP instead RAW UDP
+ *      batch       - number, receive up to N datagrams per wakeup. default: 1.
+ *                            not used with the io_uring receive
+ *      mtu         - number, MTU of the link, 576..9000. datagrams up to
+ *                            mtu - 28 bytes are received. above 1500 (jumbo
+ *                            frames, up to 47 TS packets per datagram) not used
+ *                            with shared, rx_ring, fec, latency, gap_skip and
+ *                            addr2. default: 1500
+ *      rx_ring     - boolean, receive with the shared PACKET_RX_RING socket.
+ *                            one socket for all udp_input on the interface,
+ *                            datagrams are passed by the address and port.
+ *                            requires CAP_NET_RAW, Linux only
+ *      ifname      - string, interface name for rx_ring. default: all interfaces
+ *      rx_ring_size
+ *                  - number, ring size in megabytes, defined by the first
+ *                            udp_input on the interface. default: 32
+ *      fec         - boolean, recover lost datagrams with SMPTE 2022-1 FEC
+ *                            received on the port + 2 and the port + 4.
+ *                            datagrams are reordered by the RTP sequence number.
+ *                            requires rtp
+ *      latency     - number, reorder RTP datagrams by the sequence number and
+ *                            wait for the missing datagram up to N milliseconds.
+ *                            requires rtp
+ *      gap_skip    - number, skip the missing datagram if N datagrams after it
+ *                            are received. with latency the first condition skips.
+ *                            requires rtp
+ *      trace       - number, stamp 1-in-N datagrams with the receive time to
+ *                            trace the latency through the stream graph,
+ *                            see module_stream_trace(). default: 0 - disabled
+ *      mdi         - boolean, Media Delivery Index (RFC 4445): delay factor and
+ *                            media loss rate by the continuity counters, and the
+ *                            histogram of the inter-arrival time. datagrams are
+ *                            stamped by the kernel (SO_TIMESTAMPNS).
+ *                            values are exported to the metrics registry
+ *      addr2       - string, address of the second path, SMPTE 2022-7 seamless
+ *                            protection. datagrams of both paths are merged by
+ *                            the RTP sequence number, the first copy is passed
+ *                            and the second one is dropped. requires rtp
+ *      port2       - number, port of the second path. default: port
+ *      localaddr2  - string, local interface of the second path. default: localaddr
+ *      source2     - string, source address of the second path
+ *
+ * Joins, leaves and renews are made by the membership manager of the process
+ * at the limited rate, the first datagram of the group may be delayed on
+ * the start of many instances.
+ *
+ * Misaligned datagrams and 204-byte packets are realigned by the resync
+ * stage, see resync.h. Aligned datagrams are passed without the copy.
+ * Jumbo datagrams do not fit the stream block, they are received to the
+ * buffer of the instance and passed as the batch.
+ *
+ * With the io_uring event backend the own socket is received by the multishot
+ * receive of the event loop without the recvmsg() call per wakeup, see
+ * asc_socket_set_on_recv(). Datagrams are received to the pooled blocks and
+ * passed without the copy, jumbo datagrams to the buffers of the instance.
+ *
+ * Receive queue of the socket is sampled on the read: dropped datagrams
+ * (SO_RXQ_OVFL), the queue depth and the peak of the last 10 seconds are
+ * exported to the metrics registry. Instances with the shared socket report
+ * the values of the shared socket.
  *
  * Module Methods:
  *      port()      - return number, random port number
+ *      stat()      - return table, RTP counters: reordered, duplicate, late, lost
+ *                            and recovered, receive queue: rx_dropped,
+ *                            rx_queue, rx_queue_peak and rx_buffer (bytes),
+ *                            resync: sync_lost and sync_dropped (bytes).
+ *                            with mdi: mdi_df (ms), mdi_mlr, mdi_lost and
+ *                            iat_max (ms). with addr2: path1 and path2
+ *                            (datagrams passed from each path), merge_duplicate
+ *                            and merge_late
  */
 
 #include <astra.h>
+#include "fec.h"
+#include "packet.h"
+#include "membership.h"
+#include "resync.h"
+
+#ifndef _WIN32
+#   include <arpa/inet.h>
+#endif
 
-#define UDP_BUFFER_SIZE 1460
 #define RTP_HEADER_SIZE 12
+#define UDP_BATCH_MAX 64
+#define UDP_RECV_COUNT 64 // buffers of the io_uring receive
+
+#define UDP_HEADER_SIZE 28 // IPv4 and UDP headers
+#define UDP_MTU_DEFAULT (STREAM_BLOCK_SIZE + UDP_HEADER_SIZE)
+#define UDP_MTU_MIN 576
+#define UDP_MTU_MAX 9000
 
 #define RTP_IS_EXT(_data) ((_data[0] & 0x10))
 #define RTP_EXT_SIZE(_data) \
@@ -45,6 +133,69 @@
 
 #define MSG(_msg) "[udp_input %s:%d] " _msg, mod->config.addr, mod->config.port
 
+#define JITTER_RING_SIZE 512 // media datagrams in the reorder buffer
+#define JITTER_PAYLOAD_SIZE FEC_PAYLOAD_SIZE
+#define JITTER_TIMER_INTERVAL 100 // ms
+#define JITTER_TIMER_MIN 5 // ms
+#define JITTER_IDLE_TIMEOUT (100 * 1000) // us, releases the buffer if the stream is stopped
+#define JITTER_STAT_INTERVAL (10 * 1000 * 1000) // us, interval between the log of the counters
+
+#define MERGE_WINDOW_SIZE 1024 // datagrams, skew between the paths
+#define MERGE_RESET_TIMEOUT (200 * 1000) // us, window is restarted if nothing is passed
+
+#define FEC_PENDING_SIZE 64 // FEC datagrams waiting for the loss
+
+#define MDI_INTERVAL (1000 * 1000) // us
+#define MDI_IAT_BUCKETS 8
+
+#define RXQ_SAMPLE_INTERVAL (100 * 1000) // us
+#define RXQ_PEAK_INTERVAL (10 * 1000 * 1000) // us, window of the peak and the log of the drops
+
+#define UDP_SHARED_HASH_SIZE 256
+#define UDP_SHARED_READ_LIMIT 64 // datagrams per wakeup
+
+/* receive queue of the socket, see rxq_sample() */
+typedef struct
+{
+    uint32_t last_dropped; // counter of the socket
+    uint64_t dropped;
+
+    uint64_t time; // last sample
+    uint64_t queue; // bytes
+    uint64_t peak; // last window
+    uint64_t size; // receive buffer
+
+    uint64_t window_time;
+    uint64_t window_peak;
+    uint64_t log_dropped;
+} udp_rxq_t;
+
+typedef struct
+{
+    int port;
+    int refcount;
+    asc_socket_t *sock;
+    udp_rxq_t rxq;
+
+    module_data_t *hash[UDP_SHARED_HASH_SIZE]; // instances by the group address
+} udp_shared_t;
+
+typedef struct
+{
+    uint64_t time; // received or expected since
+    uint16_t seq;
+    bool is_present;
+
+    size_t size;
+    uint8_t payload[JITTER_PAYLOAD_SIZE];
+} jitter_slot_t;
+
+typedef struct
+{
+    uint16_t seq;
+    bool is_present;
+} merge_slot_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -54,42 +205,344 @@ struct module_data_t
         const char *addr;
         int port;
         const char *localaddr;
+        const char *source;
         bool rtp;
+        int batch;
+        int mtu;
+        int trace;
+        int renew;
     } config;
 
+    int trace_skip; // datagrams to the next sampled one
+
+    // receive buffers for the batch mode
+    module_stream_block_t **block_list;
+
+    // receive buffers for the mtu above the block size
+    struct
+    {
+        uint8_t *buffer;
+        size_t size; // one datagram
+    } jumbo;
+
     bool is_error_message;
+    udp_resync_t resync;
 
     asc_socket_t *sock;
-    asc_timer_t *timer_renew;
+    udp_membership_t *membership; // own socket or the shared socket
+
+    udp_packet_sub_t *packet_sub;
 
-    uint8_t buffer[UDP_BUFFER_SIZE];
+    udp_shared_t *shared;
+    module_data_t *shared_next;
+
+    udp_rxq_t rxq_data; // own socket
+    udp_rxq_t *rxq; // own or shared, NULL for the packet ring
+
+    asc_metric_t *metric_list;
+    uint32_t shared_addr; // network order
+
+    struct
+    {
+        bool is_enabled;
+        asc_timer_t *timer;
+
+        uint32_t latency; // us
+        uint32_t gap_skip; // datagrams
+        uint32_t window; // delay in datagrams, defined by the FEC matrix
+
+        // reorder buffer, indexed by the RTP sequence number
+        jitter_slot_t *ring;
+        bool is_started;
+        uint16_t head; // next datagram to release
+        uint16_t tail; // next expected datagram
+        uint64_t last_time;
+
+        uint64_t reordered;
+        uint64_t duplicate;
+        uint64_t late;
+        uint64_t lost;
+
+        uint64_t stat_time;
+        uint64_t stat_reordered;
+        uint64_t stat_duplicate;
+        uint64_t stat_late;
+        uint64_t stat_lost;
+        uint64_t stat_recovered;
+    } jitter;
+
+    struct
+    {
+        bool is_enabled;
+        asc_socket_t *sock_column;
+        asc_socket_t *sock_row;
+        udp_membership_t *membership_column;
+        udp_membership_t *membership_row;
+
+        fec_packet_t *pending;
+        uint32_t pending_next;
+
+        uint64_t recovered;
+    } fec;
+
+    struct
+    {
+        bool is_enabled;
+        const char *addr;
+        int port;
+        asc_socket_t *sock;
+        udp_membership_t *membership;
+
+        // sequence numbers of the passed datagrams
+        merge_slot_t window[MERGE_WINDOW_SIZE];
+        bool is_started;
+        uint16_t last_seq; // highest passed
+        uint64_t last_time;
+
+        uint64_t passed[2]; // by the path
+        uint64_t duplicate;
+        uint64_t late;
+    } merge;
+
+    struct
+    {
+        bool is_enabled;
+        bool is_timestamp; // kernel receive time, see asc_socket_set_timestamp()
+        uint8_t *cc; // continuity counter by PID, 0x10 - the PID is found
+
+        // current interval
+        uint64_t time;
+        uint64_t last_time; // previous datagram
+        uint64_t bytes;
+        double rate; // bytes per us, previous interval
+        double vb_min; // virtual buffer
+        double vb_max;
+        uint64_t interval_lost;
+        uint64_t interval_iat_max;
+
+        // last interval
+        uint64_t df; // delay factor, us
+        uint64_t mlr; // lost TS packets per second
+        uint64_t iat_max; // us
+
+        uint64_t lost;
+        uint64_t iat[MDI_IAT_BUCKETS];
+    } mdi;
 };
 
+static void jitter_on_datagram(module_data_t *mod, const uint8_t *buffer, size_t size);
+static bool merge_is_first(module_data_t *mod, const uint8_t *buffer, int len, int path);
+
+static size_t metric_labels(module_data_t *mod, char *labels, size_t size)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "%s:%d", mod->config.addr, mod->config.port);
+    return asc_metric_labels(labels, size, "udp_input", name);
+}
+
+/*
+ * Samples the receive queue before the read, so the depth shows how late
+ * the main loop is. Dropped counter is updated by every read
+ */
+static void rxq_sample(udp_rxq_t *rxq, asc_socket_t *sock, const char *addr, int port)
+{
+    rxq->dropped += (uint32_t)(asc_socket_rx_dropped(sock) - rxq->last_dropped);
+    rxq->last_dropped = asc_socket_rx_dropped(sock);
+
+    const uint64_t now = asc_loop_utime();
+    if(now - rxq->time < RXQ_SAMPLE_INTERVAL)
+        return;
+    rxq->time = now;
+
+    int queue, size;
+    if(asc_socket_rx_queue(sock, &queue, &size))
+    {
+        rxq->queue = queue;
+        rxq->size = size;
+        if(rxq->queue > rxq->window_peak)
+            rxq->window_peak = rxq->queue;
+    }
+
+    if(now - rxq->window_time < RXQ_PEAK_INTERVAL)
+        return;
+    rxq->window_time = now;
+    rxq->peak = rxq->window_peak;
+    rxq->window_peak = rxq->queue;
+
+    if(rxq->dropped != rxq->log_dropped)
+    {
+        asc_log_warning("[udp_input %s:%d] receive queue overflow. dropped:%llu peak:%llu of %llu bytes"
+                        , addr, port
+                        , (unsigned long long)(rxq->dropped - rxq->log_dropped)
+                        , (unsigned long long)rxq->peak, (unsigned long long)rxq->size);
+        rxq->log_dropped = rxq->dropped;
+    }
+}
+
+static void rxq_init(module_data_t *mod, udp_rxq_t *rxq, asc_socket_t *sock)
+{
+    mod->rxq = rxq;
+    if(!asc_socket_set_rxq_ovfl(sock))
+        asc_log_warning(MSG("SO_RXQ_OVFL is not supported"));
+
+    char labels[512];
+    metric_labels(mod, labels, sizeof(labels));
+
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_rx_dropped_total", ASC_METRIC_COUNTER
+                                            , "Datagrams dropped on the socket receive queue overflow")
+                        , labels, &rxq->dropped, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_rx_queue_bytes", ASC_METRIC_GAUGE
+                                            , "Socket receive queue depth, sampled before the read")
+                        , labels, &rxq->queue, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_rx_queue_peak_bytes", ASC_METRIC_GAUGE
+                                            , "Socket receive queue peak of the last 10 seconds")
+                        , labels, &rxq->peak, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_rx_buffer_bytes", ASC_METRIC_GAUGE
+                                            , "Socket receive buffer size")
+                        , labels, &rxq->size, 1);
+}
+
 static void on_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
     if(mod->sock)
     {
-        asc_socket_multicast_leave(mod->sock);
-        asc_socket_close(mod->sock);
+        asc_handover_detach(mod);
+        ASC_FREE(mod->membership, udp_membership_leave);
+        udp_membership_close(mod->sock);
         mod->sock = NULL;
     }
+}
+
+/* true for each config.trace-th datagram */
+static inline bool trace_sample(module_data_t *mod)
+{
+    if(!mod->config.trace)
+        return false;
+
+    if(mod->trace_skip > 0)
+    {
+        --mod->trace_skip;
+        return false;
+    }
+
+    mod->trace_skip = mod->config.trace - 1;
+    return true;
+}
+
+static void mdi_on_datagram(module_data_t *mod, const uint8_t *buffer, int len
+                            , uint64_t time);
+
+/* misaligned payload, trace_time - ingress time of the sampled datagram or 0 */
+static void resync_send(module_data_t *mod, const uint8_t *payload, size_t size
+                        , uint64_t trace_time)
+{
+    const uint8_t *ts;
+    const size_t count = udp_resync_push(&mod->resync, payload, size, &ts);
+
+    if(!mod->is_error_message)
+    {
+        if(mod->resync.stride)
+        {
+            asc_log_warning(MSG("misaligned stream. resync to %zu-byte packets")
+                            , mod->resync.stride);
+            mod->is_error_message = true;
+        }
+        else if(mod->resync.dropped > 0)
+        {
+            asc_log_error(MSG("wrong stream format. drop %llu bytes")
+                          , (unsigned long long)mod->resync.dropped);
+            mod->is_error_message = true;
+        }
+    }
+
+    if(count > 0)
+    {
+        trace_time = module_stream_trace_set(trace_time);
+        module_stream_send_batch(mod, ts, count);
+        module_stream_trace_set(trace_time);
+    }
+}
+
+/* offset of the TS payload, len if the datagram is too short */
+static inline int payload_offset(module_data_t *mod, const uint8_t *buffer, int len)
+{
+    if(!mod->config.rtp)
+        return 0;
+
+    int i = RTP_HEADER_SIZE;
+    if(RTP_IS_EXT(buffer))
+    {
+        if(len < RTP_HEADER_SIZE + 4)
+            return len;
+        i += RTP_EXT_SIZE(buffer);
+    }
+
+    return i;
+}
+
+/* time is the kernel receive time or 0, path is 1 for the second path */
+static void on_datagram_path(module_data_t *mod, module_stream_block_t *block, int len
+                             , uint64_t time, int path)
+{
+    const uint8_t *buffer = block->buffer;
+
+    if(mod->merge.is_enabled && !merge_is_first(mod, buffer, len, path))
+        return;
+
+    if(mod->mdi.is_enabled)
+        mdi_on_datagram(mod, buffer, len, time);
+
+    if(mod->jitter.is_enabled)
+    {
+        jitter_on_datagram(mod, buffer, len);
+        return;
+    }
+
+    const int i = payload_offset(mod, buffer, len);
+    if(i >= len)
+        return;
 
-    if(mod->timer_renew)
+    if(udp_resync_is_aligned(&mod->resync, &buffer[i], len - i))
+    {
+        block->ts = &buffer[i];
+        block->count = (len - i) / TS_PACKET_SIZE;
+        /* the shared socket passes the same block to the other instances */
+        block->trace_time = (trace_sample(mod)) ? asc_utime() : 0;
+        module_stream_send_block(mod, block);
+    }
+    else
     {
-        asc_timer_destroy(mod->timer_renew);
-        mod->timer_renew = NULL;
+        resync_send(mod, &buffer[i], len - i, (trace_sample(mod)) ? asc_utime() : 0);
     }
 }
 
+static inline void on_datagram(module_data_t *mod, module_stream_block_t *block, int len
+                               , uint64_t time)
+{
+    on_datagram_path(mod, block, len, time, 0);
+}
+
 static void on_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    int len = asc_socket_recv(mod->sock, mod->buffer, UDP_BUFFER_SIZE);
+    rxq_sample(mod->rxq, mod->sock, mod->config.addr, mod->config.port);
+
+    module_stream_block_t *block = module_stream_block_alloc();
+
+    /* ancillary data: receive time and the drop counter */
+    uint64_t time = 0;
+    const int len = asc_socket_recv_time(mod->sock, block->buffer, STREAM_BLOCK_SIZE, &time);
     if(len <= 0)
     {
+        module_stream_block_unref(block);
+
         if(len == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
             return;
 
@@ -97,81 +550,1393 @@ static void on_read(void *arg)
         return;
     }
 
-    int i = 0;
+    on_datagram(mod, block, len, time);
+    module_stream_block_unref(block);
+}
 
-    if(mod->config.rtp)
+static void on_read_batch(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    struct iovec iov[UDP_BATCH_MAX];
+    size_t len[UDP_BATCH_MAX];
+    uint64_t time[UDP_BATCH_MAX];
+
+    rxq_sample(mod->rxq, mod->sock, mod->config.addr, mod->config.port);
+
+    for(int i = 0; i < mod->config.batch; ++i)
     {
-        i = RTP_HEADER_SIZE;
-        if(RTP_IS_EXT(mod->buffer))
+        /* block is reused if nobody keeps it since the last call */
+        module_stream_block_t *block = mod->block_list[i];
+        if(!block || block->refcount > 1)
         {
-            if(len < RTP_HEADER_SIZE + 4)
-                return;
-            i += RTP_EXT_SIZE(mod->buffer);
+            if(block)
+                module_stream_block_unref(block);
+            block = module_stream_block_alloc();
+            mod->block_list[i] = block;
         }
+
+        iov[i].iov_base = block->buffer;
+        iov[i].iov_len = STREAM_BLOCK_SIZE;
     }
 
-    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
-        module_stream_send(mod, &mod->buffer[i]);
+    const int count = asc_socket_recv_batch(  mod->sock, iov, len
+                                            , (mod->mdi.is_timestamp) ? time : NULL
+                                            , mod->config.batch);
+    if(count <= 0)
+    {
+        if(count == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
 
-    if(i != len && !mod->is_error_message)
+        on_close(mod);
+        return;
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(len[i] > 0)
+            on_datagram(mod, mod->block_list[i], len[i], (mod->mdi.is_timestamp) ? time[i] : 0);
+    }
+}
+
+/* mtu above the block size, the payload is passed from the receive buffer */
+static void on_jumbo_datagram(module_data_t *mod, const uint8_t *buffer, int len
+                              , uint64_t time)
+{
+    if(mod->mdi.is_enabled)
+        mdi_on_datagram(mod, buffer, len, time);
+
+    const int i = payload_offset(mod, buffer, len);
+    if(i >= len)
+        return;
+
+    const uint64_t trace_time = (trace_sample(mod)) ? asc_utime() : 0;
+    if(udp_resync_is_aligned(&mod->resync, &buffer[i], len - i))
     {
-        asc_log_error(MSG("wrong stream format. drop %d bytes"), len - i);
-        mod->is_error_message = true;
+        const uint64_t prev_time = module_stream_trace_set(trace_time);
+        module_stream_send_batch(mod, &buffer[i], (len - i) / TS_PACKET_SIZE);
+        module_stream_trace_set(prev_time);
+    }
+    else
+    {
+        resync_send(mod, &buffer[i], len - i, trace_time);
     }
 }
 
-static void timer_renew_callback(void *arg)
+static void on_read_jumbo(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
-    asc_socket_multicast_renew(mod->sock);
+
+    struct iovec iov[UDP_BATCH_MAX];
+    size_t len[UDP_BATCH_MAX];
+    uint64_t time[UDP_BATCH_MAX];
+
+    rxq_sample(mod->rxq, mod->sock, mod->config.addr, mod->config.port);
+
+    for(int i = 0; i < mod->config.batch; ++i)
+    {
+        iov[i].iov_base = &mod->jumbo.buffer[i * mod->jumbo.size];
+        iov[i].iov_len = mod->jumbo.size;
+    }
+
+    const int count = asc_socket_recv_batch(  mod->sock, iov, len
+                                            , (mod->mdi.is_timestamp) ? time : NULL
+                                            , mod->config.batch);
+    if(count <= 0)
+    {
+        if(count == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+
+        on_close(mod);
+        return;
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(len[i] > 0)
+            on_jumbo_datagram(mod, iov[i].iov_base, len[i], (mod->mdi.is_timestamp) ? time[i] : 0);
+    }
 }
 
-static int method_port(module_data_t *mod)
+/*
+ * io_uring receive, see asc_socket_set_on_recv(). Datagram is received to
+ * the buffer of the pooled block, the block is provided again if nobody
+ * keeps it since the send
+ */
+
+static void on_recv(void *arg, void *opaque, const uint8_t *buffer, size_t size, uint64_t time)
 {
-    const int port = asc_socket_port(mod->sock);
-    lua_pushnumber(lua, port);
-    return 1;
+    module_data_t *mod = (module_data_t *)arg;
+    module_stream_block_t *block = (module_stream_block_t *)opaque;
+    __uarg(buffer); // block->buffer
+
+    rxq_sample(mod->rxq, mod->sock, mod->config.addr, mod->config.port);
+
+    if(size > 0)
+        on_datagram(mod, block, size, time);
+
+    if(block->refcount > 1 || !mod->sock)
+    {
+        module_stream_block_unref(block);
+        if(!mod->sock)
+            return;
+        block = module_stream_block_alloc();
+    }
+
+    asc_socket_recv_provide(  mod->sock, block->headroom
+                            , STREAM_BLOCK_HEADROOM + STREAM_BLOCK_SIZE, block);
 }
 
-static void module_init(module_data_t *mod)
+static void on_recv_jumbo(void *arg, void *opaque, const uint8_t *buffer, size_t size
+                          , uint64_t time)
 {
-    module_stream_init(mod, NULL);
+    module_data_t *mod = (module_data_t *)arg;
 
-    module_option_string("addr", &mod->config.addr, NULL);
-    asc_assert(mod->config.addr != NULL, "[udp_input] option 'addr' is required");
+    rxq_sample(mod->rxq, mod->sock, mod->config.addr, mod->config.port);
 
-    module_option_number("port", &mod->config.port);
+    if(size > 0)
+        on_jumbo_datagram(mod, buffer, size, time);
 
-    mod->sock = asc_socket_open_udp4(mod);
-    asc_socket_set_reuseaddr(mod->sock, 1);
-#ifdef _WIN32
-    if(!asc_socket_bind(mod->sock, NULL, mod->config.port))
-#else
-    if(!asc_socket_bind(mod->sock, mod->config.addr, mod->config.port))
-#endif
+    if(!mod->sock)
+    {
+        free(opaque);
         return;
+    }
 
-    int value;
-    if(module_option_number("socket_size", &value))
-        asc_socket_set_buffer(mod->sock, value, 0);
+    asc_socket_recv_provide(mod->sock, opaque, ASC_SOCKET_RECV_HEADROOM + mod->jumbo.size, opaque);
+}
 
-    module_option_boolean("rtp", &mod->config.rtp);
+static void on_recv_release(void *arg)
+{
+    module_stream_block_unref((module_stream_block_t *)arg);
+}
 
-    asc_socket_set_on_read(mod->sock, on_read);
-    asc_socket_set_on_close(mod->sock, on_close);
+static bool recv_init(module_data_t *mod)
+{
+    if(mod->config.mtu > UDP_MTU_DEFAULT)
+    {
+        mod->jumbo.size = mod->config.mtu - UDP_HEADER_SIZE;
+        if(!asc_socket_set_on_recv(mod->sock, UDP_RECV_COUNT, on_recv_jumbo, free))
+            return false;
 
-    module_option_string("localaddr", &mod->config.localaddr, NULL);
-    asc_socket_multicast_join(mod->sock, mod->config.addr, mod->config.localaddr);
+        for(int i = 0; i < UDP_RECV_COUNT; ++i)
+        {
+            const size_t size = ASC_SOCKET_RECV_HEADROOM + mod->jumbo.size;
+            uint8_t *const buffer = (uint8_t *)malloc(size);
+            asc_socket_recv_provide(mod->sock, buffer, size, buffer);
+        }
+        return true;
+    }
+
+    if(!asc_socket_set_on_recv(mod->sock, UDP_RECV_COUNT, on_recv, on_recv_release))
+        return false;
 
-    if(module_option_number("renew", &value))
-        mod->timer_renew = asc_timer_init(value * 1000, timer_renew_callback, mod);
+    for(int i = 0; i < UDP_RECV_COUNT; ++i)
+    {
+        module_stream_block_t *const block = module_stream_block_alloc();
+        asc_socket_recv_provide(  mod->sock, block->headroom
+                                , STREAM_BLOCK_HEADROOM + STREAM_BLOCK_SIZE, block);
+    }
+    return true;
 }
 
-static void module_destroy(module_data_t *mod)
+/*
+ *   oooo ooooo ooooooooooo ooooooooooo ooooooooooo oooooooooo
+ *    888  888  88  888  88 88  888  88  888    88   888    888
+ *    888  888      888         888      888ooo8     888oooo88
+ *    888  888      888         888      888    oo   888  88o
+ * 8o888  o888o    o888o       o888o    o888ooo8888 o888o  88o8
+ *
+ * Datagrams are placed in the ring by the RTP sequence number and released
+ * in order. Missing datagram is waited for the latency time or while the
+ * count of the buffered datagrams is less than gap_skip, then skipped.
+ */
+
+static inline jitter_slot_t * jitter_slot(module_data_t *mod, uint16_t seq)
 {
-    module_stream_destroy(mod);
+    return &mod->jitter.ring[seq & (JITTER_RING_SIZE - 1)];
+}
 
-    on_close(mod);
+static inline bool jitter_is_present(module_data_t *mod, uint16_t seq)
+{
+    const jitter_slot_t *slot = jitter_slot(mod, seq);
+    return slot->is_present && slot->seq == seq;
+}
+
+static bool fec_recover(module_data_t *mod, uint16_t seq);
+
+static void jitter_release_head(module_data_t *mod)
+{
+    const uint16_t seq = mod->jitter.head;
+
+    if(jitter_is_present(mod, seq) || (mod->fec.is_enabled && fec_recover(mod, seq)))
+    {
+        const jitter_slot_t *slot = jitter_slot(mod, seq);
+        /* traced from the receive time, including the reorder delay */
+        const uint64_t time = (trace_sample(mod)) ? slot->time : 0;
+        if(udp_resync_is_aligned(&mod->resync, slot->payload, slot->size))
+        {
+            const uint64_t trace_time = module_stream_trace_set(time);
+            module_stream_send_batch(mod, slot->payload, slot->size / TS_PACKET_SIZE);
+            module_stream_trace_set(trace_time);
+        }
+        else if(slot->size > 0)
+        {
+            resync_send(mod, slot->payload, slot->size, time);
+        }
+    }
+    else
+    {
+        ++mod->jitter.lost;
+        udp_resync_reset(&mod->resync);
+    }
+
+    ++mod->jitter.head;
+}
+
+static void jitter_flush(module_data_t *mod)
+{
+    while(mod->jitter.head != mod->jitter.tail)
+        jitter_release_head(mod);
+}
+
+/* releases datagrams in order, stops on the missing one if it is not expired */
+static void jitter_release(module_data_t *mod)
+{
+    uint32_t limit = mod->jitter.gap_skip;
+    if(mod->jitter.window > limit)
+        limit = mod->jitter.window;
+
+    const uint64_t now = asc_loop_utime();
+
+    while(mod->jitter.head != mod->jitter.tail)
+    {
+        const uint16_t seq = mod->jitter.head;
+        if(   !jitter_is_present(mod, seq)
+           && !(mod->fec.is_enabled && fec_recover(mod, seq)))
+        {
+            const uint32_t count = (uint16_t)(mod->jitter.tail - seq);
+            const jitter_slot_t *slot = jitter_slot(mod, seq);
+
+            bool is_skip = false;
+            if(limit > 0 && count > limit)
+                is_skip = true;
+            else if(mod->jitter.latency > 0)
+                is_skip = (now - slot->time >= mod->jitter.latency);
+            else
+                is_skip = (limit == 0);
+
+            if(!is_skip)
+                return;
+        }
+
+        jitter_release_head(mod);
+    }
+}
+
+static void jitter_on_datagram(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    if(size < RTP_HEADER_SIZE || (buffer[0] >> 6) != 2)
+        return;
+
+    size_t skip = RTP_HEADER_SIZE + (buffer[0] & 0x0F) * 4;
+    if(RTP_IS_EXT(buffer))
+    {
+        if(size < skip + 4)
+            return;
+        skip += ((buffer[skip + 2] << 8) | buffer[skip + 3]) * 4 + 4;
+    }
+    if(skip > size || size - skip > JITTER_PAYLOAD_SIZE)
+        return;
+
+    const size_t payload_size = size - skip;
+
+    const uint64_t now = asc_loop_utime();
+    const uint16_t seq = (buffer[2] << 8) | buffer[3];
+    mod->jitter.last_time = now;
+
+    if(!mod->jitter.is_started)
+    {
+        mod->jitter.is_started = true;
+        mod->jitter.head = seq;
+        mod->jitter.tail = seq;
+    }
+
+    const int16_t ahead = (int16_t)(seq - mod->jitter.tail);
+    if(ahead >= 0 || (int16_t)(seq - mod->jitter.head) < -JITTER_RING_SIZE)
+    {
+        if(ahead < 0 || ahead >= JITTER_RING_SIZE)
+        {
+            // sender is restarted or the long gap
+            jitter_flush(mod);
+            mod->jitter.head = seq;
+            mod->jitter.tail = seq;
+        }
+
+        while((uint16_t)(seq - mod->jitter.head) >= JITTER_RING_SIZE)
+            jitter_release_head(mod);
+
+        for(; mod->jitter.tail != seq; ++mod->jitter.tail)
+        {
+            jitter_slot_t *slot = jitter_slot(mod, mod->jitter.tail);
+            slot->seq = mod->jitter.tail;
+            slot->is_present = false;
+            slot->time = now;
+        }
+        ++mod->jitter.tail;
+    }
+    else if((int16_t)(seq - mod->jitter.head) < 0)
+    {
+        if(jitter_is_present(mod, seq))
+            ++mod->jitter.duplicate;
+        else
+            ++mod->jitter.late;
+        return;
+    }
+    else if(jitter_is_present(mod, seq))
+    {
+        ++mod->jitter.duplicate;
+        return;
+    }
+    else
+    {
+        ++mod->jitter.reordered;
+    }
+
+    jitter_slot_t *slot = jitter_slot(mod, seq);
+    slot->seq = seq;
+    slot->is_present = true;
+    slot->time = now;
+    slot->size = payload_size;
+    memcpy(slot->payload, &buffer[skip], payload_size);
+
+    jitter_release(mod);
+}
+
+static void jitter_on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_loop_utime();
+
+    if(now - mod->jitter.last_time >= JITTER_IDLE_TIMEOUT)
+        jitter_flush(mod);
+    else
+        jitter_release(mod);
+
+    if(now - mod->jitter.stat_time < JITTER_STAT_INTERVAL)
+        return;
+    mod->jitter.stat_time = now;
+
+    const uint64_t reordered = mod->jitter.reordered - mod->jitter.stat_reordered;
+    const uint64_t duplicate = mod->jitter.duplicate - mod->jitter.stat_duplicate;
+    const uint64_t late = mod->jitter.late - mod->jitter.stat_late;
+    const uint64_t lost = mod->jitter.lost - mod->jitter.stat_lost;
+    const uint64_t recovered = mod->fec.recovered - mod->jitter.stat_recovered;
+    if(lost || recovered || late)
+    {
+        asc_log_warning(MSG("RTP reordered:%llu duplicate:%llu late:%llu lost:%llu recovered:%llu")
+                        , (unsigned long long)reordered, (unsigned long long)duplicate
+                        , (unsigned long long)late, (unsigned long long)lost
+                        , (unsigned long long)recovered);
+    }
+    mod->jitter.stat_reordered = mod->jitter.reordered;
+    mod->jitter.stat_duplicate = mod->jitter.duplicate;
+    mod->jitter.stat_late = mod->jitter.late;
+    mod->jitter.stat_lost = mod->jitter.lost;
+    mod->jitter.stat_recovered = mod->fec.recovered;
+}
+
+static void jitter_init(module_data_t *mod, int latency, int gap_skip)
+{
+    mod->jitter.is_enabled = true;
+    mod->jitter.latency = (latency > 0) ? (uint32_t)latency * 1000 : 0;
+    mod->jitter.gap_skip = (gap_skip > 0) ? (uint32_t)gap_skip : 0;
+    if(mod->jitter.gap_skip > JITTER_RING_SIZE / 2)
+        mod->jitter.gap_skip = JITTER_RING_SIZE / 2;
+
+    mod->jitter.ring = (jitter_slot_t *)calloc(JITTER_RING_SIZE, sizeof(jitter_slot_t));
+    mod->jitter.last_time = asc_loop_utime();
+    mod->jitter.stat_time = mod->jitter.last_time;
+
+    int interval = JITTER_TIMER_INTERVAL;
+    if(latency > 0 && latency / 4 < interval)
+        interval = (latency / 4 > JITTER_TIMER_MIN) ? latency / 4 : JITTER_TIMER_MIN;
+    mod->jitter.timer = asc_timer_init(interval, jitter_on_timer, mod);
+}
+
+static void jitter_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->jitter.timer, asc_timer_destroy);
+    ASC_FREE(mod->jitter.ring, free);
+}
+
+/*
+ * oooo     oooo ooooooooooo oooooooooo    ooooooo8 ooooooooooo
+ *  8888o   888   888    88   888    888 o888    88  888    88
+ *  88 888o8 88   888ooo8     888oooo88  888    oooo 888ooo8
+ *  88  888  88   888    oo   888  88o   888o    88  888    oo
+ * o88o  8  o88o o888ooo8888 o888o  88o8  888ooo888 o888ooo8888
+ *
+ * SMPTE 2022-7 seamless protection. Both paths carry the same RTP stream,
+ * the window keeps the sequence numbers of the last passed datagrams.
+ * The datagram is passed if its number is not in the window, so the loss on
+ * one path is covered by the other one without the switch.
+ */
+
+static bool merge_is_first(module_data_t *mod, const uint8_t *buffer, int len, int path)
+{
+    if(len < RTP_HEADER_SIZE || (buffer[0] >> 6) != 2)
+        return false;
+
+    const uint16_t seq = (buffer[2] << 8) | buffer[3];
+    const uint64_t now = asc_loop_utime();
+    merge_slot_t *slot = &mod->merge.window[seq & (MERGE_WINDOW_SIZE - 1)];
+
+    /* sender is restarted or both paths are stopped for a while */
+    if(mod->merge.is_started && now - mod->merge.last_time >= MERGE_RESET_TIMEOUT)
+    {
+        memset(mod->merge.window, 0, sizeof(mod->merge.window));
+        mod->merge.is_started = false;
+    }
+
+    if(!mod->merge.is_started)
+    {
+        mod->merge.is_started = true;
+        mod->merge.last_seq = seq;
+    }
+    else
+    {
+        const int16_t ahead = (int16_t)(seq - mod->merge.last_seq);
+        if(ahead <= -MERGE_WINDOW_SIZE)
+        {
+            /* the slot is reused by the newer datagram */
+            ++mod->merge.late;
+            return false;
+        }
+        if(slot->is_present && slot->seq == seq)
+        {
+            ++mod->merge.duplicate;
+            return false;
+        }
+        if(ahead > 0)
+            mod->merge.last_seq = seq;
+    }
+
+    slot->seq = seq;
+    slot->is_present = true;
+    mod->merge.last_time = now;
+    ++mod->merge.passed[path];
+
+    return true;
+}
+
+static void merge_on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    module_stream_block_t *block = module_stream_block_alloc();
+
+    uint64_t time = 0;
+    const int len = asc_socket_recv_time(mod->merge.sock, block->buffer, STREAM_BLOCK_SIZE, &time);
+    if(len > 0)
+        on_datagram_path(mod, block, len, time, 1);
+    else if(len == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+        asc_log_error(MSG("second path recv failed [%s]"), asc_socket_error());
+
+    module_stream_block_unref(block);
+}
+
+static void merge_init(module_data_t *mod)
+{
+    module_option_string("addr2", &mod->merge.addr, NULL);
+    if(!mod->merge.addr)
+        return;
+
+    asc_assert(mod->config.rtp, MSG("option 'addr2' requires rtp"));
+    asc_assert(mod->config.mtu <= UDP_MTU_DEFAULT, MSG("option 'addr2' requires mtu up to %d")
+               , UDP_MTU_DEFAULT);
+
+    mod->merge.port = mod->config.port;
+    module_option_number("port2", &mod->merge.port);
+    const char *localaddr = mod->config.localaddr;
+    module_option_string("localaddr2", &localaddr, NULL);
+    const char *source = NULL;
+    module_option_string("source2", &source, NULL);
+
+    mod->merge.sock = asc_socket_open_udp4(mod);
+    asc_socket_set_priority(mod->merge.sock, ASC_EVENT_INPUT);
+    asc_socket_set_reuseaddr(mod->merge.sock, 1);
+#ifdef _WIN32
+    if(!asc_socket_bind(mod->merge.sock, NULL, mod->merge.port))
+#else
+    if(!asc_socket_bind(mod->merge.sock, mod->merge.addr, mod->merge.port))
+#endif
+    {
+        asc_log_error(MSG("failed to bind the second path %s:%d")
+                      , mod->merge.addr, mod->merge.port);
+        ASC_FREE(mod->merge.sock, asc_socket_close);
+        return;
+    }
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(mod->merge.sock, value, 0);
+
+    asc_socket_set_on_read(mod->merge.sock, merge_on_read);
+    mod->merge.membership = udp_membership_join(  mod->merge.sock, mod->merge.addr
+                                                , localaddr, source, mod->config.renew);
+    mod->merge.is_enabled = true;
+}
+
+static void merge_destroy(module_data_t *mod)
+{
+    if(!mod->merge.sock)
+        return;
+
+    ASC_FREE(mod->merge.membership, udp_membership_leave);
+    ASC_FREE(mod->merge.sock, udp_membership_close);
+    mod->merge.is_enabled = false;
+}
+
+/*
+ * oooo     oooo ooooooooo   ooooo
+ *  8888o   888   888    88o  888
+ *  88 888o8 88   888    888  888
+ *  88  888  88   888    888  888
+ * o88o  8  o88o o888ooo88   o888o
+ *
+ * Media Delivery Index, RFC 4445. Delay factor is the span of the virtual
+ * buffer, filled by the received bytes and drained with the rate of
+ * the previous interval. Media loss is counted by the TS continuity counters.
+ * Inter-arrival time is counted in the buckets, not cumulative.
+ */
+
+static const uint32_t mdi_iat_bound[MDI_IAT_BUCKETS - 1] =
+{
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, // us
+};
+
+static const char *const mdi_iat_label[MDI_IAT_BUCKETS] =
+{
+    "1", "2", "5", "10", "20", "50", "100", "+Inf", // ms
+};
+
+static void mdi_check_cc(module_data_t *mod, const uint8_t *ts)
+{
+    if(!TS_IS_SYNC(ts) || !TS_IS_PAYLOAD(ts))
+        return;
+
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == NULL_TS_PID)
+        return;
+
+    const uint8_t cc = TS_GET_CC(ts);
+    const uint8_t last = mod->mdi.cc[pid];
+    mod->mdi.cc[pid] = 0x10 | cc;
+
+    if(!last)
+        return;
+    /* discontinuity indicator */
+    if(TS_IS_AF(ts) && ts[4] > 0 && (ts[5] & 0x80))
+        return;
+
+    const uint8_t expected = (last + 1) & 0x0F;
+    if(cc == expected || cc == (last & 0x0F))
+        return;
+
+    const uint8_t lost = (cc - expected) & 0x0F;
+    mod->mdi.interval_lost += lost;
+    mod->mdi.lost += lost;
+}
+
+static void mdi_on_datagram(module_data_t *mod, const uint8_t *buffer, int len
+                            , uint64_t time)
+{
+    /* kernel time and the loop time are the different clocks */
+    if(!time)
+        time = (mod->mdi.is_timestamp && mod->mdi.last_time) ? mod->mdi.last_time : asc_loop_utime();
+
+    if(mod->mdi.last_time && time >= mod->mdi.last_time)
+    {
+        const uint64_t iat = time - mod->mdi.last_time;
+        int i = 0;
+        while(i < MDI_IAT_BUCKETS - 1 && iat > mdi_iat_bound[i])
+            ++i;
+        ++mod->mdi.iat[i];
+        if(iat > mod->mdi.interval_iat_max)
+            mod->mdi.interval_iat_max = iat;
+    }
+    mod->mdi.last_time = time;
+
+    /* interval is restarted on the clock step or after the idle */
+    if(time < mod->mdi.time || time - mod->mdi.time >= 2 * MDI_INTERVAL)
+    {
+        mod->mdi.time = time;
+        mod->mdi.bytes = 0;
+        mod->mdi.vb_min = 0.0;
+        mod->mdi.vb_max = 0.0;
+        mod->mdi.interval_lost = 0;
+        mod->mdi.interval_iat_max = 0;
+    }
+    else if(time - mod->mdi.time >= MDI_INTERVAL)
+    {
+        const uint64_t interval = time - mod->mdi.time;
+        const double rate = mod->mdi.rate;
+
+        mod->mdi.df = (rate > 0.0) ? (uint64_t)((mod->mdi.vb_max - mod->mdi.vb_min) / rate) : 0;
+        mod->mdi.mlr = mod->mdi.interval_lost * 1000000 / interval;
+        mod->mdi.iat_max = mod->mdi.interval_iat_max;
+        mod->mdi.rate = (double)mod->mdi.bytes / interval;
+
+        mod->mdi.time = time;
+        mod->mdi.bytes = 0;
+        mod->mdi.vb_min = 0.0;
+        mod->mdi.vb_max = 0.0;
+        mod->mdi.interval_lost = 0;
+        mod->mdi.interval_iat_max = 0;
+    }
+
+    const double drained = mod->mdi.rate * (time - mod->mdi.time);
+    const double vb_pre = mod->mdi.bytes - drained;
+    mod->mdi.bytes += len;
+    const double vb_post = mod->mdi.bytes - drained;
+    if(vb_pre < mod->mdi.vb_min)
+        mod->mdi.vb_min = vb_pre;
+    if(vb_post > mod->mdi.vb_max)
+        mod->mdi.vb_max = vb_post;
+
+    int i = 0;
+    if(mod->config.rtp)
+    {
+        if(len < RTP_HEADER_SIZE)
+            return;
+        i = RTP_HEADER_SIZE + (buffer[0] & 0x0F) * 4;
+        if(RTP_IS_EXT(buffer))
+        {
+            if(len < i + 4)
+                return;
+            i += (((buffer[i + 2] << 8) | buffer[i + 3]) * 4 + 4);
+        }
+    }
+
+    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
+        mdi_check_cc(mod, &buffer[i]);
+}
+
+static void mdi_init(module_data_t *mod)
+{
+    mod->mdi.is_enabled = true;
+    mod->mdi.cc = (uint8_t *)calloc(MAX_PID, sizeof(uint8_t));
+
+    asc_socket_t *sock = (mod->shared) ? mod->shared->sock : mod->sock;
+#ifdef HAVE_PACKET_MMAP
+    if(mod->packet_sub)
+        sock = NULL;
+#endif
+    if(sock)
+        mod->mdi.is_timestamp = asc_socket_set_timestamp(sock);
+
+    char labels[512];
+    const size_t skip = metric_labels(mod, labels, sizeof(labels));
+
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_mdi_df_us", ASC_METRIC_GAUGE
+                                            , "MDI delay factor, microseconds")
+                        , labels, &mod->mdi.df, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_mdi_mlr", ASC_METRIC_GAUGE
+                                            , "MDI media loss rate, TS packets per second")
+                        , labels, &mod->mdi.mlr, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_media_lost_total", ASC_METRIC_COUNTER
+                                            , "TS packets lost by the continuity counters")
+                        , labels, &mod->mdi.lost, 1);
+    asc_metric_register(&mod->metric_list
+                        , asc_metric_family("astra_udp_input_iat_max_us", ASC_METRIC_GAUGE
+                                            , "Maximum datagram inter-arrival time, microseconds")
+                        , labels, &mod->mdi.iat_max, 1);
+
+    asc_metric_family_t *family = asc_metric_family(  "astra_udp_input_iat_total"
+                                                    , ASC_METRIC_COUNTER
+                                                    , "Datagram inter-arrival time up to iat_ms");
+    for(int i = 0; i < MDI_IAT_BUCKETS && skip < sizeof(labels); ++i)
+    {
+        snprintf(&labels[skip], sizeof(labels) - skip, ",iat_ms=\"%s\"", mdi_iat_label[i]);
+        asc_metric_register(&mod->metric_list, family, labels, &mod->mdi.iat[i], 1);
+    }
+}
+
+static void mdi_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->mdi.cc, free);
+}
+
+/*
+ * oooooooooo ooooooooooo  oooooooo8
+ *  888    88  888    88 o888     88
+ *  888oo8     888ooo8   888
+ *  888        888    oo 888o     oo
+ * o888o      o888ooo8888 888oooo88
+ *
+ */
+
+/*
+ * Recovers the datagram with the FEC datagrams where it is the only missing one.
+ * Each recovered datagram may complete other FEC datagrams, so repeats until
+ * the datagram is recovered or there are no changes.
+ * Released datagrams are kept in the ring and used for the recovery too.
+ */
+
+static bool fec_recover(module_data_t *mod, uint16_t seq)
+{
+    bool is_changed = true;
+    while(is_changed && !jitter_is_present(mod, seq))
+    {
+        is_changed = false;
+
+        for(uint32_t i = 0; i < FEC_PENDING_SIZE; ++i)
+        {
+            fec_packet_t *fec = &mod->fec.pending[i];
+            if(fec->na == 0)
+                continue;
+
+            const uint16_t last = fec->snbase + (fec->na - 1) * fec->offset;
+            if((int16_t)(last - mod->jitter.head) < 0 && (int16_t)(last - seq) < 0)
+            {
+                fec->na = 0; // obsolete
+                continue;
+            }
+
+            int missing = 0;
+            uint16_t missing_seq = 0;
+            for(int n = 0; n < fec->na && missing < 2; ++n)
+            {
+                const uint16_t s = fec->snbase + n * fec->offset;
+                if(!jitter_is_present(mod, s))
+                {
+                    ++missing;
+                    missing_seq = s;
+                }
+            }
+
+            if(missing != 1)
+            {
+                if(missing == 0)
+                    fec->na = 0;
+                continue;
+            }
+
+            // missing datagram should be in the buffer and not released
+            if(   (int16_t)(missing_seq - mod->jitter.head) < 0
+               || (int16_t)(missing_seq - mod->jitter.tail) >= 0)
+            {
+                continue;
+            }
+
+            jitter_slot_t *slot = jitter_slot(mod, missing_seq);
+            size_t size = fec->length_recovery;
+            memcpy(slot->payload, fec->payload, fec->size);
+            for(int n = 0; n < fec->na; ++n)
+            {
+                const uint16_t s = fec->snbase + n * fec->offset;
+                if(s == missing_seq)
+                    continue;
+                const jitter_slot_t *item = jitter_slot(mod, s);
+                size ^= item->size;
+                fec_xor(slot->payload, item->payload, item->size);
+            }
+            fec->na = 0;
+
+            if(size > fec->size)
+                continue;
+
+            slot->seq = missing_seq;
+            slot->size = size;
+            slot->is_present = true;
+            ++mod->fec.recovered;
+            is_changed = true;
+        }
+    }
+
+    return jitter_is_present(mod, seq);
+}
+
+static void fec_on_read(void *arg, asc_socket_t *sock)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    fec_packet_t *fec = &mod->fec.pending[mod->fec.pending_next];
+
+    uint8_t buffer[FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_PAYLOAD_SIZE + 64];
+    while(1)
+    {
+        const ssize_t len = asc_socket_recv(sock, buffer, sizeof(buffer));
+        if(len <= 0)
+        {
+            // missing datagram may be recovered now
+            jitter_release(mod);
+            return;
+        }
+
+        if(!fec_packet_parse(fec, buffer, len))
+        {
+            fec->na = 0;
+            continue;
+        }
+
+        // column FEC arrives after the last row of the matrix
+        uint32_t window = (uint32_t)fec->offset * (fec->na + 1);
+        if(window > JITTER_RING_SIZE / 2)
+            window = JITTER_RING_SIZE / 2;
+        if(window > mod->jitter.window)
+            mod->jitter.window = window;
+
+        mod->fec.pending_next = (mod->fec.pending_next + 1) % FEC_PENDING_SIZE;
+        fec = &mod->fec.pending[mod->fec.pending_next];
+    }
+}
+
+static void fec_on_read_column(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    fec_on_read(mod, mod->fec.sock_column);
+}
+
+static void fec_on_read_row(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    fec_on_read(mod, mod->fec.sock_row);
+}
+
+static asc_socket_t * fec_socket_open(  module_data_t *mod, int port, void (*on_read)(void *)
+                                      , udp_membership_t **membership)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+#ifdef _WIN32
+    if(!asc_socket_bind(sock, NULL, port))
+#else
+    if(!asc_socket_bind(sock, mod->config.addr, port))
+#endif
+    {
+        asc_socket_close(sock);
+        return NULL;
+    }
+
+    asc_socket_set_on_read(sock, on_read);
+    *membership = udp_membership_join(  sock, mod->config.addr, mod->config.localaddr
+                                      , NULL, mod->config.renew);
+
+    return sock;
+}
+
+static void fec_init(module_data_t *mod)
+{
+    mod->fec.is_enabled = true;
+    mod->fec.pending = (fec_packet_t *)calloc(FEC_PENDING_SIZE, sizeof(fec_packet_t));
+
+    mod->fec.sock_column = fec_socket_open(mod, mod->config.port + FEC_COLUMN_PORT
+                                           , fec_on_read_column, &mod->fec.membership_column);
+    mod->fec.sock_row = fec_socket_open(mod, mod->config.port + FEC_ROW_PORT
+                                        , fec_on_read_row, &mod->fec.membership_row);
+}
+
+static void fec_destroy(module_data_t *mod)
+{
+    if(mod->fec.sock_column)
+    {
+        ASC_FREE(mod->fec.membership_column, udp_membership_leave);
+        ASC_FREE(mod->fec.sock_column, udp_membership_close);
+    }
+    if(mod->fec.sock_row)
+    {
+        ASC_FREE(mod->fec.membership_row, udp_membership_leave);
+        ASC_FREE(mod->fec.sock_row, udp_membership_close);
+    }
+
+    ASC_FREE(mod->fec.pending, free);
+}
+
+#ifdef HAVE_PACKET_MMAP
+static void on_packet(void *arg, const uint8_t *buffer, size_t size)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(size > STREAM_BLOCK_SIZE)
+        return;
+
+    module_stream_block_t *block = module_stream_block_alloc();
+    memcpy(block->buffer, buffer, size);
+    on_datagram(mod, block, size, 0);
+    module_stream_block_unref(block);
+}
+
+/* returns true if datagrams are received from the ring */
+static bool packet_init(module_data_t *mod)
+{
+    bool is_rx_ring = false;
+    module_option_boolean("rx_ring", &is_rx_ring);
+    if(!is_rx_ring)
+        return false;
+
+    const char *ifname = NULL;
+    module_option_string("ifname", &ifname, NULL);
+    int ring_size = 32;
+    module_option_number("rx_ring_size", &ring_size);
+
+    mod->packet_sub = udp_packet_subscribe(  ifname, mod->config.addr, mod->config.port
+                                           , ring_size, on_packet, mod);
+    if(!mod->packet_sub)
+    {
+        asc_log_warning(MSG("rx_ring is not available. use socket"));
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+/*
+ *  oooooooo8 ooooo ooooo      o      oooooooooo  ooooooooooo ooooooooo
+ * 888         888   888      888      888    888  888    88   888    88o
+ *  888oooooo  888ooo888     8  88     888oooo88   888ooo8     888    888
+ *         888 888   888    8oooo88    888  88o    888    oo   888    888
+ * o88oooo888 o888o o888o o88o  o888o o888o  88o8 o888ooo8888 o888ooo88
+ *
+ * One socket for all groups on the same port. Socket is bound to any
+ * address and joined to each group, datagrams are passed to the instance
+ * by the destination address from IP_PKTINFO.
+ */
+
+static asc_list_t *shared_list = NULL;
+
+static inline uint32_t shared_hash(uint32_t addr)
+{
+    return (addr ^ (addr >> 8) ^ (addr >> 16) ^ (addr >> 24)) & (UDP_SHARED_HASH_SIZE - 1);
+}
+
+static inline bool shared_option_eq(const char *a, const char *b)
+{
+    return (!a && !b) || (a && b && !strcmp(a, b));
+}
+
+/* same membership: group, interface and source */
+static bool shared_is_same(module_data_t *a, module_data_t *b)
+{
+    return a->shared_addr == b->shared_addr
+        && shared_option_eq(a->config.localaddr, b->config.localaddr)
+        && shared_option_eq(a->config.source, b->config.source);
+}
+
+/* instance with the same membership on the shared socket */
+static module_data_t * shared_find(module_data_t *mod, bool is_joined)
+{
+    for(module_data_t *item = mod->shared->hash[shared_hash(mod->shared_addr)]
+        ; item
+        ; item = item->shared_next)
+    {
+        if(item != mod && (item->membership != NULL) == is_joined && shared_is_same(item, mod))
+            return item;
+    }
+    return NULL;
+}
+
+static void on_shared_read(void *arg)
+{
+    udp_shared_t *shared = (udp_shared_t *)arg;
+
+    rxq_sample(&shared->rxq, shared->sock, "*", shared->port);
+
+    for(int i = 0; i < UDP_SHARED_READ_LIMIT; ++i)
+    {
+        module_stream_block_t *block = module_stream_block_alloc();
+
+        uint32_t dst;
+        uint64_t time;
+        const ssize_t len = asc_socket_recv_pktinfo(  shared->sock, block->buffer
+                                                    , STREAM_BLOCK_SIZE, &dst, &time);
+        if(len <= 0)
+        {
+            module_stream_block_unref(block);
+            if(len == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+                asc_log_error("[udp_input *:%d] recv failed [%s]"
+                              , shared->port, asc_socket_error());
+            return;
+        }
+
+        module_data_t *mod = shared->hash[shared_hash(dst)];
+        while(mod)
+        {
+            module_data_t *next = mod->shared_next;
+            if(mod->shared_addr == dst)
+                on_datagram(mod, block, len, time);
+            mod = next;
+        }
+
+        module_stream_block_unref(block);
+    }
+}
+
+static void on_shared_handover(void *arg)
+{
+    udp_shared_t *shared = (udp_shared_t *)arg;
+
+    char key[32];
+    snprintf(key, sizeof(key), "udp/*:%d", shared->port);
+    asc_handover_pass(key, NULL, asc_socket_fd(shared->sock));
+}
+
+static void shared_init(module_data_t *mod)
+{
+    if(!shared_list)
+        shared_list = asc_list_init();
+
+    udp_shared_t *shared = NULL;
+    asc_list_for(shared_list)
+    {
+        udp_shared_t *item = (udp_shared_t *)asc_list_data(shared_list);
+        if(item->port == mod->config.port)
+        {
+            shared = item;
+            break;
+        }
+    }
+
+    if(!shared)
+    {
+        shared = (udp_shared_t *)calloc(1, sizeof(udp_shared_t));
+        shared->port = mod->config.port;
+
+        char key[32];
+        snprintf(key, sizeof(key), "udp/*:%d", shared->port);
+        const int fd = asc_handover_take(key, NULL);
+        if(fd != -1)
+            shared->sock = asc_socket_open_fd(fd, shared);
+        else
+        {
+            shared->sock = asc_socket_open_udp4(shared);
+            asc_socket_set_reuseaddr(shared->sock, 1);
+            if(!asc_socket_bind(shared->sock, NULL, shared->port))
+                astra_abort();
+        }
+        asc_socket_set_priority(shared->sock, ASC_EVENT_INPUT);
+        if(!asc_socket_set_pktinfo(shared->sock))
+            asc_log_warning("[udp_input *:%d] IP_PKTINFO is not supported", shared->port);
+
+        int value;
+        if(module_option_number("socket_size", &value))
+            asc_socket_set_buffer(shared->sock, value, 0);
+
+        asc_socket_set_on_read(shared->sock, on_shared_read);
+        asc_handover_attach(on_shared_handover, shared);
+        asc_list_insert_tail(shared_list, shared);
+    }
+
+    ++shared->refcount;
+    mod->shared = shared;
+    rxq_init(mod, &shared->rxq, shared->sock);
+    mod->shared_addr = inet_addr(mod->config.addr);
+
+    const uint32_t hash = shared_hash(mod->shared_addr);
+    mod->shared_next = shared->hash[hash];
+    shared->hash[hash] = mod;
+
+    if(!shared_find(mod, true))
+    {
+        mod->membership = udp_membership_join(  shared->sock, mod->config.addr
+                                              , mod->config.localaddr, mod->config.source
+                                              , mod->config.renew);
+    }
+}
+
+static void shared_destroy(module_data_t *mod)
+{
+    udp_shared_t *shared = mod->shared;
+    if(!shared)
+        return;
+
+    module_data_t **item = &shared->hash[shared_hash(mod->shared_addr)];
+    while(*item && *item != mod)
+        item = &(*item)->shared_next;
+    if(*item)
+        *item = mod->shared_next;
+
+    /* membership is moved to the next instance with the same group */
+    if(mod->membership)
+    {
+        module_data_t *next = shared_find(mod, false);
+        if(next)
+            next->membership = mod->membership;
+        else
+            udp_membership_leave(mod->membership);
+        mod->membership = NULL;
+    }
+
+    mod->shared = NULL;
+
+    --shared->refcount;
+    if(shared->refcount > 0)
+        return;
+
+    asc_list_remove_item(shared_list, shared);
+    asc_handover_detach(shared);
+    udp_membership_close(shared->sock);
+    free(shared);
+
+    if(asc_list_size(shared_list) == 0)
+        ASC_FREE(shared_list, asc_list_destroy);
+}
+
+static int method_port(module_data_t *mod)
+{
+    asc_socket_t *sock = (mod->shared) ? mod->shared->sock : mod->sock;
+    const int port = (sock) ? asc_socket_port(sock) : 0;
+    lua_pushnumber(lua, port);
+    return 1;
+}
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, mod->jitter.reordered);
+    lua_setfield(lua, -2, "reordered");
+    lua_pushnumber(lua, mod->jitter.duplicate);
+    lua_setfield(lua, -2, "duplicate");
+    lua_pushnumber(lua, mod->jitter.late);
+    lua_setfield(lua, -2, "late");
+    lua_pushnumber(lua, mod->jitter.lost);
+    lua_setfield(lua, -2, "lost");
+    lua_pushnumber(lua, mod->fec.recovered);
+    lua_setfield(lua, -2, "recovered");
+    lua_pushnumber(lua, mod->resync.lost);
+    lua_setfield(lua, -2, "sync_lost");
+    lua_pushnumber(lua, mod->resync.dropped);
+    lua_setfield(lua, -2, "sync_dropped");
+    if(mod->rxq)
+    {
+        lua_pushnumber(lua, mod->rxq->dropped);
+        lua_setfield(lua, -2, "rx_dropped");
+        lua_pushnumber(lua, mod->rxq->queue);
+        lua_setfield(lua, -2, "rx_queue");
+        lua_pushnumber(lua, mod->rxq->peak);
+        lua_setfield(lua, -2, "rx_queue_peak");
+        lua_pushnumber(lua, mod->rxq->size);
+        lua_setfield(lua, -2, "rx_buffer");
+    }
+    if(mod->mdi.is_enabled)
+    {
+        lua_pushnumber(lua, (double)mod->mdi.df / 1000.0);
+        lua_setfield(lua, -2, "mdi_df");
+        lua_pushnumber(lua, mod->mdi.mlr);
+        lua_setfield(lua, -2, "mdi_mlr");
+        lua_pushnumber(lua, mod->mdi.lost);
+        lua_setfield(lua, -2, "mdi_lost");
+        lua_pushnumber(lua, (double)mod->mdi.iat_max / 1000.0);
+        lua_setfield(lua, -2, "iat_max");
+    }
+    if(mod->merge.is_enabled)
+    {
+        lua_pushnumber(lua, mod->merge.passed[0]);
+        lua_setfield(lua, -2, "path1");
+        lua_pushnumber(lua, mod->merge.passed[1]);
+        lua_setfield(lua, -2, "path2");
+        lua_pushnumber(lua, mod->merge.duplicate);
+        lua_setfield(lua, -2, "merge_duplicate");
+        lua_pushnumber(lua, mod->merge.late);
+        lua_setfield(lua, -2, "merge_late");
+    }
+    return 1;
+}
+
+/* the membership of the passed socket is kept, see core/handover.h */
+static void socket_handover_key(module_data_t *mod, char *key, size_t size)
+{
+    snprintf(  key, size, "udp/%s:%d@%s/%s", mod->config.addr, mod->config.port
+             , (mod->config.localaddr) ? mod->config.localaddr : ""
+             , (mod->config.source) ? mod->config.source : "");
+}
+
+static void on_handover(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    char key[128];
+    socket_handover_key(mod, key, sizeof(key));
+    asc_handover_pass(key, NULL, asc_socket_fd(mod->sock));
+}
+
+/* own socket for the group */
+static bool socket_init(module_data_t *mod)
+{
+#ifdef HAVE_PACKET_MMAP
+    /* socket is used for the multicast membership only */
+    const bool is_packet = packet_init(mod);
+    const int bind_port = (is_packet) ? 0 : mod->config.port;
+#else
+    const bool is_packet = false;
+    const int bind_port = mod->config.port;
+#endif
+
+    char key[128];
+    socket_handover_key(mod, key, sizeof(key));
+    const int fd = (!is_packet) ? asc_handover_take(key, NULL) : -1;
+    if(fd != -1)
+        mod->sock = asc_socket_open_fd(fd, mod);
+    else
+    {
+        mod->sock = asc_socket_open_udp4(mod);
+        asc_socket_set_reuseaddr(mod->sock, 1);
+#ifdef _WIN32
+        if(!asc_socket_bind(mod->sock, NULL, bind_port))
+#else
+        if(!asc_socket_bind(mod->sock, mod->config.addr, bind_port))
+#endif
+            return false;
+    }
+    asc_socket_set_priority(mod->sock, ASC_EVENT_INPUT);
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(mod->sock, value, 0);
+
+    mod->config.batch = 1;
+    module_option_number("batch", &mod->config.batch);
+    if(mod->config.batch < 1)
+        mod->config.batch = 1;
+    else if(mod->config.batch > UDP_BATCH_MAX)
+        mod->config.batch = UDP_BATCH_MAX;
+
+    if(!is_packet)
+        rxq_init(mod, &mod->rxq_data, mod->sock);
+
+    if(is_packet)
+    {
+        asc_assert(mod->config.mtu <= UDP_MTU_DEFAULT, MSG("option 'rx_ring' requires mtu up to %d")
+                   , UDP_MTU_DEFAULT);
+    }
+    else if(recv_init(mod))
+    {
+        asc_socket_set_on_close(mod->sock, on_close);
+    }
+    else if(mod->config.mtu > UDP_MTU_DEFAULT)
+    {
+        mod->jumbo.size = mod->config.mtu - UDP_HEADER_SIZE;
+        mod->jumbo.buffer = (uint8_t *)malloc(mod->config.batch * mod->jumbo.size);
+        asc_socket_set_on_read(mod->sock, on_read_jumbo);
+        asc_socket_set_on_close(mod->sock, on_close);
+    }
+    else if(mod->config.batch > 1)
+    {
+        mod->block_list = (module_stream_block_t **)calloc(  mod->config.batch
+                                                           , sizeof(module_stream_block_t *));
+        asc_socket_set_on_read(mod->sock, on_read_batch);
+        asc_socket_set_on_close(mod->sock, on_close);
+    }
+    else
+    {
+        asc_socket_set_on_read(mod->sock, on_read);
+        asc_socket_set_on_close(mod->sock, on_close);
+    }
+
+    mod->membership = udp_membership_join(  mod->sock, mod->config.addr, mod->config.localaddr
+                                          , mod->config.source, mod->config.renew);
+
+    if(!is_packet)
+        asc_handover_attach(on_handover, mod);
+
+    return true;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    module_option_string("addr", &mod->config.addr, NULL);
+    asc_assert(mod->config.addr != NULL, "[udp_input] option 'addr' is required");
+
+    module_option_number("port", &mod->config.port);
+    module_option_string("localaddr", &mod->config.localaddr, NULL);
+    module_option_string("source", &mod->config.source, NULL);
+    module_option_boolean("rtp", &mod->config.rtp);
+    module_option_number("trace", &mod->config.trace);
+    if(mod->config.trace < 0)
+        mod->config.trace = 0;
+    module_option_number("renew", &mod->config.renew);
+
+    mod->config.mtu = UDP_MTU_DEFAULT;
+    module_option_number("mtu", &mod->config.mtu);
+    asc_assert(mod->config.mtu >= UDP_MTU_MIN && mod->config.mtu <= UDP_MTU_MAX
+               , MSG("option 'mtu' out of range"));
+    const bool is_jumbo = (mod->config.mtu > UDP_MTU_DEFAULT);
+
+    int value;
+    if(module_option_number("igmp_rate", &value))
+        udp_membership_set_rate(value);
+
+    bool is_shared = false;
+    module_option_boolean("shared", &is_shared);
+    if(is_shared)
+    {
+        asc_assert(!is_jumbo, MSG("option 'shared' requires mtu up to %d"), UDP_MTU_DEFAULT);
+        shared_init(mod);
+    }
+    else if(!socket_init(mod))
+        return;
+
+    bool is_fec = false;
+    module_option_boolean("fec", &is_fec);
+    int latency = 0;
+    module_option_number("latency", &latency);
+    int gap_skip = 0;
+    module_option_number("gap_skip", &gap_skip);
+
+    if(is_fec || latency > 0 || gap_skip > 0)
+    {
+        asc_assert(mod->config.rtp, MSG("options 'fec', 'latency' and 'gap_skip' require rtp"));
+        asc_assert(!is_jumbo, MSG("options 'fec', 'latency' and 'gap_skip' require mtu up to %d")
+                   , UDP_MTU_DEFAULT);
+        jitter_init(mod, latency, gap_skip);
+    }
+    if(is_fec)
+        fec_init(mod);
+
+    merge_init(mod);
+
+    bool is_mdi = false;
+    module_option_boolean("mdi", &is_mdi);
+    if(is_mdi)
+        mdi_init(mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    asc_metric_unregister(&mod->metric_list);
+    on_close(mod);
+    shared_destroy(mod);
+    merge_destroy(mod);
+    fec_destroy(mod);
+    jitter_destroy(mod);
+    mdi_destroy(mod);
+
+#ifdef HAVE_PACKET_MMAP
+    ASC_FREE(mod->packet_sub, udp_packet_unsubscribe);
+#endif
+
+    if(mod->block_list)
+    {
+        for(int i = 0; i < mod->config.batch; ++i)
+        {
+            if(mod->block_list[i])
+                module_stream_block_unref(mod->block_list[i]);
+        }
+        free(mod->block_list);
+        mod->block_list = NULL;
+    }
+
+    ASC_FREE(mod->jumbo.buffer, free);
 }
 
 MODULE_STREAM_METHODS()
@@ -180,5 +1945,6 @@ MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
     { "port", method_port },
+    { "stat", method_stat },
 };
 MODULE_LUA_REGISTER(udp_input)
@@ -0,0 +1,259 @@
+/*
+ * Astra Module: UDP Multicast Membership
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "membership.h"
+
+#ifndef _WIN32
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#endif
+
+/* timer interval, ms. the operations of the second are spread over the ticks */
+#define MEMBERSHIP_TICK 100
+/* joins and leaves per second */
+#define MEMBERSHIP_RATE 200
+
+typedef enum
+{
+    MEMBERSHIP_IDLE = 0,
+    MEMBERSHIP_JOIN,
+    MEMBERSHIP_RENEW,
+    MEMBERSHIP_LEAVE,
+    MEMBERSHIP_CLOSE,
+} membership_op_t;
+
+struct udp_membership_t
+{
+    asc_socket_t *sock;
+    char *addr;
+    char *localaddr;
+    char *source;
+
+    uint64_t renew; // interval, us
+    uint64_t renew_time;
+
+    bool is_joined;
+    membership_op_t op; // queued operation
+
+    TAILQ_ENTRY(udp_membership_t) entries;
+    TAILQ_ENTRY(udp_membership_t) queue_entries;
+};
+
+typedef TAILQ_HEAD(membership_list_s, udp_membership_t) membership_list_t;
+
+static struct
+{
+    membership_list_t list; // memberships of the instances
+    size_t count;
+    membership_list_t queue;
+
+    asc_timer_t *timer;
+    int rate;
+    int budget; // operations left on the current tick
+} manager =
+{
+    .list = TAILQ_HEAD_INITIALIZER(manager.list),
+    .queue = TAILQ_HEAD_INITIALIZER(manager.queue),
+    .rate = MEMBERSHIP_RATE,
+};
+
+static int membership_budget(void)
+{
+    if(manager.rate <= 0)
+        return INT_MAX;
+
+    const int budget = manager.rate * MEMBERSHIP_TICK / 1000;
+    return (budget > 0) ? budget : 1;
+}
+
+static void membership_free(udp_membership_t *membership)
+{
+    free(membership->addr);
+    free(membership->localaddr);
+    free(membership->source);
+    free(membership);
+}
+
+static void membership_run(udp_membership_t *membership)
+{
+    const membership_op_t op = membership->op;
+    membership->op = MEMBERSHIP_IDLE;
+
+    switch(op)
+    {
+        case MEMBERSHIP_RENEW:
+            if(membership->is_joined)
+            {
+                asc_socket_multicast_drop(  membership->sock, membership->addr
+                                          , membership->localaddr, membership->source);
+            }
+            // fallthrough
+        case MEMBERSHIP_JOIN:
+            membership->is_joined = asc_socket_multicast_add(  membership->sock
+                                                             , membership->addr
+                                                             , membership->localaddr
+                                                             , membership->source);
+            membership->renew_time = asc_utime() + membership->renew;
+            break;
+        case MEMBERSHIP_LEAVE:
+            if(membership->is_joined)
+            {
+                asc_socket_multicast_drop(  membership->sock, membership->addr
+                                          , membership->localaddr, membership->source);
+            }
+            membership_free(membership);
+            break;
+        case MEMBERSHIP_CLOSE:
+            asc_socket_close(membership->sock);
+            membership_free(membership);
+            break;
+        default:
+            break;
+    }
+}
+
+/* the socket close is not an IGMP report and is not limited */
+static void membership_queue_run(bool is_flush)
+{
+    udp_membership_t *membership;
+    while((membership = TAILQ_FIRST(&manager.queue)) != NULL)
+    {
+        if(!is_flush && membership->op != MEMBERSHIP_CLOSE)
+        {
+            if(manager.budget <= 0)
+                break;
+            --manager.budget;
+        }
+
+        TAILQ_REMOVE(&manager.queue, membership, queue_entries);
+        membership_run(membership);
+    }
+}
+
+/* made at once if the budget of the tick is not spent */
+static void membership_push(udp_membership_t *membership, membership_op_t op)
+{
+    if(membership->op == MEMBERSHIP_IDLE)
+        TAILQ_INSERT_TAIL(&manager.queue, membership, queue_entries);
+    membership->op = op;
+
+    membership_queue_run(false);
+}
+
+static void on_membership_timer(void *arg)
+{
+    __uarg(arg);
+
+    manager.budget = membership_budget();
+
+    const uint64_t now = asc_utime();
+    udp_membership_t *membership;
+    TAILQ_FOREACH(membership, &manager.list, entries)
+    {
+        if(   membership->renew > 0
+           && membership->op == MEMBERSHIP_IDLE
+           && now >= membership->renew_time)
+        {
+            membership->op = MEMBERSHIP_RENEW;
+            TAILQ_INSERT_TAIL(&manager.queue, membership, queue_entries);
+        }
+    }
+
+    membership_queue_run(false);
+}
+
+void udp_membership_set_rate(int rate)
+{
+    manager.rate = rate;
+}
+
+udp_membership_t * udp_membership_join(  asc_socket_t *sock
+                                       , const char *addr, const char *localaddr
+                                       , const char *source, int renew)
+{
+    // the wrong address is reported by the join
+    const in_addr_t group = inet_addr(addr);
+    if(group != INADDR_NONE && !IN_MULTICAST(ntohl(group)))
+        return NULL;
+
+    if(!manager.timer)
+    {
+        manager.timer = asc_timer_init(MEMBERSHIP_TICK, on_membership_timer, NULL);
+        manager.budget = membership_budget();
+    }
+
+    udp_membership_t *membership = (udp_membership_t *)calloc(1, sizeof(udp_membership_t));
+    membership->sock = sock;
+    membership->addr = strdup(addr);
+    membership->localaddr = (localaddr) ? strdup(localaddr) : NULL;
+    membership->source = (source) ? strdup(source) : NULL;
+    membership->renew = (renew > 0) ? (uint64_t)renew * 1000 * 1000 : 0;
+
+    TAILQ_INSERT_TAIL(&manager.list, membership, entries);
+    ++manager.count;
+
+    membership_push(membership, MEMBERSHIP_JOIN);
+    return membership;
+}
+
+void udp_membership_leave(udp_membership_t *membership)
+{
+    TAILQ_REMOVE(&manager.list, membership, entries);
+    --manager.count;
+
+    if(membership->op == MEMBERSHIP_JOIN)
+    {
+        // the group is not joined yet
+        TAILQ_REMOVE(&manager.queue, membership, queue_entries);
+        membership_free(membership);
+    }
+    else
+        membership_push(membership, MEMBERSHIP_LEAVE);
+
+    if(manager.count == 0)
+    {
+        membership_queue_run(true);
+        ASC_FREE(manager.timer, asc_timer_destroy);
+    }
+}
+
+void udp_membership_close(asc_socket_t *sock)
+{
+    asc_socket_set_on_read(sock, NULL);
+    asc_socket_set_on_ready(sock, NULL);
+    asc_socket_set_on_close(sock, NULL);
+
+    udp_membership_t *membership;
+    TAILQ_FOREACH(membership, &manager.queue, queue_entries)
+    {
+        if(membership->sock == sock)
+            break;
+    }
+
+    if(!membership)
+    {
+        asc_socket_close(sock);
+        return;
+    }
+
+    membership = (udp_membership_t *)calloc(1, sizeof(udp_membership_t));
+    membership->sock = sock;
+    membership_push(membership, MEMBERSHIP_CLOSE);
+}
@@ -0,0 +1,52 @@
+/*
+ * Astra Module: UDP Multicast Membership
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_MEMBERSHIP_H_
+#define _UDP_MEMBERSHIP_H_ 1
+
+#include <astra.h>
+
+/*
+ * Multicast membership of the udp_input instances. Joins, leaves and
+ * renews of the process are made by one timer at the limited rate:
+ * IGMP snooping switches lose the reports of the burst. The renew of
+ * all groups is one sweep of the same timer.
+ *
+ * The own socket of the instance is closed by the manager after the leave,
+ * otherwise the kernel leaves the group on close without the pacing.
+ * The queue is flushed when the last membership is left, on the reload
+ * and on the exit the main loop is not running.
+ */
+
+typedef struct udp_membership_t udp_membership_t;
+
+/* operations per second of the process, 0 - without the pacing */
+void udp_membership_set_rate(int rate);
+
+/* NULL if the address is not multicast. renew - interval in seconds, 0 - off */
+udp_membership_t * udp_membership_join(  asc_socket_t *sock
+                                       , const char *addr, const char *localaddr
+                                       , const char *source, int renew);
+void udp_membership_leave(udp_membership_t *membership);
+
+/* closes the socket after the queued leaves, callbacks of the socket are cleared */
+void udp_membership_close(asc_socket_t *sock);
+
+#endif /* _UDP_MEMBERSHIP_H_ */
@@ -1,2 +1,7 @@
-SOURCES="input.c output.c"
+SOURCES="input.c output.c packet.c membership.c resync.c"
 MODULES="udp_input udp_output"
+
+if [ "$OS" != "mingw" ] ; then
+    SOURCES="$SOURCES pcap.c"
+    MODULES="$MODULES pcap_input"
+fi
@@ -24,6 +24,7 @@
  *
  * Module Options:
  *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name for the metrics
  *      addr        - string, source IP address
  *      port        - number, source UDP port
  *      ttl         - number, time to live
@@ -31,15 +32,65 @@
  *      socket_size - number, socket buffer size
  *      rtp         - boolean, use RTP instad RAW UDP
  *      sync        - number, if greater then 0, then use MPEG-TS syncing.
- *                            average value of the stream bitrate in megabit per second
+ *                            average value of the stream bitrate in megabit per second.
+ *                            free space of the sync buffer is the credit for the
+ *                            producers with flow_control
  *      cbr         - number, constant bitrate
+ *      txtime      - boolean, sync with the kernel pacing (SO_TXTIME) instead of
+ *                            the thread. requires fq or etf qdisc on the interface
+ *      pcr_restamp - boolean, with sync. correct PCR by the departure time of
+ *                            the datagram
+ *      mtu         - number, MTU of the link, 576..9000. datagram is filled with
+ *                            TS packets up to mtu - 28 bytes: 7 packets at 1500,
+ *                            47 packets at 9000 (jumbo frames). default: 1500
+ *      batch       - number, send datagrams in groups of N with one system call.
+ *                            not used with sync. default: 1 - with the io_uring
+ *                            event backend datagrams are queued to the ring,
+ *                            sends of the loop iteration take one system call
+ *      batch_latency
+ *                  - number, maximum time in milliseconds to hold datagram in
+ *                            the batch. default: 10
+ *      strip_null  - boolean, drop null packets, the output is VBR.
+ *                            not used with sync. default: false
+ *      fec_columns - number, SMPTE 2022-1 FEC matrix columns (L), 1..20.
+ *                            requires rtp. column FEC is sent to the port + 2
+ *      fec_rows    - number, FEC matrix rows (D), 1..20. L * D should not be
+ *                            greater than 100. if 0 only row FEC is sent
+ *      fec_row     - boolean, also send row FEC to the port + 4
+ *      thread_cpus, thread_numa, thread_priority
+ *                  - sync thread placement, see module_option_thread()
+ *      destinations
+ *                  - list, additional unicast destinations "addr[:port]".
+ *                            each datagram is filled once and sent to addr and
+ *                            to every destination. FEC is sent only to addr
+ *
+ * Module Methods:
+ *      add_destination(addr [, port])
+ *                  - boolean, start sending to the destination. default port
+ *                            is the port option
+ *      remove_destination(addr [, port])
+ *                  - boolean, stop sending to the destination
  */
 
 #include <astra.h>
+#include "fec.h"
 
 #define MSG(_msg) "[udp_output %s:%d] " _msg, mod->addr, mod->port
 
-#define UDP_BUFFER_SIZE 1460
+#define UDP_HEADER_SIZE 28 // IPv4 and UDP headers
+#define UDP_MTU_DEFAULT 1500
+#define UDP_MTU_MIN 576
+#define UDP_MTU_MAX 9000
+#define UDP_BUFFER_MAX (UDP_MTU_MAX - UDP_HEADER_SIZE)
+#define UDP_BATCH_MAX 64
+
+/* txtime: departure delay of the first block and allowed drift */
+#define TXTIME_DELAY 100000
+#define TXTIME_DRIFT 1000000
+
+/* pcr_restamp: maximum correction in microseconds */
+#define RESTAMP_LIMIT 20000
+#define PCR_MAX ((UINT64_C(1) << 33) * 300)
 
 struct module_data_t
 {
@@ -51,19 +102,38 @@ struct module_data_t
 
     bool is_rtp;
     uint16_t rtpseq;
+    bool is_strip_null;
 
     asc_socket_t *sock;
 
     struct
     {
         uint32_t skip;
-        uint8_t buffer[UDP_BUFFER_SIZE];
+        uint32_t size; // datagram payload limit, defined by the mtu
+        uint8_t buffer[UDP_BUFFER_MAX];
+        uint64_t trace_time; // sampled packet in the buffer, see module_stream_trace()
     } packet;
 
+    struct
+    {
+        int size;
+        int count;
+        int latency;
+        uint8_t *buffer;
+        struct iovec iov[UDP_BATCH_MAX];
+        asc_timer_t *timer;
+        uint64_t trace_time;
+    } batch;
+
     bool is_thread_started;
     asc_thread_t *thread;
     asc_thread_buffer_t *thread_input;
 
+    // metrics. send_errors is written by the sync thread
+    uint64_t send_errors;
+    uint64_t sync_overflows;
+    uint64_t null_drops;
+
     struct
     {
         uint8_t *buffer;
@@ -75,19 +145,268 @@ struct module_data_t
         bool reload;
     } sync;
 
+    struct
+    {
+        bool is_enabled;
+        bool is_pcr;
+        uint64_t time; // departure time of the next block
+        uint64_t packet_time; // departure time of the datagram in the packet.buffer
+    } txtime;
+
+    struct
+    {
+        bool is_enabled;
+        uint64_t time; // scheduled departure time of the packet passed to on_ts()
+        int count;
+        struct
+        {
+            uint32_t skip; // PCR packet in the packet.buffer
+            uint64_t time;
+        } pcr[UDP_BUFFER_MAX / TS_PACKET_SIZE];
+    } restamp;
+
+    struct
+    {
+        int columns; // L
+        int rows; // D
+        bool is_row;
+        int index; // position of the next datagram in the matrix
+        const uint8_t *ssrc;
+
+        asc_socket_t *sock_column;
+        asc_socket_t *sock_row;
+        uint16_t seq_column;
+        uint16_t seq_row;
+
+        fec_packet_t *column;
+        fec_packet_t row;
+    } fec;
+
     uint64_t pcr;
     uint16_t pcr_pid;
 };
 
 static const uint8_t null_ts[TS_PACKET_SIZE] = { 0x47, 0x1F, 0xFF, 0x10, 0x00 };
 
+/*
+ * The last hop of the sampled packet is the system call. With sync and txtime
+ * the datagrams are sent later, the time is recorded when the packet is queued
+ */
+
+static inline void output_trace(module_data_t *mod, uint64_t *trace_time)
+{
+    if(*trace_time)
+    {
+        module_stream_trace(mod, *trace_time);
+        *trace_time = 0;
+    }
+}
+
+/* batch.size is 0 with sync and txtime, on_ts() is called by the sync thread */
+static inline void output_trace_stamp(module_data_t *mod)
+{
+    if(mod->batch.size > 0 && module_stream_trace_time && !mod->packet.trace_time)
+        mod->packet.trace_time = module_stream_trace_time;
+}
+
+static inline void output_trace_queue(module_data_t *mod)
+{
+    if(module_stream_trace_time)
+        module_stream_trace(mod, module_stream_trace_time);
+}
+
+static void batch_flush(module_data_t *mod)
+{
+    if(mod->batch.timer)
+    {
+        asc_timer_destroy(mod->batch.timer);
+        mod->batch.timer = NULL;
+    }
+
+    if(mod->batch.count == 0)
+        return;
+
+    if(asc_socket_sendto_batch(mod->sock, mod->batch.iov, mod->batch.count) != mod->batch.count)
+    {
+        ++mod->send_errors;
+        asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+    }
+    mod->batch.count = 0;
+    output_trace(mod, &mod->batch.trace_time);
+}
+
+static void on_batch_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    mod->batch.timer = NULL;
+    batch_flush(mod);
+}
+
+/*
+ * oooooooooo ooooooooooo  oooooooo8
+ *  888    88  888    88 o888     88
+ *  888oo8     888ooo8   888
+ *  888        888    oo 888o     oo
+ * o888o      o888ooo8888 888oooo88
+ *
+ */
+
+static void fec_send(module_data_t *mod, asc_socket_t *sock, fec_packet_t *fec, uint16_t *seq)
+{
+    uint8_t buffer[FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_PAYLOAD_SIZE];
+
+    buffer[0] = 0x80; // RTP version
+    buffer[1] = FEC_PT;
+    buffer[2] = (*seq >> 8) & 0xFF;
+    buffer[3] = (*seq     ) & 0xFF;
+    memset(&buffer[4], 0, 4);
+    memcpy(&buffer[8], mod->fec.ssrc, 4);
+    ++(*seq);
+
+    size_t size = FEC_RTP_HEADER_SIZE;
+    size += fec_header_put(&buffer[size], fec);
+    memcpy(&buffer[size], fec->payload, fec->size);
+    size += fec->size;
+
+    if(asc_socket_sendto(sock, buffer, size) == -1)
+        asc_log_warning(MSG("error on FEC send [%s]"), asc_socket_error());
+}
+
+/* media datagram goes to the next position of the matrix */
+static void fec_push(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    const uint16_t seq = (buffer[2] << 8) | buffer[3];
+    const int column = mod->fec.index % mod->fec.columns;
+    const int row = mod->fec.index / mod->fec.columns;
+
+    if(mod->fec.rows > 0)
+    {
+        fec_packet_t *fec = &mod->fec.column[column];
+        if(row == 0)
+            fec_packet_reset(fec, seq);
+        fec_packet_add(fec, buffer, size);
+
+        if(row == mod->fec.rows - 1)
+            fec_send(mod, mod->fec.sock_column, fec, &mod->fec.seq_column);
+    }
+
+    if(mod->fec.is_row)
+    {
+        fec_packet_t *fec = &mod->fec.row;
+        if(column == 0)
+            fec_packet_reset(fec, seq);
+        fec_packet_add(fec, buffer, size);
+
+        if(column == mod->fec.columns - 1)
+            fec_send(mod, mod->fec.sock_row, fec, &mod->fec.seq_row);
+    }
+
+    ++mod->fec.index;
+    if(mod->fec.index >= mod->fec.columns * ((mod->fec.rows > 0) ? mod->fec.rows : 1))
+        mod->fec.index = 0;
+}
+
+static void datagram_send(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    if(mod->txtime.is_enabled)
+    {
+        if(asc_socket_sendto_txtime(mod->sock, buffer, size, mod->txtime.packet_time) == -1)
+        {
+            ++mod->send_errors;
+            asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+        }
+        return;
+    }
+
+    if(mod->batch.size <= 1)
+    {
+        ssize_t ret;
+        if(mod->batch.size == 1)
+        {
+            /* errors of the queued sends are reported by the completions */
+            const uint32_t errors = asc_socket_send_errors(mod->sock);
+            if(errors > 0)
+            {
+                mod->send_errors += errors;
+                asc_log_warning(MSG("error on send. failed:%u"), errors);
+            }
+            ret = asc_socket_sendto_async(mod->sock, buffer, size);
+        }
+        else
+            ret = asc_socket_sendto(mod->sock, buffer, size); // sync thread
+
+        if(ret == -1)
+        {
+            ++mod->send_errors;
+            asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+        }
+        output_trace(mod, &mod->packet.trace_time);
+        return;
+    }
+
+    struct iovec *const iov = &mod->batch.iov[mod->batch.count];
+    memcpy(iov->iov_base, buffer, size);
+    iov->iov_len = size;
+    ++mod->batch.count;
+
+    if(mod->packet.trace_time && !mod->batch.trace_time)
+        mod->batch.trace_time = mod->packet.trace_time;
+    mod->packet.trace_time = 0;
+
+    if(mod->batch.count == mod->batch.size)
+        batch_flush(mod);
+    else if(!mod->batch.timer)
+        mod->batch.timer = asc_timer_one_shot(mod->batch.latency, on_batch_timer, mod);
+}
+
+/*
+ * PCR re-stamping. The sync thread and the kernel pacing send each packet at
+ * the time scheduled by the PCR, but the datagram leaves with the first packet
+ * (txtime) or after the last packet (thread) and the thread wakes up late under
+ * the load. PCR of the datagram is shifted by the difference between the actual
+ * departure and the scheduled time of the PCR packet, so receivers see PCR
+ * which matches the arrival time. TX timestamps of the kernel come after the
+ * datagram is sent, the departure is known before: txtime value or the clock
+ * right before the system call.
+ */
+
+static void restamp_pcr(module_data_t *mod, uint8_t *buffer)
+{
+    const uint64_t departure = (mod->txtime.is_enabled)
+                             ? mod->txtime.packet_time
+                             : asc_utime();
+
+    for(int i = 0; i < mod->restamp.count; ++i)
+    {
+        int64_t delta = (int64_t)(departure - mod->restamp.pcr[i].time);
+        if(delta > RESTAMP_LIMIT)
+            delta = RESTAMP_LIMIT;
+        else if(delta < -RESTAMP_LIMIT)
+            delta = -RESTAMP_LIMIT;
+
+        uint8_t *const ts = &buffer[mod->restamp.pcr[i].skip];
+        const uint64_t pcr = TS_GET_PCR(ts) + PCR_MAX + delta * 27;
+        TS_SET_PCR(ts, pcr % PCR_MAX);
+    }
+
+    mod->restamp.count = 0;
+}
+
+static void output_send(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    datagram_send(mod, buffer, size);
+
+    if(mod->fec.columns > 0)
+        fec_push(mod, buffer, size);
+}
+
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
+    output_trace_stamp(mod);
+
     if(mod->is_rtp && mod->packet.skip == 0)
     {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        const uint64_t msec = ((tv.tv_sec % 1000000) * 1000) + (tv.tv_usec / 1000);
+        const uint64_t msec = asc_utime_coarse() / 1000;
 
         mod->packet.buffer[2] = (mod->rtpseq >> 8) & 0xFF;
         mod->packet.buffer[3] = (mod->rtpseq     ) & 0xFF;
@@ -102,27 +421,240 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         mod->packet.skip += 12;
     }
 
+    if(mod->restamp.is_enabled && TS_IS_PCR(ts) && TS_GET_PID(ts) == mod->pcr_pid)
+    {
+        mod->restamp.pcr[mod->restamp.count].skip = mod->packet.skip;
+        mod->restamp.pcr[mod->restamp.count].time = mod->restamp.time;
+        ++mod->restamp.count;
+    }
+
     memcpy(&mod->packet.buffer[mod->packet.skip], ts, TS_PACKET_SIZE);
     mod->packet.skip += TS_PACKET_SIZE;
 
-    if(mod->packet.skip > UDP_BUFFER_SIZE - TS_PACKET_SIZE)
+    if(mod->packet.skip > mod->packet.size - TS_PACKET_SIZE)
     {
-        if(asc_socket_sendto(mod->sock, mod->packet.buffer, mod->packet.skip) == -1)
-            asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+        if(mod->restamp.count > 0)
+            restamp_pcr(mod, mod->packet.buffer);
+        output_send(mod, mod->packet.buffer, mod->packet.skip);
         mod->packet.skip = 0;
     }
 }
 
+static void on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    output_trace_stamp(mod);
+
+    while(count > 0)
+    {
+        if(mod->is_rtp && mod->packet.skip == 0)
+        {
+            /* first packet in the datagram, on_ts() puts RTP header */
+            on_ts(mod, ts);
+            ts += TS_PACKET_SIZE;
+            --count;
+            continue;
+        }
+
+        size_t block = (mod->packet.size - mod->packet.skip) / TS_PACKET_SIZE;
+        if(block > count)
+            block = count;
+
+        const size_t block_size = block * TS_PACKET_SIZE;
+        memcpy(&mod->packet.buffer[mod->packet.skip], ts, block_size);
+        mod->packet.skip += block_size;
+        ts += block_size;
+        count -= block;
+
+        if(mod->packet.skip > mod->packet.size - TS_PACKET_SIZE)
+        {
+            output_send(mod, mod->packet.buffer, mod->packet.skip);
+            mod->packet.skip = 0;
+        }
+    }
+}
+
+static void on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    const size_t size = block->count * TS_PACKET_SIZE;
+
+    /* full datagram goes to the socket as is */
+    if(   !mod->is_rtp
+       && mod->packet.skip == 0
+       && size > mod->packet.size - TS_PACKET_SIZE
+       && size <= mod->packet.size)
+    {
+        output_trace_stamp(mod);
+        output_send(mod, block->ts, size);
+        return;
+    }
+
+    on_ts_batch(mod, block->ts, block->count);
+}
+
+/* strip_null=true */
+
+static void strip_on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(TS_GET_PID(ts) == NULL_TS_PID)
+        ++mod->null_drops;
+    else
+        on_ts(mod, ts);
+}
+
+static void strip_on_run(void *arg, const uint8_t *ts, size_t count)
+{
+    on_ts_batch((module_data_t *)arg, ts, count);
+}
+
+static void strip_on_ts_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    mod->null_drops += mpegts_ts_strip_null(ts, count, strip_on_run, mod);
+}
+
+static void strip_on_ts_block(module_data_t *mod, module_stream_block_t *block)
+{
+    mod->null_drops += mpegts_ts_strip_null(block->ts, block->count, strip_on_run, mod);
+}
+
 static void thread_input_push(module_data_t *mod, const uint8_t *ts)
 {
+    output_trace_queue(mod);
     const ssize_t r = asc_thread_buffer_write(mod->thread_input, ts, TS_PACKET_SIZE);
     if(r != TS_PACKET_SIZE)
     {
+        ++mod->sync_overflows;
+        asc_log_debug(MSG("sync buffer overflow"));
+        asc_thread_buffer_flush(mod->thread_input);
+    }
+}
+
+/* free space of the sync buffer for the producers with flow control */
+static size_t thread_input_credit(module_data_t *mod)
+{
+    if(!mod->thread_input)
+        return STREAM_CREDIT_MAX;
+
+    return asc_thread_buffer_space(mod->thread_input) / TS_PACKET_SIZE;
+}
+
+static void thread_input_push_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    output_trace_queue(mod);
+    const size_t size = count * TS_PACKET_SIZE;
+    const ssize_t r = asc_thread_buffer_write(mod->thread_input, ts, size);
+    if(r != (ssize_t)size)
+    {
+        ++mod->sync_overflows;
         asc_log_debug(MSG("sync buffer overflow"));
         asc_thread_buffer_flush(mod->thread_input);
     }
 }
 
+/*
+ * Kernel pacing. All packets between two PCR are sent at once, each datagram
+ * with own departure time. The kernel holds them until that time
+ */
+
+static void txtime_send_ts(module_data_t *mod, const uint8_t *ts, uint64_t time)
+{
+    if(mod->packet.skip == 0)
+        mod->txtime.packet_time = time;
+    mod->restamp.time = time;
+    on_ts(mod, ts);
+}
+
+static void txtime_reset(module_data_t *mod)
+{
+    mod->txtime.time = asc_utime() + TXTIME_DELAY;
+}
+
+static void txtime_block(module_data_t *mod, uint64_t pcr)
+{
+    const size_t block_size = mod->sync.buffer_write;
+    mod->sync.buffer_write = 0;
+
+    const uint64_t block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
+    if(block_time == 0 || block_time > 500000)
+    {
+        asc_log_debug(MSG("block time out of range: %"PRIu64"ms block_size:%lu"),
+            (uint64_t)(block_time / 1000), block_size);
+        txtime_reset(mod);
+        return;
+    }
+
+    const uint64_t system_time = asc_utime();
+    if(mod->txtime.time < system_time || mod->txtime.time > system_time + TXTIME_DRIFT)
+    {
+        asc_log_warning(MSG("wrong syncing time. reset"));
+        txtime_reset(mod);
+    }
+
+    const uint32_t data_count = block_size / TS_PACKET_SIZE;
+    uint32_t ts_count = data_count;
+    if(mod->cbr > 0)
+    {
+        const uint32_t cbr_ts_count = mod->cbr * block_time / 1000000;
+        if(cbr_ts_count > ts_count)
+            ts_count = cbr_ts_count;
+    }
+
+    for(uint32_t i = 0; i < ts_count; ++i)
+    {
+        const uint8_t *ts = (i < data_count)
+                          ? &mod->sync.buffer[i * TS_PACKET_SIZE]
+                          : null_ts;
+        txtime_send_ts(mod, ts, mod->txtime.time + block_time * i / ts_count);
+    }
+
+    mod->txtime.time += block_time;
+}
+
+static void txtime_push(module_data_t *mod, const uint8_t *ts)
+{
+    output_trace_queue(mod);
+    if(TS_IS_PCR(ts))
+    {
+        const uint16_t pid = TS_GET_PID(ts);
+        if(mod->pcr_pid == 0)
+            mod->pcr_pid = pid;
+
+        if(mod->pcr_pid == pid)
+        {
+            const uint64_t pcr = TS_GET_PCR(ts);
+            if(mod->txtime.is_pcr)
+            {
+                txtime_block(mod, pcr);
+            }
+            else
+            {
+                mod->txtime.is_pcr = true;
+                mod->pcr = pcr;
+                txtime_reset(mod);
+            }
+        }
+    }
+
+    if(!mod->txtime.is_pcr)
+        return;
+
+    if(mod->sync.buffer_write + TS_PACKET_SIZE > mod->sync.buffer_size)
+    {
+        asc_log_error(MSG("next PCR is not found"));
+        mod->sync.buffer_write = 0;
+        mod->txtime.is_pcr = false;
+        return;
+    }
+
+    memcpy(&mod->sync.buffer[mod->sync.buffer_write], ts, TS_PACKET_SIZE);
+    mod->sync.buffer_write += TS_PACKET_SIZE;
+}
+
+static void txtime_push_batch(module_data_t *mod, const uint8_t *ts, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        txtime_push(mod, &ts[i * TS_PACKET_SIZE]);
+}
+
 static bool seek_pcr(module_data_t *mod,
     size_t *block_size, size_t *next_block, uint64_t *pcr)
 {
@@ -291,6 +823,7 @@ static void thread_loop(void *arg)
             for(uint32_t i = 0; mod->is_thread_started && i < ts_count; ++i)
             {
                 // sending
+                mod->restamp.time = block_time_total;
                 if(mod->sync.buffer_read != next_block)
                 {
                     const uint8_t *const pointer = &mod->sync.buffer[mod->sync.buffer_read];
@@ -341,6 +874,128 @@ static void thread_loop(void *arg)
     }
 }
 
+static asc_socket_t * socket_open(module_data_t *mod, int port)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+    if(!asc_socket_bind(sock, NULL, 0))
+        astra_abort();
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(sock, 0, value);
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    if(localaddr)
+        asc_socket_set_multicast_if(sock, localaddr);
+
+    value = 32;
+    module_option_number("ttl", &value);
+    asc_socket_set_multicast_ttl(sock, value);
+
+    asc_socket_multicast_join(sock, mod->addr, NULL);
+    asc_socket_set_sockaddr(sock, mod->addr, port);
+
+    return sock;
+}
+
+static void fec_init(module_data_t *mod)
+{
+    asc_assert(mod->is_rtp, MSG("option 'fec_columns' requires rtp"));
+    asc_assert(mod->fec.columns <= FEC_L_MAX, MSG("option 'fec_columns' out of range"));
+    asc_assert(mod->packet.size - FEC_RTP_HEADER_SIZE <= FEC_PAYLOAD_SIZE
+               , MSG("option 'fec_columns' requires mtu up to %d"), UDP_MTU_DEFAULT);
+
+    module_option_number("fec_rows", &mod->fec.rows);
+    asc_assert(mod->fec.rows >= 0 && mod->fec.rows <= FEC_D_MAX
+               , MSG("option 'fec_rows' out of range"));
+    if(mod->fec.columns * mod->fec.rows > FEC_LD_MAX)
+        asc_log_warning(MSG("FEC matrix is greater than %d datagrams"), FEC_LD_MAX);
+
+    module_option_boolean("fec_row", &mod->fec.is_row);
+    if(mod->fec.rows == 0)
+        mod->fec.is_row = true;
+
+    mod->fec.ssrc = &mod->packet.buffer[8];
+
+    if(mod->fec.rows > 0)
+    {
+        mod->fec.column = (fec_packet_t *)calloc(mod->fec.columns, sizeof(fec_packet_t));
+        for(int i = 0; i < mod->fec.columns; ++i)
+        {
+            mod->fec.column[i].offset = mod->fec.columns;
+            mod->fec.column[i].na = mod->fec.rows;
+        }
+        mod->fec.sock_column = socket_open(mod, mod->port + FEC_COLUMN_PORT);
+    }
+
+    if(mod->fec.is_row)
+    {
+        mod->fec.row.is_row = true;
+        mod->fec.row.offset = 1;
+        mod->fec.row.na = mod->fec.columns;
+        mod->fec.sock_row = socket_open(mod, mod->port + FEC_ROW_PORT);
+    }
+}
+
+static bool destination_add(module_data_t *mod, const char *addr, int port)
+{
+    if(!asc_socket_add_destination(mod->sock, addr, port))
+    {
+        asc_log_error(MSG("failed to add destination %s:%d"), addr, port);
+        return false;
+    }
+
+    asc_log_debug(MSG("destination %s:%d added"), addr, port);
+    return true;
+}
+
+/* "addr[:port]" */
+static void destinations_init(module_data_t *mod)
+{
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "destinations");
+    if(lua_istable(lua, -1))
+    {
+        for(lua_pushnil(lua); lua_next(lua, -2); lua_pop(lua, 1))
+        {
+            asc_assert(lua_isstring(lua, -1)
+                       , MSG("destinations format: { \"addr:port\", ... }"));
+
+            char addr[64];
+            snprintf(addr, sizeof(addr), "%s", lua_tostring(lua, -1));
+
+            int port = mod->port;
+            char *const sep = strchr(addr, ':');
+            if(sep)
+            {
+                *sep = '\0';
+                port = atoi(sep + 1);
+            }
+
+            destination_add(mod, addr, port);
+        }
+    }
+    lua_pop(lua, 1);
+}
+
+static void output_metric_init(module_data_t *mod)
+{
+    module_stream_metric(mod, "astra_udp_output_send_errors_total", ASC_METRIC_COUNTER
+                         , "Failed datagram sends", &mod->send_errors);
+
+    if(mod->thread_input)
+    {
+        module_stream_metric(mod, "astra_udp_output_sync_overflows_total", ASC_METRIC_COUNTER
+                             , "Sync buffer overflows", &mod->sync_overflows);
+    }
+    if(mod->is_strip_null)
+    {
+        module_stream_metric(mod, "astra_udp_output_null_drops_total", ASC_METRIC_COUNTER
+                             , "Null packets dropped by strip_null", &mod->null_drops);
+    }
+}
+
 static void module_init(module_data_t *mod)
 {
     module_option_string("addr", &mod->addr, NULL);
@@ -349,6 +1004,11 @@ static void module_init(module_data_t *mod)
     mod->port = 1234;
     module_option_number("port", &mod->port);
 
+    int mtu = UDP_MTU_DEFAULT;
+    module_option_number("mtu", &mtu);
+    asc_assert(mtu >= UDP_MTU_MIN && mtu <= UDP_MTU_MAX, MSG("option 'mtu' out of range"));
+    mod->packet.size = mtu - UDP_HEADER_SIZE;
+
     module_option_boolean("rtp", &mod->is_rtp);
     if(mod->is_rtp)
     {
@@ -365,50 +1025,88 @@ static void module_init(module_data_t *mod)
         mod->packet.buffer[11] = (rtpssrc      ) & 0xFF;
     }
 
-    mod->sock = asc_socket_open_udp4(mod);
-    asc_socket_set_reuseaddr(mod->sock, 1);
-    if(!asc_socket_bind(mod->sock, NULL, 0))
-        astra_abort();
-
-    int value;
-    if(module_option_number("socket_size", &value))
-        asc_socket_set_buffer(mod->sock, 0, value);
-
-    const char *localaddr = NULL;
-    module_option_string("localaddr", &localaddr, NULL);
-    if(localaddr)
-        asc_socket_set_multicast_if(mod->sock, localaddr);
-
-    value = 32;
-    module_option_number("ttl", &value);
-    asc_socket_set_multicast_ttl(mod->sock, value);
+    mod->sock = socket_open(mod, mod->port);
+    destinations_init(mod);
 
-    asc_socket_multicast_join(mod->sock, mod->addr, NULL);
-    asc_socket_set_sockaddr(mod->sock, mod->addr, mod->port);
+    if(module_option_number("fec_columns", &mod->fec.columns) && mod->fec.columns > 0)
+        fec_init(mod);
 
-    value = 0;
+    int value = 0;
     module_option_number("sync", &value);
     if(value > 0)
     {
-        module_stream_init(mod, thread_input_push);
-
         mod->sync.buffer_size = value * 1024 * 1024;
         mod->sync.buffer_size -= mod->sync.buffer_size % TS_PACKET_SIZE;
-        mod->sync.buffer = (uint8_t *)malloc(mod->sync.buffer_size);
+        mod->sync.buffer = (uint8_t *)asc_ring_alloc(mod->sync.buffer_size, -1);
 
         value = 0;
         module_option_number("cbr", &value);
         if(value > 0)
             mod->cbr = (value * 1000 * 1000) / (8 * TS_PACKET_SIZE); // ts/s
 
+        module_option_boolean("pcr_restamp", &mod->restamp.is_enabled);
+
+        bool is_txtime = false;
+        module_option_boolean("txtime", &is_txtime);
+        if(is_txtime)
+        {
+            if(asc_socket_set_txtime(mod->sock))
+            {
+                mod->txtime.is_enabled = true;
+                module_stream_init(mod, txtime_push);
+                module_stream_set_batch(mod, txtime_push_batch);
+                output_metric_init(mod);
+                return;
+            }
+            asc_log_warning(MSG("kernel pacing is not available. use sync thread"));
+        }
+
+        module_stream_init(mod, thread_input_push);
+        module_stream_set_batch(mod, thread_input_push_batch);
+        module_stream_set_credit(mod, thread_input_credit);
+
         mod->thread = asc_thread_init(mod);
-        mod->thread_input = asc_thread_buffer_init(mod->sync.buffer_size * 2);
+        asc_thread_set_name(mod->thread, "udp_output");
+        module_option_thread(mod->thread);
+        mod->thread_input = asc_thread_buffer_init_numa(mod->sync.buffer_size * 2
+                                                        , asc_thread_numa_node(mod->thread));
         asc_thread_start(mod->thread, thread_loop, NULL, NULL, on_thread_close);
     }
     else
     {
-        module_stream_init(mod, on_ts);
+        mod->batch.size = 1;
+        module_option_number("batch", &mod->batch.size);
+        if(mod->batch.size > UDP_BATCH_MAX)
+            mod->batch.size = UDP_BATCH_MAX;
+
+        if(mod->batch.size > 1)
+        {
+            mod->batch.latency = 10;
+            module_option_number("batch_latency", &mod->batch.latency);
+            if(mod->batch.latency < 1)
+                mod->batch.latency = 1;
+
+            mod->batch.buffer = (uint8_t *)malloc(mod->batch.size * mod->packet.size);
+            for(int i = 0; i < mod->batch.size; ++i)
+                mod->batch.iov[i].iov_base = &mod->batch.buffer[i * mod->packet.size];
+        }
+
+        module_option_boolean("strip_null", &mod->is_strip_null);
+        if(mod->is_strip_null)
+        {
+            module_stream_init(mod, strip_on_ts);
+            module_stream_set_batch(mod, strip_on_ts_batch);
+            module_stream_set_block(mod, strip_on_ts_block);
+        }
+        else
+        {
+            module_stream_init(mod, on_ts);
+            module_stream_set_batch(mod, on_ts_batch);
+            module_stream_set_block(mod, on_ts_block);
+        }
     }
+
+    output_metric_init(mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -420,20 +1118,52 @@ static void module_destroy(module_data_t *mod)
 
     if(mod->sync.buffer)
     {
-        free(mod->sync.buffer);
+        asc_ring_free(mod->sync.buffer, mod->sync.buffer_size);
         mod->sync.buffer = NULL;
     }
 
+    if(mod->batch.buffer)
+    {
+        batch_flush(mod);
+        free(mod->batch.buffer);
+        mod->batch.buffer = NULL;
+    }
+
     if(mod->sock)
     {
         asc_socket_close(mod->sock);
         mod->sock = NULL;
     }
+
+    ASC_FREE(mod->fec.sock_column, asc_socket_close);
+    ASC_FREE(mod->fec.sock_row, asc_socket_close);
+    ASC_FREE(mod->fec.column, free);
+}
+
+static int method_add_destination(module_data_t *mod)
+{
+    const char *addr = luaL_checkstring(lua, 2);
+    const int port = luaL_optinteger(lua, 3, mod->port);
+    lua_pushboolean(lua, destination_add(mod, addr, port));
+    return 1;
+}
+
+static int method_remove_destination(module_data_t *mod)
+{
+    const char *addr = luaL_checkstring(lua, 2);
+    const int port = luaL_optinteger(lua, 3, mod->port);
+    const bool is_removed = asc_socket_remove_destination(mod->sock, addr, port);
+    if(is_removed)
+        asc_log_debug(MSG("destination %s:%d removed"), addr, port);
+    lua_pushboolean(lua, is_removed);
+    return 1;
 }
 
 MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_STREAM_METHODS_REF()
+    MODULE_STREAM_METHODS_REF(),
+    { "add_destination", method_add_destination },
+    { "remove_destination", method_remove_destination },
 };
 MODULE_LUA_REGISTER(udp_output)
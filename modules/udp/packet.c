@@ -0,0 +1,340 @@
+/*
+ * Astra Module: UDP Packet Ring
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * TPACKET_V3 ring is mapped to the user space, the kernel fills blocks of
+ * datagrams and the main loop reads all datagrams of the block at once.
+ * Socket filter passes only not fragmented IPv4 UDP to the ring.
+ * Multicast membership is still made with the regular socket for each
+ * udp_input, but that socket is bound to other port and receives nothing.
+ */
+
+#include "packet.h"
+
+#ifdef HAVE_PACKET_MMAP
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#define MSG(_msg) "[udp_input packet %s] " _msg, (ring->ifname) ? ring->ifname : "any"
+
+#define PACKET_BLOCK_SIZE (1 << 20)
+#define PACKET_FRAME_SIZE 2048
+#define PACKET_BLOCK_TIMEOUT 2 // ms, block is passed to the user space if not filled
+#define PACKET_HASH_SIZE 1024
+
+typedef struct packet_ring_t packet_ring_t;
+
+struct udp_packet_sub_t
+{
+    packet_ring_t *ring;
+    uint32_t addr; // network order
+    uint16_t port;
+
+    udp_packet_callback_t callback;
+    void *arg;
+
+    udp_packet_sub_t *next;
+};
+
+struct packet_ring_t
+{
+    char *ifname;
+    int refcount;
+
+    int fd;
+    asc_event_t *event;
+
+    uint8_t *map;
+    size_t map_size;
+    uint32_t block_count;
+    uint32_t block_next;
+
+    udp_packet_sub_t *hash[PACKET_HASH_SIZE];
+};
+
+static asc_list_t *ring_list = NULL;
+
+static inline uint32_t packet_hash(uint32_t addr, uint16_t port)
+{
+    const uint32_t hash = addr ^ (addr >> 16) ^ ((uint32_t)port * 0x9E37);
+    return (hash ^ (hash >> 10)) & (PACKET_HASH_SIZE - 1);
+}
+
+static void packet_process(packet_ring_t *ring, const struct tpacket3_hdr *hdr)
+{
+    const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+        ((const uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if(sll->sll_pkttype == PACKET_OUTGOING)
+        return;
+
+    if(hdr->tp_net < hdr->tp_mac || (uint32_t)(hdr->tp_net - hdr->tp_mac) > hdr->tp_snaplen)
+        return;
+
+    const uint8_t *ip = (const uint8_t *)hdr + hdr->tp_net;
+    const size_t size = hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac);
+    if(size < 20 || (ip[0] >> 4) != 4)
+        return;
+
+    const size_t ip_size = (ip[0] & 0x0F) * 4;
+    const size_t total = (ip[2] << 8) | ip[3];
+    if(ip_size < 20 || total > size || total < ip_size + 8)
+        return;
+
+    const uint8_t *udp = &ip[ip_size];
+    const size_t udp_size = (udp[4] << 8) | udp[5];
+    if(udp_size < 8 || udp_size > total - ip_size)
+        return;
+
+    uint32_t addr;
+    memcpy(&addr, &ip[16], sizeof(addr));
+    const uint16_t port = (udp[2] << 8) | udp[3];
+
+    udp_packet_sub_t *sub = ring->hash[packet_hash(addr, port)];
+    while(sub)
+    {
+        udp_packet_sub_t *next = sub->next;
+        if(sub->addr == addr && sub->port == port)
+            sub->callback(sub->arg, &udp[8], udp_size - 8);
+        sub = next;
+    }
+}
+
+static void on_packet_read(void *arg)
+{
+    packet_ring_t *ring = (packet_ring_t *)arg;
+
+    /* not more than one pass over the ring */
+    for(uint32_t n = 0; n < ring->block_count; ++n)
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)
+            &ring->map[(size_t)ring->block_next * PACKET_BLOCK_SIZE];
+
+        if(!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            break;
+
+        const uint32_t count = block->hdr.bh1.num_pkts;
+        const struct tpacket3_hdr *hdr = (const struct tpacket3_hdr *)
+            ((const uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            packet_process(ring, hdr);
+            hdr = (const struct tpacket3_hdr *)((const uint8_t *)hdr + hdr->tp_next_offset);
+        }
+
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->block_next = (ring->block_next + 1) % ring->block_count;
+    }
+}
+
+static void on_packet_error(void *arg)
+{
+    packet_ring_t *ring = (packet_ring_t *)arg;
+    asc_log_error(MSG("socket error [%s]"), asc_socket_error());
+}
+
+static void ring_close(packet_ring_t *ring)
+{
+    ASC_FREE(ring->event, asc_event_close);
+    if(ring->map)
+        munmap(ring->map, ring->map_size);
+    if(ring->fd != -1)
+        close(ring->fd);
+    ASC_FREE(ring->ifname, free);
+    free(ring);
+}
+
+static packet_ring_t * ring_open(const char *ifname, int ring_size)
+{
+    packet_ring_t *ring = (packet_ring_t *)calloc(1, sizeof(packet_ring_t));
+    ring->ifname = (ifname) ? strdup(ifname) : NULL;
+
+    int ifindex = 0;
+    if(ifname)
+    {
+        ifindex = if_nametoindex(ifname);
+        if(ifindex == 0)
+        {
+            asc_log_error(MSG("interface is not found"));
+            ring->fd = -1;
+            ring_close(ring);
+            return NULL;
+        }
+    }
+
+    ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if(ring->fd == -1)
+    {
+        asc_log_error(MSG("failed to open socket [%s]"), strerror(errno));
+        ring_close(ring);
+        return NULL;
+    }
+
+    /* IPv4, UDP, not fragmented */
+    static struct sock_filter filter_code[] =
+    {
+        { 0x28, 0, 0, 0x0000000C }, // ldh [12]
+        { 0x15, 0, 5, 0x00000800 }, // jeq #0x800, next, drop
+        { 0x30, 0, 0, 0x00000017 }, // ldb [23]
+        { 0x15, 0, 3, 0x00000011 }, // jeq #17, next, drop
+        { 0x28, 0, 0, 0x00000014 }, // ldh [20]
+        { 0x45, 1, 0, 0x00003FFF }, // jset #0x3fff, drop, next
+        { 0x06, 0, 0, 0x0000FFFF }, // ret #65535
+        { 0x06, 0, 0, 0x00000000 }, // ret #0
+    };
+    struct sock_fprog filter =
+    {
+        .len = sizeof(filter_code) / sizeof(filter_code[0]),
+        .filter = filter_code,
+    };
+    if(setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1)
+        asc_log_warning(MSG("failed to attach filter [%s]"), strerror(errno));
+
+    int version = TPACKET_V3;
+    if(setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        asc_log_error(MSG("TPACKET_V3 is not supported [%s]"), strerror(errno));
+        ring_close(ring);
+        return NULL;
+    }
+
+    ring->block_count = (ring_size > 0) ? (uint32_t)ring_size : 32;
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_BLOCK_SIZE;
+    req.tp_block_nr = ring->block_count;
+    req.tp_frame_size = PACKET_FRAME_SIZE;
+    req.tp_frame_nr = (PACKET_BLOCK_SIZE / PACKET_FRAME_SIZE) * ring->block_count;
+    req.tp_retire_blk_tov = PACKET_BLOCK_TIMEOUT;
+    if(setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    {
+        asc_log_error(MSG("failed to set ring [%s]"), strerror(errno));
+        ring_close(ring);
+        return NULL;
+    }
+
+    ring->map_size = (size_t)PACKET_BLOCK_SIZE * ring->block_count;
+    ring->map = (uint8_t *)mmap(  NULL, ring->map_size, PROT_READ | PROT_WRITE
+                                , MAP_SHARED, ring->fd, 0);
+    if(ring->map == MAP_FAILED)
+    {
+        asc_log_error(MSG("failed to map ring [%s]"), strerror(errno));
+        ring->map = NULL;
+        ring_close(ring);
+        return NULL;
+    }
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = ifindex;
+    if(bind(ring->fd, (struct sockaddr *)&sll, sizeof(sll)) == -1)
+    {
+        asc_log_error(MSG("failed to bind [%s]"), strerror(errno));
+        ring_close(ring);
+        return NULL;
+    }
+
+    ring->event = asc_event_init(ring->fd, ring);
+    asc_event_set_priority(ring->event, ASC_EVENT_INPUT);
+    asc_event_set_on_read(ring->event, on_packet_read);
+    asc_event_set_on_error(ring->event, on_packet_error);
+
+    asc_log_info(MSG("ring %uMB"), ring->block_count * (PACKET_BLOCK_SIZE >> 20));
+
+    return ring;
+}
+
+static packet_ring_t * ring_find(const char *ifname)
+{
+    asc_list_for(ring_list)
+    {
+        packet_ring_t *ring = (packet_ring_t *)asc_list_data(ring_list);
+        if(ifname && ring->ifname && !strcmp(ifname, ring->ifname))
+            return ring;
+        if(!ifname && !ring->ifname)
+            return ring;
+    }
+    return NULL;
+}
+
+udp_packet_sub_t * udp_packet_subscribe(  const char *ifname, const char *addr, int port
+                                        , int ring_size
+                                        , udp_packet_callback_t callback, void *arg)
+{
+    if(!ring_list)
+        ring_list = asc_list_init();
+
+    packet_ring_t *ring = ring_find(ifname);
+    if(!ring)
+    {
+        ring = ring_open(ifname, ring_size);
+        if(!ring)
+            return NULL;
+        asc_list_insert_tail(ring_list, ring);
+    }
+    ++ring->refcount;
+
+    udp_packet_sub_t *sub = (udp_packet_sub_t *)calloc(1, sizeof(udp_packet_sub_t));
+    sub->ring = ring;
+    sub->addr = inet_addr(addr);
+    sub->port = (uint16_t)port;
+    sub->callback = callback;
+    sub->arg = arg;
+
+    udp_packet_sub_t **head = &ring->hash[packet_hash(sub->addr, sub->port)];
+    sub->next = *head;
+    *head = sub;
+
+    return sub;
+}
+
+void udp_packet_unsubscribe(udp_packet_sub_t *sub)
+{
+    packet_ring_t *ring = sub->ring;
+
+    udp_packet_sub_t **item = &ring->hash[packet_hash(sub->addr, sub->port)];
+    while(*item && *item != sub)
+        item = &(*item)->next;
+    if(*item)
+        *item = sub->next;
+    free(sub);
+
+    --ring->refcount;
+    if(ring->refcount > 0)
+        return;
+
+    asc_list_remove_item(ring_list, ring);
+    ring_close(ring);
+
+    if(asc_list_size(ring_list) == 0)
+        ASC_FREE(ring_list, asc_list_destroy);
+}
+
+#endif /* HAVE_PACKET_MMAP */
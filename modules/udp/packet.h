@@ -0,0 +1,44 @@
+/*
+ * Astra Module: UDP Packet Ring
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_PACKET_H_
+#define _UDP_PACKET_H_ 1
+
+#include <astra.h>
+
+/*
+ * Shared receive ring (PACKET_RX_RING) for the udp_input instances.
+ * One AF_PACKET socket is opened per interface, datagrams are passed
+ * to the subscriber by the destination address and port.
+ */
+
+typedef struct udp_packet_sub_t udp_packet_sub_t;
+typedef void (*udp_packet_callback_t)(void *, const uint8_t *, size_t);
+
+#ifdef HAVE_PACKET_MMAP
+
+udp_packet_sub_t * udp_packet_subscribe(  const char *ifname, const char *addr, int port
+                                        , int ring_size
+                                        , udp_packet_callback_t callback, void *arg);
+void udp_packet_unsubscribe(udp_packet_sub_t *sub);
+
+#endif /* HAVE_PACKET_MMAP */
+
+#endif /* _UDP_PACKET_H_ */
@@ -0,0 +1,685 @@
+/*
+ * Astra Module: Pcap Input
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      pcap_input
+ *
+ * Module Options:
+ *      filename    - string, pcap or pcapng capture, or raw TS file
+ *      addr        - string, destination address of the datagrams in the capture,
+ *                            default: any
+ *      port        - number, destination port of the datagrams, default: any
+ *      rtp         - boolean, datagrams have the RTP header
+ *      speed       - number, replay speed: 1 - original timing, N - N times faster,
+ *                            0 - as fast as possible. default: 1
+ *      loop        - boolean, replay the file in an infinite loop
+ *      callback    - function, called on the end of the file, without parameters
+ *
+ * Module Methods:
+ *      stat()      - return table: datagrams, bytes - sent, skipped - frames of
+ *                            the capture not matched or not IPv4 UDP, loops
+ *
+ * Replays the captured traffic into the stream graph. Datagrams are sent
+ * as the blocks in the same way as udp_input does. Timing of the capture is
+ * taken from the record time. Timing of the raw TS file is taken from the PCR
+ * of the first PCR PID, the file is sent by 7 packets. IPv4 fragments
+ * are not reassembled and skipped.
+ */
+
+#include <astra.h>
+
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#define MSG(_msg) "[pcap_input %s] " _msg, mod->config.filename
+
+#define RTP_HEADER_SIZE 12
+
+#define PCAP_TICK 1000 // us
+#define PCAP_TICK_LIMIT 4096 // datagrams per tick
+#define PCAP_IF_MAX 16 // pcapng interfaces
+
+#define PCAP_MAGIC 0xA1B2C3D4
+#define PCAP_MAGIC_NS 0xA1B23C4D
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_BOM 0x1A2B3C4D
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+
+typedef enum
+{
+    PCAP_FORMAT_PCAP = 0,
+    PCAP_FORMAT_PCAPNG,
+    PCAP_FORMAT_TS,
+} pcap_format_t;
+
+typedef struct
+{
+    uint32_t linktype;
+    uint8_t tsresol; // if_tsresol option
+} pcap_if_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *filename;
+        uint32_t addr; // network order, 0 - any
+        int port;
+        bool rtp;
+        double speed;
+        bool loop;
+    } config;
+
+    int idx_callback;
+
+    int fd;
+    uint8_t *map;
+    size_t size;
+    size_t skip; // read position
+    size_t data_skip; // first record
+
+    pcap_format_t format;
+    bool is_swap;
+    bool is_nsec;
+    uint32_t linktype;
+
+    pcap_if_t interface[PCAP_IF_MAX];
+    int interface_count;
+
+    // TS file timing
+    uint16_t pcr_pid;
+    uint64_t pcr_first;
+    uint64_t pcr_time;
+
+    // next datagram
+    bool is_pending;
+    const uint8_t *payload;
+    size_t payload_size;
+    uint64_t time; // us, capture clock
+
+    bool is_started;
+    uint64_t start_time; // loop clock of the first datagram
+    uint64_t first_time; // capture clock of the first datagram
+
+    asc_timer_t *timer;
+
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t skipped;
+    uint64_t loops;
+};
+
+/*
+ * oooooooooo   oooooooo8      o      oooooooooo
+ *  888    888 o888     88     888      888    888
+ *  888oooo88  888            8  88     888oooo88
+ *  888        888o     oo   8oooo88    888
+ * o888o        888oooo88  o88o  o888o o888o
+ *
+ */
+
+static inline uint16_t rd16(module_data_t *mod, const uint8_t *p)
+{
+    return (mod->is_swap) ? ((p[0] << 8) | p[1]) : ((p[1] << 8) | p[0]);
+}
+
+static inline uint32_t rd32(module_data_t *mod, const uint8_t *p)
+{
+    return (mod->is_swap)
+         ? (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3])
+         : (((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0]);
+}
+
+/* file is read as little endian, is_swap is set for the big endian file */
+static bool pcap_check_magic(module_data_t *mod, uint32_t magic, uint32_t value)
+{
+    mod->is_swap = false;
+    if(rd32(mod, (const uint8_t *)&value) == magic)
+        return true;
+    mod->is_swap = true;
+    return (rd32(mod, (const uint8_t *)&value) == magic);
+}
+
+/* IPv4 UDP datagram of the link layer frame. false if not matched */
+static bool pcap_frame(  module_data_t *mod, uint32_t linktype
+                       , const uint8_t *frame, size_t size)
+{
+    size_t skip = 0;
+    uint16_t proto = 0x0800;
+
+    switch(linktype)
+    {
+        case LINKTYPE_ETHERNET:
+            if(size < 14)
+                return false;
+            skip = 12;
+            proto = (frame[skip] << 8) | frame[skip + 1];
+            /* 802.1Q and 802.1ad tags */
+            while((proto == 0x8100 || proto == 0x88A8) && skip + 6 <= size)
+            {
+                skip += 4;
+                proto = (frame[skip] << 8) | frame[skip + 1];
+            }
+            skip += 2;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if(size < 16)
+                return false;
+            proto = (frame[14] << 8) | frame[15];
+            skip = 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if(size < 20)
+                return false;
+            proto = (frame[0] << 8) | frame[1];
+            skip = 20;
+            break;
+        case LINKTYPE_NULL:
+        case LINKTYPE_LOOP:
+        {
+            if(size < 4)
+                return false;
+            /* AF_INET in the host order of the capturing machine */
+            const uint32_t family = frame[0] | frame[1] | frame[2] | frame[3];
+            if(family != 2)
+                return false;
+            skip = 4;
+            break;
+        }
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+            break;
+        default:
+            return false;
+    }
+
+    if(proto != 0x0800 || skip > size)
+        return false;
+
+    const uint8_t *ip = &frame[skip];
+    size -= skip;
+    if(size < 20 || (ip[0] >> 4) != 4 || ip[9] != 17)
+        return false;
+
+    const size_t ip_size = (ip[0] & 0x0F) * 4;
+    const size_t total = (ip[2] << 8) | ip[3];
+    if(ip_size < 20 || total > size || total < ip_size + 8)
+        return false;
+
+    /* more fragments flag or the fragment offset */
+    if(((ip[6] << 8) | ip[7]) & 0x3FFF)
+        return false;
+
+    const uint8_t *udp = &ip[ip_size];
+    const size_t udp_size = (udp[4] << 8) | udp[5];
+    if(udp_size < 8 || udp_size > total - ip_size)
+        return false;
+
+    if(mod->config.addr && memcmp(&ip[16], &mod->config.addr, 4) != 0)
+        return false;
+    if(mod->config.port && ((udp[2] << 8) | udp[3]) != mod->config.port)
+        return false;
+
+    mod->payload = &udp[8];
+    mod->payload_size = udp_size - 8;
+    return true;
+}
+
+/* record time of the pcapng interface in microseconds */
+static uint64_t pcapng_time(const pcap_if_t *interface, uint64_t value)
+{
+    const uint8_t resol = interface->tsresol & 0x7F;
+    if(interface->tsresol & 0x80)
+    {
+        /* power of 2 */
+        const uint64_t mask = (1ULL << resol) - 1;
+        return (value >> resol) * 1000000 + (((value & mask) * 1000000) >> resol);
+    }
+
+    uint64_t div = 1;
+    for(uint8_t i = 6; i < resol; ++i)
+        div *= 10;
+    uint64_t mul = 1;
+    for(uint8_t i = resol; i < 6; ++i)
+        mul *= 10;
+    return value / div * mul;
+}
+
+static void pcapng_interface(module_data_t *mod, const uint8_t *body, size_t size)
+{
+    if(size < 8 || mod->interface_count >= PCAP_IF_MAX)
+        return;
+
+    pcap_if_t *interface = &mod->interface[mod->interface_count++];
+    interface->linktype = rd16(mod, body);
+    interface->tsresol = 6;
+
+    size_t skip = 8;
+    while(skip + 4 <= size)
+    {
+        const uint16_t code = rd16(mod, &body[skip]);
+        const uint16_t length = rd16(mod, &body[skip + 2]);
+        skip += 4;
+        if(code == 0 || skip + length > size)
+            break;
+        if(code == 9 && length >= 1)
+            interface->tsresol = body[skip];
+        skip += (length + 3) & ~3;
+    }
+}
+
+static bool pcap_next_pcap(module_data_t *mod)
+{
+    while(mod->skip + 16 <= mod->size)
+    {
+        const uint8_t *record = &mod->map[mod->skip];
+        const uint32_t sec = rd32(mod, &record[0]);
+        const uint32_t frac = rd32(mod, &record[4]);
+        const uint32_t length = rd32(mod, &record[8]);
+        if(length > mod->size - mod->skip - 16)
+            break;
+        mod->skip += 16 + length;
+
+        mod->time = (uint64_t)sec * 1000000 + ((mod->is_nsec) ? frac / 1000 : frac);
+        if(pcap_frame(mod, mod->linktype, &record[16], length))
+            return true;
+        ++mod->skipped;
+    }
+    return false;
+}
+
+static bool pcap_next_pcapng(module_data_t *mod)
+{
+    while(mod->skip + 12 <= mod->size)
+    {
+        const uint8_t *block = &mod->map[mod->skip];
+        const uint32_t type = rd32(mod, &block[0]);
+
+        if(type == PCAPNG_SHB)
+        {
+            /* new section, may have other byte order */
+            uint32_t bom;
+            memcpy(&bom, &block[8], sizeof(bom));
+            if(!pcap_check_magic(mod, PCAPNG_BOM, bom))
+                break;
+            mod->interface_count = 0;
+        }
+
+        const uint32_t length = rd32(mod, &block[4]);
+        if(length < 12 || (length & 3) || length > mod->size - mod->skip)
+            break;
+        mod->skip += length;
+
+        const uint8_t *body = &block[8];
+        const size_t body_size = length - 12;
+
+        if(type == 1)
+        {
+            pcapng_interface(mod, body, body_size);
+        }
+        else if(type == 6 && body_size >= 20)
+        {
+            /* enhanced packet block */
+            const uint32_t id = rd32(mod, &body[0]);
+            const uint64_t ts = ((uint64_t)rd32(mod, &body[4]) << 32) | rd32(mod, &body[8]);
+            const uint32_t caplen = rd32(mod, &body[12]);
+            if(id >= (uint32_t)mod->interface_count || caplen > body_size - 20)
+            {
+                ++mod->skipped;
+                continue;
+            }
+
+            const pcap_if_t *interface = &mod->interface[id];
+            mod->time = pcapng_time(interface, ts);
+            if(pcap_frame(mod, interface->linktype, &body[20], caplen))
+                return true;
+            ++mod->skipped;
+        }
+        else if(type == 3 && body_size >= 4 && mod->interface_count > 0)
+        {
+            /* simple packet block, without the time */
+            uint32_t caplen = rd32(mod, &body[0]);
+            if(caplen > body_size - 4)
+                caplen = body_size - 4;
+            if(pcap_frame(mod, mod->interface[0].linktype, &body[4], caplen))
+                return true;
+            ++mod->skipped;
+        }
+    }
+    return false;
+}
+
+/* 7 packets, timed by the last PCR of the first PCR PID */
+static bool pcap_next_ts(module_data_t *mod)
+{
+    if(mod->skip + TS_PACKET_SIZE > mod->size)
+        return false;
+
+    size_t count = (mod->size - mod->skip) / TS_PACKET_SIZE;
+    if(count > STREAM_BLOCK_COUNT)
+        count = STREAM_BLOCK_COUNT;
+
+    mod->payload = &mod->map[mod->skip];
+    mod->payload_size = count * TS_PACKET_SIZE;
+    mod->skip += mod->payload_size;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *ts = &mod->payload[i * TS_PACKET_SIZE];
+        if(!TS_IS_PCR(ts))
+            continue;
+
+        const uint16_t pid = TS_GET_PID(ts);
+        if(mod->pcr_pid == NULL_TS_PID)
+        {
+            mod->pcr_pid = pid;
+            mod->pcr_first = TS_GET_PCR(ts);
+        }
+        if(pid != mod->pcr_pid)
+            continue;
+
+        const uint64_t pcr = TS_GET_PCR(ts);
+        /* PCR wrap or discontinuity */
+        if(pcr < mod->pcr_first)
+            mod->pcr_first = pcr - mod->pcr_time * 27;
+        mod->pcr_time = (pcr - mod->pcr_first) / 27;
+        break;
+    }
+
+    mod->time = mod->pcr_time;
+    return true;
+}
+
+static bool pcap_next(module_data_t *mod)
+{
+    switch(mod->format)
+    {
+        case PCAP_FORMAT_PCAP:
+            return pcap_next_pcap(mod);
+        case PCAP_FORMAT_PCAPNG:
+            return pcap_next_pcapng(mod);
+        case PCAP_FORMAT_TS:
+            return pcap_next_ts(mod);
+    }
+    return false;
+}
+
+static bool pcap_open(module_data_t *mod)
+{
+    mod->fd = open(mod->config.filename, O_RDONLY);
+    if(mod->fd == -1)
+    {
+        asc_log_error(MSG("failed to open file [%s]"), strerror(errno));
+        mod->fd = 0;
+        return false;
+    }
+
+    struct stat sb;
+    if(fstat(mod->fd, &sb) != 0 || sb.st_size < 24)
+    {
+        asc_log_error(MSG("file is empty or not readable"));
+        return false;
+    }
+    mod->size = sb.st_size;
+
+    void *map = mmap(NULL, mod->size, PROT_READ, MAP_SHARED, mod->fd, 0);
+    if(map == MAP_FAILED)
+    {
+        asc_log_error(MSG("mmap() failed [%s]"), strerror(errno));
+        return false;
+    }
+    mod->map = (uint8_t *)map;
+#ifdef MADV_SEQUENTIAL
+    madvise(mod->map, mod->size, MADV_SEQUENTIAL);
+#endif
+
+    uint32_t magic;
+    memcpy(&magic, mod->map, sizeof(magic));
+
+    if(pcap_check_magic(mod, PCAP_MAGIC, magic) || pcap_check_magic(mod, PCAP_MAGIC_NS, magic))
+    {
+        mod->format = PCAP_FORMAT_PCAP;
+        mod->is_nsec = (rd32(mod, mod->map) == PCAP_MAGIC_NS);
+        mod->linktype = rd32(mod, &mod->map[20]) & 0xFFFF;
+        mod->data_skip = 24;
+    }
+    else if(magic == PCAPNG_SHB)
+    {
+        mod->format = PCAP_FORMAT_PCAPNG;
+        mod->data_skip = 0;
+    }
+    else if(TS_IS_SYNC(mod->map) && (mod->size < TS_PACKET_SIZE + 1
+                                     || mod->map[TS_PACKET_SIZE] == 0x47))
+    {
+        mod->format = PCAP_FORMAT_TS;
+        mod->data_skip = 0;
+        mod->pcr_pid = NULL_TS_PID;
+    }
+    else
+    {
+        asc_log_error(MSG("unknown file format"));
+        return false;
+    }
+
+    mod->skip = mod->data_skip;
+    return true;
+}
+
+static void pcap_close(module_data_t *mod)
+{
+    if(mod->map)
+    {
+        munmap(mod->map, mod->size);
+        mod->map = NULL;
+    }
+    if(mod->fd > 0)
+    {
+        close(mod->fd);
+        mod->fd = 0;
+    }
+}
+
+/* datagram to the stream, as udp_input on_datagram() */
+static void pcap_send(module_data_t *mod)
+{
+    const uint8_t *buffer = mod->payload;
+    size_t size = mod->payload_size;
+
+    if(mod->config.rtp)
+    {
+        if(size < RTP_HEADER_SIZE)
+            return;
+        size_t skip = RTP_HEADER_SIZE + (buffer[0] & 0x0F) * 4;
+        if(buffer[0] & 0x10)
+        {
+            if(size < skip + 4)
+                return;
+            skip += ((buffer[skip + 2] << 8) | buffer[skip + 3]) * 4 + 4;
+        }
+        if(skip > size)
+            return;
+        buffer += skip;
+        size -= skip;
+    }
+
+    size_t count = size / TS_PACKET_SIZE;
+    if(count == 0)
+        return;
+    if(count > STREAM_BLOCK_COUNT)
+        count = STREAM_BLOCK_COUNT;
+
+    module_stream_block_t *block = module_stream_block_alloc();
+    memcpy(block->buffer, buffer, count * TS_PACKET_SIZE);
+    block->ts = block->buffer;
+    block->count = count;
+    module_stream_send_block(mod, block);
+    module_stream_block_unref(block);
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_utime();
+
+    for(int i = 0; i < PCAP_TICK_LIMIT; ++i)
+    {
+        if(!mod->is_pending)
+        {
+            if(!pcap_next(mod))
+            {
+                if(mod->datagrams == 0)
+                {
+                    asc_log_error(MSG("no datagrams in the file"));
+                    ASC_FREE(mod->timer, asc_timer_destroy);
+                    return;
+                }
+
+                if(mod->config.loop)
+                {
+                    ++mod->loops;
+                    mod->skip = mod->data_skip;
+                    mod->is_started = false;
+                    mod->pcr_pid = NULL_TS_PID;
+                    mod->pcr_time = 0;
+                    continue;
+                }
+
+                asc_log_info(MSG("end of file"));
+                ASC_FREE(mod->timer, asc_timer_destroy);
+                if(mod->idx_callback)
+                {
+                    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+                    lua_call(lua, 0, 0);
+                }
+                return;
+            }
+            mod->is_pending = true;
+        }
+
+        if(!mod->is_started)
+        {
+            mod->is_started = true;
+            mod->start_time = now;
+            mod->first_time = mod->time;
+        }
+
+        if(mod->config.speed > 0.0 && mod->time > mod->first_time)
+        {
+            const uint64_t offset = (uint64_t)((mod->time - mod->first_time)
+                                               / mod->config.speed);
+            if(mod->start_time + offset > now)
+                break;
+        }
+
+        mod->is_pending = false;
+        ++mod->datagrams;
+        mod->bytes += mod->payload_size;
+        pcap_send(mod);
+    }
+}
+
+/* methods */
+
+static int method_stat(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, mod->datagrams);
+    lua_setfield(lua, -2, "datagrams");
+    lua_pushnumber(lua, mod->bytes);
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, mod->skipped);
+    lua_setfield(lua, -2, "skipped");
+    lua_pushnumber(lua, mod->loops);
+    lua_setfield(lua, -2, "loops");
+    return 1;
+}
+
+/* required */
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("filename", &mod->config.filename, NULL);
+    asc_assert(mod->config.filename != NULL, "[pcap_input] option 'filename' is required");
+
+    const char *addr = NULL;
+    if(module_option_string("addr", &addr, NULL))
+        mod->config.addr = inet_addr(addr);
+    module_option_number("port", &mod->config.port);
+    module_option_boolean("rtp", &mod->config.rtp);
+    module_option_boolean("loop", &mod->config.loop);
+
+    mod->config.speed = 1.0;
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "speed");
+    if(lua_isnumber(lua, -1))
+        mod->config.speed = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+    if(mod->config.speed < 0.0)
+        mod->config.speed = 0.0;
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "callback");
+    if(lua_type(lua, -1) == LUA_TFUNCTION)
+        mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
+
+    module_stream_init(mod, NULL);
+
+    if(!pcap_open(mod))
+    {
+        pcap_close(mod);
+        return;
+    }
+
+    mod->timer = asc_timer_init_us(PCAP_TICK, on_timer, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    ASC_FREE(mod->timer, asc_timer_destroy);
+    pcap_close(mod);
+
+    if(mod->idx_callback)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
+        mod->idx_callback = 0;
+    }
+
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stat", method_stat },
+};
+MODULE_LUA_REGISTER(pcap_input)
@@ -0,0 +1,169 @@
+/*
+ * Astra Module: UDP TS Resynchronization
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resync.h"
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+#define TS_SYNC 0x47
+
+/*
+ * Searches the offset of three sync bytes at the stride of 188 or 204 bytes.
+ * On failure the offset is the beginning of the tail to keep
+ */
+static bool resync_find(const uint8_t *buffer, size_t size, size_t *offset, size_t *stride)
+{
+    size_t skip = 0;
+
+#ifdef __SSE2__
+    /* 16 candidate offsets for both strides at once */
+    const __m128i sync = _mm_set1_epi8(TS_SYNC);
+    for(; skip + 2 * UDP_RESYNC_RS_PACKET_SIZE + 16 <= size; skip += 16)
+    {
+        const uint8_t *const ptr = &buffer[skip];
+        const __m128i s0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)ptr), sync);
+        if(!_mm_movemask_epi8(s0))
+            continue;
+
+        const __m128i a1 = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[TS_PACKET_SIZE]), sync);
+        const __m128i a2 = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[2 * TS_PACKET_SIZE]), sync);
+        const __m128i b1 = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[UDP_RESYNC_RS_PACKET_SIZE]), sync);
+        const __m128i b2 = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[2 * UDP_RESYNC_RS_PACKET_SIZE]), sync);
+
+        const int mask_a = _mm_movemask_epi8(_mm_and_si128(s0, _mm_and_si128(a1, a2)));
+        const int mask_b = _mm_movemask_epi8(_mm_and_si128(s0, _mm_and_si128(b1, b2)));
+        const int mask = mask_a | mask_b;
+        if(mask)
+        {
+            const int bit = __builtin_ctz(mask);
+            *offset = skip + bit;
+            *stride = ((mask_a >> bit) & 1) ? TS_PACKET_SIZE : UDP_RESYNC_RS_PACKET_SIZE;
+            return true;
+        }
+    }
+#endif
+
+    for(; skip + 2 * TS_PACKET_SIZE < size; ++skip)
+    {
+        if(buffer[skip] != TS_SYNC)
+            continue;
+
+        if(   buffer[skip + TS_PACKET_SIZE] == TS_SYNC
+           && buffer[skip + 2 * TS_PACKET_SIZE] == TS_SYNC)
+        {
+            *offset = skip;
+            *stride = TS_PACKET_SIZE;
+            return true;
+        }
+
+        if(   skip + 2 * UDP_RESYNC_RS_PACKET_SIZE < size
+           && buffer[skip + UDP_RESYNC_RS_PACKET_SIZE] == TS_SYNC
+           && buffer[skip + 2 * UDP_RESYNC_RS_PACKET_SIZE] == TS_SYNC)
+        {
+            *offset = skip;
+            *stride = UDP_RESYNC_RS_PACKET_SIZE;
+            return true;
+        }
+    }
+
+    *offset = (size > UDP_RESYNC_TAIL_SIZE) ? size - UDP_RESYNC_TAIL_SIZE : 0;
+    return false;
+}
+
+size_t udp_resync_push(udp_resync_t *resync, const uint8_t *payload, size_t size
+                       , const uint8_t **ts)
+{
+    uint8_t *const buffer = resync->buffer;
+
+    if(resync->skip > 0)
+    {
+        memmove(buffer, &buffer[resync->skip], resync->size);
+        resync->skip = 0;
+    }
+
+    if(size > STREAM_BLOCK_SIZE)
+    {
+        resync->dropped += size;
+        size = 0;
+    }
+    memcpy(&buffer[resync->size], payload, size);
+    size += resync->size;
+
+    size_t skip = 0;
+    size_t count = 0;
+
+    while(true)
+    {
+        if(!resync->stride)
+        {
+            size_t offset;
+            const bool is_found = resync_find(&buffer[skip], size - skip
+                                              , &offset, &resync->stride);
+            resync->dropped += offset;
+            skip += offset;
+            if(!is_found)
+                break;
+        }
+
+        /* packets are moved to the beginning, the parity is dropped */
+        const size_t stride = resync->stride;
+        for(; skip + stride <= size; skip += stride)
+        {
+            if(   buffer[skip] != TS_SYNC
+               || (skip + stride < size && buffer[skip + stride] != TS_SYNC))
+            {
+                resync->stride = 0;
+                ++resync->lost;
+                break;
+            }
+
+            uint8_t *const dst = &buffer[count * TS_PACKET_SIZE];
+            if(dst != &buffer[skip])
+                memmove(dst, &buffer[skip], TS_PACKET_SIZE);
+            ++count;
+        }
+
+        if(resync->stride)
+            break;
+
+        /* the packet at the skip is broken */
+        ++resync->dropped;
+        ++skip;
+    }
+
+    resync->skip = skip;
+    resync->size = size - skip;
+
+    *ts = buffer;
+    return count;
+}
+
+void udp_resync_reset(udp_resync_t *resync)
+{
+    resync->dropped += resync->size;
+    resync->skip = 0;
+    resync->size = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Astra Module: UDP TS Resynchronization
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_RESYNC_H_
+#define _UDP_RESYNC_H_ 1
+
+#include <astra.h>
+
+/*
+ * Realignment of the TS packets for the sources with the packets split
+ * between the datagrams or with the 204-byte packets (188 bytes and
+ * the Reed-Solomon parity, the parity is dropped). The packet size and
+ * the offset are locked on three sync bytes at the stride, the partial
+ * packet is carried to the next datagram.
+ *
+ * The aligned payload is passed by the caller as is, the stage copies
+ * the datagrams only while the stream is misaligned.
+ */
+
+#define UDP_RESYNC_RS_PACKET_SIZE 204
+/* unlocked tail waiting for the next datagram */
+#define UDP_RESYNC_TAIL_SIZE (2 * UDP_RESYNC_RS_PACKET_SIZE)
+
+typedef struct
+{
+    size_t stride; // TS_PACKET_SIZE or UDP_RESYNC_RS_PACKET_SIZE, 0 - not locked
+    size_t skip; // pending bytes begin here, the packets of the last call are before
+    size_t size; // pending bytes: the partial packet or the unlocked tail
+
+    uint64_t dropped; // bytes
+    uint64_t lost; // sync is lost after the lock
+
+    uint8_t buffer[UDP_RESYNC_TAIL_SIZE + STREAM_BLOCK_SIZE];
+} udp_resync_t;
+
+static inline bool udp_resync_is_aligned(const udp_resync_t *resync
+                                         , const uint8_t *payload, size_t size)
+{
+    return resync->size == 0
+        && size >= TS_PACKET_SIZE && (size % TS_PACKET_SIZE) == 0
+        && payload[0] == 0x47 && payload[size - TS_PACKET_SIZE] == 0x47;
+}
+
+/* returns count of the packets at *ts, valid until the next call */
+size_t udp_resync_push(udp_resync_t *resync, const uint8_t *payload, size_t size
+                       , const uint8_t **ts);
+
+/* drops the partial packet on the discontinuity */
+void udp_resync_reset(udp_resync_t *resync);
+
+#endif /* _UDP_RESYNC_H_ */
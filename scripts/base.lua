@@ -126,6 +126,16 @@ end
 
 parse_url_format.rtp = parse_url_format.udp
 
+parse_url_format.rist = function(url, data)
+    if not parse_url_format.udp(url, data) then
+        return false
+    end
+    if not url:find(":") then
+        data.port = 1968
+    end
+    return (data.port % 2) == 0
+end
+
 parse_url_format._http = function(url, data)
     local b = url:find("/")
     if b then
@@ -170,6 +180,8 @@ parse_url_format.https = function(url, data)
     return r
 end
 
+parse_url_format.hls = parse_url_format.http
+
 parse_url_format.np = function(url, data)
     local r = parse_url_format._http(url, data)
     if data.port == nil then data.port = 80 end
@@ -186,6 +198,8 @@ parse_url_format.file = function(url, data)
     return true
 end
 
+parse_url_format.pcap = parse_url_format.file
+
 function parse_url(url)
     if not url then return nil end
 
@@ -256,6 +270,17 @@ end
 
 init_input_module = {}
 kill_input_module = {}
+-- hot-spare inputs, the input module is prepared but does not deliver the stream
+standby_input_module = {}
+
+-- directory of the warm start files of the channel and decrypt modules,
+-- PAT, PMT, SDT and the last control words of the input
+input_cache_dir = nil
+
+function input_cache_file(name, suffix)
+    if not input_cache_dir then return nil end
+    return input_cache_dir .. "/" .. (name:gsub("[^%w%-_%.]", "_")) .. "." .. suffix
+end
 
 function init_input(conf)
     local instance = { config = conf, }
@@ -303,6 +328,7 @@ function init_input(conf)
             filter = string.split(conf.filter, ","),
             ["filter~"] = string.split(conf["filter~"], ","),
             no_reload = conf.no_reload,
+            cache = input_cache_file(conf.name, "channel"),
         })
         instance.tail = instance.channel
     end
@@ -312,13 +338,14 @@ function init_input(conf)
             upstream = instance.tail:stream(),
             name = conf.name,
             biss = conf.biss,
+            batch_latency = conf.batch_latency,
         })
         instance.tail = instance.decrypt
     elseif conf.cam == true then
         -- DVB-CI
     elseif conf.cam then
         local function get_softcam()
-            if type(conf.cam) == "table" then
+            if type(conf.cam) == "userdata" or type(conf.cam) == "table" then
                 if conf.cam.cam then
                     return conf.cam
                 end
@@ -329,7 +356,7 @@ function init_input(conf)
                     end
                 end
                 local i = _G[tostring(conf.cam)]
-                if type(i) == "table" and i.cam then return i end
+                if type(i) == "userdata" and i.cam then return i end
             end
             log.error("[" .. conf.name .. "] cam is not found")
             return nil
@@ -348,6 +375,8 @@ function init_input(conf)
                 disable_emm = conf.no_emm,
                 ecm_pid = conf.ecm_pid,
                 shift = conf.shift,
+                batch_latency = conf.batch_latency,
+                cache = input_cache_file(conf.name, "decrypt"),
             })
             instance.tail = instance.decrypt
         end
@@ -356,17 +385,29 @@ function init_input(conf)
     return instance
 end
 
+-- inputs without the standby mode keep delivering the stream
+function standby_input(instance, is_standby)
+    local set_standby = standby_input_module[instance.config.format]
+    if set_standby then set_standby(instance.input, instance.config, is_standby) end
+end
+
 function kill_input(instance)
     if not instance then return nil end
 
     instance.tail = nil
 
+    if instance.decrypt then
+        instance.decrypt:close()
+        instance.decrypt = nil
+    end
+    if instance.channel then
+        instance.channel:close()
+        instance.channel = nil
+    end
+
     kill_input_module[instance.config.format](instance.input, instance.config)
     instance.input = nil
     instance.config = nil
-
-    instance.channel = nil
-    instance.decrypt = nil
 end
 
 -- ooooo         ooooo  oooo ooooooooo  oooooooooo
@@ -377,19 +418,45 @@ end
 
 udp_input_instance_list = {}
 
+-- rtp://239.1.1.1:1234#merge=239.2.2.1:1234 - second path, SMPTE 2022-7
+local function udp_input_merge(conf)
+    if type(conf.merge) ~= "string" then return nil end
+    local path = {}
+    if not parse_url_format.udp(conf.merge, path) then
+        log.error("[" .. conf.name .. "] wrong format of the merge option")
+        return nil
+    end
+    if not conf.merge:find(":") then path.port = conf.port end
+    return path
+end
+
 init_input_module.udp = function(conf)
     local instance_id = tostring(conf.localaddr) .. "@" .. conf.addr .. ":" .. conf.port
+        .. "/" .. tostring(conf.source) .. "+" .. tostring(conf.merge)
     local instance = udp_input_instance_list[instance_id]
 
     if not instance then
         instance = { clients = 0, }
         udp_input_instance_list[instance_id] = instance
 
+        local path2 = udp_input_merge(conf) or {}
+
         instance.input = udp_input({
             addr = conf.addr, port = conf.port, localaddr = conf.localaddr,
             socket_size = conf.socket_size,
+            mtu = conf.mtu,
+            source = conf.source,
+            shared = conf.shared,
             renew = conf.renew,
             rtp = conf.rtp,
+            fec = conf.fec,
+            latency = conf.latency,
+            gap_skip = conf.gap_skip,
+            mdi = conf.mdi,
+            addr2 = path2.addr, port2 = path2.port, localaddr2 = path2.localaddr,
+            source2 = conf.source2,
+            -- udp_input_trace is set by the --trace option
+            trace = conf.trace or udp_input_trace,
         })
     end
 
@@ -399,10 +466,12 @@ end
 
 kill_input_module.udp = function(module, conf)
     local instance_id = tostring(conf.localaddr) .. "@" .. conf.addr .. ":" .. conf.port
+        .. "/" .. tostring(conf.source) .. "+" .. tostring(conf.merge)
     local instance = udp_input_instance_list[instance_id]
 
     instance.clients = instance.clients - 1
     if instance.clients == 0 then
+        instance.input:close()
         instance.input = nil
         udp_input_instance_list[instance_id] = nil
     end
@@ -417,6 +486,20 @@ kill_input_module.rtp = function(module, conf)
     kill_input_module.udp(module, conf)
 end
 
+init_input_module.rist = function(conf)
+    return rist_input({
+        addr = conf.addr, port = conf.port, localaddr = conf.localaddr,
+        socket_size = conf.socket_size,
+        latency = conf.latency,
+        rtt = conf.rtt,
+        buffer = conf.buffer,
+    })
+end
+
+kill_input_module.rist = function(module, conf)
+    module:close()
+end
+
 -- ooooo         ooooooooooo ooooo ooooo       ooooooooooo
 --  888           888    88   888   888         888    88
 --  888 ooooooooo 888oo8      888   888         888ooo8
@@ -432,7 +515,21 @@ init_input_module.file = function(conf)
 end
 
 kill_input_module.file = function(module)
-    --
+    module:close()
+end
+
+-- pcap:///path/capture.pcap#addr=239.0.0.1&port=1234&rtp&speed=2&loop
+
+init_input_module.pcap = function(conf)
+    conf.callback = function()
+        log.error("[" .. conf.name .. "] end of file")
+        if conf.on_error then conf.on_error() end
+    end
+    return pcap_input(conf)
+end
+
+kill_input_module.pcap = function(module)
+    module:close()
 end
 
 -- ooooo         ooooo ooooo ooooooooooo ooooooooooo oooooooooo
@@ -444,12 +541,50 @@ end
 http_user_agent = "Astra"
 http_input_instance_list = {}
 
+-- Delay before the next reconnect: doubled with each failed attempt up to
+-- 60 seconds and randomized, so inputs failed at once are not reconnected
+-- to the same server at once
+function http_reconnect_interval(attempt)
+    local interval = math.min(5 * 2 ^ math.min(attempt, 4), 60)
+    return math.random(interval, math.floor(interval * 1.5))
+end
+
+-- Route with the astra.profile() report in JSON.
+-- ?start starts the CPU accounting by module instance (counters are reset),
+-- ?stop stops it
+function http_profile(server, client, request)
+    if not request then return nil end
+
+    if request.query then
+        if request.query.start then
+            astra.profile(true)
+            astra.loopstat(true)
+            astra.latency(true)
+        elseif request.query.stop then
+            astra.profile(false)
+        end
+    end
+
+    local report = astra.profile()
+    report.loop = astra.loopstat()
+    report.latency = astra.latency()
+
+    server:send(client, {
+        code = 200,
+        headers = {
+            "Content-Type: application/json",
+            "Connection: close",
+        },
+        content = json.encode(report),
+    })
+end
+
 init_input_module.http = function(conf)
     local instance_id = conf.host .. ":" .. conf.port .. conf.path
     local instance = http_input_instance_list[instance_id]
 
     if not instance then
-        instance = { clients = 0, }
+        instance = { clients = 0, attempt = 0, }
         http_input_instance_list[instance_id] = instance
 
         instance.on_error = function(message)
@@ -488,17 +623,24 @@ init_input_module.http = function(conf)
             end
         }
 
+        local reconnect = function()
+            timer_conf.interval = http_reconnect_interval(instance.attempt)
+            instance.attempt = instance.attempt + 1
+            instance.timeout = timer(timer_conf)
+        end
+
         http_conf.callback = function(self, response)
             if not response then
                 instance.request:close()
                 instance.request = nil
-                instance.timeout = timer(timer_conf)
+                reconnect()
 
             elseif response.code == 200 then
                 if instance.timeout then
                     instance.timeout:close()
                     instance.timeout = nil
                 end
+                instance.attempt = 0
 
                 instance.transmit:set_upstream(self:stream())
 
@@ -522,14 +664,14 @@ init_input_module.http = function(conf)
                     instance.request = http_request(http_conf)
                 else
                     instance.on_error("HTTP Error: Redirect failed")
-                    instance.timeout = timer(timer_conf)
+                    reconnect()
                 end
 
             else
                 instance.request:close()
                 instance.request = nil
                 instance.on_error("HTTP Error: " .. response.code .. ":" .. response.message)
-                instance.timeout = timer(timer_conf)
+                reconnect()
             end
         end
 
@@ -555,11 +697,346 @@ kill_input_module.http = function(module)
             instance.request:close()
             instance.request = nil
         end
+        instance.transmit:close()
         instance.transmit = nil
         http_input_instance_list[instance_id] = nil
     end
 end
 
+-- ooooo         ooooo ooooo ooooo        oooooooo8
+--  888           888   888   888        888
+--  888 ooooooooo 888ooo888   888         888oooooo
+--  888           888   888   888      o         888
+-- o888o         o888o o888o o888ooooo88 o88oooo888
+
+-- hls://host:port/path/index.m3u8#prefetch=3&buffer=4&bandwidth=4000000
+--  prefetch  - segments downloaded at once
+--  buffer    - segments downloaded ahead of the playout
+--  prebuffer - segments in the queue to start the playout
+--  bandwidth - variant of the master playlist, the highest not above.
+--              default: the highest
+--
+-- Playlists and segments are requested with the http_request connection
+-- pool, the segments are paced by hls_input
+
+hls_input_instance_list = {}
+
+-- Media playlist: segments, or master playlist: variants
+function hls_parse_playlist(content)
+    if content:sub(1, 7) ~= "#EXTM3U" then
+        return { error = "wrong playlist format" }
+    end
+
+    local playlist = { segments = {}, variants = {}, sequence = 0, target_duration = 10, }
+    local duration = nil
+    local discontinuity = false
+    local bandwidth = nil
+
+    for line in content:gmatch("[^\r\n]+") do
+        if line:sub(1, 1) == "#" then
+            local tag, value = line:match("^#([%w%-]+):?(.*)$")
+            if tag == "EXT-X-TARGETDURATION" then
+                playlist.target_duration = tonumber(value) or playlist.target_duration
+            elseif tag == "EXT-X-MEDIA-SEQUENCE" then
+                playlist.sequence = tonumber(value) or 0
+            elseif tag == "EXTINF" then
+                duration = tonumber(value:match("^[%d%.]+"))
+            elseif tag == "EXT-X-DISCONTINUITY" then
+                discontinuity = true
+            elseif tag == "EXT-X-ENDLIST" then
+                playlist.is_end = true
+            elseif tag == "EXT-X-STREAM-INF" then
+                bandwidth = tonumber(value:match("BANDWIDTH=(%d+)")) or 0
+            elseif tag == "EXT-X-KEY" then
+                if not value:find("METHOD=NONE") then
+                    playlist.error = "encrypted segments are not supported"
+                end
+            elseif tag == "EXT-X-MAP" then
+                playlist.error = "fMP4 segments are not supported"
+            end
+        elseif bandwidth then
+            table.insert(playlist.variants, { bandwidth = bandwidth, uri = line, })
+            bandwidth = nil
+        else
+            table.insert(playlist.segments, {
+                sequence = playlist.sequence + #playlist.segments,
+                uri = line,
+                duration = duration or playlist.target_duration,
+                discontinuity = discontinuity,
+            })
+            duration = nil
+            discontinuity = false
+        end
+    end
+
+    return playlist
+end
+
+-- Location of the URI relative to the playlist
+function hls_resolve_uri(location, uri)
+    if uri:find("://") then
+        local o = parse_url(uri)
+        if not o or o.format ~= "http" then return nil end
+        return { host = o.host, port = o.port, path = o.path, }
+    end
+
+    local path = uri
+    if path:sub(1, 1) ~= "/" then
+        path = location.path:gsub("%?.*$", ""):match("^(.*/)") .. uri
+    end
+    return { host = location.host, port = location.port, path = path, }
+end
+
+init_input_module.hls = function(conf)
+    local instance_id = conf.host .. ":" .. conf.port .. conf.path
+    local instance = hls_input_instance_list[instance_id]
+
+    if instance then
+        instance.clients = instance.clients + 1
+        return instance.input
+    end
+
+    instance = {
+        clients = 1,
+        attempt = 0,
+        playlist = { host = conf.host, port = conf.port, path = conf.path, },
+        queue = {},     -- segments are not pushed yet, in the order of the sequence
+        requests = {},  -- active http_request instances
+        fetch_count = 0,
+    }
+    hls_input_instance_list[instance_id] = instance
+
+    local prefetch = tonumber(conf.prefetch) or 3
+    local buffer = tonumber(conf.buffer) or 4
+
+    local on_error = function(message)
+        log.error("[" .. conf.name .. "] " .. message)
+        if conf.on_error then conf.on_error(message) end
+    end
+
+    local auth = nil
+    if conf.login and conf.password then
+        auth = "Authorization: Basic " .. base64.encode(conf.login .. ":" .. conf.password)
+    end
+
+    -- GET with the connection pool, callback(content) or callback(nil, message)
+    local fetch
+    fetch = function(location, callback, redirect)
+        local headers = {
+            "User-Agent: " .. http_user_agent,
+            "Host: " .. location.host .. ":" .. location.port,
+        }
+        if auth and location.host == conf.host then table.insert(headers, auth) end
+
+        local request = http_request({
+            host = location.host,
+            port = location.port,
+            path = location.path,
+            timeout = conf.timeout,
+            headers = headers,
+            callback = function(self, response)
+                if not instance.requests[self] then return end
+                instance.requests[self] = nil
+                self:close()
+
+                if not response then
+                    callback(nil, "connection closed")
+                elseif response.code == 200 then
+                    callback(response.content or "")
+                elseif (response.code == 301 or response.code == 302) and not redirect then
+                    local o = response.headers and parse_url(response.headers["location"])
+                    if o and o.format == "http" then
+                        fetch({ host = o.host, port = o.port, path = o.path, }, callback, true)
+                    else
+                        callback(nil, "HTTP Error: Redirect failed")
+                    end
+                else
+                    callback(nil, "HTTP Error: " .. response.code .. ":" .. response.message)
+                end
+            end,
+        })
+        instance.requests[request] = true
+    end
+
+    local fill
+    local load_playlist
+
+    local on_segment = function(segment, content, message)
+        instance.fetch_count = instance.fetch_count - 1
+        if content then
+            segment.content = content
+        else
+            log.warning("[" .. conf.name .. "] segment " .. segment.sequence .. " skipped. "
+                        .. message)
+            segment.content = false
+        end
+        fill()
+    end
+
+    -- segments are pushed in the order, downloaded ahead while the buffer is not full
+    fill = function()
+        while instance.queue[1] and instance.queue[1].content ~= nil do
+            local segment = table.remove(instance.queue, 1)
+            if segment.content then
+                instance.input:push(segment.content, segment.discontinuity or instance.gap)
+                instance.gap = nil
+            else
+                instance.gap = true
+            end
+        end
+
+        local ahead = instance.input:queued()
+        for _, segment in ipairs(instance.queue) do
+            if ahead >= buffer or instance.fetch_count >= prefetch then break end
+            if not segment.is_fetch then
+                segment.is_fetch = true
+                instance.fetch_count = instance.fetch_count + 1
+                fetch(segment.location, function(content, message)
+                    on_segment(segment, content, message)
+                end)
+            end
+            ahead = ahead + 1
+        end
+    end
+
+    local reload = function(interval)
+        instance.timer = timer({
+            interval = interval,
+            callback = function(self)
+                self:close()
+                instance.timer = nil
+                load_playlist()
+            end,
+        })
+    end
+
+    local on_playlist = function(playlist)
+        if #playlist.variants > 0 then
+            local variant = nil
+            for _, item in ipairs(playlist.variants) do
+                if not conf.bandwidth or item.bandwidth <= tonumber(conf.bandwidth) then
+                    if not variant or item.bandwidth > variant.bandwidth then variant = item end
+                end
+            end
+            variant = variant or playlist.variants[1]
+
+            instance.playlist = hls_resolve_uri(instance.playlist, variant.uri)
+            if not instance.playlist then
+                on_error("HLS Error: wrong variant uri")
+                return false
+            end
+            log.info("[" .. conf.name .. "] Variant " .. variant.bandwidth .. " http://"
+                     .. instance.playlist.host .. ":" .. instance.playlist.port
+                     .. instance.playlist.path)
+            load_playlist()
+            return true
+        end
+
+        local count = #playlist.segments
+        if count == 0 then return true end
+        local last = playlist.segments[count].sequence
+
+        if instance.sequence and last + count < instance.sequence then
+            log.warning("[" .. conf.name .. "] media sequence is restarted")
+            instance.sequence = nil
+        end
+
+        local discontinuity = false
+        if not instance.sequence then
+            -- live playout starts three segments before the end
+            local first = 1
+            if not playlist.is_end then first = math.max(1, count - 2) end
+            instance.sequence = playlist.segments[first].sequence - 1
+            discontinuity = true
+        elseif playlist.segments[1].sequence > instance.sequence + 1 then
+            log.warning("[" .. conf.name .. "] segments are lost: "
+                        .. (playlist.segments[1].sequence - instance.sequence - 1))
+            discontinuity = true
+        end
+
+        local is_new = false
+        for _, segment in ipairs(playlist.segments) do
+            if segment.sequence > instance.sequence then
+                local location = hls_resolve_uri(instance.playlist, segment.uri)
+                if location then
+                    table.insert(instance.queue, {
+                        sequence = segment.sequence,
+                        location = location,
+                        discontinuity = segment.discontinuity or discontinuity,
+                    })
+                end
+                instance.sequence = segment.sequence
+                discontinuity = false
+                is_new = true
+            end
+        end
+
+        fill()
+
+        if playlist.is_end then
+            log.info("[" .. conf.name .. "] end of playlist")
+            return true
+        end
+
+        -- the next segment is expected in the duration of the last one, the
+        -- playlist without changes is requested again in half of the duration
+        local interval = math.min(playlist.segments[count].duration, playlist.target_duration)
+        if not is_new then interval = interval / 2 end
+        reload(math.max(1, math.floor(interval)))
+        return true
+    end
+
+    load_playlist = function()
+        fetch(instance.playlist, function(content, message)
+            local playlist = nil
+            if content then
+                playlist = hls_parse_playlist(content)
+                message = playlist.error
+            end
+
+            if message then
+                on_error(message)
+                reload(http_reconnect_interval(instance.attempt))
+                instance.attempt = instance.attempt + 1
+                return
+            end
+
+            instance.attempt = 0
+            on_playlist(playlist)
+        end)
+    end
+
+    instance.input = hls_input({
+        instance_id = instance_id,
+        name = conf.name,
+        prebuffer = conf.prebuffer,
+    })
+    load_playlist()
+
+    return instance.input
+end
+
+kill_input_module.hls = function(module)
+    local instance_id = module.__options.instance_id
+    local instance = hls_input_instance_list[instance_id]
+
+    instance.clients = instance.clients - 1
+    if instance.clients == 0 then
+        if instance.timer then
+            instance.timer:close()
+            instance.timer = nil
+        end
+        for request in pairs(instance.requests) do
+            request:close()
+        end
+        instance.requests = {}
+        instance.queue = {}
+        instance.input:close()
+        instance.input = nil
+        hls_input_instance_list[instance_id] = nil
+    end
+end
+
 -- ooooo         ooooooooo  ooooo  oooo oooooooooo
 --  888           888    88o 888    88   888    888
 --  888 ooooooooo 888    888  888  88    888oooo88
@@ -568,28 +1045,110 @@ end
 
 dvb_input_instance_list = {}
 dvb_list = nil
+dvb_list_cache = nil -- file name, see --dvbls-cache
+
+-- adapter numbers are assigned on boot, the cache is valid until reboot
+function dvb_list_boot_id()
+    local f = io.open("/proc/sys/kernel/random/boot_id", "r")
+    if not f then return nil end
+    local boot_id = f:read("*l")
+    f:close()
+    return boot_id
+end
+
+function dvb_list_load()
+    local boot_id = dvb_list_boot_id()
+    local f = io.open(dvb_list_cache, "r")
+    if not f or not boot_id then
+        if f then f:close() end
+        return nil
+    end
+
+    local list = nil
+    if f:read("*l") == boot_id then
+        list = {}
+        for line in f:lines() do
+            local adapter, device, type, mac, frontend =
+                line:match("^(%d+);(%d+);([^;]+);([^;]+);(.*)$")
+            if adapter then
+                table.insert(list, {
+                    adapter = tonumber(adapter),
+                    device = tonumber(device),
+                    type = type,
+                    mac = mac,
+                    frontend = frontend,
+                })
+            end
+        end
+    end
+    f:close()
+    return list
+end
+
+function dvb_list_save(list)
+    local boot_id = dvb_list_boot_id()
+    if not boot_id then return nil end
+
+    local f = io.open(dvb_list_cache, "w")
+    if not f then
+        log.warning("[dvb_tune] failed to write dvbls cache: " .. dvb_list_cache)
+        return nil
+    end
+
+    f:write(boot_id .. "\n")
+    for _, a in ipairs(list) do
+        if not a.error and a.mac:match("^%x%x:") then
+            f:write(a.adapter .. ";" .. a.device .. ";" .. a.type .. ";" ..
+                    a.mac .. ";" .. a.frontend .. "\n")
+        end
+    end
+    f:close()
+end
+
+function dvb_list_scan()
+    local list = {}
+    if dvbls then
+        list = dvbls()
+        if dvb_list_cache then dvb_list_save(list) end
+    end
+    return list
+end
+
+function dvb_list_find(mac)
+    for _, a in ipairs(dvb_list) do
+        if a.mac == mac then return a end
+    end
+    return nil
+end
 
 function dvb_tune(conf)
     if conf.mac then
         conf.adapter = nil
         conf.device = nil
 
+        local is_cached = false
         if dvb_list == nil then
-            if dvbls then
-                dvb_list = dvbls()
+            if dvb_list_cache then dvb_list = dvb_list_load() end
+            if dvb_list then
+                is_cached = true
             else
-                dvb_list = {}
+                dvb_list = dvb_list_scan()
             end
         end
+
         local mac = conf.mac:upper()
-        for _, a in ipairs(dvb_list) do
-            if a.mac == mac then
-                log.info("[dvb_tune] adapter: " .. a.adapter .. "." .. a.device .. ". " ..
-                         "MAC address: " .. mac)
-                conf.adapter = a.adapter
-                conf.device = a.device
-                break
-            end
+        local a = dvb_list_find(mac)
+        if not a and is_cached then
+            -- adapter is not in the cache, scan again
+            dvb_list = dvb_list_scan()
+            a = dvb_list_find(mac)
+        end
+
+        if a then
+            log.info("[dvb_tune] adapter: " .. a.adapter .. "." .. a.device .. ". " ..
+                     "MAC address: " .. mac)
+            conf.adapter = a.adapter
+            conf.device = a.device
         end
 
         if conf.adapter == nil then
@@ -662,6 +1221,25 @@ function dvb_tune(conf)
     return instance
 end
 
+-- channel inputs of the adapter by the state: active or hot-spare (option spare).
+-- the adapter is in the standby while it has the hot-spare inputs only
+local dvb_input_users = setmetatable({}, { __mode = "k" })
+
+local function dvb_set_state(module, conf, state)
+    if not module.standby or conf.dvb_state == state then return nil end
+
+    local users = dvb_input_users[module]
+    if not users then
+        users = { active = 0, spare = 0, }
+        dvb_input_users[module] = users
+    end
+    if conf.dvb_state then users[conf.dvb_state] = users[conf.dvb_state] - 1 end
+    if state then users[state] = users[state] + 1 end
+    conf.dvb_state = state
+
+    module:standby(users.active == 0 and users.spare > 0)
+end
+
 init_input_module.dvb = function(conf)
     local instance = nil
 
@@ -697,20 +1275,54 @@ init_input_module.dvb = function(conf)
         instance:ca_set_pnr(conf.pnr, true)
     end
 
+    conf.dvb_state = nil
+    dvb_set_state(instance, conf, (conf.spare == true) and "spare" or "active")
+
     return instance
 end
 
+standby_input_module.dvb = function(module, conf, is_standby)
+    dvb_set_state(module, conf, is_standby and "spare" or "active")
+end
+
+-- adapters without channels are kept open between dvb_tune_hold() and dvb_tune_release()
+local dvb_tune_hold_list = nil
+
+local function dvb_tune_close(module)
+    module:close()
+    local instance_id = module.__options.adapter .. "." .. module.__options.device
+    dvb_input_instance_list[instance_id] = nil
+end
+
+function dvb_tune_hold()
+    dvb_tune_hold_list = {}
+end
+
+function dvb_tune_release()
+    local list = dvb_tune_hold_list
+    dvb_tune_hold_list = nil
+    if not list then return nil end
+
+    for module in pairs(list) do
+        if module.__options.channels == 0 then dvb_tune_close(module) end
+    end
+end
+
 kill_input_module.dvb = function(module, conf)
     if conf.cam == true and conf.pnr then
         module:ca_set_pnr(conf.pnr, false)
     end
 
+    dvb_set_state(module, conf, nil)
+
     if module.__options.channels ~= nil then
         module.__options.channels = module.__options.channels - 1
         if module.__options.channels == 0 then
-            module:close()
-            local instance_id = module.__options.adapter .. "." .. module.__options.device
-            dvb_input_instance_list[instance_id] = nil
+            if dvb_tune_hold_list then
+                dvb_tune_hold_list[module] = true
+            else
+                dvb_tune_close(module)
+            end
         end
     end
 end
@@ -721,13 +1333,18 @@ end
 --  888           888  88o    888    oo   888      o 888o   o888 8oooo88    888    888
 -- o888o         o888o  88o8 o888ooo8888 o888ooooo88   88ooo88 o88o  o888o o888ooo88
 
+-- full reload, applications with the incremental reload override it
+function reload_config()
+    astra.reload()
+end
+
 init_input_module.reload = function(conf)
     return transmit({
         timer = timer({
             interval = tonumber(conf.addr),
             callback = function(self)
                 self:close()
-                astra.reload()
+                reload_config()
             end,
         })
     })
@@ -735,6 +1352,7 @@ end
 
 kill_input_module.reload = function(module)
     module.__options.timer:close()
+    module:close()
 end
 
 -- ooooo          oooooooo8 ooooooooooo   ooooooo  oooooooooo
@@ -748,7 +1366,7 @@ init_input_module.stop = function(conf)
 end
 
 kill_input_module.stop = function(module)
-    --
+    module:close()
 end
 
 -- ooooo         ooooooo      o      ooooooooo
@@ -782,6 +1400,9 @@ Astra Options:
     --no-stdout         do not print log messages into console
     --color             colored log messages in console
     --debug             print debug messages
+    --dvbls-cache FILE  keep the DVB adapters list until reboot
+    --handover SOCKET   take the sockets and the tuners of the running
+                        process with the same option and replace it
 ]])
 
     if _G.options_usage then
@@ -837,6 +1458,14 @@ astra_options = {
         log.set({ debug = true })
         return 0
     end,
+    ["--dvbls-cache"] = function(idx)
+        dvb_list_cache = argv[idx + 1]
+        return 1
+    end,
+    -- the descriptors are taken before the script, see main.c
+    ["--handover"] = function(idx)
+        return 1
+    end,
 }
 
 function astra_parse_options(idx)
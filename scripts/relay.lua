@@ -56,6 +56,7 @@ function xproxy_init_client(server, client, request, path)
     }
 
     client_data.client_id = client_id
+    if stat_cache then stat_cache:invalidate() end
 end
 
 function xproxy_kill_client(server, client)
@@ -64,6 +65,7 @@ function xproxy_kill_client(server, client)
 
     client_list[client_data.client_id] = nil
     client_data.client_id = nil
+    if stat_cache then stat_cache:invalidate() end
 end
 
 --  oooooooo8 ooooooooooo   o   ooooooooooo
@@ -132,8 +134,31 @@ table { width: 600px; margin: auto; }
 ]]
 end
 
-function on_request_stat(server, client, request)
+function relay_stat_check(server, client, request)
+    if relay_stat_pass and request.headers['authorization'] ~= relay_stat_pass then
+        server:send(client, {
+            code = 401,
+            headers = {
+                "WWW-Authenticate: Basic realm=\"Astra Relay\"",
+                "Content-Length: 0",
+                "Connection: close",
+            }
+        })
+        return false
+    end
+    return true
+end
+
+function on_request_profile(server, client, request)
     if not request then return nil end
+    if not relay_stat_check(server, client, request) then return nil end
+    http_profile(server, client, request)
+end
+
+stat_cache = nil
+
+function on_request_stat(server, client, request)
+    if not request then return stat_cache(server, client, nil) end
 
     if request.query then
         if request.query.close then
@@ -146,28 +171,9 @@ function on_request_stat(server, client, request)
         end
     end
 
-    if relay_stat_pass then
-        if request.headers['authorization'] ~= relay_stat_pass then
-            server:send(client, {
-                code = 401,
-                headers = {
-                    "WWW-Authenticate: Basic realm=\"Astra Relay\"",
-                    "Content-Length: 0",
-                    "Connection: close",
-                }
-            })
-            return nil
-        end
-    end
+    if not relay_stat_check(server, client, request) then return nil end
 
-    server:send(client, {
-        code = 200,
-        headers = {
-            "Content-Type: text/html; charset=utf-8",
-            "Connection: close",
-        },
-        content = render_stat_html(),
-    })
+    stat_cache(server, client, request)
 end
 
 -- oooooooooo ooooo            o   ooooo  oooo ooooo       ooooo  oooooooo8 ooooooooooo
@@ -176,30 +182,11 @@ end
 --  888        888      o   8oooo88    888      888      o  888          888    888
 -- o888o      o888ooooo88 o88o  o888o o888o    o888ooooo88 o888o o88oooo888    o888o
 
-function on_request_playlist(server, client, request)
-    if not request then return nil end
-
-    if not playlist_request then
-        server:abort(client, 404)
-        return nil
-    end
-
-    local playlist_callback = function(content_type, content)
-        if content_type then
-            server:send(client, {
-                code = 200,
-                headers = {
-                    "Content-Type: " .. content_type,
-                    "Connection: close",
-                },
-                content = content,
-            })
-        else
-            server:abort(client, 404)
-        end
-    end
+playlist_cache = nil
 
-    playlist_request(request, playlist_callback)
+function on_request_playlist(server, client, request)
+    if not request then return playlist_cache(server, client, nil) end
+    playlist_cache(server, client, request)
 end
 
 -- ooooo  oooo ooooooooo  oooooooooo
@@ -208,39 +195,82 @@ end
 --  888    88   888    888 888
 --   888oo88   o888ooo88  o888o
 
-function on_request_udp(server, client, request)
-    local client_data = server:data(client)
+-- viewers of the same source share one input, see the session option of http_upstream
+
+function relay_session_open(url, conf)
+    if not conf then
+        conf = parse_url(url)
+        if not conf then return nil end
+    end
+    conf.name = "Relay " .. url
+    local input = init_input(conf)
+    return input.tail:stream(), input
+end
+
+function relay_session_close(url, input)
+    kill_input(input)
+end
+
+function relay_session_send(server, client, url)
+    server:send(client, {
+        session = url,
+        buffer_size = relay_buffer_size,
+        buffer_fill = relay_buffer_fill,
+        pacing = relay_pacing,
+        strip_null = relay_strip_null,
+    })
+end
+
+-- ?pnr=N selects the program, the channel module passes the PIDs of the PMT only
+function relay_program_url(request, url)
+    local pnr = request.query and tonumber(request.query.pnr)
+    if not pnr then return url end
+    return url .. "#pnr=" .. pnr
+end
+
+-- new sessions are paced with --rate, viewers of the open sessions are not queued
+function relay_admission(upstream, request_url)
+    if not relay_rate and not relay_buffer_budget then return nil end
+    return {
+        rate = relay_rate,
+        queue = relay_queue,
+        -- new streams wait in the queue while the buffer budget is full
+        ready = relay_buffer_budget and function()
+            return upstream:budget(relay_buffer_size, relay_buffer_fill).grant > 0
+        end,
+        bypass = function(request)
+            local url = request_url(request)
+            return url ~= nil and upstream:session(url) ~= nil
+        end,
+    }
+end
 
+function relay_udp_url(request)
+    return relay_program_url(request, request.path:sub(2, 4) .. "://" .. request.path:sub(6))
+end
+
+function on_request_udp(server, client, request)
     if not request then -- on_close
-        kill_input(client_data.input)
         xproxy_kill_client(server, client)
-        collectgarbage()
         return nil
     end
 
-    local format = request.path:sub(2, 4)
-    local url = format .. "://" .. request.path:sub(6)
-    local conf = parse_url(url)
-    if not conf then
+    local url = relay_udp_url(request)
+    if not parse_url(url) then
         server:abort(client, 404)
         return nil
     end
 
     xproxy_init_client(server, client, request, url)
+    relay_session_send(server, client, url)
+end
 
-    local allow_channel = function()
-        conf.name = "Relay " .. client_data.client_id
-        conf.socket_size = 0x80000
-        if localaddr then conf.localaddr = localaddr end
-        client_data.input = init_input(conf)
-        server:send(client, {
-            upstream = client_data.input.tail:stream(),
-            buffer_size = relay_buffer_size,
-            buffer_fill = relay_buffer_fill,
-        })
-    end
-
-    allow_channel()
+function relay_session_open_udp(url)
+    local conf = parse_url(url)
+    if not conf then return nil end
+    conf.socket_size = 0x80000
+    if localaddr then conf.localaddr = localaddr end
+    return relay_session_open(url, conf)
 end
 
 -- ooooo ooooo ooooooooooo ooooooooooo oooooooooo
@@ -249,36 +279,24 @@ end
 --  888   888      888         888      888
 -- o888o o888o    o888o       o888o    o888o
 
-function on_request_http(server, client, request)
-    local client_data = server:data(client)
+function relay_http_url(request)
+    return relay_program_url(request, "http://" .. request.path:sub(7))
+end
 
+function on_request_http(server, client, request)
     if not request then -- on_close
-        kill_input(client_data.input)
         xproxy_kill_client(server, client)
-        collectgarbage()
         return nil
     end
 
-    local url = "http://" .. request.path:sub(7)
-    local conf = parse_url(url)
-    if not conf then
+    local url = relay_http_url(request)
+    if not parse_url(url) then
         server:abort(client, 404)
         return nil
     end
 
     xproxy_init_client(server, client, request, url)
-
-    local allow_channel = function()
-        conf.name = "Relay " .. client_data.client_id
-        client_data.input = init_input(conf)
-        server:send(client, {
-            upstream = client_data.input.tail:stream(),
-            buffer_size = relay_buffer_size,
-            buffer_fill = relay_buffer_fill,
-        })
-    end
-
-    allow_channel()
+    relay_session_send(server, client, url)
 end
 
 --  oo    oo
@@ -287,52 +305,30 @@ end
 --   oo88oo
 --  o88  88o
 
-function on_request_channel(server, client, request)
-    local client_data = server:data(client)
+function relay_channel_url(request)
+    if not channels then return nil end
+    return channels[request.path:sub(2)] or channels["*"]
+end
 
+function on_request_channel(server, client, request)
     if not request then -- on_close
-        kill_input(client_data.input)
         xproxy_kill_client(server, client)
-        collectgarbage()
-        return nil
-    end
-
-    if not channels then
-        server:abort(client, 404)
         return nil
     end
 
-    local path = request.path:sub(2) -- skip '/'
-    local channel = channels[path]
-
-    if not channel then
-        channel = channels["*"]
-    end
-
+    local channel = relay_channel_url(request)
     if not channel then
         server:abort(client, 404)
         return nil
     end
 
-    local conf = parse_url(channel)
-    if not conf then
+    if not parse_url(channel) then
         server:abort(client, 404)
         return nil
     end
 
     xproxy_init_client(server, client, request, request.path)
-
-    local allow_channel = function()
-        conf.name = "Relay " .. client_data.client_id
-        client_data.input = init_input(conf)
-        server:send(client, {
-            upstream = client_data.input.tail:stream(),
-            buffer_size = relay_buffer_size,
-            buffer_fill = relay_buffer_fill,
-        })
-    end
-
-    allow_channel()
+    relay_session_send(server, client, channel)
 end
 
 -- oooo     oooo      o      ooooo oooo   oooo
@@ -346,12 +342,21 @@ relay_port = 8000
 
 relay_buffer_size = nil
 relay_buffer_fill = nil
+relay_buffer_budget = nil
 
 relay_allow_udp = true
 relay_allow_http = true
 
 relay_stat_pass = nil
 
+relay_workers = 1
+
+relay_rate = nil
+relay_queue = 100
+
+relay_pacing = nil
+relay_strip_null = nil
+
 relay_script = nil
 
 function on_sighup()
@@ -364,9 +369,19 @@ options_usage = [[
     -l ADDR             source interface for UDP/RTP streams
     --buffer-size       buffer size in Kb (default: 1024)
     --buffer-fill       minimal packet size in Kb (default: 128)
+    --buffer-budget N   memory of the client buffers in Mb. buffers are reduced when
+                        the budget is filled, new streams are queued or rejected
+                        with 503 (default: unlimited)
     --no-udp            disable direct access the to UDP/RTP source
     --no-http           disable direct access the to HTTP source
     --pass              basic authentication for statistics. login:password
+    --workers N         accept and serve clients in N processes (default: 1)
+    --rate N            start at most N new streams per second, the rest are queued
+                        or rejected with 503 (default: unlimited)
+    --queue N           max count of the queued requests with --rate or --buffer-budget
+                        (default: 100)
+    --pacing [N]        send to each client at N% of the stream rate (default: 150)
+    --strip-null        drop null packets, clients receive VBR stream
     FILE                full path to the Lua-script
 ]]
 
@@ -395,6 +410,10 @@ options = {
         relay_buffer_fill = tonumber(argv[idx + 1])
         return 1
     end,
+    ["--buffer-budget"] =  function(idx)
+        relay_buffer_budget = tonumber(argv[idx + 1])
+        return 1
+    end,
     ["--channels"] = function(idx)
         relay_script = argv[idx + 1]
         on_sighup()
@@ -416,6 +435,43 @@ options = {
         relay_stat_pass = "Basic " .. base64.encode(argv[idx + 1])
         return 1
     end,
+    ["--rate"] = function(idx)
+        relay_rate = tonumber(argv[idx + 1])
+        if not relay_rate then
+            log.error("[Relay] wrong rate value")
+            astra.abort()
+        end
+        return 1
+    end,
+    ["--queue"] = function(idx)
+        relay_queue = tonumber(argv[idx + 1])
+        if not relay_queue then
+            log.error("[Relay] wrong queue value")
+            astra.abort()
+        end
+        return 1
+    end,
+    ["--pacing"] = function(idx)
+        local value = tonumber(argv[idx + 1])
+        if value then
+            relay_pacing = value
+            return 1
+        end
+        relay_pacing = true
+        return 0
+    end,
+    ["--strip-null"] = function(idx)
+        relay_strip_null = true
+        return 0
+    end,
+    ["--workers"] = function(idx)
+        relay_workers = tonumber(argv[idx + 1])
+        if not relay_workers then
+            log.error("[Relay] wrong workers value")
+            astra.abort()
+        end
+        return 1
+    end,
     ["*"] = function(idx)
         relay_script = argv[idx]
         if utils.stat(relay_script).type ~= 'file' then
@@ -434,21 +490,59 @@ function main()
     log.info("Starting Astra " .. astra.version)
     log.info("Astra Relay started on " .. relay_addr .. ":" .. relay_port)
 
+    if relay_workers > 1 then
+        astra.fork(relay_workers)
+    end
+
+    stat_cache = http_cache({
+        name = "stat",
+        callback = function(request, done)
+            done(render_stat_html(), "text/html; charset=utf-8")
+        end,
+    })
+
     local route = {
+        { "/stat/profile", on_request_profile },
         { "/stat/", on_request_stat },
         { "/stat", http_redirect({ location = "/stat/" }) },
     }
 
     if relay_allow_udp then
-        table.insert(route, { "/udp/*", http_upstream({ callback = on_request_udp }) })
-        table.insert(route, { "/rtp/*", http_upstream({ callback = on_request_udp }) })
+        local udp_upstream = http_upstream({
+            callback = on_request_udp,
+            buffer_budget = relay_buffer_budget,
+            session_open = relay_session_open_udp,
+            session_close = relay_session_close,
+        })
+        local udp_admission = relay_admission(udp_upstream, relay_udp_url)
+        table.insert(route, { "/udp/*", udp_upstream, udp_admission })
+        table.insert(route, { "/rtp/*", udp_upstream, udp_admission })
     end
 
     if relay_allow_http then
-        table.insert(route, { "/http/*", http_upstream({ callback = on_request_http }) })
+        local http_upstream_route = http_upstream({
+            callback = on_request_http,
+            buffer_budget = relay_buffer_budget,
+            session_open = relay_session_open,
+            session_close = relay_session_close,
+        })
+        table.insert(route, { "/http/*", http_upstream_route,
+            relay_admission(http_upstream_route, relay_http_url) })
     end
 
     if playlist_request then
+        playlist_cache = http_cache({
+            name = "playlist",
+            callback = function(request, done)
+                playlist_request(request, function(content_type, content)
+                    if content_type then
+                        done(content, content_type)
+                    else
+                        done(nil)
+                    end
+                end)
+            end,
+        })
         table.insert(route, { "/playlist*", on_request_playlist })
     end
 
@@ -456,12 +550,20 @@ function main()
         for _,r in ipairs(xproxy_route) do table.insert(route, r) end
     end
 
-    table.insert(route, { "/*", http_upstream({ callback = on_request_channel }) })
+    local channel_upstream = http_upstream({
+        callback = on_request_channel,
+        buffer_budget = relay_buffer_budget,
+        session_open = relay_session_open,
+        session_close = relay_session_close,
+    })
+    table.insert(route, { "/*", channel_upstream,
+        relay_admission(channel_upstream, relay_channel_url) })
 
     http_server({
         addr = relay_addr,
         port = relay_port,
         server_name = "Astra Relay",
+        workers = relay_workers,
         route = route
     })
 end
@@ -108,6 +108,9 @@ function on_analyze_spts(channel_data, input_id, data)
 
     elseif data.analyze then
 
+        -- hot-spare input delivers the tables only
+        if input_data.spare then return nil end
+
         if data.on_air ~= input_data.on_air then
             local analyze_message = "[" .. input_data.config.name .. "] Bitrate:" .. data.total.bitrate .. "Kbit/s"
 
@@ -125,7 +128,10 @@ function on_analyze_spts(channel_data, input_id, data)
 
             input_data.on_air = data.on_air
 
-            if channel_data.delay > 0 then
+            if channel_data.hot_standby then
+                -- inputs are warm, switch node selects the active one
+                channel_data.transmit:set_state(input_id, data.on_air)
+            elseif channel_data.delay > 0 then
                 if input_data.on_air == true and channel_data.active_input_id == 0 then
                     start_reserve(channel_data)
                 else
@@ -159,13 +165,15 @@ function start_reserve(channel_data)
     if active_input_id == 0 then
         local next_input_id = 0
         for input_id, input_data in ipairs(channel_data.input) do
-            if not input_data.input then
+            if not input_data.input or input_data.spare then
                 next_input_id = input_id
                 break
             end
         end
         if next_input_id == 0 then
             log.error("[" .. channel_data.config.name .. "] Failed to switch to reserve")
+        elseif channel_data.input[next_input_id].spare then
+            channel_activate_input(channel_data, next_input_id)
         else
             channel_init_input(channel_data, next_input_id)
         end
@@ -175,9 +183,14 @@ function start_reserve(channel_data)
 
         for input_id, input_data in ipairs(channel_data.input) do
             if input_data.input and input_id > active_input_id then
-                channel_kill_input(channel_data, input_id)
-                log.debug("[" .. channel_data.config.name .. "] Destroy input #" .. input_id)
-                input_data.on_air = nil
+                if input_data.config.spare then
+                    channel_standby_input(channel_data, input_id)
+                    log.debug("[" .. channel_data.config.name .. "] Standby input #" .. input_id)
+                else
+                    channel_kill_input(channel_data, input_id)
+                    log.debug("[" .. channel_data.config.name .. "] Destroy input #" .. input_id)
+                    input_data.on_air = nil
+                end
             end
         end
         collectgarbage()
@@ -190,9 +203,13 @@ end
 --  888   88   8888   888        888    88      888
 -- o888o o88o    88  o888o        888oo88      o888o
 
-function channel_init_input(channel_data, input_id)
+function channel_init_input(channel_data, input_id, is_spare)
     local input_data = channel_data.input[input_id]
     input_data.input = init_input(input_data.config)
+    if input_data.config.spare and not is_spare then
+        -- started as the active input, e.g. the first one
+        standby_input(input_data.input, false)
+    end
 
     if input_data.config.no_analyze ~= true then
         input_data.analyze = analyze({
@@ -208,7 +225,63 @@ function channel_init_input(channel_data, input_id)
 
     -- TODO: init additional modules
 
+    if channel_data.hot_standby then
+        channel_data.transmit:set_upstream(input_id, input_data.input.tail:stream())
+    elseif is_spare then
+        input_data.spare = true
+    else
+        channel_data.transmit:set_upstream(input_data.input.tail:stream())
+    end
+end
+
+-- hot-spare input (option spare, e.g. dvb://a2#pnr=1&spare) is started with the channel
+-- in the standby: the DVB adapter is tuned to the backup transponder, the demux filters
+-- and the CAM are set, only the tables are delivered. the failover switches the transmit
+-- to it without tuning, the recovered input returns it to the standby
+
+function channel_activate_input(channel_data, input_id)
+    local input_data = channel_data.input[input_id]
+    input_data.spare = nil
+    input_data.on_air = nil
+    standby_input(input_data.input, false)
     channel_data.transmit:set_upstream(input_data.input.tail:stream())
+    log.info("[" .. channel_data.config.name .. "] Switch to spare input #" .. input_id)
+end
+
+function channel_standby_input(channel_data, input_id)
+    local input_data = channel_data.input[input_id]
+    input_data.spare = true
+    input_data.on_air = nil
+    standby_input(input_data.input, true)
+end
+
+function channel_init_inputs(channel_data)
+    if channel_data.hot_standby then
+        for input_id, input_data in ipairs(channel_data.input) do
+            if not input_data.input then
+                channel_init_input(channel_data, input_id)
+            end
+        end
+        return nil
+    end
+
+    if not channel_data.input[1].input then
+        channel_init_input(channel_data, 1)
+    end
+    for input_id, input_data in ipairs(channel_data.input) do
+        if input_id > 1 and input_data.config.spare and not input_data.input then
+            channel_init_input(channel_data, input_id, true)
+        end
+    end
+end
+
+function channel_kill_inputs(channel_data)
+    for input_id, input_data in ipairs(channel_data.input) do
+        if input_data.input then
+            channel_kill_input(channel_data, input_id)
+        end
+    end
+    channel_data.active_input_id = 0
 end
 
 function channel_kill_input(channel_data, input_id)
@@ -216,6 +289,10 @@ function channel_kill_input(channel_data, input_id)
 
     -- TODO: kill additional modules
 
+    if channel_data.hot_standby and channel_data.transmit then
+        channel_data.transmit:set_upstream(input_id, nil)
+    end
+
     input_data.analyze = nil
     input_data.on_air = nil
 
@@ -246,6 +323,7 @@ init_output_option.biss = function(channel_data, output_id)
     output_data.biss = biss_encrypt({
         upstream = channel_data.tail:stream(),
         key = output_data.config.biss,
+        threads = output_data.config.biss_threads,
     })
     channel_data.tail = output_data.biss
 end
@@ -298,14 +376,19 @@ init_output_module.udp = function(channel_data, output_id)
     end
     output_data.output = udp_output({
         upstream = channel_data.tail:stream(),
+        name = channel_data.config.name .. " #" .. output_id,
         addr = output_data.config.addr,
         port = output_data.config.port,
         ttl = output_data.config.ttl,
         localaddr = localaddr,
         socket_size = output_data.config.socket_size,
+        mtu = output_data.config.mtu,
         rtp = (output_data.config.format == "rtp"),
         sync = output_data.config.sync,
         cbr = output_data.config.cbr,
+        fec_columns = output_data.config.fec_columns,
+        fec_rows = output_data.config.fec_rows,
+        fec_row = output_data.config.fec_row,
     })
 end
 
@@ -322,6 +405,24 @@ kill_output_module.rtp = function(channel_data, output_id)
     kill_output_module.udp(channel_data, output_id)
 end
 
+init_output_module.rist = function(channel_data, output_id)
+    local output_data = channel_data.output[output_id]
+    output_data.output = rist_output({
+        upstream = channel_data.tail:stream(),
+        addr = output_data.config.addr,
+        port = output_data.config.port,
+        ttl = output_data.config.ttl,
+        localaddr = output_data.config.localaddr,
+        socket_size = output_data.config.socket_size,
+        buffer = output_data.config.buffer,
+    })
+end
+
+kill_output_module.rist = function(channel_data, output_id)
+    local output_data = channel_data.output[output_id]
+    output_data.output = nil
+end
+
 --   ooooooo            ooooooooooo ooooo ooooo       ooooooooooo
 -- o888   888o           888    88   888   888         888    88
 -- 888     888 ooooooooo 888oo8      888   888         888ooo8
@@ -391,12 +492,21 @@ function http_output_on_request(server, client, request)
             local channel_data = client_data.output_data.channel_data
             channel_data.clients = channel_data.clients - 1
             if channel_data.clients == 0 and channel_data.input[1].input ~= nil then
-                for input_id, input_data in ipairs(channel_data.input) do
-                    if input_data.input then
-                        channel_kill_input(channel_data, input_id)
-                    end
+                local idle_timeout = channel_data.config.idle_timeout
+                if idle_timeout and idle_timeout > 0 then
+                    -- keep inputs warm for the next request
+                    channel_data.idle_timer = timer({
+                        interval = idle_timeout,
+                        callback = function(self)
+                            self:close()
+                            channel_data.idle_timer = nil
+                            channel_kill_inputs(channel_data)
+                            collectgarbage()
+                        end,
+                    })
+                else
+                    channel_kill_inputs(channel_data)
                 end
-                channel_data.active_input_id = 0
             end
 
             http_output_client(server, client, nil)
@@ -417,15 +527,21 @@ function http_output_on_request(server, client, request)
     channel_data.clients = channel_data.clients + 1
 
     local allow_channel = function()
-        if not channel_data.input[1].input then
-            channel_init_input(channel_data, 1)
+        if channel_data.idle_timer then
+            channel_data.idle_timer:close()
+            channel_data.idle_timer = nil
         end
 
+        -- client is attached before the inputs start to receive the cached PSI
         server:send(client, {
             upstream = channel_data.tail:stream(),
             buffer_size = client_data.output_data.config.buffer_size,
             buffer_fill = client_data.output_data.config.buffer_fill,
+            fast_start = client_data.output_data.config.fast_start,
+            pacing = client_data.output_data.config.pacing,
         })
+
+        channel_init_inputs(channel_data)
     end
 
     allow_channel()
@@ -443,7 +559,10 @@ init_output_module.http = function(channel_data, output_id)
             port = output_data.config.port,
             sctp = output_data.config.sctp,
             route = {
-                { "/*", http_upstream({ callback = http_output_on_request }) },
+                { "/*", http_upstream({
+                    name = "http " .. instance_id,
+                    callback = http_output_on_request,
+                }) },
             },
             channel_list = {},
         })
@@ -464,7 +583,9 @@ kill_output_module.http = function(channel_data, output_id)
     local instance_id = output_data.instance_id
 
     for _, client in pairs(http_output_client_list) do
-        if client.server == instance then
+        if  client.server == instance and
+            instance:data(client.client).output_data == output_data
+        then
             instance:close(client.client)
         end
     end
@@ -524,17 +645,25 @@ init_output_module.np = function(channel_data, output_id)
         end
     }
 
+    local attempt = 0
+    local reconnect = function()
+        timer_conf.interval = http_reconnect_interval(attempt)
+        attempt = attempt + 1
+        output_data.timeout = timer(timer_conf)
+    end
+
     http_conf.callback = function(self, response)
         if not response then
             output_data.request:close()
             output_data.request = nil
-            output_data.timeout = timer(timer_conf)
+            reconnect()
 
         elseif response.code == 200 then
             if output_data.timeout then
                 output_data.timeout:close()
                 output_data.timeout = nil
             end
+            attempt = 0
 
         elseif response.code == 301 or response.code == 302 then
             if output_data.timeout then
@@ -556,14 +685,14 @@ init_output_module.np = function(channel_data, output_id)
                 output_data.request = http_request(http_conf)
             else
                 log.error("[" .. conf.name .. "] NP Error: Redirect failed")
-                output_data.timeout = timer(timer_conf)
+                reconnect()
             end
 
         else
             output_data.request:close()
             output_data.request = nil
             log.error("[" .. conf.name .. "] NP Error: " .. response.code .. ":" .. response.message)
-            output_data.timeout = timer(timer_conf)
+            reconnect()
         end
     end
 
@@ -589,8 +718,42 @@ end
 --  888oooo88  o888o o888o o88o  o888o o88o    88  o88o    88  o888ooo8888 o888ooooo88
 
 channel_list = {}
+channel_count = 0
 
-function make_channel(channel_config)
+-- find_channel() index: { [key] = { [value] = channel_data } }. the index of
+-- the key is made on the first lookup and kept with the channel list
+local channel_index = {}
+
+local function channel_list_insert(channel_data)
+    table.insert(channel_list, channel_data)
+
+    for key, index in pairs(channel_index) do
+        local value = channel_data.config[key]
+        if value ~= nil and index[value] == nil then
+            index[value] = channel_data
+        end
+    end
+end
+
+local function channel_list_remove(channel_id)
+    local channel_data = table.remove(channel_list, channel_id)
+
+    for key, index in pairs(channel_index) do
+        local value = channel_data.config[key]
+        if value ~= nil and index[value] == channel_data then
+            -- the next channel with the same value
+            index[value] = nil
+            for _, item in ipairs(channel_list) do
+                if item.config[key] == value then
+                    index[value] = item
+                    break
+                end
+            end
+        end
+    end
+end
+
+local function channel_prepare(channel_config)
     if not channel_config.name then
         log.error("[make_channel] option 'name' is required")
         return nil
@@ -612,6 +775,7 @@ function make_channel(channel_config)
 
     local channel_data = {
         config = channel_config,
+        hash = config_hash(channel_config),
         input = {},
         output = {},
         delay = 3,
@@ -652,6 +816,20 @@ function make_channel(channel_config)
     if not check_url_format("input") then return nil end
     if not check_url_format("output") then return nil end
 
+    -- channels are pinned to reactors in order of declaration.
+    -- channels with http output are served by the master reactor
+    local reactor = nil
+    for _, o in pairs(channel_data.output) do
+        if o.config.format == "http" then reactor = 0 end
+    end
+    if not reactor then
+        reactor = channel_count % astra.reactors
+        channel_count = channel_count + 1
+    end
+    if reactor ~= astra.reactor then
+        return nil
+    end
+
     if channel_config.map then
         local o = channel_config.map
         if type(o) == "string" then o = o:gsub("%s+", ""):split(",") end
@@ -687,19 +865,80 @@ function make_channel(channel_config)
         end
     end
 
+    return channel_data
+end
+
+local function channel_start(channel_data)
     channel_data.active_input_id = 0
-    channel_data.transmit = transmit()
+
+    local hot_standby = channel_data.config.hot_standby
+    if hot_standby and #channel_data.input > 1 then
+        if type(hot_standby) ~= "table" then hot_standby = {} end
+        channel_data.hot_standby = true
+        channel_data.transmit = switch({
+            name = channel_data.config.name,
+            timeout = hot_standby.timeout,
+            switch_wait = hot_standby.switch_wait,
+            revert = hot_standby.revert,
+            callback = function(input_id)
+                log.info("[" .. channel_data.config.name .. "] Active input #" .. input_id)
+                channel_data.active_input_id = input_id
+            end,
+        })
+    else
+        -- on demand channels keep PAT and PMT for the fast start
+        channel_data.transmit = transmit({ psi_cache = (channel_data.clients == 0) })
+    end
     channel_data.tail = channel_data.transmit
 
     if channel_data.clients > 0 then
-        channel_init_input(channel_data, 1)
+        channel_init_inputs(channel_data)
     end
 
     for output_id in ipairs(channel_data.output) do
         channel_init_output(channel_data, output_id)
     end
 
-    table.insert(channel_list, channel_data)
+    channel_list_insert(channel_data)
+end
+
+local function channel_stop(channel_data)
+    if channel_data.idle_timer then
+        channel_data.idle_timer:close()
+        channel_data.idle_timer = nil
+    end
+
+    -- outputs first, closed http clients release the inputs
+    while #channel_data.output > 0 do
+        channel_kill_output(channel_data, 1)
+        table.remove(channel_data.output, 1)
+    end
+    channel_data.output = nil
+
+    while #channel_data.input > 0 do
+        channel_kill_input(channel_data, 1)
+        table.remove(channel_data.input, 1)
+    end
+    channel_data.input = nil
+
+    channel_data.tail = nil
+    channel_data.transmit = nil
+    channel_data.config = nil
+end
+
+-- channel configs are collected instead of start while reload_config() runs scripts
+local reload_channel_list = nil
+
+function make_channel(channel_config)
+    if reload_channel_list then
+        table.insert(reload_channel_list, channel_config)
+        return nil
+    end
+
+    local channel_data = channel_prepare(channel_config)
+    if not channel_data then return nil end
+
+    channel_start(channel_data)
     return channel_data
 end
 
@@ -719,33 +958,573 @@ function kill_channel(channel_data)
         return nil
     end
 
-    while #channel_data.input > 0 do
-        channel_kill_input(channel_data, 1)
-        table.remove(channel_data.input, 1)
+    channel_list_remove(channel_id)
+    channel_stop(channel_data)
+    collectgarbage()
+end
+
+function find_channel(key, value)
+    local index = channel_index[key]
+    if not index then
+        index = {}
+        for _, channel_data in ipairs(channel_list) do
+            local item = channel_data.config[key]
+            if item ~= nil and index[item] == nil then
+                index[item] = channel_data
+            end
+        end
+        channel_index[key] = index
     end
-    channel_data.input = nil
+    return index[value]
+end
 
-    while #channel_data.output > 0 do
-        channel_kill_output(channel_data, 1)
-        table.remove(channel_data.output, 1)
+-- oooooooooo  ooooooooooo ooooo         ooooooo      o      ooooooooo
+--  888    888  888    88   888        o888   888o   888      888    88o
+--  888oooo88   888ooo8     888        888     888  8  88     888    888
+--  888  88o    888    oo   888      o 888o   o888 8oooo88    888    888
+-- o888o  88o8 o888ooo8888 o888ooooo88   88ooo88 o88o  o888o o888ooo88
+
+-- Incremental reload. Scripts are executed again, channels with the same
+-- config are kept on air, changed channels are restarted, removed channels
+-- are stopped. Modules in reload_module_key are created once and reused
+-- by the next runs with the same key, so http_server routes and other
+-- options of the reused modules are applied on restart only.
+
+config_files = {}
+
+local function config_dump(value, parts, seen)
+    local t = type(value)
+    if t == "table" then
+        -- module instances are compared by identity
+        if getmetatable(value) ~= nil or seen[value] then
+            table.insert(parts, tostring(value))
+            return
+        end
+
+        seen[value] = true
+        local keys = {}
+        for k in pairs(value) do table.insert(keys, k) end
+        table.sort(keys, function(a, b)
+            local ta, tb = type(a), type(b)
+            if ta ~= tb then return ta < tb end
+            if ta == "number" or ta == "string" then return a < b end
+            return tostring(a) < tostring(b)
+        end)
+
+        table.insert(parts, "{")
+        for _, k in ipairs(keys) do
+            config_dump(k, parts, seen)
+            table.insert(parts, "=")
+            config_dump(value[k], parts, seen)
+            table.insert(parts, ",")
+        end
+        table.insert(parts, "}")
+        seen[value] = nil
+    elseif t == "string" then
+        table.insert(parts, string.format("%q", value))
+    elseif t == "function" then
+        table.insert(parts, "function")
+    else
+        table.insert(parts, tostring(value))
     end
-    channel_data.output = nil
+end
 
-    channel_data.tail = nil
-    channel_data.transmit = nil
-    channel_data.config = nil
+function config_hash(config)
+    local parts = {}
+    config_dump(config, parts, {})
+    return table.concat(parts)
+end
+
+reload_module_key = {
+    newcamd = config_hash,
+    http_server = function(conf)
+        return tostring(conf.addr) .. ":" .. tostring(conf.port)
+    end,
+}
+
+local reload_instance_list = {}
+-- replaced instances are kept until the channels are stopped
+local reload_retired_list = nil
+
+-- runs func with the module reuse. returns status, error and true if softcam is changed
+local function config_run(func, ...)
+    local constructor_list = {}
+    local used_list = {}
+
+    for name, get_key in pairs(reload_module_key) do
+        local constructor = _G[name]
+        if constructor then
+            constructor_list[name] = constructor
+            _G[name] = function(conf)
+                local key = name .. "|" .. get_key(conf)
+                local instance = used_list[key] or reload_instance_list[key]
+                if not instance then
+                    instance = constructor(conf)
+                end
+                used_list[key] = instance
+                return instance
+            end
+        end
+    end
+
+    local ok, err = pcall(func, ...)
+
+    for name, constructor in pairs(constructor_list) do
+        _G[name] = constructor
+    end
+
+    if not ok then
+        for key, instance in pairs(used_list) do
+            reload_instance_list[key] = instance
+        end
+        return false, err, false
+    end
+
+    local is_cam_changed = false
+    reload_retired_list = {}
+    for key, instance in pairs(reload_instance_list) do
+        if used_list[key] ~= instance then
+            table.insert(reload_retired_list, instance)
+            if type(instance) == "userdata" and instance.cam then is_cam_changed = true end
+        end
+    end
+    reload_instance_list = used_list
+
+    return true, nil, is_cam_changed
+end
+
+local function channel_has_cam(channel_data)
+    for _, input_data in ipairs(channel_data.input) do
+        local cam = input_data.config.cam
+        if cam and cam ~= true then return true end
+    end
+    return false
+end
+
+function reload_config()
+    if #config_files == 0 then
+        astra.reload()
+        return
+    end
+
+    log.info("[reload] " .. table.concat(config_files, ", "))
+
+    reload_channel_list = {}
+    local ok, err, is_cam_changed = config_run(function()
+        for _, filename in ipairs(config_files) do dofile(filename) end
+    end)
+    local channel_config_list = agent_config_list(reload_channel_list)
+    reload_channel_list = nil
+
+    if not ok then
+        log.error("[reload] " .. tostring(err))
+        log.error("[reload] configuration is not changed")
+        return
+    end
+
+    local running_list = {}
+    for _, channel_data in ipairs(channel_list) do
+        local list = running_list[channel_data.hash]
+        if not list then
+            list = {}
+            running_list[channel_data.hash] = list
+        end
+        table.insert(list, channel_data)
+    end
+
+    channel_count = 0
+    local next_list = {}
+    local start_list = {}
+    for _, channel_config in ipairs(channel_config_list) do
+        local channel_data = channel_prepare(channel_config)
+        if channel_data then
+            local list = running_list[channel_data.hash]
+            local running = list and list[1]
+            if running and not (is_cam_changed and channel_has_cam(running)) then
+                table.remove(list, 1)
+                channel_data = running
+            else
+                start_list[channel_data] = true
+            end
+            table.insert(next_list, channel_data)
+        end
+    end
+
+    -- stop first, the new channels may reuse outputs of the old ones
+    local stop_count = 0
+    dvb_tune_hold()
+    for _, list in pairs(running_list) do
+        for _, channel_data in ipairs(list) do
+            channel_stop(channel_data)
+            stop_count = stop_count + 1
+        end
+    end
+
+    local start_count = 0
+    channel_list = {}
+    channel_index = {}
+    for _, channel_data in ipairs(next_list) do
+        if start_list[channel_data] then
+            channel_start(channel_data)
+            start_count = start_count + 1
+        else
+            channel_list_insert(channel_data)
+        end
+    end
+    dvb_tune_release()
 
-    table.remove(channel_list, channel_id)
     collectgarbage()
+    reload_retired_list = nil
+
+    log.info("[reload] channels: " .. (#channel_list - start_count) .. " kept, " ..
+             stop_count .. " stopped, " .. start_count .. " started")
 end
 
-function find_channel(key, value)
-    for _, channel_data in pairs(channel_list) do
-        if channel_data.config[key] == value then
-            return channel_data
+function load_config(filename)
+    table.insert(config_files, filename)
+    local ok, err = config_run(dofile, filename)
+    if not ok then error(err, 0) end
+end
+
+function on_sighup()
+    if #config_files > 0 then reload_config() end
+end
+
+--       o         oooooooo8  ooooooooooo oooo   oooo ooooooooooo
+--      888      o888     88   888    88   8888o  88  88  888  88
+--     8  88     888    oooo   888ooo8     88 888o88      888
+--    8oooo88    888o    88    888    oo   88   8888      888
+--  o88o  o888o   888ooo888   o888ooo8888 o88o    88     o888o
+
+-- Cluster agent, see --agent. Reports the load of the channels and moves
+-- the channels between the nodes:
+--   /agent/load                            - CPU and bitrate of the channels
+--   /agent/status?channel=NAME             - the channel is on air
+--   /agent/start                           - POST, start the channel of the other node
+--   /agent/stop?channel=NAME               - stop the channel started by /agent/start
+--   /agent/migrate?channel=NAME&target=HOST:PORT
+--                                          - move the channel to the other node
+-- The target starts the channel with the warm start files of the source
+-- (see --cache), so the stream is descrambled before the first ECM response.
+-- The source stops the channel when the target is on air. Moved channels
+-- are kept by reload_config() until restart.
+
+agent_token = nil
+agent_migrate_timeout = 30
+
+local agent_channel_in = {}     -- [name] = config in JSON, started by /agent/start
+local agent_channel_out = {}    -- [name] = true, moved to the other node
+local agent_migrate_list = {}   -- [name] = target, migration in progress
+local agent_profile = { time = 0, self_us = {} }
+
+-- the list of reload_config() without the moved channels
+function agent_config_list(list)
+    local result = {}
+    for _, channel_config in ipairs(list) do
+        if not agent_channel_out[channel_config.name] then
+            table.insert(result, channel_config)
+        end
+    end
+    for _, text in pairs(agent_channel_in) do
+        table.insert(result, json.decode(text))
+    end
+    return result
+end
+
+-- modules of the channel are named "NAME #N", see channel_prepare()
+local function agent_channel_name(name)
+    return name and (name:gsub(" #%d+$", ""))
+end
+
+local function agent_is_on_air(channel_data)
+    return channel_data.clients == 0 or channel_data.active_input_id > 0
+end
+
+-- cpu is the load of one core since the previous report
+local function agent_load()
+    local channels = {}
+    local result = {}
+    for _, channel_data in ipairs(channel_list) do
+        local item = {
+            name = channel_data.config.name,
+            cpu = 0,
+            bitrate = 0,
+            on_air = agent_is_on_air(channel_data),
+            migrate = agent_migrate_list[channel_data.config.name],
+        }
+        channels[item.name] = item
+        table.insert(result, item)
+    end
+
+    local report = astra.profile()
+    local interval = report.time - agent_profile.time
+    if interval <= 0 then interval = report.time end
+
+    local total = 0
+    local self_us = {}
+    for _, p in ipairs(report.items) do
+        local key = tostring(p.type) .. "|" .. tostring(p.name)
+        self_us[key] = p.self_us
+        local cpu = (interval > 0)
+            and math.max(p.self_us - (agent_profile.self_us[key] or 0), 0) / interval
+            or 0
+        total = total + cpu
+        local item = channels[agent_channel_name(p.name)]
+        if item then item.cpu = item.cpu + cpu end
+    end
+    agent_profile.time = report.time
+    agent_profile.self_us = self_us
+
+    -- the channel stages forward the same stream, the widest one is taken
+    for _, node in ipairs(astra.stream_graph()) do
+        local item = channels[agent_channel_name(node.name)]
+        if item then
+            local bitrate = math.floor(node.edge.byte_rate * 8 / 1000)
+            if bitrate > item.bitrate then item.bitrate = bitrate end
+        end
+    end
+
+    return { cpu = total, channels = result }
+end
+
+-- module instances are passed by the global name, see get_softcam() of init_input()
+local function agent_export(value, path)
+    local t = type(value)
+    if t == "table" and getmetatable(value) == nil then
+        local result = {}
+        for k, v in pairs(value) do
+            local item, err = agent_export(v, path .. "." .. tostring(k))
+            if err then return nil, err end
+            result[k] = item
+        end
+        return result
+    elseif t == "table" or t == "userdata" then
+        for name, item in pairs(_G) do
+            if item == value then return name end
+        end
+        return nil, path .. " is not a global module instance"
+    elseif t == "function" then
+        return nil, path .. " is a function"
+    end
+    return value
+end
+
+local function agent_request(host, port, path, content, callback)
+    local headers = {
+        "User-Agent: " .. http_user_agent,
+        "Host: " .. host .. ":" .. port,
+        "Connection: close",
+    }
+    if agent_token then table.insert(headers, "X-Agent-Token: " .. agent_token) end
+    if content then
+        table.insert(headers, "Content-Type: application/json")
+        table.insert(headers, "Content-Length: " .. #content)
+    end
+
+    local request = nil
+    request = http_request({
+        host = host,
+        port = port,
+        path = path,
+        method = content and "POST" or "GET",
+        headers = headers,
+        content = content,
+        timeout = 5,
+        callback = function(self, response)
+            if not request then return end
+            request:close()
+            request = nil
+            callback(response)
+        end,
+    })
+end
+
+local function agent_urlencode(value)
+    return (value:gsub("[^%w%-_%.~]", function(c)
+        return string.format("%%%02X", c:byte())
+    end))
+end
+
+local function agent_migrate(channel_data, host, port)
+    local name = channel_data.config.name
+    local config, err = agent_export(channel_data.config, name)
+    if err then return false, err end
+
+    local cache = {}
+    for input_id in ipairs(channel_data.input) do
+        for _, suffix in ipairs({ "channel", "decrypt" }) do
+            local path = input_cache_file(name .. " #" .. input_id, suffix)
+            local f = path and io.open(path, "rb")
+            if f then
+                cache[path:match("[^/]+$")] = f:read("*a"):b64e()
+                f:close()
+            end
+        end
+    end
+
+    local target = host .. ":" .. port
+    local prefix = "[agent] " .. name .. " -> " .. target .. ": "
+    agent_migrate_list[name] = target
+
+    local function done(message)
+        agent_migrate_list[name] = nil
+        if message then log.error(prefix .. message) end
+    end
+
+    local function cancel(message)
+        done(message)
+        agent_request(host, port, "/agent/stop?channel=" .. agent_urlencode(name), nil
+            , function() end)
+    end
+
+    local attempt = 0
+    local function check()
+        agent_request(host, port, "/agent/status?channel=" .. agent_urlencode(name), nil
+            , function(response)
+                local status = response and response.code == 200 and response.content
+                    and json.decode(response.content)
+                if status and status.on_air then
+                    -- the channel could be stopped by reload while waiting
+                    if channel_data.config then kill_channel(channel_data) end
+                    agent_channel_out[name] = true
+                    agent_channel_in[name] = nil
+                    done()
+                    log.info(prefix .. "moved")
+                    return
+                end
+
+                attempt = attempt + 1
+                if attempt >= agent_migrate_timeout then
+                    cancel("the channel is not on air on the target")
+                    return
+                end
+                timer({
+                    interval = 1,
+                    callback = function(self)
+                        self:close()
+                        check()
+                    end,
+                })
+            end)
+    end
+
+    local content = json.encode({ config = config, cache = cache })
+    agent_request(host, port, "/agent/start", content, function(response)
+        if not response then
+            done("connection failed")
+        elseif response.code ~= 200 then
+            done("start failed: " .. response.code .. ":" .. tostring(response.message))
+        else
+            check()
+        end
+    end)
+
+    log.info(prefix .. "started")
+    return true
+end
+
+local function agent_start(content)
+    local ok, data = pcall(json.decode, content or "")
+    if not ok or type(data) ~= "table" or type(data.config) ~= "table"
+        or type(data.config.name) ~= "string"
+    then
+        return 400
+    end
+
+    local name = data.config.name
+    if find_channel("name", name) then return 409 end
+
+    if type(data.cache) == "table" then
+        if not input_cache_dir then
+            log.warning("[agent] " .. name .. ": warm start files are skipped, see --cache")
+        else
+            for file, value in pairs(data.cache) do
+                if type(file) == "string" and file:find("^[%w%-_%.]+$") then
+                    local f = io.open(input_cache_dir .. "/" .. file, "wb")
+                    if f then
+                        f:write(value:b64d())
+                        f:close()
+                    end
+                end
+            end
         end
     end
-    return nil
+
+    local text = json.encode(data.config)
+    if not make_channel(json.decode(text)) then return 500 end
+
+    agent_channel_in[name] = text
+    agent_channel_out[name] = nil
+    log.info("[agent] " .. name .. ": started by the other node")
+    return 200
+end
+
+function agent_on_request(server, client, request)
+    if not request then return nil end
+
+    if agent_token and request.headers["x-agent-token"] ~= agent_token then
+        server:abort(client, 403)
+        return nil
+    end
+
+    local query = request.query or {}
+    local channel_data = query.channel and find_channel("name", query.channel)
+    local result = nil
+
+    if request.path == "/agent/load" then
+        result = agent_load()
+
+    elseif request.path == "/agent/status" then
+        if not channel_data then
+            server:abort(client, 404)
+            return nil
+        end
+        result = { on_air = agent_is_on_air(channel_data) }
+
+    elseif request.path == "/agent/start" then
+        local code = agent_start(request.content)
+        if code ~= 200 then
+            server:abort(client, code)
+            return nil
+        end
+        result = { status = "started" }
+
+    elseif request.path == "/agent/stop" then
+        if not channel_data or not agent_channel_in[query.channel] then
+            server:abort(client, 404)
+            return nil
+        end
+        agent_channel_in[query.channel] = nil
+        kill_channel(channel_data)
+        result = { status = "stopped" }
+
+    elseif request.path == "/agent/migrate" then
+        local host, port = tostring(query.target):match("^([^:]+):(%d+)$")
+        if not channel_data or not host or agent_migrate_list[query.channel] then
+            server:abort(client, 400)
+            return nil
+        end
+        local ok, err = agent_migrate(channel_data, host, tonumber(port))
+        if not ok then
+            log.error("[agent] " .. query.channel .. ": " .. err)
+            server:abort(client, 400)
+            return nil
+        end
+        result = { status = "started" }
+
+    else
+        server:abort(client, 404)
+        return nil
+    end
+
+    server:send(client, {
+        code = 200,
+        headers = {
+            "Content-Type: application/json",
+            "Connection: close",
+        },
+        content = json.encode(result),
+    })
 end
 
 --  oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
@@ -755,20 +1534,133 @@ end
 -- o88oooo888    o888o    o888o  88o8 o888ooo8888 o88o  o888o o88o  8  o88o
 
 options_usage = [[
+    --reactors N        shard channels across N processes (default: 1).
+                        servers of --profile, --metrics and --agent run in
+                        the master process
+    --profile PORT      CPU accounting by module, report on http://127.0.0.1:PORT/
+                        stream graph on http://127.0.0.1:PORT/graph[?format=dot]
+    --watchdog MS       log main loop stalls longer than MS with the Lua backtrace
+    --metrics PORT      Prometheus metrics on http://0.0.0.0:PORT/metrics
+    --trace N           trace the latency of 1-in-N UDP datagrams through the
+                        stream graph, reported by --profile
+    --cache DIR         warm start files of the channel and decrypt modules
+    --agent PORT        cluster agent on http://0.0.0.0:PORT/agent/: channel load
+                        report and migration to the other node
+    --agent-token TOKEN X-Agent-Token of the agent requests
     FILE                Astra script
 ]]
 
 options = {
+    -- see reactors_fork()
+    ["--reactors"] = function(idx)
+        return 1
+    end,
+    ["--profile"] = function(idx)
+        local port = tonumber(argv[idx + 1])
+        if not port then
+            log.error("[Stream] wrong profile port")
+            astra.abort()
+        end
+        astra.profile(true)
+        if astra.reactor ~= 0 then return 1 end
+        profile_server = http_server({
+            addr = "127.0.0.1",
+            port = port,
+            route = {
+                { "/graph", http_stream_graph({}) },
+                { "/*", http_profile },
+            },
+        })
+        return 1
+    end,
+    ["--metrics"] = function(idx)
+        local port = tonumber(argv[idx + 1])
+        if not port then
+            log.error("[Stream] wrong metrics port")
+            astra.abort()
+        end
+        if astra.reactor ~= 0 then return 1 end
+        metrics_server = http_server({
+            addr = "0.0.0.0",
+            port = port,
+            route = { { "/metrics", http_metrics({}) } },
+        })
+        return 1
+    end,
+    ["--watchdog"] = function(idx)
+        local threshold = tonumber(argv[idx + 1])
+        if not threshold then
+            log.error("[Stream] wrong watchdog value")
+            astra.abort()
+        end
+        astra.watchdog(threshold)
+        return 1
+    end,
+    ["--trace"] = function(idx)
+        local sample = tonumber(argv[idx + 1])
+        if not sample or sample < 1 then
+            log.error("[Stream] wrong trace value")
+            astra.abort()
+        end
+        udp_input_trace = sample
+        return 1
+    end,
+    ["--cache"] = function(idx)
+        local path = argv[idx + 1]
+        if not path or utils.stat(path).type ~= "directory" then
+            log.error("[Stream] wrong cache directory")
+            astra.abort()
+        end
+        input_cache_dir = path
+        return 1
+    end,
+    ["--agent"] = function(idx)
+        local port = tonumber(argv[idx + 1])
+        if not port then
+            log.error("[Stream] wrong agent port")
+            astra.abort()
+        end
+        -- CPU of the channels
+        astra.profile(true)
+        if astra.reactor ~= 0 then return 1 end
+        agent_server = http_server({
+            addr = "0.0.0.0",
+            port = port,
+            route = { { "/agent/*", agent_on_request } },
+        })
+        return 1
+    end,
+    ["--agent-token"] = function(idx)
+        agent_token = argv[idx + 1]
+        return 1
+    end,
     ["*"] = function(idx)
         local filename = argv[idx]
         if utils.stat(filename).type == "file" then
-            dofile(filename)
+            load_config(filename)
             return 0
         end
         return -1
     end,
 }
 
+-- reactors are started before the other options create servers and threads
+function reactors_fork()
+    for idx = 1, #argv - 1 do
+        if argv[idx] == "--reactors" then
+            local count = tonumber(argv[idx + 1])
+            if not count then
+                log.error("[Stream] wrong reactors value")
+                astra.abort()
+            end
+            astra.fork(count)
+            return
+        end
+    end
+end
+
+reactors_fork()
+
 function main()
     log.info("Starting Astra " .. astra.version)
 end